@@ -17,6 +17,8 @@
 #include "br_common.h"
 #include "namespace.h"
 #include "color.h"
+#include "nl_stats.h"
+#include "cmd_server.h"
 
 struct rtnl_handle rth = { .fd = -1 };
 int preferred_family = AF_UNSPEC;
@@ -27,6 +29,9 @@ int compress_vlans;
 int json;
 int timestamp;
 static const char *batch_file;
+static unsigned int batch_window;
+static unsigned int batch_jobs;
+static const char *batch_key = "dev";
 int force;
 
 static void usage(void) __attribute__((noreturn));
@@ -35,11 +40,15 @@ static void usage(void)
 {
 	fprintf(stderr,
 "Usage: bridge [ OPTIONS ] OBJECT { COMMAND | help }\n"
-"       bridge [ -force ] -batch filename\n"
+"       bridge [ -force ] [ -batch-async WINDOW ] [ -batch-jobs N [ -batch-key KEY ] ]\n"
+"              -batch filename\n"
+"       bridge -server SOCKET\n"
+"       bridge -client SOCKET [ OPTIONS ] OBJECT { COMMAND | help }\n"
 "where  OBJECT := { link | fdb | mdb | mst | vlan | vni | monitor }\n"
 "       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] |\n"
 "                    -o[neline] | -t[imestamp] | -n[etns] name |\n"
-"                    -com[pressvlans] -c[olor] -p[retty] -j[son] }\n");
+"                    -com[pressvlans] -c[olor] -p[retty] -j[son] | -jsonl | -cbor |\n"
+"                    -stats-nl | -dump-pipeline }\n");
 	exit(-1);
 }
 
@@ -83,6 +92,18 @@ static int br_batch_cmd(int argc, char *argv[], void *data)
 	return do_cmd(argv[0], argc, argv);
 }
 
+/* every batch worker talks to the kernel over its own socket */
+static int br_batch_init(void *data)
+{
+	rtnl_close(&rth);
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	rtnl_set_strict_dump(&rth);
+	return 0;
+}
+
 static int batch(const char *name)
 {
 	int ret;
@@ -94,7 +115,14 @@ static int batch(const char *name)
 
 	rtnl_set_strict_dump(&rth);
 
-	ret = do_batch(name, force, br_batch_cmd, NULL);
+	if (batch_jobs > 1)
+		ret = do_batch_jobs(name, force, batch_jobs, batch_key,
+				    br_batch_init, br_batch_cmd, NULL);
+	else if (batch_window)
+		ret = do_batch_async(name, force, &rth, batch_window,
+				     br_batch_cmd, NULL);
+	else
+		ret = do_batch(name, force, br_batch_cmd, NULL);
 
 	rtnl_close(&rth);
 	return ret;
@@ -105,6 +133,13 @@ main(int argc, char **argv)
 {
 	int color = default_color_opt();
 
+	if (argc > 2 && strcmp(argv[1], "-client") == 0)
+		return cmd_client_run(argv[2], argv[0], argc - 3, argv + 3);
+	/* returns in the children forked for the commands only */
+	if (argc > 2 && strcmp(argv[1], "-server") == 0 &&
+	    cmd_server_run(argv[2], &argc, &argv))
+		return EXIT_FAILURE;
+
 	while (argc > 1) {
 		const char *opt = argv[1];
 
@@ -122,6 +157,10 @@ main(int argc, char **argv)
 		} else if (matches(opt, "-Version") == 0) {
 			printf("bridge utility, %s\n", version);
 			exit(0);
+		} else if (strcmp(opt, "-stats-nl") == 0) {
+			nl_stats_enable(false);
+		} else if (strcmp(opt, "-dump-pipeline") == 0) {
+			rtnl_dump_set_pipeline(RTNL_PIPELINE_DEPTH);
 		} else if (matches(opt, "-stats") == 0 ||
 			   matches(opt, "-statistics") == 0) {
 			++show_stats;
@@ -157,6 +196,12 @@ main(int argc, char **argv)
 			++compress_vlans;
 		} else if (matches(opt, "-force") == 0) {
 			++force;
+		} else if (strcmp(opt, "-jsonl") == 0) {
+			++json;
+			++json_lines;
+		} else if (strcmp(opt, "-cbor") == 0) {
+			++json;
+			++json_cbor;
 		} else if (matches(opt, "-json") == 0) {
 			++json;
 		} else if (matches(opt, "-pretty") == 0) {
@@ -167,6 +212,26 @@ main(int argc, char **argv)
 			if (argc <= 1)
 				usage();
 			batch_file = argv[1];
+		} else if (matches(opt, "-batch-async") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1 ||
+			    get_unsigned(&batch_window, argv[1], 0) ||
+			    !batch_window)
+				usage();
+		} else if (matches(opt, "-batch-jobs") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1 ||
+			    get_unsigned(&batch_jobs, argv[1], 0) ||
+			    !batch_jobs)
+				usage();
+		} else if (matches(opt, "-batch-key") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				usage();
+			batch_key = argv[1];
 		} else {
 			fprintf(stderr,
 				"Option \"%s\" is unknown, try \"bridge help\".\n",
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <netdb.h>
 #include <time.h>
 #include <fcntl.h>
@@ -26,12 +27,27 @@
 
 #include "json_print.h"
 #include "libnetlink.h"
+#include "rtnl_bulk.h"
 #include "br_common.h"
 #include "rt_names.h"
 #include "utils.h"
+#include "list.h"
 
 static unsigned int filter_index, filter_dynamic, filter_master,
-	filter_state, filter_vlan;
+	filter_state, filter_vlan, filter_nhid, filter_count;
+
+/* "show ... count": entries per port and VLAN, instead of the entries */
+#define FDB_COUNT_HASH	1024
+
+struct fdb_count {
+	struct hlist_node	hash;
+	int			ifindex;
+	__u16			vid;
+	unsigned int		count;
+};
+
+static struct hlist_head fdb_count_hash[FDB_COUNT_HASH];
+static unsigned int fdb_count_n;
 
 static void usage(void)
 {
@@ -42,8 +58,10 @@ static void usage(void)
 		"              { [ dst IPADDR ] [ port PORT] [ vni VNI ] | [ nhid NHID ] }\n"
 		"	       [ via DEV ] [ src_vni VNI ] [ activity_notify ]\n"
 		"	       [ inactive ] [ norefresh ]\n"
+		"       bridge fdb { add | append | del | replace } file FILE dev DEV\n"
+		"              [ OPTIONS ]\n"
 		"       bridge fdb [ show [ br BRDEV ] [ brport DEV ] [ vlan VID ]\n"
-		"              [ state STATE ] [ dynamic ] ]\n"
+		"              [ state STATE ] [ dynamic ] [ nhid NHID ] [ count ] ]\n"
 		"       bridge fdb get [ to ] LLADDR [ br BRDEV ] { brport | dev } DEV\n"
 		"              [ vlan VID ] [ vni VNI ] [ self ] [ master ] [ dynamic ]\n"
 		"       bridge fdb flush dev DEV [ brport DEV ] [ vlan VID ] [ src_vni VNI ]\n"
@@ -161,6 +179,77 @@ static void fdb_print_ext_attrs(struct rtattr *nfea)
 	}
 }
 
+static int fdb_count_add(int ifindex, __u16 vid)
+{
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	struct fdb_count *c;
+
+	head = &fdb_count_hash[(ifindex * 4099 + vid) & (FDB_COUNT_HASH - 1)];
+	hlist_for_each(pos, head) {
+		c = container_of(pos, struct fdb_count, hash);
+		if (c->ifindex == ifindex && c->vid == vid) {
+			c->count++;
+			return 0;
+		}
+	}
+
+	c = malloc(sizeof(*c));
+	if (!c)
+		return -1;
+	c->ifindex = ifindex;
+	c->vid = vid;
+	c->count = 1;
+	hlist_add_head(&c->hash, head);
+	fdb_count_n++;
+	return 0;
+}
+
+static int fdb_count_cmp(const void *a, const void *b)
+{
+	const struct fdb_count *x = *(const struct fdb_count **)a;
+	const struct fdb_count *y = *(const struct fdb_count **)b;
+
+	if (x->ifindex != y->ifindex)
+		return x->ifindex < y->ifindex ? -1 : 1;
+	return x->vid - y->vid;
+}
+
+static void fdb_count_print(void)
+{
+	struct fdb_count **v, *c;
+	struct hlist_node *pos, *tmp;
+	unsigned int i, n = 0;
+
+	v = calloc(fdb_count_n ? : 1, sizeof(*v));
+	if (!v) {
+		perror("calloc");
+		return;
+	}
+	for (i = 0; i < FDB_COUNT_HASH; i++) {
+		hlist_for_each_safe(pos, tmp, &fdb_count_hash[i]) {
+			v[n++] = container_of(pos, struct fdb_count, hash);
+			hlist_del(pos);
+		}
+	}
+	qsort(v, n, sizeof(*v), fdb_count_cmp);
+
+	for (i = 0; i < n; i++) {
+		c = v[i];
+		open_json_object(NULL);
+		print_string(PRINT_FP, NULL, "dev ", NULL);
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname", "%s ",
+				   ll_index_to_name(c->ifindex));
+		if (c->vid)
+			print_uint(PRINT_ANY, "vlan", "vlan %u ", c->vid);
+		print_uint(PRINT_ANY, "count", "count %u\n", c->count);
+		close_json_object();
+		free(c);
+	}
+	free(v);
+	fdb_count_n = 0;
+}
+
 int print_fdb(struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = arg;
@@ -207,6 +296,13 @@ int print_fdb(struct nlmsghdr *n, void *arg)
 	if (filter_dynamic && (r->ndm_state & NUD_PERMANENT))
 		return 0;
 
+	if (filter_nhid && (!tb[NDA_NH_ID] ||
+			    rta_getattr_u32(tb[NDA_NH_ID]) != filter_nhid))
+		return 0;
+
+	if (filter_count)
+		return fdb_count_add(r->ndm_ifindex, vid);
+
 	print_headers(fp, "[NEIGH]");
 
 	open_json_object(NULL);
@@ -332,6 +428,10 @@ static int fdb_linkdump_filter(struct nlmsghdr *nlh, int reqlen)
 	return 0;
 }
 
+/* A strict fdb dump request may only select the port and the bridge,
+ * the kernel rejects any other attribute or ndmsg field, so vlan, state
+ * and nhid are matched by print_fdb().
+ */
 static int fdb_dump_filter(struct nlmsghdr *nlh, int reqlen)
 {
 	int err;
@@ -378,6 +478,14 @@ static int fdb_show(int argc, char **argv)
 			filter_state |= state;
 		} else if (strcmp(*argv, "dynamic") == 0) {
 			filter_dynamic = 1;
+		} else if (strcmp(*argv, "nhid") == 0) {
+			NEXT_ARG();
+			if (filter_nhid)
+				duparg("nhid", *argv);
+			if (get_u32(&filter_nhid, *argv, 0) || !filter_nhid)
+				invarg("invalid nhid", *argv);
+		} else if (strcmp(*argv, "count") == 0) {
+			filter_count = 1;
 		} else {
 			if (matches(*argv, "help") == 0)
 				usage();
@@ -416,6 +524,8 @@ static int fdb_show(int argc, char **argv)
 		fprintf(stderr, "Dump terminated\n");
 		exit(1);
 	}
+	if (filter_count)
+		fdb_count_print();
 	delete_json_obj();
 	fflush(stdout);
 
@@ -450,6 +560,93 @@ static void fdb_add_ext_attrs(struct nlmsghdr *n, int maxlen,
 	addattr_nest_end(n, nest);
 }
 
+/* "file FILE" takes the place of ADDR and adds one entry per line of FILE:
+ *
+ *	LLADDR [ VID [ IPADDR [ VNI ] ] ]
+ *
+ * A "-" field takes the vlan, dst or vni given on the command line, if
+ * any. See rtnl_bulk.h for the rest of the file format.
+ */
+#define FDB_BULK_WINDOW	1024
+
+struct fdb_bulk {
+	short		vid;
+	int		dst_ok;
+	inet_prefix	dst;
+	unsigned long	vni;
+	__u32		nhid;
+};
+
+static bool fdb_bulk_field(char **tok, int ntok, int i)
+{
+	return i < ntok && strcmp(tok[i], "-") != 0;
+}
+
+/* Add the attributes of one line to the request in n. */
+static const char *fdb_bulk_entry(struct rtnl_bulk *b,
+				  struct nlmsghdr *n, int maxlen,
+				  char **tok, int ntok)
+{
+	const struct fdb_bulk *fb = b->arg;
+	unsigned long vni = fb->vni;
+	int dst_ok = fb->dst_ok;
+	inet_prefix dst = fb->dst;
+	int vid = fb->vid;
+	char abuf[ETH_ALEN];
+	char *endptr;
+	__u16 v;
+
+	if (sscanf(tok[0], "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+		   abuf, abuf+1, abuf+2,
+		   abuf+3, abuf+4, abuf+5) != 6)
+		return "invalid mac address";
+
+	if (fdb_bulk_field(tok, ntok, 1)) {
+		if (get_u16(&v, tok[1], 0) || v >= 4096)
+			return "invalid VID";
+		vid = v;
+	}
+	if (fdb_bulk_field(tok, ntok, 2)) {
+		if (get_addr_1(&dst, tok[2], preferred_family))
+			return "invalid dst";
+		dst_ok = 1;
+	}
+	if (fdb_bulk_field(tok, ntok, 3)) {
+		vni = strtoul(tok[3], &endptr, 0);
+		if ((endptr && *endptr) || (vni >> 24) || vni == ULONG_MAX)
+			return "invalid VNI";
+	}
+	if (fb->nhid && (dst_ok || vni != ~0))
+		return "dst, vni are mutually exclusive with nhid";
+
+	addattr_l(n, maxlen, NDA_LLADDR, abuf, ETH_ALEN);
+	if (dst_ok)
+		addattr_l(n, maxlen, NDA_DST, &dst.data, dst.bytelen);
+	if (vid >= 0)
+		addattr16(n, maxlen, NDA_VLAN, vid);
+	if (vni != ~0)
+		addattr32(n, maxlen, NDA_VNI, vni);
+	return NULL;
+}
+
+static int fdb_bulk(const char *file, struct fdb_bulk *fb,
+		    const struct nlmsghdr *proto, int maxlen)
+{
+	struct rtnl_bulk b = {
+		.file = file,
+		.window = FDB_BULK_WINDOW,
+		.max_fields = 4,
+		.parse = fdb_bulk_entry,
+		.arg = fb,
+	};
+	int ret;
+
+	ret = rtnl_bulk_load(&b, proto, maxlen);
+	if (show_stats)
+		printf("%u entries, %.0f entries/s\n", b.entries, b.rate);
+	return ret;
+}
+
 static int fdb_modify(int cmd, int flags, int argc, char **argv)
 {
 	struct {
@@ -467,6 +664,7 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 	bool norefresh = false;
 	bool inactive = false;
 	char *addr = NULL;
+	char *file = NULL;
 	char *d = NULL;
 	char abuf[ETH_ALEN];
 	int dst_ok = 0;
@@ -555,6 +753,9 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 			inactive = true;
 		} else if (strcmp(*argv, "norefresh") == 0) {
 			norefresh = true;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			file = *argv;
 		} else {
 			if (strcmp(*argv, "to") == 0)
 				NEXT_ARG();
@@ -568,11 +769,16 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 		argc--; argv++;
 	}
 
-	if (d == NULL || addr == NULL) {
+	if (d == NULL || (addr == NULL && file == NULL)) {
 		fprintf(stderr, "Device and address are required arguments.\n");
 		return -1;
 	}
 
+	if (addr && file) {
+		fprintf(stderr, "Either address or file, not both\n");
+		return -1;
+	}
+
 	if (nhid && (dst_ok || port || vni != ~0)) {
 		fprintf(stderr, "dst, port, vni are mutually exclusive with nhid\n");
 		return -1;
@@ -586,19 +792,22 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 	if (!(req.ndm.ndm_state&(NUD_PERMANENT|NUD_REACHABLE)))
 		req.ndm.ndm_state |= NUD_PERMANENT;
 
-	if (sscanf(addr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
-		   abuf, abuf+1, abuf+2,
-		   abuf+3, abuf+4, abuf+5) != 6) {
-		fprintf(stderr, "Invalid mac address %s\n", addr);
-		return -1;
-	}
+	if (!file) {
+		if (sscanf(addr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+			   abuf, abuf+1, abuf+2,
+			   abuf+3, abuf+4, abuf+5) != 6) {
+			fprintf(stderr, "Invalid mac address %s\n", addr);
+			return -1;
+		}
 
-	addattr_l(&req.n, sizeof(req), NDA_LLADDR, abuf, ETH_ALEN);
-	if (dst_ok)
-		addattr_l(&req.n, sizeof(req), NDA_DST, &dst.data, dst.bytelen);
+		addattr_l(&req.n, sizeof(req), NDA_LLADDR, abuf, ETH_ALEN);
+		if (dst_ok)
+			addattr_l(&req.n, sizeof(req), NDA_DST, &dst.data,
+				  dst.bytelen);
 
-	if (vid >= 0)
-		addattr16(&req.n, sizeof(req), NDA_VLAN, vid);
+		if (vid >= 0)
+			addattr16(&req.n, sizeof(req), NDA_VLAN, vid);
+	}
 	if (nhid > 0)
 		addattr32(&req.n, sizeof(req), NDA_NH_ID, nhid);
 
@@ -608,7 +817,7 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 		dport = htons((unsigned short)port);
 		addattr16(&req.n, sizeof(req), NDA_PORT, dport);
 	}
-	if (vni != ~0)
+	if (vni != ~0 && !file)
 		addattr32(&req.n, sizeof(req), NDA_VNI, vni);
 	if (src_vni != ~0)
 		addattr32(&req.n, sizeof(req), NDA_SRC_VNI, src_vni);
@@ -622,6 +831,18 @@ static int fdb_modify(int cmd, int flags, int argc, char **argv)
 	fdb_add_ext_attrs(&req.n, sizeof(req), activity_notify, inactive,
 			  norefresh);
 
+	if (file) {
+		struct fdb_bulk fb = {
+			.vid = vid,
+			.dst_ok = dst_ok,
+			.dst = dst,
+			.vni = vni,
+			.nhid = nhid,
+		};
+
+		return fdb_bulk(file, &fb, &req.n, sizeof(req));
+	}
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		return -1;
 
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <net/if.h>
@@ -22,11 +23,8 @@
 #include "br_common.h"
 #include "rt_names.h"
 #include "json_print.h"
+#include "rtnl_bulk.h"
 
-#ifndef MDBA_RTA
-#define MDBA_RTA(r) \
-	((struct rtattr *)(((char *)(r)) + NLMSG_ALIGN(sizeof(struct br_port_msg))))
-#endif
 
 static unsigned int filter_index, filter_vlan;
 
@@ -36,6 +34,7 @@ static void usage(void)
 		"Usage: bridge mdb { add | del | replace } dev DEV port PORT grp GROUP [src SOURCE] [permanent | temp] [vid VID]\n"
 		"              [ filter_mode { include | exclude } ] [ source_list SOURCE_LIST ] [ proto PROTO ] [ dst IPADDR ]\n"
 		"              [ dst_port DST_PORT ] [ vni VNI ] [ src_vni SRC_VNI ] [ via DEV ]\n"
+		"       bridge mdb { add | del | replace } dev DEV file FILE [ OPTIONS ]\n"
 		"       bridge mdb {show} [ dev DEV ] [ vid VID ]\n"
 		"       bridge mdb get dev DEV grp GROUP [ src SOURCE ] [ vid VID ] [ src_vni SRC_VNI ]\n"
 		"       bridge mdb flush dev DEV [ port PORT ] [ vid VID ] [ src_vni SRC_VNI ] [ proto PROTO ]\n"
@@ -559,27 +558,53 @@ static int mdb_parse_mode(struct nlmsghdr *n, int maxlen, const char *mode)
 	return -1;
 }
 
-static int mdb_parse_src_entry(struct nlmsghdr *n, int maxlen, char *src_entry)
+static int mdb_add_src_entry(struct nlmsghdr *n, int maxlen,
+			     const void *addr, int len)
 {
-	struct in6_addr src_ip6;
 	struct rtattr *nest;
-	__be32 src_ip4;
 
 	nest = addattr_nest(n, maxlen, MDBE_SRC_LIST_ENTRY | NLA_F_NESTED);
-
-	if (inet_pton(AF_INET, src_entry, &src_ip4))
-		addattr32(n, maxlen, MDBE_SRCATTR_ADDRESS, src_ip4);
-	else if (inet_pton(AF_INET6, src_entry, &src_ip6))
-		addattr_l(n, maxlen, MDBE_SRCATTR_ADDRESS, &src_ip6,
-			  sizeof(src_ip6));
-	else
+	if (!nest || addattr_l(n, maxlen, MDBE_SRCATTR_ADDRESS, addr, len))
 		return -1;
-
 	addattr_nest_end(n, nest);
 
 	return 0;
 }
 
+/* An address, or a range of IPv4 addresses "FIRST-LAST". */
+static int mdb_parse_src_entry(struct nlmsghdr *n, int maxlen, char *src_entry)
+{
+	struct in6_addr src_ip6;
+	__be32 src_ip4, last_ip4;
+	__u32 ip;
+	char *sep;
+
+	sep = strchr(src_entry, '-');
+	if (sep) {
+		*sep = '\0';
+		if (!inet_pton(AF_INET, src_entry, &src_ip4) ||
+		    !inet_pton(AF_INET, sep + 1, &last_ip4))
+			return -1;
+		if (ntohl(src_ip4) > ntohl(last_ip4))
+			return -1;
+		for (ip = ntohl(src_ip4); ; ip++) {
+			src_ip4 = htonl(ip);
+			if (mdb_add_src_entry(n, maxlen, &src_ip4,
+					      sizeof(src_ip4)))
+				return -1;
+			if (src_ip4 == last_ip4)
+				return 0;
+		}
+	}
+
+	if (inet_pton(AF_INET, src_entry, &src_ip4))
+		return mdb_add_src_entry(n, maxlen, &src_ip4, sizeof(src_ip4));
+	if (inet_pton(AF_INET6, src_entry, &src_ip6))
+		return mdb_add_src_entry(n, maxlen, &src_ip6, sizeof(src_ip6));
+
+	return -1;
+}
+
 static int mdb_parse_src_list(struct nlmsghdr *n, int maxlen, char *src_list)
 {
 	struct rtattr *nest;
@@ -690,6 +715,155 @@ static int mdb_parse_dev(struct nlmsghdr *n, int maxlen, const char *dev)
 	return 0;
 }
 
+/* The entry attributes that do not depend on the group. */
+static int mdb_parse_attrs(struct nlmsghdr *n, int maxlen, const char *proto,
+			   const char *dst, const char *dst_port,
+			   const char *vni, const char *src_vni,
+			   const char *via)
+{
+	if (proto && mdb_parse_proto(n, maxlen, proto)) {
+		fprintf(stderr, "Invalid protocol value \"%s\"\n", proto);
+		return -1;
+	}
+
+	if (dst && mdb_parse_dst(n, maxlen, dst)) {
+		fprintf(stderr, "Invalid underlay destination address \"%s\"\n",
+			dst);
+		return -1;
+	}
+
+	if (dst_port && mdb_parse_dst_port(n, maxlen, dst_port)) {
+		fprintf(stderr, "Invalid destination port \"%s\"\n", dst_port);
+		return -1;
+	}
+
+	if (vni && mdb_parse_vni(n, maxlen, vni, MDBE_ATTR_VNI)) {
+		fprintf(stderr, "Invalid destination VNI \"%s\"\n", vni);
+		return -1;
+	}
+
+	if (src_vni && mdb_parse_vni(n, maxlen, src_vni, MDBE_ATTR_SRC_VNI)) {
+		fprintf(stderr, "Invalid source VNI \"%s\"\n", src_vni);
+		return -1;
+	}
+
+	if (via && mdb_parse_dev(n, maxlen, via))
+		return nodev(via);
+
+	return 0;
+}
+
+/* "file FILE" takes the place of grp and port and adds one entry per line
+ * of FILE:
+ *
+ *	GROUP [ SOURCE [ PORT [ VID [ SOURCE_LIST [ FILTER_MODE ] ] ] ] ]
+ *
+ * A "-" field takes the value given on the command line, if any. Other
+ * entry attributes are parsed once and copied into each request.
+ */
+#define MDB_BULK_WINDOW		1024
+#define MDB_BULK_FIELDS		6
+#define MDB_BULK_REQ_SIZE	(NLMSG_SPACE(sizeof(struct br_port_msg)) + 32768)
+
+struct mdb_bulk {
+	struct rtnl_bulk	bulk;
+	/* command line defaults */
+	char			*fields[MDB_BULK_FIELDS];
+	__u8			state;
+	/* MDBA_SET_ENTRY_ATTRS common to all entries */
+	const void		*attrs;
+	int			attrs_len;
+	/* the last port looked up */
+	char			port[IFNAMSIZ];
+	int			port_ifindex;
+};
+
+static int mdb_bulk_port(struct mdb_bulk *b, const char *port)
+{
+	if (strcmp(port, b->port) != 0) {
+		b->port_ifindex = ll_name_to_index(port);
+		strlcpy(b->port, port, sizeof(b->port));
+	}
+	return b->port_ifindex;
+}
+
+/* Build the request for one line on top of the header in req. */
+static const char *mdb_bulk_entry(struct mdb_bulk *b, struct nlmsghdr *n,
+				  int maxlen, char **tok)
+{
+	const char *grp = tok[0], *src = tok[1], *port = tok[2];
+	const char *vid = tok[3], *mode = tok[5];
+	struct br_mdb_entry entry = {};
+	char *src_list = tok[4];
+	struct rtattr *nest;
+	__u16 v = 0;
+	int ret = 0;
+
+	if (!port)
+		return "port is missing";
+	entry.ifindex = mdb_bulk_port(b, port);
+	if (!entry.ifindex)
+		return "cannot find port";
+	if (mdb_parse_grp(grp, &entry))
+		return "invalid group";
+	if (vid && (get_u16(&v, vid, 0) || v >= 4096))
+		return "invalid VID";
+	entry.vid = v;
+	entry.state = b->state;
+	addattr_l(n, maxlen, MDBA_SET_ENTRY, &entry, sizeof(entry));
+
+	if (!src && !src_list && !mode && !b->attrs_len)
+		return NULL;
+
+	nest = addattr_nest(n, maxlen, MDBA_SET_ENTRY_ATTRS | NLA_F_NESTED);
+	if (src && mdb_parse_src(n, maxlen, src))
+		return "invalid source";
+	if (mode && mdb_parse_mode(n, maxlen, mode))
+		return "invalid filter mode";
+	if (src_list) {
+		/* parsing splits the list, keep the command line one */
+		if (src_list == b->fields[4])
+			src_list = strdup(src_list);
+		if (!src_list)
+			return "out of memory";
+		ret = mdb_parse_src_list(n, maxlen, src_list);
+		if (src_list != tok[4])
+			free(src_list);
+		if (ret)
+			return "invalid source list";
+	}
+	if (b->attrs_len && addraw_l(n, maxlen, b->attrs, b->attrs_len))
+		return "entry too large";
+	addattr_nest_end(n, nest);
+	return NULL;
+}
+
+static const char *mdb_bulk_line(struct rtnl_bulk *rb, struct nlmsghdr *n,
+				 int maxlen, char **tok, int ntok)
+{
+	struct mdb_bulk *b = (struct mdb_bulk *)rb;
+	int i;
+
+	for (i = 0; i < MDB_BULK_FIELDS; i++)
+		if (i >= ntok || strcmp(tok[i], "-") == 0)
+			tok[i] = b->fields[i];
+	if (!tok[0])
+		return "group is missing";
+
+	return mdb_bulk_entry(b, n, maxlen, tok);
+}
+
+static int mdb_bulk(struct mdb_bulk *b, const struct nlmsghdr *proto)
+{
+	int ret;
+
+	ret = rtnl_bulk_load(&b->bulk, proto, MDB_BULK_REQ_SIZE);
+	if (show_stats)
+		printf("%u entries, %.0f entries/s\n", b->bulk.entries,
+		       b->bulk.rate);
+	return ret;
+}
+
 static int mdb_modify(int cmd, int flags, int argc, char **argv)
 {
 	struct {
@@ -705,6 +879,7 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 	char *d = NULL, *p = NULL, *grp = NULL, *src = NULL, *mode = NULL;
 	char *dst_port = NULL, *vni = NULL, *src_vni = NULL, *via = NULL;
 	char *src_list = NULL, *proto = NULL, *dst = NULL;
+	char *file = NULL, *vid_arg = NULL;
 	struct br_mdb_entry entry = {};
 	bool set_attrs = false;
 	short vid = 0;
@@ -726,7 +901,11 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 			;/* nothing */
 		} else if (strcmp(*argv, "vid") == 0) {
 			NEXT_ARG();
+			vid_arg = *argv;
 			vid = atoi(*argv);
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			file = *argv;
 		} else if (strcmp(*argv, "src") == 0) {
 			NEXT_ARG();
 			src = *argv;
@@ -770,7 +949,7 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 		argc--; argv++;
 	}
 
-	if (d == NULL || grp == NULL || p == NULL) {
+	if (d == NULL || (file == NULL && (grp == NULL || p == NULL))) {
 		fprintf(stderr, "Device, group address and port name are required arguments.\n");
 		return -1;
 	}
@@ -779,6 +958,31 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 	if (!req.bpm.ifindex)
 		return nodev(d);
 
+	if (file) {
+		struct {
+			struct nlmsghdr	n;
+			char		buf[256];
+		} attrs = {
+			.n.nlmsg_len = NLMSG_LENGTH(0),
+		};
+		struct mdb_bulk b = {
+			.bulk.file = file,
+			.bulk.window = MDB_BULK_WINDOW,
+			.bulk.max_fields = MDB_BULK_FIELDS,
+			.bulk.parse = mdb_bulk_line,
+			.fields = { grp, src, p, vid_arg, src_list, mode },
+			.state = entry.state,
+		};
+
+		if (mdb_parse_attrs(&attrs.n, sizeof(attrs), proto, dst,
+				    dst_port, vni, src_vni, via))
+			return -1;
+		b.attrs = NLMSG_DATA(&attrs.n);
+		b.attrs_len = attrs.n.nlmsg_len - NLMSG_LENGTH(0);
+
+		return mdb_bulk(&b, &req.n);
+	}
+
 	entry.ifindex = ll_name_to_index(p);
 	if (!entry.ifindex)
 		return nodev(p);
@@ -810,39 +1014,9 @@ static int mdb_modify(int cmd, int flags, int argc, char **argv)
 						   src_list))
 			return -1;
 
-		if (proto && mdb_parse_proto(&req.n, sizeof(req), proto)) {
-			fprintf(stderr, "Invalid protocol value \"%s\"\n",
-				proto);
-			return -1;
-		}
-
-		if (dst && mdb_parse_dst(&req.n, sizeof(req), dst)) {
-			fprintf(stderr, "Invalid underlay destination address \"%s\"\n",
-				dst);
-			return -1;
-		}
-
-		if (dst_port && mdb_parse_dst_port(&req.n, sizeof(req),
-						   dst_port)) {
-			fprintf(stderr, "Invalid destination port \"%s\"\n", dst_port);
-			return -1;
-		}
-
-		if (vni && mdb_parse_vni(&req.n, sizeof(req), vni,
-					 MDBE_ATTR_VNI)) {
-			fprintf(stderr, "Invalid destination VNI \"%s\"\n",
-				vni);
+		if (mdb_parse_attrs(&req.n, sizeof(req), proto, dst, dst_port,
+				    vni, src_vni, via))
 			return -1;
-		}
-
-		if (src_vni && mdb_parse_vni(&req.n, sizeof(req), src_vni,
-					     MDBE_ATTR_SRC_VNI)) {
-			fprintf(stderr, "Invalid source VNI \"%s\"\n", src_vni);
-			return -1;
-		}
-
-		if (via && mdb_parse_dev(&req.n, sizeof(req), via))
-			return nodev(via);
 
 		addattr_nest_end(&req.n, nest);
 	}
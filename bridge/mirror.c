@@ -0,0 +1,593 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * mirror.c		"bridge monitor mirror"
+ *
+ * Keep a copy of the fdb and mdb tables in memory: subscribe to the
+ * neigh, mdb and link groups first, then dump, and apply every event
+ * to a hash of entries. Events queued while dumping are applied after
+ * the dump, so the copy converges on the kernel tables. If the socket
+ * overruns (ENOBUFS) events were lost and the tables are dumped again.
+ * The copy is printed on SIGUSR1, every "interval" seconds, or both,
+ * to standard output or atomically replacing a file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/if_bridge.h>
+#include <linux/if_ether.h>
+#include <linux/neighbour.h>
+#include <string.h>
+
+#include "json_print.h"
+#include "libnetlink.h"
+#include "br_common.h"
+#include "utils.h"
+#include "list.h"
+
+#define MIRROR_KEY_MAX		64
+#define MIRROR_MIN_HASH		4096
+
+struct mirror_entry {
+	struct hlist_node	hash;
+	__u32			hval;
+	int			ifindex[2];	/* device or bridge, port */
+	struct nlmsghdr		*n;
+	unsigned int		keylen;
+	unsigned char		key[MIRROR_KEY_MAX];
+};
+
+struct mirror_key {
+	unsigned int		len;
+	unsigned char		buf[MIRROR_KEY_MAX];
+};
+
+static struct hlist_head *mirror_hash;
+static unsigned int mirror_hash_size;
+static unsigned int mirror_entries, mirror_fdbs, mirror_mdbs;
+static unsigned int mirror_resyncs;
+static volatile sig_atomic_t mirror_want_snapshot;
+
+static void usage(void) __attribute__((noreturn));
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: bridge monitor mirror [ fdb ] [ mdb ] [ interval SECS ]\n"
+		"                             [ snapshot FILE ]\n");
+	exit(-1);
+}
+
+static void mirror_key_add(struct mirror_key *k, int type,
+			   const void *data, unsigned int len)
+{
+	if (k->len + 2 + len > sizeof(k->buf))
+		len = sizeof(k->buf) - k->len - 2;
+	k->buf[k->len++] = type;
+	k->buf[k->len++] = len;
+	memcpy(k->buf + k->len, data, len);
+	k->len += len;
+}
+
+static __u32 mirror_key_hash(const struct mirror_key *k)
+{
+	__u32 h = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < k->len; i++)
+		h = (h ^ k->buf[i]) * 16777619U;
+	return h;
+}
+
+static struct mirror_entry *mirror_lookup(const struct mirror_key *k,
+					  __u32 hval)
+{
+	struct hlist_node *pos;
+	struct mirror_entry *e;
+
+	hlist_for_each(pos, &mirror_hash[hval & (mirror_hash_size - 1)]) {
+		e = container_of(pos, struct mirror_entry, hash);
+		if (e->hval == hval && e->keylen == k->len &&
+		    memcmp(e->key, k->buf, k->len) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+static int mirror_resize(unsigned int size)
+{
+	struct hlist_head *h;
+	struct hlist_node *pos, *tmp;
+	struct mirror_entry *e;
+	unsigned int i;
+
+	h = calloc(size, sizeof(*h));
+	if (!h)
+		return -1;
+	for (i = 0; i < mirror_hash_size; i++) {
+		hlist_for_each_safe(pos, tmp, &mirror_hash[i]) {
+			e = container_of(pos, struct mirror_entry, hash);
+			hlist_del(pos);
+			hlist_add_head(&e->hash, &h[e->hval & (size - 1)]);
+		}
+	}
+	free(mirror_hash);
+	mirror_hash = h;
+	mirror_hash_size = size;
+	return 0;
+}
+
+static void mirror_count(const struct mirror_entry *e, int delta)
+{
+	mirror_entries += delta;
+	if (e->n->nlmsg_type == RTM_NEWNEIGH)
+		mirror_fdbs += delta;
+	else
+		mirror_mdbs += delta;
+}
+
+static void mirror_del(struct mirror_entry *e)
+{
+	mirror_count(e, -1);
+	hlist_del(&e->hash);
+	free(e->n);
+	free(e);
+}
+
+/* Insert or replace the entry for k, taking ownership of n. */
+static int mirror_set(const struct mirror_key *k, struct nlmsghdr *n,
+		      int dev, int port)
+{
+	__u32 hval = mirror_key_hash(k);
+	struct mirror_entry *e;
+
+	e = mirror_lookup(k, hval);
+	if (e) {
+		free(e->n);
+		e->n = n;
+		return 0;
+	}
+
+	if (mirror_entries >= 2 * mirror_hash_size &&
+	    mirror_resize(2 * mirror_hash_size) < 0)
+		goto err;
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		goto err;
+	e->hval = hval;
+	e->ifindex[0] = dev;
+	e->ifindex[1] = port;
+	e->n = n;
+	e->keylen = k->len;
+	memcpy(e->key, k->buf, k->len);
+	hlist_add_head(&e->hash, &mirror_hash[hval & (mirror_hash_size - 1)]);
+	mirror_count(e, 1);
+	return 0;
+err:
+	free(n);
+	perror("Cannot allocate mirror entry");
+	return -1;
+}
+
+static void mirror_unset(const struct mirror_key *k)
+{
+	struct mirror_entry *e;
+
+	e = mirror_lookup(k, mirror_key_hash(k));
+	if (e)
+		mirror_del(e);
+}
+
+static void mirror_flush(int ifindex)
+{
+	struct hlist_node *pos, *tmp;
+	struct mirror_entry *e;
+	unsigned int i;
+
+	for (i = 0; i < mirror_hash_size; i++) {
+		hlist_for_each_safe(pos, tmp, &mirror_hash[i]) {
+			e = container_of(pos, struct mirror_entry, hash);
+			if (!ifindex || e->ifindex[0] == ifindex ||
+			    e->ifindex[1] == ifindex)
+				mirror_del(e);
+		}
+	}
+}
+
+/* An fdb entry is identified by its device, whether it is the device's
+ * own (self) or its master's, its address, vlan and vxlan source VNI.
+ * Only multicast and all-zeros entries of vxlan can have several
+ * remotes (append), so only there the remote is part of the key; a
+ * unicast entry has one remote, replaced without a delete event.
+ */
+static const int mirror_fdb_keys[] = {
+	NDA_LLADDR, NDA_VLAN, NDA_SRC_VNI,
+};
+
+static const int mirror_fdb_remote_keys[] = {
+	NDA_DST, NDA_PORT, NDA_VNI, NDA_IFINDEX,
+};
+
+static bool mirror_fdb_multi(const struct rtattr *lladdr)
+{
+	static const __u8 zero[ETH_ALEN];
+	const __u8 *mac = RTA_DATA(lladdr);
+
+	return RTA_PAYLOAD(lladdr) == ETH_ALEN &&
+	       ((mac[0] & 1) || memcmp(mac, zero, ETH_ALEN) == 0);
+}
+
+static int mirror_fdb(struct nlmsghdr *n)
+{
+	struct ndmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[NDA_MAX+1];
+	struct mirror_key k = {};
+	struct nlmsghdr *copy;
+	__u8 flags;
+	int i;
+
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*r)) ||
+	    r->ndm_family != AF_BRIDGE)
+		return 0;
+
+	parse_rtattr_flags(tb, NDA_MAX, NDA_RTA(r),
+			   n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+			   NLA_F_NESTED);
+
+	mirror_key_add(&k, 0, &r->ndm_ifindex, sizeof(r->ndm_ifindex));
+	flags = r->ndm_flags & (NTF_SELF | NTF_MASTER);
+	mirror_key_add(&k, 0, &flags, sizeof(flags));
+	for (i = 0; i < ARRAY_SIZE(mirror_fdb_keys); i++) {
+		struct rtattr *a = tb[mirror_fdb_keys[i]];
+
+		if (a)
+			mirror_key_add(&k, mirror_fdb_keys[i], RTA_DATA(a),
+				       RTA_PAYLOAD(a));
+	}
+	for (i = 0; tb[NDA_LLADDR] && mirror_fdb_multi(tb[NDA_LLADDR]) &&
+		    i < ARRAY_SIZE(mirror_fdb_remote_keys); i++) {
+		struct rtattr *a = tb[mirror_fdb_remote_keys[i]];
+
+		if (a)
+			mirror_key_add(&k, mirror_fdb_remote_keys[i],
+				       RTA_DATA(a), RTA_PAYLOAD(a));
+	}
+
+	if (n->nlmsg_type == RTM_DELNEIGH) {
+		mirror_unset(&k);
+		return 0;
+	}
+
+	copy = malloc(n->nlmsg_len);
+	if (!copy)
+		return -1;
+	memcpy(copy, n, n->nlmsg_len);
+	copy->nlmsg_type = RTM_NEWNEIGH;
+	return mirror_set(&k, copy, r->ndm_ifindex, 0);
+}
+
+/* Store one MDBA_MDB_ENTRY_INFO as a message of its own, the way the
+ * kernel notifies a single entry, so that print_mdb_mon() can show it.
+ */
+static int mirror_mdb_entry(const struct nlmsghdr *n,
+			    const struct br_port_msg *r, struct rtattr *info)
+{
+	struct br_mdb_entry *e = RTA_DATA(info);
+	struct rtattr *etb[MDBA_MDB_EATTR_MAX + 1];
+	struct mirror_key k = {};
+	struct rtattr *mdb, *ent;
+	struct nlmsghdr *copy;
+	int maxlen;
+
+	if (RTA_PAYLOAD(info) < sizeof(*e))
+		return 0;
+
+	parse_rtattr_flags(etb, MDBA_MDB_EATTR_MAX, MDB_RTA(e),
+			   RTA_PAYLOAD(info) - RTA_ALIGN(sizeof(*e)),
+			   NLA_F_NESTED);
+
+	mirror_key_add(&k, 0, &r->ifindex, sizeof(r->ifindex));
+	mirror_key_add(&k, 0, &e->ifindex, sizeof(e->ifindex));
+	mirror_key_add(&k, 0, &e->vid, sizeof(e->vid));
+	mirror_key_add(&k, 0, &e->addr.proto, sizeof(e->addr.proto));
+	if (!e->addr.proto)
+		mirror_key_add(&k, 0, e->addr.u.mac_addr, ETH_ALEN);
+	else if (e->addr.proto == htons(ETH_P_IP))
+		mirror_key_add(&k, 0, &e->addr.u.ip4, sizeof(e->addr.u.ip4));
+	else
+		mirror_key_add(&k, 0, &e->addr.u.ip6, sizeof(e->addr.u.ip6));
+	if (etb[MDBA_MDB_EATTR_SOURCE])
+		mirror_key_add(&k, MDBA_MDB_EATTR_SOURCE,
+			       RTA_DATA(etb[MDBA_MDB_EATTR_SOURCE]),
+			       RTA_PAYLOAD(etb[MDBA_MDB_EATTR_SOURCE]));
+
+	if (n->nlmsg_type == RTM_DELMDB) {
+		mirror_unset(&k);
+		return 0;
+	}
+
+	maxlen = NLMSG_LENGTH(sizeof(*r)) + 2 * RTA_LENGTH(0) +
+		 RTA_SPACE(RTA_PAYLOAD(info));
+	copy = malloc(maxlen);
+	if (!copy)
+		return -1;
+	copy->nlmsg_len = NLMSG_LENGTH(sizeof(*r));
+	copy->nlmsg_type = RTM_NEWMDB;
+	copy->nlmsg_flags = 0;
+	memcpy(NLMSG_DATA(copy), r, sizeof(*r));
+	mdb = addattr_nest(copy, maxlen, MDBA_MDB);
+	ent = addattr_nest(copy, maxlen, MDBA_MDB_ENTRY);
+	addattr_l(copy, maxlen, MDBA_MDB_ENTRY_INFO, RTA_DATA(info),
+		  RTA_PAYLOAD(info));
+	addattr_nest_end(copy, ent);
+	addattr_nest_end(copy, mdb);
+	return mirror_set(&k, copy, r->ifindex, e->ifindex);
+}
+
+static int mirror_mdb(struct nlmsghdr *n)
+{
+	struct br_port_msg *r = NLMSG_DATA(n);
+	struct rtattr *tb[MDBA_MAX+1];
+	struct rtattr *i, *j;
+	int rem, rem2;
+
+	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*r)))
+		return 0;
+
+	parse_rtattr(tb, MDBA_MAX, MDBA_RTA(r),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
+	if (!tb[MDBA_MDB])
+		return 0;
+
+	rem = RTA_PAYLOAD(tb[MDBA_MDB]);
+	for (i = RTA_DATA(tb[MDBA_MDB]); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		if (i->rta_type != MDBA_MDB_ENTRY)
+			continue;
+		rem2 = RTA_PAYLOAD(i);
+		for (j = RTA_DATA(i); RTA_OK(j, rem2); j = RTA_NEXT(j, rem2)) {
+			if (j->rta_type == MDBA_MDB_ENTRY_INFO &&
+			    mirror_mdb_entry(n, r, j) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int mirror_msg(struct nlmsghdr *n, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+		return mirror_fdb(n);
+	case RTM_NEWMDB:
+	case RTM_DELMDB:
+		return mirror_mdb(n);
+	case RTM_DELLINK:
+		/* a device that goes away takes its entries along */
+		if (n->nlmsg_len >= NLMSG_LENGTH(sizeof(*ifi)))
+			mirror_flush(ifi->ifi_index);
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static int mirror_sync(bool fdb, bool mdb)
+{
+	mirror_flush(0);
+
+	if (fdb) {
+		if (rtnl_neighdump_req(&rth, PF_BRIDGE, NULL) < 0) {
+			perror("Cannot send dump request");
+			return -1;
+		}
+		if (rtnl_dump_filter(&rth, mirror_msg, NULL) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			return -1;
+		}
+	}
+
+	if (mdb) {
+		if (rtnl_mdbdump_req(&rth, PF_BRIDGE) < 0) {
+			perror("Cannot send dump request");
+			return -1;
+		}
+		if (rtnl_dump_filter(&rth, mirror_msg, NULL) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void mirror_print(void)
+{
+	struct hlist_node *pos;
+	struct mirror_entry *e;
+	unsigned int i;
+
+	new_json_obj(json);
+	for (i = 0; i < mirror_hash_size; i++) {
+		hlist_for_each(pos, &mirror_hash[i]) {
+			e = container_of(pos, struct mirror_entry, hash);
+			if (e->n->nlmsg_type == RTM_NEWNEIGH)
+				print_fdb(e->n, stdout);
+			else
+				print_mdb_mon(e->n, stdout);
+		}
+	}
+	delete_json_obj();
+	if (show_stats)
+		fprintf(stderr, "%u fdb entries, %u mdb entries, %u resyncs\n",
+			mirror_fdbs, mirror_mdbs, mirror_resyncs);
+}
+
+/* Print the tables, to FILE.tmp renamed over FILE if a file is given,
+ * so that readers always see a complete snapshot.
+ */
+static int mirror_snapshot(const char *file)
+{
+	char tmp[PATH_MAX];
+	int fd, saved;
+
+	if (!file) {
+		mirror_print();
+		if (!json)
+			putchar('\n');
+		fflush(stdout);
+		return 0;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open \"%s\": %s\n", tmp,
+			strerror(errno));
+		return -1;
+	}
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	if (saved < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+		perror("dup");
+		close(fd);
+		return -1;
+	}
+	mirror_print();
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	if (close(fd) < 0 || rename(tmp, file) < 0) {
+		fprintf(stderr, "Cannot write \"%s\": %s\n", file,
+			strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+static void mirror_sigusr1(int sig)
+{
+	mirror_want_snapshot = 1;
+}
+
+int do_mirror(int argc, char **argv)
+{
+	struct sigaction sa = { .sa_handler = mirror_sigusr1 };
+	struct rtnl_handle lrth = { .fd = -1 };
+	unsigned int interval = 0;
+	char *file = NULL;
+	bool fdb = false, mdb = false;
+	double next = 0;
+	char buf[32768];
+
+	while (argc > 0) {
+		if (strcmp(*argv, "fdb") == 0) {
+			fdb = true;
+		} else if (strcmp(*argv, "mdb") == 0) {
+			mdb = true;
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("invalid interval", *argv);
+		} else if (strcmp(*argv, "snapshot") == 0) {
+			NEXT_ARG();
+			file = *argv;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			fprintf(stderr, "Argument \"%s\" is unknown, try \"bridge monitor mirror help\".\n",
+				*argv);
+			exit(-1);
+		}
+		argc--;	argv++;
+	}
+	if (!fdb && !mdb)
+		fdb = mdb = true;
+
+	/* Subscribe before dumping, so that no change is missed. */
+	if (rtnl_open(&lrth, nl_mgrp(RTNLGRP_LINK) |
+			     (fdb ? nl_mgrp(RTNLGRP_NEIGH) : 0) |
+			     (mdb ? nl_mgrp(RTNLGRP_MDB) : 0)) < 0)
+		exit(1);
+	if (rtnl_open(&rth, 0) < 0)
+		exit(1);
+	rtnl_set_strict_dump(&rth);
+	ll_init_map(&rth);
+
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+
+	if (mirror_resize(MIRROR_MIN_HASH) < 0 || mirror_sync(fdb, mdb) < 0)
+		exit(1);
+	if (mirror_snapshot(file) < 0)
+		exit(1);
+	if (interval)
+		next = monotonic_now() + interval;
+
+	while (1) {
+		struct pollfd pfd = { .fd = lrth.fd, .events = POLLIN };
+		int timeout = -1;
+		double now;
+		ssize_t len;
+
+		if (interval) {
+			now = monotonic_now();
+			timeout = next > now ? (next - now) * 1000 + 1 : 0;
+		}
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+			perror("poll");
+			exit(2);
+		}
+
+		while (pfd.revents & POLLIN) {
+			struct nlmsghdr *h;
+
+			len = recv(lrth.fd, buf, sizeof(buf), MSG_DONTWAIT);
+			if (len < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				if (errno == EINTR)
+					continue;
+				if (errno != ENOBUFS) {
+					perror("netlink receive error");
+					exit(2);
+				}
+				/* Events were dropped, start over. */
+				mirror_resyncs++;
+				if (mirror_sync(fdb, mdb) < 0)
+					exit(2);
+				continue;
+			}
+			for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+			     h = NLMSG_NEXT(h, len))
+				if (mirror_msg(h, NULL) < 0)
+					exit(2);
+		}
+
+		if (interval && monotonic_now() >= next) {
+			mirror_want_snapshot = 1;
+			next += interval;
+		}
+		if (mirror_want_snapshot) {
+			mirror_want_snapshot = 0;
+			if (mirror_snapshot(file) < 0)
+				exit(2);
+		}
+	}
+
+	return 0;
+}
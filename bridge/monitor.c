@@ -26,7 +26,9 @@ static int prefix_banner;
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: bridge monitor [file | link | fdb | mdb | vlan | vni | all]\n");
+	fprintf(stderr,
+		"Usage: bridge monitor [file | link | fdb | mdb | vlan | vni | all]\n"
+		"       bridge monitor mirror [ fdb ] [ mdb ] [ interval SECS ] [ snapshot FILE ]\n");
 	exit(-1);
 }
 
@@ -86,6 +88,9 @@ int do_monitor(int argc, char **argv)
 
 	rtnl_close(&rth);
 
+	if (argc > 0 && strcmp(*argv, "mirror") == 0)
+		return do_mirror(argc - 1, argv + 1);
+
 	while (argc > 0) {
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
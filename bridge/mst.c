@@ -4,7 +4,11 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/time.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <linux/if_bridge.h>
 #include <net/if.h>
@@ -12,8 +16,10 @@
 #include "libnetlink.h"
 #include "json_print.h"
 #include "utils.h"
+#include "list.h"
 
 #include "br_common.h"
+#include "rtnl_bulk.h"
 
 #define MST_ID_LEN 9
 
@@ -26,7 +32,8 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: bridge mst set dev DEV msti MSTI state STATE\n"
-		"       bridge mst {show} [ dev DEV ]\n");
+		"       bridge mst set [ dev DEV ] file FILE\n"
+		"       bridge mst {show} [ dev DEV ] [ watch [ interval SECS ] ]\n");
 	exit(-1);
 }
 
@@ -117,9 +124,226 @@ static int print_msts(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/* "show watch" prints the table once, then only the (port, msti) states
+ * which changed. The kernel does not announce MST state changes, so the
+ * table is dumped again on every link notification and at least every
+ * interval, and compared with the states kept from the previous dump.
+ */
+#define MST_WATCH_HASH	1024
+
+struct mst_watch_ent {
+	struct hlist_node	hash;
+	int			ifindex;
+	__u16			msti;
+	__u8			state;
+	unsigned int		gen;
+};
+
+static struct hlist_head mst_watch_hash[MST_WATCH_HASH];
+static unsigned int mst_watch_gen;
+/* the first dump prints the table, later ones the changes */
+static bool mst_watch_changes;
+static bool mst_watch_json_open;
+
+static void mst_watch_begin(void)
+{
+	if (!mst_watch_json_open) {
+		new_json_obj(json);
+		mst_watch_json_open = true;
+	}
+	open_json_object(NULL);
+	if (timestamp)
+		print_timestamp(stdout);
+}
+
+static void mst_watch_end(void)
+{
+	print_nl();
+	close_json_object();
+}
+
+static void print_mst_change(int ifindex, __u16 msti, __u8 state)
+{
+	mst_watch_begin();
+	print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname", "%s ",
+			   ll_index_to_name(ifindex));
+	print_uint(PRINT_ANY, "msti", "msti %u ", msti);
+	print_stp_state(state);
+	mst_watch_end();
+}
+
+static void print_mst_deleted(int ifindex, __u16 msti)
+{
+	mst_watch_begin();
+	print_bool(PRINT_ANY, "deleted", "Deleted ", true);
+	print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname", "%s ",
+			   ll_index_to_name(ifindex));
+	print_uint(PRINT_ANY, "msti", "msti %u", msti);
+	mst_watch_end();
+}
+
+static void mst_watch_update(int ifindex, struct rtattr *a)
+{
+	struct rtattr *tb[IFLA_BRIDGE_MST_ENTRY_MAX + 1];
+	struct mst_watch_ent *e;
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	__u16 msti;
+	__u8 state;
+
+	parse_rtattr_flags(tb, IFLA_BRIDGE_MST_ENTRY_MAX, RTA_DATA(a),
+			   RTA_PAYLOAD(a), NLA_F_NESTED);
+	if (!(tb[IFLA_BRIDGE_MST_ENTRY_MSTI] &&
+	      tb[IFLA_BRIDGE_MST_ENTRY_STATE]))
+		return;
+
+	msti = rta_getattr_u16(tb[IFLA_BRIDGE_MST_ENTRY_MSTI]);
+	state = rta_getattr_u8(tb[IFLA_BRIDGE_MST_ENTRY_STATE]);
+
+	head = &mst_watch_hash[((__u32)ifindex << 12 ^ msti) % MST_WATCH_HASH];
+	hlist_for_each(pos, head) {
+		e = container_of(pos, struct mst_watch_ent, hash);
+		if (e->ifindex == ifindex && e->msti == msti)
+			goto found;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return;
+	e->ifindex = ifindex;
+	e->msti = msti;
+	hlist_add_head(&e->hash, head);
+	if (mst_watch_changes)
+		print_mst_change(ifindex, msti, state);
+	goto out;
+
+found:
+	if (e->state != state && mst_watch_changes)
+		print_mst_change(ifindex, msti, state);
+out:
+	e->state = state;
+	e->gen = mst_watch_gen;
+}
+
+static int mst_watch_link(struct nlmsghdr *n, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *af_spec, *mst, *a;
+	int rem = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+
+	if (rem < 0)
+		return -1;
+	if (filter_index && filter_index != ifi->ifi_index)
+		return 0;
+
+	af_spec = parse_rtattr_one(IFLA_AF_SPEC, IFLA_RTA(ifi), rem);
+	if (!af_spec)
+		return 0;
+	mst = parse_rtattr_one_nested(NLA_F_NESTED | IFLA_BRIDGE_MST, af_spec);
+	if (!mst)
+		return 0;
+
+	rem = RTA_PAYLOAD(mst);
+	for (a = RTA_DATA(mst); RTA_OK(a, rem); a = RTA_NEXT(a, rem))
+		if ((a->rta_type & NLA_TYPE_MASK) == IFLA_BRIDGE_MST_ENTRY)
+			mst_watch_update(ifi->ifi_index, a);
+
+	return mst_watch_changes ? 0 : print_msts(n, arg);
+}
+
+static void mst_watch_prune(void)
+{
+	struct hlist_node *pos, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < MST_WATCH_HASH; i++) {
+		hlist_for_each_safe(pos, tmp, &mst_watch_hash[i]) {
+			struct mst_watch_ent *e;
+
+			e = container_of(pos, struct mst_watch_ent, hash);
+			if (e->gen == mst_watch_gen)
+				continue;
+			print_mst_deleted(e->ifindex, e->msti);
+			hlist_del(&e->hash);
+			free(e);
+		}
+	}
+}
+
+static int mst_watch_dump(void)
+{
+	mst_watch_gen++;
+	if (rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_MST) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+
+	if (!mst_watch_changes) {
+		new_json_obj(json);
+		mst_watch_json_open = true;
+		if (!is_json_context())
+			printf("%-" __stringify(IFNAMSIZ) "s  "
+			       "%-" __stringify(MST_ID_LEN) "s\n",
+			       "port", "msti");
+	}
+
+	if (rtnl_dump_filter(&rth, mst_watch_link, stdout) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	if (mst_watch_changes)
+		mst_watch_prune();
+
+	if (mst_watch_json_open) {
+		delete_json_obj();
+		mst_watch_json_open = false;
+	}
+	mst_watch_changes = true;
+	fflush(stdout);
+	return 0;
+}
+
+/* Any link notification triggers a new dump, read them all first */
+static void mst_watch_drain(struct rtnl_handle *mon)
+{
+	char buf[16384];
+
+	while (recv(mon->fd, buf, sizeof(buf), MSG_DONTWAIT) > 0 ||
+	       errno == ENOBUFS)
+		;
+}
+
+static int mst_watch(unsigned int interval)
+{
+	struct rtnl_handle mon = { .fd = -1 };
+	int ret = -1;
+
+	if (rtnl_open(&mon, nl_mgrp(RTNLGRP_LINK)) < 0)
+		return -1;
+
+	while (mst_watch_dump() == 0) {
+		struct pollfd pfd = { .fd = mon.fd, .events = POLLIN };
+		int n = poll(&pfd, 1, interval * 1000);
+
+		if (n < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+		if (n > 0)
+			mst_watch_drain(&mon);
+	}
+
+	if (mst_watch_json_open)
+		delete_json_obj();
+	rtnl_close(&mon);
+	return ret;
+}
+
 static int mst_show(int argc, char **argv)
 {
+	unsigned int interval = 1;
 	char *filter_dev = NULL;
+	bool watch = false;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
@@ -127,6 +351,12 @@ static int mst_show(int argc, char **argv)
 			if (filter_dev)
 				duparg("dev", *argv);
 			filter_dev = *argv;
+		} else if (strcmp(*argv, "watch") == 0) {
+			watch = true;
+		} else if (watch && strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("invalid interval", *argv);
 		}
 		argc--; argv++;
 	}
@@ -137,6 +367,9 @@ static int mst_show(int argc, char **argv)
 			return nodev(filter_dev);
 	}
 
+	if (watch)
+		return mst_watch(interval);
+
 	if (rtnl_linkdump_req_filter(&rth, PF_BRIDGE, RTEXT_FILTER_MST) < 0) {
 		perror("Cannon send dump request");
 		exit(1);
@@ -162,6 +395,268 @@ static int mst_show(int argc, char **argv)
 	return 0;
 }
 
+static int mst_parse_state(const char *arg)
+{
+	char *endptr;
+	long state;
+
+	state = strtol(arg, &endptr, 10);
+	if (!(*arg != '\0' && *endptr == '\0'))
+		state = parse_stp_state(arg);
+
+	if (state < 0 || state > UINT8_MAX)
+		return -1;
+	return state;
+}
+
+/* "set file FILE" sets one state per line of FILE:
+ *
+ *	DEV MSTI STATE
+ *
+ * A "-" for DEV takes the dev given on the command line. The whole file
+ * is read first and nothing is sent if a line is invalid. Then the states
+ * of each port are packed as IFLA_BRIDGE_MST_ENTRY nests into as few
+ * RTM_SETLINK requests as they fit in. A failed request is reported at
+ * the line of its first entry.
+ */
+#define MST_BULK_WINDOW		256
+#define MST_BULK_FIELDS		3
+/* a nest with the u16 MSTI and the u8 state */
+#define MST_ENTRY_SPACE		(RTA_LENGTH(0) + RTA_SPACE(sizeof(__u16)) + \
+				 RTA_SPACE(sizeof(__u8)))
+
+struct mst_bulk_req {
+	struct nlmsghdr		n;
+	struct ifinfomsg	ifi;
+	char			buf[16384];
+};
+
+struct mst_bulk_ent {
+	int			lineno;
+	__u16			msti;
+	__u8			state;
+};
+
+struct mst_bulk_port {
+	int			ifindex;
+	struct mst_bulk_ent	*ent;
+	unsigned int		count;
+	unsigned int		size;
+};
+
+struct mst_bulk {
+	struct rtnl_bulk	bulk;
+	const char		*dev;
+	struct mst_bulk_port	*port;
+	unsigned int		ports;
+	unsigned int		size;
+	/* the last port looked up */
+	char			name[IFNAMSIZ];
+	struct mst_bulk_port	*last;
+	unsigned int		entries;
+	unsigned int		requests;
+};
+
+static struct mst_bulk_port *mst_bulk_port(struct mst_bulk *b,
+					   const char *name)
+{
+	struct mst_bulk_port *p;
+	unsigned int i;
+	int ifindex;
+
+	if (b->last && strcmp(name, b->name) == 0)
+		return b->last;
+
+	ifindex = ll_name_to_index(name);
+	if (!ifindex)
+		return NULL;
+
+	for (i = 0; i < b->ports; i++)
+		if (b->port[i].ifindex == ifindex)
+			goto found;
+
+	if (b->ports == b->size) {
+		unsigned int size = b->size ? b->size * 2 : 64;
+
+		p = realloc(b->port, size * sizeof(*p));
+		if (!p)
+			return NULL;
+		b->port = p;
+		b->size = size;
+	}
+	p = &b->port[b->ports++];
+	memset(p, 0, sizeof(*p));
+	p->ifindex = ifindex;
+found:
+	strlcpy(b->name, name, sizeof(b->name));
+	b->last = &b->port[i];
+	return b->last;
+}
+
+static const char *mst_bulk_entry(struct mst_bulk *b, char **tok, int lineno)
+{
+	struct mst_bulk_port *p;
+	struct mst_bulk_ent *e;
+	const char *dev = tok[0];
+	int state;
+	__u16 msti;
+
+	if (strcmp(dev, "-") == 0)
+		dev = b->dev;
+	if (!dev)
+		return "dev is missing";
+	if (get_u16(&msti, tok[1], 10))
+		return "invalid MSTI";
+	state = mst_parse_state(tok[2]);
+	if (state < 0)
+		return "invalid STP port state";
+
+	p = mst_bulk_port(b, dev);
+	if (!p)
+		return "cannot find port";
+
+	if (p->count == p->size) {
+		unsigned int size = p->size ? p->size * 2 : 64;
+
+		e = realloc(p->ent, size * sizeof(*e));
+		if (!e)
+			return "out of memory";
+		p->ent = e;
+		p->size = size;
+	}
+	e = &p->ent[p->count++];
+	e->lineno = lineno;
+	e->msti = msti;
+	e->state = state;
+	return NULL;
+}
+
+static int mst_bulk_read(struct mst_bulk *b)
+{
+	char *line = NULL;
+	int lineno = 0;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(&b->bulk);
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *tok[MST_BULK_FIELDS];
+		const char *err;
+		int ntok;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, MST_BULK_FIELDS);
+		if (ntok == 0)
+			continue;
+
+		b->entries++;
+		if (ntok != MST_BULK_FIELDS)
+			err = ntok < MST_BULK_FIELDS ? "missing fields" :
+						       "too many fields";
+		else
+			err = mst_bulk_entry(b, tok, lineno);
+		if (err)
+			rtnl_bulk_line_error(&b->bulk, lineno, err);
+	}
+
+	free(line);
+	rtnl_bulk_close(fp);
+
+	if (b->bulk.failed) {
+		fprintf(stderr, "%s: %u of %u lines invalid, nothing was sent\n",
+			b->bulk.file, b->bulk.failed, b->entries);
+		return -1;
+	}
+	return 0;
+}
+
+static int mst_bulk_send(struct mst_bulk *b, struct rtnl_flush *f,
+			 struct mst_bulk_port *p, struct mst_bulk_req *req)
+{
+	unsigned int i = 0;
+
+	while (i < p->count) {
+		struct rtattr *af_spec, *mst, *entry;
+
+		memset(req, 0, sizeof(req->n) + sizeof(req->ifi));
+		req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+		req->n.nlmsg_flags = NLM_F_REQUEST;
+		req->n.nlmsg_type = RTM_SETLINK;
+		req->ifi.ifi_family = PF_BRIDGE;
+		req->ifi.ifi_index = p->ifindex;
+
+		af_spec = addattr_nest(&req->n, sizeof(*req), IFLA_AF_SPEC);
+		mst = addattr_nest(&req->n, sizeof(*req), IFLA_BRIDGE_MST);
+		f->tag = p->ent[i].lineno;
+
+		for (; i < p->count; i++) {
+			if (NLMSG_ALIGN(req->n.nlmsg_len) + MST_ENTRY_SPACE >
+			    sizeof(*req))
+				break;
+
+			entry = addattr_nest(&req->n, sizeof(*req),
+					     IFLA_BRIDGE_MST_ENTRY);
+			entry->rta_type |= NLA_F_NESTED;
+			addattr16(&req->n, sizeof(*req),
+				  IFLA_BRIDGE_MST_ENTRY_MSTI, p->ent[i].msti);
+			addattr8(&req->n, sizeof(*req),
+				 IFLA_BRIDGE_MST_ENTRY_STATE, p->ent[i].state);
+			addattr_nest_end(&req->n, entry);
+		}
+
+		addattr_nest_end(&req->n, mst);
+		addattr_nest_end(&req->n, af_spec);
+
+		if (rtnl_flush_add(f, &req->n, 0) < 0) {
+			perror("Cannot talk to rtnetlink");
+			return -1;
+		}
+		b->requests++;
+	}
+	return 0;
+}
+
+static int mst_bulk(struct mst_bulk *b)
+{
+	struct mst_bulk_req *req = NULL;
+	struct rtnl_flush f;
+	unsigned int i;
+	int ret = -1;
+
+	if (mst_bulk_read(b) < 0)
+		goto out_free;
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		goto out_free;
+
+	if (rtnl_bulk_start(&b->bulk, &f) < 0)
+		goto out_free;
+
+	for (i = 0; i < b->ports; i++) {
+		if (mst_bulk_send(b, &f, &b->port[i], req) < 0) {
+			rtnl_flush_close(&f);
+			goto out_free;
+		}
+	}
+
+	b->bulk.entries = b->requests;
+	ret = rtnl_bulk_finish(&b->bulk, &f);
+	if (show_stats)
+		printf("%u entries on %u ports in %u requests, %.0f requests/s\n",
+		       b->entries, b->ports, b->requests, b->bulk.rate);
+
+out_free:
+	free(req);
+	for (i = 0; i < b->ports; i++)
+		free(b->port[i].ent);
+	free(b->port);
+	return ret;
+}
+
 static int mst_set(int argc, char **argv)
 {
 	struct {
@@ -174,7 +669,7 @@ static int mst_set(int argc, char **argv)
 		.n.nlmsg_type = RTM_SETLINK,
 		.ifi.ifi_family = PF_BRIDGE,
 	};
-	char *d = NULL, *m = NULL, *s = NULL, *endptr;
+	char *d = NULL, *m = NULL, *s = NULL, *file = NULL;
 	struct rtattr *af_spec, *mst, *entry;
 	__u16 msti;
 	int state;
@@ -189,6 +684,9 @@ static int mst_set(int argc, char **argv)
 		} else if (strcmp(*argv, "state") == 0) {
 			NEXT_ARG();
 			s = *argv;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			file = *argv;
 		} else {
 			if (matches(*argv, "help") == 0)
 				usage();
@@ -196,6 +694,21 @@ static int mst_set(int argc, char **argv)
 		argc--; argv++;
 	}
 
+	if (file) {
+		struct mst_bulk b = {
+			.bulk.file = file,
+			.bulk.what = "requests",
+			.bulk.window = MST_BULK_WINDOW,
+			.dev = d,
+		};
+
+		if (m || s) {
+			fprintf(stderr, "Either MSTI and state or file, not both\n");
+			return -1;
+		}
+		return mst_bulk(&b);
+	}
+
 	if (d == NULL || m == NULL || s == NULL) {
 		fprintf(stderr, "Device, MSTI and state are required arguments.\n");
 		return -1;
@@ -205,18 +718,14 @@ static int mst_set(int argc, char **argv)
 	if (!req.ifi.ifi_index)
 		return nodev(d);
 
-	msti = strtol(m, &endptr, 10);
-	if (!(*s != '\0' && *endptr == '\0')) {
+	if (get_u16(&msti, m, 10)) {
 		fprintf(stderr,
 			"Error: invalid MSTI\n");
 		return -1;
 	}
 
-	state = strtol(s, &endptr, 10);
-	if (!(*s != '\0' && *endptr == '\0'))
-		state = parse_stp_state(s);
-	
-	if (state < 0 || state > UINT8_MAX) {
+	state = mst_parse_state(s);
+	if (state < 0) {
 		fprintf(stderr, "Error: invalid STP port state\n");
 		return -1;
 	}
@@ -11,12 +11,14 @@
 #include <linux/if_ether.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "json_print.h"
 #include "libnetlink.h"
 #include "br_common.h"
 #include "bridge.h"
 #include "utils.h"
+#include "list.h"
 
 static unsigned int filter_index, filter_vlan;
 static int vlan_rtm_cur_ifidx = -1;
@@ -35,11 +37,14 @@ static void usage(void)
 		"Usage: bridge vlan { add | del } vid VLAN_ID dev DEV [ tunnel_info id TUNNEL_ID ]\n"
 		"                                                     [ pvid ] [ untagged ]\n"
 		"                                                     [ self ] [ master ]\n"
+		"       bridge vlan sync dev DEV vid VLAN_LIST [ untagged VLAN_LIST ]\n"
+		"                        [ pvid VLAN_ID ] [ self ] [ master ]\n"
 		"       bridge vlan { set } vid VLAN_ID dev DEV [ state STP_STATE ]\n"
 		"                                               [ mcast_router MULTICAST_ROUTER ]\n"
 		"                                               [ mcast_max_groups MAX_GROUPS ]\n"
 		"                                               [ neigh_suppress {on | off} ]\n"
 		"       bridge vlan { show } [ dev DEV ] [ vid VLAN_ID ]\n"
+		"                            [ interval SECS [ count COUNT ] ]\n"
 		"       bridge vlan { tunnelshow } [ dev DEV ] [ vid VLAN_ID ]\n"
 		"       bridge vlan global { set } vid VLAN_ID dev DEV\n"
 		"                      [ mcast_snooping MULTICAST_SNOOPING ]\n"
@@ -262,6 +267,267 @@ static int vlan_modify(int cmd, int argc, char **argv)
 	return 0;
 }
 
+/* "sync" makes the VLANs of a port those of a target set, sending only
+ * the ranges that differ from the current state: one request deletes
+ * the VLANs that go away, one adds the new ones and those whose flags
+ * change.
+ */
+#define VLAN_N_VID	4096
+
+struct vlan_bitmap {
+	__u64	member[VLAN_N_VID / 64];
+	__u64	untagged[VLAN_N_VID / 64];
+	__u16	pvid;
+};
+
+struct vlan_sync_req {
+	struct nlmsghdr		n;
+	struct ifinfomsg	ifm;
+	char			buf[VLAN_N_VID *
+				    RTA_SPACE(sizeof(struct bridge_vlan_info)) +
+				    64];
+};
+
+static bool vlan_test(const __u64 *map, __u16 vid)
+{
+	return map[vid / 64] & (1ULL << (vid % 64));
+}
+
+static void vlan_set_range(__u64 *map, __u16 start, __u16 end)
+{
+	for (; start <= end; start++)
+		map[start / 64] |= 1ULL << (start % 64);
+}
+
+/* "1,10-20,100" */
+static int vlan_parse_list(__u64 *map, char *arg)
+{
+	char *tok, *end, *save = NULL;
+
+	for (tok = strtok_r(arg, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		__u16 first, last;
+
+		end = strchr(tok, '-');
+		if (end)
+			*end++ = '\0';
+		if (get_u16(&first, tok, 0) || first == 0 ||
+		    first >= VLAN_N_VID - 1)
+			return -1;
+		last = first;
+		if (end && (get_u16(&last, end, 0) || last < first ||
+			    last >= VLAN_N_VID - 1))
+			return -1;
+		vlan_set_range(map, first, last);
+	}
+	return 0;
+}
+
+static int vlan_sync_read(struct nlmsghdr *n, void *arg)
+{
+	struct vlan_bitmap *cur = arg;
+	struct ifinfomsg *ifm = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX+1], *i;
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifm));
+	__u16 start = 0;
+	int rem;
+
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0 ||
+	    ifm->ifi_family != AF_BRIDGE || ifm->ifi_index != filter_index)
+		return 0;
+
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifm), len);
+	if (!tb[IFLA_AF_SPEC])
+		return 0;
+
+	rem = RTA_PAYLOAD(tb[IFLA_AF_SPEC]);
+	for (i = RTA_DATA(tb[IFLA_AF_SPEC]); RTA_OK(i, rem);
+	     i = RTA_NEXT(i, rem)) {
+		struct bridge_vlan_info *vinfo;
+
+		if (i->rta_type != IFLA_BRIDGE_VLAN_INFO)
+			continue;
+
+		vinfo = RTA_DATA(i);
+		if (vinfo->vid >= VLAN_N_VID)
+			continue;
+		if (vinfo->flags & BRIDGE_VLAN_INFO_RANGE_BEGIN) {
+			start = vinfo->vid;
+			continue;
+		}
+		if (!(vinfo->flags & BRIDGE_VLAN_INFO_RANGE_END))
+			start = vinfo->vid;
+		vlan_set_range(cur->member, start, vinfo->vid);
+		if (vinfo->flags & BRIDGE_VLAN_INFO_UNTAGGED)
+			vlan_set_range(cur->untagged, start, vinfo->vid);
+		if (vinfo->flags & BRIDGE_VLAN_INFO_PVID)
+			cur->pvid = vinfo->vid;
+	}
+	return 0;
+}
+
+static struct rtattr *vlan_sync_start(struct vlan_sync_req *req, int cmd,
+				      int ifindex, unsigned short flags)
+{
+	struct rtattr *afspec;
+
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->n.nlmsg_type = cmd;
+	memset(&req->ifm, 0, sizeof(req->ifm));
+	req->ifm.ifi_family = PF_BRIDGE;
+	req->ifm.ifi_index = ifindex;
+	afspec = addattr_nest(&req->n, sizeof(*req), IFLA_AF_SPEC);
+	if (flags)
+		addattr16(&req->n, sizeof(*req), IFLA_BRIDGE_FLAGS, flags);
+	return afspec;
+}
+
+static void vlan_sync_range(struct vlan_sync_req *req, __u16 start,
+			    __u16 end, __u16 flags, unsigned int *ranges)
+{
+	if (start == end)
+		add_vlan_info_range(&req->n, sizeof(*req), start, -1, flags);
+	else
+		add_vlan_info_range(&req->n, sizeof(*req), start, end,
+				    flags | BRIDGE_VLAN_INFO_RANGE_BEGIN);
+	(*ranges)++;
+}
+
+static int vlan_sync_send(struct vlan_sync_req *req, struct rtattr *afspec)
+{
+	addattr_nest_end(&req->n, afspec);
+	return rtnl_talk(&rth, &req->n, NULL);
+}
+
+static int vlan_sync(int argc, char **argv)
+{
+	struct vlan_bitmap cur = {}, tgt = {};
+	struct vlan_sync_req *req;
+	struct rtattr *afspec;
+	unsigned int nadd = 0, ndel = 0;
+	unsigned short flags = 0;
+	int start, vid, ret = -1;
+	__u16 run_flags = 0;
+	char *d = NULL;
+	bool have_vid = false;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			d = *argv;
+		} else if (strcmp(*argv, "vid") == 0) {
+			NEXT_ARG();
+			if (vlan_parse_list(tgt.member, *argv))
+				invarg("invalid VLAN list", *argv);
+			have_vid = true;
+		} else if (strcmp(*argv, "untagged") == 0) {
+			NEXT_ARG();
+			if (vlan_parse_list(tgt.untagged, *argv))
+				invarg("invalid VLAN list", *argv);
+		} else if (strcmp(*argv, "pvid") == 0) {
+			NEXT_ARG();
+			if (get_u16(&tgt.pvid, *argv, 0) || !tgt.pvid ||
+			    tgt.pvid >= VLAN_N_VID - 1)
+				invarg("invalid pvid", *argv);
+		} else if (strcmp(*argv, "self") == 0) {
+			flags |= BRIDGE_FLAGS_SELF;
+		} else if (strcmp(*argv, "master") == 0) {
+			flags |= BRIDGE_FLAGS_MASTER;
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown argument", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (d == NULL || !have_vid) {
+		fprintf(stderr, "Device and VLAN list are required arguments.\n");
+		return -1;
+	}
+
+	filter_index = ll_name_to_index(d);
+	if (!filter_index)
+		return nodev(d);
+
+	/* untagged and pvid VLANs are members too */
+	for (vid = 0; vid < ARRAY_SIZE(tgt.member); vid++)
+		tgt.member[vid] |= tgt.untagged[vid];
+	if (tgt.pvid)
+		vlan_set_range(tgt.member, tgt.pvid, tgt.pvid);
+
+	if (rtnl_linkdump_req_filter(&rth, PF_BRIDGE,
+				     RTEXT_FILTER_BRVLAN_COMPRESSED) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, vlan_sync_read, &cur) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return -1;
+
+	/* VLANs that go away, in ranges of consecutive VIDs */
+	afspec = vlan_sync_start(req, RTM_DELLINK, filter_index, flags);
+	for (start = -1, vid = 1; vid <= VLAN_N_VID; vid++) {
+		bool del = vid < VLAN_N_VID && vlan_test(cur.member, vid) &&
+			   !vlan_test(tgt.member, vid);
+
+		if (del && start < 0)
+			start = vid;
+		if (!del && start >= 0) {
+			vlan_sync_range(req, start, vid - 1, 0, &ndel);
+			start = -1;
+		}
+	}
+	if (ndel && vlan_sync_send(req, afspec) < 0)
+		goto out;
+
+	/* New VLANs and those whose flags change, in ranges of consecutive
+	 * VIDs with the same flags; the pvid cannot be part of a range.
+	 */
+	afspec = vlan_sync_start(req, RTM_SETLINK, filter_index, flags);
+	for (start = -1, vid = 1; vid <= VLAN_N_VID; vid++) {
+		bool add = false;
+		__u16 vflags = 0;
+
+		if (vid < VLAN_N_VID && vlan_test(tgt.member, vid)) {
+			if (vlan_test(tgt.untagged, vid))
+				vflags |= BRIDGE_VLAN_INFO_UNTAGGED;
+			if (vid == tgt.pvid)
+				vflags |= BRIDGE_VLAN_INFO_PVID;
+			add = !vlan_test(cur.member, vid) ||
+			      vlan_test(cur.untagged, vid) !=
+			      vlan_test(tgt.untagged, vid) ||
+			      (vid == cur.pvid) != (vid == tgt.pvid);
+		}
+
+		if (start >= 0 && (!add || vflags != run_flags ||
+				   (vflags & BRIDGE_VLAN_INFO_PVID))) {
+			vlan_sync_range(req, start, vid - 1, run_flags, &nadd);
+			start = -1;
+		}
+		if (add && start < 0) {
+			start = vid;
+			run_flags = vflags;
+		}
+	}
+	if (nadd && vlan_sync_send(req, afspec) < 0)
+		goto out;
+
+	if (show_stats)
+		printf("%u ranges deleted, %u ranges added or changed\n",
+		       ndel, nadd);
+	ret = 0;
+out:
+	free(req);
+	return ret;
+}
+
 static int vlan_option_set(int argc, char **argv)
 {
 	struct {
@@ -782,6 +1048,230 @@ static int print_vlan_stats(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/* "show ... interval SECS": the counters of each (port, vid) are kept from
+ * one sample to the next and the difference is printed, with the rate
+ * over the time actually elapsed. A single device is fetched with one
+ * RTM_GETSTATS request, all of them with one dump of both the bridge and
+ * the port counters.
+ */
+#define VLAN_RATE_HASH	1024
+
+struct vlan_sample {
+	struct hlist_node		hash;
+	__u32				key;	/* ifindex << 12 | vid */
+	struct bridge_vlan_xstats	last;
+};
+
+static struct hlist_head vlan_samples[VLAN_RATE_HASH];
+static double vlan_rate_secs;
+static bool vlan_rate_print;
+
+static struct vlan_sample *vlan_sample_get(int ifindex, __u16 vid, bool *new)
+{
+	__u32 key = (__u32)ifindex << 12 | (vid & 0xfff);
+	struct hlist_head *head = &vlan_samples[key % VLAN_RATE_HASH];
+	struct hlist_node *pos;
+	struct vlan_sample *s;
+
+	hlist_for_each(pos, head) {
+		s = container_of(pos, struct vlan_sample, hash);
+		if (s->key == key) {
+			*new = false;
+			return s;
+		}
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->key = key;
+	hlist_add_head(&s->hash, head);
+	*new = true;
+	return s;
+}
+
+static __u64 vlan_delta(__u64 cur, __u64 last)
+{
+	/* counters start over if the vlan was deleted and added again */
+	return cur >= last ? cur - last : cur;
+}
+
+static void print_vlan_rate_dir(const char *dir, __u64 bytes, __u64 packets)
+{
+	char name[32];
+
+	print_string(PRINT_FP, NULL, "%-" textify(IFNAMSIZ) "s    ", "");
+	print_string(PRINT_FP, NULL, "%s: ", dir);
+	snprintf(name, sizeof(name), "%s_bytes", dir[0] == 'R' ? "rx" : "tx");
+	print_lluint(PRINT_ANY, name, "%llu bytes", bytes);
+	snprintf(name, sizeof(name), "%s_packets", dir[0] == 'R' ? "rx" : "tx");
+	print_lluint(PRINT_ANY, name, " %llu packets", packets);
+	snprintf(name, sizeof(name), "%s_bytes_rate", dir[0] == 'R' ? "rx" : "tx");
+	print_float(PRINT_ANY, name, " %.0f bytes/s", bytes / vlan_rate_secs);
+	snprintf(name, sizeof(name), "%s_packets_rate",
+		 dir[0] == 'R' ? "rx" : "tx");
+	print_float(PRINT_ANY, name, " %.0f packets/s\n",
+		    packets / vlan_rate_secs);
+}
+
+static void print_vlan_rate_attr(struct rtattr *attr, int ifindex)
+{
+	struct rtattr *brtb[LINK_XSTATS_TYPE_MAX+1];
+	struct rtattr *i, *list;
+	bool found_vlan = false;
+	int rem;
+
+	parse_rtattr(brtb, LINK_XSTATS_TYPE_MAX, RTA_DATA(attr),
+		     RTA_PAYLOAD(attr));
+	if (!brtb[LINK_XSTATS_TYPE_BRIDGE])
+		return;
+
+	list = brtb[LINK_XSTATS_TYPE_BRIDGE];
+	rem = RTA_PAYLOAD(list);
+
+	for (i = RTA_DATA(list); RTA_OK(i, rem); i = RTA_NEXT(i, rem)) {
+		const struct bridge_vlan_xstats *vstats = RTA_DATA(i);
+		struct vlan_sample *s;
+		bool new;
+
+		if (i->rta_type != BRIDGE_XSTATS_VLAN)
+			continue;
+
+		if (filter_vlan && filter_vlan != vstats->vid)
+			continue;
+
+		/* pure port entries come with the port's own counters */
+		if ((vstats->flags & BRIDGE_VLAN_INFO_MASTER) &&
+		    !(vstats->flags & BRIDGE_VLAN_INFO_BRENTRY))
+			continue;
+
+		s = vlan_sample_get(ifindex, vstats->vid, &new);
+		if (!s)
+			continue;
+
+		if (!new && vlan_rate_print) {
+			if (!found_vlan) {
+				open_vlan_port(ifindex, VLAN_SHOW_VLAN);
+				found_vlan = true;
+			} else {
+				print_string(PRINT_FP, NULL,
+					     "%-" textify(IFNAMSIZ) "s  ", "");
+			}
+			open_json_object(NULL);
+			print_hu(PRINT_ANY, "vid", "%hu", vstats->vid);
+			bridge_print_vlan_flags(vstats->flags);
+			print_nl();
+			print_vlan_rate_dir("RX",
+					    vlan_delta(vstats->rx_bytes,
+						       s->last.rx_bytes),
+					    vlan_delta(vstats->rx_packets,
+						       s->last.rx_packets));
+			print_vlan_rate_dir("TX",
+					    vlan_delta(vstats->tx_bytes,
+						       s->last.tx_bytes),
+					    vlan_delta(vstats->tx_packets,
+						       s->last.tx_packets));
+			close_json_object();
+		}
+		s->last = *vstats;
+	}
+
+	if (found_vlan)
+		close_vlan_port();
+}
+
+static int print_vlan_rate(struct nlmsghdr *n, void *arg)
+{
+	struct if_stats_msg *ifsm = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_STATS_MAX+1];
+	int len = n->nlmsg_len;
+
+	len -= NLMSG_LENGTH(sizeof(*ifsm));
+	if (len < 0) {
+		fprintf(stderr, "BUG: wrong nlmsg len %d\n", len);
+		return -1;
+	}
+
+	if (filter_index && filter_index != ifsm->ifindex)
+		return 0;
+
+	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
+
+	if (tb[IFLA_STATS_LINK_XSTATS])
+		print_vlan_rate_attr(tb[IFLA_STATS_LINK_XSTATS],
+				     ifsm->ifindex);
+
+	if (tb[IFLA_STATS_LINK_XSTATS_SLAVE])
+		print_vlan_rate_attr(tb[IFLA_STATS_LINK_XSTATS_SLAVE],
+				     ifsm->ifindex);
+	return 0;
+}
+
+static int vlan_rate_sample(void)
+{
+	__u32 filt_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_XSTATS) |
+			  IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_XSTATS_SLAVE);
+
+	if (filter_index) {
+		struct ipstats_req req = {
+			.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct if_stats_msg)),
+			.nlh.nlmsg_type = RTM_GETSTATS,
+			.nlh.nlmsg_flags = NLM_F_REQUEST,
+			.ifsm.ifindex = filter_index,
+			.ifsm.filter_mask = filt_mask,
+		};
+		struct nlmsghdr *answer;
+		int ret;
+
+		if (rtnl_talk(&rth, &req.nlh, &answer) < 0)
+			return -1;
+		ret = print_vlan_rate(answer, NULL);
+		free(answer);
+		return ret;
+	}
+
+	if (rtnl_statsdump_req_filter(&rth, AF_UNSPEC, filt_mask,
+				      NULL, NULL) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, print_vlan_rate, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int vlan_rate_show(unsigned int interval, unsigned int count)
+{
+	double last, next, now;
+	unsigned int i;
+
+	last = next = monotonic_now();
+	if (vlan_rate_sample() < 0)
+		return -1;
+
+	vlan_rate_print = true;
+	for (i = 0; !count || i < count; i++) {
+		next += interval;
+		monotonic_sleep_until(next);
+		now = monotonic_now();
+		vlan_rate_secs = now - last;
+		last = now;
+
+		new_json_obj(json);
+		if (!is_json_context())
+			printf("%-" textify(IFNAMSIZ) "s  vlan-id\n", "port");
+		if (vlan_rate_sample() < 0) {
+			delete_json_obj();
+			return -1;
+		}
+		delete_json_obj();
+		fflush(stdout);
+	}
+	return 0;
+}
+
 static void print_vlan_router_ports(struct rtattr *rattr)
 {
 	int rem = RTA_PAYLOAD(rattr);
@@ -1094,6 +1584,7 @@ static int print_vlan_rtm_global_filter(struct nlmsghdr *n, void *arg)
 
 static int vlan_show(int argc, char **argv, int subject)
 {
+	unsigned int interval = 0, count = 0;
 	char *filter_dev = NULL;
 	int ret = 0;
 
@@ -1108,6 +1599,14 @@ static int vlan_show(int argc, char **argv, int subject)
 			if (filter_vlan)
 				duparg("vid", *argv);
 			filter_vlan = atoi(*argv);
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("invalid interval", *argv);
+		} else if (strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0) || !count)
+				invarg("invalid count", *argv);
 		}
 		argc--; argv++;
 	}
@@ -1118,6 +1617,9 @@ static int vlan_show(int argc, char **argv, int subject)
 			return nodev(filter_dev);
 	}
 
+	if (interval && subject == VLAN_SHOW_VLAN)
+		return vlan_rate_show(interval, count);
+
 	new_json_obj(json);
 
 	/* if show_details is true then use the new bridge vlan dump format */
@@ -1343,6 +1845,8 @@ int do_vlan(int argc, char **argv)
 		if (matches(*argv, "tunnelshow") == 0) {
 			return vlan_show(argc-1, argv+1, VLAN_SHOW_TUNNELINFO);
 		}
+		if (strcmp(*argv, "sync") == 0)
+			return vlan_sync(argc-1, argv+1);
 		if (matches(*argv, "set") == 0)
 			return vlan_option_set(argc-1, argv+1);
 		if (strcmp(*argv, "global") == 0)
@@ -11,6 +11,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <linux/if_link.h>
@@ -33,26 +34,34 @@ static void usage(void)
 		"Usage: bridge vni { add | del } vni VNI\n"
 		"		[ { group | remote } IP_ADDRESS ]\n"
 		"		dev DEV\n"
+		"       bridge vni sync dev DEV vni VNI_LIST\n"
+		"		[ { group | remote } IP_ADDRESS ]\n"
 		"       bridge vni { show } [ dev DEV ]\n"
+		"		[ interval SECS [ count COUNT ] [ top N ] ]\n"
 		"\n"
 		"Where:	VNI	:= 0-16777215\n"
 	       );
 	exit(-1);
 }
 
+static int vni_group_type(const inet_prefix *group)
+{
+	if (!group || !is_addrtype_inet(group))
+		return AF_UNSPEC;
+
+	return group->family == AF_INET ? VXLAN_VNIFILTER_ENTRY_GROUP :
+					  VXLAN_VNIFILTER_ENTRY_GROUP6;
+}
+
 static int parse_vni_filter(const char *argv, struct nlmsghdr *n, int reqsize,
 			    inet_prefix *group)
 {
 	char *vnilist = strdupa(argv);
 	char *vni = strtok(vnilist, ",");
-	int group_type = AF_UNSPEC;
+	int group_type = vni_group_type(group);
 	struct rtattr *nlvlist_e;
 	char *v;
 
-	if (group && is_addrtype_inet(group))
-		group_type = (group->family == AF_INET) ?  VXLAN_VNIFILTER_ENTRY_GROUP :
-						     VXLAN_VNIFILTER_ENTRY_GROUP6;
-
 	while (vni != NULL) {
 		__u32 vni_start = 0, vni_end = 0;
 
@@ -146,6 +155,290 @@ static int vni_modify(int cmd, int argc, char **argv)
 	return 0;
 }
 
+/* "sync" makes the VNIs of a vxlan device those of a target set. Both
+ * sets are bitmaps over the whole VNI space and only the difference is
+ * sent, as ranges of consecutive VNIs: first the VNIs that go away,
+ * then the new ones and those whose group or remote changes.
+ */
+#define VXLAN_N_VID	(1U << 24)
+#define VNI_MAP_WORDS	(VXLAN_N_VID / 64)
+
+struct vni_sync {
+	__u64			*cur;
+	__u64			*tgt;
+	__u64			*moved;	/* members with another group/remote */
+	int			ifindex;
+	const inet_prefix	*group;
+};
+
+struct vni_sync_req {
+	struct nlmsghdr		n;
+	struct tunnel_msg	tmsg;
+	char			buf[16384];
+};
+
+/* one entry: the nest, start, end and an IPv6 group */
+#define VNI_SYNC_ENTRY_SPACE	(RTA_SPACE(0) + 2 * RTA_SPACE(4) + \
+				 RTA_SPACE(sizeof(struct in6_addr)))
+
+static void vni_set_range(__u64 *map, __u32 start, __u32 end)
+{
+	for (; start <= end; start++)
+		map[start / 64] |= 1ULL << (start % 64);
+}
+
+static bool vni_test(const __u64 *map, __u32 vni)
+{
+	return map[vni / 64] & (1ULL << (vni % 64));
+}
+
+/* The next run of set bits at or after *pos, skipping empty words */
+static bool vni_next_range(const __u64 *map, __u32 *pos, __u32 *start,
+			   __u32 *end)
+{
+	__u32 v = *pos;
+
+	while (v < VXLAN_N_VID && !(map[v / 64] >> (v % 64)))
+		v = (v | 63) + 1;
+	if (v >= VXLAN_N_VID)
+		return false;
+
+	while (!vni_test(map, v))
+		v++;
+	*start = v;
+	while (v < VXLAN_N_VID && vni_test(map, v))
+		v++;
+	*end = v - 1;
+	*pos = v;
+	return true;
+}
+
+/* "100,200-300" */
+static int vni_parse_list(__u64 *map, char *arg)
+{
+	char *tok, *end, *save = NULL;
+
+	for (tok = strtok_r(arg, ",", &save); tok;
+	     tok = strtok_r(NULL, ",", &save)) {
+		__u32 first, last;
+
+		end = strchr(tok, '-');
+		if (end)
+			*end++ = '\0';
+		if (get_u32(&first, tok, 0) || first >= VXLAN_N_VID)
+			return -1;
+		last = first;
+		if (end && (get_u32(&last, end, 0) || last < first ||
+			    last >= VXLAN_N_VID))
+			return -1;
+		vni_set_range(map, first, last);
+	}
+	return 0;
+}
+
+static bool vni_group_match(struct rtattr *ttb[], const inet_prefix *group)
+{
+	struct rtattr *a = ttb[vni_group_type(group)];
+
+	return a && RTA_PAYLOAD(a) == group->bytelen &&
+	       memcmp(RTA_DATA(a), group->data, group->bytelen) == 0;
+}
+
+static int vni_sync_read(struct nlmsghdr *n, void *arg)
+{
+	struct tunnel_msg *tmsg = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*tmsg));
+	struct vni_sync *s = arg;
+	struct rtattr *t;
+
+	if (n->nlmsg_type != RTM_NEWTUNNEL || len < 0 ||
+	    tmsg->family != AF_BRIDGE || tmsg->ifindex != s->ifindex)
+		return 0;
+
+	for (t = TUNNEL_RTA(tmsg); RTA_OK(t, len); t = RTA_NEXT(t, len)) {
+		struct rtattr *ttb[VXLAN_VNIFILTER_ENTRY_MAX+1];
+		__u32 start, end;
+
+		if (rta_type(t) != VXLAN_VNIFILTER_ENTRY)
+			continue;
+
+		parse_rtattr_flags(ttb, VXLAN_VNIFILTER_ENTRY_MAX,
+				   RTA_DATA(t), RTA_PAYLOAD(t), NLA_F_NESTED);
+		if (!ttb[VXLAN_VNIFILTER_ENTRY_START])
+			continue;
+		start = rta_getattr_u32(ttb[VXLAN_VNIFILTER_ENTRY_START]);
+		end = ttb[VXLAN_VNIFILTER_ENTRY_END] ?
+		      rta_getattr_u32(ttb[VXLAN_VNIFILTER_ENTRY_END]) : start;
+		if (end < start || end >= VXLAN_N_VID)
+			continue;
+
+		vni_set_range(s->cur, start, end);
+		if (s->group && !vni_group_match(ttb, s->group))
+			vni_set_range(s->moved, start, end);
+	}
+	return 0;
+}
+
+static void vni_sync_start(struct vni_sync_req *req, int cmd, int ifindex)
+{
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tunnel_msg));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->n.nlmsg_type = cmd;
+	memset(&req->tmsg, 0, sizeof(req->tmsg));
+	req->tmsg.family = PF_BRIDGE;
+	req->tmsg.ifindex = ifindex;
+}
+
+static int vni_sync_send(struct vni_sync_req *req, unsigned int *msgs)
+{
+	if (req->n.nlmsg_len == NLMSG_LENGTH(sizeof(struct tunnel_msg)))
+		return 0;
+
+	(*msgs)++;
+	return rtnl_talk(&rth, &req->n, NULL);
+}
+
+/* Send the ranges of map, in as many requests as they need */
+static int vni_sync_ranges(struct vni_sync_req *req, int cmd, int ifindex,
+			   const __u64 *map, const inet_prefix *group,
+			   unsigned int *ranges, unsigned int *msgs)
+{
+	int group_type = vni_group_type(group);
+	__u32 pos = 0, start, end;
+
+	vni_sync_start(req, cmd, ifindex);
+	while (vni_next_range(map, &pos, &start, &end)) {
+		struct rtattr *nest;
+
+		if (NLMSG_ALIGN(req->n.nlmsg_len) + VNI_SYNC_ENTRY_SPACE >
+		    sizeof(*req)) {
+			if (vni_sync_send(req, msgs) < 0)
+				return -1;
+			vni_sync_start(req, cmd, ifindex);
+		}
+
+		nest = addattr_nest(&req->n, sizeof(*req),
+				    VXLAN_VNIFILTER_ENTRY | NLA_F_NESTED);
+		addattr32(&req->n, sizeof(*req), VXLAN_VNIFILTER_ENTRY_START,
+			  start);
+		if (end != start)
+			addattr32(&req->n, sizeof(*req),
+				  VXLAN_VNIFILTER_ENTRY_END, end);
+		if (group)
+			addattr_l(&req->n, sizeof(*req), group_type,
+				  group->data, group->bytelen);
+		addattr_nest_end(&req->n, nest);
+		(*ranges)++;
+	}
+	return vni_sync_send(req, msgs);
+}
+
+static int vni_sync(int argc, char **argv)
+{
+	unsigned int ndel = 0, nadd = 0, msgs = 0;
+	struct vni_sync s = {};
+	struct vni_sync_req *req = NULL;
+	bool daddr_present = false;
+	inet_prefix daddr;
+	char *vni = NULL;
+	char *d = NULL;
+	int ret = -1;
+	__u32 w;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			d = *argv;
+		} else if (strcmp(*argv, "vni") == 0) {
+			NEXT_ARG();
+			if (vni)
+				duparg("vni", *argv);
+			vni = *argv;
+		} else if (strcmp(*argv, "group") == 0) {
+			NEXT_ARG();
+			if (daddr_present)
+				duparg("destination", *argv);
+			get_addr(&daddr, *argv, AF_UNSPEC);
+			if (!is_addrtype_inet_multi(&daddr))
+				invarg("invalid group address", *argv);
+			daddr_present = true;
+		} else if (strcmp(*argv, "remote") == 0) {
+			NEXT_ARG();
+			if (daddr_present)
+				duparg("destination", *argv);
+			get_addr(&daddr, *argv, AF_UNSPEC);
+			daddr_present = true;
+		} else if (strcmp(*argv, "help") == 0) {
+			usage();
+		} else {
+			invarg("unknown argument", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (d == NULL || vni == NULL) {
+		fprintf(stderr, "Device and VNI list are required arguments.\n");
+		return -1;
+	}
+
+	s.ifindex = ll_name_to_index(d);
+	if (s.ifindex == 0) {
+		fprintf(stderr, "Cannot find vxlan device \"%s\"\n", d);
+		return -1;
+	}
+	if (daddr_present)
+		s.group = &daddr;
+
+	s.cur = calloc(VNI_MAP_WORDS, sizeof(__u64));
+	s.tgt = calloc(VNI_MAP_WORDS, sizeof(__u64));
+	s.moved = calloc(VNI_MAP_WORDS, sizeof(__u64));
+	req = malloc(sizeof(*req));
+	if (!s.cur || !s.tgt || !s.moved || !req) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
+	}
+
+	if (vni_parse_list(s.tgt, strdupa(vni))) {
+		fprintf(stderr, "Invalid VNI list \"%s\"\n", vni);
+		goto out;
+	}
+
+	if (rtnl_tunneldump_req(&rth, PF_BRIDGE, s.ifindex, 0) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, vni_sync_read, &s) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	/* cur becomes the VNIs to delete, tgt those to add or update */
+	for (w = 0; w < VNI_MAP_WORDS; w++) {
+		__u64 del = s.cur[w] & ~s.tgt[w];
+		__u64 add = s.tgt[w] & (~s.cur[w] | s.moved[w]);
+
+		s.cur[w] = del;
+		s.tgt[w] = add;
+	}
+
+	if (vni_sync_ranges(req, RTM_DELTUNNEL, s.ifindex, s.cur, NULL,
+			    &ndel, &msgs) < 0 ||
+	    vni_sync_ranges(req, RTM_NEWTUNNEL, s.ifindex, s.tgt, s.group,
+			    &nadd, &msgs) < 0)
+		goto out;
+
+	if (show_stats)
+		printf("%u ranges deleted, %u ranges added or changed, %u requests\n",
+		       ndel, nadd, msgs);
+	ret = 0;
+out:
+	free(req);
+	free(s.moved);
+	free(s.tgt);
+	free(s.cur);
+	return ret;
+}
+
 static void open_vni_port(int ifi_index)
 {
 	open_json_object(NULL);
@@ -337,8 +630,246 @@ int print_vnifilter_rtm(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/* "show interval SECS": the per-VNI counters of each sample are kept in
+ * an array sorted by (ifindex, vni) and merged with those of the
+ * previous sample. The two arrays swap roles every tick so their memory
+ * is reused. With "top N" only the N busiest VNIs are printed.
+ */
+#define VNI_RATE_NUM	VNIFILTER_ENTRY_STATS_TX_ERRORS
+
+static const char * const vni_rate_names[VNI_RATE_NUM] = {
+	"rx_bytes_rate", "rx_pkts_rate", "rx_drops_rate", "rx_errors_rate",
+	"tx_bytes_rate", "tx_pkts_rate", "tx_drops_rate", "tx_errors_rate",
+};
+
+struct vni_sample {
+	int	ifindex;
+	__u32	vni;
+	__u64	val[VNI_RATE_NUM];
+};
+
+struct vni_samples {
+	struct vni_sample	*s;
+	unsigned int		n, size;
+};
+
+struct vni_rate {
+	int	ifindex;
+	__u32	vni;
+	double	val[VNI_RATE_NUM];
+};
+
+static int vni_rate_collect(struct nlmsghdr *n, void *arg)
+{
+	struct tunnel_msg *tmsg = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*tmsg));
+	struct vni_samples *cur = arg;
+	struct rtattr *t;
+
+	if (n->nlmsg_type != RTM_NEWTUNNEL || len < 0 ||
+	    tmsg->family != AF_BRIDGE)
+		return 0;
+
+	if (filter_index && filter_index != tmsg->ifindex)
+		return 0;
+
+	for (t = TUNNEL_RTA(tmsg); RTA_OK(t, len); t = RTA_NEXT(t, len)) {
+		struct rtattr *ttb[VXLAN_VNIFILTER_ENTRY_MAX+1];
+		struct rtattr *stb[VNIFILTER_ENTRY_STATS_MAX+1];
+		struct vni_sample *s;
+		int i;
+
+		if (rta_type(t) != VXLAN_VNIFILTER_ENTRY)
+			continue;
+
+		parse_rtattr_flags(ttb, VXLAN_VNIFILTER_ENTRY_MAX,
+				   RTA_DATA(t), RTA_PAYLOAD(t), NLA_F_NESTED);
+		/* counters come per VNI, never for a range */
+		if (!ttb[VXLAN_VNIFILTER_ENTRY_START] ||
+		    !ttb[VXLAN_VNIFILTER_ENTRY_STATS] ||
+		    (ttb[VXLAN_VNIFILTER_ENTRY_END] &&
+		     rta_getattr_u32(ttb[VXLAN_VNIFILTER_ENTRY_END]) !=
+		     rta_getattr_u32(ttb[VXLAN_VNIFILTER_ENTRY_START])))
+			continue;
+
+		if (cur->n == cur->size) {
+			unsigned int size = cur->size ? 2 * cur->size : 1024;
+
+			s = realloc(cur->s, size * sizeof(*s));
+			if (!s)
+				return -1;
+			cur->s = s;
+			cur->size = size;
+		}
+
+		parse_rtattr_flags(stb, VNIFILTER_ENTRY_STATS_MAX,
+				   RTA_DATA(ttb[VXLAN_VNIFILTER_ENTRY_STATS]),
+				   RTA_PAYLOAD(ttb[VXLAN_VNIFILTER_ENTRY_STATS]),
+				   NLA_F_NESTED);
+		s = &cur->s[cur->n++];
+		s->ifindex = tmsg->ifindex;
+		s->vni = rta_getattr_u32(ttb[VXLAN_VNIFILTER_ENTRY_START]);
+		for (i = 0; i < VNI_RATE_NUM; i++)
+			s->val[i] = stb[i + 1] ? rta_getattr_u64(stb[i + 1]) : 0;
+	}
+	return 0;
+}
+
+static int vni_sample_cmp(const void *a, const void *b)
+{
+	const struct vni_sample *x = a, *y = b;
+
+	if (x->ifindex != y->ifindex)
+		return x->ifindex < y->ifindex ? -1 : 1;
+	if (x->vni != y->vni)
+		return x->vni < y->vni ? -1 : 1;
+	return 0;
+}
+
+/* busiest first: bytes, then drops and errors */
+static int vni_rate_cmp(const void *a, const void *b)
+{
+	const struct vni_rate *x = a, *y = b;
+	double bx = x->val[0] + x->val[4], by = y->val[0] + y->val[4];
+	double ex = x->val[2] + x->val[3] + x->val[6] + x->val[7];
+	double ey = y->val[2] + y->val[3] + y->val[6] + y->val[7];
+
+	if (bx != by)
+		return bx > by ? -1 : 1;
+	if (ex != ey)
+		return ex > ey ? -1 : 1;
+	if (x->ifindex != y->ifindex)
+		return x->ifindex < y->ifindex ? -1 : 1;
+	return x->vni < y->vni ? -1 : x->vni > y->vni;
+}
+
+static void vni_rate_print(const struct vni_rate *r, unsigned int n)
+{
+	unsigned int i;
+	int j;
+
+	if (!is_json_context())
+		printf("%-" textify(IFNAMSIZ) "s  %-8s %12s %10s %8s %8s %12s %10s %8s %8s\n",
+		       "dev", "vni", "rx bytes/s", "pkts/s", "drops/s",
+		       "errors/s", "tx bytes/s", "pkts/s", "drops/s",
+		       "errors/s");
+
+	for (i = 0; i < n; i++) {
+		open_json_object(NULL);
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname",
+				   "%-" textify(IFNAMSIZ) "s  ",
+				   ll_index_to_name(r[i].ifindex));
+		print_uint(PRINT_ANY, "vni", "%-8u", r[i].vni);
+		for (j = 0; j < VNI_RATE_NUM; j++)
+			print_float(PRINT_ANY, vni_rate_names[j],
+				    j % 4 == 0 ? " %12.0f" :
+				    j % 4 == 1 ? " %10.0f" : " %8.0f",
+				    r[i].val[j]);
+		print_nl();
+		close_json_object();
+	}
+}
+
+static int vni_rate_sample(struct vni_samples *cur)
+{
+	cur->n = 0;
+	if (rtnl_tunneldump_req(&rth, PF_BRIDGE, filter_index,
+				TUNNEL_MSG_FLAG_STATS) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, vni_rate_collect, cur) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	qsort(cur->s, cur->n, sizeof(*cur->s), vni_sample_cmp);
+	return 0;
+}
+
+static int vni_rate_show(unsigned int interval, unsigned int count,
+			 unsigned int top)
+{
+	struct vni_samples a = {}, b = {}, *cur = &a, *prev = &b, *tmp;
+	struct vni_rate *rates = NULL;
+	unsigned int size = 0, i, j, k, n;
+	double last, next, now, secs;
+	int ret = -1;
+
+	last = next = monotonic_now();
+	if (vni_rate_sample(prev) < 0)
+		goto out;
+
+	for (i = 0; !count || i < count; i++) {
+		next += interval;
+		monotonic_sleep_until(next);
+		if (vni_rate_sample(cur) < 0)
+			goto out;
+		now = monotonic_now();
+		secs = now - last;
+		last = now;
+
+		if (cur->n > size) {
+			struct vni_rate *r = realloc(rates,
+						     cur->n * sizeof(*r));
+
+			if (!r) {
+				fprintf(stderr, "Out of memory\n");
+				goto out;
+			}
+			rates = r;
+			size = cur->n;
+		}
+
+		/* both are sorted, VNIs new since the last sample are skipped */
+		for (j = 0, k = 0, n = 0; j < cur->n; j++) {
+			const struct vni_sample *c = &cur->s[j];
+			int m;
+
+			while (k < prev->n && vni_sample_cmp(&prev->s[k], c) < 0)
+				k++;
+			if (k == prev->n || vni_sample_cmp(&prev->s[k], c))
+				continue;
+
+			rates[n].ifindex = c->ifindex;
+			rates[n].vni = c->vni;
+			for (m = 0; m < VNI_RATE_NUM; m++) {
+				__u64 p = prev->s[k].val[m];
+
+				/* counters start over if the VNI was re-added */
+				rates[n].val[m] = (c->val[m] >= p ?
+						   c->val[m] - p : c->val[m]) /
+						  secs;
+			}
+			n++;
+		}
+
+		if (top) {
+			qsort(rates, n, sizeof(*rates), vni_rate_cmp);
+			n = MIN(n, top);
+		}
+
+		new_json_obj(json);
+		vni_rate_print(rates, n);
+		delete_json_obj();
+		if (!json)
+			printf("\n");
+		fflush(stdout);
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+	ret = 0;
+out:
+	free(rates);
+	free(a.s);
+	free(b.s);
+	return ret;
+}
+
 static int vni_show(int argc, char **argv)
 {
+	unsigned int interval = 0, count = 0, top = 0;
 	char *filter_dev = NULL;
 	__u8 flags = 0;
 	int ret = 0;
@@ -349,6 +880,18 @@ static int vni_show(int argc, char **argv)
 			if (filter_dev)
 				duparg("dev", *argv);
 			filter_dev = *argv;
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("invalid interval", *argv);
+		} else if (strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0) || !count)
+				invarg("invalid count", *argv);
+		} else if (strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&top, *argv, 0) || !top)
+				invarg("invalid top", *argv);
 		}
 		argc--; argv++;
 	}
@@ -359,6 +902,9 @@ static int vni_show(int argc, char **argv)
 			return nodev(filter_dev);
 	}
 
+	if (interval)
+		return vni_rate_show(interval, count, top);
+
 	new_json_obj(json);
 
 	if (show_stats)
@@ -396,6 +942,8 @@ int do_vni(int argc, char **argv)
 		if (strcmp(*argv, "delete") == 0 ||
 		    strcmp(*argv, "del") == 0)
 			return vni_modify(RTM_DELTUNNEL, argc-1, argv+1);
+		if (strcmp(*argv, "sync") == 0)
+			return vni_sync(argc-1, argv+1);
 		if (strcmp(*argv, "show") == 0 ||
 		    strcmp(*argv, "lst") == 0 ||
 		    strcmp(*argv, "list") == 0)
@@ -470,8 +470,8 @@ static void dcb_help(void)
 	fprintf(stderr,
 		"Usage: dcb [ OPTIONS ] OBJECT { COMMAND | help }\n"
 		"       dcb [ -f | --force ] { -b | --batch } filename [ -n | --netns ] netnsname\n"
-		"where  OBJECT := { app | apptrust | buffer | dcbx | ets | maxrate | pfc | rewr }\n"
-		"       OPTIONS := [ -V | --Version | -i | --iec | -j | --json\n"
+		"where  OBJECT := { app | apptrust | buffer | dcbx | ets | maxrate | pfc | profile | rewr }\n"
+		"       OPTIONS := [ -V | --Version | -i | --iec | -j | --json | --jsonl\n"
 		"                  | -N | --Numeric | -p | --pretty\n"
 		"                  | -s | --statistics | -v | --verbose]\n");
 }
@@ -497,6 +497,8 @@ static int dcb_cmd(struct dcb *dcb, int argc, char **argv)
 		return dcb_cmd_maxrate(dcb, argc - 1, argv + 1);
 	} else if (matches(*argv, "pfc") == 0) {
 		return dcb_cmd_pfc(dcb, argc - 1, argv + 1);
+	} else if (strcmp(*argv, "profile") == 0) {
+		return dcb_cmd_profile(dcb, argc - 1, argv + 1);
 	}
 
 	fprintf(stderr, "Object \"%s\" is unknown\n", *argv);
@@ -523,6 +525,7 @@ int main(int argc, char **argv)
 		{ "batch",		required_argument,	NULL, 'b' },
 		{ "iec",		no_argument,		NULL, 'i' },
 		{ "json",		no_argument,		NULL, 'j' },
+		{ "jsonl",		no_argument,		NULL, 'l' },
 		{ "Numeric",		no_argument,		NULL, 'N' },
 		{ "pretty",		no_argument,		NULL, 'p' },
 		{ "statistics",		no_argument,		NULL, 's' },
@@ -560,6 +563,11 @@ int main(int argc, char **argv)
 		case 'j':
 			dcb->json_output = true;
 			break;
+		case 'l':
+			/* one object per line, for "pfc watch" */
+			dcb->json_output = true;
+			json_lines = 1;
+			break;
 		case 'N':
 			dcb->numeric = true;
 			break;
@@ -78,6 +78,10 @@ struct dcb_app_parse_mapping {
 int dcb_cmd_app(struct dcb *dcb, int argc, char **argv);
 
 int dcb_app_get(struct dcb *dcb, const char *dev, struct dcb_app_table *tab);
+int dcb_app_table_parse(struct dcb_app_table *tab, const void *payload,
+			__u16 payload_len);
+int dcb_cmd_app_parse_add_del(struct dcb *dcb, const char *dev,
+			      int argc, char **argv, struct dcb_app_table *tab);
 int dcb_app_add_del(struct dcb *dcb, const char *dev, int command,
 		    const struct dcb_app_table *tab,
 		    bool (*filter)(const struct dcb_app *));
@@ -121,7 +125,10 @@ int dcb_cmd_apptrust(struct dcb *dcb, int argc, char **argv);
 
 /* dcb_buffer.c */
 
+struct dcbnl_buffer;
+
 int dcb_cmd_buffer(struct dcb *dcb, int argc, char **argv);
+int dcb_buffer_parse(int argc, char **argv, struct dcbnl_buffer *buffer);
 
 /* dcb_dcbx.c */
 
@@ -129,14 +136,28 @@ int dcb_cmd_dcbx(struct dcb *dcb, int argc, char **argv);
 
 /* dcb_ets.c */
 
+struct ieee_ets;
+
 int dcb_cmd_ets(struct dcb *dcb, int argc, char **argv);
+int dcb_ets_parse(int argc, char **argv, struct ieee_ets *ets);
+int dcb_ets_validate(const struct ieee_ets *ets);
 
 /* dcb_maxrate.c */
 
+struct ieee_maxrate;
+
 int dcb_cmd_maxrate(struct dcb *dcb, int argc, char **argv);
+int dcb_maxrate_parse(int argc, char **argv, struct ieee_maxrate *maxrate);
 
 /* dcb_pfc.c */
 
+struct ieee_pfc;
+
 int dcb_cmd_pfc(struct dcb *dcb, int argc, char **argv);
+int dcb_pfc_parse(int argc, char **argv, struct ieee_pfc *pfc);
+
+/* dcb_profile.c */
+
+int dcb_cmd_profile(struct dcb *dcb, int argc, char **argv);
 
 #endif /* __DCB_H__ */
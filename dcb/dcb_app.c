@@ -587,6 +587,18 @@ static int dcb_app_get_table_attr_cb(const struct nlattr *attr, void *data)
 	return MNL_CB_OK;
 }
 
+int dcb_app_table_parse(struct dcb_app_table *tab, const void *payload,
+			__u16 payload_len)
+{
+	int ret;
+
+	ret = mnl_attr_parse_payload(payload, payload_len, dcb_app_get_table_attr_cb, tab);
+	if (ret != MNL_CB_OK)
+		return -EINVAL;
+
+	return 0;
+}
+
 int dcb_app_get(struct dcb *dcb, const char *dev, struct dcb_app_table *tab)
 {
 	uint16_t payload_len;
@@ -597,11 +609,7 @@ int dcb_app_get(struct dcb *dcb, const char *dev, struct dcb_app_table *tab)
 	if (ret != 0)
 		return ret;
 
-	ret = mnl_attr_parse_payload(payload, payload_len, dcb_app_get_table_attr_cb, tab);
-	if (ret != MNL_CB_OK)
-		return -EINVAL;
-
-	return 0;
+	return dcb_app_table_parse(tab, payload, payload_len);
 }
 
 struct dcb_app_add_del {
@@ -645,8 +653,8 @@ int dcb_app_add_del(struct dcb *dcb, const char *dev, int command,
 	return dcb_set_attribute_va(dcb, command, dev, dcb_app_add_del_cb, &add_del);
 }
 
-static int dcb_cmd_app_parse_add_del(struct dcb *dcb, const char *dev,
-				     int argc, char **argv, struct dcb_app_table *tab)
+int dcb_cmd_app_parse_add_del(struct dcb *dcb, const char *dev,
+			      int argc, char **argv, struct dcb_app_table *tab)
 {
 	struct dcb_app_parse_mapping pm = {
 		.tab = tab,
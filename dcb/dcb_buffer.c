@@ -123,28 +123,21 @@ static int dcb_buffer_set(struct dcb *dcb, const char *dev, const struct dcbnl_b
 	return dcb_set_attribute(dcb, dev, DCB_ATTR_DCB_BUFFER, buffer, sizeof(*buffer));
 }
 
-static int dcb_cmd_buffer_set(struct dcb *dcb, const char *dev, int argc, char **argv)
+/* Parse the arguments of "buffer set" into @buffer. Returns 1 if help was
+ * asked for and printed.
+ */
+int dcb_buffer_parse(int argc, char **argv, struct dcbnl_buffer *buffer)
 {
-	struct dcbnl_buffer buffer;
 	int ret;
 
-	if (!argc) {
-		dcb_buffer_help_set();
-		return 0;
-	}
-
-	ret = dcb_buffer_get(dcb, dev, &buffer);
-	if (ret)
-		return ret;
-
 	do {
 		if (matches(*argv, "help") == 0) {
 			dcb_buffer_help_set();
-			return 0;
+			return 1;
 		} else if (matches(*argv, "prio-buffer") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true,
-					    &dcb_buffer_parse_mapping_prio_buffer, &buffer);
+					    &dcb_buffer_parse_mapping_prio_buffer, buffer);
 			if (ret) {
 				fprintf(stderr, "Invalid priority mapping %s\n", *argv);
 				return ret;
@@ -153,7 +146,7 @@ static int dcb_cmd_buffer_set(struct dcb *dcb, const char *dev, int argc, char *
 		} else if (matches(*argv, "buffer-size") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true,
-					    &dcb_buffer_parse_mapping_buffer_size, &buffer);
+					    &dcb_buffer_parse_mapping_buffer_size, buffer);
 			if (ret) {
 				fprintf(stderr, "Invalid buffer size mapping %s\n", *argv);
 				return ret;
@@ -168,6 +161,27 @@ static int dcb_cmd_buffer_set(struct dcb *dcb, const char *dev, int argc, char *
 		NEXT_ARG_FWD();
 	} while (argc > 0);
 
+	return 0;
+}
+
+static int dcb_cmd_buffer_set(struct dcb *dcb, const char *dev, int argc, char **argv)
+{
+	struct dcbnl_buffer buffer;
+	int ret;
+
+	if (!argc) {
+		dcb_buffer_help_set();
+		return 0;
+	}
+
+	ret = dcb_buffer_get(dcb, dev, &buffer);
+	if (ret)
+		return ret;
+
+	ret = dcb_buffer_parse(argc, argv, &buffer);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	return dcb_buffer_set(dcb, dev, &buffer);
 }
 
@@ -242,7 +242,7 @@ static int dcb_ets_validate_bw(const __u8 bw[], const __u8 tsa[], const char *wh
 	return -EINVAL;
 }
 
-static int dcb_ets_set(struct dcb *dcb, const char *dev, const struct ieee_ets *ets)
+int dcb_ets_validate(const struct ieee_ets *ets)
 {
 	/* Do not validate pg-bw, which is not standard and has unclear
 	 * meaning.
@@ -250,37 +250,37 @@ static int dcb_ets_set(struct dcb *dcb, const char *dev, const struct ieee_ets *
 	if (dcb_ets_validate_bw(ets->tc_tx_bw, ets->tc_tsa, "tc-bw") ||
 	    dcb_ets_validate_bw(ets->tc_reco_bw, ets->tc_reco_tsa, "reco-tc-bw"))
 		return -EINVAL;
+	return 0;
+}
+
+static int dcb_ets_set(struct dcb *dcb, const char *dev, const struct ieee_ets *ets)
+{
+	if (dcb_ets_validate(ets))
+		return -EINVAL;
 
 	return dcb_set_attribute(dcb, dev, DCB_ATTR_IEEE_ETS, ets, sizeof(*ets));
 }
 
-static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **argv)
+/* Parse the arguments of "ets set" into @ets. Returns 1 if help was
+ * asked for and printed.
+ */
+int dcb_ets_parse(int argc, char **argv, struct ieee_ets *ets)
 {
-	struct ieee_ets ets;
 	int ret;
 
-	if (!argc) {
-		dcb_ets_help_set();
-		return 1;
-	}
-
-	ret = dcb_ets_get(dcb, dev, &ets);
-	if (ret)
-		return ret;
-
 	do {
 		if (matches(*argv, "help") == 0) {
 			dcb_ets_help_set();
-			return 0;
+			return 1;
 		} else if (matches(*argv, "willing") == 0) {
 			NEXT_ARG();
-			ets.willing = parse_on_off("willing", *argv, &ret);
+			ets->willing = parse_on_off("willing", *argv, &ret);
 			if (ret)
 				return ret;
 		} else if (matches(*argv, "tc-tsa") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true, &dcb_ets_parse_mapping_tc_tsa,
-					    ets.tc_tsa);
+					    ets->tc_tsa);
 			if (ret) {
 				fprintf(stderr, "Invalid tc-tsa mapping %s\n", *argv);
 				return ret;
@@ -289,7 +289,7 @@ static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **ar
 		} else if (matches(*argv, "reco-tc-tsa") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true, &dcb_ets_parse_mapping_tc_tsa,
-					    ets.tc_reco_tsa);
+					    ets->tc_reco_tsa);
 			if (ret) {
 				fprintf(stderr, "Invalid reco-tc-tsa mapping %s\n", *argv);
 				return ret;
@@ -298,7 +298,7 @@ static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **ar
 		} else if (matches(*argv, "tc-bw") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true, &dcb_ets_parse_mapping_tc_bw,
-					    ets.tc_tx_bw);
+					    ets->tc_tx_bw);
 			if (ret) {
 				fprintf(stderr, "Invalid tc-bw mapping %s\n", *argv);
 				return ret;
@@ -307,7 +307,7 @@ static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **ar
 		} else if (matches(*argv, "pg-bw") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true, &dcb_ets_parse_mapping_tc_bw,
-					    ets.tc_rx_bw);
+					    ets->tc_rx_bw);
 			if (ret) {
 				fprintf(stderr, "Invalid pg-bw mapping %s\n", *argv);
 				return ret;
@@ -316,7 +316,7 @@ static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **ar
 		} else if (matches(*argv, "reco-tc-bw") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true, &dcb_ets_parse_mapping_tc_bw,
-					    ets.tc_reco_bw);
+					    ets->tc_reco_bw);
 			if (ret) {
 				fprintf(stderr, "Invalid reco-tc-bw mapping %s\n", *argv);
 				return ret;
@@ -325,7 +325,7 @@ static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **ar
 		} else if (matches(*argv, "prio-tc") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true, &dcb_ets_parse_mapping_prio_tc,
-					    ets.prio_tc);
+					    ets->prio_tc);
 			if (ret) {
 				fprintf(stderr, "Invalid prio-tc mapping %s\n", *argv);
 				return ret;
@@ -334,7 +334,7 @@ static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **ar
 		} else if (matches(*argv, "reco-prio-tc") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true, &dcb_ets_parse_mapping_prio_tc,
-					    ets.reco_prio_tc);
+					    ets->reco_prio_tc);
 			if (ret) {
 				fprintf(stderr, "Invalid reco-prio-tc mapping %s\n", *argv);
 				return ret;
@@ -349,6 +349,27 @@ static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **ar
 		NEXT_ARG_FWD();
 	} while (argc > 0);
 
+	return 0;
+}
+
+static int dcb_cmd_ets_set(struct dcb *dcb, const char *dev, int argc, char **argv)
+{
+	struct ieee_ets ets;
+	int ret;
+
+	if (!argc) {
+		dcb_ets_help_set();
+		return 1;
+	}
+
+	ret = dcb_ets_get(dcb, dev, &ets);
+	if (ret)
+		return ret;
+
+	ret = dcb_ets_parse(argc, argv, &ets);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	return dcb_ets_set(dcb, dev, &ets);
 }
 
@@ -98,28 +98,21 @@ static int dcb_maxrate_set(struct dcb *dcb, const char *dev, const struct ieee_m
 	return dcb_set_attribute(dcb, dev, DCB_ATTR_IEEE_MAXRATE, maxrate, sizeof(*maxrate));
 }
 
-static int dcb_cmd_maxrate_set(struct dcb *dcb, const char *dev, int argc, char **argv)
+/* Parse the arguments of "maxrate set" into @maxrate. Returns 1 if help was
+ * asked for and printed.
+ */
+int dcb_maxrate_parse(int argc, char **argv, struct ieee_maxrate *maxrate)
 {
-	struct ieee_maxrate maxrate;
 	int ret;
 
-	if (!argc) {
-		dcb_maxrate_help_set();
-		return 0;
-	}
-
-	ret = dcb_maxrate_get(dcb, dev, &maxrate);
-	if (ret)
-		return ret;
-
 	do {
 		if (matches(*argv, "help") == 0) {
 			dcb_maxrate_help_set();
-			return 0;
+			return 1;
 		} else if (matches(*argv, "tc-maxrate") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true,
-					    &dcb_maxrate_parse_mapping_tc_maxrate, &maxrate);
+					    &dcb_maxrate_parse_mapping_tc_maxrate, maxrate);
 			if (ret) {
 				fprintf(stderr, "Invalid mapping %s\n", *argv);
 				return ret;
@@ -134,6 +127,27 @@ static int dcb_cmd_maxrate_set(struct dcb *dcb, const char *dev, int argc, char
 		NEXT_ARG_FWD();
 	} while (argc > 0);
 
+	return 0;
+}
+
+static int dcb_cmd_maxrate_set(struct dcb *dcb, const char *dev, int argc, char **argv)
+{
+	struct ieee_maxrate maxrate;
+	int ret;
+
+	if (!argc) {
+		dcb_maxrate_help_set();
+		return 0;
+	}
+
+	ret = dcb_maxrate_get(dcb, dev, &maxrate);
+	if (ret)
+		return ret;
+
+	ret = dcb_maxrate_parse(argc, argv, &maxrate);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	return dcb_maxrate_set(dcb, dev, &maxrate);
 }
 
@@ -1,7 +1,10 @@
 // SPDX-License-Identifier: GPL-2.0+
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <linux/dcbnl.h>
 
 #include "dcb.h"
@@ -33,6 +36,18 @@ static void dcb_pfc_help_show(void)
 	);
 }
 
+static void dcb_pfc_help_watch(void)
+{
+	fprintf(stderr,
+		"Usage: dcb pfc watch dev STRING [ dev STRING ... ]\n"
+		"           [ interval SECONDS ] [ count COUNT ] [ ceiling RATE ]\n"
+		"\n"
+		" where SECONDS may be a fraction, e.g. 0.1\n"
+		"       RATE is in pause frames per second per priority\n"
+		"\n"
+	);
+}
+
 static void dcb_pfc_help(void)
 {
 	fprintf(stderr,
@@ -41,6 +56,7 @@ static void dcb_pfc_help(void)
 	);
 	dcb_pfc_help_show();
 	dcb_pfc_help_set();
+	dcb_pfc_help_watch();
 }
 
 static void dcb_pfc_to_array(__u8 array[IEEE_8021QAZ_MAX_TCS], __u8 pfc_en)
@@ -156,28 +172,21 @@ static int dcb_pfc_set(struct dcb *dcb, const char *dev, const struct ieee_pfc *
 	return dcb_set_attribute(dcb, dev, DCB_ATTR_IEEE_PFC, pfc, sizeof(*pfc));
 }
 
-static int dcb_cmd_pfc_set(struct dcb *dcb, const char *dev, int argc, char **argv)
+/* Parse the arguments of "pfc set" into @pfc. Returns 1 if help was
+ * asked for and printed.
+ */
+int dcb_pfc_parse(int argc, char **argv, struct ieee_pfc *pfc)
 {
-	struct ieee_pfc pfc;
 	int ret;
 
-	if (!argc) {
-		dcb_pfc_help_set();
-		return 0;
-	}
-
-	ret = dcb_pfc_get(dcb, dev, &pfc);
-	if (ret)
-		return ret;
-
 	do {
 		if (matches(*argv, "help") == 0) {
 			dcb_pfc_help_set();
-			return 0;
+			return 1;
 		} else if (matches(*argv, "prio-pfc") == 0) {
 			NEXT_ARG();
 			ret = parse_mapping(&argc, &argv, true,
-					    &dcb_pfc_parse_mapping_prio_pfc, &pfc);
+					    &dcb_pfc_parse_mapping_prio_pfc, pfc);
 			if (ret) {
 				fprintf(stderr, "Invalid pfc mapping %s\n", *argv);
 				return ret;
@@ -185,7 +194,7 @@ static int dcb_cmd_pfc_set(struct dcb *dcb, const char *dev, int argc, char **ar
 			continue;
 		} else if (matches(*argv, "macsec-bypass") == 0) {
 			NEXT_ARG();
-			pfc.mbc = parse_on_off("macsec-bypass", *argv, &ret);
+			pfc->mbc = parse_on_off("macsec-bypass", *argv, &ret);
 			if (ret)
 				return ret;
 		} else if (matches(*argv, "delay") == 0) {
@@ -196,7 +205,7 @@ static int dcb_cmd_pfc_set(struct dcb *dcb, const char *dev, int argc, char **ar
 			 * be confusing that 10Kbit does not mean 10240,
 			 * but 1280.
 			 */
-			if (get_u16(&pfc.delay, *argv, 0)) {
+			if (get_u16(&pfc->delay, *argv, 0)) {
 				fprintf(stderr, "Invalid delay `%s', expected an integer 0..65535\n",
 					*argv);
 				return -EINVAL;
@@ -210,6 +219,27 @@ static int dcb_cmd_pfc_set(struct dcb *dcb, const char *dev, int argc, char **ar
 		NEXT_ARG_FWD();
 	} while (argc > 0);
 
+	return 0;
+}
+
+static int dcb_cmd_pfc_set(struct dcb *dcb, const char *dev, int argc, char **argv)
+{
+	struct ieee_pfc pfc;
+	int ret;
+
+	if (!argc) {
+		dcb_pfc_help_set();
+		return 0;
+	}
+
+	ret = dcb_pfc_get(dcb, dev, &pfc);
+	if (ret)
+		return ret;
+
+	ret = dcb_pfc_parse(argc, argv, &pfc);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	return dcb_pfc_set(dcb, dev, &pfc);
 }
 
@@ -265,6 +295,178 @@ out:
 	return 0;
 }
 
+struct dcb_pfc_watch_dev {
+	const char *name;
+	struct ieee_pfc prev;
+};
+
+static __u64 dcb_pfc_delta(__u64 cur, __u64 prev)
+{
+	/* a counter that went back was reset, count from zero */
+	return cur >= prev ? cur - prev : cur;
+}
+
+static void dcb_pfc_print_rates(const char *json_name, const char *fp_name,
+				const __u64 *rates)
+{
+	open_json_array(PRINT_JSON, json_name);
+	print_string(PRINT_FP, NULL, "%s ", fp_name);
+	dcb_print_array_u64(rates, IEEE_8021QAZ_MAX_TCS);
+	close_json_array(PRINT_JSON, json_name);
+}
+
+static void dcb_pfc_watch_print(struct dcb_pfc_watch_dev *d,
+				const struct ieee_pfc *pfc, double secs,
+				__u64 ceiling)
+{
+	__u64 requests[IEEE_8021QAZ_MAX_TCS];
+	__u64 indications[IEEE_8021QAZ_MAX_TCS];
+	bool alert = false;
+	int i;
+
+	for (i = 0; i < IEEE_8021QAZ_MAX_TCS; i++) {
+		requests[i] = dcb_pfc_delta(pfc->requests[i],
+					    d->prev.requests[i]) / secs + .5;
+		indications[i] = dcb_pfc_delta(pfc->indications[i],
+					       d->prev.indications[i]) / secs + .5;
+		if (ceiling && (requests[i] > ceiling || indications[i] > ceiling))
+			alert = true;
+	}
+
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "dev", "%s ", d->name);
+	print_float(PRINT_JSON, "interval", NULL, secs);
+	dcb_pfc_print_rates("requests_rate", "requests/s", requests);
+	dcb_pfc_print_rates("indications_rate", "indications/s", indications);
+	print_nl();
+
+	if (alert) {
+		open_json_array(PRINT_JSON, "alert");
+		for (i = 0; i < IEEE_8021QAZ_MAX_TCS; i++) {
+			if (requests[i] <= ceiling && indications[i] <= ceiling)
+				continue;
+			print_uint(PRINT_JSON, NULL, NULL, i);
+			print_string(PRINT_FP, NULL, "%s ", d->name);
+			print_uint(PRINT_FP, NULL, "ALERT prio %u ", i);
+			print_u64(PRINT_FP, NULL, "requests %" PRIu64 "/s ", requests[i]);
+			print_u64(PRINT_FP, NULL, "indications %" PRIu64 "/s ",
+				  indications[i]);
+			print_u64(PRINT_FP, NULL, "above ceiling %" PRIu64 "/s",
+				  ceiling);
+			print_nl();
+		}
+		close_json_array(PRINT_JSON, NULL);
+	}
+	close_json_object();
+}
+
+/*
+ * Sample the PFC counters of every device once per interval, all on the
+ * one netlink socket, and print per priority rates. The rates are taken
+ * over the time that actually passed between two reads of a device.
+ */
+static int dcb_cmd_pfc_watch(struct dcb *dcb, int argc, char **argv)
+{
+	struct dcb_pfc_watch_dev *devs = NULL, *d;
+	double interval = 1, deadline, *stamps = NULL;
+	unsigned int count = 0, n = 0, i, sample;
+	__u64 ceiling = 0;
+	char *end;
+	int ret;
+
+	while (argc > 0) {
+		if (matches(*argv, "help") == 0) {
+			dcb_pfc_help_watch();
+			ret = 0;
+			goto out;
+		} else if (matches(*argv, "dev") == 0) {
+			NEXT_ARG();
+			d = realloc(devs, (n + 1) * sizeof(*devs));
+			if (!d) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			devs = d;
+			devs[n++].name = *argv;
+		} else if (matches(*argv, "interval") == 0) {
+			NEXT_ARG();
+			interval = strtod(*argv, &end);
+			if (*end || !(interval > 0)) {
+				fprintf(stderr, "Invalid interval \"%s\"\n", *argv);
+				ret = -EINVAL;
+				goto out;
+			}
+		} else if (matches(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0) || !count) {
+				fprintf(stderr, "Invalid count \"%s\"\n", *argv);
+				ret = -EINVAL;
+				goto out;
+			}
+		} else if (matches(*argv, "ceiling") == 0) {
+			NEXT_ARG();
+			if (get_u64(&ceiling, *argv, 0)) {
+				fprintf(stderr, "Invalid ceiling \"%s\"\n", *argv);
+				ret = -EINVAL;
+				goto out;
+			}
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			dcb_pfc_help_watch();
+			ret = -EINVAL;
+			goto out;
+		}
+		NEXT_ARG_FWD();
+	}
+
+	if (!n) {
+		fprintf(stderr, "At least one dev is needed\n");
+		dcb_pfc_help_watch();
+		ret = -EINVAL;
+		goto out;
+	}
+
+	stamps = calloc(n, sizeof(*stamps));
+	if (!stamps) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		ret = dcb_pfc_get(dcb, devs[i].name, &devs[i].prev);
+		if (ret)
+			goto out;
+		stamps[i] = monotonic_now();
+	}
+
+	deadline = monotonic_now();
+	for (sample = 0; !count || sample < count; sample++) {
+		deadline += interval;
+		monotonic_sleep_until(deadline);
+
+		for (i = 0; i < n; i++) {
+			struct ieee_pfc pfc;
+			double now;
+
+			ret = dcb_pfc_get(dcb, devs[i].name, &pfc);
+			if (ret)
+				goto out;
+			now = monotonic_now();
+			dcb_pfc_watch_print(&devs[i], &pfc, now - stamps[i],
+					    ceiling);
+			devs[i].prev = pfc;
+			stamps[i] = now;
+		}
+		fflush(stdout);
+	}
+	ret = 0;
+
+out:
+	free(stamps);
+	free(devs);
+	return ret;
+}
+
 int dcb_cmd_pfc(struct dcb *dcb, int argc, char **argv)
 {
 	if (!argc || matches(*argv, "help") == 0) {
@@ -278,6 +480,9 @@ int dcb_cmd_pfc(struct dcb *dcb, int argc, char **argv)
 		NEXT_ARG_FWD();
 		return dcb_cmd_parse_dev(dcb, argc, argv,
 					 dcb_cmd_pfc_set, dcb_pfc_help_set);
+	} else if (matches(*argv, "watch") == 0) {
+		NEXT_ARG_FWD();
+		return dcb_cmd_pfc_watch(dcb, argc, argv);
 	} else {
 		fprintf(stderr, "What is \"%s\"?\n", *argv);
 		dcb_pfc_help();
@@ -0,0 +1,658 @@
+// SPDX-License-Identifier: GPL-2.0+
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <net/if.h>
+#include <linux/dcbnl.h>
+#include <linux/rtnetlink.h>
+#include <libmnl/libmnl.h>
+
+#include "dcb.h"
+#include "mnl_utils.h"
+#include "utils.h"
+
+/*
+ * A profile is a file of "dcb OBJECT set" argument lines without the
+ * "set dev DEV", e.g. "ets tc-tsa all:ets tc-bw 0:50 1:50", applied on
+ * top of the current state of every device given. For app, the lines
+ * take the arguments of "dcb app replace".
+ *
+ * The state of all devices is read with one DCB_CMD_IEEE_GET each, which
+ * reports every IEEE object at once, and these requests are sent back
+ * to back on the socket before any answer is read. Each device then gets
+ * at most one DCB_CMD_IEEE_SET, with only the objects that differ from
+ * the profile, and a DCB_CMD_IEEE_DEL for APP entries the profile
+ * replaces. "verify" reports the differences and writes nothing.
+ */
+
+static void dcb_profile_help(void)
+{
+	fprintf(stderr,
+		"Usage: dcb profile { apply | verify } file FILE dev DEV [ dev DEV ... ]\n"
+		"\n"
+		" where FILE holds lines of OBJECT ARGS, with the ARGS of\n"
+		"       dcb { ets | pfc | buffer | maxrate } set dev DEV ARGS\n"
+		"       dcb app replace dev DEV ARGS\n"
+		"\n"
+	);
+}
+
+enum {
+	DCB_PROFILE_ETS,
+	DCB_PROFILE_PFC,
+	DCB_PROFILE_BUFFER,
+	DCB_PROFILE_MAXRATE,
+	DCB_PROFILE_APP,
+	DCB_PROFILE_OBJS,
+};
+
+struct dcb_profile_state {
+	struct ieee_ets ets;
+	struct ieee_pfc pfc;
+	struct dcbnl_buffer buffer;
+	struct ieee_maxrate maxrate;
+	struct dcb_app_table apps;
+	unsigned int have;	/* objects the device reported */
+};
+
+struct dcb_profile_field {
+	const char *name;
+	size_t off;
+	size_t len;
+};
+
+#define DCB_PROFILE_FIELD(type, name, member)			\
+	{ name, offsetof(struct type, member),			\
+	  sizeof(((struct type *)0)->member) }
+
+/* The fields "set" can change; capabilities and counters are left out */
+static const struct dcb_profile_field dcb_profile_ets_fields[] = {
+	DCB_PROFILE_FIELD(ieee_ets, "willing", willing),
+	DCB_PROFILE_FIELD(ieee_ets, "tc-tsa", tc_tsa),
+	DCB_PROFILE_FIELD(ieee_ets, "reco-tc-tsa", tc_reco_tsa),
+	DCB_PROFILE_FIELD(ieee_ets, "pg-bw", tc_rx_bw),
+	DCB_PROFILE_FIELD(ieee_ets, "tc-bw", tc_tx_bw),
+	DCB_PROFILE_FIELD(ieee_ets, "reco-tc-bw", tc_reco_bw),
+	DCB_PROFILE_FIELD(ieee_ets, "prio-tc", prio_tc),
+	DCB_PROFILE_FIELD(ieee_ets, "reco-prio-tc", reco_prio_tc),
+	{ NULL }
+};
+
+static const struct dcb_profile_field dcb_profile_pfc_fields[] = {
+	DCB_PROFILE_FIELD(ieee_pfc, "prio-pfc", pfc_en),
+	DCB_PROFILE_FIELD(ieee_pfc, "macsec-bypass", mbc),
+	DCB_PROFILE_FIELD(ieee_pfc, "delay", delay),
+	{ NULL }
+};
+
+static const struct dcb_profile_field dcb_profile_buffer_fields[] = {
+	DCB_PROFILE_FIELD(dcbnl_buffer, "prio-buffer", prio2buffer),
+	DCB_PROFILE_FIELD(dcbnl_buffer, "buffer-size", buffer_size),
+	{ NULL }
+};
+
+static const struct dcb_profile_field dcb_profile_maxrate_fields[] = {
+	DCB_PROFILE_FIELD(ieee_maxrate, "tc-maxrate", tc_maxrate),
+	{ NULL }
+};
+
+static int dcb_profile_parse_ets(int argc, char **argv, void *data)
+{
+	return dcb_ets_parse(argc, argv, data);
+}
+
+static int dcb_profile_parse_pfc(int argc, char **argv, void *data)
+{
+	return dcb_pfc_parse(argc, argv, data);
+}
+
+static int dcb_profile_parse_buffer(int argc, char **argv, void *data)
+{
+	return dcb_buffer_parse(argc, argv, data);
+}
+
+static int dcb_profile_parse_maxrate(int argc, char **argv, void *data)
+{
+	return dcb_maxrate_parse(argc, argv, data);
+}
+
+static const struct dcb_profile_obj {
+	const char *name;
+	int attr;
+	size_t off;	/* in struct dcb_profile_state */
+	size_t len;
+	int (*parse)(int argc, char **argv, void *data);
+	const struct dcb_profile_field *fields;
+} dcb_profile_objs[DCB_PROFILE_OBJS] = {
+	[DCB_PROFILE_ETS] = {
+		"ets", DCB_ATTR_IEEE_ETS,
+		offsetof(struct dcb_profile_state, ets), sizeof(struct ieee_ets),
+		dcb_profile_parse_ets, dcb_profile_ets_fields,
+	},
+	[DCB_PROFILE_PFC] = {
+		"pfc", DCB_ATTR_IEEE_PFC,
+		offsetof(struct dcb_profile_state, pfc), sizeof(struct ieee_pfc),
+		dcb_profile_parse_pfc, dcb_profile_pfc_fields,
+	},
+	[DCB_PROFILE_BUFFER] = {
+		"buffer", DCB_ATTR_DCB_BUFFER,
+		offsetof(struct dcb_profile_state, buffer),
+		sizeof(struct dcbnl_buffer),
+		dcb_profile_parse_buffer, dcb_profile_buffer_fields,
+	},
+	[DCB_PROFILE_MAXRATE] = {
+		"maxrate", DCB_ATTR_IEEE_MAXRATE,
+		offsetof(struct dcb_profile_state, maxrate),
+		sizeof(struct ieee_maxrate),
+		dcb_profile_parse_maxrate, dcb_profile_maxrate_fields,
+	},
+	[DCB_PROFILE_APP] = {
+		"app", DCB_ATTR_IEEE_APP_TABLE,
+	},
+};
+
+struct dcb_profile_line {
+	int obj;
+	int argc;
+	char **argv;
+};
+
+struct dcb_profile {
+	struct dcb *dcb;
+	struct dcb_profile_line *lines;
+	size_t n_lines;
+	unsigned int objs;	/* objects the profile sets */
+};
+
+struct dcb_profile_dev {
+	const char *name;
+	struct dcb_profile_state cur;
+	bool done;
+	int err;
+};
+
+static void dcb_profile_argv_free(int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < argc; i++)
+		free(argv[i]);
+	free(argv);
+}
+
+/* The parsers write into their arguments, so each run gets a copy */
+static char **dcb_profile_argv_dup(int argc, char **argv)
+{
+	char **copy;
+	int i;
+
+	copy = calloc(argc + 1, sizeof(*copy));
+	if (!copy)
+		return NULL;
+	for (i = 0; i < argc; i++) {
+		copy[i] = strdup(argv[i]);
+		if (!copy[i]) {
+			dcb_profile_argv_free(i, copy);
+			return NULL;
+		}
+	}
+	return copy;
+}
+
+/* Apply one profile line to @st, or to @apps for app lines */
+static int dcb_profile_line_run(struct dcb *dcb, const char *dev,
+				const struct dcb_profile_line *line,
+				struct dcb_profile_state *st,
+				struct dcb_app_table *apps)
+{
+	const struct dcb_profile_obj *o = &dcb_profile_objs[line->obj];
+	char **argv;
+	int ret;
+
+	argv = dcb_profile_argv_dup(line->argc, line->argv);
+	if (!argv)
+		return -ENOMEM;
+
+	if (line->obj == DCB_PROFILE_APP)
+		ret = dcb_cmd_app_parse_add_del(dcb, dev, line->argc, argv, apps);
+	else
+		ret = o->parse(line->argc, argv, (char *)st + o->off);
+
+	dcb_profile_argv_free(line->argc, argv);
+	return ret;
+}
+
+static int dcb_profile_load_line(int argc, char *argv[], void *data)
+{
+	struct dcb_profile_state scratch = {
+		.apps = { .attr = DCB_ATTR_IEEE_APP_TABLE },
+	};
+	struct dcb_profile *prof = data;
+	struct dcb_profile_line *lines, line;
+	int obj, ret;
+
+	for (obj = 0; obj < DCB_PROFILE_OBJS; obj++) {
+		if (strcmp(argv[0], dcb_profile_objs[obj].name) == 0)
+			break;
+	}
+	if (obj == DCB_PROFILE_OBJS) {
+		fprintf(stderr, "Object \"%s\" cannot be in a profile\n", argv[0]);
+		return -EINVAL;
+	}
+	if (argc < 2) {
+		fprintf(stderr, "Nothing to set for %s\n", argv[0]);
+		return -EINVAL;
+	}
+
+	line.obj = obj;
+	line.argc = argc - 1;
+	line.argv = dcb_profile_argv_dup(argc - 1, argv + 1);
+	if (!line.argv)
+		return -ENOMEM;
+
+	/* catch syntax errors once, not once per device */
+	ret = dcb_profile_line_run(prof->dcb, "", &line, &scratch,
+				   &scratch.apps);
+	dcb_app_table_fini(&scratch.apps);
+	if (ret) {
+		dcb_profile_argv_free(line.argc, line.argv);
+		return ret < 0 ? ret : -EINVAL;
+	}
+
+	lines = realloc(prof->lines, (prof->n_lines + 1) * sizeof(*lines));
+	if (!lines) {
+		dcb_profile_argv_free(line.argc, line.argv);
+		return -ENOMEM;
+	}
+	prof->lines = lines;
+	prof->lines[prof->n_lines++] = line;
+	prof->objs |= 1 << obj;
+	return 0;
+}
+
+static void dcb_profile_fini(struct dcb_profile *prof)
+{
+	size_t i;
+
+	for (i = 0; i < prof->n_lines; i++)
+		dcb_profile_argv_free(prof->lines[i].argc, prof->lines[i].argv);
+	free(prof->lines);
+}
+
+static int dcb_profile_ieee_cb(const struct nlattr *attr, void *data)
+{
+	struct dcb_profile_state *st = data;
+	int type = mnl_attr_get_type(attr);
+	int obj;
+
+	for (obj = 0; obj < DCB_PROFILE_OBJS; obj++) {
+		const struct dcb_profile_obj *o = &dcb_profile_objs[obj];
+
+		if (o->attr != type)
+			continue;
+
+		if (obj == DCB_PROFILE_APP) {
+			if (dcb_app_table_parse(&st->apps,
+						mnl_attr_get_payload(attr),
+						mnl_attr_get_payload_len(attr)))
+				return MNL_CB_ERROR;
+		} else if (mnl_attr_get_payload_len(attr) == o->len) {
+			memcpy((char *)st + o->off,
+			       mnl_attr_get_payload(attr), o->len);
+		} else {
+			fprintf(stderr, "Wrong len %d of %s, expected %zd\n",
+				mnl_attr_get_payload_len(attr), o->name, o->len);
+			return MNL_CB_ERROR;
+		}
+		st->have |= 1 << obj;
+	}
+	return MNL_CB_OK;
+}
+
+static int dcb_profile_attr_cb(const struct nlattr *attr, void *data)
+{
+	if (mnl_attr_get_type(attr) != DCB_ATTR_IEEE)
+		return MNL_CB_OK;
+
+	return mnl_attr_parse_nested(attr, dcb_profile_ieee_cb, data);
+}
+
+#define DCB_PROFILE_WINDOW	32
+
+static int dcb_profile_send_get(struct dcb *dcb, const char *dev,
+				unsigned int seq)
+{
+	char buf[MNL_NLMSG_HDRLEN + 64 + IFNAMSIZ];
+	struct dcbmsg dcbm = {
+		.cmd = DCB_CMD_IEEE_GET,
+	};
+	struct nlmsghdr *nlh;
+
+	nlh = mnlu_msg_prepare(buf, RTM_GETDCB, NLM_F_REQUEST,
+			       &dcbm, sizeof(dcbm));
+	nlh->nlmsg_seq = seq;
+	mnl_attr_put_strz(nlh, DCB_ATTR_IFNAME, dev);
+
+	if (mnl_socket_sendto(dcb->nl, nlh, nlh->nlmsg_len) < 0) {
+		perror("mnl_socket_sendto");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read the state of all devices with up to DCB_PROFILE_WINDOW requests
+ * in flight. The answers are told apart by sequence number.
+ */
+static int dcb_profile_fetch(struct dcb *dcb, struct dcb_profile_dev *devs,
+			     size_t n)
+{
+	unsigned int base = time(NULL) & 0x7fffffff;
+	size_t sent = 0, done = 0;
+
+	while (done < n) {
+		struct nlmsghdr *nlh;
+		int len;
+
+		while (sent < n && sent - done < DCB_PROFILE_WINDOW) {
+			if (dcb_profile_send_get(dcb, devs[sent].name,
+						 base + sent))
+				return -1;
+			sent++;
+		}
+
+		len = mnl_socket_recvfrom(dcb->nl, dcb->buf,
+					  MNL_SOCKET_BUFFER_SIZE);
+		if (len < 0) {
+			perror("mnl_socket_recvfrom");
+			return -1;
+		}
+
+		for (nlh = (struct nlmsghdr *)dcb->buf; mnl_nlmsg_ok(nlh, len);
+		     nlh = mnl_nlmsg_next(nlh, &len)) {
+			struct dcb_profile_dev *d;
+
+			if (nlh->nlmsg_seq - base >= sent)
+				continue;
+			d = &devs[nlh->nlmsg_seq - base];
+			if (d->done)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				const struct nlmsgerr *e = mnl_nlmsg_get_payload(nlh);
+
+				d->err = e->error ? e->error : -EINVAL;
+			} else if (mnl_attr_parse(nlh, sizeof(struct dcbmsg),
+						  dcb_profile_attr_cb,
+						  &d->cur) != MNL_CB_OK) {
+				d->err = -EINVAL;
+			}
+			d->done = true;
+			done++;
+		}
+	}
+	return 0;
+}
+
+static bool dcb_profile_app_pid_eq(const struct dcb_app *aa,
+				   const struct dcb_app *ab)
+{
+	return aa->selector == ab->selector &&
+	       aa->protocol == ab->protocol;
+}
+
+struct dcb_profile_set {
+	const struct dcb_profile_state *want;
+	unsigned int objs;
+	const struct dcb_app_table *add;
+};
+
+static int dcb_profile_set_cb(struct dcb *dcb, struct nlmsghdr *nlh, void *data)
+{
+	struct dcb_profile_set *set = data;
+	struct nlattr *nest;
+	size_t i;
+	int obj;
+
+	for (obj = 0; obj < DCB_PROFILE_APP; obj++) {
+		const struct dcb_profile_obj *o = &dcb_profile_objs[obj];
+
+		if (set->objs & (1 << obj))
+			mnl_attr_put(nlh, o->attr, o->len,
+				     (const char *)set->want + o->off);
+	}
+
+	if (set->add->n_apps) {
+		nest = mnl_attr_nest_start(nlh, DCB_ATTR_IEEE_APP_TABLE);
+		for (i = 0; i < set->add->n_apps; i++) {
+			const struct dcb_app *app = &set->add->apps[i];
+
+			mnl_attr_put(nlh, dcb_app_attr_type_get(app->selector),
+				     sizeof(*app), app);
+		}
+		mnl_attr_nest_end(nlh, nest);
+	}
+	return 0;
+}
+
+/* Returns 1 if @d differs from the profile, 0 if not, <0 on errors */
+static int dcb_profile_dev_run(struct dcb_profile *prof,
+			       struct dcb_profile_dev *d, bool apply)
+{
+	struct dcb_app_table want_apps = { .attr = DCB_ATTR_IEEE_APP_TABLE };
+	struct dcb_app_table add = { .attr = DCB_ATTR_IEEE_APP_TABLE };
+	struct dcb_app_table del = { .attr = DCB_ATTR_IEEE_APP_TABLE };
+	struct dcb_profile_state want = d->cur;
+	struct dcb_profile_set set = {
+		.want = &want,
+		.add = &add,
+	};
+	bool differs = false;
+	size_t i;
+	int obj, ret;
+
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "dev", "%s:", d->name);
+
+	if (d->err) {
+		errno = -d->err;
+		fprintf(stderr, "%s: cannot read DCB state: %s\n", d->name,
+			strerror(errno));
+		ret = d->err;
+		goto out;
+	}
+
+	for (obj = 0; obj < DCB_PROFILE_OBJS; obj++) {
+		if ((prof->objs & (1 << obj)) && !(d->cur.have & (1 << obj)) &&
+		    obj != DCB_PROFILE_APP) {
+			fprintf(stderr, "%s: no %s reported\n", d->name,
+				dcb_profile_objs[obj].name);
+			ret = -EOPNOTSUPP;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < prof->n_lines; i++) {
+		ret = dcb_profile_line_run(prof->dcb, d->name, &prof->lines[i],
+					   &want, &want_apps);
+		if (ret)
+			goto out;
+	}
+
+	for (obj = 0; obj < DCB_PROFILE_APP; obj++) {
+		const struct dcb_profile_obj *o = &dcb_profile_objs[obj];
+		const struct dcb_profile_field *f;
+		const char *cur = (const char *)&d->cur + o->off;
+		const char *new = (const char *)&want + o->off;
+
+		if (!(prof->objs & (1 << obj)))
+			continue;
+
+		for (f = o->fields; f->name; f++) {
+			if (!memcmp(cur + f->off, new + f->off, f->len))
+				continue;
+			if (!(set.objs & (1 << obj))) {
+				open_json_array(PRINT_JSON, o->name);
+				print_string(PRINT_FP, NULL, " %s", o->name);
+			}
+			set.objs |= 1 << obj;
+			print_string(PRINT_ANY, NULL, " %s", f->name);
+		}
+		if (set.objs & (1 << obj))
+			close_json_array(PRINT_JSON, NULL);
+	}
+
+	if (prof->objs & (1 << DCB_PROFILE_APP)) {
+		ret = dcb_app_table_copy(&add, &want_apps);
+		if (ret)
+			goto out;
+		dcb_app_table_remove_existing(&add, &d->cur.apps);
+
+		ret = dcb_app_table_copy(&del, &d->cur.apps);
+		if (ret)
+			goto out;
+		dcb_app_table_remove_replaced(&del, &want_apps,
+					      dcb_profile_app_pid_eq);
+
+		if (add.n_apps || del.n_apps) {
+			open_json_object("app");
+			print_uint(PRINT_ANY, "add", " app add %u",
+				   add.n_apps);
+			print_uint(PRINT_ANY, "del", " del %u", del.n_apps);
+			close_json_object();
+		}
+	}
+
+	differs = set.objs || add.n_apps || del.n_apps;
+	if (!differs)
+		print_string(PRINT_FP, NULL, " %s", "in sync");
+	print_bool(PRINT_JSON, "differs", NULL, differs);
+
+	ret = 0;
+	if (!apply || !differs)
+		goto out;
+
+	if ((set.objs & (1 << DCB_PROFILE_ETS)) && dcb_ets_validate(&want.ets)) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (set.objs || add.n_apps) {
+		ret = dcb_set_attribute_va(prof->dcb, DCB_CMD_IEEE_SET, d->name,
+					   dcb_profile_set_cb, &set);
+		if (ret)
+			goto out;
+	}
+	ret = dcb_app_add_del(prof->dcb, d->name, DCB_CMD_IEEE_DEL, &del, NULL);
+
+out:
+	print_nl();
+	close_json_object();
+	dcb_app_table_fini(&del);
+	dcb_app_table_fini(&add);
+	dcb_app_table_fini(&want_apps);
+	if (ret)
+		return ret;
+	return differs;
+}
+
+static int dcb_cmd_profile_run(struct dcb *dcb, int argc, char **argv,
+			       bool apply)
+{
+	struct dcb_profile prof = { .dcb = dcb };
+	struct dcb_profile_dev *devs = NULL, *d;
+	const char *file = NULL;
+	bool failed = false, differs = false;
+	size_t n = 0, i;
+	int ret;
+
+	while (argc > 0) {
+		if (matches(*argv, "help") == 0) {
+			dcb_profile_help();
+			return 0;
+		} else if (matches(*argv, "file") == 0) {
+			NEXT_ARG();
+			file = *argv;
+		} else if (matches(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (check_ifname(*argv)) {
+				invarg("not a valid ifname", *argv);
+				ret = -EINVAL;
+				goto out;
+			}
+			d = realloc(devs, (n + 1) * sizeof(*devs));
+			if (!d) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			devs = d;
+			devs[n++] = (struct dcb_profile_dev) {
+				.name = *argv,
+				.cur.apps = { .attr = DCB_ATTR_IEEE_APP_TABLE },
+			};
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			dcb_profile_help();
+			ret = -EINVAL;
+			goto out;
+		}
+		NEXT_ARG_FWD();
+	}
+
+	if (!file || !n) {
+		fprintf(stderr, "A profile needs a file and at least one dev\n");
+		dcb_profile_help();
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (do_batch(file, false, dcb_profile_load_line, &prof)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = dcb_profile_fetch(dcb, devs, n);
+	if (ret)
+		goto out;
+
+	open_json_array(PRINT_JSON, NULL);
+	for (i = 0; i < n; i++) {
+		ret = dcb_profile_dev_run(&prof, &devs[i], apply);
+		if (ret < 0)
+			failed = true;
+		else if (ret > 0)
+			differs = true;
+	}
+	close_json_array(PRINT_JSON, NULL);
+
+	/* verify fails on any difference, so it can gate a script */
+	ret = failed || (!apply && differs) ? -1 : 0;
+
+out:
+	for (i = 0; i < n; i++)
+		dcb_app_table_fini(&devs[i].cur.apps);
+	free(devs);
+	dcb_profile_fini(&prof);
+	return ret;
+}
+
+int dcb_cmd_profile(struct dcb *dcb, int argc, char **argv)
+{
+	if (!argc || matches(*argv, "help") == 0) {
+		dcb_profile_help();
+		return 0;
+	} else if (matches(*argv, "apply") == 0) {
+		NEXT_ARG_FWD();
+		return dcb_cmd_profile_run(dcb, argc, argv, true);
+	} else if (matches(*argv, "verify") == 0) {
+		NEXT_ARG_FWD();
+		return dcb_cmd_profile_run(dcb, argc, argv, false);
+	} else {
+		fprintf(stderr, "What is \"%s\"?\n", *argv);
+		dcb_profile_help();
+		return -EINVAL;
+	}
+}
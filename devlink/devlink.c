@@ -17,6 +17,7 @@
 #include <inttypes.h>
 #include <signal.h>
 #include <time.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/sysinfo.h>
@@ -31,6 +32,9 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <rt_names.h>
 
 #include "version.h"
@@ -41,6 +45,7 @@
 #include "utils.h"
 #include "namespace.h"
 #include "libnetlink.h"
+#include "rtnl_bulk.h"
 #include "../ip/ip_common.h"
 
 #define ESWITCH_MODE_LEGACY "legacy"
@@ -202,19 +207,22 @@ static int _mnlg_socket_group_add(struct mnlu_gen_socket *nlg,
 	return 0;
 }
 
+/* Port handle <-> netdev name map, hashed both ways */
+#define IFNAME_MAP_HT_SIZE	1024
+
 struct ifname_map {
-	struct list_head list;
+	struct hlist_node port_node;	/* by bus, dev and port index */
+	struct hlist_node name_node;	/* by ifname */
 	char *bus_name;
 	char *dev_name;
 	uint32_t port_index;
 	char *ifname;
+	char names[];			/* bus_name and dev_name */
 };
 
 static void ifname_map_free(struct ifname_map *ifname_map)
 {
 	free(ifname_map->ifname);
-	free(ifname_map->dev_name);
-	free(ifname_map->bus_name);
 	free(ifname_map);
 }
 
@@ -223,33 +231,44 @@ static struct ifname_map *ifname_map_alloc(const char *bus_name,
 					   uint32_t port_index,
 					   const char *ifname)
 {
+	size_t bus_len = strlen(bus_name) + 1;
+	size_t dev_len = strlen(dev_name) + 1;
 	struct ifname_map *ifname_map;
 
-	ifname_map = calloc(1, sizeof(*ifname_map));
+	ifname_map = calloc(1, sizeof(*ifname_map) + bus_len + dev_len);
 	if (!ifname_map)
 		return NULL;
-	ifname_map->bus_name = strdup(bus_name);
-	ifname_map->dev_name = strdup(dev_name);
+	ifname_map->bus_name = memcpy(ifname_map->names, bus_name, bus_len);
+	ifname_map->dev_name = memcpy(ifname_map->names + bus_len, dev_name,
+				      dev_len);
 	ifname_map->port_index = port_index;
 	ifname_map->ifname = strdup(ifname);
-	if (!ifname_map->bus_name || !ifname_map->dev_name ||
-	    !ifname_map->ifname) {
-		ifname_map_free(ifname_map);
+	if (!ifname_map->ifname) {
+		free(ifname_map);
 		return NULL;
 	}
 	return ifname_map;
 }
 
-static int ifname_map_update(struct ifname_map *ifname_map, const char *ifname)
+static unsigned int ifname_map_str_hash(unsigned int hash, const char *str)
 {
-	char *new_ifname;
+	while (*str)
+		hash = hash * 31 + (unsigned char)*str++;
+	return hash;
+}
 
-	new_ifname = strdup(ifname);
-	if (!new_ifname)
-		return -ENOMEM;
-	free(ifname_map->ifname);
-	ifname_map->ifname = new_ifname;
-	return 0;
+static unsigned int ifname_map_port_hash(const char *bus_name,
+					 const char *dev_name,
+					 uint32_t port_index)
+{
+	unsigned int hash = ifname_map_str_hash(port_index, bus_name);
+
+	return ifname_map_str_hash(hash, dev_name) % IFNAME_MAP_HT_SIZE;
+}
+
+static unsigned int ifname_map_name_hash(const char *ifname)
+{
+	return ifname_map_str_hash(0, ifname) % IFNAME_MAP_HT_SIZE;
 }
 
 #define DL_OPT_HANDLE		BIT(0)
@@ -314,6 +333,8 @@ static int ifname_map_update(struct ifname_map *ifname_map, const char *ifname)
 #define DL_OPT_PORT_FN_RATE_TC_BWS	BIT(59)
 #define DL_OPT_HEALTH_REPORTER_BURST_PERIOD	BIT(60)
 #define DL_OPT_PARAM_SET_DEFAULT	BIT(61)
+#define DL_OPT_REGION_OUTPUT		BIT(62)
+#define DL_OPT_INTERVAL		BIT(63)
 
 struct dl_opts {
 	uint64_t present; /* flags of present items */
@@ -345,6 +366,12 @@ struct dl_opts {
 	uint32_t region_snapshot_id;
 	__u64 region_address;
 	__u64 region_length;
+	const char *region_output;
+	uint32_t interval;
+	uint32_t count;
+	uint32_t top;
+	uint32_t warn;
+	uint32_t crit;
 	const char *flash_file_name;
 	const char *flash_component;
 	const char *reporter_name;
@@ -387,7 +414,8 @@ struct dl_opts {
 
 struct dl {
 	struct mnlu_gen_socket nlg;
-	struct list_head ifname_map_list;
+	struct hlist_head ifname_map_port_ht[IFNAME_MAP_HT_SIZE];
+	struct hlist_head ifname_map_name_ht[IFNAME_MAP_HT_SIZE];
 	int argc;
 	char **argv;
 	char *handle_argv;
@@ -399,13 +427,16 @@ struct dl {
 	bool stats;
 	bool hex;
 	bool use_iec;
-	bool map_loaded;
+	bool map_loaded; /* all ports are in the map */
 	struct {
 		bool present;
 		char *bus_name;
 		char *dev_name;
 		uint32_t port_index;
 	} arr_last;
+	struct dl_region_out *region_out;
+	const struct timespec *mon_ts; /* monitor stream event time */
+	unsigned int mon_count;
 };
 
 static int dl_argc(struct dl *dl)
@@ -804,25 +835,79 @@ static int function_attr_cb(const struct nlattr *attr, void *data)
 	return MNL_CB_OK;
 }
 
+static struct ifname_map *ifname_map_port_find(struct dl *dl,
+						const char *bus_name,
+						const char *dev_name,
+						uint32_t port_index)
+{
+	unsigned int hash = ifname_map_port_hash(bus_name, dev_name, port_index);
+	struct ifname_map *ifname_map;
+
+	hlist_for_each_entry(ifname_map, &dl->ifname_map_port_ht[hash],
+			     port_node) {
+		if (port_index == ifname_map->port_index &&
+		    strcmp(bus_name, ifname_map->bus_name) == 0 &&
+		    strcmp(dev_name, ifname_map->dev_name) == 0)
+			return ifname_map;
+	}
+	return NULL;
+}
+
+static struct ifname_map *ifname_map_name_find(struct dl *dl,
+						const char *ifname)
+{
+	unsigned int hash = ifname_map_name_hash(ifname);
+	struct ifname_map *ifname_map;
+
+	hlist_for_each_entry(ifname_map, &dl->ifname_map_name_ht[hash],
+			     name_node) {
+		if (strcmp(ifname, ifname_map->ifname) == 0)
+			return ifname_map;
+	}
+	return NULL;
+}
+
+static int ifname_map_update(struct dl *dl, struct ifname_map *ifname_map,
+			     const char *ifname)
+{
+	char *new_ifname;
+
+	if (strcmp(ifname, ifname_map->ifname) == 0)
+		return 0;
+
+	new_ifname = strdup(ifname);
+	if (!new_ifname)
+		return -ENOMEM;
+	hlist_del(&ifname_map->name_node);
+	free(ifname_map->ifname);
+	ifname_map->ifname = new_ifname;
+	hlist_add_head(&ifname_map->name_node,
+		       &dl->ifname_map_name_ht[ifname_map_name_hash(ifname)]);
+	return 0;
+}
+
 static int ifname_map_add(struct dl *dl, const char *ifname,
 			  const char *bus_name, const char *dev_name,
 			  uint32_t port_index)
 {
 	struct ifname_map *ifname_map;
 
+	ifname_map = ifname_map_port_find(dl, bus_name, dev_name, port_index);
+	if (ifname_map)
+		return ifname_map_update(dl, ifname_map, ifname);
+
 	ifname_map = ifname_map_alloc(bus_name, dev_name, port_index, ifname);
 	if (!ifname_map)
 		return -ENOMEM;
-	list_add(&ifname_map->list, &dl->ifname_map_list);
+	hlist_add_head(&ifname_map->port_node,
+		       &dl->ifname_map_port_ht[ifname_map_port_hash(bus_name,
+								    dev_name,
+								    port_index)]);
+	hlist_add_head(&ifname_map->name_node,
+		       &dl->ifname_map_name_ht[ifname_map_name_hash(ifname)]);
 	return 0;
 }
 
-static void ifname_map_del(struct ifname_map *ifname_map)
-{
-	list_del(&ifname_map->list);
-	ifname_map_free(ifname_map);
-}
-
 static int ifname_map_rtnl_port_parse(struct dl *dl, const char *ifname,
 				      struct rtattr *nest)
 {
@@ -931,66 +1016,64 @@ static int ifname_map_cb(const struct nlmsghdr *nlh, void *data)
 
 static void ifname_map_fini(struct dl *dl)
 {
-	struct ifname_map *ifname_map, *tmp;
+	struct hlist_node *pos, *tmp;
+	int i;
 
-	list_for_each_entry_safe(ifname_map, tmp,
-				 &dl->ifname_map_list, list) {
-		ifname_map_del(ifname_map);
+	for (i = 0; i < IFNAME_MAP_HT_SIZE; i++) {
+		hlist_for_each_safe(pos, tmp, &dl->ifname_map_port_ht[i])
+			ifname_map_free(container_of(pos, struct ifname_map,
+						     port_node));
 	}
+	memset(dl->ifname_map_port_ht, 0, sizeof(dl->ifname_map_port_ht));
+	memset(dl->ifname_map_name_ht, 0, sizeof(dl->ifname_map_name_ht));
+	dl->map_loaded = false;
 }
 
 static void ifname_map_init(struct dl *dl)
 {
-	INIT_LIST_HEAD(&dl->ifname_map_list);
+	memset(dl->ifname_map_port_ht, 0, sizeof(dl->ifname_map_port_ht));
+	memset(dl->ifname_map_name_ht, 0, sizeof(dl->ifname_map_name_ht));
+	dl->map_loaded = false;
 }
 
-static int ifname_map_load(struct dl *dl, const char *ifname)
+/*
+ * The map is only filled when a name has to be resolved: a netdev given
+ * on the command line is looked up with a single RTM_GETLINK when the
+ * kernel reports its devlink port there, and all ports are dumped once
+ * only when that is not enough. The map lives as long as @dl, so batch
+ * lines share it.
+ */
+static int ifname_map_load(struct dl *dl)
 {
 	struct mnlu_gen_socket nlg_map;
 	struct nlmsghdr *nlh;
 	int err;
 
-	if (ifname) {
-		err = ifname_map_rtnl_init(dl, ifname);
-		if (!err)
-			return 0;
-		/* In case kernel does not support devlink port info passed over
-		 * RT netlink, fall-back to ports dump.
-		 */
-	}
+	if (dl->map_loaded)
+		return 0;
 
 	err = mnlu_gen_socket_open(&nlg_map, DEVLINK_GENL_NAME,
 				   DEVLINK_GENL_VERSION);
 	if (err)
-		return err;
+		goto err_out;
 
 	nlh = mnlu_gen_socket_cmd_prepare(&nlg_map, DEVLINK_CMD_PORT_GET,
 			       NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP);
 
 	err = mnlu_gen_socket_sndrcv(&nlg_map, nlh, ifname_map_cb, dl);
-	if (err)
-		ifname_map_fini(dl);
-
 	mnlu_gen_socket_close(&nlg_map);
-	return err;
-}
-
-static int ifname_map_check_load(struct dl *dl, const char *ifname)
-{
-	int err;
-
-	if (dl->map_loaded)
-		return 0;
-
-	err = ifname_map_load(dl, ifname);
 	if (err) {
-		pr_err("Failed to create index map\n");
-		return err;
+		ifname_map_fini(dl);
+		goto err_out;
 	}
+
 	dl->map_loaded = true;
 	return 0;
-}
 
+err_out:
+	pr_err("Failed to create index map\n");
+	return err;
+}
 
 static int ifname_map_lookup(struct dl *dl, const char *ifname,
 			     char **p_bus_name, char **p_dev_name,
@@ -999,19 +1082,25 @@ static int ifname_map_lookup(struct dl *dl, const char *ifname,
 	struct ifname_map *ifname_map;
 	int err;
 
-	err = ifname_map_check_load(dl, ifname);
-	if (err)
-		return err;
-
-	list_for_each_entry(ifname_map, &dl->ifname_map_list, list) {
-		if (strcmp(ifname, ifname_map->ifname) == 0) {
-			*p_bus_name = ifname_map->bus_name;
-			*p_dev_name = ifname_map->dev_name;
-			*p_port_index = ifname_map->port_index;
-			return 0;
+	ifname_map = ifname_map_name_find(dl, ifname);
+	if (!ifname_map && !dl->map_loaded) {
+		/* In case kernel does not support devlink port info passed over
+		 * RT netlink, fall-back to ports dump.
+		 */
+		if (ifname_map_rtnl_init(dl, ifname)) {
+			err = ifname_map_load(dl);
+			if (err)
+				return err;
 		}
+		ifname_map = ifname_map_name_find(dl, ifname);
 	}
-	return -ENOENT;
+	if (!ifname_map)
+		return -ENOENT;
+
+	*p_bus_name = ifname_map->bus_name;
+	*p_dev_name = ifname_map->dev_name;
+	*p_port_index = ifname_map->port_index;
+	return 0;
 }
 
 static int ifname_map_rev_lookup(struct dl *dl, const char *bus_name,
@@ -1019,28 +1108,26 @@ static int ifname_map_rev_lookup(struct dl *dl, const char *bus_name,
 				 const char **p_ifname)
 {
 	struct ifname_map *ifname_map;
-
 	int err;
 
-	err = ifname_map_check_load(dl, NULL);
-	if (err)
-		return err;
-
-	list_for_each_entry(ifname_map, &dl->ifname_map_list, list) {
-		if (strcmp(bus_name, ifname_map->bus_name) == 0 &&
-		    strcmp(dev_name, ifname_map->dev_name) == 0 &&
-		    port_index == ifname_map->port_index) {
-			/* In case non-NULL ifname is passed, update the
-			 * looked-up entry.
-			 */
-			if (*p_ifname)
-				return ifname_map_update(ifname_map, *p_ifname);
+	/* A name the kernel just reported only needs to be recorded */
+	if (*p_ifname)
+		return ifname_map_add(dl, *p_ifname, bus_name, dev_name,
+				      port_index);
 
-			*p_ifname = ifname_map->ifname;
-			return 0;
-		}
+	ifname_map = ifname_map_port_find(dl, bus_name, dev_name, port_index);
+	if (!ifname_map && !dl->map_loaded) {
+		err = ifname_map_load(dl);
+		if (err)
+			return err;
+		ifname_map = ifname_map_port_find(dl, bus_name, dev_name,
+						  port_index);
 	}
-	return -ENOENT;
+	if (!ifname_map)
+		return -ENOENT;
+
+	*p_ifname = ifname_map->ifname;
+	return 0;
 }
 
 static int ident_str_validate(char *str, unsigned int expected)
@@ -1660,6 +1747,7 @@ static const struct dl_args_metadata dl_args_required[] = {
 	{DL_OPT_REGION_SNAPSHOT_ID,   "Region snapshot id expected."},
 	{DL_OPT_REGION_ADDRESS,	      "Region address value expected."},
 	{DL_OPT_REGION_LENGTH,	      "Region length value expected."},
+	{DL_OPT_REGION_OUTPUT,	      "Region output file name expected."},
 	{DL_OPT_HEALTH_REPORTER_NAME, "Reporter's name is expected."},
 	{DL_OPT_TRAP_NAME,            "Trap's name is expected."},
 	{DL_OPT_TRAP_GROUP_NAME,      "Trap group's name is expected."},
@@ -1776,10 +1864,14 @@ static int dl_argv_parse(struct dl *dl, uint64_t o_required,
 	const char *unknown_option = NULL;
 	struct dl_opts *opts = &dl->opts;
 	uint64_t o_all = o_required | o_optional;
-	char *str = dl_argv_next(dl);
 	uint64_t o_found = 0;
+	char *str = NULL;
 	int err;
 
+	/* the first argument is the handle, if there is one to take */
+	if (o_required & (DL_OPT_HANDLE | DL_OPT_HANDLEP |
+			  DL_OPT_HANDLE_REGION | DL_OPT_PORT_FN_RATE_NODE_NAME))
+		str = dl_argv_next(dl);
 	if (str) {
 		str = strdup(str);
 		if (!str)
@@ -2037,6 +2129,47 @@ static int dl_argv_parse(struct dl *dl, uint64_t o_required,
 			if (err)
 				return err;
 			o_found |= DL_OPT_REGION_LENGTH;
+		} else if (dl_argv_match(dl, "interval") &&
+			   (o_all & DL_OPT_INTERVAL)) {
+			dl_arg_inc(dl);
+			err = dl_argv_uint32_t(dl, &opts->interval);
+			if (err)
+				return err;
+			o_found |= DL_OPT_INTERVAL;
+		} else if (dl_argv_match(dl, "count") &&
+			   (o_all & DL_OPT_INTERVAL)) {
+			/* count, top, warn and crit only ever come with an
+			 * interval and have no bit of their own
+			 */
+			dl_arg_inc(dl);
+			err = dl_argv_uint32_t(dl, &opts->count);
+			if (err)
+				return err;
+		} else if (dl_argv_match(dl, "top") &&
+			   (o_all & DL_OPT_INTERVAL)) {
+			dl_arg_inc(dl);
+			err = dl_argv_uint32_t(dl, &opts->top);
+			if (err)
+				return err;
+		} else if (dl_argv_match(dl, "warn") &&
+			   (o_all & DL_OPT_INTERVAL)) {
+			dl_arg_inc(dl);
+			err = dl_argv_uint32_t(dl, &opts->warn);
+			if (err)
+				return err;
+		} else if (dl_argv_match(dl, "crit") &&
+			   (o_all & DL_OPT_INTERVAL)) {
+			dl_arg_inc(dl);
+			err = dl_argv_uint32_t(dl, &opts->crit);
+			if (err)
+				return err;
+		} else if (dl_argv_match(dl, "output") &&
+			   (o_all & DL_OPT_REGION_OUTPUT)) {
+			dl_arg_inc(dl);
+			err = dl_argv_str(dl, &opts->region_output);
+			if (err)
+				return err;
+			o_found |= DL_OPT_REGION_OUTPUT;
 		} else if (dl_argv_match(dl, "file") &&
 			   (o_all & DL_OPT_FLASH_FILE_NAME)) {
 			dl_arg_inc(dl);
@@ -2795,6 +2928,144 @@ static void dl_opts_put(struct nlmsghdr *nlh, struct dl *dl)
 				  opts->linecard_type);
 }
 
+/* Requests of the loaders that read a file go out in windows on the
+ * devlink socket: one sendto() per window, then its ACKs are collected
+ * and failures are reported with the line of the file they came from.
+ * The file is read with the rtnl_bulk helpers, so "-" is stdin and
+ * errors have the "FILE:LINE:" form of the other loaders.
+ */
+#define DL_WIN_SIZE	64
+#define DL_LOAD_MAX_ARGS	64
+
+struct dl_win {
+	struct rtnl_bulk bulk;		/* file, failed and the report */
+	char		*buf;
+	size_t		len;
+	size_t		bufsize;
+	int		lineno[DL_WIN_SIZE];
+	unsigned int	queued;
+	unsigned int	seq;
+	unsigned int	sent;
+};
+
+static void dl_win_init(struct dl_win *w, const char *file)
+{
+	memset(w, 0, sizeof(*w));
+	w->bulk.file = file;
+	w->bulk.genl = true;
+	w->seq = time(NULL);
+}
+
+/* Hand every line of the file to parse(), reporting the lines it rejects
+ * as what. Returns -EINVAL if the file could not be read or any line was
+ * rejected.
+ */
+static int dl_win_read(struct dl_win *w,
+		       int (*parse)(int argc, char **argv, int lineno,
+				    void *data),
+		       void *data, const char *what)
+{
+	char *tok[DL_LOAD_MAX_ARGS];
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(&w->bulk);
+	if (!fp)
+		return -EINVAL;
+
+	while (getline(&line, &len, fp) != -1) {
+		int ntok;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, DL_LOAD_MAX_ARGS);
+		if (!ntok)
+			continue;
+		if (ntok > DL_LOAD_MAX_ARGS)
+			rtnl_bulk_line_error(&w->bulk, lineno,
+					     "too many words");
+		else if (parse(ntok, tok, lineno, data))
+			rtnl_bulk_line_error(&w->bulk, lineno, what);
+	}
+
+	rtnl_bulk_close(fp);
+	free(line);
+	return w->bulk.failed ? -EINVAL : 0;
+}
+
+static void dl_win_free(struct dl_win *w)
+{
+	free(w->buf);
+	w->buf = NULL;
+}
+
+static int dl_win_flush(struct dl *dl, struct dl_win *w)
+{
+	struct mnlu_gen_socket *nlg = &dl->nlg;
+	unsigned int acked = 0;
+
+	if (!w->queued)
+		return 0;
+	if (mnl_socket_sendto(nlg->nl, w->buf, w->len) < 0) {
+		perror("Failed to send data");
+		return -errno;
+	}
+
+	while (acked < w->queued) {
+		const struct nlmsghdr *nlh = (struct nlmsghdr *)nlg->buf;
+		int len;
+
+		len = mnl_socket_recvfrom(nlg->nl, nlg->buf,
+					  MNL_SOCKET_BUFFER_SIZE);
+		if (len < 0) {
+			perror("Failed to receive data");
+			return -errno;
+		}
+		for (; mnl_nlmsg_ok(nlh, len); nlh = mnl_nlmsg_next(nlh, &len)) {
+			const struct nlmsgerr *e = mnl_nlmsg_get_payload(nlh);
+			unsigned int i = nlh->nlmsg_seq - w->seq;
+
+			if (nlh->nlmsg_type != NLMSG_ERROR || i >= w->queued)
+				continue;
+			acked++;
+			if (e->error)
+				rtnl_bulk_report(nlh, w->lineno[i], &w->bulk);
+		}
+	}
+
+	w->sent += w->queued;
+	w->seq += w->queued;
+	w->queued = 0;
+	w->len = 0;
+	return 0;
+}
+
+static int dl_win_queue(struct dl *dl, struct dl_win *w,
+			const struct nlmsghdr *nlh, int lineno)
+{
+	struct nlmsghdr *copy;
+
+	if (w->len + NLMSG_ALIGN(nlh->nlmsg_len) > w->bufsize) {
+		size_t bufsize = w->bufsize ? w->bufsize * 2 : 16 * 1024;
+		char *buf = realloc(w->buf, bufsize);
+
+		if (!buf)
+			return -ENOMEM;
+		w->buf = buf;
+		w->bufsize = bufsize;
+	}
+
+	copy = memcpy(w->buf + w->len, nlh, nlh->nlmsg_len);
+	copy->nlmsg_seq = w->seq + w->queued;
+	w->lineno[w->queued++] = lineno;
+	w->len += NLMSG_ALIGN(nlh->nlmsg_len);
+
+	if (w->queued == DL_WIN_SIZE)
+		return dl_win_flush(dl, w);
+	return 0;
+}
+
 static bool dl_dump_filter(struct dl *dl, struct nlattr **tb)
 {
 	struct dl_opts *opts = &dl->opts;
@@ -2848,6 +3119,7 @@ static void cmd_dev_help(void)
 	pr_err("       devlink dev eswitch show DEV\n");
 	pr_err("       devlink dev param set DEV name PARAMETER [ value VALUE | default ] cmode { permanent | driverinit | runtime }\n");
 	pr_err("       devlink dev param show [DEV name PARAMETER]\n");
+	pr_err("       devlink dev param load FILE\n");
 	pr_err("       devlink dev reload DEV [ netns { PID | NAME | ID } ]\n");
 	pr_err("                              [ action { driver_reinit | fw_activate } ] [ limit no_reset ]\n");
 	pr_err("       devlink dev info [ DEV ]\n");
@@ -3928,41 +4200,540 @@ err_param_value_parse:
 	return err;
 }
 
-static int cmd_port_param_show_cb(const struct nlmsghdr *nlh, void *data)
+/* "param load FILE" sets parameters of many devices and ports from one
+ * file, a line per parameter:
+ *
+ *	{ DEV | DEV/PORT_INDEX | * } name NAME { value VALUE | default }
+ *		cmode CMODE
+ *
+ * where "*" stands for every device that has the parameter. All the
+ * parameters are dumped once, for their type and current values, and
+ * only those that differ are set, in windows of requests on one socket.
+ * Nothing is sent if a line does not apply.
+ */
+#define PARAM_LOAD_HT_SIZE	1024
+
+struct param_ent {
+	struct hlist_node	hash;
+	char			*bus_name;
+	char			*dev_name;
+	bool			port;
+	uint32_t		port_index;
+	char			*name;
+	int			nla_type;
+	uint32_t		cmodes;		/* BIT() of the cmodes seen */
+	uint64_t		val[DEVLINK_PARAM_CMODE_MAX + 1];
+	char			*str[DEVLINK_PARAM_CMODE_MAX + 1];
+};
+
+struct param_want {
+	int		lineno;
+	char		*bus_name;	/* NULL for every device */
+	char		*dev_name;
+	bool		port;
+	uint32_t	port_index;
+	char		*name;
+	char		*value;		/* NULL for the default */
+	uint8_t		cmode;
+};
+
+struct param_load {
+	struct dl		*dl;
+	struct hlist_head	ht[PARAM_LOAD_HT_SIZE];
+	struct param_want	*wants;
+	unsigned int		count;
+	unsigned int		size;
+	bool			ports;
+	struct dl_win		win;
+	unsigned int		checked;
+	unsigned int		skipped;
+	unsigned int		errors;
+};
+
+static unsigned int param_ent_hash(const char *bus_name, const char *dev_name,
+				   bool port, uint32_t port_index,
+				   const char *name)
+{
+	const char *names[] = { bus_name, dev_name, name };
+	unsigned int hash = port ? port_index + 1 : 0;
+	const char *p;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++)
+		for (p = names[i]; *p; p++)
+			hash = hash * 31 + *p;
+	return hash % PARAM_LOAD_HT_SIZE;
+}
+
+static struct param_ent *param_ent_find(struct param_load *pl,
+					const char *bus_name,
+					const char *dev_name, bool port,
+					uint32_t port_index, const char *name)
+{
+	struct hlist_node *pos;
+	struct param_ent *e;
+
+	hlist_for_each(pos, &pl->ht[param_ent_hash(bus_name, dev_name, port,
+						   port_index, name)]) {
+		e = container_of(pos, struct param_ent, hash);
+		if (e->port == port && (!port || e->port_index == port_index) &&
+		    !strcmp(e->name, name) && !strcmp(e->dev_name, dev_name) &&
+		    !strcmp(e->bus_name, bus_name))
+			return e;
+	}
+	return NULL;
+}
+
+static int param_load_dump_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *nla_param[DEVLINK_ATTR_MAX + 1] = {};
 	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
-	struct dl *dl = data;
+	const char *bus_name, *dev_name, *name;
+	struct param_load *pl = data;
+	struct nlattr *param_value_attr;
+	uint32_t port_index = 0;
+	struct param_ent *e;
+	bool port;
+	int err;
 
 	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
 	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
-	    !tb[DEVLINK_ATTR_PORT_INDEX] || !tb[DEVLINK_ATTR_PARAM])
+	    !tb[DEVLINK_ATTR_PARAM])
 		return MNL_CB_ERROR;
 
-	pr_out_param(dl, tb, true, true);
+	err = mnl_attr_parse_nested(tb[DEVLINK_ATTR_PARAM], attr_cb, nla_param);
+	if (err != MNL_CB_OK)
+		return MNL_CB_ERROR;
+	if (!nla_param[DEVLINK_ATTR_PARAM_NAME] ||
+	    !nla_param[DEVLINK_ATTR_PARAM_TYPE] ||
+	    !nla_param[DEVLINK_ATTR_PARAM_VALUES_LIST])
+		return MNL_CB_ERROR;
+
+	bus_name = mnl_attr_get_str(tb[DEVLINK_ATTR_BUS_NAME]);
+	dev_name = mnl_attr_get_str(tb[DEVLINK_ATTR_DEV_NAME]);
+	name = mnl_attr_get_str(nla_param[DEVLINK_ATTR_PARAM_NAME]);
+	port = tb[DEVLINK_ATTR_PORT_INDEX];
+	if (port)
+		port_index = mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]);
+	if (param_ent_find(pl, bus_name, dev_name, port, port_index, name))
+		return MNL_CB_OK;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return MNL_CB_ERROR;
+	hlist_add_head(&e->hash, &pl->ht[param_ent_hash(bus_name, dev_name,
+							port, port_index,
+							name)]);
+	e->bus_name = strdup(bus_name);
+	e->dev_name = strdup(dev_name);
+	e->name = strdup(name);
+	if (!e->bus_name || !e->dev_name || !e->name)
+		return MNL_CB_ERROR;
+	e->port = port;
+	e->port_index = port_index;
+	e->nla_type = mnl_attr_get_u8(nla_param[DEVLINK_ATTR_PARAM_TYPE]);
+
+	mnl_attr_for_each_nested(param_value_attr,
+				 nla_param[DEVLINK_ATTR_PARAM_VALUES_LIST]) {
+		struct nlattr *nla_value[DEVLINK_ATTR_MAX + 1] = {};
+		struct nlattr *val_attr;
+		uint8_t cmode;
+
+		err = mnl_attr_parse_nested(param_value_attr,
+					    attr_cb, nla_value);
+		if (err != MNL_CB_OK)
+			return MNL_CB_ERROR;
+		if (!nla_value[DEVLINK_ATTR_PARAM_VALUE_CMODE])
+			return MNL_CB_ERROR;
+		cmode = mnl_attr_get_u8(nla_value[DEVLINK_ATTR_PARAM_VALUE_CMODE]);
+		if (cmode > DEVLINK_PARAM_CMODE_MAX)
+			continue;
+		val_attr = nla_value[DEVLINK_ATTR_PARAM_VALUE_DATA];
+		if (!val_attr && e->nla_type != MNL_TYPE_FLAG)
+			return MNL_CB_ERROR;
+
+		e->cmodes |= BIT(cmode);
+		switch (e->nla_type) {
+		case MNL_TYPE_U8:
+			e->val[cmode] = mnl_attr_get_u8(val_attr);
+			break;
+		case MNL_TYPE_U16:
+			e->val[cmode] = mnl_attr_get_u16(val_attr);
+			break;
+		case MNL_TYPE_U32:
+			e->val[cmode] = mnl_attr_get_u32(val_attr);
+			break;
+		case MNL_TYPE_U64:
+			e->val[cmode] = mnl_attr_get_u64(val_attr);
+			break;
+		case MNL_TYPE_STRING:
+			e->str[cmode] = strdup(mnl_attr_get_str(val_attr));
+			if (!e->str[cmode])
+				return MNL_CB_ERROR;
+			break;
+		case MNL_TYPE_FLAG:
+			e->val[cmode] = !!val_attr;
+			break;
+		}
+	}
 	return MNL_CB_OK;
 }
 
-static int cmd_dev_param_show(struct dl *dl)
+static int param_load_line(int argc, char **argv, int lineno, void *data)
 {
-	uint16_t flags = NLM_F_REQUEST | NLM_F_ACK;
-	struct nlmsghdr *nlh;
+	struct param_load *pl = data;
+	struct dl *dl = pl->dl;
+	struct dl_opts *opts = &dl->opts;
+	uint64_t handle = DL_OPT_HANDLE | DL_OPT_HANDLEP;
+	struct param_want *w;
 	int err;
 
-	err = dl_argv_parse_with_selector(dl, &flags, DEVLINK_CMD_PARAM_GET,
-					  DL_OPT_HANDLE | DL_OPT_PARAM_NAME, 0,
-					  DL_OPT_HANDLE, 0);
+	if (argc && !strcmp(*argv, "*")) {
+		handle = 0;
+		argc--;
+		argv++;
+	}
+	memset(opts, 0, sizeof(*opts));
+	dl->argc = argc;
+	dl->argv = argv;
+	err = dl_argv_parse(dl, handle | DL_OPT_PARAM_NAME | DL_OPT_PARAM_CMODE,
+			    DL_OPT_PARAM_VALUE | DL_OPT_PARAM_SET_DEFAULT);
 	if (err)
 		return err;
+	if (!!(opts->present & DL_OPT_PARAM_VALUE) ==
+	    !!(opts->present & DL_OPT_PARAM_SET_DEFAULT)) {
+		pr_err("Either value or default must be specified\n");
+		return -EINVAL;
+	}
 
-	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_PARAM_GET, flags);
-
-	dl_opts_put(nlh, dl);
+	if (pl->count == pl->size) {
+		unsigned int size = pl->size ? pl->size * 2 : 64;
+		struct param_want *wants;
 
-	pr_out_section_start(dl, "param");
-	err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, cmd_dev_param_show_cb, dl);
-	pr_out_section_end(dl);
-	return err;
+		wants = realloc(pl->wants, size * sizeof(*wants));
+		if (!wants)
+			return -ENOMEM;
+		pl->wants = wants;
+		pl->size = size;
+	}
+	w = &pl->wants[pl->count++];
+	memset(w, 0, sizeof(*w));
+	w->lineno = lineno;
+	w->cmode = opts->cmode;
+	w->name = strdup(opts->param_name);
+	if (!w->name)
+		return -ENOMEM;
+	if (opts->present & DL_OPT_PARAM_VALUE) {
+		w->value = strdup(opts->param_value);
+		if (!w->value)
+			return -ENOMEM;
+	}
+	if (handle) {
+		w->bus_name = strdup(opts->bus_name);
+		w->dev_name = strdup(opts->dev_name);
+		if (!w->bus_name || !w->dev_name)
+			return -ENOMEM;
+		w->port = opts->present & DL_OPT_HANDLEP;
+		w->port_index = opts->port_index;
+		if (w->port)
+			pl->ports = true;
+	}
+	return 0;
+}
+
+static int param_val_parse(const char *name, int nla_type, const char *vstr,
+			   uint64_t *val)
+{
+	__u64 max = UINT64_MAX;
+	bool vbool;
+	int err;
+
+	switch (nla_type) {
+	case MNL_TYPE_U8:
+		max = UINT8_MAX;
+		break;
+	case MNL_TYPE_U16:
+		max = UINT16_MAX;
+		break;
+	case MNL_TYPE_U32:
+		max = UINT32_MAX;
+		break;
+	case MNL_TYPE_U64:
+		break;
+	case MNL_TYPE_FLAG:
+		err = str_to_bool(vstr, &vbool);
+		*val = vbool;
+		return err;
+	default:
+		return -ENOTSUP;
+	}
+
+	if (param_val_conv_exists(param_val_conv, PARAM_VAL_CONV_LEN, name))
+		return param_val_conv_uint_get(param_val_conv,
+					       PARAM_VAL_CONV_LEN, name, vstr,
+					       val);
+	err = get_u64((__u64 *)val, vstr, 10);
+	if (!err && *val > max)
+		err = -ERANGE;
+	return err;
+}
+
+/* Check the line against one parameter, and queue the set if it differs */
+static int param_load_ent(struct param_load *pl, const struct param_want *w,
+			  const struct param_ent *e, bool queue)
+{
+	struct dl_opts *opts = &pl->dl->opts;
+	const char *file = pl->win.bulk.file;
+	struct nlmsghdr *nlh;
+	uint64_t val = 0;
+	int err;
+
+	if (!(e->cmodes & BIT(w->cmode))) {
+		pr_err("%s:%d: %s/%s: \"%s\" has no %s value\n", file,
+		       w->lineno, e->bus_name, e->dev_name, e->name,
+		       param_cmode_name(w->cmode));
+		return -ENOTSUP;
+	}
+	if (w->value && e->nla_type != MNL_TYPE_STRING) {
+		err = param_val_parse(e->name, e->nla_type, w->value, &val);
+		if (err) {
+			pr_err("%s:%d: Value \"%s\" is not valid for \"%s\"\n",
+			       file, w->lineno, w->value, e->name);
+			return err;
+		}
+		if (val == e->val[w->cmode])
+			goto unchanged;
+	} else if (w->value) {
+		if (!strcmp(w->value, e->str[w->cmode] ? : ""))
+			goto unchanged;
+	}
+	if (!queue)
+		return 0;
+
+	memset(opts, 0, sizeof(*opts));
+	opts->bus_name = e->bus_name;
+	opts->dev_name = e->dev_name;
+	opts->port_index = e->port_index;
+	opts->param_name = e->name;
+	opts->cmode = w->cmode;
+	opts->present = (e->port ? DL_OPT_HANDLEP : DL_OPT_HANDLE) |
+			DL_OPT_PARAM_NAME | DL_OPT_PARAM_CMODE |
+			(w->value ? 0 : DL_OPT_PARAM_SET_DEFAULT);
+
+	nlh = mnlu_gen_socket_cmd_prepare(&pl->dl->nlg,
+					  e->port ? DEVLINK_CMD_PORT_PARAM_SET :
+						    DEVLINK_CMD_PARAM_SET,
+					  NLM_F_REQUEST | NLM_F_ACK);
+	dl_opts_put(nlh, pl->dl);
+	mnl_attr_put_u8(nlh, DEVLINK_ATTR_PARAM_TYPE, e->nla_type);
+	if (w->value) {
+		switch (e->nla_type) {
+		case MNL_TYPE_U8:
+			mnl_attr_put_u8(nlh, DEVLINK_ATTR_PARAM_VALUE_DATA, val);
+			break;
+		case MNL_TYPE_U16:
+			mnl_attr_put_u16(nlh, DEVLINK_ATTR_PARAM_VALUE_DATA, val);
+			break;
+		case MNL_TYPE_U32:
+			mnl_attr_put_u32(nlh, DEVLINK_ATTR_PARAM_VALUE_DATA, val);
+			break;
+		case MNL_TYPE_U64:
+			mnl_attr_put_u64(nlh, DEVLINK_ATTR_PARAM_VALUE_DATA, val);
+			break;
+		case MNL_TYPE_STRING:
+			mnl_attr_put_strz(nlh, DEVLINK_ATTR_PARAM_VALUE_DATA,
+					  w->value);
+			break;
+		case MNL_TYPE_FLAG:
+			if (val)
+				mnl_attr_put(nlh, DEVLINK_ATTR_PARAM_VALUE_DATA,
+					     0, NULL);
+			break;
+		}
+	}
+	return dl_win_queue(pl->dl, &pl->win, nlh, w->lineno);
+
+unchanged:
+	if (queue)
+		pl->skipped++;
+	return 0;
+}
+
+static int param_load_want(struct param_load *pl, const struct param_want *w,
+			   bool queue)
+{
+	struct hlist_node *pos;
+	struct param_ent *e;
+	unsigned int i, n = 0;
+	int err;
+
+	if (w->bus_name) {
+		e = param_ent_find(pl, w->bus_name, w->dev_name, w->port,
+				   w->port_index, w->name);
+		if (!e) {
+			pr_err("%s:%d: No parameter \"%s\"\n",
+			       pl->win.bulk.file, w->lineno, w->name);
+			return -ENOENT;
+		}
+		pl->checked++;
+		return param_load_ent(pl, w, e, queue);
+	}
+
+	for (i = 0; i < PARAM_LOAD_HT_SIZE; i++) {
+		hlist_for_each(pos, &pl->ht[i]) {
+			e = container_of(pos, struct param_ent, hash);
+			if (e->port || strcmp(e->name, w->name))
+				continue;
+			n++;
+			pl->checked++;
+			err = param_load_ent(pl, w, e, queue);
+			if (err)
+				return err;
+		}
+	}
+	if (!n) {
+		pr_err("%s:%d: No device has parameter \"%s\"\n",
+		       pl->win.bulk.file, w->lineno, w->name);
+		return -ENOENT;
+	}
+	return 0;
+}
+
+static int param_load_dump(struct param_load *pl, uint8_t cmd)
+{
+	struct nlmsghdr *nlh;
+
+	nlh = mnlu_gen_socket_cmd_prepare(&pl->dl->nlg, cmd,
+					  NLM_F_REQUEST | NLM_F_ACK |
+					  NLM_F_DUMP);
+	return mnlu_gen_socket_sndrcv(&pl->dl->nlg, nlh, param_load_dump_cb,
+				      pl);
+}
+
+static void param_load_free(struct param_load *pl)
+{
+	struct hlist_node *pos, *tmp;
+	struct param_ent *e;
+	unsigned int i, j;
+
+	for (i = 0; i < PARAM_LOAD_HT_SIZE; i++) {
+		hlist_for_each_safe(pos, tmp, &pl->ht[i]) {
+			e = container_of(pos, struct param_ent, hash);
+			hlist_del(&e->hash);
+			free(e->bus_name);
+			free(e->dev_name);
+			free(e->name);
+			for (j = 0; j <= DEVLINK_PARAM_CMODE_MAX; j++)
+				free(e->str[j]);
+			free(e);
+		}
+	}
+	for (i = 0; i < pl->count; i++) {
+		free(pl->wants[i].bus_name);
+		free(pl->wants[i].dev_name);
+		free(pl->wants[i].name);
+		free(pl->wants[i].value);
+	}
+	free(pl->wants);
+	dl_win_free(&pl->win);
+}
+
+static int cmd_dev_param_load(struct dl *dl)
+{
+	struct param_load pl = { .dl = dl };
+	const char *file;
+	unsigned int i;
+	int err;
+
+	if (dl_no_arg(dl)) {
+		pr_err("File name expected.\n");
+		return -EINVAL;
+	}
+	file = dl_argv_next(dl);
+	if (dl_argc(dl)) {
+		pr_err("Unknown option \"%s\"\n", dl_argv(dl));
+		return -EINVAL;
+	}
+	dl_win_init(&pl.win, file);
+
+	err = dl_win_read(&pl.win, param_load_line, &pl, "invalid parameter");
+	if (err) {
+		pr_err("%s: nothing was sent\n", pl.win.bulk.file);
+		goto out;
+	}
+
+	err = param_load_dump(&pl, DEVLINK_CMD_PARAM_GET);
+	if (!err && pl.ports)
+		err = param_load_dump(&pl, DEVLINK_CMD_PORT_PARAM_GET);
+	if (err)
+		goto out;
+
+	for (i = 0; i < pl.count; i++)
+		if (param_load_want(&pl, &pl.wants[i], false))
+			pl.errors++;
+	if (pl.errors) {
+		pr_err("%s: nothing was sent\n", pl.win.bulk.file);
+		err = -EINVAL;
+		goto out;
+	}
+
+	pl.checked = 0;
+	for (i = 0; i < pl.count && !err; i++)
+		err = param_load_want(&pl, &pl.wants[i], true);
+	if (!err)
+		err = dl_win_flush(dl, &pl.win);
+	if (err)
+		goto out;
+
+	if (pl.win.bulk.failed) {
+		pr_err("%u of %u requests failed\n", pl.win.bulk.failed,
+		       pl.win.sent);
+		err = -EINVAL;
+	}
+	if (dl->stats)
+		pr_out("%u parameters, %u set, %u unchanged\n", pl.checked,
+		       pl.win.sent - pl.win.bulk.failed, pl.skipped);
+out:
+	param_load_free(&pl);
+	return err;
+}
+
+static int cmd_port_param_show_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct dl *dl = data;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    !tb[DEVLINK_ATTR_PORT_INDEX] || !tb[DEVLINK_ATTR_PARAM])
+		return MNL_CB_ERROR;
+
+	pr_out_param(dl, tb, true, true);
+	return MNL_CB_OK;
+}
+
+static int cmd_dev_param_show(struct dl *dl)
+{
+	uint16_t flags = NLM_F_REQUEST | NLM_F_ACK;
+	struct nlmsghdr *nlh;
+	int err;
+
+	err = dl_argv_parse_with_selector(dl, &flags, DEVLINK_CMD_PARAM_GET,
+					  DL_OPT_HANDLE | DL_OPT_PARAM_NAME, 0,
+					  DL_OPT_HANDLE, 0);
+	if (err)
+		return err;
+
+	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_PARAM_GET, flags);
+
+	dl_opts_put(nlh, dl);
+
+	pr_out_section_start(dl, "param");
+	err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, cmd_dev_param_show_cb, dl);
+	pr_out_section_end(dl);
+	return err;
 }
 
 static int cmd_dev_param(struct dl *dl)
@@ -3977,6 +4748,9 @@ static int cmd_dev_param(struct dl *dl)
 	} else if (dl_argv_match(dl, "set")) {
 		dl_arg_inc(dl);
 		return cmd_dev_param_set(dl);
+	} else if (dl_argv_match(dl, "load")) {
+		dl_arg_inc(dl);
+		return cmd_dev_param_load(dl);
 	}
 	pr_err("Command \"%s\" not found\n", dl_argv(dl));
 	return -ENOENT;
@@ -4957,7 +5731,7 @@ static void cmd_port_help(void)
 	pr_err("                      [ roce { enable | disable } ] [ migratable { enable | disable } ]\n");
 	pr_err("                      [ ipsec_crypto { enable | disable } ] [ ipsec_packet { enable | disable } ]\n");
 	pr_err("                      [ max_io_eqs EQS ]\n");
-	pr_err("       devlink port function rate { help | show | add | del | set }\n");
+	pr_err("       devlink port function rate { help | show | add | del | set | load }\n");
 	pr_err("       devlink port param set DEV/PORT_INDEX name PARAMETER value VALUE cmode { permanent | driverinit | runtime }\n");
 	pr_err("       devlink port param show [DEV/PORT_INDEX name PARAMETER]\n");
 	pr_err("       devlink port health show [ DEV/PORT_INDEX reporter REPORTER_NAME ]\n");
@@ -5294,7 +6068,7 @@ static void cmd_port_function_help(void)
 	pr_err("Usage: devlink port function set DEV/PORT_INDEX [ hw_addr ADDR ] [ state { active | inactive } ]\n");
 	pr_err("                      [ roce { enable | disable } ] [ migratable { enable | disable } ]\n");
 	pr_err("                      [ ipsec_crypto { enable | disable } ] [ ipsec_packet { enable | disable } ]\n");
-	pr_err("       devlink port function rate { help | show | add | del | set }\n");
+	pr_err("       devlink port function rate { help | show | add | del | set | load }\n");
 }
 
 static int cmd_port_function_set(struct dl *dl)
@@ -5722,7 +6496,8 @@ static void cmd_port_fn_rate_help(void)
 	pr_err("               [ tx_share VAL ][ tx_max VAL ][ tx_priority N ][ tx_weight N ][ tc-bw INDEX:N ... INDEX:N ][ { parent NODE_NAME | noparent } ]\n");
 	pr_err("       devlink port function rate del DEV/NODE_NAME\n");
 	pr_err("       devlink port function rate set DEV/{ PORT_INDEX | NODE_NAME }\n");
-	pr_err("               [ tx_share VAL ][ tx_max VAL ][ tx_priority N ][ tx_weight N ][ tc-bw INDEX:N ... INDEX:N ][ { parent NODE_NAME | noparent } ]\n\n");
+	pr_err("               [ tx_share VAL ][ tx_max VAL ][ tx_priority N ][ tx_weight N ][ tc-bw INDEX:N ... INDEX:N ][ { parent NODE_NAME | noparent } ]\n");
+	pr_err("       devlink port function rate load FILE [ diff ]\n\n");
 	pr_err("       VAL - float or integer value in units of bits or bytes per second (bit|bps)\n");
 	pr_err("       N - integer representing priority/weight of the node among siblings\n");
 	pr_err("       INDEX - integer representing traffic class index in the tc-bw option, ranging from 0 to 7\n");
@@ -5915,116 +6690,576 @@ static int cmd_port_fn_rate_set(struct dl *dl)
 	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, NULL, NULL);
 }
 
-static int cmd_port_function_rate(struct dl *dl)
-{
-	if (dl_argv_match(dl, "help")) {
-		cmd_port_fn_rate_help();
-		return 0;
-	} else if (dl_argv_match(dl, "show") || dl_no_arg(dl)) {
-		dl_arg_inc(dl);
-		return cmd_port_fn_rate_show(dl);
-	} else if (dl_argv_match(dl, "add")) {
-		dl_arg_inc(dl);
-		return cmd_port_fn_rate_add(dl);
-	} else if (dl_argv_match(dl, "del")) {
-		dl_arg_inc(dl);
-		return cmd_port_fn_rate_del(dl);
-	} else if (dl_argv_match(dl, "set")) {
-		dl_arg_inc(dl);
-		return cmd_port_fn_rate_set(dl);
-	}
-	pr_err("Command \"%s\" not found\n", dl_argv(dl));
-	return -ENOENT;
-}
+/* "rate load FILE [ diff ]" programs a rate tree in one go. Every line of
+ * FILE describes one rate object with the arguments of "rate set"; values
+ * that are left out are 0 and an object without "parent" has none. The
+ * file is checked against the rate objects of the devices before anything
+ * is sent: leaves must exist, parents must be nodes, there must be no
+ * cycle, tx_share must not exceed tx_max and the tx_share of the children
+ * of a node must not add up to more than its tx_max. Nodes then go out
+ * parent first, created when they do not exist yet, and the leaves after
+ * them, in windows of requests on one socket. With "diff" the objects
+ * that already match are skipped and only the values that differ are set.
+ */
+#define RATE_LOAD_HT_SIZE	256
+#define RATE_LOAD_OPTS		(DL_OPT_PORT_FN_RATE_TX_SHARE | \
+				 DL_OPT_PORT_FN_RATE_TX_MAX | \
+				 DL_OPT_PORT_FN_RATE_TX_PRIORITY | \
+				 DL_OPT_PORT_FN_RATE_TX_WEIGHT | \
+				 DL_OPT_PORT_FN_RATE_PARENT | \
+				 DL_OPT_PORT_FN_RATE_TC_BWS)
+
+struct rate_val {
+	uint64_t	tx_share;
+	uint64_t	tx_max;
+	uint32_t	tx_priority;
+	uint32_t	tx_weight;
+	uint32_t	tc_bw[DEVLINK_RATE_TCS_MAX];
+	char		*parent;	/* NULL when there is none */
+};
 
-static int cmd_port_function(struct dl *dl)
-{
-	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
-		cmd_port_function_help();
-		return 0;
-	} else if (dl_argv_match(dl, "set")) {
-		dl_arg_inc(dl);
-		return cmd_port_function_set(dl);
-	} else if (dl_argv_match(dl, "rate")) {
-		dl_arg_inc(dl);
-		return cmd_port_function_rate(dl);
-	}
-	pr_err("Command \"%s\" not found\n", dl_argv(dl));
-	return -ENOENT;
-}
+struct rate_obj {
+	struct hlist_node	hash;
+	char			*bus_name;
+	char			*dev_name;
+	char			*node_name;	/* NULL for a leaf */
+	uint32_t		port_index;
+	int			lineno;		/* 0 when not in the file */
+	uint64_t		present;	/* options given on the line */
+	bool			exists;
+	struct rate_val		want;
+	struct rate_val		cur;
+	struct rate_obj		*up;
+	unsigned int		depth;
+	uint64_t		child_share;
+};
 
-static int cmd_health(struct dl *dl);
-static int __cmd_health_show(struct dl *dl, bool show_device, bool show_port);
+struct rate_load {
+	struct dl		*dl;
+	bool			diff;
+	struct hlist_head	ht[RATE_LOAD_HT_SIZE];
+	unsigned int		nobjs;
+	struct rate_obj		**objs;		/* the file, by line */
+	unsigned int		count;
+	unsigned int		size;
+	struct dl_win		win;
+	unsigned int		skipped;
+};
 
-static void cmd_port_add_help(void)
+static unsigned int rate_obj_hash(const char *bus_name, const char *dev_name,
+				  const char *node_name, uint32_t port_index)
 {
-	pr_err("       devlink port add DEV/PORT_INDEX flavour FLAVOUR pfnum PFNUM\n"
-	       "                      [ sfnum SFNUM ][ controller CNUM ]\n");
+	const char *names[] = { bus_name, dev_name, node_name };
+	unsigned int hash = port_index;
+	const char *p;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++)
+		for (p = names[i]; p && *p; p++)
+			hash = hash * 31 + *p;
+	return hash % RATE_LOAD_HT_SIZE;
 }
 
-static int cmd_port_add(struct dl *dl)
+static struct rate_obj *rate_obj_get(struct rate_load *rl,
+				     const char *bus_name,
+				     const char *dev_name,
+				     const char *node_name,
+				     uint32_t port_index, bool create)
 {
-	struct nlmsghdr *nlh;
-	int err;
+	struct hlist_head *head;
+	struct hlist_node *pos;
+	struct rate_obj *o;
 
-	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
-		cmd_port_add_help();
-		return 0;
+	head = &rl->ht[rate_obj_hash(bus_name, dev_name, node_name,
+				     port_index)];
+	hlist_for_each(pos, head) {
+		o = container_of(pos, struct rate_obj, hash);
+		if (strcmp(o->bus_name, bus_name) ||
+		    strcmp(o->dev_name, dev_name))
+			continue;
+		if (node_name ? o->node_name &&
+				!strcmp(o->node_name, node_name) :
+				!o->node_name && o->port_index == port_index)
+			return o;
 	}
+	if (!create)
+		return NULL;
 
-	err = dl_argv_parse(dl, DL_OPT_HANDLE | DL_OPT_HANDLEP |
-			    DL_OPT_PORT_FLAVOUR | DL_OPT_PORT_PFNUMBER,
-			    DL_OPT_PORT_SFNUMBER | DL_OPT_PORT_CONTROLLER);
-	if (err)
-		return err;
-
-	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_PORT_NEW,
-					  NLM_F_REQUEST | NLM_F_ACK);
-
-	dl_opts_put(nlh, dl);
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		return NULL;
+	o->bus_name = strdup(bus_name);
+	o->dev_name = strdup(dev_name);
+	o->node_name = node_name ? strdup(node_name) : NULL;
+	o->port_index = port_index;
+	if (!o->bus_name || !o->dev_name || (node_name && !o->node_name)) {
+		free(o->bus_name);
+		free(o->dev_name);
+		free(o->node_name);
+		free(o);
+		return NULL;
+	}
+	hlist_add_head(&o->hash, head);
+	rl->nobjs++;
+	return o;
+}
 
-	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, cmd_port_show_cb, dl);
+/* the values that count: those of the file if the object is in it */
+static struct rate_val *rate_obj_val(struct rate_obj *o)
+{
+	return o->lineno ? &o->want : &o->cur;
 }
 
-static void cmd_port_del_help(void)
+static void pr_err_rate_obj(struct rate_load *rl, struct rate_obj *o)
 {
-	pr_err("       devlink port del DEV/PORT_INDEX\n");
+	if (o->lineno)
+		pr_err("%s:%d: ", rl->win.bulk.file, o->lineno);
+	if (o->node_name)
+		pr_err("%s/%s/%s: ", o->bus_name, o->dev_name, o->node_name);
+	else
+		pr_err("%s/%s/%u: ", o->bus_name, o->dev_name, o->port_index);
 }
 
-static int cmd_port_del(struct dl *dl)
+static int rate_load_line(int argc, char **argv, int lineno, void *data)
 {
-	struct nlmsghdr *nlh;
+	struct rate_load *rl = data;
+	struct dl *dl = rl->dl;
+	struct dl_opts *opts = &dl->opts;
+	struct rate_obj *o;
 	int err;
 
-	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
-		cmd_port_del_help();
-		return 0;
-	}
-
-	err = dl_argv_parse(dl, DL_OPT_HANDLEP, 0);
+	memset(opts, 0, sizeof(*opts));
+	dl->argc = argc;
+	dl->argv = argv;
+	err = dl_argv_parse(dl, DL_OPT_HANDLEP | DL_OPT_PORT_FN_RATE_NODE_NAME,
+			    RATE_LOAD_OPTS);
 	if (err)
 		return err;
+	if ((opts->present & DL_OPT_PORT_FN_RATE_TX_SHARE) &&
+	    (opts->present & DL_OPT_PORT_FN_RATE_TX_MAX)) {
+		err = port_fn_check_tx_rates(opts->rate_tx_share,
+					     opts->rate_tx_max);
+		if (err)
+			return err;
+	}
 
-	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_PORT_DEL,
-					  NLM_F_REQUEST | NLM_F_ACK);
+	o = rate_obj_get(rl, opts->bus_name, opts->dev_name,
+			 opts->present & DL_OPT_PORT_FN_RATE_NODE_NAME ?
+			 opts->rate_node_name : NULL, opts->port_index, true);
+	if (!o)
+		return -ENOMEM;
+	if (o->lineno) {
+		pr_err("Rate object already given on line %d\n", o->lineno);
+		return -EINVAL;
+	}
 
-	dl_opts_put(nlh, dl);
+	if (rl->count == rl->size) {
+		unsigned int size = rl->size ? rl->size * 2 : 64;
+		struct rate_obj **objs;
 
-	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, NULL, NULL);
+		objs = realloc(rl->objs, size * sizeof(*objs));
+		if (!objs)
+			return -ENOMEM;
+		rl->objs = objs;
+		rl->size = size;
+	}
+	rl->objs[rl->count++] = o;
+
+	o->lineno = lineno;
+	o->present = opts->present & RATE_LOAD_OPTS;
+	o->want.tx_share = opts->rate_tx_share;
+	o->want.tx_max = opts->rate_tx_max;
+	o->want.tx_priority = opts->rate_tx_priority;
+	o->want.tx_weight = opts->rate_tx_weight;
+	memcpy(o->want.tc_bw, opts->rate_tc_bw, sizeof(o->want.tc_bw));
+	if ((opts->present & DL_OPT_PORT_FN_RATE_PARENT) &&
+	    *opts->rate_parent_node) {
+		o->want.parent = strdup(opts->rate_parent_node);
+		if (!o->want.parent)
+			return -ENOMEM;
+	}
+	return 0;
 }
 
-static int cmd_port(struct dl *dl)
+static int rate_load_dump_cb(const struct nlmsghdr *nlh, void *data)
 {
-	if (dl_argv_match(dl, "help")) {
-		cmd_port_help();
-		return 0;
-	} else if (dl_argv_match(dl, "show") ||
-		   dl_argv_match(dl, "list") ||  dl_no_arg(dl)) {
-		dl_arg_inc(dl);
-		return cmd_port_show(dl);
-	} else if (dl_argv_match(dl, "set")) {
-		dl_arg_inc(dl);
-		return cmd_port_set(dl);
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct rate_load *rl = data;
+	struct dl_opts opts = {};
+	struct rate_obj *o;
+	int err;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    (!tb[DEVLINK_ATTR_PORT_INDEX] && !tb[DEVLINK_ATTR_RATE_NODE_NAME]))
+		return MNL_CB_ERROR;
+
+	o = rate_obj_get(rl, mnl_attr_get_str(tb[DEVLINK_ATTR_BUS_NAME]),
+			 mnl_attr_get_str(tb[DEVLINK_ATTR_DEV_NAME]),
+			 tb[DEVLINK_ATTR_RATE_NODE_NAME] ?
+			 mnl_attr_get_str(tb[DEVLINK_ATTR_RATE_NODE_NAME]) :
+			 NULL,
+			 tb[DEVLINK_ATTR_RATE_NODE_NAME] ? 0 :
+			 mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]), true);
+	if (!o)
+		return MNL_CB_ERROR;
+
+	err = port_fn_get_rates_cb(nlh, &opts);
+	if (err != MNL_CB_OK)
+		return err;
+	o->exists = true;
+	o->cur.tx_share = opts.rate_tx_share;
+	o->cur.tx_max = opts.rate_tx_max;
+	o->cur.tx_priority = opts.rate_tx_priority;
+	o->cur.tx_weight = opts.rate_tx_weight;
+	memcpy(o->cur.tc_bw, opts.rate_tc_bw, sizeof(o->cur.tc_bw));
+	if (tb[DEVLINK_ATTR_RATE_PARENT_NODE_NAME]) {
+		free(o->cur.parent);
+		o->cur.parent =
+			strdup(mnl_attr_get_str(tb[DEVLINK_ATTR_RATE_PARENT_NODE_NAME]));
+		if (!o->cur.parent)
+			return MNL_CB_ERROR;
+	}
+	return MNL_CB_OK;
+}
+
+static int rate_load_check(struct rate_load *rl)
+{
+	struct hlist_node *pos;
+	struct rate_obj *o, *up;
+	struct rate_val *val;
+	unsigned int i, depth;
+	int err = 0;
+
+	for (i = 0; i < RATE_LOAD_HT_SIZE; i++) {
+		hlist_for_each(pos, &rl->ht[i]) {
+			o = container_of(pos, struct rate_obj, hash);
+			o->child_share = 0;
+			val = rate_obj_val(o);
+			if (!o->node_name && !o->exists) {
+				pr_err_rate_obj(rl, o);
+				pr_err("No such leaf rate object\n");
+				err = -ENOENT;
+			}
+			if (!val->parent)
+				continue;
+			o->up = rate_obj_get(rl, o->bus_name, o->dev_name,
+					     val->parent, 0, false);
+			if (!o->up) {
+				pr_err_rate_obj(rl, o);
+				pr_err("Parent node \"%s\" does not exist\n",
+				       val->parent);
+				err = -ENOENT;
+			}
+		}
+	}
+	if (err)
+		return err;
+
+	/* a walk up that is longer than the number of objects loops */
+	for (i = 0; i < rl->count; i++) {
+		o = rl->objs[i];
+		for (up = o->up, depth = 0; up && depth <= rl->nobjs;
+		     up = up->up)
+			depth++;
+		if (up) {
+			pr_err_rate_obj(rl, o);
+			pr_err("Parent \"%s\" makes a cycle\n", o->want.parent);
+			return -ELOOP;
+		}
+		o->depth = depth;
+	}
+
+	for (i = 0; i < RATE_LOAD_HT_SIZE; i++) {
+		hlist_for_each(pos, &rl->ht[i]) {
+			o = container_of(pos, struct rate_obj, hash);
+			if (o->up)
+				o->up->child_share += rate_obj_val(o)->tx_share;
+		}
+	}
+	for (i = 0; i < RATE_LOAD_HT_SIZE; i++) {
+		hlist_for_each(pos, &rl->ht[i]) {
+			o = container_of(pos, struct rate_obj, hash);
+			val = rate_obj_val(o);
+			if (val->tx_max && o->child_share > val->tx_max) {
+				pr_err_rate_obj(rl, o);
+				pr_err("tx_share of the children %" PRIu64
+				       " exceeds tx_max %" PRIu64
+				       " (bytes per second)\n",
+				       o->child_share, val->tx_max);
+				err = -EINVAL;
+			}
+		}
+	}
+	return err;
+}
+
+/* nodes before leaves, parents before children, then file order */
+static int rate_obj_cmp(const void *a, const void *b)
+{
+	const struct rate_obj *oa = *(const struct rate_obj **)a;
+	const struct rate_obj *ob = *(const struct rate_obj **)b;
+
+	if (!oa->node_name != !ob->node_name)
+		return oa->node_name ? -1 : 1;
+	if (oa->node_name && oa->depth != ob->depth)
+		return oa->depth < ob->depth ? -1 : 1;
+	return oa->lineno - ob->lineno;
+}
+
+static int rate_load_obj(struct rate_load *rl, struct rate_obj *o)
+{
+	const struct rate_val *want = &o->want, *cur = &o->cur;
+	struct dl_opts *opts = &rl->dl->opts;
+	uint8_t cmd = DEVLINK_CMD_RATE_SET;
+	struct nlmsghdr *nlh;
+	uint64_t send = 0;
+
+	if (!o->exists) {
+		cmd = DEVLINK_CMD_RATE_NEW;
+		send = o->present;
+	} else {
+		if (!rl->diff)
+			send = o->present;
+		if (want->tx_share != cur->tx_share)
+			send |= DL_OPT_PORT_FN_RATE_TX_SHARE;
+		if (want->tx_max != cur->tx_max)
+			send |= DL_OPT_PORT_FN_RATE_TX_MAX;
+		if (want->tx_priority != cur->tx_priority)
+			send |= DL_OPT_PORT_FN_RATE_TX_PRIORITY;
+		if (want->tx_weight != cur->tx_weight)
+			send |= DL_OPT_PORT_FN_RATE_TX_WEIGHT;
+		if (strcmp(want->parent ? : "", cur->parent ? : ""))
+			send |= DL_OPT_PORT_FN_RATE_PARENT;
+		if (memcmp(want->tc_bw, cur->tc_bw, sizeof(want->tc_bw)))
+			send |= DL_OPT_PORT_FN_RATE_TC_BWS;
+		if (!send) {
+			rl->skipped++;
+			return 0;
+		}
+	}
+
+	memset(opts, 0, sizeof(*opts));
+	opts->bus_name = o->bus_name;
+	opts->dev_name = o->dev_name;
+	if (o->node_name) {
+		opts->rate_node_name = o->node_name;
+		send |= DL_OPT_PORT_FN_RATE_NODE_NAME;
+	} else {
+		opts->port_index = o->port_index;
+		send |= DL_OPT_HANDLEP;
+	}
+	opts->present = send;
+	opts->rate_tx_share = want->tx_share;
+	opts->rate_tx_max = want->tx_max;
+	opts->rate_tx_priority = want->tx_priority;
+	opts->rate_tx_weight = want->tx_weight;
+	opts->rate_parent_node = want->parent ? : "";
+	memcpy(opts->rate_tc_bw, want->tc_bw, sizeof(opts->rate_tc_bw));
+
+	nlh = mnlu_gen_socket_cmd_prepare(&rl->dl->nlg, cmd,
+					  NLM_F_REQUEST | NLM_F_ACK);
+	dl_opts_put(nlh, rl->dl);
+	return dl_win_queue(rl->dl, &rl->win, nlh, o->lineno);
+}
+
+static void rate_load_free(struct rate_load *rl)
+{
+	struct hlist_node *pos, *tmp;
+	struct rate_obj *o;
+	unsigned int i;
+
+	for (i = 0; i < RATE_LOAD_HT_SIZE; i++) {
+		hlist_for_each_safe(pos, tmp, &rl->ht[i]) {
+			o = container_of(pos, struct rate_obj, hash);
+			hlist_del(&o->hash);
+			free(o->bus_name);
+			free(o->dev_name);
+			free(o->node_name);
+			free(o->want.parent);
+			free(o->cur.parent);
+			free(o);
+		}
+	}
+	free(rl->objs);
+	dl_win_free(&rl->win);
+}
+
+static int cmd_port_fn_rate_load(struct dl *dl)
+{
+	struct rate_load rl = { .dl = dl };
+	struct nlmsghdr *nlh;
+	unsigned int i;
+	int err;
+
+	if (dl_no_arg(dl)) {
+		pr_err("File name expected.\n");
+		return -EINVAL;
+	}
+	dl_win_init(&rl.win, dl_argv_next(dl));
+	if (dl_argv_match(dl, "diff")) {
+		dl_arg_inc(dl);
+		rl.diff = true;
+	}
+	if (dl_argc(dl)) {
+		pr_err("Unknown option \"%s\"\n", dl_argv(dl));
+		return -EINVAL;
+	}
+
+	err = dl_win_read(&rl.win, rate_load_line, &rl, "invalid rate object");
+	if (err) {
+		pr_err("%s: nothing was sent\n", rl.win.bulk.file);
+		goto out;
+	}
+
+	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_RATE_GET,
+					  NLM_F_REQUEST | NLM_F_ACK |
+					  NLM_F_DUMP);
+	err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, rate_load_dump_cb, &rl);
+	if (err)
+		goto out;
+
+	err = rate_load_check(&rl);
+	if (err) {
+		pr_err("%s: nothing was sent\n", rl.win.bulk.file);
+		goto out;
+	}
+
+	qsort(rl.objs, rl.count, sizeof(*rl.objs), rate_obj_cmp);
+	for (i = 0; i < rl.count && !err; i++)
+		err = rate_load_obj(&rl, rl.objs[i]);
+	if (!err)
+		err = dl_win_flush(dl, &rl.win);
+	if (err)
+		goto out;
+
+	if (rl.win.bulk.failed) {
+		pr_err("%u of %u requests failed\n", rl.win.bulk.failed,
+		       rl.win.sent);
+		err = -EINVAL;
+	}
+	if (dl->stats)
+		pr_out("%u rate objects, %u set, %u unchanged\n",
+		       rl.count, rl.win.sent - rl.win.bulk.failed, rl.skipped);
+out:
+	rate_load_free(&rl);
+	return err;
+}
+
+static int cmd_port_function_rate(struct dl *dl)
+{
+	if (dl_argv_match(dl, "help")) {
+		cmd_port_fn_rate_help();
+		return 0;
+	} else if (dl_argv_match(dl, "show") || dl_no_arg(dl)) {
+		dl_arg_inc(dl);
+		return cmd_port_fn_rate_show(dl);
+	} else if (dl_argv_match(dl, "add")) {
+		dl_arg_inc(dl);
+		return cmd_port_fn_rate_add(dl);
+	} else if (dl_argv_match(dl, "del")) {
+		dl_arg_inc(dl);
+		return cmd_port_fn_rate_del(dl);
+	} else if (dl_argv_match(dl, "set")) {
+		dl_arg_inc(dl);
+		return cmd_port_fn_rate_set(dl);
+	} else if (dl_argv_match(dl, "load")) {
+		dl_arg_inc(dl);
+		return cmd_port_fn_rate_load(dl);
+	}
+	pr_err("Command \"%s\" not found\n", dl_argv(dl));
+	return -ENOENT;
+}
+
+static int cmd_port_function(struct dl *dl)
+{
+	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
+		cmd_port_function_help();
+		return 0;
+	} else if (dl_argv_match(dl, "set")) {
+		dl_arg_inc(dl);
+		return cmd_port_function_set(dl);
+	} else if (dl_argv_match(dl, "rate")) {
+		dl_arg_inc(dl);
+		return cmd_port_function_rate(dl);
+	}
+	pr_err("Command \"%s\" not found\n", dl_argv(dl));
+	return -ENOENT;
+}
+
+static int cmd_health(struct dl *dl);
+static int __cmd_health_show(struct dl *dl, bool show_device, bool show_port);
+
+static void cmd_port_add_help(void)
+{
+	pr_err("       devlink port add DEV/PORT_INDEX flavour FLAVOUR pfnum PFNUM\n"
+	       "                      [ sfnum SFNUM ][ controller CNUM ]\n");
+}
+
+static int cmd_port_add(struct dl *dl)
+{
+	struct nlmsghdr *nlh;
+	int err;
+
+	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
+		cmd_port_add_help();
+		return 0;
+	}
+
+	err = dl_argv_parse(dl, DL_OPT_HANDLE | DL_OPT_HANDLEP |
+			    DL_OPT_PORT_FLAVOUR | DL_OPT_PORT_PFNUMBER,
+			    DL_OPT_PORT_SFNUMBER | DL_OPT_PORT_CONTROLLER);
+	if (err)
+		return err;
+
+	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_PORT_NEW,
+					  NLM_F_REQUEST | NLM_F_ACK);
+
+	dl_opts_put(nlh, dl);
+
+	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, cmd_port_show_cb, dl);
+}
+
+static void cmd_port_del_help(void)
+{
+	pr_err("       devlink port del DEV/PORT_INDEX\n");
+}
+
+static int cmd_port_del(struct dl *dl)
+{
+	struct nlmsghdr *nlh;
+	int err;
+
+	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
+		cmd_port_del_help();
+		return 0;
+	}
+
+	err = dl_argv_parse(dl, DL_OPT_HANDLEP, 0);
+	if (err)
+		return err;
+
+	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_PORT_DEL,
+					  NLM_F_REQUEST | NLM_F_ACK);
+
+	dl_opts_put(nlh, dl);
+
+	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, NULL, NULL);
+}
+
+static int cmd_port(struct dl *dl)
+{
+	if (dl_argv_match(dl, "help")) {
+		cmd_port_help();
+		return 0;
+	} else if (dl_argv_match(dl, "show") ||
+		   dl_argv_match(dl, "list") ||  dl_no_arg(dl)) {
+		dl_arg_inc(dl);
+		return cmd_port_show(dl);
+	} else if (dl_argv_match(dl, "set")) {
+		dl_arg_inc(dl);
+		return cmd_port_set(dl);
 	} else if (dl_argv_match(dl, "split")) {
 		dl_arg_inc(dl);
 		return cmd_port_split(dl);
@@ -6213,6 +7448,8 @@ static void cmd_sb_help(void)
 	pr_err("       devlink sb occupancy show { DEV | DEV/PORT_INDEX } [ sb SB_INDEX ]\n");
 	pr_err("       devlink sb occupancy snapshot DEV [ sb SB_INDEX ]\n");
 	pr_err("       devlink sb occupancy clearmax DEV [ sb SB_INDEX ]\n");
+	pr_err("       devlink sb occupancy watch DEV [ sb SB_INDEX ]\n");
+	pr_err("                                  [ interval MSEC ] [ count COUNT ]\n");
 }
 
 static void pr_out_sb(struct dl *dl, struct nlattr **tb)
@@ -6900,16 +8137,11 @@ out:
 	return err;
 }
 
-static int cmd_sb_occ_snapshot(struct dl *dl)
+static int sb_occ_cmd(struct dl *dl, uint8_t cmd)
 {
 	struct nlmsghdr *nlh;
-	int err;
-
-	err = dl_argv_parse(dl, DL_OPT_HANDLE | DL_OPT_SB, 0);
-	if (err)
-		return err;
 
-	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_SB_OCC_SNAPSHOT,
+	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, cmd,
 			       NLM_F_REQUEST | NLM_F_ACK);
 
 	dl_opts_put(nlh, dl);
@@ -6917,48 +8149,461 @@ static int cmd_sb_occ_snapshot(struct dl *dl)
 	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, NULL, NULL);
 }
 
+static int cmd_sb_occ_snapshot(struct dl *dl)
+{
+	int err;
+
+	err = dl_argv_parse(dl, DL_OPT_HANDLE | DL_OPT_SB, 0);
+	if (err)
+		return err;
+
+	return sb_occ_cmd(dl, DEVLINK_CMD_SB_OCC_SNAPSHOT);
+}
+
 static int cmd_sb_occ_clearmax(struct dl *dl)
 {
-	struct nlmsghdr *nlh;
 	int err;
 
 	err = dl_argv_parse(dl, DL_OPT_HANDLE | DL_OPT_SB, 0);
 	if (err)
 		return err;
 
-	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_SB_OCC_MAX_CLEAR,
-			       NLM_F_REQUEST | NLM_F_ACK);
+	return sb_occ_cmd(dl, DEVLINK_CMD_SB_OCC_MAX_CLEAR);
+}
 
-	dl_opts_put(nlh, dl);
+/*
+ * "sb occupancy watch": once per interval take a snapshot, read it back
+ * and clear the watermarks, all on the devlink socket. The ports, pools
+ * and TCs are learnt by a first read and laid out in one array, so a
+ * tick only stores into it. Each tick is printed as one record of the
+ * items that saw traffic, and a log2 histogram of every item's max
+ * watermark is printed when the watch ends.
+ */
+#define OCC_WATCH_HIST		33	/* 0, then [2^(n-1), 2^n - 1] */
+#define OCC_WATCH_INTERVAL	100	/* msec */
 
-	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, NULL, NULL);
+struct occ_watch_item {
+	uint32_t cur;
+	uint32_t max;
+	uint32_t hist[OCC_WATCH_HIST];
+};
+
+struct occ_watch {
+	struct dl *dl;
+	bool learn;
+	uint32_t *ports;	/* sorted port indexes */
+	unsigned int port_count;
+	unsigned int pool_count;
+	unsigned int tc_count;
+	unsigned int stride;	/* items per port: pools, itcs, etcs */
+	struct occ_watch_item *items;
+	int err;
+};
+
+static volatile sig_atomic_t occ_watch_stop;
+
+static void occ_watch_sig(int signum)
+{
+	occ_watch_stop = 1;
 }
 
-static int cmd_sb_occ(struct dl *dl)
+static int occ_watch_port_cmp(const void *a, const void *b)
 {
-	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
-		cmd_sb_help();
-		return 0;
-	} else if (dl_argv_match(dl, "show") ||
-		   dl_argv_match(dl, "list")) {
-		dl_arg_inc(dl);
-		return cmd_sb_occ_show(dl);
-	} else if (dl_argv_match(dl, "snapshot")) {
-		dl_arg_inc(dl);
-		return cmd_sb_occ_snapshot(dl);
-	} else if (dl_argv_match(dl, "clearmax")) {
-		dl_arg_inc(dl);
-		return cmd_sb_occ_clearmax(dl);
-	}
-	pr_err("Command \"%s\" not found\n", dl_argv(dl));
-	return -ENOENT;
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
 }
 
-static int cmd_sb(struct dl *dl)
+static void occ_watch_learn(struct occ_watch *w, uint32_t port_index,
+			    unsigned int pool, unsigned int tc)
 {
-	if (dl_argv_match(dl, "help")) {
-		cmd_sb_help();
-		return 0;
+	uint32_t *ports;
+	unsigned int i;
+
+	if (pool >= w->pool_count)
+		w->pool_count = pool + 1;
+	if (tc != UINT_MAX && tc >= w->tc_count)
+		w->tc_count = tc + 1;
+
+	for (i = 0; i < w->port_count; i++)
+		if (w->ports[i] == port_index)
+			return;
+	ports = realloc(w->ports, (w->port_count + 1) * sizeof(*ports));
+	if (!ports) {
+		w->err = -ENOMEM;
+		return;
+	}
+	ports[w->port_count++] = port_index;
+	w->ports = ports;
+}
+
+static struct occ_watch_item *occ_watch_item(struct occ_watch *w,
+					     uint32_t port_index,
+					     unsigned int off)
+{
+	uint32_t *port;
+
+	port = bsearch(&port_index, w->ports, w->port_count,
+		       sizeof(*w->ports), occ_watch_port_cmp);
+	if (!port || off >= w->stride)
+		return NULL;
+	return &w->items[(port - w->ports) * w->stride + off];
+}
+
+static void occ_watch_store(struct occ_watch_item *item, struct nlattr **tb)
+{
+	item->cur = mnl_attr_get_u32(tb[DEVLINK_ATTR_SB_OCC_CUR]);
+	item->max = mnl_attr_get_u32(tb[DEVLINK_ATTR_SB_OCC_MAX]);
+	item->hist[item->max ? 32 - __builtin_clz(item->max) : 0]++;
+}
+
+static int occ_watch_pool_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct occ_watch *w = data;
+	struct occ_watch_item *item;
+	uint32_t port_index;
+	uint16_t pool;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    !tb[DEVLINK_ATTR_PORT_INDEX] || !tb[DEVLINK_ATTR_SB_INDEX] ||
+	    !tb[DEVLINK_ATTR_SB_POOL_INDEX] ||
+	    !tb[DEVLINK_ATTR_SB_OCC_CUR] || !tb[DEVLINK_ATTR_SB_OCC_MAX])
+		return MNL_CB_ERROR;
+	if (!dl_dump_filter(w->dl, tb))
+		return MNL_CB_OK;
+
+	port_index = mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]);
+	pool = mnl_attr_get_u16(tb[DEVLINK_ATTR_SB_POOL_INDEX]);
+	if (w->learn) {
+		occ_watch_learn(w, port_index, pool, UINT_MAX);
+		return MNL_CB_OK;
+	}
+
+	item = occ_watch_item(w, port_index, pool);
+	if (item)
+		occ_watch_store(item, tb);
+	return MNL_CB_OK;
+}
+
+static int occ_watch_tc_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct occ_watch *w = data;
+	struct occ_watch_item *item;
+	uint32_t port_index;
+	uint8_t pool_type;
+	uint16_t tc;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    !tb[DEVLINK_ATTR_PORT_INDEX] || !tb[DEVLINK_ATTR_SB_INDEX] ||
+	    !tb[DEVLINK_ATTR_SB_TC_INDEX] || !tb[DEVLINK_ATTR_SB_POOL_TYPE] ||
+	    !tb[DEVLINK_ATTR_SB_POOL_INDEX] ||
+	    !tb[DEVLINK_ATTR_SB_OCC_CUR] || !tb[DEVLINK_ATTR_SB_OCC_MAX])
+		return MNL_CB_ERROR;
+	if (!dl_dump_filter(w->dl, tb))
+		return MNL_CB_OK;
+
+	port_index = mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]);
+	tc = mnl_attr_get_u16(tb[DEVLINK_ATTR_SB_TC_INDEX]);
+	if (w->learn) {
+		occ_watch_learn(w, port_index,
+				mnl_attr_get_u16(tb[DEVLINK_ATTR_SB_POOL_INDEX]),
+				tc);
+		return MNL_CB_OK;
+	}
+
+	pool_type = mnl_attr_get_u8(tb[DEVLINK_ATTR_SB_POOL_TYPE]);
+	if (pool_type != DEVLINK_SB_POOL_TYPE_INGRESS &&
+	    pool_type != DEVLINK_SB_POOL_TYPE_EGRESS)
+		return MNL_CB_OK;
+	if (tc >= w->tc_count)
+		return MNL_CB_OK;
+
+	item = occ_watch_item(w, port_index, w->pool_count + tc +
+			      (pool_type == DEVLINK_SB_POOL_TYPE_EGRESS ?
+			       w->tc_count : 0));
+	if (item)
+		occ_watch_store(item, tb);
+	return MNL_CB_OK;
+}
+
+static void occ_watch_item_name(struct occ_watch *w, unsigned int off,
+				const char **type, unsigned int *index)
+{
+	if (off < w->pool_count) {
+		*type = "pool";
+		*index = off;
+	} else if (off < w->pool_count + w->tc_count) {
+		*type = "itc";
+		*index = off - w->pool_count;
+	} else {
+		*type = "etc";
+		*index = off - w->pool_count - w->tc_count;
+	}
+}
+
+static void occ_watch_print_tick(struct occ_watch *w, unsigned long long tick,
+				 uint64_t elapsed_ns)
+{
+	struct dl *dl = w->dl;
+	unsigned int p, off, index;
+	const char *type;
+
+	if (dl->json_output) {
+		open_json_object(NULL);
+		print_lluint(PRINT_JSON, "tick", NULL, tick);
+		print_u64(PRINT_JSON, "time", NULL, elapsed_ns);
+		open_json_array(PRINT_JSON, "occupancy");
+	} else {
+		pr_out("%llu %" PRIu64 ".%03" PRIu64, tick,
+		       elapsed_ns / 1000000000, elapsed_ns / 1000000 % 1000);
+	}
+
+	for (p = 0; p < w->port_count; p++) {
+		for (off = 0; off < w->stride; off++) {
+			struct occ_watch_item *item;
+
+			item = &w->items[p * w->stride + off];
+			if (!item->cur && !item->max)
+				continue;
+			occ_watch_item_name(w, off, &type, &index);
+			if (dl->json_output) {
+				open_json_object(NULL);
+				print_uint(PRINT_JSON, "port", NULL,
+					   w->ports[p]);
+				print_string(PRINT_JSON, "type", NULL, type);
+				print_uint(PRINT_JSON, "index", NULL, index);
+				print_uint(PRINT_JSON, "current", NULL,
+					   item->cur);
+				print_uint(PRINT_JSON, "max", NULL, item->max);
+				close_json_object();
+			} else {
+				pr_out(" %u:%s%u:%u/%u", w->ports[p], type,
+				       index, item->cur, item->max);
+			}
+		}
+	}
+
+	if (dl->json_output) {
+		close_json_array(PRINT_JSON, NULL);
+		close_json_object();
+	} else {
+		pr_out("\n");
+	}
+	fflush(stdout);
+}
+
+static void occ_watch_print_hist(struct occ_watch *w)
+{
+	struct dl *dl = w->dl;
+	unsigned int p, off, index, b;
+	const char *type;
+
+	if (dl->json_output) {
+		open_json_object(NULL);
+		open_json_array(PRINT_JSON, "histogram");
+	}
+
+	for (p = 0; p < w->port_count; p++) {
+		for (off = 0; off < w->stride; off++) {
+			struct occ_watch_item *item;
+
+			item = &w->items[p * w->stride + off];
+			for (b = 1; b < OCC_WATCH_HIST; b++)
+				if (item->hist[b])
+					break;
+			if (b == OCC_WATCH_HIST)
+				continue;	/* never occupied */
+			occ_watch_item_name(w, off, &type, &index);
+			if (dl->json_output) {
+				open_json_object(NULL);
+				print_uint(PRINT_JSON, "port", NULL,
+					   w->ports[p]);
+				print_string(PRINT_JSON, "type", NULL, type);
+				print_uint(PRINT_JSON, "index", NULL, index);
+				open_json_array(PRINT_JSON, "max");
+			} else {
+				pr_out("%u:%s%u:", w->ports[p], type, index);
+			}
+			for (b = 0; b < OCC_WATCH_HIST; b++) {
+				uint64_t lo = b ? 1ULL << (b - 1) : 0;
+				uint64_t hi = b ? (1ULL << b) - 1 : 0;
+
+				if (!item->hist[b])
+					continue;
+				if (dl->json_output) {
+					open_json_object(NULL);
+					print_u64(PRINT_JSON, "low", NULL, lo);
+					print_u64(PRINT_JSON, "high", NULL, hi);
+					print_uint(PRINT_JSON, "count", NULL,
+						   item->hist[b]);
+					close_json_object();
+				} else {
+					pr_out(" %" PRIu64 "-%" PRIu64 ":%u",
+					       lo, hi, item->hist[b]);
+				}
+			}
+			if (dl->json_output) {
+				close_json_array(PRINT_JSON, NULL);
+				close_json_object();
+			} else {
+				pr_out("\n");
+			}
+		}
+	}
+
+	if (dl->json_output) {
+		close_json_array(PRINT_JSON, NULL);
+		close_json_object();
+	}
+}
+
+static int occ_watch_read(struct occ_watch *w)
+{
+	uint16_t flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP;
+	struct dl *dl = w->dl;
+	struct nlmsghdr *nlh;
+	int err;
+
+	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg,
+					  DEVLINK_CMD_SB_PORT_POOL_GET, flags);
+	err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, occ_watch_pool_cb, w);
+	if (err)
+		return err;
+
+	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg,
+					  DEVLINK_CMD_SB_TC_POOL_BIND_GET,
+					  flags);
+	err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, occ_watch_tc_cb, w);
+	return err ? err : w->err;
+}
+
+static int cmd_sb_occ_watch(struct dl *dl)
+{
+	struct sigaction act = { .sa_handler = occ_watch_sig };
+	struct sigaction oldint, oldterm;
+	struct occ_watch w = { .dl = dl };
+	double start, next, now, interval;
+	unsigned long long tick;
+	int err;
+
+	dl->opts.interval = OCC_WATCH_INTERVAL;
+	dl->opts.count = 0;
+	err = dl_argv_parse(dl, DL_OPT_HANDLE | DL_OPT_SB,
+			    DL_OPT_INTERVAL);
+	if (err)
+		return err;
+	if (!dl->opts.interval) {
+		pr_err("Interval must be at least 1 msec\n");
+		return -EINVAL;
+	}
+	interval = dl->opts.interval / 1000.0;
+
+	w.learn = true;
+	err = occ_watch_read(&w);
+	if (err)
+		goto out;
+	w.learn = false;
+	if (!w.port_count) {
+		pr_err("No shared buffer occupancy to watch\n");
+		err = -ENOENT;
+		goto out;
+	}
+	qsort(w.ports, w.port_count, sizeof(*w.ports), occ_watch_port_cmp);
+	w.stride = w.pool_count + 2 * w.tc_count;
+	w.items = calloc(w.port_count * w.stride, sizeof(*w.items));
+	if (!w.items) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	/* one record per line, whatever -p says */
+	if (dl->json_output) {
+		jsonw_pretty(get_json_writer(), false);
+		jsonw_lines(get_json_writer(), true);
+	}
+
+	occ_watch_stop = 0;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGINT, &act, &oldint);
+	sigaction(SIGTERM, &act, &oldterm);
+
+	/* the first window starts with cleared watermarks */
+	err = sb_occ_cmd(dl, DEVLINK_CMD_SB_OCC_MAX_CLEAR);
+	start = monotonic_now();
+	next = start;
+
+	for (tick = 1; !err && !occ_watch_stop; tick++) {
+		next += interval;
+		if (monotonic_sleep_until(next) || occ_watch_stop)
+			break;
+
+		err = sb_occ_cmd(dl, DEVLINK_CMD_SB_OCC_SNAPSHOT);
+		if (!err)
+			err = occ_watch_read(&w);
+		if (!err)
+			err = sb_occ_cmd(dl, DEVLINK_CMD_SB_OCC_MAX_CLEAR);
+		if (err)
+			break;
+
+		now = monotonic_now();
+		occ_watch_print_tick(&w, tick, (now - start) * 1e9);
+
+		/* fell behind: skip the missed ticks rather than bunch up */
+		if (now > next + interval)
+			next = now;
+
+		if (dl->opts.count && tick == dl->opts.count)
+			break;
+	}
+
+	sigaction(SIGINT, &oldint, NULL);
+	sigaction(SIGTERM, &oldterm, NULL);
+
+	/* a signal may have cut a request short */
+	if (occ_watch_stop)
+		err = 0;
+	occ_watch_print_hist(&w);
+out:
+	free(w.items);
+	free(w.ports);
+	return err;
+}
+
+
+static int cmd_sb_occ(struct dl *dl)
+{
+	if (dl_argv_match(dl, "help") || dl_no_arg(dl)) {
+		cmd_sb_help();
+		return 0;
+	} else if (dl_argv_match(dl, "show") ||
+		   dl_argv_match(dl, "list")) {
+		dl_arg_inc(dl);
+		return cmd_sb_occ_show(dl);
+	} else if (dl_argv_match(dl, "snapshot")) {
+		dl_arg_inc(dl);
+		return cmd_sb_occ_snapshot(dl);
+	} else if (dl_argv_match(dl, "clearmax")) {
+		dl_arg_inc(dl);
+		return cmd_sb_occ_clearmax(dl);
+	} else if (dl_argv_match(dl, "watch")) {
+		dl_arg_inc(dl);
+		return cmd_sb_occ_watch(dl);
+	}
+	pr_err("Command \"%s\" not found\n", dl_argv(dl));
+	return -ENOENT;
+}
+
+static int cmd_sb(struct dl *dl)
+{
+	if (dl_argv_match(dl, "help")) {
+		cmd_sb_help();
+		return 0;
 	} else if (dl_argv_match(dl, "show") ||
 		   dl_argv_match(dl, "list") || dl_no_arg(dl)) {
 		dl_arg_inc(dl);
@@ -7086,12 +8731,20 @@ static const char *cmd_obj(uint8_t cmd)
 	}
 }
 
-static void pr_out_mon_header(uint8_t cmd)
+static void pr_out_mon_ts(const struct timespec *ts);
+
+static void pr_out_mon_header(struct dl *dl, uint8_t cmd)
 {
 	if (!is_json_context()) {
 		pr_out("[%s,%s] ", cmd_obj(cmd), cmd_name(cmd));
 	} else {
 		open_json_object(NULL);
+		if (dl->mon_ts) {
+			pr_out_mon_ts(dl->mon_ts);
+			if (dl->mon_count > 1)
+				print_uint(PRINT_JSON, "count", NULL,
+					   dl->mon_count);
+		}
 		print_string(PRINT_JSON, "command", NULL, cmd_name(cmd));
 		open_json_object(cmd_obj(cmd));
 	}
@@ -7171,7 +8824,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
 		if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		dl->stats = true;
 		pr_out_dev(dl, nlh, tb);
 		pr_out_mon_footer();
@@ -7184,7 +8837,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
 		    !tb[DEVLINK_ATTR_PORT_INDEX])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_port(dl, tb);
 		pr_out_mon_footer();
 		break;
@@ -7196,7 +8849,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
 		    !tb[DEVLINK_ATTR_PARAM])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_param(dl, tb, false, false);
 		pr_out_mon_footer();
 		break;
@@ -7208,7 +8861,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
 		    !tb[DEVLINK_ATTR_REGION_NAME])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_region(dl, tb);
 		pr_out_mon_footer();
 		break;
@@ -7218,7 +8871,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
 		if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_flash_update(dl, tb);
 		pr_out_mon_footer();
 		break;
@@ -7227,7 +8880,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
 		    !tb[DEVLINK_ATTR_HEALTH_REPORTER])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_health(dl, tb, true, true);
 		pr_out_mon_footer();
 		break;
@@ -7244,7 +8897,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		    !tb[DEVLINK_ATTR_TRAP_METADATA] ||
 		    !tb[DEVLINK_ATTR_STATS])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_trap(dl, tb, false);
 		pr_out_mon_footer();
 		break;
@@ -7257,7 +8910,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		    !tb[DEVLINK_ATTR_TRAP_GROUP_NAME] ||
 		    !tb[DEVLINK_ATTR_STATS])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_trap_group(dl, tb, false);
 		pr_out_mon_footer();
 		break;
@@ -7271,7 +8924,7 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		    !tb[DEVLINK_ATTR_TRAP_POLICER_RATE] ||
 		    !tb[DEVLINK_ATTR_TRAP_POLICER_BURST])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_trap_policer(dl, tb, false);
 		pr_out_mon_footer();
 		break;
@@ -7283,20 +8936,309 @@ static int cmd_mon_show_cb(const struct nlmsghdr *nlh, void *data)
 		if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
 		    !tb[DEVLINK_ATTR_LINECARD_INDEX])
 			return MNL_CB_ERROR;
-		pr_out_mon_header(genl->cmd);
+		pr_out_mon_header(dl, genl->cmd);
 		pr_out_linecard(dl, tb);
 		pr_out_mon_footer();
 		break;
 	}
-	fflush(stdout);
+	/* the stream flushes once per batch */
+	if (!dl->mon_ts)
+		fflush(stdout);
+	return MNL_CB_OK;
+}
+
+/*
+ * "monitor stream": the socket gets a large receive buffer and is drained
+ * a batch of datagrams at a time. Each event is one compact JSON line
+ * stamped with the time its batch was received. Port and health events
+ * that repeat for the same object within the window are held back and
+ * printed once at the end of it, with a count. Overruns of the receive
+ * buffer are reported as records of their own.
+ */
+#define MON_STREAM_RCVBUF	(4 * 1024 * 1024)
+#define MON_STREAM_VLEN		64
+#define MON_STREAM_SLOT		32768
+#define MON_STREAM_PENDING	256
+
+struct mon_pending {
+	char key[128];
+	unsigned int count;
+	struct timespec ts;
+	struct nlmsghdr *nlh;	/* the latest one */
+};
+
+struct mon_stream {
+	struct dl *dl;
+	unsigned int window;	/* msec, 0 to not coalesce */
+	struct timespec ts;
+	struct timespec window_end;
+	struct mon_pending pending[MON_STREAM_PENDING];
+	unsigned int pending_count;
+	uint64_t events;
+	uint64_t coalesced;
+	uint64_t overruns;
+};
+
+static void pr_out_mon_ts(const struct timespec *ts)
+{
+	print_u64(PRINT_JSON, "ts", NULL,
+		  (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec);
+}
+
+/* The key of an event worth coalescing, false if it is not one. */
+static bool mon_stream_key(const struct nlmsghdr *nlh, char *key, size_t len)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb_health[DEVLINK_ATTR_MAX + 1] = {};
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	const char *reporter = "";
+	int64_t port_index = -1;
+
+	switch (genl->cmd) {
+	case DEVLINK_CMD_PORT_GET: /* fall through */
+	case DEVLINK_CMD_PORT_SET: /* fall through */
+	case DEVLINK_CMD_PORT_NEW: /* fall through */
+	case DEVLINK_CMD_PORT_DEL: /* fall through */
+	case DEVLINK_CMD_HEALTH_REPORTER_RECOVER:
+		break;
+	default:
+		return false;
+	}
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME])
+		return false;
+	if (tb[DEVLINK_ATTR_PORT_INDEX])
+		port_index = mnl_attr_get_u32(tb[DEVLINK_ATTR_PORT_INDEX]);
+	if (tb[DEVLINK_ATTR_HEALTH_REPORTER] &&
+	    mnl_attr_parse_nested(tb[DEVLINK_ATTR_HEALTH_REPORTER], attr_cb,
+				  tb_health) == MNL_CB_OK &&
+	    tb_health[DEVLINK_ATTR_HEALTH_REPORTER_NAME])
+		reporter = mnl_attr_get_str(tb_health[DEVLINK_ATTR_HEALTH_REPORTER_NAME]);
+
+	snprintf(key, len, "%u %s/%s %" PRId64 " %s", genl->cmd,
+		 mnl_attr_get_str(tb[DEVLINK_ATTR_BUS_NAME]),
+		 mnl_attr_get_str(tb[DEVLINK_ATTR_DEV_NAME]),
+		 port_index, reporter);
+	return true;
+}
+
+static void mon_stream_print(struct mon_stream *ms, const struct nlmsghdr *nlh,
+			     const struct timespec *ts, unsigned int count)
+{
+	struct dl *dl = ms->dl;
+
+	dl->mon_ts = ts;
+	dl->mon_count = count;
+	/* a malformed event is not worth ending the stream over */
+	cmd_mon_show_cb(nlh, dl);
+	dl->mon_ts = NULL;
+}
+
+static void mon_stream_flush(struct mon_stream *ms)
+{
+	struct mon_pending *p;
+	unsigned int i;
+
+	for (i = 0; i < ms->pending_count; i++) {
+		p = &ms->pending[i];
+		mon_stream_print(ms, p->nlh, &p->ts, p->count);
+		free(p->nlh);
+	}
+	ms->pending_count = 0;
+}
+
+static int mon_stream_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct mon_stream *ms = data;
+	struct mon_pending *p;
+	struct nlmsghdr *copy;
+	char key[128];
+	unsigned int i;
+
+	if (!cmd_filter_check(ms->dl, genl->cmd))
+		return MNL_CB_OK;
+	ms->events++;
+
+	if (!ms->window || !mon_stream_key(nlh, key, sizeof(key))) {
+		mon_stream_print(ms, nlh, &ms->ts, 1);
+		return MNL_CB_OK;
+	}
+
+	copy = malloc(nlh->nlmsg_len);
+	if (!copy) {
+		mon_stream_print(ms, nlh, &ms->ts, 1);
+		return MNL_CB_OK;
+	}
+	memcpy(copy, nlh, nlh->nlmsg_len);
+
+	for (i = 0; i < ms->pending_count; i++) {
+		p = &ms->pending[i];
+		if (strcmp(p->key, key))
+			continue;
+		free(p->nlh);
+		p->nlh = copy;
+		p->ts = ms->ts;
+		p->count++;
+		ms->coalesced++;
+		return MNL_CB_OK;
+	}
+
+	if (ms->pending_count == MON_STREAM_PENDING)
+		mon_stream_flush(ms);
+	if (!ms->pending_count) {
+		clock_gettime(CLOCK_MONOTONIC, &ms->window_end);
+		ms->window_end.tv_sec += ms->window / 1000;
+		ms->window_end.tv_nsec += (ms->window % 1000) * 1000000;
+		if (ms->window_end.tv_nsec >= 1000000000) {
+			ms->window_end.tv_sec++;
+			ms->window_end.tv_nsec -= 1000000000;
+		}
+	}
+	p = &ms->pending[ms->pending_count++];
+	strcpy(p->key, key);
+	p->nlh = copy;
+	p->ts = ms->ts;
+	p->count = 1;
 	return MNL_CB_OK;
 }
 
+/* msec until the window closes, -1 if there is nothing held back */
+static int mon_stream_timeout(struct mon_stream *ms)
+{
+	struct timespec now;
+	int64_t ms_left;
+
+	if (!ms->pending_count)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms_left = (ms->window_end.tv_sec - now.tv_sec) * 1000 +
+		  (ms->window_end.tv_nsec - now.tv_nsec) / 1000000;
+	return ms_left > 0 ? ms_left : 0;
+}
+
+static int cmd_mon_stream(struct dl *dl, unsigned int rcvbuf,
+			  unsigned int window)
+{
+	struct mon_stream *ms;
+	struct mnlu_batch batch;
+	struct sigaction act, oact;
+	struct pollfd pfd;
+	int err = 0, n;
+
+	ms = calloc(1, sizeof(*ms));
+	if (!ms)
+		return -ENOMEM;
+	ms->dl = dl;
+	ms->window = window;
+
+	if (mnlu_batch_init(&batch, MON_STREAM_VLEN, MON_STREAM_SLOT)) {
+		pr_err("Failed to allocate receive buffers\n");
+		free(ms);
+		return -ENOMEM;
+	}
+	if (mnlu_socket_set_rcvbuf(dl->nlg.nl, rcvbuf))
+		pr_err("Failed to set receive buffer size: %s\n",
+		       strerror(errno));
+
+	/* stop on SIGINT, but only after what was held back is out */
+	act.sa_handler = dummy_signal_handler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = SA_NODEFER;
+	sigaction(SIGINT, &act, &oact);
+
+	pfd.fd = mnl_socket_get_fd(dl->nlg.nl);
+	pfd.events = POLLIN;
+
+	while (1) {
+		n = poll(&pfd, 1, mon_stream_timeout(ms));
+		if (n < 0) {
+			if (errno != EINTR) {
+				pr_err("poll() failed: %s\n", strerror(errno));
+				err = -errno;
+			}
+			break;
+		}
+
+		if (pfd.revents & POLLIN) {
+			do {
+				n = mnlu_socket_recv_batch(dl->nlg.nl, &batch,
+							   &ms->ts,
+							   mon_stream_cb, ms);
+				if (n < 0 && errno == ENOBUFS) {
+					/* events were dropped, say so */
+					ms->overruns++;
+					clock_gettime(CLOCK_REALTIME, &ms->ts);
+					open_json_object(NULL);
+					pr_out_mon_ts(&ms->ts);
+					print_u64(PRINT_JSON, "overrun", NULL,
+						  ms->overruns);
+					close_json_object();
+					n = MON_STREAM_VLEN;
+				} else if (n < 0) {
+					pr_err("devlink answers: %s\n",
+					       strerror(errno));
+					err = -errno;
+					goto out;
+				}
+			} while (n == MON_STREAM_VLEN);
+		}
+
+		if (ms->pending_count && !mon_stream_timeout(ms))
+			mon_stream_flush(ms);
+		fflush(stdout);
+	}
+
+out:
+	mon_stream_flush(ms);
+	clock_gettime(CLOCK_REALTIME, &ms->ts);
+	open_json_object(NULL);
+	pr_out_mon_ts(&ms->ts);
+	open_json_object("summary");
+	print_u64(PRINT_JSON, "events", NULL, ms->events);
+	print_u64(PRINT_JSON, "coalesced", NULL, ms->coalesced);
+	print_u64(PRINT_JSON, "overruns", NULL, ms->overruns);
+	close_json_object();
+	close_json_object();
+	fflush(stdout);
+
+	sigaction(SIGINT, &oact, NULL);
+	mnlu_batch_free(&batch);
+	free(ms);
+	return err;
+}
+
 static int cmd_mon_show(struct dl *dl)
 {
-	int err;
+	uint32_t rcvbuf = MON_STREAM_RCVBUF;
+	uint32_t window = 0;
 	unsigned int index = 0;
 	const char *cur_obj;
+	bool stream = false;
+	int err;
+
+	if (dl_argv_match(dl, "stream")) {
+		dl_arg_inc(dl);
+		stream = true;
+		while (dl_argc(dl)) {
+			if (dl_argv_match(dl, "rcvbuf")) {
+				dl_arg_inc(dl);
+				err = dl_argv_uint32_t(dl, &rcvbuf);
+			} else if (dl_argv_match(dl, "window")) {
+				dl_arg_inc(dl);
+				err = dl_argv_uint32_t(dl, &window);
+			} else {
+				break;
+			}
+			if (err)
+				return err;
+		}
+		if (dl->json_output) {
+			pr_err("monitor stream always writes JSON lines, drop -j\n");
+			return -EINVAL;
+		}
+	}
 
 	while ((cur_obj = dl_argv_index(dl, index++))) {
 		if (strcmp(cur_obj, "all") != 0 &&
@@ -7314,6 +9256,12 @@ static int cmd_mon_show(struct dl *dl)
 	err = _mnlg_socket_group_add(&dl->nlg, DEVLINK_GENL_MCGRP_CONFIG_NAME);
 	if (err)
 		return err;
+	if (stream) {
+		delete_json_obj_plain();
+		dl->json_output = true;
+		new_json_obj_lines();
+		return cmd_mon_stream(dl, rcvbuf, window);
+	}
 	open_json_object(NULL);
 	open_json_array(PRINT_JSON, "mon");
 	err = _mnlg_socket_recv_run_intr(&dl->nlg, cmd_mon_show_cb, dl);
@@ -7326,7 +9274,8 @@ static int cmd_mon_show(struct dl *dl)
 
 static void cmd_mon_help(void)
 {
-	pr_err("Usage: devlink monitor [ all | OBJECT-LIST ]\n"
+	pr_err("Usage: devlink monitor [ stream [ rcvbuf BYTES ] [ window MSEC ] ]\n"
+	       "                       [ all | OBJECT-LIST ]\n"
 	       "where  OBJECT-LIST := { dev | port | lc | health | trap | trap-group | trap-policer }\n");
 }
 
@@ -7344,6 +9293,7 @@ struct dpipe_field {
 	unsigned int id;
 	unsigned int bitwidth;
 	enum devlink_dpipe_field_mapping_type mapping_type;
+	const struct dpipe_field_printer *printer;
 };
 
 struct dpipe_header {
@@ -7456,10 +9406,16 @@ struct dpipe_ctx {
 	int err;
 	struct list_head global_headers;
 	struct list_head local_headers;
+	/* headers indexed by id, [0] local, [1] global */
+	struct dpipe_header **header_lut[2];
+	unsigned int header_lut_len[2];
+	bool header_lut_valid;
 	struct dpipe_tables *tables;
 	struct resources *resources;
 	bool print_headers;
 	bool print_tables;
+	bool csv;
+	bool csv_header_done;
 };
 
 static struct dpipe_header *dpipe_header_alloc(unsigned int fields_count)
@@ -7498,9 +9454,22 @@ static void dpipe_header_clear(struct dpipe_header *header)
 	free(header->name);
 }
 
+static void dpipe_header_lut_free(struct dpipe_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		free(ctx->header_lut[i]);
+		ctx->header_lut[i] = NULL;
+		ctx->header_lut_len[i] = 0;
+	}
+	ctx->header_lut_valid = false;
+}
+
 static void dpipe_header_add(struct dpipe_ctx *ctx,
 			     struct dpipe_header *header, bool global)
 {
+	dpipe_header_lut_free(ctx);
 	if (global)
 		list_add(&header->list, &ctx->global_headers);
 	else
@@ -7570,46 +9539,107 @@ static void dpipe_ctx_fini(struct dpipe_ctx *ctx)
 		dpipe_header_clear(header);
 		dpipe_header_free(header);
 	}
+	dpipe_header_lut_free(ctx);
 	dpipe_tables_free(ctx->tables);
 }
 
-static const char *dpipe_header_id2s(struct dpipe_ctx *ctx,
-				     uint32_t header_id, bool global)
+/* Ids are small enumerations, anything past this is looked up in the list. */
+#define DPIPE_HEADER_LUT_MAX	1024
+
+static const struct dpipe_field_printer *
+dpipe_field_printer_get(uint32_t header_id, uint32_t field_id);
+
+/* Index the headers by id and resolve the printer of every global field,
+ * so that the values of a dump are not matched against the header lists
+ * one by one.
+ */
+static void dpipe_header_lut_build(struct dpipe_ctx *ctx)
 {
-	struct list_head *header_list;
 	struct dpipe_header *header;
+	struct list_head *header_list;
+	unsigned int len;
+	int global, i;
+
+	for (global = 0; global < 2; global++) {
+		header_list = global ? &ctx->global_headers :
+				       &ctx->local_headers;
+		len = 0;
+		list_for_each_entry(header, header_list, list) {
+			if (header->id < DPIPE_HEADER_LUT_MAX &&
+			    header->id >= len)
+				len = header->id + 1;
+			if (!global)
+				continue;
+			for (i = 0; i < header->fields_count; i++)
+				header->fields[i].printer =
+					dpipe_field_printer_get(header->id, i);
+		}
 
-	if (global)
-		header_list = &ctx->global_headers;
-	else
-		header_list = &ctx->local_headers;
-	list_for_each_entry(header, header_list, list) {
-		if (header->id != header_id)
+		ctx->header_lut[global] = calloc(len, sizeof(header));
+		if (!ctx->header_lut[global])
 			continue;
-		return header->name;
+		ctx->header_lut_len[global] = len;
+		list_for_each_entry(header, header_list, list) {
+			if (header->id < len && !ctx->header_lut[global][header->id])
+				ctx->header_lut[global][header->id] = header;
+		}
 	}
-	return NULL;
+	ctx->header_lut_valid = true;
 }
 
-static const char *dpipe_field_id2s(struct dpipe_ctx *ctx,
-				    uint32_t header_id,
-				    uint32_t field_id, bool global)
+static struct dpipe_header *dpipe_header_find(struct dpipe_ctx *ctx,
+					      uint32_t header_id, bool global)
 {
 	struct list_head *header_list;
 	struct dpipe_header *header;
 
+	if (!ctx->header_lut_valid)
+		dpipe_header_lut_build(ctx);
+	if (header_id < ctx->header_lut_len[global])
+		return ctx->header_lut[global][header_id];
+
 	if (global)
 		header_list = &ctx->global_headers;
 	else
 		header_list = &ctx->local_headers;
 	list_for_each_entry(header, header_list, list) {
-		if (header->id != header_id)
-			continue;
-		return header->fields[field_id].name;
+		if (header->id == header_id)
+			return header;
 	}
 	return NULL;
 }
 
+static struct dpipe_field *dpipe_field_find(struct dpipe_ctx *ctx,
+					    uint32_t header_id,
+					    uint32_t field_id, bool global)
+{
+	struct dpipe_header *header;
+
+	header = dpipe_header_find(ctx, header_id, global);
+	if (!header || field_id >= header->fields_count)
+		return NULL;
+	return &header->fields[field_id];
+}
+
+static const char *dpipe_header_id2s(struct dpipe_ctx *ctx,
+				     uint32_t header_id, bool global)
+{
+	struct dpipe_header *header;
+
+	header = dpipe_header_find(ctx, header_id, global);
+	return header ? header->name : NULL;
+}
+
+static const char *dpipe_field_id2s(struct dpipe_ctx *ctx,
+				    uint32_t header_id,
+				    uint32_t field_id, bool global)
+{
+	struct dpipe_field *field;
+
+	field = dpipe_field_find(ctx, header_id, field_id, global);
+	return field ? field->name : NULL;
+}
+
 static const char *
 dpipe_field_mapping_e2s(enum devlink_dpipe_field_mapping_type mapping_type)
 {
@@ -7627,21 +9657,10 @@ static const char *
 dpipe_mapping_get(struct dpipe_ctx *ctx, uint32_t header_id,
 		  uint32_t field_id, bool global)
 {
-	enum devlink_dpipe_field_mapping_type mapping_type;
-	struct list_head *header_list;
-	struct dpipe_header *header;
+	struct dpipe_field *field;
 
-	if (global)
-		header_list = &ctx->global_headers;
-	else
-		header_list = &ctx->local_headers;
-	list_for_each_entry(header, header_list, list) {
-		if (header->id != header_id)
-			continue;
-		mapping_type = header->fields[field_id].mapping_type;
-		return dpipe_field_mapping_e2s(mapping_type);
-	}
-	return NULL;
+	field = dpipe_field_find(ctx, header_id, field_id, global);
+	return field ? dpipe_field_mapping_e2s(field->mapping_type) : NULL;
 }
 
 static void pr_out_dpipe_fields(struct dpipe_ctx *ctx,
@@ -7861,7 +9880,7 @@ static void cmd_dpipe_help(void)
 	pr_err("Usage: devlink dpipe table show DEV [ name TABLE_NAME ]\n");
 	pr_err("       devlink dpipe table set DEV name TABLE_NAME\n");
 	pr_err("                               [ counters_enabled { true | false } ]\n");
-	pr_err("       devlink dpipe table dump DEV name TABLE_NAME\n");
+	pr_err("       devlink dpipe table dump DEV name TABLE_NAME [ csv ]\n");
 	pr_err("       devlink dpipe header show DEV\n");
 }
 
@@ -8319,7 +10338,7 @@ dpipe_value_type_e2s(enum dpipe_value_type type)
 
 struct dpipe_field_printer {
 	unsigned int field_id;
-	void (*printer)(struct dpipe_ctx *, enum dpipe_value_type, void *);
+	const char *(*format)(void *value, char *buf, size_t len);
 };
 
 struct dpipe_header_printer {
@@ -8328,41 +10347,30 @@ struct dpipe_header_printer {
 	unsigned int header_id;
 };
 
-static void dpipe_field_printer_ipv4_addr(struct dpipe_ctx *ctx,
-					  enum dpipe_value_type type,
-					  void *value)
+static const char *dpipe_field_format_ipv4_addr(void *value, char *buf,
+						size_t len)
 {
 	struct in_addr ip_addr;
 
 	ip_addr.s_addr = htonl(*(uint32_t *)value);
-	check_indent_newline(ctx->dl);
-	print_string_name_value(dpipe_value_type_e2s(type), inet_ntoa(ip_addr));
+	return inet_ntop(AF_INET, &ip_addr, buf, len);
 }
 
-static void
-dpipe_field_printer_ethernet_addr(struct dpipe_ctx *ctx,
-				  enum dpipe_value_type type,
-				  void *value)
+static const char *dpipe_field_format_ethernet_addr(void *value, char *buf,
+						    size_t len)
 {
-	check_indent_newline(ctx->dl);
-	print_string_name_value(dpipe_value_type_e2s(type),
-				ether_ntoa((struct ether_addr *)value));
+	return ether_ntoa_r((struct ether_addr *)value, buf);
 }
 
-static void dpipe_field_printer_ipv6_addr(struct dpipe_ctx *ctx,
-					  enum dpipe_value_type type,
-					  void *value)
+static const char *dpipe_field_format_ipv6_addr(void *value, char *buf,
+						size_t len)
 {
-	char str[INET6_ADDRSTRLEN];
-
-	inet_ntop(AF_INET6, value, str, INET6_ADDRSTRLEN);
-	check_indent_newline(ctx->dl);
-	print_string_name_value(dpipe_value_type_e2s(type), str);
+	return inet_ntop(AF_INET6, value, buf, len);
 }
 
 static struct dpipe_field_printer dpipe_field_printers_ipv4[] = {
 	{
-		.printer = dpipe_field_printer_ipv4_addr,
+		.format = dpipe_field_format_ipv4_addr,
 		.field_id = DEVLINK_DPIPE_FIELD_IPV4_DST_IP,
 	}
 };
@@ -8375,7 +10383,7 @@ static struct dpipe_header_printer dpipe_header_printer_ipv4  = {
 
 static struct dpipe_field_printer dpipe_field_printers_ethernet[] = {
 	{
-		.printer = dpipe_field_printer_ethernet_addr,
+		.format = dpipe_field_format_ethernet_addr,
 		.field_id = DEVLINK_DPIPE_FIELD_ETHERNET_DST_MAC,
 	},
 };
@@ -8388,7 +10396,7 @@ static struct dpipe_header_printer dpipe_header_printer_ethernet = {
 
 static struct dpipe_field_printer dpipe_field_printers_ipv6[] = {
 	{
-		.printer = dpipe_field_printer_ipv6_addr,
+		.format = dpipe_field_format_ipv6_addr,
 		.field_id = DEVLINK_DPIPE_FIELD_IPV6_DST_IP,
 	}
 };
@@ -8405,10 +10413,8 @@ static struct dpipe_header_printer *dpipe_header_printers[] = {
 	&dpipe_header_printer_ipv6,
 };
 
-static int dpipe_print_prot_header(struct dpipe_ctx *ctx,
-				   struct dpipe_op_info *info,
-				   enum dpipe_value_type type,
-				   void *value)
+static const struct dpipe_field_printer *
+dpipe_field_printer_get(uint32_t header_id, uint32_t field_id)
 {
 	unsigned int header_printers_count = ARRAY_SIZE(dpipe_header_printers);
 	struct dpipe_header_printer *header_printer;
@@ -8419,19 +10425,31 @@ static int dpipe_print_prot_header(struct dpipe_ctx *ctx,
 
 	for (i = 0; i < header_printers_count; i++) {
 		header_printer = dpipe_header_printers[i];
-		if (header_printer->header_id != info->header_id)
+		if (header_printer->header_id != header_id)
 			continue;
 		field_printers_count = header_printer->printers_count;
 		for (j = 0; j < field_printers_count; j++) {
 			field_printer = &header_printer->printers[j];
-			if (field_printer->field_id != info->field_id)
+			if (field_printer->field_id != field_id)
 				continue;
-			field_printer->printer(ctx, type, value);
-			return 0;
+			return field_printer;
 		}
 	}
 
-	return -EINVAL;
+	return NULL;
+}
+
+static const struct dpipe_field_printer *
+dpipe_value_printer(struct dpipe_ctx *ctx, struct dpipe_op_info *info)
+{
+	struct dpipe_field *field;
+
+	if (!info->header_global)
+		return NULL;
+	field = dpipe_field_find(ctx, info->header_id, info->field_id, true);
+	if (field)
+		return field->printer;
+	return dpipe_field_printer_get(info->header_id, info->field_id);
 }
 
 static void __pr_out_entry_value(struct dpipe_ctx *ctx,
@@ -8440,9 +10458,17 @@ static void __pr_out_entry_value(struct dpipe_ctx *ctx,
 				 struct dpipe_op_info *info,
 				 enum dpipe_value_type type)
 {
-	if (info->header_global &&
-	    !dpipe_print_prot_header(ctx, info, type, value))
+	const struct dpipe_field_printer *printer;
+	char buf[INET6_ADDRSTRLEN];
+
+	printer = dpipe_value_printer(ctx, info);
+	if (printer) {
+		check_indent_newline(ctx->dl);
+		print_string_name_value(dpipe_value_type_e2s(type),
+					printer->format(value, buf,
+							sizeof(buf)));
 		return;
+	}
 
 	if (value_len == sizeof(uint32_t)) {
 		uint32_t *value_32 = value;
@@ -8615,11 +10641,153 @@ err_match_values_show:
 	return -EINVAL;
 }
 
+/* "table dump ... csv": one line per entry, the first line naming the
+ * columns after the match and action values of the first entry.
+ */
+static int dpipe_value_csv(struct dpipe_ctx *ctx, struct nlattr *nl,
+			   bool is_match, bool header)
+{
+	struct nlattr *nla_value[DEVLINK_ATTR_MAX + 1] = {};
+	const struct dpipe_field_printer *printer;
+	struct dpipe_action action;
+	struct dpipe_match match;
+	char buf[INET6_ADDRSTRLEN];
+	struct dpipe_op_info *info;
+	uint16_t value_len;
+	const char *kind;
+	void *value;
+	int err;
+
+	err = mnl_attr_parse_nested(nl, attr_cb, nla_value);
+	if (err != MNL_CB_OK || !nla_value[DEVLINK_ATTR_DPIPE_VALUE])
+		return -EINVAL;
+
+	if (is_match) {
+		if (!nla_value[DEVLINK_ATTR_DPIPE_MATCH] ||
+		    dpipe_match_parse(&match, nla_value[DEVLINK_ATTR_DPIPE_MATCH]))
+			return -EINVAL;
+		info = &match.info;
+		kind = "match";
+	} else {
+		if (!nla_value[DEVLINK_ATTR_DPIPE_ACTION] ||
+		    dpipe_action_parse(&action, nla_value[DEVLINK_ATTR_DPIPE_ACTION]))
+			return -EINVAL;
+		info = &action.info;
+		kind = "action";
+	}
+
+	if (header) {
+		const char *header_name, *field_name, *mapping;
+
+		header_name = dpipe_header_id2s(ctx, info->header_id,
+						info->header_global);
+		field_name = dpipe_field_id2s(ctx, info->header_id,
+					      info->field_id,
+					      info->header_global);
+		printf(",%s:%s.%s", kind, header_name ? : "<unknown>",
+		       field_name ? : "<unknown>");
+		if (nla_value[DEVLINK_ATTR_DPIPE_VALUE_MAPPING]) {
+			mapping = dpipe_mapping_get(ctx, info->header_id,
+						    info->field_id,
+						    info->header_global);
+			printf(",%s:%s.%s:%s", kind,
+			       header_name ? : "<unknown>",
+			       field_name ? : "<unknown>",
+			       mapping ? : "mapping");
+		}
+		return 0;
+	}
+
+	printer = dpipe_value_printer(ctx, info);
+	value_len = mnl_attr_get_payload_len(nla_value[DEVLINK_ATTR_DPIPE_VALUE]);
+	value = mnl_attr_get_payload(nla_value[DEVLINK_ATTR_DPIPE_VALUE]);
+	putchar(',');
+	if (printer)
+		fputs(printer->format(value, buf, sizeof(buf)), stdout);
+	else if (value_len == sizeof(uint32_t))
+		printf("%u", *(uint32_t *)value);
+
+	if (nla_value[DEVLINK_ATTR_DPIPE_VALUE_MASK] &&
+	    mnl_attr_get_payload_len(nla_value[DEVLINK_ATTR_DPIPE_VALUE_MASK]) ==
+	    value_len) {
+		value = mnl_attr_get_payload(nla_value[DEVLINK_ATTR_DPIPE_VALUE_MASK]);
+		if (printer)
+			printf("/%s", printer->format(value, buf, sizeof(buf)));
+		else if (value_len == sizeof(uint32_t))
+			printf("/%u", *(uint32_t *)value);
+	}
+
+	if (nla_value[DEVLINK_ATTR_DPIPE_VALUE_MAPPING])
+		printf(",%u",
+		       mnl_attr_get_u32(nla_value[DEVLINK_ATTR_DPIPE_VALUE_MAPPING]));
+	return 0;
+}
+
+static int dpipe_values_csv(struct dpipe_ctx *ctx, struct nlattr **nla_entry,
+			    bool header)
+{
+	struct nlattr *nla_value;
+
+	mnl_attr_for_each_nested(nla_value,
+				 nla_entry[DEVLINK_ATTR_DPIPE_ENTRY_MATCH_VALUES]) {
+		if (dpipe_value_csv(ctx, nla_value, true, header))
+			return -EINVAL;
+	}
+	mnl_attr_for_each_nested(nla_value,
+				 nla_entry[DEVLINK_ATTR_DPIPE_ENTRY_ACTION_VALUES]) {
+		if (dpipe_value_csv(ctx, nla_value, false, header))
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static int dpipe_entry_csv(struct dpipe_ctx *ctx, struct nlattr *nl)
+{
+	struct nlattr *nla_entry[DEVLINK_ATTR_MAX + 1] = {};
+	int err;
+
+	err = mnl_attr_parse_nested(nl, attr_cb, nla_entry);
+	if (err != MNL_CB_OK)
+		return -EINVAL;
+
+	if (!nla_entry[DEVLINK_ATTR_DPIPE_ENTRY_INDEX] ||
+	    !nla_entry[DEVLINK_ATTR_DPIPE_ENTRY_MATCH_VALUES] ||
+	    !nla_entry[DEVLINK_ATTR_DPIPE_ENTRY_ACTION_VALUES]) {
+		return -EINVAL;
+	}
+
+	if (!ctx->csv_header_done) {
+		fputs("index,counter", stdout);
+		if (dpipe_values_csv(ctx, nla_entry, true))
+			return -EINVAL;
+		putchar('\n');
+		ctx->csv_header_done = true;
+	}
+
+	printf("%" PRIu64 ",",
+	       mnl_attr_get_u64(nla_entry[DEVLINK_ATTR_DPIPE_ENTRY_INDEX]));
+	if (nla_entry[DEVLINK_ATTR_DPIPE_ENTRY_COUNTER])
+		printf("%" PRIu64,
+		       mnl_attr_get_u64(nla_entry[DEVLINK_ATTR_DPIPE_ENTRY_COUNTER]));
+	if (dpipe_values_csv(ctx, nla_entry, false))
+		return -EINVAL;
+	putchar('\n');
+	return 0;
+}
+
 static int dpipe_table_entries_show(struct dpipe_ctx *ctx, struct nlattr **tb)
 {
 	struct nlattr *nla_entries = tb[DEVLINK_ATTR_DPIPE_ENTRIES];
 	struct nlattr *nla_entry;
 
+	if (ctx->csv) {
+		mnl_attr_for_each_nested(nla_entry, nla_entries) {
+			if (dpipe_entry_csv(ctx, nla_entry))
+				return -EINVAL;
+		}
+		return 0;
+	}
+
 	mnl_attr_for_each_nested(nla_entry, nla_entries) {
 		pr_out_handle_start_arr(ctx->dl, tb);
 		if (dpipe_entry_show(ctx, nla_entry))
@@ -8660,6 +10828,17 @@ static int cmd_dpipe_table_dump(struct dl *dl)
 	if (err)
 		return err;
 
+	/* there is no option bit left for "csv", it can only come last */
+	if (dl_argc(dl) && !strcmp(dl->argv[dl_argc(dl) - 1], "csv")) {
+		if (dl->json_output) {
+			pr_err("csv output can not be combined with -j\n");
+			err = -EINVAL;
+			goto out;
+		}
+		ctx.csv = true;
+		dl->argc--;
+	}
+
 	err = dl_argv_parse(dl, DL_OPT_HANDLE | DL_OPT_DPIPE_TABLE_NAME, 0);
 	if (err)
 		goto out;
@@ -8676,6 +10855,12 @@ static int cmd_dpipe_table_dump(struct dl *dl)
 	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_DPIPE_ENTRIES_GET, flags);
 	dl_opts_put(nlh, dl);
 
+	if (ctx.csv) {
+		err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh,
+					     cmd_dpipe_table_entry_dump_cb,
+					     &ctx);
+		goto out;
+	}
 	pr_out_section_start(dl, "table_entry");
 	mnlu_gen_socket_sndrcv(&dl->nlg, nlh, cmd_dpipe_table_entry_dump_cb, &ctx);
 	pr_out_section_end(dl);
@@ -8885,49 +11070,418 @@ static void resource_show(struct resource *resource,
 		resource_show(child_resource, ctx);
 		pr_out_entry_end(dl);
 	}
-	pr_out_array_end(dl);
+	pr_out_array_end(dl);
+}
+
+static void
+resources_show(struct resource_ctx *ctx, struct nlattr **tb)
+{
+	struct resources *resources = ctx->resources;
+	struct resource *resource;
+
+	list_for_each_entry(resource, &resources->resource_list, list) {
+		pr_out_handle_start_arr(ctx->dl, tb);
+		resource_show(resource, ctx);
+		pr_out_handle_end(ctx->dl);
+	}
+}
+
+static int resources_get(struct resource_ctx *ctx, struct nlattr **tb)
+{
+	return resource_get(ctx, NULL, NULL, tb[DEVLINK_ATTR_RESOURCE_LIST]);
+}
+
+static int cmd_resource_dump_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct resource_ctx *ctx = data;
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	int err;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    !tb[DEVLINK_ATTR_RESOURCE_LIST])
+		return MNL_CB_ERROR;
+
+	err = resources_get(ctx, tb);
+	if (err) {
+		ctx->err = err;
+		return MNL_CB_ERROR;
+	}
+
+	if (ctx->print_resources)
+		resources_show(ctx, tb);
+
+	return MNL_CB_OK;
+}
+
+/*
+ * "resource show DEV interval SECS": the resource tree is read once and
+ * flattened into an array of the resources which report occupancy, with
+ * their paths. Each tick the occupancy is read again and stored through a
+ * table indexed by resource id, without rebuilding the tree. Every tick
+ * prints the utilisation of each resource, its fill rate since the
+ * previous tick and, when it is filling, the time left until it is full
+ * at that rate. A line is printed when a resource crosses the warn or the
+ * crit utilisation threshold, in either direction.
+ */
+#define RES_WATCH_WARN		80	/* percent */
+#define RES_WATCH_CRIT		90
+#define RES_WATCH_LUT_MAX	65536	/* ids above use a binary search */
+
+enum {
+	RES_WATCH_OK,
+	RES_WATCH_ALARM_WARN,
+	RES_WATCH_ALARM_CRIT,
+};
+
+struct res_watch_item {
+	uint64_t id;
+	char *path;
+	uint64_t size;
+	uint64_t occ;
+	uint64_t last_occ;
+	int level;
+};
+
+struct res_watch {
+	struct dl *dl;
+	struct res_watch_item *items;	/* sorted by id */
+	unsigned int count;
+	unsigned int *lut;		/* id -> index + 1, 0 for none */
+	uint64_t lut_len;
+	int err;
+};
+
+static int res_watch_add(struct res_watch *w, struct resource *resource,
+			 const char *parent)
+{
+	struct resource *child;
+	char *path;
+
+	if (asprintf(&path, "%s/%s", parent, resource->name) < 0)
+		return -ENOMEM;
+
+	if (resource->occ_valid) {
+		struct res_watch_item *items;
+
+		items = realloc(w->items, (w->count + 1) * sizeof(*items));
+		if (!items) {
+			free(path);
+			return -ENOMEM;
+		}
+		w->items = items;
+		items[w->count++] = (struct res_watch_item) {
+			.id = resource->id,
+			.path = path,
+			.size = resource->size,
+			.occ = resource->size_occ,
+			.last_occ = resource->size_occ,
+		};
+	}
+
+	list_for_each_entry(child, &resource->resource_list, list) {
+		int err = res_watch_add(w, child, path);
+
+		if (err) {
+			if (!resource->occ_valid)
+				free(path);
+			return err;
+		}
+	}
+	if (!resource->occ_valid)
+		free(path);
+	return 0;
+}
+
+static int res_watch_item_cmp(const void *a, const void *b)
+{
+	const struct res_watch_item *x = a, *y = b;
+
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static int res_watch_learn(struct res_watch *w)
+{
+	struct resource_ctx ctx = {};
+	struct resource *resource;
+	struct nlmsghdr *nlh;
+	uint64_t max_id = 0;
+	unsigned int i;
+	int err;
+
+	err = resource_ctx_init(&ctx, w->dl);
+	if (err)
+		return err;
+
+	nlh = mnlu_gen_socket_cmd_prepare(&w->dl->nlg,
+					  DEVLINK_CMD_RESOURCE_DUMP,
+					  NLM_F_REQUEST | NLM_F_ACK);
+	dl_opts_put(nlh, w->dl);
+	err = mnlu_gen_socket_sndrcv(&w->dl->nlg, nlh, cmd_resource_dump_cb,
+				     &ctx);
+	if (err) {
+		pr_err("error getting resources %s\n", strerror(ctx.err));
+		goto out;
+	}
+
+	list_for_each_entry(resource, &ctx.resources->resource_list, list) {
+		err = res_watch_add(w, resource, "");
+		if (err)
+			goto out;
+	}
+	if (!w->count) {
+		pr_err("No resource reports its occupancy\n");
+		err = -ENOENT;
+		goto out;
+	}
+
+	qsort(w->items, w->count, sizeof(*w->items), res_watch_item_cmp);
+	max_id = w->items[w->count - 1].id;
+	if (max_id < RES_WATCH_LUT_MAX) {
+		w->lut_len = max_id + 1;
+		w->lut = calloc(w->lut_len, sizeof(*w->lut));
+		if (!w->lut) {
+			err = -ENOMEM;
+			goto out;
+		}
+		for (i = 0; i < w->count; i++)
+			w->lut[w->items[i].id] = i + 1;
+	}
+out:
+	resource_ctx_fini(&ctx);
+	return err;
+}
+
+static struct res_watch_item *res_watch_item(struct res_watch *w, uint64_t id)
+{
+	struct res_watch_item key = { .id = id };
+
+	if (w->lut)
+		return id < w->lut_len && w->lut[id] ?
+		       &w->items[w->lut[id] - 1] : NULL;
+	return bsearch(&key, w->items, w->count, sizeof(*w->items),
+		       res_watch_item_cmp);
+}
+
+static void res_watch_walk(struct res_watch *w, struct nlattr *list)
+{
+	struct nlattr *nla;
+
+	mnl_attr_for_each_nested(nla, list) {
+		struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+		struct res_watch_item *item;
+
+		if (mnl_attr_parse_nested(nla, attr_cb, tb) != MNL_CB_OK)
+			continue;
+		if (tb[DEVLINK_ATTR_RESOURCE_ID] &&
+		    tb[DEVLINK_ATTR_RESOURCE_OCC]) {
+			item = res_watch_item(w,
+				mnl_attr_get_u64(tb[DEVLINK_ATTR_RESOURCE_ID]));
+			if (item) {
+				item->occ = mnl_attr_get_u64(tb[DEVLINK_ATTR_RESOURCE_OCC]);
+				if (tb[DEVLINK_ATTR_RESOURCE_SIZE])
+					item->size = mnl_attr_get_u64(tb[DEVLINK_ATTR_RESOURCE_SIZE]);
+			}
+		}
+		if (tb[DEVLINK_ATTR_RESOURCE_LIST])
+			res_watch_walk(w, tb[DEVLINK_ATTR_RESOURCE_LIST]);
+	}
+}
+
+static int res_watch_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct res_watch *w = data;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_RESOURCE_LIST])
+		return MNL_CB_ERROR;
+
+	res_watch_walk(w, tb[DEVLINK_ATTR_RESOURCE_LIST]);
+	return MNL_CB_OK;
+}
+
+static const char *res_watch_level_str(int level)
+{
+	switch (level) {
+	case RES_WATCH_ALARM_WARN: return "warn";
+	case RES_WATCH_ALARM_CRIT: return "crit";
+	default: return "ok";
+	}
+}
+
+static void pr_out_res_watch_alarm(struct res_watch *w,
+				   struct res_watch_item *item, double util,
+				   int level)
+{
+	bool above = level > item->level;
+	/* the threshold crossed, the lower one when both were */
+	int crossed = above ? level : level + 1;
+	struct dl *dl = w->dl;
+	uint32_t threshold;
+
+	threshold = crossed == RES_WATCH_ALARM_CRIT ? dl->opts.crit :
+						      dl->opts.warn;
+
+	if (dl->json_output) {
+		open_json_object(NULL);
+		print_string(PRINT_JSON, "alarm", NULL,
+			     res_watch_level_str(level));
+		print_string(PRINT_JSON, "was", NULL,
+			     res_watch_level_str(item->level));
+		print_string(PRINT_JSON, "resource_path", NULL, item->path);
+		print_float(PRINT_JSON, "util", NULL, util);
+		print_uint(PRINT_JSON, "threshold", NULL, threshold);
+		close_json_object();
+	} else {
+		pr_out("alarm %s %s util %.1f%% %s %s %u%%\n",
+		       res_watch_level_str(level), item->path, util,
+		       above ? "above" : "below",
+		       res_watch_level_str(crossed), threshold);
+	}
+}
+
+static void pr_out_res_watch(struct res_watch *w, double secs)
+{
+	struct dl *dl = w->dl;
+	unsigned int i;
+
+	if (dl->json_output) {
+		open_json_object(NULL);
+		print_string(PRINT_JSON, "dev", NULL, dl->opts.dev_name);
+		print_float(PRINT_JSON, "interval", NULL, secs);
+		open_json_array(PRINT_JSON, "resources");
+	} else {
+		pr_out("%s/%s interval %.3fs\n", dl->opts.bus_name,
+		       dl->opts.dev_name, secs);
+	}
+
+	for (i = 0; i < w->count; i++) {
+		struct res_watch_item *item = &w->items[i];
+		double rate = ((double)item->occ - item->last_occ) / secs;
+		double util = item->size ? item->occ * 100.0 / item->size : 0;
+		bool filling = rate > 0 && item->occ < item->size;
+		double ttf = filling ? (item->size - item->occ) / rate : 0;
+
+		if (dl->json_output) {
+			open_json_object(NULL);
+			print_string(PRINT_JSON, "resource_path", NULL,
+				     item->path);
+			print_u64(PRINT_JSON, "size", NULL, item->size);
+			print_u64(PRINT_JSON, "occ", NULL, item->occ);
+			print_float(PRINT_JSON, "util", NULL, util);
+			print_float(PRINT_JSON, "rate", NULL, rate);
+			if (filling)
+				print_float(PRINT_JSON, "time_to_full", NULL,
+					    ttf);
+			else
+				print_null(PRINT_JSON, "time_to_full", NULL,
+					   NULL);
+			print_string(PRINT_JSON, "level", NULL,
+				     res_watch_level_str(item->level));
+			close_json_object();
+		} else {
+			pr_out("  %s size %" PRIu64 " occ %" PRIu64
+			       " util %.1f%% rate %+.0f/s", item->path,
+			       item->size, item->occ, util, rate);
+			if (filling)
+				pr_out(" full in %.0fs", ttf);
+			if (item->level != RES_WATCH_OK)
+				pr_out(" [%s]", res_watch_level_str(item->level));
+			pr_out("\n");
+		}
+	}
+
+	if (dl->json_output) {
+		close_json_array(PRINT_JSON, NULL);
+		close_json_object();
+	}
 }
 
-static void
-resources_show(struct resource_ctx *ctx, struct nlattr **tb)
+static void res_watch_alarms(struct res_watch *w)
 {
-	struct resources *resources = ctx->resources;
-	struct resource *resource;
+	struct dl *dl = w->dl;
+	unsigned int i;
 
-	list_for_each_entry(resource, &resources->resource_list, list) {
-		pr_out_handle_start_arr(ctx->dl, tb);
-		resource_show(resource, ctx);
-		pr_out_handle_end(ctx->dl);
-	}
-}
+	for (i = 0; i < w->count; i++) {
+		struct res_watch_item *item = &w->items[i];
+		double util = item->size ? item->occ * 100.0 / item->size : 0;
+		int level = RES_WATCH_OK;
 
-static int resources_get(struct resource_ctx *ctx, struct nlattr **tb)
-{
-	return resource_get(ctx, NULL, NULL, tb[DEVLINK_ATTR_RESOURCE_LIST]);
+		if (util >= dl->opts.crit)
+			level = RES_WATCH_ALARM_CRIT;
+		else if (util >= dl->opts.warn)
+			level = RES_WATCH_ALARM_WARN;
+
+		if (level != item->level) {
+			pr_out_res_watch_alarm(w, item, util, level);
+			item->level = level;
+		}
+	}
 }
 
-static int cmd_resource_dump_cb(const struct nlmsghdr *nlh, void *data)
+static int cmd_resource_watch(struct dl *dl)
 {
-	struct resource_ctx *ctx = data;
-	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
-	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct res_watch w = { .dl = dl };
+	struct nlmsghdr *nlh;
+	double now, last, next;
+	unsigned int i;
+	uint32_t tick;
 	int err;
 
-	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
-	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
-	    !tb[DEVLINK_ATTR_RESOURCE_LIST])
-		return MNL_CB_ERROR;
+	if (!dl->opts.interval) {
+		pr_err("Interval must be at least 1 second\n");
+		return -EINVAL;
+	}
+	if (!dl->opts.warn)
+		dl->opts.warn = RES_WATCH_WARN;
+	if (!dl->opts.crit)
+		dl->opts.crit = RES_WATCH_CRIT;
+	if (dl->opts.warn > dl->opts.crit) {
+		pr_err("warn threshold is above the crit threshold\n");
+		return -EINVAL;
+	}
 
-	err = resources_get(ctx, tb);
-	if (err) {
-		ctx->err = err;
-		return MNL_CB_ERROR;
+	err = res_watch_learn(&w);
+	if (err)
+		goto out;
+	last = next = monotonic_now();
+
+	/* one sample per line, whatever -p says */
+	if (dl->json_output) {
+		jsonw_pretty(get_json_writer(), false);
+		jsonw_lines(get_json_writer(), true);
 	}
 
-	if (ctx->print_resources)
-		resources_show(ctx, tb);
+	for (tick = 1; !dl->opts.count || tick <= dl->opts.count; tick++) {
+		next += dl->opts.interval;
+		monotonic_sleep_until(next);
 
-	return MNL_CB_OK;
+		nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg,
+						  DEVLINK_CMD_RESOURCE_DUMP,
+						  NLM_F_REQUEST | NLM_F_ACK);
+		dl_opts_put(nlh, dl);
+		err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, res_watch_cb, &w);
+		if (err)
+			break;
+
+		now = monotonic_now();
+		pr_out_res_watch(&w, now - last);
+		res_watch_alarms(&w);
+		fflush(stdout);
+		last = now;
+		for (i = 0; i < w.count; i++)
+			w.items[i].last_occ = w.items[i].occ;
+	}
+
+out:
+	for (i = 0; i < w.count; i++)
+		free(w.items[i].path);
+	free(w.items);
+	free(w.lut);
+	return err;
 }
 
 static int cmd_resource_show(struct dl *dl)
@@ -8937,10 +11491,13 @@ static int cmd_resource_show(struct dl *dl)
 	struct resource_ctx resource_ctx = {};
 	int err;
 
-	err = dl_argv_parse(dl, DL_OPT_HANDLE, 0);
+	err = dl_argv_parse(dl, DL_OPT_HANDLE, DL_OPT_INTERVAL);
 	if (err)
 		return err;
 
+	if (dl->opts.present & DL_OPT_INTERVAL)
+		return cmd_resource_watch(dl);
+
 	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_DPIPE_TABLE_GET,
 			       NLM_F_REQUEST);
 	dl_opts_put(nlh, dl);
@@ -8978,6 +11535,8 @@ out:
 static void cmd_resource_help(void)
 {
 	pr_err("Usage: devlink resource show DEV\n"
+	       "                             [ interval SECS [ count COUNT ]\n"
+	       "                               [ warn PCT ] [ crit PCT ] ]\n"
 	       "       devlink resource set DEV path PATH size SIZE\n");
 }
 
@@ -9239,6 +11798,64 @@ static int cmd_region_snapshot_del(struct dl *dl)
 	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, NULL, NULL);
 }
 
+/*
+ * "output FILE" writes the region bytes as they are instead of printing
+ * them. A regular file is sized up front and mapped, and every chunk is
+ * copied to its own offset; anything else, such as a pipe or "-" for
+ * stdout, gets the chunks written in the order the kernel sends them,
+ * which is by address. Replies are received into a buffer large enough
+ * for the kernel to pack as many chunks as it can into each message.
+ */
+#define DL_REGION_RECV_SIZE	32768
+
+struct dl_region_out {
+	int fd;
+	uint8_t *map;
+	uint64_t base;		/* address of the first byte */
+	uint64_t size;
+	uint64_t done;
+	bool sized;
+	int err;
+};
+
+static int dl_region_out_write(struct dl_region_out *out,
+			       const uint8_t *data, uint32_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(out->fd, data, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		data += ret;
+		len -= ret;
+		out->done += ret;
+	}
+	return 0;
+}
+
+static int dl_region_out_chunk(struct dl_region_out *out, const uint8_t *data,
+			       uint32_t len, uint64_t addr)
+{
+	uint64_t off = addr - out->base;
+
+	if (!out->map) {
+		out->err = dl_region_out_write(out, data, len);
+		return out->err;
+	}
+
+	if (addr < out->base || off > out->size || len > out->size - off) {
+		out->err = -ERANGE;
+		return out->err;
+	}
+	memcpy(out->map + off, data, len);
+	out->done += len;
+	return 0;
+}
+
 static int cmd_region_read_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nlattr *nla_entry, *nla_chunk_data, *nla_chunk_addr;
@@ -9266,6 +11883,15 @@ static int cmd_region_read_cb(const struct nlmsghdr *nlh, void *data)
 		if (!nla_chunk_addr)
 			continue;
 
+		if (dl->region_out) {
+			if (dl_region_out_chunk(dl->region_out,
+						mnl_attr_get_payload(nla_chunk_data),
+						mnl_attr_get_payload_len(nla_chunk_data),
+						mnl_attr_get_u64(nla_chunk_addr)))
+				return MNL_CB_ERROR;
+			continue;
+		}
+
 		pr_out_region_chunk(dl, mnl_attr_get_payload(nla_chunk_data),
 				    mnl_attr_get_payload_len(nla_chunk_data),
 				    mnl_attr_get_u64(nla_chunk_addr));
@@ -9273,22 +11899,149 @@ static int cmd_region_read_cb(const struct nlmsghdr *nlh, void *data)
 	return MNL_CB_OK;
 }
 
+static int dl_region_size_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	uint64_t *size = data;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_REGION_SIZE])
+		return MNL_CB_ERROR;
+	*size = mnl_attr_get_u64(tb[DEVLINK_ATTR_REGION_SIZE]);
+	return MNL_CB_OK;
+}
+
+static int dl_region_size(struct dl *dl, uint64_t *size)
+{
+	uint64_t present = dl->opts.present;
+	struct nlmsghdr *nlh;
+
+	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_REGION_GET,
+					  NLM_F_REQUEST | NLM_F_ACK);
+	dl->opts.present &= DL_OPT_HANDLE_REGION;
+	dl_opts_put(nlh, dl);
+	dl->opts.present = present;
+
+	return mnlu_gen_socket_sndrcv(&dl->nlg, nlh, dl_region_size_cb, size);
+}
+
+static int dl_region_out_open(struct dl *dl, struct dl_region_out *out,
+			      uint64_t base, uint64_t size)
+{
+	const char *name = dl->opts.region_output;
+	struct stat st;
+
+	memset(out, 0, sizeof(*out));
+	out->base = base;
+	out->size = size;
+
+	if (strcmp(name, "-") == 0) {
+		out->fd = STDOUT_FILENO;
+		return 0;
+	}
+
+	out->fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (out->fd < 0) {
+		pr_err("Failed to open \"%s\": %s\n", name, strerror(errno));
+		return -errno;
+	}
+
+	if (fstat(out->fd, &st) || !S_ISREG(st.st_mode) || !size)
+		return 0;
+
+	if (ftruncate(out->fd, size)) {
+		pr_err("Failed to size \"%s\": %s\n", name, strerror(errno));
+		close(out->fd);
+		return -errno;
+	}
+	out->sized = true;
+	out->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			out->fd, 0);
+	if (out->map == MAP_FAILED)
+		out->map = NULL;
+	return 0;
+}
+
+static int dl_region_out_close(struct dl_region_out *out)
+{
+	int err = 0;
+
+	if (out->map)
+		munmap(out->map, out->size);
+	/* a snapshot may end short of the advertised size */
+	if (out->sized && out->done < out->size &&
+	    ftruncate(out->fd, out->done))
+		err = -errno;
+	if (out->fd != STDOUT_FILENO && close(out->fd) && !err)
+		err = -errno;
+	return err;
+}
+
+static int dl_region_read_raw(struct dl *dl, struct nlmsghdr *nlh,
+			      uint64_t base, uint64_t size)
+{
+	struct dl_region_out out;
+	char *buf;
+	int err, ret;
+
+	buf = malloc(DL_REGION_RECV_SIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	err = dl_region_out_open(dl, &out, base, size);
+	if (err)
+		goto out_free;
+
+	dl->region_out = &out;
+	err = mnl_socket_sendto(dl->nlg.nl, nlh, nlh->nlmsg_len);
+	if (err >= 0)
+		err = mnlu_socket_recv_run(dl->nlg.nl, nlh->nlmsg_seq, buf,
+					   DL_REGION_RECV_SIZE,
+					   cmd_region_read_cb, dl);
+	if (err < 0 && !out.err) {
+		pr_err("kernel answers: %s\n", strerror(errno));
+		err = -errno;
+	}
+	dl->region_out = NULL;
+
+	ret = dl_region_out_close(&out);
+	if (!out.err)
+		out.err = ret;
+	if (out.err) {
+		pr_err("Failed to write \"%s\": %s\n",
+		       dl->opts.region_output, strerror(-out.err));
+		err = out.err;
+	}
+out_free:
+	free(buf);
+	return err;
+}
+
 static int cmd_region_dump(struct dl *dl)
 {
 	struct nlmsghdr *nlh;
+	uint64_t size = 0;
 	int err;
 
 	err = dl_argv_parse(dl,
 			    DL_OPT_HANDLE_REGION | DL_OPT_REGION_SNAPSHOT_ID,
-			    0);
+			    DL_OPT_REGION_OUTPUT);
 	if (err)
 		return err;
 
+	if ((dl->opts.present & DL_OPT_REGION_OUTPUT) &&
+	    dl_region_size(dl, &size))
+		return -EINVAL;
+
 	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_REGION_READ,
 			       NLM_F_REQUEST | NLM_F_ACK | NLM_F_DUMP);
 
 	dl_opts_put(nlh, dl);
 
+	if (dl->opts.present & DL_OPT_REGION_OUTPUT)
+		return dl_region_read_raw(dl, nlh, 0, size);
+
 	pr_out_section_start(dl, "dump");
 	err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, cmd_region_read_cb, dl);
 	pr_out_section_end(dl);
@@ -9304,7 +12057,7 @@ static int cmd_region_read(struct dl *dl)
 
 	err = dl_argv_parse(dl, DL_OPT_HANDLE_REGION | DL_OPT_REGION_ADDRESS |
 			    DL_OPT_REGION_LENGTH,
-			    DL_OPT_REGION_SNAPSHOT_ID);
+			    DL_OPT_REGION_SNAPSHOT_ID | DL_OPT_REGION_OUTPUT);
 	if (err)
 		return err;
 
@@ -9317,6 +12070,10 @@ static int cmd_region_read(struct dl *dl)
 	if (!(dl->opts.present & DL_OPT_REGION_SNAPSHOT_ID))
 		mnl_attr_put(nlh, DEVLINK_ATTR_REGION_DIRECT, 0, NULL);
 
+	if (dl->opts.present & DL_OPT_REGION_OUTPUT)
+		return dl_region_read_raw(dl, nlh, dl->opts.region_address,
+					  dl->opts.region_length);
+
 	pr_out_section_start(dl, "read");
 	err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, cmd_region_read_cb, dl);
 	pr_out_section_end(dl);
@@ -9368,8 +12125,8 @@ static void cmd_region_help(void)
 	pr_err("Usage: devlink region show [ DEV/REGION ]\n");
 	pr_err("       devlink region del DEV/REGION snapshot SNAPSHOT_ID\n");
 	pr_err("       devlink region new DEV/REGION [ snapshot SNAPSHOT_ID ]\n");
-	pr_err("       devlink region dump DEV/REGION [ snapshot SNAPSHOT_ID ]\n");
-	pr_err("       devlink region read DEV/REGION [ snapshot SNAPSHOT_ID ] address ADDRESS length LENGTH\n");
+	pr_err("       devlink region dump DEV/REGION [ snapshot SNAPSHOT_ID ] [ output FILE ]\n");
+	pr_err("       devlink region read DEV/REGION [ snapshot SNAPSHOT_ID ] address ADDRESS length LENGTH [ output FILE ]\n");
 }
 
 static int cmd_region(struct dl *dl)
@@ -10080,25 +12837,321 @@ static void cmd_trap_help(void)
 {
 	pr_err("Usage: devlink trap set DEV trap TRAP [ action { trap | drop | mirror } ]\n");
 	pr_err("       devlink trap show [ DEV trap TRAP ]\n");
+	pr_err("                         [ interval SECS [ count COUNT ] [ top N ] ]\n");
 	pr_err("       devlink trap group set DEV group GROUP [ action { trap | drop | mirror } ]\n");
 	pr_err("                              [ policer POLICER ] [ nopolicer ]\n");
 	pr_err("       devlink trap group show [ DEV group GROUP ]\n");
+	pr_err("                               [ interval SECS [ count COUNT ] [ top N ] ]\n");
 	pr_err("       devlink trap policer set DEV policer POLICER [ rate RATE ] [ burst BURST ]\n");
 	pr_err("       devlink trap policer show DEV policer POLICER\n");
 }
 
+/*
+ * "trap show ... interval SECS" and "trap group show ... interval SECS":
+ * the rx counters of every (device, trap) are kept from one sample to
+ * the next, and the traps are printed busiest first with the packets,
+ * bytes and drops since the previous sample and their per-second rates.
+ * Only the name and the stats of each reply are looked at.
+ */
+#define TRAP_RATE_HT_SIZE	256
+
+enum {
+	TRAP_RATE_PACKETS,
+	TRAP_RATE_BYTES,
+	TRAP_RATE_DROPPED,
+	TRAP_RATE_MAX,
+};
+
+struct trap_rate_entry {
+	struct hlist_node hlist;
+	bool seen;
+	uint64_t last[TRAP_RATE_MAX];
+	uint64_t delta[TRAP_RATE_MAX];
+	const char *name;	/* in key, after the handle */
+	char key[];		/* "bus/dev", '\0', name */
+};
+
+struct trap_rate {
+	struct dl *dl;
+	int name_attr;
+	struct hlist_head ht[TRAP_RATE_HT_SIZE];
+	struct trap_rate_entry **entries;
+	unsigned int entry_count;
+	unsigned int seen_count;
+	int err;
+};
+
+static unsigned int trap_rate_hash(const char *handle, const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*handle)
+		hash = hash * 33 + (unsigned char)*handle++;
+	while (*name)
+		hash = hash * 33 + (unsigned char)*name++;
+	return hash % TRAP_RATE_HT_SIZE;
+}
+
+static struct trap_rate_entry *trap_rate_get(struct trap_rate *tr,
+					     const char *handle,
+					     const char *name, bool *new)
+{
+	struct hlist_head *head = &tr->ht[trap_rate_hash(handle, name)];
+	struct trap_rate_entry *entry, **entries;
+	size_t handle_len = strlen(handle) + 1;
+	struct hlist_node *pos;
+
+	hlist_for_each(pos, head) {
+		entry = hlist_entry(pos, struct trap_rate_entry, hlist);
+		if (!strcmp(entry->key, handle) && !strcmp(entry->name, name)) {
+			*new = false;
+			return entry;
+		}
+	}
+
+	entries = realloc(tr->entries,
+			  (tr->entry_count + 1) * sizeof(*entries));
+	if (!entries)
+		return NULL;
+	tr->entries = entries;
+
+	entry = calloc(1, sizeof(*entry) + handle_len + strlen(name) + 1);
+	if (!entry)
+		return NULL;
+	memcpy(entry->key, handle, handle_len);
+	strcpy(entry->key + handle_len, name);
+	entry->name = entry->key + handle_len;
+	hlist_add_head(&entry->hlist, head);
+	tr->entries[tr->entry_count++] = entry;
+	*new = true;
+	return entry;
+}
+
+static void trap_rate_fini(struct trap_rate *tr)
+{
+	unsigned int i;
+
+	for (i = 0; i < tr->entry_count; i++)
+		free(tr->entries[i]);
+	free(tr->entries);
+}
+
+static uint64_t trap_rate_delta(uint64_t cur, uint64_t last)
+{
+	/* counters start over if the device was reloaded */
+	return cur >= last ? cur - last : cur;
+}
+
+static int trap_rate_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb_stats[DEVLINK_ATTR_STATS_MAX + 1] = {};
+	struct nlattr *tb[DEVLINK_ATTR_MAX + 1] = {};
+	static const int stats_attr[TRAP_RATE_MAX] = {
+		[TRAP_RATE_PACKETS] = DEVLINK_ATTR_STATS_RX_PACKETS,
+		[TRAP_RATE_BYTES] = DEVLINK_ATTR_STATS_RX_BYTES,
+		[TRAP_RATE_DROPPED] = DEVLINK_ATTR_STATS_RX_DROPPED,
+	};
+	struct trap_rate *tr = data;
+	struct trap_rate_entry *entry;
+	char handle[64];
+	bool new;
+	int i;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[DEVLINK_ATTR_BUS_NAME] || !tb[DEVLINK_ATTR_DEV_NAME] ||
+	    !tb[tr->name_attr] || !tb[DEVLINK_ATTR_STATS])
+		return MNL_CB_ERROR;
+	if (mnl_attr_parse_nested(tb[DEVLINK_ATTR_STATS], attr_stats_cb,
+				  tb_stats) != MNL_CB_OK)
+		return MNL_CB_ERROR;
+
+	snprintf(handle, sizeof(handle), "%s/%s",
+		 mnl_attr_get_str(tb[DEVLINK_ATTR_BUS_NAME]),
+		 mnl_attr_get_str(tb[DEVLINK_ATTR_DEV_NAME]));
+	entry = trap_rate_get(tr, handle, mnl_attr_get_str(tb[tr->name_attr]),
+			      &new);
+	if (!entry) {
+		tr->err = -ENOMEM;
+		return MNL_CB_ERROR;
+	}
+
+	for (i = 0; i < TRAP_RATE_MAX; i++) {
+		uint64_t cur = 0;
+
+		if (tb_stats[stats_attr[i]])
+			cur = mnl_attr_get_u64(tb_stats[stats_attr[i]]);
+		entry->delta[i] = trap_rate_delta(cur, entry->last[i]);
+		entry->last[i] = cur;
+	}
+	/* a trap first seen now has no previous sample to compare with */
+	entry->seen = !new;
+	return MNL_CB_OK;
+}
+
+static int trap_rate_cmp(const void *a, const void *b)
+{
+	const struct trap_rate_entry *x = *(const struct trap_rate_entry **)a;
+	const struct trap_rate_entry *y = *(const struct trap_rate_entry **)b;
+	int i, ret;
+
+	/* seen ones first, then busiest first */
+	if (x->seen != y->seen)
+		return x->seen ? -1 : 1;
+	for (i = 0; i < TRAP_RATE_MAX; i++) {
+		if (x->delta[i] != y->delta[i])
+			return x->delta[i] > y->delta[i] ? -1 : 1;
+	}
+	ret = strcmp(x->key, y->key);
+	return ret ? ret : strcmp(x->name, y->name);
+}
+
+static void pr_out_trap_rate(struct trap_rate *tr, double secs)
+{
+	static const char * const names[TRAP_RATE_MAX] = {
+		[TRAP_RATE_PACKETS] = "packets",
+		[TRAP_RATE_BYTES] = "bytes",
+		[TRAP_RATE_DROPPED] = "dropped",
+	};
+	struct dl *dl = tr->dl;
+	unsigned int n, i;
+	char name[32];
+	int j;
+
+	n = tr->seen_count;
+	if (dl->opts.top && dl->opts.top < n)
+		n = dl->opts.top;
+
+	if (dl->json_output) {
+		open_json_object(NULL);
+		print_float(PRINT_JSON, "interval", NULL, secs);
+		open_json_array(PRINT_JSON, tr->name_attr == DEVLINK_ATTR_TRAP_NAME ?
+				"trap" : "trap_group");
+	} else {
+		pr_out("interval %.3fs\n", secs);
+	}
+
+	for (i = 0; i < n; i++) {
+		struct trap_rate_entry *entry = tr->entries[i];
+
+		if (dl->json_output) {
+			open_json_object(NULL);
+			print_string(PRINT_JSON, "dev", NULL, entry->key);
+			print_string(PRINT_JSON, "name", NULL, entry->name);
+			open_json_object("rx");
+		} else {
+			pr_out("%s name %s rx", entry->key, entry->name);
+		}
+		for (j = 0; j < TRAP_RATE_MAX; j++) {
+			if (dl->json_output) {
+				print_u64(PRINT_JSON, names[j], NULL,
+					  entry->delta[j]);
+				snprintf(name, sizeof(name), "%s_rate",
+					 names[j]);
+				print_float(PRINT_JSON, name, NULL,
+					    entry->delta[j] / secs);
+			} else {
+				pr_out(" %s %" PRIu64 " %.0f/s", names[j],
+				       entry->delta[j], entry->delta[j] / secs);
+			}
+		}
+		if (dl->json_output) {
+			close_json_object();
+			close_json_object();
+		} else {
+			pr_out("\n");
+		}
+	}
+
+	if (dl->json_output) {
+		close_json_array(PRINT_JSON, NULL);
+		close_json_object();
+	}
+}
+
+static int cmd_trap_rate(struct dl *dl, uint8_t cmd, uint16_t flags,
+			 int name_attr)
+{
+	struct trap_rate tr = { .dl = dl, .name_attr = name_attr };
+	struct nlmsghdr *nlh;
+	double now, last = 0, next;
+	unsigned int i;
+	uint32_t tick;
+	int err;
+
+	if (!dl->opts.interval) {
+		pr_err("Interval must be at least 1 second\n");
+		return -EINVAL;
+	}
+
+	/* one sample per line, whatever -p says */
+	if (dl->json_output) {
+		jsonw_pretty(get_json_writer(), false);
+		jsonw_lines(get_json_writer(), true);
+	}
+
+	/* tick 0 only takes the first sample */
+	next = monotonic_now();
+	for (tick = 0; !dl->opts.count || tick <= dl->opts.count; tick++) {
+		if (tick) {
+			next += dl->opts.interval;
+			monotonic_sleep_until(next);
+		}
+
+		for (i = 0; i < tr.entry_count; i++)
+			tr.entries[i]->seen = false;
+
+		nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, cmd, flags);
+		dl_opts_put(nlh, dl);
+		err = mnlu_gen_socket_sndrcv(&dl->nlg, nlh, trap_rate_cb, &tr);
+		if (tr.err)
+			err = tr.err;
+		if (err)
+			break;
+
+		now = monotonic_now();
+		if (tick) {
+			qsort(tr.entries, tr.entry_count, sizeof(*tr.entries),
+			      trap_rate_cmp);
+			for (tr.seen_count = 0; tr.seen_count < tr.entry_count;
+			     tr.seen_count++)
+				if (!tr.entries[tr.seen_count]->seen)
+					break;
+			pr_out_trap_rate(&tr, now - last);
+			fflush(stdout);
+		}
+		last = now;
+	}
+
+	trap_rate_fini(&tr);
+	return err;
+}
+
 static int cmd_trap_show(struct dl *dl)
 {
 	uint16_t flags = NLM_F_REQUEST | NLM_F_ACK;
 	struct nlmsghdr *nlh;
 	int err;
 
-	err = dl_argv_parse_with_selector(dl, &flags, DEVLINK_CMD_TRAP_GET,
-					  DL_OPT_HANDLE | DL_OPT_TRAP_NAME, 0,
-					  DL_OPT_HANDLE, 0);
+	if (dl_argv_match(dl, "interval")) {
+		/* every trap of every device */
+		flags |= NLM_F_DUMP;
+		err = dl_argv_parse(dl, 0, DL_OPT_INTERVAL);
+	} else {
+		err = dl_argv_parse_with_selector(dl, &flags,
+						  DEVLINK_CMD_TRAP_GET,
+						  DL_OPT_HANDLE | DL_OPT_TRAP_NAME,
+						  DL_OPT_INTERVAL,
+						  DL_OPT_HANDLE,
+						  DL_OPT_INTERVAL);
+	}
 	if (err)
 		return err;
 
+	if (dl->opts.present & DL_OPT_INTERVAL)
+		return cmd_trap_rate(dl, DEVLINK_CMD_TRAP_GET, flags,
+				     DEVLINK_ATTR_TRAP_NAME);
+
 	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_TRAP_GET, flags);
 
 	dl_opts_put(nlh, dl);
@@ -10168,13 +13221,25 @@ static int cmd_trap_group_show(struct dl *dl)
 	struct nlmsghdr *nlh;
 	int err;
 
-	err = dl_argv_parse_with_selector(dl, &flags,
-					  DEVLINK_CMD_TRAP_GROUP_GET,
-					  DL_OPT_HANDLE | DL_OPT_TRAP_GROUP_NAME, 0,
-					  DL_OPT_HANDLE, 0);
+	if (dl_argv_match(dl, "interval")) {
+		/* every trap group of every device */
+		flags |= NLM_F_DUMP;
+		err = dl_argv_parse(dl, 0, DL_OPT_INTERVAL);
+	} else {
+		err = dl_argv_parse_with_selector(dl, &flags,
+						  DEVLINK_CMD_TRAP_GROUP_GET,
+						  DL_OPT_HANDLE | DL_OPT_TRAP_GROUP_NAME,
+						  DL_OPT_INTERVAL,
+						  DL_OPT_HANDLE,
+						  DL_OPT_INTERVAL);
+	}
 	if (err)
 		return err;
 
+	if (dl->opts.present & DL_OPT_INTERVAL)
+		return cmd_trap_rate(dl, DEVLINK_CMD_TRAP_GROUP_GET, flags,
+				     DEVLINK_ATTR_TRAP_GROUP_NAME);
+
 	nlh = mnlu_gen_socket_cmd_prepare(&dl->nlg, DEVLINK_CMD_TRAP_GROUP_GET, flags);
 
 	dl_opts_put(nlh, dl);
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/signalfd.h>
+#include <time.h>
 #include <unistd.h>
 #include <linux/dpll.h>
 #include <linux/genetlink.h>
@@ -2145,10 +2146,28 @@ static int cmd_pin(struct dpll *dpll)
 	return -ENOENT;
 }
 
+/*
+ * "monitor stream": the socket queue is enlarged and drained with one
+ * recvmmsg() per batch; each notification becomes one compact JSON line
+ * stamped with the time its batch was received, and stdout is flushed
+ * once per batch rather than once per message.
+ */
+#define DPLL_STREAM_RCVBUF	(4 * 1024 * 1024)
+#define DPLL_STREAM_VLEN	64
+#define DPLL_STREAM_SLOT	32768
+
+static void dpll_monitor_ts(const struct timespec *ts)
+{
+	if (ts)
+		print_u64(PRINT_JSON, "ts", NULL,
+			  (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec);
+}
+
 /* Monitor command - notification handling */
 static int cmd_monitor_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	const struct timespec *ts = data;
 	const char *cmd_name = "UNKNOWN";
 	const char *json_name = "unknown";
 	int ret = MNL_CB_OK;
@@ -2174,6 +2193,7 @@ static int cmd_monitor_cb(const struct nlmsghdr *nlh, void *data)
 		mnl_attr_parse(nlh, sizeof(struct genlmsghdr), attr_cb, tb);
 
 		open_json_object(NULL);
+		dpll_monitor_ts(ts);
 		print_string(PRINT_JSON, "name", NULL, json_name);
 		open_json_object("msg");
 		print_string(PRINT_FP, NULL, "[%s] ", cmd_name);
@@ -2201,6 +2221,7 @@ static int cmd_monitor_cb(const struct nlmsghdr *nlh, void *data)
 		}
 
 		open_json_object(NULL);
+		dpll_monitor_ts(ts);
 		print_string(PRINT_JSON, "name", NULL, json_name);
 		open_json_object("msg");
 		print_string(PRINT_FP, NULL, "[%s] ", cmd_name);
@@ -2216,17 +2237,95 @@ static int cmd_monitor_cb(const struct nlmsghdr *nlh, void *data)
 		break;
 	}
 
-	fflush(stdout);
+	if (!ts)
+		fflush(stdout);
+	return ret;
+}
+
+static int dpll_monitor_stream(struct dpll *dpll, struct pollfd *pfds)
+{
+	struct mnlu_batch batch;
+	struct timespec ts;
+	int ret = 0, n;
+
+	if (mnlu_batch_init(&batch, DPLL_STREAM_VLEN, DPLL_STREAM_SLOT)) {
+		pr_err("Failed to allocate receive buffers\n");
+		return -ENOMEM;
+	}
+
+	while (1) {
+		ret = poll(pfds, 2, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("poll() failed: %s\n", strerror(errno));
+			ret = -errno;
+			break;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			ret = 0;
+			break;
+		}
+
+		if (!(pfds[1].revents & POLLIN))
+			continue;
+
+		do {
+			n = mnlu_socket_recv_batch(dpll->nlg.nl, &batch, &ts,
+						   cmd_monitor_cb, &ts);
+			if (n < 0 && errno == ENOBUFS) {
+				/* notifications were dropped, tell the reader */
+				clock_gettime(CLOCK_REALTIME, &ts);
+				open_json_object(NULL);
+				dpll_monitor_ts(&ts);
+				print_string(PRINT_JSON, "name", NULL,
+					     "overrun");
+				close_json_object();
+				n = DPLL_STREAM_VLEN;
+			} else if (n < 0) {
+				pr_err("Failed to receive notifications: %s\n",
+				       strerror(errno));
+				ret = -errno;
+				goto out;
+			}
+			fflush(stdout);
+		} while (n == DPLL_STREAM_VLEN);
+	}
+
+out:
+	mnlu_batch_free(&batch);
 	return ret;
 }
 
 static int cmd_monitor(struct dpll *dpll)
 {
 	int netlink_fd, signal_fd = -1;
+	__u32 rcvbuf = DPLL_STREAM_RCVBUF;
+	bool stream = false;
 	struct pollfd pfds[2];
 	sigset_t mask;
 	int ret = 0;
 
+	if (dpll_argv_match_inc(dpll, "stream")) {
+		stream = true;
+		if (dpll_argv_match(dpll, "rcvbuf") &&
+		    dpll_parse_u32(dpll, "rcvbuf", &rcvbuf))
+			return -EINVAL;
+	}
+	if (!dpll_no_arg(dpll)) {
+		pr_err("Usage: dpll monitor [ stream [ rcvbuf BYTES ] ]\n");
+		return -EINVAL;
+	}
+	if (stream && json) {
+		pr_err("monitor stream always writes JSON lines, drop -j\n");
+		return -EINVAL;
+	}
+
+	if (stream && mnlu_socket_set_rcvbuf(dpll->nlg.nl, rcvbuf))
+		pr_err("Failed to set receive buffer size: %s\n",
+		       strerror(errno));
+
 	ret = mnlg_socket_group_add(&dpll->nlg, "monitor");
 	if (ret) {
 		pr_err("Failed to subscribe to monitor group: %s\n",
@@ -2234,9 +2333,10 @@ static int cmd_monitor(struct dpll *dpll)
 		return ret;
 	}
 
-	print_string(PRINT_FP, NULL,
-		     "Monitoring DPLL events (Press Ctrl+C to stop)...\n",
-		     NULL);
+	if (!stream)
+		print_string(PRINT_FP, NULL,
+			     "Monitoring DPLL events (Press Ctrl+C to stop)...\n",
+			     NULL);
 
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
@@ -2274,13 +2374,22 @@ static int cmd_monitor(struct dpll *dpll)
 		goto err_signalfd;
 	}
 
-	open_json_array(PRINT_JSON, "monitor");
-
 	pfds[0].fd = signal_fd;
 	pfds[0].events = POLLIN;
 	pfds[1].fd = netlink_fd;
 	pfds[1].events = POLLIN;
 
+	if (stream) {
+		/* the reader sees a batch as soon as it has been drained */
+		setvbuf(stdout, NULL, _IOFBF, DPLL_STREAM_VLEN * 256);
+		new_json_obj_lines();
+		ret = dpll_monitor_stream(dpll, pfds);
+		delete_json_obj_plain();
+		goto err_signalfd;
+	}
+
+	open_json_array(PRINT_JSON, "monitor");
+
 	while (1) {
 		ret = poll(pfds, ARRAY_SIZE(pfds), -1);
 		if (ret < 0) {
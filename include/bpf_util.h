@@ -262,7 +262,10 @@ int bpf_parse_and_load_common(struct bpf_cfg_in *cfg,
 const char *bpf_prog_to_default_section(enum bpf_prog_type type);
 
 int bpf_graft_map(const char *map_path, uint32_t *key, int argc, char **argv);
+int bpf_load_map(const char *map_path, const char *file, bool hex);
 int bpf_trace_pipe(void);
+int bpf_dbg_map(const char *map_path, const char *type, const char *prog_path,
+		bool raw);
 
 void bpf_print_ops(struct rtattr *bpf_ops, __u16 len);
 
@@ -272,6 +275,13 @@ int bpf_prog_load_dev(enum bpf_prog_type type, const struct bpf_insn *insns,
 int bpf_program_load(enum bpf_prog_type type, const struct bpf_insn *insns,
 		     size_t size_insns, const char *license, char *log,
 		     size_t size_log, bool verbose);
+int bpf_program_load_name(enum bpf_prog_type type,
+			  const struct bpf_insn *insns, size_t size_insns,
+			  const char *license, const char *name, char *log,
+			  size_t size_log, bool verbose);
+int bpf_prog_query_fd(int target_fd, enum bpf_attach_type type,
+		      __u32 *prog_ids, __u32 *prog_cnt);
+int bpf_prog_name_by_id(uint32_t id, char *name, size_t len);
 
 int bpf_prog_attach_fd(int prog_fd, int target_fd, enum bpf_attach_type type);
 int bpf_prog_detach_fd(int target_fd, enum bpf_attach_type type);
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __CMD_SERVER_H__
+#define __CMD_SERVER_H__
+
+/*
+ * Resident command server for -server and its client, -client. The
+ * server keeps the link map loaded and current, and forks a child for
+ * every command line a client sends. cmd_server_run() returns only in
+ * those children, with the command line in *argcp and *argvp and the
+ * stdin, stdout, stderr and working directory of the client, or on
+ * failure to start. cmd_client_run() returns the exit status of the
+ * command.
+ */
+int cmd_server_run(const char *path, int *argcp, char ***argvp);
+int cmd_client_run(const char *path, const char *argv0,
+		   int argc, char *argv[]);
+
+#endif /* __CMD_SERVER_H__ */
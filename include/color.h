@@ -24,6 +24,8 @@ int default_color_opt(void);
 bool check_enable_color(int color, int json);
 bool matches_color(const char *arg, int *val);
 int color_fprintf(FILE *fp, enum color_attr attr, const char *fmt, ...);
+/* The escapes color_fprintf() puts around attr, empty without color */
+void color_escapes(enum color_attr attr, const char **start, const char **end);
 enum color_attr ifa_family_color(__u8 ifa_family);
 enum color_attr oper_state_color(__u8 state);
 
@@ -36,6 +36,7 @@ void new_json_obj(int json);
 void delete_json_obj(void);
 void new_json_obj_plain(int json);
 void delete_json_obj_plain(void);
+void new_json_obj_lines(void);
 
 bool is_json_context(void);
 
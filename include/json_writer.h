@@ -25,6 +25,12 @@ void jsonw_destroy(json_writer_t **self_p);
 /* Cause output to have pretty whitespace */
 void jsonw_pretty(json_writer_t *self, bool on);
 
+/* Cause each top-level value to be output on a line of its own */
+void jsonw_lines(json_writer_t *self, bool on);
+
+/* Cause output to be binary CBOR (RFC 8949) instead of JSON */
+void jsonw_cbor(json_writer_t *self, bool on);
+
 /* Add property name */
 void jsonw_name(json_writer_t *self, const char *name);
 
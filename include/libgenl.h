@@ -21,6 +21,14 @@ struct {								\
 	},								\
 }
 
+/*
+ * Replies to CTRL_CMD_GETFAMILY, cached by family name or, with a NULL
+ * name, by id for the life of the process.
+ */
+void genl_family_cache_put(const struct nlmsghdr *n);
+const struct nlmsghdr *genl_family_cache_get(const char *name, int id);
+void genl_family_cache_flush(void);
+
 int genl_add_mcast_grp(struct rtnl_handle *grth, __u16 genl_family, const char *group);
 int genl_resolve_family(struct rtnl_handle *grth, const char *family);
 int genl_init_handle(struct rtnl_handle *grth, const char *family,
@@ -3,8 +3,10 @@
 #define __LIBNETLINK_H__ 1
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
 #include <endian.h>
+#include <time.h>
 #include <asm/types.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -25,7 +27,13 @@ struct rtnl_handle {
 #define RTNL_HANDLE_F_LISTEN_ALL_NSID		0x01
 #define RTNL_HANDLE_F_SUPPRESS_NLERR		0x02
 #define RTNL_HANDLE_F_STRICT_CHK		0x04
+#define RTNL_HANDLE_F_LARGE_BUF			0x08
 	int			flags;
+	/* persistent receive arena used by dumps */
+	char		       *rbuf;
+	size_t			rbuf_len;
+	/* largest request the socket send buffer takes */
+	size_t			max_dgram;
 };
 
 struct nlmsg_list {
@@ -33,11 +41,25 @@ struct nlmsg_list {
 	struct nlmsghdr   h;
 };
 
+struct nlmsg_arena;
+
 struct nlmsg_chain {
 	struct nlmsg_list *head;
 	struct nlmsg_list *tail;
+	/* backing store of the list entries */
+	struct nlmsg_arena *arena;
+};
+
+/* Address space reserved for a request built in place with addattr_l()
+ * and friends; pages are only backed as the request grows into them.
+ */
+struct nlmsg_builder {
+	struct nlmsghdr	*n;
+	size_t		size;
 };
 
+#define NLMSG_BUILDER_INIT(sz)	{ .size = (sz) }
+
 struct ipstats_req {
 	struct nlmsghdr nlh;
 	struct if_stats_msg ifsm;
@@ -56,6 +78,15 @@ int rtnl_add_nl_group(struct rtnl_handle *rth, unsigned int group)
 	__attribute__((warn_unused_result));
 void rtnl_close(struct rtnl_handle *rth);
 void rtnl_set_strict_dump(struct rtnl_handle *rth);
+int rtnl_set_large_rbuf(struct rtnl_handle *rth, size_t len)
+	__attribute__((warn_unused_result));
+
+struct nlmsg_list *nlmsg_chain_append(struct nlmsg_chain *chain,
+				      const struct nlmsghdr *n);
+void nlmsg_chain_free(struct nlmsg_chain *chain);
+struct nlmsghdr *nlmsg_builder_start(struct nlmsg_builder *b, __u16 type,
+				     __u16 flags, size_t hdrlen);
+void nlmsg_builder_free(struct nlmsg_builder *b);
 
 typedef int (*req_filter_fn_t)(struct nlmsghdr *nlh, int reqlen);
 
@@ -161,6 +192,12 @@ struct rtnl_dump_filter_arg {
 int rtnl_dump_filter_nc(struct rtnl_handle *rth,
 			rtnl_filter_t filter,
 			void *arg, __u16 nc_flags);
+/* Called on every message of a dump before the first one is filtered */
+typedef void (*rtnl_prescan_t)(int proto, const struct nlmsghdr *n);
+void rtnl_dump_set_prescan(rtnl_prescan_t prescan);
+/* Receive dumps in a thread, into a ring of "depth" datagrams */
+#define RTNL_PIPELINE_DEPTH	16
+void rtnl_dump_set_pipeline(unsigned int depth);
 #define rtnl_dump_filter(rth, filter, arg) \
 	rtnl_dump_filter_nc(rth, filter, arg, 0)
 int rtnl_dump_filter_errhndlr_nc(struct rtnl_handle *rth,
@@ -172,6 +209,21 @@ int rtnl_dump_filter_errhndlr_nc(struct rtnl_handle *rth,
 #define rtnl_dump_filter_errhndlr(rth, filter, farg, errhndlr, earg) \
 	rtnl_dump_filter_errhndlr_nc(rth, filter, farg, errhndlr, earg, 0)
 
+/* One in-flight dump for rtnl_dump_filter_multi(); the request must
+ * already have been sent on rth, one dump per handle.
+ */
+struct rtnl_dump_multi {
+	struct rtnl_handle	*rth;
+	rtnl_filter_t		filter;
+	void			*arg;
+	__u16			nc_flags;
+	/* private */
+	bool			done;
+	int			dump_intr;
+};
+
+int rtnl_dump_filter_multi(struct rtnl_dump_multi *dumps, int count);
+
 int rtnl_echo_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n, int json,
 		   int (*print_info)(struct nlmsghdr *n, void *arg))
 	__attribute__((warn_unused_result));
@@ -186,6 +238,79 @@ int rtnl_send(struct rtnl_handle *rth, const void *buf, int)
 int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int)
 	__attribute__((warn_unused_result));
 int nl_dump_ext_ack(const struct nlmsghdr *nlh, nl_ext_ack_fn_t errfn);
+
+/* Batched delete engine used by the various "flush" commands.
+ *
+ * Requests are queued into a window and sent on a dedicated socket in
+ * as few datagrams as the socket buffers allow: a datagram is no larger
+ * than the send buffer and has no more requests than the receive buffer
+ * has room for replies to. The last request of each datagram asks for
+ * an ACK; failures of the others are collected while waiting for it.
+ */
+#define RTNL_FLUSH_WINDOW	(256 * 1024)
+
+struct rtnl_flush {
+	struct rtnl_handle	rth;
+	char			*buf;
+	int			len;
+	int			size;
+	int			max_dgram;
+	int			max_replies;	/* bytes of replies per datagram */
+	unsigned int		queued;
+	unsigned int		issued;
+	/* errno values which are not reported, e.g. already deleted */
+	int			ignore_errno;
+	/* added to the flags of every request, e.g. NLM_F_CREATE */
+	__u16			flags;
+	struct timespec		start;
+	/* optional per-request error reporting, see rtnl_flush_set_report() */
+	void			(*report)(const struct nlmsghdr *err, int tag,
+					  void *arg);
+	void			*report_arg;
+	/* optional, for requests the kernel answers, see rtnl_flush_set_answer() */
+	void			(*answer)(const struct nlmsghdr *n, int tag,
+					  void *arg);
+	int			*tags;
+	unsigned int		max_queued;
+	__u32			first_seq;
+	int			tag;
+};
+
+int rtnl_flush_open(struct rtnl_flush *f, int window)
+	__attribute__((warn_unused_result));
+int rtnl_flush_open_byproto(struct rtnl_flush *f, int window, int protocol)
+	__attribute__((warn_unused_result));
+int rtnl_flush_add(struct rtnl_flush *f, const struct nlmsghdr *n, __u16 type)
+	__attribute__((warn_unused_result));
+int rtnl_flush_commit(struct rtnl_flush *f)
+	__attribute__((warn_unused_result));
+int rtnl_flush_set_report(struct rtnl_flush *f, unsigned int max_queued,
+			  void (*report)(const struct nlmsghdr *err, int tag,
+					 void *arg),
+			  void *arg)
+	__attribute__((warn_unused_result));
+void rtnl_flush_set_answer(struct rtnl_flush *f,
+			   void (*answer)(const struct nlmsghdr *n, int tag,
+					  void *arg));
+double rtnl_flush_rate(const struct rtnl_flush *f);
+void rtnl_flush_close(struct rtnl_flush *f);
+
+/* Windowed mode for batch files: requests that rtnl_talk() would send
+ * on the given handle without expecting an answer are queued instead
+ * and sent in windows of up to "window" requests. Any other netlink
+ * traffic first waits for the queued requests to complete, so later
+ * queries see their effect. Failed requests are reported with the tag
+ * that was current when they were queued (the batch line number). If
+ * replies were lost, every request of the window whose outcome is not
+ * known is reported as failed with ENOBUFS.
+ */
+int rtnl_async_start(struct rtnl_handle *rth, unsigned int window,
+		     void (*report)(int tag, void *arg), void *arg)
+	__attribute__((warn_unused_result));
+void rtnl_async_tag(int tag);
+unsigned int rtnl_async_failed(void);
+int rtnl_async_sync(void);
+unsigned int rtnl_async_stop(void);
 int nl_dump_ext_ack_done(const struct nlmsghdr *nlh, unsigned int offset, int error);
 
 int addattr(struct nlmsghdr *n, int maxlen, int type);
@@ -304,6 +429,22 @@ static inline int rta_type(const struct rtattr *rta)
 int rtnl_listen_all_nsid(struct rtnl_handle *);
 int rtnl_listen(struct rtnl_handle *, rtnl_listen_filter_t handler,
 		void *jarg);
+
+/* Receive buffers for draining a notification socket in batches */
+struct rtnl_batch {
+	struct mmsghdr	*msgs;
+	struct iovec	*iov;
+	char		*buf;
+	char		*cbuf;
+	unsigned int	vlen;
+	size_t		slot;
+};
+
+int rtnl_batch_init(struct rtnl_batch *b, unsigned int vlen, size_t slot);
+void rtnl_batch_free(struct rtnl_batch *b);
+int rtnl_listen_batch(struct rtnl_handle *rth, struct rtnl_batch *b,
+		      struct timespec *ts, rtnl_listen_filter_t handler,
+		      void *jarg);
 int rtnl_from_file(FILE *, rtnl_listen_filter_t handler,
 		   void *jarg);
 
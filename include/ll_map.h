@@ -5,12 +5,21 @@
 int ll_remember_index(struct nlmsghdr *n, void *arg);
 
 void ll_init_map(struct rtnl_handle *rth);
+void ll_init_map_lazy(void);
 unsigned ll_name_to_index(const char *name);
 const char *ll_index_to_name(unsigned idx);
 int ll_index_to_type(unsigned idx);
 int ll_index_to_flags(unsigned idx);
 void ll_drop_by_index(unsigned index);
 unsigned namehash(const char *str);
+void ll_map_stats(FILE *fp);
+void ll_map_cache_invalidate(void);
+
+struct ll_map_state;
+struct ll_map_state *ll_map_state_alloc(void);
+void ll_map_swap(struct ll_map_state *st);
+void ll_map_state_free(struct ll_map_state *st);
+void ll_map_reset(void);
 
 const char *ll_idx_n2a(unsigned int idx);
 
@@ -33,4 +33,21 @@ int mnlu_gen_socket_recv_run(struct mnlu_gen_socket *nlg, mnl_cb_t cb,
 			     void *data);
 int mnlu_gen_cmd_dump_policy(struct mnlu_gen_socket *nlg, uint8_t cmd);
 
+struct timespec;
+
+/* Receive buffers for draining several datagrams with one recvmmsg() */
+struct mnlu_batch {
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	char *buf;
+	size_t slot;
+	unsigned int vlen;
+};
+
+int mnlu_batch_init(struct mnlu_batch *b, unsigned int vlen, size_t slot);
+void mnlu_batch_free(struct mnlu_batch *b);
+int mnlu_socket_set_rcvbuf(struct mnl_socket *nl, int size);
+int mnlu_socket_recv_batch(struct mnl_socket *nl, struct mnlu_batch *b,
+			   struct timespec *ts, mnl_cb_t cb, void *data);
+
 #endif /* __MNL_UTILS_H__ */
@@ -53,6 +53,8 @@ static inline int setns(int fd, int nstype)
 int netns_switch(char *netns);
 int netns_get_fd(const char *netns);
 int netns_foreach(int (*func)(char *nsname, void *arg), void *arg);
+int netns_names(char ***names);
+void netns_names_free(char **names, int cnt);
 
 struct netns_func {
 	int (*func)(char *nsname, void *arg);
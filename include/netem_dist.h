@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * netem_dist.h	Binary netem distribution tables
+ *
+ * A table is this header followed by @count __s16 values in host byte
+ * order, as produced by netem/distbin. tc maps it as is, so the values
+ * start @hdrlen bytes into the file and the file ends right after them.
+ */
+
+#ifndef __NETEM_DIST_H__
+#define __NETEM_DIST_H__
+
+#include <linux/types.h>
+
+#define NETEM_DIST_MAGIC	0x7464656eU	/* "nedt" on little endian */
+#define NETEM_DIST_VERSION	1
+
+struct netem_dist_hdr {
+	__u32	magic;
+	__u16	version;
+	__u16	hdrlen;
+	__u32	count;
+	__u32	csum;		/* netem_dist_csum() of the values */
+};
+
+static inline __u32 netem_dist_csum(const __s16 *data, __u32 count)
+{
+	__u32 a = 1, b = 0, i;
+
+	for (i = 0; i < count; i++) {
+		a = (a + (__u16)data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return b << 16 | a;
+}
+
+#endif /* __NETEM_DIST_H__ */
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __NL_PIPELINE_H__
+#define __NL_PIPELINE_H__
+
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "libnetlink.h"
+
+/*
+ * Internal to libnetlink: the dump pipeline lives in its own object so
+ * that libnetlink.o does not depend on libpthread. libnetlink calls the
+ * hook only when rtnl_dump_set_pipeline() has set it.
+ */
+extern int (*rtnl_dump_pipeline)(struct rtnl_handle *rth,
+				 const struct rtnl_dump_filter_arg *arg,
+				 int *ret);
+
+int __rtnl_recvmsg(int fd, struct msghdr *msg, int flags);
+int rtnl_dump_filter_buf(struct rtnl_handle *rth,
+			 const struct sockaddr_nl *nladdr,
+			 const struct rtnl_dump_filter_arg *arg,
+			 char *buf, int status, int *msglen, int *dump_intr);
+
+#endif /* __NL_PIPELINE_H__ */
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __NL_STATS_H__
+#define __NL_STATS_H__
+
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <linux/types.h>
+#include <linux/netlink.h>
+
+/*
+ * Netlink instrumentation for -stats-nl, or NL_STATS=1 (summary) and
+ * NL_STATS=trace (summary and one line per request) in the environment.
+ * The summary is printed to stderr on exit. libnetlink calls the hooks
+ * only while nl_stats_on is set, so they cost nothing otherwise.
+ */
+extern bool nl_stats_on;
+
+void nl_stats_enable(bool trace);
+void nl_stats_env(void);
+
+__u64 nl_stats_now(void);
+void nl_stats_sent(const struct msghdr *msg, ssize_t len, __u64 ns);
+void nl_stats_recvd(const struct msghdr *msg, int flags, ssize_t len,
+		    __u64 ns);
+void nl_stats_trunc(void);
+void nl_stats_filter(__u64 ns);
+void nl_stats_begin(const struct nlmsghdr *n, bool dump);
+void nl_stats_end(void);
+
+#endif /* __NL_STATS_H__ */
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __PROC_SCAN_H__
+#define __PROC_SCAN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct proc_scan_buf;
+
+struct proc_scan {
+	const char	*root;	/* $PROC_ROOT or /proc if NULL */
+	bool		tasks;	/* also visit the other threads */
+	/* Runs concurrently in worker threads. dirfd is open on the
+	 * directory of the process or thread, results are handed back
+	 * with proc_scan_emit().
+	 */
+	void		(*visit)(int dirfd, int pid, int tid,
+				 struct proc_scan_buf *out, void *arg);
+	/* Runs in the calling thread, for all results in pid order */
+	int		(*collect)(const void *rec, size_t len, void *arg);
+	void		*arg;
+};
+
+int proc_scan(const struct proc_scan *ps);
+int proc_scan_emit(struct proc_scan_buf *out, const void *rec, size_t len);
+
+#endif /* __PROC_SCAN_H__ */
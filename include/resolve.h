@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __RESOLVE_H__
+#define __RESOLVE_H__
+
+#include <linux/netlink.h>
+
+/*
+ * Parallel reverse lookups for -resolve. resolve_start() makes
+ * format_host() use them and queues the addresses of every dump before
+ * it is printed. Needs -lpthread.
+ */
+void resolve_start(void);
+
+void resolve_prefetch(int af, int len, const void *addr);
+void resolve_prefetch_nlmsg(int proto, const struct nlmsghdr *n);
+const char *resolve_lookup(int af, int len, const void *addr);
+
+#endif /* __RESOLVE_H__ */
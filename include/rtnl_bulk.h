@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __RTNL_BULK_H__
+#define __RTNL_BULK_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <linux/netlink.h>
+
+#include "libnetlink.h"
+
+/* fields of a line that are split out at most */
+#define RTNL_BULK_MAX_FIELDS	64
+
+/*
+ * Loader for the "file FILE" argument of commands that add many objects
+ * at once, one per line of FILE ("-" reads stdin). Everything from a '#'
+ * on is a comment, fields are separated by blanks and empty lines are
+ * skipped. Requests are sent in windows of up to "window" requests with
+ * rtnl_flush, after the queued requests of a -batch-async window, and
+ * failures are reported with the file name and line number.
+ */
+struct rtnl_bulk;
+
+/* Build the request for the fields of one line in n, which holds a copy
+ * of the prototype request and has room for maxlen bytes. Returns NULL,
+ * or why the line is not valid.
+ */
+typedef const char *(*rtnl_bulk_parse_t)(struct rtnl_bulk *b,
+					 struct nlmsghdr *n, int maxlen,
+					 char **tok, int ntok);
+
+struct rtnl_bulk {
+	const char		*file;
+	const char		*what;		/* "entries" in the summary */
+	int			protocol;	/* 0: NETLINK_ROUTE */
+	unsigned int		window;
+	int			max_fields;	/* more fail the line, 0: any */
+	bool			genl;		/* errors are not rtnetlink's */
+	rtnl_bulk_parse_t	parse;
+	/* optional, names what a tag is instead of "FILE:LINE", or NULL */
+	const char		*(*name)(struct rtnl_bulk *b, int tag);
+	/* optional, for requests the kernel answers */
+	void			(*answer)(struct rtnl_bulk *b,
+					  const struct nlmsghdr *n,
+					  int lineno);
+	void			*arg;
+	/* set by parse() when the lines after this one would fail too */
+	bool			stop;
+
+	unsigned int		entries;
+	unsigned int		failed;
+	double			rate;		/* requests per second */
+};
+
+/* The whole job: parse every line and send its request */
+int rtnl_bulk_load(struct rtnl_bulk *b, const struct nlmsghdr *proto,
+		   int maxlen);
+
+/* Pieces for loaders that read the whole file before sending */
+FILE *rtnl_bulk_open(struct rtnl_bulk *b);
+void rtnl_bulk_close(FILE *fp);
+int rtnl_bulk_tokens(char *line, char **tok, int max);
+int rtnl_bulk_start(struct rtnl_bulk *b, struct rtnl_flush *f);
+void rtnl_bulk_report(const struct nlmsghdr *err, int lineno, void *arg);
+int rtnl_bulk_finish(struct rtnl_bulk *b, struct rtnl_flush *f);
+void rtnl_bulk_line_error(struct rtnl_bulk *b, int lineno, const char *err);
+
+#endif /* __RTNL_BULK_H__ */
@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __RTNL_RING_H__
+#define __RTNL_RING_H__
+
+#include <stddef.h>
+#include <time.h>
+#include <linux/types.h>
+#include <linux/netlink.h>
+
+struct rtnl_ring;
+
+#define RTNL_RING_F_ALL_NSID	0x01	/* captured with all-nsid */
+
+struct rtnl_ring_stats {
+	__u64	records;	/* ever written */
+	__u64	lost;		/* overwritten before being read */
+	__u64	overruns;	/* times the socket dropped notifications */
+	__u64	expired;	/* dropped for being older than the max age */
+};
+
+typedef int (*rtnl_ring_filter_t)(const struct timespec *ts, int nsid,
+				  struct nlmsghdr *n, void *arg);
+
+/* Writer side, for ip monitor capture */
+struct rtnl_ring *rtnl_ring_create(const char *path, size_t size,
+				   unsigned int flags);
+int rtnl_ring_put(struct rtnl_ring *ring, const struct timespec *ts,
+		  int nsid, const struct nlmsghdr *n);
+void rtnl_ring_overrun(struct rtnl_ring *ring);
+void rtnl_ring_set_max_age(struct rtnl_ring *ring, unsigned int secs);
+
+/* Reader side. Open fails with EBADMSG if @path is not a ring file. */
+struct rtnl_ring *rtnl_ring_open(const char *path);
+int rtnl_ring_walk(struct rtnl_ring *ring, rtnl_ring_filter_t filter,
+		   void *arg);
+int rtnl_ring_walk_range(struct rtnl_ring *ring, const struct timespec *since,
+			 const struct timespec *until,
+			 rtnl_ring_filter_t filter, void *arg);
+
+unsigned int rtnl_ring_flags(const struct rtnl_ring *ring);
+void rtnl_ring_stats(const struct rtnl_ring *ring,
+		     struct rtnl_ring_stats *stats);
+void rtnl_ring_close(struct rtnl_ring *ring);
+
+#endif /* __RTNL_RING_H__ */
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __STAT_HIST_H__
+#define __STAT_HIST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Record layouts, one per tool */
+#define STAT_HIST_NSTAT		1
+#define STAT_HIST_IFSTAT	2
+
+struct stat_hist {
+	char		source[128];
+	const void	*data;		/* count records of rec_size bytes */
+	size_t		count;
+	void		*map;
+	size_t		map_len;
+};
+
+/* Opens and locks the history file at path */
+int stat_hist_open(const char *path);
+
+/* Returns 0 with the records of a binary history mapped, 1 if the file
+ * is not a binary history (it is empty or text), -1 if it is damaged or
+ * of another version or layout.
+ */
+int stat_hist_map(int fd, uint16_t kind, size_t rec_size,
+		  struct stat_hist *h);
+void stat_hist_unmap(struct stat_hist *h);
+
+/* Replaces the history at path by rename */
+int stat_hist_write(const char *path, uint16_t kind, const char *source,
+		    const void *data, size_t rec_size, size_t count);
+
+#endif /* __STAT_HIST_H__ */
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef __STAT_SHM_H__
+#define __STAT_SHM_H__
+
+#include <stddef.h>
+
+struct stat_shm;
+
+/* Writer side, for the nstat and ifstat daemons */
+struct stat_shm *stat_shm_create(const char *path);
+int stat_shm_publish(struct stat_shm *shm, const void *data, size_t len);
+void stat_shm_destroy(struct stat_shm *shm);
+
+/* Returns a malloc'd copy of the last snapshot, or NULL if there is none
+ * or its writer is gone.
+ */
+void *stat_shm_read(const char *path, size_t *len);
+
+#endif /* __STAT_SHM_H__ */
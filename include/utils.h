@@ -29,6 +29,8 @@ extern int oneline;
 extern int brief;
 extern int json;
 extern int pretty;
+extern int json_lines;
+extern int json_cbor;
 extern int timestamp;
 extern int timestamp_short;
 extern const char * _SL_;
@@ -175,6 +177,8 @@ const char *format_host_r(int af, int len, const void *addr,
 		      buf, buflen)
 
 const char *format_host(int af, int lne, const void *addr);
+void format_host_set_resolver(const char *(*resolve)(int af, int len,
+						     const void *addr));
 #define format_host_rta(af, rta) \
 	format_host(af, RTA_PAYLOAD(rta), RTA_DATA(rta))
 const char *rt_addr_n2a_r(int af, int len, const void *addr,
@@ -196,6 +200,31 @@ int check_altifname(const char *name);
 int get_ifname(char *, const char *);
 const char *get_ifname_rta(int ifindex, const struct rtattr *rta);
 int matches(const char *prefix, const char *string);
+
+/*
+ * A keyword list looked up with one hash probe. keyword_lookup() returns
+ * the id of the first entry in the list that matches, exactly or, for
+ * prefix entries, the way matches() does, or -1; so a list in the order
+ * of an if/else chain of strcmp() and matches() gives the same result.
+ */
+struct keyword {
+	const char	*name;
+	int		id;
+	bool		prefix;
+};
+
+struct keyword_slot;
+
+struct keyword_table {
+	const struct keyword	*kw;
+	unsigned int		n;
+	unsigned int		mask;
+	struct keyword_slot	*slot;	/* built on first use */
+};
+
+#define KEYWORD_TABLE(list) { .kw = list, .n = ARRAY_SIZE(list) }
+
+int keyword_lookup(struct keyword_table *t, const char *arg);
 int inet_addr_match(const inet_prefix *a, const inet_prefix *b, int bits);
 int inet_addr_match_rta(const inet_prefix *m, const struct rtattr *rta);
 
@@ -259,6 +288,7 @@ static inline void __jiffies_to_tv(struct timeval *tv, unsigned long jiffies)
 void print_escape_buf(const __u8 *buf, size_t len, const char *escape);
 
 int print_timestamp(FILE *fp);
+int print_timestamp_tv(FILE *fp, const struct timeval *tv);
 void print_nlmsg_timestamp(FILE *fp, const struct nlmsghdr *n);
 
 unsigned int print_name_and_link(const char *fmt,
@@ -312,10 +342,14 @@ int get_real_family(int rtm_type, int rtm_family);
 
 int cmd_exec(const char *cmd, char **argv, bool do_fork,
 	     int (*setup)(void *), void *arg);
+int cmd_exec_parallel(const char *cmd, char **argv, void **args, int cnt,
+		      unsigned int jobs, int (*setup)(void *),
+		      void (*done)(void *arg, int fd, int status));
 int make_path(const char *path, mode_t mode);
 char *find_cgroup2_mount(bool do_mount);
 __u64 get_cgroup2_id(const char *path);
 char *get_cgroup2_path(__u64 id, bool full);
+int cgroup2_path_by_handle(int mnt_fd, __u64 id, char *buf, size_t len);
 int get_command_name(const char *pid, char *comm, size_t len);
 int get_task_name(pid_t pid, char *name, size_t len);
 
@@ -333,10 +367,18 @@ int get_time(unsigned int *time, const char *str);
 int get_time64(__s64 *time, const char *str);
 char *sprint_time(__u32 time, char *buf);
 char *sprint_time64(__s64 time, char *buf);
+double monotonic_now(void);
+int monotonic_sleep_until(double deadline);
 void print_num(FILE *fp, unsigned int width, uint64_t count);
 
 int do_batch(const char *name, bool force,
 	     int (*cmd)(int argc, char *argv[], void *user), void *user);
+int do_batch_async(const char *name, bool force, struct rtnl_handle *rth,
+		   unsigned int window,
+		   int (*cmd)(int argc, char *argv[], void *user), void *user);
+int do_batch_jobs(const char *name, bool force, unsigned int jobs,
+		  const char *key, int (*init)(void *user),
+		  int (*cmd)(int argc, char *argv[], void *user), void *user);
 
 int parse_one_of(const char *msg, const char *realval, const char * const *list,
 		 size_t len, int *p_err);
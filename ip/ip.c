@@ -21,6 +21,11 @@
 #include "color.h"
 #include "rt_names.h"
 #include "bpf_util.h"
+#include "ll_map.h"
+#include "json_writer.h"
+#include "resolve.h"
+#include "nl_stats.h"
+#include "cmd_server.h"
 
 #ifndef LIBDIR
 #define LIBDIR "/usr/lib"
@@ -38,6 +43,11 @@ int force;
 int max_flush_loops = 10;
 int batch_mode;
 bool do_all;
+static unsigned int batch_window;
+static unsigned int batch_jobs;
+unsigned int netns_jobs;
+static bool all_netns;
+static const char *batch_key = "dev";
 
 struct rtnl_handle rth = { .fd = -1 };
 
@@ -58,19 +68,24 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip [ OPTIONS ] OBJECT { COMMAND | help }\n"
-		"       ip [ -force ] -batch filename\n"
+		"       ip [ -force ] [ -batch-async WINDOW ] [ -batch-jobs N [ -batch-key KEY ] ]\n"
+		"          -batch filename\n"
+		"       ip -server SOCKET\n"
+		"       ip -client SOCKET [ OPTIONS ] OBJECT { COMMAND | help }\n"
 		"where  OBJECT := { address | addrlabel | fou | help | ila | ioam | l2tp | link |\n"
 		"                   macsec | maddress | monitor | mptcp | mroute | mrule |\n"
 		"                   neighbor | neighbour | netconf | netns | nexthop | ntable |\n"
 		"                   ntbl | route | rule | sr | stats | tap | tcpmetrics |\n"
 		"                   token | tunnel | tuntap | vrf | xfrm }\n"
 		"       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] | -r[esolve] |\n"
-		"                    -h[uman-readable] | -iec | -j[son] | -p[retty] |\n"
+		"                    -h[uman-readable] | -iec | -j[son] | -jsonl | -cbor |\n"
+		"                    -p[retty] |\n"
 		"                    -f[amily] { inet | inet6 | mpls | bridge | link } |\n"
 		"                    -4 | -6 | -M | -B | -0 |\n"
 		"                    -l[oops] { maximum-addr-flush-attempts } | -echo | -br[ief] |\n"
 		"                    -o[neline] | -t[imestamp] | -ts[hort] | -b[atch] [filename] |\n"
 		"                    -rc[vbuf] [size] | -n[etns] name | -N[umeric] | -a[ll] |\n"
+		"                    -par[allel] N | -all-netns | -stats-nl | -dump-pipeline |\n"
 		"                    -c[olor]}\n");
 	exit(-1);
 }
@@ -144,6 +159,111 @@ static int ip_batch_cmd(int argc, char *argv[], void *data)
 	return do_cmd(argv[0], argc, argv, true);
 }
 
+/* every batch worker talks to the kernel over its own socket */
+static int ip_batch_init(void *data)
+{
+	rtnl_close(&rth);
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Run the command in every named network namespace from this process:
+ * a socket is opened in each one with setns() and the command runs with
+ * a link map of its own, so there is no fork, exec or netns_switch() per
+ * namespace. The output of each is headed with the namespace name, as
+ * "-all netns exec" does, or wrapped in {"netns": NAME, "data": ...}
+ * objects of an array with -json.
+ */
+static int do_cmd_all_netns(int argc, char **argv)
+{
+	json_writer_t *jw = NULL;
+	int cnt, i, self, ret = 0;
+	char **names;
+
+	cnt = netns_names(&names);
+	if (cnt < 0)
+		return EXIT_FAILURE;
+
+	self = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+	if (self < 0) {
+		perror("Cannot open the current network namespace");
+		netns_names_free(names, cnt);
+		return EXIT_FAILURE;
+	}
+
+	if (json) {
+		jw = jsonw_new(stdout);
+		if (!jw) {
+			perror("json object");
+			exit(1);
+		}
+		jsonw_cbor(jw, json_cbor);
+		jsonw_pretty(jw, pretty);
+		jsonw_start_array(jw);
+	}
+
+	for (i = 0; i < cnt; i++) {
+		struct ll_map_state *ll = ll_map_state_alloc();
+		int fd = netns_get_fd(names[i]);
+		int err;
+
+		if (fd < 0 || !ll || setns(fd, CLONE_NEWNET) < 0) {
+			fprintf(stderr,
+				"Cannot enter network namespace \"%s\": %s\n",
+				names[i], strerror(errno));
+			ret = EXIT_FAILURE;
+			goto next;
+		}
+
+		if (rtnl_open(&rth, 0) < 0) {
+			ret = EXIT_FAILURE;
+			goto back;
+		}
+		rtnl_set_strict_dump(&rth);
+
+		if (jw) {
+			jsonw_start_object(jw);
+			jsonw_string_field(jw, "netns", names[i]);
+			jsonw_name(jw, "data");
+		} else {
+			printf("\nnetns: %s\n", names[i]);
+		}
+		fflush(stdout);
+
+		ll_map_swap(ll);
+		err = do_cmd(argv[0], argc, argv, true);
+		ll_map_swap(ll);
+		if (err)
+			ret = err;
+
+		if (jw)
+			jsonw_end_object(jw);
+		fflush(stdout);
+		rtnl_close(&rth);
+back:
+		if (setns(self, CLONE_NEWNET) < 0) {
+			perror("Cannot return to the original network namespace");
+			exit(1);
+		}
+next:
+		if (fd >= 0)
+			close(fd);
+		ll_map_state_free(ll);
+	}
+
+	if (jw) {
+		jsonw_end_array(jw);
+		jsonw_destroy(&jw);
+	}
+	close(self);
+	netns_names_free(names, cnt);
+	return ret;
+}
+
 static int batch(const char *name)
 {
 	int orig_family = preferred_family;
@@ -155,7 +275,14 @@ static int batch(const char *name)
 	}
 
 	batch_mode = 1;
-	ret = do_batch(name, force, ip_batch_cmd, &orig_family);
+	if (batch_jobs > 1)
+		ret = do_batch_jobs(name, force, batch_jobs, batch_key,
+				    ip_batch_init, ip_batch_cmd, &orig_family);
+	else if (batch_window)
+		ret = do_batch_async(name, force, &rth, batch_window,
+				     ip_batch_cmd, &orig_family);
+	else
+		ret = do_batch(name, force, ip_batch_cmd, &orig_family);
 
 	rtnl_close(&rth);
 	return ret;
@@ -168,6 +295,13 @@ int main(int argc, char **argv)
 	char *basename;
 	int color = default_color_opt();
 
+	if (argc > 2 && strcmp(argv[1], "-client") == 0)
+		return cmd_client_run(argv[2], argv[0], argc - 3, argv + 3);
+	/* returns in the children forked for the commands only */
+	if (argc > 2 && strcmp(argv[1], "-server") == 0 &&
+	    cmd_server_run(argv[2], &argc, &argv))
+		return EXIT_FAILURE;
+
 	/* to run vrf exec without root, capabilities might be set, drop them
 	 * if not needed as the first thing.
 	 * execv will drop them for the child command.
@@ -229,6 +363,10 @@ int main(int argc, char **argv)
 			++human_readable;
 		} else if (matches(opt, "-iec") == 0) {
 			++use_iec;
+		} else if (strcmp(opt, "-stats-nl") == 0) {
+			nl_stats_enable(false);
+		} else if (strcmp(opt, "-dump-pipeline") == 0) {
+			rtnl_dump_set_pipeline(RTNL_PIPELINE_DEPTH);
 		} else if (matches(opt, "-stats") == 0 ||
 			   matches(opt, "-statistics") == 0) {
 			++show_stats;
@@ -258,8 +396,35 @@ int main(int argc, char **argv)
 			if (argc <= 1)
 				missarg("batch file");
 			batch_file = argv[1];
+		} else if (matches(opt, "-batch-async") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("batch window");
+			if (get_unsigned(&batch_window, argv[1], 0) ||
+			    !batch_window)
+				invarg("invalid batch window", argv[1]);
+		} else if (matches(opt, "-batch-jobs") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("batch jobs");
+			if (get_unsigned(&batch_jobs, argv[1], 0) || !batch_jobs)
+				invarg("invalid number of batch jobs", argv[1]);
+		} else if (matches(opt, "-batch-key") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("batch key");
+			batch_key = argv[1];
 		} else if (matches(opt, "-brief") == 0) {
 			++brief;
+		} else if (strcmp(opt, "-jsonl") == 0) {
+			++json;
+			++json_lines;
+		} else if (strcmp(opt, "-cbor") == 0) {
+			++json;
+			++json_cbor;
 		} else if (matches(opt, "-json") == 0) {
 			++json;
 		} else if (matches(opt, "-pretty") == 0) {
@@ -286,8 +451,18 @@ int main(int argc, char **argv)
 				exit(-1);
 		} else if (matches(opt, "-Numeric") == 0) {
 			++numeric;
+		} else if (strcmp(opt, "-all-netns") == 0) {
+			all_netns = true;
 		} else if (matches(opt, "-all") == 0) {
 			do_all = true;
+		} else if (matches(opt, "-parallel") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("number of parallel jobs");
+			if (get_unsigned(&netns_jobs, argv[1], 0) || !netns_jobs)
+				invarg("Invalid number of parallel jobs",
+				       argv[1]);
 		} else if (strcmp(opt, "-echo") == 0) {
 			++echo_request;
 		} else {
@@ -303,6 +478,23 @@ int main(int argc, char **argv)
 
 	check_enable_color(color, json);
 
+	if (resolve_hosts)
+		resolve_start();
+
+	if (batch_file && all_netns) {
+		fprintf(stderr, "-all-netns cannot be used with -batch\n");
+		exit(-1);
+	}
+	if (all_netns) {
+		if (argc < 2)
+			usage();
+		if (json_lines) {
+			fprintf(stderr, "-all-netns cannot be used with -jsonl\n");
+			exit(-1);
+		}
+		return do_cmd_all_netns(argc - 1, argv + 1);
+	}
+
 	if (batch_file)
 		return batch(batch_file);
 
@@ -18,6 +18,7 @@
 #include <linux/if.h>
 #include <linux/if_arp.h>
 #include <linux/if_tunnel.h>
+#include <linux/if_link.h>
 #include <linux/ip6_tunnel.h>
 
 #include "utils.h"
@@ -42,6 +43,7 @@ static void usage(void)
 		"          [ dscp inherit ]\n"
 		"          [ [no]allow-localremote ]\n"
 		"          [ [i|o]seq ] [ [i|o]key KEY ] [ [i|o]csum ]\n"
+		"       ip -f inet6 -s tunnel show [ NAME ] [ interval SECS ]\n"
 		"\n"
 		"Where: NAME      := STRING\n"
 		"       ADDR      := IPV6_ADDRESS\n"
@@ -314,6 +316,77 @@ static void ip6_tnl_parm_initialize(const struct tnl_print_nlmsg_info *info)
 	strcpy(p2->name, p1->name);
 }
 
+/*
+ * ip6tnl and ip6gre report in the link dump all that SIOCGETTUNNEL
+ * returns for them; ip6_vti keeps using the ioctl.
+ */
+static bool ip6_tnl_parm_parse(const struct tnl_print_nlmsg_info *info,
+			       const char *name, const char *kind,
+			       struct rtattr *data)
+{
+	struct ip6_tnl_parm2 *p = info->p2;
+	struct rtattr *tb[MAX(IFLA_GRE_MAX, IFLA_IPTUN_MAX) + 1];
+
+	if (!data)
+		return false;
+
+	memset(p, 0, sizeof(*p));
+	if (strcmp(kind, "ip6gre") == 0) {
+		parse_rtattr_nested(tb, IFLA_GRE_MAX, data);
+		p->proto = IPPROTO_GRE;
+		if (tb[IFLA_GRE_LINK])
+			p->link = rta_getattr_u32(tb[IFLA_GRE_LINK]);
+		if (tb[IFLA_GRE_IFLAGS])
+			p->i_flags = rta_getattr_u16(tb[IFLA_GRE_IFLAGS]);
+		if (tb[IFLA_GRE_OFLAGS])
+			p->o_flags = rta_getattr_u16(tb[IFLA_GRE_OFLAGS]);
+		if (tb[IFLA_GRE_IKEY])
+			p->i_key = rta_getattr_u32(tb[IFLA_GRE_IKEY]);
+		if (tb[IFLA_GRE_OKEY])
+			p->o_key = rta_getattr_u32(tb[IFLA_GRE_OKEY]);
+		if (tb[IFLA_GRE_LOCAL])
+			memcpy(&p->laddr, RTA_DATA(tb[IFLA_GRE_LOCAL]),
+			       sizeof(p->laddr));
+		if (tb[IFLA_GRE_REMOTE])
+			memcpy(&p->raddr, RTA_DATA(tb[IFLA_GRE_REMOTE]),
+			       sizeof(p->raddr));
+		if (tb[IFLA_GRE_TTL])
+			p->hop_limit = rta_getattr_u8(tb[IFLA_GRE_TTL]);
+		if (tb[IFLA_GRE_ENCAP_LIMIT])
+			p->encap_limit = rta_getattr_u8(tb[IFLA_GRE_ENCAP_LIMIT]);
+		if (tb[IFLA_GRE_FLOWINFO])
+			p->flowinfo = rta_getattr_u32(tb[IFLA_GRE_FLOWINFO]);
+		if (tb[IFLA_GRE_FLAGS])
+			p->flags = rta_getattr_u32(tb[IFLA_GRE_FLAGS]);
+	} else if (strcmp(kind, "ip6tnl") == 0) {
+		parse_rtattr_nested(tb, IFLA_IPTUN_MAX, data);
+		if (tb[IFLA_IPTUN_PROTO])
+			p->proto = rta_getattr_u8(tb[IFLA_IPTUN_PROTO]);
+		if (tb[IFLA_IPTUN_LINK])
+			p->link = rta_getattr_u32(tb[IFLA_IPTUN_LINK]);
+		if (tb[IFLA_IPTUN_LOCAL])
+			memcpy(&p->laddr, RTA_DATA(tb[IFLA_IPTUN_LOCAL]),
+			       sizeof(p->laddr));
+		if (tb[IFLA_IPTUN_REMOTE])
+			memcpy(&p->raddr, RTA_DATA(tb[IFLA_IPTUN_REMOTE]),
+			       sizeof(p->raddr));
+		if (tb[IFLA_IPTUN_TTL])
+			p->hop_limit = rta_getattr_u8(tb[IFLA_IPTUN_TTL]);
+		if (tb[IFLA_IPTUN_ENCAP_LIMIT])
+			p->encap_limit = rta_getattr_u8(tb[IFLA_IPTUN_ENCAP_LIMIT]);
+		if (tb[IFLA_IPTUN_FLOWINFO])
+			p->flowinfo = rta_getattr_u32(tb[IFLA_IPTUN_FLOWINFO]);
+		if (tb[IFLA_IPTUN_FLAGS])
+			p->flags = rta_getattr_u32(tb[IFLA_IPTUN_FLAGS]);
+	} else {
+		ip6_tnl_parm_initialize(info);
+		return false;
+	}
+
+	strlcpy(p->name, name, sizeof(p->name));
+	return true;
+}
+
 static bool ip6_tnl_parm_match(const struct tnl_print_nlmsg_info *info)
 {
 	const struct ip6_tnl_parm2 *p1 = info->p1;
@@ -338,10 +411,14 @@ static bool ip6_tnl_parm_match(const struct tnl_print_nlmsg_info *info)
 static int do_show(int argc, char **argv)
 {
 	struct ip6_tnl_parm2 p, p1;
+	unsigned int interval = 0;
 
 	ip6_tnl_parm_init(&p, 0);
 	p.proto = 0;  /* default to any */
 
+	if (show_stats)
+		interval = tnl_parse_interval(&argc, argv);
+
 	if (parse_args(argc, argv, SIOCGETTUNNEL, &p) < 0)
 		return -1;
 
@@ -350,10 +427,13 @@ static int do_show(int argc, char **argv)
 			.p1    = &p,
 			.p2    = &p1,
 			.init  = ip6_tnl_parm_initialize,
+			.parse = ip6_tnl_parm_parse,
 			.match = ip6_tnl_parm_match,
 			.print = print_tunnel,
 		};
 
+		if (interval)
+			return do_tunnels_rates(&info, interval);
 		return do_tunnels_list(&info);
 	}
 
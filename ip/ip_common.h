@@ -19,9 +19,7 @@ struct link_filter {
 	int down;
 	char *label;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_flush *flush;
 	int group;
 	int master;
 	char *kind;
@@ -98,7 +96,6 @@ int iplink_get(char *name, __u32 filt_mask);
 int iplink_ifla_xstats(int argc, char **argv);
 
 int ip_link_list(req_filter_fn_t filter_fn, struct nlmsg_chain *linfo);
-void free_nlmsg_chain(struct nlmsg_chain *info);
 
 static inline int rtm_get_table(struct rtmsg *r, struct rtattr **tb)
 {
@@ -110,6 +107,7 @@ static inline int rtm_get_table(struct rtmsg *r, struct rtattr **tb)
 }
 
 extern struct rtnl_handle rth;
+extern unsigned int netns_jobs;
 
 struct iplink_req {
 	struct nlmsghdr		n;
@@ -151,9 +149,16 @@ int bond_print_xstats(struct nlmsghdr *n, void *arg);
 extern const struct ipstats_stat_desc ipstats_stat_desc_xstats_bond_group;
 extern const struct ipstats_stat_desc ipstats_stat_desc_xstats_slave_bond_group;
 
+/* iplink_can.c */
+int can_link_watch(int ifindex, unsigned int interval_ms);
+
+/* iplink_bond_slave.c */
+void bond_slave_print_oper_state(FILE *fp, const char *name, __u16 state);
+
 /* iproute_lwtunnel.c */
 int lwt_parse_encap(struct rtattr *rta, size_t len, int *argcp, char ***argvp,
 		    int encap_attr, int encap_type_attr);
+int lwt_template_define(int argc, char **argv);
 void lwt_print_encap(FILE *fp, struct rtattr *encap_type, struct rtattr *encap);
 
 /* iplink_xdp.c */
@@ -174,6 +179,12 @@ enum ipstats_stat_desc_kind {
 struct ipstats_stat_dump_filters;
 struct ipstats_stat_show_attrs;
 
+/* How the counters of a leaf are laid out, for "ip stats show interval" */
+enum ipstats_stat_desc_counters {
+	IPSTATS_COUNTERS_U64,		/* a struct of __u64 counters */
+	IPSTATS_COUNTERS_NEST_U64,	/* a nest of __u64 attributes */
+};
+
 struct ipstats_stat_desc {
 	const char *name;
 	enum ipstats_stat_desc_kind kind;
@@ -187,6 +198,10 @@ struct ipstats_stat_desc {
 				     const struct ipstats_stat_desc *desc);
 			int (*show)(struct ipstats_stat_show_attrs *attrs,
 				    const struct ipstats_stat_desc *desc);
+			/* NULL if what the leaf shows is not counters */
+			struct rtattr *(*counters)(struct ipstats_stat_show_attrs *attrs,
+						   const struct ipstats_stat_desc *desc);
+			enum ipstats_stat_desc_counters counters_layout;
 		};
 	};
 };
@@ -203,14 +218,22 @@ void ipstats_stat_desc_pack_xstats(struct ipstats_stat_dump_filters *filters,
 				   const struct ipstats_stat_desc *desc);
 int ipstats_stat_desc_show_xstats(struct ipstats_stat_show_attrs *attrs,
 				  const struct ipstats_stat_desc *desc);
+struct rtattr *
+ipstats_stat_desc_counters_xstats(struct ipstats_stat_show_attrs *attrs,
+				  const struct ipstats_stat_desc *desc);
 
-#define IPSTATS_STAT_DESC_XSTATS_LEAF(NAME) {		\
-		.name = (NAME),				\
-		.kind = IPSTATS_STAT_DESC_KIND_LEAF,	\
-		.show = &ipstats_stat_desc_show_xstats,	\
-		.pack = &ipstats_stat_desc_pack_xstats,	\
+#define IPSTATS_STAT_DESC_XSTATS_LEAF_LAYOUT(NAME, LAYOUT) {		\
+		.name = (NAME),						\
+		.kind = IPSTATS_STAT_DESC_KIND_LEAF,			\
+		.show = &ipstats_stat_desc_show_xstats,			\
+		.pack = &ipstats_stat_desc_pack_xstats,			\
+		.counters = &ipstats_stat_desc_counters_xstats,		\
+		.counters_layout = (LAYOUT),				\
 	}
 
+#define IPSTATS_STAT_DESC_XSTATS_LEAF(NAME)				\
+	IPSTATS_STAT_DESC_XSTATS_LEAF_LAYOUT(NAME, IPSTATS_COUNTERS_U64)
+
 #ifndef	INFINITY_LIFE_TIME
 #define     INFINITY_LIFE_TIME      0xFFFFFFFFU
 #endif
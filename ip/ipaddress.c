@@ -31,6 +31,7 @@
 #include "ll_map.h"
 #include "ip_common.h"
 #include "color.h"
+#include "rtnl_bulk.h"
 
 enum {
 	IPADD_LIST,
@@ -40,6 +41,7 @@ enum {
 
 static struct link_filter filter;
 static int do_link;
+static int do_apply;
 
 static void usage(void) __attribute__((noreturn));
 
@@ -51,6 +53,9 @@ static void usage(void)
 	fprintf(stderr,
 		"Usage: ip address {add|change|replace} IFADDR dev IFNAME [ LIFETIME ]\n"
 		"                                                      [ CONFFLAG-LIST ]\n"
+		"       ip address {add|change|replace|del} file FILE [ dev IFNAME ]\n"
+		"                            [ LIFETIME ] [ CONFFLAG-LIST ] ...\n"
+		"       ip address apply [ file ] FILE proto ADDRPROTO [ dev IFNAME ] ...\n"
 		"       ip address del IFADDR dev IFNAME [mngtmpaddr]\n"
 		"       ip address {save|flush} [ dev IFNAME ] [ scope SCOPE-ID ] [ to PREFIX ]\n"
 		"                            [ FLAG-LIST ] [ label LABEL ] [ { up | down } ]\n"
@@ -80,35 +85,48 @@ static void usage(void)
 	exit(-1);
 }
 
+static const struct {
+	unsigned int	flag;
+	const char	*name;
+} link_flag_names[] = {
+#define _PF(f) { IFF_##f, #f }
+	_PF(LOOPBACK),
+	_PF(BROADCAST),
+	_PF(POINTOPOINT),
+	_PF(MULTICAST),
+	_PF(NOARP),
+	_PF(ALLMULTI),
+	_PF(PROMISC),
+	_PF(MASTER),
+	_PF(SLAVE),
+	_PF(DEBUG),
+	_PF(DYNAMIC),
+	_PF(AUTOMEDIA),
+	_PF(PORTSEL),
+	_PF(NOTRAILERS),
+	_PF(UP),
+	_PF(LOWER_UP),
+	_PF(DORMANT),
+	_PF(ECHO),
+#undef _PF
+};
+
 static void print_link_flags(FILE *fp, unsigned int flags, unsigned int mdown)
 {
+	unsigned int i;
+
 	open_json_array(PRINT_ANY, is_json_context() ? "flags" : "<");
 	if (flags & IFF_UP && !(flags & IFF_RUNNING))
 		print_string(PRINT_ANY, NULL,
 			     flags ? "%s," : "%s", "NO-CARRIER");
 	flags &= ~IFF_RUNNING;
-#define _PF(f) if (flags&IFF_##f) {					\
-		flags &= ~IFF_##f ;					\
-		print_string(PRINT_ANY, NULL, flags ? "%s," : "%s", #f); }
-	_PF(LOOPBACK);
-	_PF(BROADCAST);
-	_PF(POINTOPOINT);
-	_PF(MULTICAST);
-	_PF(NOARP);
-	_PF(ALLMULTI);
-	_PF(PROMISC);
-	_PF(MASTER);
-	_PF(SLAVE);
-	_PF(DEBUG);
-	_PF(DYNAMIC);
-	_PF(AUTOMEDIA);
-	_PF(PORTSEL);
-	_PF(NOTRAILERS);
-	_PF(UP);
-	_PF(LOWER_UP);
-	_PF(DORMANT);
-	_PF(ECHO);
-#undef _PF
+	for (i = 0; i < ARRAY_SIZE(link_flag_names); i++) {
+		if (!(flags & link_flag_names[i].flag))
+			continue;
+		flags &= ~link_flag_names[i].flag;
+		print_string(PRINT_ANY, NULL, flags ? "%s," : "%s",
+			     link_flag_names[i].name);
+	}
 	if (flags)
 		print_hex(PRINT_ANY, NULL, "%x", flags);
 	if (mdown)
@@ -973,21 +991,14 @@ static int get_rtattr(struct nlmsghdr *n, struct rtattr **tb)
 	return 0;
 }
 
-int print_linkinfo(struct nlmsghdr *n, void *arg)
+/*
+ * Returns 1 with the name of the link if it is to be shown, 0 if only
+ * its addresses are, -1 if it is filtered out.
+ */
+static int linkinfo_match(const struct ifinfomsg *ifi, struct rtattr *tb[],
+			  const char **namep)
 {
-	FILE *fp = (FILE *)arg;
-	struct ifinfomsg *ifi = NLMSG_DATA(n);
-	struct rtattr *tb[IFLA_MAX+1];
 	const char *name;
-	unsigned int m_flag = 0;
-	SPRINT_BUF(b1);
-	bool truncated_vfs = false;
-
-	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
-		return 0;
-
-	if (get_rtattr(n, tb) < 0)
-		return -1;
 
 	if (filter.ifindex && ifi->ifi_index != filter.ifindex)
 		return -1;
@@ -1024,6 +1035,31 @@ int print_linkinfo(struct nlmsghdr *n, void *arg)
 	if (filter.slave_kind && match_link_kind(tb, filter.slave_kind, 1))
 		return -1;
 
+	*namep = name;
+	return 1;
+}
+
+int print_linkinfo(struct nlmsghdr *n, void *arg)
+{
+	FILE *fp = (FILE *)arg;
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX+1];
+	const char *name;
+	unsigned int m_flag = 0;
+	SPRINT_BUF(b1);
+	bool truncated_vfs = false;
+	int ret;
+
+	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
+		return 0;
+
+	if (get_rtattr(n, tb) < 0)
+		return -1;
+
+	ret = linkinfo_match(ifi, tb, &name);
+	if (ret <= 0)
+		return ret;
+
 	print_headers(fp, "[LINK]");
 
 	if (n->nlmsg_type == RTM_DELLINK)
@@ -1353,26 +1389,6 @@ int print_linkinfo(struct nlmsghdr *n, void *arg)
 	return 1;
 }
 
-static int flush_update(void)
-{
-
-	/*
-	 * Note that the kernel may delete multiple addresses for one
-	 * delete request (e.g. if ipv4 address promotion is disabled).
-	 * Since a flush operation is really a series of delete requests
-	 * its possible that we may request an address delete that has
-	 * already been done by the kernel. Therefore, ignore EADDRNOTAVAIL
-	 * errors returned from a flush request
-	 */
-	if ((rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) &&
-	    (errno != EADDRNOTAVAIL)) {
-		perror("Failed to send flush request");
-		return -1;
-	}
-	filter.flushp = 0;
-	return 0;
-}
-
 static int set_lifetime(unsigned int *lifetime, char *argv)
 {
 	if (strcmp(argv, "forever") == 0)
@@ -1512,6 +1528,31 @@ static int ifa_label_match_rta(int ifindex, const struct rtattr *rta)
 	return fnmatch(filter.label, label, 0);
 }
 
+static bool addrinfo_match(const struct ifaddrmsg *ifa, struct rtattr *rta_tb[],
+			   unsigned int ifa_flags)
+{
+	if (filter.ifindex && filter.ifindex != ifa->ifa_index)
+		return false;
+	if ((filter.scope^ifa->ifa_scope)&filter.scopemask)
+		return false;
+	if ((filter.flags ^ ifa_flags) & filter.flagmask)
+		return false;
+
+	if (filter.family && filter.family != ifa->ifa_family)
+		return false;
+	if (filter.have_proto && rta_tb[IFA_PROTO] &&
+	    filter.proto != rta_getattr_u8(rta_tb[IFA_PROTO]))
+		return false;
+
+	if (ifa_label_match_rta(ifa->ifa_index, rta_tb[IFA_LABEL]))
+		return false;
+
+	if (inet_addr_match_rta(&filter.pfx, rta_tb[IFA_LOCAL]))
+		return false;
+
+	return true;
+}
+
 int print_addrinfo(struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = arg;
@@ -1535,7 +1576,7 @@ int print_addrinfo(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWADDR)
+	if (filter.flush && n->nlmsg_type != RTM_NEWADDR)
 		return 0;
 
 	parse_rtattr(rta_tb, IFA_MAX, IFA_RTA(ifa),
@@ -1548,38 +1589,14 @@ int print_addrinfo(struct nlmsghdr *n, void *arg)
 	if (!rta_tb[IFA_ADDRESS])
 		rta_tb[IFA_ADDRESS] = rta_tb[IFA_LOCAL];
 
-	if (filter.ifindex && filter.ifindex != ifa->ifa_index)
-		return 0;
-	if ((filter.scope^ifa->ifa_scope)&filter.scopemask)
-		return 0;
-	if ((filter.flags ^ ifa_flags) & filter.flagmask)
-		return 0;
-
-	if (filter.family && filter.family != ifa->ifa_family)
-		return 0;
-	if (filter.have_proto && rta_tb[IFA_PROTO] &&
-	    filter.proto != rta_getattr_u8(rta_tb[IFA_PROTO]))
-		return 0;
-
-	if (ifa_label_match_rta(ifa->ifa_index, rta_tb[IFA_LABEL]))
-		return 0;
-
-	if (inet_addr_match_rta(&filter.pfx, rta_tb[IFA_LOCAL]))
+	if (!addrinfo_match(ifa, rta_tb, ifa_flags))
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
+	if (filter.flush) {
+		if (rtnl_flush_add(filter.flush, n, RTM_DELADDR) < 0) {
+			perror("Failed to send flush request");
+			return -1;
 		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELADDR;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -1595,7 +1612,7 @@ int print_addrinfo(struct nlmsghdr *n, void *arg)
 	if (!brief) {
 		const char *name;
 
-		if (filter.oneline || filter.flushb || echo_request) {
+		if (filter.oneline || filter.flush || echo_request) {
 			const char *dev = ll_index_to_name(ifa->ifa_index);
 
 			if (is_json_context()) {
@@ -1736,12 +1753,95 @@ brief_exit:
 	return 0;
 }
 
+/* Addresses bucketed by interface index: lookups for one link only
+ * walk the addresses of links sharing its bucket instead of the whole
+ * address chain.
+ */
+struct addr_index {
+	unsigned int		mask;
+	unsigned int		*start;
+	struct nlmsghdr		**addrs;
+};
+
+static int addr_index_bucket(const struct addr_index *idx, int ifindex)
+{
+	return ifindex & idx->mask;
+}
+
+static int addr_index_build(struct addr_index *idx,
+			    const struct nlmsg_chain *ainfo)
+{
+	unsigned int n = 0, size = 1, i, *pos;
+	struct nlmsg_list *a;
+
+	for (a = ainfo->head; a; a = a->next)
+		n++;
+	while (size < n)
+		size <<= 1;
+
+	idx->mask = size - 1;
+	idx->start = calloc(size + 1, sizeof(*idx->start));
+	idx->addrs = calloc(n ? : 1, sizeof(*idx->addrs));
+	pos = calloc(size, sizeof(*pos));
+	if (!idx->start || !idx->addrs || !pos) {
+		free(pos);
+		return -1;
+	}
+
+	for (a = ainfo->head; a; a = a->next) {
+		struct ifaddrmsg *ifa = NLMSG_DATA(&a->h);
+
+		idx->start[addr_index_bucket(idx, ifa->ifa_index) + 1]++;
+	}
+	for (i = 0; i < size; i++) {
+		idx->start[i + 1] += idx->start[i];
+		pos[i] = idx->start[i];
+	}
+
+	/* keeps the dump order within a bucket */
+	for (a = ainfo->head; a; a = a->next) {
+		struct ifaddrmsg *ifa = NLMSG_DATA(&a->h);
+
+		idx->addrs[pos[addr_index_bucket(idx, ifa->ifa_index)]++] = &a->h;
+	}
+
+	free(pos);
+	return 0;
+}
+
+static void addr_index_free(struct addr_index *idx)
+{
+	free(idx->start);
+	free(idx->addrs);
+}
+
+/* Addresses which may belong to ifindex; callers still check ifa_index */
+static struct nlmsghdr **addr_index_get(const struct addr_index *idx,
+					int ifindex, unsigned int *count)
+{
+	unsigned int b;
+
+	if (!idx->start) {
+		*count = 0;
+		return NULL;
+	}
+
+	b = addr_index_bucket(idx, ifindex);
+	*count = idx->start[b + 1] - idx->start[b];
+	return idx->addrs + idx->start[b];
+}
+
 static int print_selected_addrinfo(struct ifinfomsg *ifi,
-				   struct nlmsg_list *ainfo, FILE *fp)
+				   const struct addr_index *aidx, FILE *fp)
 {
+	struct nlmsghdr **addrs;
+	unsigned int i, count;
+
+	addrs = addr_index_get(aidx, ifi->ifi_index, &count);
+
 	open_json_array(PRINT_JSON, "addr_info");
-	for ( ; ainfo ;  ainfo = ainfo->next) {
-		struct nlmsghdr *n = &ainfo->h;
+	for (i = 0; i < count; i++) {
+		struct nlmsghdr *n = addrs[i];
 		struct ifaddrmsg *ifa = NLMSG_DATA(n);
 
 		if (n->nlmsg_type != RTM_NEWADDR)
@@ -1774,123 +1874,509 @@ static int print_selected_addrinfo(struct ifinfomsg *ifi,
 }
 
 
-static int store_nlmsg(struct nlmsghdr *n, void *arg)
+/*
+ * Text -brief listings skip the print_* helpers: the rows are formatted
+ * straight into one large buffer, with specialised address formatters
+ * and the color escapes looked up once, and written out in big chunks.
+ * The output is the same as from print_linkinfo_brief() and the brief
+ * part of print_addrinfo(), which JSON output still goes through.
+ */
+#define BRIEF_BUF_SIZE		(1 << 20)
+#define BRIEF_FIELD_MAX		512	/* room made for one field */
+
+struct brief_out {
+	char		*buf;
+	size_t		len;
+	const char	*start[COLOR_NONE];
+	const char	*end[COLOR_NONE];
+};
+
+static void brief_flush(struct brief_out *b)
 {
-	struct nlmsg_chain *lchain = (struct nlmsg_chain *)arg;
-	struct nlmsg_list *h;
+	fwrite(b->buf, 1, b->len, stdout);
+	b->len = 0;
+}
 
-	h = malloc(n->nlmsg_len+sizeof(void *));
-	if (h == NULL)
-		return -1;
+/* Returns room for at least BRIEF_FIELD_MAX bytes */
+static char *brief_room(struct brief_out *b)
+{
+	if (BRIEF_BUF_SIZE - b->len < BRIEF_FIELD_MAX)
+		brief_flush(b);
+	return b->buf + b->len;
+}
 
-	memcpy(&h->h, n, n->nlmsg_len);
-	h->next = NULL;
+static void brief_str(struct brief_out *b, const char *s)
+{
+	size_t len = strlen(s);
 
-	if (lchain->tail)
-		lchain->tail->next = h;
-	else
-		lchain->head = h;
-	lchain->tail = h;
+	if (len >= BRIEF_FIELD_MAX) {
+		brief_flush(b);
+		fwrite(s, 1, len, stdout);
+		return;
+	}
+	memcpy(brief_room(b), s, len);
+	b->len += len;
+}
 
-	ll_remember_index(n, NULL);
-	return 0;
+static void brief_color(struct brief_out *b, enum color_attr attr)
+{
+	if (attr != COLOR_NONE)
+		brief_str(b, b->start[attr]);
 }
 
-static __u32 ipadd_dump_magic = 0x47361222;
+static void brief_uncolor(struct brief_out *b, enum color_attr attr)
+{
+	if (attr != COLOR_NONE)
+		brief_str(b, b->end[attr]);
+}
 
-static int ipadd_save_prep(void)
+/* As color_fprintf(fp, attr, "%-<width>s ", s) */
+static void brief_column(struct brief_out *b, enum color_attr attr,
+			 const char *s, size_t width)
 {
-	int ret;
+	size_t len = strlen(s);
 
-	if (isatty(STDOUT_FILENO)) {
-		fprintf(stderr, "Not sending a binary stream to stdout\n");
-		return -1;
+	brief_color(b, attr);
+	brief_str(b, s);
+	if (len < width) {
+		memset(brief_room(b), ' ', width - len);
+		b->len += width - len;
 	}
+	brief_str(b, " ");
+	brief_uncolor(b, attr);
+}
 
-	ret = write(STDOUT_FILENO, &ipadd_dump_magic, sizeof(ipadd_dump_magic));
-	if (ret != sizeof(ipadd_dump_magic)) {
-		fprintf(stderr, "Can't write magic to dump file\n");
-		return -1;
-	}
+static char *brief_u32(char *p, __u32 v)
+{
+	char tmp[10];
+	int i = 0;
+
+	do {
+		tmp[i++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (i)
+		*p++ = tmp[--i];
+	return p;
+}
 
-	return 0;
+static char *brief_hex16(char *p, unsigned int v)
+{
+	static const char hex[] = "0123456789abcdef";
+	int shift = 12;
+
+	while (shift && !(v >> shift))
+		shift -= 4;
+	for (; shift >= 0; shift -= 4)
+		*p++ = hex[(v >> shift) & 0xf];
+	return p;
 }
 
-static int ipadd_dump_check_magic(void)
+static char *brief_inet(char *p, const __u8 *a)
 {
-	int ret;
-	__u32 magic = 0;
+	int i;
 
-	if (isatty(STDIN_FILENO)) {
-		fprintf(stderr, "Can't restore address dump from a terminal\n");
-		return -1;
+	for (i = 0; i < 4; i++) {
+		if (i)
+			*p++ = '.';
+		p = brief_u32(p, a[i]);
 	}
+	return p;
+}
 
-	ret = fread(&magic, sizeof(magic), 1, stdin);
-	if (magic != ipadd_dump_magic) {
-		fprintf(stderr, "Magic mismatch (%d elems, %x magic)\n", ret, magic);
-		return -1;
+/* As inet_ntop(AF_INET6), down to the embedded IPv4 forms */
+static char *brief_inet6(char *p, const __u8 *a)
+{
+	int best = -1, best_len = 0, cur = -1, cur_len = 0;
+	unsigned int w[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		w[i] = a[2 * i] << 8 | a[2 * i + 1];
+		if (!w[i]) {
+			if (cur < 0) {
+				cur = i;
+				cur_len = 0;
+			}
+			if (++cur_len > best_len) {
+				best = cur;
+				best_len = cur_len;
+			}
+		} else {
+			cur = -1;
+		}
 	}
+	if (best_len < 2)
+		best = -1;
 
-	return 0;
+	for (i = 0; i < 8; i++) {
+		if (best >= 0 && i >= best && i < best + best_len) {
+			if (i == best)
+				*p++ = ':';
+			continue;
+		}
+		if (i)
+			*p++ = ':';
+		if (i == 6 && best == 0 &&
+		    (best_len == 6 || (best_len == 5 && w[5] == 0xffff)))
+			return brief_inet(p, a + 12);
+		p = brief_hex16(p, w[i]);
+	}
+	if (best >= 0 && best + best_len == 8)
+		*p++ = ':';
+	return p;
 }
 
-static int save_nlmsg(struct nlmsghdr *n, void *arg)
+static void brief_addr(struct brief_out *b, int family, const struct rtattr *rta)
 {
-	int ret;
+	enum color_attr attr = ifa_family_color(family);
+	char *p;
+
+	brief_color(b, attr);
+	if (resolve_hosts ||
+	    !((family == AF_INET && RTA_PAYLOAD(rta) >= 4) ||
+	      (family == AF_INET6 && RTA_PAYLOAD(rta) >= 16))) {
+		brief_str(b, format_host_rta(family, rta));
+	} else {
+		p = brief_room(b);
+		if (family == AF_INET)
+			b->len = brief_inet(p, RTA_DATA(rta)) - b->buf;
+		else
+			b->len = brief_inet6(p, RTA_DATA(rta)) - b->buf;
+	}
+	brief_uncolor(b, attr);
+}
 
-	ret = write(STDOUT_FILENO, n, n->nlmsg_len);
-	if ((ret > 0) && (ret != n->nlmsg_len)) {
-		fprintf(stderr, "Short write while saving nlmsg\n");
-		ret = -EIO;
+static void brief_lladdr(struct brief_out *b, const struct rtattr *rta,
+			 int type)
+{
+	static const char hex[] = "0123456789abcdef";
+	const __u8 *a = RTA_DATA(rta);
+	int alen = RTA_PAYLOAD(rta);
+	char *p;
+	int i;
+
+	brief_color(b, COLOR_MAC);
+	switch (type) {
+	case ARPHRD_TUNNEL:
+	case ARPHRD_SIT:
+	case ARPHRD_IPGRE:
+	case ARPHRD_TUNNEL6:
+	case ARPHRD_IP6GRE:
+	case ARPHRD_AX25:
+	case ARPHRD_NETROM:
+	case ARPHRD_ROSE:
+		alen = 0;
+		break;
 	}
+	if (alen > 0 && alen * 3 < BRIEF_FIELD_MAX) {
+		p = brief_room(b);
+		for (i = 0; i < alen; i++) {
+			if (i)
+				*p++ = ':';
+			*p++ = hex[a[i] >> 4];
+			*p++ = hex[a[i] & 0xf];
+		}
+		*p++ = ' ';
+		b->len = p - b->buf;
+	} else {
+		SPRINT_BUF(b1);
 
-	return ret == n->nlmsg_len ? 0 : ret;
+		brief_str(b, ll_addr_n2a(a, RTA_PAYLOAD(rta), type,
+					 b1, sizeof(b1)));
+		brief_str(b, " ");
+	}
+	brief_uncolor(b, COLOR_MAC);
 }
 
-static int show_handler(struct rtnl_ctrl_data *ctrl,
-			struct nlmsghdr *n, void *arg)
+/* As print_link_flags() */
+static void brief_link_flags(struct brief_out *b, unsigned int flags,
+			     unsigned int mdown)
 {
-	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	char *p;
+	int i;
 
-	open_json_object(NULL);
-	print_int(PRINT_ANY, "index", "if%d:", ifa->ifa_index);
-	print_nl();
-	print_addrinfo(n, stdout);
-	close_json_object();
-	return 0;
+	brief_str(b, "<");
+	if (flags & IFF_UP && !(flags & IFF_RUNNING))
+		brief_str(b, flags ? "NO-CARRIER," : "NO-CARRIER");
+	flags &= ~IFF_RUNNING;
+	for (i = 0; i < ARRAY_SIZE(link_flag_names); i++) {
+		if (!(flags & link_flag_names[i].flag))
+			continue;
+		flags &= ~link_flag_names[i].flag;
+		brief_str(b, link_flag_names[i].name);
+		if (flags)
+			brief_str(b, ",");
+	}
+	if (flags) {
+		p = brief_room(b);
+		b->len += snprintf(p, BRIEF_FIELD_MAX, "%x", flags);
+	}
+	if (mdown)
+		brief_str(b, ",M-DOWN");
+	brief_str(b, "> ");
 }
 
-static int ipaddr_showdump(void)
+/* As print_linkinfo_brief() */
+static void brief_link(struct brief_out *b, const struct ifinfomsg *ifi,
+		       struct rtattr *tb[], const char *name)
 {
-	int err;
+	unsigned int m_flag = 0;
+	SPRINT_BUF(b1);
 
-	if (ipadd_dump_check_magic())
-		exit(-1);
+	/* as print_name_and_link() */
+	if (tb[IFLA_LINK]) {
+		int iflink = rta_getattr_u32(tb[IFLA_LINK]);
+		const char *link;
 
-	new_json_obj(json);
-	open_json_object(NULL);
-	open_json_array(PRINT_JSON, "addr_info");
+		if (!iflink) {
+			link = "NONE";
+		} else if (tb[IFLA_LINK_NETNSID]) {
+			link = ll_idx_n2a(iflink);
+		} else {
+			link = ll_index_to_name(iflink);
+			m_flag = !(ll_index_to_flags(iflink) & IFF_UP);
+		}
+		snprintf(b1, sizeof(b1), "%s@%s", name, link);
+		name = b1;
+	}
+	brief_column(b, COLOR_IFNAME, name, 16);
 
-	err = rtnl_from_file(stdin, &show_handler, NULL);
+	if (tb[IFLA_OPERSTATE]) {
+		__u8 state = rta_getattr_u8(tb[IFLA_OPERSTATE]);
 
-	close_json_array(PRINT_JSON, NULL);
-	close_json_object();
-	delete_json_obj();
+		if (state < ARRAY_SIZE(oper_states)) {
+			brief_column(b, oper_state_color(state),
+				     oper_states[state], 14);
+		} else {
+			snprintf(b1, sizeof(b1), "state %#x", state);
+			brief_str(b, b1);
+		}
+	}
 
-	exit(err);
+	if (filter.family == AF_PACKET) {
+		if (tb[IFLA_ADDRESS])
+			brief_lladdr(b, tb[IFLA_ADDRESS], ifi->ifi_type);
+		brief_link_flags(b, ifi->ifi_flags, m_flag);
+		brief_str(b, "\n");
+	}
 }
 
-static int restore_handler(struct rtnl_ctrl_data *ctrl,
-			   struct nlmsghdr *n, void *arg)
+/* As print_selected_addrinfo() and print_addrinfo() */
+static int brief_addrs(struct brief_out *b, const struct ifinfomsg *ifi,
+		       const struct addr_index *aidx)
 {
-	int ret;
+	struct nlmsghdr **addrs;
+	unsigned int i, count;
 
-	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
+	addrs = addr_index_get(aidx, ifi->ifi_index, &count);
+	for (i = 0; i < count; i++) {
+		struct nlmsghdr *n = addrs[i];
+		struct ifaddrmsg *ifa = NLMSG_DATA(n);
+		struct rtattr *rta_tb[IFA_MAX+1];
+		unsigned int ifa_flags;
+		char *p;
 
-	ll_init_map(&rth);
+		if (n->nlmsg_type != RTM_NEWADDR)
+			continue;
 
-	ret = rtnl_talk(&rth, n, NULL);
+		if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+			return -1;
+
+		if (ifa->ifa_index != ifi->ifi_index ||
+		    (filter.family && filter.family != ifa->ifa_family))
+			continue;
+
+		if (filter.up && !(ifi->ifi_flags&IFF_UP))
+			continue;
+
+		if (filter.down && ifi->ifi_flags&IFF_UP)
+			continue;
+
+		parse_rtattr(rta_tb, IFA_MAX, IFA_RTA(ifa),
+			     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)));
+
+		ifa_flags = get_ifa_flags(ifa, rta_tb[IFA_FLAGS]);
+
+		if (!rta_tb[IFA_LOCAL])
+			rta_tb[IFA_LOCAL] = rta_tb[IFA_ADDRESS];
+		if (!rta_tb[IFA_ADDRESS])
+			rta_tb[IFA_ADDRESS] = rta_tb[IFA_LOCAL];
+
+		if (!addrinfo_match(ifa, rta_tb, ifa_flags) ||
+		    !rta_tb[IFA_LOCAL])
+			continue;
+
+		brief_addr(b, ifa->ifa_family, rta_tb[IFA_LOCAL]);
+		if (rta_tb[IFA_ADDRESS] &&
+		    memcmp(RTA_DATA(rta_tb[IFA_ADDRESS]),
+			   RTA_DATA(rta_tb[IFA_LOCAL]),
+			   ifa->ifa_family == AF_INET ? 4 : 16)) {
+			brief_str(b, " peer ");
+			brief_addr(b, ifa->ifa_family, rta_tb[IFA_ADDRESS]);
+		}
+
+		p = brief_room(b);
+		*p++ = '/';
+		p = brief_u32(p, ifa->ifa_prefixlen);
+		*p++ = ' ';
+		if (rta_tb[IFA_RT_PRIORITY]) {
+			memcpy(p, "metric ", 7);
+			p = brief_u32(p + 7,
+				      rta_getattr_u32(rta_tb[IFA_RT_PRIORITY]));
+			*p++ = ' ';
+		}
+		b->len = p - b->buf;
+	}
+
+	brief_str(b, "\n");
+	return 0;
+}
+
+/* Returns -1 if the buffer cannot be had, for the generic path to run */
+static int brief_list(struct nlmsg_chain *linfo,
+		      const struct addr_index *aidx)
+{
+	struct brief_out b = {};
+	struct nlmsg_list *l;
+	int i;
+
+	b.buf = malloc(BRIEF_BUF_SIZE);
+	if (!b.buf)
+		return -1;
+	for (i = 0; i < COLOR_NONE; i++)
+		color_escapes(i, &b.start[i], &b.end[i]);
+
+	for (l = linfo->head; l; l = l->next) {
+		struct nlmsghdr *n = &l->h;
+		struct ifinfomsg *ifi = NLMSG_DATA(n);
+		struct rtattr *tb[IFLA_MAX+1];
+		const char *name;
+		int res = 0;
+
+		if (n->nlmsg_type == RTM_NEWLINK ||
+		    n->nlmsg_type == RTM_DELLINK) {
+			res = get_rtattr(n, tb);
+			if (res == 0)
+				res = linkinfo_match(ifi, tb, &name);
+			if (res > 0)
+				brief_link(&b, ifi, tb, name);
+		}
+		if (res >= 0 && filter.family != AF_PACKET)
+			brief_addrs(&b, ifi, aidx);
+	}
+
+	brief_flush(&b);
+	free(b.buf);
+	return 0;
+}
+
+static int store_nlmsg(struct nlmsghdr *n, void *arg)
+{
+	struct nlmsg_chain *lchain = (struct nlmsg_chain *)arg;
+
+	if (!nlmsg_chain_append(lchain, n))
+		return -1;
+
+	ll_remember_index(n, NULL);
+	return 0;
+}
+
+static __u32 ipadd_dump_magic = 0x47361222;
+
+static int ipadd_save_prep(void)
+{
+	int ret;
+
+	if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Not sending a binary stream to stdout\n");
+		return -1;
+	}
+
+	ret = write(STDOUT_FILENO, &ipadd_dump_magic, sizeof(ipadd_dump_magic));
+	if (ret != sizeof(ipadd_dump_magic)) {
+		fprintf(stderr, "Can't write magic to dump file\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ipadd_dump_check_magic(void)
+{
+	int ret;
+	__u32 magic = 0;
+
+	if (isatty(STDIN_FILENO)) {
+		fprintf(stderr, "Can't restore address dump from a terminal\n");
+		return -1;
+	}
+
+	ret = fread(&magic, sizeof(magic), 1, stdin);
+	if (magic != ipadd_dump_magic) {
+		fprintf(stderr, "Magic mismatch (%d elems, %x magic)\n", ret, magic);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int save_nlmsg(struct nlmsghdr *n, void *arg)
+{
+	int ret;
+
+	ret = write(STDOUT_FILENO, n, n->nlmsg_len);
+	if ((ret > 0) && (ret != n->nlmsg_len)) {
+		fprintf(stderr, "Short write while saving nlmsg\n");
+		ret = -EIO;
+	}
+
+	return ret == n->nlmsg_len ? 0 : ret;
+}
+
+static int show_handler(struct rtnl_ctrl_data *ctrl,
+			struct nlmsghdr *n, void *arg)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+
+	open_json_object(NULL);
+	print_int(PRINT_ANY, "index", "if%d:", ifa->ifa_index);
+	print_nl();
+	print_addrinfo(n, stdout);
+	close_json_object();
+	return 0;
+}
+
+static int ipaddr_showdump(void)
+{
+	int err;
+
+	if (ipadd_dump_check_magic())
+		exit(-1);
+
+	new_json_obj(json);
+	open_json_object(NULL);
+	open_json_array(PRINT_JSON, "addr_info");
+
+	err = rtnl_from_file(stdin, &show_handler, NULL);
+
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+	delete_json_obj();
+
+	exit(err);
+}
+
+static int restore_handler(struct rtnl_ctrl_data *ctrl,
+			   struct nlmsghdr *n, void *arg)
+{
+	int ret;
+
+	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
+
+	ll_init_map_lazy();
+
+	ret = rtnl_talk(&rth, n, NULL);
 	if ((ret < 0) && (errno == EEXIST))
 		ret = 0;
 
@@ -1905,17 +2391,8 @@ static int ipaddr_restore(void)
 	exit(rtnl_from_file(stdin, &restore_handler, NULL));
 }
 
-void free_nlmsg_chain(struct nlmsg_chain *info)
-{
-	struct nlmsg_list *l, *n;
-
-	for (l = info->head; l; l = n) {
-		n = l->next;
-		free(l);
-	}
-}
-
-static void ipaddr_filter(struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
+static void ipaddr_filter(struct nlmsg_chain *linfo,
+			  const struct addr_index *aidx)
 {
 	struct nlmsg_list *l, **lp;
 
@@ -1924,10 +2401,12 @@ static void ipaddr_filter(struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
 		int ok = 0;
 		int missing_net_address = 1;
 		struct ifinfomsg *ifi = NLMSG_DATA(&l->h);
-		struct nlmsg_list *a;
+		struct nlmsghdr **addrs;
+		unsigned int i, count;
 
-		for (a = ainfo->head; a; a = a->next) {
-			struct nlmsghdr *n = &a->h;
+		addrs = addr_index_get(aidx, ifi->ifi_index, &count);
+		for (i = 0; i < count; i++) {
+			struct nlmsghdr *n = addrs[i];
 			struct ifaddrmsg *ifa = NLMSG_DATA(n);
 			struct rtattr *tb[IFA_MAX + 1];
 			unsigned int ifa_flags;
@@ -1960,10 +2439,9 @@ static void ipaddr_filter(struct nlmsg_chain *linfo, struct nlmsg_chain *ainfo)
 		if (missing_net_address &&
 		    (filter.family == AF_UNSPEC || filter.family == AF_PACKET))
 			ok = 1;
-		if (!ok) {
+		if (!ok)
 			*lp = l->next;
-			free(l);
-		} else
+		else
 			lp = &l->next;
 	}
 }
@@ -1979,12 +2457,22 @@ static int ipaddr_dump_filter(struct nlmsghdr *nlh, int reqlen)
 
 static int ipaddr_flush(void)
 {
+	struct rtnl_flush flush;
 	int round = 0;
-	char flushb[4096-512];
 
-	filter.flushb = flushb;
-	filter.flushp = 0;
-	filter.flushe = sizeof(flushb);
+	if (rtnl_flush_open(&flush, 0) < 0)
+		return 1;
+
+	/*
+	 * Note that the kernel may delete multiple addresses for one
+	 * delete request (e.g. if ipv4 address promotion is disabled).
+	 * Since a flush operation is really a series of delete requests
+	 * its possible that we may request an address delete that has
+	 * already been done by the kernel. Therefore, ignore EADDRNOTAVAIL
+	 * errors returned from a flush request
+	 */
+	flush.ignore_errno = EADDRNOTAVAIL;
+	filter.flush = &flush;
 
 	while ((max_flush_loops == 0) || (round < max_flush_loops)) {
 		if (rtnl_addrdump_req(&rth, filter.family,
@@ -2004,14 +2492,19 @@ static int ipaddr_flush(void)
 				if (round == 0)
 					printf("Nothing to flush.\n");
 				else
-					printf("*** Flush is complete after %d round%s ***\n", round, round > 1?"s":"");
+					printf("*** Flush is complete after %d round%s, %.0f deletes/s ***\n",
+					       round, round > 1?"s":"",
+					       rtnl_flush_rate(&flush));
 			}
 			fflush(stdout);
-			return 0;
+			goto out;
 		}
 		round++;
-		if (flush_update() < 0)
-			return 1;
+		if (rtnl_flush_commit(&flush) < 0) {
+			perror("Failed to send flush request");
+			round = -1;
+			goto out;
+		}
 
 		if (show_stats) {
 			printf("\n*** Round %d, deleting %d addresses ***\n", round, filter.flushed);
@@ -2028,7 +2521,11 @@ static int ipaddr_flush(void)
 	}
 	fprintf(stderr, "*** Flush remains incomplete after %d rounds. ***\n", max_flush_loops);
 	fflush(stderr);
-	return 1;
+	round = -1;
+out:
+	filter.flush = NULL;
+	rtnl_flush_close(&flush);
+	return round < 0;
 }
 
 static int iplink_filter_req(struct nlmsghdr *nlh, int reqlen)
@@ -2099,69 +2596,621 @@ static int ipaddr_link_get(int index, struct nlmsg_chain *linfo)
 	return 0;
 }
 
-/* fills in linfo with link data and optionally ainfo with address info
- * caller can walk lists as desired and must call free_nlmsg_chain for
- * both when done
- */
-int ip_link_list(req_filter_fn_t filter_fn, struct nlmsg_chain *linfo)
+/* fills in linfo with link data and optionally ainfo with address info
+ * caller can walk lists as desired and must call nlmsg_chain_free for
+ * both when done
+ */
+int ip_link_list(req_filter_fn_t filter_fn, struct nlmsg_chain *linfo)
+{
+	if (rtnl_linkdump_req_filter_fn(&rth, preferred_family,
+					filter_fn) < 0) {
+		perror("Cannot send dump request");
+		return 1;
+	}
+
+	if (rtnl_dump_filter(&rth, store_nlmsg, linfo) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int ip_addr_list(struct nlmsg_chain *ainfo)
+{
+	if (rtnl_addrdump_req(&rth, filter.family, ipaddr_dump_filter) < 0) {
+		perror("Cannot send dump request");
+		return 1;
+	}
+
+	if (rtnl_dump_filter(&rth, store_nlmsg, ainfo) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Dump links and addresses in parallel: the address dump runs on a
+ * second socket so it does not wait for NLMSG_DONE of the link dump.
+ */
+static int ip_linkaddr_list(req_filter_fn_t filter_fn,
+			    struct nlmsg_chain *linfo,
+			    struct nlmsg_chain *ainfo)
+{
+	struct rtnl_handle arth = { .fd = -1 };
+	struct rtnl_dump_multi dumps[] = {
+		{ .rth = &rth, .filter = store_nlmsg, .arg = linfo },
+		{ .rth = &arth, .filter = store_nlmsg, .arg = ainfo },
+	};
+	int ret = 1;
+
+	if (rtnl_open(&arth, 0) < 0) {
+		if (ip_link_list(filter_fn, linfo) != 0)
+			return 1;
+		return ip_addr_list(ainfo);
+	}
+
+	if (rth.flags & RTNL_HANDLE_F_STRICT_CHK)
+		rtnl_set_strict_dump(&arth);
+
+	if (rtnl_linkdump_req_filter_fn(&rth, preferred_family,
+					filter_fn) < 0 ||
+	    rtnl_addrdump_req(&arth, filter.family, ipaddr_dump_filter) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+
+	if (rtnl_dump_filter_multi(dumps, ARRAY_SIZE(dumps)) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	ret = 0;
+out:
+	rtnl_close(&arth);
+	return ret;
+}
+
+static void group_filter(struct nlmsg_chain *linfo)
+{
+	struct nlmsg_list *l, **lp;
+
+	lp = &linfo->head;
+	while ((l = *lp) != NULL) {
+		struct nlmsghdr *n = &l->h;
+		struct rtattr *tb[IFLA_MAX+1];
+
+		if (get_rtattr(n, tb) < 0)
+			return;
+
+		if (tb[IFLA_GROUP]) {
+			if (rta_getattr_u32(tb[IFLA_GROUP]) != filter.group)
+				*lp = l->next;
+			else
+				lp = &l->next;
+		}
+	}
+}
+
+/*
+ * "ip -s link show interval SECS": dump only the 64 bit link stats
+ * every SECS seconds and print what changed per second, busiest links
+ * first. The previous counters are kept in an array by ifindex.
+ */
+struct link_rate {
+	int				ifindex;
+	struct rtnl_link_stats64	s;
+	double				rx_bytes, tx_bytes;
+	double				rx_packets, tx_packets;
+	double				errors, dropped;
+};
+
+struct link_rates {
+	struct link_rate		*cur;
+	unsigned int			ncur, size;
+	struct rtnl_link_stats64	*prev;
+	bool				*have_prev;
+	unsigned int			nprev;
+};
+
+static int link_rates_collect(struct nlmsghdr *n, void *arg)
+{
+	struct if_stats_msg *ifsm = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm));
+	struct rtattr *tb[IFLA_STATS_MAX + 1];
+	struct link_rates *lr = arg;
+	struct link_rate *r;
+
+	if (n->nlmsg_type != RTM_NEWSTATS)
+		return 0;
+	if (len < 0)
+		return -1;
+	if (filter.ifindex && ifsm->ifindex != filter.ifindex)
+		return 0;
+
+	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
+	if (!tb[IFLA_STATS_LINK_64] ||
+	    RTA_PAYLOAD(tb[IFLA_STATS_LINK_64]) < sizeof(r->s))
+		return 0;
+
+	if (lr->ncur == lr->size) {
+		lr->size = lr->size ? 2 * lr->size : 64;
+		lr->cur = realloc(lr->cur, lr->size * sizeof(*lr->cur));
+		if (!lr->cur)
+			return -1;
+	}
+	r = &lr->cur[lr->ncur++];
+	memset(r, 0, sizeof(*r));
+	r->ifindex = ifsm->ifindex;
+	memcpy(&r->s, RTA_DATA(tb[IFLA_STATS_LINK_64]), sizeof(r->s));
+	return 0;
+}
+
+static int link_rates_keep(struct link_rates *lr, const struct link_rate *r)
+{
+	if (r->ifindex >= lr->nprev) {
+		unsigned int n = MAX(2 * lr->nprev, r->ifindex + 1);
+
+		lr->prev = realloc(lr->prev, n * sizeof(*lr->prev));
+		lr->have_prev = realloc(lr->have_prev, n);
+		if (!lr->prev || !lr->have_prev)
+			return -1;
+		memset(lr->have_prev + lr->nprev, 0, n - lr->nprev);
+		lr->nprev = n;
+	}
+	lr->prev[r->ifindex] = r->s;
+	lr->have_prev[r->ifindex] = true;
+	return 0;
+}
+
+/* counters that went back, e.g. on a driver reset, count from 0 */
+static double link_rate(__u64 cur, __u64 prev, double secs)
+{
+	return (cur >= prev ? cur - prev : cur) / secs;
+}
+
+static int link_rate_cmp(const void *a, const void *b)
+{
+	const struct link_rate *ra = a, *rb = b;
+	double ta = ra->rx_bytes + ra->tx_bytes;
+	double tb = rb->rx_bytes + rb->tx_bytes;
+
+	if (ta != tb)
+		return ta < tb ? 1 : -1;
+	return ra->ifindex - rb->ifindex;
+}
+
+static void link_rates_print(struct link_rate *rates, unsigned int n)
+{
+	unsigned int i;
+
+	open_json_array(PRINT_JSON, NULL);
+	if (!is_json_context())
+		printf("%-16s %12s %12s %10s %10s %9s %9s\n", "dev", "rx",
+		       "tx", "rx pps", "tx pps", "errors/s", "drops/s");
+	for (i = 0; i < n; i++) {
+		const struct link_rate *r = &rates[i];
+
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "ifname", "%-16s ",
+			     ll_index_to_name(r->ifindex));
+		print_rate(use_iec, PRINT_ANY, "rx_bytes", "%12s ",
+			   r->rx_bytes);
+		print_rate(use_iec, PRINT_ANY, "tx_bytes", "%12s ",
+			   r->tx_bytes);
+		print_u64(PRINT_ANY, "rx_packets", "%10llu ",
+			  r->rx_packets + 0.5);
+		print_u64(PRINT_ANY, "tx_packets", "%10llu ",
+			  r->tx_packets + 0.5);
+		print_u64(PRINT_ANY, "errors", "%9llu ", r->errors + 0.5);
+		print_u64(PRINT_ANY, "dropped", "%9llu", r->dropped + 0.5);
+		print_nl();
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	if (!is_json_context())
+		printf("\n");
+	fflush(stdout);
+}
+
+static int ipaddr_link_rates(unsigned int interval_ms)
+{
+	__u32 filt_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+	struct link_rates lr = {};
+	double next, now, last = 0;
+	unsigned int i, n;
+
+	if (filter.group != -1 || filter.master || filter.kind ||
+	    filter.slave_kind || filter.up || filter.down ||
+	    filter.have_proto) {
+		fprintf(stderr,
+			"Only a device can be selected with \"interval\".\n");
+		return -1;
+	}
+
+	new_json_obj(json);
+	next = monotonic_now();
+	for (;;) {
+		double secs;
+
+		lr.ncur = 0;
+		if (rtnl_statsdump_req_filter(&rth, AF_UNSPEC, filt_mask,
+					      NULL, NULL) < 0) {
+			perror("Cannot send dump request");
+			break;
+		}
+		if (rtnl_dump_filter(&rth, link_rates_collect, &lr) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			break;
+		}
+		now = monotonic_now();
+		secs = now - last;
+
+		for (i = 0, n = 0; i < lr.ncur; i++) {
+			struct link_rate *r = &lr.cur[i];
+			const struct rtnl_link_stats64 *p;
+
+			if (r->ifindex < lr.nprev && lr.have_prev[r->ifindex]) {
+				p = &lr.prev[r->ifindex];
+				r->rx_bytes = link_rate(r->s.rx_bytes,
+							p->rx_bytes, secs);
+				r->tx_bytes = link_rate(r->s.tx_bytes,
+							p->tx_bytes, secs);
+				r->rx_packets = link_rate(r->s.rx_packets,
+							  p->rx_packets, secs);
+				r->tx_packets = link_rate(r->s.tx_packets,
+							  p->tx_packets, secs);
+				r->errors = link_rate(r->s.rx_errors +
+						      r->s.tx_errors,
+						      p->rx_errors +
+						      p->tx_errors, secs);
+				r->dropped = link_rate(r->s.rx_dropped +
+						       r->s.tx_dropped,
+						       p->rx_dropped +
+						       p->tx_dropped, secs);
+				lr.cur[n++] = *r;
+			}
+			if (link_rates_keep(&lr, r)) {
+				fprintf(stderr, "Out of memory\n");
+				goto out;
+			}
+		}
+		/* links seen for the first time have no rate yet */
+		if (last) {
+			qsort(lr.cur, n, sizeof(*lr.cur), link_rate_cmp);
+			link_rates_print(lr.cur, n);
+		}
+		last = now;
+		next += interval_ms / 1000.0;
+		monotonic_sleep_until(next);
+	}
+out:
+	delete_json_obj();
+	free(lr.cur);
+	free(lr.prev);
+	free(lr.have_prev);
+	return -1;
+}
+
+/*
+ * "ip -s link show [ DEVICE ] vf interval SECS": the rates of the VFs of
+ * SR-IOV devices, one line per VF, busiest first, with their spoof check
+ * and trust settings. Each interval only the selected PFs are asked for,
+ * one RTM_GETLINK each, instead of dumping the VF info of every link.
+ * The previous counters are kept per PF in an array by VF number.
+ */
+struct vf_sample {
+	__u64	rx_bytes, tx_bytes;
+	__u64	rx_packets, tx_packets;
+	__u64	broadcast;
+	__u64	dropped;
+};
+
+struct vf_rate {
+	int			pf;
+	int			vf;
+	int			spoofchk;	/* -1 when unknown */
+	int			trust;
+	double			rx_bytes, tx_bytes;
+	double			rx_packets, tx_packets;
+	double			broadcast, dropped;
+};
+
+struct vf_pf {
+	int			ifindex;
+	unsigned int		nvf;
+	struct vf_sample	*prev;
+	bool			*have_prev;
+};
+
+struct vf_rates {
+	struct vf_pf		*pfs;
+	unsigned int		npfs;
+	struct vf_rate		*cur;
+	unsigned int		ncur, size;
+	unsigned int		spoofchk_off, trusted;
+	double			secs;
+};
+
+static __u64 vf_stat(struct rtattr **tb, int type)
+{
+	return tb[type] ? rta_getattr_u64(tb[type]) : 0;
+}
+
+static int vf_pf_keep(struct vf_pf *pf, int vf, const struct vf_sample *s)
+{
+	if (vf >= pf->nvf) {
+		unsigned int n = MAX(2 * pf->nvf, vf + 1);
+
+		pf->prev = realloc(pf->prev, n * sizeof(*pf->prev));
+		pf->have_prev = realloc(pf->have_prev, n);
+		if (!pf->prev || !pf->have_prev)
+			return -1;
+		memset(pf->have_prev + pf->nvf, 0, n - pf->nvf);
+		pf->nvf = n;
+	}
+	pf->prev[vf] = *s;
+	pf->have_prev[vf] = true;
+	return 0;
+}
+
+static int vf_rates_vf(struct vf_rates *vr, struct vf_pf *pf,
+		       struct rtattr *vfinfo)
+{
+	struct rtattr *vf[IFLA_VF_MAX + 1], *st[IFLA_VF_STATS_MAX + 1];
+	struct ifla_vf_spoofchk *spoofchk;
+	struct ifla_vf_trust *trust;
+	struct vf_sample s;
+	struct vf_rate *r;
+	int id;
+
+	if (vfinfo->rta_type != IFLA_VF_INFO)
+		return 0;
+	parse_rtattr_nested(vf, IFLA_VF_MAX, vfinfo);
+	if (!vf[IFLA_VF_MAC] || !vf[IFLA_VF_STATS])
+		return 0;
+	id = ((struct ifla_vf_mac *)RTA_DATA(vf[IFLA_VF_MAC]))->vf;
+
+	parse_rtattr_nested(st, IFLA_VF_STATS_MAX, vf[IFLA_VF_STATS]);
+	s.rx_bytes = vf_stat(st, IFLA_VF_STATS_RX_BYTES);
+	s.tx_bytes = vf_stat(st, IFLA_VF_STATS_TX_BYTES);
+	s.rx_packets = vf_stat(st, IFLA_VF_STATS_RX_PACKETS);
+	s.tx_packets = vf_stat(st, IFLA_VF_STATS_TX_PACKETS);
+	s.broadcast = vf_stat(st, IFLA_VF_STATS_BROADCAST);
+	s.dropped = vf_stat(st, IFLA_VF_STATS_RX_DROPPED) +
+		    vf_stat(st, IFLA_VF_STATS_TX_DROPPED);
+
+	if (vr->ncur == vr->size) {
+		vr->size = vr->size ? 2 * vr->size : 64;
+		vr->cur = realloc(vr->cur, vr->size * sizeof(*vr->cur));
+		if (!vr->cur)
+			return -1;
+	}
+	r = &vr->cur[vr->ncur];
+	memset(r, 0, sizeof(*r));
+	r->pf = pf->ifindex;
+	r->vf = id;
+
+	spoofchk = vf[IFLA_VF_SPOOFCHK] ? RTA_DATA(vf[IFLA_VF_SPOOFCHK]) : NULL;
+	r->spoofchk = spoofchk ? (int)spoofchk->setting : -1;
+	trust = vf[IFLA_VF_TRUST] ? RTA_DATA(vf[IFLA_VF_TRUST]) : NULL;
+	r->trust = trust ? (int)trust->setting : -1;
+	if (r->spoofchk == 0)
+		vr->spoofchk_off++;
+	if (r->trust == 1)
+		vr->trusted++;
+
+	/* VFs seen for the first time have no rate yet */
+	if (id < pf->nvf && pf->have_prev[id]) {
+		const struct vf_sample *p = &pf->prev[id];
+
+		r->rx_bytes = link_rate(s.rx_bytes, p->rx_bytes, vr->secs);
+		r->tx_bytes = link_rate(s.tx_bytes, p->tx_bytes, vr->secs);
+		r->rx_packets = link_rate(s.rx_packets, p->rx_packets,
+					  vr->secs);
+		r->tx_packets = link_rate(s.tx_packets, p->tx_packets,
+					  vr->secs);
+		r->broadcast = link_rate(s.broadcast, p->broadcast, vr->secs);
+		r->dropped = link_rate(s.dropped, p->dropped, vr->secs);
+		vr->ncur++;
+	}
+	return vf_pf_keep(pf, id, &s);
+}
+
+static int vf_rates_pf(struct vf_rates *vr, struct vf_pf *pf)
+{
+	struct iplink_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETLINK,
+		.i.ifi_family = AF_UNSPEC,
+		.i.ifi_index = pf->ifindex,
+	};
+	struct rtattr *tb[IFLA_MAX + 1], *i;
+	struct nlmsghdr *answer;
+	struct ifinfomsg *ifi;
+	int len, rem, ret = 0;
+
+	addattr32(&req.n, sizeof(req), IFLA_EXT_MASK, RTEXT_FILTER_VF);
+	if (rtnl_talk(&rth, &req.n, &answer) < 0)
+		return -1;
+
+	ifi = NLMSG_DATA(answer);
+	len = answer->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	if (len >= 0) {
+		parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len,
+				   NLA_F_NESTED);
+		if (tb[IFLA_VFINFO_LIST]) {
+			rem = RTA_PAYLOAD(tb[IFLA_VFINFO_LIST]);
+			for (i = RTA_DATA(tb[IFLA_VFINFO_LIST]);
+			     RTA_OK(i, rem) && !ret; i = RTA_NEXT(i, rem))
+				ret = vf_rates_vf(vr, pf, i);
+		}
+	}
+	free(answer);
+	return ret;
+}
+
+/* The PFs: the device given, or every link that has VFs */
+static int vf_rates_find_pf(struct nlmsghdr *n, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+	struct vf_rates *vr = arg;
+	struct rtattr *num_vf;
+	struct vf_pf *pfs;
+
+	if (n->nlmsg_type != RTM_NEWLINK || len < 0)
+		return 0;
+	if (filter.ifindex && ifi->ifi_index != filter.ifindex)
+		return 0;
+	num_vf = parse_rtattr_one(IFLA_NUM_VF, IFLA_RTA(ifi), len);
+	if (!num_vf || !rta_getattr_u32(num_vf))
+		return 0;
+
+	pfs = realloc(vr->pfs, (vr->npfs + 1) * sizeof(*pfs));
+	if (!pfs)
+		return -1;
+	vr->pfs = pfs;
+	memset(&pfs[vr->npfs], 0, sizeof(*pfs));
+	pfs[vr->npfs++].ifindex = ifi->ifi_index;
+	return 0;
+}
+
+static int vf_rate_cmp(const void *a, const void *b)
 {
-	if (rtnl_linkdump_req_filter_fn(&rth, preferred_family,
-					filter_fn) < 0) {
-		perror("Cannot send dump request");
-		return 1;
-	}
-
-	if (rtnl_dump_filter(&rth, store_nlmsg, linfo) < 0) {
-		fprintf(stderr, "Dump terminated\n");
-		return 1;
-	}
+	const struct vf_rate *ra = a, *rb = b;
+	double ta = ra->rx_bytes + ra->tx_bytes;
+	double tb = rb->rx_bytes + rb->tx_bytes;
+
+	if (ta != tb)
+		return ta < tb ? 1 : -1;
+	if (ra->pf != rb->pf)
+		return ra->pf - rb->pf;
+	return ra->vf - rb->vf;
+}
 
-	return 0;
+static const char *vf_setting(int setting)
+{
+	return setting < 0 ? "-" : setting ? "on" : "off";
 }
 
-static int ip_addr_list(struct nlmsg_chain *ainfo)
+static void vf_rates_print(struct vf_rates *vr)
 {
-	if (rtnl_addrdump_req(&rth, filter.family, ipaddr_dump_filter) < 0) {
-		perror("Cannot send dump request");
-		return 1;
-	}
+	unsigned int i;
 
-	if (rtnl_dump_filter(&rth, store_nlmsg, ainfo) < 0) {
-		fprintf(stderr, "Dump terminated\n");
-		return 1;
-	}
+	open_json_array(PRINT_JSON, NULL);
+	if (!is_json_context())
+		printf("%-16s %4s %12s %12s %10s %10s %8s %8s %5s %5s\n",
+		       "pf", "vf", "rx", "tx", "rx pps", "tx pps", "bcast/s",
+		       "drops/s", "spoof", "trust");
+	for (i = 0; i < vr->ncur; i++) {
+		const struct vf_rate *r = &vr->cur[i];
 
-	return 0;
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "ifname", "%-16s ",
+			     ll_index_to_name(r->pf));
+		print_int(PRINT_ANY, "vf", "%4d ", r->vf);
+		print_rate(use_iec, PRINT_ANY, "rx_bytes", "%12s ",
+			   r->rx_bytes);
+		print_rate(use_iec, PRINT_ANY, "tx_bytes", "%12s ",
+			   r->tx_bytes);
+		print_u64(PRINT_ANY, "rx_packets", "%10llu ",
+			  r->rx_packets + 0.5);
+		print_u64(PRINT_ANY, "tx_packets", "%10llu ",
+			  r->tx_packets + 0.5);
+		print_u64(PRINT_ANY, "broadcast", "%8llu ",
+			  r->broadcast + 0.5);
+		print_u64(PRINT_ANY, "dropped", "%8llu ", r->dropped + 0.5);
+		if (r->spoofchk >= 0)
+			print_bool(PRINT_JSON, "spoofchk", NULL, r->spoofchk);
+		print_string(PRINT_FP, NULL, "%5s ", vf_setting(r->spoofchk));
+		if (r->trust >= 0)
+			print_bool(PRINT_JSON, "trust", NULL, r->trust);
+		print_string(PRINT_FP, NULL, "%5s", vf_setting(r->trust));
+		print_nl();
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	if (!is_json_context())
+		printf("%u VFs, %u with spoof checking off, %u trusted\n\n",
+		       vr->ncur, vr->spoofchk_off, vr->trusted);
+	fflush(stdout);
 }
 
-static void group_filter(struct nlmsg_chain *linfo)
+static int ipaddr_vf_rates(unsigned int interval_ms)
 {
-	struct nlmsg_list *l, **lp;
+	double next, now, last = 0;
+	struct vf_rates vr = {};
+	unsigned int i;
 
-	lp = &linfo->head;
-	while ((l = *lp) != NULL) {
-		struct nlmsghdr *n = &l->h;
-		struct rtattr *tb[IFLA_MAX+1];
+	if (filter.group != -1 || filter.master || filter.kind ||
+	    filter.slave_kind || filter.up || filter.down ||
+	    filter.have_proto) {
+		fprintf(stderr,
+			"Only a device can be selected with \"interval\".\n");
+		return -1;
+	}
 
-		if (get_rtattr(n, tb) < 0)
-			return;
+	/* the only dump with the VF info of every link */
+	if (rtnl_linkdump_req_filter(&rth, AF_UNSPEC, RTEXT_FILTER_VF) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, vf_rates_find_pf, &vr) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+	if (!vr.npfs) {
+		fprintf(stderr, "No device with VFs.\n");
+		goto out;
+	}
 
-		if (tb[IFLA_GROUP]) {
-			if (rta_getattr_u32(tb[IFLA_GROUP]) != filter.group) {
-				*lp = l->next;
-				free(l);
-			} else
-				lp = &l->next;
+	new_json_obj(json);
+	next = monotonic_now();
+	for (;;) {
+		vr.ncur = 0;
+		vr.spoofchk_off = vr.trusted = 0;
+		now = monotonic_now();
+		vr.secs = now - last;
+
+		for (i = 0; i < vr.npfs; i++)
+			if (vf_rates_pf(&vr, &vr.pfs[i]) < 0) {
+				fprintf(stderr, "Cannot get the VFs of %s\n",
+					ll_index_to_name(vr.pfs[i].ifindex));
+				goto out_json;
+			}
+
+		if (last) {
+			qsort(vr.cur, vr.ncur, sizeof(*vr.cur), vf_rate_cmp);
+			vf_rates_print(&vr);
 		}
+		last = now;
+		next += interval_ms / 1000.0;
+		monotonic_sleep_until(next);
+	}
+out_json:
+	delete_json_obj();
+out:
+	for (i = 0; i < vr.npfs; i++) {
+		free(vr.pfs[i].prev);
+		free(vr.pfs[i].have_prev);
 	}
+	free(vr.pfs);
+	free(vr.cur);
+	return -1;
 }
 
 static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 {
 	struct nlmsg_chain linfo = { NULL, NULL};
 	struct nlmsg_chain _ainfo = { NULL, NULL}, *ainfo = &_ainfo;
+	struct addr_index aidx = {};
 	struct nlmsg_list *l;
 	char *filter_dev = NULL;
+	unsigned int interval_ms = 0;
+	bool vfs = false;
 	int no_link = 0;
 
 	ipaddr_reset_filter(oneline, 0);
@@ -2254,6 +3303,18 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 			filter.proto = proto;
 		} else if (strcmp(*argv, "novf") == 0) {
 			filter.vfinfo = 0;
+		} else if (do_link && show_stats &&
+			   strcmp(*argv, "interval") == 0) {
+			double secs;
+			char *end;
+
+			NEXT_ARG();
+			secs = strtod(*argv, &end);
+			if (end == *argv || *end || secs < 0.001 || secs > 86400)
+				invarg("\"interval\" value is invalid\n", *argv);
+			interval_ms = secs * 1000 + 0.5;
+		} else if (do_link && show_stats && strcmp(*argv, "vf") == 0) {
+			vfs = true;
 		} else {
 			if (strcmp(*argv, "dev") == 0)
 				NEXT_ARG();
@@ -2277,6 +3338,15 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 	if (action == IPADD_FLUSH)
 		return ipaddr_flush();
 
+	if (vfs && !interval_ms)
+		missarg("interval");
+	if (vfs)
+		return ipaddr_vf_rates(interval_ms);
+	if (interval_ms && filter.kind && strcmp(filter.kind, "can") == 0)
+		return can_link_watch(filter.ifindex, interval_ms);
+	if (interval_ms)
+		return ipaddr_link_rates(interval_ms);
+
 	if (action == IPADD_SAVE) {
 		if (ipadd_save_prep())
 			exit(1);
@@ -2319,6 +3389,9 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 	if (filter.ifindex) {
 		if (ipaddr_link_get(filter.ifindex, &linfo) != 0)
 			goto out;
+	} else if (filter.family != AF_PACKET) {
+		if (ip_linkaddr_list(iplink_filter_req, &linfo, ainfo) != 0)
+			goto out;
 	} else {
 		if (ip_link_list(iplink_filter_req, &linfo) != 0)
 			goto out;
@@ -2328,15 +3401,22 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 		if (filter.oneline)
 			no_link = 1;
 
-		if (ip_addr_list(ainfo) != 0)
+		if (filter.ifindex && ip_addr_list(ainfo) != 0)
 			goto out;
 
-		ipaddr_filter(&linfo, ainfo);
+		if (addr_index_build(&aidx, ainfo) < 0) {
+			fprintf(stderr, "Out of memory\n");
+			goto out;
+		}
+		ipaddr_filter(&linfo, &aidx);
 	}
 
 	if (filter.group != -1)
 		group_filter(&linfo);
 
+	if (brief && !is_json_context() && brief_list(&linfo, &aidx) == 0)
+		goto flush;
+
 	for (l = linfo.head; l; l = l->next) {
 		struct nlmsghdr *n = &l->h;
 		struct ifinfomsg *ifi = NLMSG_DATA(n);
@@ -2346,16 +3426,18 @@ static int ipaddr_list_flush_or_save(int argc, char **argv, int action)
 		if (brief || !no_link)
 			res = print_linkinfo(n, stdout);
 		if (res >= 0 && filter.family != AF_PACKET)
-			print_selected_addrinfo(ifi, ainfo->head, stdout);
+			print_selected_addrinfo(ifi, &aidx, stdout);
 		if (res > 0 && !do_link && show_stats)
 			print_link_stats(stdout, n);
 		close_json_object();
 	}
+flush:
 	fflush(stdout);
 
 out:
-	free_nlmsg_chain(ainfo);
-	free_nlmsg_chain(&linfo);
+	addr_index_free(&aidx);
+	nlmsg_chain_free(ainfo);
+	nlmsg_chain_free(&linfo);
 	delete_json_obj();
 	return 0;
 }
@@ -2463,6 +3545,536 @@ static bool ipaddr_is_multicast(inet_prefix *a)
 		return false;
 }
 
+static int ipaddr_lifetimes(struct nlmsghdr *n, int maxlen,
+			    const char *valid_lftp, const char *preferred_lftp,
+			    __u32 valid_lft, __u32 preferred_lft)
+{
+	struct ifa_cacheinfo cinfo = {};
+
+	if (!valid_lftp && !preferred_lftp)
+		return 0;
+
+	if (!valid_lft) {
+		fprintf(stderr, "valid_lft is zero\n");
+		return -1;
+	}
+	if (valid_lft < preferred_lft) {
+		fprintf(stderr, "preferred_lft is greater than valid_lft\n");
+		return -1;
+	}
+
+	cinfo.ifa_prefered = preferred_lft;
+	cinfo.ifa_valid = valid_lft;
+	return addattr_l(n, maxlen, IFA_CACHEINFO, &cinfo, sizeof(cinfo));
+}
+
+/* "file FILE" takes the place of IFADDR and adds, changes or deletes one
+ * address per line:
+ *
+ *	PREFIX [ DEV ]
+ *
+ * A missing or "-" DEV takes the dev given on the command line. The rest
+ * of the command line (flags, scope, lifetimes, label, metric, proto) is
+ * parsed once into a template every line starts from.
+ *
+ * "apply" reads the same file as the complete set of addresses of a proto
+ * on the devices it names. The installed addresses are dumped once, and
+ * only the adds, replaces and deletes needed are sent.
+ */
+#define IPADDR_BULK_WINDOW	1024
+#define IPADDR_BULK_REQ_SIZE	(NLMSG_SPACE(sizeof(struct ifaddrmsg)) + 256)
+
+struct ipaddr_ent {
+	struct ipaddr_ent	*next;
+	__u32			hash;
+	int			lineno;
+	int			ifindex;
+	__u8			family;
+	__u8			prefixlen;
+	__u8			scope;
+	enum {
+		IPADDR_ENT_MISSING,
+		IPADDR_ENT_CHANGED,
+		IPADDR_ENT_READD,
+		IPADDR_ENT_INSTALLED,
+	} state;
+	__u8			addr[16];
+};
+
+struct ipaddr_bulk {
+	struct rtnl_bulk	bulk;
+	const struct nlmsghdr	*proto;	/* the template */
+	int			ifindex;
+	int			brd;	/* -1 for "+", -2 for "-" */
+	bool			scoped;
+	__u32			ifa_flags;
+	/* apply */
+	__u8			addrprot;
+	__u32			metric;
+	const char		*label;
+	bool			lifetimes;
+	struct ipaddr_ent	**ents;
+	unsigned int		count;
+	unsigned int		size;
+	struct ipaddr_ent	**hash;
+	unsigned int		hash_mask;
+	int			*devs;	/* sorted */
+	unsigned int		ndevs;
+	__u64			families;	/* bit per AF_* */
+	struct nlmsg_chain	stale;
+	unsigned int		kept;
+	unsigned int		replaced;
+	unsigned int		readded;	/* of the replaced */
+};
+
+/* Flags that are part of the configuration rather than the state */
+#define IPADDR_CONF_FLAGS	(IFA_F_HOMEADDRESS | IFA_F_NODAD | \
+				 IFA_F_MANAGETEMPADDR | IFA_F_NOPREFIXROUTE | \
+				 IFA_F_MCAUTOJOIN)
+
+static const char *ipaddr_bulk_parse(const struct ipaddr_bulk *b,
+				     struct ipaddr_ent *e, char **tok, int ntok)
+{
+	const struct ifaddrmsg *ifa = NLMSG_DATA(b->proto);
+	inet_prefix lcl;
+
+	if (get_prefix_1(&lcl, tok[0], ifa->ifa_family) ||
+	    lcl.family == AF_UNSPEC || lcl.bitlen < 0 ||
+	    lcl.bytelen > (int)sizeof(e->addr))
+		return "invalid address";
+	if (b->brd && lcl.family != AF_INET)
+		return "broadcast can be set only for IPv4 addresses";
+	if (b->ifa_flags & IFA_F_MCAUTOJOIN && !ipaddr_is_multicast(&lcl))
+		return "autojoin needs multicast address";
+
+	memset(e, 0, sizeof(*e));
+	e->family = lcl.family;
+	e->prefixlen = lcl.bitlen;
+	memcpy(e->addr, lcl.data, lcl.bytelen);
+	e->scope = b->scoped ? ifa->ifa_scope : default_scope(&lcl);
+
+	e->ifindex = b->ifindex;
+	if (ntok > 1 && strcmp(tok[1], "-") != 0) {
+		e->ifindex = ll_name_to_index(tok[1]);
+		if (!e->ifindex)
+			return "no such device";
+	}
+	if (!e->ifindex)
+		return "device is required";
+	return NULL;
+}
+
+/* The request for one address: the template with the address filled in */
+static int ipaddr_bulk_req(const struct ipaddr_bulk *b,
+			   const struct ipaddr_ent *e, struct nlmsghdr *n,
+			   int maxlen)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	int bytelen = e->family == AF_INET ? 4 : 16;
+
+	memcpy(n, b->proto, b->proto->nlmsg_len);
+	ifa->ifa_family = e->family;
+	ifa->ifa_prefixlen = e->prefixlen;
+	ifa->ifa_index = e->ifindex;
+	if (n->nlmsg_type != RTM_DELADDR)
+		ifa->ifa_scope = e->scope;
+
+	if (addattr_l(n, maxlen, IFA_LOCAL, e->addr, bytelen) ||
+	    addattr_l(n, maxlen, IFA_ADDRESS, e->addr, bytelen))
+		return -1;
+
+	if (b->brd && e->prefixlen <= 30 && n->nlmsg_type != RTM_DELADDR) {
+		__u32 brd, host = e->prefixlen ? ~0U >> e->prefixlen : ~0U;
+
+		memcpy(&brd, e->addr, sizeof(brd));
+		if (b->brd == -1)
+			brd |= htonl(host);
+		else
+			brd &= ~htonl(host);
+		if (addattr32(n, maxlen, IFA_BROADCAST, brd))
+			return -1;
+	}
+	return 0;
+}
+
+static const char *ipaddr_bulk_line(struct rtnl_bulk *rb, struct nlmsghdr *n,
+				    int maxlen, char **tok, int ntok)
+{
+	struct ipaddr_bulk *b = (struct ipaddr_bulk *)rb;
+	struct ipaddr_ent e;
+	const char *err;
+
+	err = ipaddr_bulk_parse(b, &e, tok, ntok);
+	if (!err && ipaddr_bulk_req(b, &e, n, maxlen))
+		err = "request too large";
+	return err;
+}
+
+static int ipaddr_bulk(struct ipaddr_bulk *b)
+{
+	int ret;
+
+	b->bulk.what = "addresses";
+	b->bulk.max_fields = 2;
+	b->bulk.parse = ipaddr_bulk_line;
+	ret = rtnl_bulk_load(&b->bulk, b->proto, IPADDR_BULK_REQ_SIZE);
+	if (show_stats)
+		printf("%u addresses, %.0f addresses/s\n", b->bulk.entries,
+		       b->bulk.rate);
+	return ret;
+}
+
+static __u32 ipaddr_ent_hash(const struct ipaddr_ent *e)
+{
+	__u32 h = 2166136261U;
+	unsigned int i;
+
+	h = (h ^ e->family) * 16777619U;
+	h = (h ^ e->prefixlen) * 16777619U;
+	for (i = 0; i < sizeof(e->ifindex); i++)
+		h = (h ^ ((e->ifindex >> (8 * i)) & 0xff)) * 16777619U;
+	for (i = 0; i < sizeof(e->addr); i++)
+		h = (h ^ e->addr[i]) * 16777619U;
+	return h;
+}
+
+static struct ipaddr_ent *ipaddr_apply_find(const struct ipaddr_bulk *b,
+					    const struct ipaddr_ent *e)
+{
+	struct ipaddr_ent *h;
+
+	for (h = b->hash[e->hash & b->hash_mask]; h; h = h->next)
+		if (h->hash == e->hash && h->ifindex == e->ifindex &&
+		    h->family == e->family && h->prefixlen == e->prefixlen &&
+		    !memcmp(h->addr, e->addr, sizeof(h->addr)))
+			return h;
+	return NULL;
+}
+
+static int ipaddr_apply_add(struct ipaddr_bulk *b, const struct ipaddr_ent *e)
+{
+	struct ipaddr_ent *n;
+
+	if (b->count == b->size) {
+		unsigned int size = b->size ? b->size * 2 : 256;
+		struct ipaddr_ent **ents;
+
+		ents = realloc(b->ents, size * sizeof(*ents));
+		if (!ents)
+			return -1;
+		b->ents = ents;
+		b->size = size;
+	}
+	n = malloc(sizeof(*n));
+	if (!n)
+		return -1;
+	*n = *e;
+	n->hash = ipaddr_ent_hash(n);
+	b->ents[b->count++] = n;
+	return 0;
+}
+
+static int ipaddr_dev_cmp(const void *a, const void *b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Index the addresses read, drop those the file repeats, list the devices */
+static int ipaddr_apply_index(struct ipaddr_bulk *b)
+{
+	unsigned int size = 64, i, j;
+
+	while (size < 2 * b->count)
+		size *= 2;
+	b->hash = calloc(size, sizeof(*b->hash));
+	b->devs = calloc(b->count + 1, sizeof(*b->devs));
+	if (!b->hash || !b->devs) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	b->hash_mask = size - 1;
+
+	if (b->ifindex)
+		b->devs[b->ndevs++] = b->ifindex;
+	for (i = j = 0; i < b->count; i++) {
+		struct ipaddr_ent *e = b->ents[i], *dup;
+
+		dup = ipaddr_apply_find(b, e);
+		if (dup) {
+			fprintf(stderr, "%s:%d: same address as line %d, ignored\n",
+				b->bulk.file, e->lineno, dup->lineno);
+			free(e);
+			continue;
+		}
+		e->next = b->hash[e->hash & b->hash_mask];
+		b->hash[e->hash & b->hash_mask] = e;
+		b->ents[j++] = e;
+		b->devs[b->ndevs++] = e->ifindex;
+		b->families |= 1ULL << e->family;
+	}
+	b->count = j;
+
+	qsort(b->devs, b->ndevs, sizeof(*b->devs), ipaddr_dev_cmp);
+	for (i = j = 0; i < b->ndevs; i++)
+		if (!j || b->devs[j - 1] != b->devs[i])
+			b->devs[j++] = b->devs[i];
+	b->ndevs = j;
+	return 0;
+}
+
+static int ipaddr_apply_read(struct ipaddr_bulk *b)
+{
+	char *line = NULL;
+	int lineno = 0, ret = -1;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(&b->bulk);
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		struct ipaddr_ent e;
+		const char *err;
+		char *tok[2];
+		int ntok;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, 2);
+		if (ntok == 0)
+			continue;
+
+		err = ntok > 2 ? "too many fields" :
+			ipaddr_bulk_parse(b, &e, tok, ntok);
+		if (err) {
+			/* a partial set would delete the rest */
+			fprintf(stderr, "%s:%d: %s\n", b->bulk.file, lineno,
+				err);
+			goto out;
+		}
+		e.lineno = lineno;
+		if (ipaddr_apply_add(b, &e)) {
+			fprintf(stderr, "Out of memory\n");
+			goto out;
+		}
+	}
+	ret = ipaddr_apply_index(b);
+out:
+	rtnl_bulk_close(fp);
+	free(line);
+	return ret;
+}
+
+/* What an installed address needs to become what the template asks for.
+ * A replace updates the lifetimes and the metric, and the configuration
+ * flags of IPv6 addresses. It does not take an IPv6 metric back to 0,
+ * nor change any other property: such addresses are deleted and added
+ * again.
+ */
+static int ipaddr_apply_diff(const struct ipaddr_bulk *b,
+			     const struct ipaddr_ent *want,
+			     struct ifaddrmsg *ifa, struct rtattr **tb)
+{
+	__u32 flags = get_ifa_flags(ifa, tb[IFA_FLAGS]) ^ b->ifa_flags;
+	__u32 metric = tb[IFA_RT_PRIORITY] ?
+		       rta_getattr_u32(tb[IFA_RT_PRIORITY]) : 0;
+	bool v6 = ifa->ifa_family == AF_INET6;
+
+	if (flags & (v6 ? IFA_F_MCAUTOJOIN : IPADDR_CONF_FLAGS) ||
+	    (v6 && metric && !b->metric) ||
+	    (!v6 && ifa->ifa_scope != want->scope) ||
+	    (b->label && (!tb[IFA_LABEL] ||
+			  strcmp(rta_getattr_str(tb[IFA_LABEL]), b->label))))
+		return IPADDR_ENT_READD;
+	/* finite lifetimes count down, they are always refreshed */
+	if (b->lifetimes || metric != b->metric || flags & IPADDR_CONF_FLAGS)
+		return IPADDR_ENT_CHANGED;
+	return IPADDR_ENT_INSTALLED;
+}
+
+static int ipaddr_apply_addr(struct ipaddr_bulk *b, struct nlmsghdr *n)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+	struct rtattr *tb[IFA_MAX+1], *addr;
+	struct ipaddr_ent e = {}, *want;
+	__u8 proto;
+
+	if (n->nlmsg_type != RTM_NEWADDR || len < 0)
+		return 0;
+	if (ifa->ifa_family >= 64 || !(b->families & (1ULL << ifa->ifa_family)))
+		return 0;
+	if (!bsearch(&ifa->ifa_index, b->devs, b->ndevs, sizeof(*b->devs),
+		     ipaddr_dev_cmp))
+		return 0;
+
+	parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), len);
+	proto = tb[IFA_PROTO] ? rta_getattr_u8(tb[IFA_PROTO]) : IFAPROT_UNSPEC;
+	if (proto != b->addrprot)
+		return 0;
+
+	/* a peer address never matches a line, it is replaced */
+	addr = tb[IFA_LOCAL] ? : tb[IFA_ADDRESS];
+	if (addr && RTA_PAYLOAD(addr) <= sizeof(e.addr) &&
+	    (!tb[IFA_LOCAL] || !tb[IFA_ADDRESS] ||
+	     !memcmp(RTA_DATA(tb[IFA_LOCAL]), RTA_DATA(tb[IFA_ADDRESS]),
+		     RTA_PAYLOAD(addr)))) {
+		e.family = ifa->ifa_family;
+		e.prefixlen = ifa->ifa_prefixlen;
+		e.ifindex = ifa->ifa_index;
+		memcpy(e.addr, RTA_DATA(addr), RTA_PAYLOAD(addr));
+		e.hash = ipaddr_ent_hash(&e);
+
+		want = ipaddr_apply_find(b, &e);
+		if (want && want->state == IPADDR_ENT_MISSING) {
+			want->state = ipaddr_apply_diff(b, want, ifa, tb);
+			if (want->state == IPADDR_ENT_INSTALLED) {
+				b->kept++;
+				return 0;
+			}
+			b->replaced++;
+			if (want->state == IPADDR_ENT_CHANGED)
+				return 0;
+			b->readded++;
+		}
+	}
+
+	if (!nlmsg_chain_append(&b->stale, n))
+		return -1;
+	return 0;
+}
+
+/* The kernel finds the address to delete by its key */
+static int ipaddr_apply_del(struct rtnl_flush *f, const struct nlmsghdr *n)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	struct rtattr *tb[IFA_MAX+1];
+	struct {
+		struct nlmsghdr	n;
+		struct ifaddrmsg	ifa;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
+		.n.nlmsg_type = RTM_DELADDR,
+		.ifa.ifa_family = ifa->ifa_family,
+		.ifa.ifa_prefixlen = ifa->ifa_prefixlen,
+		.ifa.ifa_index = ifa->ifa_index,
+	};
+
+	parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa),
+		     n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa)));
+	if (tb[IFA_LOCAL] &&
+	    addattr_l(&req.n, sizeof(req), IFA_LOCAL, RTA_DATA(tb[IFA_LOCAL]),
+		      RTA_PAYLOAD(tb[IFA_LOCAL])))
+		return -1;
+	if (tb[IFA_ADDRESS] &&
+	    addattr_l(&req.n, sizeof(req), IFA_ADDRESS,
+		      RTA_DATA(tb[IFA_ADDRESS]), RTA_PAYLOAD(tb[IFA_ADDRESS])))
+		return -1;
+
+	f->tag = 0;
+	return rtnl_flush_add(f, &req.n, 0);
+}
+
+static int ipaddr_apply_send(struct ipaddr_bulk *b, struct rtnl_flush *f,
+			     bool readd)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct ifaddrmsg	ifa;
+		char			buf[256];
+	} req;
+	unsigned int i;
+
+	for (i = 0; i < b->count; i++) {
+		struct ipaddr_ent *e = b->ents[i];
+
+		if (e->state == IPADDR_ENT_INSTALLED ||
+		    (e->state == IPADDR_ENT_READD) != readd)
+			continue;
+		if (ipaddr_bulk_req(b, e, &req.n, sizeof(req))) {
+			rtnl_bulk_line_error(&b->bulk, e->lineno,
+					     "request too large");
+			continue;
+		}
+		f->tag = e->lineno;
+		if (rtnl_flush_add(f, &req.n, 0) < 0)
+			return -1;
+	}
+	return rtnl_flush_commit(f) == -2 ? -1 : 0;
+}
+
+static int ipaddr_apply(struct ipaddr_bulk *b)
+{
+	struct nlmsg_chain ainfo = {};
+	unsigned int added, deleted = 0, stale = 0, i;
+	struct nlmsg_list *a;
+	struct rtnl_flush f;
+	int ret = -1;
+
+	if (ipaddr_apply_read(b))
+		goto out;
+	if (preferred_family != AF_UNSPEC)
+		b->families |= 1ULL << preferred_family;
+	/* an empty file has nothing to say about the family */
+	if (!b->families)
+		b->families = 1ULL << AF_INET | 1ULL << AF_INET6;
+
+	/* one dump, narrowed to the device on strict kernels */
+	filter.family = preferred_family;
+	filter.ifindex = b->ndevs == 1 ? b->devs[0] : 0;
+	if (ip_addr_list(&ainfo))
+		goto out;
+	for (a = ainfo.head; a; a = a->next)
+		if (ipaddr_apply_addr(b, &a->h)) {
+			fprintf(stderr, "Out of memory\n");
+			goto out;
+		}
+
+	b->bulk.what = "changes";
+	if (rtnl_bulk_start(&b->bulk, &f))
+		goto out;
+
+	for (a = b->stale.head; a; a = a->next)
+		stale++;
+	added = b->count - b->kept - b->replaced;
+	deleted = stale - b->readded;
+	b->bulk.entries = added + b->replaced + deleted;
+
+	/* new addresses go in before the old ones go away, those that
+	 * could not be replaced come back last
+	 */
+	if (ipaddr_apply_send(b, &f, false) < 0)
+		goto out_err;
+	for (a = b->stale.head; a; a = a->next)
+		if (ipaddr_apply_del(&f, &a->h) < 0)
+			goto out_err;
+	if (rtnl_flush_commit(&f) == -2 ||
+	    ipaddr_apply_send(b, &f, true) < 0)
+		goto out_err;
+
+	ret = rtnl_bulk_finish(&b->bulk, &f);
+	if (show_stats)
+		printf("%u addresses: %u added, %u replaced, %u deleted, %u unchanged\n",
+		       b->count, added, b->replaced, deleted, b->kept);
+	goto out;
+
+out_err:
+	perror("Cannot talk to rtnetlink");
+	rtnl_flush_close(&f);
+out:
+	for (i = 0; i < b->count; i++)
+		free(b->ents[i]);
+	free(b->ents);
+	free(b->hash);
+	free(b->devs);
+	nlmsg_chain_free(&b->stale);
+	nlmsg_chain_free(&ainfo);
+	return ret;
+}
+
 static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 {
 	struct {
@@ -2490,6 +4102,10 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 	__u32 preferred_lft = INFINITY_LIFE_TIME;
 	__u32 valid_lft = INFINITY_LIFE_TIME;
 	unsigned int ifa_flags = 0;
+	struct ipaddr_bulk b = {};
+	char *file = NULL;
+	int addrprot = -1;
+	__u32 metric = 0;
 	int ret;
 
 	while (argc > 0) {
@@ -2549,11 +4165,14 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 			NEXT_ARG();
 			l = *argv;
 			addattr_l(&req.n, sizeof(req), IFA_LABEL, l, strlen(l)+1);
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (file)
+				duparg("file", *argv);
+			file = *argv;
 		} else if (matches(*argv, "metric") == 0 ||
 			   matches(*argv, "priority") == 0 ||
 			   matches(*argv, "preference") == 0) {
-			__u32 metric;
-
 			NEXT_ARG();
 			if (get_u32(&metric, *argv, 0))
 				invarg("\"metric\" value is invalid\n", *argv);
@@ -2588,11 +4207,19 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 			if (rtnl_addrprot_a2n(&proto, *argv))
 				invarg("\"proto\" value is invalid\n", *argv);
 			addattr8(&req.n, sizeof(req), IFA_PROTO, proto);
+			addrprot = proto;
 		} else {
 			if (strcmp(*argv, "local") == 0)
 				NEXT_ARG();
 			if (matches(*argv, "help") == 0)
 				usage();
+			if (do_apply) {
+				if (file)
+					duparg2("file", *argv);
+				file = *argv;
+				argc--; argv++;
+				continue;
+			}
 			if (local_len)
 				duparg2("local", *argv);
 			lcl_arg = *argv;
@@ -2609,6 +4236,41 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 	else
 		addattr32(&req.n, sizeof(req), IFA_FLAGS, ifa_flags);
 
+	if (do_apply && !file)
+		missarg("FILE");
+	if (file) {
+		if (local_len || peer_len || brd_len > 0 || any_len)
+			invarg("\"file\" takes the place of the address", file);
+		if (do_apply && addrprot < 0)
+			missarg("proto");
+
+		ll_init_map(&rth);
+		if (d) {
+			b.ifindex = ll_name_to_index(d);
+			if (!b.ifindex)
+				return nodev(d);
+		}
+		if (ipaddr_lifetimes(&req.n, sizeof(req), valid_lftp,
+				     preferred_lftp, valid_lft, preferred_lft))
+			return -1;
+
+		b.bulk.file = file;
+		b.bulk.window = IPADDR_BULK_WINDOW;
+		b.proto = &req.n;
+		b.brd = brd_len;
+		b.scoped = scoped;
+		b.ifa_flags = ifa_flags;
+		if (!do_apply)
+			return ipaddr_bulk(&b);
+
+		b.addrprot = addrprot;
+		b.metric = metric;
+		b.label = l;
+		b.lifetimes = valid_lft != INFINITY_LIFE_TIME ||
+			      preferred_lft != INFINITY_LIFE_TIME;
+		return ipaddr_apply(&b);
+	}
+
 	if (d == NULL) {
 		fprintf(stderr, "Not enough information: \"dev\" argument is required.\n");
 		return -1;
@@ -2656,23 +4318,9 @@ static int ipaddr_modify(int cmd, int flags, int argc, char **argv)
 	if (!req.ifa.ifa_index)
 		return nodev(d);
 
-	if (valid_lftp || preferred_lftp) {
-		struct ifa_cacheinfo cinfo = {};
-
-		if (!valid_lft) {
-			fprintf(stderr, "valid_lft is zero\n");
-			return -1;
-		}
-		if (valid_lft < preferred_lft) {
-			fprintf(stderr, "preferred_lft is greater than valid_lft\n");
-			return -1;
-		}
-
-		cinfo.ifa_prefered = preferred_lft;
-		cinfo.ifa_valid = valid_lft;
-		addattr_l(&req.n, sizeof(req), IFA_CACHEINFO, &cinfo,
-			  sizeof(cinfo));
-	}
+	if (ipaddr_lifetimes(&req.n, sizeof(req), valid_lftp, preferred_lftp,
+			     valid_lft, preferred_lft))
+		return -1;
 
 	if ((ifa_flags & IFA_F_MCAUTOJOIN) && !ipaddr_is_multicast(&lcl)) {
 		fprintf(stderr, "autojoin needs multicast address\n");
@@ -2703,6 +4351,10 @@ int do_ipaddr(int argc, char **argv)
 		return ipaddr_modify(RTM_NEWADDR, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1);
 	if (matches(*argv, "delete") == 0)
 		return ipaddr_modify(RTM_DELADDR, 0, argc-1, argv+1);
+	if (strcmp(*argv, "apply") == 0) {
+		do_apply = 1;
+		return ipaddr_modify(RTM_NEWADDR, NLM_F_CREATE|NLM_F_REPLACE, argc-1, argv+1);
+	}
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
 		return ipaddr_list_flush_or_save(argc-1, argv+1, IPADD_LIST);
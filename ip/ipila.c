@@ -20,13 +20,17 @@
 #include "ip_common.h"
 #include "ila_common.h"
 #include "json_print.h"
+#include "list.h"
+#include "rtnl_bulk.h"
 
 static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip ila add loc_match LOCATOR_MATCH loc LOCATOR [ dev DEV ] OPTIONS\n"
 		"       ip ila del loc_match LOCATOR_MATCH [ loc LOCATOR ] [ dev DEV ]\n"
-		"       ip ila list\n"
+		"       ip ila { add | del } file FILE\n"
+		"       ip ila { diff | apply } file FILE\n"
+		"       ip ila list [ count ]\n"
 		"OPTIONS := [ csum-mode { adj-transport | neutral-map |\n"
 		"                         neutral-map-auto | no-action } ]\n"
 		"           [ ident-type { luid | use-format } ]\n");
@@ -45,41 +49,41 @@ static int genl_family = -1;
 #define ILA_RTA(g) ((struct rtattr *)(((char *)(g)) +	\
 	NLMSG_ALIGN(sizeof(struct genlmsghdr))))
 
-static void print_addr64(__u64 addr, char *buff, size_t len)
+/* Dumps run into the millions of mappings, so the words are formatted
+ * by hand rather than with four snprintf() calls. The output is the same
+ * as "%x:%x:%x:%x".
+ */
+static void print_addr64(__u64 addr, char *buf)
 {
+	static const char hex[] = "0123456789abcdef";
 	union {
 		__u64 id64;
 		__u16 words[4];
 	} id = { .id64 = addr };
+	int i, shift;
 	__u16 v;
-	int i, ret;
-	size_t written = 0;
-	char *sep = ":";
 
 	for (i = 0; i < 4; i++) {
 		v = ntohs(id.words[i]);
 
-		if (i == 3)
-			sep = "";
-
-		ret = snprintf(&buff[written], len - written, "%x%s", v, sep);
-		if (ret < 0 || ret >= len - written)
-			break;
-		written += ret;
+		for (shift = 12; shift > 0 && !(v >> shift); shift -= 4)
+			;
+		for (; shift >= 0; shift -= 4)
+			*buf++ = hex[(v >> shift) & 0xf];
+		*buf++ = ':';
 	}
+	buf[-1] = '\0';
 }
 
 static void print_ila_locid(const char *tag, int attr, struct rtattr *tb[])
 {
-	char abuf[256];
+	char abuf[ADDR64_BUF_SIZE];
 
 	if (tb[attr])
-		print_addr64(rta_getattr_u64(tb[attr]),
-			     abuf, sizeof(abuf));
+		print_addr64(rta_getattr_u64(tb[attr]), abuf);
 	else
-		snprintf(abuf, sizeof(abuf), "-");
+		strcpy(abuf, "-");
 
-	/* 20 = sizeof("xxxx:xxxx:xxxx:xxxx") */
 	print_string(PRINT_ANY, tag, "%-20s", abuf);
 }
 
@@ -137,14 +141,29 @@ static int print_ila_mapping(struct nlmsghdr *n, void *arg)
 
 #define NLMSG_BUF_SIZE 4096
 
+static int count_ila_mapping(struct nlmsghdr *n, void *arg)
+{
+	unsigned int *count = arg;
+
+	if (n->nlmsg_type == genl_family)
+		(*count)++;
+	return 0;
+}
+
 static int do_list(int argc, char **argv)
 {
 	ILA_REQUEST(req, 1024, ILA_CMD_GET, NLM_F_REQUEST | NLM_F_DUMP);
+	unsigned int count = 0;
+	bool count_only = false;
+	int ret;
 
 	if (argc > 0) {
-		fprintf(stderr, "\"ip ila show\" does not take "
-			"any arguments.\n");
-		return -1;
+		if (strcmp(*argv, "count") != 0 || argc > 1) {
+			fprintf(stderr, "\"ip ila show\" only takes "
+				"\"count\".\n");
+			return -1;
+		}
+		count_only = true;
 	}
 
 	if (rtnl_send(&genl_rth, (void *)&req, req.n.nlmsg_len) < 0) {
@@ -153,11 +172,20 @@ static int do_list(int argc, char **argv)
 	}
 
 	new_json_obj(json);
-	if (rtnl_dump_filter(&genl_rth, print_ila_mapping, stdout) < 0) {
+	if (count_only)
+		ret = rtnl_dump_filter(&genl_rth, count_ila_mapping, &count);
+	else
+		ret = rtnl_dump_filter(&genl_rth, print_ila_mapping, stdout);
+	if (ret < 0) {
 		fprintf(stderr, "Dump terminated\n");
 		delete_json_obj();
 		return 1;
 	}
+	if (count_only) {
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "count", "%u\n", count);
+		close_json_object();
+	}
 	delete_json_obj();
 	fflush(stdout);
 
@@ -262,23 +290,455 @@ static int ila_parse_opt(int argc, char **argv, struct nlmsghdr *n,
 	return 0;
 }
 
-static int do_add(int argc, char **argv)
+/* "add file FILE" and "del file FILE" take one mapping per line, either
+ * with the arguments of the command or as comma separated values:
+ *
+ *	LOC_MATCH,LOC[,DEV[,CSUM_MODE[,IDENT_TYPE]]]
+ *
+ * The whole file is parsed into this queue before anything is sent.
+ *
+ * "diff file FILE" and "apply file FILE" compare the mappings of an add
+ * file with a dump. Mappings are keyed by locator match and device, a
+ * mapping which differs is deleted and added again since there is no
+ * replace.
+ */
+#define ILA_BULK_WINDOW	256
+
+struct ila_ent {
+	struct hlist_node	hash;
+	__u64			loc_match;
+	__u32			ifindex;
+	int			lineno;
+	size_t			off;
+	bool			seen;
+};
+
+static struct ila_bulk {
+	struct rtnl_bulk	bulk;
+	int			cmd;
+	char			*buf;
+	size_t			len;
+	size_t			bufsize;
+	struct ila_ent		*ent;
+	unsigned int		count;
+	unsigned int		size;
+	struct hlist_head	*hash;
+	unsigned int		hash_mask;
+	struct rtnl_flush	*flush;
+	bool			apply;
+	unsigned int		added;
+	unsigned int		deleted;
+	unsigned int		changed;
+} *ila_bulk;
+
+static int ila_bulk_queue(const struct nlmsghdr *n)
 {
-	ILA_REQUEST(req, 1024, ILA_CMD_ADD, NLM_F_REQUEST);
+	struct ila_bulk *b = ila_bulk;
 
-	ila_parse_opt(argc, argv, &req.n, true);
+	if (b->count == b->size) {
+		unsigned int size = b->size ? b->size * 2 : 1024;
+		struct ila_ent *ent = realloc(b->ent, size * sizeof(*ent));
 
-	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
-		return -2;
+		if (!ent)
+			goto oom;
+		b->ent = ent;
+		b->size = size;
+	}
+
+	if (b->len + NLMSG_ALIGN(n->nlmsg_len) > b->bufsize) {
+		size_t bufsize = b->bufsize ? b->bufsize * 2 : 256 * 1024;
+		char *buf = realloc(b->buf, bufsize);
+
+		if (!buf)
+			goto oom;
+		b->buf = buf;
+		b->bufsize = bufsize;
+	}
+
+	memset(&b->ent[b->count], 0, sizeof(b->ent[0]));
+	b->ent[b->count].lineno = cmdlineno;
+	b->ent[b->count].off = b->len;
+	b->count++;
+	memcpy(b->buf + b->len, n, n->nlmsg_len);
+	b->len += NLMSG_ALIGN(n->nlmsg_len);
+	return 0;
+oom:
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+}
+
+/* deletes of mappings which are not in the file have no line */
+static const char *ila_bulk_name(struct rtnl_bulk *b, int lineno)
+{
+	static char name[PATH_MAX + 32];
+
+	if (lineno)
+		return NULL;
+	snprintf(name, sizeof(name), "%s: stale mapping", b->file);
+	return name;
+}
+
+static int ila_modify(int argc, char **argv, int cmd);
+
+/* LOC_MATCH,LOC[,DEV[,CSUM_MODE[,IDENT_TYPE]]], empty fields are unset */
+static int ila_bulk_line(int argc, char **argv, void *data)
+{
+	static const char * const keys[] = {
+		"loc_match", "loc", "dev", "csum-mode", "ident-type",
+	};
+	char *largv[2 * ARRAY_SIZE(keys)];
+	char *field, *next;
+	int largc = 0, i;
+
+	if (argc != 1 || !strchr(*argv, ','))
+		return ila_modify(argc, argv, ila_bulk->cmd);
+
+	for (i = 0, field = *argv; field; i++, field = next) {
+		next = strchr(field, ',');
+		if (next)
+			*next++ = '\0';
+		if (i == ARRAY_SIZE(keys)) {
+			fprintf(stderr, "Too many fields\n");
+			return -1;
+		}
+		if (*field) {
+			largv[largc++] = (char *)keys[i];
+			largv[largc++] = field;
+		}
+	}
+
+	return ila_modify(largc, largv, ila_bulk->cmd);
+}
 
+static void ila_parse_msg(const struct nlmsghdr *n, struct rtattr *tb[])
+{
+	const struct genlmsghdr *ghdr = NLMSG_DATA(n);
+
+	parse_rtattr(tb, ILA_ATTR_MAX, (void *) ghdr + GENL_HDRLEN,
+		     n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+}
+
+static __u32 ila_ifindex(struct rtattr *tb[])
+{
+	return tb[ILA_ATTR_IFINDEX] ? rta_getattr_u32(tb[ILA_ATTR_IFINDEX]) : 0;
+}
+
+static unsigned int ila_hash(__u64 loc_match, __u32 ifindex)
+{
+	return ((loc_match ^ ifindex) * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static int ila_bulk_index(struct ila_bulk *b)
+{
+	unsigned int i, size = 1024;
+
+	while (size < b->count)
+		size *= 2;
+	b->hash = calloc(size, sizeof(*b->hash));
+	if (!b->hash) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	b->hash_mask = size - 1;
+
+	for (i = 0; i < b->count; i++) {
+		struct ila_ent *e = &b->ent[i], *dup;
+		struct rtattr *tb[ILA_ATTR_MAX + 1];
+		struct hlist_head *head;
+		struct hlist_node *pos;
+
+		ila_parse_msg((struct nlmsghdr *)(b->buf + e->off), tb);
+		e->loc_match = rta_getattr_u64(tb[ILA_ATTR_LOCATOR_MATCH]);
+		e->ifindex = ila_ifindex(tb);
+
+		head = &b->hash[ila_hash(e->loc_match, e->ifindex) &
+				b->hash_mask];
+		hlist_for_each(pos, head) {
+			dup = container_of(pos, struct ila_ent, hash);
+			if (dup->loc_match == e->loc_match &&
+			    dup->ifindex == e->ifindex) {
+				fprintf(stderr, "%s:%d: same mapping as line %d\n",
+					b->bulk.file, e->lineno, dup->lineno);
+				return -1;
+			}
+		}
+		hlist_add_head(&e->hash, head);
+	}
+	return 0;
+}
+
+static struct ila_ent *ila_bulk_lookup(struct ila_bulk *b, __u64 loc_match,
+				       __u32 ifindex)
+{
+	struct hlist_node *pos;
+
+	hlist_for_each(pos, &b->hash[ila_hash(loc_match, ifindex) &
+				     b->hash_mask]) {
+		struct ila_ent *e = container_of(pos, struct ila_ent, hash);
+
+		if (e->loc_match == loc_match && e->ifindex == ifindex)
+			return e;
+	}
+	return NULL;
+}
+
+/* Attributes left out of the file take any value */
+static bool ila_same(struct rtattr *want[], struct rtattr *have[])
+{
+	static const int attrs[] = {
+		ILA_ATTR_LOCATOR, ILA_ATTR_CSUM_MODE, ILA_ATTR_IDENT_TYPE,
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(attrs); i++) {
+		struct rtattr *w = want[attrs[i]], *h = have[attrs[i]];
+
+		if (!w)
+			continue;
+		if (!h || RTA_PAYLOAD(w) != RTA_PAYLOAD(h) ||
+		    memcmp(RTA_DATA(w), RTA_DATA(h), RTA_PAYLOAD(w)))
+			return false;
+	}
+	return true;
+}
+
+/* in the syntax of the add file, so that a diff can be edited into one */
+static void print_ila_diff(char sign, struct rtattr *tb[])
+{
+	char abuf[ADDR64_BUF_SIZE];
+	__u32 ifindex = ila_ifindex(tb);
+
+	print_addr64(rta_getattr_u64(tb[ILA_ATTR_LOCATOR_MATCH]), abuf);
+	printf("%c loc_match %s", sign, abuf);
+	if (tb[ILA_ATTR_LOCATOR]) {
+		print_addr64(rta_getattr_u64(tb[ILA_ATTR_LOCATOR]), abuf);
+		printf(" loc %s", abuf);
+	}
+	if (ifindex)
+		printf(" dev %s", ll_index_to_name(ifindex));
+	if (tb[ILA_ATTR_CSUM_MODE])
+		printf(" csum-mode %s", ila_csum_mode2name(
+			       rta_getattr_u8(tb[ILA_ATTR_CSUM_MODE])));
+	if (tb[ILA_ATTR_IDENT_TYPE])
+		printf(" ident-type %s", ila_ident_type2name(
+			       rta_getattr_u8(tb[ILA_ATTR_IDENT_TYPE])));
+	printf("\n");
+}
+
+static int ila_bulk_send(struct ila_bulk *b, const struct nlmsghdr *n,
+			 int lineno)
+{
+	b->flush->tag = lineno;
+	if (rtnl_flush_add(b->flush, n, 0) < 0) {
+		perror("Cannot talk to generic netlink");
+		return -1;
+	}
 	return 0;
 }
 
-static int do_del(int argc, char **argv)
+static int ila_bulk_delete(struct ila_bulk *b, struct rtattr *tb[],
+			   int lineno)
 {
 	ILA_REQUEST(req, 1024, ILA_CMD_DEL, NLM_F_REQUEST);
+	__u32 ifindex = ila_ifindex(tb);
+
+	addattr64(&req.n, 1024, ILA_ATTR_LOCATOR_MATCH,
+		  rta_getattr_u64(tb[ILA_ATTR_LOCATOR_MATCH]));
+	if (ifindex)
+		addattr32(&req.n, 1024, ILA_ATTR_IFINDEX, ifindex);
+
+	return ila_bulk_send(b, &req.n, lineno);
+}
+
+static int ila_reconcile_mapping(struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *want[ILA_ATTR_MAX + 1];
+	struct rtattr *tb[ILA_ATTR_MAX + 1];
+	struct ila_bulk *b = arg;
+	struct nlmsghdr *add;
+	struct ila_ent *e;
+
+	if (n->nlmsg_type != genl_family)
+		return 0;
+	if (n->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+		return -1;
+
+	ila_parse_msg(n, tb);
+	if (!tb[ILA_ATTR_LOCATOR_MATCH])
+		return 0;
+
+	e = ila_bulk_lookup(b, rta_getattr_u64(tb[ILA_ATTR_LOCATOR_MATCH]),
+			    ila_ifindex(tb));
+	if (!e) {
+		b->deleted++;
+		if (!b->apply) {
+			print_ila_diff('-', tb);
+			return 0;
+		}
+		return ila_bulk_delete(b, tb, 0);
+	}
+
+	e->seen = true;
+	add = (struct nlmsghdr *)(b->buf + e->off);
+	ila_parse_msg(add, want);
+	if (ila_same(want, tb))
+		return 0;
 
-	ila_parse_opt(argc, argv, &req.n, false);
+	b->changed++;
+	if (!b->apply) {
+		print_ila_diff('-', tb);
+		print_ila_diff('+', want);
+		return 0;
+	}
+	if (ila_bulk_delete(b, tb, e->lineno) < 0)
+		return -1;
+	return ila_bulk_send(b, add, e->lineno);
+}
+
+static int ila_reconcile(struct ila_bulk *b)
+{
+	ILA_REQUEST(req, 1024, ILA_CMD_GET, NLM_F_REQUEST | NLM_F_DUMP);
+	struct rtnl_flush f;
+	unsigned int i;
+	int ret;
+
+	if (ila_bulk_index(b) < 0)
+		return -1;
+
+	b->bulk.what = "requests";
+	if (rtnl_bulk_start(&b->bulk, &f) < 0)
+		return -1;
+	b->flush = &f;
+
+	if (rtnl_send(&genl_rth, &req.n, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&genl_rth, ila_reconcile_mapping, b) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	for (i = 0; i < b->count; i++) {
+		struct ila_ent *e = &b->ent[i];
+		struct nlmsghdr *n = (struct nlmsghdr *)(b->buf + e->off);
+
+		if (e->seen)
+			continue;
+		b->added++;
+		if (b->apply) {
+			if (ila_bulk_send(b, n, e->lineno) < 0)
+				goto out;
+		} else {
+			struct rtattr *tb[ILA_ATTR_MAX + 1];
+
+			ila_parse_msg(n, tb);
+			print_ila_diff('+', tb);
+		}
+	}
+
+	b->flush = NULL;
+	b->bulk.entries = f.issued;
+	ret = rtnl_bulk_finish(&b->bulk, &f);
+	/* like diff(1), 1 when there are differences */
+	if (ret == 0 && !b->apply)
+		ret = b->added || b->deleted || b->changed;
+	if (show_stats) {
+		printf("%u added, %u deleted, %u changed", b->added,
+		       b->deleted, b->changed);
+		if (b->apply)
+			printf(", %.0f requests/s", b->bulk.rate);
+		printf("\n");
+	}
+	return ret;
+
+out:
+	b->flush = NULL;
+	rtnl_flush_close(&f);
+	return -1;
+}
+
+static int ila_bulk_load(struct ila_bulk *b)
+{
+	struct rtnl_flush f;
+	unsigned int i;
+	int ret;
+
+	b->bulk.what = "mappings";
+	b->bulk.entries = b->count;
+	if (rtnl_bulk_start(&b->bulk, &f) < 0)
+		return -1;
+
+	for (i = 0; i < b->count; i++) {
+		f.tag = b->ent[i].lineno;
+		if (rtnl_flush_add(&f, (struct nlmsghdr *)(b->buf + b->ent[i].off),
+				   0) < 0) {
+			perror("Cannot talk to generic netlink");
+			rtnl_flush_close(&f);
+			return -1;
+		}
+	}
+
+	ret = rtnl_bulk_finish(&b->bulk, &f);
+	if (show_stats)
+		printf("%u mappings, %.0f mappings/s\n", b->count,
+		       b->bulk.rate);
+	return ret;
+}
+
+/* "file FILE" takes the place of all the arguments */
+static const char *get_file_arg(int argc, char **argv)
+{
+	if (ila_bulk || argc < 1 || strcmp(*argv, "file") != 0)
+		return NULL;
+	NEXT_ARG();
+	if (argc > 1)
+		invarg("file takes the place of all arguments", argv[1]);
+	return *argv;
+}
+
+static int ila_bulk_run(const char *file, int cmd, bool reconcile,
+			bool apply)
+{
+	struct ila_bulk b = {
+		.bulk.file = file,
+		.bulk.protocol = NETLINK_GENERIC,
+		.bulk.window = ILA_BULK_WINDOW,
+		.bulk.genl = true,
+		.bulk.name = ila_bulk_name,
+		.cmd = cmd,
+		.apply = apply,
+	};
+	int ret = -1;
+
+	ila_bulk = &b;
+	if (do_batch(file, false, ila_bulk_line, NULL) != 0)
+		fprintf(stderr, "%s: nothing was sent\n", file);
+	else if (reconcile)
+		ret = ila_reconcile(&b);
+	else
+		ret = ila_bulk_load(&b);
+	ila_bulk = NULL;
+
+	free(b.hash);
+	free(b.buf);
+	free(b.ent);
+	return ret;
+}
+
+static int ila_modify(int argc, char **argv, int cmd)
+{
+	ILA_REQUEST(req, 1024, cmd, NLM_F_REQUEST);
+	const char *file = get_file_arg(argc, argv);
+
+	if (file)
+		return ila_bulk_run(file, cmd, false, false);
+
+	if (ila_parse_opt(argc, argv, &req.n, cmd == ILA_CMD_ADD) < 0)
+		return -1;
+
+	if (ila_bulk)
+		return ila_bulk_queue(&req.n);
 
 	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
 		return -2;
@@ -286,6 +746,18 @@ static int do_del(int argc, char **argv)
 	return 0;
 }
 
+static int do_reconcile(int argc, char **argv, bool apply)
+{
+	const char *file = get_file_arg(argc, argv);
+
+	if (!file) {
+		fprintf(stderr, "\"ip ila %s\" takes \"file FILE\".\n",
+			apply ? "apply" : "diff");
+		return -1;
+	}
+	return ila_bulk_run(file, ILA_CMD_ADD, true, apply);
+}
+
 int do_ipila(int argc, char **argv)
 {
 	if (argc < 1)
@@ -298,13 +770,17 @@ int do_ipila(int argc, char **argv)
 		exit(1);
 
 	if (matches(*argv, "add") == 0)
-		return do_add(argc-1, argv+1);
+		return ila_modify(argc-1, argv+1, ILA_CMD_ADD);
 	if (matches(*argv, "delete") == 0)
-		return do_del(argc-1, argv+1);
+		return ila_modify(argc-1, argv+1, ILA_CMD_DEL);
 	if (matches(*argv, "show") == 0 ||
 	    matches(*argv, "lst") == 0 ||
 	    matches(*argv, "list") == 0)
 		return do_list(argc-1, argv+1);
+	if (strcmp(*argv, "diff") == 0)
+		return do_reconcile(argc-1, argv+1, false);
+	if (strcmp(*argv, "apply") == 0)
+		return do_reconcile(argc-1, argv+1, true);
 
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip ila help\".\n",
 		*argv);
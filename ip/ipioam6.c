@@ -11,6 +11,9 @@
 #include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 
 #include <linux/genetlink.h>
 #include <linux/ioam6.h>
@@ -20,6 +23,8 @@
 #include "ip_common.h"
 #include "libgenl.h"
 #include "json_print.h"
+#include "list.h"
+#include "rtnl_ring.h"
 
 static void usage(void)
 {
@@ -32,7 +37,9 @@ static void usage(void)
 		"	ip ioam schema add ID DATA\n"
 		"	ip ioam schema del ID\n"
 		"	ip ioam namespace set ID schema { ID | none }\n"
-		"	ip ioam monitor\n");
+		"	ip ioam monitor [ collect [ interval SECS ]\n"
+		"			  [ ring FILE [ size SIZE ] ] ]\n"
+		"	ip ioam monitor [ collect ] file FILE\n");
 	exit(-1);
 }
 
@@ -45,6 +52,12 @@ static int genl_family = -1;
 
 static struct {
 	bool monitor;
+	bool collect;
+	bool has_interval;
+	unsigned int interval;
+	const char *ring;
+	const char *file;
+	__u64 ring_size;
 	unsigned int cmd;
 	__u32 sc_id;
 	__u32 ns_data;
@@ -160,24 +173,32 @@ static int process_msg(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
-static int ioam6_monitor_msg(struct rtnl_ctrl_data *ctrl, struct nlmsghdr *n,
-			      void *arg)
+/* Returns the event type with its attributes in attrs, or -1 */
+static int ioam6_event_parse(const struct nlmsghdr *n, struct rtattr *attrs[])
 {
-	struct rtattr *attrs[IOAM6_EVENT_ATTR_MAX + 1];
 	const struct genlmsghdr *ghdr = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 
-	if (n->nlmsg_type != genl_family)
-		return -1;
-
 	len -= NLMSG_LENGTH(GENL_HDRLEN);
 	if (len < 0)
 		return -1;
 
 	parse_rtattr(attrs, IOAM6_EVENT_ATTR_MAX,
 		     (void *)ghdr + GENL_HDRLEN, len);
+	return ghdr->cmd;
+}
 
-	switch (ghdr->cmd) {
+static int ioam6_monitor_msg(struct rtnl_ctrl_data *ctrl, struct nlmsghdr *n,
+			      void *arg)
+{
+	struct rtattr *attrs[IOAM6_EVENT_ATTR_MAX + 1];
+
+	if (n->nlmsg_type != genl_family)
+		return -1;
+
+	switch (ioam6_event_parse(n, attrs)) {
+	case -1:
+		return -1;
 	case IOAM6_EVENT_TRACE:
 		print_trace(attrs);
 		break;
@@ -186,27 +207,625 @@ static int ioam6_monitor_msg(struct rtnl_ctrl_data *ctrl, struct nlmsghdr *n,
 	return 0;
 }
 
-static int ioam6_do_cmd(void)
+/*
+ * "ip ioam monitor collect" decodes the trace events instead of printing
+ * them, into a latency and a queue depth histogram per namespace, node
+ * and hop, hop 0 being the first node on the path. The latency of a hop
+ * is the time from the timestamp of the hop before to its own, when both
+ * nodes filled them in. Every interval the histograms are printed and
+ * forgotten, so the memory follows the paths seen in one interval, up
+ * to IOAM6_COL_MAX keys. With "ring" the events are also recorded as
+ * received into a ring file, for "ip ioam monitor file" to go over later.
+ */
+#define IOAM6_COL_HASH		1024
+#define IOAM6_COL_MAX		4096
+#define IOAM6_COL_RCVBUF	(32 * 1024 * 1024)
+#define IOAM6_COL_BATCH_VLEN	64
+#define IOAM6_COL_BATCH_SLOT	32768
+#define IOAM6_COL_RING_SIZE	(64ULL << 20)
+#define IOAM6_COL_NODES		(IOAM6_TRACE_DATA_SIZE_MAX / 4)
+#define IOAM6_COL_NODE_NONE	UINT64_MAX
+
+/* Log histogram: exact below 8, then 4 buckets per power of 2 */
+#define IOAM6_HIST_EXACT	8
+#define IOAM6_HIST_BUCKETS	(IOAM6_HIST_EXACT + 4 * (40 - 3))
+
+/* Trace type bit n, bit 0 being the most significant */
+#define IOAM6_TRACE_BIT(n)	(1U << (31 - (n)))
+#define IOAM6_TRACE_OSS		22	/* opaque state snapshot */
+
+/* What a node fills in when it has no value, as the uapi IOAM6_*_UNAVAILABLE */
+#define IOAM6_COL_UNAVAILABLE	UINT32_MAX
+#define IOAM6_COL_ID_NONE	(UINT32_MAX >> 8)
+#define IOAM6_COL_ID_WIDE_NONE	(UINT64_MAX >> 8)
+
+struct ioam6_hist {
+	__u32		count[IOAM6_HIST_BUCKETS];
+	__u64		n;
+	__u64		max;
+	double		sum;
+};
+
+struct ioam6_col_key {
+	__u64		node;
+	__u16		ns;
+	__u8		hop;
+};
+
+struct ioam6_col_ent {
+	struct hlist_node	hash;
+	struct ioam6_col_key	key;
+	__u64			traces;
+	__u64			skew;	/* timestamp before the previous hop's */
+	struct ioam6_hist	lat;	/* usec */
+	struct ioam6_hist	queue;
+};
+
+struct ioam6_col {
+	struct hlist_head	hash[IOAM6_COL_HASH];
+	struct rtnl_ring	*ring;
+	struct timespec		ts;
+	bool			aggregate;
+	unsigned int		keys;
+	__u64			traces;
+	__u64			malformed;
+	__u64			dropped;	/* hops with no room for a key */
+	__u64			overruns;
+	__u64			interval_overruns;
+};
+
+struct ioam6_node {
+	__u64		id;
+	__u32		sec;
+	__u32		frac;	/* usec on Linux nodes */
+	__u32		queue;
+	bool		has_ts;
+	bool		has_queue;
+};
+
+static unsigned int ioam6_hist_bucket(__u64 v)
 {
-	IOAM6_REQUEST(req, 1056, opts.cmd, NLM_F_REQUEST);
-	int dump = 0;
+	unsigned int o, b;
 
-	if (genl_init_handle(&grth, IOAM6_GENL_NAME, &genl_family))
-		exit(1);
+	if (v < IOAM6_HIST_EXACT)
+		return v;
+	o = 63 - __builtin_clzll(v);
+	b = IOAM6_HIST_EXACT + 4 * (o - 3) + ((v >> (o - 2)) & 3);
+	return b < IOAM6_HIST_BUCKETS ? b : IOAM6_HIST_BUCKETS - 1;
+}
+
+/* The middle of a bucket */
+static __u64 ioam6_hist_value(unsigned int b)
+{
+	unsigned int o;
+
+	if (b < IOAM6_HIST_EXACT)
+		return b;
+	o = 3 + (b - IOAM6_HIST_EXACT) / 4;
+	return ((4ULL + (b - IOAM6_HIST_EXACT) % 4) << (o - 2)) +
+	       (1ULL << (o - 2)) / 2;
+}
+
+static void ioam6_hist_add(struct ioam6_hist *h, __u64 v)
+{
+	h->count[ioam6_hist_bucket(v)]++;
+	h->n++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+}
+
+static __u64 ioam6_hist_pct(const struct ioam6_hist *h, unsigned int pct)
+{
+	__u64 rank = (h->n * pct + 99) / 100, seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < IOAM6_HIST_BUCKETS; b++) {
+		seen += h->count[b];
+		if (seen >= rank && seen)
+			return min(ioam6_hist_value(b), h->max);
+	}
+	return h->max;
+}
+
+static void ioam6_hist_print(const char *name, const struct ioam6_hist *h,
+			     const char *unit)
+{
+	if (!h->n)
+		return;
+
+	open_json_object(name);
+	print_string(PRINT_FP, NULL, " %s", name);
+	print_float(PRINT_ANY, "avg", " avg %.1f", h->sum / h->n);
+	print_u64(PRINT_ANY, "p50", " p50 %" PRIu64, ioam6_hist_pct(h, 50));
+	print_u64(PRINT_ANY, "p90", " p90 %" PRIu64, ioam6_hist_pct(h, 90));
+	print_u64(PRINT_ANY, "p99", " p99 %" PRIu64, ioam6_hist_pct(h, 99));
+	print_u64(PRINT_ANY, "max", " max %" PRIu64, h->max);
+	if (unit)
+		print_string(PRINT_FP, NULL, " %s", unit);
+	close_json_object();
+}
+
+static __u32 ioam6_get_be32(const __u8 *p)
+{
+	__u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
 
-	if (opts.monitor) {
-		if (genl_add_mcast_grp(&grth, genl_family,
-					IOAM6_GENL_EV_GRP_NAME) < 0) {
-			perror("can't subscribe to ioam6 events");
+/*
+ * Decodes the node data at p, nodelen 4-octet units plus the opaque
+ * state if the trace has one. Returns its length, or -1 if it does not
+ * fit in len.
+ */
+static int ioam6_node_parse(const __u8 *p, int len, __u32 type,
+			    unsigned int nodelen, struct ioam6_node *nd)
+{
+	unsigned int size = nodelen * 4, off = 0, bit;
+	bool has_sec = false, has_frac = false;
+	__u64 wide;
+	__u32 v;
+
+	if (size > len)
+		return -1;
+
+	memset(nd, 0, sizeof(*nd));
+	nd->id = IOAM6_COL_NODE_NONE;
+
+	for (bit = 0; bit < IOAM6_TRACE_OSS; bit++) {
+		/* wide node id, interface ids and namespace data */
+		unsigned int width = bit >= 8 && bit <= 10 ? 8 : 4;
+
+		if (!(type & IOAM6_TRACE_BIT(bit)))
+			continue;
+		if (off + width > size)
+			return -1;
+
+		v = ioam6_get_be32(p + off);
+		switch (bit) {
+		case 0:
+			if ((v & 0xffffff) != IOAM6_COL_ID_NONE)
+				nd->id = v & 0xffffff;
+			break;
+		case 2:
+			nd->sec = v;
+			has_sec = v != IOAM6_COL_UNAVAILABLE;
+			break;
+		case 3:
+			nd->frac = v;
+			has_frac = v != IOAM6_COL_UNAVAILABLE;
+			break;
+		case 6:
+			nd->queue = v;
+			nd->has_queue = v != IOAM6_COL_UNAVAILABLE;
+			break;
+		case 8:
+			wide = (__u64)v << 32 | ioam6_get_be32(p + off + 4);
+			wide &= IOAM6_COL_ID_WIDE_NONE;
+			if (nd->id == IOAM6_COL_NODE_NONE &&
+			    wide != IOAM6_COL_ID_WIDE_NONE)
+				nd->id = wide;
+			break;
+		}
+		off += width;
+	}
+	nd->has_ts = has_sec && has_frac;
+
+	if (type & IOAM6_TRACE_BIT(IOAM6_TRACE_OSS)) {
+		if (size + 4 > len)
+			return -1;
+		size += 4 + p[size] * 4;
+		if (size > len)
+			return -1;
+	}
+	return size;
+}
+
+static struct ioam6_col_ent *ioam6_col_ent(struct ioam6_col *col,
+					   const struct ioam6_col_key *key)
+{
+	unsigned int h = (key->node * 31 + key->ns) * 31 + key->hop;
+	struct hlist_head *head = &col->hash[h % IOAM6_COL_HASH];
+	struct ioam6_col_ent *e;
+	struct hlist_node *pos;
+
+	hlist_for_each(pos, head) {
+		e = container_of(pos, struct ioam6_col_ent, hash);
+		if (e->key.node == key->node && e->key.ns == key->ns &&
+		    e->key.hop == key->hop)
+			return e;
+	}
+
+	if (col->keys >= IOAM6_COL_MAX)
+		return NULL;
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	e->key = *key;
+	hlist_add_head(&e->hash, head);
+	col->keys++;
+	return e;
+}
+
+static void ioam6_col_trace(struct ioam6_col *col, struct rtattr *attrs[])
+{
+	struct ioam6_node nodes[IOAM6_COL_NODES];
+	const struct ioam6_node *prev = NULL;
+	unsigned int nodelen, cnt = 0, i;
+	const __u8 *p;
+	__u32 type;
+	__u16 ns;
+	int len;
+
+	if (!attrs[IOAM6_EVENT_ATTR_TRACE_NAMESPACE] ||
+	    !attrs[IOAM6_EVENT_ATTR_TRACE_NODELEN] ||
+	    !attrs[IOAM6_EVENT_ATTR_TRACE_TYPE] ||
+	    !attrs[IOAM6_EVENT_ATTR_TRACE_DATA])
+		goto malformed;
+
+	ns = rta_getattr_u16(attrs[IOAM6_EVENT_ATTR_TRACE_NAMESPACE]);
+	nodelen = rta_getattr_u8(attrs[IOAM6_EVENT_ATTR_TRACE_NODELEN]);
+	type = rta_getattr_u32(attrs[IOAM6_EVENT_ATTR_TRACE_TYPE]);
+	if (!nodelen)
+		goto malformed;
+
+	/* the newest node comes first */
+	p = RTA_DATA(attrs[IOAM6_EVENT_ATTR_TRACE_DATA]);
+	len = RTA_PAYLOAD(attrs[IOAM6_EVENT_ATTR_TRACE_DATA]);
+	while (len > 0 && cnt < IOAM6_COL_NODES) {
+		int l = ioam6_node_parse(p, len, type, nodelen, &nodes[cnt]);
+
+		if (l < 0)
+			goto malformed;
+		p += l;
+		len -= l;
+		cnt++;
+	}
+	col->traces++;
+
+	for (i = cnt; i-- > 0; prev = &nodes[i]) {
+		const struct ioam6_node *nd = &nodes[i];
+		struct ioam6_col_key key = {
+			.node = nd->id,
+			.ns = ns,
+			.hop = cnt - 1 - i,
+		};
+		struct ioam6_col_ent *e;
+
+		e = ioam6_col_ent(col, &key);
+		if (!e) {
+			col->dropped++;
+			continue;
+		}
+		e->traces++;
+		if (nd->has_queue)
+			ioam6_hist_add(&e->queue, nd->queue);
+		if (prev && prev->has_ts && nd->has_ts) {
+			__s64 d = ((__s64)nd->sec - prev->sec) * 1000000 +
+				  ((__s64)nd->frac - prev->frac);
+
+			if (d < 0)
+				e->skew++;
+			else
+				ioam6_hist_add(&e->lat, d);
+		}
+	}
+	return;
+
+malformed:
+	col->malformed++;
+}
+
+static int ioam6_col_ent_cmp(const void *a, const void *b)
+{
+	const struct ioam6_col_ent *x = *(const struct ioam6_col_ent **)a;
+	const struct ioam6_col_ent *y = *(const struct ioam6_col_ent **)b;
+
+	if (x->key.ns != y->key.ns)
+		return x->key.ns < y->key.ns ? -1 : 1;
+	if (x->key.hop != y->key.hop)
+		return x->key.hop < y->key.hop ? -1 : 1;
+	if (x->key.node != y->key.node)
+		return x->key.node < y->key.node ? -1 : 1;
+	return 0;
+}
+
+static void ioam6_col_print(struct ioam6_col *col)
+{
+	struct ioam6_col_ent **ents;
+	struct hlist_node *pos, *tmp;
+	unsigned int i, n = 0;
+
+	/* without the array the keys are only freed */
+	ents = calloc(col->keys ? : 1, sizeof(*ents));
+	for (i = 0; i < IOAM6_COL_HASH; i++) {
+		hlist_for_each_safe(pos, tmp, &col->hash[i]) {
+			struct ioam6_col_ent *e;
+
+			e = container_of(pos, struct ioam6_col_ent, hash);
+			hlist_del(&e->hash);
+			if (ents)
+				ents[n++] = e;
+			else
+				free(e);
+		}
+	}
+
+	open_json_object(NULL);
+	if (timestamp && !is_json_context())
+		print_timestamp(stdout);
+	print_u64(PRINT_ANY, "traces", "traces %" PRIu64, col->traces);
+	print_uint(PRINT_ANY, "keys", " keys %u", col->keys);
+	print_u64(PRINT_ANY, "malformed", " malformed %" PRIu64,
+		  col->malformed);
+	print_u64(PRINT_ANY, "dropped", " dropped %" PRIu64, col->dropped);
+	print_u64(PRINT_ANY, "overruns", " overruns %" PRIu64,
+		  col->interval_overruns);
+	print_nl();
+
+	open_json_array(PRINT_JSON, "hops");
+	if (ents) {
+		qsort(ents, n, sizeof(*ents), ioam6_col_ent_cmp);
+		for (i = 0; i < n; i++) {
+			struct ioam6_col_ent *e = ents[i];
+
+			open_json_object(NULL);
+			print_uint(PRINT_ANY, "namespace", "  namespace %u",
+				   e->key.ns);
+			print_uint(PRINT_ANY, "hop", " hop %u", e->key.hop);
+			if (e->key.node == IOAM6_COL_NODE_NONE)
+				print_null(PRINT_ANY, "node", " node %s",
+					   "none");
+			else
+				print_u64(PRINT_ANY, "node", " node %" PRIu64,
+					  e->key.node);
+			print_u64(PRINT_ANY, "traces", " traces %" PRIu64,
+				  e->traces);
+			if (e->skew)
+				print_u64(PRINT_ANY, "skew", " skew %" PRIu64,
+					  e->skew);
+			ioam6_hist_print("latency", &e->lat, "usec");
+			ioam6_hist_print("queue", &e->queue, NULL);
+			print_nl();
+			close_json_object();
+			free(e);
+		}
+		free(ents);
+	}
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+	fflush(stdout);
+
+	col->keys = 0;
+	col->traces = 0;
+	col->malformed = 0;
+	col->dropped = 0;
+	col->interval_overruns = 0;
+}
+
+static int ioam6_col_msg(struct rtnl_ctrl_data *ctrl, struct nlmsghdr *n,
+			 void *arg)
+{
+	struct rtattr *attrs[IOAM6_EVENT_ATTR_MAX + 1];
+	struct ioam6_col *col = arg;
+
+	if (n->nlmsg_type != genl_family)
+		return 0;
+
+	if (col->ring)
+		rtnl_ring_put(col->ring, &col->ts, -1, n);
+	if (col->aggregate &&
+	    ioam6_event_parse(n, attrs) == IOAM6_EVENT_TRACE)
+		ioam6_col_trace(col, attrs);
+	return 0;
+}
+
+static volatile sig_atomic_t ioam6_col_stop;
+
+static void ioam6_col_sig(int sig)
+{
+	ioam6_col_stop = 1;
+}
+
+/*
+ * Every wakeup drains the socket with as few recvmmsg() calls as it
+ * takes. With an interval of 0 the events are only recorded.
+ */
+static int ioam6_collect(struct ioam6_col *col, unsigned int interval)
+{
+	struct sigaction sa = { .sa_handler = ioam6_col_sig };
+	int size_rcv = IOAM6_COL_RCVBUF;
+	struct rtnl_batch b;
+	double next = 0;
+	int err = 0;
+
+	if (size_rcv < rcvbuf)
+		size_rcv = rcvbuf;
+	if (setsockopt(grth.fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &size_rcv, sizeof(size_rcv)) < 0)
+		setsockopt(grth.fd, SOL_SOCKET, SO_RCVBUF,
+			   &size_rcv, sizeof(size_rcv));
+
+	if (rtnl_batch_init(&b, IOAM6_COL_BATCH_VLEN, IOAM6_COL_BATCH_SLOT)) {
+		perror("Cannot allocate receive buffers");
+		return -1;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (col->aggregate)
+		next = monotonic_now() + interval;
+	while (!ioam6_col_stop) {
+		struct pollfd pfd = { .fd = grth.fd, .events = POLLIN };
+		double now = monotonic_now();
+		int n;
+
+		if (col->aggregate && now >= next) {
+			ioam6_col_print(col);
+			while (next <= now)
+				next += interval;
+		}
+
+		n = poll(&pfd, 1,
+			 col->aggregate ? (next - now) * 1000 + 1 : -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			err = -1;
+			break;
+		}
+		if (n == 0)
+			continue;
+
+		do {
+			n = rtnl_listen_batch(&grth, &b, &col->ts,
+					      ioam6_col_msg, col);
+			if (n < 0 && errno == ENOBUFS) {
+				col->overruns++;
+				col->interval_overruns++;
+				if (col->ring)
+					rtnl_ring_overrun(col->ring);
+				n = 1;
+			}
+		} while (n > 0 && !ioam6_col_stop);
+
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			err = -1;
+			break;
+		}
+	}
+
+	fprintf(stderr, "%llu socket overruns\n",
+		(unsigned long long)col->overruns);
+	rtnl_batch_free(&b);
+	return err;
+}
+
+static int ioam6_replay_msg(const struct timespec *ts, int nsid,
+			    struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *attrs[IOAM6_EVENT_ATTR_MAX + 1];
+	struct ioam6_col *col = arg;
+
+	/* the family id of the recording may not be the current one */
+	if (ioam6_event_parse(n, attrs) != IOAM6_EVENT_TRACE)
+		return 0;
+
+	if (col)
+		ioam6_col_trace(col, attrs);
+	else
+		print_trace(attrs);
+	return 0;
+}
+
+/* Prints the traces of a ring file, or their aggregates at the end */
+static int ioam6_replay(const char *file, struct ioam6_col *col)
+{
+	struct rtnl_ring_stats stats;
+	struct rtnl_ring *ring;
+	int err;
+
+	ring = rtnl_ring_open(file);
+	if (!ring) {
+		fprintf(stderr, "Cannot open ring file \"%s\": %s\n",
+			file, strerror(errno));
+		return -1;
+	}
+
+	err = rtnl_ring_walk(ring, ioam6_replay_msg, col);
+	rtnl_ring_stats(ring, &stats);
+	if (col) {
+		col->interval_overruns = stats.overruns;
+		ioam6_col_print(col);
+	}
+	fflush(stdout);
+
+	if (stats.lost || stats.overruns)
+		fprintf(stderr,
+			"%llu traces overwritten, %llu socket overruns while collecting\n",
+			stats.lost, stats.overruns);
+	rtnl_ring_close(ring);
+	return err;
+}
+
+static int ioam6_monitor(void)
+{
+	struct ioam6_col *col = NULL;
+	unsigned int interval = 0;
+	int err = 0;
+
+	if (opts.collect) {
+		col = calloc(1, sizeof(*col));
+		if (!col) {
+			fprintf(stderr, "Out of memory\n");
 			exit(1);
 		}
+		/* a ring alone only records, without decoding */
+		interval = opts.has_interval ? opts.interval :
+			   opts.ring ? 0 : 1;
+		col->aggregate = opts.file || interval;
+	}
+
+	if (opts.file) {
+		new_json_obj(json);
+		err = ioam6_replay(opts.file, col);
+		delete_json_obj();
+		free(col);
+		return err;
+	}
+
+	if (genl_init_handle(&grth, IOAM6_GENL_NAME, &genl_family))
+		exit(1);
+
+	if (genl_add_mcast_grp(&grth, genl_family,
+				IOAM6_GENL_EV_GRP_NAME) < 0) {
+		perror("can't subscribe to ioam6 events");
+		exit(1);
+	}
 
+	if (!col) {
 		if (rtnl_listen(&grth, ioam6_monitor_msg, stdout) < 0)
 			exit(1);
-
 		return 0;
 	}
 
+	if (opts.ring) {
+		col->ring = rtnl_ring_create(opts.ring,
+					     opts.ring_size ? :
+					     IOAM6_COL_RING_SIZE, 0);
+		if (!col->ring) {
+			fprintf(stderr, "Cannot create ring file \"%s\": %s\n",
+				opts.ring, strerror(errno));
+			exit(1);
+		}
+	}
+
+	new_json_obj(json);
+	err = ioam6_collect(col, interval);
+	delete_json_obj();
+
+	if (col->ring)
+		rtnl_ring_close(col->ring);
+	free(col);
+	return err;
+}
+
+static int ioam6_do_cmd(void)
+{
+	IOAM6_REQUEST(req, 1056, opts.cmd, NLM_F_REQUEST);
+	int dump = 0;
+
+	if (opts.monitor)
+		return ioam6_monitor();
+
+	if (genl_init_handle(&grth, IOAM6_GENL_NAME, &genl_family))
+		exit(1);
+
 	req.n.nlmsg_type = genl_family;
 
 	switch (opts.cmd) {
@@ -401,6 +1020,50 @@ int do_ioam6(int argc, char **argv)
 	} else if (strcmp(*argv, "monitor") == 0) {
 		opts.monitor = true;
 
+		while (NEXT_ARG_OK()) {
+			NEXT_ARG_FWD();
+
+			if (strcmp(*argv, "collect") == 0) {
+				opts.collect = true;
+
+			} else if (strcmp(*argv, "interval") == 0) {
+				NEXT_ARG();
+
+				if (get_unsigned(&opts.interval, *argv, 0))
+					invarg("Invalid interval", *argv);
+
+				opts.has_interval = true;
+
+			} else if (strcmp(*argv, "ring") == 0) {
+				NEXT_ARG();
+				opts.ring = *argv;
+
+			} else if (strcmp(*argv, "size") == 0) {
+				NEXT_ARG();
+
+				if (get_size64(&opts.ring_size, *argv) ||
+				    !opts.ring_size)
+					invarg("Invalid ring size", *argv);
+
+			} else if (strcmp(*argv, "file") == 0) {
+				NEXT_ARG();
+				opts.file = *argv;
+
+			} else {
+				invarg("Unknown", *argv);
+			}
+		}
+
+		if ((opts.has_interval || opts.ring) && !opts.collect)
+			invarg("\"interval\" and \"ring\" need", "collect");
+		if (opts.ring_size && !opts.ring)
+			invarg("\"size\" needs", "ring");
+		if (opts.file && (opts.has_interval || opts.ring))
+			invarg("\"file\" excludes", "interval and ring");
+		if (opts.collect && opts.has_interval && !opts.interval &&
+		    !opts.ring)
+			invarg("Interval 0 needs", "ring");
+
 	} else {
 		invarg("Unknown", *argv);
 	}
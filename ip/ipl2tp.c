@@ -24,6 +24,7 @@
 
 #include "utils.h"
 #include "ip_common.h"
+#include "rtnl_bulk.h"
 
 enum {
 	L2TP_ADD,
@@ -81,6 +82,125 @@ struct l2tp_data {
 static struct rtnl_handle genl_rth;
 static int genl_family = -1;
 
+/*****************************************************************************
+ * Bulk requests
+ *****************************************************************************/
+
+/* "add file FILE" and "del file FILE" take one tunnel or session per
+ * line, with the arguments of the command. The whole file is parsed into
+ * this queue before anything is sent, then the requests go out in file
+ * order so that tunnels exist by the time their sessions are created.
+ */
+#define L2TP_BULK_WINDOW	256
+
+static struct l2tp_bulk {
+	struct rtnl_bulk	bulk;
+	char			*buf;
+	size_t			len;
+	size_t			bufsize;
+	int			*lineno;
+	unsigned int		count;
+	unsigned int		size;
+} *l2tp_bulk;
+
+static int l2tp_bulk_queue(const struct nlmsghdr *n)
+{
+	struct l2tp_bulk *b = l2tp_bulk;
+
+	if (b->count == b->size) {
+		unsigned int size = b->size ? b->size * 2 : 1024;
+		int *lineno = realloc(b->lineno, size * sizeof(*lineno));
+
+		if (!lineno)
+			goto oom;
+		b->lineno = lineno;
+		b->size = size;
+	}
+
+	if (b->len + NLMSG_ALIGN(n->nlmsg_len) > b->bufsize) {
+		size_t bufsize = b->bufsize ? b->bufsize * 2 : 256 * 1024;
+		char *buf = realloc(b->buf, bufsize);
+
+		if (!buf)
+			goto oom;
+		b->buf = buf;
+		b->bufsize = bufsize;
+	}
+
+	b->lineno[b->count++] = cmdlineno;
+	memcpy(b->buf + b->len, n, n->nlmsg_len);
+	b->len += NLMSG_ALIGN(n->nlmsg_len);
+	return 0;
+oom:
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+}
+
+static int l2tp_bulk_send(struct l2tp_bulk *b)
+{
+	struct rtnl_flush f;
+	unsigned int i;
+	size_t off = 0;
+	int ret;
+
+	b->bulk.entries = b->count;
+	if (rtnl_bulk_start(&b->bulk, &f) < 0)
+		return -1;
+
+	for (i = 0; i < b->count; i++) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(b->buf + off);
+
+		f.tag = b->lineno[i];
+		if (rtnl_flush_add(&f, n, 0) < 0) {
+			perror("Cannot talk to generic netlink");
+			rtnl_flush_close(&f);
+			return -1;
+		}
+		off += NLMSG_ALIGN(n->nlmsg_len);
+	}
+
+	ret = rtnl_bulk_finish(&b->bulk, &f);
+	if (show_stats)
+		printf("%u requests, %.0f requests/s\n", b->count,
+		       b->bulk.rate);
+	return ret;
+}
+
+static int l2tp_bulk_run(const char *file, int (*line)(int, char **, void *))
+{
+	struct l2tp_bulk b = {
+		.bulk.file = file,
+		.bulk.what = "requests",
+		.bulk.protocol = NETLINK_GENERIC,
+		.bulk.window = L2TP_BULK_WINDOW,
+		.bulk.genl = true,
+	};
+	int ret = -1;
+
+	l2tp_bulk = &b;
+	if (do_batch(file, false, line, NULL) == 0)
+		ret = l2tp_bulk_send(&b);
+	else
+		fprintf(stderr, "%s: nothing was sent\n", file);
+	l2tp_bulk = NULL;
+
+	free(b.buf);
+	free(b.lineno);
+	return ret;
+}
+
+/* Send a request now, or queue it when a file is loaded */
+static int l2tp_talk(struct nlmsghdr *n)
+{
+	if (l2tp_bulk)
+		return l2tp_bulk_queue(n);
+
+	if (rtnl_talk(&genl_rth, n, NULL) < 0)
+		return -2;
+
+	return 0;
+}
+
 /*****************************************************************************
  * Netlink actions
  *****************************************************************************/
@@ -119,10 +239,7 @@ static int create_tunnel(struct l2tp_parm *p)
 			addattr(&req.n, 1024, L2TP_ATTR_UDP_ZERO_CSUM6_RX);
 	}
 
-	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
-		return -2;
-
-	return 0;
+	return l2tp_talk(&req.n);
 }
 
 static int delete_tunnel(struct l2tp_parm *p)
@@ -132,10 +249,7 @@ static int delete_tunnel(struct l2tp_parm *p)
 
 	addattr32(&req.n, 128, L2TP_ATTR_CONN_ID, p->tunnel_id);
 
-	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
-		return -2;
-
-	return 0;
+	return l2tp_talk(&req.n);
 }
 
 static int create_session(struct l2tp_parm *p)
@@ -167,10 +281,7 @@ static int create_session(struct l2tp_parm *p)
 	if (p->ifname)
 		addattrstrz(&req.n, 1024, L2TP_ATTR_IFNAME, p->ifname);
 
-	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
-		return -2;
-
-	return 0;
+	return l2tp_talk(&req.n);
 }
 
 static int delete_session(struct l2tp_parm *p)
@@ -180,10 +291,7 @@ static int delete_session(struct l2tp_parm *p)
 
 	addattr32(&req.n, 1024, L2TP_ATTR_CONN_ID, p->tunnel_id);
 	addattr32(&req.n, 1024, L2TP_ATTR_SESSION_ID, p->session_id);
-	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
-		return -2;
-
-	return 0;
+	return l2tp_talk(&req.n);
 }
 
 static void __attribute__((format(printf, 2, 0)))
@@ -434,30 +542,57 @@ static int get_response(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/* The kernel dumps every tunnel or session whatever the request holds */
+static uint32_t filter_tunnel_id;
+
 static int session_nlmsg(struct nlmsghdr *n, void *arg)
 {
+	struct l2tp_data *data = arg;
 	int ret = get_response(n, arg);
 
-	if (ret == 0)
+	if (ret == 0 && (!filter_tunnel_id ||
+			 data->config.tunnel_id == filter_tunnel_id))
 		print_session(arg);
 
 	return ret;
 }
 
+/* Ask for one object by id, rather than picking it out of a dump */
+static int get_one(struct nlmsghdr *n, rtnl_filter_t print,
+		   struct l2tp_data *p)
+{
+	struct nlmsghdr *answer;
+	int ret;
+
+	if (rtnl_talk(&genl_rth, n, &answer) < 0)
+		return -2;
+
+	new_json_obj(json);
+	ret = print(answer, p);
+	delete_json_obj();
+	fflush(stdout);
+	free(answer);
+
+	return ret;
+}
+
 static int get_session(struct l2tp_data *p)
 {
 	GENL_REQUEST(req, 128, genl_family, 0, L2TP_GENL_VERSION,
 		     L2TP_CMD_SESSION_GET,
 		     NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST);
 
-	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
-
+	filter_tunnel_id = p->config.tunnel_id;
 	if (p->config.tunnel_id && p->config.session_id) {
 		addattr32(&req.n, 128, L2TP_ATTR_CONN_ID, p->config.tunnel_id);
 		addattr32(&req.n, 128, L2TP_ATTR_SESSION_ID,
 			  p->config.session_id);
+		req.n.nlmsg_flags = NLM_F_REQUEST;
+		return get_one(&req.n, session_nlmsg, p);
 	}
 
+	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
+
 	if (rtnl_send(&genl_rth, &req, req.n.nlmsg_len) < 0)
 		return -2;
 
@@ -488,10 +623,13 @@ static int get_tunnel(struct l2tp_data *p)
 		     L2TP_CMD_TUNNEL_GET,
 		     NLM_F_ROOT | NLM_F_MATCH | NLM_F_REQUEST);
 
-	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
-
-	if (p->config.tunnel_id)
+	if (p->config.tunnel_id) {
 		addattr32(&req.n, 1024, L2TP_ATTR_CONN_ID, p->config.tunnel_id);
+		req.n.nlmsg_flags = NLM_F_REQUEST;
+		return get_one(&req.n, tunnel_nlmsg, p);
+	}
+
+	req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
 
 	if (rtnl_send(&genl_rth, &req, req.n.nlmsg_len) < 0)
 		return -2;
@@ -529,6 +667,7 @@ static void usage(void)
 		"          [ cookie HEXSTR ] [ peer_cookie HEXSTR ]\n"
 		"          [ seq { none | send | recv | both } ]\n"
 		"          [ l2spec_type L2SPEC ]\n"
+		"       ip l2tp { add | del } file FILE\n"
 		"       ip l2tp del tunnel tunnel_id ID\n"
 		"       ip l2tp del session tunnel_id ID session_id ID\n"
 		"       ip l2tp show tunnel [ tunnel_id ID ]\n"
@@ -730,11 +869,39 @@ static int parse_args(int argc, char **argv, int cmd, struct l2tp_parm *p)
 }
 
 
+static int do_add(int argc, char **argv);
+static int do_del(int argc, char **argv);
+
+static int add_line(int argc, char **argv, void *data)
+{
+	return do_add(argc, argv);
+}
+
+static int del_line(int argc, char **argv, void *data)
+{
+	return do_del(argc, argv);
+}
+
+/* "file FILE" takes the place of all the arguments */
+static const char *get_file_arg(int argc, char **argv)
+{
+	if (l2tp_bulk || argc < 1 || strcmp(*argv, "file") != 0)
+		return NULL;
+	NEXT_ARG();
+	if (argc > 1)
+		invarg("file takes the place of all arguments", argv[1]);
+	return *argv;
+}
+
 static int do_add(int argc, char **argv)
 {
+	const char *file = get_file_arg(argc, argv);
 	struct l2tp_parm p;
 	int ret = 0;
 
+	if (file)
+		return l2tp_bulk_run(file, add_line);
+
 	if (parse_args(argc, argv, L2TP_ADD, &p) < 0)
 		return -1;
 
@@ -783,8 +950,12 @@ static int do_add(int argc, char **argv)
 
 static int do_del(int argc, char **argv)
 {
+	const char *file = get_file_arg(argc, argv);
 	struct l2tp_parm p;
 
+	if (file)
+		return l2tp_bulk_run(file, del_line);
+
 	if (parse_args(argc, argv, L2TP_DEL, &p) < 0)
 		return -1;
 
@@ -816,11 +987,9 @@ static int do_show(int argc, char **argv)
 		missarg("tunnel or session");
 
 	if (p->session)
-		get_session(&data);
+		return get_session(&data);
 	else
-		get_tunnel(&data);
-
-	return 0;
+		return get_tunnel(&data);
 }
 
 int do_ipl2tp(int argc, char **argv)
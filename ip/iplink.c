@@ -59,6 +59,8 @@ void iplink_usage(void)
 		"		    [ netns { PID | NETNSNAME | NETNSFILE } ]\n"
 		"		    type TYPE [ ARGS ]\n"
 		"\n"
+		"	ip link add-range FIRST LAST [ ip link add ARGS with %%d ]\n"
+		"\n"
 		"	ip link delete { DEVICE | dev DEVICE | group DEVGROUP } type TYPE [ ARGS ]\n"
 		"\n"
 		"	ip link { set | change } { DEVICE | dev DEVICE | group DEVGROUP }\n"
@@ -109,6 +111,8 @@ void iplink_usage(void)
 		"\n"
 		"	ip link show [ DEVICE | group GROUP ] [ { up | down } ] [master DEV] [vrf NAME]\n"
 		"		[type TYPE] [nomaster] [ novf ]\n"
+		"	ip -s link show [ DEVICE ] [ vf ] interval SECS\n"
+		"	ip -s link show type can [ DEVICE ] interval SECS\n"
 		"\n"
 		"	ip link xstats type TYPE [ ARGS ]\n"
 		"\n"
@@ -141,15 +145,59 @@ static int on_off(const char *msg, const char *realval)
 static void *BODY;		/* cached dlopen(NULL) handle */
 static struct link_util *linkutil_list;
 
+/* The link kinds built into ip, sorted by kind for bsearch() */
+#define IPLINK_BUILTIN_KINDS(X)						\
+	X(amt) X(bareudp) X(batadv) X(bond) X(bond_slave) X(bridge)	\
+	X(bridge_slave) X(can) X(dsa) X(dummy) X(erspan) X(geneve)	\
+	X(gre) X(gretap) X(gtp) X(hsr) X(ifb) X(ip6erspan) X(ip6gre)	\
+	X(ip6gretap) X(ip6tnl) X(ipip) X(ipoib) X(ipvlan) X(ipvtap)	\
+	X(macsec) X(macvlan) X(macvtap) X(netdevsim) X(netkit)		\
+	X(nlmon) X(rmnet) X(sit) X(team) X(tun) X(vcan) X(veth)		\
+	X(virt_wifi) X(vlan) X(vrf) X(vrf_slave) X(vti) X(vti6)		\
+	X(vxcan) X(vxlan) X(wwan) X(xfrm)
+
+#define IPLINK_KIND_DECLARE(kind)	extern struct link_util kind##_link_util;
+#define IPLINK_KIND_ENTRY(kind)		&kind##_link_util,
+
+IPLINK_BUILTIN_KINDS(IPLINK_KIND_DECLARE)
+
+static struct link_util *const builtin_link_utils[] = {
+	IPLINK_BUILTIN_KINDS(IPLINK_KIND_ENTRY)
+};
+
+/* Kinds that neither ip nor a plug-in knows, so as to look once only */
+struct link_kind_miss {
+	struct link_kind_miss	*next;
+	char			id[];
+};
+
+static struct link_kind_miss *link_kind_misses;
+
+static int link_util_cmp(const void *id, const void *lu)
+{
+	return strcmp(id, (*(struct link_util *const *)lu)->id);
+}
+
 struct link_util *get_link_kind(const char *id)
 {
+	struct link_util *const *b;
+	struct link_kind_miss *m;
 	void *dlh;
 	char buf[256];
 	struct link_util *l;
 
+	b = bsearch(id, builtin_link_utils, ARRAY_SIZE(builtin_link_utils),
+		    sizeof(builtin_link_utils[0]), link_util_cmp);
+	if (b)
+		return *b;
+
+	/* plug-ins, and link_utils built in but not listed above */
 	for (l = linkutil_list; l; l = l->next)
 		if (strcmp(l->id, id) == 0)
 			return l;
+	for (m = link_kind_misses; m; m = m->next)
+		if (strcmp(m->id, id) == 0)
+			return NULL;
 
 	snprintf(buf, sizeof(buf), "%s/link_%s.so", get_ip_lib_dir(), id);
 	dlh = dlopen(buf, RTLD_LAZY);
@@ -165,8 +213,15 @@ struct link_util *get_link_kind(const char *id)
 
 	snprintf(buf, sizeof(buf), "%s_link_util", id);
 	l = dlsym(dlh, buf);
-	if (l == NULL)
+	if (l == NULL) {
+		m = malloc(sizeof(*m) + strlen(id) + 1);
+		if (m) {
+			strcpy(m->id, id);
+			m->next = link_kind_misses;
+			link_kind_misses = m;
+		}
 		return NULL;
+	}
 
 	l->next = linkutil_list;
 	linkutil_list = l;
@@ -1116,18 +1171,14 @@ out:
 	return ret;
 }
 
-static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
+/* Build the whole request from the "ip link { add | set | ... }" arguments */
+static int iplink_build(struct iplink_req *req, int argc, char **argv)
 {
+	unsigned int flags = req->n.nlmsg_flags;
 	char *type = NULL;
-	struct iplink_req req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.i.ifi_family = preferred_family,
-	};
 	int ret;
 
-	ret = iplink_parse(argc, argv, &req, &type);
+	ret = iplink_parse(argc, argv, req, &type);
 	if (ret < 0)
 		return ret;
 
@@ -1137,8 +1188,8 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 		char *ulinep = strchr(type, '_');
 		int iflatype;
 
-		linkinfo = addattr_nest(&req.n, sizeof(req), IFLA_LINKINFO);
-		addattr_l(&req.n, sizeof(req), IFLA_INFO_KIND, type,
+		linkinfo = addattr_nest(&req->n, sizeof(*req), IFLA_LINKINFO);
+		addattr_l(&req->n, sizeof(*req), IFLA_INFO_KIND, type,
 			 strlen(type) + 1);
 
 		lu = get_link_kind(type);
@@ -1153,12 +1204,12 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 		if (lu && lu->parse_opt && argc) {
 			struct rtattr *data;
 
-			data = addattr_nest(&req.n, sizeof(req), iflatype);
+			data = addattr_nest(&req->n, sizeof(*req), iflatype);
 
-			if (lu->parse_opt(lu, argc, argv, &req.n))
+			if (lu->parse_opt(lu, argc, argv, &req->n))
 				return -1;
 
-			addattr_nest_end(&req.n, data);
+			addattr_nest_end(&req->n, data);
 		} else if (argc) {
 			if (matches(*argv, "help") == 0)
 				usage();
@@ -1167,13 +1218,30 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 				*argv);
 			return -1;
 		}
-		addattr_nest_end(&req.n, linkinfo);
+		addattr_nest_end(&req->n, linkinfo);
 	} else if (flags & NLM_F_CREATE) {
 		fprintf(stderr,
 			"Not enough information: \"type\" argument is required\n");
 		return -1;
 	}
 
+	return 0;
+}
+
+static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
+{
+	struct iplink_req req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST | flags,
+		.n.nlmsg_type = cmd,
+		.i.ifi_family = preferred_family,
+	};
+	int ret;
+
+	ret = iplink_build(&req, argc, argv);
+	if (ret < 0)
+		return ret;
+
 	if (echo_request)
 		ret = rtnl_echo_talk(&rth, &req.n, json, print_linkinfo);
 	else
@@ -1186,10 +1254,131 @@ static int iplink_modify(int cmd, unsigned int flags, int argc, char **argv)
 
 	/* remove device from cache; next use can refresh with new data */
 	ll_drop_by_index(req.i.ifi_index);
+	ll_map_cache_invalidate();
 
 	return 0;
 }
 
+/*
+ * "ip link add-range FIRST LAST ARGS" creates a link per index from FIRST
+ * to LAST out of the same "ip link add" ARGS, with every "%d" in them
+ * replaced by the index. Only the arguments holding "%d" are rebuilt
+ * per link, and the requests are sent in windows of IPLINK_RANGE_WINDOW
+ * instead of one round trip each. The netns fds of a window stay open
+ * until the kernel has handled it.
+ */
+#define IPLINK_RANGE_WINDOW	128
+
+static char *iplink_range_arg(const char *tmpl, int idx)
+{
+	char num[16], *arg, *p;
+	const char *t;
+	size_t len;
+
+	len = snprintf(num, sizeof(num), "%d", idx);
+	arg = malloc(strlen(tmpl) / 2 * len + strlen(tmpl) + 1);
+	if (!arg)
+		return NULL;
+
+	for (t = tmpl, p = arg; *t; ) {
+		if (t[0] == '%' && t[1] == 'd') {
+			memcpy(p, num, len);
+			p += len;
+			t += 2;
+		} else {
+			*p++ = *t++;
+		}
+	}
+	*p = '\0';
+	return arg;
+}
+
+static void iplink_range_report(int tag, void *arg)
+{
+	fprintf(stderr, "Link %d was not created.\n", tag);
+}
+
+static int iplink_add_range(int argc, char **argv)
+{
+	unsigned int failed = 0;
+	bool windowed = false;
+	int first, last, idx;
+	char **args;
+	int i;
+
+	if (argc < 2 || get_integer(&first, argv[0], 0) ||
+	    get_integer(&last, argv[1], 0) || first < 0 || last < first) {
+		fprintf(stderr, "Usage: ip link add-range FIRST LAST ARGS\n");
+		return -1;
+	}
+	argc -= 2;
+	argv += 2;
+
+	args = calloc(argc + 1, sizeof(*args));
+	if (!args)
+		return -1;
+
+	if (!echo_request &&
+	    rtnl_async_start(&rth, IPLINK_RANGE_WINDOW,
+			     iplink_range_report, NULL) == 0)
+		windowed = true;
+
+	for (idx = first; idx <= last; idx++) {
+		struct iplink_req req = {
+			.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg)),
+			.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE |
+					 NLM_F_EXCL,
+			.n.nlmsg_type = RTM_NEWLINK,
+			.i.ifi_family = preferred_family,
+		};
+		int ret;
+
+		for (i = 0; i < argc; i++) {
+			if (args[i] != argv[i])
+				free(args[i]);
+			args[i] = strstr(argv[i], "%d") ?
+				  iplink_range_arg(argv[i], idx) : argv[i];
+			if (!args[i]) {
+				perror("add-range");
+				failed++;
+				goto out;
+			}
+		}
+
+		if (iplink_build(&req, argc, args) < 0) {
+			failed++;
+			goto out;
+		}
+
+		if (windowed)
+			rtnl_async_tag(idx);
+		if (echo_request)
+			ret = rtnl_echo_talk(&rth, &req.n, json,
+					     print_linkinfo);
+		else
+			ret = rtnl_talk(&rth, &req.n, NULL);
+		if (ret < 0) {
+			fprintf(stderr, "Link %d was not created.\n", idx);
+			failed++;
+		}
+
+		if ((idx - first + 1) % IPLINK_RANGE_WINDOW == 0)
+			open_fds_close();
+	}
+
+out:
+	if (windowed)
+		failed += rtnl_async_stop();
+	open_fds_close();
+	ll_map_cache_invalidate();
+	for (i = 0; i < argc; i++)
+		if (args[i] != argv[i])
+			free(args[i]);
+	free(args);
+
+	return failed ? -2 : 0;
+}
+
 int iplink_get(char *name, __u32 filt_mask)
 {
 	struct iplink_req req = {
@@ -1463,6 +1652,7 @@ static int iplink_prop_mod(int argc, char **argv, struct iplink_req *req)
 	if (rtnl_talk(&rth, &req->n, NULL) < 0)
 		return -2;
 
+	ll_map_cache_invalidate();
 	return 0;
 }
 
@@ -1514,6 +1704,8 @@ int do_iplink(int argc, char **argv)
 	if (argc < 1)
 		return ipaddr_list_link(0, NULL);
 
+	if (strcmp(*argv, "add-range") == 0)
+		return iplink_add_range(argc-1, argv+1);
 	if (matches(*argv, "add") == 0)
 		return iplink_modify(RTM_NEWLINK,
 				     NLM_F_CREATE|NLM_F_EXCL,
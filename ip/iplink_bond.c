@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <linux/if_bonding.h>
 
 #include "list.h"
@@ -788,7 +790,8 @@ static void bond_print_help(struct link_util *lu, int argc, char **argv,
 
 static void bond_print_xstats_help(struct link_util *lu, FILE *f)
 {
-	fprintf(f, "Usage: ... %s [ 802.3ad ] [ dev DEVICE ]\n", lu->id);
+	fprintf(f, "Usage: ... %s [ 802.3ad ] [ dev DEVICE ] [ interval SECS ]\n",
+		lu->id);
 }
 
 static void bond_print_3ad_stats(const struct rtattr *lacpattr)
@@ -919,8 +922,332 @@ int bond_print_xstats(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/*
+ * "xstats type bond[_slave] ... interval SECS" samples the 802.3ad
+ * counters and the LACP oper states of every bond slave, from a link
+ * dump and a slave xstats dump per interval. The previous sample is kept
+ * by slave ifindex, and a line is only printed for a slave when its
+ * bond, actor or partner state changed, when unknown or illegal LACPDUs
+ * arrived, when LACPDUs stopped or started arriving, or when it was
+ * added or removed. -s prints every slave in every interval.
+ */
+#define BOND_WATCH_HASH		1024
+
+struct bond_watch_slave {
+	struct hlist_node	hash;
+	int			ifindex;
+	char			name[IFNAMSIZ];
+	int			master;
+	int			last_master;
+	__u8			actor;
+	__u8			partner;
+	__u8			last_actor;
+	__u8			last_partner;
+	unsigned int		gen;
+	bool			sampled;	/* the last_ fields are set */
+	bool			has_stats;
+	bool			had_stats;
+	__u64			cur[BOND_3AD_STAT_MAX + 1];
+	__u64			last[BOND_3AD_STAT_MAX + 1];
+	double			rx_rate;	/* < 0 until there is one */
+};
+
+struct bond_watch {
+	struct hlist_head	hash[BOND_WATCH_HASH];
+	unsigned int		gen;
+	double			secs;
+};
+
+static struct bond_watch_slave *bond_watch_find(struct bond_watch *bw,
+						int ifindex)
+{
+	struct hlist_node *pos;
+	struct bond_watch_slave *s;
+
+	hlist_for_each(pos, &bw->hash[ifindex % BOND_WATCH_HASH]) {
+		s = container_of(pos, struct bond_watch_slave, hash);
+		if (s->ifindex == ifindex)
+			return s;
+	}
+	return NULL;
+}
+
+static int bond_watch_link(struct nlmsghdr *n, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *slave[IFLA_BOND_SLAVE_MAX + 1];
+	struct rtattr *linkinfo[IFLA_INFO_MAX + 1];
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct bond_watch *bw = arg;
+	struct bond_watch_slave *s;
+	int len = n->nlmsg_len;
+	int master;
+
+	if (n->nlmsg_type != RTM_NEWLINK)
+		return 0;
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0)
+		return -1;
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+	if (!tb[IFLA_MASTER] || !tb[IFLA_LINKINFO] || !tb[IFLA_IFNAME])
+		return 0;
+	parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+	if (!linkinfo[IFLA_INFO_SLAVE_KIND] ||
+	    strcmp(rta_getattr_str(linkinfo[IFLA_INFO_SLAVE_KIND]), "bond"))
+		return 0;
+
+	master = rta_getattr_u32(tb[IFLA_MASTER]);
+	if (filter_index && filter_index != ifi->ifi_index &&
+	    filter_index != master)
+		return 0;
+
+	s = bond_watch_find(bw, ifi->ifi_index);
+	if (!s) {
+		s = calloc(1, sizeof(*s));
+		if (!s) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+		s->ifindex = ifi->ifi_index;
+		s->rx_rate = -1;
+		hlist_add_head(&s->hash,
+			       &bw->hash[s->ifindex % BOND_WATCH_HASH]);
+	}
+	strlcpy(s->name, rta_getattr_str(tb[IFLA_IFNAME]), sizeof(s->name));
+	s->master = master;
+	s->gen = bw->gen;
+	s->has_stats = false;
+
+	s->actor = s->partner = 0;
+	if (linkinfo[IFLA_INFO_SLAVE_DATA]) {
+		parse_rtattr_nested(slave, IFLA_BOND_SLAVE_MAX,
+				    linkinfo[IFLA_INFO_SLAVE_DATA]);
+		if (slave[IFLA_BOND_SLAVE_AD_ACTOR_OPER_PORT_STATE])
+			s->actor = rta_getattr_u8(slave[IFLA_BOND_SLAVE_AD_ACTOR_OPER_PORT_STATE]);
+		if (slave[IFLA_BOND_SLAVE_AD_PARTNER_OPER_PORT_STATE])
+			s->partner = rta_getattr_u8(slave[IFLA_BOND_SLAVE_AD_PARTNER_OPER_PORT_STATE]);
+	}
+	return 0;
+}
+
+static int bond_watch_stats(struct nlmsghdr *n, void *arg)
+{
+	struct if_stats_msg *ifsm = NLMSG_DATA(n);
+	struct rtattr *bondtb[LINK_XSTATS_TYPE_MAX + 1];
+	struct rtattr *lacptb[BOND_3AD_STAT_MAX + 1];
+	struct rtattr *tb[IFLA_STATS_MAX + 1];
+	struct bond_watch *bw = arg;
+	struct bond_watch_slave *s;
+	int len = n->nlmsg_len;
+	struct rtattr *i;
+	int rem, j;
+
+	len -= NLMSG_LENGTH(sizeof(*ifsm));
+	if (len < 0)
+		return -1;
+
+	s = bond_watch_find(bw, ifsm->ifindex);
+	if (!s || s->gen != bw->gen)
+		return 0;
+
+	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
+	if (!tb[IFLA_STATS_LINK_XSTATS_SLAVE])
+		return 0;
+	parse_rtattr_nested(bondtb, LINK_XSTATS_TYPE_MAX,
+			    tb[IFLA_STATS_LINK_XSTATS_SLAVE]);
+	if (!bondtb[LINK_XSTATS_TYPE_BOND])
+		return 0;
+
+	rem = RTA_PAYLOAD(bondtb[LINK_XSTATS_TYPE_BOND]);
+	for (i = RTA_DATA(bondtb[LINK_XSTATS_TYPE_BOND]); RTA_OK(i, rem);
+	     i = RTA_NEXT(i, rem)) {
+		if (i->rta_type != BOND_XSTATS_3AD)
+			continue;
+		parse_rtattr_nested(lacptb, BOND_3AD_STAT_MAX, i);
+		for (j = 0; j <= BOND_3AD_STAT_MAX; j++)
+			s->cur[j] = lacptb[j] ? rta_getattr_u64(lacptb[j]) : 0;
+		s->has_stats = true;
+	}
+	return 0;
+}
+
+static double bond_watch_rate(const struct bond_watch_slave *s, int attr,
+			      double secs)
+{
+	__u64 cur = s->cur[attr], last = s->last[attr];
+
+	/* the counters start over when a slave is enslaved again */
+	return (cur >= last ? cur - last : cur) / secs;
+}
+
+static void bond_watch_report(struct bond_watch *bw,
+			      struct bond_watch_slave *s, const char *event)
+{
+	bool rates = s->sampled && s->has_stats && s->had_stats &&
+		     bw->secs > 0;
+	double rx = 0, tx = 0, unknown = 0, illegal = 0;
+	bool stopped = false, resumed = false;
+
+	if (rates) {
+		rx = bond_watch_rate(s, BOND_3AD_STAT_LACPDU_RX, bw->secs);
+		tx = bond_watch_rate(s, BOND_3AD_STAT_LACPDU_TX, bw->secs);
+		unknown = bond_watch_rate(s, BOND_3AD_STAT_LACPDU_UNKNOWN_RX,
+					  bw->secs);
+		illegal = bond_watch_rate(s, BOND_3AD_STAT_LACPDU_ILLEGAL_RX,
+					  bw->secs);
+		stopped = s->rx_rate > 0 && rx == 0;
+		resumed = s->rx_rate == 0 && rx > 0;
+		s->rx_rate = rx;
+	} else {
+		s->rx_rate = -1;
+	}
+
+	if (!event && !show_stats &&
+	    (!s->sampled ||
+	     (s->master == s->last_master && s->actor == s->last_actor &&
+	      s->partner == s->last_partner && !unknown && !illegal &&
+	      !stopped && !resumed)))
+		return;
+
+	if (timestamp)
+		print_timestamp(stdout);
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "ifname", "%s", s->name);
+	if (event)
+		print_string(PRINT_ANY, "event", " %s", event);
+	print_string(PRINT_ANY, "master", " master %s",
+		     ll_index_to_name(s->master));
+	if (s->sampled && s->master != s->last_master)
+		print_string(PRINT_ANY, "last_master", " (was %s)",
+			     ll_index_to_name(s->last_master));
+
+	print_string(PRINT_FP, NULL, " actor", NULL);
+	if (s->sampled && s->actor != s->last_actor) {
+		bond_slave_print_oper_state(stdout, "last_actor_state",
+				       s->last_actor);
+		print_string(PRINT_FP, NULL, "->", NULL);
+	}
+	bond_slave_print_oper_state(stdout, "actor_state", s->actor);
+	print_string(PRINT_FP, NULL, "partner", NULL);
+	if (s->sampled && s->partner != s->last_partner) {
+		bond_slave_print_oper_state(stdout, "last_partner_state",
+				       s->last_partner);
+		print_string(PRINT_FP, NULL, "->", NULL);
+	}
+	bond_slave_print_oper_state(stdout, "partner_state", s->partner);
+
+	if (rates) {
+		print_float(PRINT_ANY, "lacpdu_rx_rate",
+			    "lacpdu rx %.1f/s", rx);
+		print_float(PRINT_ANY, "lacpdu_tx_rate", " tx %.1f/s", tx);
+		print_float(PRINT_ANY, "lacpdu_unknown_rx_rate",
+			    " unknown rx %.1f/s", unknown);
+		print_float(PRINT_ANY, "lacpdu_illegal_rx_rate",
+			    " illegal rx %.1f/s", illegal);
+		if (stopped)
+			print_null(PRINT_ANY, "lacpdu_rx_stopped",
+				   " rx stopped", NULL);
+		if (resumed)
+			print_null(PRINT_ANY, "lacpdu_rx_resumed",
+				   " rx resumed", NULL);
+	}
+	print_string(PRINT_FP, NULL, "\n", NULL);
+	close_json_object();
+}
+
+/* Report the slaves of this sample and keep it, or free all of them */
+static void bond_watch_sweep(struct bond_watch *bw, bool all)
+{
+	struct hlist_node *pos, *n;
+	unsigned int i;
+
+	for (i = 0; i < BOND_WATCH_HASH; i++) {
+		hlist_for_each_safe(pos, n, &bw->hash[i]) {
+			struct bond_watch_slave *s;
+
+			s = container_of(pos, struct bond_watch_slave, hash);
+			if (all || s->gen != bw->gen) {
+				if (!all && s->sampled) {
+					s->sampled = false;
+					bond_watch_report(bw, s, "removed");
+				}
+				hlist_del(&s->hash);
+				free(s);
+				continue;
+			}
+
+			bond_watch_report(bw, s, !s->sampled && bw->gen > 1 ?
+					  "added" : NULL);
+			memcpy(s->last, s->cur, sizeof(s->last));
+			s->had_stats = s->has_stats;
+			s->last_master = s->master;
+			s->last_actor = s->actor;
+			s->last_partner = s->partner;
+			s->sampled = true;
+		}
+	}
+}
+
+static int bond_watch(unsigned int interval)
+{
+	double next, now, last = 0;
+	struct bond_watch *bw;
+	int ret = 0;
+
+	bw = calloc(1, sizeof(*bw));
+	if (!bw) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	new_json_obj(json);
+	next = monotonic_now();
+	for (;;) {
+		now = monotonic_now();
+		if (last)
+			bw->secs = now - last;
+		last = now;
+		bw->gen++;
+
+		if (rtnl_linkdump_req_filter(&rth, AF_UNSPEC, 0) < 0) {
+			perror("Cannot send dump request");
+			ret = -1;
+			break;
+		}
+		if (rtnl_dump_filter(&rth, bond_watch_link, bw) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = -1;
+			break;
+		}
+		if (rtnl_statsdump_req_filter(&rth, AF_UNSPEC,
+					      IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_XSTATS_SLAVE),
+					      NULL, NULL) < 0) {
+			perror("Cannot send dump request");
+			ret = -1;
+			break;
+		}
+		if (rtnl_dump_filter(&rth, bond_watch_stats, bw) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = -1;
+			break;
+		}
+		bond_watch_sweep(bw, false);
+		fflush(stdout);
+		next += interval;
+		monotonic_sleep_until(next);
+	}
+	delete_json_obj();
+
+	bond_watch_sweep(bw, true);
+	free(bw);
+	return ret;
+}
+
 int bond_parse_xstats(struct link_util *lu, int argc, char **argv)
 {
+	unsigned int interval = 0;
+
 	while (argc > 0) {
 		if (strcmp(*argv, "lacp") == 0 ||
 		    strcmp(*argv, "802.3ad") == 0) {
@@ -930,6 +1257,10 @@ int bond_parse_xstats(struct link_util *lu, int argc, char **argv)
 			filter_index = ll_name_to_index(*argv);
 			if (!filter_index)
 				return nodev(*argv);
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("\"interval\" value is invalid\n", *argv);
 		} else if (strcmp(*argv, "help") == 0) {
 			bond_print_xstats_help(lu, stdout);
 			exit(0);
@@ -939,6 +1270,10 @@ int bond_parse_xstats(struct link_util *lu, int argc, char **argv)
 		argc--; argv++;
 	}
 
+	/* the sampler does its own dumps, there is nothing left to print */
+	if (interval)
+		exit(bond_watch(interval) ? 1 : 0);
+
 	return 0;
 }
 
@@ -954,7 +1289,8 @@ struct link_util bond_link_util = {
 
 static const struct ipstats_stat_desc_xstats
 ipstats_stat_desc_xstats_bond_lacp = {
-	.desc = IPSTATS_STAT_DESC_XSTATS_LEAF("802.3ad"),
+	.desc = IPSTATS_STAT_DESC_XSTATS_LEAF_LAYOUT("802.3ad",
+						     IPSTATS_COUNTERS_NEST_U64),
 	.xstats_at = IFLA_STATS_LINK_XSTATS,
 	.link_type_at = LINK_XSTATS_TYPE_BOND,
 	.inner_at = BOND_XSTATS_3AD,
@@ -975,7 +1311,8 @@ const struct ipstats_stat_desc ipstats_stat_desc_xstats_bond_group = {
 
 static const struct ipstats_stat_desc_xstats
 ipstats_stat_desc_xstats_slave_bond_lacp = {
-	.desc = IPSTATS_STAT_DESC_XSTATS_LEAF("802.3ad"),
+	.desc = IPSTATS_STAT_DESC_XSTATS_LEAF_LAYOUT("802.3ad",
+						     IPSTATS_COUNTERS_NEST_U64),
 	.xstats_at = IFLA_STATS_LINK_XSTATS_SLAVE,
 	.link_type_at = LINK_XSTATS_TYPE_BOND,
 	.inner_at = BOND_XSTATS_3AD,
@@ -8,12 +8,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
+#include <linux/if.h>
 #include <linux/can/netlink.h>
 
 #include "rt_names.h"
 #include "utils.h"
 #include "ip_common.h"
+#include "list.h"
 
 struct can_tdc {
 	__u32 tdcv;
@@ -959,6 +963,301 @@ static void can_print_xstats(struct link_util *lu,
 	}
 }
 
+/*
+ * "ip -s link show type can [ DEVICE ] interval SECS" samples the CAN
+ * buses at up to tens of Hz. Each interval one link dump, of the can
+ * kind only and without the generic link stats, gives the state, error
+ * counters and device stats of every bus, and the samples go in a ring
+ * per bus. State changes, restarts and bus-off are printed as soon as
+ * they are seen; once a second, or every interval if it is longer, a
+ * line per bus gives the error rates and how the error counters moved
+ * over that period.
+ */
+#define CAN_WATCH_RING		64
+#define CAN_WATCH_HASH		256
+
+struct can_sample {
+	double			t;
+	__u32			state;
+	struct can_berr_counter	bec;
+	struct can_device_stats	stats;
+};
+
+struct can_bus {
+	struct hlist_node	hash;
+	int			ifindex;
+	char			name[IFNAMSIZ];
+	unsigned int		gen;
+	unsigned int		n;	/* samples taken, the last at n - 1 */
+	struct can_sample	ring[CAN_WATCH_RING];
+};
+
+struct can_watch {
+	struct hlist_head	hash[CAN_WATCH_HASH];
+	int			ifindex;
+	unsigned int		gen;
+	double			now;
+};
+
+static const char *can_state_name(__u32 state)
+{
+	return state < CAN_STATE_MAX ? can_state_names[state] : "UNKNOWN";
+}
+
+static struct can_sample *can_bus_sample(struct can_bus *bus, unsigned int ago)
+{
+	return &bus->ring[(bus->n - 1 - ago) % CAN_WATCH_RING];
+}
+
+static int can_watch_filter(struct nlmsghdr *nlh, int reqlen)
+{
+	struct rtattr *linkinfo;
+	int err;
+
+	err = addattr32(nlh, reqlen, IFLA_EXT_MASK, RTEXT_FILTER_SKIP_STATS);
+	if (err)
+		return err;
+
+	linkinfo = addattr_nest(nlh, reqlen, IFLA_LINKINFO);
+	err = addattr_l(nlh, reqlen, IFLA_INFO_KIND, "can", strlen("can"));
+	if (err)
+		return err;
+	addattr_nest_end(nlh, linkinfo);
+
+	return 0;
+}
+
+static void can_watch_event(struct can_bus *bus, const char *event)
+{
+	const struct can_sample *s = can_bus_sample(bus, 0);
+
+	if (timestamp)
+		print_timestamp(stdout);
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "ifname", "%s", bus->name);
+	print_string(PRINT_ANY, "event", " %s", event);
+	if (bus->n > 1 && strcmp(event, "state") == 0)
+		print_string(PRINT_ANY, "last_state", " %s ->",
+			     can_state_name(can_bus_sample(bus, 1)->state));
+	print_string(PRINT_ANY, "state", " %s", can_state_name(s->state));
+	open_json_object("berr_counter");
+	print_uint(PRINT_ANY, "tx", " (berr-counter tx %u", s->bec.txerr);
+	print_uint(PRINT_ANY, "rx", " rx %u)", s->bec.rxerr);
+	close_json_object();
+	print_nl();
+	close_json_object();
+}
+
+static int can_watch_link(struct nlmsghdr *n, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *linkinfo[IFLA_INFO_MAX + 1];
+	struct rtattr *can[IFLA_CAN_MAX + 1] = {};
+	struct rtattr *tb[IFLA_MAX + 1];
+	struct can_watch *cw = arg;
+	struct can_sample *s, *last;
+	int len = n->nlmsg_len;
+	struct can_bus *bus;
+	struct hlist_node *pos;
+	unsigned int h;
+
+	if (n->nlmsg_type != RTM_NEWLINK)
+		return 0;
+	len -= NLMSG_LENGTH(sizeof(*ifi));
+	if (len < 0)
+		return -1;
+	if (cw->ifindex && cw->ifindex != ifi->ifi_index)
+		return 0;
+
+	parse_rtattr_flags(tb, IFLA_MAX, IFLA_RTA(ifi), len, NLA_F_NESTED);
+	if (!tb[IFLA_LINKINFO] || !tb[IFLA_IFNAME])
+		return 0;
+	/* older kernels ignore the kind in the request */
+	parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, tb[IFLA_LINKINFO]);
+	if (!linkinfo[IFLA_INFO_KIND] ||
+	    strcmp(rta_getattr_str(linkinfo[IFLA_INFO_KIND]), "can"))
+		return 0;
+
+	h = ifi->ifi_index % CAN_WATCH_HASH;
+	bus = NULL;
+	hlist_for_each(pos, &cw->hash[h]) {
+		bus = container_of(pos, struct can_bus, hash);
+		if (bus->ifindex == ifi->ifi_index)
+			break;
+		bus = NULL;
+	}
+	if (!bus) {
+		bus = calloc(1, sizeof(*bus));
+		if (!bus) {
+			fprintf(stderr, "Out of memory\n");
+			return -1;
+		}
+		bus->ifindex = ifi->ifi_index;
+		hlist_add_head(&bus->hash, &cw->hash[h]);
+	}
+	strlcpy(bus->name, rta_getattr_str(tb[IFLA_IFNAME]), sizeof(bus->name));
+	bus->gen = cw->gen;
+
+	s = &bus->ring[bus->n++ % CAN_WATCH_RING];
+	memset(s, 0, sizeof(*s));
+	s->t = cw->now;
+	s->state = CAN_STATE_MAX;
+	if (linkinfo[IFLA_INFO_DATA])
+		parse_rtattr_nested(can, IFLA_CAN_MAX, linkinfo[IFLA_INFO_DATA]);
+	if (can[IFLA_CAN_STATE])
+		s->state = rta_getattr_u32(can[IFLA_CAN_STATE]);
+	if (can[IFLA_CAN_BERR_COUNTER] &&
+	    RTA_PAYLOAD(can[IFLA_CAN_BERR_COUNTER]) >= sizeof(s->bec))
+		memcpy(&s->bec, RTA_DATA(can[IFLA_CAN_BERR_COUNTER]),
+		       sizeof(s->bec));
+	if (linkinfo[IFLA_INFO_XSTATS] &&
+	    RTA_PAYLOAD(linkinfo[IFLA_INFO_XSTATS]) == sizeof(s->stats))
+		memcpy(&s->stats, RTA_DATA(linkinfo[IFLA_INFO_XSTATS]),
+		       sizeof(s->stats));
+
+	if (bus->n == 1) {
+		if (cw->gen > 1)
+			can_watch_event(bus, "added");
+		return 0;
+	}
+
+	last = can_bus_sample(bus, 1);
+	if (s->state != last->state)
+		can_watch_event(bus, "state");
+	else if (s->stats.bus_off != last->stats.bus_off)
+		/* went bus-off and recovered between two samples */
+		can_watch_event(bus, "bus-off");
+	if (s->stats.restarts != last->stats.restarts)
+		can_watch_event(bus, "restarted");
+	return 0;
+}
+
+/* counters that went back, e.g. when the driver was reloaded, count from 0 */
+static double can_watch_rate(__u32 cur, __u32 last, double secs)
+{
+	return (cur >= last ? cur - last : cur) / secs;
+}
+
+static void can_watch_print(struct can_bus *bus, unsigned int period)
+{
+	const struct can_sample *s = can_bus_sample(bus, 0);
+	const struct can_sample *o = can_bus_sample(bus, period);
+	__u16 txmax = 0, rxmax = 0;
+	double secs = s->t - o->t;
+	unsigned int i;
+
+	for (i = 0; i < period; i++) {
+		const struct can_sample *p = can_bus_sample(bus, i);
+
+		txmax = MAX(txmax, p->bec.txerr);
+		rxmax = MAX(rxmax, p->bec.rxerr);
+	}
+
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "ifname", "%-8s", bus->name);
+	print_string(PRINT_ANY, "state", " %-13s", can_state_name(s->state));
+	open_json_object("berr_counter");
+	print_uint(PRINT_ANY, "tx", " tx %3u", s->bec.txerr);
+	print_int(PRINT_ANY, "tx_delta", " (%+d,", s->bec.txerr - o->bec.txerr);
+	print_uint(PRINT_ANY, "tx_max", " max %u)", txmax);
+	print_uint(PRINT_ANY, "rx", " rx %3u", s->bec.rxerr);
+	print_int(PRINT_ANY, "rx_delta", " (%+d,", s->bec.rxerr - o->bec.rxerr);
+	print_uint(PRINT_ANY, "rx_max", " max %u)", rxmax);
+	close_json_object();
+	print_float(PRINT_ANY, "bus_error_rate", " bus-errors %.1f/s",
+		    can_watch_rate(s->stats.bus_error, o->stats.bus_error,
+				   secs));
+	print_float(PRINT_ANY, "arbitration_lost_rate", " arbit-lost %.1f/s",
+		    can_watch_rate(s->stats.arbitration_lost,
+				   o->stats.arbitration_lost, secs));
+	print_float(PRINT_ANY, "error_warning_rate", " error-warn %.1f/s",
+		    can_watch_rate(s->stats.error_warning,
+				   o->stats.error_warning, secs));
+	print_float(PRINT_ANY, "error_passive_rate", " error-pass %.1f/s",
+		    can_watch_rate(s->stats.error_passive,
+				   o->stats.error_passive, secs));
+	print_float(PRINT_ANY, "bus_off_rate", " bus-off %.1f/s",
+		    can_watch_rate(s->stats.bus_off, o->stats.bus_off, secs));
+	print_float(PRINT_ANY, "restart_rate", " restarts %.1f/s",
+		    can_watch_rate(s->stats.restarts, o->stats.restarts, secs));
+	print_nl();
+	close_json_object();
+}
+
+/* Print the buses which have a full period, drop those which are gone */
+static void can_watch_sweep(struct can_watch *cw, unsigned int period,
+			    bool print, bool all)
+{
+	struct hlist_node *pos, *n;
+	unsigned int i;
+
+	for (i = 0; i < CAN_WATCH_HASH; i++) {
+		hlist_for_each_safe(pos, n, &cw->hash[i]) {
+			struct can_bus *bus;
+
+			bus = container_of(pos, struct can_bus, hash);
+			if (all || bus->gen != cw->gen) {
+				if (!all)
+					can_watch_event(bus, "removed");
+				hlist_del(&bus->hash);
+				free(bus);
+			} else if (print && bus->n > period) {
+				can_watch_print(bus, period);
+			}
+		}
+	}
+}
+
+int can_link_watch(int ifindex, unsigned int interval_ms)
+{
+	double start, next;
+	unsigned int period, tick;
+	struct can_watch *cw;
+	int ret = 0;
+
+	cw = calloc(1, sizeof(*cw));
+	if (!cw) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	cw->ifindex = ifindex;
+
+	period = interval_ms < 1000 ? 1000 / interval_ms : 1;
+	if (period >= CAN_WATCH_RING)
+		period = CAN_WATCH_RING - 1;
+
+	new_json_obj(json);
+	start = monotonic_now();
+	next = start;
+	for (tick = 1; ; tick++) {
+		cw->now = monotonic_now() - start;
+		cw->gen++;
+
+		if (rtnl_linkdump_req_filter_fn(&rth, AF_UNSPEC,
+						can_watch_filter) < 0) {
+			perror("Cannot send dump request");
+			ret = -1;
+			break;
+		}
+		if (rtnl_dump_filter(&rth, can_watch_link, cw) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = -1;
+			break;
+		}
+		can_watch_sweep(cw, period, tick % period == 0, false);
+		fflush(stdout);
+
+		/* sleep to the next tick, so the dumps do not add up */
+		next += interval_ms / 1000.0;
+		monotonic_sleep_until(next);
+	}
+	delete_json_obj();
+
+	can_watch_sweep(cw, period, false, true);
+	free(cw);
+	return ret;
+}
+
 static void can_print_help(struct link_util *lu, int argc, char **argv, FILE *f)
 {
 	print_usage(f);
@@ -18,6 +18,8 @@
 #include "ip_common.h"
 #include "ll_map.h"
 #include "libgenl.h"
+#include "list.h"
+#include "rtnl_bulk.h"
 
 static const char * const validate_str[] = {
 	[MACSEC_VALIDATE_DISABLED] = "disabled",
@@ -101,7 +103,9 @@ static void ipmacsec_usage(void)
 		"       ip macsec del DEV rx SCI sa { 0..3 }\n"
 		"       ip macsec show\n"
 		"       ip macsec show DEV\n"
+		"       ip macsec show [ DEV ] interval SECS\n"
 		"       ip macsec offload DEV [ off | phy | mac ]\n"
+		"       ip macsec rotate file FILE\n"
 		"where  OPTS := [ pn <u32> | xpn <u64> ] [ salt SALT ] [ ssci <u32> ] [ on | off ]\n"
 		"       ID   := 128-bit hex string\n"
 		"       KEY  := 128-bit or 256-bit hex string\n"
@@ -405,6 +409,77 @@ static const enum macsec_nl_commands macsec_commands[__CMD_MAX][2][2] = {
 	},
 };
 
+/* "ip macsec rotate file FILE" parses the whole file into this queue
+ * before sending anything, so a typo on one line does not leave the
+ * links half rotated.
+ */
+#define MACSEC_ROTATE_WINDOW	256
+#define MACSEC_ROTATE_MAX_ARGS	64
+
+struct macsec_rotate_sa {
+	int lineno;
+	int ifindex;
+	__u64 sci;
+	__u8 an;
+	bool rx;
+	size_t off;	/* of the request in buf */
+};
+
+static struct macsec_rotate {
+	struct rtnl_bulk bulk;		/* tags index sa */
+	int lineno;			/* being parsed */
+	struct macsec_rotate_sa *sa;
+	unsigned int count;
+	unsigned int size;
+	char *buf;
+	size_t len;
+	size_t bufsize;
+} *macsec_rotate;
+
+static int macsec_rotate_queue(const struct nlmsghdr *n, int ifindex,
+			       const struct rxsc_desc *rxsc,
+			       const struct sa_desc *sa)
+{
+	struct macsec_rotate *r = macsec_rotate;
+	struct macsec_rotate_sa *s;
+
+	if (r->count == r->size) {
+		unsigned int size = r->size ? r->size * 2 : 64;
+
+		s = realloc(r->sa, size * sizeof(*s));
+		if (!s)
+			goto oom;
+		r->sa = s;
+		r->size = size;
+	}
+
+	if (r->len + NLMSG_ALIGN(n->nlmsg_len) > r->bufsize) {
+		size_t bufsize = r->bufsize ? r->bufsize * 2 : 64 * 1024;
+		char *buf = realloc(r->buf, bufsize);
+
+		if (!buf)
+			goto oom;
+		r->buf = buf;
+		r->bufsize = bufsize;
+	}
+
+	s = &r->sa[r->count++];
+	s->lineno = r->lineno;
+	s->ifindex = ifindex;
+	s->rx = rxsc != NULL;
+	s->sci = rxsc ? rxsc->sci : 0;
+	s->an = sa->an;
+	s->off = r->len;
+
+	memcpy(r->buf + r->len, n, n->nlmsg_len);
+	r->len += NLMSG_ALIGN(n->nlmsg_len);
+	return 0;
+
+oom:
+	fprintf(stderr, "Not enough memory\n");
+	return -1;
+}
+
 static int do_modify_nl(enum cmd c, enum macsec_nl_commands cmd, int ifindex,
 			struct rxsc_desc *rxsc, struct sa_desc *sa)
 {
@@ -467,6 +542,9 @@ static int do_modify_nl(enum cmd c, enum macsec_nl_commands cmd, int ifindex,
 	addattr_nest_end(&req.n, attr_sa);
 
 talk:
+	if (macsec_rotate)
+		return macsec_rotate_queue(&req.n, ifindex, rxsc, sa);
+
 	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
 		return -2;
 
@@ -611,6 +689,140 @@ static int do_offload(enum cmd c, int argc, char **argv)
 	return 0;
 }
 
+static const char *macsec_rotate_name(struct rtnl_bulk *b, int idx)
+{
+	static char name[PATH_MAX + 64];
+	const struct macsec_rotate_sa *s = &macsec_rotate->sa[idx];
+	int len;
+
+	len = snprintf(name, sizeof(name), "%s:%d: %s", b->file, s->lineno,
+		       ll_index_to_name(s->ifindex));
+	if (s->rx)
+		len += snprintf(name + len, sizeof(name) - len,
+				" rx sci %016llx", ntohll(s->sci));
+	else
+		len += snprintf(name + len, sizeof(name) - len, " tx");
+	if (s->an != 0xff)
+		snprintf(name + len, sizeof(name) - len, " sa %u", s->an);
+	return name;
+}
+
+static int macsec_rotate_line(int argc, char **argv)
+{
+	if (matches(*argv, "add") == 0)
+		return do_modify(CMD_ADD, argc-1, argv+1);
+	if (matches(*argv, "set") == 0)
+		return do_modify(CMD_UPD, argc-1, argv+1);
+	if (matches(*argv, "delete") == 0)
+		return do_modify(CMD_DEL, argc-1, argv+1);
+
+	fprintf(stderr, "expected add, set or delete, not \"%s\"\n", *argv);
+	return -1;
+}
+
+static int macsec_rotate_send(struct macsec_rotate *r)
+{
+	struct rtnl_flush f;
+	unsigned int i;
+	int ret = -1;
+
+	if (rtnl_bulk_start(&r->bulk, &f) < 0)
+		return -1;
+
+	for (i = 0; i < r->count; i++) {
+		f.tag = i;
+		if (rtnl_flush_add(&f, (struct nlmsghdr *)(r->buf + r->sa[i].off),
+				   0) < 0) {
+			perror("Cannot talk to generic netlink");
+			goto out;
+		}
+	}
+
+	if (rtnl_flush_commit(&f) == -2) {
+		perror("Cannot talk to generic netlink");
+		goto out;
+	}
+
+	if (r->bulk.failed)
+		fprintf(stderr, "%u of %u requests failed\n",
+			r->bulk.failed, r->count);
+	else
+		ret = 0;
+	if (show_stats)
+		printf("%u requests, %.0f requests/s\n", r->count,
+		       rtnl_flush_rate(&f));
+
+out:
+	/* the requests carry keys */
+	memset(f.buf, 0, f.size);
+	rtnl_flush_close(&f);
+	return ret;
+}
+
+static int macsec_rotate_read(struct macsec_rotate *r)
+{
+	char *tok[MACSEC_ROTATE_MAX_ARGS];
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(&r->bulk);
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		int ntok;
+
+		r->lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, MACSEC_ROTATE_MAX_ARGS);
+		if (!ntok)
+			continue;
+		if (ntok > MACSEC_ROTATE_MAX_ARGS)
+			rtnl_bulk_line_error(&r->bulk, r->lineno,
+					     "too many words");
+		else if (macsec_rotate_line(ntok, tok))
+			rtnl_bulk_line_error(&r->bulk, r->lineno,
+					     "invalid SA");
+	}
+
+	rtnl_bulk_close(fp);
+	/* the lines carry keys */
+	if (line)
+		memset(line, 0, len);
+	free(line);
+	return r->bulk.failed ? -1 : 0;
+}
+
+static int do_rotate(int argc, char **argv)
+{
+	struct macsec_rotate r = {
+		.bulk = {
+			.protocol	= NETLINK_GENERIC,
+			.window		= MACSEC_ROTATE_WINDOW,
+			.genl		= true,
+			.name		= macsec_rotate_name,
+		},
+	};
+	int ret = -1;
+
+	if (argc != 2 || strcmp(*argv, "file") != 0)
+		ipmacsec_usage();
+	r.bulk.file = argv[1];
+
+	macsec_rotate = &r;
+	if (macsec_rotate_read(&r) == 0)
+		ret = macsec_rotate_send(&r);
+	else
+		fprintf(stderr, "%s: nothing was sent\n", r.bulk.file);
+	macsec_rotate = NULL;
+
+	if (r.buf)
+		memset(r.buf, 0, r.len);
+	free(r.buf);
+	free(r.sa);
+	return ret;
+}
+
 /* dump/show */
 static struct {
 	int ifindex;
@@ -1060,17 +1272,12 @@ static void print_rxsc_list(struct rtattr *sc, bool is_xpn)
 	close_json_array(PRINT_JSON, NULL);
 }
 
-static int process(struct nlmsghdr *n, void *arg)
+/* Parse one secy of the dump, returns 1 if the filter skips it */
+static int parse_dump(struct nlmsghdr *n, struct rtattr *attrs[],
+		      struct rtattr *attrs_secy[])
 {
 	struct genlmsghdr *ghdr;
-	struct rtattr *attrs[MACSEC_ATTR_MAX + 1];
-	struct rtattr *attrs_secy[MACSEC_SECY_ATTR_MAX + 1];
 	int len = n->nlmsg_len;
-	int ifindex;
-	__u64 sci;
-	__u8 encoding_sa;
-	__u64 cid;
-	bool is_xpn = false;
 
 	if (n->nlmsg_type != genl_family)
 		return -1;
@@ -1081,7 +1288,7 @@ static int process(struct nlmsghdr *n, void *arg)
 
 	ghdr = NLMSG_DATA(n);
 	if (ghdr->cmd != MACSEC_CMD_GET_TXSC)
-		return 0;
+		return 1;
 
 	parse_rtattr(attrs, MACSEC_ATTR_MAX, (void *) ghdr + GENL_HDRLEN, len);
 	if (!validate_dump(attrs)) {
@@ -1089,7 +1296,6 @@ static int process(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	ifindex = rta_getattr_u32(attrs[MACSEC_ATTR_IFINDEX]);
 	parse_rtattr_nested(attrs_secy, MACSEC_SECY_ATTR_MAX,
 			    attrs[MACSEC_ATTR_SECY]);
 
@@ -1098,14 +1304,34 @@ static int process(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	sci = rta_getattr_u64(attrs_secy[MACSEC_SECY_ATTR_SCI]);
-	encoding_sa = rta_getattr_u8(attrs_secy[MACSEC_SECY_ATTR_ENCODING_SA]);
+	if (filter.ifindex &&
+	    rta_getattr_u32(attrs[MACSEC_ATTR_IFINDEX]) != filter.ifindex)
+		return 1;
 
-	if (filter.ifindex && ifindex != filter.ifindex)
-		return 0;
+	if (filter.sci &&
+	    rta_getattr_u64(attrs_secy[MACSEC_SECY_ATTR_SCI]) != filter.sci)
+		return 1;
 
-	if (filter.sci && sci != filter.sci)
-		return 0;
+	return 0;
+}
+
+static int process(struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *attrs[MACSEC_ATTR_MAX + 1];
+	struct rtattr *attrs_secy[MACSEC_SECY_ATTR_MAX + 1];
+	int ifindex, ret;
+	__u64 sci;
+	__u8 encoding_sa;
+	__u64 cid;
+	bool is_xpn = false;
+
+	ret = parse_dump(n, attrs, attrs_secy);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	ifindex = rta_getattr_u32(attrs[MACSEC_ATTR_IFINDEX]);
+	sci = rta_getattr_u64(attrs_secy[MACSEC_SECY_ATTR_SCI]);
+	encoding_sa = rta_getattr_u8(attrs_secy[MACSEC_SECY_ATTR_ENCODING_SA]);
 
 	open_json_object(NULL);
 	print_uint(PRINT_ANY, "ifindex", "%u: ", ifindex);
@@ -1142,6 +1368,391 @@ static int process(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/*
+ * "ip macsec show [ DEV ] interval SECS": print the counters of every
+ * secy, TX/RX SC and SA as rates per second, and how far each SA is
+ * from running out of packet numbers. The previous values are kept
+ * in a hash by (ifindex, sci, an) and dropped once the object is gone.
+ */
+#define MACSEC_RATES_HASH	4096
+
+enum {
+	MACSEC_RATES_SECY,
+	MACSEC_RATES_TXSC,
+	MACSEC_RATES_RXSC,
+	MACSEC_RATES_TXSA,
+	MACSEC_RATES_RXSA,
+};
+
+struct macsec_prev {
+	struct hlist_node hash;
+	int ifindex;
+	__u64 sci;
+	__u8 an;
+	__u8 kind;
+	unsigned int gen;
+	__u64 pn;
+	__u64 val[NUM_MACSEC_RXSC_STATS_ATTR];	/* the largest set */
+};
+
+struct macsec_rates {
+	struct hlist_head hash[MACSEC_RATES_HASH];
+	unsigned int gen;
+	double secs;
+};
+
+static struct macsec_prev *macsec_prev_get(struct macsec_rates *mr,
+					   int ifindex, __u64 sci, __u8 an,
+					   __u8 kind, bool *have_prev)
+{
+	unsigned int h = ((unsigned int)ifindex * 31 +
+			  (__u32)(sci ^ (sci >> 32)) + an * 7 + kind) %
+			 MACSEC_RATES_HASH;
+	struct hlist_node *pos;
+	struct macsec_prev *p;
+
+	hlist_for_each(pos, &mr->hash[h]) {
+		p = container_of(pos, struct macsec_prev, hash);
+		if (p->ifindex == ifindex && p->sci == sci &&
+		    p->an == an && p->kind == kind) {
+			*have_prev = true;
+			p->gen = mr->gen;
+			return p;
+		}
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	p->ifindex = ifindex;
+	p->sci = sci;
+	p->an = an;
+	p->kind = kind;
+	p->gen = mr->gen;
+	hlist_add_head(&p->hash, &mr->hash[h]);
+
+	*have_prev = false;
+	return p;
+}
+
+/* Forget the objects which were not in the last dump */
+static void macsec_rates_sweep(struct macsec_rates *mr, bool all)
+{
+	struct hlist_node *pos, *n;
+	unsigned int i;
+
+	for (i = 0; i < MACSEC_RATES_HASH; i++) {
+		hlist_for_each_safe(pos, n, &mr->hash[i]) {
+			struct macsec_prev *p;
+
+			p = container_of(pos, struct macsec_prev, hash);
+			if (all || p->gen != mr->gen) {
+				hlist_del(&p->hash);
+				free(p);
+			}
+		}
+	}
+}
+
+static void print_rates(const char *prefix, const char *label,
+			const char *names[], unsigned int num,
+			struct rtattr *stats[], const __u64 *rate,
+			bool have_prev)
+{
+	unsigned int i;
+	int pad;
+
+	if (is_json_context()) {
+		for (i = 1; i < num; i++) {
+			if (!names[i] || !stats[i] || !have_prev)
+				continue;
+			print_u64(PRINT_JSON, names[i], NULL, rate[i]);
+		}
+		return;
+	}
+
+	printf("%s%s:", prefix, label);
+	for (i = 1; i < num; i++) {
+		if (!names[i])
+			continue;
+		printf(" %s", names[i]);
+	}
+
+	printf("\n%s%*s", prefix, (int)strlen(label) + 1, "");
+	for (i = 1; i < num; i++) {
+		if (!names[i])
+			continue;
+
+		pad = strlen(names[i]) + 1;
+		if (stats[i] && have_prev)
+			printf("%*llu", pad, rate[i]);
+		else
+			printf("%*c", pad, '-');
+	}
+	printf("\n");
+}
+
+/* Counters which went back (e.g. SA replaced) count from 0 */
+static __u64 macsec_rate(__u64 cur, __u64 prev, double secs)
+{
+	return (cur >= prev ? cur - prev : cur) / secs + 0.5;
+}
+
+static void macsec_rates_stats(struct macsec_rates *mr,
+			       struct macsec_prev *p, bool have_prev,
+			       const char *prefix, const char *label,
+			       const char *names[], unsigned int num,
+			       struct rtattr *attr)
+{
+	struct rtattr *stats[NUM_MACSEC_RXSC_STATS_ATTR] = {};
+	__u64 rate[NUM_MACSEC_RXSC_STATS_ATTR] = {};
+	unsigned int i;
+
+	if (!attr)
+		return;
+
+	parse_rtattr_nested(stats, num - 1, attr);
+	for (i = 1; i < num; i++) {
+		__u64 cur;
+
+		if (!stats[i])
+			continue;
+		cur = getattr_u64(stats[i]);
+		if (have_prev && mr->secs > 0)
+			rate[i] = macsec_rate(cur, p->val[i], mr->secs);
+		p->val[i] = cur;
+	}
+
+	if (mr->secs > 0)
+		print_rates(prefix, label, names, num, stats, rate, have_prev);
+}
+
+static const char *macsec_sprint_eta(double secs, char *buf, size_t len)
+{
+	if (secs >= 86400)
+		snprintf(buf, len, "%.1fd", secs / 86400);
+	else if (secs >= 3600)
+		snprintf(buf, len, "%.1fh", secs / 3600);
+	else if (secs >= 60)
+		snprintf(buf, len, "%.1fm", secs / 60);
+	else
+		snprintf(buf, len, "%.0fs", secs);
+	return buf;
+}
+
+/* PNs left before the SA must be replaced, and when that happens at the
+ * current rate.
+ */
+static void macsec_rates_pn(struct macsec_rates *mr, struct macsec_prev *p,
+			    bool have_prev, __u64 pn, bool is_xpn)
+{
+	__u64 limit = is_xpn ? ~0ULL : 0xffffffffULL;
+	__u64 headroom = pn < limit ? limit - pn : 0;
+	double pn_rate = 0;
+	SPRINT_BUF(b1);
+
+	if (have_prev && pn >= p->pn)
+		pn_rate = (pn - p->pn) / mr->secs;
+
+	print_lluint(PRINT_ANY, "pn", " PN %llu,", pn);
+	print_lluint(PRINT_ANY, "pn_headroom", " headroom %llu", headroom);
+	print_float(PRINT_ANY, "pn_headroom_pct", " (%.1f%%)",
+		    100.0 * headroom / limit);
+	if (!have_prev) {
+		print_string(PRINT_FP, NULL, "%s", "\n");
+		return;
+	}
+
+	print_float(PRINT_ANY, "pn_rate", ", %.0f PN/s", pn_rate);
+	if (pn_rate > 0) {
+		double eta = headroom / pn_rate;
+
+		print_float(PRINT_JSON, "pn_exhausted_secs", NULL, eta);
+		print_string(PRINT_FP, NULL, ", exhausted in %s",
+			     macsec_sprint_eta(eta, b1, sizeof(b1)));
+	}
+	print_string(PRINT_FP, NULL, "%s", "\n");
+}
+
+static void macsec_rates_sa_list(struct macsec_rates *mr, int ifindex,
+				 __u64 sci, bool tx, bool is_xpn,
+				 struct rtattr *sa)
+{
+	const char **names = tx ? txsa_stats_names : rxsa_stats_names;
+	__u8 kind = tx ? MACSEC_RATES_TXSA : MACSEC_RATES_RXSA;
+	struct rtattr *sa_attr[MACSEC_SA_ATTR_MAX + 1];
+	struct rtattr *a;
+	int rem;
+
+	if (mr->secs > 0)
+		open_json_array(PRINT_JSON, "sa_list");
+	rem = RTA_PAYLOAD(sa);
+	for (a = RTA_DATA(sa); RTA_OK(a, rem); a = RTA_NEXT(a, rem)) {
+		struct macsec_prev *p;
+		bool have_prev;
+		__u64 pn;
+		__u8 an;
+
+		parse_rtattr_nested(sa_attr, MACSEC_SA_ATTR_MAX, a);
+		an = rta_getattr_u8(sa_attr[MACSEC_SA_ATTR_AN]);
+		pn = is_xpn ? rta_getattr_u64(sa_attr[MACSEC_SA_ATTR_PN]) :
+			      rta_getattr_u32(sa_attr[MACSEC_SA_ATTR_PN]);
+
+		p = macsec_prev_get(mr, ifindex, sci, an, kind, &have_prev);
+		if (mr->secs > 0) {
+			open_json_object(NULL);
+			print_uint(PRINT_ANY, "an", "        %u:", an);
+			macsec_rates_pn(mr, p, have_prev, pn, is_xpn);
+		}
+		macsec_rates_stats(mr, p, have_prev, "        ", "rates",
+				   names, NUM_MACSEC_SA_STATS_ATTR,
+				   sa_attr[MACSEC_SA_ATTR_STATS]);
+		if (mr->secs > 0)
+			close_json_object();
+		p->pn = pn;
+	}
+	if (mr->secs > 0)
+		close_json_array(PRINT_JSON, NULL);
+}
+
+static int process_rates(struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *attrs[MACSEC_ATTR_MAX + 1];
+	struct rtattr *attrs_secy[MACSEC_SECY_ATTR_MAX + 1];
+	struct macsec_rates *mr = arg;
+	bool print = mr->secs > 0;
+	struct macsec_prev *p;
+	struct rtattr *c;
+	int ifindex, ret, rem;
+	bool is_xpn, have_prev;
+	__u64 sci;
+
+	ret = parse_dump(n, attrs, attrs_secy);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	ifindex = rta_getattr_u32(attrs[MACSEC_ATTR_IFINDEX]);
+	sci = rta_getattr_u64(attrs_secy[MACSEC_SECY_ATTR_SCI]);
+	is_xpn = ciphersuite_is_xpn(
+		rta_getattr_u64(attrs_secy[MACSEC_SECY_ATTR_CIPHER_SUITE]));
+
+	if (print) {
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "ifindex", "%u: ", ifindex);
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname",
+				   "%s: per second\n",
+				   ll_index_to_name(ifindex));
+		print_float(PRINT_JSON, "interval", NULL, mr->secs);
+	}
+
+	if (print)
+		open_json_object("secy");
+	p = macsec_prev_get(mr, ifindex, sci, 0xff, MACSEC_RATES_SECY,
+			    &have_prev);
+	macsec_rates_stats(mr, p, have_prev, "    ", "secy",
+			   secy_stats_names, NUM_MACSEC_SECY_STATS_ATTR,
+			   attrs[MACSEC_ATTR_SECY_STATS]);
+	if (print) {
+		close_json_object();
+		open_json_object("tx_sc");
+		print_0xhex(PRINT_ANY, "sci", "    TXSC: %016llx\n",
+			    ntohll(sci));
+	}
+	p = macsec_prev_get(mr, ifindex, sci, 0xff, MACSEC_RATES_TXSC,
+			    &have_prev);
+	macsec_rates_stats(mr, p, have_prev, "    ", "rates",
+			   txsc_stats_names, NUM_MACSEC_TXSC_STATS_ATTR,
+			   attrs[MACSEC_ATTR_TXSC_STATS]);
+	macsec_rates_sa_list(mr, ifindex, sci, true, is_xpn,
+			     attrs[MACSEC_ATTR_TXSA_LIST]);
+	if (print) {
+		close_json_object();
+		open_json_array(PRINT_JSON, "rx_sc");
+	}
+
+	rem = attrs[MACSEC_ATTR_RXSC_LIST] ?
+	      RTA_PAYLOAD(attrs[MACSEC_ATTR_RXSC_LIST]) : 0;
+	for (c = rem ? RTA_DATA(attrs[MACSEC_ATTR_RXSC_LIST]) : NULL;
+	     rem && RTA_OK(c, rem); c = RTA_NEXT(c, rem)) {
+		struct rtattr *sc_attr[MACSEC_RXSC_ATTR_MAX + 1];
+		__u64 rxsci;
+
+		parse_rtattr_nested(sc_attr, MACSEC_RXSC_ATTR_MAX, c);
+		rxsci = rta_getattr_u64(sc_attr[MACSEC_RXSC_ATTR_SCI]);
+		if (print) {
+			open_json_object(NULL);
+			print_0xhex(PRINT_ANY, "sci", "    RXSC: %016llx\n",
+				    ntohll(rxsci));
+		}
+		p = macsec_prev_get(mr, ifindex, rxsci, 0xff,
+				    MACSEC_RATES_RXSC, &have_prev);
+		macsec_rates_stats(mr, p, have_prev, "    ", "rates",
+				   rxsc_stats_names, NUM_MACSEC_RXSC_STATS_ATTR,
+				   sc_attr[MACSEC_RXSC_ATTR_STATS]);
+		macsec_rates_sa_list(mr, ifindex, rxsci, false, is_xpn,
+				     sc_attr[MACSEC_RXSC_ATTR_SA_LIST]);
+		if (print)
+			close_json_object();
+	}
+
+	if (print) {
+		close_json_array(PRINT_JSON, NULL);
+		close_json_object();
+	}
+	return 0;
+}
+
+static int do_dump_rates(int ifindex, unsigned int interval)
+{
+	struct macsec_rates *mr;
+	double next, now, last = 0;
+
+	mr = calloc(1, sizeof(*mr));
+	if (!mr) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	memset(&filter, 0, sizeof(filter));
+	filter.ifindex = ifindex;
+
+	new_json_obj(json);
+	next = monotonic_now();
+	for (;;) {
+		MACSEC_GENL_REQ(req, MACSEC_BUFLEN, MACSEC_CMD_GET_TXSC,
+				NLM_F_REQUEST | NLM_F_DUMP);
+
+		now = monotonic_now();
+		if (last)
+			mr->secs = now - last;
+		last = now;
+		mr->gen++;
+
+		req.n.nlmsg_seq = genl_rth.dump = ++genl_rth.seq;
+		if (rtnl_send(&genl_rth, &req, req.n.nlmsg_len) < 0) {
+			perror("Failed to send dump request");
+			break;
+		}
+		if (rtnl_dump_filter(&genl_rth, process_rates, mr) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			break;
+		}
+		macsec_rates_sweep(mr, false);
+		if (mr->secs > 0 && !json)
+			fputc('\n', stdout);
+		fflush(stdout);
+		next += interval;
+		monotonic_sleep_until(next);
+	}
+	delete_json_obj();
+
+	macsec_rates_sweep(mr, true);
+	free(mr);
+	return -1;
+}
+
 static int do_dump(int ifindex)
 {
 	MACSEC_GENL_REQ(req, MACSEC_BUFLEN, MACSEC_CMD_GET_TXSC,
@@ -1169,18 +1780,25 @@ static int do_dump(int ifindex)
 
 static int do_show(int argc, char **argv)
 {
-	int ifindex;
+	unsigned int interval = 0;
+	int ifindex = 0;
 
-	if (argc == 0)
-		return do_dump(0);
+	if (argc && strcmp(*argv, "interval") != 0) {
+		ifindex = ll_name_to_index(*argv);
+		if (ifindex == 0) {
+			fprintf(stderr, "Device \"%s\" does not exist.\n",
+				*argv);
+			return -1;
+		}
+		argc--, argv++;
+	}
 
-	ifindex = ll_name_to_index(*argv);
-	if (ifindex == 0) {
-		fprintf(stderr, "Device \"%s\" does not exist.\n", *argv);
-		return -1;
+	if (argc == 2 && strcmp(*argv, "interval") == 0) {
+		if (get_unsigned(&interval, argv[1], 0) || !interval)
+			invarg("\"interval\" value is invalid\n", argv[1]);
+		return do_dump_rates(ifindex, interval);
 	}
 
-	argc--, argv++;
 	if (argc == 0)
 		return do_dump(ifindex);
 
@@ -1210,6 +1828,8 @@ int do_ipmacsec(int argc, char **argv)
 		return do_modify(CMD_DEL, argc-1, argv+1);
 	if (matches(*argv, "offload") == 0)
 		return do_offload(CMD_OFFLOAD, argc-1, argv+1);
+	if (matches(*argv, "rotate") == 0)
+		return do_rotate(argc-1, argv+1);
 
 	fprintf(stderr, "Command \"%s\" is unknown, try \"ip macsec help\".\n",
 		*argv);
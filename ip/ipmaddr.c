@@ -27,6 +27,7 @@
 
 static struct {
 	char *dev;
+	int  ifindex;
 	int  family;
 } filter;
 
@@ -59,99 +60,174 @@ static int parse_hex(char *str, unsigned char *addr, size_t size)
 }
 
 struct ma_info {
-	struct ma_info *next;
 	int		index;
 	int		users;
-	char		*features;
+	int		hnext;	/* next in the hash chain, -1 at the end */
+	unsigned int	seq;	/* keeps the order of equal indexes */
+	const char	*features;
 	char		name[IFNAMSIZ];
 	inet_prefix	addr;
 };
 
-static void maddr_ins(struct ma_info **lst, struct ma_info *m)
+/* The groups of all sources, deduplicated through a hash on
+ * (index, family, address) and sorted by index once complete.
+ */
+#define MA_HASH_SIZE	4096
+
+struct ma_list {
+	struct ma_info	*v;
+	unsigned int	n, size;
+	int		hash[MA_HASH_SIZE];
+};
+
+static unsigned int maddr_hash(const struct ma_info *m)
+{
+	unsigned int h = m->index * 31 + m->addr.family;
+	int i;
+
+	for (i = 0; i < m->addr.bytelen; i++)
+		h = h * 33 + ((unsigned char *)m->addr.data)[i];
+	return h % MA_HASH_SIZE;
+}
+
+static int maddr_ins(struct ma_list *lst, const struct ma_info *m)
 {
+	unsigned int h = maddr_hash(m);
 	struct ma_info *mp;
+	int i;
+
+	for (i = lst->hash[h]; i >= 0; i = mp->hnext) {
+		mp = &lst->v[i];
+		if (mp->index == m->index &&
+		    mp->addr.family == m->addr.family &&
+		    mp->addr.bytelen == m->addr.bytelen &&
+		    !memcmp(mp->addr.data, m->addr.data, m->addr.bytelen)) {
+			if (m->users > mp->users)
+				mp->users = m->users;
+			return 0;
+		}
+	}
 
-	for (; (mp = *lst) != NULL; lst = &mp->next) {
-		if (mp->index > m->index)
-			break;
+	if (lst->n == lst->size) {
+		unsigned int size = lst->size ? 2 * lst->size : 256;
+
+		mp = realloc(lst->v, size * sizeof(*mp));
+		if (!mp)
+			return -1;
+		lst->v = mp;
+		lst->size = size;
 	}
-	m->next = *lst;
-	*lst = m;
+
+	mp = &lst->v[lst->n];
+	*mp = *m;
+	mp->seq = lst->n;
+	mp->hnext = lst->hash[h];
+	lst->hash[h] = lst->n++;
+	return 0;
 }
 
-static void maddr_clear(struct ma_info *lst)
+static int maddr_cmp(const void *a, const void *b)
 {
-	struct ma_info *mp;
+	const struct ma_info *x = a, *y = b;
+
+	if (x->index != y->index)
+		return x->index < y->index ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
 
-	while ((mp = lst) != NULL) {
-		lst = mp->next;
-		free(mp);
+/* Read all of a /proc file in one go, NULL if it can't be read */
+static char *maddr_read_file(const char *path)
+{
+	size_t len = 0, size = 64 * 1024;
+	char *buf = NULL, *nbuf;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	for (;;) {
+		nbuf = realloc(buf, size + 1);
+		if (!nbuf)
+			goto err;
+		buf = nbuf;
+
+		n = read(fd, buf + len, size - len);
+		if (n < 0)
+			goto err;
+		if (n == 0)
+			break;
+		len += n;
+		if (len == size)
+			size *= 2;
 	}
+	close(fd);
+	buf[len] = '\0';
+	return buf;
+
+err:
+	close(fd);
+	free(buf);
+	return NULL;
 }
 
-static void read_dev_mcast(struct ma_info **result_p)
+static void read_dev_mcast(struct ma_list *result)
 {
-	char buf[256];
-	FILE *fp = fopen("/proc/net/dev_mcast", "r");
+	char *buf = maddr_read_file("/proc/net/dev_mcast");
+	char *line, *save = NULL;
 
-	if (!fp)
+	if (!buf)
 		return;
 
-	while (fgets(buf, sizeof(buf), fp)) {
+	for (line = strtok_r(buf, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
 		char hexa[256];
 		struct ma_info m = { .addr.family = AF_PACKET };
 		int len;
 		int st;
 
-		sscanf(buf, "%d%s%d%d%s", &m.index, m.name, &m.users, &st,
-		       hexa);
+		if (sscanf(line, "%d%15s%d%d%255s", &m.index, m.name, &m.users,
+			   &st, hexa) != 5)
+			continue;
 		if (filter.dev && strcmp(filter.dev, m.name))
 			continue;
 
 		len = parse_hex(hexa, (unsigned char *)&m.addr.data, sizeof(m.addr.data));
 		if (len >= 0) {
-			struct ma_info *ma = malloc(sizeof(m));
-
-			if (ma == NULL)
-				break;
-			memcpy(ma, &m, sizeof(m));
-			ma->addr.bytelen = len;
-			ma->addr.bitlen = len<<3;
+			m.addr.bytelen = len;
+			m.addr.bitlen = len<<3;
 			if (st)
-				ma->features = "static";
-			maddr_ins(result_p, ma);
+				m.features = "static";
+			if (maddr_ins(result, &m))
+				break;
 		}
 	}
-	fclose(fp);
+	free(buf);
 }
 
-static void read_igmp(struct ma_info **result_p)
+static void read_igmp(struct ma_list *result)
 {
 	struct ma_info m = {
 		.addr.family = AF_INET,
 		.addr.bitlen = 32,
 		.addr.bytelen = 4,
 	};
-	char buf[256];
-	FILE *fp = fopen("/proc/net/igmp", "r");
+	char *buf = maddr_read_file("/proc/net/igmp");
+	char *line, *save = NULL;
 
-	if (!fp)
-		return;
-	if (!fgets(buf, sizeof(buf), fp)) {
-		fclose(fp);
+	if (!buf)
 		return;
-	}
-
-	while (fgets(buf, sizeof(buf), fp)) {
-		struct ma_info *ma;
 
-		if (buf[0] != '\t') {
+	/* the first line is the header */
+	line = strtok_r(buf, "\n", &save);
+	while ((line = strtok_r(NULL, "\n", &save)) != NULL) {
+		if (line[0] != '\t') {
 			size_t len;
 
-			sscanf(buf, "%d%s", &m.index, m.name);
-			len = strlen(m.name);
-			if (len == 0)
+			if (sscanf(line, "%d%15s", &m.index, m.name) != 2)
 				continue;
+			len = strlen(m.name);
 			if (m.name[len - 1] == ':')
 				m.name[len - 1] = '\0';
 			continue;
@@ -160,51 +236,109 @@ static void read_igmp(struct ma_info **result_p)
 		if (filter.dev && strcmp(filter.dev, m.name))
 			continue;
 
-		sscanf(buf, "%08x%d", (__u32 *)&m.addr.data, &m.users);
+		if (sscanf(line, "%08x%d", (__u32 *)&m.addr.data, &m.users) != 2)
+			continue;
 
-		ma = malloc(sizeof(m));
-		if (ma == NULL)
+		if (maddr_ins(result, &m))
 			break;
-
-		memcpy(ma, &m, sizeof(m));
-		maddr_ins(result_p, ma);
 	}
-	fclose(fp);
+	free(buf);
 }
 
 
-static void read_igmp6(struct ma_info **result_p)
+static void read_igmp6(struct ma_list *result)
 {
-	char buf[256];
-	FILE *fp = fopen("/proc/net/igmp6", "r");
+	char *buf = maddr_read_file("/proc/net/igmp6");
+	char *line, *save = NULL;
 
-	if (!fp)
+	if (!buf)
 		return;
 
-	while (fgets(buf, sizeof(buf), fp)) {
+	for (line = strtok_r(buf, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
 		char hexa[256];
 		struct ma_info m = { .addr.family = AF_INET6 };
 		int len;
 
-		sscanf(buf, "%d%s%s%d", &m.index, m.name, hexa, &m.users);
+		if (sscanf(line, "%d%15s%255s%d", &m.index, m.name, hexa,
+			   &m.users) != 4)
+			continue;
 
 		if (filter.dev && strcmp(filter.dev, m.name))
 			continue;
 
 		len = parse_hex(hexa, (unsigned char *)&m.addr.data, sizeof(m.addr.data));
 		if (len >= 0) {
-			struct ma_info *ma = malloc(sizeof(m));
-
-			if (ma == NULL)
+			m.addr.bytelen = len;
+			m.addr.bitlen = len<<3;
+			if (maddr_ins(result, &m))
 				break;
-
-			memcpy(ma, &m, sizeof(m));
-			ma->addr.bytelen = len;
-			ma->addr.bitlen = len<<3;
-			maddr_ins(result_p, ma);
 		}
 	}
-	fclose(fp);
+	free(buf);
+}
+
+/* Kernels which dump the groups of a family with RTM_GETMULTICAST do not
+ * report how many users a group has, so those are listed with one.
+ */
+static int maddr_nlmsg(struct nlmsghdr *n, void *arg)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+	struct rtattr *tb[IFA_MAX + 1];
+	struct ma_list *result = arg;
+	struct ma_info m = {
+		.addr.family = ifa->ifa_family,
+		.index = ifa->ifa_index,
+		.users = 1,
+	};
+
+	/* dumps come as RTM_GETMULTICAST */
+	if ((n->nlmsg_type != RTM_GETMULTICAST &&
+	     n->nlmsg_type != RTM_NEWMULTICAST) || len < 0)
+		return 0;
+
+	if (filter.ifindex && filter.ifindex != ifa->ifa_index)
+		return 0;
+
+	parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), len);
+	if (!tb[IFA_MULTICAST] ||
+	    RTA_PAYLOAD(tb[IFA_MULTICAST]) > sizeof(m.addr.data))
+		return 0;
+
+	strlcpy(m.name, ll_index_to_name(ifa->ifa_index), sizeof(m.name));
+
+	m.addr.bytelen = RTA_PAYLOAD(tb[IFA_MULTICAST]);
+	m.addr.bitlen = m.addr.bytelen << 3;
+	memcpy(m.addr.data, RTA_DATA(tb[IFA_MULTICAST]), m.addr.bytelen);
+
+	return maddr_ins(result, &m);
+}
+
+static int read_nl_mcast(struct ma_list *result, int family)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifaddrmsg ifa;
+	} req = {
+		.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg)),
+		.nlh.nlmsg_type = RTM_GETMULTICAST,
+		.nlh.nlmsg_flags = NLM_F_DUMP | NLM_F_REQUEST,
+		.nlh.nlmsg_seq = rth.dump = ++rth.seq,
+		.ifa.ifa_family = family,
+	};
+	int ret;
+
+	if (rtnl_send(&rth, &req, sizeof(req)) < 0)
+		return -1;
+
+	/* Older kernels refuse the dump and /proc is read instead; groups
+	 * a failed dump added are merged with those from /proc.
+	 */
+	rth.flags |= RTNL_HANDLE_F_SUPPRESS_NLERR;
+	ret = rtnl_dump_filter(&rth, maddr_nlmsg, result);
+	rth.flags &= ~RTNL_HANDLE_F_SUPPRESS_NLERR;
+	return ret;
 }
 
 static void print_maddr(FILE *fp, struct ma_info *list)
@@ -238,12 +372,14 @@ static void print_maddr(FILE *fp, struct ma_info *list)
 	close_json_object();
 }
 
-static void print_mlist(FILE *fp, struct ma_info *list)
+static void print_mlist(FILE *fp, struct ma_list *lst)
 {
 	int cur_index = 0;
+	unsigned int i;
 
 	new_json_obj(json);
-	for (; list; list = list->next) {
+	for (i = 0; i < lst->n; i++) {
+		struct ma_info *list = &lst->v[i];
 
 		if (list->index != cur_index || oneline) {
 			if (cur_index) {
@@ -273,7 +409,7 @@ static void print_mlist(FILE *fp, struct ma_info *list)
 
 static int multiaddr_list(int argc, char **argv)
 {
-	struct ma_info *list = NULL;
+	struct ma_list *list;
 
 	if (!filter.family)
 		filter.family = preferred_family;
@@ -291,14 +427,35 @@ static int multiaddr_list(int argc, char **argv)
 		argv++; argc--;
 	}
 
+	list = malloc(sizeof(*list));
+	if (!list) {
+		fprintf(stderr, "Not enough memory\n");
+		return -1;
+	}
+	memset(list, 0, sizeof(*list));
+	memset(list->hash, -1, sizeof(list->hash));
+
+	ll_init_map(&rth);
+	if (filter.dev) {
+		filter.ifindex = ll_name_to_index(filter.dev);
+		/* nothing to list, as from /proc */
+		if (!filter.ifindex)
+			filter.ifindex = -1;
+	}
+
 	if (!filter.family || filter.family == AF_PACKET)
-		read_dev_mcast(&list);
-	if (!filter.family || filter.family == AF_INET)
-		read_igmp(&list);
-	if (!filter.family || filter.family == AF_INET6)
-		read_igmp6(&list);
+		read_dev_mcast(list);
+	if ((!filter.family || filter.family == AF_INET) &&
+	    read_nl_mcast(list, AF_INET) < 0)
+		read_igmp(list);
+	if ((!filter.family || filter.family == AF_INET6) &&
+	    read_nl_mcast(list, AF_INET6) < 0)
+		read_igmp6(list);
+
+	qsort(list->v, list->n, sizeof(*list->v), maddr_cmp);
 	print_mlist(stdout, list);
-	maddr_clear(list);
+	free(list->v);
+	free(list);
 	return 0;
 }
 
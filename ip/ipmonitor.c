@@ -10,6 +10,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -19,21 +24,30 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "nh_common.h"
+#include "rtnl_ring.h"
+#include "namespace.h"
+#include "ll_map.h"
+#include "list.h"
 
 static void usage(void) __attribute__((noreturn));
 static int prefix_banner;
 int listen_all_nsid;
 struct rtnl_ctrl_data *ctrl_data;
 int do_monitor;
+static const struct timespec *replay_ts;
+static const char *cur_netns;
 
 static void usage(void)
 {
 	fprintf(stderr,
-		"Usage: ip monitor [ all | OBJECTS ] [ FILE ] [ label ] [ all-nsid ]\n"
-		"                  [ dev DEVICE ]\n"
+		"Usage: ip monitor [ all | OBJECTS ] [ FILE | CAPTURE ] [ label ]\n"
+		"                  [ all-nsid ] [ dev DEVICE ] [ netns { NAME | all } ]...\n"
+		"                  [ coalesce [ MSECS ] ]\n"
 		"OBJECTS :=  address | link | mroute | maddress | acaddress | neigh |\n"
 		"            netconf | nexthop | nsid | prefix | route | rule | stats\n"
-		"FILE := file FILENAME\n");
+		"FILE := file FILENAME [ since TIME ] [ until TIME ]\n"
+		"CAPTURE := capture FILENAME [ size SIZE ] [ keep SECS ]\n"
+		"TIME := { [YYYY-MM-DD{T| }]HH:MM[:SS] | @SECONDS }\n");
 	exit(-1);
 }
 
@@ -42,8 +56,19 @@ void print_headers(FILE *fp, const char *label)
 	if (!do_monitor)
 		return;
 
-	if (timestamp)
+	if (timestamp && replay_ts) {
+		struct timeval tv = {
+			.tv_sec = replay_ts->tv_sec,
+			.tv_usec = replay_ts->tv_nsec / 1000,
+		};
+
+		print_timestamp_tv(fp, &tv);
+	} else if (timestamp) {
 		print_timestamp(fp);
+	}
+
+	if (cur_netns)
+		fprintf(fp, "[netns %s]", cur_netns);
 
 	if (listen_all_nsid) {
 		if (ctrl_data == NULL || ctrl_data->nsid < 0)
@@ -191,12 +216,884 @@ static int accept_msg(struct rtnl_ctrl_data *ctrl,
 
 #define IPMON_L_ALL		(~0)
 
+#define IPMON_CAPTURE_SIZE	(64ULL << 20)
+#define IPMON_CAPTURE_RCVBUF	(32 << 20)
+#define IPMON_BATCH_VLEN	64
+#define IPMON_BATCH_SLOT	32768
+
+/*
+ * The objects a message belongs to, matching the groups it would have
+ * been received on, for filtering a capture when it is replayed.
+ */
+static unsigned int ipmon_msg_mask(const struct nlmsghdr *n)
+{
+	/* all the families filtered on are the first byte of the header */
+	int family = NLMSG_PAYLOAD(n, 0) ? *(__u8 *)NLMSG_DATA(n) : AF_UNSPEC;
+	unsigned int mask;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		return IPMON_LLINK;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		mask = IPMON_LADDR;
+		break;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		mask = IPMON_LROUTE;
+		if (family == RTNL_FAMILY_IPMR) {
+			family = AF_INET;
+			mask = IPMON_LMROUTE;
+		} else if (family == RTNL_FAMILY_IP6MR) {
+			family = AF_INET6;
+			mask = IPMON_LMROUTE;
+		}
+		break;
+	case RTM_NEWNEXTHOP:
+	case RTM_DELNEXTHOP:
+	case RTM_NEWNEXTHOPBUCKET:
+	case RTM_DELNEXTHOPBUCKET:
+		return IPMON_LNEXTHOP;
+	case RTM_NEWNEIGH:
+	case RTM_DELNEIGH:
+	case RTM_GETNEIGH:
+		return IPMON_LNEIGH;
+	case RTM_NEWPREFIX:
+		return IPMON_LPREFIX;
+	case RTM_NEWRULE:
+	case RTM_DELRULE:
+		mask = IPMON_LRULE;
+		break;
+	case RTM_NEWNETCONF:
+	case RTM_DELNETCONF:
+		mask = IPMON_LNETCONF;
+		break;
+	case RTM_NEWNSID:
+	case RTM_DELNSID:
+		return IPMON_LNSID;
+	case RTM_NEWSTATS:
+		return IPMON_LSTATS;
+	case RTM_NEWMULTICAST:
+	case RTM_DELMULTICAST:
+		mask = IPMON_LMADDR;
+		break;
+	case RTM_NEWANYCAST:
+	case RTM_DELANYCAST:
+		mask = IPMON_LACADDR;
+		break;
+	default:
+		return IPMON_L_ALL;
+	}
+
+	if (preferred_family && family != preferred_family)
+		return 0;
+	return mask;
+}
+
+struct ipmon_replay {
+	unsigned int	lmask;
+	FILE		*fp;
+};
+
+static int replay_msg(const struct timespec *ts, int nsid,
+		      struct nlmsghdr *n, void *arg)
+{
+	struct ipmon_replay *r = arg;
+	struct rtnl_ctrl_data ctrl = { .nsid = nsid };
+	int err;
+
+	if (!(ipmon_msg_mask(n) & r->lmask)) {
+		/* still learn the names the events shown refer to */
+		if (n->nlmsg_type == RTM_NEWLINK ||
+		    n->nlmsg_type == RTM_DELLINK)
+			ll_remember_index(n, NULL);
+		return 0;
+	}
+
+	replay_ts = ts;
+	err = accept_msg(&ctrl, n, r->fp);
+	replay_ts = NULL;
+	return err;
+}
+
+/*
+ * A local time, of today when there is no date, or seconds since the
+ * epoch after an '@'.
+ */
+static int get_replay_time(struct timespec *ts, const char *arg)
+{
+	static const char * const fmts[] = {
+		"%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%dT%H:%M", "%Y-%m-%d %H:%M", "%H:%M:%S", "%H:%M",
+	};
+	time_t now = time(NULL);
+	unsigned int i;
+	struct tm tm;
+	__u64 secs;
+
+	if (arg[0] == '@') {
+		if (get_u64(&secs, arg + 1, 10))
+			return -1;
+		ts->tv_sec = secs;
+		ts->tv_nsec = 0;
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(fmts); i++) {
+		const char *end;
+
+		localtime_r(&now, &tm);
+		tm.tm_sec = 0;
+		end = strptime(arg, fmts[i], &tm);
+		if (!end || *end)
+			continue;
+		tm.tm_isdst = -1;
+		ts->tv_sec = mktime(&tm);
+		ts->tv_nsec = 0;
+		return ts->tv_sec == (time_t)-1 ? -1 : 0;
+	}
+	return -1;
+}
+
+static int ipmon_replay(struct rtnl_ring *ring, unsigned int lmask,
+			const struct timespec *since,
+			const struct timespec *until)
+{
+	struct ipmon_replay r = { .lmask = lmask, .fp = stdout };
+	struct rtnl_ring_stats stats;
+	int err;
+
+	if (rtnl_ring_flags(ring) & RTNL_RING_F_ALL_NSID)
+		listen_all_nsid = 1;
+
+	/* the index lets the walk start near since instead of the tail */
+	err = rtnl_ring_walk_range(ring, since, until, replay_msg, &r);
+	fflush(stdout);
+
+	rtnl_ring_stats(ring, &stats);
+	if (stats.lost || stats.overruns)
+		fprintf(stderr,
+			"%llu messages overwritten, %llu socket overruns while capturing\n",
+			stats.lost, stats.overruns);
+	rtnl_ring_close(ring);
+	return err;
+}
+
+struct ipmon_capture {
+	struct rtnl_ring	*ring;
+	struct timespec		ts;
+};
+
+static volatile sig_atomic_t capture_stop;
+
+static void capture_sig(int sig)
+{
+	capture_stop = 1;
+}
+
+static int capture_msg(struct rtnl_ctrl_data *ctrl,
+		       struct nlmsghdr *n, void *arg)
+{
+	struct ipmon_capture *c = arg;
+
+	if (rtnl_ring_put(c->ring, &c->ts, ctrl ? ctrl->nsid : -1, n) < 0)
+		fprintf(stderr, "Message of %u bytes does not fit the ring\n",
+			n->nlmsg_len);
+	return 0;
+}
+
+static int capture_dump_msg(struct nlmsghdr *n, void *arg)
+{
+	return capture_msg(NULL, n, arg);
+}
+
+/*
+ * Record notifications into a ring file until interrupted. Links are
+ * dumped first, from another socket so that no notification is missed
+ * meanwhile, for replay to have their names. Every wakeup drains the
+ * socket with as few recvmmsg() calls as it takes.
+ */
+static int ipmon_capture(const char *file, __u64 size, unsigned int keep)
+{
+	struct sigaction sa = { .sa_handler = capture_sig };
+	struct ipmon_capture c = {};
+	struct rtnl_ring_stats stats;
+	struct rtnl_handle drth;
+	struct rtnl_batch b;
+	int size_rcv = rcvbuf;
+	int err = 0;
+
+	c.ring = rtnl_ring_create(file, size,
+				  listen_all_nsid ? RTNL_RING_F_ALL_NSID : 0);
+	if (!c.ring) {
+		fprintf(stderr, "Cannot create ring file \"%s\": %s\n",
+			file, strerror(errno));
+		return -1;
+	}
+	rtnl_ring_set_max_age(c.ring, keep);
+
+	if (size_rcv < IPMON_CAPTURE_RCVBUF)
+		size_rcv = IPMON_CAPTURE_RCVBUF;
+	setsockopt(rth.fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		   &size_rcv, sizeof(size_rcv));
+
+	if (rtnl_batch_init(&b, IPMON_BATCH_VLEN, IPMON_BATCH_SLOT)) {
+		perror("Cannot allocate receive buffers");
+		rtnl_ring_close(c.ring);
+		return -1;
+	}
+
+	if (rtnl_open(&drth, 0) == 0) {
+		clock_gettime(CLOCK_REALTIME, &c.ts);
+		if (rtnl_linkdump_req(&drth, AF_UNSPEC) < 0 ||
+		    rtnl_dump_filter(&drth, capture_dump_msg, &c) < 0)
+			fprintf(stderr, "Cannot dump links, capturing without\n");
+		rtnl_close(&drth);
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!capture_stop) {
+		struct pollfd pfd = { .fd = rth.fd, .events = POLLIN };
+		int n;
+
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			err = -1;
+			break;
+		}
+
+		do {
+			n = rtnl_listen_batch(&rth, &b, &c.ts, capture_msg, &c);
+			if (n < 0 && errno == ENOBUFS) {
+				rtnl_ring_overrun(c.ring);
+				n = 1;
+			}
+		} while (n > 0 && !capture_stop);
+
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			err = -1;
+			break;
+		}
+	}
+
+	rtnl_ring_stats(c.ring, &stats);
+	fprintf(stderr,
+		"%llu messages captured, %llu overwritten, %llu socket overruns\n",
+		stats.records, stats.lost, stats.overruns);
+
+	rtnl_batch_free(&b);
+	rtnl_ring_close(c.ring);
+	return err;
+}
+
+/*
+ * Route notifications coalesced over a window: every RTM_NEWROUTE and
+ * RTM_DELROUTE is folded into an entry per route, and only the net
+ * change of each is printed when the window closes. Routes that came
+ * and went, or went and came back the same, are only counted. A route
+ * known to have existed when the window opened, because it was deleted
+ * or replaced, and still existing at the end with other attributes is
+ * printed as the deletion of the old one and the new one.
+ */
+#define IPMON_COALESCE_HASH	16384
+
+struct ipmon_route_key {
+	int		nsid;
+	__u32		table;
+	__u32		priority;
+	__u8		family;
+	__u8		dst_len;
+	__u8		tos;
+	__u8		dst[16];
+};
+
+struct ipmon_route {
+	struct hlist_node	hash;
+	struct list_head	list;
+	struct ipmon_route_key	key;
+	/* the deletion that opened the window, for the old attributes */
+	struct nlmsghdr		*first;
+	struct nlmsghdr		*last;
+	unsigned int		events;
+	bool			existed;
+};
+
+struct ipmon_coalesce {
+	struct hlist_head	hash[IPMON_COALESCE_HASH];
+	struct list_head	routes;
+	unsigned int		window;
+	unsigned int		events;
+	unsigned int		prefixes;
+	unsigned int		overruns;
+	bool			open;
+	double			deadline;
+};
+
+static int ipmon_route_key(const struct nlmsghdr *n, int nsid,
+			   struct ipmon_route_key *key)
+{
+	const struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX+1];
+
+	if (len < 0)
+		return -1;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	memset(key, 0, sizeof(*key));
+	key->nsid = nsid;
+	key->family = r->rtm_family;
+	key->dst_len = r->rtm_dst_len;
+	key->tos = r->rtm_tos;
+	key->table = rtm_get_table((struct rtmsg *)r, tb);
+	if (tb[RTA_PRIORITY])
+		key->priority = rta_getattr_u32(tb[RTA_PRIORITY]);
+	if (tb[RTA_DST]) {
+		len = RTA_PAYLOAD(tb[RTA_DST]);
+		memcpy(key->dst, RTA_DATA(tb[RTA_DST]),
+		       len < sizeof(key->dst) ? len : sizeof(key->dst));
+	}
+	return 0;
+}
+
+static unsigned int ipmon_route_hash(const struct ipmon_route_key *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	__u32 h = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h % IPMON_COALESCE_HASH;
+}
+
+static struct nlmsghdr *ipmon_msg_dup(struct nlmsghdr *old,
+				      const struct nlmsghdr *n)
+{
+	struct nlmsghdr *m = realloc(old, n->nlmsg_len);
+
+	if (!m) {
+		free(old);
+		return NULL;
+	}
+	memcpy(m, n, n->nlmsg_len);
+	return m;
+}
+
+static int ipmon_coalesce_route(struct ipmon_coalesce *c, int nsid,
+				const struct nlmsghdr *n)
+{
+	struct ipmon_route_key key;
+	struct ipmon_route *rt;
+	struct hlist_head *head;
+	struct hlist_node *pos;
+
+	if (ipmon_route_key(n, nsid, &key) < 0)
+		return -1;
+
+	head = &c->hash[ipmon_route_hash(&key)];
+	hlist_for_each(pos, head) {
+		rt = container_of(pos, struct ipmon_route, hash);
+		if (!memcmp(&rt->key, &key, sizeof(key)))
+			goto found;
+	}
+
+	rt = calloc(1, sizeof(*rt));
+	if (!rt)
+		return -1;
+	rt->key = key;
+	rt->existed = n->nlmsg_type == RTM_DELROUTE ||
+		      n->nlmsg_flags & NLM_F_REPLACE;
+	if (n->nlmsg_type == RTM_DELROUTE) {
+		rt->first = ipmon_msg_dup(NULL, n);
+		if (!rt->first) {
+			free(rt);
+			return -1;
+		}
+	}
+	hlist_add_head(&rt->hash, head);
+	list_add_tail(&rt->list, &c->routes);
+	c->prefixes++;
+found:
+	rt->last = ipmon_msg_dup(rt->last, n);
+	if (!rt->last)
+		return -1;
+	rt->events++;
+	c->events++;
+	return 0;
+}
+
+static void ipmon_print_route(struct nlmsghdr *n, int nsid)
+{
+	struct rtnl_ctrl_data ctrl = { .nsid = nsid };
+
+	ctrl_data = &ctrl;
+	print_route(n, stdout);
+	ctrl_data = NULL;
+}
+
+static void ipmon_coalesce_flush(struct ipmon_coalesce *c)
+{
+	unsigned int added = 0, deleted = 0, changed = 0, flapped = 0;
+	struct ipmon_route *rt, *tmp;
+
+	list_for_each_entry_safe(rt, tmp, &c->routes, list) {
+		bool exists = rt->last->nlmsg_type == RTM_NEWROUTE;
+
+		if (!rt->existed && !exists) {
+			flapped++;
+		} else if (!rt->existed) {
+			ipmon_print_route(rt->last, rt->key.nsid);
+			added++;
+		} else if (!exists) {
+			ipmon_print_route(rt->last, rt->key.nsid);
+			deleted++;
+		} else if (rt->first &&
+			   rt->first->nlmsg_len == rt->last->nlmsg_len &&
+			   !memcmp(NLMSG_DATA(rt->first), NLMSG_DATA(rt->last),
+				   NLMSG_PAYLOAD(rt->last, 0))) {
+			flapped++;
+		} else {
+			if (rt->first)
+				ipmon_print_route(rt->first, rt->key.nsid);
+			ipmon_print_route(rt->last, rt->key.nsid);
+			changed++;
+		}
+
+		hlist_del(&rt->hash);
+		list_del(&rt->list);
+		free(rt->first);
+		free(rt->last);
+		free(rt);
+	}
+
+	if (show_stats) {
+		print_headers(stdout, "[ROUTE]");
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "coalesced", "coalesced %u route events",
+			   c->events);
+		print_uint(PRINT_ANY, "routes", " of %u routes:", c->prefixes);
+		print_uint(PRINT_ANY, "added", " %u added", added);
+		print_uint(PRINT_ANY, "deleted", " %u deleted", deleted);
+		print_uint(PRINT_ANY, "changed", " %u changed", changed);
+		print_uint(PRINT_ANY, "flapped", " %u flapped", flapped);
+		if (c->overruns)
+			print_uint(PRINT_ANY, "overruns", " %u overruns",
+				   c->overruns);
+		print_string(PRINT_FP, NULL, "\n", NULL);
+		close_json_object();
+	}
+	fflush(stdout);
+
+	c->events = c->prefixes = c->overruns = 0;
+	c->open = false;
+}
+
+static int coalesce_msg(struct rtnl_ctrl_data *ctrl,
+			struct nlmsghdr *n, void *arg)
+{
+	struct ipmon_coalesce *c = arg;
+	struct rtmsg *r = NLMSG_DATA(n);
+
+	if ((n->nlmsg_type != RTM_NEWROUTE &&
+	     n->nlmsg_type != RTM_DELROUTE) ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*r)) ||
+	    r->rtm_family == RTNL_FAMILY_IPMR ||
+	    r->rtm_family == RTNL_FAMILY_IP6MR)
+		return accept_msg(ctrl, n, stdout);
+
+	if (r->rtm_flags & RTM_F_CLONED)
+		return 0;
+
+	if (!c->open) {
+		c->deadline = monotonic_now() + c->window / 1000.0;
+		c->open = true;
+	}
+	if (ipmon_coalesce_route(c, ctrl ? ctrl->nsid : -1, n) < 0) {
+		/* better late than wrong: show what was collected */
+		ipmon_coalesce_flush(c);
+		return accept_msg(ctrl, n, stdout);
+	}
+	return 0;
+}
+
+static int ipmon_coalesce(unsigned int window)
+{
+	struct ipmon_coalesce *c;
+	struct rtnl_batch b;
+	struct timespec ts;
+	int size_rcv = rcvbuf;
+	int err = 0;
+
+	c = calloc(1, sizeof(*c));
+	if (!c || rtnl_batch_init(&b, IPMON_BATCH_VLEN, IPMON_BATCH_SLOT)) {
+		perror("Cannot allocate receive buffers");
+		free(c);
+		return -1;
+	}
+	INIT_LIST_HEAD(&c->routes);
+	c->window = window;
+
+	if (size_rcv < IPMON_CAPTURE_RCVBUF)
+		size_rcv = IPMON_CAPTURE_RCVBUF;
+	setsockopt(rth.fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		   &size_rcv, sizeof(size_rcv));
+
+	while (1) {
+		struct pollfd pfd = { .fd = rth.fd, .events = POLLIN };
+		int timeout = -1, n;
+
+		if (c->open) {
+			double left = c->deadline - monotonic_now();
+
+			if (left <= 0) {
+				ipmon_coalesce_flush(c);
+				continue;
+			}
+			timeout = left * 1000 + 1;
+		}
+
+		n = poll(&pfd, 1, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			err = -1;
+			break;
+		}
+		if (n == 0)
+			continue;
+
+		do {
+			n = rtnl_listen_batch(&rth, &b, &ts, coalesce_msg, c);
+			if (n < 0 && errno == ENOBUFS) {
+				/* the net changes of this window may be off */
+				c->overruns++;
+				n = 1;
+			}
+		} while (n > 0 &&
+			 (!c->open || monotonic_now() < c->deadline));
+
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			err = -1;
+			break;
+		}
+	}
+
+	rtnl_batch_free(&b);
+	free(c);
+	return err;
+}
+
+struct ipmon_groups {
+	unsigned int	groups;
+	unsigned int	lmask;
+	/* "needed" mask, failure to enable is an error */
+	unsigned int	nmask;
+};
+
+static int ipmon_open(struct rtnl_handle *rth, const struct ipmon_groups *g)
+{
+	if (rtnl_open(rth, g->groups) < 0)
+		return -1;
+
+	if (g->lmask & IPMON_LNEXTHOP &&
+	    rtnl_add_nl_group(rth, RTNLGRP_NEXTHOP) < 0) {
+		if (errno != EINVAL) {
+			fprintf(stderr, "Failed to add nexthop group to list\n");
+			return -1;
+		}
+	}
+
+	if (g->lmask & IPMON_LSTATS &&
+	    rtnl_add_nl_group(rth, RTNLGRP_STATS) < 0 &&
+	    g->nmask & IPMON_LSTATS) {
+		if (errno != EINVAL) {
+			fprintf(stderr, "Failed to add stats group to list\n");
+			return -1;
+		}
+	}
+
+	if (g->lmask & IPMON_LMADDR) {
+		if ((!preferred_family || preferred_family == AF_INET) &&
+		    rtnl_add_nl_group(rth, RTNLGRP_IPV4_MCADDR) < 0) {
+			if (errno != EINVAL) {
+				fprintf(stderr,
+					"Failed to add ipv4 mcaddr group to list\n");
+				return -1;
+			}
+		}
+		if ((!preferred_family || preferred_family == AF_INET6) &&
+		    rtnl_add_nl_group(rth, RTNLGRP_IPV6_MCADDR) < 0) {
+			if (errno != EINVAL) {
+				fprintf(stderr,
+					"Failed to add ipv6 mcaddr group to list\n");
+				return -1;
+			}
+		}
+	}
+
+	if (g->lmask & IPMON_LACADDR) {
+		if ((!preferred_family || preferred_family == AF_INET6) &&
+		    rtnl_add_nl_group(rth, RTNLGRP_IPV6_ACADDR) < 0) {
+			if (errno != EINVAL) {
+				fprintf(stderr,
+					"Failed to add ipv6 acaddr group to list\n");
+				return -1;
+			}
+		}
+	}
+
+	if (listen_all_nsid && rtnl_listen_all_nsid(rth) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Several network namespaces watched from one process: a socket is
+ * opened in each of them with setns() and they are all polled together.
+ * Every namespace has its own link map, and its batches are handled
+ * from within it, so names resolve the way "ip -n NAME monitor" would.
+ */
+struct ipmon_netns {
+	struct list_head	list;
+	struct rtnl_handle	rth;
+	struct ll_map_state	*ll;
+	int			fd;
+	bool			seen;
+	char			name[];
+};
+
+static struct list_head ipmon_netns_list;
+static int ipmon_self_fd = -1;
+
+#define IPMON_NETNS_RESCAN_MS	1000
+
+static void ipmon_netns_return(void)
+{
+	if (setns(ipmon_self_fd, CLONE_NEWNET) < 0) {
+		perror("Cannot return to the original network namespace");
+		exit(1);
+	}
+}
+
+static struct ipmon_netns *ipmon_netns_find(const char *name)
+{
+	struct ipmon_netns *ns;
+
+	list_for_each_entry(ns, &ipmon_netns_list, list)
+		if (!strcmp(ns->name, name))
+			return ns;
+	return NULL;
+}
+
+static void ipmon_netns_free(struct ipmon_netns *ns)
+{
+	rtnl_close(&ns->rth);
+	if (ns->fd >= 0)
+		close(ns->fd);
+	ll_map_state_free(ns->ll);
+	free(ns);
+}
+
+static int ipmon_netns_add(const char *name, const struct ipmon_groups *g,
+			   int epfd, bool quiet)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct ipmon_netns *ns;
+	int err;
+
+	ns = calloc(1, sizeof(*ns) + strlen(name) + 1);
+	if (!ns)
+		return -1;
+	strcpy(ns->name, name);
+	ns->rth.fd = -1;
+
+	ns->fd = netns_get_fd(name);
+	ns->ll = ll_map_state_alloc();
+	if (ns->fd < 0 || !ns->ll || setns(ns->fd, CLONE_NEWNET) < 0) {
+		if (!quiet)
+			fprintf(stderr,
+				"Cannot enter network namespace \"%s\": %s\n",
+				name, strerror(errno));
+		ipmon_netns_free(ns);
+		return -1;
+	}
+
+	err = ipmon_open(&ns->rth, g);
+	if (!err) {
+		ll_map_swap(ns->ll);
+		ll_init_map(&ns->rth);
+		ll_map_swap(ns->ll);
+	}
+	ipmon_netns_return();
+
+	ev.data.ptr = ns;
+	if (err || epoll_ctl(epfd, EPOLL_CTL_ADD, ns->rth.fd, &ev) < 0) {
+		ipmon_netns_free(ns);
+		return -1;
+	}
+
+	ns->seen = true;
+	list_add_tail(&ns->list, &ipmon_netns_list);
+	return 0;
+}
+
+static void ipmon_netns_del(struct ipmon_netns *ns)
+{
+	list_del(&ns->list);
+	ipmon_netns_free(ns);
+}
+
+/* Handle one batch, so that a busy namespace does not hold up the rest */
+static int ipmon_netns_recv(struct ipmon_netns *ns, struct rtnl_batch *b)
+{
+	struct timespec ts;
+	int n;
+
+	if (setns(ns->fd, CLONE_NEWNET) < 0)
+		return -1;
+	ll_map_swap(ns->ll);
+	cur_netns = ns->name;
+
+	n = rtnl_listen_batch(&ns->rth, b, &ts, accept_msg, stdout);
+	if (n < 0)
+		fprintf(stderr, "netns %s: netlink receive error %s (%d)\n",
+			ns->name, strerror(errno), errno);
+
+	cur_netns = NULL;
+	ll_map_swap(ns->ll);
+	ipmon_netns_return();
+
+	return n < 0 && errno != ENOBUFS ? -1 : 0;
+}
+
+struct ipmon_scan {
+	const struct ipmon_groups	*g;
+	int				epfd;
+	bool				retry;
+};
+
+static int ipmon_netns_scan_one(char *name, void *arg)
+{
+	struct ipmon_scan *scan = arg;
+	struct ipmon_netns *ns = ipmon_netns_find(name);
+
+	/* a namespace just added may not be mounted yet */
+	if (ns)
+		ns->seen = true;
+	else if (ipmon_netns_add(name, scan->g, scan->epfd, true) < 0)
+		scan->retry = true;
+	return 0;
+}
+
+/* Follow the namespaces being added to and deleted from NETNS_RUN_DIR */
+static bool ipmon_netns_rescan(const struct ipmon_groups *g, int epfd)
+{
+	struct ipmon_scan scan = { .g = g, .epfd = epfd };
+	struct ipmon_netns *ns, *tmp;
+
+	list_for_each_entry(ns, &ipmon_netns_list, list)
+		ns->seen = false;
+
+	netns_foreach(ipmon_netns_scan_one, &scan);
+
+	list_for_each_entry_safe(ns, tmp, &ipmon_netns_list, list)
+		if (!ns->seen)
+			ipmon_netns_del(ns);
+	return scan.retry;
+}
+
+static bool ipmon_netns_dir_changed(struct timespec *mtime)
+{
+	struct stat st;
+
+	if (stat(NETNS_RUN_DIR, &st) < 0)
+		return false;
+	if (st.st_mtim.tv_sec == mtime->tv_sec &&
+	    st.st_mtim.tv_nsec == mtime->tv_nsec)
+		return false;
+	*mtime = st.st_mtim;
+	return true;
+}
+
+static int ipmon_netns_run(const struct ipmon_groups *g,
+			   char **names, int cnt, bool all)
+{
+	struct epoll_event evs[IPMON_BATCH_VLEN];
+	struct timespec mtime = {};
+	struct rtnl_batch b;
+	bool retry = false;
+	int epfd, i;
+
+	INIT_LIST_HEAD(&ipmon_netns_list);
+	ipmon_self_fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (ipmon_self_fd < 0 || epfd < 0) {
+		perror("Cannot set up network namespace monitoring");
+		return -1;
+	}
+	if (rtnl_batch_init(&b, IPMON_BATCH_VLEN, IPMON_BATCH_SLOT)) {
+		perror("Cannot allocate receive buffers");
+		return -1;
+	}
+
+	for (i = 0; i < cnt; i++)
+		if (!ipmon_netns_find(names[i]) &&
+		    ipmon_netns_add(names[i], g, epfd, false) < 0)
+			return -1;
+
+	if (all) {
+		ipmon_netns_dir_changed(&mtime);
+		retry = ipmon_netns_rescan(g, epfd);
+	}
+
+	while (1) {
+		int n;
+
+		n = epoll_wait(epfd, evs, ARRAY_SIZE(evs),
+			       all ? IPMON_NETNS_RESCAN_MS : -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return -1;
+		}
+
+		for (i = 0; i < n; i++)
+			if (ipmon_netns_recv(evs[i].data.ptr, &b) < 0)
+				return -1;
+
+		if (all && (ipmon_netns_dir_changed(&mtime) || retry))
+			retry = ipmon_netns_rescan(g, epfd);
+	}
+}
+
 int do_ipmonitor(int argc, char **argv)
 {
 	unsigned int groups = 0, lmask = 0;
 	/* "needed" mask, failure to enable is an error */
 	unsigned int nmask;
-	char *file = NULL;
+	__u64 capture_size = IPMON_CAPTURE_SIZE;
+	struct timespec since, until;
+	bool has_since = false, has_until = false;
+	char *file = NULL, *capture = NULL;
+	unsigned int keep = 0;
+	unsigned int coalesce = 0;
+	char **netns_names = NULL;
+	bool netns_all = false;
+	struct ipmon_groups g;
+	int netns_cnt = 0;
 	int ifindex = 0;
 
 	rtnl_close(&rth);
@@ -206,6 +1103,47 @@ int do_ipmonitor(int argc, char **argv)
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (strcmp(*argv, "capture") == 0) {
+			NEXT_ARG();
+			capture = *argv;
+		} else if (strcmp(*argv, "size") == 0) {
+			NEXT_ARG();
+			if (get_size64(&capture_size, *argv) || !capture_size)
+				invarg("invalid capture size", *argv);
+		} else if (strcmp(*argv, "keep") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&keep, *argv, 0) || !keep)
+				invarg("invalid age to keep", *argv);
+		} else if (strcmp(*argv, "coalesce") == 0) {
+			coalesce = 100;
+			if (NEXT_ARG_OK() &&
+			    get_unsigned(&coalesce, argv[1], 0) == 0) {
+				NEXT_ARG();
+				if (!coalesce)
+					invarg("coalesce window must be positive",
+					       *argv);
+			}
+		} else if (strcmp(*argv, "since") == 0) {
+			NEXT_ARG();
+			if (get_replay_time(&since, *argv))
+				invarg("invalid time", *argv);
+			has_since = true;
+		} else if (strcmp(*argv, "until") == 0) {
+			NEXT_ARG();
+			if (get_replay_time(&until, *argv))
+				invarg("invalid time", *argv);
+			has_until = true;
+		} else if (strcmp(*argv, "netns") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "all") == 0) {
+				netns_all = true;
+			} else {
+				if (!netns_names)
+					netns_names = calloc(argc, sizeof(char *));
+				if (!netns_names)
+					exit(1);
+				netns_names[netns_cnt++] = *argv;
+			}
 		} else if (matches(*argv, "label") == 0) {
 			prefix_banner = 1;
 		} else if (matches(*argv, "link") == 0) {
@@ -253,6 +1191,21 @@ int do_ipmonitor(int argc, char **argv)
 		argc--;	argv++;
 	}
 
+	if (file && capture) {
+		fprintf(stderr, "\"file\" and \"capture\" are mutually exclusive\n");
+		exit(-1);
+	}
+	if ((file || capture) && (netns_cnt || netns_all)) {
+		fprintf(stderr, "\"netns\" cannot be used with \"%s\"\n",
+			file ? "file" : "capture");
+		exit(-1);
+	}
+	if (coalesce && (file || capture || netns_cnt || netns_all)) {
+		fprintf(stderr, "\"coalesce\" cannot be used with \"%s\"\n",
+			file ? "file" : capture ? "capture" : "netns");
+		exit(-1);
+	}
+
 	ipaddr_reset_filter(1, ifindex);
 	iproute_reset_filter(ifindex);
 	ipmroute_reset_filter(ifindex);
@@ -310,10 +1263,30 @@ int do_ipmonitor(int argc, char **argv)
 		groups |= nl_mgrp(RTNLGRP_NSID);
 	}
 
+	g.groups = groups;
+	g.lmask = lmask;
+	g.nmask = nmask;
+
 	if (file) {
+		struct rtnl_ring *ring;
 		FILE *fp;
 		int err;
 
+		ring = rtnl_ring_open(file);
+		if (ring)
+			return ipmon_replay(ring, lmask,
+					    has_since ? &since : NULL,
+					    has_until ? &until : NULL);
+		if (errno != EBADMSG) {
+			perror("Cannot open");
+			exit(-1);
+		}
+		if (has_since || has_until) {
+			fprintf(stderr,
+				"\"since\" and \"until\" need a ring file\n");
+			exit(-1);
+		}
+
 		fp = fopen(file, "r");
 		if (fp == NULL) {
 			perror("Cannot fopen");
@@ -324,61 +1297,22 @@ int do_ipmonitor(int argc, char **argv)
 		return err;
 	}
 
-	if (rtnl_open(&rth, groups) < 0)
-		exit(1);
+	if (netns_cnt || netns_all)
+		return ipmon_netns_run(&g, netns_names, netns_cnt, netns_all);
 
-	if (lmask & IPMON_LNEXTHOP &&
-	    rtnl_add_nl_group(&rth, RTNLGRP_NEXTHOP) < 0) {
-		if (errno != EINVAL) {
-			fprintf(stderr, "Failed to add nexthop group to list\n");
-			exit(1);
-		}
-	}
-
-	if (lmask & IPMON_LSTATS &&
-	    rtnl_add_nl_group(&rth, RTNLGRP_STATS) < 0 &&
-	    nmask & IPMON_LSTATS) {
-		if (errno != EINVAL) {
-			fprintf(stderr, "Failed to add stats group to list\n");
-			exit(1);
-		}
-	}
-
-	if (lmask & IPMON_LMADDR) {
-		if ((!preferred_family || preferred_family == AF_INET) &&
-		    rtnl_add_nl_group(&rth, RTNLGRP_IPV4_MCADDR) < 0) {
-			if (errno != EINVAL) {
-				fprintf(stderr, "Failed to add ipv4 mcaddr group to list\n");
-				exit(1);
-			}
-		}
-		if ((!preferred_family || preferred_family == AF_INET6) &&
-		    rtnl_add_nl_group(&rth, RTNLGRP_IPV6_MCADDR) < 0) {
-			if (errno != EINVAL) {
-				fprintf(stderr,
-					"Failed to add ipv6 mcaddr group to list\n");
-				exit(1);
-			}
-		}
-	}
-
-	if (lmask & IPMON_LACADDR) {
-		if ((!preferred_family || preferred_family == AF_INET6) &&
-		    rtnl_add_nl_group(&rth, RTNLGRP_IPV6_ACADDR) < 0) {
-			if (errno != EINVAL) {
-				fprintf(stderr, "Failed to add ipv6 acaddr group to list\n");
-				exit(1);
-			}
-		}
-	}
-
-	if (listen_all_nsid && rtnl_listen_all_nsid(&rth) < 0)
+	if (ipmon_open(&rth, &g) < 0)
 		exit(1);
 
+	if (capture)
+		return ipmon_capture(capture, capture_size, keep);
+
 	ll_init_map(&rth);
 	netns_nsid_socket_init();
 	netns_map_init();
 
+	if (coalesce)
+		return ipmon_coalesce(coalesce);
+
 	if (rtnl_listen(&rth, accept_msg, stdout) < 0)
 		exit(2);
 
@@ -2,10 +2,14 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <linux/genetlink.h>
 #include <linux/netlink.h>
@@ -18,6 +22,8 @@
 #include "libgenl.h"
 #include "libnetlink.h"
 #include "ll_map.h"
+#include "rtnl_bulk.h"
+#include "list.h"
 
 static void usage(void)
 {
@@ -26,11 +32,12 @@ static void usage(void)
 		"				      [ port NR ] [ FLAG-LIST ]\n"
 		"	ip mptcp endpoint delete id ID [ ADDRESS ]\n"
 		"	ip mptcp endpoint change [ id ID ] [ ADDRESS ] [ port NR ] CHANGE-OPT\n"
+		"	ip mptcp endpoint { add | delete | change } file FILE\n"
 		"	ip mptcp endpoint show [ id ID ]\n"
-		"	ip mptcp endpoint flush\n"
+		"	ip mptcp endpoint flush [ PREFIX ] [ dev NAME ] [ FLAG-LIST ]\n"
 		"	ip mptcp limits set [ subflows NR ] [ add_addr_accepted NR ]\n"
 		"	ip mptcp limits show\n"
-		"	ip mptcp monitor\n"
+		"	ip mptcp monitor [ aggregate [ SECS ] [ top N ] ]\n"
 		"FLAG-LIST := [ FLAG-LIST ] FLAG\n"
 		"FLAG  := [ signal | subflow | laminar | backup | fullmesh ]\n"
 		"CHANGE-OPT := [ backup | nobackup | fullmesh | nofullmesh ]\n");
@@ -118,7 +125,7 @@ static int mptcp_parse_opt(int argc, char **argv, struct nlmsghdr *n, int cmd)
 	__u16 port = 0;
 	__u8 id = 0;
 
-	ll_init_map(&rth);
+	ll_init_map_lazy();
 	while (argc > 0) {
 		if (get_flags(*argv, &flags) == 0) {
 			if (adding &&
@@ -210,15 +217,138 @@ static int mptcp_parse_opt(int argc, char **argv, struct nlmsghdr *n, int cmd)
 	return 0;
 }
 
+/* "file FILE" takes the place of the arguments and programs one endpoint
+ * per line, with the arguments of the command. The whole file is parsed
+ * into this queue before anything is sent, so a typo does not leave the
+ * endpoints half programmed.
+ */
+#define MPTCP_BULK_WINDOW	256
+
+static struct mptcp_bulk {
+	struct rtnl_bulk	bulk;
+	int			cmd;
+	char			*buf;
+	size_t			len;
+	size_t			bufsize;
+	int			*lineno;
+	unsigned int		count;
+	unsigned int		size;
+} *mptcp_bulk;
+
+static int mptcp_bulk_queue(const struct nlmsghdr *n)
+{
+	struct mptcp_bulk *b = mptcp_bulk;
+
+	if (b->count == b->size) {
+		unsigned int size = b->size ? b->size * 2 : 64;
+		int *lineno = realloc(b->lineno, size * sizeof(*lineno));
+
+		if (!lineno)
+			goto oom;
+		b->lineno = lineno;
+		b->size = size;
+	}
+
+	if (b->len + NLMSG_ALIGN(n->nlmsg_len) > b->bufsize) {
+		size_t bufsize = b->bufsize ? b->bufsize * 2 : 64 * 1024;
+		char *buf = realloc(b->buf, bufsize);
+
+		if (!buf)
+			goto oom;
+		b->buf = buf;
+		b->bufsize = bufsize;
+	}
+
+	b->lineno[b->count++] = cmdlineno;
+	memcpy(b->buf + b->len, n, n->nlmsg_len);
+	b->len += NLMSG_ALIGN(n->nlmsg_len);
+	return 0;
+oom:
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+}
+
+static int mptcp_addr_modify(int argc, char **argv, int cmd);
+
+static int mptcp_bulk_line(int argc, char **argv, void *data)
+{
+	return mptcp_addr_modify(argc, argv, mptcp_bulk->cmd);
+}
+
+static int mptcp_bulk_send(struct mptcp_bulk *b)
+{
+	struct rtnl_flush f;
+	unsigned int i;
+	size_t off = 0;
+	int ret;
+
+	b->bulk.entries = b->count;
+	if (rtnl_bulk_start(&b->bulk, &f) < 0)
+		return -1;
+
+	for (i = 0; i < b->count; i++) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(b->buf + off);
+
+		f.tag = b->lineno[i];
+		if (rtnl_flush_add(&f, n, 0) < 0) {
+			perror("Cannot talk to generic netlink");
+			rtnl_flush_close(&f);
+			return -1;
+		}
+		off += NLMSG_ALIGN(n->nlmsg_len);
+	}
+
+	ret = rtnl_bulk_finish(&b->bulk, &f);
+	if (show_stats)
+		printf("%u endpoints, %.0f endpoints/s\n", b->count,
+		       b->bulk.rate);
+	return ret;
+}
+
+static int mptcp_addr_bulk(const char *file, int cmd)
+{
+	struct mptcp_bulk b = {
+		.bulk.file = file,
+		.bulk.what = "endpoints",
+		.bulk.protocol = NETLINK_GENERIC,
+		.bulk.window = MPTCP_BULK_WINDOW,
+		.bulk.genl = true,
+		.cmd = cmd,
+	};
+	int ret = -1;
+
+	mptcp_bulk = &b;
+	if (do_batch(file, false, mptcp_bulk_line, NULL) == 0)
+		ret = mptcp_bulk_send(&b);
+	else
+		fprintf(stderr, "%s: nothing was sent\n", file);
+	mptcp_bulk = NULL;
+
+	free(b.buf);
+	free(b.lineno);
+	return ret;
+}
+
 static int mptcp_addr_modify(int argc, char **argv, int cmd)
 {
 	MPTCP_REQUEST(req, cmd, NLM_F_REQUEST);
 	int ret;
 
+	if (!mptcp_bulk && argc > 0 && strcmp(*argv, "file") == 0) {
+		NEXT_ARG();
+		if (argc > 1)
+			invarg("file takes the place of all arguments",
+			       argv[1]);
+		return mptcp_addr_bulk(*argv, cmd);
+	}
+
 	ret = mptcp_parse_opt(argc, argv, &req.n, cmd);
 	if (ret)
 		return ret;
 
+	if (mptcp_bulk)
+		return mptcp_bulk_queue(&req.n);
+
 	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
 		return -2;
 
@@ -352,14 +482,167 @@ static int mptcp_addr_show(int argc, char **argv)
 	return ret;
 }
 
+/* Endpoints selected for a flush are deleted by id while the dump is
+ * received, in windows on a socket of their own.
+ */
+static struct {
+	inet_prefix	pfx;
+	int		ifindex;
+	__u32		flags;
+	struct rtnl_flush *flush;
+	unsigned int	flushed;
+	unsigned int	failed;
+} mptcp_flush;
+
+static void mptcp_flush_report(const struct nlmsghdr *err, int id, void *arg)
+{
+	const struct nlmsgerr *e = NLMSG_DATA(err);
+
+	fprintf(stderr, "id %d: ", id);
+	if (!nl_dump_ext_ack(err, NULL))
+		fprintf(stderr, "%s\n", strerror(-e->error));
+	mptcp_flush.failed++;
+}
+
+static int mptcp_flush_addr(struct nlmsghdr *n, void *arg)
+{
+	MPTCP_REQUEST(req, MPTCP_PM_CMD_DEL_ADDR, NLM_F_REQUEST);
+	struct rtattr *atb[MPTCP_PM_ADDR_ATTR_MAX + 1];
+	struct rtattr *tb[MPTCP_PM_ATTR_MAX + 1];
+	struct genlmsghdr *ghdr;
+	int len = n->nlmsg_len;
+	struct rtattr *nest;
+	__u8 id;
+
+	if (n->nlmsg_type != genl_family)
+		return 0;
+
+	len -= NLMSG_LENGTH(GENL_HDRLEN);
+	if (len < 0)
+		return -1;
+
+	ghdr = NLMSG_DATA(n);
+	parse_rtattr_flags(tb, MPTCP_PM_ATTR_MAX, (void *) ghdr + GENL_HDRLEN,
+			   len, NLA_F_NESTED);
+	if (!tb[MPTCP_PM_ATTR_ADDR])
+		return -1;
+	parse_rtattr_nested(atb, MPTCP_PM_ADDR_ATTR_MAX, tb[MPTCP_PM_ATTR_ADDR]);
+
+	if (!atb[MPTCP_PM_ADDR_ATTR_ID])
+		return 0;
+	id = rta_getattr_u8(atb[MPTCP_PM_ADDR_ATTR_ID]);
+
+	if (mptcp_flush.ifindex &&
+	    (!atb[MPTCP_PM_ADDR_ATTR_IF_IDX] ||
+	     rta_getattr_s32(atb[MPTCP_PM_ADDR_ATTR_IF_IDX]) != mptcp_flush.ifindex))
+		return 0;
+
+	if (mptcp_flush.flags &&
+	    (!atb[MPTCP_PM_ADDR_ATTR_FLAGS] ||
+	     (rta_getattr_u32(atb[MPTCP_PM_ADDR_ATTR_FLAGS]) &
+	      mptcp_flush.flags) != mptcp_flush.flags))
+		return 0;
+
+	if (mptcp_flush.pfx.family) {
+		__u16 family = AF_UNSPEC;
+		struct rtattr *addr;
+
+		if (atb[MPTCP_PM_ADDR_ATTR_FAMILY])
+			family = rta_getattr_u16(atb[MPTCP_PM_ADDR_ATTR_FAMILY]);
+		if (family != mptcp_flush.pfx.family)
+			return 0;
+		addr = atb[family == AF_INET ? MPTCP_PM_ADDR_ATTR_ADDR4 :
+					       MPTCP_PM_ADDR_ATTR_ADDR6];
+		if (inet_addr_match_rta(&mptcp_flush.pfx, addr))
+			return 0;
+	}
+
+	nest = addattr_nest(&req.n, MPTCP_BUFLEN,
+			    MPTCP_PM_ATTR_ADDR | NLA_F_NESTED);
+	addattr8(&req.n, MPTCP_BUFLEN, MPTCP_PM_ADDR_ATTR_ID, id);
+	addattr_nest_end(&req.n, nest);
+
+	mptcp_flush.flush->tag = id;
+	if (rtnl_flush_add(mptcp_flush.flush, &req.n, 0) < 0) {
+		perror("Failed to send flush request");
+		return -1;
+	}
+	mptcp_flush.flushed++;
+	return 0;
+}
+
 static int mptcp_addr_flush(int argc, char **argv)
 {
 	MPTCP_REQUEST(req, MPTCP_PM_CMD_FLUSH_ADDRS, NLM_F_REQUEST);
+	struct rtnl_flush f;
+	int ret = -2;
 
-	if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
-		return -2;
+	/* all of them go in one request */
+	if (argc <= 0) {
+		if (rtnl_talk(&genl_rth, &req.n, NULL) < 0)
+			return -2;
 
-	return 0;
+		return 0;
+	}
+
+	memset(&mptcp_flush, 0, sizeof(mptcp_flush));
+	ll_init_map_lazy();
+	while (argc > 0) {
+		if (get_flags(*argv, &mptcp_flush.flags) == 0) {
+			;
+		} else if (matches(*argv, "dev") == 0) {
+			NEXT_ARG();
+			mptcp_flush.ifindex = ll_name_to_index(*argv);
+			if (!mptcp_flush.ifindex)
+				invarg("device does not exist\n", *argv);
+		} else {
+			if (mptcp_flush.pfx.family)
+				duparg2("PREFIX", *argv);
+			get_prefix(&mptcp_flush.pfx, *argv, AF_UNSPEC);
+		}
+		NEXT_ARG_FWD();
+	}
+
+	if (rtnl_flush_open_byproto(&f, 0, NETLINK_GENERIC) < 0)
+		return -1;
+	if (rtnl_flush_set_report(&f, MPTCP_BULK_WINDOW,
+				  mptcp_flush_report, NULL) < 0)
+		goto out;
+	mptcp_flush.flush = &f;
+
+	req.g.cmd = MPTCP_PM_CMD_GET_ADDR;
+	req.n.nlmsg_flags |= NLM_F_DUMP;
+	if (rtnl_send(&genl_rth, &req.n, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+
+	if (rtnl_dump_filter(&genl_rth, mptcp_flush_addr, NULL) < 0) {
+		fprintf(stderr, "Flush terminated\n");
+		goto out;
+	}
+	if (rtnl_flush_commit(&f) == -2) {
+		perror("Failed to send flush request");
+		goto out;
+	}
+
+	if (mptcp_flush.failed)
+		fprintf(stderr, "%u of %u deletes failed\n",
+			mptcp_flush.failed, mptcp_flush.flushed);
+	else
+		ret = 0;
+	if (show_stats) {
+		if (!mptcp_flush.flushed)
+			printf("Nothing to flush.\n");
+		else
+			printf("%u endpoints deleted, %.0f deletes/s\n",
+			       mptcp_flush.flushed, rtnl_flush_rate(&f));
+	}
+
+out:
+	mptcp_flush.flush = NULL;
+	rtnl_flush_close(&f);
+	return ret;
 }
 
 static int mptcp_parse_limit(int argc, char **argv, struct nlmsghdr *n)
@@ -577,19 +860,299 @@ out:
 	return 0;
 }
 
-static int mptcp_monitor(void)
+/*
+ * "ip mptcp monitor aggregate" counts the events by type and by token
+ * instead of printing them. Every interval it prints a line with the
+ * totals and the socket overruns (ENOBUFS, events the kernel dropped),
+ * then the busiest tokens. Tokens are forgotten after each interval, so
+ * the memory follows the churn of one interval only.
+ */
+#define MPTCP_MON_EVENTS	ARRAY_SIZE(event_to_str)
+#define MPTCP_MON_HASH		4096
+#define MPTCP_MON_RCVBUF	(32 * 1024 * 1024)
+#define MPTCP_MON_BATCH_VLEN	64
+#define MPTCP_MON_BATCH_SLOT	32768
+
+struct mptcp_mon_token {
+	struct hlist_node	hash;
+	__u32			token;
+	__u64			events;
+	__u64			count[MPTCP_MON_EVENTS + 1];	/* + unknown */
+};
+
+struct mptcp_mon {
+	struct hlist_head	hash[MPTCP_MON_HASH];
+	unsigned int		tokens;
+	unsigned int		top;
+	__u64			count[MPTCP_MON_EVENTS + 1];
+	__u64			events;
+	__u64			overruns;
+	__u64			interval_overruns;
+	bool			oom;
+};
+
+static unsigned int mptcp_mon_event(__u8 cmd)
 {
-	if (genl_add_mcast_grp(&genl_rth, genl_family, MPTCP_PM_EV_GRP_NAME) < 0) {
-		perror("can't subscribe to mptcp events");
-		return 1;
+	if (cmd >= MPTCP_MON_EVENTS || !event_to_str[cmd])
+		return MPTCP_MON_EVENTS;
+	return cmd;
+}
+
+static const char *mptcp_mon_name(unsigned int ev)
+{
+	return ev < MPTCP_MON_EVENTS ? event_to_str[ev] : "UNKNOWN";
+}
+
+static struct mptcp_mon_token *mptcp_mon_token(struct mptcp_mon *mon,
+					       __u32 token)
+{
+	struct hlist_head *head = &mon->hash[token % MPTCP_MON_HASH];
+	struct mptcp_mon_token *t;
+	struct hlist_node *pos;
+
+	hlist_for_each(pos, head) {
+		t = container_of(pos, struct mptcp_mon_token, hash);
+		if (t->token == token)
+			return t;
 	}
 
-	if (rtnl_listen(&genl_rth, mptcp_monitor_msg, stdout) < 0)
-		return 2;
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->token = token;
+	hlist_add_head(&t->hash, head);
+	mon->tokens++;
+	return t;
+}
+
+static int mptcp_mon_count(struct rtnl_ctrl_data *ctrl,
+			   struct nlmsghdr *n, void *arg)
+{
+	const struct genlmsghdr *ghdr = NLMSG_DATA(n);
+	struct rtattr *tb[MPTCP_ATTR_MAX + 1];
+	struct mptcp_mon *mon = arg;
+	int len = n->nlmsg_len;
+	unsigned int ev;
+
+	len -= NLMSG_LENGTH(GENL_HDRLEN);
+	if (len < 0 || n->nlmsg_type != genl_family)
+		return 0;
+
+	ev = mptcp_mon_event(ghdr->cmd);
+	mon->count[ev]++;
+	mon->events++;
 
+	parse_rtattr(tb, MPTCP_ATTR_MAX, (void *) ghdr + GENL_HDRLEN, len);
+	if (tb[MPTCP_ATTR_TOKEN]) {
+		struct mptcp_mon_token *t;
+
+		t = mptcp_mon_token(mon, rta_getattr_u32(tb[MPTCP_ATTR_TOKEN]));
+		if (!t) {
+			/* keep the totals going, the tokens are incomplete */
+			mon->oom = true;
+			return 0;
+		}
+		t->count[ev]++;
+		t->events++;
+	}
 	return 0;
 }
 
+static int mptcp_mon_token_cmp(const void *a, const void *b)
+{
+	const struct mptcp_mon_token *x = *(const struct mptcp_mon_token **)a;
+	const struct mptcp_mon_token *y = *(const struct mptcp_mon_token **)b;
+
+	if (x->events != y->events)
+		return x->events < y->events ? 1 : -1;
+	return x->token < y->token ? -1 : x->token > y->token;
+}
+
+static void mptcp_mon_print(struct mptcp_mon *mon)
+{
+	struct mptcp_mon_token **tokens;
+	struct hlist_node *pos, *tmp;
+	unsigned int i, j, n = 0;
+
+	if (timestamp)
+		print_timestamp(stdout);
+	printf("events %llu", (unsigned long long)mon->events);
+	for (i = 0; i <= MPTCP_MON_EVENTS; i++)
+		if (i == MPTCP_MON_EVENTS || event_to_str[i])
+			printf(" %s %llu", mptcp_mon_name(i),
+			       (unsigned long long)mon->count[i]);
+	printf(" tokens %u overruns %llu%s\n", mon->tokens,
+	       (unsigned long long)mon->interval_overruns,
+	       mon->oom ? " tokens-incomplete" : "");
+
+	/* without the array the tokens are only freed */
+	tokens = calloc(mon->tokens ? : 1, sizeof(*tokens));
+	for (i = 0; i < MPTCP_MON_HASH; i++) {
+		hlist_for_each_safe(pos, tmp, &mon->hash[i]) {
+			struct mptcp_mon_token *t;
+
+			t = container_of(pos, struct mptcp_mon_token, hash);
+			hlist_del(&t->hash);
+			if (tokens)
+				tokens[n++] = t;
+			else
+				free(t);
+		}
+	}
+
+	if (tokens) {
+		qsort(tokens, n, sizeof(*tokens), mptcp_mon_token_cmp);
+		for (i = 0; i < n; i++) {
+			struct mptcp_mon_token *t = tokens[i];
+
+			if (i < mon->top) {
+				printf("  token=%08x events %llu", t->token,
+				       (unsigned long long)t->events);
+				for (j = 0; j <= MPTCP_MON_EVENTS; j++)
+					if (t->count[j])
+						printf(" %s %llu",
+						       mptcp_mon_name(j),
+						       (unsigned long long)t->count[j]);
+				printf("\n");
+			}
+			free(t);
+		}
+		free(tokens);
+	}
+
+	memset(mon->count, 0, sizeof(mon->count));
+	mon->events = 0;
+	mon->tokens = 0;
+	mon->interval_overruns = 0;
+	mon->oom = false;
+	fflush(stdout);
+}
+
+static volatile sig_atomic_t mptcp_mon_stop;
+
+static void mptcp_mon_sig(int sig)
+{
+	mptcp_mon_stop = 1;
+}
+
+static int mptcp_monitor_aggregate(struct mptcp_mon *mon, int interval)
+{
+	struct sigaction sa = { .sa_handler = mptcp_mon_sig };
+	int size_rcv = MPTCP_MON_RCVBUF;
+	struct rtnl_batch b;
+	struct timespec ts;
+	double next;
+	int err = 0;
+
+	if (size_rcv < rcvbuf)
+		size_rcv = rcvbuf;
+	if (setsockopt(genl_rth.fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &size_rcv, sizeof(size_rcv)) < 0)
+		setsockopt(genl_rth.fd, SOL_SOCKET, SO_RCVBUF,
+			   &size_rcv, sizeof(size_rcv));
+
+	if (rtnl_batch_init(&b, MPTCP_MON_BATCH_VLEN, MPTCP_MON_BATCH_SLOT)) {
+		perror("Cannot allocate receive buffers");
+		return -1;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	next = monotonic_now() + interval;
+	while (!mptcp_mon_stop) {
+		struct pollfd pfd = { .fd = genl_rth.fd, .events = POLLIN };
+		double now = monotonic_now();
+		int n;
+
+		if (now >= next) {
+			mptcp_mon_print(mon);
+			while (next <= now)
+				next += interval;
+		}
+
+		n = poll(&pfd, 1, (next - now) * 1000 + 1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			err = -1;
+			break;
+		}
+		if (n == 0)
+			continue;
+
+		do {
+			n = rtnl_listen_batch(&genl_rth, &b, &ts,
+					      mptcp_mon_count, mon);
+			if (n < 0 && errno == ENOBUFS) {
+				mon->overruns++;
+				mon->interval_overruns++;
+				n = 1;
+			}
+		} while (n > 0 && !mptcp_mon_stop);
+
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			err = -1;
+			break;
+		}
+	}
+
+	fprintf(stderr, "%llu socket overruns\n",
+		(unsigned long long)mon->overruns);
+	rtnl_batch_free(&b);
+	return err;
+}
+
+static int mptcp_monitor(int argc, char **argv)
+{
+	struct mptcp_mon *mon = NULL;
+	int interval = 1;
+	int ret = 0;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "aggregate") == 0) {
+			if (!mon) {
+				mon = calloc(1, sizeof(*mon));
+				if (!mon) {
+					fprintf(stderr, "Out of memory\n");
+					return 1;
+				}
+				mon->top = 10;
+			}
+			if (NEXT_ARG_OK() &&
+			    get_integer(&interval, argv[1], 0) == 0) {
+				NEXT_ARG();
+				if (interval <= 0)
+					invarg("aggregate interval must be positive",
+					       *argv);
+			}
+		} else if (mon && strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&mon->top, *argv, 0))
+				invarg("invalid top count", *argv);
+		} else {
+			invarg("unknown argument", *argv);
+		}
+		NEXT_ARG_FWD();
+	}
+
+	if (genl_add_mcast_grp(&genl_rth, genl_family, MPTCP_PM_EV_GRP_NAME) < 0) {
+		perror("can't subscribe to mptcp events");
+		ret = 1;
+	} else if (mon) {
+		if (mptcp_monitor_aggregate(mon, interval) < 0)
+			ret = 2;
+	} else if (rtnl_listen(&genl_rth, mptcp_monitor_msg, stdout) < 0) {
+		ret = 2;
+	}
+
+	free(mon);
+	return ret;
+}
+
 int do_mptcp(int argc, char **argv)
 {
 	if (argc == 0)
@@ -639,10 +1202,7 @@ int do_mptcp(int argc, char **argv)
 
 	if (matches(*argv, "monitor") == 0) {
 		NEXT_ARG_FWD();
-		if (argc == 0)
-			return mptcp_monitor();
-
-		goto unknown;
+		return mptcp_monitor(argc, argv);
 	}
 
 unknown:
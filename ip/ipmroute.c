@@ -15,6 +15,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <time.h>
 
 #include <linux/netdevice.h>
 #include <linux/if.h>
@@ -25,6 +26,7 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "json_print.h"
+#include "list.h"
 
 static void usage(void) __attribute__((noreturn));
 
@@ -32,7 +34,7 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip mroute show [ [ to ] PREFIX ] [ from PREFIX ] [ iif DEVICE ]\n"
-		"                      [ table TABLE_ID ]\n"
+		"                      [ table TABLE_ID ] [ interval SECS ]\n"
 		"TABLE_ID := [ local | main | default | all | NUMBER ]\n"
 	);
 	exit(-1);
@@ -46,18 +48,12 @@ static struct rtfilter {
 	inet_prefix msrc;
 } filter;
 
-int print_mroute(struct nlmsghdr *n, void *arg)
+/* Parse a cache entry into tb, returns 1 if it passes the filter */
+static int mroute_parse(struct nlmsghdr *n, struct rtattr *tb[],
+			__u32 *table, int *iif)
 {
 	struct rtmsg *r = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct rtattr *tb[RTA_MAX+1];
-	FILE *fp = arg;
-	const char *src, *dst;
-	SPRINT_BUF(b1);
-	SPRINT_BUF(b2);
-	__u32 table;
-	int iif = 0;
-	int family;
 
 	if ((n->nlmsg_type != RTM_NEWROUTE &&
 	     n->nlmsg_type != RTM_DELROUTE)) {
@@ -78,14 +74,15 @@ int print_mroute(struct nlmsghdr *n, void *arg)
 	}
 
 	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
-	table = rtm_get_table(r, tb);
+	*table = rtm_get_table(r, tb);
 
-	if (filter.tb > 0 && filter.tb != table)
+	if (filter.tb > 0 && filter.tb != *table)
 		return 0;
 
+	*iif = 0;
 	if (tb[RTA_IIF])
-		iif = rta_getattr_u32(tb[RTA_IIF]);
-	if (filter.iif && filter.iif != iif)
+		*iif = rta_getattr_u32(tb[RTA_IIF]);
+	if (filter.iif && filter.iif != *iif)
 		return 0;
 
 	if (filter.af && filter.af != r->rtm_family)
@@ -97,13 +94,15 @@ int print_mroute(struct nlmsghdr *n, void *arg)
 	if (inet_addr_match_rta(&filter.msrc, tb[RTA_SRC]))
 		return 0;
 
-	print_headers(fp, "[MROUTE]");
-
-	family = get_real_family(r->rtm_type, r->rtm_family);
+	return 1;
+}
 
-	open_json_object(NULL);
-	if (n->nlmsg_type == RTM_DELROUTE)
-		print_bool(PRINT_ANY, "deleted", "Deleted ", true);
+static void print_mroute_flow(struct rtmsg *r, struct rtattr *tb[], int iif)
+{
+	int family = get_real_family(r->rtm_type, r->rtm_family);
+	const char *src, *dst;
+	SPRINT_BUF(b1);
+	SPRINT_BUF(b2);
 
 	if (tb[RTA_SRC])
 		src = rt_addr_n2a_r(family, RTA_PAYLOAD(tb[RTA_SRC]),
@@ -133,6 +132,29 @@ int print_mroute(struct nlmsghdr *n, void *arg)
 				   "iif", "%-10s ", ll_index_to_name(iif));
 	else
 		print_string(PRINT_ANY,"iif", "%s ", "unresolved");
+}
+
+int print_mroute(struct nlmsghdr *n, void *arg)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct rtattr *tb[RTA_MAX+1];
+	FILE *fp = arg;
+	SPRINT_BUF(b1);
+	__u32 table;
+	int iif, len;
+	int ret;
+
+	ret = mroute_parse(n, tb, &table, &iif);
+	if (ret <= 0)
+		return ret;
+
+	print_headers(fp, "[MROUTE]");
+
+	open_json_object(NULL);
+	if (n->nlmsg_type == RTM_DELROUTE)
+		print_bool(PRINT_ANY, "deleted", "Deleted ", true);
+
+	print_mroute_flow(r, tb, iif);
 
 	if (tb[RTA_MULTIPATH]) {
 		struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
@@ -231,8 +253,206 @@ static int iproute_dump_filter(struct nlmsghdr *nlh, int reqlen)
 	return 0;
 }
 
+/*
+ * "ip mroute show ... interval SECS": print the packet, byte and wrong
+ * iif counters of each cache entry as rates per second. The previous
+ * counters are kept in a hash by (table, S, G, iif), entries which were
+ * not in the last dump have expired and are dropped. A flow is flagged
+ * "stalled" when no packets were forwarded and "wrong_if spike" when
+ * packets on the wrong interface arrive at more than twice the rate of
+ * the interval before, e.g. because a stream is duplicated.
+ */
+#define MROUTE_RATE_HASH	4096
+
+struct mroute_sample {
+	struct hlist_node	hash;
+	__u32			table;
+	int			iif;
+	__u8			src[16];
+	__u8			dst[16];
+	unsigned int		gen;
+	struct rta_mfc_stats	last;
+	double			wrong_if_rate;
+};
+
+struct mroute_rates {
+	struct hlist_head	hash[MROUTE_RATE_HASH];
+	unsigned int		gen;
+	double			secs;
+};
+
+static void mroute_key_addr(__u8 *addr, const struct rtattr *rta)
+{
+	memset(addr, 0, 16);
+	if (rta)
+		memcpy(addr, RTA_DATA(rta), MIN(RTA_PAYLOAD(rta), 16));
+}
+
+static struct mroute_sample *mroute_sample_get(struct mroute_rates *mr,
+					       __u32 table, int iif,
+					       struct rtattr *tb[], bool *new)
+{
+	struct mroute_sample key = { .table = table, .iif = iif };
+	struct hlist_node *pos;
+	struct mroute_sample *s;
+	unsigned int h, i;
+
+	mroute_key_addr(key.src, tb[RTA_SRC]);
+	mroute_key_addr(key.dst, tb[RTA_DST]);
+	for (h = table * 31 + iif, i = 0; i < 16; i++)
+		h = h * 33 + (key.src[i] ^ key.dst[i]);
+	h %= MROUTE_RATE_HASH;
+
+	hlist_for_each(pos, &mr->hash[h]) {
+		s = container_of(pos, struct mroute_sample, hash);
+		if (s->table == table && s->iif == iif &&
+		    !memcmp(s->src, key.src, 16) &&
+		    !memcmp(s->dst, key.dst, 16)) {
+			*new = false;
+			s->gen = mr->gen;
+			return s;
+		}
+	}
+
+	s = malloc(sizeof(*s));
+	if (!s)
+		return NULL;
+	*s = key;
+	s->gen = mr->gen;
+	hlist_add_head(&s->hash, &mr->hash[h]);
+	*new = true;
+	return s;
+}
+
+/* Drop the flows which have expired, or all of them */
+static void mroute_rates_prune(struct mroute_rates *mr, bool all)
+{
+	struct hlist_node *pos, *n;
+	unsigned int i;
+
+	for (i = 0; i < MROUTE_RATE_HASH; i++) {
+		hlist_for_each_safe(pos, n, &mr->hash[i]) {
+			struct mroute_sample *s;
+
+			s = container_of(pos, struct mroute_sample, hash);
+			if (all || s->gen != mr->gen) {
+				hlist_del(&s->hash);
+				free(s);
+			}
+		}
+	}
+}
+
+static double mroute_rate(__u64 cur, __u64 last, double secs)
+{
+	/* counters start over if the entry was flushed and created again */
+	return (cur >= last ? cur - last : cur) / secs;
+}
+
+static int print_mroute_rate(struct nlmsghdr *n, void *arg)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	struct mroute_rates *mr = arg;
+	struct rtattr *tb[RTA_MAX+1];
+	const struct rta_mfc_stats *mfcs;
+	double pps, bps, wrong_if;
+	struct mroute_sample *s;
+	bool new, spike;
+	__u32 table;
+	int iif, ret;
+	SPRINT_BUF(b1);
+
+	if (n->nlmsg_type != RTM_NEWROUTE)
+		return 0;
+
+	ret = mroute_parse(n, tb, &table, &iif);
+	if (ret <= 0)
+		return ret;
+	if (!tb[RTA_MFC_STATS] ||
+	    RTA_PAYLOAD(tb[RTA_MFC_STATS]) < sizeof(*mfcs))
+		return 0;
+	mfcs = RTA_DATA(tb[RTA_MFC_STATS]);
+
+	s = mroute_sample_get(mr, table, iif, tb, &new);
+	if (!s) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	if (new || mr->secs <= 0)
+		goto out;
+
+	pps = mroute_rate(mfcs->mfcs_packets, s->last.mfcs_packets, mr->secs);
+	bps = mroute_rate(mfcs->mfcs_bytes, s->last.mfcs_bytes, mr->secs);
+	wrong_if = mroute_rate(mfcs->mfcs_wrong_if, s->last.mfcs_wrong_if,
+			       mr->secs);
+	spike = wrong_if >= 1 && wrong_if > 2 * s->wrong_if_rate;
+	s->wrong_if_rate = wrong_if;
+
+	open_json_object(NULL);
+	print_mroute_flow(r, tb, iif);
+	print_float(PRINT_ANY, "packets_rate", "%.0f packets/s,", pps);
+	print_float(PRINT_ANY, "bytes_rate", " %.0f bytes/s,", bps);
+	print_float(PRINT_ANY, "wrong_if_rate", " wrong iif %.0f/s", wrong_if);
+	if (!(r->rtm_flags & RTNH_F_UNRESOLVED) && pps == 0)
+		print_null(PRINT_ANY, "stalled", " stalled", NULL);
+	if (spike)
+		print_null(PRINT_ANY, "wrong_if_spike", " wrong_if spike", NULL);
+	if (table && (table != RT_TABLE_MAIN || show_details > 0) && !filter.tb)
+		print_string(PRINT_ANY, "table", " Table: %s",
+			     rtnl_rttable_n2a(table, b1, sizeof(b1)));
+	print_string(PRINT_FP, NULL, "\n", NULL);
+	close_json_object();
+out:
+	s->last = *mfcs;
+	return 0;
+}
+
+static int mroute_rates_show(unsigned int interval)
+{
+	struct mroute_rates *mr;
+	double next, now, last = 0;
+
+	mr = calloc(1, sizeof(*mr));
+	if (!mr) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+
+	new_json_obj(json);
+	next = monotonic_now();
+	for (;;) {
+		now = monotonic_now();
+		if (last)
+			mr->secs = now - last;
+		last = now;
+		mr->gen++;
+
+		if (rtnl_routedump_req(&rth, filter.af,
+				       iproute_dump_filter) < 0) {
+			perror("Cannot send dump request");
+			break;
+		}
+		if (rtnl_dump_filter(&rth, print_mroute_rate, mr) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			break;
+		}
+		mroute_rates_prune(mr, false);
+		if (mr->secs > 0 && !json)
+			printf("\n");
+		fflush(stdout);
+		next += interval;
+		monotonic_sleep_until(next);
+	}
+	delete_json_obj();
+
+	mroute_rates_prune(mr, true);
+	free(mr);
+	return 1;
+}
+
 static int mroute_list(int argc, char **argv)
 {
+	unsigned int interval = 0;
 	char *id = NULL;
 	int family = preferred_family;
 
@@ -269,6 +489,10 @@ static int mroute_list(int argc, char **argv)
 		} else if (strcmp(*argv, "iif") == 0) {
 			NEXT_ARG();
 			id = *argv;
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("\"interval\" value is invalid\n", *argv);
 		} else if (matches(*argv, "from") == 0) {
 			NEXT_ARG();
 			if (get_prefix(&filter.msrc, *argv, preferred_family))
@@ -296,6 +520,9 @@ static int mroute_list(int argc, char **argv)
 		filter.iif = idx;
 	}
 
+	if (interval)
+		return mroute_rates_show(interval);
+
 	if (rtnl_routedump_req(&rth, filter.af, iproute_dump_filter) < 0) {
 		perror("Cannot send dump request");
 		return 1;
@@ -7,9 +7,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -19,6 +22,7 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "json_print.h"
+#include "rtnl_bulk.h"
 
 #define NUD_VALID	(NUD_PERMANENT|NUD_NOARP|NUD_REACHABLE|NUD_PROBE|NUD_STALE|NUD_DELAY)
 #define MAX_ROUNDS	10
@@ -31,9 +35,7 @@ static struct
 	int unused_only;
 	inet_prefix pfx;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_flush *flush;
 	int master;
 	int protocol;
 	__u8 ndm_flags;
@@ -48,9 +50,10 @@ static void usage(void)
 		"                { ADDR [ lladdr LLADDR ] [ nud STATE ] proxy ADDR }\n"
 		"                [ dev DEV ] [ router ] [ use ] [ managed ] [ extern_learn ]\n"
 		"                [ extern_valid ] [ protocol PROTO ]\n"
+		"	ip neigh { add | del | change | replace } file FILE [ dev DEV ] ...\n"
 		"\n"
 		"	ip neigh { show | flush } [ proxy ] [ to PREFIX ] [ dev DEV ] [ nud STATE ]\n"
-		"				  [ vrf NAME ] [ nomaster ]\n"
+		"				  [ vrf NAME ] [ nomaster ] [ window NUMBER ]\n"
 		"	ip neigh get { ADDR | proxy ADDR } dev DEV\n"
 		"\n"
 		"STATE := { delay | failed | incomplete | noarp | none |\n"
@@ -87,16 +90,74 @@ static int nud_state_a2n(unsigned int *state, const char *arg)
 	return 0;
 }
 
-static int flush_update(void)
+
+/* "file FILE" takes the place of ADDR and programs one entry per line:
+ *
+ *	ADDR [ LLADDR [ DEV ] ]
+ *
+ * A "-" field takes the lladdr or dev given on the command line, if any.
+ */
+#define IPNEIGH_BULK_WINDOW	1024
+
+static bool ipneigh_bulk_field(char **tok, int ntok, int i)
 {
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -1;
+	return i < ntok && strcmp(tok[i], "-") != 0;
+}
+
+/* Add the attributes of one line to the request in n. */
+static const char *ipneigh_bulk_entry(struct rtnl_bulk *b,
+				      struct nlmsghdr *n, int maxlen,
+				      char **tok, int ntok)
+{
+	struct ndmsg *ndm = NLMSG_DATA(n);
+	const char *lla = b->arg;
+	inet_prefix dst;
+
+	if (get_addr_1(&dst, tok[0], preferred_family) ||
+	    dst.family == AF_UNSPEC)
+		return "invalid address";
+	ndm->ndm_family = dst.family;
+
+	if (ipneigh_bulk_field(tok, ntok, 1))
+		lla = tok[1];
+	if (ipneigh_bulk_field(tok, ntok, 2)) {
+		ndm->ndm_ifindex = ll_name_to_index(tok[2]);
+		if (!ndm->ndm_ifindex)
+			return "no such device";
 	}
-	filter.flushp = 0;
-	return 0;
+	if (!ndm->ndm_ifindex)
+		return "device is required";
+
+	addattr_l(n, maxlen, NDA_DST, &dst.data, dst.bytelen);
+	if (lla && strcmp(lla, "null")) {
+		char llabuf[20];
+		int l;
+
+		l = ll_addr_a2n(llabuf, sizeof(llabuf), lla);
+		if (l < 0)
+			return "invalid lladdr";
+		addattr_l(n, maxlen, NDA_LLADDR, llabuf, l);
+	}
+	return NULL;
 }
 
+static int ipneigh_bulk(const char *file, const char *lla,
+			const struct nlmsghdr *proto, int maxlen)
+{
+	struct rtnl_bulk b = {
+		.file = file,
+		.window = IPNEIGH_BULK_WINDOW,
+		.max_fields = 3,
+		.parse = ipneigh_bulk_entry,
+		.arg = (void *)lla,
+	};
+	int ret;
+
+	ret = rtnl_bulk_load(&b, proto, maxlen);
+	if (show_stats)
+		printf("%u entries, %.0f entries/s\n", b.entries, b.rate);
+	return ret;
+}
 
 static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 {
@@ -117,10 +178,16 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 	int dev_ok = 0;
 	int lladdr_ok = 0;
 	char *lla = NULL;
+	char *file = NULL;
 	inet_prefix dst;
 
 	while (argc > 0) {
-		if (matches(*argv, "lladdr") == 0) {
+		if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (file)
+				duparg("file", *argv);
+			file = *argv;
+		} else if (matches(*argv, "lladdr") == 0) {
 			NEXT_ARG();
 			if (lladdr_ok)
 				duparg("lladdr", *argv);
@@ -180,6 +247,22 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 		}
 		argc--; argv++;
 	}
+	if (file) {
+		if (dst_ok)
+			invarg("\"file\" takes the place of the address", file);
+		if (ext_flags &&
+		    addattr_l(&req.n, sizeof(req), NDA_FLAGS_EXT, &ext_flags,
+			      sizeof(ext_flags)) < 0)
+			return -1;
+
+		ll_init_map(&rth);
+		if (dev) {
+			req.ndm.ndm_ifindex = ll_name_to_index(dev);
+			if (!req.ndm.ndm_ifindex)
+				return nodev(dev);
+		}
+		return ipneigh_bulk(file, lla, &req.n, sizeof(req));
+	}
 	if (!dev_ok || !dst_ok || dst.family == AF_UNSPEC) {
 		fprintf(stderr, "Device and destination are required arguments.\n");
 		exit(-1);
@@ -203,7 +286,7 @@ static int ipneigh_modify(int cmd, int flags, int argc, char **argv)
 			return -1;
 	}
 
-	ll_init_map(&rth);
+	ll_init_map_lazy();
 
 	if (dev) {
 		req.ndm.ndm_ifindex = ll_name_to_index(dev);
@@ -303,6 +386,34 @@ static int print_neigh_brief(FILE *fp, struct ndmsg *r, struct rtattr *tb[])
 	return 0;
 }
 
+/* The kernel only looks at the key of the entry to delete */
+#define IPNEIGH_FLUSH_REQLEN \
+	NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct ndmsg)) + \
+		    RTA_LENGTH(sizeof(struct in6_addr)))
+
+static int ipneigh_flush_add(const struct ndmsg *ndm,
+			     const struct rtattr *dst)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct ndmsg		ndm;
+		char			buf[64];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
+		.n.nlmsg_type = RTM_DELNEIGH,
+		.ndm.ndm_family = ndm->ndm_family,
+		.ndm.ndm_ifindex = ndm->ndm_ifindex,
+		.ndm.ndm_flags = ndm->ndm_flags & NTF_PROXY,
+	};
+
+	if (dst &&
+	    addattr_l(&req.n, sizeof(req), NDA_DST, RTA_DATA(dst),
+		      RTA_PAYLOAD(dst)) < 0)
+		return -1;
+
+	return rtnl_flush_add(filter.flush, &req.n, 0);
+}
+
 int print_neigh(struct nlmsghdr *n, void *arg)
 {
 	FILE *fp = (FILE *)arg;
@@ -326,7 +437,7 @@ int print_neigh(struct nlmsghdr *n, void *arg)
 		return -1;
 	}
 
-	if (filter.flushb && n->nlmsg_type != RTM_NEWNEIGH)
+	if (filter.flush && n->nlmsg_type != RTM_NEWNEIGH)
 		return 0;
 
 	if (filter.family && filter.family != r->ndm_family)
@@ -367,19 +478,11 @@ int print_neigh(struct nlmsghdr *n, void *arg)
 			return 0;
 	}
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			if (flush_update())
-				return -1;
+	if (filter.flush) {
+		if (ipneigh_flush_add(r, tb[NDA_DST]) < 0) {
+			perror("Failed to send flush request");
+			return -1;
 		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELNEIGH;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -508,6 +611,7 @@ static int ipneigh_dump_filter(struct nlmsghdr *nlh, int reqlen)
 static int do_show_or_flush(int argc, char **argv, int flush)
 {
 	char *filter_dev = NULL;
+	unsigned int window = 0;
 	int state_given = 0;
 
 	ipneigh_reset_filter(0);
@@ -572,6 +676,11 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 			filter.state |= state;
 		} else if (strcmp(*argv, "proxy") == 0) {
 			filter.ndm_flags = NTF_PROXY;
+		} else if (flush && strcmp(*argv, "window") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&window, *argv, 0) || !window ||
+			    window > INT_MAX / IPNEIGH_FLUSH_REQLEN)
+				invarg("\"window\" value is invalid\n", *argv);
 		} else if (matches(*argv, "protocol") == 0) {
 			__u32 prot;
 
@@ -605,12 +714,14 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 	}
 
 	if (flush) {
+		struct rtnl_flush fl;
 		int round = 0;
-		char flushb[4096-512];
 
-		filter.flushb = flushb;
-		filter.flushp = 0;
-		filter.flushe = sizeof(flushb);
+		if (rtnl_flush_open(&fl, window * IPNEIGH_FLUSH_REQLEN) < 0)
+			exit(1);
+		/* aged out between the dump and the delete */
+		fl.ignore_errno = ENOENT;
+		filter.flush = &fl;
 
 		while (round < MAX_ROUNDS) {
 			if (rtnl_neighdump_req(&rth, filter.family,
@@ -628,14 +739,19 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 					if (round == 0)
 						printf("Nothing to flush.\n");
 					else
-						printf("*** Flush is complete after %d round%s ***\n", round, round > 1?"s":"");
+						printf("*** Flush is complete after %d round%s, %.0f deletes/s ***\n",
+						       round, round > 1?"s":"",
+						       rtnl_flush_rate(&fl));
 				}
 				fflush(stdout);
+				rtnl_flush_close(&fl);
 				return 0;
 			}
 			round++;
-			if (flush_update() < 0)
+			if (rtnl_flush_commit(&fl) < 0) {
+				perror("Failed to send flush request");
 				exit(1);
+			}
 			if (show_stats) {
 				printf("\n*** Round %d, deleting %d entries ***\n", round, filter.flushed);
 				fflush(stdout);
@@ -644,6 +760,7 @@ static int do_show_or_flush(int argc, char **argv, int flush)
 		}
 		printf("*** Flush not complete bailing out after %d rounds\n",
 			MAX_ROUNDS);
+		rtnl_flush_close(&fl);
 		return 1;
 	}
 
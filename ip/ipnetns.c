@@ -23,18 +23,20 @@
 #include "list.h"
 #include "ip_common.h"
 #include "namespace.h"
+#include "proc_scan.h"
 
 static int usage(void)
 {
 	fprintf(stderr,
 		"Usage:	ip netns list\n"
 		"	ip netns add NAME\n"
+		"	ip netns add-many PREFIX COUNT [ start FIRST ]\n"
 		"	ip netns attach NAME PID\n"
 		"	ip netns set NAME NETNSID\n"
 		"	ip [-all] netns delete [NAME]\n"
 		"	ip netns identify [PID]\n"
 		"	ip netns pids NAME\n"
-		"	ip [-all] netns exec [NAME] cmd ...\n"
+		"	ip [-all [-parallel N]] netns exec [NAME] cmd ...\n"
 		"	ip netns monitor\n"
 		"	ip netns list-id [target-nsid POSITIVE-INT] [nsid POSITIVE-INT]\n"
 		"NETNSID := auto | POSITIVE-INT\n");
@@ -103,13 +105,6 @@ static int ipnetns_have_nsid(void)
 	return have_rtnl_getnsid;
 }
 
-static int get_netnsid_from_name(const char *name)
-{
-	netns_nsid_socket_init();
-
-	return netns_id_from_name(&rtnsh, name);
-}
-
 struct nsid_cache {
 	struct hlist_node	nsid_hash;
 	struct hlist_node	name_hash;
@@ -117,13 +112,110 @@ struct nsid_cache {
 	char			name[0];
 };
 
-#define NSIDMAP_SIZE		128
+#define NSIDMAP_SIZE		1024
 #define NSID_HASH_NSID(nsid)	(nsid & (NSIDMAP_SIZE - 1))
 #define NSID_HASH_NAME(name)	(namehash(name) & (NSIDMAP_SIZE - 1))
 
+/* RTM_GETNSID requests sent per datagram */
+#define NSID_BATCH		64
+
 static struct hlist_head	nsid_head[NSIDMAP_SIZE];
 static struct hlist_head	name_head[NSIDMAP_SIZE];
 
+/*
+ * Names in NETNS_RUN_DIR whose nsid has not been asked for yet. The map
+ * is filled from here only when an nsid missing from it is looked up.
+ */
+static char			**nsid_pending;
+static int			nsid_pending_cnt;
+static int			nsid_pending_pos;
+
+struct nsid_batch {
+	int		*nsids;
+	__u32		seq;
+	int		cnt;
+	int		left;
+};
+
+static int nsid_batch_reply(struct rtnl_ctrl_data *ctrl,
+			    struct nlmsghdr *n, void *arg)
+{
+	struct rtgenmsg *rthdr = NLMSG_DATA(n);
+	struct rtattr *tb[NETNSA_MAX + 1];
+	struct nsid_batch *b = arg;
+	__u32 i = n->nlmsg_seq - b->seq;
+	int len;
+
+	if (n->nlmsg_pid != rtnsh.local.nl_pid || i >= b->cnt)
+		return 0;
+
+	len = n->nlmsg_len - NLMSG_SPACE(sizeof(*rthdr));
+	if (n->nlmsg_type == RTM_NEWNSID && len >= 0) {
+		parse_rtattr(tb, NETNSA_MAX, NETNS_RTA(rthdr), len);
+		if (tb[NETNSA_NSID])
+			b->nsids[i] = rta_getattr_s32(tb[NETNSA_NSID]);
+	}
+	return --b->left ? 0 : -1;
+}
+
+/*
+ * Get the nsids of up to NSID_BATCH namespaces with one datagram of
+ * RTM_GETNSID requests instead of a round trip each. nsids[i] is left
+ * at -1 when names[i] has no nsid or cannot be opened.
+ */
+static int netns_nsids_from_names(char **names, int *nsids, int cnt)
+{
+	char buf[NSID_BATCH * NLMSG_SPACE(NLMSG_ALIGN(sizeof(struct rtgenmsg)) +
+					  RTA_SPACE(sizeof(__u32)))];
+	struct nsid_batch b = { .nsids = nsids, .cnt = cnt };
+	int fds[NSID_BATCH];
+	int i, len = 0, err = 0;
+
+	if (rtnsh.fd < 0) {
+		for (i = 0; i < cnt; i++)
+			nsids[i] = -1;
+		return -1;
+	}
+
+	memset(buf, 0, sizeof(buf));
+	b.seq = rtnsh.seq + 1;
+	for (i = 0; i < cnt; i++) {
+		struct nlmsghdr *n = (struct nlmsghdr *)(buf + len);
+		struct rtgenmsg *g = NLMSG_DATA(n);
+
+		nsids[i] = -1;
+		fds[i] = netns_get_fd(names[i]);
+		if (fds[i] < 0)
+			continue;
+
+		n->nlmsg_len = NLMSG_LENGTH(sizeof(*g));
+		n->nlmsg_type = RTM_GETNSID;
+		n->nlmsg_flags = NLM_F_REQUEST;
+		n->nlmsg_seq = b.seq + i;
+		g->rtgen_family = AF_UNSPEC;
+		addattr32(n, sizeof(buf) - len, NETNSA_FD, fds[i]);
+		len += NLMSG_ALIGN(n->nlmsg_len);
+		b.left++;
+	}
+	rtnsh.seq = b.seq + cnt;
+
+	if (b.left) {
+		if (rtnl_send(&rtnsh, buf, len) < 0) {
+			perror("rtnl_send(RTM_GETNSID)");
+			err = -1;
+		} else {
+			rtnl_listen(&rtnsh, nsid_batch_reply, &b);
+			if (b.left)
+				err = -1;
+		}
+	}
+
+	for (i = 0; i < cnt; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	return err;
+}
+
 static struct nsid_cache *netns_map_get_by_nsid(int nsid)
 {
 	struct hlist_node *n;
@@ -143,6 +235,68 @@ static struct nsid_cache *netns_map_get_by_nsid(int nsid)
 	return NULL;
 }
 
+static struct nsid_cache *netns_map_get_by_name(const char *name)
+{
+	struct hlist_node *n;
+	uint32_t h;
+
+	h = NSID_HASH_NAME(name);
+	hlist_for_each(n, &name_head[h]) {
+		struct nsid_cache *c = container_of(n, struct nsid_cache,
+						    name_hash);
+		if (strcmp(c->name, name) == 0)
+			return c;
+	}
+
+	return NULL;
+}
+
+static int netns_map_add(int nsid, const char *name);
+
+/* Ask for the nsids of the next batch of pending names */
+static void netns_map_resolve_batch(void)
+{
+	char *names[NSID_BATCH];
+	int nsids[NSID_BATCH];
+	int i, cnt = 0;
+
+	while (cnt < NSID_BATCH && nsid_pending_pos < nsid_pending_cnt) {
+		char *name = nsid_pending[nsid_pending_pos++];
+
+		if (!netns_map_get_by_name(name))
+			names[cnt++] = name;
+	}
+	if (!cnt || netns_nsids_from_names(names, nsids, cnt) < 0)
+		return;
+
+	for (i = 0; i < cnt; i++)
+		if (nsids[i] >= 0)
+			netns_map_add(nsids[i], names[i]);
+}
+
+static struct nsid_cache *netns_map_resolve(int nsid)
+{
+	struct nsid_cache *c = netns_map_get_by_nsid(nsid);
+
+	while (!c && nsid_pending_pos < nsid_pending_cnt) {
+		netns_map_resolve_batch();
+		c = netns_map_get_by_nsid(nsid);
+	}
+	return c;
+}
+
+/* Queue again every name in NETNS_RUN_DIR the map does not have */
+static void netns_map_rescan(void)
+{
+	netns_names_free(nsid_pending, nsid_pending_cnt);
+	nsid_pending = NULL;
+	nsid_pending_cnt = nsid_pending_pos = 0;
+
+	nsid_pending_cnt = netns_names(&nsid_pending);
+	if (nsid_pending_cnt < 0)
+		nsid_pending_cnt = 0;
+}
+
 char *get_name_from_nsid(int nsid)
 {
 	struct nsid_cache *c;
@@ -153,7 +307,7 @@ char *get_name_from_nsid(int nsid)
 	netns_nsid_socket_init();
 	netns_map_init();
 
-	c = netns_map_get_by_nsid(nsid);
+	c = netns_map_resolve(nsid);
 	if (c)
 		return c->name;
 
@@ -204,64 +358,21 @@ void netns_nsid_socket_init(void)
 
 }
 
+/*
+ * Only list NETNS_RUN_DIR here; nsids are asked for on demand, in
+ * batches, by the first lookup that misses the map.
+ */
 void netns_map_init(void)
 {
 	static int initialized;
-	struct dirent *entry;
-	DIR *dir;
-	int nsid;
 
 	if (initialized || !ipnetns_have_nsid())
 		return;
 
-	dir = opendir(NETNS_RUN_DIR);
-	if (!dir)
-		return;
-
-	while ((entry = readdir(dir)) != NULL) {
-		if (strcmp(entry->d_name, ".") == 0)
-			continue;
-		if (strcmp(entry->d_name, "..") == 0)
-			continue;
-		nsid = get_netnsid_from_name(entry->d_name);
-
-		if (nsid >= 0)
-			netns_map_add(nsid, entry->d_name);
-	}
-	closedir(dir);
+	netns_map_rescan();
 	initialized = 1;
 }
 
-static int netns_get_name(int nsid, char *name)
-{
-	struct dirent *entry;
-	DIR *dir;
-	int id;
-
-	if (nsid < 0)
-		return -EINVAL;
-
-	dir = opendir(NETNS_RUN_DIR);
-	if (!dir)
-		return -ENOENT;
-
-	while ((entry = readdir(dir)) != NULL) {
-		if (strcmp(entry->d_name, ".") == 0)
-			continue;
-		if (strcmp(entry->d_name, "..") == 0)
-			continue;
-		id = get_netnsid_from_name(entry->d_name);
-
-		if (id >= 0 && nsid == id) {
-			strcpy(name, entry->d_name);
-			closedir(dir);
-			return 0;
-		}
-	}
-	closedir(dir);
-	return -ENOENT;
-}
-
 int print_nsid(struct nlmsghdr *n, void *arg)
 {
 	struct rtgenmsg *rthdr = NLMSG_DATA(n);
@@ -269,7 +380,6 @@ int print_nsid(struct nlmsghdr *n, void *arg)
 	int len = n->nlmsg_len;
 	FILE *fp = (FILE *)arg;
 	struct nsid_cache *c;
-	char name[NAME_MAX];
 	int nsid, current;
 
 	if (n->nlmsg_type != RTM_NEWNSID && n->nlmsg_type != RTM_DELNSID)
@@ -310,21 +420,23 @@ int print_nsid(struct nlmsghdr *n, void *arg)
 				  "current-nsid %d ", current);
 	}
 
-	c = netns_map_get_by_nsid(tb[NETNSA_CURRENT_NSID] ? current : nsid);
+	if (tb[NETNSA_CURRENT_NSID])
+		nsid = current;
+	c = netns_map_resolve(nsid);
+
+	/* a new nsid may belong to a name added since the map was filled */
+	if (c == NULL && n->nlmsg_type == RTM_NEWNSID && nsid >= 0) {
+		netns_map_rescan();
+		c = netns_map_resolve(nsid);
+	}
+
 	if (c != NULL) {
 		print_string(PRINT_ANY, "name",
 			     "(iproute2 netns name: %s)", c->name);
-		netns_map_del(c);
+		if (n->nlmsg_type == RTM_DELNSID)
+			netns_map_del(c);
 	}
 
-	/* nsid might not be in cache */
-	if (c == NULL && n->nlmsg_type == RTM_NEWNSID)
-		if (netns_get_name(nsid, name) == 0) {
-			print_string(PRINT_ANY, "name",
-				     "(iproute2 netns name: %s)", name);
-			netns_map_add(nsid, name);
-		}
-
 	print_string(PRINT_FP, NULL, "\n", NULL);
 	close_json_object();
 	fflush(fp);
@@ -447,34 +559,31 @@ static int netns_list_id(int argc, char **argv)
 
 static int netns_list(int argc, char **argv)
 {
-	struct dirent *entry;
-	DIR *dir;
-	int id;
+	int ids[NSID_BATCH];
+	char **names;
+	int cnt, i, j;
 
-	dir = opendir(NETNS_RUN_DIR);
-	if (!dir)
+	cnt = netns_names(&names);
+	if (cnt < 0)
 		return 0;
 
 	new_json_obj(json);
-	while ((entry = readdir(dir)) != NULL) {
-		if (strcmp(entry->d_name, ".") == 0)
-			continue;
-		if (strcmp(entry->d_name, "..") == 0)
-			continue;
-
-		open_json_object(NULL);
-		print_string(PRINT_ANY, "name",
-			     "%s", entry->d_name);
-		if (ipnetns_have_nsid()) {
-			id = get_netnsid_from_name(entry->d_name);
-			if (id >= 0)
-				print_int(PRINT_ANY, "id", " (id: %d)", id);
+	for (i = 0; i < cnt; i += NSID_BATCH) {
+		int batch = min(cnt - i, NSID_BATCH);
+
+		netns_nsids_from_names(names + i, ids, batch);
+
+		for (j = 0; j < batch; j++) {
+			open_json_object(NULL);
+			print_string(PRINT_ANY, "name", "%s", names[i + j]);
+			if (ids[j] >= 0)
+				print_int(PRINT_ANY, "id", " (id: %d)", ids[j]);
+			print_string(PRINT_FP, NULL, "\n", NULL);
+			close_json_object();
 		}
-		print_string(PRINT_FP, NULL, "\n", NULL);
-		close_json_object();
 	}
-	closedir(dir);
 	delete_json_obj();
+	netns_names_free(names, cnt);
 	return 0;
 }
 
@@ -499,6 +608,36 @@ static int on_netns_exec(char *nsname, void *arg)
 	return 0;
 }
 
+static void on_netns_exec_done(void *arg, int fd, int status)
+{
+	char buf[4096];
+	off_t off = 0;
+	ssize_t cc;
+
+	printf("\nnetns: %s\n", (char *)arg);
+	while ((cc = pread(fd, buf, sizeof(buf), off)) > 0) {
+		fwrite(buf, 1, cc, stdout);
+		off += cc;
+	}
+	fflush(stdout);
+}
+
+/* The same as netns_foreach(on_netns_exec), netns_jobs at a time */
+static int netns_exec_parallel(char **argv)
+{
+	char **names;
+	int cnt, ret;
+
+	cnt = netns_names(&names);
+	if (cnt < 0)
+		return -1;
+
+	ret = cmd_exec_parallel(argv[0], argv, (void **)names, cnt,
+				netns_jobs, do_switch, on_netns_exec_done);
+	netns_names_free(names, cnt);
+	return ret;
+}
+
 static int netns_exec(int argc, char **argv)
 {
 	/* Setup the proper environment for apps that are not netns
@@ -513,6 +652,8 @@ static int netns_exec(int argc, char **argv)
 		return -1;
 	}
 
+	if (do_all && netns_jobs > 1)
+		return netns_exec_parallel(argv);
 	if (do_all)
 		return netns_foreach(on_netns_exec, argv);
 
@@ -534,14 +675,37 @@ static int is_pid(const char *str)
 	return 1;
 }
 
+static void netns_pids_visit(int dirfd, int pid, int tid,
+			     struct proc_scan_buf *out, void *arg)
+{
+	const struct stat *netst = arg;
+	struct stat st;
+
+	if (fstatat(dirfd, "ns/net", &st, 0) != 0)
+		return;
+	if ((st.st_dev == netst->st_dev) &&
+	    (st.st_ino == netst->st_ino))
+		proc_scan_emit(out, &pid, sizeof(pid));
+}
+
+static int netns_pids_print(const void *rec, size_t len, void *arg)
+{
+	printf("%d\n", *(const int *)rec);
+	return 0;
+}
+
 static int netns_pids(int argc, char **argv)
 {
 	const char *name;
 	char net_path[PATH_MAX];
 	int netns = -1, ret = -1;
 	struct stat netst;
-	DIR *dir;
-	struct dirent *entry;
+	struct proc_scan ps = {
+		.root = "/proc",
+		.visit = netns_pids_visit,
+		.collect = netns_pids_print,
+		.arg = &netst,
+	};
 
 	if (argc < 1) {
 		fprintf(stderr, "No netns name specified\n");
@@ -565,29 +729,12 @@ static int netns_pids(int argc, char **argv)
 			strerror(errno));
 		goto out;
 	}
-	dir = opendir("/proc/");
-	if (!dir) {
+	if (proc_scan(&ps) < 0) {
 		fprintf(stderr, "Open of /proc failed: %s\n",
 			strerror(errno));
 		goto out;
 	}
-	while ((entry = readdir(dir))) {
-		char pid_net_path[PATH_MAX];
-		struct stat st;
-
-		if (!is_pid(entry->d_name))
-			continue;
-		snprintf(pid_net_path, sizeof(pid_net_path), "/proc/%s/ns/net",
-			entry->d_name);
-		if (stat(pid_net_path, &st) != 0)
-			continue;
-		if ((st.st_dev == netst.st_dev) &&
-		    (st.st_ino == netst.st_ino)) {
-			printf("%s\n", entry->d_name);
-		}
-	}
 	ret = 0;
-	closedir(dir);
 out:
 	if (netns >= 0)
 		close(netns);
@@ -631,7 +778,6 @@ int netns_identify_pid(const char *pidstr, char *name, int len)
 	}
 
 	while ((entry = readdir(dir))) {
-		char name_path[PATH_MAX];
 		struct stat st;
 
 		if (strcmp(entry->d_name, ".") == 0)
@@ -639,10 +785,7 @@ int netns_identify_pid(const char *pidstr, char *name, int len)
 		if (strcmp(entry->d_name, "..") == 0)
 			continue;
 
-		snprintf(name_path, sizeof(name_path), "%s/%s",	NETNS_RUN_DIR,
-			entry->d_name);
-
-		if (stat(name_path, &st) != 0)
+		if (fstatat(dirfd(dir), entry->d_name, &st, 0) != 0)
 			continue;
 
 		if ((st.st_dev == netst.st_dev) &&
@@ -754,46 +897,12 @@ static void netns_restore(void)
 	saved_netns = -1;
 }
 
-static int netns_add(int argc, char **argv, bool create)
+/* Set up NETNS_RUN_DIR for the bind mounts of the namespaces added to it */
+static int netns_run_dir_setup(void)
 {
-	/* This function creates a new network namespace and
-	 * a new mount namespace and bind them into a well known
-	 * location in the filesystem based on the name provided.
-	 *
-	 * If create is true, a new namespace will be created,
-	 * otherwise an existing one will be attached to the file.
-	 *
-	 * The mount namespace is created so that any necessary
-	 * userspace tweaks like remounting /sys, or bind mounting
-	 * a new /etc/resolv.conf can be shared between users.
-	 */
-	char netns_path[PATH_MAX], proc_path[PATH_MAX];
-	const char *name;
-	pid_t pid;
-	int fd;
 	int lock;
 	int made_netns_run_dir_mount = 0;
 
-	if (create) {
-		if (argc < 1) {
-			fprintf(stderr, "No netns name specified\n");
-			return -1;
-		}
-	} else {
-		if (argc < 2) {
-			fprintf(stderr, "No netns name and PID specified\n");
-			return -1;
-		}
-
-		if (get_s32(&pid, argv[1], 0) || !pid) {
-			fprintf(stderr, "Invalid PID: %s\n", argv[1]);
-			return -1;
-		}
-	}
-	name = argv[0];
-
-	snprintf(netns_path, sizeof(netns_path), "%s/%s", NETNS_RUN_DIR, name);
-
 	if (create_netns_dir())
 		return -1;
 
@@ -867,6 +976,50 @@ static int netns_add(int argc, char **argv, bool create)
 		close(lock);
 	}
 
+	return 0;
+}
+
+static int netns_add(int argc, char **argv, bool create)
+{
+	/* This function creates a new network namespace and
+	 * a new mount namespace and bind them into a well known
+	 * location in the filesystem based on the name provided.
+	 *
+	 * If create is true, a new namespace will be created,
+	 * otherwise an existing one will be attached to the file.
+	 *
+	 * The mount namespace is created so that any necessary
+	 * userspace tweaks like remounting /sys, or bind mounting
+	 * a new /etc/resolv.conf can be shared between users.
+	 */
+	char netns_path[PATH_MAX], proc_path[PATH_MAX];
+	const char *name;
+	pid_t pid;
+	int fd;
+
+	if (create) {
+		if (argc < 1) {
+			fprintf(stderr, "No netns name specified\n");
+			return -1;
+		}
+	} else {
+		if (argc < 2) {
+			fprintf(stderr, "No netns name and PID specified\n");
+			return -1;
+		}
+
+		if (get_s32(&pid, argv[1], 0) || !pid) {
+			fprintf(stderr, "Invalid PID: %s\n", argv[1]);
+			return -1;
+		}
+	}
+	name = argv[0];
+
+	snprintf(netns_path, sizeof(netns_path), "%s/%s", NETNS_RUN_DIR, name);
+
+	if (netns_run_dir_setup())
+		return -1;
+
 	/* Create the filesystem state */
 	fd = open(netns_path, O_RDONLY|O_CREAT|O_EXCL, 0);
 	if (fd < 0) {
@@ -909,6 +1062,94 @@ out_delete:
 	return -1;
 }
 
+static int invalid_name(const char *name);
+
+/*
+ * Add PREFIX<FIRST> to PREFIX<FIRST + COUNT - 1> in one go: the run
+ * directory is set up once and every namespace is then just an
+ * unshare() and a bind mount, from this process.
+ */
+static int netns_add_many(int argc, char **argv)
+{
+	char name[NAME_MAX + 1], netns_path[PATH_MAX];
+	unsigned int count, first = 0, i;
+	const char *prefix;
+	int dirfd, fd;
+
+	if (argc < 2) {
+		fprintf(stderr, "No netns name prefix and count specified\n");
+		return -1;
+	}
+	prefix = argv[0];
+	if (get_unsigned(&count, argv[1], 0) || !count)
+		invarg("Invalid namespace count", argv[1]);
+	argc -= 2;
+	argv += 2;
+	if (argc >= 2 && strcmp(argv[0], "start") == 0) {
+		if (get_unsigned(&first, argv[1], 0))
+			invarg("Invalid first namespace number", argv[1]);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc) {
+		fprintf(stderr, "Unknown argument \"%s\"\n", argv[0]);
+		return -1;
+	}
+	if (first + count - 1 < first ||
+	    snprintf(name, sizeof(name), "%s%u", prefix, first + count - 1) >=
+	    sizeof(name) || invalid_name(name)) {
+		fprintf(stderr, "Invalid netns name prefix \"%s\"\n", prefix);
+		return -1;
+	}
+
+	if (netns_run_dir_setup())
+		return -1;
+
+	dirfd = open(NETNS_RUN_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		fprintf(stderr, "Cannot open netns runtime directory \"%s\": %s\n",
+			NETNS_RUN_DIR, strerror(errno));
+		return -1;
+	}
+
+	netns_save();
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "%s%u", prefix, first + i);
+		snprintf(netns_path, sizeof(netns_path), "%s/%s",
+			 NETNS_RUN_DIR, name);
+
+		fd = openat(dirfd, name, O_RDONLY | O_CREAT | O_EXCL, 0);
+		if (fd < 0) {
+			fprintf(stderr, "Cannot create namespace file \"%s\": %s\n",
+				netns_path, strerror(errno));
+			break;
+		}
+		close(fd);
+
+		if (unshare(CLONE_NEWNET) < 0) {
+			fprintf(stderr, "Failed to create a new network namespace \"%s\": %s\n",
+				name, strerror(errno));
+			unlinkat(dirfd, name, 0);
+			break;
+		}
+		if (mount("/proc/self/ns/net", netns_path, "none",
+			  MS_BIND, NULL) < 0) {
+			fprintf(stderr, "Bind /proc/self/ns/net -> %s failed: %s\n",
+				netns_path, strerror(errno));
+			unlinkat(dirfd, name, 0);
+			break;
+		}
+	}
+	netns_restore();
+	close(dirfd);
+
+	if (i < count) {
+		fprintf(stderr, "Added %u of %u namespaces\n", i, count);
+		return -1;
+	}
+	return 0;
+}
+
 static int set_netnsid_from_name(const char *name, int nsid)
 {
 	netns_nsid_socket_init();
@@ -992,10 +1233,8 @@ int do_netns(int argc, char **argv)
 {
 	netns_nsid_socket_init();
 
-	if (argc < 1) {
-		netns_map_init();
+	if (argc < 1)
 		return netns_list(0, NULL);
-	}
 
 	if (!do_all && argc > 1 && invalid_name(argv[1])) {
 		fprintf(stderr, "Invalid netns name \"%s\"\n", argv[1]);
@@ -1003,10 +1242,8 @@ int do_netns(int argc, char **argv)
 	}
 
 	if ((matches(*argv, "list") == 0) || (matches(*argv, "show") == 0) ||
-	    (matches(*argv, "lst") == 0)) {
-		netns_map_init();
+	    (matches(*argv, "lst") == 0))
 		return netns_list(argc-1, argv+1);
-	}
 
 	if ((matches(*argv, "list-id") == 0)) {
 		netns_map_init();
@@ -1016,6 +1253,9 @@ int do_netns(int argc, char **argv)
 	if (matches(*argv, "help") == 0)
 		return usage();
 
+	if (strcmp(*argv, "add-many") == 0)
+		return netns_add_many(argc-1, argv+1);
+
 	if (matches(*argv, "add") == 0)
 		return netns_add(argc-1, argv+1, true);
 
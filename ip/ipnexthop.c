@@ -15,6 +15,7 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "nh_common.h"
+#include "rtnl_bulk.h"
 
 static struct {
 	unsigned int flushed;
@@ -36,9 +37,25 @@ enum {
 #define RTM_NHA(h)  ((struct rtattr *)(((char *)(h)) + \
 			NLMSG_ALIGN(sizeof(struct nhmsg))))
 
-static struct hlist_head nh_cache[NH_CACHE_SIZE];
+/* Nexthops looked up while printing routes (nh_info) or followed by
+ * ip monitor. The hash grows with the number of entries, and once more
+ * than NH_CACHE_PREFETCH ids had to be looked up one by one, all
+ * nexthops are dumped at once instead.
+ */
+#define NH_CACHE_PREFETCH	32
+
+static struct hlist_head *nh_cache;
+static unsigned int nh_cache_size;
+static unsigned int nh_cache_cnt;
 static struct rtnl_handle nh_cache_rth = { .fd = -1 };
 
+static struct {
+	unsigned int hits;
+	unsigned int lookups;
+	unsigned int prefetched;
+	bool prefetch_done;
+} nh_cache_stats;
+
 static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
@@ -46,8 +63,9 @@ static void usage(void)
 	fprintf(stderr,
 		"Usage: ip nexthop { list | flush } [ protocol ID ] SELECTOR\n"
 		"       ip nexthop { add | replace } id ID NH [ protocol ID ]\n"
+		"       ip nexthop { add | replace } file FILE [ BULK_OPTIONS ]\n"
 		"       ip nexthop { get | del } id ID\n"
-		"       ip nexthop bucket list BUCKET_SELECTOR\n"
+		"       ip nexthop bucket list BUCKET_SELECTOR [ summary ]\n"
 		"       ip nexthop bucket get id ID index INDEX\n"
 		"SELECTOR := [ id ID ] [ dev DEV ] [ vrf NAME ] [ master DEV ]\n"
 		"            [ groups ] [ fdb ]\n"
@@ -62,7 +80,10 @@ static void usage(void)
 		"RESILIENT_ARGS := [ buckets BUCKETS ] [ idle_timer IDLE ]\n"
 		"                  [ unbalanced_timer UNBALANCED ]\n"
 		"ENCAPTYPE := [ mpls ]\n"
-		"ENCAPHDR := [ MPLSLABEL ]\n");
+		"ENCAPHDR := [ MPLSLABEL ]\n"
+		"BULK_OPTIONS := [ protocol ID ] [ onlink ] [ fdb ]\n"
+		"                [ encap ENCAPTYPE ENCAPHDR ]\n"
+		"                [ type TYPE [ TYPE_ARGS ] ] [ hw_stats {off|on} ]\n");
 	exit(-1);
 }
 
@@ -644,32 +665,73 @@ static int  __ipnh_get_id(struct rtnl_handle *rthp, __u32 nh_id,
 	return rtnl_talk(rthp, &req.n, answer);
 }
 
-static struct hlist_head *ipnh_cache_head(__u32 nh_id)
+static struct hlist_head *__ipnh_cache_head(struct hlist_head *cache,
+					    unsigned int size, __u32 nh_id)
 {
 	nh_id ^= nh_id >> 20;
 	nh_id ^= nh_id >> 10;
 
-	return &nh_cache[nh_id % NH_CACHE_SIZE];
+	return &cache[nh_id % size];
+}
+
+static struct hlist_head *ipnh_cache_head(__u32 nh_id)
+{
+	return __ipnh_cache_head(nh_cache, nh_cache_size, nh_id);
+}
+
+/* Keep the chains short: rehash into 4 times the buckets when full */
+static void ipnh_cache_grow(void)
+{
+	unsigned int size = nh_cache_size ? 4 * nh_cache_size : NH_CACHE_SIZE;
+	struct hlist_head *cache;
+	unsigned int i;
+
+	cache = calloc(size, sizeof(*cache));
+	if (!cache)
+		return;
+
+	for (i = 0; i < nh_cache_size; i++) {
+		struct hlist_node *n, *tmp;
+
+		hlist_for_each_safe(n, tmp, &nh_cache[i]) {
+			struct nh_entry *nhe;
+
+			nhe = container_of(n, struct nh_entry, nh_hash);
+			hlist_del(n);
+			hlist_add_head(n, __ipnh_cache_head(cache, size,
+							    nhe->nh_id));
+		}
+	}
+	free(nh_cache);
+	nh_cache = cache;
+	nh_cache_size = size;
 }
 
 static void ipnh_cache_link_entry(struct nh_entry *nhe)
 {
-	struct hlist_head *head = ipnh_cache_head(nhe->nh_id);
+	if (nh_cache_cnt >= nh_cache_size)
+		ipnh_cache_grow();
 
-	hlist_add_head(&nhe->nh_hash, head);
+	hlist_add_head(&nhe->nh_hash, ipnh_cache_head(nhe->nh_id));
+	nh_cache_cnt++;
 }
 
 static void ipnh_cache_unlink_entry(struct nh_entry *nhe)
 {
 	hlist_del(&nhe->nh_hash);
+	nh_cache_cnt--;
 }
 
 static struct nh_entry *ipnh_cache_get(__u32 nh_id)
 {
-	struct hlist_head *head = ipnh_cache_head(nh_id);
+	struct hlist_head *head;
 	struct nh_entry *nhe;
 	struct hlist_node *n;
 
+	if (!nh_cache)
+		return NULL;
+
+	head = ipnh_cache_head(nh_id);
 	hlist_for_each(n, head) {
 		nhe = container_of(n, struct nh_entry, nh_hash);
 		if (nhe->nh_id == nh_id)
@@ -699,6 +761,49 @@ static int __ipnh_cache_parse_nlmsg(const struct nlmsghdr *n,
 	return 0;
 }
 
+static int ipnh_cache_prefetch_filter(struct nlmsghdr *nlh, int reqlen)
+{
+	return addattr32(nlh, reqlen, NHA_OP_FLAGS, ipnh_get_op_flags());
+}
+
+static int ipnh_cache_prefetch_one(struct nlmsghdr *n, void *arg)
+{
+	struct nh_entry *nhe;
+
+	if (n->nlmsg_type != RTM_NEWNEXTHOP)
+		return 0;
+
+	nhe = malloc(sizeof(*nhe));
+	if (!nhe)
+		return -1;
+
+	if (__ipnh_cache_parse_nlmsg(n, nhe)) {
+		free(nhe);
+		return 0;
+	}
+	if (ipnh_cache_get(nhe->nh_id)) {
+		ipnh_destroy_entry(nhe);
+		free(nhe);
+		return 0;
+	}
+
+	ipnh_cache_link_entry(nhe);
+	nh_cache_stats.prefetched++;
+	return 0;
+}
+
+/* One dump of all nexthops, for when lookups by id do not pay off */
+static void ipnh_cache_prefetch(void)
+{
+	nh_cache_stats.prefetch_done = true;
+
+	if (rtnl_nexthopdump_req(&nh_cache_rth, AF_UNSPEC,
+				 ipnh_cache_prefetch_filter) < 0 ||
+	    rtnl_dump_filter(&nh_cache_rth, ipnh_cache_prefetch_one,
+			     NULL) < 0)
+		fprintf(stderr, "Cannot dump nexthops, looking them up by id\n");
+}
+
 static struct nh_entry *ipnh_cache_add(__u32 nh_id)
 {
 	struct nlmsghdr *answer = NULL;
@@ -709,6 +814,15 @@ static struct nh_entry *ipnh_cache_add(__u32 nh_id)
 		goto out;
 	}
 
+	if (!nh_cache_stats.prefetch_done &&
+	    nh_cache_stats.lookups >= NH_CACHE_PREFETCH) {
+		ipnh_cache_prefetch();
+		nhe = ipnh_cache_get(nh_id);
+		if (nhe)
+			goto out;
+	}
+
+	nh_cache_stats.lookups++;
 	if (__ipnh_get_id(&nh_cache_rth, nh_id, &answer) < 0)
 		goto out;
 
@@ -784,6 +898,8 @@ void print_cache_nexthop_id(FILE *fp, const char *fp_prefix, const char *jsobj,
 		nhe = ipnh_cache_add(nh_id);
 		if (!nhe)
 			return;
+	} else {
+		nh_cache_stats.hits++;
 	}
 
 	if (fp_prefix)
@@ -791,6 +907,16 @@ void print_cache_nexthop_id(FILE *fp, const char *fp_prefix, const char *jsobj,
 	__print_nexthop_entry(fp, jsobj, nhe, false);
 }
 
+void print_nexthop_cache_stats(FILE *fp)
+{
+	if (!nh_cache_stats.hits && !nh_cache_stats.lookups)
+		return;
+
+	fprintf(fp, "nexthop cache: %u hits, %u lookups, %u prefetched\n",
+		nh_cache_stats.hits, nh_cache_stats.lookups,
+		nh_cache_stats.prefetched);
+}
+
 int print_cache_nexthop(struct nlmsghdr *n, void *arg, bool process_cache)
 {
 	struct nhmsg *nhm = NLMSG_DATA(n);
@@ -887,6 +1013,151 @@ int print_nexthop_bucket(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/* "bucket list ... summary" prints, per group and member, the number of
+ * buckets and their idle times instead of every bucket. They are folded
+ * in as the dump streams in: the kernel dumps the buckets of a group one
+ * after another, so only the members of the current group are kept, in
+ * an array that is reused from group to group.
+ */
+#define NH_IDLE_HIST		8	/* [0,1s) [1s,2s) [2s,4s) ... [64s,inf) */
+
+struct nh_bucket_member {
+	__u32		nhid;
+	__u32		buckets;
+	__u64		idle_sum;
+	__u64		idle_min;
+	__u64		idle_max;
+	__u32		idle_hist[NH_IDLE_HIST];
+};
+
+struct nh_bucket_summary {
+	__u32			id;
+	struct nh_bucket_member	*members;
+	unsigned int		cnt;
+	unsigned int		size;
+};
+
+static void print_idle_time(const char *key, const char *fmt, __u64 jiffies)
+{
+	struct timeval tv;
+
+	__jiffies_to_tv(&tv, jiffies);
+	print_tv(PRINT_ANY, key, fmt, &tv);
+}
+
+static void nh_bucket_summary_flush(struct nh_bucket_summary *s)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < s->cnt; i++) {
+		const struct nh_bucket_member *m = &s->members[i];
+
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "id", "id %u ", s->id);
+		print_uint(PRINT_ANY, "nhid", "nhid %u ", m->nhid);
+		print_uint(PRINT_ANY, "buckets", "buckets %u ", m->buckets);
+
+		open_json_object("idle_time");
+		print_string(PRINT_FP, NULL, "%s", "idle_time ");
+		print_idle_time("min", "min %g ", m->idle_min);
+		print_idle_time("avg", "avg %g ", m->idle_sum / m->buckets);
+		print_idle_time("max", "max %g ", m->idle_max);
+		close_json_object();
+
+		open_json_array(PRINT_JSON, "idle_hist");
+		print_string(PRINT_FP, NULL, "%s", "idle_hist ");
+		for (j = 0; j < NH_IDLE_HIST; j++)
+			print_uint(PRINT_ANY, NULL,
+				   j < NH_IDLE_HIST - 1 ? "%u/" : "%u",
+				   m->idle_hist[j]);
+		close_json_array(PRINT_JSON, NULL);
+
+		print_string(PRINT_FP, NULL, "%s", "\n");
+		close_json_object();
+	}
+	s->cnt = 0;
+}
+
+static struct nh_bucket_member *
+nh_bucket_summary_member(struct nh_bucket_summary *s, __u32 nhid)
+{
+	struct nh_bucket_member *m;
+	unsigned int i;
+
+	for (i = 0; i < s->cnt; i++)
+		if (s->members[i].nhid == nhid)
+			return &s->members[i];
+
+	if (s->cnt == s->size) {
+		unsigned int size = s->size ? 2 * s->size : 64;
+
+		m = realloc(s->members, size * sizeof(*m));
+		if (!m)
+			return NULL;
+		s->members = m;
+		s->size = size;
+	}
+
+	m = &s->members[s->cnt++];
+	memset(m, 0, sizeof(*m));
+	m->nhid = nhid;
+	m->idle_min = ~0ULL;
+	return m;
+}
+
+static int nh_bucket_summary_add(struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *tb[NHA_MAX + 1], *btb[NHA_RES_BUCKET_MAX + 1];
+	struct nh_bucket_summary *s = arg;
+	struct nhmsg *nhm = NLMSG_DATA(n);
+	struct nh_bucket_member *m;
+	__u64 idle = 0, secs;
+	int len, bin;
+	__u32 id;
+
+	if (n->nlmsg_type != RTM_NEWNEXTHOPBUCKET)
+		return 0;
+
+	len = n->nlmsg_len - NLMSG_SPACE(sizeof(*nhm));
+	if (len < 0) {
+		fprintf(stderr, "BUG: wrong nlmsg len %d\n", len);
+		return -1;
+	}
+
+	parse_rtattr_flags(tb, NHA_MAX, RTM_NHA(nhm), len, NLA_F_NESTED);
+	if (!tb[NHA_ID] || !tb[NHA_RES_BUCKET])
+		return 0;
+	parse_rtattr_nested(btb, NHA_RES_BUCKET_MAX, tb[NHA_RES_BUCKET]);
+	if (!btb[NHA_RES_BUCKET_NH_ID])
+		return 0;
+
+	id = rta_getattr_u32(tb[NHA_ID]);
+	if (id != s->id) {
+		nh_bucket_summary_flush(s);
+		s->id = id;
+	}
+
+	m = nh_bucket_summary_member(s, rta_getattr_u32(btb[NHA_RES_BUCKET_NH_ID]));
+	if (!m)
+		return -1;
+
+	if (btb[NHA_RES_BUCKET_IDLE_TIME])
+		idle = rta_getattr_u64(btb[NHA_RES_BUCKET_IDLE_TIME]);
+
+	m->buckets++;
+	m->idle_sum += idle;
+	m->idle_min = min(m->idle_min, idle);
+	m->idle_max = max(m->idle_max, idle);
+
+	/* idle times are in units of 10ms, see __jiffies_to_tv() */
+	secs = idle / 100;
+	for (bin = 0; secs && bin < NH_IDLE_HIST - 1; bin++)
+		secs >>= 1;
+	m->idle_hist[bin]++;
+
+	return 0;
+}
+
 static int add_nh_group_attr(struct nlmsghdr *n, int maxlen, char *argv)
 {
 	struct nexthop_grp *grps = NULL;
@@ -1047,6 +1318,295 @@ static int ipnh_parse_id(const char *argv)
 	return id;
 }
 
+/* "file FILE" adds one nexthop per line of FILE:
+ *
+ *	ID GATEWAY DEV
+ *	ID blackhole
+ *	ID group ID[,WEIGHT]/ID[,WEIGHT]/...
+ *
+ * where either of GATEWAY and DEV may be "-". The options given on the
+ * command line are parsed once and copied into each request, those that
+ * only make sense for groups (type, hw_stats) or for single nexthops
+ * (onlink, encap) only into those.
+ *
+ * Group members must be added earlier in the file or exist already; the
+ * ids in the kernel are dumped once, the first time a member is not one
+ * of the file's, instead of being looked up per group.
+ */
+#define IPNH_BULK_WINDOW	1024
+#define IPNH_BULK_MAX_GRP	1024
+
+struct ipnh_bulk_req {
+	struct nlmsghdr	n;
+	struct nhmsg	nhm;
+	char		buf[IPNH_BULK_MAX_GRP * sizeof(struct nexthop_grp) +
+			    1024];
+};
+
+/* Open addressed set of nexthop ids, 0 marks a free slot */
+struct ipnh_idset {
+	__u32		*ids;
+	unsigned int	size;
+	unsigned int	cnt;
+};
+
+static __u32 *ipnh_idset_slot(const struct ipnh_idset *set, __u32 id)
+{
+	unsigned int i = (id * 0x9e3779b1U) & (set->size - 1);
+
+	while (set->ids[i] && set->ids[i] != id)
+		i = (i + 1) & (set->size - 1);
+	return &set->ids[i];
+}
+
+static bool ipnh_idset_has(const struct ipnh_idset *set, __u32 id)
+{
+	return set->size && *ipnh_idset_slot(set, id) == id;
+}
+
+/* Returns 1 if id was added, 0 if it was there already */
+static int ipnh_idset_add(struct ipnh_idset *set, __u32 id)
+{
+	__u32 *slot;
+
+	if (2 * (set->cnt + 1) > set->size) {
+		struct ipnh_idset grown = {
+			.size = set->size ? 2 * set->size : 1024,
+		};
+		unsigned int i;
+
+		grown.ids = calloc(grown.size, sizeof(*grown.ids));
+		if (!grown.ids)
+			return -1;
+		for (i = 0; i < set->size; i++)
+			if (set->ids[i])
+				*ipnh_idset_slot(&grown, set->ids[i]) =
+					set->ids[i];
+		grown.cnt = set->cnt;
+		free(set->ids);
+		*set = grown;
+	}
+
+	slot = ipnh_idset_slot(set, id);
+	if (*slot)
+		return 0;
+	*slot = id;
+	set->cnt++;
+	return 1;
+}
+
+struct ipnh_bulk {
+	const struct nlmsghdr	*group;	/* prototype of group requests */
+	/* ids added by the file, and those in the kernel when dumped */
+	struct ipnh_idset	ids;
+	struct ipnh_idset	kernel_ids;
+	bool			dumped;
+	bool			unchecked;
+	bool			excl;
+};
+
+static int ipnh_bulk_dump_id(struct nlmsghdr *n, void *arg)
+{
+	struct nhmsg *nhm = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_SPACE(sizeof(*nhm));
+	struct rtattr *tb[NHA_MAX + 1];
+
+	if (n->nlmsg_type != RTM_NEWNEXTHOP || len < 0)
+		return 0;
+
+	parse_rtattr_flags(tb, NHA_MAX, RTM_NHA(nhm), len, NLA_F_NESTED);
+	if (tb[NHA_ID] &&
+	    ipnh_idset_add(arg, rta_getattr_u32(tb[NHA_ID])) < 0)
+		return -1;
+	return 0;
+}
+
+static bool ipnh_bulk_known_id(struct ipnh_bulk *b, __u32 id)
+{
+	if (ipnh_idset_has(&b->ids, id))
+		return true;
+
+	if (!b->dumped) {
+		b->dumped = true;
+		if (rtnl_nexthopdump_req(&rth, AF_UNSPEC, NULL) < 0 ||
+		    rtnl_dump_filter(&rth, ipnh_bulk_dump_id,
+				     &b->kernel_ids) < 0) {
+			fprintf(stderr, "Cannot dump nexthops, group members are not checked\n");
+			b->unchecked = true;
+		}
+	}
+	return b->unchecked || ipnh_idset_has(&b->kernel_ids, id);
+}
+
+/* Like add_nh_group_attr(), but reports errors instead of exiting */
+static const char *ipnh_bulk_group(struct ipnh_bulk *b, struct nlmsghdr *n,
+				   int maxlen, char *str)
+{
+	struct nexthop_grp grps[IPNH_BULK_MAX_GRP] = {};
+	int count = 0;
+	char *tok, *wsep;
+
+	for (tok = strtok(str, "/"); tok; tok = strtok(NULL, "/")) {
+		if (count == IPNH_BULK_MAX_GRP)
+			return "too many group members";
+
+		wsep = strchr(tok, ',');
+		if (wsep)
+			*wsep++ = '\0';
+		if (get_unsigned(&grps[count].id, tok, 0) || !grps[count].id)
+			return "invalid group member id";
+		if (!ipnh_bulk_known_id(b, grps[count].id))
+			return "unknown group member id";
+		if (wsep) {
+			unsigned int w;
+
+			if (get_unsigned(&w, wsep, 0) || w == 0 || w > 65536)
+				return "invalid weight";
+			nhgrp_set_weight(&grps[count], w);
+		}
+		count++;
+	}
+	if (!count)
+		return "empty group";
+
+	if (addattr_l(n, maxlen, NHA_GROUP, grps, count * sizeof(*grps)))
+		return "group too large";
+	return NULL;
+}
+
+static const char *ipnh_bulk_entry(struct rtnl_bulk *rb, struct nlmsghdr *n,
+				   int maxlen, char **tok, int ntok)
+{
+	struct nhmsg *nhm = NLMSG_DATA(n);
+	struct ipnh_bulk *b = rb->arg;
+	inet_prefix addr;
+	__u32 id;
+	int ifindex;
+
+	if (ntok > 1 && strcmp(tok[1], "group") == 0)
+		memcpy(n, b->group, b->group->nlmsg_len);
+
+	if (get_unsigned(&id, tok[0], 0) || !id)
+		return "invalid id";
+	addattr32(n, maxlen, NHA_ID, id);
+
+	if (ntok == 2 && strcmp(tok[1], "blackhole") == 0) {
+		addattr_l(n, maxlen, NHA_BLACKHOLE, NULL, 0);
+		if (nhm->nh_family == AF_UNSPEC)
+			nhm->nh_family = AF_INET;
+	} else if (ntok == 3 && strcmp(tok[1], "group") == 0) {
+		const char *err = ipnh_bulk_group(b, n, maxlen, tok[2]);
+
+		if (err)
+			return err;
+	} else if (ntok == 3) {
+		if (strcmp(tok[1], "-") != 0) {
+			if (get_addr_1(&addr, tok[1], nhm->nh_family))
+				return "invalid gateway";
+			nhm->nh_family = addr.family;
+			addattr_l(n, maxlen, NHA_GATEWAY, &addr.data,
+				  addr.bytelen);
+		}
+		if (strcmp(tok[2], "-") != 0) {
+			ifindex = ll_name_to_index(tok[2]);
+			if (!ifindex)
+				return "cannot find device";
+			addattr32(n, maxlen, NHA_OIF, ifindex);
+			if (nhm->nh_family == AF_UNSPEC)
+				nhm->nh_family = AF_INET;
+		}
+		if (nhm->nh_family == AF_UNSPEC)
+			return "gateway or device is required";
+	} else {
+		return "invalid nexthop";
+	}
+
+	switch (ipnh_idset_add(&b->ids, id)) {
+	case 0:
+		if (b->excl)
+			return "duplicate id";
+		break;
+	case -1:
+		return "out of memory";
+	}
+	return NULL;
+}
+
+static int ipnh_bulk(struct ipnh_bulk *b, const char *file,
+		     const struct nlmsghdr *single)
+{
+	struct rtnl_bulk rb = {
+		.file = file,
+		.what = "nexthops",
+		.window = IPNH_BULK_WINDOW,
+		.max_fields = 3,
+		.parse = ipnh_bulk_entry,
+		.arg = b,
+	};
+	int ret;
+
+	ret = rtnl_bulk_load(&rb, single, sizeof(struct ipnh_bulk_req));
+	if (show_stats)
+		printf("%u nexthops, %.0f nexthops/s\n", rb.entries, rb.rate);
+
+	free(b->ids.ids);
+	free(b->kernel_ids.ids);
+	return ret;
+}
+
+/* Split the command line attributes between single and group nexthops */
+static int ipnh_bulk_start(const char *file, const struct nlmsghdr *n)
+{
+	const struct nhmsg *nhm = NLMSG_DATA(n);
+	struct ipnh_bulk_req single, group;
+	struct ipnh_bulk b = {
+		.group = &group.n,
+		.excl = n->nlmsg_flags & NLM_F_EXCL,
+	};
+	struct rtattr *rta = RTM_NHA(nhm);
+	int len = n->nlmsg_len - NLMSG_SPACE(sizeof(*nhm));
+
+	if (n->nlmsg_type != RTM_NEWNEXTHOP) {
+		fprintf(stderr, "\"file\" is only supported by add and replace\n");
+		return -1;
+	}
+
+	memcpy(&single, n, NLMSG_SPACE(sizeof(*nhm)));
+	single.n.nlmsg_len = NLMSG_SPACE(sizeof(*nhm));
+	group = single;
+	group.nhm.nh_flags = 0;
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		bool to_single = false, to_group = false;
+
+		switch (rta->rta_type & NLA_TYPE_MASK) {
+		case NHA_FDB:
+			to_single = to_group = true;
+			break;
+		case NHA_ENCAP:
+		case NHA_ENCAP_TYPE:
+			to_single = true;
+			break;
+		case NHA_GROUP_TYPE:
+		case NHA_RES_GROUP:
+		case NHA_HW_STATS_ENABLE:
+			to_group = true;
+			break;
+		default:
+			fprintf(stderr, "Nexthop attributes other than BULK_OPTIONS cannot be used with \"file\"\n");
+			return -1;
+		}
+		if (to_single)
+			addraw_l(&single.n, sizeof(single), rta,
+				 RTA_ALIGN(rta->rta_len));
+		if (to_group)
+			addraw_l(&group.n, sizeof(group), rta,
+				 RTA_ALIGN(rta->rta_len));
+	}
+
+	return ipnh_bulk(&b, file, &single.n) ? -2 : 0;
+}
+
 static int ipnh_modify(int cmd, unsigned int flags, int argc, char **argv)
 {
 	struct {
@@ -1060,10 +1620,14 @@ static int ipnh_modify(int cmd, unsigned int flags, int argc, char **argv)
 		.nhm.nh_family = preferred_family,
 	};
 	__u32 nh_flags = 0;
+	char *file = NULL;
 	int ret;
 
 	while (argc > 0) {
-		if (!strcmp(*argv, "id")) {
+		if (!strcmp(*argv, "file")) {
+			NEXT_ARG();
+			file = *argv;
+		} else if (!strcmp(*argv, "id")) {
 			NEXT_ARG();
 			addattr32(&req.n, sizeof(req), NHA_ID,
 				  ipnh_parse_id(*argv));
@@ -1151,6 +1715,9 @@ static int ipnh_modify(int cmd, unsigned int flags, int argc, char **argv)
 
 	req.nhm.nh_flags = nh_flags;
 
+	if (file)
+		return ipnh_bulk_start(file, &req.n);
+
 	if (echo_request)
 		ret = rtnl_echo_talk(&rth, &req.n, json, print_nexthop_nocache);
 	else
@@ -1295,6 +1862,10 @@ static int ipnh_get(int argc, char **argv)
 
 static int ipnh_bucket_list(int argc, char **argv)
 {
+	struct nh_bucket_summary summary = {};
+	bool aggregate = false;
+	int ret;
+
 	while (argc > 0) {
 		if (!matches(*argv, "dev")) {
 			NEXT_ARG();
@@ -1319,6 +1890,8 @@ static int ipnh_bucket_list(int argc, char **argv)
 		} else if (!strcmp(*argv, "nhid")) {
 			NEXT_ARG();
 			filter.nhid = ipnh_parse_id(*argv);
+		} else if (!strcmp(*argv, "summary")) {
+			aggregate = true;
 		} else if (matches(*argv, "help") == 0) {
 			usage();
 		} else {
@@ -1335,11 +1908,18 @@ static int ipnh_bucket_list(int argc, char **argv)
 
 	new_json_obj(json);
 
-	if (rtnl_dump_filter(&rth, print_nexthop_bucket, stdout) < 0) {
+	if (aggregate)
+		ret = rtnl_dump_filter(&rth, nh_bucket_summary_add, &summary);
+	else
+		ret = rtnl_dump_filter(&rth, print_nexthop_bucket, stdout);
+	if (ret < 0) {
 		delete_json_obj();
+		free(summary.members);
 		fprintf(stderr, "Dump terminated\n");
 		return -2;
 	}
+	nh_bucket_summary_flush(&summary);
+	free(summary.members);
 
 	delete_json_obj();
 	fflush(stdout);
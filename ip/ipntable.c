@@ -10,7 +10,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <time.h>
@@ -36,6 +38,8 @@ static void usage(void)
 		"        [ thresh1 VAL ] [ thresh2 VAL ] [ thresh3 VAL ] [ gc_int MSEC ]\n"
 		"        [ PARMS ]\n"
 		"Usage: ip ntable show [ dev DEV ] [ name NAME ]\n"
+		"       ip ntable show [ name NAME ] interval SECS [ count COUNT ]\n"
+		"                      [ alert PERCENT ]\n"
 
 		"PARMS := [ base_reachable MSEC ] [ retrans MSEC ] [ gc_stale MSEC ]\n"
 		"         [ delay_probe MSEC ] [ queue LEN ]\n"
@@ -638,6 +642,201 @@ static int print_ntable(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/* "show ... interval SECS": the statistics of each table are kept from
+ * one sample to the next and the rate of the counters that show pressure
+ * on the table is printed along with the entries as a share of the gc
+ * thresholds. Only the first message of each table in the dump carries
+ * the statistics, the per-device parameters are skipped.
+ */
+#define NTABLE_RATE_MAX	16
+
+struct ntable_sample {
+	int			family;
+	char			name[32];
+	struct ndt_stats	last;
+};
+
+static struct ntable_sample ntable_samples[NTABLE_RATE_MAX];
+static unsigned int ntable_nsamples;
+static unsigned int ntable_alert;
+static double ntable_rate_secs;
+static bool ntable_rate_print;
+
+static struct ntable_sample *ntable_sample_get(int family, const char *name,
+					       bool *new)
+{
+	struct ntable_sample *s;
+	unsigned int i;
+
+	for (i = 0; i < ntable_nsamples; i++) {
+		s = &ntable_samples[i];
+		if (s->family == family && !strcmp(s->name, name)) {
+			*new = false;
+			return s;
+		}
+	}
+
+	if (ntable_nsamples == NTABLE_RATE_MAX)
+		return NULL;
+	s = &ntable_samples[ntable_nsamples++];
+	s->family = family;
+	strlcpy(s->name, name, sizeof(s->name));
+	*new = true;
+	return s;
+}
+
+static __u64 ntable_delta(__u64 cur, __u64 last)
+{
+	return cur >= last ? cur - last : cur;
+}
+
+static void print_ntable_rate_one(const char *name, __u64 cur, __u64 last)
+{
+	char key[32];
+
+	snprintf(key, sizeof(key), "%s_rate", name);
+	print_string(PRINT_FP, NULL, "%s ", name);
+	print_float(PRINT_ANY, key, "%.0f/s ",
+		    ntable_delta(cur, last) / ntable_rate_secs);
+}
+
+static unsigned int print_ntable_thresh(const char *name, struct rtattr *rta,
+					__u32 entries)
+{
+	unsigned int pct;
+	__u32 thresh;
+	char key[32];
+
+	if (!rta)
+		return 0;
+	thresh = rta_getattr_u32(rta);
+	if (!thresh)
+		return 0;
+
+	pct = (__u64)entries * 100 / thresh;
+	snprintf(key, sizeof(key), "%s_pct", name);
+	print_string(PRINT_FP, NULL, "%s ", name);
+	print_uint(PRINT_ANY, key, "%u%% ", pct);
+	return pct;
+}
+
+static int print_ntable_rate(struct nlmsghdr *n, void *arg)
+{
+	struct ndtmsg *ndtm = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndtm));
+	const struct ndt_config *ndtc;
+	const struct ndt_stats *st;
+	struct rtattr *tb[NDTA_MAX+1];
+	struct ntable_sample *s;
+	const char *name;
+	unsigned int pct;
+	bool new, alert;
+
+	if (n->nlmsg_type != RTM_NEWNEIGHTBL || len < 0)
+		return 0;
+	if (preferred_family && preferred_family != ndtm->ndtm_family)
+		return 0;
+
+	parse_rtattr(tb, NDTA_MAX, NDTA_RTA(ndtm), len);
+	if (!tb[NDTA_NAME] || !tb[NDTA_STATS] || !tb[NDTA_CONFIG])
+		return 0;
+
+	name = rta_getattr_str(tb[NDTA_NAME]);
+	if (filter.name && strcmp(filter.name, name))
+		return 0;
+
+	s = ntable_sample_get(ndtm->ndtm_family, name, &new);
+	if (!s)
+		return 0;
+	st = RTA_DATA(tb[NDTA_STATS]);
+	ndtc = RTA_DATA(tb[NDTA_CONFIG]);
+
+	if (!new && ntable_rate_print) {
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "family", "%s ",
+			     family_name(ndtm->ndtm_family));
+		print_string(PRINT_ANY, "name", "%s ", name);
+		print_uint(PRINT_ANY, "entries", "entries %u ",
+			   ndtc->ndtc_entries);
+
+		print_ntable_thresh("thresh1", tb[NDTA_THRESH1],
+				    ndtc->ndtc_entries);
+		print_ntable_thresh("thresh2", tb[NDTA_THRESH2],
+				    ndtc->ndtc_entries);
+		pct = print_ntable_thresh("thresh3", tb[NDTA_THRESH3],
+					  ndtc->ndtc_entries);
+
+		print_ntable_rate_one("allocs", st->ndts_allocs,
+				      s->last.ndts_allocs);
+		print_ntable_rate_one("destroys", st->ndts_destroys,
+				      s->last.ndts_destroys);
+		print_ntable_rate_one("hash_grows", st->ndts_hash_grows,
+				      s->last.ndts_hash_grows);
+		print_ntable_rate_one("forced_gc_runs", st->ndts_forced_gc_runs,
+				      s->last.ndts_forced_gc_runs);
+		print_ntable_rate_one("table_fulls", st->ndts_table_fulls,
+				      s->last.ndts_table_fulls);
+		print_ntable_rate_one("res_failed", st->ndts_res_failed,
+				      s->last.ndts_res_failed);
+
+		/* a full table drops new neighbours, whatever the threshold */
+		alert = ntable_alert &&
+			(pct >= ntable_alert ||
+			 st->ndts_table_fulls != s->last.ndts_table_fulls);
+		if (ntable_alert)
+			print_bool(PRINT_JSON, "alert", NULL, alert);
+		if (alert)
+			print_string(PRINT_FP, NULL, "%s", "ALERT");
+		print_string(PRINT_FP, NULL, "\n", NULL);
+		close_json_object();
+	}
+	s->last = *st;
+	return 0;
+}
+
+static int ntable_rate_sample(void)
+{
+	if (rtnl_neightbldump_req(&rth, preferred_family) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, print_ntable_rate, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int ntable_rate_show(unsigned int interval, unsigned int count)
+{
+	double last, next, now;
+	unsigned int i;
+
+	last = next = monotonic_now();
+	if (ntable_rate_sample() < 0)
+		return -1;
+
+	ntable_rate_print = true;
+	for (i = 0; !count || i < count; i++) {
+		next += interval;
+		monotonic_sleep_until(next);
+		now = monotonic_now();
+		ntable_rate_secs = now - last;
+		last = now;
+
+		if (timestamp && !json)
+			print_timestamp(stdout);
+		new_json_obj(json);
+		if (ntable_rate_sample() < 0) {
+			delete_json_obj();
+			return -1;
+		}
+		delete_json_obj();
+		fflush(stdout);
+	}
+	return 0;
+}
+
 static void ipntable_reset_filter(void)
 {
 	memset(&filter, 0, sizeof(filter));
@@ -645,6 +844,8 @@ static void ipntable_reset_filter(void)
 
 static int ipntable_show(int argc, char **argv)
 {
+	unsigned int interval = 0, count = 0;
+
 	ipntable_reset_filter();
 
 	filter.family = preferred_family;
@@ -661,12 +862,35 @@ static int ipntable_show(int argc, char **argv)
 			NEXT_ARG();
 
 			filter.name = *argv;
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("\"interval\" value is invalid", *argv);
+		} else if (strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0))
+				invarg("\"count\" value is invalid", *argv);
+		} else if (strcmp(*argv, "alert") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&ntable_alert, *argv, 0) ||
+			    !ntable_alert)
+				invarg("\"alert\" value is invalid", *argv);
 		} else
 			invarg("unknown", *argv);
 
 		argc--; argv++;
 	}
 
+	if (interval) {
+		if (filter.index) {
+			fprintf(stderr, "The statistics are per table, \"dev\" can't be used with \"interval\"\n");
+			return -1;
+		}
+		return ntable_rate_show(interval, count) ? 1 : 0;
+	}
+	if (count || ntable_alert)
+		missarg("interval");
+
 	if (rtnl_neightbldump_req(&rth, preferred_family) < 0) {
 		perror("Cannot send dump request");
 		exit(1);
@@ -13,22 +13,30 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
 #include <linux/in_route.h>
 #include <linux/icmpv6.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #include "rt_names.h"
 #include "utils.h"
 #include "ip_common.h"
 #include "nh_common.h"
+#include "rtnl_bulk.h"
 
 #ifndef RTAX_RTTVAR
 #define RTAX_RTTVAR RTAX_HOPS
 #endif
 
+#ifndef IP6_RT_PRIO_USER
+#define IP6_RT_PRIO_USER	1024
+#endif
+
 enum list_action {
 	IPROUTE_LIST,
 	IPROUTE_FLUSH,
@@ -59,9 +67,12 @@ static void usage(void)
 	fprintf(stderr,
 		"Usage: ip route { list | flush } SELECTOR\n"
 		"       ip route save SELECTOR\n"
-		"       ip route restore\n"
+		"       ip route restore [ table TABLE_ID | vrf NAME ]\n"
 		"       ip route showdump\n"
-		"       ip route get [ ROUTE_GET_FLAGS ] [ to ] ADDRESS\n"
+		"       ip route apply [ file ] FILE proto RTPROTO\n"
+		"                      [ table TABLE_ID ]...\n"
+		"       ip route get [ ROUTE_GET_FLAGS ] [ to ] ADDRESS...\n"
+		"                            [ file FILE ]\n"
 		"                            [ from ADDRESS iif STRING ]\n"
 		"                            [ oif STRING ] [ tos TOS ]\n"
 		"                            [ mark NUMBER ] [ vrf NAME ]\n"
@@ -69,6 +80,7 @@ static void usage(void)
 		"                            [ sport NUMBER ] [ dport NUMBER ]\n"
 		"                            [ as ADDRESS ] [ flowlabel FLOWLABEL ]\n"
 		"       ip route { add | del | change | append | replace } ROUTE\n"
+		"       ip route template NAME encap ENCAPTYPE ENCAPHDR\n"
 		"SELECTOR := [ root PREFIX ] [ match PREFIX ] [ exact PREFIX ]\n"
 		"            [ table TABLE_ID ] [ vrf NAME ] [ proto RTPROTO ]\n"
 		"            [ type TYPE ] [ scope SCOPE ]\n"
@@ -78,7 +90,8 @@ static void usage(void)
 		"             [ scope SCOPE ] [ metric METRIC ]\n"
 		"             [ ttl-propagate { enabled | disabled } ]\n"
 		"INFO_SPEC := { NH | nhid ID } OPTIONS FLAGS [ nexthop NH ]...\n"
-		"NH := [ encap ENCAPTYPE ENCAPHDR ] [ via [ FAMILY ] ADDRESS ]\n"
+		"NH := [ encap { ENCAPTYPE ENCAPHDR | template NAME } ]\n"
+		"      [ via [ FAMILY ] ADDRESS ]\n"
 		"      [ dev STRING ] [ weight NUMBER ] NHFLAGS\n"
 		"FAMILY := [ inet | inet6 | mpls | bridge | link ]\n"
 		"OPTIONS := FLAGS [ mtu NUMBER ] [ advmss NUMBER ] [ as [ to ] ADDRESS ]\n"
@@ -124,9 +137,7 @@ static struct
 	unsigned int tb;
 	int cloned;
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_flush *flush;
 	int protocol, protocolmask;
 	int scope, scopemask;
 	__u64 typemask;
@@ -144,16 +155,6 @@ static struct
 	inet_prefix msrc;
 } filter;
 
-static int flush_update(void)
-{
-	if (rtnl_send_check(&rth, filter.flushb, filter.flushp) < 0) {
-		perror("Failed to send flush request");
-		return -2;
-	}
-	filter.flushp = 0;
-	return 0;
-}
-
 static bool filter_multipath(const struct rtattr *rta)
 {
 	const struct rtnexthop *nh = RTA_DATA(rta);
@@ -354,7 +355,7 @@ static int filter_nlmsg(struct nlmsghdr *n, struct rtattr **tb, int host_len)
 		if ((metric ^ filter.metric) & filter.metricmask)
 			return 0;
 	}
-	if (filter.flushb &&
+	if (filter.flush &&
 	    r->rtm_family == AF_INET6 &&
 	    r->rtm_dst_len == 0 &&
 	    r->rtm_type == RTN_UNREACHABLE &&
@@ -773,7 +774,6 @@ int print_route(struct nlmsghdr *n, void *arg)
 	struct rtattr *tb[RTA_MAX+1];
 	int family, color, host_len;
 	__u32 table;
-	int ret;
 
 	SPRINT_BUF(b1);
 	SPRINT_BUF(b2);
@@ -783,7 +783,7 @@ int print_route(struct nlmsghdr *n, void *arg)
 			n->nlmsg_len, n->nlmsg_type, n->nlmsg_flags);
 		return -1;
 	}
-	if (filter.flushb && n->nlmsg_type != RTM_NEWROUTE)
+	if (filter.flush && n->nlmsg_type != RTM_NEWROUTE)
 		return 0;
 	len -= NLMSG_LENGTH(sizeof(*r));
 	if (len < 0) {
@@ -799,20 +799,11 @@ int print_route(struct nlmsghdr *n, void *arg)
 	if (!filter_nlmsg(n, tb, host_len))
 		return 0;
 
-	if (filter.flushb) {
-		struct nlmsghdr *fn;
-
-		if (NLMSG_ALIGN(filter.flushp) + n->nlmsg_len > filter.flushe) {
-			ret = flush_update();
-			if (ret < 0)
-				return ret;
+	if (filter.flush) {
+		if (rtnl_flush_add(filter.flush, n, RTM_DELROUTE) < 0) {
+			perror("Failed to send flush request");
+			return -2;
 		}
-		fn = (struct nlmsghdr *)(filter.flushb + NLMSG_ALIGN(filter.flushp));
-		memcpy(fn, n, n->nlmsg_len);
-		fn->nlmsg_type = RTM_DELROUTE;
-		fn->nlmsg_flags = NLM_F_REQUEST;
-		fn->nlmsg_seq = ++rth.seq;
-		filter.flushp = (((char *)fn) + n->nlmsg_len) - filter.flushb;
 		filter.flushed++;
 		if (show_stats < 2)
 			return 0;
@@ -1155,20 +1146,117 @@ static unsigned int parse_features(int *argcp, char ***argvp)
 	return features;
 }
 
-static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
+struct iproute_req {
+	struct nlmsghdr	n;
+	struct rtmsg		r;
+	char			buf[4096];
+};
+
+static void iproute_req_init(struct iproute_req *req, int cmd,
+			     unsigned int flags)
 {
-	struct {
-		struct nlmsghdr	n;
-		struct rtmsg		r;
-		char			buf[4096];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.r.rtm_family = preferred_family,
-		.r.rtm_table = RT_TABLE_MAIN,
-		.r.rtm_scope = RT_SCOPE_NOWHERE,
-	};
+	memset(req, 0, sizeof(*req));
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req->n.nlmsg_flags = NLM_F_REQUEST | flags;
+	req->n.nlmsg_type = cmd;
+	req->r.rtm_family = preferred_family;
+	req->r.rtm_table = RT_TABLE_MAIN;
+	req->r.rtm_scope = RT_SCOPE_NOWHERE;
+
+	if (cmd != RTM_DELROUTE) {
+		req->r.rtm_protocol = RTPROT_BOOT;
+		req->r.rtm_scope = RT_SCOPE_UNIVERSE;
+		req->r.rtm_type = RTN_UNICAST;
+	}
+}
+
+enum {
+	RT_ARG_SRC,
+	RT_ARG_AS,
+	RT_ARG_VIA,
+	RT_ARG_FROM,
+	RT_ARG_TOS,
+	RT_ARG_EXPIRES,
+	RT_ARG_METRIC,
+	RT_ARG_SCOPE,
+	RT_ARG_MTU,
+	RT_ARG_HOPLIMIT,
+	RT_ARG_ADVMSS,
+	RT_ARG_REORDERING,
+	RT_ARG_RTT,
+	RT_ARG_RTO_MIN,
+	RT_ARG_WINDOW,
+	RT_ARG_CWND,
+	RT_ARG_INITCWND,
+	RT_ARG_INITRWND,
+	RT_ARG_FEATURES,
+	RT_ARG_QUICKACK,
+	RT_ARG_CONGCTL,
+	RT_ARG_RTTVAR,
+	RT_ARG_SSTHRESH,
+	RT_ARG_REALMS,
+	RT_ARG_ONLINK,
+	RT_ARG_NEXTHOP,
+	RT_ARG_NHID,
+	RT_ARG_PROTOCOL,
+	RT_ARG_TABLE,
+	RT_ARG_VRF,
+	RT_ARG_DEV,
+	RT_ARG_PREF,
+	RT_ARG_ENCAP,
+	RT_ARG_TTL_PROPAGATE,
+	RT_ARG_FASTOPEN_NO_COOKIE,
+};
+
+/* In the order the arguments used to be compared in */
+static const struct keyword iproute_args[] = {
+	{ "src", RT_ARG_SRC },
+	{ "as", RT_ARG_AS },
+	{ "via", RT_ARG_VIA },
+	{ "from", RT_ARG_FROM },
+	{ "tos", RT_ARG_TOS },
+	{ "dsfield", RT_ARG_TOS, true },
+	{ "expires", RT_ARG_EXPIRES },
+	{ "metric", RT_ARG_METRIC, true },
+	{ "priority", RT_ARG_METRIC, true },
+	{ "preference", RT_ARG_METRIC },
+	{ "scope", RT_ARG_SCOPE },
+	{ "mtu", RT_ARG_MTU },
+	{ "hoplimit", RT_ARG_HOPLIMIT },
+	{ "advmss", RT_ARG_ADVMSS },
+	{ "reordering", RT_ARG_REORDERING, true },
+	{ "rtt", RT_ARG_RTT },
+	{ "rto_min", RT_ARG_RTO_MIN },
+	{ "window", RT_ARG_WINDOW, true },
+	{ "cwnd", RT_ARG_CWND, true },
+	{ "initcwnd", RT_ARG_INITCWND, true },
+	{ "initrwnd", RT_ARG_INITRWND, true },
+	{ "features", RT_ARG_FEATURES, true },
+	{ "quickack", RT_ARG_QUICKACK, true },
+	{ "congctl", RT_ARG_CONGCTL, true },
+	{ "rttvar", RT_ARG_RTTVAR, true },
+	{ "ssthresh", RT_ARG_SSTHRESH, true },
+	{ "realms", RT_ARG_REALMS, true },
+	{ "onlink", RT_ARG_ONLINK },
+	{ "nexthop", RT_ARG_NEXTHOP },
+	{ "nhid", RT_ARG_NHID },
+	{ "protocol", RT_ARG_PROTOCOL, true },
+	{ "table", RT_ARG_TABLE, true },
+	{ "vrf", RT_ARG_VRF, true },
+	{ "dev", RT_ARG_DEV },
+	{ "oif", RT_ARG_DEV },
+	{ "pref", RT_ARG_PREF, true },
+	{ "encap", RT_ARG_ENCAP },
+	{ "ttl-propagate", RT_ARG_TTL_PROPAGATE },
+	{ "fastopen_no_cookie", RT_ARG_FASTOPEN_NO_COOKIE, true },
+};
+
+static struct keyword_table iproute_arg_table = KEYWORD_TABLE(iproute_args);
+
+/* Add ROUTE to a request set up by iproute_req_init() */
+static int iproute_parse(struct iproute_req *req, int argc, char **argv)
+{
+	int cmd = req->n.nlmsg_type;
 	char  mxbuf[256];
 	struct rtattr *mxrta = (void *)mxbuf;
 	unsigned int mxlock = 0;
@@ -1181,40 +1269,35 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 	int raw = 0;
 	int type_ok = 0;
 	__u32 nhid = 0;
-	int ret;
-
-	if (cmd != RTM_DELROUTE) {
-		req.r.rtm_protocol = RTPROT_BOOT;
-		req.r.rtm_scope = RT_SCOPE_UNIVERSE;
-		req.r.rtm_type = RTN_UNICAST;
-	}
 
 	mxrta->rta_type = RTA_METRICS;
 	mxrta->rta_len = RTA_LENGTH(0);
 
 	while (argc > 0) {
-		if (strcmp(*argv, "src") == 0) {
+		int kw = keyword_lookup(&iproute_arg_table, *argv);
+
+		if (kw == RT_ARG_SRC) {
 			inet_prefix addr;
 
 			NEXT_ARG();
-			get_addr(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
-			addattr_l(&req.n, sizeof(req),
+			get_addr(&addr, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
+			addattr_l(&req->n, sizeof(*req),
 				  RTA_PREFSRC, &addr.data, addr.bytelen);
-		} else if (strcmp(*argv, "as") == 0) {
+		} else if (kw == RT_ARG_AS) {
 			inet_prefix addr;
 
 			NEXT_ARG();
 			if (strcmp(*argv, "to") == 0) {
 				NEXT_ARG();
 			}
-			get_addr(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
-			addattr_l(&req.n, sizeof(req),
+			get_addr(&addr, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
+			addattr_l(&req->n, sizeof(*req),
 				  RTA_NEWDST, &addr.data, addr.bytelen);
-		} else if (strcmp(*argv, "via") == 0) {
+		} else if (kw == RT_ARG_VIA) {
 			inet_prefix addr;
 			int family;
 
@@ -1226,61 +1309,58 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			NEXT_ARG();
 			family = read_family(*argv);
 			if (family == AF_UNSPEC)
-				family = req.r.rtm_family;
+				family = req->r.rtm_family;
 			else
 				NEXT_ARG();
 			get_addr(&addr, *argv, family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
-			if (addr.family == req.r.rtm_family)
-				addattr_l(&req.n, sizeof(req), RTA_GATEWAY,
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
+			if (addr.family == req->r.rtm_family)
+				addattr_l(&req->n, sizeof(*req), RTA_GATEWAY,
 					  &addr.data, addr.bytelen);
 			else
-				addattr_l(&req.n, sizeof(req), RTA_VIA,
+				addattr_l(&req->n, sizeof(*req), RTA_VIA,
 					  &addr.family, addr.bytelen+2);
-		} else if (strcmp(*argv, "from") == 0) {
+		} else if (kw == RT_ARG_FROM) {
 			inet_prefix addr;
 
 			NEXT_ARG();
-			get_prefix(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
+			get_prefix(&addr, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = addr.family;
 			if (addr.bytelen)
-				addattr_l(&req.n, sizeof(req), RTA_SRC, &addr.data, addr.bytelen);
-			req.r.rtm_src_len = addr.bitlen;
-		} else if (strcmp(*argv, "tos") == 0 ||
-			   matches(*argv, "dsfield") == 0) {
+				addattr_l(&req->n, sizeof(*req), RTA_SRC, &addr.data, addr.bytelen);
+			req->r.rtm_src_len = addr.bitlen;
+		} else if (kw == RT_ARG_TOS) {
 			__u32 tos;
 
 			NEXT_ARG();
 			if (rtnl_dsfield_a2n(&tos, *argv))
 				invarg("\"tos\" value is invalid\n", *argv);
-			req.r.rtm_tos = tos;
-		} else if (strcmp(*argv, "expires") == 0) {
+			req->r.rtm_tos = tos;
+		} else if (kw == RT_ARG_EXPIRES) {
 			__u32 expires;
 
 			NEXT_ARG();
 			if (get_u32(&expires, *argv, 0))
 				invarg("\"expires\" value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), RTA_EXPIRES, expires);
-		} else if (matches(*argv, "metric") == 0 ||
-			   matches(*argv, "priority") == 0 ||
-			   strcmp(*argv, "preference") == 0) {
+			addattr32(&req->n, sizeof(*req), RTA_EXPIRES, expires);
+		} else if (kw == RT_ARG_METRIC) {
 			__u32 metric;
 
 			NEXT_ARG();
 			if (get_u32(&metric, *argv, 0))
 				invarg("\"metric\" value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), RTA_PRIORITY, metric);
-		} else if (strcmp(*argv, "scope") == 0) {
+			addattr32(&req->n, sizeof(*req), RTA_PRIORITY, metric);
+		} else if (kw == RT_ARG_SCOPE) {
 			__u32 scope = 0;
 
 			NEXT_ARG();
 			if (rtnl_rtscope_a2n(&scope, *argv))
 				invarg("invalid \"scope\" value\n", *argv);
-			req.r.rtm_scope = scope;
+			req->r.rtm_scope = scope;
 			scope_ok = 1;
-		} else if (strcmp(*argv, "mtu") == 0) {
+		} else if (kw == RT_ARG_MTU) {
 			unsigned int mtu;
 
 			NEXT_ARG();
@@ -1291,7 +1371,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_unsigned(&mtu, *argv, 0))
 				invarg("\"mtu\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_MTU, mtu);
-		} else if (strcmp(*argv, "hoplimit") == 0) {
+		} else if (kw == RT_ARG_HOPLIMIT) {
 			unsigned int hoplimit;
 
 			NEXT_ARG();
@@ -1302,7 +1382,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_unsigned(&hoplimit, *argv, 0) || hoplimit > 255)
 				invarg("\"hoplimit\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_HOPLIMIT, hoplimit);
-		} else if (strcmp(*argv, "advmss") == 0) {
+		} else if (kw == RT_ARG_ADVMSS) {
 			unsigned int mss;
 
 			NEXT_ARG();
@@ -1313,7 +1393,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_unsigned(&mss, *argv, 0))
 				invarg("\"mss\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_ADVMSS, mss);
-		} else if (matches(*argv, "reordering") == 0) {
+		} else if (kw == RT_ARG_REORDERING) {
 			unsigned int reord;
 
 			NEXT_ARG();
@@ -1324,7 +1404,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_unsigned(&reord, *argv, 0))
 				invarg("\"reordering\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_REORDERING, reord);
-		} else if (strcmp(*argv, "rtt") == 0) {
+		} else if (kw == RT_ARG_RTT) {
 			unsigned int rtt;
 
 			NEXT_ARG();
@@ -1336,7 +1416,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				invarg("\"rtt\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_RTT,
 				(raw) ? rtt : rtt * 8);
-		} else if (strcmp(*argv, "rto_min") == 0) {
+		} else if (kw == RT_ARG_RTO_MIN) {
 			unsigned int rto_min;
 
 			NEXT_ARG();
@@ -1346,7 +1426,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				       *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_RTO_MIN,
 				      rto_min);
-		} else if (matches(*argv, "window") == 0) {
+		} else if (kw == RT_ARG_WINDOW) {
 			unsigned int win;
 
 			NEXT_ARG();
@@ -1357,7 +1437,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_unsigned(&win, *argv, 0))
 				invarg("\"window\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_WINDOW, win);
-		} else if (matches(*argv, "cwnd") == 0) {
+		} else if (kw == RT_ARG_CWND) {
 			unsigned int win;
 
 			NEXT_ARG();
@@ -1368,7 +1448,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_unsigned(&win, *argv, 0))
 				invarg("\"cwnd\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_CWND, win);
-		} else if (matches(*argv, "initcwnd") == 0) {
+		} else if (kw == RT_ARG_INITCWND) {
 			unsigned int win;
 
 			NEXT_ARG();
@@ -1380,7 +1460,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				invarg("\"initcwnd\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf),
 				      RTAX_INITCWND, win);
-		} else if (matches(*argv, "initrwnd") == 0) {
+		} else if (kw == RT_ARG_INITRWND) {
 			unsigned int win;
 
 			NEXT_ARG();
@@ -1392,7 +1472,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				invarg("\"initrwnd\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf),
 				      RTAX_INITRWND, win);
-		} else if (matches(*argv, "features") == 0) {
+		} else if (kw == RT_ARG_FEATURES) {
 			unsigned int features = 0;
 
 			features = parse_features(&argc, &argv);
@@ -1406,7 +1486,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 
 			rta_addattr32(mxrta, sizeof(mxbuf),
 				      RTAX_FEATURES, features);
-		} else if (matches(*argv, "quickack") == 0) {
+		} else if (kw == RT_ARG_QUICKACK) {
 			unsigned int quickack;
 
 			NEXT_ARG();
@@ -1416,7 +1496,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				invarg("\"quickack\" value should be 0 or 1\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf),
 				      RTAX_QUICKACK, quickack);
-		} else if (matches(*argv, "congctl") == 0) {
+		} else if (kw == RT_ARG_CONGCTL) {
 			NEXT_ARG();
 			if (strcmp(*argv, "lock") == 0) {
 				mxlock |= 1 << RTAX_CC_ALGO;
@@ -1424,7 +1504,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			}
 			rta_addattr_l(mxrta, sizeof(mxbuf), RTAX_CC_ALGO, *argv,
 				      strlen(*argv));
-		} else if (matches(*argv, "rttvar") == 0) {
+		} else if (kw == RT_ARG_RTTVAR) {
 			unsigned int win;
 
 			NEXT_ARG();
@@ -1436,7 +1516,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				invarg("\"rttvar\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_RTTVAR,
 				(raw) ? win : win * 4);
-		} else if (matches(*argv, "ssthresh") == 0) {
+		} else if (kw == RT_ARG_SSTHRESH) {
 			unsigned int win;
 
 			NEXT_ARG();
@@ -1447,44 +1527,44 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_unsigned(&win, *argv, 0))
 				invarg("\"ssthresh\" value is invalid\n", *argv);
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_SSTHRESH, win);
-		} else if (matches(*argv, "realms") == 0) {
+		} else if (kw == RT_ARG_REALMS) {
 			__u32 realm;
 
 			NEXT_ARG();
 			if (get_rt_realms_or_raw(&realm, *argv))
 				invarg("\"realm\" value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), RTA_FLOW, realm);
-		} else if (strcmp(*argv, "onlink") == 0) {
-			req.r.rtm_flags |= RTNH_F_ONLINK;
-		} else if (strcmp(*argv, "nexthop") == 0) {
+			addattr32(&req->n, sizeof(*req), RTA_FLOW, realm);
+		} else if (kw == RT_ARG_ONLINK) {
+			req->r.rtm_flags |= RTNH_F_ONLINK;
+		} else if (kw == RT_ARG_NEXTHOP) {
 			nhs_ok = 1;
 			break;
-		} else if (!strcmp(*argv, "nhid")) {
+		} else if (kw == RT_ARG_NHID) {
 			NEXT_ARG();
 			if (get_u32(&nhid, *argv, 0))
 				invarg("\"id\" value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), RTA_NH_ID, nhid);
-		} else if (matches(*argv, "protocol") == 0) {
+			addattr32(&req->n, sizeof(*req), RTA_NH_ID, nhid);
+		} else if (kw == RT_ARG_PROTOCOL) {
 			__u32 prot;
 
 			NEXT_ARG();
 			if (rtnl_rtprot_a2n(&prot, *argv))
 				invarg("\"protocol\" value is invalid\n", *argv);
-			req.r.rtm_protocol = prot;
-		} else if (matches(*argv, "table") == 0) {
+			req->r.rtm_protocol = prot;
+		} else if (kw == RT_ARG_TABLE) {
 			__u32 tid;
 
 			NEXT_ARG();
 			if (rtnl_rttable_a2n(&tid, *argv))
 				invarg("\"table\" value is invalid\n", *argv);
 			if (tid < 256)
-				req.r.rtm_table = tid;
+				req->r.rtm_table = tid;
 			else {
-				req.r.rtm_table = RT_TABLE_UNSPEC;
-				addattr32(&req.n, sizeof(req), RTA_TABLE, tid);
+				req->r.rtm_table = RT_TABLE_UNSPEC;
+				addattr32(&req->n, sizeof(*req), RTA_TABLE, tid);
 			}
 			table_ok = 1;
-		} else if (matches(*argv, "vrf") == 0) {
+		} else if (kw == RT_ARG_VRF) {
 			__u32 tid;
 
 			NEXT_ARG();
@@ -1492,17 +1572,16 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (tid == 0)
 				invarg("Invalid VRF\n", *argv);
 			if (tid < 256)
-				req.r.rtm_table = tid;
+				req->r.rtm_table = tid;
 			else {
-				req.r.rtm_table = RT_TABLE_UNSPEC;
-				addattr32(&req.n, sizeof(req), RTA_TABLE, tid);
+				req->r.rtm_table = RT_TABLE_UNSPEC;
+				addattr32(&req->n, sizeof(*req), RTA_TABLE, tid);
 			}
 			table_ok = 1;
-		} else if (strcmp(*argv, "dev") == 0 ||
-			   strcmp(*argv, "oif") == 0) {
+		} else if (kw == RT_ARG_DEV) {
 			NEXT_ARG();
 			d = *argv;
-		} else if (matches(*argv, "pref") == 0) {
+		} else if (kw == RT_ARG_PREF) {
 			__u8 pref;
 
 			NEXT_ARG();
@@ -1514,8 +1593,8 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				pref = ICMPV6_ROUTER_PREF_HIGH;
 			else if (get_u8(&pref, *argv, 0))
 				invarg("\"pref\" value is invalid\n", *argv);
-			addattr8(&req.n, sizeof(req), RTA_PREF, pref);
-		} else if (strcmp(*argv, "encap") == 0) {
+			addattr8(&req->n, sizeof(*req), RTA_PREF, pref);
+		} else if (kw == RT_ARG_ENCAP) {
 			char buf[1024];
 			struct rtattr *rta = (void *)buf;
 
@@ -1526,9 +1605,9 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 					RTA_ENCAP, RTA_ENCAP_TYPE);
 
 			if (rta->rta_len > RTA_LENGTH(0))
-				addraw_l(&req.n, 1024
+				addraw_l(&req->n, 1024
 					 , RTA_DATA(rta), RTA_PAYLOAD(rta));
-		} else if (strcmp(*argv, "ttl-propagate") == 0) {
+		} else if (kw == RT_ARG_TTL_PROPAGATE) {
 			__u8 ttl_prop;
 
 			NEXT_ARG();
@@ -1540,9 +1619,9 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				invarg("\"ttl-propagate\" value is invalid\n",
 				       *argv);
 
-			addattr8(&req.n, sizeof(req), RTA_TTL_PROPAGATE,
+			addattr8(&req->n, sizeof(*req), RTA_TTL_PROPAGATE,
 				 ttl_prop);
-		} else if (matches(*argv, "fastopen_no_cookie") == 0) {
+		} else if (kw == RT_ARG_FASTOPEN_NO_COOKIE) {
 			unsigned int fastopen_no_cookie;
 
 			NEXT_ARG();
@@ -1561,7 +1640,7 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if ((**argv < '0' || **argv > '9') &&
 			    rtnl_rtntype_a2n(&type, *argv) == 0) {
 				NEXT_ARG();
-				req.r.rtm_type = type;
+				req->r.rtm_type = type;
 				type_ok = 1;
 			}
 
@@ -1569,70 +1648,85 @@ static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
 				usage();
 			if (dst_ok)
 				duparg2("to", *argv);
-			get_prefix(&dst, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = dst.family;
-			req.r.rtm_dst_len = dst.bitlen;
+			get_prefix(&dst, *argv, req->r.rtm_family);
+			if (req->r.rtm_family == AF_UNSPEC)
+				req->r.rtm_family = dst.family;
+			req->r.rtm_dst_len = dst.bitlen;
 			dst_ok = 1;
 			if (dst.bytelen)
-				addattr_l(&req.n, sizeof(req),
+				addattr_l(&req->n, sizeof(*req),
 					  RTA_DST, &dst.data, dst.bytelen);
 		}
 		argc--; argv++;
 	}
 
 	if (!dst_ok)
-		usage();
+		return -EINVAL;
 
 	if (d) {
 		int idx = ll_name_to_index(d);
 
 		if (!idx)
 			return nodev(d);
-		addattr32(&req.n, sizeof(req), RTA_OIF, idx);
+		addattr32(&req->n, sizeof(*req), RTA_OIF, idx);
 	}
 
 	if (mxrta->rta_len > RTA_LENGTH(0)) {
 		if (mxlock)
 			rta_addattr32(mxrta, sizeof(mxbuf), RTAX_LOCK, mxlock);
-		addattr_l(&req.n, sizeof(req), RTA_METRICS, RTA_DATA(mxrta), RTA_PAYLOAD(mxrta));
+		addattr_l(&req->n, sizeof(*req), RTA_METRICS, RTA_DATA(mxrta), RTA_PAYLOAD(mxrta));
 	}
 
-	if (nhs_ok && parse_nexthops(&req.n, &req.r, argc, argv))
+	if (nhs_ok && parse_nexthops(&req->n, &req->r, argc, argv))
 		return -1;
 
-	if (req.r.rtm_family == AF_UNSPEC)
-		req.r.rtm_family = AF_INET;
+	if (req->r.rtm_family == AF_UNSPEC)
+		req->r.rtm_family = AF_INET;
 
 	if (!table_ok) {
-		if (req.r.rtm_type == RTN_LOCAL ||
-		    req.r.rtm_type == RTN_BROADCAST ||
-		    req.r.rtm_type == RTN_NAT ||
-		    req.r.rtm_type == RTN_ANYCAST)
-			req.r.rtm_table = RT_TABLE_LOCAL;
+		if (req->r.rtm_type == RTN_LOCAL ||
+		    req->r.rtm_type == RTN_BROADCAST ||
+		    req->r.rtm_type == RTN_NAT ||
+		    req->r.rtm_type == RTN_ANYCAST)
+			req->r.rtm_table = RT_TABLE_LOCAL;
 	}
 	if (!scope_ok) {
-		if (req.r.rtm_family == AF_INET6 ||
-		    req.r.rtm_family == AF_MPLS)
-			req.r.rtm_scope = RT_SCOPE_UNIVERSE;
-		else if (req.r.rtm_type == RTN_LOCAL ||
-			 req.r.rtm_type == RTN_NAT)
-			req.r.rtm_scope = RT_SCOPE_HOST;
-		else if (req.r.rtm_type == RTN_BROADCAST ||
-			 req.r.rtm_type == RTN_MULTICAST ||
-			 req.r.rtm_type == RTN_ANYCAST)
-			req.r.rtm_scope = RT_SCOPE_LINK;
-		else if (req.r.rtm_type == RTN_UNICAST ||
-			 req.r.rtm_type == RTN_UNSPEC) {
+		if (req->r.rtm_family == AF_INET6 ||
+		    req->r.rtm_family == AF_MPLS)
+			req->r.rtm_scope = RT_SCOPE_UNIVERSE;
+		else if (req->r.rtm_type == RTN_LOCAL ||
+			 req->r.rtm_type == RTN_NAT)
+			req->r.rtm_scope = RT_SCOPE_HOST;
+		else if (req->r.rtm_type == RTN_BROADCAST ||
+			 req->r.rtm_type == RTN_MULTICAST ||
+			 req->r.rtm_type == RTN_ANYCAST)
+			req->r.rtm_scope = RT_SCOPE_LINK;
+		else if (req->r.rtm_type == RTN_UNICAST ||
+			 req->r.rtm_type == RTN_UNSPEC) {
 			if (cmd == RTM_DELROUTE)
-				req.r.rtm_scope = RT_SCOPE_NOWHERE;
+				req->r.rtm_scope = RT_SCOPE_NOWHERE;
 			else if (!gw_ok && !nhs_ok && !nhid)
-				req.r.rtm_scope = RT_SCOPE_LINK;
+				req->r.rtm_scope = RT_SCOPE_LINK;
 		}
 	}
 
-	if (!type_ok && req.r.rtm_family == AF_MPLS)
-		req.r.rtm_type = RTN_UNICAST;
+	if (!type_ok && req->r.rtm_family == AF_MPLS)
+		req->r.rtm_type = RTN_UNICAST;
+
+	return 0;
+}
+
+static int iproute_modify(int cmd, unsigned int flags, int argc, char **argv)
+{
+	struct iproute_req req;
+	int ret;
+
+	iproute_req_init(&req, cmd, flags);
+	ret = iproute_parse(&req, argc, argv);
+	if (ret == -EINVAL)
+		usage();
+	if (ret)
+		return ret;
 
 	if (echo_request)
 		ret = rtnl_echo_talk(&rth, &req.n, json, print_route);
@@ -1672,6 +1766,65 @@ static int iproute_flush_cache(void)
 
 static __u32 route_dump_magic = 0x45311224;
 
+/*
+ * A dump saved to a file starts with an index of where the routes of
+ * each table are, so a restore of one table skips the rest. It is a
+ * NLMSG_NOOP looking like a route with no attributes. Older versions
+ * send it to the kernel on restore, which just acks it. Dumps written
+ * to a pipe have no index.
+ */
+#define ROUTE_DUMP_INDEX_MAGIC	0x58444952	/* "RIDX" */
+#define ROUTE_DUMP_INDEX_MAX	256
+
+struct route_dump_range {
+	__u32	table;
+	__u32	count;
+	__u64	offset;		/* from the dump magic */
+	__u64	len;
+	__u8	family;
+	__u8	pad[7];
+};
+
+struct route_dump_index {
+	struct nlmsghdr		n;
+	struct rtmsg		r;
+	struct rtattr		rta;	/* RTA_UNSPEC, holds the rest */
+	__u32			magic;
+	__u32			nranges;	/* 0: incomplete, scan it all */
+	struct route_dump_range	ranges[ROUTE_DUMP_INDEX_MAX];
+};
+
+static struct {
+	struct route_dump_index	idx;
+	off_t			base;	/* of the magic, -1 without index */
+	__u64			off;
+	bool			full;
+} route_save = { .base = -1 };
+
+static void save_route_index(const struct rtmsg *r, __u32 table, __u32 len)
+{
+	struct route_dump_index *idx = &route_save.idx;
+	struct route_dump_range *rg = NULL;
+
+	if (route_save.base < 0 || route_save.full)
+		return;
+
+	if (idx->nranges)
+		rg = &idx->ranges[idx->nranges - 1];
+	if (!rg || rg->family != r->rtm_family || rg->table != table) {
+		if (idx->nranges == ROUTE_DUMP_INDEX_MAX) {
+			route_save.full = true;
+			return;
+		}
+		rg = &idx->ranges[idx->nranges++];
+		rg->family = r->rtm_family;
+		rg->table = table;
+		rg->offset = route_save.off;
+	}
+	rg->count++;
+	rg->len += NLMSG_ALIGN(len);
+}
+
 static int save_route(struct nlmsghdr *n, void *arg)
 {
 	int ret;
@@ -1687,6 +1840,9 @@ static int save_route(struct nlmsghdr *n, void *arg)
 	if (!filter_nlmsg(n, tb, host_len))
 		return 0;
 
+	save_route_index(r, rtm_get_table(r, tb), n->nlmsg_len);
+	route_save.off += NLMSG_ALIGN(n->nlmsg_len);
+
 	ret = write(STDOUT_FILENO, n, n->nlmsg_len);
 	if ((ret > 0) && (ret != n->nlmsg_len)) {
 		fprintf(stderr, "Short write while saving nlmsg\n");
@@ -1698,6 +1854,8 @@ static int save_route(struct nlmsghdr *n, void *arg)
 
 static int save_route_prep(void)
 {
+	struct route_dump_index *idx = &route_save.idx;
+	struct stat st;
 	int ret;
 
 	if (isatty(STDOUT_FILENO)) {
@@ -1705,12 +1863,48 @@ static int save_route_prep(void)
 		return -1;
 	}
 
+	/* the index is filled in at the end, which needs a real file */
+	if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode) &&
+	    !(fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND))
+		route_save.base = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+
 	ret = write(STDOUT_FILENO, &route_dump_magic, sizeof(route_dump_magic));
 	if (ret != sizeof(route_dump_magic)) {
 		fprintf(stderr, "Can't write magic to dump file\n");
 		return -1;
 	}
 
+	if (route_save.base < 0)
+		return 0;
+
+	idx->n.nlmsg_len = sizeof(*idx);
+	idx->n.nlmsg_type = NLMSG_NOOP;
+	idx->rta.rta_type = RTA_UNSPEC;
+	idx->rta.rta_len = sizeof(*idx) - offsetof(struct route_dump_index, rta);
+	idx->magic = ROUTE_DUMP_INDEX_MAGIC;
+	ret = write(STDOUT_FILENO, idx, sizeof(*idx));
+	if (ret != sizeof(*idx)) {
+		fprintf(stderr, "Can't write index to dump file\n");
+		return -1;
+	}
+	route_save.off = sizeof(*idx);
+
+	return 0;
+}
+
+static int save_route_done(void)
+{
+	struct route_dump_index *idx = &route_save.idx;
+
+	if (route_save.base < 0)
+		return 0;
+	if (route_save.full)
+		idx->nranges = 0;
+	if (pwrite(STDOUT_FILENO, idx, sizeof(*idx),
+		   route_save.base + sizeof(route_dump_magic)) != sizeof(*idx)) {
+		fprintf(stderr, "Can't write index to dump file\n");
+		return -1;
+	}
 	return 0;
 }
 
@@ -1719,7 +1913,17 @@ static int iproute_dump_filter(struct nlmsghdr *nlh, int reqlen)
 	struct rtmsg *rtm = NLMSG_DATA(nlh);
 	int err;
 
+	/*
+	 * Push every selector the kernel can match on into the request so
+	 * that strict-check kernels only dump matching routes. The kernel
+	 * matches type exactly, so a set of types (e.g. "vrf") is left to
+	 * filter_nlmsg(), which also covers kernels without strict check.
+	 * The MPLS dump rejects any rtm_type, so it is filtered here too.
+	 */
 	rtm->rtm_protocol = filter.protocol;
+	if (rtm->rtm_family != AF_MPLS && filter.typemask &&
+	    !(filter.typemask & (filter.typemask - 1)))
+		rtm->rtm_type = ffs(filter.typemask) - 1;
 	if (filter.cloned)
 		rtm->rtm_flags |= RTM_F_CLONED;
 
@@ -1741,7 +1945,7 @@ static int iproute_dump_filter(struct nlmsghdr *nlh, int reqlen)
 static int iproute_flush(int family, rtnl_filter_t filter_fn)
 {
 	time_t start = time(0);
-	char flushb[4096-512];
+	struct rtnl_flush flush;
 	int round = 0;
 	int ret;
 
@@ -1758,19 +1962,21 @@ static int iproute_flush(int family, rtnl_filter_t filter_fn)
 			return 0;
 	}
 
-	filter.flushb = flushb;
-	filter.flushp = 0;
-	filter.flushe = sizeof(flushb);
+	if (rtnl_flush_open(&flush, 0) < 0)
+		return -2;
+	filter.flush = &flush;
 
 	for (;;) {
 		if (rtnl_routedump_req(&rth, family, iproute_dump_filter) < 0) {
 			perror("Cannot send dump request");
-			return -2;
+			ret = -2;
+			break;
 		}
 		filter.flushed = 0;
 		if (rtnl_dump_filter(&rth, filter_fn, stdout) < 0) {
 			fprintf(stderr, "Flush terminated\n");
-			return -2;
+			ret = -2;
+			break;
 		}
 		if (filter.flushed == 0) {
 			if (show_stats) {
@@ -1778,21 +1984,26 @@ static int iproute_flush(int family, rtnl_filter_t filter_fn)
 				    (!filter.cloned || family == AF_INET6))
 					printf("Nothing to flush.\n");
 				else
-					printf("*** Flush is complete after %d round%s ***\n",
-					       round, round > 1 ? "s" : "");
+					printf("*** Flush is complete after %d round%s, %.0f deletes/s ***\n",
+					       round, round > 1 ? "s" : "",
+					       rtnl_flush_rate(&flush));
 			}
 			fflush(stdout);
-			return 0;
+			ret = 0;
+			break;
 		}
 		round++;
-		ret = flush_update();
-		if (ret < 0)
-			return ret;
+		if (rtnl_flush_commit(&flush) < 0) {
+			perror("Failed to send flush request");
+			ret = -2;
+			break;
+		}
 
 		if (time(0) - start > 30) {
 			printf("\n*** Flush not completed after %ld seconds, %d entries remain ***\n",
 			       (long)(time(0) - start), filter.flushed);
-			return -1;
+			ret = -1;
+			break;
 		}
 
 		if (show_stats) {
@@ -1801,6 +2012,613 @@ static int iproute_flush(int family, rtnl_filter_t filter_fn)
 			fflush(stdout);
 		}
 	}
+
+	filter.flush = NULL;
+	rtnl_flush_close(&flush);
+	return ret;
+}
+
+#define IPROUTE_APPLY_WINDOW		1024
+#define IPROUTE_APPLY_MAX_ARGS		256
+#define IPROUTE_APPLY_MAX_TABLES	64
+#define IPROUTE_KEY_MAX			4096
+
+/*
+ * A route is keyed on what the kernel tells routes apart by: family,
+ * table, prefixes, tos and metric. The rest of the route follows in the
+ * key. Routes are looked up by the first idlen bytes of the key. The
+ * whole key then says whether the installed route is the wanted one.
+ */
+struct iproute_ent {
+	struct iproute_ent	*next;		/* in the hash chain */
+	struct nlmsghdr		*n;
+	char			*key;
+	unsigned int		idlen;
+	unsigned int		keylen;
+	__u32			hash;		/* of the identity */
+	int			lineno;
+	bool			devs;		/* key has the devices */
+	enum {
+		IPROUTE_ENT_MISSING,
+		IPROUTE_ENT_CHANGED,
+		IPROUTE_ENT_INSTALLED,
+	} state;
+};
+
+struct iproute_set {
+	struct iproute_ent	**ents;
+	unsigned int		count;
+	unsigned int		size;
+	struct iproute_ent	**hash;
+	unsigned int		hash_mask;
+};
+
+struct iproute_apply {
+	struct rtnl_bulk	bulk;
+	struct iproute_set	set;
+	struct iproute_set	stale;
+	int			protocol;
+	__u32			tables[IPROUTE_APPLY_MAX_TABLES];
+	unsigned int		ntables;
+	__u64			families;	/* bit per AF_* */
+	unsigned int		kept;
+	unsigned int		replaced;
+};
+
+static const char *iproute_apply_name(struct rtnl_bulk *b, int lineno)
+{
+	static char name[PATH_MAX + 32];
+
+	if (lineno)
+		return NULL;
+	snprintf(name, sizeof(name), "%s: stale route", b->file);
+	return name;
+}
+
+static char *route_key_put(char *p, const char *end, __u16 type,
+			   const void *data, __u16 len)
+{
+	if (!p || p + 2 * sizeof(__u16) + len > end)
+		return NULL;
+	memcpy(p, &type, sizeof(type));
+	memcpy(p + sizeof(type), &len, sizeof(len));
+	memcpy(p + 2 * sizeof(__u16), data, len);
+	return p + 2 * sizeof(__u16) + len;
+}
+
+/* Attributes go in by type, nothing says the kernel keeps our order */
+static char *route_key_attrs(char *p, const char *end,
+			     struct rtattr *rta, int len)
+{
+	struct rtattr *tb[RTA_MAX+1];
+	int type;
+
+	parse_rtattr(tb, RTA_MAX, rta, len);
+	for (type = 1; type <= RTA_MAX; type++)
+		if (tb[type])
+			p = route_key_put(p, end, type, RTA_DATA(tb[type]),
+					  RTA_PAYLOAD(tb[type]));
+	return p;
+}
+
+static char *route_key_multipath(char *p, const char *end,
+				 const struct rtattr *mp, bool devs)
+{
+	struct rtnexthop *nh = RTA_DATA(mp);
+	int len = RTA_PAYLOAD(mp);
+
+	while (len >= (int)sizeof(*nh) && nh->rtnh_len >= sizeof(*nh) &&
+	       nh->rtnh_len <= len) {
+		struct rtnexthop hdr = {
+			.rtnh_flags = nh->rtnh_flags &
+				      (RTNH_F_ONLINK | RTNH_F_PERVASIVE),
+			.rtnh_hops = nh->rtnh_hops,
+			.rtnh_ifindex = devs ? nh->rtnh_ifindex : 0,
+		};
+
+		p = route_key_put(p, end, RTA_MULTIPATH, &hdr, sizeof(hdr));
+		p = route_key_attrs(p, end, RTNH_DATA(nh),
+				    nh->rtnh_len - sizeof(*nh));
+		len -= NLMSG_ALIGN(nh->rtnh_len);
+		nh = RTNH_NEXT(nh);
+	}
+	return p;
+}
+
+/* Serialise a route the way the kernel reports it back, so that a request
+ * and the dump of the route it created compare equal. The protocol is left
+ * out, apply selects the routes by protocol anyway. Without @devs the
+ * devices are left out too, for comparing with a route given without
+ * one: the kernel reports the device it found for the gateway.
+ */
+static int route_key(const struct nlmsghdr *n, char *key, unsigned int *idlen,
+		     bool devs)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	char *p = key, *end = key + IPROUTE_KEY_MAX;
+	struct rtattr *tb[RTA_MAX+1];
+	struct {
+		__u32	table;
+		__u32	metric;
+		__u8	family;
+		__u8	dst_len;
+		__u8	src_len;
+		__u8	tos;
+	} id = {
+		.family = r->rtm_family,
+		.dst_len = r->rtm_dst_len,
+		.src_len = r->rtm_src_len,
+		.tos = r->rtm_tos,
+	};
+	struct rtmsg hdr = {
+		.rtm_scope = r->rtm_scope,
+		.rtm_type = r->rtm_type,
+		.rtm_flags = r->rtm_flags & (RTNH_F_ONLINK | RTNH_F_PERVASIVE),
+	};
+	int type;
+
+	if (len < 0)
+		return -1;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	id.table = rtm_get_table(r, tb);
+	if (tb[RTA_PRIORITY])
+		id.metric = rta_getattr_u32(tb[RTA_PRIORITY]);
+	else if (r->rtm_family == AF_INET6)
+		id.metric = IP6_RT_PRIO_USER;
+	p = route_key_put(p, end, 0, &id, sizeof(id));
+	if (tb[RTA_DST] && r->rtm_dst_len)
+		p = route_key_put(p, end, RTA_DST, RTA_DATA(tb[RTA_DST]),
+				  RTA_PAYLOAD(tb[RTA_DST]));
+	if (tb[RTA_SRC] && r->rtm_src_len)
+		p = route_key_put(p, end, RTA_SRC, RTA_DATA(tb[RTA_SRC]),
+				  RTA_PAYLOAD(tb[RTA_SRC]));
+	if (!p)
+		return -1;
+	*idlen = p - key;
+
+	p = route_key_put(p, end, 0, &hdr, sizeof(hdr));
+	for (type = 1; type <= RTA_MAX; type++) {
+		struct rtattr *rta = tb[type];
+
+		if (!rta)
+			continue;
+
+		switch (type) {
+		case RTA_DST:
+		case RTA_SRC:
+		case RTA_TABLE:
+		case RTA_PRIORITY:
+		case RTA_CACHEINFO:
+		case RTA_PAD:
+			continue;
+		case RTA_OIF:
+		case RTA_GATEWAY:
+		case RTA_VIA:
+		case RTA_MULTIPATH:
+			/* also dumped for routes using a nexthop object */
+			if (tb[RTA_NH_ID])
+				continue;
+			if (type == RTA_MULTIPATH) {
+				p = route_key_multipath(p, end, rta, devs);
+				continue;
+			}
+			if (type == RTA_OIF && !devs)
+				continue;
+			break;
+		case RTA_METRICS:
+			p = route_key_put(p, end, type, NULL, 0);
+			p = route_key_attrs(p, end, RTA_DATA(rta),
+					    RTA_PAYLOAD(rta));
+			continue;
+		case RTA_PREF:
+			/* dumped for every IPv6 route */
+			if (rta_getattr_u8(rta) == ICMPV6_ROUTER_PREF_MEDIUM)
+				continue;
+			break;
+		}
+		/* RTA_EXPIRES is not dumped, so such routes get refreshed */
+		p = route_key_put(p, end, type, RTA_DATA(rta), RTA_PAYLOAD(rta));
+	}
+
+	return p ? p - key : -1;
+}
+
+static __u32 route_key_hash(const char *key, unsigned int len)
+{
+	__u32 h = 2166136261U;
+
+	while (len--)
+		h = (h ^ (unsigned char)*key++) * 16777619U;
+	return h;
+}
+
+/* Whether a route names a device, for one nexthop at least */
+static bool route_devs(const struct nlmsghdr *n)
+{
+	const struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	const struct rtnexthop *nh;
+	struct rtattr *tb[RTA_MAX+1];
+
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+	if (tb[RTA_OIF])
+		return true;
+	if (!tb[RTA_MULTIPATH])
+		return false;
+
+	nh = RTA_DATA(tb[RTA_MULTIPATH]);
+	len = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+	while (len >= (int)sizeof(*nh) && nh->rtnh_len >= sizeof(*nh) &&
+	       nh->rtnh_len <= len) {
+		if (nh->rtnh_ifindex)
+			return true;
+		len -= NLMSG_ALIGN(nh->rtnh_len);
+		nh = RTNH_NEXT(nh);
+	}
+	return false;
+}
+
+static struct iproute_ent *iproute_ent_new(const struct nlmsghdr *n,
+					   int lineno, bool devs)
+{
+	char key[IPROUTE_KEY_MAX];
+	struct iproute_ent *e;
+	unsigned int idlen;
+	int keylen;
+
+	keylen = route_key(n, key, &idlen, devs);
+	if (keylen < 0) {
+		errno = EMSGSIZE;
+		return NULL;
+	}
+
+	e = malloc(sizeof(*e) + NLMSG_ALIGN(n->nlmsg_len) + keylen);
+	if (!e)
+		return NULL;
+	e->next = NULL;
+	e->n = (struct nlmsghdr *)(e + 1);
+	memcpy(e->n, n, n->nlmsg_len);
+	e->key = (char *)e->n + NLMSG_ALIGN(n->nlmsg_len);
+	memcpy(e->key, key, keylen);
+	e->idlen = idlen;
+	e->keylen = keylen;
+	e->hash = route_key_hash(key, idlen);
+	e->lineno = lineno;
+	e->devs = devs;
+	e->state = IPROUTE_ENT_MISSING;
+	return e;
+}
+
+static int iproute_set_add(struct iproute_set *set, struct iproute_ent *e)
+{
+	if (set->count == set->size) {
+		unsigned int size = set->size ? set->size * 2 : 256;
+		struct iproute_ent **ents;
+
+		ents = realloc(set->ents, size * sizeof(*ents));
+		if (!ents)
+			return -1;
+		set->ents = ents;
+		set->size = size;
+	}
+	set->ents[set->count++] = e;
+	return 0;
+}
+
+/* The route of the set that @e would replace */
+static struct iproute_ent *iproute_set_find(const struct iproute_set *set,
+					    const struct iproute_ent *e)
+{
+	struct iproute_ent *h;
+
+	for (h = set->hash[e->hash & set->hash_mask]; h; h = h->next)
+		if (h->hash == e->hash && h->idlen == e->idlen &&
+		    !memcmp(h->key, e->key, e->idlen))
+			return h;
+	return NULL;
+}
+
+/* Index the routes read so far, dropping those the file repeats */
+static int iproute_set_hash(struct iproute_set *set, const char *file)
+{
+	unsigned int size = 64, i, j;
+
+	while (size < 2 * set->count)
+		size *= 2;
+	set->hash = calloc(size, sizeof(*set->hash));
+	if (!set->hash)
+		return -1;
+	set->hash_mask = size - 1;
+
+	for (i = j = 0; i < set->count; i++) {
+		struct iproute_ent *e = set->ents[i], *dup;
+
+		dup = iproute_set_find(set, e);
+		if (dup) {
+			fprintf(stderr, "%s:%d: same route as line %d, ignored\n",
+				file, e->lineno, dup->lineno);
+			free(e);
+			continue;
+		}
+		e->next = set->hash[e->hash & set->hash_mask];
+		set->hash[e->hash & set->hash_mask] = e;
+		set->ents[j++] = e;
+	}
+	set->count = j;
+	return 0;
+}
+
+static void iproute_set_free(struct iproute_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; i++)
+		free(set->ents[i]);
+	free(set->ents);
+	free(set->hash);
+}
+
+static bool iproute_apply_owns(const struct iproute_apply *ap,
+			       int family, __u32 table)
+{
+	unsigned int i;
+
+	if (family >= 64 || !(ap->families & (1ULL << family)))
+		return false;
+	for (i = 0; i < ap->ntables; i++)
+		if (ap->tables[i] == table)
+			return true;
+	return false;
+}
+
+static int iproute_apply_table(struct iproute_apply *ap, __u32 table)
+{
+	unsigned int i;
+
+	for (i = 0; i < ap->ntables; i++)
+		if (ap->tables[i] == table)
+			return 0;
+	if (ap->ntables == IPROUTE_APPLY_MAX_TABLES)
+		return -1;
+	ap->tables[ap->ntables++] = table;
+	return 0;
+}
+
+/* Read the whole file; a line that fails would delete its route */
+static int iproute_apply_read(struct iproute_apply *ap)
+{
+	struct rtnl_bulk *b = &ap->bulk;
+	char *args[IPROUTE_APPLY_MAX_ARGS];
+	char *line = NULL;
+	int lineno = 0;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(b);
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		struct rtattr *tb[RTA_MAX+1];
+		struct iproute_req req;
+		struct iproute_ent *e;
+		int nargs;
+
+		lineno++;
+		nargs = rtnl_bulk_tokens(line, args, IPROUTE_APPLY_MAX_ARGS);
+		if (nargs == 0)
+			continue;
+
+		b->entries++;
+		if (nargs > IPROUTE_APPLY_MAX_ARGS) {
+			rtnl_bulk_line_error(b, lineno, "too many arguments");
+			continue;
+		}
+
+		/* routes of the file are those of the protocol applied */
+		iproute_req_init(&req, RTM_NEWROUTE,
+				 NLM_F_CREATE | NLM_F_REPLACE);
+		req.r.rtm_protocol = ap->protocol;
+		if (iproute_parse(&req, nargs, args)) {
+			rtnl_bulk_line_error(b, lineno, "invalid route");
+			continue;
+		}
+		if (req.r.rtm_protocol != ap->protocol) {
+			rtnl_bulk_line_error(b, lineno,
+					     "\"proto\" differs from the one applied");
+			continue;
+		}
+
+		parse_rtattr(tb, RTA_MAX, RTM_RTA(&req.r),
+			     req.n.nlmsg_len - NLMSG_LENGTH(sizeof(req.r)));
+		if (req.r.rtm_family >= 64 ||
+		    iproute_apply_table(ap, rtm_get_table(&req.r, tb))) {
+			rtnl_bulk_line_error(b, lineno, "too many tables");
+			continue;
+		}
+		ap->families |= 1ULL << req.r.rtm_family;
+
+		e = iproute_ent_new(&req.n, lineno, route_devs(&req.n));
+		if (!e || iproute_set_add(&ap->set, e)) {
+			rtnl_bulk_line_error(b, lineno,
+					     errno == EMSGSIZE ?
+					     "route too large to compare" :
+					     strerror(errno));
+			free(e);
+			break;
+		}
+	}
+	rtnl_bulk_close(fp);
+	free(line);
+
+	if (b->failed) {
+		fprintf(stderr, "%u of %u routes invalid, nothing applied\n",
+			b->failed, b->entries);
+		return -1;
+	}
+	return 0;
+}
+
+static int iproute_apply_route(struct nlmsghdr *n, void *arg)
+{
+	struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct iproute_apply *ap = arg;
+	struct iproute_ent *e, *want;
+	struct rtattr *table;
+
+	if (n->nlmsg_type != RTM_NEWROUTE || len < 0)
+		return 0;
+	if (r->rtm_protocol != ap->protocol || r->rtm_flags & RTM_F_CLONED)
+		return 0;
+
+	table = parse_rtattr_one(RTA_TABLE, RTM_RTA(r), len);
+	if (!iproute_apply_owns(ap, r->rtm_family,
+				table ? rta_getattr_u32(table) : r->rtm_table))
+		return 0;
+
+	e = iproute_ent_new(n, 0, true);
+	if (!e)
+		return -1;
+
+	want = iproute_set_find(&ap->set, e);
+	if (want && !want->devs) {
+		free(e);
+		e = iproute_ent_new(n, 0, false);
+		if (!e)
+			return -1;
+	}
+	if (want && want->state == IPROUTE_ENT_MISSING) {
+		if (want->keylen == e->keylen &&
+		    !memcmp(want->key, e->key, e->keylen)) {
+			want->state = IPROUTE_ENT_INSTALLED;
+			ap->kept++;
+		} else {
+			want->state = IPROUTE_ENT_CHANGED;
+			ap->replaced++;
+		}
+		free(e);
+		return 0;
+	}
+	/* not in the file, or one more route with the same key */
+	if (iproute_set_add(&ap->stale, e)) {
+		free(e);
+		return -1;
+	}
+	return 0;
+}
+
+/* Queue the routes not installed yet */
+static int iproute_apply_send(struct rtnl_flush *f, struct iproute_ent **ents,
+			      unsigned int count, __u16 type)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (ents[i]->state == IPROUTE_ENT_INSTALLED)
+			continue;
+		f->tag = ents[i]->lineno;
+		if (rtnl_flush_add(f, ents[i]->n, type) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int iproute_apply(int argc, char **argv)
+{
+	struct iproute_apply ap = {
+		.bulk.what = "changes",
+		.bulk.window = IPROUTE_APPLY_WINDOW,
+		.bulk.name = iproute_apply_name,
+		.protocol = -1,
+	};
+	struct iproute_set *set = &ap.set;
+	unsigned int added, deleted;
+	struct rtnl_flush f;
+	int dump_family;
+	int ret = -1;
+
+	while (argc > 0) {
+		if (matches(*argv, "protocol") == 0) {
+			__u32 prot;
+
+			NEXT_ARG();
+			if (rtnl_rtprot_a2n(&prot, *argv) || prot > 255)
+				invarg("\"protocol\" value is invalid\n", *argv);
+			ap.protocol = prot;
+		} else if (matches(*argv, "table") == 0) {
+			__u32 tid;
+
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&tid, *argv))
+				invarg("\"table\" value is invalid\n", *argv);
+			if (iproute_apply_table(&ap, tid))
+				invarg("too many tables\n", *argv);
+		} else {
+			if (strcmp(*argv, "file") == 0)
+				NEXT_ARG();
+			if (ap.bulk.file)
+				duparg2("file", *argv);
+			ap.bulk.file = *argv;
+		}
+		argc--; argv++;
+	}
+	if (!ap.bulk.file)
+		missarg("file");
+	/* every route of the protocol that FILE does not list is deleted */
+	if (ap.protocol < 0)
+		missarg("proto");
+	if (preferred_family != AF_UNSPEC)
+		ap.families |= 1ULL << preferred_family;
+
+	if (iproute_apply_read(&ap) || iproute_set_hash(set, ap.bulk.file))
+		goto out;
+	/* an empty file, like "ip route show", is about IPv4 */
+	if (!ap.families)
+		ap.families = 1ULL << AF_INET;
+	if (!ap.ntables)
+		iproute_apply_table(&ap, RT_TABLE_MAIN);
+
+	/* one dump, narrowed down to the protocol on strict kernels */
+	dump_family = AF_UNSPEC;
+	if (ap.families && !(ap.families & (ap.families - 1)))
+		dump_family = ffsll(ap.families) - 1;
+	filter.protocol = ap.protocol;
+	if (rtnl_routedump_req(&rth, dump_family, iproute_dump_filter) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, iproute_apply_route, &ap) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	if (rtnl_bulk_start(&ap.bulk, &f) < 0)
+		goto out;
+
+	/* new routes go in before the old ones go away */
+	if (iproute_apply_send(&f, set->ents, set->count, 0) < 0 ||
+	    rtnl_flush_commit(&f) == -2 ||
+	    iproute_apply_send(&f, ap.stale.ents, ap.stale.count,
+			       RTM_DELROUTE) < 0) {
+		perror("Cannot talk to rtnetlink");
+		rtnl_flush_close(&f);
+		goto out;
+	}
+
+	added = set->count - ap.kept - ap.replaced;
+	deleted = ap.stale.count;
+	ap.bulk.entries = added + ap.replaced + deleted;
+	ret = rtnl_bulk_finish(&ap.bulk, &f);
+	if (show_stats)
+		printf("%u routes: %u added, %u replaced, %u deleted, %u unchanged\n",
+		       set->count, added, ap.replaced, deleted, ap.kept);
+out:
+	iproute_set_free(&ap.stale);
+	iproute_set_free(set);
+	return ret;
 }
 
 static int save_route_errhndlr(struct nlmsghdr *n, void *arg)
@@ -2036,10 +2854,172 @@ static int iproute_list_flush_or_save(int argc, char **argv, int action)
 
 	delete_json_obj();
 	fflush(stdout);
+	if (action == IPROUTE_SAVE && save_route_done())
+		return -1;
+	if (show_stats)
+		print_nexthop_cache_stats(stderr);
 	return 0;
 }
 
 
+#define IPROUTE_GET_WINDOW	1024
+
+struct iproute_get_many {
+	struct rtnl_bulk	bulk;
+	FILE			*fp;
+	char			*line;
+	size_t			len;
+	int			lineno;
+	inet_prefix		*dsts;	/* of the lookups in flight, by tag */
+	unsigned int		window;
+	unsigned int		count;
+};
+
+static void iproute_get_many_answer(const struct nlmsghdr *n, int tag,
+				    void *arg)
+{
+	/* filter.cloned is 2 as for a single "get", so every answer shows */
+	print_route((struct nlmsghdr *)n, stdout);
+}
+
+static void iproute_get_many_report(const struct nlmsghdr *err, int tag,
+				    void *arg)
+{
+	const struct nlmsgerr *e = NLMSG_DATA(err);
+	struct iproute_get_many *g = arg;
+	const inet_prefix *dst = &g->dsts[tag % g->window];
+
+	open_json_object(NULL);
+	print_color_string(PRINT_ANY, ifa_family_color(dst->family), "dst",
+			   "%s", rt_addr_n2a(dst->family, dst->bytelen,
+					     dst->data));
+	print_string(PRINT_ANY, "error", " error %s", strerror(-e->error));
+	print_nl();
+	close_json_object();
+	g->bulk.failed++;
+}
+
+/* Next destination of the file, 1 at its end */
+static int iproute_get_many_read(struct iproute_get_many *g,
+				 inet_prefix *dst, int family)
+{
+	char *tok[1];
+	int ntok;
+
+	while (getline(&g->line, &g->len, g->fp) != -1) {
+		g->lineno++;
+		ntok = rtnl_bulk_tokens(g->line, tok, 1);
+		if (ntok == 0)
+			continue;
+
+		g->bulk.entries++;
+		if (ntok > 1)
+			rtnl_bulk_line_error(&g->bulk, g->lineno,
+					     "too many fields");
+		else if (get_addr_1(dst, tok[0], family))
+			rtnl_bulk_line_error(&g->bulk, g->lineno,
+					     "invalid address");
+		else
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Look up many destinations at once, with lookups pipelined in windows
+ * on one socket and their answers matched by sequence number. The rest
+ * of the request is in @tmpl.
+ */
+static int iproute_get_many(const struct nlmsghdr *tmpl, int maxlen,
+			    const char *file, char **dstv, int ndst)
+{
+	struct iproute_get_many g = {
+		.bulk.file = file,
+		.bulk.what = "lookups",
+	};
+	socklen_t optlen = sizeof(int);
+	struct nlmsghdr *n = NULL;
+	struct rtnl_flush f;
+	int ret = -1, i = 0;
+	int rcvbuf;
+
+	if (file) {
+		g.fp = rtnl_bulk_open(&g.bulk);
+		if (!g.fp)
+			return -1;
+	}
+
+	if (rtnl_flush_open(&f, 0) < 0)
+		goto out;
+
+	/*
+	 * The kernel answers the lookups of a window while we send it, so
+	 * they all have to fit into the receive buffer. An answer takes
+	 * well below 2k of it, the reported size is twice the real one.
+	 */
+	if (getsockopt(f.rth.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) < 0) {
+		perror("SO_RCVBUF");
+		rtnl_flush_close(&f);
+		goto out;
+	}
+	g.window = MAX(16, MIN(IPROUTE_GET_WINDOW, rcvbuf / 4096));
+
+	n = malloc(maxlen);
+	g.dsts = calloc(g.window, sizeof(*g.dsts));
+	if (!n || !g.dsts ||
+	    rtnl_flush_set_report(&f, g.window, iproute_get_many_report,
+				  &g) < 0) {
+		rtnl_flush_close(&f);
+		goto out;
+	}
+	rtnl_flush_set_answer(&f, iproute_get_many_answer);
+
+	new_json_obj(json);
+	for (;;) {
+		const struct rtmsg *t = NLMSG_DATA(tmpl);
+		inet_prefix *dst = &g.dsts[g.count % g.window];
+		struct rtmsg *r;
+
+		if (g.fp) {
+			if (iproute_get_many_read(&g, dst, t->rtm_family))
+				break;
+		} else {
+			if (i == ndst)
+				break;
+			get_addr(dst, dstv[i++], t->rtm_family);
+			g.bulk.entries++;
+		}
+
+		memcpy(n, tmpl, tmpl->nlmsg_len);
+		r = NLMSG_DATA(n);
+		r->rtm_family = dst->family;
+		r->rtm_dst_len = dst->bitlen;
+		addattr_l(n, maxlen, RTA_DST, &dst->data, dst->bytelen);
+		/* Only IPv4 supports the RTM_F_LOOKUP_TABLE flag */
+		if (r->rtm_family == AF_INET)
+			r->rtm_flags |= RTM_F_LOOKUP_TABLE;
+
+		f.tag = g.count++;
+		if (rtnl_flush_add(&f, n, 0) < 0) {
+			perror("Cannot talk to rtnetlink");
+			rtnl_flush_close(&f);
+			delete_json_obj();
+			goto out;
+		}
+	}
+	ret = rtnl_bulk_finish(&g.bulk, &f);
+	delete_json_obj();
+	if (show_stats && !json)
+		printf("%u lookups, %.0f lookups/s\n", g.count,
+		       g.bulk.rate);
+out:
+	rtnl_bulk_close(g.fp);
+	free(g.line);
+	free(g.dsts);
+	free(n);
+	return ret;
+}
+
 static int iproute_get(int argc, char **argv)
 {
 	struct {
@@ -2059,7 +3039,11 @@ static int iproute_get(int argc, char **argv)
 	int fib_match = 0;
 	int from_ok = 0;
 	unsigned int mark = 0;
-	bool address_found = false;
+	char *file = NULL;
+	/* collected at the front of argv, which the loop has moved past */
+	char **dstv = argv;
+	int ndst = 0;
+	inet_prefix addr;
 
 	iproute_reset_filter(0);
 	filter.cloned = 2;
@@ -2158,38 +3142,23 @@ static int iproute_get(int argc, char **argv)
 				invarg("invalid flowlabel", *argv);
 			addattr32(&req.n, sizeof(req), RTA_FLOWLABEL,
 				  flowlabel);
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (file)
+				duparg("file", *argv);
+			file = *argv;
 		} else {
-			inet_prefix addr;
-
 			if (strcmp(*argv, "to") == 0) {
 				NEXT_ARG();
 			}
 			if (matches(*argv, "help") == 0)
 				usage();
-			get_prefix(&addr, *argv, req.r.rtm_family);
-			if (req.r.rtm_family == AF_UNSPEC)
-				req.r.rtm_family = addr.family;
-			if (addr.bytelen)
-				addattr_l(&req.n, sizeof(req),
-					  RTA_DST, &addr.data, addr.bytelen);
-			if (req.r.rtm_family == AF_INET && addr.bitlen != 32) {
-				fprintf(stderr,
-					"Warning: /%u as prefix is invalid, only /32 (or none) is supported.\n",
-					addr.bitlen);
-				req.r.rtm_dst_len = 32;
-			} else if (req.r.rtm_family == AF_INET6 && addr.bitlen != 128) {
-				fprintf(stderr,
-					"Warning: /%u as prefix is invalid, only /128 (or none) is supported.\n",
-					addr.bitlen);
-				req.r.rtm_dst_len = 128;
-			} else
-				req.r.rtm_dst_len = addr.bitlen;
-			address_found = true;
+			dstv[ndst++] = *argv;
 		}
 		argc--; argv++;
 	}
 
-	if (!address_found) {
+	if (!ndst && !file) {
 		fprintf(stderr, "need at least a destination address\n");
 		return -1;
 	}
@@ -2212,6 +3181,35 @@ static int iproute_get(int argc, char **argv)
 	}
 	if (mark)
 		addattr32(&req.n, sizeof(req), RTA_MARK, mark);
+	if (fib_match)
+		req.r.rtm_flags |= RTM_F_FIB_MATCH;
+
+	if (file || ndst > 1) {
+		if (connected) {
+			fprintf(stderr, "\"connected\" takes a single destination\n");
+			return -1;
+		}
+		return iproute_get_many(&req.n, sizeof(req), file, dstv, ndst);
+	}
+
+	get_prefix(&addr, dstv[0], req.r.rtm_family);
+	if (req.r.rtm_family == AF_UNSPEC)
+		req.r.rtm_family = addr.family;
+	if (addr.bytelen)
+		addattr_l(&req.n, sizeof(req),
+			  RTA_DST, &addr.data, addr.bytelen);
+	if (req.r.rtm_family == AF_INET && addr.bitlen != 32) {
+		fprintf(stderr,
+			"Warning: /%u as prefix is invalid, only /32 (or none) is supported.\n",
+			addr.bitlen);
+		req.r.rtm_dst_len = 32;
+	} else if (req.r.rtm_family == AF_INET6 && addr.bitlen != 128) {
+		fprintf(stderr,
+			"Warning: /%u as prefix is invalid, only /128 (or none) is supported.\n",
+			addr.bitlen);
+		req.r.rtm_dst_len = 128;
+	} else
+		req.r.rtm_dst_len = addr.bitlen;
 
 	if (req.r.rtm_family == AF_UNSPEC)
 		req.r.rtm_family = AF_INET;
@@ -2219,8 +3217,6 @@ static int iproute_get(int argc, char **argv)
 	/* Only IPv4 supports the RTM_F_LOOKUP_TABLE flag */
 	if (req.r.rtm_family == AF_INET)
 		req.r.rtm_flags |= RTM_F_LOOKUP_TABLE;
-	if (fib_match)
-		req.r.rtm_flags |= RTM_F_FIB_MATCH;
 
 	if (rtnl_talk(&rth, &req.n, &answer) < 0)
 		return -2;
@@ -2301,42 +3297,18 @@ static int rtattr_cmp(const struct rtattr *rta1, const struct rtattr *rta2)
 	return memcmp(RTA_DATA(rta1), RTA_DATA(rta2), RTA_PAYLOAD(rta1));
 }
 
-static int restore_handler(struct rtnl_ctrl_data *ctrl,
-			   struct nlmsghdr *n, void *arg)
+/* Restore routes in correct order:
+ * 0. ones for local addresses,
+ * 1. ones for local networks,
+ * 2. others (remote networks/hosts).
+ */
+static int restore_prio(struct rtattr **tb)
 {
-	struct rtmsg *r = NLMSG_DATA(n);
-	struct rtattr *tb[RTA_MAX+1];
-	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
-	int ret, prio = *(int *)arg;
-
-	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
-
-	/* Restore routes in correct order:
-	 * 0. ones for local addresses,
-	 * 1. ones for local networks,
-	 * 2. others (remote networks/hosts).
-	 */
-	if (!prio && !tb[RTA_GATEWAY] && (!tb[RTA_PREFSRC] ||
-	    !rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST])))
-		goto restore;
-	else if (prio == 1 && !tb[RTA_GATEWAY] && tb[RTA_PREFSRC] &&
-		 rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST]))
-		goto restore;
-	else if (prio == 2 && tb[RTA_GATEWAY])
-		goto restore;
-
-	return 0;
-
-restore:
-	n->nlmsg_flags |= NLM_F_REQUEST | NLM_F_CREATE | NLM_F_ACK;
-
-	ll_init_map(&rth);
-
-	ret = rtnl_talk(&rth, n, NULL);
-	if ((ret < 0) && (errno == EEXIST))
-		ret = 0;
-
-	return ret;
+	if (tb[RTA_GATEWAY])
+		return 2;
+	if (!tb[RTA_PREFSRC] || !rtattr_cmp(tb[RTA_PREFSRC], tb[RTA_DST]))
+		return 0;
+	return 1;
 }
 
 static int route_dump_check_magic(void)
@@ -2358,51 +3330,249 @@ static int route_dump_check_magic(void)
 	return 0;
 }
 
-static int iproute_restore(void)
+#define IPROUTE_RESTORE_WINDOW	1024
+
+/* A saved dump, mapped when it is a file and read in otherwise */
+struct route_dump {
+	char		*map;
+	size_t		map_len;
+	char		*data;		/* the magic */
+	size_t		len;
+	const struct route_dump_index *idx;
+	unsigned int	failed;
+	unsigned int	count;
+};
+
+static int route_dump_open(struct route_dump *d)
 {
-	int pos, prio;
+	const struct route_dump_index *idx;
+	struct stat st;
+	off_t pos;
 
-	if (route_dump_check_magic())
+	if (isatty(STDIN_FILENO)) {
+		fprintf(stderr, "Can't restore route dump from a terminal\n");
 		return -1;
+	}
+
+	pos = lseek(STDIN_FILENO, 0, SEEK_CUR);
+	if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && pos >= 0 &&
+	    st.st_size > pos) {
+		d->map_len = st.st_size;
+		d->map = mmap(NULL, d->map_len, PROT_READ, MAP_PRIVATE,
+			      STDIN_FILENO, 0);
+		if (d->map == MAP_FAILED) {
+			perror("Failed to restore: mmap");
+			return -1;
+		}
+		madvise(d->map, d->map_len, MADV_SEQUENTIAL);
+		d->data = d->map + pos;
+		d->len = d->map_len - pos;
+	} else {
+		size_t size = 0;
+		ssize_t ret;
+
+		for (;;) {
+			if (d->len == size) {
+				char *data;
 
-	pos = ftell(stdin);
-	if (pos == -1) {
-		perror("Failed to restore: ftell");
+				size = size ? 2 * size : 1024 * 1024;
+				data = realloc(d->data, size);
+				if (!data) {
+					fprintf(stderr, "Failed to restore: not enough memory\n");
+					return -1;
+				}
+				d->data = data;
+			}
+			ret = read(STDIN_FILENO, d->data + d->len,
+				   size - d->len);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0) {
+				perror("Failed to restore: read");
+				return -1;
+			}
+			if (ret == 0)
+				break;
+			d->len += ret;
+		}
+	}
+
+	if (d->len < sizeof(route_dump_magic) ||
+	    memcmp(d->data, &route_dump_magic, sizeof(route_dump_magic))) {
+		fprintf(stderr, "Magic mismatch\n");
 		return -1;
 	}
 
-	for (prio = 0; prio < 3; prio++) {
-		int err;
+	idx = (void *)(d->data + sizeof(route_dump_magic));
+	if (d->len >= sizeof(route_dump_magic) + sizeof(*idx) &&
+	    idx->n.nlmsg_type == NLMSG_NOOP &&
+	    idx->n.nlmsg_len == sizeof(*idx) &&
+	    idx->magic == ROUTE_DUMP_INDEX_MAGIC &&
+	    idx->nranges <= ROUTE_DUMP_INDEX_MAX)
+		d->idx = idx;
 
-		err = rtnl_from_file(stdin, &restore_handler, &prio);
-		if (err)
-			return -2;
+	return 0;
+}
+
+static void route_dump_close(struct route_dump *d)
+{
+	if (d->map)
+		munmap(d->map, d->map_len);
+	else
+		free(d->data);
+}
+
+static void restore_report(const struct nlmsghdr *err, int tag, void *arg)
+{
+	const struct nlmsgerr *e = NLMSG_DATA(err);
+	struct route_dump *d = arg;
+
+	if (!nl_dump_ext_ack(err, NULL))
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(-e->error));
+	d->failed++;
+}
+
+/* Queue the routes of [off, off + len) that are of @prio and @table */
+static int restore_range(struct route_dump *d, struct rtnl_flush *f,
+			 __u64 off, __u64 len, int prio, __u32 table)
+{
+	__u64 end = off + len;
+
+	if (end > d->len)
+		end = d->len;
 
-		if (fseek(stdin, pos, SEEK_SET) == -1) {
-			perror("Failed to restore: fseek");
+	while (off + sizeof(struct nlmsghdr) <= end) {
+		struct nlmsghdr *n = (void *)(d->data + off);
+		struct rtmsg *r = NLMSG_DATA(n);
+		struct rtattr *tb[RTA_MAX+1];
+		int l = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+
+		if (n->nlmsg_len < sizeof(*n) || n->nlmsg_len > end - off) {
+			fprintf(stderr, "!!!malformed message: len=%u @%llu\n",
+				n->nlmsg_len, (unsigned long long)off);
 			return -1;
 		}
-	}
+		off += NLMSG_ALIGN(n->nlmsg_len);
+
+		if (n->nlmsg_type != RTM_NEWROUTE || l < 0)
+			continue;
+		parse_rtattr(tb, RTA_MAX, RTM_RTA(r), l);
+		if (table && rtm_get_table(r, tb) != table)
+			continue;
+		if (restore_prio(tb) != prio)
+			continue;
 
+		if (rtnl_flush_add(f, n, RTM_NEWROUTE) < 0)
+			return -1;
+		d->count++;
+	}
 	return 0;
 }
 
+static int iproute_restore(int argc, char **argv)
+{
+	struct route_dump d = {};
+	struct rtnl_flush f;
+	__u32 table = 0;
+	int prio, ret = -1;
+
+	while (argc > 0) {
+		if (matches(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (rtnl_rttable_a2n(&table, *argv))
+				invarg("\"table\" value is invalid\n", *argv);
+		} else if (matches(*argv, "vrf") == 0) {
+			NEXT_ARG();
+			table = ipvrf_get_table(*argv);
+			if (table == 0)
+				invarg("Invalid VRF\n", *argv);
+		} else {
+			invarg("unknown", *argv);
+		}
+		argc--; argv++;
+	}
+
+	if (route_dump_open(&d))
+		goto out;
+	if (rtnl_flush_open(&f, 0) < 0)
+		goto out;
+	if (rtnl_flush_set_report(&f, IPROUTE_RESTORE_WINDOW, restore_report,
+				  &d) < 0)
+		goto out_close;
+	f.flags = NLM_F_CREATE;
+	f.ignore_errno = EEXIST;
+
+	/*
+	 * Later routes may need the ones before them, the kernel handles
+	 * the requests of a window in order, so there is no need to wait
+	 * between the passes.
+	 */
+	for (prio = 0; prio < 3; prio++) {
+		int i, err = 0;
+
+		if (!d.idx || !d.idx->nranges || !table) {
+			err = restore_range(&d, &f, sizeof(route_dump_magic),
+					    d.len, prio, table);
+		} else {
+			for (i = 0; i < d.idx->nranges && !err; i++) {
+				const struct route_dump_range *rg;
+
+				rg = &d.idx->ranges[i];
+				if (rg->table != table)
+					continue;
+				err = restore_range(&d, &f,
+						    sizeof(route_dump_magic) +
+						    rg->offset, rg->len,
+						    prio, table);
+			}
+		}
+		if (err) {
+			perror("Failed to restore");
+			goto out_close;
+		}
+	}
+	if (rtnl_flush_commit(&f) == -2) {
+		perror("Failed to restore");
+		goto out_close;
+	}
+
+	if (d.failed)
+		fprintf(stderr, "%u of %u routes failed\n", d.failed, d.count);
+	else
+		ret = 0;
+	if (show_stats)
+		printf("%u routes, %.0f routes/s\n", d.count,
+		       rtnl_flush_rate(&f));
+
+out_close:
+	rtnl_flush_close(&f);
+out:
+	route_dump_close(&d);
+	return ret;
+}
+
 static int show_handler(struct rtnl_ctrl_data *ctrl,
 			struct nlmsghdr *n, void *arg)
 {
+	/* the index of a dump saved to a file */
+	if (n->nlmsg_type == NLMSG_NOOP)
+		return 0;
 	print_route(n, stdout);
 	return 0;
 }
 
 static int iproute_showdump(void)
 {
+	int err;
+
 	if (route_dump_check_magic())
 		return -1;
 
-	if (rtnl_from_file(stdin, &show_handler, NULL))
-		return -2;
+	new_json_obj(json);
+	err = rtnl_from_file(stdin, &show_handler, NULL);
+	delete_json_obj();
 
-	return 0;
+	return err ? -2 : 0;
 }
 
 void iproute_reset_filter(int ifindex)
@@ -2451,9 +3621,13 @@ int do_iproute(int argc, char **argv)
 	if (matches(*argv, "save") == 0)
 		return iproute_list_flush_or_save(argc-1, argv+1, IPROUTE_SAVE);
 	if (matches(*argv, "restore") == 0)
-		return iproute_restore();
+		return iproute_restore(argc-1, argv+1);
 	if (matches(*argv, "showdump") == 0)
 		return iproute_showdump();
+	if (matches(*argv, "apply") == 0)
+		return iproute_apply(argc-1, argv+1);
+	if (strcmp(*argv, "template") == 0)
+		return lwt_template_define(argc-1, argv+1);
 	if (matches(*argv, "help") == 0)
 		usage();
 
@@ -2244,6 +2244,110 @@ static int parse_encap_xfrm(struct rtattr *rta, size_t len,
 	return ret;
 }
 
+/*
+ * Encaps parsed once and referenced by name with "encap template NAME".
+ * A batch installing many routes that share a few encaps then copies
+ * the attributes instead of parsing each of them again.
+ */
+#define LWT_TEMPLATE_HASH	1024
+
+struct lwt_template {
+	struct lwt_template	*next;
+	char			*name;
+	__u16			type;
+	__u16			len;
+	char			data[];		/* payload of the encap nest */
+};
+
+static struct lwt_template *lwt_templates[LWT_TEMPLATE_HASH];
+
+static struct lwt_template **lwt_template_slot(const char *name)
+{
+	struct lwt_template **t;
+	__u32 h = 2166136261U;
+	const char *p;
+
+	for (p = name; *p; p++)
+		h = (h ^ (unsigned char)*p) * 16777619U;
+
+	for (t = &lwt_templates[h % LWT_TEMPLATE_HASH]; *t; t = &(*t)->next)
+		if (strcmp((*t)->name, name) == 0)
+			break;
+	return t;
+}
+
+static int lwt_template_put(struct rtattr *rta, size_t len, const char *name,
+			    int encap_attr, int encap_type_attr)
+{
+	const struct lwt_template *t = *lwt_template_slot(name);
+	struct rtattr *nest;
+
+	if (!t)
+		invarg("\"encap template\" is not defined\n", name);
+
+	if (RTA_ALIGN(rta->rta_len) + RTA_LENGTH(t->len) > len) {
+		fprintf(stderr, "Error: encap template \"%s\" is too large\n",
+			name);
+		return -1;
+	}
+	nest = rta_nest(rta, len, encap_attr);
+	memcpy(RTA_TAIL(rta), t->data, t->len);
+	rta->rta_len += RTA_ALIGN(t->len);
+	rta_nest_end(rta, nest);
+
+	return rta_addattr16(rta, len, encap_type_attr, t->type);
+}
+
+/* ip route template NAME encap ENCAPTYPE ENCAPHDR */
+int lwt_template_define(int argc, char **argv)
+{
+	struct lwt_template **slot, *t;
+	struct rtattr *tb[RTA_MAX+1];
+	char buf[4096];
+	struct rtattr *rta = (void *)buf;
+	const char *name;
+
+	if (argc < 2 || strcmp(argv[1], "encap") != 0) {
+		fprintf(stderr, "Usage: ip route template NAME encap ENCAPTYPE ENCAPHDR\n");
+		return -1;
+	}
+	name = *argv;
+	NEXT_ARG();
+
+	rta->rta_type = RTA_ENCAP;
+	rta->rta_len = RTA_LENGTH(0);
+	if (lwt_parse_encap(rta, sizeof(buf), &argc, &argv,
+			    RTA_ENCAP, RTA_ENCAP_TYPE))
+		return -1;
+	if (argc > 1)
+		invarg("unknown encap argument\n", argv[1]);
+
+	parse_rtattr_flags(tb, RTA_MAX, RTA_DATA(rta), RTA_PAYLOAD(rta),
+			   NLA_F_NESTED);
+	t = malloc(sizeof(*t) + RTA_PAYLOAD(tb[RTA_ENCAP]));
+	if (!t)
+		return -1;
+	t->name = strdup(name);
+	if (!t->name) {
+		free(t);
+		return -1;
+	}
+	t->type = rta_getattr_u16(tb[RTA_ENCAP_TYPE]);
+	t->len = RTA_PAYLOAD(tb[RTA_ENCAP]);
+	memcpy(t->data, RTA_DATA(tb[RTA_ENCAP]), t->len);
+
+	/* a later definition replaces the earlier one */
+	slot = lwt_template_slot(name);
+	t->next = NULL;
+	if (*slot) {
+		t->next = (*slot)->next;
+		free((*slot)->name);
+		free(*slot);
+	}
+	*slot = t;
+	return 0;
+}
+
 int lwt_parse_encap(struct rtattr *rta, size_t len, int *argcp, char ***argvp,
 		    int encap_attr, int encap_type_attr)
 {
@@ -2254,6 +2358,15 @@ int lwt_parse_encap(struct rtattr *rta, size_t len, int *argcp, char ***argvp,
 	int ret = 0;
 
 	NEXT_ARG();
+	if (strcmp(*argv, "template") == 0) {
+		NEXT_ARG();
+		ret = lwt_template_put(rta, len, *argv, encap_attr,
+				       encap_type_attr);
+		*argcp = argc;
+		*argvp = argv;
+		return ret;
+	}
+
 	type = read_encap_type(*argv);
 	if (!type)
 		invarg("\"encap type\" value is invalid\n", *argv);
@@ -17,14 +17,17 @@
 #include <linux/if.h>
 #include <linux/fib_rules.h>
 #include <errno.h>
+#include <stdbool.h>
 
 #include "rt_names.h"
 #include "utils.h"
 #include "ip_common.h"
 #include "json_print.h"
+#include "rtnl_bulk.h"
 
 #define PORT_MAX_MASK 0xFFFF
 #define DSCP_MAX_MASK 0x3F
+#define MAX_ROUNDS	10
 
 enum list_action {
 	IPRULE_LIST,
@@ -40,6 +43,8 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: ip rule { add | del } SELECTOR ACTION\n"
+		"       ip rule { add | del } file FILE\n"
+		"       ip rule sync file FILE [ protocol PROTO ]\n"
 		"       ip rule { flush | save | restore }\n"
 		"       ip rule [ list [ SELECTOR ]]\n"
 		"SELECTOR := [ not ] [ from PREFIX ] [ to PREFIX ] [ tos TOS ]\n"
@@ -85,6 +90,7 @@ static struct
 	struct fib_rule_port_range dport;
 	__u16 sport_mask, dport_mask;
 	__u8 ipproto;
+	int flushed;
 } filter;
 
 static inline int frh_get_table(struct fib_rule_hdr *frh, struct rtattr **tb)
@@ -638,7 +644,6 @@ static int save_rule(struct nlmsghdr *n, void *arg)
 
 static int flush_rule(struct nlmsghdr *n, void *arg)
 {
-	struct rtnl_handle rth2;
 	struct fib_rule_hdr *frh = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 	struct rtattr *tb[FRA_MAX+1];
@@ -662,16 +667,11 @@ static int flush_rule(struct nlmsghdr *n, void *arg)
 	}
 
 	if (tb[FRA_PRIORITY]) {
-		n->nlmsg_type = RTM_DELRULE;
-		n->nlmsg_flags = NLM_F_REQUEST;
-
-		if (rtnl_open(&rth2, 0) < 0)
-			return -1;
-
-		if (rtnl_talk(&rth2, n, NULL) < 0)
+		if (rtnl_flush_add(arg, n, RTM_DELRULE) < 0) {
+			perror("Failed to send flush request");
 			return -2;
-
-		rtnl_close(&rth2);
+		}
+		filter.flushed++;
 	}
 
 	return 0;
@@ -899,6 +899,40 @@ static int iprule_list_flush_or_save(int argc, char **argv, int action)
 		argc--; argv++;
 	}
 
+	if (action == IPRULE_FLUSH) {
+		struct rtnl_flush fl;
+		int round, ret = 1;
+
+		if (rtnl_flush_open(&fl, 0) < 0)
+			return 1;
+
+		/* deletes sent during the dump make it skip rules, go again */
+		for (round = 0; round < MAX_ROUNDS; round++) {
+			filter.flushed = 0;
+			if (rtnl_ruledump_req(&rth, af) < 0) {
+				perror("Cannot send dump request");
+				break;
+			}
+			if (rtnl_dump_filter(&rth, filter_fn, &fl) < 0) {
+				fprintf(stderr, "Flush terminated\n");
+				break;
+			}
+			if (rtnl_flush_commit(&fl) < 0) {
+				perror("Failed to send flush request");
+				break;
+			}
+			if (!filter.flushed) {
+				ret = 0;
+				break;
+			}
+		}
+		if (round == MAX_ROUNDS)
+			fprintf(stderr, "*** Flush not complete bailing out after %d rounds\n",
+				MAX_ROUNDS);
+		rtnl_flush_close(&fl);
+		return ret;
+	}
+
 	if (rtnl_ruledump_req(&rth, af) < 0) {
 		perror("Cannot send dump request");
 		return 1;
@@ -960,57 +994,53 @@ static int iprule_restore(void)
 	exit(rtnl_from_file(stdin, &restore_handler, NULL));
 }
 
-static int iprule_modify(int cmd, int argc, char **argv)
+struct iprule_req {
+	struct nlmsghdr		n;
+	struct fib_rule_hdr	frh;
+	char			buf[1024];
+};
+
+static void iprule_req_init(struct iprule_req *req, int cmd)
 {
-	int l3mdev_rule = 0;
-	int table_ok = 0;
-	__u32 tid = 0;
-	struct {
-		struct nlmsghdr	n;
-		struct fib_rule_hdr	frh;
-		char			buf[1024];
-	} req = {
-		.n.nlmsg_type = cmd,
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct fib_rule_hdr)),
-		.n.nlmsg_flags = NLM_F_REQUEST,
-		.frh.family = preferred_family,
-		.frh.action = FR_ACT_UNSPEC,
-	};
-	int ret;
+	memset(req, 0, sizeof(*req));
+	req->n.nlmsg_type = cmd;
+	req->n.nlmsg_len = NLMSG_LENGTH(sizeof(struct fib_rule_hdr));
+	req->n.nlmsg_flags = NLM_F_REQUEST;
+	req->frh.family = preferred_family;
+	req->frh.action = FR_ACT_UNSPEC;
 
 	if (cmd == RTM_NEWRULE) {
-		if (argc == 0) {
-			fprintf(stderr,
-				"\"ip rule add\" requires arguments.\n");
-			return -1;
-		}
-		req.n.nlmsg_flags |= NLM_F_CREATE|NLM_F_EXCL;
-		req.frh.action = FR_ACT_TO_TBL;
+		req->n.nlmsg_flags |= NLM_F_CREATE|NLM_F_EXCL;
+		req->frh.action = FR_ACT_TO_TBL;
 	}
+}
 
-	if (cmd == RTM_DELRULE && argc == 0) {
-		fprintf(stderr, "\"ip rule del\" requires arguments.\n");
-		return -1;
-	}
+/* Add SELECTOR and ACTION of a rule to a request set up by iprule_req_init() */
+static int iprule_parse(struct iprule_req *req, int argc, char **argv)
+{
+	int cmd = req->n.nlmsg_type;
+	int l3mdev_rule = 0;
+	int table_ok = 0;
+	__u32 tid = 0;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "not") == 0) {
-			req.frh.flags |= FIB_RULE_INVERT;
+			req->frh.flags |= FIB_RULE_INVERT;
 		} else if (strcmp(*argv, "from") == 0) {
 			inet_prefix dst;
 
 			NEXT_ARG();
-			get_prefix(&dst, *argv, req.frh.family);
-			req.frh.src_len = dst.bitlen;
-			addattr_l(&req.n, sizeof(req), FRA_SRC,
+			get_prefix(&dst, *argv, req->frh.family);
+			req->frh.src_len = dst.bitlen;
+			addattr_l(&req->n, sizeof(*req), FRA_SRC,
 				  &dst.data, dst.bytelen);
 		} else if (strcmp(*argv, "to") == 0) {
 			inet_prefix dst;
 
 			NEXT_ARG();
-			get_prefix(&dst, *argv, req.frh.family);
-			req.frh.dst_len = dst.bitlen;
-			addattr_l(&req.n, sizeof(req), FRA_DST,
+			get_prefix(&dst, *argv, req->frh.family);
+			req->frh.dst_len = dst.bitlen;
+			addattr_l(&req->n, sizeof(*req), FRA_DST,
 				  &dst.data, dst.bytelen);
 		} else if (matches(*argv, "preference") == 0 ||
 			   matches(*argv, "order") == 0 ||
@@ -1020,7 +1050,7 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			NEXT_ARG();
 			if (get_u32(&pref, *argv, 0))
 				invarg("preference value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), FRA_PRIORITY, pref);
+			addattr32(&req->n, sizeof(*req), FRA_PRIORITY, pref);
 		} else if (strcmp(*argv, "tos") == 0 ||
 			   matches(*argv, "dsfield") == 0) {
 			__u32 tos;
@@ -1028,7 +1058,7 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			NEXT_ARG();
 			if (rtnl_dsfield_a2n(&tos, *argv))
 				invarg("TOS value is invalid\n", *argv);
-			req.frh.tos = tos;
+			req->frh.tos = tos;
 		} else if (strcmp(*argv, "fwmark") == 0) {
 			char *slash;
 			__u32 fwmark, fwmask;
@@ -1040,12 +1070,12 @@ static int iprule_modify(int cmd, int argc, char **argv)
 				*slash = '\0';
 			if (get_u32(&fwmark, *argv, 0))
 				invarg("fwmark value is invalid\n", *argv);
-			addattr32(&req.n, sizeof(req), FRA_FWMARK, fwmark);
+			addattr32(&req->n, sizeof(*req), FRA_FWMARK, fwmark);
 			if (slash) {
 				if (get_u32(&fwmask, slash+1, 0))
 					invarg("fwmask value is invalid\n",
 					       slash+1);
-				addattr32(&req.n, sizeof(req),
+				addattr32(&req->n, sizeof(*req),
 					  FRA_FWMASK, fwmask);
 			}
 		} else if (matches(*argv, "realms") == 0) {
@@ -1054,31 +1084,31 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			NEXT_ARG();
 			if (get_rt_realms_or_raw(&realm, *argv))
 				invarg("invalid realms\n", *argv);
-			addattr32(&req.n, sizeof(req), FRA_FLOW, realm);
+			addattr32(&req->n, sizeof(*req), FRA_FLOW, realm);
 		} else if (matches(*argv, "protocol") == 0) {
 			__u32 proto;
 
 			NEXT_ARG();
 			if (rtnl_rtprot_a2n(&proto, *argv))
 				invarg("\"protocol\" value is invalid\n", *argv);
-			addattr8(&req.n, sizeof(req), FRA_PROTOCOL, proto);
+			addattr8(&req->n, sizeof(*req), FRA_PROTOCOL, proto);
 		} else if (matches(*argv, "tun_id") == 0) {
 			__u64 tun_id;
 
 			NEXT_ARG();
 			if (get_be64(&tun_id, *argv, 0))
 				invarg("\"tun_id\" value is invalid\n", *argv);
-			addattr64(&req.n, sizeof(req), FRA_TUN_ID, tun_id);
+			addattr64(&req->n, sizeof(*req), FRA_TUN_ID, tun_id);
 		} else if (matches(*argv, "table") == 0 ||
 			   strcmp(*argv, "lookup") == 0) {
 			NEXT_ARG();
 			if (rtnl_rttable_a2n(&tid, *argv))
 				invarg("invalid table ID\n", *argv);
 			if (tid < 256)
-				req.frh.table = tid;
+				req->frh.table = tid;
 			else {
-				req.frh.table = RT_TABLE_UNSPEC;
-				addattr32(&req.n, sizeof(req), FRA_TABLE, tid);
+				req->frh.table = RT_TABLE_UNSPEC;
+				addattr32(&req->n, sizeof(*req), FRA_TABLE, tid);
 			}
 			table_ok = 1;
 		} else if (matches(*argv, "suppress_prefixlength") == 0 ||
@@ -1089,7 +1119,7 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			if (get_s32(&pl, *argv, 0) || pl < 0)
 				invarg("suppress_prefixlength value is invalid\n",
 				       *argv);
-			addattr32(&req.n, sizeof(req),
+			addattr32(&req->n, sizeof(*req),
 				  FRA_SUPPRESS_PREFIXLEN, pl);
 		} else if (matches(*argv, "suppress_ifgroup") == 0 ||
 			   strcmp(*argv, "sup_group") == 0) {
@@ -1099,23 +1129,23 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			if (rtnl_group_a2n(&group, *argv))
 				invarg("Invalid \"suppress_ifgroup\" value\n",
 				       *argv);
-			addattr32(&req.n, sizeof(req),
+			addattr32(&req->n, sizeof(*req),
 				  FRA_SUPPRESS_IFGROUP, group);
 		} else if (strcmp(*argv, "dev") == 0 ||
 			   strcmp(*argv, "iif") == 0) {
 			NEXT_ARG();
 			if (check_ifname(*argv))
 				invarg("\"iif\"/\"dev\" not a valid ifname", *argv);
-			addattr_l(&req.n, sizeof(req), FRA_IFNAME,
+			addattr_l(&req->n, sizeof(*req), FRA_IFNAME,
 				  *argv, strlen(*argv)+1);
 		} else if (strcmp(*argv, "oif") == 0) {
 			NEXT_ARG();
 			if (check_ifname(*argv))
 				invarg("\"oif\" not a valid ifname", *argv);
-			addattr_l(&req.n, sizeof(req), FRA_OIFNAME,
+			addattr_l(&req->n, sizeof(*req), FRA_OIFNAME,
 				  *argv, strlen(*argv)+1);
 		} else if (strcmp(*argv, "l3mdev") == 0) {
-			addattr8(&req.n, sizeof(req), FRA_L3MDEV, 1);
+			addattr8(&req->n, sizeof(*req), FRA_L3MDEV, 1);
 			table_ok = 1;
 			l3mdev_rule = 1;
 		} else if (strcmp(*argv, "uidrange") == 0) {
@@ -1124,15 +1154,15 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			NEXT_ARG();
 			if (sscanf(*argv, "%u-%u", &r.start, &r.end) != 2)
 				invarg("invalid UID range\n", *argv);
-			addattr_l(&req.n, sizeof(req), FRA_UID_RANGE, &r,
+			addattr_l(&req->n, sizeof(*req), FRA_UID_RANGE, &r,
 				  sizeof(r));
 		} else if (strcmp(*argv, "nat") == 0 ||
 			   matches(*argv, "map-to") == 0) {
 			NEXT_ARG();
 			fprintf(stderr, "Warning: route NAT is deprecated\n");
-			addattr32(&req.n, sizeof(req), RTA_GATEWAY,
+			addattr32(&req->n, sizeof(*req), RTA_GATEWAY,
 				  get_addr32(*argv));
-			req.frh.action = RTN_NAT;
+			req->frh.action = RTN_NAT;
 		} else if (strcmp(*argv, "ipproto") == 0) {
 			int ipproto;
 
@@ -1141,17 +1171,17 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			if (ipproto < 0)
 				invarg("Invalid \"ipproto\" value\n",
 				       *argv);
-			addattr8(&req.n, sizeof(req), FRA_IP_PROTO, ipproto);
+			addattr8(&req->n, sizeof(*req), FRA_IP_PROTO, ipproto);
 		} else if (strcmp(*argv, "sport") == 0) {
 			struct fib_rule_port_range r;
 			__u16 sport_mask;
 
 			NEXT_ARG();
 			iprule_port_parse(*argv, &r, &sport_mask);
-			addattr_l(&req.n, sizeof(req), FRA_SPORT_RANGE, &r,
+			addattr_l(&req->n, sizeof(*req), FRA_SPORT_RANGE, &r,
 				  sizeof(r));
 			if (sport_mask != PORT_MAX_MASK)
-				addattr16(&req.n, sizeof(req), FRA_SPORT_MASK,
+				addattr16(&req->n, sizeof(*req), FRA_SPORT_MASK,
 					  sport_mask);
 		} else if (strcmp(*argv, "dport") == 0) {
 			struct fib_rule_port_range r;
@@ -1159,19 +1189,19 @@ static int iprule_modify(int cmd, int argc, char **argv)
 
 			NEXT_ARG();
 			iprule_port_parse(*argv, &r, &dport_mask);
-			addattr_l(&req.n, sizeof(req), FRA_DPORT_RANGE, &r,
+			addattr_l(&req->n, sizeof(*req), FRA_DPORT_RANGE, &r,
 				  sizeof(r));
 			if (dport_mask != PORT_MAX_MASK)
-				addattr16(&req.n, sizeof(req), FRA_DPORT_MASK,
+				addattr16(&req->n, sizeof(*req), FRA_DPORT_MASK,
 					  dport_mask);
 		} else if (strcmp(*argv, "dscp") == 0) {
 			__u32 dscp, dscp_mask;
 
 			NEXT_ARG();
 			iprule_dscp_parse(*argv, &dscp, &dscp_mask);
-			addattr8(&req.n, sizeof(req), FRA_DSCP, dscp);
+			addattr8(&req->n, sizeof(*req), FRA_DSCP, dscp);
 			if (dscp_mask != DSCP_MAX_MASK)
-				addattr8(&req.n, sizeof(req), FRA_DSCP_MASK,
+				addattr8(&req->n, sizeof(*req), FRA_DSCP_MASK,
 					 dscp_mask);
 		} else if (strcmp(*argv, "flowlabel") == 0) {
 			__u32 flowlabel, flowlabel_mask;
@@ -1179,9 +1209,9 @@ static int iprule_modify(int cmd, int argc, char **argv)
 			NEXT_ARG();
 			iprule_flowlabel_parse(*argv, &flowlabel,
 					       &flowlabel_mask);
-			addattr32(&req.n, sizeof(req), FRA_FLOWLABEL,
+			addattr32(&req->n, sizeof(*req), FRA_FLOWLABEL,
 				  htonl(flowlabel));
-			addattr32(&req.n, sizeof(req), FRA_FLOWLABEL_MASK,
+			addattr32(&req->n, sizeof(*req), FRA_FLOWLABEL_MASK,
 				  htonl(flowlabel_mask));
 		} else {
 			int type;
@@ -1198,13 +1228,13 @@ static int iprule_modify(int cmd, int argc, char **argv)
 				NEXT_ARG();
 				if (get_u32(&target, *argv, 0))
 					invarg("invalid target\n", *argv);
-				addattr32(&req.n, sizeof(req),
+				addattr32(&req->n, sizeof(*req),
 					  FRA_GOTO, target);
 			} else if (matches(*argv, "nop") == 0)
 				type = FR_ACT_NOP;
 			else if (rtnl_rtntype_a2n(&type, *argv))
 				invarg("Failed to parse rule type", *argv);
-			req.frh.action = type;
+			req->frh.action = type;
 			table_ok = 1;
 		}
 		argc--;
@@ -1217,11 +1247,502 @@ static int iprule_modify(int cmd, int argc, char **argv)
 		return -EINVAL;
 	}
 
-	if (req.frh.family == AF_UNSPEC)
-		req.frh.family = AF_INET;
+	if (req->frh.family == AF_UNSPEC)
+		req->frh.family = AF_INET;
 
 	if (!table_ok && cmd == RTM_NEWRULE)
-		req.frh.table = RT_TABLE_MAIN;
+		req->frh.table = RT_TABLE_MAIN;
+
+	return 0;
+}
+
+/* "add file FILE", "del file FILE" and "sync file FILE" read one rule per
+ * line, written as the arguments of "ip rule add". The whole file is
+ * parsed before anything is sent.
+ *
+ * sync makes the rules of one protocol those of the file: rules are
+ * keyed on everything but their protocol, as normalised by rule_key(),
+ * and hashed so that only the rules missing from the kernel are added
+ * and only those missing from the file are deleted.
+ */
+#define IPRULE_BULK_WINDOW	1024
+#define IPRULE_BULK_MAX_ARGS	64
+#define IPRULE_KEY_MAX		1024
+
+struct iprule_ent {
+	struct iprule_ent	*next;		/* in the hash chain */
+	struct nlmsghdr		*n;
+	char			*key;
+	unsigned int		keylen;
+	__u32			hash;
+	int			lineno;
+	bool			present;
+};
+
+struct iprule_set {
+	struct rtnl_bulk	bulk;
+	struct iprule_ent	**ents;
+	unsigned int		count;
+	unsigned int		size;
+	struct iprule_ent	**hash;
+	unsigned int		hash_mask;
+};
+
+static char *rule_key_put(char *p, const char *end, __u16 type,
+			  const void *data, __u16 len)
+{
+	if (!p || p + 2 * sizeof(__u16) + len > end)
+		return NULL;
+	memcpy(p, &type, sizeof(type));
+	memcpy(p + sizeof(type), &len, sizeof(len));
+	memcpy(p + 2 * sizeof(__u16), data, len);
+	return p + 2 * sizeof(__u16) + len;
+}
+
+/* Serialise the fields of a rule the way the kernel reports them back,
+ * so that a request and the dump of the rule it created compare equal.
+ * The protocol is left out, sync selects the rules by protocol anyway.
+ */
+static int rule_key(const struct nlmsghdr *n, char *key)
+{
+	const struct fib_rule_hdr *frh = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*frh));
+	char *p = key, *end = key + IPRULE_KEY_MAX;
+	struct rtattr *tb[FRA_MAX+1];
+	__u32 table, mark = 0, mask;
+	struct fib_rule_hdr hdr = {
+		.family = frh->family,
+		.dst_len = frh->dst_len,
+		.src_len = frh->src_len,
+		.tos = frh->tos,
+		.action = frh->action,
+		.flags = frh->flags & FIB_RULE_INVERT,
+	};
+	int type;
+
+	if (len < 0)
+		return -1;
+	parse_rtattr(tb, FRA_MAX, RTM_RTA(frh), len);
+
+	table = frh_get_table((struct fib_rule_hdr *)frh, tb);
+	p = rule_key_put(p, end, 0, &hdr, sizeof(hdr));
+	p = rule_key_put(p, end, FRA_TABLE, &table, sizeof(table));
+
+	/* a mark without a mask matches all of its bits */
+	if (tb[FRA_FWMARK])
+		mark = rta_getattr_u32(tb[FRA_FWMARK]);
+	mask = mark ? ~0U : 0;
+	if (tb[FRA_FWMASK])
+		mask = rta_getattr_u32(tb[FRA_FWMASK]);
+	if (mark || mask) {
+		p = rule_key_put(p, end, FRA_FWMARK, &mark, sizeof(mark));
+		p = rule_key_put(p, end, FRA_FWMASK, &mask, sizeof(mask));
+	}
+
+	for (type = 1; type <= FRA_MAX; type++) {
+		const struct rtattr *rta = tb[type];
+
+		if (!rta)
+			continue;
+
+		switch (type) {
+		case FRA_TABLE:
+		case FRA_FWMARK:
+		case FRA_FWMASK:
+		case FRA_PROTOCOL:
+		case FRA_PAD:
+			continue;
+		case FRA_SRC:
+			if (!frh->src_len)
+				continue;
+			break;
+		case FRA_DST:
+			if (!frh->dst_len)
+				continue;
+			break;
+		case FRA_SUPPRESS_PREFIXLEN:
+		case FRA_SUPPRESS_IFGROUP:
+			/* -1 is how the kernel says unset */
+			if (rta_getattr_u32(rta) == ~0U)
+				continue;
+			break;
+		case FRA_SPORT_MASK:
+		case FRA_DPORT_MASK:
+			if (rta_getattr_u16(rta) == PORT_MAX_MASK)
+				continue;
+			break;
+		case FRA_DSCP_MASK:
+			if (rta_getattr_u8(rta) == DSCP_MAX_MASK)
+				continue;
+			break;
+		case FRA_UID_RANGE:
+			if (RTA_PAYLOAD(rta) >= sizeof(struct fib_rule_uid_range) &&
+			    ((struct fib_rule_uid_range *)RTA_DATA(rta))->end == ~0U)
+				continue;
+			break;
+		}
+		p = rule_key_put(p, end, type, RTA_DATA(rta), RTA_PAYLOAD(rta));
+	}
+
+	return p ? p - key : -1;
+}
+
+static __u32 rule_key_hash(const char *key, unsigned int len)
+{
+	__u32 h = 2166136261U;
+
+	while (len--)
+		h = (h ^ (unsigned char)*key++) * 16777619U;
+	return h;
+}
+
+static struct iprule_ent *iprule_ent_new(const struct nlmsghdr *n, int lineno)
+{
+	char key[IPRULE_KEY_MAX];
+	struct iprule_ent *e;
+	int keylen;
+
+	keylen = rule_key(n, key);
+	if (keylen < 0)
+		return NULL;
+
+	e = malloc(sizeof(*e) + NLMSG_ALIGN(n->nlmsg_len) + keylen);
+	if (!e)
+		return NULL;
+	e->next = NULL;
+	e->n = (struct nlmsghdr *)(e + 1);
+	memcpy(e->n, n, n->nlmsg_len);
+	e->key = (char *)e->n + NLMSG_ALIGN(n->nlmsg_len);
+	memcpy(e->key, key, keylen);
+	e->keylen = keylen;
+	e->hash = rule_key_hash(key, keylen);
+	e->lineno = lineno;
+	e->present = false;
+	return e;
+}
+
+static int iprule_set_add(struct iprule_set *set, struct iprule_ent *e)
+{
+	if (set->count == set->size) {
+		unsigned int size = set->size ? set->size * 2 : 256;
+		struct iprule_ent **ents;
+
+		ents = realloc(set->ents, size * sizeof(*ents));
+		if (!ents)
+			return -1;
+		set->ents = ents;
+		set->size = size;
+	}
+	set->ents[set->count++] = e;
+	return 0;
+}
+
+static struct iprule_ent *iprule_set_find(const struct iprule_set *set,
+					  const struct iprule_ent *e)
+{
+	struct iprule_ent *h;
+
+	for (h = set->hash[e->hash & set->hash_mask]; h; h = h->next)
+		if (h->hash == e->hash && h->keylen == e->keylen &&
+		    !memcmp(h->key, e->key, e->keylen))
+			return h;
+	return NULL;
+}
+
+/* Index the rules read so far, dropping those the file repeats */
+static int iprule_set_hash(struct iprule_set *set)
+{
+	unsigned int size = 64, i, j;
+
+	while (size < 2 * set->count)
+		size *= 2;
+	set->hash = calloc(size, sizeof(*set->hash));
+	if (!set->hash)
+		return -1;
+	set->hash_mask = size - 1;
+
+	for (i = j = 0; i < set->count; i++) {
+		struct iprule_ent *e = set->ents[i], *dup;
+
+		dup = iprule_set_find(set, e);
+		if (dup) {
+			fprintf(stderr, "%s:%d: same rule as line %d, ignored\n",
+				set->bulk.file, e->lineno, dup->lineno);
+			free(e);
+			continue;
+		}
+		e->next = set->hash[e->hash & set->hash_mask];
+		set->hash[e->hash & set->hash_mask] = e;
+		set->ents[j++] = e;
+	}
+	set->count = j;
+	return 0;
+}
+
+static void iprule_set_free(struct iprule_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; i++)
+		free(set->ents[i]);
+	free(set->ents);
+	free(set->hash);
+}
+
+/* protocol is that of sync, or -1 */
+static int iprule_set_read(struct iprule_set *set, int cmd, int protocol)
+{
+	int lineno = 0, ret = -1;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(&set->bulk);
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *args[IPRULE_BULK_MAX_ARGS];
+		struct iprule_req req;
+		struct iprule_ent *e;
+		int nargs;
+
+		lineno++;
+		nargs = rtnl_bulk_tokens(line, args, IPRULE_BULK_MAX_ARGS);
+		if (nargs > IPRULE_BULK_MAX_ARGS) {
+			fprintf(stderr, "%s:%d: too many arguments\n",
+				set->bulk.file, lineno);
+			goto out;
+		}
+		if (nargs == 0)
+			continue;
+
+		iprule_req_init(&req, cmd);
+		if (iprule_parse(&req, nargs, args)) {
+			fprintf(stderr, "%s:%d: invalid rule\n",
+				set->bulk.file, lineno);
+			goto out;
+		}
+
+		/* sync: the rules of the file are those of its protocol */
+		if (protocol >= 0) {
+			struct rtattr *tb[FRA_MAX+1];
+
+			parse_rtattr(tb, FRA_MAX, RTM_RTA(&req.frh),
+				     req.n.nlmsg_len -
+				     NLMSG_LENGTH(sizeof(req.frh)));
+			if (!tb[FRA_PRIORITY]) {
+				fprintf(stderr, "%s:%d: \"pref\" is required\n",
+					set->bulk.file, lineno);
+				goto out;
+			}
+			if (tb[FRA_PROTOCOL] &&
+			    rta_getattr_u8(tb[FRA_PROTOCOL]) != protocol) {
+				fprintf(stderr, "%s:%d: \"protocol\" differs from the one synced\n",
+					set->bulk.file, lineno);
+				goto out;
+			}
+			if (!tb[FRA_PROTOCOL] && protocol)
+				addattr8(&req.n, sizeof(req), FRA_PROTOCOL,
+					 protocol);
+			/* known to be missing, skip the kernel's O(n) check */
+			req.n.nlmsg_flags &= ~NLM_F_EXCL;
+		}
+
+		e = iprule_ent_new(&req.n, lineno);
+		if (!e || iprule_set_add(set, e)) {
+			fprintf(stderr, "%s:%d: rule too large\n",
+				set->bulk.file, lineno);
+			free(e);
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	rtnl_bulk_close(fp);
+	free(line);
+	return ret;
+}
+
+static int iprule_set_send(struct iprule_set *set, struct rtnl_flush *f,
+			   struct iprule_ent **ents, unsigned int count,
+			   __u16 type)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (ents[i]->present)
+			continue;
+		f->tag = ents[i]->lineno;
+		if (rtnl_flush_add(f, ents[i]->n, type) < 0)
+			return -1;
+	}
+	return rtnl_flush_commit(f) == -2 ? -1 : 0;
+}
+
+static int iprule_file(int cmd, const char *file)
+{
+	struct iprule_set set = {
+		.bulk.file = file,
+		.bulk.what = "rules",
+		.bulk.window = IPRULE_BULK_WINDOW,
+	};
+	struct rtnl_flush f;
+	int ret = -1;
+
+	if (iprule_set_read(&set, cmd, -1))
+		goto out;
+
+	if (rtnl_bulk_start(&set.bulk, &f) < 0)
+		goto out;
+
+	set.bulk.entries = set.count;
+	if (iprule_set_send(&set, &f, set.ents, set.count, 0) < 0) {
+		perror("Cannot talk to rtnetlink");
+		rtnl_flush_close(&f);
+		goto out;
+	}
+
+	ret = rtnl_bulk_finish(&set.bulk, &f);
+	if (show_stats)
+		printf("%u rules, %.0f rules/s\n", set.count, set.bulk.rate);
+out:
+	iprule_set_free(&set);
+	return ret;
+}
+
+struct iprule_sync {
+	struct iprule_set	*set;
+	struct iprule_set	stale;
+	int			protocol;
+	unsigned int		kept;
+};
+
+static int iprule_sync_rule(struct nlmsghdr *n, void *arg)
+{
+	struct fib_rule_hdr *frh = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*frh));
+	struct iprule_sync *sync = arg;
+	struct iprule_ent *e, *want;
+	struct rtattr *proto;
+
+	if (n->nlmsg_type != RTM_NEWRULE || len < 0)
+		return 0;
+
+	proto = parse_rtattr_one(FRA_PROTOCOL, RTM_RTA(frh), len);
+	if ((proto ? rta_getattr_u8(proto) : 0) != sync->protocol)
+		return 0;
+
+	e = iprule_ent_new(n, 0);
+	if (!e)
+		return -1;
+
+	want = iprule_set_find(sync->set, e);
+	if (want && !want->present) {
+		want->present = true;
+		sync->kept++;
+		free(e);
+		return 0;
+	}
+	/* not in the file, or there twice */
+	if (iprule_set_add(&sync->stale, e)) {
+		free(e);
+		return -1;
+	}
+	return 0;
+}
+
+static int iprule_sync(int argc, char **argv)
+{
+	struct iprule_set set = {
+		.bulk.what = "changes",
+		.bulk.window = IPRULE_BULK_WINDOW,
+	};
+	struct iprule_sync sync = { .set = &set };
+	struct rtnl_flush f;
+	int af = preferred_family;
+	int ret = -1;
+
+	if (af == AF_UNSPEC)
+		af = AF_INET;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			set.bulk.file = *argv;
+		} else if (matches(*argv, "protocol") == 0) {
+			__u32 proto;
+
+			NEXT_ARG();
+			if (rtnl_rtprot_a2n(&proto, *argv) || proto > 255)
+				invarg("\"protocol\" value is invalid\n", *argv);
+			sync.protocol = proto;
+		} else {
+			invarg("unknown", *argv);
+		}
+		argc--; argv++;
+	}
+	if (!set.bulk.file)
+		missarg("file");
+
+	if (iprule_set_read(&set, RTM_NEWRULE, sync.protocol) ||
+	    iprule_set_hash(&set))
+		goto out;
+
+	if (rtnl_ruledump_req(&rth, af) < 0) {
+		perror("Cannot send dump request");
+		goto out;
+	}
+	if (rtnl_dump_filter(&rth, iprule_sync_rule, &sync) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	if (rtnl_bulk_start(&set.bulk, &f) < 0)
+		goto out;
+
+	/* new rules go in before the old ones go away */
+	set.bulk.entries = set.count - sync.kept + sync.stale.count;
+	if (iprule_set_send(&set, &f, set.ents, set.count, 0) < 0 ||
+	    iprule_set_send(&set, &f, sync.stale.ents, sync.stale.count,
+			    RTM_DELRULE) < 0) {
+		perror("Cannot talk to rtnetlink");
+		rtnl_flush_close(&f);
+		goto out;
+	}
+
+	ret = rtnl_bulk_finish(&set.bulk, &f);
+	if (show_stats)
+		printf("%u rules: %u added, %u deleted, %u unchanged\n",
+		       set.count, set.count - sync.kept, sync.stale.count,
+		       sync.kept);
+out:
+	iprule_set_free(&sync.stale);
+	iprule_set_free(&set);
+	return ret;
+}
+static int iprule_modify(int cmd, int argc, char **argv)
+{
+	struct iprule_req req;
+	int ret;
+
+	if (argc == 0) {
+		fprintf(stderr, "\"ip rule %s\" requires arguments.\n",
+			cmd == RTM_NEWRULE ? "add" : "del");
+		return -1;
+	}
+
+	if (strcmp(*argv, "file") == 0) {
+		NEXT_ARG();
+		if (argc > 1)
+			invarg("\"file\" takes no further arguments", argv[1]);
+		return iprule_file(cmd, *argv);
+	}
+
+	iprule_req_init(&req, cmd);
+	ret = iprule_parse(&req, argc, argv);
+	if (ret)
+		return ret;
 
 	if (echo_request)
 		ret = rtnl_echo_talk(&rth, &req.n, json, print_rule);
@@ -1252,6 +1773,8 @@ int do_iprule(int argc, char **argv)
 		return iprule_modify(RTM_DELRULE, argc-1, argv+1);
 	} else if (matches(argv[0], "flush") == 0) {
 		return iprule_list_flush_or_save(argc-1, argv+1, IPRULE_FLUSH);
+	} else if (strcmp(argv[0], "sync") == 0) {
+		return iprule_sync(argc-1, argv+1);
 	} else if (matches(argv[0], "help") == 0)
 		usage();
 
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 
@@ -55,9 +56,12 @@ struct ipstats_stat_enabled_one {
 	struct ipstats_sel sel;
 };
 
+struct ipstats_samples;
+
 struct ipstats_stat_enabled {
 	struct ipstats_stat_enabled_one *enabled;
 	size_t nenabled;
+	struct ipstats_samples *samples;	/* NULL unless "interval" */
 };
 
 static const unsigned int ipstats_stat_ifla_max[] = {
@@ -169,6 +173,24 @@ static int ipstats_show_64(struct ipstats_stat_show_attrs *attrs,
 	return 0;
 }
 
+/* The attribute holding the counters of a leaf, or its @inner nest */
+static struct rtattr *
+ipstats_stat_counters_at(struct ipstats_stat_show_attrs *attrs,
+			 int group, int subgroup, int inner)
+{
+	const struct rtattr *at;
+	const struct rtattr *i;
+
+	at = ipstats_stat_show_get_attr(attrs, group, subgroup, NULL);
+	if (at == NULL || !inner)
+		return (struct rtattr *)at;
+
+	rtattr_for_each_nested(i, at)
+		if (i->rta_type == inner)
+			return (struct rtattr *)i;
+	return NULL;
+}
+
 static void print_hw_stats64(FILE *fp, struct rtnl_hw_stats64 *s)
 {
 	unsigned int cols[] = {
@@ -500,11 +522,20 @@ static int ipstats_stat_desc_show_cpu_hit(struct ipstats_stat_show_attrs *attrs,
 			       IFLA_OFFLOAD_XSTATS_CPU_HIT);
 }
 
+static struct rtattr *
+ipstats_stat_desc_counters_cpu_hit(struct ipstats_stat_show_attrs *attrs,
+				   const struct ipstats_stat_desc *desc)
+{
+	return ipstats_stat_counters_at(attrs, IFLA_STATS_LINK_OFFLOAD_XSTATS,
+					IFLA_OFFLOAD_XSTATS_CPU_HIT, 0);
+}
+
 static const struct ipstats_stat_desc ipstats_stat_desc_offload_cpu_hit = {
 	.name = "cpu_hit",
 	.kind = IPSTATS_STAT_DESC_KIND_LEAF,
 	.pack = &ipstats_stat_desc_pack_cpu_hit,
 	.show = &ipstats_stat_desc_show_cpu_hit,
+	.counters = &ipstats_stat_desc_counters_cpu_hit,
 };
 
 static void
@@ -555,11 +586,20 @@ ipstats_stat_desc_show_l3_stats(struct ipstats_stat_show_attrs *attrs,
 				     IPSTATS_HW_S_INFO_IDX_L3_STATS);
 }
 
+static struct rtattr *
+ipstats_stat_desc_counters_l3_stats(struct ipstats_stat_show_attrs *attrs,
+				    const struct ipstats_stat_desc *desc)
+{
+	return ipstats_stat_counters_at(attrs, IFLA_STATS_LINK_OFFLOAD_XSTATS,
+					IFLA_OFFLOAD_XSTATS_L3_STATS, 0);
+}
+
 static const struct ipstats_stat_desc ipstats_stat_desc_offload_l3_stats = {
 	.name = "l3_stats",
 	.kind = IPSTATS_STAT_DESC_KIND_LEAF,
 	.pack = &ipstats_stat_desc_pack_l3_stats,
 	.show = &ipstats_stat_desc_show_l3_stats,
+	.counters = &ipstats_stat_desc_counters_l3_stats,
 };
 
 static const struct ipstats_stat_desc *ipstats_stat_desc_offload_subs[] = {
@@ -609,6 +649,17 @@ int ipstats_stat_desc_show_xstats(struct ipstats_stat_show_attrs *attrs,
 	return 0;
 }
 
+struct rtattr *
+ipstats_stat_desc_counters_xstats(struct ipstats_stat_show_attrs *attrs,
+				  const struct ipstats_stat_desc *desc)
+{
+	struct ipstats_stat_desc_xstats *xdesc;
+
+	xdesc = container_of(desc, struct ipstats_stat_desc_xstats, desc);
+	return ipstats_stat_counters_at(attrs, xdesc->xstats_at,
+					xdesc->link_type_at, xdesc->inner_at);
+}
+
 static const struct ipstats_stat_desc *ipstats_stat_desc_xstats_subs[] = {
 	&ipstats_stat_desc_xstats_bridge_group,
 	&ipstats_stat_desc_xstats_bond_group,
@@ -649,11 +700,19 @@ ipstats_stat_desc_show_link(struct ipstats_stat_show_attrs *attrs,
 	return ipstats_show_64(attrs, IFLA_STATS_LINK_64, 0);
 }
 
+static struct rtattr *
+ipstats_stat_desc_counters_link(struct ipstats_stat_show_attrs *attrs,
+				const struct ipstats_stat_desc *desc)
+{
+	return ipstats_stat_counters_at(attrs, IFLA_STATS_LINK_64, 0, 0);
+}
+
 static const struct ipstats_stat_desc ipstats_stat_desc_toplev_link = {
 	.name = "link",
 	.kind = IPSTATS_STAT_DESC_KIND_LEAF,
 	.pack = &ipstats_stat_desc_pack_link,
 	.show = &ipstats_stat_desc_show_link,
+	.counters = &ipstats_stat_desc_counters_link,
 };
 
 static const struct ipstats_stat_desc ipstats_stat_desc_afstats_group;
@@ -692,11 +751,20 @@ ipstats_stat_desc_show_afstats_mpls(struct ipstats_stat_show_attrs *attrs,
 	return 0;
 }
 
+static struct rtattr *
+ipstats_stat_desc_counters_afstats_mpls(struct ipstats_stat_show_attrs *attrs,
+					const struct ipstats_stat_desc *desc)
+{
+	return ipstats_stat_counters_at(attrs, IFLA_STATS_AF_SPEC, AF_MPLS,
+					MPLS_STATS_LINK);
+}
+
 static const struct ipstats_stat_desc ipstats_stat_desc_afstats_mpls = {
 	.name = "mpls",
 	.kind = IPSTATS_STAT_DESC_KIND_LEAF,
 	.pack = &ipstats_stat_desc_pack_afstats,
 	.show = &ipstats_stat_desc_show_afstats_mpls,
+	.counters = &ipstats_stat_desc_counters_afstats_mpls,
 };
 
 static const struct ipstats_stat_desc *ipstats_stat_desc_afstats_subs[] = {
@@ -828,6 +896,186 @@ ipstats_req_add_filters(struct ipstats_req *req, void *data)
 	return 0;
 }
 
+/*
+ * "ip stats show interval": the counters of every enabled leaf are kept
+ * per (ifindex, leaf) from one dump to the next, and the counters of the
+ * new dump are replaced in place by what they grew by, so the leaves show
+ * deltas without knowing. Leaves that are not counters show as they are.
+ */
+struct ipstats_sample {
+	void *data;
+	size_t len;
+	size_t size;
+};
+
+struct ipstats_samples {
+	struct ipstats_sample *samples;	/* [ifindex * nenabled + leaf] */
+	bool *seen;			/* by ifindex */
+	int nifindex;
+	void *scratch;
+	size_t scratch_size;
+};
+
+static int ipstats_buf_reserve(void **buf, size_t *size, size_t len)
+{
+	void *p;
+
+	if (len <= *size)
+		return 0;
+	p = realloc(*buf, len);
+	if (p == NULL)
+		return -ENOMEM;
+	*buf = p;
+	*size = len;
+	return 0;
+}
+
+static int ipstats_samples_reserve(struct ipstats_samples *smp,
+				   size_t nenabled, int ifindex)
+{
+	struct ipstats_sample *samples;
+	int n = smp->nifindex;
+	bool *seen;
+
+	if (ifindex < n)
+		return 0;
+	n = MAX(2 * n, ifindex + 1);
+
+	samples = realloc(smp->samples, n * nenabled * sizeof(*samples));
+	if (samples == NULL)
+		return -ENOMEM;
+	smp->samples = samples;
+	memset(samples + smp->nifindex * nenabled, 0,
+	       (n - smp->nifindex) * nenabled * sizeof(*samples));
+
+	seen = realloc(smp->seen, n * sizeof(*seen));
+	if (seen == NULL)
+		return -ENOMEM;
+	smp->seen = seen;
+	memset(seen + smp->nifindex, 0, (n - smp->nifindex) * sizeof(*seen));
+
+	smp->nifindex = n;
+	return 0;
+}
+
+/* A counter that went back, e.g. when a driver reset it, counts from 0 */
+static void ipstats_delta_u64(void *cur, const void *prev)
+{
+	__u64 c, p;
+
+	memcpy(&c, cur, sizeof(c));
+	memcpy(&p, prev, sizeof(p));
+	c = c >= p ? c - p : c;
+	memcpy(cur, &c, sizeof(c));
+}
+
+static void ipstats_delta(struct rtattr *at, const struct ipstats_sample *prev,
+			  enum ipstats_stat_desc_counters layout)
+{
+	size_t len = RTA_PAYLOAD(at);
+	const struct rtattr *j;
+	struct rtattr *i;
+	int rem;
+	size_t k;
+
+	switch (layout) {
+	case IPSTATS_COUNTERS_U64:
+		for (k = 0; k + sizeof(__u64) <= MIN(len, prev->len);
+		     k += sizeof(__u64))
+			ipstats_delta_u64(RTA_DATA(at) + k, prev->data + k);
+		break;
+	case IPSTATS_COUNTERS_NEST_U64:
+		rtattr_for_each_nested(i, at) {
+			if (RTA_PAYLOAD(i) != sizeof(__u64))
+				continue;
+			j = prev->data;
+			for (rem = prev->len; RTA_OK(j, rem);
+			     j = RTA_NEXT(j, rem)) {
+				if (j->rta_type == i->rta_type &&
+				    RTA_PAYLOAD(j) == sizeof(__u64)) {
+					ipstats_delta_u64(RTA_DATA(i),
+							  RTA_DATA(j));
+					break;
+				}
+			}
+		}
+		break;
+	}
+}
+
+/*
+ * Turn the counters in @n into deltas from the previous sample of its
+ * ifindex and keep the new ones. Returns 1 if there was a previous
+ * sample, 0 if this one is only kept, or a negative error.
+ */
+static int ipstats_samples_update(struct ipstats_stat_enabled *enabled,
+				  struct nlmsghdr *n)
+{
+	struct ipstats_stat_show_attrs attrs = {};
+	struct ipstats_samples *smp = enabled->samples;
+	struct ipstats_sample *sample;
+	bool seen;
+	int err;
+	int i;
+
+	attrs.ifsm = NLMSG_DATA(n);
+	attrs.len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*attrs.ifsm));
+	if (attrs.len < 0 || attrs.ifsm->ifindex <= 0)
+		return -EINVAL;
+
+	err = ipstats_samples_reserve(smp, enabled->nenabled,
+				      attrs.ifsm->ifindex);
+	if (err)
+		return err;
+	err = ipstats_stat_show_attrs_alloc_tb(&attrs, 0);
+	if (err)
+		return err;
+
+	seen = smp->seen[attrs.ifsm->ifindex];
+	sample = &smp->samples[attrs.ifsm->ifindex * enabled->nenabled];
+	for (i = 0; i < enabled->nenabled; i++, sample++) {
+		const struct ipstats_stat_desc *desc = enabled->enabled[i].desc;
+		struct rtattr *at;
+		size_t len;
+
+		if (desc->counters == NULL)
+			continue;
+		at = desc->counters(&attrs, desc);
+		if (at == NULL)
+			continue;
+
+		len = RTA_PAYLOAD(at);
+		err = ipstats_buf_reserve(&smp->scratch, &smp->scratch_size,
+					  len) ?:
+		      ipstats_buf_reserve(&sample->data, &sample->size, len);
+		if (err)
+			goto out;
+
+		memcpy(smp->scratch, RTA_DATA(at), len);
+		if (seen)
+			ipstats_delta(at, sample, desc->counters_layout);
+		memcpy(sample->data, smp->scratch, len);
+		sample->len = len;
+	}
+	smp->seen[attrs.ifsm->ifindex] = true;
+	err = seen;
+
+out:
+	ipstats_stat_show_attrs_free(&attrs);
+	return err;
+}
+
+static void ipstats_samples_free(struct ipstats_samples *smp, size_t nenabled)
+{
+	size_t i;
+
+	for (i = 0; i < smp->nifindex * nenabled; i++)
+		free(smp->samples[i].data);
+	free(smp->samples);
+	free(smp->seen);
+	free(smp->scratch);
+}
+
 static int
 ipstats_show_one(int ifindex, struct ipstats_stat_enabled *enabled)
 {
@@ -844,7 +1092,10 @@ ipstats_show_one(int ifindex, struct ipstats_stat_enabled *enabled)
 	ipstats_req_add_filters(&req, enabled);
 	if (rtnl_talk(&rth, &req.nlh, &answer) < 0)
 		return -2;
-	err = ipstats_process_ifsm(stdout, answer, enabled);
+	if (enabled->samples)
+		err = ipstats_samples_update(enabled, answer);
+	if (err >= 0 && (!enabled->samples || err))
+		err = ipstats_process_ifsm(stdout, answer, enabled);
 	free(answer);
 
 	return err;
@@ -855,6 +1106,12 @@ static int ipstats_dump_one(struct nlmsghdr *n, void *arg)
 	struct ipstats_stat_enabled *enabled = arg;
 	int rc;
 
+	if (enabled->samples) {
+		rc = ipstats_samples_update(enabled, n);
+		if (rc <= 0)
+			return rc;
+	}
+
 	rc = ipstats_process_ifsm(stdout, n, enabled);
 	if (rc)
 		return rc;
@@ -898,6 +1155,30 @@ ipstats_show_do(int ifindex, struct ipstats_stat_enabled *enabled)
 	return rc;
 }
 
+static int ipstats_show_interval(int ifindex, struct ipstats_stat_enabled *enabled,
+				 unsigned int interval)
+{
+	struct ipstats_samples samples = {};
+	double next = monotonic_now();
+	int rc;
+
+	enabled->samples = &samples;
+
+	/* the first dump only gives the counters to start from */
+	rc = ifindex ? ipstats_show_one(ifindex, enabled)
+		     : ipstats_dump(enabled);
+	while (rc == 0) {
+		next += interval;
+		monotonic_sleep_until(next);
+		rc = ipstats_show_do(ifindex, enabled);
+		fflush(stdout);
+	}
+
+	ipstats_samples_free(&samples, enabled->nenabled);
+	enabled->samples = NULL;
+	return rc;
+}
+
 static int ipstats_add_enabled(struct ipstats_stat_enabled_one ens[],
 			       size_t nens,
 			       struct ipstats_stat_enabled *enabled)
@@ -1093,6 +1374,7 @@ static int do_help(void)
 	fprintf(stderr,
 		"Usage: ip stats help\n"
 		"       ip stats show [ dev DEV ] [ group GROUP [ subgroup SUBGROUP [ suite SUITE ] ... ] ... ] ...\n"
+		"                     [ interval SECS ]\n"
 		"       ip stats set dev DEV l3_stats { on | off }\n"
 		);
 
@@ -1175,6 +1457,7 @@ static int ipstats_show(int argc, char **argv)
 {
 	struct ipstats_stat_enabled enabled = {};
 	struct ipstats_sel sel = {};
+	unsigned int interval = 0;
 	const char *dev = NULL;
 	int ifindex;
 	int err;
@@ -1188,6 +1471,12 @@ static int ipstats_show(int argc, char **argv)
 			if (check_ifname(*argv))
 				invarg("\"dev\" not a valid ifname", *argv);
 			dev = *argv;
+		} else if (strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (interval)
+				duparg("interval", *argv);
+			if (get_unsigned(&interval, *argv, 0) || !interval)
+				invarg("\"interval\" value is invalid", *argv);
 		} else if (strcmp(*argv, "help") == 0) {
 			do_help();
 			return 0;
@@ -1232,8 +1521,10 @@ static int ipstats_show(int argc, char **argv)
 		ifindex = 0;
 	}
 
-
-	err = ipstats_show_do(ifindex, &enabled);
+	if (interval)
+		err = ipstats_show_interval(ifindex, &enabled, interval);
+	else
+		err = ipstats_show_do(ifindex, &enabled);
 
 err:
 	ipstats_enabled_free(&enabled);
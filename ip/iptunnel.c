@@ -14,6 +14,7 @@
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <linux/if_link.h>
 #include <net/if_arp.h>
 #include <linux/ip.h>
 #include <linux/if_tunnel.h>
@@ -36,6 +37,7 @@ static void usage(void)
 		"        [ prl-default ADDR ] [ prl-nodefault ADDR ] [ prl-delete ADDR ]\n"
 		"        [ 6rd-prefix ADDR ] [ 6rd-relay_prefix ADDR ] [ 6rd-reset ]\n"
 		"        [ ttl TTL ] [ tos TOS ] [ [no]pmtudisc ] [ dev PHYS_DEV ]\n"
+		"       ip -s tunnel show [ NAME ] [ interval SECS ]\n"
 		"\n"
 		"Where: NAME := STRING\n"
 		"       ADDR := { IP_ADDRESS | any }\n"
@@ -291,10 +293,18 @@ static int do_del(int argc, char **argv)
 	return tnl_del_ioctl(tnl_defname(&p) ? : p.name, p.name, &p);
 }
 
+/* What "show" prints: the parameters and, for sit, the 6rd ones */
+struct ip_tunnel_show {
+	struct ip_tunnel_parm	p;	/* first, for tnl_get_ioctl() */
+	struct ip_tunnel_6rd	ip6rd;
+	bool			have_6rd;
+};
+
 static void print_tunnel(const void *t)
 {
-	const struct ip_tunnel_parm *p = t;
-	struct ip_tunnel_6rd ip6rd = {};
+	const struct ip_tunnel_show *ts = t;
+	const struct ip_tunnel_parm *p = &ts->p;
+	struct ip_tunnel_6rd ip6rd = ts->ip6rd;
 	SPRINT_BUF(b1);
 
 	/* Do not use format_host() for local addr,
@@ -369,7 +379,9 @@ static void print_tunnel(const void *t)
 	if (!(p->iph.frag_off & htons(IP_DF)))
 		print_null(PRINT_ANY, "nopmtudisc", " nopmtudisc", NULL);
 
-	if (p->iph.protocol == IPPROTO_IPV6 && !tnl_ioctl_get_6rd(p->name, &ip6rd) && ip6rd.prefixlen) {
+	if (p->iph.protocol == IPPROTO_IPV6 &&
+	    (ts->have_6rd || !tnl_ioctl_get_6rd(p->name, &ip6rd)) &&
+	    ip6rd.prefixlen) {
 		print_string(PRINT_ANY, "6rd-prefix", " 6rd-prefix %s",
 			     inet_ntop(AF_INET6, &ip6rd.prefix, b1, sizeof(b1)));
 		print_uint(PRINT_ANY, "6rd-prefixlen", "/%u", ip6rd.prefixlen);
@@ -391,15 +403,102 @@ static void print_tunnel(const void *t)
 
 static void ip_tunnel_parm_initialize(const struct tnl_print_nlmsg_info *info)
 {
-	struct ip_tunnel_parm *p2 = info->p2;
+	struct ip_tunnel_show *ts = info->p2;
 
-	memset(p2, 0, sizeof(*p2));
+	memset(ts, 0, sizeof(*ts));
+}
+
+/*
+ * The link dump carries what SIOCGETTUNNEL returns for ipip, sit and
+ * gre, in the form the ioctl has it. Other kinds, e.g. vti, keep using
+ * the ioctl.
+ */
+static bool ip_tunnel_parm_parse(const struct tnl_print_nlmsg_info *info,
+				 const char *name, const char *kind,
+				 struct rtattr *data)
+{
+	struct ip_tunnel_show *ts = info->p2;
+	struct ip_tunnel_parm *p = &ts->p;
+	struct rtattr *tb[MAX(IFLA_GRE_MAX, IFLA_IPTUN_MAX) + 1];
+	bool pmtudisc;
+
+	if (!data)
+		return false;
+
+	if (strcmp(kind, "gre") == 0) {
+		parse_rtattr_nested(tb, IFLA_GRE_MAX, data);
+		p->iph.protocol = IPPROTO_GRE;
+		if (tb[IFLA_GRE_LINK])
+			p->link = rta_getattr_u32(tb[IFLA_GRE_LINK]);
+		if (tb[IFLA_GRE_IFLAGS])
+			p->i_flags = rta_getattr_u16(tb[IFLA_GRE_IFLAGS]);
+		if (tb[IFLA_GRE_OFLAGS])
+			p->o_flags = rta_getattr_u16(tb[IFLA_GRE_OFLAGS]);
+		if (tb[IFLA_GRE_IKEY])
+			p->i_key = rta_getattr_u32(tb[IFLA_GRE_IKEY]);
+		if (tb[IFLA_GRE_OKEY])
+			p->o_key = rta_getattr_u32(tb[IFLA_GRE_OKEY]);
+		if (tb[IFLA_GRE_LOCAL])
+			p->iph.saddr = rta_getattr_u32(tb[IFLA_GRE_LOCAL]);
+		if (tb[IFLA_GRE_REMOTE])
+			p->iph.daddr = rta_getattr_u32(tb[IFLA_GRE_REMOTE]);
+		if (tb[IFLA_GRE_TTL])
+			p->iph.ttl = rta_getattr_u8(tb[IFLA_GRE_TTL]);
+		if (tb[IFLA_GRE_TOS])
+			p->iph.tos = rta_getattr_u8(tb[IFLA_GRE_TOS]);
+		pmtudisc = tb[IFLA_GRE_PMTUDISC] &&
+			   rta_getattr_u8(tb[IFLA_GRE_PMTUDISC]);
+	} else if (strcmp(kind, "ipip") == 0 || strcmp(kind, "sit") == 0) {
+		parse_rtattr_nested(tb, IFLA_IPTUN_MAX, data);
+		if (tb[IFLA_IPTUN_PROTO])
+			p->iph.protocol = rta_getattr_u8(tb[IFLA_IPTUN_PROTO]);
+		if (tb[IFLA_IPTUN_LINK])
+			p->link = rta_getattr_u32(tb[IFLA_IPTUN_LINK]);
+		if (tb[IFLA_IPTUN_FLAGS])
+			p->i_flags = rta_getattr_u16(tb[IFLA_IPTUN_FLAGS]);
+		if (tb[IFLA_IPTUN_LOCAL])
+			p->iph.saddr = rta_getattr_u32(tb[IFLA_IPTUN_LOCAL]);
+		if (tb[IFLA_IPTUN_REMOTE])
+			p->iph.daddr = rta_getattr_u32(tb[IFLA_IPTUN_REMOTE]);
+		if (tb[IFLA_IPTUN_TTL])
+			p->iph.ttl = rta_getattr_u8(tb[IFLA_IPTUN_TTL]);
+		if (tb[IFLA_IPTUN_TOS])
+			p->iph.tos = rta_getattr_u8(tb[IFLA_IPTUN_TOS]);
+		pmtudisc = tb[IFLA_IPTUN_PMTUDISC] &&
+			   rta_getattr_u8(tb[IFLA_IPTUN_PMTUDISC]);
+
+		/* kernels without 6rd support leave these out */
+		if (tb[IFLA_IPTUN_6RD_PREFIX] && tb[IFLA_IPTUN_6RD_PREFIXLEN]) {
+			memcpy(&ts->ip6rd.prefix,
+			       RTA_DATA(tb[IFLA_IPTUN_6RD_PREFIX]),
+			       sizeof(ts->ip6rd.prefix));
+			ts->ip6rd.prefixlen =
+				rta_getattr_u16(tb[IFLA_IPTUN_6RD_PREFIXLEN]);
+			if (tb[IFLA_IPTUN_6RD_RELAY_PREFIX])
+				ts->ip6rd.relay_prefix =
+					rta_getattr_u32(tb[IFLA_IPTUN_6RD_RELAY_PREFIX]);
+			if (tb[IFLA_IPTUN_6RD_RELAY_PREFIXLEN])
+				ts->ip6rd.relay_prefixlen =
+					rta_getattr_u16(tb[IFLA_IPTUN_6RD_RELAY_PREFIXLEN]);
+			ts->have_6rd = true;
+		}
+	} else {
+		return false;
+	}
+
+	strlcpy(p->name, name, sizeof(p->name));
+	p->iph.version = 4;
+	p->iph.ihl = 5;
+	if (pmtudisc)
+		p->iph.frag_off = htons(IP_DF);
+	return true;
 }
 
 static bool ip_tunnel_parm_match(const struct tnl_print_nlmsg_info *info)
 {
 	const struct ip_tunnel_parm *p1 = info->p1;
-	const struct ip_tunnel_parm *p2 = info->p2;
+	const struct ip_tunnel_show *ts = info->p2;
+	const struct ip_tunnel_parm *p2 = &ts->p;
 
 	return ((!p1->link || p1->link == p2->link) &&
 		(!p1->name[0] || strcmp(p1->name, p2->name) == 0) &&
@@ -410,29 +509,37 @@ static bool ip_tunnel_parm_match(const struct tnl_print_nlmsg_info *info)
 
 static int do_show(int argc, char **argv)
 {
-	struct ip_tunnel_parm p, p1;
+	struct ip_tunnel_show ts = {};
+	struct ip_tunnel_parm p;
+	unsigned int interval = 0;
 	const char *basedev;
 
+	if (show_stats)
+		interval = tnl_parse_interval(&argc, argv);
+
 	if (parse_args(argc, argv, SIOCGETTUNNEL, &p) < 0)
 		return -1;
 
 	basedev = tnl_defname(&p);
-	if (!basedev) {
+	if (!basedev || interval) {
 		struct tnl_print_nlmsg_info info = {
 			.p1    = &p,
-			.p2    = &p1,
+			.p2    = &ts,
 			.init  = ip_tunnel_parm_initialize,
+			.parse = ip_tunnel_parm_parse,
 			.match = ip_tunnel_parm_match,
 			.print = print_tunnel,
 		};
 
+		if (interval)
+			return do_tunnels_rates(&info, interval);
 		return do_tunnels_list(&info);
 	}
 
-	if (tnl_get_ioctl(p.name[0] ? p.name : basedev, &p))
+	if (tnl_get_ioctl(p.name[0] ? p.name : basedev, &ts.p))
 		return -1;
 
-	print_tunnel(&p);
+	print_tunnel(&ts);
 	fputc('\n', stdout);
 	return 0;
 }
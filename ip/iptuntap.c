@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <sys/ioctl.h>
 #include <linux/if.h>
@@ -39,13 +40,57 @@ static void usage(void)
 		"Usage: ip tuntap { add | del | show | list | lst | help } [ dev PHYS_DEV ]\n"
 		"       [ mode { tun | tap } ] [ user USER ] [ group GROUP ]\n"
 		"       [ one_queue ] [ pi ] [ vnet_hdr ] [ multi_queue ] [ name NAME ]\n"
+		"       ip tuntap add ... [ count COUNT ] [ queues QUEUES fd-socket PATH ]\n"
 		"\n"
 		"Where: USER  := { STRING | NUMBER }\n"
 		"       GROUP := { STRING | NUMBER }\n");
 	exit(-1);
 }
 
-static int tap_add_ioctl(struct ifreq *ifr, uid_t uid, gid_t gid)
+/* The kernel's SCM_MAX_FD */
+#define TAP_MAX_QUEUES	253
+
+struct tap_bulk {
+	unsigned int count;
+	unsigned int queues;
+	const char *fd_socket;
+};
+
+/* Attach queues 1 and on of the device @fds[0] was made for */
+static int tap_open_queues(struct ifreq *ifr, int *fds, unsigned int nfds)
+{
+	struct ifreq qifr = *ifr;
+	unsigned int i;
+
+#ifdef IFF_TUN_EXCL
+	qifr.ifr_flags &= ~IFF_TUN_EXCL;
+#endif
+	for (i = 1; i < nfds; i++) {
+		fds[i] = open(TUNDEV, O_RDWR);
+		if (fds[i] < 0) {
+			perror("open");
+			goto err;
+		}
+		if (ioctl(fds[i], TUNSETIFF, &qifr)) {
+			perror("ioctl(TUNSETIFF)");
+			close(fds[i]);
+			goto err;
+		}
+	}
+	return 0;
+
+err:
+	while (--i > 0)
+		close(fds[i]);
+	return -1;
+}
+
+/*
+ * Create the persistent device of @ifr, whose ifr_name is then the name
+ * it got. If @fds is given, its @nfds queues are left open there.
+ */
+static int tap_add_ioctl(struct ifreq *ifr, uid_t uid, gid_t gid,
+			 int *fds, unsigned int nfds)
 {
 	int fd;
 	int ret = -1;
@@ -75,12 +120,79 @@ static int tap_add_ioctl(struct ifreq *ifr, uid_t uid, gid_t gid)
 		perror("ioctl(TUNSETPERSIST)");
 		goto out;
 	}
+	if (fds) {
+		fds[0] = fd;
+		if (tap_open_queues(ifr, fds, nfds) == 0)
+			return 0;
+		ioctl(fd, TUNSETPERSIST, 0);
+		goto out;
+	}
 	ret = 0;
  out:
 	close(fd);
 	return ret;
 }
 
+/* Hand the queues of a device to whoever listens on the fd socket: one
+ * message per device with its name as data and the fds as SCM_RIGHTS.
+ */
+static int tap_send_fds(int sock, const char *name, const int *fds,
+			unsigned int nfds)
+{
+	char cbuf[CMSG_SPACE(sizeof(int) * TAP_MAX_QUEUES)] = {};
+	char data[IFNAMSIZ] = {};
+	struct iovec iov = {
+		.iov_base = data,
+		.iov_len = sizeof(data),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = CMSG_SPACE(sizeof(int) * nfds),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+	memcpy(data, name, strnlen(name, sizeof(data) - 1));
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+	if (sendmsg(sock, &msg, 0) != sizeof(data)) {
+		perror("sendmsg");
+		return -1;
+	}
+	return 0;
+}
+
+static int tap_connect_fd_socket(const char *path)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int type[] = { SOCK_SEQPACKET, SOCK_STREAM };
+	int i, sock;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "\"fd-socket\" path is too long\n");
+		return -1;
+	}
+	strcpy(sun.sun_path, path);
+
+	for (i = 0; i < ARRAY_SIZE(type); i++) {
+		sock = socket(AF_UNIX, type[i] | SOCK_CLOEXEC, 0);
+		if (sock < 0)
+			break;
+		if (connect(sock, (struct sockaddr *)&sun, sizeof(sun)) == 0)
+			return sock;
+		close(sock);
+		if (errno != EPROTOTYPE)
+			break;
+	}
+	fprintf(stderr, "Cannot connect to \"%s\": %s\n", path,
+		strerror(errno));
+	return -1;
+}
+
 static int tap_del_ioctl(struct ifreq *ifr)
 {
 	int fd = open(TUNDEV, O_RDWR);
@@ -105,7 +217,8 @@ static int tap_del_ioctl(struct ifreq *ifr)
 
 }
 static int parse_args(int argc, char **argv,
-		      struct ifreq *ifr, uid_t *uid, gid_t *gid)
+		      struct ifreq *ifr, uid_t *uid, gid_t *gid,
+		      struct tap_bulk *bulk)
 {
 	memset(ifr, 0, sizeof(*ifr));
 
@@ -175,6 +288,19 @@ static int parse_args(int argc, char **argv,
 			NEXT_ARG();
 			if (get_ifname(ifr->ifr_name, *argv))
 				invarg("\"dev\" not a valid ifname", *argv);
+		} else if (bulk && strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&bulk->count, *argv, 0) ||
+			    !bulk->count)
+				invarg("\"count\" value is invalid", *argv);
+		} else if (bulk && strcmp(*argv, "queues") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&bulk->queues, *argv, 0) ||
+			    !bulk->queues || bulk->queues > TAP_MAX_QUEUES)
+				invarg("\"queues\" value is invalid", *argv);
+		} else if (bulk && strcmp(*argv, "fd-socket") == 0) {
+			NEXT_ARG();
+			bulk->fd_socket = *argv;
 		} else {
 			if (matches(*argv, "name") == 0) {
 				NEXT_ARG();
@@ -197,26 +323,92 @@ static int parse_args(int argc, char **argv,
 }
 
 
+/*
+ * Add "count" devices, kernel numbered where the name has a "%d" in it.
+ * With "fd-socket", the "queues" fds of every device go to the process
+ * listening there instead of being closed, so it need not reopen them.
+ */
+static int do_add_bulk(struct ifreq *tmpl, uid_t uid, gid_t gid,
+		       const struct tap_bulk *bulk)
+{
+	unsigned int nfds = bulk->queues ?: 1;
+	int fds[TAP_MAX_QUEUES];
+	int sock = -1;
+	unsigned int i, j;
+	int ret = 0;
+
+	if (bulk->count > 1 && !strstr(tmpl->ifr_name, "%d")) {
+		fprintf(stderr, "\"count\" needs a name with \"%%d\" in it\n");
+		return -1;
+	}
+	if (bulk->queues && !bulk->fd_socket) {
+		fprintf(stderr, "\"queues\" needs \"fd-socket\"\n");
+		return -1;
+	}
+	if (nfds > 1)
+		tmpl->ifr_flags |= IFF_MULTI_QUEUE;
+
+	if (bulk->fd_socket) {
+		sock = tap_connect_fd_socket(bulk->fd_socket);
+		if (sock < 0)
+			return -1;
+	}
+
+	for (i = 0; i < (bulk->count ?: 1); i++) {
+		struct ifreq ifr = *tmpl;
+
+		if (tap_add_ioctl(&ifr, uid, gid,
+				  sock >= 0 ? fds : NULL, nfds)) {
+			ret = -1;
+			break;
+		}
+		if (sock >= 0) {
+			ret = tap_send_fds(sock, ifr.ifr_name, fds, nfds);
+			for (j = 0; j < nfds; j++)
+				close(fds[j]);
+			if (ret)
+				break;
+		}
+		if (bulk->count)
+			printf("%s\n", ifr.ifr_name);
+	}
+
+	if (sock >= 0)
+		close(sock);
+	fflush(stdout);
+	return ret;
+}
+
 static int do_add(int argc, char **argv)
 {
+	struct tap_bulk bulk = {};
 	struct ifreq ifr;
 	uid_t uid = -1;
 	gid_t gid = -1;
+	int ret;
 
-	if (parse_args(argc, argv, &ifr, &uid, &gid) < 0)
+	if (parse_args(argc, argv, &ifr, &uid, &gid, &bulk) < 0)
 		return -1;
 
-	return tap_add_ioctl(&ifr, uid, gid);
+	if (bulk.count || bulk.queues || bulk.fd_socket)
+		ret = do_add_bulk(&ifr, uid, gid, &bulk);
+	else
+		ret = tap_add_ioctl(&ifr, uid, gid, NULL, 0);
+	ll_map_cache_invalidate();
+	return ret;
 }
 
 static int do_del(int argc, char **argv)
 {
 	struct ifreq ifr;
+	int ret;
 
-	if (parse_args(argc, argv, &ifr, NULL, NULL) < 0)
+	if (parse_args(argc, argv, &ifr, NULL, NULL, NULL) < 0)
 		return -1;
 
-	return tap_del_ioctl(&ifr);
+	ret = tap_del_ioctl(&ifr);
+	ll_map_cache_invalidate();
+	return ret;
 }
 
 static void print_flags(long flags)
@@ -357,6 +549,37 @@ static int tuntap_filter_req(struct nlmsghdr *nlh, int reqlen)
 	return 0;
 }
 
+/*
+ * The flags, owner and group of a device from its link info, as they
+ * read in sysfs. one_queue, which does nothing since Linux 3.8, and the
+ * napi flags are not in there.
+ */
+static int tuntap_dissect_info(const struct rtattr *data, long *flags,
+			       long *owner, long *group)
+{
+	struct rtattr *tb[IFLA_TUN_MAX + 1];
+
+	parse_rtattr_nested(tb, IFLA_TUN_MAX, data);
+	if (!tb[IFLA_TUN_TYPE])
+		return -1;
+
+	*flags = rta_getattr_u8(tb[IFLA_TUN_TYPE]) & TUN_TYPE_MASK;
+	if (!tb[IFLA_TUN_PI] || !rta_getattr_u8(tb[IFLA_TUN_PI]))
+		*flags |= IFF_NO_PI;
+	if (tb[IFLA_TUN_VNET_HDR] && rta_getattr_u8(tb[IFLA_TUN_VNET_HDR]))
+		*flags |= IFF_VNET_HDR;
+	if (tb[IFLA_TUN_MULTI_QUEUE] &&
+	    rta_getattr_u8(tb[IFLA_TUN_MULTI_QUEUE]))
+		*flags |= IFF_MULTI_QUEUE;
+	if (tb[IFLA_TUN_PERSIST] && rta_getattr_u8(tb[IFLA_TUN_PERSIST]))
+		*flags |= IFF_PERSIST;
+	if (tb[IFLA_TUN_OWNER])
+		*owner = rta_getattr_u32(tb[IFLA_TUN_OWNER]);
+	if (tb[IFLA_TUN_GROUP])
+		*group = rta_getattr_u32(tb[IFLA_TUN_GROUP]);
+	return 0;
+}
+
 static int print_tuntap(struct nlmsghdr *n, void *arg)
 {
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
@@ -398,12 +621,19 @@ static int print_tuntap(struct nlmsghdr *n, void *arg)
 
 	name = rta_getattr_str(tb[IFLA_IFNAME]);
 
-	if (read_prop(name, "tun_flags", &flags))
-		return 0;
-	if (read_prop(name, "owner", &owner))
-		return 0;
-	if (read_prop(name, "group", &group))
-		return 0;
+	if (linkinfo[IFLA_INFO_DATA]) {
+		if (tuntap_dissect_info(linkinfo[IFLA_INFO_DATA], &flags,
+					&owner, &group))
+			return 0;
+	} else {
+		/* kernels before 4.15 only have them in sysfs */
+		if (read_prop(name, "tun_flags", &flags))
+			return 0;
+		if (read_prop(name, "owner", &owner))
+			return 0;
+		if (read_prop(name, "group", &group))
+			return 0;
+	}
 
 	open_json_object(NULL);
 	print_color_string(PRINT_ANY, COLOR_IFNAME,
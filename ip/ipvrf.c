@@ -239,8 +239,19 @@ out:
 /* load BPF program to set sk_bound_dev_if for sockets */
 static char bpf_log_buf[256*1024];
 
+/* The program of a VRF is named after its ifindex, so a cgroup that has
+ * the right one attached already can be told apart.
+ */
+static void prog_name(char *name, size_t len, int idx)
+{
+	snprintf(name, len, "vrf_%d", idx);
+}
+
 static int prog_load(int idx)
 {
+	char name[BPF_OBJ_NAME_LEN];
+	int fd;
+
 	struct bpf_insn prog[] = {
 		BPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
 		BPF_MOV64_IMM(BPF_REG_3, idx),
@@ -252,11 +263,41 @@ static int prog_load(int idx)
 		BPF_EXIT_INSN(),
 	};
 
+	prog_name(name, sizeof(name), idx);
+	fd = bpf_program_load_name(BPF_PROG_TYPE_CGROUP_SOCK, prog,
+				   sizeof(prog), "GPL", name, bpf_log_buf,
+				   sizeof(bpf_log_buf), false);
+	if (fd >= 0 || (errno != E2BIG && errno != EINVAL))
+		return fd;
+
+	/* no program names before 4.15 */
 	return bpf_program_load(BPF_PROG_TYPE_CGROUP_SOCK, prog, sizeof(prog),
 				"GPL", bpf_log_buf, sizeof(bpf_log_buf),
 				false);
 }
 
+/* Whether the cgroup at @path was set up for the VRF by an earlier exec */
+static bool vrf_cgroup_ready(const char *path, int ifindex)
+{
+	char name[BPF_OBJ_NAME_LEN], want[BPF_OBJ_NAME_LEN];
+	__u32 ids[1], cnt = ARRAY_SIZE(ids);
+	bool ready;
+	int cg_fd;
+
+	cg_fd = open(path, O_DIRECTORY | O_RDONLY);
+	if (cg_fd < 0)
+		return false;
+
+	prog_name(want, sizeof(want), ifindex);
+	ready = bpf_prog_query_fd(cg_fd, BPF_CGROUP_INET_SOCK_CREATE,
+				  ids, &cnt) == 0 && cnt == 1 &&
+		bpf_prog_name_by_id(ids[0], name, sizeof(name)) == 0 &&
+		strcmp(name, want) == 0;
+
+	close(cg_fd);
+	return ready;
+}
+
 static int vrf_configure_cgroup(const char *path, int ifindex)
 {
 	int rc = -1, cg_fd, prog_fd = -1;
@@ -403,13 +444,18 @@ static int vrf_switch(const char *name)
 		goto out;
 	}
 
-	if (make_path(path, 0755)) {
-		fprintf(stderr, "Failed to setup vrf cgroup2 directory\n");
-		goto out;
-	}
+	/* The cgroup and its program stay for the next exec into the VRF,
+	 * which then only needs to join it.
+	 */
+	if (!ifindex || !vrf_cgroup_ready(path, ifindex)) {
+		if (make_path(path, 0755)) {
+			fprintf(stderr, "Failed to setup vrf cgroup2 directory\n");
+			goto out;
+		}
 
-	if (ifindex && vrf_configure_cgroup(path, ifindex))
-		goto out;
+		if (ifindex && vrf_configure_cgroup(path, ifindex))
+			goto out;
+	}
 
 	/*
 	 * write pid to cgroup.procs making process part of cgroup
@@ -620,7 +666,7 @@ static int ipvrf_show(int argc, char **argv)
 	} else
 		rc = 1;
 
-	free_nlmsg_chain(&linfo);
+	nlmsg_chain_free(&linfo);
 
 	return rc;
 }
@@ -16,6 +16,7 @@
 #include <sys/socket.h>
 #include <time.h>
 #include <netdb.h>
+#include <errno.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/udp.h>
@@ -1551,6 +1552,41 @@ int xfrm_lifetime_cfg_parse(struct xfrm_lifetime_cfg *lft,
 	return 0;
 }
 
+/* An address field of a bulk line, all of which must be of one family */
+int xfrm_bulk_addr(xfrm_address_t *addr, __u16 *family, const char *arg)
+{
+	inet_prefix a;
+
+	if (get_addr_1(&a, arg, *family))
+		return -1;
+	memset(addr, 0, sizeof(*addr));
+	memcpy(addr, &a.data, a.bytelen);
+	*family = a.family;
+	return 0;
+}
+
+/*
+ * Have b->parse() turn the fields of each line of b->file into a request
+ * on top of a copy of tmpl, sent on an XFRM socket of its own.
+ */
+#define XFRM_BULK_WINDOW	1024
+
+int xfrm_bulk_load(struct rtnl_bulk *b, const struct nlmsghdr *tmpl,
+		   int maxlen)
+{
+	int ret;
+
+	b->protocol = NETLINK_XFRM;
+	b->window = XFRM_BULK_WINDOW;
+	b->max_fields = XFRM_BULK_FIELDS;
+
+	ret = rtnl_bulk_load(b, tmpl, maxlen);
+	if (show_stats)
+		fprintf(stderr, "%u entries, %.0f entries/s\n", b->entries,
+			b->rate);
+	return ret;
+}
+
 int do_xfrm(int argc, char **argv)
 {
 	memset(&filter, 0, sizeof(filter));
@@ -4,7 +4,7 @@
 
 #include <list.h>
 
-#define NH_CACHE_SIZE		1024
+#define NH_CACHE_SIZE		1024	/* initial, grows with the entries */
 
 struct nha_res_grp {
 	__u16			buckets;
@@ -61,5 +61,6 @@ struct nh_entry {
 void print_cache_nexthop_id(FILE *fp, const char *fp_prefix, const char *jsobj,
 			    __u32 nh_id);
 int print_cache_nexthop(struct nlmsghdr *n, void *arg, bool process_cache);
+void print_nexthop_cache_stats(FILE *fp);
 
 #endif /* __NH_COMMON_H__ */
@@ -13,11 +13,14 @@
 #include <sys/time.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include "version.h"
 
 #include "utils.h"
 #include "libnetlink.h"
+#include "rtnl_ring.h"
 
 static int init_phase = 1;
 
@@ -55,10 +58,35 @@ static int dump_msg2(struct nlmsghdr *n, void *arg)
 	return dump_msg(NULL, n, arg);
 }
 
+/*
+ * With "size", FILE is a ring file of that size preallocated at start
+ * instead of a log that grows for ever, read back with "ip monitor file"
+ * which can seek to a time window in it. "keep" drops the records older
+ * than that many seconds even when there is room left.
+ */
+static int ring_msg(struct rtnl_ctrl_data *ctrl,
+		    struct nlmsghdr *n, void *arg)
+{
+	struct rtnl_ring *ring = arg;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (rtnl_ring_put(ring, &ts, ctrl ? ctrl->nsid : -1, n) < 0)
+		fprintf(stderr, "Message of %u bytes does not fit the ring\n",
+			n->nlmsg_len);
+	return 0;
+}
+
+static int ring_msg2(struct nlmsghdr *n, void *arg)
+{
+	return ring_msg(NULL, n, arg);
+}
+
 static void usage(void)
 {
 	fprintf(stderr,
-		"Usage: rtmon [ OPTIONS ] file FILE [ all | OBJECTS ]\n"
+		"Usage: rtmon [ OPTIONS ] file FILE [ size SIZE [ keep SECS ] ]\n"
+		"             [ all | OBJECTS ]\n"
 		"OPTIONS := { -f[amily] { inet | inet6 | link | help } |\n"
 		"             -4 | -6 | -0 | -V[ersion] }\n"
 		"OBJECTS := [ link ] [ address ] [ route ]\n");
@@ -68,7 +96,7 @@ static void usage(void)
 int
 main(int argc, char **argv)
 {
-	FILE *fp;
+	FILE *fp = NULL;
 	struct rtnl_handle rth;
 	int family = AF_UNSPEC;
 	unsigned int groups = ~0U;
@@ -76,6 +104,9 @@ main(int argc, char **argv)
 	int laddr = 0;
 	int lroute = 0;
 	char *file = NULL;
+	struct rtnl_ring *ring = NULL;
+	__u64 ring_size = 0;
+	unsigned int keep = 0;
 
 	while (argc > 1) {
 		if (matches(argv[1], "-family") == 0) {
@@ -110,6 +141,20 @@ main(int argc, char **argv)
 			if (argc <= 1)
 				missarg("file");
 			file = argv[1];
+		} else if (strcmp(argv[1], "size") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("size");
+			if (get_size64(&ring_size, argv[1]) || !ring_size)
+				invarg("invalid ring size", argv[1]);
+		} else if (strcmp(argv[1], "keep") == 0) {
+			argc--;
+			argv++;
+			if (argc <= 1)
+				missarg("keep");
+			if (get_unsigned(&keep, argv[1], 0) || !keep)
+				invarg("invalid age to keep", argv[1]);
 		} else if (matches(argv[1], "link") == 0) {
 			llink = 1;
 			groups = 0;
@@ -149,12 +194,27 @@ main(int argc, char **argv)
 			groups |= nl_mgrp(RTNLGRP_IPV6_ROUTE);
 	}
 
-	fp = fopen(file, "w");
-	if (fp == NULL) {
-		perror("Cannot fopen");
+	if (keep && !ring_size) {
+		fprintf(stderr, "\"keep\" needs a ring file, see \"size\"\n");
 		exit(-1);
 	}
 
+	if (ring_size) {
+		ring = rtnl_ring_create(file, ring_size, 0);
+		if (ring == NULL) {
+			fprintf(stderr, "Cannot create ring file \"%s\": %s\n",
+				file, strerror(errno));
+			exit(-1);
+		}
+		rtnl_ring_set_max_age(ring, keep);
+	} else {
+		fp = fopen(file, "w");
+		if (fp == NULL) {
+			perror("Cannot fopen");
+			exit(-1);
+		}
+	}
+
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
 
@@ -163,6 +223,16 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (ring) {
+		if (rtnl_dump_filter(&rth, ring_msg2, ring) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			return 1;
+		}
+		if (rtnl_listen(&rth, ring_msg, ring) < 0)
+			exit(2);
+		exit(0);
+	}
+
 	write_stamp(fp);
 
 	if (rtnl_dump_filter(&rth, dump_msg2, fp) < 0) {
@@ -22,6 +22,7 @@
 #include "utils.h"
 #include "ip_common.h"
 #include "libgenl.h"
+#include "list.h"
 
 static void usage(void)
 {
@@ -29,6 +30,7 @@ static void usage(void)
 		"Usage:	ip tcp_metrics/tcpmetrics { COMMAND | help }\n"
 		"	ip tcp_metrics { show | flush } SELECTOR\n"
 		"	ip tcp_metrics delete [ address ] ADDRESS\n"
+		"	ip tcp_metrics analyze SELECTOR [ group4 PLEN ] [ group6 PLEN ]\n"
 		"SELECTOR := [ [ address ] PREFIX ]\n");
 	exit(-1);
 }
@@ -45,6 +47,7 @@ static const double usec_per_sec = 1000000.;
 #define CMD_LIST	0x0001	/* list, lst, show		*/
 #define CMD_DEL		0x0002	/* delete, remove		*/
 #define CMD_FLUSH	0x0004	/* flush			*/
+#define CMD_ANALYZE	0x0008	/* analyze			*/
 
 static const struct {
 	const char *name;
@@ -56,6 +59,7 @@ static const struct {
 	{	"delete",	CMD_DEL		},
 	{	"remove",	CMD_DEL		},
 	{	"flush",	CMD_FLUSH	},
+	{	"analyze",	CMD_ANALYZE	},
 };
 
 static const char *metric_name[TCP_METRIC_MAX + 1] = {
@@ -66,24 +70,240 @@ static const char *metric_name[TCP_METRIC_MAX + 1] = {
 	[TCP_METRIC_REORDERING]		= "reordering",
 };
 
+struct tcpm_analysis;
+
 static struct {
 	int flushed;
-	char *flushb;
-	int flushp;
-	int flushe;
+	struct rtnl_flush *flush;
+	struct tcpm_analysis *analysis;
 	int cmd;
 	inet_prefix daddr;
 	inet_prefix saddr;
 } f;
 
-static int flush_update(void)
+/*
+ * "ip tcp_metrics analyze": entries are folded into per-prefix groups
+ * (/24 and /48 by default) as the dump streams in, only the values the
+ * medians are taken of are kept.
+ */
+#define TCPM_GROUP_HASH		65536
+
+struct tcpm_vals {
+	__u32		*v;
+	unsigned int	n;
+	unsigned int	size;
+};
+
+struct tcpm_group {
+	struct hlist_node	hash;
+	int			family;
+	__u8			addr[16];
+	unsigned int		entries;
+	unsigned long long	syn_drops;
+	struct tcpm_vals	rtt;
+	struct tcpm_vals	cwnd;
+	struct tcpm_vals	drops;
+};
+
+struct tcpm_analysis {
+	struct hlist_head	hash[TCPM_GROUP_HASH];
+	unsigned int		groups;
+	int			plen4;
+	int			plen6;
+};
+
+static int tcpm_vals_add(struct tcpm_vals *vals, __u32 v)
 {
-	if (rtnl_send_check(&grth, f.flushb, f.flushp) < 0) {
-		perror("Failed to send flush request\n");
-		return -1;
+	if (vals->n == vals->size) {
+		unsigned int size = vals->size ? vals->size * 2 : 16;
+		__u32 *nv = realloc(vals->v, size * sizeof(*nv));
+
+		if (!nv)
+			return -1;
+		vals->v = nv;
+		vals->size = size;
+	}
+	vals->v[vals->n++] = v;
+	return 0;
+}
+
+static int tcpm_u32_cmp(const void *a, const void *b)
+{
+	__u32 x = *(const __u32 *)a, y = *(const __u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double tcpm_vals_median(struct tcpm_vals *vals)
+{
+	unsigned int mid = vals->n / 2;
+
+	qsort(vals->v, vals->n, sizeof(*vals->v), tcpm_u32_cmp);
+	if (vals->n & 1)
+		return vals->v[mid];
+	return (vals->v[mid - 1] + (double)vals->v[mid]) / 2;
+}
+
+static struct tcpm_group *tcpm_group_get(struct tcpm_analysis *an,
+					 const inet_prefix *daddr)
+{
+	int plen = daddr->family == AF_INET ? an->plen4 : an->plen6;
+	struct tcpm_group key = { .family = daddr->family };
+	struct hlist_node *pos;
+	struct tcpm_group *g;
+	unsigned int h, i;
+
+	memcpy(key.addr, daddr->data, daddr->bytelen);
+	for (i = plen / 8; i < 16; i++)
+		key.addr[i] = 0;
+	if (plen % 8)
+		key.addr[plen / 8] = ((__u8 *)daddr->data)[plen / 8] &
+				     (0xff << (8 - plen % 8));
+
+	for (h = key.family, i = 0; i < 16; i++)
+		h = h * 31 + key.addr[i];
+	h %= TCPM_GROUP_HASH;
+
+	hlist_for_each(pos, &an->hash[h]) {
+		g = container_of(pos, struct tcpm_group, hash);
+		if (g->family == key.family &&
+		    !memcmp(g->addr, key.addr, sizeof(key.addr)))
+			return g;
 	}
-	f.flushp = 0;
+
+	g = malloc(sizeof(*g));
+	if (!g)
+		return NULL;
+	*g = key;
+	hlist_add_head(&g->hash, &an->hash[h]);
+	an->groups++;
+	return g;
+}
+
+static int tcpm_analyze_add(const inet_prefix *daddr, struct rtattr *attrs[])
+{
+	struct tcpm_group *g = tcpm_group_get(f.analysis, daddr);
+	struct rtattr *a;
+	__u16 drops = 0;
+
+	if (!g)
+		goto oom;
+	g->entries++;
+
+	a = attrs[TCP_METRICS_ATTR_VALS];
+	if (a) {
+		struct rtattr *m[TCP_METRIC_MAX + 1 + 1];
+		__u32 rtt = 0;
+
+		parse_rtattr_nested(m, TCP_METRIC_MAX + 1, a);
+		if (m[TCP_METRIC_RTT_US + 1])
+			rtt = rta_getattr_u32(m[TCP_METRIC_RTT_US + 1]) >> 3;
+		else if (m[TCP_METRIC_RTT + 1])
+			rtt = (rta_getattr_u32(m[TCP_METRIC_RTT + 1]) * 1000UL) >> 3;
+		if (rtt && tcpm_vals_add(&g->rtt, rtt))
+			goto oom;
+		if (m[TCP_METRIC_CWND + 1] &&
+		    tcpm_vals_add(&g->cwnd,
+				  rta_getattr_u32(m[TCP_METRIC_CWND + 1])))
+			goto oom;
+	}
+
+	/* the kernel leaves out the drop count while it is zero */
+	a = attrs[TCP_METRICS_ATTR_FOPEN_SYN_DROPS];
+	if (a)
+		drops = rta_getattr_u16(a);
+	g->syn_drops += drops;
+	if (tcpm_vals_add(&g->drops, drops))
+		goto oom;
 	return 0;
+oom:
+	fprintf(stderr, "Out of memory\n");
+	return -1;
+}
+
+static int tcpm_group_cmp(const void *a, const void *b)
+{
+	const struct tcpm_group *x = *(const struct tcpm_group **)a;
+	const struct tcpm_group *y = *(const struct tcpm_group **)b;
+
+	if (x->family != y->family)
+		return x->family < y->family ? -1 : 1;
+	return memcmp(x->addr, y->addr, sizeof(x->addr));
+}
+
+static void tcpm_analyze_print(struct tcpm_analysis *an)
+{
+	struct tcpm_group **groups;
+	unsigned int i, n = 0;
+
+	groups = calloc(an->groups ? : 1, sizeof(*groups));
+	if (!groups) {
+		fprintf(stderr, "Out of memory\n");
+		return;
+	}
+	for (i = 0; i < TCPM_GROUP_HASH; i++) {
+		struct hlist_node *pos;
+
+		hlist_for_each(pos, &an->hash[i])
+			groups[n++] = container_of(pos, struct tcpm_group,
+						   hash);
+	}
+	qsort(groups, n, sizeof(*groups), tcpm_group_cmp);
+
+	new_json_obj(json);
+	for (i = 0; i < n; i++) {
+		struct tcpm_group *g = groups[i];
+		int bytes = g->family == AF_INET ? 4 : 16;
+		char prefix[INET6_ADDRSTRLEN + 8];
+
+		snprintf(prefix, sizeof(prefix), "%s/%d",
+			 format_host(g->family, bytes, g->addr),
+			 g->family == AF_INET ? an->plen4 : an->plen6);
+
+		open_json_object(NULL);
+		print_color_string(PRINT_ANY, ifa_family_color(g->family),
+				   "prefix", "%s", prefix);
+		print_uint(PRINT_ANY, "entries", " entries %u", g->entries);
+		if (g->rtt.n) {
+			double rtt = tcpm_vals_median(&g->rtt);
+
+			print_float(PRINT_JSON, "rtt_median", NULL,
+				    rtt / usec_per_sec);
+			print_float(PRINT_FP, NULL, " rtt_median %.0fus", rtt);
+		}
+		if (g->cwnd.n)
+			print_float(PRINT_ANY, "cwnd_median",
+				    " cwnd_median %.1f",
+				    tcpm_vals_median(&g->cwnd));
+		print_float(PRINT_ANY, "fopen_syn_drops_median",
+			    " fo_syn_drops_median %.1f",
+			    tcpm_vals_median(&g->drops));
+		print_lluint(PRINT_ANY, "fopen_syn_drops",
+			     " fo_syn_drops %llu", g->syn_drops);
+		print_string(PRINT_FP, NULL, "\n", "");
+		close_json_object();
+	}
+	delete_json_obj();
+	free(groups);
+}
+
+static void tcpm_analyze_free(struct tcpm_analysis *an)
+{
+	struct hlist_node *pos, *n;
+	unsigned int i;
+
+	for (i = 0; i < TCPM_GROUP_HASH; i++) {
+		hlist_for_each_safe(pos, n, &an->hash[i]) {
+			struct tcpm_group *g;
+
+			g = container_of(pos, struct tcpm_group, hash);
+			free(g->rtt.v);
+			free(g->cwnd.v);
+			free(g->drops.v);
+			free(g);
+		}
+	}
+	free(an);
 }
 
 static void print_tcp_metrics(struct rtattr *a)
@@ -228,9 +448,7 @@ static int process_msg(struct nlmsghdr *n, void *arg)
 			return 0;
 	}
 
-	if (f.flushb) {
-		struct nlmsghdr *fn;
-
+	if (f.flush) {
 		TCPM_REQUEST(req2, 128, TCP_METRICS_CMD_DEL, NLM_F_REQUEST);
 
 		addattr_l(&req2.n, sizeof(req2), atype, daddr.data,
@@ -239,19 +457,18 @@ static int process_msg(struct nlmsghdr *n, void *arg)
 			addattr_l(&req2.n, sizeof(req2), stype, saddr.data,
 				  saddr.bytelen);
 
-		if (NLMSG_ALIGN(f.flushp) + req2.n.nlmsg_len > f.flushe) {
-			if (flush_update())
-				return -1;
+		if (rtnl_flush_add(f.flush, &req2.n, 0) < 0) {
+			perror("Failed to send flush request");
+			return -1;
 		}
-		fn = (struct nlmsghdr *) (f.flushb + NLMSG_ALIGN(f.flushp));
-		memcpy(fn, &req2.n, req2.n.nlmsg_len);
-		fn->nlmsg_seq = ++grth.seq;
-		f.flushp = (((char *) fn) + req2.n.nlmsg_len) - f.flushb;
 		f.flushed++;
 		if (show_stats < 2)
 			return 0;
 	}
 
+	if (f.analysis)
+		return tcpm_analyze_add(&daddr, attrs);
+
 	open_json_object(NULL);
 	if (f.cmd & (CMD_DEL | CMD_FLUSH))
 		print_bool(PRINT_ANY, "deleted", "Deleted ", true);
@@ -341,6 +558,7 @@ static int process_msg(struct nlmsghdr *n, void *arg)
 static int tcpm_do_cmd(int cmd, int argc, char **argv)
 {
 	TCPM_REQUEST(req, 1024, TCP_METRICS_CMD_GET, NLM_F_REQUEST);
+	int plen4 = 24, plen6 = 48;
 	struct nlmsghdr *answer;
 	int atype = -1, stype = -1;
 	int ack;
@@ -385,6 +603,16 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 					*argv);
 				return -1;
 			}
+		} else if (cmd == CMD_ANALYZE && strcmp(*argv, "group4") == 0) {
+			NEXT_ARG();
+			if (get_integer(&plen4, *argv, 0) ||
+			    plen4 < 0 || plen4 > 32)
+				invarg("invalid IPv4 group prefix length", *argv);
+		} else if (cmd == CMD_ANALYZE && strcmp(*argv, "group6") == 0) {
+			NEXT_ARG();
+			if (get_integer(&plen6, *argv, 0) ||
+			    plen6 < 0 || plen6 > 128)
+				invarg("invalid IPv6 group prefix length", *argv);
 		} else {
 			char *who = "address";
 
@@ -411,7 +639,6 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 				return -1;
 			}
 		}
-		argc--; argv++;
 	}
 
 	if (cmd == CMD_DEL && atype < 0)
@@ -421,7 +648,10 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 	if (cmd == CMD_FLUSH && atype >= 0)
 		cmd = CMD_DEL;
 
-	/* flush for all addresses ? Single del without address */
+	/*
+	 * flush for all addresses ? Single del without address. The kernel
+	 * has no prefix delete, other flushes delete entry by entry.
+	 */
 	if (cmd == CMD_FLUSH && f.daddr.bitlen <= 0 &&
 	    f.saddr.bitlen <= 0 && preferred_family == AF_UNSPEC) {
 		cmd = CMD_DEL;
@@ -453,12 +683,18 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 
 	f.cmd = cmd;
 	if (cmd & CMD_FLUSH) {
+		struct rtnl_flush fl;
 		int round = 0;
-		char flushb[4096-512];
 
-		f.flushb = flushb;
-		f.flushp = 0;
-		f.flushe = sizeof(flushb);
+		/*
+		 * Deletes go out in windows on their own socket while the
+		 * dump streams in, entries which expired in the meantime
+		 * are not worth a complaint.
+		 */
+		if (rtnl_flush_open_byproto(&fl, 0, NETLINK_GENERIC) < 0)
+			exit(1);
+		fl.ignore_errno = ESRCH;
+		f.flush = &fl;
 
 		for (;;) {
 			req.n.nlmsg_seq = grth.dump = ++grth.seq;
@@ -475,23 +711,38 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 				if (round == 0) {
 					fprintf(stderr, "Nothing to flush.\n");
 				} else if (show_stats)
-					printf("*** Flush is complete after %d round%s ***\n",
-					       round, round > 1 ? "s" : "");
+					printf("*** Flush is complete after %d round%s, %.0f deletes/s ***\n",
+					       round, round > 1 ? "s" : "",
+					       rtnl_flush_rate(&fl));
 				fflush(stdout);
-				return 0;
+				break;
 			}
 			round++;
-			if (flush_update() < 0)
+			if (rtnl_flush_commit(&fl) < 0) {
+				perror("Failed to send flush request");
 				exit(1);
+			}
 			if (show_stats) {
 				printf("\n*** Round %d, deleting %d entries ***\n",
 				       round, f.flushed);
 				fflush(stdout);
 			}
 		}
+		f.flush = NULL;
+		rtnl_flush_close(&fl);
 		return 0;
 	}
 
+	if (cmd == CMD_ANALYZE) {
+		f.analysis = calloc(1, sizeof(*f.analysis));
+		if (!f.analysis) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		f.analysis->plen4 = plen4;
+		f.analysis->plen6 = plen6;
+	}
+
 	if (ack) {
 		if (rtnl_talk(&grth, &req.n, NULL) < 0)
 			return -2;
@@ -503,6 +754,16 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 			exit(1);
 		}
 		free(answer);
+	} else if (f.analysis) {
+		req.n.nlmsg_seq = grth.dump = ++grth.seq;
+		if (rtnl_send(&grth, &req, req.n.nlmsg_len) < 0) {
+			perror("Failed to send dump request");
+			exit(1);
+		}
+		if (rtnl_dump_filter(&grth, process_msg, stdout) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			exit(1);
+		}
 	} else {
 		req.n.nlmsg_seq = grth.dump = ++grth.seq;
 		if (rtnl_send(&grth, &req, req.n.nlmsg_len) < 0) {
@@ -517,6 +778,12 @@ static int tcpm_do_cmd(int cmd, int argc, char **argv)
 		}
 		delete_json_obj();
 	}
+
+	if (f.analysis) {
+		tcpm_analyze_print(f.analysis);
+		tcpm_analyze_free(f.analysis);
+		f.analysis = NULL;
+	}
 	return 0;
 }
 
@@ -10,6 +10,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
@@ -91,6 +93,8 @@ int tnl_add_ioctl(int cmd, const char *basedev, const char *name, void *p)
 	if (err)
 		fprintf(stderr, "add tunnel \"%s\" failed: %s\n", ifr.ifr_name,
 			strerror(errno));
+	else
+		ll_map_cache_invalidate();
 	close(fd);
 	return err;
 }
@@ -118,6 +122,8 @@ int tnl_del_ioctl(const char *basedev, const char *name, void *p)
 	if (err)
 		fprintf(stderr, "delete tunnel \"%s\" failed: %s\n",
 			ifr.ifr_name, strerror(errno));
+	else
+		ll_map_cache_invalidate();
 	close(fd);
 	return err;
 }
@@ -346,18 +352,38 @@ static void tnl_print_stats(const struct rtnl_link_stats64 *s)
 	       s->tx_carrier_errors, s->tx_dropped);
 }
 
-static int print_nlmsg_tunnel(struct nlmsghdr *n, void *arg)
+static bool tnl_parse_linkinfo(const struct tnl_print_nlmsg_info *info,
+			       const char *name, struct rtattr *rta)
+{
+	struct rtattr *linkinfo[IFLA_INFO_MAX + 1];
+
+	parse_rtattr_nested(linkinfo, IFLA_INFO_MAX, rta);
+	if (!linkinfo[IFLA_INFO_KIND])
+		return false;
+
+	return info->parse(info, name,
+			   rta_getattr_str(linkinfo[IFLA_INFO_KIND]),
+			   linkinfo[IFLA_INFO_DATA]);
+}
+
+/*
+ * Fill info->p2 for the tunnel link in @n if it passes the filter and
+ * return its name, NULL otherwise. The parameters come from the
+ * IFLA_INFO_DATA of the dump where info->parse knows the kind, so only
+ * kinds it does not know cost a SIOCGETTUNNEL per device.
+ */
+static const char *tnl_nlmsg_match(struct nlmsghdr *n,
+				   struct tnl_print_nlmsg_info *info,
+				   struct rtattr **tb)
 {
-	struct tnl_print_nlmsg_info *info = arg;
 	struct ifinfomsg *ifi = NLMSG_DATA(n);
-	struct rtattr *tb[IFLA_MAX+1];
 	const char *name, *n1;
 
 	if (n->nlmsg_type != RTM_NEWLINK && n->nlmsg_type != RTM_DELLINK)
-		return 0;
+		return NULL;
 
 	if (n->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
-		return -1;
+		return NULL;
 
 	if (preferred_family == AF_INET) {
 		switch (ifi->ifi_type) {
@@ -366,7 +392,7 @@ static int print_nlmsg_tunnel(struct nlmsghdr *n, void *arg)
 		case ARPHRD_SIT:
 			break;
 		default:
-			return 0;
+			return NULL;
 		}
 	} else {
 		switch (ifi->ifi_type) {
@@ -374,30 +400,43 @@ static int print_nlmsg_tunnel(struct nlmsghdr *n, void *arg)
 		case ARPHRD_IP6GRE:
 			break;
 		default:
-			return 0;
+			return NULL;
 		}
 	}
 
 	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(n));
 
 	if (!tb[IFLA_IFNAME])
-		return 0;
+		return NULL;
 
 	name = rta_getattr_str(tb[IFLA_IFNAME]);
 
 	/* Assume p1->name[IFNAMSIZ] is first field of structure */
 	n1 = info->p1;
 	if (n1[0] && strcmp(n1, name))
-		return 0;
+		return NULL;
 
 	info->ifi = ifi;
 	info->init(info);
 
-	/* TODO: parse netlink attributes */
-	if (tnl_get_ioctl(name, info->p2))
-		return 0;
+	if (!info->parse || !tb[IFLA_LINKINFO] ||
+	    !tnl_parse_linkinfo(info, name, tb[IFLA_LINKINFO])) {
+		if (tnl_get_ioctl(name, info->p2))
+			return NULL;
+	}
 
 	if (!info->match(info))
+		return NULL;
+
+	return name;
+}
+
+static int print_nlmsg_tunnel(struct nlmsghdr *n, void *arg)
+{
+	struct tnl_print_nlmsg_info *info = arg;
+	struct rtattr *tb[IFLA_MAX+1];
+
+	if (!tnl_nlmsg_match(n, info, tb))
 		return 0;
 
 	info->print(info->p2);
@@ -432,3 +471,145 @@ int do_tunnels_list(struct tnl_print_nlmsg_info *info)
 
 	return 0;
 }
+
+/*
+ * "ip -s tunnel show ... interval SECS": print the counters of the
+ * matching tunnels as rates per second, in the layout of -s. The
+ * previous counters are kept in an array by ifindex.
+ */
+struct tnl_rates {
+	struct tnl_print_nlmsg_info	*info;
+	struct rtnl_link_stats64	*prev;
+	bool				*have_prev;
+	unsigned int			nprev;
+	double				secs;
+};
+
+static int tnl_rates_keep(struct tnl_rates *tr, int ifindex,
+			  const struct rtnl_link_stats64 *s)
+{
+	if (ifindex >= tr->nprev) {
+		unsigned int n = MAX(2 * tr->nprev, ifindex + 1);
+
+		tr->prev = realloc(tr->prev, n * sizeof(*tr->prev));
+		tr->have_prev = realloc(tr->have_prev, n);
+		if (!tr->prev || !tr->have_prev)
+			return -1;
+		memset(tr->have_prev + tr->nprev, 0, n - tr->nprev);
+		tr->nprev = n;
+	}
+	tr->prev[ifindex] = *s;
+	tr->have_prev[ifindex] = true;
+	return 0;
+}
+
+static void tnl_print_rates(const char *name, const struct rtnl_link_stats64 *r)
+{
+	open_json_object(NULL);
+	print_color_string(PRINT_ANY, COLOR_IFNAME, "ifname", "%s:", name);
+	if (is_json_context()) {
+		print_u64(PRINT_JSON, "rx_packets", NULL, r->rx_packets);
+		print_u64(PRINT_JSON, "rx_bytes", NULL, r->rx_bytes);
+		print_u64(PRINT_JSON, "rx_errors", NULL, r->rx_errors);
+		print_u64(PRINT_JSON, "rx_csum_errors", NULL, r->rx_frame_errors);
+		print_u64(PRINT_JSON, "rx_out_of_seq", NULL, r->rx_fifo_errors);
+		print_u64(PRINT_JSON, "rx_mcasts", NULL, r->multicast);
+		print_u64(PRINT_JSON, "tx_packets", NULL, r->tx_packets);
+		print_u64(PRINT_JSON, "tx_bytes", NULL, r->tx_bytes);
+		print_u64(PRINT_JSON, "tx_errors", NULL, r->tx_errors);
+		print_u64(PRINT_JSON, "tx_dead_loop", NULL, r->collisions);
+		print_u64(PRINT_JSON, "tx_no_route", NULL, r->tx_carrier_errors);
+		print_u64(PRINT_JSON, "tx_no_bufs", NULL, r->tx_dropped);
+	} else {
+		printf(" per second");
+		tnl_print_stats(r);
+		fputc('\n', stdout);
+	}
+	close_json_object();
+}
+
+static int tnl_rates_nlmsg(struct nlmsghdr *n, void *arg)
+{
+	struct tnl_rates *tr = arg;
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *tb[IFLA_MAX+1];
+	struct rtnl_link_stats64 s, r;
+	const __u64 *cur = (const __u64 *)&s, *prev;
+	__u64 *rate = (__u64 *)&r;
+	const char *name;
+	unsigned int i;
+
+	name = tnl_nlmsg_match(n, tr->info, tb);
+	if (!name || get_rtnl_link_stats_rta(&s, tb) <= 0)
+		return 0;
+
+	if (tr->secs > 0 && ifi->ifi_index < tr->nprev &&
+	    tr->have_prev[ifi->ifi_index]) {
+		/* all counters are __u64; those that went back count from 0 */
+		prev = (const __u64 *)&tr->prev[ifi->ifi_index];
+		for (i = 0; i < sizeof(s) / sizeof(*cur); i++)
+			rate[i] = (cur[i] >= prev[i] ? cur[i] - prev[i] : cur[i]) /
+				  tr->secs + 0.5;
+		tnl_print_rates(name, &r);
+	}
+
+	if (tnl_rates_keep(tr, ifi->ifi_index, &s)) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Take "interval SECS" out of the arguments of "show", 0 if not there */
+unsigned int tnl_parse_interval(int *argc, char **argv)
+{
+	unsigned int interval = 0;
+	int i;
+
+	for (i = 0; i + 1 < *argc; i++) {
+		if (strcmp(argv[i], "interval"))
+			continue;
+		if (get_unsigned(&interval, argv[i + 1], 0) || !interval)
+			invarg("\"interval\" value is invalid\n", argv[i + 1]);
+		memmove(&argv[i], &argv[i + 2], (*argc - i - 2) * sizeof(*argv));
+		*argc -= 2;
+		break;
+	}
+	return interval;
+}
+
+int do_tunnels_rates(struct tnl_print_nlmsg_info *info, unsigned int interval)
+{
+	struct tnl_rates tr = { .info = info };
+	double next, now, last = 0;
+	int ret = -1;
+
+	next = monotonic_now();
+	for (;;) {
+		now = monotonic_now();
+		if (last)
+			tr.secs = now - last;
+		last = now;
+
+		if (rtnl_linkdump_req(&rth, preferred_family) < 0) {
+			perror("Cannot send dump request");
+			break;
+		}
+		new_json_obj(json);
+		if (rtnl_dump_filter(&rth, tnl_rates_nlmsg, &tr) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			delete_json_obj();
+			break;
+		}
+		delete_json_obj();
+		if (tr.secs > 0 && !json)
+			fputc('\n', stdout);
+		fflush(stdout);
+		next += interval;
+		monotonic_sleep_until(next);
+	}
+
+	free(tr.prev);
+	free(tr.have_prev);
+	return ret;
+}
@@ -22,11 +22,16 @@ struct tnl_print_nlmsg_info {
 	void *p2;
 
 	void (*init)(const struct tnl_print_nlmsg_info *info);
+	/* fill p2 from IFLA_INFO_DATA, false if the kind is not known */
+	bool (*parse)(const struct tnl_print_nlmsg_info *info,
+		      const char *name, const char *kind, struct rtattr *data);
 	bool (*match)(const struct tnl_print_nlmsg_info *info);
 	void (*print)(const void *t);
 };
 
 int do_tunnels_list(struct tnl_print_nlmsg_info *info);
+int do_tunnels_rates(struct tnl_print_nlmsg_info *info, unsigned int interval);
+unsigned int tnl_parse_interval(int *argc, char **argv);
 
 const char *tnl_strproto(__u8 proto);
 
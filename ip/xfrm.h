@@ -10,11 +10,14 @@
 #define __XFRM_H__ 1
 
 #include <stdio.h>
+#include <stdbool.h>
 #include <sys/socket.h>
 #include <linux/in.h>
 #include <linux/xfrm.h>
 #include <linux/ipsec.h>
 
+#include "rtnl_bulk.h"
+
 #ifndef IPPROTO_MH
 #define IPPROTO_MH              135
 #endif
@@ -46,13 +49,10 @@
 		} \
 	} while(0)
 
+/* deleteall: the matching states or policies, deleted in windows */
 struct xfrm_buffer {
-	char *buf;
-	int size;
-	int offset;
-
-	int nlmsg_count;
-	struct rtnl_handle *rth;
+	struct rtnl_flush	flush;
+	int			nlmsg_count;
 };
 
 struct xfrm_filter {
@@ -127,4 +127,11 @@ int xfrm_lifetime_cfg_parse(struct xfrm_lifetime_cfg *lft,
 			    int *argcp, char ***argvp);
 int xfrm_sctx_parse(char *ctxstr, char *context,
 		    struct xfrm_user_sec_ctx *sctx);
+
+/* Bulk loading for "ip xfrm { state | policy } COMMAND file FILE" */
+#define XFRM_BULK_FIELDS	8
+
+int xfrm_bulk_load(struct rtnl_bulk *b, const struct nlmsghdr *tmpl,
+		   int maxlen);
+int xfrm_bulk_addr(xfrm_address_t *addr, __u16 *family, const char *arg);
 #endif
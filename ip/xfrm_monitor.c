@@ -11,6 +11,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 #include <netinet/in.h>
 
 #include "utils.h"
@@ -24,7 +28,8 @@ static bool nokeys;
 static void usage(void)
 {
 	fprintf(stderr,
-		"Usage: ip xfrm monitor [ nokeys ] [ all-nsid ] [ all | OBJECTS | help ]\n"
+		"Usage: ip xfrm monitor [ nokeys ] [ all-nsid ]\n"
+		"	[ compact | aggregate [ SECS ] ] [ all | OBJECTS | help ]\n"
 		"OBJECTS := { acquire | expire | SA | aevent | policy | report }\n");
 	exit(-1);
 }
@@ -282,12 +287,14 @@ static int xfrm_accept_msg(struct rtnl_ctrl_data *ctrl,
 	case XFRM_MSG_UPDSA:
 	case XFRM_MSG_EXPIRE:
 		xfrm_state_print(n, arg);
+		fflush(fp);
 		return 0;
 	case XFRM_MSG_NEWPOLICY:
 	case XFRM_MSG_DELPOLICY:
 	case XFRM_MSG_UPDPOLICY:
 	case XFRM_MSG_POLEXPIRE:
 		xfrm_policy_print(n, arg);
+		fflush(fp);
 		return 0;
 	case XFRM_MSG_ACQUIRE:
 		xfrm_acquire_print(n, arg);
@@ -324,6 +331,388 @@ static int xfrm_accept_msg(struct rtnl_ctrl_data *ctrl,
 
 extern struct rtnl_handle rth;
 
+/*
+ * "compact": one short line per event, read in batches from a socket
+ * with a large receive buffer, for keeping up with rekey storms.
+ * "aggregate": only the number of events of each kind, every interval.
+ */
+#define XFRM_MON_RCVBUF		(32 * 1024 * 1024)
+#define XFRM_MON_BATCH_VLEN	64
+#define XFRM_MON_BATCH_SLOT	32768
+
+enum {
+	XFRM_MON_ACQUIRE,
+	XFRM_MON_EXPIRE_SOFT,
+	XFRM_MON_EXPIRE_HARD,
+	XFRM_MON_NEWSA,
+	XFRM_MON_DELSA,
+	XFRM_MON_UPDSA,
+	XFRM_MON_NEWPOLICY,
+	XFRM_MON_DELPOLICY,
+	XFRM_MON_UPDPOLICY,
+	XFRM_MON_POLEXPIRE_SOFT,
+	XFRM_MON_POLEXPIRE_HARD,
+	XFRM_MON_REPORT,
+	XFRM_MON_AEVENT,
+	XFRM_MON_MAPPING,
+	XFRM_MON_FLUSH,
+	XFRM_MON_OTHER,
+	XFRM_MON_MAX
+};
+
+static const char * const xfrm_mon_names[XFRM_MON_MAX] = {
+	[XFRM_MON_ACQUIRE]		= "acquire",
+	[XFRM_MON_EXPIRE_SOFT]		= "expire-soft",
+	[XFRM_MON_EXPIRE_HARD]		= "expire-hard",
+	[XFRM_MON_NEWSA]		= "newsa",
+	[XFRM_MON_DELSA]		= "delsa",
+	[XFRM_MON_UPDSA]		= "updsa",
+	[XFRM_MON_NEWPOLICY]		= "newpolicy",
+	[XFRM_MON_DELPOLICY]		= "delpolicy",
+	[XFRM_MON_UPDPOLICY]		= "updpolicy",
+	[XFRM_MON_POLEXPIRE_SOFT]	= "polexpire-soft",
+	[XFRM_MON_POLEXPIRE_HARD]	= "polexpire-hard",
+	[XFRM_MON_REPORT]		= "report",
+	[XFRM_MON_AEVENT]		= "aevent",
+	[XFRM_MON_MAPPING]		= "mapping",
+	[XFRM_MON_FLUSH]		= "flush",
+	[XFRM_MON_OTHER]		= "other",
+};
+
+struct xfrm_mon {
+	bool		aggregate;
+	struct timespec	ts;		/* of the batch being handled */
+	__u64		count[XFRM_MON_MAX];
+	__u64		events;
+	__u64		overruns;
+	__u64		interval_overruns;
+};
+
+/* What a compact record says about the SA or policy of an event */
+struct xfrm_mon_rec {
+	int			kind;
+	const xfrm_address_t	*daddr;
+	__u16			family;
+	__u8			proto;
+	__u32			spi;
+	int			dir;	/* policies, -1 for SAs */
+	__u32			index;
+	__u32			flags;	/* aevent reason */
+};
+
+#define XFRM_MON_HAS(n, type) ((n)->nlmsg_len >= NLMSG_LENGTH(sizeof(type)))
+
+static void xfrm_mon_sa(struct xfrm_mon_rec *r, const struct xfrm_usersa_info *x)
+{
+	r->daddr = &x->id.daddr;
+	r->family = x->family;
+	r->proto = x->id.proto;
+	r->spi = x->id.spi;
+}
+
+static void xfrm_mon_said(struct xfrm_mon_rec *r, const struct xfrm_usersa_id *x)
+{
+	r->daddr = &x->daddr;
+	r->family = x->family;
+	r->proto = x->proto;
+	r->spi = x->spi;
+}
+
+static void xfrm_mon_classify(const struct nlmsghdr *n, struct xfrm_mon_rec *r)
+{
+	void *data = NLMSG_DATA(n);
+
+	memset(r, 0, sizeof(*r));
+	r->kind = XFRM_MON_OTHER;
+	r->dir = -1;
+
+	switch (n->nlmsg_type) {
+	case XFRM_MSG_ACQUIRE:
+		if (XFRM_MON_HAS(n, struct xfrm_user_acquire)) {
+			struct xfrm_user_acquire *xacq = data;
+
+			r->kind = XFRM_MON_ACQUIRE;
+			r->daddr = &xacq->id.daddr;
+			r->family = xacq->sel.family ? : xacq->policy.sel.family;
+			r->proto = xacq->id.proto;
+			r->spi = xacq->id.spi;
+		}
+		break;
+	case XFRM_MSG_EXPIRE:
+		if (XFRM_MON_HAS(n, struct xfrm_user_expire)) {
+			struct xfrm_user_expire *xexp = data;
+
+			r->kind = xexp->hard ? XFRM_MON_EXPIRE_HARD :
+					       XFRM_MON_EXPIRE_SOFT;
+			xfrm_mon_sa(r, &xexp->state);
+		}
+		break;
+	case XFRM_MSG_NEWSA:
+	case XFRM_MSG_UPDSA:
+		if (XFRM_MON_HAS(n, struct xfrm_usersa_info)) {
+			r->kind = n->nlmsg_type == XFRM_MSG_NEWSA ?
+				  XFRM_MON_NEWSA : XFRM_MON_UPDSA;
+			xfrm_mon_sa(r, data);
+		}
+		break;
+	case XFRM_MSG_DELSA:
+		if (XFRM_MON_HAS(n, struct xfrm_usersa_id)) {
+			r->kind = XFRM_MON_DELSA;
+			xfrm_mon_said(r, data);
+		}
+		break;
+	case XFRM_MSG_NEWPOLICY:
+	case XFRM_MSG_UPDPOLICY:
+		if (XFRM_MON_HAS(n, struct xfrm_userpolicy_info)) {
+			struct xfrm_userpolicy_info *xpinfo = data;
+
+			r->kind = n->nlmsg_type == XFRM_MSG_NEWPOLICY ?
+				  XFRM_MON_NEWPOLICY : XFRM_MON_UPDPOLICY;
+			r->dir = xpinfo->dir;
+			r->index = xpinfo->index;
+		}
+		break;
+	case XFRM_MSG_DELPOLICY:
+		if (XFRM_MON_HAS(n, struct xfrm_userpolicy_id)) {
+			struct xfrm_userpolicy_id *xpid = data;
+
+			r->kind = XFRM_MON_DELPOLICY;
+			r->dir = xpid->dir;
+			r->index = xpid->index;
+		}
+		break;
+	case XFRM_MSG_POLEXPIRE:
+		if (XFRM_MON_HAS(n, struct xfrm_user_polexpire)) {
+			struct xfrm_user_polexpire *xpexp = data;
+
+			r->kind = xpexp->hard ? XFRM_MON_POLEXPIRE_HARD :
+						XFRM_MON_POLEXPIRE_SOFT;
+			r->dir = xpexp->pol.dir;
+			r->index = xpexp->pol.index;
+		}
+		break;
+	case XFRM_MSG_REPORT:
+		if (XFRM_MON_HAS(n, struct xfrm_user_report)) {
+			struct xfrm_user_report *xrep = data;
+
+			r->kind = XFRM_MON_REPORT;
+			r->daddr = &xrep->sel.daddr;
+			r->family = xrep->sel.family;
+			r->proto = xrep->proto;
+		}
+		break;
+	case XFRM_MSG_NEWAE:
+		if (XFRM_MON_HAS(n, struct xfrm_aevent_id)) {
+			struct xfrm_aevent_id *id = data;
+
+			r->kind = XFRM_MON_AEVENT;
+			xfrm_mon_said(r, &id->sa_id);
+			r->flags = id->flags;
+		}
+		break;
+	case XFRM_MSG_MAPPING:
+		if (XFRM_MON_HAS(n, struct xfrm_user_mapping)) {
+			r->kind = XFRM_MON_MAPPING;
+			xfrm_mon_said(r, &((struct xfrm_user_mapping *)data)->id);
+		}
+		break;
+	case XFRM_MSG_FLUSHSA:
+	case XFRM_MSG_FLUSHPOLICY:
+		r->kind = XFRM_MON_FLUSH;
+		break;
+	}
+}
+
+static const char *xfrm_mon_dir(int dir)
+{
+	static char buf[16];
+
+	switch (dir) {
+	case XFRM_POLICY_IN:
+		return "in";
+	case XFRM_POLICY_OUT:
+		return "out";
+	case XFRM_POLICY_FWD:
+		return "fwd";
+	}
+	snprintf(buf, sizeof(buf), "%d", dir);
+	return buf;
+}
+
+static void xfrm_mon_prefix(FILE *fp, const struct xfrm_mon *mon,
+			    const struct rtnl_ctrl_data *ctrl)
+{
+	if (timestamp)
+		fprintf(fp, "%lld.%06ld ", (long long)mon->ts.tv_sec,
+			mon->ts.tv_nsec / 1000);
+	if (listen_all_nsid) {
+		if (ctrl == NULL || ctrl->nsid < 0)
+			fprintf(fp, "nsid current ");
+		else
+			fprintf(fp, "nsid %d ", ctrl->nsid);
+	}
+}
+
+static int xfrm_compact_msg(struct rtnl_ctrl_data *ctrl,
+			    struct nlmsghdr *n, void *arg)
+{
+	struct xfrm_mon *mon = arg;
+	struct xfrm_mon_rec r;
+	FILE *fp = stdout;
+
+	if (n->nlmsg_type == NLMSG_ERROR || n->nlmsg_type == NLMSG_NOOP ||
+	    n->nlmsg_type == NLMSG_DONE)
+		return 0;
+
+	xfrm_mon_classify(n, &r);
+	mon->count[r.kind]++;
+	mon->events++;
+	if (mon->aggregate)
+		return 0;
+
+	xfrm_mon_prefix(fp, mon, ctrl);
+	fputs(xfrm_mon_names[r.kind], fp);
+	if (r.dir >= 0)
+		fprintf(fp, " dir %s index %u", xfrm_mon_dir(r.dir), r.index);
+	if (r.proto)
+		fprintf(fp, " proto %s", strxf_xfrmproto(r.proto));
+	if (r.daddr)
+		fprintf(fp, " spi 0x%08x dst %s", ntohl(r.spi),
+			rt_addr_n2a(r.family, sizeof(*r.daddr), r.daddr));
+	if (r.kind == XFRM_MON_AEVENT) {
+		const char *sep = " reason ";
+
+		if (r.flags & XFRM_AE_CR) {
+			fprintf(fp, "%sreplay", sep);
+			sep = ",";
+		}
+		if (r.flags & XFRM_AE_CE) {
+			fprintf(fp, "%stimer", sep);
+			sep = ",";
+		}
+		if (r.flags & XFRM_AE_CU)
+			fprintf(fp, "%spolicy", sep);
+	}
+	if (r.kind == XFRM_MON_OTHER)
+		fprintf(fp, " type %u", n->nlmsg_type);
+	fputc('\n', fp);
+
+	return 0;
+}
+
+static void xfrm_mon_print_counts(FILE *fp, const struct xfrm_mon *mon,
+				  __u64 overruns)
+{
+	int i;
+
+	fprintf(fp, "%lld", (long long)mon->ts.tv_sec);
+	for (i = 0; i < XFRM_MON_MAX; i++)
+		fprintf(fp, " %s %llu", xfrm_mon_names[i],
+			(unsigned long long)mon->count[i]);
+	fprintf(fp, " overruns %llu\n", (unsigned long long)overruns);
+}
+
+static volatile sig_atomic_t xfrm_mon_stop;
+
+static void xfrm_mon_sig(int sig)
+{
+	xfrm_mon_stop = 1;
+}
+
+/*
+ * Every wakeup drains the socket with as few recvmmsg() calls as it
+ * takes and writes the records out at once. A kernel drop (ENOBUFS) is
+ * counted, and in compact mode shows up as an "overrun" record.
+ */
+static int xfrm_mon_run(struct xfrm_mon *mon, int interval)
+{
+	struct sigaction sa = { .sa_handler = xfrm_mon_sig };
+	int size_rcv = rcvbuf;
+	struct rtnl_batch b;
+	double next = 0;
+	int err = 0;
+
+	if (size_rcv < XFRM_MON_RCVBUF)
+		size_rcv = XFRM_MON_RCVBUF;
+	if (setsockopt(rth.fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &size_rcv, sizeof(size_rcv)) < 0)
+		setsockopt(rth.fd, SOL_SOCKET, SO_RCVBUF,
+			   &size_rcv, sizeof(size_rcv));
+
+	if (rtnl_batch_init(&b, XFRM_MON_BATCH_VLEN, XFRM_MON_BATCH_SLOT)) {
+		perror("Cannot allocate receive buffers");
+		return -1;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (mon->aggregate)
+		next = monotonic_now() + interval;
+
+	while (!xfrm_mon_stop) {
+		struct pollfd pfd = { .fd = rth.fd, .events = POLLIN };
+		int timeout = -1;
+		int n;
+
+		if (mon->aggregate) {
+			double now = monotonic_now();
+
+			if (now >= next) {
+				clock_gettime(CLOCK_REALTIME, &mon->ts);
+				xfrm_mon_print_counts(stdout, mon,
+						      mon->interval_overruns);
+				fflush(stdout);
+				memset(mon->count, 0, sizeof(mon->count));
+				mon->interval_overruns = 0;
+				while (next <= now)
+					next += interval;
+			}
+			timeout = (next - now) * 1000 + 1;
+		}
+
+		n = poll(&pfd, 1, timeout);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			err = -1;
+			break;
+		}
+		if (n == 0)
+			continue;
+
+		do {
+			n = rtnl_listen_batch(&rth, &b, &mon->ts,
+					      xfrm_compact_msg, mon);
+			if (n < 0 && errno == ENOBUFS) {
+				mon->overruns++;
+				mon->interval_overruns++;
+				if (!mon->aggregate) {
+					clock_gettime(CLOCK_REALTIME, &mon->ts);
+					xfrm_mon_prefix(stdout, mon, NULL);
+					fputs("overrun\n", stdout);
+				}
+				n = 1;
+			}
+		} while (n > 0 && !xfrm_mon_stop);
+		fflush(stdout);
+
+		if (n < 0 && errno != EINTR) {
+			fprintf(stderr, "netlink receive error %s (%d)\n",
+				strerror(errno), errno);
+			err = -1;
+			break;
+		}
+	}
+
+	fprintf(stderr, "%llu events, %llu socket overruns\n",
+		(unsigned long long)mon->events,
+		(unsigned long long)mon->overruns);
+	rtnl_batch_free(&b);
+	return err;
+}
+
 int do_xfrm_monitor(int argc, char **argv)
 {
 	char *file = NULL;
@@ -334,6 +723,9 @@ int do_xfrm_monitor(int argc, char **argv)
 	int lpolicy = 0;
 	int lsa = 0;
 	int lreport = 0;
+	struct xfrm_mon mon = {};
+	bool compact = false;
+	int interval = 1;
 
 	rtnl_close(&rth);
 
@@ -343,6 +735,17 @@ int do_xfrm_monitor(int argc, char **argv)
 			file = *argv;
 		} else if (strcmp(*argv, "nokeys") == 0) {
 			nokeys = true;
+		} else if (strcmp(*argv, "compact") == 0) {
+			compact = true;
+		} else if (strcmp(*argv, "aggregate") == 0) {
+			compact = true;
+			mon.aggregate = true;
+			if (NEXT_ARG_OK() && get_integer(&interval, argv[1], 0) == 0) {
+				NEXT_ARG();
+				if (interval <= 0)
+					invarg("aggregate interval must be positive",
+					       *argv);
+			}
 		} else if (strcmp(*argv, "all") == 0) {
 			/* fall out */
 		} else if (matches(*argv, "all-nsid") == 0) {
@@ -396,7 +799,15 @@ int do_xfrm_monitor(int argc, char **argv)
 			perror("Cannot fopen");
 			exit(-1);
 		}
-		err = rtnl_from_file(fp, xfrm_accept_msg, stdout);
+		if (compact) {
+			err = rtnl_from_file(fp, xfrm_compact_msg, &mon);
+			if (mon.aggregate) {
+				clock_gettime(CLOCK_REALTIME, &mon.ts);
+				xfrm_mon_print_counts(stdout, &mon, 0);
+			}
+		} else {
+			err = rtnl_from_file(fp, xfrm_accept_msg, stdout);
+		}
 		fclose(fp);
 		return err;
 	}
@@ -406,6 +817,9 @@ int do_xfrm_monitor(int argc, char **argv)
 	if (listen_all_nsid && rtnl_listen_all_nsid(&rth) < 0)
 		exit(1);
 
+	if (compact)
+		return xfrm_mon_run(&mon, interval) < 0 ? 2 : 0;
+
 	if (rtnl_listen(&rth, xfrm_accept_msg, (void *)stdout) < 0)
 		exit(2);
 
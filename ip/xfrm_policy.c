@@ -17,9 +17,6 @@
 #include "xfrm.h"
 #include "ip_common.h"
 
-/* #define NLMSG_DELETEALL_BUF_SIZE (4096-512) */
-#define NLMSG_DELETEALL_BUF_SIZE 8192
-
 /*
  * Receiving buffer defines:
  * nlmsg
@@ -42,6 +39,7 @@ static void usage(void)
 		"	[ action ACTION ] [ priority PRIORITY ] [ flag FLAG-LIST ]\n"
 		"	[ if_id IF_ID ] [ LIMIT-LIST ] [ TMPL-LIST ]\n"
 		"	[ offload packet dev DEV] } ]\n"
+		"	[ file FILE ]\n"
 		"Usage: ip xfrm policy { delete | get } { SELECTOR | index INDEX } dir DIR\n"
 		"	[ ctx CTX ] [ mark MARK [ mask MASK ] ] [ ptype PTYPE ]\n"
 		"	[ if_id IF_ID ]\n"
@@ -223,6 +221,90 @@ int xfrm_sctx_parse(char *ctxstr, char *s,
 	return 0;
 }
 
+/*
+ * "policy { add | update } file FILE": one policy per line,
+ * SRC[/PLEN] DST[/PLEN] [ TMPL-SRC TMPL-DST [ REQID ] ], replacing the
+ * selector addresses and those of the first template given on the
+ * command line.
+ */
+struct xfrm_policy_bulk {
+	struct rtnl_bulk	b;
+	int			tmpl_off;
+};
+
+static const char *xfrm_policy_bulk_sel(xfrm_address_t *addr, __u8 *plen,
+					__u16 *family, char *arg)
+{
+	inet_prefix p;
+
+	if (get_prefix_1(&p, arg, *family))
+		return "invalid selector prefix";
+	memset(addr, 0, sizeof(*addr));
+	memcpy(addr, &p.data, p.bytelen);
+	*plen = p.bitlen;
+	*family = p.family;
+	return NULL;
+}
+
+static const char *xfrm_policy_bulk_entry(struct rtnl_bulk *b,
+					  struct nlmsghdr *n, int maxlen,
+					  char **tok, int ntok)
+{
+	struct xfrm_policy_bulk *pb = (struct xfrm_policy_bulk *)b;
+	struct xfrm_userpolicy_info *xpinfo = NLMSG_DATA(n);
+	struct xfrm_user_tmpl *tmpl;
+	__u16 family = AF_UNSPEC;
+	const char *err;
+
+	if (ntok != 2 && ntok != 4 && ntok != 5)
+		return "expected SRC DST [ TMPL-SRC TMPL-DST [ REQID ] ]";
+	err = xfrm_policy_bulk_sel(&xpinfo->sel.saddr,
+				   &xpinfo->sel.prefixlen_s, &family, tok[0]);
+	if (!err)
+		err = xfrm_policy_bulk_sel(&xpinfo->sel.daddr,
+					   &xpinfo->sel.prefixlen_d, &family,
+					   tok[1]);
+	if (err)
+		return err;
+	xpinfo->sel.family = family;
+
+	if (ntok == 2)
+		return NULL;
+	if (pb->tmpl_off < 0)
+		return "no \"tmpl\" on the command line";
+
+	/* the template may be of another family, e.g. IPv6 over IPv4 */
+	tmpl = (struct xfrm_user_tmpl *)((char *)n + pb->tmpl_off);
+	family = AF_UNSPEC;
+	if (xfrm_bulk_addr(&tmpl->saddr, &family, tok[2]) ||
+	    xfrm_bulk_addr(&tmpl->id.daddr, &family, tok[3]))
+		return "invalid template address";
+	if (ntok > 4 && get_u32(&tmpl->reqid, tok[4], 0))
+		return "invalid REQID";
+	tmpl->family = family;
+	return NULL;
+}
+
+static int xfrm_policy_bulk(struct nlmsghdr *n, int maxlen, const char *file)
+{
+	struct xfrm_policy_bulk pb = {
+		.b.file = file,
+		.b.parse = xfrm_policy_bulk_entry,
+		.tmpl_off = -1,
+	};
+	struct rtattr *rta = XFRMP_RTA(NLMSG_DATA(n));
+	int len = NLMSG_PAYLOAD(n, sizeof(struct xfrm_userpolicy_info));
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == XFRMA_TMPL) {
+			pb.tmpl_off = (char *)RTA_DATA(rta) - (char *)n;
+			break;
+		}
+	}
+
+	return xfrm_bulk_load(&pb.b, n, maxlen);
+}
+
 static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv)
 {
 	struct rtnl_handle rth;
@@ -257,6 +339,7 @@ static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv
 	unsigned int ifindex = 0;
 	bool is_offload = false;
 	__u32 if_id = 0;
+	char *file = NULL;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dir") == 0) {
@@ -345,6 +428,11 @@ static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv
 			} else
 				invarg("Missing dev keyword", *argv);
 			is_offload = true;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (file)
+				duparg("file", *argv);
+			file = *argv;
 		} else {
 			if (selp)
 				duparg("unknown", *argv);
@@ -397,6 +485,9 @@ static int xfrm_policy_modify(int cmd, unsigned int flags, int argc, char **argv
 			  sizeof(xuo));
 	}
 
+	if (file)
+		return xfrm_policy_bulk(&req.n, sizeof(req), file);
+
 	if (rtnl_open_byproto(&rth, 0, NETLINK_XFRM) < 0)
 		exit(1);
 
@@ -565,7 +656,6 @@ int xfrm_policy_print(struct nlmsghdr *n, void *arg)
 
 	if (oneline)
 		fprintf(fp, "\n");
-	fflush(fp);
 
 	return 0;
 }
@@ -721,18 +811,24 @@ static int xfrm_policy_get(int argc, char **argv)
 
 /*
  * With an existing policy of nlmsg, make new nlmsg for deleting the policy
- * and store it to buffer.
+ * and queue it for deletion.
  */
 static int xfrm_policy_keep(struct nlmsghdr *n, void *arg)
 {
 	struct xfrm_buffer *xb = (struct xfrm_buffer *)arg;
-	struct rtnl_handle *rth = xb->rth;
 	struct xfrm_userpolicy_info *xpinfo = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
 	struct rtattr *tb[XFRMA_MAX+1];
 	__u8 ptype = XFRM_POLICY_TYPE_MAIN;
-	struct nlmsghdr *new_n;
-	struct xfrm_userpolicy_id *xpid;
+	struct {
+		struct nlmsghdr			n;
+		struct xfrm_userpolicy_id	xpid;
+		char				buf[RTA_BUF_SIZE];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.xpid)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_DELPOLICY,
+	};
 
 	if (n->nlmsg_type != XFRM_MSG_NEWPOLICY) {
 		fprintf(stderr, "Not a policy: %08x %08x %08x\n",
@@ -766,23 +862,14 @@ static int xfrm_policy_keep(struct nlmsghdr *n, void *arg)
 	if (xpinfo->dir >= XFRM_POLICY_MAX)
 		return 0;
 
-	if (xb->offset + NLMSG_LENGTH(sizeof(*xpid)) > xb->size)
-		return 0;
-
-	new_n = (struct nlmsghdr *)(xb->buf + xb->offset);
-	new_n->nlmsg_len = NLMSG_LENGTH(sizeof(*xpid));
-	new_n->nlmsg_flags = NLM_F_REQUEST;
-	new_n->nlmsg_type = XFRM_MSG_DELPOLICY;
-	new_n->nlmsg_seq = ++rth->seq;
-
-	xpid = NLMSG_DATA(new_n);
-	memcpy(&xpid->sel, &xpinfo->sel, sizeof(xpid->sel));
-	xpid->dir = xpinfo->dir;
-	xpid->index = xpinfo->index;
+	memcpy(&req.xpid.sel, &xpinfo->sel, sizeof(req.xpid.sel));
+	req.xpid.dir = xpinfo->dir;
+	req.xpid.index = xpinfo->index;
 
 	if (tb[XFRMA_MARK]) {
-		int r = addattr_l(new_n, xb->size, XFRMA_MARK,
-				(void *)RTA_DATA(tb[XFRMA_MARK]), tb[XFRMA_MARK]->rta_len);
+		int r = addattr_l(&req.n, sizeof(req), XFRMA_MARK,
+				  RTA_DATA(tb[XFRMA_MARK]),
+				  RTA_PAYLOAD(tb[XFRMA_MARK]));
 		if (r < 0) {
 			fprintf(stderr, "%s: XFRMA_MARK failed\n", __func__);
 			exit(1);
@@ -790,11 +877,12 @@ static int xfrm_policy_keep(struct nlmsghdr *n, void *arg)
 	}
 
 	if (tb[XFRMA_IF_ID]) {
-		addattr32(new_n, xb->size, XFRMA_IF_ID,
+		addattr32(&req.n, sizeof(req), XFRMA_IF_ID,
 			  rta_getattr_u32(tb[XFRMA_IF_ID]));
 	}
 
-	xb->offset += new_n->nlmsg_len;
+	if (rtnl_flush_add(&xb->flush, &req.n, 0) < 0)
+		return -1;
 	xb->nlmsg_count++;
 
 	return 0;
@@ -876,12 +964,10 @@ static int xfrm_policy_list_or_deleteall(int argc, char **argv, int deleteall)
 
 	if (deleteall) {
 		struct xfrm_buffer xb;
-		char buf[NLMSG_DELETEALL_BUF_SIZE];
 		int i;
 
-		xb.buf = buf;
-		xb.size = sizeof(buf);
-		xb.rth = &rth;
+		if (rtnl_flush_open_byproto(&xb.flush, 0, NETLINK_XFRM) < 0)
+			exit(1);
 
 		for (i = 0; ; i++) {
 			struct {
@@ -894,7 +980,6 @@ static int xfrm_policy_list_or_deleteall(int argc, char **argv, int deleteall)
 				.n.nlmsg_seq = rth.dump = ++rth.seq,
 			};
 
-			xb.offset = 0;
 			xb.nlmsg_count = 0;
 
 			if (show_stats > 1)
@@ -911,20 +996,19 @@ static int xfrm_policy_list_or_deleteall(int argc, char **argv, int deleteall)
 			}
 			if (xb.nlmsg_count == 0) {
 				if (show_stats > 1)
-					fprintf(stderr, "Delete-all completed\n");
+					fprintf(stderr, "Delete-all completed, %.0f deletes/s\n",
+						rtnl_flush_rate(&xb.flush));
 				break;
 			}
 
-			if (rtnl_send_check(&rth, xb.buf, xb.offset) < 0) {
+			if (rtnl_flush_commit(&xb.flush) < 0) {
 				perror("Failed to send delete-all request");
 				exit(1);
 			}
 			if (show_stats > 1)
 				fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
-
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
 		}
+		rtnl_flush_close(&xb.flush);
 	} else {
 		struct {
 			struct nlmsghdr n;
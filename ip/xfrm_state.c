@@ -12,13 +12,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <netdb.h>
+#include <errno.h>
 #include "utils.h"
 #include "xfrm.h"
 #include "ip_common.h"
 
-/* #define NLMSG_DELETEALL_BUF_SIZE (4096-512) */
-#define NLMSG_DELETEALL_BUF_SIZE 8192
-
 /*
  * Receiving buffer defines:
  * nlmsg
@@ -48,12 +46,14 @@ static void usage(void)
 		"        [ offload [ crypto | packet ] dev DEV dir DIR ]\n"
 		"        [ output-mark OUTPUT-MARK [ mask MASK ] ]\n"
 		"        [ if_id IF_ID ] [ tfcpad LENGTH ] [ pcpu-num CPUNUM ]\n"
+		"        [ file FILE [ keys KEYFILE ] ]\n"
 		"Usage: ip xfrm state allocspi ID [ mode MODE ] [ mark MARK [ mask MASK ] ]\n"
 		"        [ reqid REQID ] [ dir DIR ] [ seq SEQ ] [ min SPI max SPI ] [ pcpu-num CPUNUM ]\n"
+		"        [ file FILE ]\n"
 		"Usage: ip xfrm state { delete | get } ID [ mark MARK [ mask MASK ] ]\n"
 		"Usage: ip xfrm state deleteall [ ID ] [ mode MODE ] [ reqid REQID ]\n"
 		"        [ flag FLAG-LIST ]\n"
-		"Usage: ip xfrm state list [ nokeys ] [ ID ] [ mode MODE ] [ reqid REQID ]\n"
+		"Usage: ip xfrm state list [ nokeys | stats ] [ ID ] [ mode MODE ] [ reqid REQID ]\n"
 		"        [ flag FLAG-LIST ]\n"
 		"Usage: ip xfrm state flush [ proto XFRM-PROTO ]\n"
 		"Usage: ip xfrm state count\n"
@@ -267,6 +267,188 @@ static void xfrm_dir_parse(__u8 *dir, int *argcp, char ***argvp)
 	*argvp = argv;
 }
 
+/*
+ * "state { add | update } file FILE": one SA per line, SRC DST SPI [ REQID ],
+ * on top of the template given on the command line. With "keys KEYFILE"
+ * the keys of every SA are read from KEYFILE as raw bytes, in the order
+ * and with the lengths of the algorithms of the template.
+ */
+#define XFRM_STATE_BULK_KEYS	4
+
+struct xfrm_state_bulk {
+	struct rtnl_bulk	b;
+	FILE			*keys;
+	int			nkeys;
+	struct {
+		int		off;
+		unsigned int	len;
+	} key[XFRM_STATE_BULK_KEYS];
+};
+
+static void xfrm_state_bulk_keys(struct xfrm_state_bulk *sb,
+				 struct nlmsghdr *n)
+{
+	struct rtattr *rta = XFRMS_RTA(NLMSG_DATA(n));
+	int len = XFRMS_PAYLOAD(n);
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		struct xfrm_algo_aead *aead = RTA_DATA(rta);
+		struct xfrm_algo_auth *auth = RTA_DATA(rta);
+		struct xfrm_algo *alg = RTA_DATA(rta);
+		char *key;
+		int bits;
+
+		switch (rta->rta_type) {
+		case XFRMA_ALG_AEAD:
+			key = aead->alg_key;
+			bits = aead->alg_key_len;
+			break;
+		case XFRMA_ALG_AUTH_TRUNC:
+			key = auth->alg_key;
+			bits = auth->alg_key_len;
+			break;
+		case XFRMA_ALG_CRYPT:
+		case XFRMA_ALG_AUTH:
+			key = alg->alg_key;
+			bits = alg->alg_key_len;
+			break;
+		default:
+			continue;
+		}
+		sb->key[sb->nkeys].off = key - (char *)n;
+		sb->key[sb->nkeys].len = bits / 8;
+		sb->nkeys++;
+	}
+}
+
+static const char *xfrm_state_bulk_entry(struct rtnl_bulk *b,
+					 struct nlmsghdr *n, int maxlen,
+					 char **tok, int ntok)
+{
+	struct xfrm_state_bulk *sb = (struct xfrm_state_bulk *)b;
+	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
+	__u16 family = AF_UNSPEC;
+	__u32 spi;
+	int i;
+
+	/* even for a bad line, so that the keys of the next lines line up */
+	for (i = 0; i < sb->nkeys; i++) {
+		if (fread((char *)n + sb->key[i].off, 1, sb->key[i].len,
+			  sb->keys) != sb->key[i].len) {
+			b->stop = true;
+			return "key file too short";
+		}
+	}
+
+	if (ntok < 3 || ntok > 4)
+		return "expected SRC DST SPI [ REQID ]";
+	if (xfrm_bulk_addr(&xsinfo->saddr, &family, tok[0]) ||
+	    xfrm_bulk_addr(&xsinfo->id.daddr, &family, tok[1]))
+		return "invalid address";
+	if (get_u32(&spi, tok[2], 0) || !spi)
+		return "invalid SPI";
+	if (ntok > 3 && get_u32(&xsinfo->reqid, tok[3], 0))
+		return "invalid REQID";
+	xsinfo->id.spi = htonl(spi);
+	xsinfo->family = family;
+	return NULL;
+}
+
+static int xfrm_state_bulk(struct nlmsghdr *n, int maxlen, const char *file,
+			   const char *keyfile)
+{
+	struct xfrm_state_bulk sb = {
+		.b.file = file,
+		.b.parse = xfrm_state_bulk_entry,
+	};
+	int ret;
+
+	if (keyfile) {
+		xfrm_state_bulk_keys(&sb, n);
+		if (!sb.nkeys) {
+			fprintf(stderr, "\"keys\" needs an algorithm with a key\n");
+			return -1;
+		}
+		if (strcmp(keyfile, "-") == 0) {
+			if (strcmp(file, "-") == 0) {
+				fprintf(stderr, "\"file\" and \"keys\" cannot both be stdin\n");
+				return -1;
+			}
+			sb.keys = stdin;
+		} else {
+			sb.keys = fopen(keyfile, "r");
+			if (!sb.keys) {
+				fprintf(stderr, "Cannot open \"%s\": %s\n",
+					keyfile, strerror(errno));
+				return -1;
+			}
+		}
+	}
+
+	ret = xfrm_bulk_load(&sb.b, n, maxlen);
+
+	if (sb.keys && sb.keys != stdin)
+		fclose(sb.keys);
+	return ret;
+}
+
+/*
+ * "state allocspi file FILE": one SPI per line, SRC DST [ REQID ]. The
+ * SPIs are printed as "SRC DST SPI REQID", so the output can be fed to
+ * "state add file" once the keys are negotiated.
+ */
+static const char *xfrm_state_allocspi_entry(struct rtnl_bulk *b,
+					     struct nlmsghdr *n, int maxlen,
+					     char **tok, int ntok)
+{
+	struct xfrm_userspi_info *xspi = NLMSG_DATA(n);
+	__u16 family = AF_UNSPEC;
+
+	if (ntok < 2 || ntok > 3)
+		return "expected SRC DST [ REQID ]";
+	if (xfrm_bulk_addr(&xspi->info.saddr, &family, tok[0]) ||
+	    xfrm_bulk_addr(&xspi->info.id.daddr, &family, tok[1]))
+		return "invalid address";
+	if (ntok > 2 && get_u32(&xspi->info.reqid, tok[2], 0))
+		return "invalid REQID";
+	xspi->info.family = family;
+	return NULL;
+}
+
+static void xfrm_state_allocspi_answer(struct rtnl_bulk *b,
+				       const struct nlmsghdr *n, int lineno)
+{
+	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+	int len = xsinfo->family == AF_INET6 ? 16 : 4;
+
+	if (n->nlmsg_type != XFRM_MSG_NEWSA ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*xsinfo)))
+		return;
+
+	printf("%s %s 0x%08x %u\n",
+	       rt_addr_n2a_r(xsinfo->family, len, &xsinfo->saddr,
+			     src, sizeof(src)),
+	       rt_addr_n2a_r(xsinfo->family, len, &xsinfo->id.daddr,
+			     dst, sizeof(dst)),
+	       ntohl(xsinfo->id.spi), xsinfo->reqid);
+}
+
+static int xfrm_state_allocspi_bulk(struct nlmsghdr *n, int maxlen,
+				    const char *file)
+{
+	struct rtnl_bulk b = {
+		.file = file,
+		.parse = xfrm_state_allocspi_entry,
+		.answer = xfrm_state_allocspi_answer,
+	};
+	int ret;
+
+	ret = xfrm_bulk_load(&b, n, maxlen);
+	fflush(stdout);
+	return ret;
+}
+
 static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 {
 	struct rtnl_handle rth;
@@ -310,6 +492,8 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 	__u32 pcpu_num = -1;
 	__u32 if_id = 0;
 	__u32 tfcpad = 0;
+	char *file = NULL;
+	char *keyfile = NULL;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "mode") == 0) {
@@ -463,6 +647,16 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 			NEXT_ARG();
 			if (get_u32(&pcpu_num, *argv, 0))
 				invarg("value after \"pcpu-num\" is invalid", *argv);
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (file)
+				duparg("file", *argv);
+			file = *argv;
+		} else if (strcmp(*argv, "keys") == 0) {
+			NEXT_ARG();
+			if (keyfile)
+				duparg("keys", *argv);
+			keyfile = *argv;
 		} else {
 			/* try to assume ALGO */
 			int type = xfrm_algotype_getbyname(*argv);
@@ -638,6 +832,11 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 		exit(1);
 	}
 
+	if (keyfile && !file) {
+		fprintf(stderr, "\"keys\" requires \"file\"\n");
+		exit(1);
+	}
+
 	if (mark.m) {
 		int r = addattr_l(&req.n, sizeof(req.buf), XFRMA_MARK,
 				  (void *)&mark, sizeof(mark));
@@ -778,6 +977,11 @@ static int xfrm_state_modify(int cmd, unsigned int flags, int argc, char **argv)
 	if (req.xsinfo.family == AF_UNSPEC)
 		req.xsinfo.family = AF_INET;
 
+	if (file) {
+		rtnl_close(&rth);
+		return xfrm_state_bulk(&req.n, sizeof(req), file, keyfile);
+	}
+
 	if (rtnl_talk(&rth, &req.n, NULL) < 0)
 		exit(2);
 
@@ -806,6 +1010,7 @@ static int xfrm_state_allocspi(int argc, char **argv)
 	struct nlmsghdr *answer;
 	__u32 pcpu_num = -1;
 	__u8 dir = 0;
+	char *file = NULL;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "mode") == 0) {
@@ -844,6 +1049,11 @@ static int xfrm_state_allocspi(int argc, char **argv)
 			NEXT_ARG();
 			if (get_u32(&pcpu_num, *argv, 0))
 				invarg("value after \"pcpu-num\" is invalid", *argv);
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			if (file)
+				duparg("file", *argv);
+			file = *argv;
 		} else {
 			/* try to assume ID */
 			if (idp)
@@ -923,6 +1133,10 @@ static int xfrm_state_allocspi(int argc, char **argv)
 	if (req.xspi.info.family == AF_UNSPEC)
 		req.xspi.info.family = AF_INET;
 
+	if (file) {
+		rtnl_close(&rth);
+		return xfrm_state_allocspi_bulk(&req.n, sizeof(req), file);
+	}
 
 	if (rtnl_talk(&rth, &req.n, &answer) < 0)
 		exit(2);
@@ -1051,7 +1265,6 @@ static int __do_xfrm_state_print(struct nlmsghdr *n, void *arg, bool nokeys)
 
 	if (oneline)
 		fprintf(fp, "\n");
-	fflush(fp);
 
 	return 0;
 }
@@ -1066,6 +1279,69 @@ static int xfrm_state_print_nokeys(struct nlmsghdr *n, void *arg)
 	return __do_xfrm_state_print(n, arg, true);
 }
 
+/* "list stats": only the counters, one line per state */
+static int xfrm_state_print_stats(struct nlmsghdr *n, void *arg)
+{
+	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
+	struct rtattr *tb[XFRMA_MAX+1];
+	FILE *fp = (FILE *)arg;
+	int len = n->nlmsg_len;
+
+	if (n->nlmsg_type != XFRM_MSG_NEWSA) {
+		fprintf(stderr, "Not a state: %08x %08x %08x\n",
+			n->nlmsg_len, n->nlmsg_type, n->nlmsg_flags);
+		return 0;
+	}
+
+	len -= NLMSG_SPACE(sizeof(*xsinfo));
+	if (len < 0) {
+		fprintf(stderr, "BUG: wrong nlmsg len %d\n", len);
+		return -1;
+	}
+
+	if (!xfrm_state_filter_match(xsinfo))
+		return 0;
+
+	parse_rtattr(tb, XFRMA_MAX, XFRMS_RTA(xsinfo), len);
+
+	fprintf(fp, "src %s ", rt_addr_n2a(xsinfo->family,
+					   sizeof(xsinfo->saddr),
+					   &xsinfo->saddr));
+	fprintf(fp, "dst %s ", rt_addr_n2a(xsinfo->family,
+					   sizeof(xsinfo->id.daddr),
+					   &xsinfo->id.daddr));
+	fprintf(fp, "proto %s spi 0x%08x reqid %u ",
+		strxf_xfrmproto(xsinfo->id.proto), ntohl(xsinfo->id.spi),
+		xsinfo->reqid);
+	fprintf(fp, "bytes %llu packets %llu ",
+		(unsigned long long)xsinfo->curlft.bytes,
+		(unsigned long long)xsinfo->curlft.packets);
+	fprintf(fp, "replay-window %u replay %u failed %u",
+		xsinfo->stats.replay_window, xsinfo->stats.replay,
+		xsinfo->stats.integrity_failed);
+
+	if (tb[XFRMA_REPLAY_ESN_VAL] &&
+	    RTA_PAYLOAD(tb[XFRMA_REPLAY_ESN_VAL]) >=
+	    sizeof(struct xfrm_replay_state_esn)) {
+		struct xfrm_replay_state_esn *esn =
+			RTA_DATA(tb[XFRMA_REPLAY_ESN_VAL]);
+
+		fprintf(fp, " seq 0x%llx oseq 0x%llx",
+			(unsigned long long)esn->seq_hi << 32 | esn->seq,
+			(unsigned long long)esn->oseq_hi << 32 | esn->oseq);
+	} else if (tb[XFRMA_REPLAY_VAL] &&
+		   RTA_PAYLOAD(tb[XFRMA_REPLAY_VAL]) >=
+		   sizeof(struct xfrm_replay_state)) {
+		struct xfrm_replay_state *replay =
+			RTA_DATA(tb[XFRMA_REPLAY_VAL]);
+
+		fprintf(fp, " seq 0x%x oseq 0x%x", replay->seq, replay->oseq);
+	}
+	fputc('\n', fp);
+
+	return 0;
+}
+
 static int xfrm_state_get_or_delete(int argc, char **argv, int delete)
 {
 	struct rtnl_handle rth;
@@ -1149,16 +1425,22 @@ static int xfrm_state_get_or_delete(int argc, char **argv, int delete)
 
 /*
  * With an existing state of nlmsg, make new nlmsg for deleting the state
- * and store it to buffer.
+ * and queue it for deletion.
  */
 static int xfrm_state_keep(struct nlmsghdr *n, void *arg)
 {
 	struct xfrm_buffer *xb = (struct xfrm_buffer *)arg;
-	struct rtnl_handle *rth = xb->rth;
 	struct xfrm_usersa_info *xsinfo = NLMSG_DATA(n);
 	int len = n->nlmsg_len;
-	struct nlmsghdr *new_n;
-	struct xfrm_usersa_id *xsid;
+	struct {
+		struct nlmsghdr		n;
+		struct xfrm_usersa_id	xsid;
+		char			buf[RTA_BUF_SIZE];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.xsid)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = XFRM_MSG_DELSA,
+	};
 	struct rtattr *tb[XFRMA_MAX+1];
 
 	if (n->nlmsg_type != XFRM_MSG_NEWSA) {
@@ -1180,48 +1462,59 @@ static int xfrm_state_keep(struct nlmsghdr *n, void *arg)
 	    xsinfo->id.proto == IPPROTO_IPV6)
 		return 0;
 
-	if (xb->offset > xb->size) {
-		fprintf(stderr, "State buffer overflow\n");
-		return -1;
-	}
-
-	new_n = (struct nlmsghdr *)(xb->buf + xb->offset);
-	new_n->nlmsg_len = NLMSG_LENGTH(sizeof(*xsid));
-	new_n->nlmsg_flags = NLM_F_REQUEST;
-	new_n->nlmsg_type = XFRM_MSG_DELSA;
-	new_n->nlmsg_seq = ++rth->seq;
+	req.xsid.family = xsinfo->family;
+	memcpy(&req.xsid.daddr, &xsinfo->id.daddr, sizeof(req.xsid.daddr));
+	req.xsid.spi = xsinfo->id.spi;
+	req.xsid.proto = xsinfo->id.proto;
 
-	xsid = NLMSG_DATA(new_n);
-	xsid->family = xsinfo->family;
-	memcpy(&xsid->daddr, &xsinfo->id.daddr, sizeof(xsid->daddr));
-	xsid->spi = xsinfo->id.spi;
-	xsid->proto = xsinfo->id.proto;
-
-	addattr_l(new_n, xb->size, XFRMA_SRCADDR, &xsinfo->saddr,
-		  sizeof(xsid->daddr));
+	addattr_l(&req.n, sizeof(req), XFRMA_SRCADDR, &xsinfo->saddr,
+		  sizeof(req.xsid.daddr));
 
 	parse_rtattr(tb, XFRMA_MAX, XFRMS_RTA(xsinfo), len);
 
 	if (tb[XFRMA_MARK]) {
-		int r = addattr_l(new_n, xb->size, XFRMA_MARK,
-				(void *)RTA_DATA(tb[XFRMA_MARK]), tb[XFRMA_MARK]->rta_len);
+		int r = addattr_l(&req.n, sizeof(req), XFRMA_MARK,
+				  RTA_DATA(tb[XFRMA_MARK]),
+				  RTA_PAYLOAD(tb[XFRMA_MARK]));
 		if (r < 0) {
 			fprintf(stderr, "%s: XFRMA_MARK failed\n", __func__);
 			exit(1);
 		}
 	}
 
-	xb->offset += new_n->nlmsg_len;
+	if (rtnl_flush_add(&xb->flush, &req.n, 0) < 0)
+		return -1;
 	xb->nlmsg_count++;
 
 	return 0;
 }
 
+/*
+ * Have the kernel skip the states of other protocols and addresses, it
+ * knows no other filter for a dump of the SAD.
+ */
+static void xfrm_state_dump_req(struct nlmsghdr *n, int maxlen)
+{
+	struct xfrm_address_filter addrfilter = {
+		.saddr = filter.xsinfo.saddr,
+		.daddr = filter.xsinfo.id.daddr,
+		.family = filter.xsinfo.family,
+		.splen = filter.id_src_mask,
+		.dplen = filter.id_dst_mask,
+	};
+
+	if (filter.xsinfo.id.proto)
+		addattr8(n, maxlen, XFRMA_PROTO, filter.xsinfo.id.proto);
+	addattr_l(n, maxlen, XFRMA_ADDRESS_FILTER,
+		  &addrfilter, sizeof(addrfilter));
+}
+
 static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 {
 	char *idp = NULL;
 	struct rtnl_handle rth;
 	bool nokeys = false;
+	bool stats = false;
 
 	if (argc > 0 || preferred_family != AF_UNSPEC)
 		filter.use = 1;
@@ -1230,6 +1523,8 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 	while (argc > 0) {
 		if (strcmp(*argv, "nokeys") == 0) {
 			nokeys = true;
+		} else if (strcmp(*argv, "stats") == 0 && !deleteall) {
+			stats = true;
 		} else if (strcmp(*argv, "mode") == 0) {
 			NEXT_ARG();
 			xfrm_mode_parse(&filter.xsinfo.mode, &argc, &argv);
@@ -1267,12 +1562,10 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 
 	if (deleteall) {
 		struct xfrm_buffer xb;
-		char buf[NLMSG_DELETEALL_BUF_SIZE];
 		int i;
 
-		xb.buf = buf;
-		xb.size = sizeof(buf);
-		xb.rth = &rth;
+		if (rtnl_flush_open_byproto(&xb.flush, 0, NETLINK_XFRM) < 0)
+			exit(1);
 
 		for (i = 0; ; i++) {
 			struct {
@@ -1285,12 +1578,12 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 				.n.nlmsg_seq = rth.dump = ++rth.seq,
 			};
 
-			xb.offset = 0;
 			xb.nlmsg_count = 0;
 
 			if (show_stats > 1)
 				fprintf(stderr, "Delete-all round = %d\n", i);
 
+			xfrm_state_dump_req(&req.n, sizeof(req));
 			if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
 				perror("Cannot send dump request");
 				exit(1);
@@ -1302,29 +1595,21 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 			}
 			if (xb.nlmsg_count == 0) {
 				if (show_stats > 1)
-					fprintf(stderr, "Delete-all completed\n");
+					fprintf(stderr, "Delete-all completed, %.0f deletes/s\n",
+						rtnl_flush_rate(&xb.flush));
 				break;
 			}
 
-			if (rtnl_send_check(&rth, xb.buf, xb.offset) < 0) {
-				perror("Failed to send delete-all request\n");
+			if (rtnl_flush_commit(&xb.flush) < 0) {
+				perror("Failed to send delete-all request");
 				exit(1);
 			}
 			if (show_stats > 1)
 				fprintf(stderr, "Delete-all nlmsg count = %d\n", xb.nlmsg_count);
-
-			xb.offset = 0;
-			xb.nlmsg_count = 0;
 		}
+		rtnl_flush_close(&xb.flush);
 
 	} else {
-		struct xfrm_address_filter addrfilter = {
-			.saddr = filter.xsinfo.saddr,
-			.daddr = filter.xsinfo.id.daddr,
-			.family = filter.xsinfo.family,
-			.splen = filter.id_src_mask,
-			.dplen = filter.id_dst_mask,
-		};
 		struct {
 			struct nlmsghdr n;
 			char buf[NLMSG_BUF_SIZE];
@@ -1335,19 +1620,15 @@ static int xfrm_state_list_or_deleteall(int argc, char **argv, int deleteall)
 			.n.nlmsg_seq = rth.dump = ++rth.seq,
 		};
 
-		if (filter.xsinfo.id.proto)
-			addattr8(&req.n, sizeof(req), XFRMA_PROTO,
-				 filter.xsinfo.id.proto);
-		addattr_l(&req.n, sizeof(req), XFRMA_ADDRESS_FILTER,
-			  &addrfilter, sizeof(addrfilter));
-
+		xfrm_state_dump_req(&req.n, sizeof(req));
 		if (rtnl_send(&rth, (void *)&req, req.n.nlmsg_len) < 0) {
 			perror("Cannot send dump request");
 			exit(1);
 		}
 
-		rtnl_filter_t filter = nokeys ?
-				xfrm_state_print_nokeys : xfrm_state_print;
+		rtnl_filter_t filter = stats ? xfrm_state_print_stats :
+				       nokeys ? xfrm_state_print_nokeys :
+				       xfrm_state_print;
 		if (rtnl_dump_filter(&rth, filter, stdout) < 0) {
 			fprintf(stderr, "Dump terminated\n");
 			exit(1);
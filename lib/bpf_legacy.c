@@ -19,6 +19,7 @@
 #include <limits.h>
 #include <assert.h>
 #include <libgen.h>
+#include <time.h>
 
 #ifdef HAVE_ELF
 #include <libelf.h>
@@ -32,10 +33,18 @@
 #include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <signal.h>
+#include <linux/btf.h>
+#include <linux/perf_event.h>
 
 #include <arpa/inet.h>
 
 #include "utils.h"
+#include "rtnl_bulk.h"
 #include "json_print.h"
 #include "sha1.h"
 
@@ -115,10 +124,12 @@ const char *bpf_prog_to_default_section(enum bpf_prog_type type)
 
 #ifdef HAVE_ELF
 static int bpf_obj_open(const char *path, enum bpf_prog_type type,
-			const char *sec, __u32 ifindex, bool verbose);
+			const char *sec, __u32 ifindex, bool verbose,
+			bool share);
 #else
 static int bpf_obj_open(const char *path, enum bpf_prog_type type,
-			const char *sec, __u32 ifindex, bool verbose)
+			const char *sec, __u32 ifindex, bool verbose,
+			bool share)
 {
 	fprintf(stderr, "No ELF library support compiled in.\n");
 	errno = ENOSYS;
@@ -951,9 +962,14 @@ static int bpf_do_load(struct bpf_cfg_in *cfg)
 #ifdef HAVE_LIBBPF
 		return iproute2_load_libbpf(cfg);
 #endif
+		/* Exported maps and verifier logs are per load, as are
+		 * offloaded programs.
+		 */
 		cfg->prog_fd = bpf_obj_open(cfg->object, cfg->type,
 					    cfg->section, cfg->ifindex,
-					    cfg->verbose);
+					    cfg->verbose,
+					    !cfg->uds && !cfg->verbose &&
+					    !cfg->ifindex);
 		return cfg->prog_fd;
 	}
 	return 0;
@@ -1077,6 +1093,1007 @@ out_prog:
 	return ret;
 }
 
+#ifndef ENOTSUPP
+#define ENOTSUPP	524
+#endif
+
+#define BPF_LOAD_BATCH	8192
+
+struct bpf_map_loader {
+	struct rtnl_bulk bulk;		/* only file and line errors */
+	int		map_fd;
+	struct bpf_elf_map map;
+	__u32		count;
+	__u8		*keys;
+	__u8		*values;
+	unsigned int	*lines;		/* of the entries, hex files only */
+	bool		one_by_one;
+	unsigned long	loaded;
+};
+
+static int bpf_map_update_batch(int fd, const void *keys, const void *values,
+				__u32 *count, uint64_t flags)
+{
+	union bpf_attr attr = {};
+	int ret;
+
+	attr.batch.map_fd = fd;
+	attr.batch.keys = bpf_ptr_to_u64(keys);
+	attr.batch.values = bpf_ptr_to_u64(values);
+	attr.batch.count = *count;
+	attr.batch.elem_flags = flags;
+
+	ret = bpf(BPF_MAP_UPDATE_BATCH, &attr, sizeof(attr));
+	*count = attr.batch.count;
+	return ret;
+}
+
+static void bpf_map_loader_drop(struct bpf_map_loader *l)
+{
+	__u32 i;
+
+	/* the map holds its own references to the programs */
+	if (l->map.type == BPF_MAP_TYPE_PROG_ARRAY) {
+		for (i = 0; i < l->count; i++)
+			close(*(int *)(l->values + i * l->map.size_value));
+	}
+	l->count = 0;
+}
+
+/* Push the queued entries, as one batch where the kernel and map type
+ * support it and one update per entry otherwise.
+ */
+static int bpf_map_loader_flush(struct bpf_map_loader *l)
+{
+	const __u32 ksz = l->map.size_key, vsz = l->map.size_value;
+	__u32 i = 0, n;
+	int ret = 0;
+
+	while (!l->one_by_one && i < l->count) {
+		n = l->count - i;
+		ret = bpf_map_update_batch(l->map_fd, l->keys + i * ksz,
+					   l->values + i * vsz, &n, BPF_ANY);
+		i += n;
+		if (!ret)
+			continue;
+		if (errno != EINVAL && errno != ENOTSUPP &&
+		    errno != EOPNOTSUPP && errno != ENOSYS)
+			goto err;
+		/* older kernel or map type without batch ops */
+		l->one_by_one = true;
+	}
+
+	for (; i < l->count; i++) {
+		ret = bpf_map_update(l->map_fd, l->keys + i * ksz,
+				     l->values + i * vsz, BPF_ANY);
+		if (ret < 0)
+			goto err;
+	}
+	goto out;
+err:
+	if (l->lines)
+		fprintf(stderr, "%s:%u: Map update failed: %s\n",
+			l->bulk.file, l->lines[i], strerror(errno));
+	else
+		fprintf(stderr, "Map update of entry %lu failed: %s\n",
+			l->loaded + i + 1, strerror(errno));
+out:
+	l->loaded += i;
+	bpf_map_loader_drop(l);
+	return ret;
+}
+
+static int bpf_map_loader_add(struct bpf_map_loader *l)
+{
+	if (++l->count < BPF_LOAD_BATCH)
+		return 0;
+	return bpf_map_loader_flush(l);
+}
+
+/* Binary files are packed records of key_size then value_size bytes */
+static int bpf_map_load_bin(struct bpf_map_loader *l, const char *file)
+{
+	const __u32 ksz = l->map.size_key, vsz = l->map.size_value;
+	size_t rec = ksz + vsz, off;
+	struct stat st;
+	__u8 *data;
+	int fd, ret = 0;
+
+	if (l->map.type == BPF_MAP_TYPE_PROG_ARRAY) {
+		fprintf(stderr, "Program arrays take pinned programs, use a hex file!\n");
+		return -EINVAL;
+	}
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		ret = -errno;
+		fprintf(stderr, "Cannot open %s: %s\n", file, strerror(-ret));
+		goto out;
+	}
+	if (st.st_size % rec) {
+		fprintf(stderr, "%s is not made of %zu byte key/value records!\n",
+			file, rec);
+		ret = -EINVAL;
+		goto out;
+	}
+	if (!st.st_size)
+		goto out;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		ret = -errno;
+		fprintf(stderr, "Cannot map %s: %s\n", file, strerror(-ret));
+		goto out;
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	for (off = 0; off < st.st_size && !ret; off += rec) {
+		memcpy(l->keys + l->count * ksz, data + off, ksz);
+		memcpy(l->values + l->count * vsz, data + off + ksz, vsz);
+		ret = bpf_map_loader_add(l);
+	}
+	munmap(data, st.st_size);
+out:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+/* Hex files have one "KEY VALUE" line per entry, both as hex strings of
+ * key_size and value_size bytes; for program arrays VALUE is the path of
+ * a pinned program instead. Blank lines and text from a '#' on are
+ * skipped.
+ */
+static int bpf_map_load_hex(struct bpf_map_loader *l)
+{
+	const __u32 ksz = l->map.size_key, vsz = l->map.size_value;
+	bool progs = l->map.type == BPF_MAP_TYPE_PROG_ARRAY;
+	unsigned int lineno = 0;
+	char *line = NULL;
+	size_t len = 0;
+	int ret = 0;
+	FILE *fp;
+
+	l->lines = malloc(BPF_LOAD_BATCH * sizeof(*l->lines));
+	if (!l->lines)
+		return -ENOMEM;
+
+	fp = rtnl_bulk_open(&l->bulk);
+	if (!fp)
+		return errno ? -errno : -EINVAL;
+
+	while (!ret && getline(&line, &len, fp) != -1) {
+		__u8 *value = l->values + l->count * vsz;
+		char *tok[2];
+		int ntok;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, ARRAY_SIZE(tok));
+		if (ntok == 0)
+			continue;
+
+		if (ntok != 2 || strlen(tok[0]) != 2 * ksz ||
+		    hex2mem(tok[0], l->keys + l->count * ksz, ksz) < 0) {
+			ret = -EINVAL;
+		} else if (progs) {
+			int prog_fd = bpf_obj_get(tok[1], BPF_PROG_TYPE_UNSPEC);
+
+			if (prog_fd < 0) {
+				ret = -errno;
+				fprintf(stderr, "%s:%u: Couldn\'t retrieve pinned program \'%s\': %s\n",
+					l->bulk.file, lineno, tok[1],
+					strerror(-ret));
+				break;
+			}
+			memcpy(value, &prog_fd, sizeof(prog_fd));
+		} else if (strlen(tok[1]) != 2 * vsz ||
+			   hex2mem(tok[1], value, vsz) < 0) {
+			ret = -EINVAL;
+		}
+		if (ret) {
+			fprintf(stderr, "%s:%u: expected %u byte key and %u byte value in hex\n",
+				l->bulk.file, lineno, ksz, vsz);
+			break;
+		}
+		l->lines[l->count] = lineno;
+		ret = bpf_map_loader_add(l);
+	}
+
+	free(line);
+	rtnl_bulk_close(fp);
+	return ret;
+}
+
+int bpf_load_map(const char *map_path, const char *file, bool hex)
+{
+	struct bpf_map_loader l = { .bulk.file = file };
+	struct timespec start, end;
+	double elapsed;
+	int ret;
+
+	l.map_fd = bpf_obj_get(map_path, BPF_PROG_TYPE_UNSPEC);
+	if (l.map_fd < 0) {
+		fprintf(stderr, "Couldn\'t retrieve pinned map \'%s\': %s\n",
+			map_path, strerror(errno));
+		return l.map_fd;
+	}
+
+	ret = bpf_derive_elf_map_from_fdinfo(l.map_fd, &l.map, NULL);
+	if (ret < 0)
+		goto out;
+
+	switch (l.map.type) {
+	case BPF_MAP_TYPE_PERCPU_HASH:
+	case BPF_MAP_TYPE_PERCPU_ARRAY:
+	case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+		fprintf(stderr, "Per-CPU maps are not supported!\n");
+		ret = -EINVAL;
+		goto out;
+	case BPF_MAP_TYPE_PROG_ARRAY:
+		l.one_by_one = true;
+		break;
+	}
+
+	l.keys = malloc((size_t)BPF_LOAD_BATCH * l.map.size_key);
+	l.values = malloc((size_t)BPF_LOAD_BATCH * l.map.size_value);
+	if (!l.keys || !l.values) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = hex ? bpf_map_load_hex(&l) : bpf_map_load_bin(&l, file);
+	if (!ret && l.count)
+		ret = bpf_map_loader_flush(&l);
+	bpf_map_loader_drop(&l);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = end.tv_sec - start.tv_sec +
+		  (end.tv_nsec - start.tv_nsec) / 1e9;
+	if (!ret)
+		fprintf(stderr, "%lu entries loaded into %s in %.3fs (%.0f entries/s, %s)\n",
+			l.loaded, map_path, elapsed,
+			elapsed > 0 ? l.loaded / elapsed : 0.0,
+			l.one_by_one ? "one by one" : "batched");
+out:
+	free(l.keys);
+	free(l.values);
+	free(l.lines);
+	close(l.map_fd);
+	return ret;
+}
+
+/* "tc exec bpf debug MAP_FILE" consumes the records a program writes into
+ * a pinned BPF_MAP_TYPE_RINGBUF or BPF_MAP_TYPE_PERF_EVENT_ARRAY map,
+ * instead of the global text trace_pipe. The buffers are mapped and
+ * drained on every epoll wakeup, all records at once, before the consumer
+ * position is handed back to the kernel. Records are decoded with a type
+ * of the map's or a program's BTF, printed in hex, or written raw.
+ */
+#define BPF_DBG_PERF_PAGES	64	/* data pages per CPU, a power of 2 */
+#define BPF_DBG_EVENTS		64
+
+struct bpf_dbg_btf {
+	void		*raw;
+	const char	*strs;
+	__u32		str_len;
+	const struct btf_type **types;	/* by id, 0 is void */
+	__u32		ntypes;
+};
+
+struct bpf_dbg_cpu {
+	int		fd;
+	void		*base;
+};
+
+struct bpf_dbg {
+	int		map_fd;
+	struct bpf_map_info info;
+	bool		raw;
+	struct bpf_dbg_btf btf;
+	__u32		type_id;
+	__u32		type_size;
+	int		epfd;
+	/* ring buffer */
+	unsigned long	*cons_pos;
+	unsigned long	*prod_pos;
+	void		*data;
+	size_t		page_size;
+	/* perf event array */
+	struct bpf_dbg_cpu *cpus;
+	unsigned int	ncpus;
+	void		*bounce;
+	unsigned long long records, bytes, lost;
+};
+
+static volatile sig_atomic_t bpf_dbg_stop;
+
+static void bpf_dbg_sig(int sig)
+{
+	bpf_dbg_stop = 1;
+}
+
+static int bpf_obj_info_by_fd(int fd, void *info, __u32 *info_len)
+{
+	union bpf_attr attr = {};
+	int ret;
+
+	attr.info.bpf_fd = fd;
+	attr.info.info = bpf_ptr_to_u64(info);
+	attr.info.info_len = *info_len;
+
+	ret = bpf(BPF_OBJ_GET_INFO_BY_FD, &attr, sizeof(attr));
+	if (!ret)
+		*info_len = attr.info.info_len;
+	return ret;
+}
+
+static __u32 bpf_btf_type_extra(const struct btf_type *t)
+{
+	__u16 vlen = BTF_INFO_VLEN(t->info);
+
+	switch (BTF_INFO_KIND(t->info)) {
+	case BTF_KIND_INT:
+		return sizeof(__u32);
+	case BTF_KIND_ARRAY:
+		return sizeof(struct btf_array);
+	case BTF_KIND_STRUCT:
+	case BTF_KIND_UNION:
+		return vlen * sizeof(struct btf_member);
+	case BTF_KIND_ENUM:
+		return vlen * sizeof(struct btf_enum);
+	case BTF_KIND_FUNC_PROTO:
+		return vlen * sizeof(struct btf_param);
+	case BTF_KIND_VAR:
+		return sizeof(struct btf_var);
+	case BTF_KIND_DATASEC:
+		return vlen * sizeof(struct btf_var_secinfo);
+	case BTF_KIND_DECL_TAG:
+		return sizeof(struct btf_decl_tag);
+	case BTF_KIND_ENUM64:
+		return vlen * sizeof(struct btf_enum64);
+	default:
+		return 0;
+	}
+}
+
+static int bpf_dbg_btf_load(struct bpf_dbg_btf *btf, __u32 id)
+{
+	struct bpf_btf_info info = {};
+	__u32 len = sizeof(info), off, n;
+	const struct btf_header *hdr;
+	union bpf_attr attr = {};
+	const char *types;
+	int fd, ret = -1;
+
+	attr.btf_id = id;
+	fd = bpf(BPF_BTF_GET_FD_BY_ID, &attr, sizeof(attr));
+	if (fd < 0) {
+		fprintf(stderr, "Cannot get BTF %u: %s\n", id, strerror(errno));
+		return -1;
+	}
+	if (bpf_obj_info_by_fd(fd, &info, &len))
+		goto out;
+	btf->raw = malloc(info.btf_size);
+	if (!btf->raw)
+		goto out;
+	len = info.btf_size;
+	memset(&info, 0, sizeof(info));
+	info.btf = bpf_ptr_to_u64(btf->raw);
+	info.btf_size = len;
+	len = sizeof(info);
+	if (bpf_obj_info_by_fd(fd, &info, &len))
+		goto out;
+
+	hdr = btf->raw;
+	if (hdr->magic != BTF_MAGIC ||
+	    hdr->hdr_len + hdr->type_off + hdr->type_len > info.btf_size ||
+	    hdr->hdr_len + hdr->str_off + hdr->str_len > info.btf_size) {
+		fprintf(stderr, "BTF %u is not valid\n", id);
+		goto out;
+	}
+	types = (const char *)btf->raw + hdr->hdr_len + hdr->type_off;
+	btf->strs = (const char *)btf->raw + hdr->hdr_len + hdr->str_off;
+	btf->str_len = hdr->str_len;
+
+	/* count, then index the types */
+	for (n = 1, off = 0; off + sizeof(struct btf_type) <= hdr->type_len; n++)
+		off += sizeof(struct btf_type) +
+		       bpf_btf_type_extra((const void *)(types + off));
+	btf->types = calloc(n, sizeof(*btf->types));
+	if (!btf->types)
+		goto out;
+	for (n = 1, off = 0; off + sizeof(struct btf_type) <= hdr->type_len; n++) {
+		btf->types[n] = (const void *)(types + off);
+		off += sizeof(struct btf_type) +
+		       bpf_btf_type_extra(btf->types[n]);
+	}
+	btf->ntypes = n;
+	ret = 0;
+out:
+	if (ret)
+		fprintf(stderr, "Cannot read BTF %u\n", id);
+	close(fd);
+	return ret;
+}
+
+static const struct btf_type *bpf_dbg_btf_type(const struct bpf_dbg_btf *btf,
+					       __u32 id)
+{
+	return id && id < btf->ntypes ? btf->types[id] : NULL;
+}
+
+static const char *bpf_dbg_btf_str(const struct bpf_dbg_btf *btf, __u32 off)
+{
+	return off < btf->str_len ? btf->strs + off : "";
+}
+
+/* Skip typedefs and qualifiers */
+static __u32 bpf_dbg_btf_strip(const struct bpf_dbg_btf *btf, __u32 id)
+{
+	const struct btf_type *t;
+
+	while ((t = bpf_dbg_btf_type(btf, id))) {
+		switch (BTF_INFO_KIND(t->info)) {
+		case BTF_KIND_TYPEDEF:
+		case BTF_KIND_VOLATILE:
+		case BTF_KIND_CONST:
+		case BTF_KIND_RESTRICT:
+		case BTF_KIND_TYPE_TAG:
+			id = t->type;
+			continue;
+		}
+		break;
+	}
+	return id;
+}
+
+static __u32 bpf_dbg_btf_size(const struct bpf_dbg_btf *btf, __u32 id)
+{
+	const struct btf_type *t;
+	const struct btf_array *a;
+
+	t = bpf_dbg_btf_type(btf, bpf_dbg_btf_strip(btf, id));
+	if (!t)
+		return 0;
+
+	switch (BTF_INFO_KIND(t->info)) {
+	case BTF_KIND_PTR:
+		return sizeof(void *);
+	case BTF_KIND_ARRAY:
+		a = (const void *)(t + 1);
+		return a->nelems * bpf_dbg_btf_size(btf, a->type);
+	case BTF_KIND_INT:
+	case BTF_KIND_STRUCT:
+	case BTF_KIND_UNION:
+	case BTF_KIND_ENUM:
+	case BTF_KIND_ENUM64:
+	case BTF_KIND_FLOAT:
+		return t->size;
+	default:
+		return 0;
+	}
+}
+
+static __u32 bpf_dbg_btf_find(const struct bpf_dbg_btf *btf, const char *name)
+{
+	__u32 id;
+
+	for (id = 1; id < btf->ntypes; id++) {
+		const struct btf_type *t = btf->types[id];
+
+		switch (BTF_INFO_KIND(t->info)) {
+		case BTF_KIND_INT:
+		case BTF_KIND_STRUCT:
+		case BTF_KIND_UNION:
+		case BTF_KIND_TYPEDEF:
+		case BTF_KIND_ENUM:
+		case BTF_KIND_ENUM64:
+			if (!strcmp(bpf_dbg_btf_str(btf, t->name_off), name))
+				return id;
+		}
+	}
+	return 0;
+}
+
+static __u64 bpf_dbg_bits(const void *data, __u32 bit_off, __u32 bits)
+{
+	__u64 v = 0;
+
+	memcpy(&v, (const char *)data + bit_off / 8,
+	       (bit_off % 8 + bits + 7) / 8);
+	v >>= bit_off % 8;
+	if (bits < 64)
+		v &= (1ULL << bits) - 1;
+	return v;
+}
+
+static void bpf_dbg_print_type(const struct bpf_dbg_btf *btf, __u32 id,
+			       const char *name, const void *data,
+			       __u32 bit_off, __u32 bitfield);
+
+static void bpf_dbg_print_int(const struct btf_type *t, const char *name,
+			      const void *data, __u32 bit_off, __u32 bitfield)
+{
+	__u32 enc = *(const __u32 *)(t + 1);
+	__u32 bits = bitfield ? : BTF_INT_BITS(enc);
+	__u64 v;
+
+	if (bits > 64) {
+		print_string(PRINT_ANY, name, "%s", "<int128>");
+		return;
+	}
+	v = bpf_dbg_bits(data, bit_off + BTF_INT_OFFSET(enc), bits);
+
+	if (BTF_INT_ENCODING(enc) & BTF_INT_BOOL) {
+		print_bool(PRINT_ANY, name, "%s", v);
+	} else if (BTF_INT_ENCODING(enc) & BTF_INT_SIGNED) {
+		if (bits < 64 && v & (1ULL << (bits - 1)))
+			v |= ~0ULL << bits;
+		print_s64(PRINT_ANY, name, "%lld", v);
+	} else {
+		print_u64(PRINT_ANY, name, "%llu", v);
+	}
+}
+
+static bool bpf_dbg_btf_is_char(const struct bpf_dbg_btf *btf, __u32 id)
+{
+	const struct btf_type *t;
+
+	t = bpf_dbg_btf_type(btf, bpf_dbg_btf_strip(btf, id));
+	return t && BTF_INFO_KIND(t->info) == BTF_KIND_INT && t->size == 1 &&
+	       (BTF_INT_ENCODING(*(const __u32 *)(t + 1)) & BTF_INT_CHAR ||
+		!strcmp(bpf_dbg_btf_str(btf, t->name_off), "char"));
+}
+
+static void bpf_dbg_print_array(const struct bpf_dbg_btf *btf,
+				const struct btf_type *t, const char *name,
+				const void *data)
+{
+	const struct btf_array *a = (const void *)(t + 1);
+	__u32 i, size = bpf_dbg_btf_size(btf, a->type);
+
+	if (bpf_dbg_btf_is_char(btf, a->type)) {
+		char buf[256];
+
+		snprintf(buf, sizeof(buf), "%.*s",
+			 (int)MIN(a->nelems, sizeof(buf) - 1),
+			 (const char *)data);
+		print_string(PRINT_ANY, name, "\"%s\"", buf);
+		return;
+	}
+
+	open_json_array(PRINT_JSON, name);
+	print_string(PRINT_FP, NULL, "%s", "[");
+	for (i = 0; i < a->nelems; i++) {
+		if (i)
+			print_string(PRINT_FP, NULL, "%s", ",");
+		bpf_dbg_print_type(btf, a->type, NULL,
+				   (const char *)data + i * size, 0, 0);
+	}
+	print_string(PRINT_FP, NULL, "%s", "]");
+	close_json_array(PRINT_JSON, NULL);
+}
+
+static void bpf_dbg_print_struct(const struct bpf_dbg_btf *btf,
+				 const struct btf_type *t, const char *name,
+				 const void *data)
+{
+	const struct btf_member *m = (const void *)(t + 1);
+	bool kflag = BTF_INFO_KFLAG(t->info);
+	__u16 i, vlen = BTF_INFO_VLEN(t->info);
+
+	open_json_object(name);
+	print_string(PRINT_FP, NULL, "%s", "{");
+	for (i = 0; i < vlen; i++, m++) {
+		const char *mname = bpf_dbg_btf_str(btf, m->name_off);
+		__u32 off = kflag ? BTF_MEMBER_BIT_OFFSET(m->offset) : m->offset;
+		__u32 bitfield = kflag ? BTF_MEMBER_BITFIELD_SIZE(m->offset) : 0;
+
+		if (i)
+			print_string(PRINT_FP, NULL, "%s", ",");
+		if (*mname)
+			print_string(PRINT_FP, NULL, "%s=", mname);
+		bpf_dbg_print_type(btf, m->type, *mname ? mname : NULL,
+				   (const char *)data + off / 8, off % 8,
+				   bitfield);
+	}
+	print_string(PRINT_FP, NULL, "%s", "}");
+	close_json_object();
+}
+
+static void bpf_dbg_print_enum(const struct bpf_dbg_btf *btf,
+			       const struct btf_type *t, const char *name,
+			       const void *data)
+{
+	__u16 i, vlen = BTF_INFO_VLEN(t->info);
+	__s64 v = 0;
+
+	if (t->size == 8)
+		memcpy(&v, data, 8);
+	else if (t->size == 4)
+		v = *(const __s32 *)data;
+	else if (t->size == 2)
+		v = *(const __s16 *)data;
+	else
+		v = *(const __s8 *)data;
+
+	for (i = 0; i < vlen; i++) {
+		const char *ename;
+		__s64 ev;
+
+		if (BTF_INFO_KIND(t->info) == BTF_KIND_ENUM64) {
+			const struct btf_enum64 *e = (const void *)(t + 1);
+
+			ev = (__s64)((__u64)e[i].val_hi32 << 32 | e[i].val_lo32);
+			ename = bpf_dbg_btf_str(btf, e[i].name_off);
+		} else {
+			const struct btf_enum *e = (const void *)(t + 1);
+
+			ev = e[i].val;
+			ename = bpf_dbg_btf_str(btf, e[i].name_off);
+		}
+		if (ev == v) {
+			print_string(PRINT_ANY, name, "%s", ename);
+			return;
+		}
+	}
+	print_s64(PRINT_ANY, name, "%lld", v);
+}
+
+static void bpf_dbg_print_type(const struct bpf_dbg_btf *btf, __u32 id,
+			       const char *name, const void *data,
+			       __u32 bit_off, __u32 bitfield)
+{
+	const struct btf_type *t;
+
+	t = bpf_dbg_btf_type(btf, bpf_dbg_btf_strip(btf, id));
+	if (!t) {
+		print_null(PRINT_ANY, name, "%s", "?");
+		return;
+	}
+
+	switch (BTF_INFO_KIND(t->info)) {
+	case BTF_KIND_INT:
+		bpf_dbg_print_int(t, name, data, bit_off, bitfield);
+		break;
+	case BTF_KIND_PTR:
+		print_0xhex(PRINT_ANY, name, "%#llx",
+			    bpf_dbg_bits(data, 0, sizeof(void *) * 8));
+		break;
+	case BTF_KIND_ARRAY:
+		bpf_dbg_print_array(btf, t, name, data);
+		break;
+	case BTF_KIND_STRUCT:
+	case BTF_KIND_UNION:
+		bpf_dbg_print_struct(btf, t, name, data);
+		break;
+	case BTF_KIND_ENUM:
+	case BTF_KIND_ENUM64:
+		bpf_dbg_print_enum(btf, t, name, data);
+		break;
+	case BTF_KIND_FLOAT:
+		if (t->size == sizeof(double))
+			print_float(PRINT_ANY, name, "%g", *(const double *)data);
+		else if (t->size == sizeof(float))
+			print_float(PRINT_ANY, name, "%g", *(const float *)data);
+		else
+			print_null(PRINT_ANY, name, "%s", "?");
+		break;
+	default:
+		print_null(PRINT_ANY, name, "%s", "?");
+	}
+}
+
+static void bpf_dbg_record(struct bpf_dbg *d, int cpu, const void *data,
+			   __u32 size)
+{
+	d->records++;
+	d->bytes += size;
+
+	if (d->raw) {
+		if (fwrite(&size, sizeof(size), 1, stdout) != 1 ||
+		    fwrite(data, 1, size, stdout) != size)
+			bpf_dbg_stop = 1;
+		return;
+	}
+
+	open_json_object(NULL);
+	if (cpu >= 0)
+		print_int(PRINT_ANY, "cpu", "cpu %d ", cpu);
+	print_uint(PRINT_ANY, "size", "size %u: ", size);
+	if (d->type_id && size >= d->type_size) {
+		bpf_dbg_print_type(&d->btf, d->type_id, "data", data, 0, 0);
+	} else {
+		char *hex = malloc(size * 2 + 1);
+		__u32 i;
+
+		if (hex) {
+			for (i = 0; i < size; i++)
+				sprintf(hex + 2 * i, "%02x",
+					((const __u8 *)data)[i]);
+			hex[2 * size] = '\0';
+			print_string(PRINT_ANY, "data", "%s", hex);
+			free(hex);
+		}
+	}
+	close_json_object();
+	print_string(PRINT_FP, NULL, "%s", "\n");
+}
+
+static int bpf_dbg_ringbuf_open(struct bpf_dbg *d)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	void *prod;
+
+	d->cons_pos = mmap(NULL, d->page_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED, d->map_fd, 0);
+	if (d->cons_pos == MAP_FAILED)
+		goto err;
+	/* the data pages are mapped twice in a row, records never wrap */
+	prod = mmap(NULL, d->page_size + 2 * (size_t)d->info.max_entries,
+		    PROT_READ, MAP_SHARED, d->map_fd, d->page_size);
+	if (prod == MAP_FAILED)
+		goto err;
+	d->prod_pos = prod;
+	d->data = (char *)prod + d->page_size;
+
+	if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, d->map_fd, &ev))
+		goto err;
+	return 0;
+err:
+	fprintf(stderr, "Cannot map the ring buffer: %s\n", strerror(errno));
+	return -1;
+}
+
+static void bpf_dbg_ringbuf_drain(struct bpf_dbg *d)
+{
+	unsigned long mask = d->info.max_entries - 1;
+	unsigned long cons, prod;
+
+	cons = __atomic_load_n(d->cons_pos, __ATOMIC_ACQUIRE);
+	for (;;) {
+		prod = __atomic_load_n(d->prod_pos, __ATOMIC_ACQUIRE);
+		if (cons >= prod)
+			break;
+
+		while (cons < prod) {
+			__u32 *hdr = (__u32 *)((char *)d->data + (cons & mask));
+			__u32 len = __atomic_load_n(hdr, __ATOMIC_ACQUIRE);
+
+			if (len & BPF_RINGBUF_BUSY_BIT)
+				break;
+			cons += (((len & ~BPF_RINGBUF_DISCARD_BIT) +
+				  BPF_RINGBUF_HDR_SZ) + 7) & ~7UL;
+			if (!(len & BPF_RINGBUF_DISCARD_BIT))
+				bpf_dbg_record(d, -1, hdr + 2, len);
+		}
+		/* hand the space back once per batch, not per record */
+		__atomic_store_n(d->cons_pos, cons, __ATOMIC_RELEASE);
+		if (cons < prod)
+			break;	/* a record still being written */
+	}
+}
+
+static int bpf_dbg_perf_open(struct bpf_dbg *d)
+{
+	struct perf_event_attr attr = {
+		.size		= sizeof(attr),
+		.type		= PERF_TYPE_SOFTWARE,
+		.config		= PERF_COUNT_SW_BPF_OUTPUT,
+		.sample_type	= PERF_SAMPLE_RAW,
+		.sample_period	= 1,
+		.wakeup_events	= 1,
+	};
+	size_t size = (BPF_DBG_PERF_PAGES + 1) * d->page_size;
+	unsigned int i;
+
+	d->ncpus = MIN((unsigned int)get_nprocs_conf(), d->info.max_entries);
+	d->cpus = calloc(d->ncpus, sizeof(*d->cpus));
+	d->bounce = malloc(BPF_DBG_PERF_PAGES * d->page_size);
+	if (!d->cpus || !d->bounce)
+		return -1;
+
+	for (i = 0; i < d->ncpus; i++) {
+		struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+		struct bpf_dbg_cpu *c = &d->cpus[i];
+
+		c->fd = syscall(__NR_perf_event_open, &attr, -1, i, -1,
+				PERF_FLAG_FD_CLOEXEC);
+		if (c->fd < 0) {
+			/* offline CPUs have no buffer */
+			if (errno == ENODEV)
+				continue;
+			goto err;
+		}
+		c->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			       c->fd, 0);
+		if (c->base == MAP_FAILED) {
+			c->base = NULL;
+			goto err;
+		}
+		if (bpf_map_update(d->map_fd, &i, &c->fd, BPF_ANY) ||
+		    ioctl(c->fd, PERF_EVENT_IOC_ENABLE, 0) ||
+		    epoll_ctl(d->epfd, EPOLL_CTL_ADD, c->fd, &ev))
+			goto err;
+	}
+	return 0;
+err:
+	fprintf(stderr, "Cannot set up the buffer of CPU %u: %s\n", i,
+		strerror(errno));
+	return -1;
+}
+
+static void bpf_dbg_perf_drain(struct bpf_dbg *d, unsigned int cpu)
+{
+	struct perf_event_mmap_page *meta = d->cpus[cpu].base;
+	size_t size = BPF_DBG_PERF_PAGES * d->page_size;
+	char *data = (char *)meta + d->page_size;
+	__u64 head, tail = meta->data_tail;
+
+	head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+	while (tail < head) {
+		struct perf_event_header *hdr;
+		size_t off = tail % size;
+
+		hdr = (struct perf_event_header *)(data + off);
+		if (off + hdr->size > size) {
+			/* wraps, put it together */
+			memcpy(d->bounce, data + off, size - off);
+			memcpy((char *)d->bounce + size - off, data,
+			       hdr->size - (size - off));
+			hdr = d->bounce;
+		}
+
+		if (hdr->type == PERF_RECORD_SAMPLE) {
+			__u32 *raw = (__u32 *)(hdr + 1);
+
+			bpf_dbg_record(d, cpu, raw + 1, *raw);
+		} else if (hdr->type == PERF_RECORD_LOST) {
+			__u64 *lost = (__u64 *)(hdr + 1);
+
+			d->lost += lost[1];
+		}
+		tail += hdr->size;
+	}
+	__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+static void bpf_dbg_close(struct bpf_dbg *d)
+{
+	unsigned int i;
+
+	for (i = 0; d->cpus && i < d->ncpus; i++) {
+		if (d->cpus[i].base)
+			munmap(d->cpus[i].base,
+			       (BPF_DBG_PERF_PAGES + 1) * d->page_size);
+		if (d->cpus[i].fd > 0)
+			close(d->cpus[i].fd);
+	}
+	free(d->cpus);
+	free(d->bounce);
+	if (d->cons_pos && d->cons_pos != MAP_FAILED)
+		munmap(d->cons_pos, d->page_size);
+	if (d->prod_pos)
+		munmap(d->prod_pos,
+		       d->page_size + 2 * (size_t)d->info.max_entries);
+	free(d->btf.types);
+	free(d->btf.raw);
+	if (d->epfd >= 0)
+		close(d->epfd);
+	close(d->map_fd);
+}
+
+int bpf_dbg_map(const char *map_path, const char *type, const char *prog_path,
+		bool raw)
+{
+	struct sigaction sa = { .sa_handler = bpf_dbg_sig };
+	struct epoll_event ev[BPF_DBG_EVENTS];
+	struct bpf_dbg d = {
+		.raw = raw,
+		.epfd = -1,
+		.page_size = sysconf(_SC_PAGESIZE),
+	};
+	__u32 len = sizeof(d.info), btf_id;
+	int i, n, ret = -1;
+
+	d.map_fd = bpf_obj_get(map_path, BPF_PROG_TYPE_UNSPEC);
+	if (d.map_fd < 0) {
+		fprintf(stderr, "Couldn\'t retrieve pinned map \'%s\': %s\n",
+			map_path, strerror(errno));
+		return -1;
+	}
+	if (bpf_obj_info_by_fd(d.map_fd, &d.info, &len)) {
+		fprintf(stderr, "Cannot get map info: %s\n", strerror(errno));
+		close(d.map_fd);
+		return -1;
+	}
+	if (d.info.type != BPF_MAP_TYPE_RINGBUF &&
+	    d.info.type != BPF_MAP_TYPE_PERF_EVENT_ARRAY) {
+		fprintf(stderr, "\'%s\' is not a ring buffer or perf event array map\n",
+			map_path);
+		close(d.map_fd);
+		return -1;
+	}
+
+	d.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (d.epfd < 0)
+		goto out;
+
+	if (type) {
+		btf_id = d.info.btf_id;
+		if (prog_path) {
+			struct bpf_prog_info pinfo = {};
+			int prog_fd;
+
+			prog_fd = bpf_obj_get(prog_path, BPF_PROG_TYPE_UNSPEC);
+			if (prog_fd < 0) {
+				fprintf(stderr, "Couldn\'t retrieve pinned program \'%s\': %s\n",
+					prog_path, strerror(errno));
+				goto out;
+			}
+			len = sizeof(pinfo);
+			if (bpf_prog_info_by_fd(prog_fd, &pinfo, &len) == 0)
+				btf_id = pinfo.btf_id;
+			close(prog_fd);
+		}
+		if (!btf_id) {
+			fprintf(stderr, "No BTF to find \"%s\" in, try \"prog PROG_FILE\"\n",
+				type);
+			goto out;
+		}
+		if (bpf_dbg_btf_load(&d.btf, btf_id))
+			goto out;
+		d.type_id = bpf_dbg_btf_find(&d.btf, type);
+		if (!d.type_id) {
+			fprintf(stderr, "No type \"%s\" in BTF %u\n", type,
+				btf_id);
+			goto out;
+		}
+		d.type_size = bpf_dbg_btf_size(&d.btf, d.type_id);
+	}
+
+	if (d.info.type == BPF_MAP_TYPE_RINGBUF)
+		ret = bpf_dbg_ringbuf_open(&d);
+	else
+		ret = bpf_dbg_perf_open(&d);
+	if (ret)
+		goto out;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGPIPE, &sa, NULL);
+
+	fprintf(stderr, "Running! Hang up with ^C!\n\n");
+	if (!raw)
+		new_json_obj(json);
+	while (!bpf_dbg_stop) {
+		n = epoll_wait(d.epfd, ev, BPF_DBG_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			ret = -1;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (d.info.type == BPF_MAP_TYPE_RINGBUF)
+				bpf_dbg_ringbuf_drain(&d);
+			else
+				bpf_dbg_perf_drain(&d, ev[i].data.u32);
+		}
+		fflush(stdout);
+	}
+	if (!raw)
+		delete_json_obj();
+	fflush(stdout);
+	fprintf(stderr, "%llu records, %llu bytes, %llu lost\n",
+		d.records, d.bytes, d.lost);
+out:
+	bpf_dbg_close(&d);
+	return ret;
+}
+
 int bpf_prog_attach_fd(int prog_fd, int target_fd, enum bpf_attach_type type)
 {
 	union bpf_attr attr = {};
@@ -1098,9 +2115,46 @@ int bpf_prog_detach_fd(int target_fd, enum bpf_attach_type type)
 	return bpf(BPF_PROG_DETACH, &attr, sizeof(attr));
 }
 
-int bpf_prog_load_dev(enum bpf_prog_type type, const struct bpf_insn *insns,
-		      size_t size_insns, const char *license, __u32 ifindex,
-		      char *log, size_t size_log, bool verbose)
+int bpf_prog_query_fd(int target_fd, enum bpf_attach_type type,
+		      __u32 *prog_ids, __u32 *prog_cnt)
+{
+	union bpf_attr attr = {};
+	int ret;
+
+	attr.query.target_fd = target_fd;
+	attr.query.attach_type = type;
+	attr.query.prog_ids = bpf_ptr_to_u64(prog_ids);
+	attr.query.prog_cnt = *prog_cnt;
+
+	ret = bpf(BPF_PROG_QUERY, &attr, sizeof(attr));
+	*prog_cnt = attr.query.prog_cnt;
+	return ret;
+}
+
+int bpf_prog_name_by_id(uint32_t id, char *name, size_t len)
+{
+	struct bpf_prog_info info = {};
+	uint32_t info_len = sizeof(info);
+	int fd, ret;
+
+	fd = bpf_prog_fd_by_id(id);
+	if (fd < 0)
+		return fd;
+
+	ret = bpf_prog_info_by_fd(fd, &info, &info_len);
+	close(fd);
+	if (ret)
+		return ret;
+
+	strlcpy(name, info.name, len);
+	return 0;
+}
+
+static int __bpf_prog_load(enum bpf_prog_type type,
+			   const struct bpf_insn *insns, size_t size_insns,
+			   const char *license, const char *name,
+			   __u32 ifindex, char *log, size_t size_log,
+			   bool verbose)
 {
 	union bpf_attr attr = {};
 
@@ -1109,6 +2163,8 @@ int bpf_prog_load_dev(enum bpf_prog_type type, const struct bpf_insn *insns,
 	attr.insn_cnt = size_insns / sizeof(struct bpf_insn);
 	attr.license = bpf_ptr_to_u64(license);
 	attr.prog_ifindex = ifindex;
+	if (name)
+		strlcpy(attr.prog_name, name, sizeof(attr.prog_name));
 
 	if (size_log > 0) {
 		attr.log_buf = bpf_ptr_to_u64(log);
@@ -1121,6 +2177,24 @@ int bpf_prog_load_dev(enum bpf_prog_type type, const struct bpf_insn *insns,
 	return bpf(BPF_PROG_LOAD, &attr, sizeof(attr));
 }
 
+int bpf_prog_load_dev(enum bpf_prog_type type, const struct bpf_insn *insns,
+		      size_t size_insns, const char *license, __u32 ifindex,
+		      char *log, size_t size_log, bool verbose)
+{
+	return __bpf_prog_load(type, insns, size_insns, license, NULL,
+			       ifindex, log, size_log, verbose);
+}
+
+/* Named programs need Linux 4.15 */
+int bpf_program_load_name(enum bpf_prog_type type,
+			  const struct bpf_insn *insns, size_t size_insns,
+			  const char *license, const char *name, char *log,
+			  size_t size_log, bool verbose)
+{
+	return __bpf_prog_load(type, insns, size_insns, license, name, 0,
+			       log, size_log, verbose);
+}
+
 int bpf_program_load(enum bpf_prog_type type, const struct bpf_insn *insns,
 		     size_t size_insns, const char *license, char *log,
 		     size_t size_log, bool verbose)
@@ -1155,8 +2229,34 @@ struct bpf_btf {
 	int			types_num;
 };
 
+/* A program loaded from an object whose maps are all pinned; loading
+ * the section again would give an identical program, so it is shared.
+ */
+struct bpf_elf_obj_prog {
+	struct bpf_elf_obj_prog	*next;
+	enum bpf_prog_type	type;
+	char			*section;
+	int			fd;
+};
+
+/* An object file mapped, hashed and parsed once per process, e.g. for
+ * a batch attaching it to many hooks. libelf works on the private
+ * mapping, so section data is read in place rather than copied.
+ */
+struct bpf_elf_obj {
+	struct bpf_elf_obj	*next;
+	struct stat		st;
+	char			uid[64];
+	int			fd;
+	void			*image;
+	size_t			size;
+	Elf			*elf;
+	struct bpf_elf_obj_prog	*progs;
+};
+
 struct bpf_elf_ctx {
 	struct bpf_config	cfg;
+	struct bpf_elf_obj	*obj;
 	Elf			*elf_fd;
 	GElf_Ehdr		elf_hdr;
 	Elf_Data		*sym_tab;
@@ -1308,28 +2408,141 @@ static int bpf_obj_pin(int fd, const char *pathname)
 	return bpf(BPF_OBJ_PIN, &attr, sizeof(attr));
 }
 
-static int bpf_obj_hash(int fd, const char *object, __u8 out[SHA1_DIGEST_SIZE])
+static struct bpf_elf_obj *bpf_elf_objs;
+
+static bool bpf_elf_obj_unchanged(const struct bpf_elf_obj *obj,
+				  const struct stat *st)
+{
+	return obj->st.st_dev == st->st_dev &&
+	       obj->st.st_ino == st->st_ino &&
+	       obj->st.st_size == st->st_size &&
+	       obj->st.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+	       obj->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static int bpf_elf_obj_get(const char *object, struct bpf_elf_obj **objp)
 {
-	struct stat stbuff;
-	void *data;
+	__u8 tmp[SHA1_DIGEST_SIZE];
+	struct bpf_elf_obj *obj;
+	char uid[64];
+	struct stat st;
+	void *image;
+	int fd, ret;
 
-	if (fstat(fd, &stbuff) < 0) {
+	fd = open(object, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error opening object %s: %s\n", object,
+			strerror(errno));
+		return fd;
+	}
+	if (fstat(fd, &st) < 0) {
 		fprintf(stderr, "Error doing fstat: %s\n", strerror(errno));
-		return -1;
+		ret = -1;
+		goto out_fd;
+	}
+
+	/* seen before and not rewritten since, no need to hash it again */
+	for (obj = bpf_elf_objs; obj; obj = obj->next) {
+		if (bpf_elf_obj_unchanged(obj, &st))
+			goto found;
 	}
-	if ((size_t)stbuff.st_size != stbuff.st_size) {
+
+	if ((size_t)st.st_size != st.st_size) {
 		fprintf(stderr, "Object %s is too big\n", object);
-		return -EFBIG;
+		ret = -EFBIG;
+		goto out_fd;
 	}
-	data = mmap(NULL, stbuff.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (data == MAP_FAILED) {
+	/* writable as libelf may convert foreign byte order in place */
+	image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		     fd, 0);
+	if (image == MAP_FAILED) {
 		fprintf(stderr, "Error mapping object %s: %s\n", object,
 			strerror(errno));
-		return -1;
+		ret = -1;
+		goto out_fd;
 	}
-	sha1(data, stbuff.st_size, out);
-	munmap(data, stbuff.st_size);
+	sha1(image, st.st_size, tmp);
+	hexstring_n2a(tmp, sizeof(tmp), uid, sizeof(uid));
+
+	for (obj = bpf_elf_objs; obj; obj = obj->next) {
+		if (!strcmp(obj->uid, uid)) {
+			munmap(image, st.st_size);
+			goto found;
+		}
+	}
+
+	obj = calloc(1, sizeof(*obj));
+	if (!obj) {
+		ret = -ENOMEM;
+		goto out_map;
+	}
+
+	obj->elf = elf_memory(image, st.st_size);
+	if (!obj->elf || elf_kind(obj->elf) != ELF_K_ELF) {
+		if (obj->elf)
+			elf_end(obj->elf);
+		free(obj);
+		ret = -EINVAL;
+		goto out_map;
+	}
+
+	obj->st = st;
+	strlcpy(obj->uid, uid, sizeof(obj->uid));
+	obj->fd = fd;
+	obj->image = image;
+	obj->size = st.st_size;
+	obj->next = bpf_elf_objs;
+	bpf_elf_objs = obj;
+
+	*objp = obj;
 	return 0;
+found:
+	close(fd);
+	*objp = obj;
+	return 0;
+out_map:
+	munmap(image, st.st_size);
+out_fd:
+	close(fd);
+	return ret;
+}
+
+static int bpf_elf_obj_prog_get(const struct bpf_elf_obj *obj,
+				enum bpf_prog_type type, const char *section)
+{
+	const struct bpf_elf_obj_prog *prog;
+
+	for (prog = obj->progs; prog; prog = prog->next) {
+		if (prog->type == type && !strcmp(prog->section, section))
+			return dup(prog->fd);
+	}
+
+	return -1;
+}
+
+static void bpf_elf_obj_prog_add(struct bpf_elf_obj *obj,
+				 enum bpf_prog_type type, const char *section,
+				 int fd)
+{
+	struct bpf_elf_obj_prog *prog;
+
+	prog = calloc(1, sizeof(*prog));
+	if (!prog)
+		return;
+
+	prog->section = strdup(section);
+	prog->fd = dup(fd);
+	if (!prog->section || prog->fd < 0) {
+		if (prog->fd >= 0)
+			close(prog->fd);
+		free(prog->section);
+		free(prog);
+		return;
+	}
+
+	prog->type = type;
+	prog->next = obj->progs;
+	obj->progs = prog;
 }
 
 static void bpf_init_env(void)
@@ -2819,7 +4032,6 @@ static int bpf_elf_ctx_init(struct bpf_elf_ctx *ctx, const char *pathname,
 			    enum bpf_prog_type type, __u32 ifindex,
 			    bool verbose)
 {
-	__u8 tmp[SHA1_DIGEST_SIZE];
 	int ret;
 
 	if (elf_version(EV_CURRENT) == EV_NONE)
@@ -2834,45 +4046,26 @@ static int bpf_elf_ctx_init(struct bpf_elf_ctx *ctx, const char *pathname,
 	ctx->type    = type;
 	ctx->ifindex = ifindex;
 
-	ctx->obj_fd = open(pathname, O_RDONLY);
-	if (ctx->obj_fd < 0) {
-		fprintf(stderr, "Error opening object %s: %s\n", pathname,
-			strerror(errno));
-		return ctx->obj_fd;
-	}
-
-	ret = bpf_obj_hash(ctx->obj_fd, pathname, tmp);
-	if (ret)
-		goto out_fd;
-	hexstring_n2a(tmp, sizeof(tmp), ctx->obj_uid, sizeof(ctx->obj_uid));
+	ret = bpf_elf_obj_get(pathname, &ctx->obj);
+	if (ret < 0)
+		return ret;
 
-	ctx->elf_fd = elf_begin(ctx->obj_fd, ELF_C_READ, NULL);
-	if (!ctx->elf_fd) {
-		ret = -EINVAL;
-		goto out_fd;
-	}
-
-	if (elf_kind(ctx->elf_fd) != ELF_K_ELF) {
-		ret = -EINVAL;
-		goto out_fd;
-	}
+	ctx->obj_fd = ctx->obj->fd;
+	ctx->elf_fd = ctx->obj->elf;
+	strlcpy(ctx->obj_uid, ctx->obj->uid, sizeof(ctx->obj_uid));
 
 	if (gelf_getehdr(ctx->elf_fd, &ctx->elf_hdr) !=
-	    &ctx->elf_hdr) {
-		ret = -EIO;
-		goto out_elf;
-	}
+	    &ctx->elf_hdr)
+		return -EIO;
 
 	ret = bpf_elf_check_ehdr(ctx);
 	if (ret < 0)
-		goto out_elf;
+		return ret;
 
 	ctx->sec_done = calloc(ctx->elf_hdr.e_shnum,
 			       sizeof(*(ctx->sec_done)));
-	if (!ctx->sec_done) {
-		ret = -ENOMEM;
-		goto out_elf;
-	}
+	if (!ctx->sec_done)
+		return -ENOMEM;
 
 	if (ctx->verbose && bpf_log_realloc(ctx)) {
 		ret = -ENOMEM;
@@ -2887,10 +4080,6 @@ static int bpf_elf_ctx_init(struct bpf_elf_ctx *ctx, const char *pathname,
 	return 0;
 out_free:
 	free(ctx->sec_done);
-out_elf:
-	elf_end(ctx->elf_fd);
-out_fd:
-	close(ctx->obj_fd);
 	return ret;
 }
 
@@ -2931,15 +4120,25 @@ static void bpf_elf_ctx_destroy(struct bpf_elf_ctx *ctx, bool failure)
 	free(ctx->prog_text.insns);
 	free(ctx->sec_done);
 	free(ctx->log);
+}
 
-	elf_end(ctx->elf_fd);
-	close(ctx->obj_fd);
+static bool bpf_elf_ctx_shareable(const struct bpf_elf_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->map_num; i++) {
+		if (bpf_no_pinning(ctx, ctx->maps[i].pinning))
+			return false;
+	}
+
+	return true;
 }
 
 static struct bpf_elf_ctx __ctx;
 
 static int bpf_obj_open(const char *pathname, enum bpf_prog_type type,
-			const char *section, __u32 ifindex, bool verbose)
+			const char *section, __u32 ifindex, bool verbose,
+			bool share)
 {
 	struct bpf_elf_ctx *ctx = &__ctx;
 	int fd = 0, ret;
@@ -2950,6 +4149,15 @@ static int bpf_obj_open(const char *pathname, enum bpf_prog_type type,
 		return ret;
 	}
 
+	if (share) {
+		fd = bpf_elf_obj_prog_get(ctx->obj, type, section);
+		if (fd >= 0) {
+			bpf_elf_ctx_destroy(ctx, false);
+			return fd;
+		}
+		fd = 0;
+	}
+
 	ret = bpf_fetch_ancillary(ctx, strcmp(section, ".text"));
 	if (ret < 0) {
 		fprintf(stderr, "Error fetching ELF ancillary data!\n");
@@ -2966,6 +4174,8 @@ static int bpf_obj_open(const char *pathname, enum bpf_prog_type type,
 	ret = bpf_fill_prog_arrays(ctx);
 	if (ret < 0)
 		fprintf(stderr, "Error filling program arrays!\n");
+	else if (share && bpf_elf_ctx_shareable(ctx))
+		bpf_elf_obj_prog_add(ctx->obj, type, section, fd);
 out:
 	bpf_elf_ctx_destroy(ctx, ret < 0);
 	if (ret < 0) {
@@ -15,6 +15,8 @@
 #include <fcntl.h>
 #include <limits.h>
 
+#include <sys/stat.h>
+
 #include <libelf.h>
 #include <gelf.h>
 
@@ -270,6 +272,108 @@ static bool find_prog_to_attach(struct bpf_program *prog,
 		return !strcmp(get_bpf_program__section_name(prog), section);
 }
 
+/* Programs loaded by this process from objects whose maps are all pinned
+ * or read only. Loading such a section again would give an identical
+ * program, so e.g. a batch attaching one object to many devices has it
+ * verified once. The pin root follows from the program type.
+ */
+struct bpf_prog_cache {
+	struct bpf_prog_cache	*next;
+	char			*object;
+	char			*section;
+	char			*prog_name;
+	enum bpf_prog_type	type;
+	struct stat		st;
+	int			fd;
+};
+
+static struct bpf_prog_cache *bpf_prog_cache;
+
+static bool bpf_prog_cache_match(const struct bpf_prog_cache *c,
+				 const struct bpf_cfg_in *cfg,
+				 const struct stat *st)
+{
+	return c->type == cfg->type &&
+	       c->st.st_dev == st->st_dev && c->st.st_ino == st->st_ino &&
+	       c->st.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+	       c->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec &&
+	       !strcmp(c->object, cfg->object) &&
+	       !strcmp(c->section, cfg->section ? : "") &&
+	       !strcmp(c->prog_name, cfg->prog_name ? : "");
+}
+
+static int bpf_prog_cache_get(const struct bpf_cfg_in *cfg)
+{
+	const struct bpf_prog_cache *c;
+	struct stat st;
+
+	if (stat(cfg->object, &st) < 0)
+		return -1;
+
+	for (c = bpf_prog_cache; c; c = c->next) {
+		if (bpf_prog_cache_match(c, cfg, &st))
+			return fcntl(c->fd, F_DUPFD_CLOEXEC, 1);
+	}
+
+	return -1;
+}
+
+static void bpf_prog_cache_add(const struct bpf_cfg_in *cfg, int fd)
+{
+	struct bpf_prog_cache *c;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return;
+
+	if (stat(cfg->object, &c->st) < 0)
+		goto err;
+
+	c->object = strdup(cfg->object);
+	c->section = strdup(cfg->section ? : "");
+	c->prog_name = strdup(cfg->prog_name ? : "");
+	c->fd = fcntl(fd, F_DUPFD_CLOEXEC, 1);
+	if (!c->object || !c->section || !c->prog_name || c->fd < 0)
+		goto err;
+
+	c->type = cfg->type;
+	c->next = bpf_prog_cache;
+	bpf_prog_cache = c;
+	return;
+err:
+	if (c->fd > 0)
+		close(c->fd);
+	free(c->object);
+	free(c->section);
+	free(c->prog_name);
+	free(c);
+}
+
+/* Maps private to this load, e.g. unpinned ones or .data/.bss, would
+ * be shared by every user of a cached program.
+ */
+static bool bpf_object_shareable(struct bpf_object *obj)
+{
+	struct bpf_map *map;
+
+	bpf_object__for_each_map(map, obj) {
+		if (bpf_map__is_pinned(map))
+			continue;
+		if (bpf_map__is_internal(map) &&
+		    strstr(bpf_map__name(map), ".rodata"))
+			continue;
+		return false;
+	}
+
+	return true;
+}
+
+static bool bpf_prog_cacheable(const struct bpf_cfg_in *cfg)
+{
+	/* verifier logs, exported maps and offload are per load */
+	return !cfg->verbose && !cfg->uds && !cfg->ifindex;
+}
+
 static int load_bpf_object(struct bpf_cfg_in *cfg)
 {
 	struct bpf_program *p, *prog = NULL;
@@ -348,10 +452,13 @@ static int load_bpf_object(struct bpf_cfg_in *cfg)
 		goto unload_obj;
 
 	prog_fd = fcntl(bpf_program__fd(prog), F_DUPFD_CLOEXEC, 1);
-	if (prog_fd < 0)
+	if (prog_fd < 0) {
 		ret = -errno;
-	else
+	} else {
 		cfg->prog_fd = prog_fd;
+		if (bpf_prog_cacheable(cfg) && bpf_object_shareable(obj))
+			bpf_prog_cache_add(cfg, prog_fd);
+	}
 
 unload_obj:
 	/* Close obj as we don't need it */
@@ -364,6 +471,15 @@ int iproute2_load_libbpf(struct bpf_cfg_in *cfg)
 {
 	int ret = 0;
 
+	if (bpf_prog_cacheable(cfg)) {
+		ret = bpf_prog_cache_get(cfg);
+		if (ret >= 0) {
+			cfg->prog_fd = ret;
+			return ret;
+		}
+		ret = 0;
+	}
+
 	if (cfg->verbose)
 		libbpf_set_print(verbose_print);
 	else
@@ -10,6 +10,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include <linux/types.h>
 #include <ftw.h>
@@ -62,12 +64,46 @@ static struct cg_cache *cg_entry_create(__u64 id, const char *path)
 	return cg;
 }
 
+/*
+ * Ids are resolved when they are first seen, through a file handle on the
+ * cgroup2 mount, so only the cgroups of the sockets shown are looked at.
+ * Without handle support (old kernel, or no CAP_DAC_READ_SEARCH) the whole
+ * hierarchy is walked once instead.
+ */
+static char *cg_mnt;
+static int cg_mnt_fd = -1;
 static int mntlen;
+static bool cg_no_handles;
+static bool cg_walked;
+
+static int cg_open_mount(void)
+{
+	static bool tried;
+
+	if (!tried) {
+		tried = true;
+		cg_mnt = find_cgroup2_mount(false);
+		if (cg_mnt) {
+			mntlen = strlen(cg_mnt);
+			cg_mnt_fd = open(cg_mnt, O_RDONLY | O_DIRECTORY);
+		}
+	}
+	return cg_mnt_fd;
+}
+
+static const char *cg_rel_path(const char *fpath)
+{
+	if (strncmp(fpath, cg_mnt, mntlen) == 0)
+		fpath += mntlen;
+	if (*fpath == '\0')
+		/* root cgroup */
+		fpath = "/";
+	return fpath;
+}
 
 static int nftw_fn(const char *fpath, const struct stat *sb,
 		   int typeflag, struct FTW *ftw)
 {
-	const char *path;
 	__u64 id;
 
 	if (typeflag != FTW_D)
@@ -77,11 +113,7 @@ static int nftw_fn(const char *fpath, const struct stat *sb,
 	if (!id)
 		return -1;
 
-	path = fpath + mntlen;
-	if (*path == '\0')
-		/* root cgroup */
-		path = "/";
-	if (!cg_entry_create(id, path))
+	if (!cg_get_by_id(id) && !cg_entry_create(id, cg_rel_path(fpath)))
 		return -1;
 
 	return 0;
@@ -89,43 +121,53 @@ static int nftw_fn(const char *fpath, const struct stat *sb,
 
 static void cg_init_map(void)
 {
-	char *mnt;
-
-	mnt = find_cgroup2_mount(false);
-	if (!mnt)
+	if (!cg_mnt)
 		return;
 
-	mntlen = strlen(mnt);
-	(void) nftw(mnt, nftw_fn, 1024, FTW_MOUNT);
-
-	free(mnt);
+	(void) nftw(cg_mnt, nftw_fn, 1024, FTW_MOUNT);
 }
 
-const char *cg_id_to_path(__u64 id)
+static struct cg_cache *cg_resolve(__u64 id)
 {
-	static int initialized;
-	static char buf[64];
+	char path[PATH_MAX];
 
-	const struct cg_cache *cg;
-	char *path;
+	if (cg_no_handles)
+		return NULL;
 
-	if (!initialized) {
-		cg_init_map();
-		initialized = 1;
+	if (cg_open_mount() < 0 ||
+	    cgroup2_path_by_handle(cg_mnt_fd, id, path, sizeof(path)) < 0) {
+		/* a cgroup which is gone is not found by a walk either */
+		if (!cg_mnt || errno != ESTALE)
+			cg_no_handles = true;
+		return NULL;
 	}
 
+	return cg_entry_create(id, cg_rel_path(path));
+}
+
+const char *cg_id_to_path(__u64 id)
+{
+	const struct cg_cache *cg;
+	char buf[64];
+
 	cg = cg_get_by_id(id);
 	if (cg)
 		return cg->path;
 
-	path = get_cgroup2_path(id, false);
-	if (path) {
-		cg = cg_entry_create(id, path);
-		free(path);
+	cg = cg_resolve(id);
+	if (cg)
+		return cg->path;
+
+	if (cg_no_handles && !cg_walked) {
+		cg_walked = true;
+		cg_init_map();
+		cg = cg_get_by_id(id);
 		if (cg)
 			return cg->path;
 	}
 
+	/* remembered too, sockets often outlive their cgroup */
 	snprintf(buf, sizeof(buf), "unreachable:%llx", id);
-	return buf;
+	cg = cg_entry_create(id, buf);
+	return cg ? cg->path : "unreachable";
 }
@@ -0,0 +1,499 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * cmd_server.c	resident command server for -server and -client
+ *
+ * A client sends its command line as one SOCK_SEQPACKET message of NUL
+ * terminated arguments, argv[0] first, with its stdin, stdout, stderr
+ * and working directory attached as SCM_RIGHTS. The server forks a
+ * child which takes those over and returns to main() to run the command
+ * as if it had been started from the shell, so a command calling exit()
+ * or leaving state behind cannot harm the server. The server answers
+ * with the exit status of the child as an int, and terminates the
+ * child if the client goes away first.
+ *
+ * The link map is loaded once and the children inherit it. RTNLGRP_LINK
+ * notifications keep it current: they are applied as they arrive and
+ * once more right before every fork, and since the kernel queues them
+ * before it answers the request that caused them, a command sees the
+ * links the commands before it created. If notifications were lost,
+ * the map is loaded again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+
+#include "libnetlink.h"
+#include "ll_map.h"
+#include "cmd_server.h"
+
+#define CMD_SERVER_MAX		64	/* commands running at once */
+#define CMD_SERVER_ARGS_MAX	65536	/* bytes of a command line */
+#define CMD_SERVER_FDS		4	/* stdin, stdout, stderr and cwd */
+
+/* A child left behind by a client that went away keeps its slot with
+ * fd -1 until it is reaped.
+ */
+struct cmd_server_req {
+	int	fd;
+	pid_t	pid;		/* 0 until the command line arrived */
+};
+
+struct cmd_server {
+	int			lfd;
+	int			sfd;
+	struct rtnl_handle	rth;
+	struct rtnl_handle	mon;
+	struct cmd_server_req	req[CMD_SERVER_MAX];
+	unsigned int		nreq;
+};
+
+static int cmd_server_addr(const char *path, struct sockaddr_un *sun)
+{
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun->sun_path)) {
+		fprintf(stderr, "Socket path \"%s\" is too long\n", path);
+		return -1;
+	}
+	strcpy(sun->sun_path, path);
+	return 0;
+}
+
+static int cmd_server_listen(const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat stb;
+	mode_t mask;
+	int fd, err;
+
+	if (cmd_server_addr(path, &sun))
+		return -1;
+
+	/* a socket left behind by a server that is gone */
+	if (lstat(path, &stb) == 0 && S_ISSOCK(stb.st_mode)) {
+		fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (fd >= 0 && connect(fd, (void *)&sun, sizeof(sun)) < 0 &&
+		    errno == ECONNREFUSED)
+			unlink(path);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Cannot create server socket");
+		return -1;
+	}
+
+	/* commands run with the privileges of the server */
+	mask = umask(0077);
+	err = bind(fd, (void *)&sun, sizeof(sun));
+	umask(mask);
+	if (err < 0 || listen(fd, CMD_SERVER_MAX) < 0) {
+		fprintf(stderr, "Cannot listen on \"%s\": %s\n",
+			path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Apply the link notifications queued, -1 if some were lost */
+static int cmd_server_drain(struct rtnl_handle *mon, bool apply)
+{
+	static __u64 buf[65536 / sizeof(__u64)];
+
+	for (;;) {
+		struct nlmsghdr *h;
+		ssize_t len;
+		int rest;
+
+		len = recv(mon->fd, buf, sizeof(buf), MSG_DONTWAIT | MSG_TRUNC);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN ? 0 : -1;
+		}
+		if (len > sizeof(buf))
+			return -1;
+		if (!apply)
+			continue;
+
+		rest = len;
+		for (h = (void *)buf; NLMSG_OK(h, rest); h = NLMSG_NEXT(h, rest))
+			ll_remember_index(h, NULL);
+	}
+}
+
+static void cmd_server_sync(struct cmd_server *s)
+{
+	if (cmd_server_drain(&s->mon, true) == 0)
+		return;
+
+	/* what is queued now is older than the dump */
+	cmd_server_drain(&s->mon, false);
+	ll_map_reset();
+	ll_init_map(&s->rth);
+}
+
+static void cmd_server_drop(struct cmd_server_req *req)
+{
+	if (req->fd >= 0)
+		close(req->fd);
+	req->fd = -1;
+	req->pid = 0;
+}
+
+/* The client went away, its hangup is reported until the fd is closed */
+static void cmd_server_kill(struct cmd_server_req *req)
+{
+	kill(req->pid, SIGTERM);
+	close(req->fd);
+	req->fd = -1;
+}
+
+static void cmd_server_compact(struct cmd_server *s)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < s->nreq; i++)
+		if (s->req[i].fd >= 0 || s->req[i].pid)
+			s->req[n++] = s->req[i];
+	s->nreq = n;
+}
+
+/* Take over the fds of the client, only returns in the child */
+static void cmd_server_child(struct cmd_server *s, const int *fds)
+{
+	sigset_t mask;
+	unsigned int i;
+
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+	signal(SIGPIPE, SIG_DFL);
+
+	for (i = 0; i < s->nreq; i++)
+		if (s->req[i].fd >= 0)
+			close(s->req[i].fd);
+	close(s->lfd);
+	close(s->sfd);
+	rtnl_close(&s->mon);
+	rtnl_close(&s->rth);
+
+	for (i = 0; i < 3; i++)
+		if (dup2(fds[i], i) < 0)
+			_exit(EXIT_FAILURE);
+	if (fchdir(fds[3]) < 0)
+		_exit(EXIT_FAILURE);
+	for (i = 0; i < CMD_SERVER_FDS; i++)
+		close(fds[i]);
+}
+
+/* Returns 1 in the child forked for the command line */
+static int cmd_server_recv(struct cmd_server *s, struct cmd_server_req *req,
+			   int *argcp, char ***argvp)
+{
+	static char buf[CMD_SERVER_ARGS_MAX];
+	union {
+		char		buf[CMSG_SPACE(CMD_SERVER_FDS * sizeof(int))];
+		struct cmsghdr	align;
+	} u;
+	struct iovec iov = { buf, sizeof(buf) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = u.buf,
+		.msg_controllen = sizeof(u.buf),
+	};
+	int fds[CMD_SERVER_FDS], nfds = 0;
+	struct cmsghdr *cmsg;
+	char **argv, *cp;
+	int argc = 0, i;
+	ssize_t len;
+	pid_t pid;
+
+	len = recvmsg(req->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+
+	cmsg = len > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS) {
+		nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+	}
+	if (nfds != CMD_SERVER_FDS || (msg.msg_flags & MSG_TRUNC) ||
+	    len <= 0 || buf[len - 1] != '\0')
+		goto err;
+
+	for (cp = buf; cp < buf + len; cp += strlen(cp) + 1)
+		argc++;
+	argv = calloc(argc + 1, sizeof(*argv));
+	if (!argv)
+		goto err;
+	for (i = 0, cp = buf; i < argc; i++, cp += strlen(cp) + 1)
+		argv[i] = cp;
+
+	cmd_server_sync(s);
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid == 0) {
+		cmd_server_child(s, fds);
+		*argcp = argc;
+		*argvp = argv;
+		return 1;
+	}
+	free(argv);
+	if (pid < 0) {
+		perror("fork");
+		goto err;
+	}
+
+	req->pid = pid;
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+	return 0;
+
+err:
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+	cmd_server_drop(req);
+	return 0;
+}
+
+static void cmd_server_accept(struct cmd_server *s)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	int fd;
+
+	fd = accept4(s->lfd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+	    (cred.uid != 0 && cred.uid != geteuid())) {
+		close(fd);
+		return;
+	}
+
+	s->req[s->nreq++] = (struct cmd_server_req) { .fd = fd };
+}
+
+static void cmd_server_reap(struct cmd_server *s)
+{
+	unsigned int i;
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < s->nreq; i++) {
+			struct cmd_server_req *req = &s->req[i];
+			int ret;
+
+			if (req->pid != pid)
+				continue;
+
+			ret = WIFEXITED(status) ? WEXITSTATUS(status) :
+						  128 + WTERMSIG(status);
+			if (req->fd >= 0)
+				send(req->fd, &ret, sizeof(ret), MSG_NOSIGNAL);
+			cmd_server_drop(req);
+			break;
+		}
+	}
+}
+
+int cmd_server_run(const char *path, int *argcp, char ***argvp)
+{
+	struct pollfd pfd[3 + CMD_SERVER_MAX];
+	struct cmd_server s = {};
+	struct signalfd_siginfo si;
+	sigset_t mask;
+	unsigned int i;
+
+	if (rtnl_open(&s.mon, RTMGRP_LINK) < 0 || rtnl_open(&s.rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	ll_init_map(&s.rth);
+
+	s.lfd = cmd_server_listen(path);
+	if (s.lfd < 0)
+		return -1;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	s.sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (s.sfd < 0) {
+		perror("signalfd");
+		unlink(path);
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		pfd[0] = (struct pollfd) { .fd = s.sfd, .events = POLLIN };
+		pfd[1] = (struct pollfd) { .fd = s.mon.fd, .events = POLLIN };
+		pfd[2] = (struct pollfd) {
+			.fd = s.lfd,
+			.events = s.nreq < CMD_SERVER_MAX ? POLLIN : 0,
+		};
+		/* a client with a command running only hangs up, poll()
+		 * skips the -1 of one that did
+		 */
+		for (i = 0; i < s.nreq; i++)
+			pfd[3 + i] = (struct pollfd) {
+				.fd = s.req[i].fd,
+				.events = s.req[i].pid ? 0 : POLLIN,
+			};
+
+		if (poll(pfd, 3 + s.nreq, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		for (i = 0; i < s.nreq; i++) {
+			struct cmd_server_req *req = &s.req[i];
+
+			if (!(pfd[3 + i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (req->pid)
+				cmd_server_kill(req);
+			else if (cmd_server_recv(&s, req, argcp, argvp)) {
+				return 0;
+			}
+		}
+
+		if (pfd[1].revents)
+			cmd_server_sync(&s);
+
+		if (pfd[0].revents &&
+		    read(s.sfd, &si, sizeof(si)) == sizeof(si)) {
+			if (si.ssi_signo != SIGCHLD)
+				break;
+			cmd_server_reap(&s);
+		}
+
+		cmd_server_compact(&s);
+		if (pfd[2].revents)
+			cmd_server_accept(&s);
+	}
+
+	for (i = 0; i < s.nreq; i++) {
+		if (s.req[i].pid)
+			kill(s.req[i].pid, SIGTERM);
+		if (s.req[i].fd >= 0)
+			close(s.req[i].fd);
+	}
+	close(s.lfd);
+	unlink(path);
+	exit(EXIT_SUCCESS);
+}
+
+int cmd_client_run(const char *path, const char *argv0,
+		   int argc, char *argv[])
+{
+	union {
+		char		buf[CMSG_SPACE(CMD_SERVER_FDS * sizeof(int))];
+		struct cmsghdr	align;
+	} u = {};
+	int fds[CMD_SERVER_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = u.buf,
+		.msg_controllen = sizeof(u.buf),
+	};
+	struct sockaddr_un sun;
+	struct cmsghdr *cmsg;
+	size_t len, off;
+	int fd, i, ret;
+	ssize_t cc;
+	char *buf;
+
+	if (cmd_server_addr(path, &sun))
+		return EXIT_FAILURE;
+
+	len = strlen(argv0) + 1;
+	for (i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	if (len > CMD_SERVER_ARGS_MAX) {
+		fprintf(stderr, "Command line is too long\n");
+		return EXIT_FAILURE;
+	}
+	buf = malloc(len);
+	if (!buf) {
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+	off = strlen(argv0) + 1;
+	memcpy(buf, argv0, off);
+	for (i = 0; i < argc; i++) {
+		memcpy(buf + off, argv[i], strlen(argv[i]) + 1);
+		off += strlen(argv[i]) + 1;
+	}
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	/* a closed stdin, stdout or stderr is /dev/null for the command */
+	for (i = 0; i < 3; i++)
+		if (fcntl(fds[i], F_GETFD) < 0)
+			fds[i] = open("/dev/null", O_RDWR | O_CLOEXEC);
+	fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	for (i = 0; i < CMD_SERVER_FDS; i++) {
+		if (fds[i] < 0) {
+			perror("Cannot pass file descriptors");
+			return EXIT_FAILURE;
+		}
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (void *)&sun, sizeof(sun)) < 0) {
+		fprintf(stderr, "Cannot connect to server \"%s\": %s\n",
+			path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+		fprintf(stderr, "Cannot send command to server \"%s\": %s\n",
+			path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	free(buf);
+
+	do {
+		cc = recv(fd, &ret, sizeof(ret), 0);
+	} while (cc < 0 && errno == EINTR);
+	if (cc != sizeof(ret)) {
+		fprintf(stderr, "Server \"%s\" closed the connection\n", path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	return ret;
+}
@@ -177,6 +177,18 @@ end:
 	return ret;
 }
 
+void color_escapes(enum color_attr attr, const char **start, const char **end)
+{
+	if (!color_is_enabled || attr == COLOR_NONE) {
+		*start = *end = "";
+		return;
+	}
+
+	*start = color_codes[is_dark_bg ?
+		attr_colors_dark[attr] : attr_colors_light[attr]];
+	*end = color_codes[C_CLEAR];
+}
+
 enum color_attr ifa_family_color(__u8 ifa_family)
 {
 	switch (ifa_family) {
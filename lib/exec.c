@@ -1,7 +1,9 @@
 /* SPDX-License-Identifier: GPL-2.0 */
 #include <sys/wait.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "utils.h"
@@ -49,3 +51,110 @@ int cmd_exec(const char *cmd, char **argv, bool do_fork,
 				cmd, strerror(errno));
 	_exit(1);
 }
+
+struct exec_job {
+	pid_t	pid;
+	int	fd;
+	int	idx;
+};
+
+static int cmd_exec_start(struct exec_job *job, const char *cmd, char **argv,
+			  int (*setup)(void *), void *arg)
+{
+	FILE *out = tmpfile();
+
+	if (!out) {
+		perror("Cannot create output file");
+		return -1;
+	}
+	job->fd = dup(fileno(out));
+	fclose(out);
+	if (job->fd < 0) {
+		perror("dup");
+		return -1;
+	}
+	fcntl(job->fd, F_SETFD, FD_CLOEXEC);
+
+	job->pid = fork();
+	if (job->pid < 0) {
+		perror("fork");
+		close(job->fd);
+		return -1;
+	}
+	if (job->pid)
+		return 0;
+
+	dup2(job->fd, STDOUT_FILENO);
+	dup2(job->fd, STDERR_FILENO);
+	if (setup && setup(arg))
+		_exit(1);
+	execvp(cmd, argv);
+	fprintf(stderr, "exec of \"%s\" failed: %s\n", cmd, strerror(errno));
+	_exit(1);
+}
+
+/*
+ * Run @cmd once for each of @args, calling @setup(args[i]) in the child
+ * first, with up to @jobs children at a time. What a child prints, on
+ * stdout and stderr alike, goes to a file of its own which is handed to
+ * @done once the child exited, so that every output can be shown in one
+ * piece. Children are reaped, and @done called, in the order they exit.
+ */
+int cmd_exec_parallel(const char *cmd, char **argv, void **args, int cnt,
+		      unsigned int jobs, int (*setup)(void *),
+		      void (*done)(void *arg, int fd, int status))
+{
+	struct exec_job *job;
+	unsigned int running = 0, i;
+	int next = 0, ret = 0;
+
+	if (!jobs)
+		jobs = 1;
+	job = calloc(jobs, sizeof(*job));
+	if (!job)
+		return -1;
+
+	fflush(stdout);
+	fflush(stderr);
+	while (next < cnt || running) {
+		int status;
+		pid_t pid;
+
+		for (i = 0; i < jobs && next < cnt && !ret; i++) {
+			if (job[i].pid)
+				continue;
+			job[i].idx = next++;
+			if (cmd_exec_start(&job[i], cmd, argv, setup,
+					   args[job[i].idx])) {
+				job[i].pid = 0;
+				ret = -1;
+				break;
+			}
+			running++;
+		}
+		if (!running)
+			break;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("waitpid");
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < jobs; i++) {
+			if (job[i].pid != pid)
+				continue;
+			done(args[job[i].idx], job[i].fd, status);
+			close(job[i].fd);
+			job[i].pid = 0;
+			running--;
+			break;
+		}
+	}
+
+	free(job);
+	return ret;
+}
@@ -186,8 +186,13 @@ out:
 
 #define FILEID_INO32_GEN 1
 
-/* caller needs to free string returned */
-char *get_cgroup2_path(__u64 id, bool full)
+/*
+ * Resolve cgroup2 @id through a file handle on the cgroup2 mount @mnt_fd.
+ * The full path of the cgroup is stored in @buf. Returns 0, or -1
+ * with errno set and nothing printed, so that callers can tell a cgroup
+ * which is gone (ESTALE) from a kernel or a caller without handle support.
+ */
+int cgroup2_path_by_handle(int mnt_fd, __u64 id, char *buf, size_t len)
 {
 	char fh_buf[sizeof(struct file_handle) + sizeof(__u64)] = { 0 };
 	struct file_handle *fhp = (struct file_handle *)fh_buf;
@@ -195,12 +200,38 @@ char *get_cgroup2_path(__u64 id, bool full)
 		__u64 id;
 		unsigned char bytes[sizeof(__u64)];
 	} cg_id = { .id = id };
-	int mnt_fd = -1, fd = -1;
-	char link_buf[PATH_MAX];
-	char *path = NULL;
 	char fd_path[64];
 	int link_len;
+	int fd;
+
+	fhp->handle_bytes = sizeof(__u64);
+	fhp->handle_type = FILEID_INO32_GEN;
+	memcpy(fhp->f_handle, cg_id.bytes, sizeof(__u64));
+
+	fd = open_by_handle_at(mnt_fd, fhp, 0);
+	if (fd < 0)
+		return -1;
+
+	snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+	link_len = readlink(fd_path, buf, len - 1);
+	close(fd);
+	if (link_len < 0)
+		return -1;
+	if (link_len == len - 1) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	buf[link_len] = '\0';
+	return 0;
+}
+
+/* caller needs to free string returned */
+char *get_cgroup2_path(__u64 id, bool full)
+{
+	char link_buf[PATH_MAX];
+	char *path = NULL;
 	char *mnt = NULL;
+	int mnt_fd = -1;
 
 	if (!id) {
 		fprintf(stderr, "Invalid cgroup2 ID\n");
@@ -217,27 +248,13 @@ char *get_cgroup2_path(__u64 id, bool full)
 		goto out;
 	}
 
-	fhp->handle_bytes = sizeof(__u64);
-	fhp->handle_type = FILEID_INO32_GEN;
-	memcpy(fhp->f_handle, cg_id.bytes, sizeof(__u64));
-
-	fd = open_by_handle_at(mnt_fd, fhp, 0);
-	if (fd < 0) {
+	if (cgroup2_path_by_handle(mnt_fd, id, link_buf,
+				   sizeof(link_buf)) < 0) {
 		if (errno != ESTALE)
 			fprintf(stderr, "Failed to open cgroup2 by ID\n");
 		goto out;
 	}
 
-	snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
-	link_len = readlink(fd_path, link_buf, sizeof(link_buf) - 1);
-	if (link_len < 0) {
-		fprintf(stderr,
-			"Failed to read value of symbolic link %s\n",
-			fd_path);
-		goto out;
-	}
-	link_buf[link_len] = '\0';
-
 	if (full)
 		path = strdup(link_buf);
 	else
@@ -247,8 +264,6 @@ char *get_cgroup2_path(__u64 id, bool full)
 			"Failed to allocate memory for cgroup2 path\n");
 
 out:
-	if (fd >= 0)
-		close(fd);
 	if (mnt_fd >= 0)
 		close(mnt_fd);
 	free(mnt);
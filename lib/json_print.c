@@ -12,7 +12,13 @@
 #include "json_print.h"
 
 static json_writer_t *_jw;
+static bool _jw_array;
 
+/*
+ * With -jsonl the array is left out and every element goes on a line
+ * of its own, so the output can be consumed one record at a time.
+ * With -cbor the same values are written as binary CBOR.
+ */
 static void __new_json_obj(int json, bool have_array)
 {
 	if (json) {
@@ -21,9 +27,14 @@ static void __new_json_obj(int json, bool have_array)
 			perror("json object");
 			exit(1);
 		}
-		if (pretty)
+		_jw_array = have_array && !json_lines;
+		if (json_cbor)
+			jsonw_cbor(_jw, true);
+		if (json_lines)
+			jsonw_lines(_jw, true);
+		else if (pretty)
 			jsonw_pretty(_jw, true);
-		if (have_array)
+		if (_jw_array)
 			jsonw_start_array(_jw);
 	}
 }
@@ -31,7 +42,7 @@ static void __new_json_obj(int json, bool have_array)
 static void __delete_json_obj(bool have_array)
 {
 	if (_jw) {
-		if (have_array)
+		if (_jw_array)
 			jsonw_end_array(_jw);
 		jsonw_destroy(&_jw);
 	}
@@ -57,6 +68,18 @@ void delete_json_obj_plain(void)
 	__delete_json_obj(false);
 }
 
+/*
+ * Compact JSON lines: every top-level object is written on a line of its
+ * own and nothing is flushed until the caller does it or the object is
+ * deleted with delete_json_obj_plain().
+ */
+void new_json_obj_lines(void)
+{
+	__new_json_obj(1, false);
+	jsonw_pretty(_jw, false);
+	jsonw_lines(_jw, true);
+}
+
 bool is_json_context(void)
 {
 	return _jw != NULL;
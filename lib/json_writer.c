@@ -15,22 +15,112 @@
 #include <malloc.h>
 #include <inttypes.h>
 #include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <endian.h>
 
 #include "json_writer.h"
 
+/*
+ * All output goes through the stream's own buffer, without taking its
+ * lock for every character. Callers mix JSON with plain stdio on the
+ * same stream, so nothing is held back in the writer itself.
+ */
+#define jsonw_putc(c, self)	putc_unlocked(c, (self)->out)
+#define jsonw_write(self, s, len) \
+	fwrite_unlocked(s, 1, len, (self)->out)
+#define jsonw_fputs(s, self)	jsonw_write(self, s, strlen(s))
+
 struct json_writer {
 	FILE		*out;	/* output file */
 	unsigned	depth;  /* nesting */
 	bool		pretty; /* optional whitepace */
+	bool		lines;	/* one top-level value per line */
+	bool		cbor;	/* binary CBOR instead of JSON text */
 	char		sep;	/* either nul or comma */
 };
 
+/*
+ * CBOR (RFC 8949) output carries the same values as the JSON output,
+ * typed: objects and arrays are indefinite length maps and arrays,
+ * names and strings are text strings and numbers are binary integers
+ * and doubles. Top-level values are simply concatenated, which makes
+ * the lines mode a CBOR sequence (RFC 8742).
+ */
+enum {
+	CBOR_UINT	= 0,
+	CBOR_NEGINT	= 1,
+	CBOR_TEXT	= 3,
+	CBOR_ARRAY	= 4,
+	CBOR_MAP	= 5,
+	CBOR_SIMPLE	= 7,
+};
+
+#define CBOR_INDEFINITE	31
+#define CBOR_FALSE	0xf4
+#define CBOR_TRUE	0xf5
+#define CBOR_NULL	0xf6
+#define CBOR_DOUBLE	0xfb
+#define CBOR_BREAK	0xff
+
+/* Initial byte and argument of a data item, in the shortest form */
+static void cbor_head(json_writer_t *self, unsigned int major, uint64_t val)
+{
+	unsigned char buf[9];
+	size_t len;
+
+	if (val < 24) {
+		buf[0] = major << 5 | val;
+		len = 1;
+	} else if (val <= UINT8_MAX) {
+		buf[0] = major << 5 | 24;
+		buf[1] = val;
+		len = 2;
+	} else if (val <= UINT16_MAX) {
+		uint16_t v = htobe16(val);
+
+		buf[0] = major << 5 | 25;
+		memcpy(buf + 1, &v, sizeof(v));
+		len = 3;
+	} else if (val <= UINT32_MAX) {
+		uint32_t v = htobe32(val);
+
+		buf[0] = major << 5 | 26;
+		memcpy(buf + 1, &v, sizeof(v));
+		len = 5;
+	} else {
+		uint64_t v = htobe64(val);
+
+		buf[0] = major << 5 | 27;
+		memcpy(buf + 1, &v, sizeof(v));
+		len = 9;
+	}
+	jsonw_write(self, buf, len);
+}
+
+static void cbor_text(json_writer_t *self, const char *str, size_t len)
+{
+	cbor_head(self, CBOR_TEXT, len);
+	jsonw_write(self, str, len);
+}
+
+static void cbor_double(json_writer_t *self, double num)
+{
+	uint64_t v;
+
+	memcpy(&v, &num, sizeof(v));
+	v = htobe64(v);
+	jsonw_putc(CBOR_DOUBLE, self);
+	jsonw_write(self, &v, sizeof(v));
+}
+
 /* indentation for pretty print */
 static void jsonw_indent(json_writer_t *self)
 {
 	unsigned i;
 	for (i = 0; i < self->depth; ++i)
-		fputs("    ", self->out);
+		jsonw_write(self, "    ", 4);
 }
 
 /* end current line and indent if pretty printing */
@@ -39,54 +129,111 @@ static void jsonw_eol(json_writer_t *self)
 	if (!self->pretty)
 		return;
 
-	putc('\n', self->out);
+	jsonw_putc('\n', self);
 	jsonw_indent(self);
 }
 
 /* If current object is not empty print a comma */
 static void jsonw_eor(json_writer_t *self)
 {
+	if (self->cbor)
+		return;
 	if (self->sep != '\0')
-		putc(self->sep, self->out);
+		jsonw_putc(self->sep, self);
 	self->sep = ',';
 }
 
 
+/*
+ * Escape for every byte that needs one: the character after the
+ * backslash, or 'u' for \u00XX. NUL is marked too, to end the scan.
+ */
+static const char jsonw_escape[256] = {
+	[0x00 ... 0x1f] = 'u',
+	['\t'] = 't', ['\n'] = 'n', ['\r'] = 'r', ['\f'] = 'f', ['\b'] = 'b',
+	['\\'] = '\\', ['"'] = '"', [0x7f] = 'u',
+};
+
 /* Output JSON encoded string */
 /* Handles C escapes and control characters per RFC 8259 */
 static void jsonw_puts(json_writer_t *self, const char *str)
 {
-	putc('"', self->out);
-	for (; *str; ++str)
-		switch (*str) {
-		case '\t':
-			fputs("\\t", self->out);
-			break;
-		case '\n':
-			fputs("\\n", self->out);
-			break;
-		case '\r':
-			fputs("\\r", self->out);
-			break;
-		case '\f':
-			fputs("\\f", self->out);
-			break;
-		case '\b':
-			fputs("\\b", self->out);
-			break;
-		case '\\':
-			fputs("\\\\", self->out);
-			break;
-		case '"':
-			fputs("\\\"", self->out);
+	static const char hex[] = "0123456789abcdef";
+
+	if (self->cbor) {
+		cbor_text(self, str, strlen(str));
+		return;
+	}
+
+	jsonw_putc('"', self);
+	for (;;) {
+		const char *run = str;
+		unsigned char c;
+		char esc;
+
+		/* copy the longest run that needs no escaping at once */
+		while (!jsonw_escape[(unsigned char)*str])
+			++str;
+		if (str != run)
+			jsonw_write(self, run, str - run);
+
+		c = *str++;
+		if (!c)
 			break;
-		default:
-			if ((unsigned char)*str < 0x20 || *str == 0x7f)
-				fprintf(self->out, "\\u%04x", *str);
-			else
-				putc(*str, self->out);
+		esc = jsonw_escape[c];
+		jsonw_putc('\\', self);
+		jsonw_putc(esc, self);
+		if (esc == 'u') {
+			jsonw_write(self, "00", 2);
+			jsonw_putc(hex[c >> 4], self);
+			jsonw_putc(hex[c & 0xf], self);
 		}
-	putc('"', self->out);
+	}
+	jsonw_putc('"', self);
+}
+
+/* Format numbers by hand, printf is much slower for these */
+static void jsonw_u64_out(json_writer_t *self, uint64_t num)
+{
+	static const char digits[] =
+		"0001020304050607080910111213141516171819"
+		"2021222324252627282930313233343536373839"
+		"4041424344454647484950515253545556575859"
+		"6061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	char buf[20], *p = buf + sizeof(buf);
+
+	if (self->cbor) {
+		cbor_head(self, CBOR_UINT, num);
+		return;
+	}
+
+	while (num >= 100) {
+		const char *d = digits + 2 * (num % 100);
+
+		num /= 100;
+		*--p = d[1];
+		*--p = d[0];
+	}
+	if (num >= 10) {
+		*--p = digits[2 * num + 1];
+		*--p = digits[2 * num];
+	} else {
+		*--p = '0' + num;
+	}
+	jsonw_write(self, p, buf + sizeof(buf) - p);
+}
+
+static void jsonw_s64_out(json_writer_t *self, int64_t num)
+{
+	if (self->cbor && num < 0) {
+		cbor_head(self, CBOR_NEGINT, -1 - num);
+	} else if (num < 0) {
+		jsonw_putc('-', self);
+		jsonw_u64_out(self, -(uint64_t)num);
+	} else {
+		jsonw_u64_out(self, num);
+	}
 }
 
 /* Create a new JSON stream */
@@ -97,6 +244,8 @@ json_writer_t *jsonw_new(FILE *f)
 		self->out = f;
 		self->depth = 0;
 		self->pretty = false;
+		self->lines = false;
+		self->cbor = false;
 		self->sep = '\0';
 	}
 	return self;
@@ -108,7 +257,8 @@ void jsonw_destroy(json_writer_t **self_p)
 	json_writer_t *self = *self_p;
 
 	assert(self->depth == 0);
-	fputs("\n", self->out);
+	if (!self->lines && !self->cbor)
+		jsonw_putc('\n', self);
 	fflush(self->out);
 	free(self);
 	*self_p = NULL;
@@ -116,14 +266,32 @@ void jsonw_destroy(json_writer_t **self_p)
 
 void jsonw_pretty(json_writer_t *self, bool on)
 {
-	self->pretty = on;
+	self->pretty = on && !self->cbor;
+}
+
+/* End each top-level value with a newline instead of a comma */
+void jsonw_lines(json_writer_t *self, bool on)
+{
+	self->lines = on;
+}
+
+/* Write CBOR instead of JSON, from the start of the stream */
+void jsonw_cbor(json_writer_t *self, bool on)
+{
+	self->cbor = on;
+	if (on)
+		self->pretty = false;
 }
 
 /* Basic blocks */
 static void jsonw_begin(json_writer_t *self, int c)
 {
 	jsonw_eor(self);
-	putc(c, self->out);
+	if (self->cbor)
+		jsonw_putc(c == '{' ? CBOR_MAP << 5 | CBOR_INDEFINITE :
+				      CBOR_ARRAY << 5 | CBOR_INDEFINITE, self);
+	else
+		jsonw_putc(c, self);
 	++self->depth;
 	self->sep = '\0';
 }
@@ -133,10 +301,19 @@ static void jsonw_end(json_writer_t *self, int c)
 	assert(self->depth > 0);
 
 	--self->depth;
+	if (self->cbor) {
+		jsonw_putc(CBOR_BREAK, self);
+		return;
+	}
 	if (self->sep != '\0')
 		jsonw_eol(self);
-	putc(c, self->out);
+	jsonw_putc(c, self);
 	self->sep = ',';
+
+	if (self->lines && self->depth == 0) {
+		jsonw_putc('\n', self);
+		self->sep = '\0';
+	}
 }
 
 
@@ -147,9 +324,45 @@ void jsonw_name(json_writer_t *self, const char *name)
 	jsonw_eol(self);
 	self->sep = '\0';
 	jsonw_puts(self, name);
-	putc(':', self->out);
+	if (self->cbor)
+		return;
+	jsonw_putc(':', self);
 	if (self->pretty)
-		putc(' ', self->out);
+		jsonw_putc(' ', self);
+}
+
+/*
+ * jsonw_printf() writes a JSON literal, which for its users is a number
+ * such as "1.50". Keep numbers typed in CBOR, anything else is text.
+ */
+__attribute__((format(printf, 2, 0)))
+static void cbor_vprintf(json_writer_t *self, const char *fmt, va_list ap)
+{
+	char *str, *end;
+	long long ll;
+	double d;
+	int len;
+
+	len = vasprintf(&str, fmt, ap);
+	if (len < 0)
+		return;
+
+	errno = 0;
+	ll = strtoll(str, &end, 10);
+	if (len && !*end && !errno) {
+		if (ll < 0)
+			cbor_head(self, CBOR_NEGINT, -1 - ll);
+		else
+			cbor_head(self, CBOR_UINT, ll);
+		goto out;
+	}
+	d = strtod(str, &end);
+	if (len && !*end)
+		cbor_double(self, d);
+	else
+		cbor_text(self, str, len);
+out:
+	free(str);
 }
 
 __attribute__((format(printf, 2, 3)))
@@ -159,7 +372,10 @@ void jsonw_printf(json_writer_t *self, const char *fmt, ...)
 
 	va_start(ap, fmt);
 	jsonw_eor(self);
-	vfprintf(self->out, fmt, ap);
+	if (self->cbor)
+		cbor_vprintf(self, fmt, ap);
+	else
+		vfprintf(self->out, fmt, ap);
 	va_end(ap);
 }
 
@@ -178,13 +394,13 @@ void jsonw_start_array(json_writer_t *self)
 {
 	jsonw_begin(self, '[');
 	if (self->pretty)
-		putc(' ', self->out);
+		jsonw_putc(' ', self);
 }
 
 void jsonw_end_array(json_writer_t *self)
 {
 	if (self->pretty && self->sep)
-		putc(' ', self->out);
+		jsonw_putc(' ', self);
 	self->sep = '\0';
 	jsonw_end(self, ']');
 }
@@ -198,62 +414,94 @@ void jsonw_string(json_writer_t *self, const char *value)
 
 void jsonw_bool(json_writer_t *self, bool val)
 {
-	jsonw_printf(self, "%s", val ? "true" : "false");
+	jsonw_eor(self);
+	if (self->cbor)
+		jsonw_putc(val ? CBOR_TRUE : CBOR_FALSE, self);
+	else
+		jsonw_fputs(val ? "true" : "false", self);
 }
 
 void jsonw_null(json_writer_t *self)
 {
-	jsonw_printf(self, "null");
+	jsonw_eor(self);
+	if (self->cbor)
+		jsonw_putc(CBOR_NULL, self);
+	else
+		jsonw_write(self, "null", 4);
 }
 
 void jsonw_float(json_writer_t *self, double num)
 {
-	jsonw_printf(self, "%g", num);
+	if (self->cbor)
+		cbor_double(self, num);
+	else
+		jsonw_printf(self, "%g", num);
 }
 
 void jsonw_hhu(json_writer_t *self, unsigned char num)
 {
-	jsonw_printf(self, "%hhu", num);
+	jsonw_eor(self);
+	jsonw_u64_out(self, num);
 }
 
 void jsonw_hu(json_writer_t *self, unsigned short num)
 {
-	jsonw_printf(self, "%hu", num);
+	jsonw_eor(self);
+	jsonw_u64_out(self, num);
 }
 
 void jsonw_uint(json_writer_t *self, unsigned int num)
 {
-	jsonw_printf(self, "%u", num);
+	jsonw_eor(self);
+	jsonw_u64_out(self, num);
 }
 
 void jsonw_u64(json_writer_t *self, uint64_t num)
 {
-	jsonw_printf(self, "%"PRIu64, num);
+	jsonw_eor(self);
+	jsonw_u64_out(self, num);
 }
 
 void jsonw_xint(json_writer_t *self, uint64_t num)
 {
-	jsonw_printf(self, "%"PRIx64, num);
+	static const char hex[] = "0123456789abcdef";
+	char buf[16], *p = buf + sizeof(buf);
+
+	if (self->cbor) {
+		cbor_head(self, CBOR_UINT, num);
+		return;
+	}
+
+	do {
+		*--p = hex[num & 0xf];
+		num >>= 4;
+	} while (num);
+	jsonw_eor(self);
+	jsonw_write(self, p, buf + sizeof(buf) - p);
 }
 
 void jsonw_luint(json_writer_t *self, unsigned long num)
 {
-	jsonw_printf(self, "%lu", num);
+	jsonw_eor(self);
+	jsonw_u64_out(self, num);
 }
 
 void jsonw_lluint(json_writer_t *self, unsigned long long num)
 {
-	jsonw_printf(self, "%llu", num);
+	jsonw_eor(self);
+	jsonw_u64_out(self, num);
 }
 
 void jsonw_int(json_writer_t *self, int num)
 {
-	jsonw_printf(self, "%d", num);
+	jsonw_eor(self);
+	jsonw_s64_out(self, num);
 }
 
 void jsonw_s64(json_writer_t *self, int64_t num)
 {
-	jsonw_printf(self, "%"PRId64, num);
+	jsonw_eor(self);
+	jsonw_s64_out(self, num);
 }
 
 /* Basic name/value objects */
@@ -6,12 +6,106 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <linux/genetlink.h>
 #include "libgenl.h"
 
-static int genl_parse_getfamily(struct nlmsghdr *nlh)
+/*
+ * Family cache: the CTRL_CMD_NEWFAMILY reply of every family looked up,
+ * by name or id, is kept for the rest of the process, so batch lines,
+ * extra sockets and multicast group lookups of the same family do not
+ * ask the controller again. A fresh reply replaces the entry of its
+ * family, and any other entry with the same id, so a family that came
+ * back with another id or version is never served stale.
+ */
+struct genl_family_entry {
+	struct genl_family_entry	*next;
+	char				*name;
+	__u16				id;
+	struct nlmsghdr			n;
+};
+
+static struct genl_family_entry *genl_families;
+
+static struct rtattr *genl_family_attr(const struct nlmsghdr *n, int type)
+{
+	const struct genlmsghdr *ghdr = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	struct rtattr *tb[CTRL_ATTR_MAX + 1];
+
+	if (n->nlmsg_type != GENL_ID_CTRL || len < 0 ||
+	    ghdr->cmd != CTRL_CMD_NEWFAMILY || type > CTRL_ATTR_MAX)
+		return NULL;
+
+	parse_rtattr(tb, CTRL_ATTR_MAX,
+		     (struct rtattr *)((char *)ghdr + GENL_HDRLEN), len);
+	return tb[type];
+}
+
+static void genl_family_drop(struct genl_family_entry **pp)
+{
+	struct genl_family_entry *e = *pp;
+
+	*pp = e->next;
+	free(e->name);
+	free(e);
+}
+
+void genl_family_cache_put(const struct nlmsghdr *n)
+{
+	struct rtattr *name = genl_family_attr(n, CTRL_ATTR_FAMILY_NAME);
+	struct rtattr *id = genl_family_attr(n, CTRL_ATTR_FAMILY_ID);
+	struct genl_family_entry *e, **pp;
+
+	if (!name || !id)
+		return;
+
+	for (e = genl_families; e; e = e->next) {
+		if (&e->n == n)
+			return;
+	}
+	for (pp = &genl_families; *pp; ) {
+		if ((*pp)->id == rta_getattr_u16(id) ||
+		    strcmp((*pp)->name, rta_getattr_str(name)) == 0)
+			genl_family_drop(pp);
+		else
+			pp = &(*pp)->next;
+	}
+
+	e = malloc(sizeof(*e) - sizeof(e->n) + n->nlmsg_len);
+	if (!e)
+		return;
+	e->name = strdup(rta_getattr_str(name));
+	if (!e->name) {
+		free(e);
+		return;
+	}
+	e->id = rta_getattr_u16(id);
+	memcpy(&e->n, n, n->nlmsg_len);
+	e->next = genl_families;
+	genl_families = e;
+}
+
+const struct nlmsghdr *genl_family_cache_get(const char *name, int id)
+{
+	struct genl_family_entry *e;
+
+	for (e = genl_families; e; e = e->next) {
+		if (name ? strcmp(e->name, name) == 0 : e->id == id)
+			return &e->n;
+	}
+	return NULL;
+}
+
+void genl_family_cache_flush(void)
+{
+	while (genl_families)
+		genl_family_drop(&genl_families);
+}
+
+static int genl_parse_getfamily(const struct nlmsghdr *nlh)
 {
 	struct rtattr *tb[CTRL_ATTR_MAX + 1];
 	struct genlmsghdr *ghdr = NLMSG_DATA(nlh);
@@ -51,9 +145,14 @@ int genl_resolve_family(struct rtnl_handle *grth, const char *family)
 {
 	GENL_REQUEST(req, 1024, GENL_ID_CTRL, 0, 0, CTRL_CMD_GETFAMILY,
 		     NLM_F_REQUEST);
+	const struct nlmsghdr *cached;
 	struct nlmsghdr *answer;
 	int fnum;
 
+	cached = genl_family_cache_get(family, 0);
+	if (cached)
+		return genl_parse_getfamily(cached);
+
 	addattr_l(&req.n, sizeof(req), CTRL_ATTR_FAMILY_NAME,
 		  family, strlen(family) + 1);
 
@@ -63,6 +162,8 @@ int genl_resolve_family(struct rtnl_handle *grth, const char *family)
 	}
 
 	fnum = genl_parse_getfamily(answer);
+	if (fnum >= 0)
+		genl_family_cache_put(answer);
 	free(answer);
 
 	return fnum;
@@ -93,44 +194,38 @@ int genl_add_mcast_grp(struct rtnl_handle *grth, __u16 fnum, const char *group)
 {
 	GENL_REQUEST(req, 1024, GENL_ID_CTRL, 0, 0, CTRL_CMD_GETFAMILY,
 		     NLM_F_REQUEST);
-	struct rtattr *tb[CTRL_ATTR_MAX + 1];
+	const struct nlmsghdr *cached;
 	struct nlmsghdr *answer = NULL;
-	struct genlmsghdr *ghdr;
-	struct rtattr *attrs;
-	int len, ret = -1;
+	struct rtattr *grps;
+	int ret = -1;
 	unsigned int id;
 
-	addattr16(&req.n, sizeof(req), CTRL_ATTR_FAMILY_ID, fnum);
-
-	if (rtnl_talk(grth, &req.n, &answer) < 0) {
-		fprintf(stderr, "Error talking to the kernel\n");
-		return -2;
-	}
-
-	ghdr = NLMSG_DATA(answer);
-	len = answer->nlmsg_len;
+	cached = genl_family_cache_get(NULL, fnum);
+	if (!cached) {
+		addattr16(&req.n, sizeof(req), CTRL_ATTR_FAMILY_ID, fnum);
 
-	if (answer->nlmsg_type != GENL_ID_CTRL) {
-		errno = EINVAL;
-		goto err_free;
+		if (rtnl_talk(grth, &req.n, &answer) < 0) {
+			fprintf(stderr, "Error talking to the kernel\n");
+			return -2;
+		}
+		genl_family_cache_put(answer);
+		cached = answer;
 	}
 
-	len -= NLMSG_LENGTH(GENL_HDRLEN);
-	if (len < 0) {
+	if (cached->nlmsg_type != GENL_ID_CTRL ||
+	    cached->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) {
 		errno = EINVAL;
 		goto err_free;
 	}
 
-	attrs = (struct rtattr *) ((char *) ghdr + GENL_HDRLEN);
-	parse_rtattr(tb, CTRL_ATTR_MAX, attrs, len);
-
-	if (tb[CTRL_ATTR_MCAST_GROUPS] == NULL) {
+	grps = genl_family_attr(cached, CTRL_ATTR_MCAST_GROUPS);
+	if (grps == NULL) {
 		errno = ENOENT;
 		fprintf(stderr, "Missing mcast groups TLV\n");
 		goto err_free;
 	}
 
-	if (genl_parse_grps(tb[CTRL_ATTR_MCAST_GROUPS], group, &id) < 0)
+	if (genl_parse_grps(grps, group, &id) < 0)
 		goto err_free;
 
 	ret = rtnl_add_nl_group(grth, id);
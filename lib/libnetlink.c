@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <net/if_arp.h>
@@ -17,6 +18,8 @@
 #include <errno.h>
 #include <time.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <linux/fib_rules.h>
 #include <linux/if_addrlabel.h>
 #include <linux/if_bridge.h>
@@ -24,6 +27,8 @@
 
 #include "libnetlink.h"
 #include "json_print.h"
+#include "nl_stats.h"
+#include "nl_pipeline.h"
 #include "utils.h"
 
 #ifndef __aligned
@@ -40,6 +45,9 @@
 
 int rcvbuf = 1024 * 1024;
 
+/* minimum size of the per-handle receive arena used by dumps */
+#define RTNL_RBUF_MIN		32768
+
 #ifdef HAVE_LIBMNL
 #include <libmnl/libmnl.h>
 
@@ -176,6 +184,37 @@ void rtnl_set_strict_dump(struct rtnl_handle *rth)
 	rth->flags |= RTNL_HANDLE_F_STRICT_CHK;
 }
 
+static ssize_t rtnl_sendmsg(int fd, const struct msghdr *msg)
+{
+	const struct nlmsghdr *h = msg->msg_iov[0].iov_base;
+	ssize_t len;
+	__u64 t;
+
+	if (!nl_stats_on)
+		return sendmsg(fd, msg, 0);
+
+	if (msg->msg_iov[0].iov_len >= sizeof(*h) &&
+	    (h->nlmsg_flags & NLM_F_DUMP) == NLM_F_DUMP &&
+	    !(h->nlmsg_flags & NLM_F_CREATE))
+		nl_stats_begin(h, true);
+	t = nl_stats_now();
+	len = sendmsg(fd, msg, 0);
+	nl_stats_sent(msg, len, nl_stats_now() - t);
+	return len;
+}
+
+/* Anything sent outside of rtnl_talk() must observe queued requests */
+static int rtnl_send_req(struct rtnl_handle *rth, const void *buf, int len)
+{
+	struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (rtnl_async_sync() < 0)
+		return -1;
+
+	return rtnl_sendmsg(rth->fd, &msg);
+}
+
 int rtnl_add_nl_group(struct rtnl_handle *rth, unsigned int group)
 {
 	return setsockopt(rth->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
@@ -188,6 +227,159 @@ void rtnl_close(struct rtnl_handle *rth)
 		close(rth->fd);
 		rth->fd = -1;
 	}
+
+	free(rth->rbuf);
+	rth->rbuf = NULL;
+	rth->rbuf_len = 0;
+}
+
+static int rtnl_rbuf_reserve(struct rtnl_handle *rth, size_t len)
+{
+	char *buf;
+
+	if (len < RTNL_RBUF_MIN)
+		len = RTNL_RBUF_MIN;
+	if (rth->rbuf && rth->rbuf_len >= len)
+		return 0;
+
+	buf = realloc(rth->rbuf, len);
+	if (!buf) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		return -ENOMEM;
+	}
+
+	rth->rbuf = buf;
+	rth->rbuf_len = len;
+	return 0;
+}
+
+/* Size the receive arena up front and never peek at incoming dump
+ * datagrams. Useful when the caller knows objects are big (links with
+ * many VFs, large tc filters) and wants one recvmsg() per datagram.
+ */
+int rtnl_set_large_rbuf(struct rtnl_handle *rth, size_t len)
+{
+	int err;
+
+	err = rtnl_rbuf_reserve(rth, len);
+	if (err)
+		return err;
+
+	rth->flags |= RTNL_HANDLE_F_LARGE_BUF;
+	return 0;
+}
+
+/* Copies of dumped messages are carved out of big blocks instead of
+ * being malloc()ed one by one; entries are only ever freed together
+ * with the whole chain.
+ */
+#define NLMSG_ARENA_MIN		(64 * 1024)
+#define NLMSG_ARENA_MAX		(4 * 1024 * 1024)
+
+struct nlmsg_arena {
+	struct nlmsg_arena	*next;
+	size_t			size;
+	size_t			used;
+	char			data[];
+};
+
+static void *nlmsg_arena_alloc(struct nlmsg_arena **arenap, size_t len)
+{
+	struct nlmsg_arena *a = *arenap;
+	size_t size;
+
+	len = (len + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (!a || a->size - a->used < len) {
+		/* grow geometrically so big dumps need few blocks */
+		size = a ? MIN(2 * a->size, NLMSG_ARENA_MAX) : NLMSG_ARENA_MIN;
+		if (size < len)
+			size = len;
+
+		a = malloc(sizeof(*a) + size);
+		if (!a)
+			return NULL;
+		a->next = *arenap;
+		a->size = size;
+		a->used = 0;
+		*arenap = a;
+	}
+
+	a->used += len;
+	return a->data + a->used - len;
+}
+
+struct nlmsg_list *nlmsg_chain_append(struct nlmsg_chain *chain,
+				      const struct nlmsghdr *n)
+{
+	struct nlmsg_list *h;
+
+	h = nlmsg_arena_alloc(&chain->arena,
+			      offsetof(struct nlmsg_list, h) + n->nlmsg_len);
+	if (!h)
+		return NULL;
+
+	memcpy(&h->h, n, n->nlmsg_len);
+	h->next = NULL;
+
+	if (chain->tail)
+		chain->tail->next = h;
+	else
+		chain->head = h;
+	chain->tail = h;
+
+	return h;
+}
+
+void nlmsg_chain_free(struct nlmsg_chain *chain)
+{
+	struct nlmsg_arena *a, *next;
+
+	for (a = chain->arena; a; a = next) {
+		next = a->next;
+		free(a);
+	}
+	chain->arena = NULL;
+	chain->head = chain->tail = NULL;
+}
+
+/*
+ * Start a request of @type with a zeroed family header of @hdrlen bytes
+ * in @b and return it, or NULL if the space cannot be reserved.
+ *
+ * Attributes are added with the usual helpers bounded by b->size. They
+ * hand out pointers into the message (nests), so it can never move: the
+ * whole size is reserved up front and the kernel backs it page by page
+ * as the request grows. Reusing the builder clears only what the
+ * previous request wrote, not b->size bytes.
+ */
+struct nlmsghdr *nlmsg_builder_start(struct nlmsg_builder *b, __u16 type,
+				     __u16 flags, size_t hdrlen)
+{
+	if (!b->n) {
+		void *p = mmap(NULL, b->size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			       -1, 0);
+
+		if (p == MAP_FAILED) {
+			perror("Cannot allocate request");
+			return NULL;
+		}
+		b->n = p;
+	} else {
+		memset(b->n, 0, MIN(NLMSG_ALIGN(b->n->nlmsg_len), b->size));
+	}
+
+	b->n->nlmsg_len = NLMSG_LENGTH(hdrlen);
+	b->n->nlmsg_type = type;
+	b->n->nlmsg_flags = flags;
+	return b->n;
+}
+
+void nlmsg_builder_free(struct nlmsg_builder *b)
+{
+	if (b->n)
+		munmap(b->n, b->size);
+	b->n = NULL;
 }
 
 int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
@@ -198,6 +390,10 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 	int one = 1;
 
 	memset(rth, 0, sizeof(*rth));
+	nl_stats_env();
+
+	/* e.g. ll_map lookups of devices created by queued requests */
+	rtnl_async_sync();
 
 	rth->proto = protocol;
 	rth->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
@@ -211,6 +407,7 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 		perror("SO_SNDBUF");
 		goto err;
 	}
+	rth->max_dgram = sndbuf;
 
 	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF,
 		       &rcvbuf, sizeof(rcvbuf)) < 0) {
@@ -221,6 +418,11 @@ int rtnl_open_byproto(struct rtnl_handle *rth, unsigned int subscriptions,
 	/* Older kernels may no support extended ACK reporting */
 	setsockopt(rth->fd, SOL_NETLINK, NETLINK_EXT_ACK,
 		   &one, sizeof(one));
+	/* Errors only need the header of the failed request, not an echo
+	 * of all of it; nl_dump_ext_ack() copes with capped errors.
+	 */
+	setsockopt(rth->fd, SOL_NETLINK, NETLINK_CAP_ACK,
+		   &one, sizeof(one));
 
 	memset(&rth->local, 0, sizeof(rth->local));
 	rth->local.nl_family = AF_NETLINK;
@@ -281,7 +483,7 @@ int rtnl_nexthopdump_req(struct rtnl_handle *rth, int family,
 			return err;
 	}
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_nexthop_bucket_dump_req(struct rtnl_handle *rth, int family,
@@ -307,7 +509,7 @@ int rtnl_nexthop_bucket_dump_req(struct rtnl_handle *rth, int family,
 			return err;
 	}
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_addrdump_req(struct rtnl_handle *rth, int family,
@@ -333,7 +535,7 @@ int rtnl_addrdump_req(struct rtnl_handle *rth, int family,
 			return err;
 	}
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_addrlbldump_req(struct rtnl_handle *rth, int family)
@@ -349,7 +551,7 @@ int rtnl_addrlbldump_req(struct rtnl_handle *rth, int family)
 		.ifal.ifal_family = family,
 	};
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_routedump_req(struct rtnl_handle *rth, int family,
@@ -375,7 +577,7 @@ int rtnl_routedump_req(struct rtnl_handle *rth, int family,
 			return err;
 	}
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_ruledump_req(struct rtnl_handle *rth, int family)
@@ -391,7 +593,7 @@ int rtnl_ruledump_req(struct rtnl_handle *rth, int family)
 		.frh.family = family
 	};
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_neighdump_req(struct rtnl_handle *rth, int family,
@@ -417,7 +619,7 @@ int rtnl_neighdump_req(struct rtnl_handle *rth, int family,
 			return err;
 	}
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_neightbldump_req(struct rtnl_handle *rth, int family)
@@ -433,7 +635,7 @@ int rtnl_neightbldump_req(struct rtnl_handle *rth, int family)
 		.ndtmsg.ndtm_family = family,
 	};
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_mdbdump_req(struct rtnl_handle *rth, int family)
@@ -449,7 +651,7 @@ int rtnl_mdbdump_req(struct rtnl_handle *rth, int family)
 		.bpm.family = family,
 	};
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_brvlandump_req(struct rtnl_handle *rth, int family, __u32 dump_flags)
@@ -468,7 +670,7 @@ int rtnl_brvlandump_req(struct rtnl_handle *rth, int family, __u32 dump_flags)
 
 	addattr32(&req.nlh, sizeof(req), BRIDGE_VLANDB_DUMP_FLAGS, dump_flags);
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_netconfdump_req(struct rtnl_handle *rth, int family)
@@ -485,7 +687,7 @@ int rtnl_netconfdump_req(struct rtnl_handle *rth, int family)
 		.ncm.ncm_family = family,
 	};
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_nsiddump_req_filter_fn(struct rtnl_handle *rth, int family,
@@ -511,7 +713,7 @@ int rtnl_nsiddump_req_filter_fn(struct rtnl_handle *rth, int family,
 	if (err)
 		return err;
 
-	return send(rth->fd, &req, req.nlh.nlmsg_len, 0);
+	return rtnl_send_req(rth, &req, req.nlh.nlmsg_len);
 }
 
 static int __rtnl_linkdump_req(struct rtnl_handle *rth, int family)
@@ -527,7 +729,7 @@ static int __rtnl_linkdump_req(struct rtnl_handle *rth, int family)
 		.ifm.ifi_family = family,
 	};
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_linkdump_req(struct rtnl_handle *rth, int family)
@@ -559,7 +761,7 @@ int rtnl_linkdump_req_filter(struct rtnl_handle *rth, int family,
 			.ext_filter_mask = filt_mask,
 		};
 
-		return send(rth->fd, &req, sizeof(req), 0);
+		return rtnl_send_req(rth, &req, sizeof(req));
 	}
 
 	return __rtnl_linkdump_req(rth, family);
@@ -589,7 +791,7 @@ int rtnl_linkdump_req_filter_fn(struct rtnl_handle *rth, int family,
 		if (err)
 			return err;
 
-		return send(rth->fd, &req, req.nlh.nlmsg_len, 0);
+		return rtnl_send_req(rth, &req, req.nlh.nlmsg_len);
 	}
 
 	return __rtnl_linkdump_req(rth, family);
@@ -615,7 +817,7 @@ int rtnl_fdb_linkdump_req_filter_fn(struct rtnl_handle *rth,
 	if (err)
 		return err;
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_statsdump_req_filter(struct rtnl_handle *rth, int fam,
@@ -643,12 +845,12 @@ int rtnl_statsdump_req_filter(struct rtnl_handle *rth, int fam,
 			return err;
 	}
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
 
 int rtnl_send(struct rtnl_handle *rth, const void *buf, int len)
 {
-	return send(rth->fd, buf, len, 0);
+	return rtnl_send_req(rth, buf, len);
 }
 
 int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int len)
@@ -657,7 +859,7 @@ int rtnl_send_check(struct rtnl_handle *rth, const void *buf, int len)
 	int status;
 	char resp[1024];
 
-	status = send(rth->fd, buf, len, 0);
+	status = rtnl_send_req(rth, buf, len);
 	if (status < 0)
 		return status;
 
@@ -705,7 +907,10 @@ int rtnl_dump_request(struct rtnl_handle *rth, int type, void *req, int len)
 		.msg_iovlen = 2,
 	};
 
-	return sendmsg(rth->fd, &msg, 0);
+	if (rtnl_async_sync() < 0)
+		return -1;
+
+	return rtnl_sendmsg(rth->fd, &msg);
 }
 
 int rtnl_dump_request_n(struct rtnl_handle *rth, struct nlmsghdr *n)
@@ -726,7 +931,10 @@ int rtnl_dump_request_n(struct rtnl_handle *rth, struct nlmsghdr *n)
 	n->nlmsg_pid = 0;
 	n->nlmsg_seq = rth->dump = ++rth->seq;
 
-	return sendmsg(rth->fd, &msg, 0);
+	if (rtnl_async_sync() < 0)
+		return -1;
+
+	return rtnl_sendmsg(rth->fd, &msg);
 }
 
 static int rtnl_dump_done(struct nlmsghdr *h,
@@ -797,12 +1005,19 @@ static int rtnl_dump_error(const struct rtnl_handle *rth,
 	return -1;
 }
 
-static int __rtnl_recvmsg(int fd, struct msghdr *msg, int flags)
+int __rtnl_recvmsg(int fd, struct msghdr *msg, int flags)
 {
 	int len;
 
 	do {
-		len = recvmsg(fd, msg, flags);
+		if (nl_stats_on) {
+			__u64 t = nl_stats_now();
+
+			len = recvmsg(fd, msg, flags);
+			nl_stats_recvd(msg, flags, len, nl_stats_now() - t);
+		} else {
+			len = recvmsg(fd, msg, flags);
+		}
 	} while (len < 0 && (errno == EINTR || errno == EAGAIN));
 
 	if (len < 0) {
@@ -857,10 +1072,167 @@ static int rtnl_recvmsg(int fd, struct msghdr *msg, char **answer)
 	return len;
 }
 
-static int rtnl_dump_filter_l(struct rtnl_handle *rth,
-			      const struct rtnl_dump_filter_arg *arg)
+/* Receive one datagram into the handle's arena.
+ *
+ * Every datagram is peeked at first so that the arena can grow to fit
+ * it: a datagram read into a smaller buffer loses its tail. Handles set
+ * up with rtnl_set_large_rbuf() skip the peek.
+ */
+static int rtnl_recvmsg_rbuf(struct rtnl_handle *rth, struct msghdr *msg)
 {
-	struct sockaddr_nl nladdr;
+	struct iovec *iov = msg->msg_iov;
+	int len = 0;
+	int err;
+
+	if (!(rth->flags & RTNL_HANDLE_F_LARGE_BUF)) {
+		iov->iov_base = NULL;
+		iov->iov_len = 0;
+
+		len = __rtnl_recvmsg(rth->fd, msg, MSG_PEEK | MSG_TRUNC);
+		if (len < 0)
+			return len;
+	}
+
+	err = rtnl_rbuf_reserve(rth, len);
+	if (err)
+		return err;
+
+	iov->iov_base = rth->rbuf;
+	iov->iov_len = rth->rbuf_len;
+
+	len = __rtnl_recvmsg(rth->fd, msg, 0);
+	if (len < 0)
+		return len;
+
+	if ((msg->msg_flags & MSG_TRUNC) && nl_stats_on)
+		nl_stats_trunc();
+
+	return len;
+}
+
+/* Run one received datagram through the filters of a dump.
+ *
+ * Returns < 0 on error, 1 once NLMSG_DONE has been seen and 0 if more
+ * datagrams are expected. *msglen is left with the unparsed remnant.
+ */
+int rtnl_dump_filter_buf(struct rtnl_handle *rth,
+			 const struct sockaddr_nl *nladdr,
+			 const struct rtnl_dump_filter_arg *arg,
+			 char *buf, int status, int *msglen, int *dump_intr)
+{
+	const struct rtnl_dump_filter_arg *a;
+	int found_done = 0;
+
+	if (rth->dump_fp)
+		fwrite(buf, 1, NLMSG_ALIGN(status), rth->dump_fp);
+
+	*msglen = 0;
+	for (a = arg; a->filter; a++) {
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+
+		*msglen = status;
+
+		while (NLMSG_OK(h, *msglen)) {
+			int err = 0;
+
+			h->nlmsg_flags &= ~a->nc_flags;
+
+			if (nladdr->nl_pid != 0 ||
+			    h->nlmsg_pid != rth->local.nl_pid ||
+			    h->nlmsg_seq != rth->dump)
+				goto skip_it;
+
+			if (h->nlmsg_flags & NLM_F_DUMP_INTR)
+				*dump_intr = 1;
+
+			if (h->nlmsg_type == NLMSG_DONE) {
+				err = rtnl_dump_done(h, a);
+				if (err < 0)
+					return -1;
+
+				found_done = 1;
+				break; /* process next filter */
+			}
+
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				err = rtnl_dump_error(rth, h, a);
+				if (err < 0)
+					return -1;
+
+				goto skip_it;
+			}
+
+			if (!rth->dump_fp) {
+				if (nl_stats_on) {
+					__u64 t = nl_stats_now();
+
+					err = a->filter(h, a->arg1);
+					nl_stats_filter(nl_stats_now() - t);
+				} else {
+					err = a->filter(h, a->arg1);
+				}
+				if (err < 0)
+					return err;
+			}
+
+skip_it:
+			h = NLMSG_NEXT(h, *msglen);
+		}
+	}
+
+	return found_done;
+}
+
+static rtnl_prescan_t rtnl_dump_prescan;
+
+/*
+ * With a prescan hook, the whole dump is received before the filters see
+ * any of it and the hook is run on every message as it arrives. This lets
+ * -resolve start the lookups of all the addresses before printing the
+ * first one.
+ */
+void rtnl_dump_set_prescan(rtnl_prescan_t prescan)
+{
+	rtnl_dump_prescan = prescan;
+}
+
+struct rtnl_dump_chunk {
+	struct rtnl_dump_chunk	*next;
+	__u32			nl_pid;
+	int			len;
+	bool			trunc;
+	char			data[];
+};
+
+/* Returns 1 once the end of the dump is in the chunk */
+static int rtnl_dump_prescan_buf(struct rtnl_handle *rth,
+				 const struct rtnl_dump_chunk *c)
+{
+	const struct nlmsghdr *h = (void *)c->data;
+	int len = c->len;
+
+	for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+		if (c->nl_pid != 0 || h->nlmsg_pid != rth->local.nl_pid ||
+		    h->nlmsg_seq != rth->dump)
+			continue;
+		if (h->nlmsg_type == NLMSG_DONE || h->nlmsg_type == NLMSG_ERROR)
+			return 1;
+		rtnl_dump_prescan(rth->proto, h);
+	}
+	return 0;
+}
+
+/*
+ * Receive a dump whole, then run it through the filters. Returns 1 if
+ * the dump was not complete after all, so that the caller goes on with
+ * the normal receive loop.
+ */
+static int rtnl_dump_filter_prescan(struct rtnl_handle *rth,
+				    const struct rtnl_dump_filter_arg *arg,
+				    int *ret)
+{
+	struct rtnl_dump_chunk *head = NULL, **tail = &head, *c;
+	struct sockaddr_nl nladdr = {};
 	struct iovec iov;
 	struct msghdr msg = {
 		.msg_name = &nladdr,
@@ -868,76 +1240,115 @@ static int rtnl_dump_filter_l(struct rtnl_handle *rth,
 		.msg_iov = &iov,
 		.msg_iovlen = 1,
 	};
-	char *buf;
 	int dump_intr = 0;
+	int done = 0;
+	int more = 0;
 
-	while (1) {
-		int status;
-		const struct rtnl_dump_filter_arg *a;
-		int found_done = 0;
-		int msglen = 0;
-
-		status = rtnl_recvmsg(rth->fd, &msg, &buf);
-		if (status < 0)
-			return status;
-
-		if (rth->dump_fp)
-			fwrite(buf, 1, NLMSG_ALIGN(status), rth->dump_fp);
+	*ret = 0;
+	while (!done) {
+		int status = rtnl_recvmsg_rbuf(rth, &msg);
 
-		for (a = arg; a->filter; a++) {
-			struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		if (status < 0) {
+			*ret = status;
+			goto out;
+		}
 
-			msglen = status;
+		c = malloc(sizeof(*c) + status);
+		if (!c) {
+			*ret = -1;
+			goto out;
+		}
+		c->next = NULL;
+		c->nl_pid = nladdr.nl_pid;
+		c->len = status;
+		c->trunc = msg.msg_flags & MSG_TRUNC;
+		memcpy(c->data, rth->rbuf, status);
+		*tail = c;
+		tail = &c->next;
+
+		done = rtnl_dump_prescan_buf(rth, c);
+	}
 
-			while (NLMSG_OK(h, msglen)) {
-				int err = 0;
+	for (c = head; c; c = c->next) {
+		int err, msglen = 0;
 
-				h->nlmsg_flags &= ~a->nc_flags;
+		nladdr.nl_pid = c->nl_pid;
+		err = rtnl_dump_filter_buf(rth, &nladdr, arg, c->data, c->len,
+					   &msglen, &dump_intr);
+		if (err < 0) {
+			*ret = err;
+			goto out;
+		}
+		if (err) {
+			if (dump_intr)
+				fprintf(stderr,
+					"Dump was interrupted and may be inconsistent.\n");
+			goto out;
+		}
+		if (c->trunc) {
+			fprintf(stderr, "Message truncated\n");
+			continue;
+		}
+		if (msglen) {
+			fprintf(stderr, "!!!Remnant of size %d\n", msglen);
+			exit(1);
+		}
+	}
+	/* an error the filter let pass ended the dump without NLMSG_DONE */
+	more = 1;
+out:
+	while (head) {
+		c = head->next;
+		free(head);
+		head = c;
+	}
+	return more;
+}
 
-				if (nladdr.nl_pid != 0 ||
-				    h->nlmsg_pid != rth->local.nl_pid ||
-				    h->nlmsg_seq != rth->dump)
-					goto skip_it;
+/* set by rtnl_dump_set_pipeline(), see nl_pipeline.c */
+int (*rtnl_dump_pipeline)(struct rtnl_handle *rth,
+			  const struct rtnl_dump_filter_arg *arg, int *ret);
 
-				if (h->nlmsg_flags & NLM_F_DUMP_INTR)
-					dump_intr = 1;
+static int __rtnl_dump_filter_l(struct rtnl_handle *rth,
+				const struct rtnl_dump_filter_arg *arg)
+{
+	struct sockaddr_nl nladdr = {};
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	int dump_intr = 0;
 
-				if (h->nlmsg_type == NLMSG_DONE) {
-					err = rtnl_dump_done(h, a);
-					if (err < 0) {
-						free(buf);
-						return -1;
-					}
+	if (rtnl_dump_prescan && !rth->dump_fp) {
+		int ret;
 
-					found_done = 1;
-					break; /* process next filter */
-				}
+		if (!rtnl_dump_filter_prescan(rth, arg, &ret) || ret)
+			return ret;
+	} else if (rtnl_dump_pipeline && !rth->dump_fp && !nl_stats_on) {
+		/* the statistics would be taken from two threads */
+		int ret;
 
-				if (h->nlmsg_type == NLMSG_ERROR) {
-					err = rtnl_dump_error(rth, h, a);
-					if (err < 0) {
-						free(buf);
-						return -1;
-					}
+		if (!rtnl_dump_pipeline(rth, arg, &ret))
+			return ret;
+	}
 
-					goto skip_it;
-				}
+	while (1) {
+		int status, err;
+		int msglen = 0;
 
-				if (!rth->dump_fp) {
-					err = a->filter(h, a->arg1);
-					if (err < 0) {
-						free(buf);
-						return err;
-					}
-				}
+		status = rtnl_recvmsg_rbuf(rth, &msg);
+		if (status < 0)
+			return status;
 
-skip_it:
-				h = NLMSG_NEXT(h, msglen);
-			}
-		}
-		free(buf);
+		err = rtnl_dump_filter_buf(rth, &nladdr, arg, rth->rbuf,
+					   status, &msglen, &dump_intr);
+		if (err < 0)
+			return err;
 
-		if (found_done) {
+		if (err) {
 			if (dump_intr)
 				fprintf(stderr,
 					"Dump was interrupted and may be inconsistent.\n");
@@ -955,6 +1366,111 @@ skip_it:
 	}
 }
 
+static int rtnl_dump_filter_l(struct rtnl_handle *rth,
+			      const struct rtnl_dump_filter_arg *arg)
+{
+	int ret = __rtnl_dump_filter_l(rth, arg);
+
+	if (nl_stats_on)
+		nl_stats_end();
+	return ret;
+}
+
+/* Collect the replies of dumps already requested on several handles.
+ *
+ * A netlink socket runs one dump at a time, so each entry needs its own
+ * handle; replies are read as they become ready and demultiplexed by
+ * socket and sequence number into the entry's filter. Returns once all
+ * dumps completed or on the first error.
+ */
+int rtnl_dump_filter_multi(struct rtnl_dump_multi *dumps, int count)
+{
+	struct pollfd pfds[count];
+	int pending = count;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		dumps[i].done = false;
+		dumps[i].dump_intr = 0;
+	}
+
+	while (pending) {
+		int n = 0;
+
+		for (i = 0; i < count; i++) {
+			if (dumps[i].done)
+				continue;
+			pfds[n].fd = dumps[i].rth->fd;
+			pfds[n].events = POLLIN;
+			pfds[n].revents = 0;
+			n++;
+		}
+
+		if (poll(pfds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return -1;
+		}
+
+		for (i = 0, n = 0; i < count; i++) {
+			struct rtnl_dump_multi *d = &dumps[i];
+			const struct rtnl_dump_filter_arg a[] = {
+				{
+					.filter = d->filter, .arg1 = d->arg,
+					.nc_flags = d->nc_flags,
+				},
+				{ },
+			};
+			struct sockaddr_nl nladdr = {};
+			struct iovec iov;
+			struct msghdr msg = {
+				.msg_name = &nladdr,
+				.msg_namelen = sizeof(nladdr),
+				.msg_iov = &iov,
+				.msg_iovlen = 1,
+			};
+			int status, err, msglen;
+
+			if (d->done)
+				continue;
+			if (!pfds[n++].revents)
+				continue;
+
+			status = rtnl_recvmsg_rbuf(d->rth, &msg);
+			if (status < 0)
+				return status;
+
+			err = rtnl_dump_filter_buf(d->rth, &nladdr, a,
+						   d->rth->rbuf, status,
+						   &msglen, &d->dump_intr);
+			if (err < 0)
+				return err;
+
+			if (err) {
+				if (d->dump_intr)
+					fprintf(stderr,
+						"Dump was interrupted and may be inconsistent.\n");
+				d->done = true;
+				pending--;
+				continue;
+			}
+
+			if (msg.msg_flags & MSG_TRUNC) {
+				fprintf(stderr, "Message truncated\n");
+				continue;
+			}
+			if (msglen) {
+				fprintf(stderr, "!!!Remnant of size %d\n",
+					msglen);
+				exit(1);
+			}
+		}
+	}
+
+	return 0;
+}
+
 int rtnl_dump_filter_nc(struct rtnl_handle *rth,
 			rtnl_filter_t filter,
 			void *arg1, __u16 nc_flags)
@@ -1000,9 +1516,495 @@ static void rtnl_talk_error(struct nlmsghdr *h, struct nlmsgerr *err,
 }
 
 
-static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
-			   size_t iovlen, struct nlmsghdr **answer,
-			   bool show_rtnl_err, nl_ext_ack_fn_t errfn)
+int rtnl_flush_open(struct rtnl_flush *f, int window)
+{
+	return rtnl_flush_open_byproto(f, window, NETLINK_ROUTE);
+}
+
+int rtnl_flush_open_byproto(struct rtnl_flush *f, int window, int protocol)
+{
+	socklen_t optlen = sizeof(int);
+	int sndbuf, rcvlen;
+
+	memset(f, 0, sizeof(*f));
+	if (window <= 0)
+		window = RTNL_FLUSH_WINDOW;
+
+	if (rtnl_open_byproto(&f->rth, 0, protocol) < 0)
+		return -1;
+
+	/* The kernel caps this at wmem_max, use whatever we got */
+	sndbuf = window;
+	setsockopt(f->rth.fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	if (getsockopt(f->rth.fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0) {
+		perror("SO_SNDBUF");
+		goto err;
+	}
+	/* reported value is doubled for bookkeeping overhead */
+	f->max_dgram = MIN(window, sndbuf / 2);
+
+	/* the replies to a datagram have to fit, see rtnl_flush_commit();
+	 * never go below what rtnl_open() asked for
+	 */
+	rcvlen = window > rcvbuf ? window : rcvbuf;
+	if (setsockopt(f->rth.fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &rcvlen, sizeof(rcvlen)) < 0)
+		setsockopt(f->rth.fd, SOL_SOCKET, SO_RCVBUF,
+			   &rcvlen, sizeof(rcvlen));
+	if (getsockopt(f->rth.fd, SOL_SOCKET, SO_RCVBUF, &rcvlen, &optlen) < 0) {
+		perror("SO_RCVBUF");
+		goto err;
+	}
+	/* this one is what the kernel checks, keep half of it spare */
+	f->max_replies = rcvlen / 2;
+
+	f->buf = malloc(window);
+	if (!f->buf) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		goto err;
+	}
+	f->size = window;
+	f->rth.flags |= RTNL_HANDLE_F_SUPPRESS_NLERR;
+
+	clock_gettime(CLOCK_MONOTONIC, &f->start);
+	return 0;
+err:
+	rtnl_close(&f->rth);
+	return -1;
+}
+
+int rtnl_flush_add(struct rtnl_flush *f, const struct nlmsghdr *n, __u16 type)
+{
+	struct nlmsghdr *fn;
+
+	if (n->nlmsg_len > f->max_dgram) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (NLMSG_ALIGN(f->len) + n->nlmsg_len > f->size ||
+	    (f->max_queued && f->queued >= f->max_queued)) {
+		int err = rtnl_flush_commit(f);
+
+		/* failed requests were passed to report(), keep going */
+		if (err == -2 || (err < 0 && !f->report))
+			return -1;
+	}
+
+	fn = (struct nlmsghdr *)(f->buf + NLMSG_ALIGN(f->len));
+	memcpy(fn, n, n->nlmsg_len);
+	if (type)
+		fn->nlmsg_type = type;
+	fn->nlmsg_flags = NLM_F_REQUEST | f->flags |
+			  (type ? 0 : n->nlmsg_flags);
+	fn->nlmsg_flags &= ~NLM_F_ACK;
+	fn->nlmsg_pid = 0;
+	fn->nlmsg_seq = ++f->rth.seq;
+	if (!f->queued)
+		f->first_seq = fn->nlmsg_seq;
+	if (f->tags)
+		f->tags[f->queued] = f->tag;
+	f->len = NLMSG_ALIGN(f->len) + n->nlmsg_len;
+	f->queued++;
+
+	return 0;
+}
+
+/* Report every failed request of a window instead of only the first one.
+ * max_queued bounds the number of requests per window and tags each
+ * request with the value of f->tag at the time it was added.
+ */
+int rtnl_flush_set_report(struct rtnl_flush *f, unsigned int max_queued,
+			  void (*report)(const struct nlmsghdr *err, int tag,
+					 void *arg),
+			  void *arg)
+{
+	f->tags = calloc(max_queued, sizeof(*f->tags));
+	if (!f->tags) {
+		fprintf(stderr, "malloc error: not enough buffer\n");
+		return -1;
+	}
+
+	f->max_queued = max_queued;
+	f->report = report;
+	f->report_arg = arg;
+	return 0;
+}
+
+/* Pass the answers to requests that have one (e.g. XFRM_MSG_ALLOCSPI) to
+ * answer(), with the tag of the request. Needs rtnl_flush_set_report().
+ */
+void rtnl_flush_set_answer(struct rtnl_flush *f,
+			   void (*answer)(const struct nlmsghdr *n, int tag,
+					  void *arg))
+{
+	f->answer = answer;
+}
+
+/* The kernel handles the requests of a datagram and queues the replies
+ * before sendmsg() returns, so a datagram only takes as many requests as
+ * the receive buffer has room for replies to. A reply costs about the
+ * skb overhead and twice the echoed request, for the rounding up of the
+ * allocation.
+ */
+#define RTNL_FLUSH_REPLY_COST(len)	(1024 + 2 * NLMSG_ALIGN(len))
+/* Never wait longer than this for a reply that should already be in */
+#define RTNL_FLUSH_TIMEOUT		5000	/* ms */
+
+/* Handle one datagram of replies, waiting at most timeout ms for it.
+ *
+ * Returns 1 once the reply to ack_seq is in, 0 if it is not yet (or
+ * there was nothing to read) and -2 if talking to the kernel failed or
+ * timed out. *error is set to the first failure that is not ignored and
+ * *replied past the last request a reply was read for.
+ */
+static int rtnl_flush_replies(struct rtnl_flush *f, unsigned int queued,
+			      __u32 ack_seq, int timeout, int *error,
+			      unsigned int *replied)
+{
+	struct pollfd pfd = { .fd = f->rth.fd, .events = POLLIN };
+	struct sockaddr_nl nladdr;
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct nlmsghdr *h;
+	int status;
+
+	do {
+		status = poll(&pfd, 1, timeout);
+	} while (status < 0 && errno == EINTR);
+	if (status < 0)
+		return -2;
+	if (status == 0) {
+		if (!timeout)
+			return 0;
+		errno = ETIMEDOUT;
+		return -2;
+	}
+
+	status = rtnl_recvmsg_rbuf(&f->rth, &msg);
+	if (status < 0) {
+		errno = -status;
+		return -2;
+	}
+
+	for (h = (struct nlmsghdr *)f->rth.rbuf; NLMSG_OK(h, status);
+	     h = NLMSG_NEXT(h, status)) {
+		struct nlmsgerr *err = NLMSG_DATA(h);
+		__u32 idx = h->nlmsg_seq - f->first_seq;
+
+		if (h->nlmsg_pid != f->rth.local.nl_pid)
+			continue;
+		if (idx < queued && idx >= *replied)
+			*replied = idx + 1;
+
+		if (h->nlmsg_type != NLMSG_ERROR) {
+			if (f->answer && f->tags && idx < queued)
+				f->answer(h, f->tags[idx], f->report_arg);
+			continue;
+		}
+
+		if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+			fprintf(stderr, "ERROR truncated\n");
+			errno = EINVAL;
+			return -2;
+		}
+
+		if (err->error && -err->error != f->ignore_errno) {
+			if (f->report && idx < queued)
+				f->report(h, f->tags[idx], f->report_arg);
+			if (!*error)
+				*error = -err->error;
+		}
+
+		if (h->nlmsg_seq == ack_seq)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Replies were dropped (ENOBUFS): read what is left of them, then fail
+ * every request of the window past the last reply, as their outcome is
+ * unknown.
+ */
+static void rtnl_flush_resync(struct rtnl_flush *f, unsigned int queued,
+			      int *error, unsigned int *replied)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct nlmsgerr	e;
+	} lost = {
+		.n.nlmsg_len = sizeof(lost),
+		.n.nlmsg_type = NLMSG_ERROR,
+		.e.error = -ENOBUFS,
+	};
+	struct pollfd pfd = { .fd = f->rth.fd, .events = POLLIN };
+	unsigned int idx;
+	char *p = f->buf;
+
+	while (poll(&pfd, 1, 0) > 0 &&
+	       rtnl_flush_replies(f, queued, 0, 0, error, replied) >= 0)
+		;
+
+	for (idx = 0; idx < queued; idx++) {
+		struct nlmsghdr *h = (struct nlmsghdr *)p;
+
+		p += NLMSG_ALIGN(h->nlmsg_len);
+		if (idx < *replied)
+			continue;
+		if (f->report) {
+			lost.n.nlmsg_seq = h->nlmsg_seq;
+			lost.n.nlmsg_pid = f->rth.local.nl_pid;
+			lost.e.msg = *h;
+			f->report(&lost.n, f->tags[idx], f->report_arg);
+		}
+	}
+	*error = ENOBUFS;
+}
+
+/* Send the queued window, a datagram at a time, and read the replies
+ * to each datagram before sending the next one. The last request of a
+ * datagram asks for an ACK; the failures of the others come before it.
+ *
+ * Returns 0 on success, -1 if a request failed (errno is set to the
+ * first failure, ENOBUFS if replies were lost and the rest of the
+ * window was given up) and -2 if talking to the kernel failed.
+ */
+int rtnl_flush_commit(struct rtnl_flush *f)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	char *p = f->buf, *end = f->buf + f->len;
+	unsigned int queued = f->queued;
+	unsigned int replied = 0;
+	int error = 0;
+
+	if (!queued)
+		return 0;
+
+	f->queued = 0;
+	f->len = 0;
+
+	while (p < end) {
+		struct nlmsghdr *h = (struct nlmsghdr *)p, *last;
+		unsigned int count = 0;
+		int cost = 0, ret;
+		char *q = p;
+
+		/* whole requests, while both they and their replies fit */
+		do {
+			last = h;
+			cost += RTNL_FLUSH_REPLY_COST(h->nlmsg_len);
+			q += NLMSG_ALIGN(h->nlmsg_len);
+			count++;
+			h = (struct nlmsghdr *)q;
+		} while (q < end && (q - p) + h->nlmsg_len <= f->max_dgram &&
+			 cost + RTNL_FLUSH_REPLY_COST(h->nlmsg_len) <=
+			 f->max_replies);
+		if (q > end)
+			q = end;
+		last->nlmsg_flags |= NLM_F_ACK;
+
+		iov.iov_base = p;
+		iov.iov_len = q - p;
+		if (rtnl_sendmsg(f->rth.fd, &msg) < 0)
+			return -2;
+		f->issued += count;
+		p = q;
+
+		do {
+			ret = rtnl_flush_replies(f, queued, last->nlmsg_seq,
+						 RTNL_FLUSH_TIMEOUT, &error,
+						 &replied);
+		} while (ret == 0);
+
+		if (ret < 0) {
+			if (errno != ENOBUFS)
+				return -2;
+			rtnl_flush_resync(f, queued, &error, &replied);
+			break;
+		}
+	}
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/* deletes issued per second since rtnl_flush_open() */
+double rtnl_flush_rate(const struct rtnl_flush *f)
+{
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - f->start.tv_sec) +
+		  (now.tv_nsec - f->start.tv_nsec) / 1e9;
+	if (elapsed <= 0)
+		return 0;
+
+	return f->issued / elapsed;
+}
+
+void rtnl_flush_close(struct rtnl_flush *f)
+{
+	free(f->tags);
+	f->tags = NULL;
+	free(f->buf);
+	f->buf = NULL;
+	rtnl_close(&f->rth);
+}
+
+static struct rtnl_async {
+	struct rtnl_handle	*owner;
+	struct rtnl_flush	flush;
+	unsigned int		failed;
+	void			(*report)(int tag, void *arg);
+	void			*arg;
+} *rtnl_async;
+
+static void rtnl_async_report(const struct nlmsghdr *h, int tag, void *arg)
+{
+	struct rtnl_async *a = arg;
+
+	rtnl_talk_error((struct nlmsghdr *)h, NLMSG_DATA(h), NULL);
+	a->failed++;
+	if (a->report)
+		a->report(tag, a->arg);
+}
+
+int rtnl_async_start(struct rtnl_handle *rth, unsigned int window,
+		     void (*report)(int tag, void *arg), void *arg)
+{
+	struct rtnl_async *a;
+
+	if (rtnl_async) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	a = calloc(1, sizeof(*a));
+	if (!a)
+		return -1;
+
+	if (rtnl_flush_open(&a->flush, 0) < 0)
+		goto err_free;
+
+	if (rtnl_flush_set_report(&a->flush, window, rtnl_async_report,
+				  a) < 0)
+		goto err_close;
+
+	a->owner = rth;
+	a->report = report;
+	a->arg = arg;
+	rtnl_async = a;
+	return 0;
+
+err_close:
+	rtnl_flush_close(&a->flush);
+err_free:
+	free(a);
+	return -1;
+}
+
+void rtnl_async_tag(int tag)
+{
+	if (rtnl_async)
+		rtnl_async->flush.tag = tag;
+}
+
+unsigned int rtnl_async_failed(void)
+{
+	return rtnl_async ? rtnl_async->failed : 0;
+}
+
+/* Send whatever is queued and wait until the kernel has handled it.
+ * Failed requests are reported through the callback, only a failure
+ * to talk to the kernel is returned.
+ */
+int rtnl_async_sync(void)
+{
+	if (!rtnl_async || !rtnl_async->flush.queued)
+		return 0;
+
+	if (rtnl_flush_commit(&rtnl_async->flush) == -2) {
+		perror("Cannot talk to rtnetlink");
+		return -1;
+	}
+	return 0;
+}
+
+/* Complete the queued requests and leave windowed mode, returns the
+ * number of requests that failed since rtnl_async_start().
+ */
+unsigned int rtnl_async_stop(void)
+{
+	struct rtnl_async *a = rtnl_async;
+	unsigned int failed;
+
+	if (!a)
+		return 0;
+
+	if (rtnl_async_sync() < 0)
+		a->failed++;
+	failed = a->failed;
+
+	rtnl_async = NULL;
+	rtnl_flush_close(&a->flush);
+	free(a);
+
+	return failed;
+}
+
+static bool rtnl_async_queue(struct rtnl_handle *rtnl, struct nlmsghdr *n)
+{
+	struct rtnl_async *a = rtnl_async;
+
+	if (!a || a->owner != rtnl || (n->nlmsg_flags & NLM_F_ECHO) ||
+	    n->nlmsg_len > a->flush.max_dgram)
+		return false;
+
+	if (rtnl_flush_add(&a->flush, n, 0) < 0) {
+		perror("Cannot talk to rtnetlink");
+		a->failed++;
+		if (a->report)
+			a->report(a->flush.tag, a->arg);
+	}
+	return true;
+}
+
+/* Requests larger than the send buffer fail with EMSGSIZE, so make room
+ * for big ones (e.g. long action lists) as they come. The force variant
+ * is not capped by wmem_max but needs CAP_NET_ADMIN.
+ */
+static void rtnl_grow_sndbuf(struct rtnl_handle *rtnl, size_t len)
+{
+	int sndbuf = len;
+
+	if (setsockopt(rtnl->fd, SOL_SOCKET, SO_SNDBUFFORCE,
+		       &sndbuf, sizeof(sndbuf)) < 0 &&
+	    setsockopt(rtnl->fd, SOL_SOCKET, SO_SNDBUF,
+		       &sndbuf, sizeof(sndbuf)) < 0)
+		return;
+	rtnl->max_dgram = len;
+}
+
+static int rtnl_talk_iov_once(struct rtnl_handle *rtnl, struct iovec *iov,
+			      size_t iovlen, struct nlmsghdr **answer,
+			      bool show_rtnl_err, nl_ext_ack_fn_t errfn)
 {
 	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
 	struct iovec riov;
@@ -1015,16 +2017,30 @@ static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
 	unsigned int seq = 0;
 	struct nlmsghdr *h;
 	int i, status;
+	size_t len;
 	char *buf;
 
-	for (i = 0; i < iovlen; i++) {
+	if (!answer && show_rtnl_err && !errfn && iovlen == 1 &&
+	    rtnl_async_queue(rtnl, iov[0].iov_base))
+		return 0;
+
+	if (rtnl_async_sync() < 0)
+		return -1;
+
+	for (i = 0, len = 0; i < iovlen; i++) {
 		h = iov[i].iov_base;
 		h->nlmsg_seq = seq = ++rtnl->seq;
 		if (answer == NULL)
 			h->nlmsg_flags |= NLM_F_ACK;
+		len += iov[i].iov_len;
 	}
 
-	status = sendmsg(rtnl->fd, &msg, 0);
+	if (len > rtnl->max_dgram)
+		rtnl_grow_sndbuf(rtnl, len);
+
+	if (nl_stats_on)
+		nl_stats_begin(iov[0].iov_base, false);
+	status = rtnl_sendmsg(rtnl->fd, &msg);
 	if (status < 0) {
 		perror("Cannot talk to rtnetlink");
 		return -1;
@@ -1135,6 +2151,18 @@ next:
 	}
 }
 
+static int __rtnl_talk_iov(struct rtnl_handle *rtnl, struct iovec *iov,
+			   size_t iovlen, struct nlmsghdr **answer,
+			   bool show_rtnl_err, nl_ext_ack_fn_t errfn)
+{
+	int ret = rtnl_talk_iov_once(rtnl, iov, iovlen, answer, show_rtnl_err,
+				     errfn);
+
+	if (nl_stats_on)
+		nl_stats_end();
+	return ret;
+}
+
 static int __rtnl_talk(struct rtnl_handle *rtnl, struct nlmsghdr *n,
 		       struct nlmsghdr **answer,
 		       bool show_rtnl_err, nl_ext_ack_fn_t errfn)
@@ -1292,6 +2320,104 @@ int rtnl_listen(struct rtnl_handle *rtnl,
 	}
 }
 
+#define RTNL_BATCH_CMSG	CMSG_SPACE(sizeof(int))
+
+int rtnl_batch_init(struct rtnl_batch *b, unsigned int vlen, size_t slot)
+{
+	unsigned int i;
+
+	b->msgs = calloc(vlen, sizeof(*b->msgs));
+	b->iov = calloc(vlen, sizeof(*b->iov));
+	b->buf = malloc(vlen * slot);
+	b->cbuf = calloc(vlen, RTNL_BATCH_CMSG);
+	if (!b->msgs || !b->iov || !b->buf || !b->cbuf) {
+		rtnl_batch_free(b);
+		return -1;
+	}
+
+	for (i = 0; i < vlen; i++) {
+		b->iov[i].iov_base = b->buf + i * slot;
+		b->iov[i].iov_len = slot;
+		b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	b->slot = slot;
+	b->vlen = vlen;
+	return 0;
+}
+
+void rtnl_batch_free(struct rtnl_batch *b)
+{
+	free(b->msgs);
+	free(b->iov);
+	free(b->buf);
+	free(b->cbuf);
+	b->msgs = NULL;
+	b->iov = NULL;
+	b->buf = NULL;
+	b->cbuf = NULL;
+}
+
+/*
+ * Like rtnl_listen(), but take whatever is queued on the socket, up to
+ * b->vlen datagrams, with a single non-blocking recvmmsg() and return.
+ * @ts is set to the time the batch was received before @handler is
+ * called. Returns the number of datagrams handled, 0 if none were
+ * queued, or -1 with errno set (ENOBUFS when the kernel had to drop
+ * notifications).
+ */
+int rtnl_listen_batch(struct rtnl_handle *rtnl, struct rtnl_batch *b,
+		      struct timespec *ts, rtnl_listen_filter_t handler,
+		      void *jarg)
+{
+	bool all_nsid = rtnl->flags & RTNL_HANDLE_F_LISTEN_ALL_NSID;
+	unsigned int i;
+	int n;
+
+	/* the kernel shrinks msg_controllen to what it filled in */
+	for (i = 0; all_nsid && i < b->vlen; i++) {
+		struct msghdr *msg = &b->msgs[i].msg_hdr;
+
+		msg->msg_control = b->cbuf + i * RTNL_BATCH_CMSG;
+		msg->msg_controllen = RTNL_BATCH_CMSG;
+	}
+
+	n = recvmmsg(rtnl->fd, b->msgs, b->vlen, MSG_DONTWAIT, NULL);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+	clock_gettime(CLOCK_REALTIME, ts);
+
+	for (i = 0; i < n; i++) {
+		struct msghdr *msg = &b->msgs[i].msg_hdr;
+		int status = b->msgs[i].msg_len;
+		struct rtnl_ctrl_data ctrl = { .nsid = -1 };
+		struct cmsghdr *cmsg;
+		struct nlmsghdr *h;
+
+		if (msg->msg_flags & MSG_TRUNC) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+
+		for (cmsg = all_nsid ? CMSG_FIRSTHDR(msg) : NULL; cmsg;
+		     cmsg = CMSG_NXTHDR(msg, cmsg))
+			if (cmsg->cmsg_level == SOL_NETLINK &&
+			    cmsg->cmsg_type == NETLINK_LISTEN_ALL_NSID &&
+			    cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+				ctrl.nsid = *(int *)CMSG_DATA(cmsg);
+
+		for (h = b->iov[i].iov_base; NLMSG_OK(h, status);
+		     h = NLMSG_NEXT(h, status)) {
+			int err = handler(&ctrl, h, jarg);
+
+			if (err < 0)
+				return err;
+		}
+	}
+	return n;
+}
+
 int rtnl_from_file(FILE *rtnl, rtnl_listen_filter_t handler,
 		   void *jarg)
 {
@@ -1579,5 +2705,5 @@ int rtnl_tunneldump_req(struct rtnl_handle *rth, int family, int ifindex,
 		.tmsg.ifindex = ifindex,
 	};
 
-	return send(rth->fd, &req, sizeof(req), 0);
+	return rtnl_send_req(rth, &req, sizeof(req));
 }
@@ -12,7 +12,11 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
 #include <net/if.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "libnetlink.h"
 #include "ll_map.h"
@@ -23,22 +27,126 @@ struct ll_cache {
 	struct hlist_node idx_hash;
 	struct hlist_node name_hash;
 	unsigned	flags;
+	bool		flags_known;	/* false when loaded from a snapshot */
 	unsigned 	index;
 	unsigned short	type;
 	struct list_head altnames_list;
 	char		name[];
 };
 
-#define IDXMAP_SIZE	1024
-static struct hlist_head idx_head[IDXMAP_SIZE];
-static struct hlist_head name_head[IDXMAP_SIZE];
+/* Both maps start with LL_HASH_MIN buckets and double whenever they
+ * hold more entries than buckets, so lookups stay O(1) on hosts with
+ * many thousands of links and altnames.
+ */
+#define LL_HASH_MIN	1024
+
+struct ll_hash {
+	struct hlist_head	*head;
+	unsigned int		size;
+	unsigned int		count;
+	unsigned long		hits;
+	unsigned long		misses;
+};
+
+static struct ll_hash idx_map;
+static struct ll_hash name_map;
+
+unsigned namehash(const char *str)
+{
+	unsigned hash = 5381;
+
+	while (*str)
+		hash = ((hash << 5) + hash) + *str++; /* hash * 33 + c */
+
+	return hash;
+}
+
+static unsigned int ll_idx_key(const struct hlist_node *n)
+{
+	return container_of(n, struct ll_cache, idx_hash)->index;
+}
+
+static unsigned int ll_name_key(const struct hlist_node *n)
+{
+	return namehash(container_of(n, struct ll_cache, name_hash)->name);
+}
+
+static struct hlist_head *ll_hash_bucket(const struct ll_hash *h,
+					 unsigned int key)
+{
+	return h->head ? &h->head[key & (h->size - 1)] : NULL;
+}
+
+static void ll_map_stats_atexit(void)
+{
+	ll_map_stats(stderr);
+}
+
+static void ll_hash_resize(struct ll_hash *h, unsigned int size,
+			   unsigned int (*key)(const struct hlist_node *n))
+{
+	struct hlist_head *head;
+	unsigned int i;
+
+	if (!idx_map.head && !name_map.head && getenv("LL_MAP_STATS"))
+		atexit(ll_map_stats_atexit);
+
+	head = calloc(size, sizeof(*head));
+	if (!head)
+		return;	/* keep going with longer chains */
+
+	for (i = 0; i < h->size; i++) {
+		struct hlist_node *n, *tmp;
+
+		hlist_for_each_safe(n, tmp, &h->head[i])
+			hlist_add_head(n, &head[key(n) & (size - 1)]);
+	}
+
+	free(h->head);
+	h->head = head;
+	h->size = size;
+}
+
+static void ll_hash_add(struct ll_hash *h, struct hlist_node *n,
+			unsigned int (*key)(const struct hlist_node *n))
+{
+	if (!h->head)
+		ll_hash_resize(h, LL_HASH_MIN, key);
+	else if (h->count >= h->size)
+		ll_hash_resize(h, 2 * h->size, key);
+
+	if (!h->head)
+		return;
+
+	hlist_add_head(n, ll_hash_bucket(h, key(n)));
+	h->count++;
+}
+
+static void ll_hash_del(struct ll_hash *h, struct hlist_node *n)
+{
+	hlist_del(n);
+	h->count--;
+}
+
+static const struct ll_cache *ll_hash_account(struct ll_hash *h,
+					      const struct ll_cache *im)
+{
+	if (im)
+		h->hits++;
+	else
+		h->misses++;
+	return im;
+}
 
 static struct ll_cache *ll_get_by_index(unsigned index)
 {
+	struct hlist_head *head = ll_hash_bucket(&idx_map, index);
 	struct hlist_node *n;
-	unsigned h = index & (IDXMAP_SIZE - 1);
 
-	hlist_for_each(n, &idx_head[h]) {
+	if (!head)
+		return NULL;
+
+	hlist_for_each(n, head) {
 		struct ll_cache *im
 			= container_of(n, struct ll_cache, idx_hash);
 		if (im->index == index)
@@ -48,22 +156,15 @@ static struct ll_cache *ll_get_by_index(unsigned index)
 	return NULL;
 }
 
-unsigned namehash(const char *str)
-{
-	unsigned hash = 5381;
-
-	while (*str)
-		hash = ((hash << 5) + hash) + *str++; /* hash * 33 + c */
-
-	return hash;
-}
-
 static struct ll_cache *ll_get_by_name(const char *name)
 {
+	struct hlist_head *head = ll_hash_bucket(&name_map, namehash(name));
 	struct hlist_node *n;
-	unsigned h = namehash(name) & (IDXMAP_SIZE - 1);
 
-	hlist_for_each(n, &name_head[h]) {
+	if (!head)
+		return NULL;
+
+	hlist_for_each(n, head) {
 		struct ll_cache *im
 			= container_of(n, struct ll_cache, name_hash);
 
@@ -74,12 +175,44 @@ static struct ll_cache *ll_get_by_name(const char *name)
 	return NULL;
 }
 
+static void ll_hash_stats(FILE *fp, const char *what, const struct ll_hash *h)
+{
+	unsigned int i, used = 0, longest = 0;
+
+	for (i = 0; i < h->size; i++) {
+		struct hlist_node *n;
+		unsigned int len = 0;
+
+		hlist_for_each(n, &h->head[i])
+			len++;
+		if (len)
+			used++;
+		if (len > longest)
+			longest = len;
+	}
+
+	fprintf(fp,
+		"ll_map %s: %u entries, %u buckets (%u used), longest chain %u, %lu hits, %lu misses\n",
+		what, h->count, h->size, used, longest, h->hits, h->misses);
+}
+
+static __u64 ll_snap_gen;	/* of the snapshot loaded or stored */
+
+/* Also printed on exit when LL_MAP_STATS is set in the environment */
+void ll_map_stats(FILE *fp)
+{
+	ll_hash_stats(fp, "index", &idx_map);
+	ll_hash_stats(fp, "name", &name_map);
+	if (ll_snap_gen)
+		fprintf(fp, "ll_map snapshot: generation %llu\n",
+			(unsigned long long)ll_snap_gen);
+}
+
 static struct ll_cache *ll_entry_create(struct ifinfomsg *ifi,
 					const char *ifname,
 					struct ll_cache *parent_im)
 {
 	struct ll_cache *im;
-	unsigned int h;
 
 	im = malloc(sizeof(*im) + strlen(ifname) + 1);
 	if (!im)
@@ -88,26 +221,25 @@ static struct ll_cache *ll_entry_create(struct ifinfomsg *ifi,
 	strcpy(im->name, ifname);
 	im->type = ifi->ifi_type;
 	im->flags = ifi->ifi_flags;
+	im->flags_known = true;
 
 	if (parent_im) {
 		list_add_tail(&im->altnames_list, &parent_im->altnames_list);
 	} else {
 		/* This is parent, insert to index hash. */
-		h = ifi->ifi_index & (IDXMAP_SIZE - 1);
-		hlist_add_head(&im->idx_hash, &idx_head[h]);
+		ll_hash_add(&idx_map, &im->idx_hash, ll_idx_key);
 		INIT_LIST_HEAD(&im->altnames_list);
 	}
 
-	h = namehash(ifname) & (IDXMAP_SIZE - 1);
-	hlist_add_head(&im->name_hash, &name_head[h]);
+	ll_hash_add(&name_map, &im->name_hash, ll_name_key);
 	return im;
 }
 
 static void ll_entry_destroy(struct ll_cache *im, bool im_is_parent)
 {
-	hlist_del(&im->name_hash);
+	ll_hash_del(&name_map, &im->name_hash);
 	if (im_is_parent)
-		hlist_del(&im->idx_hash);
+		ll_hash_del(&idx_map, &im->idx_hash);
 	else
 		list_del(&im->altnames_list);
 	free(im);
@@ -116,14 +248,12 @@ static void ll_entry_destroy(struct ll_cache *im, bool im_is_parent)
 static void ll_entry_update(struct ll_cache *im, struct ifinfomsg *ifi,
 			    const char *ifname)
 {
-	unsigned int h;
-
 	im->flags = ifi->ifi_flags;
+	im->flags_known = true;
 	if (!strcmp(im->name, ifname))
 		return;
-	hlist_del(&im->name_hash);
-	h = namehash(ifname) & (IDXMAP_SIZE - 1);
-	hlist_add_head(&im->name_hash, &name_head[h]);
+	ll_hash_del(&name_map, &im->name_hash);
+	ll_hash_add(&name_map, &im->name_hash, ll_name_key);
 }
 
 static void ll_altname_entries_create(struct ll_cache *parent_im,
@@ -304,6 +434,318 @@ out:
 	return rc;
 }
 
+/* With LL_MAP_CACHE=SECS in the environment, the map built by a full
+ * link dump is also written to a snapshot file per network namespace,
+ * and a later process in the same namespace loads the map from it
+ * instead of dumping, as long as the snapshot is less than SECS old.
+ * The namespace is named by the device and inode of its nsfs file, since
+ * inode numbers alone are only unique within one device. Link flags are
+ * left out as they change too often, they are fetched when asked for.
+ * The first process to find it missing or stale writes the next one, to
+ * a temporary file renamed over the old one, so that readers only ever
+ * map a complete snapshot. Links changed by the tools themselves drop
+ * the snapshot; changes made by others are seen once it has aged out,
+ * and a name that is not in it is still looked up in the kernel.
+ */
+#define LL_SNAP_DIR	"/run/iproute2"
+#define LL_SNAP_MAGIC	0x6c6c6d70	/* "llmp" */
+#define LL_SNAP_VERSION	2
+#define LL_SNAP_PATH_LEN	96
+
+struct ll_snap_hdr {
+	__u32	magic;
+	__u32	version;
+	__u64	gen;		/* bumped by every refresh */
+	__s64	time;
+	__u32	count;
+	__u32	size;		/* of the whole file */
+};
+
+struct ll_snap_rec {
+	__u32	index;
+	__u16	type;
+	__u8	altname;	/* of the last record that was not */
+	__u8	len;		/* of name, with the NUL */
+	char	name[];
+};
+
+#define LL_SNAP_REC_LEN(len)	\
+	((sizeof(struct ll_snap_rec) + (len) + 3) & ~3U)
+
+static int ll_snap_age = -1;	/* -1 until looked up, 0 when disabled */
+
+static bool ll_snap_path(char *path, size_t len)
+{
+	struct stat st;
+
+	if (ll_snap_age < 0) {
+		const char *env = getenv("LL_MAP_CACHE");
+
+		ll_snap_age = 0;
+		if (env && get_integer(&ll_snap_age, env, 0) < 0)
+			ll_snap_age = 0;
+		if (ll_snap_age < 0)
+			ll_snap_age = 0;
+	}
+	if (!ll_snap_age || stat("/proc/self/ns/net", &st) < 0)
+		return false;
+
+	snprintf(path, len, "%s/ll_map.%llu.%llu", LL_SNAP_DIR,
+		 (unsigned long long)st.st_dev,
+		 (unsigned long long)st.st_ino);
+	return true;
+}
+
+static int ll_snap_load(void)
+{
+	const struct ll_snap_hdr *hdr;
+	struct ll_cache *parent = NULL;
+	char path[LL_SNAP_PATH_LEN];
+	__u32 i, count;
+	struct stat st;
+	size_t off;
+	void *map;
+	__u64 gen;
+	int fd;
+
+	if (!ll_snap_path(path, sizeof(path)))
+		return -1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	/* only trust what root or we wrote */
+	if (fstat(fd, &st) < 0 || (st.st_uid && st.st_uid != geteuid()) ||
+	    st.st_size < (off_t)sizeof(*hdr) ||
+	    st.st_mtime + ll_snap_age <= time(NULL)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	hdr = map;
+	if (hdr->magic != LL_SNAP_MAGIC || hdr->version != LL_SNAP_VERSION ||
+	    hdr->size != st.st_size) {
+		munmap(map, st.st_size);
+		return -1;
+	}
+
+	off = sizeof(*hdr);
+	for (i = 0; i < hdr->count; i++) {
+		const struct ll_snap_rec *rec = map + off;
+		struct ifinfomsg ifi = {};
+
+		if (off + sizeof(*rec) > hdr->size || !rec->len ||
+		    off + LL_SNAP_REC_LEN(rec->len) > hdr->size ||
+		    rec->name[rec->len - 1] != '\0' ||
+		    (rec->altname && !parent))
+			break;
+
+		ifi.ifi_index = rec->index;
+		ifi.ifi_type = rec->type;
+		if (rec->altname)
+			ll_entry_create(&ifi, rec->name, parent);
+		else if (!(parent = ll_entry_create(&ifi, rec->name, NULL)))
+			break;
+		else
+			parent->flags_known = false;
+		off += LL_SNAP_REC_LEN(rec->len);
+	}
+	gen = hdr->gen;
+	count = hdr->count;
+	munmap(map, st.st_size);
+
+	if (i < count) {
+		/* a corrupt snapshot, start over from the kernel */
+		ll_map_reset();
+		return -1;
+	}
+	ll_snap_gen = gen;
+	return 0;
+}
+
+static int ll_snap_put(char **buf, size_t *len, size_t *size,
+		       const struct ll_cache *im, bool altname)
+{
+	size_t namelen = strlen(im->name) + 1;
+	size_t reclen = LL_SNAP_REC_LEN(namelen);
+	struct ll_snap_rec *rec;
+
+	if (namelen > 255)
+		return 0;
+	if (*len + reclen > *size) {
+		size_t nsize = *size * 2 + reclen;
+		char *nbuf = realloc(*buf, nsize);
+
+		if (!nbuf)
+			return -1;
+		*buf = nbuf;
+		*size = nsize;
+	}
+
+	rec = (struct ll_snap_rec *)(*buf + *len);
+	memset(rec, 0, reclen);
+	rec->index = im->index;
+	rec->type = im->type;
+	rec->altname = altname;
+	rec->len = namelen;
+	memcpy(rec->name, im->name, namelen);
+	*len += reclen;
+	return 1;
+}
+
+static void ll_snap_store(void)
+{
+	size_t len = sizeof(struct ll_snap_hdr), size = 4096;
+	char path[LL_SNAP_PATH_LEN], tmp[LL_SNAP_PATH_LEN + 16];
+	struct ll_snap_hdr *hdr;
+	__u64 gen = 0;
+	__u32 count = 0;
+	unsigned int i;
+	bool ok;
+	char *buf;
+	int fd;
+
+	if (!ll_snap_path(path, sizeof(path)))
+		return;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		struct ll_snap_hdr old;
+
+		if (read(fd, &old, sizeof(old)) == sizeof(old) &&
+		    old.magic == LL_SNAP_MAGIC)
+			gen = old.gen;
+		close(fd);
+	}
+
+	buf = malloc(size);
+	if (!buf)
+		return;
+
+	for (i = 0; i < idx_map.size; i++) {
+		struct hlist_node *n;
+
+		hlist_for_each(n, &idx_map.head[i]) {
+			struct ll_cache *im, *alt;
+			int ret;
+
+			im = container_of(n, struct ll_cache, idx_hash);
+			ret = ll_snap_put(&buf, &len, &size, im, false);
+			if (ret < 0)
+				goto out;
+			if (!ret)
+				continue;
+			count++;
+			list_for_each_entry(alt, &im->altnames_list,
+					    altnames_list) {
+				ret = ll_snap_put(&buf, &len, &size, alt, true);
+				if (ret < 0)
+					goto out;
+				count += ret;
+			}
+		}
+	}
+
+	hdr = (struct ll_snap_hdr *)buf;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = LL_SNAP_MAGIC;
+	hdr->version = LL_SNAP_VERSION;
+	hdr->gen = gen + 1;
+	hdr->time = time(NULL);
+	hdr->count = count;
+	hdr->size = len;
+
+	mkdir(LL_SNAP_DIR, 0755);
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out;
+	ok = fchmod(fd, 0644) == 0 && write(fd, buf, len) == (ssize_t)len;
+	if (close(fd) < 0)
+		ok = false;
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+	else
+		ll_snap_gen = hdr->gen;
+out:
+	free(buf);
+}
+
+/* For commands that add, delete or rename links */
+void ll_map_cache_invalidate(void)
+{
+	char path[LL_SNAP_PATH_LEN];
+
+	if (ll_snap_path(path, sizeof(path)))
+		unlink(path);
+}
+
+/* In lazy mode (ll_init_map_lazy()) no link dump is done up front and
+ * lookups fetch the links they miss one at a time. Once LL_LAZY_MISSES
+ * links were fetched that way the map is completed with a single dump,
+ * which is cheaper for callers resolving many links.
+ */
+#define LL_LAZY_MISSES	16
+
+static bool ll_map_initialized;
+static bool ll_map_lazy;
+static unsigned int ll_lazy_misses;
+
+static int ll_dump_map(struct rtnl_handle *rth)
+{
+	/* a snapshot only replaces a map that is still empty */
+	if (!idx_map.count && ll_snap_load() == 0) {
+		ll_map_initialized = true;
+		return 0;
+	}
+
+	if (rtnl_linkdump_req(rth, AF_UNSPEC) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+
+	if (rtnl_dump_filter(rth, ll_remember_index, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+
+	ll_map_initialized = true;
+	ll_snap_store();
+	return 0;
+}
+
+/* Returns true if the whole map was just loaded */
+static bool ll_lazy_miss(void)
+{
+	struct rtnl_handle rth = {};
+	char path[64];
+	int err;
+
+	if (ll_map_initialized)
+		return false;
+
+	/* with a snapshot to use or to refresh, the first miss loads all,
+	 * lazy or not
+	 */
+	if (++ll_lazy_misses > 1 || idx_map.count ||
+	    !ll_snap_path(path, sizeof(path))) {
+		if (!ll_map_lazy || ll_lazy_misses < LL_LAZY_MISSES)
+			return false;
+	}
+
+	/* lookups may come from a dump in progress on the caller's socket */
+	if (rtnl_open(&rth, 0) < 0)
+		return false;
+	err = ll_dump_map(&rth);
+	rtnl_close(&rth);
+
+	return !err;
+}
+
 const char *ll_index_to_name(unsigned int idx)
 {
 	static char buf[IFNAMSIZ];
@@ -312,11 +754,11 @@ const char *ll_index_to_name(unsigned int idx)
 	if (idx == 0)
 		return "*";
 
-	im = ll_get_by_index(idx);
+	im = ll_hash_account(&idx_map, ll_get_by_index(idx));
 	if (im)
 		return im->name;
 
-	if (ll_link_get(NULL, idx) == idx) {
+	if (ll_lazy_miss() || ll_link_get(NULL, idx) == idx) {
 		im = ll_get_by_index(idx);
 		if (im)
 			return im->name;
@@ -328,6 +770,19 @@ const char *ll_index_to_name(unsigned int idx)
 	return buf;
 }
 
+/* Type and flags are only known for cached links */
+static const struct ll_cache *ll_get_cached(unsigned int idx)
+{
+	const struct ll_cache *im;
+
+	im = ll_hash_account(&idx_map, ll_get_by_index(idx));
+	if (!im && ll_map_lazy &&
+	    (ll_lazy_miss() || ll_link_get(NULL, idx) == idx))
+		im = ll_get_by_index(idx);
+
+	return im;
+}
+
 int ll_index_to_type(unsigned idx)
 {
 	const struct ll_cache *im;
@@ -335,7 +790,7 @@ int ll_index_to_type(unsigned idx)
 	if (idx == 0)
 		return -1;
 
-	im = ll_get_by_index(idx);
+	im = ll_get_cached(idx);
 	return im ? im->type : -1;
 }
 
@@ -346,7 +801,9 @@ int ll_index_to_flags(unsigned idx)
 	if (idx == 0)
 		return 0;
 
-	im = ll_get_by_index(idx);
+	im = ll_get_cached(idx);
+	if (im && !im->flags_known && ll_link_get(NULL, idx) == idx)
+		im = ll_get_by_index(idx);
 	return im ? im->flags : -1;
 }
 
@@ -358,10 +815,16 @@ unsigned ll_name_to_index(const char *name)
 	if (name == NULL)
 		return 0;
 
-	im = ll_get_by_name(name);
+	im = ll_hash_account(&name_map, ll_get_by_name(name));
 	if (im)
 		return im->index;
 
+	if (ll_lazy_miss()) {
+		im = ll_get_by_name(name);
+		if (im)
+			return im->index;
+	}
+
 	idx = ll_link_get(name, 0);
 	if (idx == 0)
 		idx = if_nametoindex(name);
@@ -378,28 +841,87 @@ void ll_drop_by_index(unsigned index)
 	if (!im)
 		return;
 
-	hlist_del(&im->idx_hash);
-	hlist_del(&im->name_hash);
-
-	free(im);
+	ll_entries_destroy(im);
 }
 
 void ll_init_map(struct rtnl_handle *rth)
 {
-	static int initialized;
-
-	if (initialized)
+	if (ll_map_initialized)
 		return;
 
-	if (rtnl_linkdump_req(rth, AF_UNSPEC) < 0) {
-		perror("Cannot send dump request");
+	if (ll_dump_map(rth) < 0)
 		exit(1);
-	}
+}
 
-	if (rtnl_dump_filter(rth, ll_remember_index, NULL) < 0) {
-		fprintf(stderr, "Dump terminated\n");
-		exit(1);
+/* For commands resolving only a few links, e.g. when adding objects */
+void ll_init_map_lazy(void)
+{
+	ll_map_lazy = true;
+}
+
+struct ll_map_state {
+	struct ll_hash	idx_map;
+	struct ll_hash	name_map;
+	bool		initialized;
+	bool		lazy;
+	unsigned int	lazy_misses;
+};
+
+struct ll_map_state *ll_map_state_alloc(void)
+{
+	return calloc(1, sizeof(struct ll_map_state));
+}
+
+/* Set the map in use aside in @st and continue with the one that was
+ * there, e.g. to resolve the links of another network namespace.
+ * Swapping again with the same @st switches back.
+ */
+void ll_map_swap(struct ll_map_state *st)
+{
+	struct ll_map_state cur = {
+		.idx_map = idx_map,
+		.name_map = name_map,
+		.initialized = ll_map_initialized,
+		.lazy = ll_map_lazy,
+		.lazy_misses = ll_lazy_misses,
+	};
+
+	idx_map = st->idx_map;
+	name_map = st->name_map;
+	ll_map_initialized = st->initialized;
+	ll_map_lazy = st->lazy;
+	ll_lazy_misses = st->lazy_misses;
+	*st = cur;
+}
+
+void ll_map_state_free(struct ll_map_state *st)
+{
+	unsigned int i;
+
+	if (!st)
+		return;
+
+	ll_map_swap(st);
+	for (i = 0; i < idx_map.size; i++) {
+		struct hlist_node *n, *tmp;
+
+		hlist_for_each_safe(n, tmp, &idx_map.head[i])
+			ll_entries_destroy(container_of(n, struct ll_cache,
+							idx_hash));
 	}
+	free(idx_map.head);
+	free(name_map.head);
+	ll_map_swap(st);
+	free(st);
+}
 
-	initialized = 1;
+/* Forget all links, e.g. when they belong to another network namespace */
+void ll_map_reset(void)
+{
+	struct ll_map_state *st = ll_map_state_alloc();
+
+	if (!st)
+		return;
+	ll_map_swap(st);
+	ll_map_state_free(st);
 }
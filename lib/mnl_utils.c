@@ -4,12 +4,15 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/socket.h>
 #include <libmnl/libmnl.h>
 #include <linux/genetlink.h>
 
 #include "libnetlink.h"
+#include "libgenl.h"
 #include "mnl_utils.h"
 #include "utils.h"
 
@@ -120,6 +123,83 @@ int mnlu_socket_recv_run(struct mnl_socket *nl, unsigned int seq, void *buf, siz
 	return err;
 }
 
+int mnlu_batch_init(struct mnlu_batch *b, unsigned int vlen, size_t slot)
+{
+	unsigned int i;
+
+	b->msgs = calloc(vlen, sizeof(*b->msgs));
+	b->iov = calloc(vlen, sizeof(*b->iov));
+	b->buf = malloc(vlen * slot);
+	if (!b->msgs || !b->iov || !b->buf) {
+		mnlu_batch_free(b);
+		return -1;
+	}
+
+	for (i = 0; i < vlen; i++) {
+		b->iov[i].iov_base = b->buf + i * slot;
+		b->iov[i].iov_len = slot;
+		b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+		b->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	b->slot = slot;
+	b->vlen = vlen;
+	return 0;
+}
+
+void mnlu_batch_free(struct mnlu_batch *b)
+{
+	free(b->msgs);
+	free(b->iov);
+	free(b->buf);
+	b->msgs = NULL;
+	b->iov = NULL;
+	b->buf = NULL;
+}
+
+/* Grow the receive queue of a notification socket, past rmem_max if allowed */
+int mnlu_socket_set_rcvbuf(struct mnl_socket *nl, int size)
+{
+	int fd = mnl_socket_get_fd(nl);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) &&
+	    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)))
+		return -1;
+	return 0;
+}
+
+/*
+ * Take whatever is queued on the socket, up to b->vlen datagrams, with a
+ * single non-blocking recvmmsg() and run @cb on every message in them.
+ * @ts is set to the time the batch was received before @cb is called.
+ * Returns the number of datagrams handled, 0 if none were queued, or -1
+ * with errno set (ENOBUFS when the kernel had to drop notifications).
+ */
+int mnlu_socket_recv_batch(struct mnl_socket *nl, struct mnlu_batch *b,
+			   struct timespec *ts, mnl_cb_t cb, void *data)
+{
+	int fd = mnl_socket_get_fd(nl);
+	int i, n, err;
+
+	n = recvmmsg(fd, b->msgs, b->vlen, MSG_DONTWAIT, NULL);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+	clock_gettime(CLOCK_REALTIME, ts);
+
+	for (i = 0; i < n; i++) {
+		if (b->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		err = mnl_cb_run2(b->iov[i].iov_base, b->msgs[i].msg_len, 0, 0,
+				  cb, data, mnlu_cb_array,
+				  ARRAY_SIZE(mnlu_cb_array));
+		if (err < 0)
+			return -1;
+	}
+	return n;
+}
+
 static int ctrl_attrs_cb(const struct nlattr *attr, void *data)
 {
 	int type = mnl_attr_get_type(attr);
@@ -157,15 +237,21 @@ static int get_family_cb(const struct nlmsghdr *nlh, void *data)
 		return MNL_CB_ERROR;
 	nlg->family = mnl_attr_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
 	nlg->maxattr = mnl_attr_get_u32(tb[CTRL_ATTR_MAXATTR]);
+	genl_family_cache_put(nlh);
 	return MNL_CB_OK;
 }
 
 static int family_get(struct mnlu_gen_socket *nlg, const char *family_name)
 {
+	const struct nlmsghdr *cached;
 	struct genlmsghdr hdr = {};
 	struct nlmsghdr *nlh;
 	int err;
 
+	cached = genl_family_cache_get(family_name, 0);
+	if (cached && get_family_cb(cached, nlg) == MNL_CB_OK)
+		return 0;
+
 	hdr.cmd = CTRL_CMD_GETFAMILY;
 	hdr.version = 0x1;
 
@@ -14,6 +14,7 @@
 #include <linux/genetlink.h>
 
 #include "libnetlink.h"
+#include "libgenl.h"
 #include "mnl_utils.h"
 #include "utils.h"
 #include "mnlg.h"
@@ -99,15 +100,23 @@ static int get_group_id_cb(const struct nlmsghdr *nlh, void *data)
 	if (!tb[CTRL_ATTR_MCAST_GROUPS])
 		return MNL_CB_ERROR;
 	parse_genl_mc_grps(tb[CTRL_ATTR_MCAST_GROUPS], group_info);
+	genl_family_cache_put(nlh);
 	return MNL_CB_OK;
 }
 
 int mnlg_socket_group_add(struct mnlu_gen_socket *nlg, const char *group_name)
 {
+	const struct nlmsghdr *cached;
 	struct nlmsghdr *nlh;
 	struct group_info group_info;
 	int err;
 
+	group_info.found = false;
+	group_info.name = group_name;
+	cached = genl_family_cache_get(NULL, nlg->family);
+	if (cached && get_group_id_cb(cached, &group_info) == MNL_CB_OK)
+		goto found;
+
 	nlh = _mnlu_gen_socket_cmd_prepare(nlg, CTRL_CMD_GETFAMILY,
 					   NLM_F_REQUEST | NLM_F_ACK,
 					   GENL_ID_CTRL, 1);
@@ -118,12 +127,11 @@ int mnlg_socket_group_add(struct mnlu_gen_socket *nlg, const char *group_name)
 	if (err < 0)
 		return err;
 
-	group_info.found = false;
-	group_info.name = group_name;
 	err = mnlu_gen_socket_recv_run(nlg, get_group_id_cb, &group_info);
 	if (err < 0)
 		return err;
 
+found:
 	if (!group_info.found) {
 		errno = ENOENT;
 		return -1;
@@ -12,6 +12,7 @@
 #include "utils.h"
 #include "namespace.h"
 #include "libnetlink.h"
+#include "ll_map.h"
 
 static void bind_etc(const char *name)
 {
@@ -67,6 +68,9 @@ int netns_switch(char *name)
 	}
 	close(netns);
 
+	/* links loaded before, e.g. by a -server, are those of the old one */
+	ll_map_reset();
+
 	if (unshare(CLONE_NEWNS) < 0) {
 		fprintf(stderr, "unshare failed: %s\n", strerror(errno));
 		return -1;
@@ -142,6 +146,52 @@ int netns_foreach(int (*func)(char *nsname, void *arg), void *arg)
 	return 0;
 }
 
+struct netns_name_list {
+	char	**names;
+	int	cnt;
+};
+
+static int netns_name_add(char *nsname, void *arg)
+{
+	struct netns_name_list *nl = arg;
+	char **names;
+
+	names = realloc(nl->names, (nl->cnt + 1) * sizeof(*names));
+	if (!names)
+		return -1;
+	nl->names = names;
+	nl->names[nl->cnt] = strdup(nsname);
+	if (!nl->names[nl->cnt])
+		return -1;
+	nl->cnt++;
+	return 0;
+}
+
+/*
+ * Collect the names netns_foreach() would visit, for callers that work
+ * on several namespaces at once. Returns how many there are, or -1.
+ */
+int netns_names(char ***names)
+{
+	struct netns_name_list nl = {};
+
+	if (netns_foreach(netns_name_add, &nl) < 0) {
+		netns_names_free(nl.names, nl.cnt);
+		return -1;
+	}
+	*names = nl.names;
+	return nl.cnt;
+}
+
+void netns_names_free(char **names, int cnt)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++)
+		free(names[i]);
+	free(names);
+}
+
 int netns_id_from_name(struct rtnl_handle *rtnl, const char *name)
 {
 	struct {
@@ -0,0 +1,242 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * nl_pipeline.c	threaded receive of rtnetlink dumps
+ *
+ * Kept apart from libnetlink.c so that only the programs that turn the
+ * pipeline on with rtnl_dump_set_pipeline() link against libpthread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <pthread.h>
+
+#include "libnetlink.h"
+#include "nl_pipeline.h"
+
+/* initial size of a ring buffer, grown to the largest datagram */
+#define RTNL_PIPE_BUF_MIN	32768
+
+static unsigned int rtnl_pipeline_depth;
+
+struct rtnl_pipe_slot {
+	char		*buf;
+	size_t		size;
+	int		len;		/* < 0: receive error */
+	__u32		nl_pid;
+	bool		trunc;
+};
+
+struct rtnl_pipe {
+	struct rtnl_handle	*rth;
+	struct rtnl_pipe_slot	*slots;
+	unsigned int		depth;
+	unsigned int		head;	/* next slot to receive into */
+	unsigned int		tail;	/* next slot to filter */
+	size_t			size;	/* of the datagrams of this dump */
+	bool			done;	/* the receiver has stopped */
+	bool			stop;	/* the filters have stopped */
+	pthread_mutex_t		lock;
+	pthread_cond_t		filled;
+	pthread_cond_t		drained;
+};
+
+static int rtnl_pipe_recv(struct rtnl_pipe *p, struct rtnl_pipe_slot *s)
+{
+	struct sockaddr_nl nladdr = {};
+	struct iovec iov = {};
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	int len;
+
+	/* peek at every datagram, a later one may be larger */
+	if (!(p->rth->flags & RTNL_HANDLE_F_LARGE_BUF)) {
+		len = __rtnl_recvmsg(p->rth->fd, &msg, MSG_PEEK | MSG_TRUNC);
+		if (len < 0)
+			return len;
+		if (len > p->size)
+			p->size = len;
+	}
+
+	if (s->size < p->size) {
+		char *buf = realloc(s->buf, p->size);
+
+		if (!buf) {
+			fprintf(stderr, "malloc error: not enough buffer\n");
+			return -ENOMEM;
+		}
+		s->buf = buf;
+		s->size = p->size;
+	}
+
+	iov.iov_base = s->buf;
+	iov.iov_len = s->size;
+	len = __rtnl_recvmsg(p->rth->fd, &msg, 0);
+	if (len < 0)
+		return len;
+
+	s->nl_pid = nladdr.nl_pid;
+	s->trunc = msg.msg_flags & MSG_TRUNC;
+	return len;
+}
+
+/* Like rtnl_dump_prescan_buf(), true once the end of the dump is in */
+static bool rtnl_pipe_last(const struct rtnl_handle *rth,
+			   const struct rtnl_pipe_slot *s)
+{
+	const struct nlmsghdr *h = (void *)s->buf;
+	int len = s->len;
+
+	for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+		if (s->nl_pid != 0 || h->nlmsg_pid != rth->local.nl_pid ||
+		    h->nlmsg_seq != rth->dump)
+			continue;
+		if (h->nlmsg_type == NLMSG_DONE || h->nlmsg_type == NLMSG_ERROR)
+			return true;
+	}
+	return false;
+}
+
+static void *rtnl_pipe_receiver(void *arg)
+{
+	struct rtnl_pipe *p = arg;
+	bool last = false;
+
+	while (!last) {
+		struct rtnl_pipe_slot *s;
+
+		pthread_mutex_lock(&p->lock);
+		while (p->head - p->tail == p->depth && !p->stop)
+			pthread_cond_wait(&p->drained, &p->lock);
+		if (p->stop) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		s = &p->slots[p->head % p->depth];
+		pthread_mutex_unlock(&p->lock);
+
+		s->len = rtnl_pipe_recv(p, s);
+		last = s->len < 0 || rtnl_pipe_last(p->rth, s);
+
+		pthread_mutex_lock(&p->lock);
+		p->head++;
+		pthread_cond_signal(&p->filled);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->done = true;
+	pthread_cond_signal(&p->filled);
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+/*
+ * Returns 1 if the pipeline could not be started, so that the caller
+ * goes on with the normal receive loop.
+ */
+static int rtnl_dump_filter_pipeline(struct rtnl_handle *rth,
+				     const struct rtnl_dump_filter_arg *arg,
+				     int *ret)
+{
+	struct rtnl_pipe p = {
+		.rth = rth,
+		.depth = rtnl_pipeline_depth,
+		.size = RTNL_PIPE_BUF_MIN,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.filled = PTHREAD_COND_INITIALIZER,
+		.drained = PTHREAD_COND_INITIALIZER,
+	};
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	int dump_intr = 0;
+	pthread_t tid;
+	unsigned int i;
+
+	if (rth->rbuf_len > p.size)
+		p.size = rth->rbuf_len;
+	p.slots = calloc(p.depth, sizeof(*p.slots));
+	if (!p.slots)
+		return 1;
+	if (pthread_create(&tid, NULL, rtnl_pipe_receiver, &p)) {
+		free(p.slots);
+		return 1;
+	}
+
+	*ret = 0;
+	while (1) {
+		struct rtnl_pipe_slot *s;
+		int err, msglen = 0;
+
+		pthread_mutex_lock(&p.lock);
+		while (p.head == p.tail && !p.done)
+			pthread_cond_wait(&p.filled, &p.lock);
+		if (p.head == p.tail) {
+			pthread_mutex_unlock(&p.lock);
+			/* an error the filter let pass ended the dump */
+			break;
+		}
+		s = &p.slots[p.tail % p.depth];
+		pthread_mutex_unlock(&p.lock);
+
+		if (s->len < 0) {
+			*ret = s->len;
+			break;
+		}
+
+		nladdr.nl_pid = s->nl_pid;
+		err = rtnl_dump_filter_buf(rth, &nladdr, arg, s->buf, s->len,
+					   &msglen, &dump_intr);
+		if (err < 0) {
+			*ret = err;
+			break;
+		}
+		if (err) {
+			if (dump_intr)
+				fprintf(stderr,
+					"Dump was interrupted and may be inconsistent.\n");
+			break;
+		}
+		if (s->trunc) {
+			fprintf(stderr, "Message truncated\n");
+		} else if (msglen) {
+			fprintf(stderr, "!!!Remnant of size %d\n", msglen);
+			exit(1);
+		}
+
+		pthread_mutex_lock(&p.lock);
+		p.tail++;
+		pthread_cond_signal(&p.drained);
+		pthread_mutex_unlock(&p.lock);
+	}
+
+	pthread_mutex_lock(&p.lock);
+	p.stop = true;
+	pthread_cond_signal(&p.drained);
+	pthread_mutex_unlock(&p.lock);
+	pthread_join(tid, NULL);
+
+	for (i = 0; i < p.depth; i++)
+		free(p.slots[i].buf);
+	free(p.slots);
+	return 0;
+}
+
+/*
+ * With a pipeline, a thread receives the datagrams of a dump into a ring
+ * of "depth" buffers while the caller runs the filters on the ones that
+ * are already in, so the kernel fills the next datagram while the last
+ * one is printed. The receiver stops when the ring is full until the
+ * filters catch up. 0 turns it off.
+ */
+void rtnl_dump_set_pipeline(unsigned int depth)
+{
+	rtnl_pipeline_depth = depth;
+	rtnl_dump_pipeline = depth ? rtnl_dump_filter_pipeline : NULL;
+}
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * nl_stats.c	netlink instrumentation for -stats-nl and NL_STATS
+ *
+ * libnetlink reports every send and receive syscall, the time spent in
+ * dump filter callbacks and, for rtnl_talk() and dumps, where a request
+ * starts and ends. Time is split into sending, waiting in recvmsg() for
+ * the kernel, running the filters, and the rest, which is userspace
+ * outside of the filters: parsing arguments, building requests and
+ * printing after a dump.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "nl_stats.h"
+
+struct nl_counters {
+	__u64	send_calls;
+	__u64	send_msgs;
+	__u64	send_bytes;
+	__u64	send_ns;
+	__u64	recv_calls;
+	__u64	recv_peeks;
+	__u64	recv_msgs;
+	__u64	recv_bytes;
+	__u64	recv_ns;
+	__u64	truncs;
+	__u64	filter_calls;
+	__u64	filter_ns;
+};
+
+/* received datagram sizes, up to 1K, 4K, ... */
+static const unsigned int nl_size_max[] = { 1024, 4096, 16384, 65536, 262144 };
+#define NL_SIZES	(sizeof(nl_size_max) / sizeof(nl_size_max[0]) + 1)
+
+bool nl_stats_on;
+static bool nl_trace;
+static __u64 nl_start;
+static struct nl_counters nl_tot;
+static __u64 nl_sizes[NL_SIZES];
+static __u64 nl_max_dgram;
+static unsigned int nl_requests, nl_dumps;
+
+static struct {
+	bool			active;
+	bool			dump;
+	__u16			type;
+	__u32			seq;
+	__u64			start;
+	struct nl_counters	c;
+} nl_txn;
+
+__u64 nl_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double ms(__u64 ns)
+{
+	return ns / 1e6;
+}
+
+static void nl_stats_atexit(void)
+{
+	__u64 wall = nl_stats_now() - nl_start;
+	__u64 busy = nl_tot.send_ns + nl_tot.recv_ns + nl_tot.filter_ns;
+	struct rusage self = {}, children = {};
+	unsigned int i;
+
+	fprintf(stderr, "netlink: %u requests (%u dumps) in %.3fms\n",
+		nl_requests, nl_dumps, ms(wall));
+	fprintf(stderr, "  send: %llu calls, %llu messages, %llu bytes, %.3fms\n",
+		nl_tot.send_calls, nl_tot.send_msgs, nl_tot.send_bytes,
+		ms(nl_tot.send_ns));
+	fprintf(stderr,
+		"  recv: %llu calls (%llu peeks), %llu messages, %llu bytes, %llu truncated re-reads, %.3fms waiting\n",
+		nl_tot.recv_calls, nl_tot.recv_peeks, nl_tot.recv_msgs,
+		nl_tot.recv_bytes, nl_tot.truncs, ms(nl_tot.recv_ns));
+	fprintf(stderr, "  recv sizes:");
+	for (i = 0; i < NL_SIZES - 1; i++)
+		fprintf(stderr, " <=%uK %llu", nl_size_max[i] / 1024,
+			nl_sizes[i]);
+	fprintf(stderr, " more %llu, max %llu\n", nl_sizes[i], nl_max_dgram);
+	fprintf(stderr, "  filters: %llu calls, %.3fms\n",
+		nl_tot.filter_calls, ms(nl_tot.filter_ns));
+	fprintf(stderr, "  rest: %.3fms\n",
+		wall > busy ? ms(wall - busy) : 0.);
+
+	/* -batch-jobs workers count as children */
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+	fprintf(stderr, "  peak rss: %ldK\n",
+		self.ru_maxrss > children.ru_maxrss ?
+		self.ru_maxrss : children.ru_maxrss);
+}
+
+void nl_stats_enable(bool trace)
+{
+	nl_trace |= trace;
+	if (nl_stats_on)
+		return;
+	nl_stats_on = true;
+	nl_start = nl_stats_now();
+	atexit(nl_stats_atexit);
+}
+
+void nl_stats_env(void)
+{
+	static bool done;
+	const char *env;
+
+	if (done)
+		return;
+	done = true;
+	env = getenv("NL_STATS");
+	if (env && *env && strcmp(env, "0"))
+		nl_stats_enable(strcmp(env, "trace") == 0);
+}
+
+static unsigned int nl_count_msgs(const void *buf, size_t len)
+{
+	const struct nlmsghdr *h = buf;
+	int rest = len;
+	unsigned int n = 0;
+
+	for (; NLMSG_OK(h, rest); h = NLMSG_NEXT(h, rest))
+		n++;
+	return n;
+}
+
+void nl_stats_sent(const struct msghdr *msg, ssize_t len, __u64 ns)
+{
+	size_t i;
+
+	nl_tot.send_calls++;
+	nl_tot.send_ns += ns;
+	if (len <= 0)
+		return;
+	nl_tot.send_bytes += len;
+	/* a header and its payload may come in separate iovecs */
+	if (msg->msg_iovlen > 1 &&
+	    msg->msg_iov[0].iov_len == sizeof(struct nlmsghdr)) {
+		nl_tot.send_msgs++;
+		return;
+	}
+	for (i = 0; i < msg->msg_iovlen; i++)
+		nl_tot.send_msgs += nl_count_msgs(msg->msg_iov[i].iov_base,
+						  msg->msg_iov[i].iov_len);
+}
+
+void nl_stats_recvd(const struct msghdr *msg, int flags, ssize_t len,
+		    __u64 ns)
+{
+	unsigned int i;
+
+	nl_tot.recv_calls++;
+	nl_tot.recv_ns += ns;
+	if (flags & MSG_PEEK) {
+		nl_tot.recv_peeks++;
+		return;
+	}
+	if (len <= 0)
+		return;
+
+	nl_tot.recv_bytes += len;
+	for (i = 0; i < NL_SIZES - 1 && len > nl_size_max[i]; i++)
+		;
+	nl_sizes[i]++;
+	if (len > nl_max_dgram)
+		nl_max_dgram = len;
+	if (msg->msg_iov[0].iov_base)
+		nl_tot.recv_msgs += nl_count_msgs(msg->msg_iov[0].iov_base,
+				len < msg->msg_iov[0].iov_len ?
+				len : msg->msg_iov[0].iov_len);
+}
+
+void nl_stats_trunc(void)
+{
+	nl_tot.truncs++;
+}
+
+void nl_stats_filter(__u64 ns)
+{
+	nl_tot.filter_calls++;
+	nl_tot.filter_ns += ns;
+}
+
+void nl_stats_begin(const struct nlmsghdr *n, bool dump)
+{
+	nl_stats_end();
+
+	nl_requests++;
+	if (dump)
+		nl_dumps++;
+	nl_txn.active = true;
+	nl_txn.dump = dump;
+	nl_txn.type = n->nlmsg_type;
+	nl_txn.seq = n->nlmsg_seq;
+	nl_txn.c = nl_tot;
+	nl_txn.start = nl_stats_now();
+}
+
+void nl_stats_end(void)
+{
+	const struct nl_counters *c = &nl_txn.c;
+
+	if (!nl_txn.active)
+		return;
+	nl_txn.active = false;
+	if (!nl_trace)
+		return;
+
+	fprintf(stderr,
+		"netlink: %s type %u seq %u: %.3fms, sent %llu bytes, received %llu messages %llu bytes in %llu calls, %.3fms waiting, %.3fms in filters\n",
+		nl_txn.dump ? "dump" : "request", nl_txn.type, nl_txn.seq,
+		ms(nl_stats_now() - nl_txn.start),
+		nl_tot.send_bytes - c->send_bytes,
+		nl_tot.recv_msgs - c->recv_msgs,
+		nl_tot.recv_bytes - c->recv_bytes,
+		nl_tot.recv_calls - c->recv_calls,
+		ms(nl_tot.recv_ns - c->recv_ns),
+		ms(nl_tot.filter_ns - c->filter_ns));
+}
@@ -0,0 +1,256 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * proc_scan.c	parallel walk of the /proc process directories
+ *
+ * The pid directories are handed out in blocks to a small pool of
+ * threads. Each block has its own result buffer, so workers never
+ * share state, and the buffers are replayed in block order once all
+ * workers are done: callers see the results in the same order as a
+ * serial readdir() of /proc would produce them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "proc_scan.h"
+
+#define PROC_SCAN_BLOCK		64	/* pids per unit of work */
+#define PROC_SCAN_WORKERS_MAX	16
+#define PROC_SCAN_ALIGN(len)	(((len) + 7) & ~7)
+#define PROC_SCAN_HDRLEN	PROC_SCAN_ALIGN(sizeof(uint32_t))
+
+struct proc_scan_buf {
+	char		*data;
+	size_t		len;
+	size_t		size;
+};
+
+struct proc_scan_ctx {
+	const struct proc_scan	*ps;
+	int			rootfd;
+	int			*pids;
+	unsigned int		npids;
+	struct proc_scan_buf	*out;		/* one per block */
+	unsigned int		nblocks;
+	unsigned int		next;		/* next block to scan */
+	pthread_mutex_t		lock;
+};
+
+int proc_scan_emit(struct proc_scan_buf *out, const void *rec, size_t len)
+{
+	size_t need = PROC_SCAN_HDRLEN + PROC_SCAN_ALIGN(len);
+
+	if (out->size - out->len < need) {
+		size_t size = out->size ? 2 * out->size : 4096;
+		char *data;
+
+		while (size - out->len < need)
+			size *= 2;
+		data = realloc(out->data, size);
+		if (!data)
+			return -1;
+		out->data = data;
+		out->size = size;
+	}
+
+	*(uint32_t *)(out->data + out->len) = len;
+	memcpy(out->data + out->len + PROC_SCAN_HDRLEN, rec, len);
+	out->len += need;
+	return 0;
+}
+
+static void proc_scan_tasks(const struct proc_scan *ps, int dirfd, int pid,
+			    struct proc_scan_buf *out)
+{
+	struct dirent *d;
+	int taskfd;
+	DIR *dir;
+
+	taskfd = openat(dirfd, "task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (taskfd < 0)
+		return;
+
+	dir = fdopendir(taskfd);
+	if (!dir) {
+		close(taskfd);
+		return;
+	}
+
+	while ((d = readdir(dir)) != NULL) {
+		int tid, fd;
+
+		if (sscanf(d->d_name, "%d%*c", &tid) != 1 || tid == pid)
+			continue;
+
+		fd = openat(taskfd, d->d_name,
+			    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		ps->visit(fd, pid, tid, out, ps->arg);
+		close(fd);
+	}
+	closedir(dir);
+}
+
+static void proc_scan_block(struct proc_scan_ctx *ctx, unsigned int block)
+{
+	const struct proc_scan *ps = ctx->ps;
+	unsigned int i, end;
+
+	end = (block + 1) * PROC_SCAN_BLOCK;
+	if (end > ctx->npids)
+		end = ctx->npids;
+
+	for (i = block * PROC_SCAN_BLOCK; i < end; i++) {
+		char name[16];
+		int dirfd;
+
+		snprintf(name, sizeof(name), "%d", ctx->pids[i]);
+		dirfd = openat(ctx->rootfd, name,
+			       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirfd < 0)
+			continue;	/* process exited meanwhile */
+
+		ps->visit(dirfd, ctx->pids[i], ctx->pids[i],
+			  &ctx->out[block], ps->arg);
+		if (ps->tasks)
+			proc_scan_tasks(ps, dirfd, ctx->pids[i],
+					&ctx->out[block]);
+		close(dirfd);
+	}
+}
+
+static void *proc_scan_worker(void *arg)
+{
+	struct proc_scan_ctx *ctx = arg;
+
+	for (;;) {
+		unsigned int block;
+
+		pthread_mutex_lock(&ctx->lock);
+		block = ctx->next++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if (block >= ctx->nblocks)
+			break;
+		proc_scan_block(ctx, block);
+	}
+
+	return NULL;
+}
+
+static int proc_scan_read_pids(struct proc_scan_ctx *ctx)
+{
+	unsigned int size = 0;
+	struct dirent *d;
+	DIR *dir;
+	int fd;
+
+	fd = dup(ctx->rootfd);
+	if (fd < 0)
+		return -1;
+
+	dir = fdopendir(fd);
+	if (!dir) {
+		close(fd);
+		return -1;
+	}
+
+	while ((d = readdir(dir)) != NULL) {
+		int pid;
+
+		if (sscanf(d->d_name, "%d%*c", &pid) != 1)
+			continue;
+
+		if (ctx->npids == size) {
+			int *pids;
+
+			size = size ? 2 * size : 1024;
+			pids = realloc(ctx->pids, size * sizeof(*pids));
+			if (!pids) {
+				closedir(dir);
+				return -1;
+			}
+			ctx->pids = pids;
+		}
+		ctx->pids[ctx->npids++] = pid;
+	}
+
+	closedir(dir);
+	return 0;
+}
+
+static unsigned int proc_scan_nworkers(unsigned int nblocks)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int n = ncpus > 0 ? ncpus : 1;
+
+	if (n > PROC_SCAN_WORKERS_MAX)
+		n = PROC_SCAN_WORKERS_MAX;
+	if (n > nblocks)
+		n = nblocks;
+	return n;
+}
+
+int proc_scan(const struct proc_scan *ps)
+{
+	const char *root = ps->root ? : getenv("PROC_ROOT") ? : "/proc";
+	struct proc_scan_ctx ctx = { .ps = ps };
+	pthread_t threads[PROC_SCAN_WORKERS_MAX];
+	unsigned int i, nthreads = 0;
+	int ret = 0;
+
+	ctx.rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (ctx.rootfd < 0)
+		return -1;
+
+	if (proc_scan_read_pids(&ctx) < 0) {
+		ret = -1;
+		goto out;
+	}
+
+	ctx.nblocks = (ctx.npids + PROC_SCAN_BLOCK - 1) / PROC_SCAN_BLOCK;
+	ctx.out = calloc(ctx.nblocks ? : 1, sizeof(*ctx.out));
+	if (!ctx.out) {
+		ret = -1;
+		goto out;
+	}
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	/* the calling thread is a worker too */
+	for (i = 1; i < proc_scan_nworkers(ctx.nblocks); i++) {
+		if (pthread_create(&threads[nthreads], NULL,
+				   proc_scan_worker, &ctx))
+			break;
+		nthreads++;
+	}
+	proc_scan_worker(&ctx);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&ctx.lock);
+
+	for (i = 0; i < ctx.nblocks; i++) {
+		const struct proc_scan_buf *out = &ctx.out[i];
+		size_t pos = 0;
+
+		while (!ret && pos < out->len) {
+			uint32_t len = *(uint32_t *)(out->data + pos);
+
+			ret = ps->collect(out->data + pos + PROC_SCAN_HDRLEN,
+					  len, ps->arg);
+			pos += PROC_SCAN_HDRLEN + PROC_SCAN_ALIGN(len);
+		}
+		free(out->data);
+	}
+	free(ctx.out);
+out:
+	free(ctx.pids);
+	close(ctx.rootfd);
+	return ret;
+}
@@ -0,0 +1,319 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * resolve.c	parallel reverse lookups for -resolve
+ *
+ * The addresses of a dump are queued as its messages arrive, before the
+ * first one is printed, and a pool of threads looks them up with
+ * getnameinfo() meanwhile. Printing then mostly finds the names ready.
+ * Otherwise it waits for the lookup, but no longer than RESOLVE_TIMEOUT
+ * after the address was queued; an address not resolved by then is
+ * printed numerically, and stays so for the rest of the run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <linux/fib_rules.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+#include "libnetlink.h"
+#include "utils.h"
+#include "resolve.h"
+
+#define RESOLVE_WORKERS		32
+#define RESOLVE_HASH		16384
+#define RESOLVE_TIMEOUT		5	/* seconds */
+
+struct resolve_entry {
+	struct resolve_entry	*next;		/* hash chain */
+	struct resolve_entry	*qnext;		/* work queue */
+	const char		*name;		/* NULL if there is none */
+	struct timespec		deadline;
+	bool			done;
+	int			af;
+	int			len;
+	__u8			addr[16];
+};
+
+static struct resolve_entry *resolve_hash[RESOLVE_HASH];
+static struct resolve_entry *resolve_queue, **resolve_queue_tail = &resolve_queue;
+static unsigned int resolve_workers, resolve_idle;
+static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolve_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t resolve_done = PTHREAD_COND_INITIALIZER;
+
+static char *resolve_one(const struct resolve_entry *e)
+{
+	struct sockaddr_storage ss = {};
+	char host[NI_MAXHOST];
+	socklen_t salen;
+
+	if (e->af == AF_INET) {
+		struct sockaddr_in *sin = (void *)&ss;
+
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, e->addr, 4);
+		salen = sizeof(*sin);
+	} else {
+		struct sockaddr_in6 *sin6 = (void *)&ss;
+
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, e->addr, 16);
+		salen = sizeof(*sin6);
+	}
+
+	if (getnameinfo((void *)&ss, salen, host, sizeof(host), NULL, 0,
+			NI_NAMEREQD))
+		return NULL;
+	return strdup(host);
+}
+
+static void *resolve_worker(void *arg)
+{
+	pthread_mutex_lock(&resolve_lock);
+	for (;;) {
+		struct resolve_entry *e;
+		char *name;
+
+		while (!resolve_queue) {
+			resolve_idle++;
+			pthread_cond_wait(&resolve_work, &resolve_lock);
+			resolve_idle--;
+		}
+		e = resolve_queue;
+		resolve_queue = e->qnext;
+		if (!resolve_queue)
+			resolve_queue_tail = &resolve_queue;
+		pthread_mutex_unlock(&resolve_lock);
+
+		name = resolve_one(e);
+
+		pthread_mutex_lock(&resolve_lock);
+		if (!e->done) {
+			e->name = name;
+			e->done = true;
+		} else {
+			free(name);	/* timed out meanwhile */
+		}
+		pthread_cond_broadcast(&resolve_done);
+	}
+	return NULL;
+}
+
+/* Called with resolve_lock held */
+static struct resolve_entry *resolve_get(int af, int len, const void *addr)
+{
+	struct resolve_entry *e;
+	__u32 h = 2166136261U;
+	pthread_t thread;
+	int i;
+
+	if (af == AF_INET6 && len == 16 && IN6_IS_ADDR_V4MAPPED(addr)) {
+		af = AF_INET;
+		addr += 12;
+		len = 4;
+	}
+	if ((af != AF_INET || len != 4) && (af != AF_INET6 || len != 16))
+		return NULL;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ ((const __u8 *)addr)[i]) * 16777619U;
+	for (e = resolve_hash[h % RESOLVE_HASH]; e; e = e->next)
+		if (e->af == af && memcmp(e->addr, addr, len) == 0)
+			return e;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	e->af = af;
+	e->len = len;
+	memcpy(e->addr, addr, len);
+	clock_gettime(CLOCK_REALTIME, &e->deadline);
+	e->deadline.tv_sec += RESOLVE_TIMEOUT;
+	e->next = resolve_hash[h % RESOLVE_HASH];
+	resolve_hash[h % RESOLVE_HASH] = e;
+
+	*resolve_queue_tail = e;
+	resolve_queue_tail = &e->qnext;
+	if (resolve_idle) {
+		pthread_cond_signal(&resolve_work);
+	} else if (resolve_workers < RESOLVE_WORKERS &&
+		   pthread_create(&thread, NULL, resolve_worker, NULL) == 0) {
+		pthread_detach(thread);
+		resolve_workers++;
+	}
+	return e;
+}
+
+void resolve_prefetch(int af, int len, const void *addr)
+{
+	pthread_mutex_lock(&resolve_lock);
+	resolve_get(af, len, addr);
+	pthread_mutex_unlock(&resolve_lock);
+}
+
+const char *resolve_lookup(int af, int len, const void *addr)
+{
+	struct resolve_entry *e;
+	const char *name;
+
+	pthread_mutex_lock(&resolve_lock);
+	e = resolve_get(af, len, addr);
+	if (!e) {
+		pthread_mutex_unlock(&resolve_lock);
+		return NULL;
+	}
+	if (!e->done && !resolve_workers) {
+		/* no thread could be started, look it up here */
+		e->name = resolve_one(e);
+		e->done = true;
+	}
+	if (!e->done)
+		fflush(stdout);
+	while (!e->done) {
+		if (pthread_cond_timedwait(&resolve_done, &resolve_lock,
+					   &e->deadline) == ETIMEDOUT)
+			e->done = true;
+	}
+	name = e->name;
+	pthread_mutex_unlock(&resolve_lock);
+	return name;
+}
+
+static void resolve_prefetch_rta(int af, const struct rtattr *rta)
+{
+	resolve_prefetch(af, RTA_PAYLOAD(rta), RTA_DATA(rta));
+}
+
+static void resolve_prefetch_route(const struct nlmsghdr *n)
+{
+	const struct rtmsg *r = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+	struct rtattr *tb[RTA_MAX + 1];
+
+	if (len < 0)
+		return;
+	parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+	if (tb[RTA_DST])
+		resolve_prefetch_rta(r->rtm_family, tb[RTA_DST]);
+	if (tb[RTA_SRC])
+		resolve_prefetch_rta(r->rtm_family, tb[RTA_SRC]);
+	if (tb[RTA_GATEWAY])
+		resolve_prefetch_rta(r->rtm_family, tb[RTA_GATEWAY]);
+	if (tb[RTA_PREFSRC])
+		resolve_prefetch_rta(r->rtm_family, tb[RTA_PREFSRC]);
+	if (tb[RTA_VIA] && RTA_PAYLOAD(tb[RTA_VIA]) >= sizeof(struct rtvia)) {
+		const struct rtvia *via = RTA_DATA(tb[RTA_VIA]);
+
+		resolve_prefetch(via->rtvia_family,
+				 RTA_PAYLOAD(tb[RTA_VIA]) - sizeof(*via),
+				 via->rtvia_addr);
+	}
+	if (tb[RTA_MULTIPATH]) {
+		const struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
+		int rest = RTA_PAYLOAD(tb[RTA_MULTIPATH]);
+
+		while (rest >= (int)sizeof(*nh) && nh->rtnh_len >= sizeof(*nh) &&
+		       nh->rtnh_len <= rest) {
+			struct rtattr *ntb[RTA_MAX + 1];
+
+			parse_rtattr(ntb, RTA_MAX, RTNH_DATA(nh),
+				     nh->rtnh_len - sizeof(*nh));
+			if (ntb[RTA_GATEWAY])
+				resolve_prefetch_rta(r->rtm_family,
+						     ntb[RTA_GATEWAY]);
+			rest -= RTNH_ALIGN(nh->rtnh_len);
+			nh = RTNH_NEXT(nh);
+		}
+	}
+}
+
+static void resolve_prefetch_rtnl(const struct nlmsghdr *n)
+{
+	int len;
+
+	switch (n->nlmsg_type) {
+	case RTM_NEWROUTE:
+		resolve_prefetch_route(n);
+		break;
+	case RTM_NEWADDR: {
+		const struct ifaddrmsg *ifa = NLMSG_DATA(n);
+		struct rtattr *tb[IFA_MAX + 1];
+
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ifa));
+		if (len < 0)
+			return;
+		parse_rtattr(tb, IFA_MAX, IFA_RTA(ifa), len);
+		if (tb[IFA_LOCAL])
+			resolve_prefetch_rta(ifa->ifa_family, tb[IFA_LOCAL]);
+		if (tb[IFA_ADDRESS])
+			resolve_prefetch_rta(ifa->ifa_family, tb[IFA_ADDRESS]);
+		break;
+	}
+	case RTM_NEWNEIGH: {
+		const struct ndmsg *ndm = NLMSG_DATA(n);
+		struct rtattr *tb[NDA_MAX + 1];
+
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+		if (len < 0)
+			return;
+		parse_rtattr(tb, NDA_MAX, NDA_RTA(ndm), len);
+		if (tb[NDA_DST])
+			resolve_prefetch_rta(ndm->ndm_family, tb[NDA_DST]);
+		break;
+	}
+	case RTM_NEWRULE: {
+		const struct fib_rule_hdr *frh = NLMSG_DATA(n);
+		struct rtattr *tb[FRA_MAX + 1];
+
+		len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*frh));
+		if (len < 0)
+			return;
+		parse_rtattr(tb, FRA_MAX, RTM_RTA(frh), len);
+		if (tb[FRA_SRC])
+			resolve_prefetch_rta(frh->family, tb[FRA_SRC]);
+		if (tb[FRA_DST])
+			resolve_prefetch_rta(frh->family, tb[FRA_DST]);
+		break;
+	}
+	}
+}
+
+static void resolve_prefetch_diag(const struct nlmsghdr *n)
+{
+	const struct inet_diag_msg *r = NLMSG_DATA(n);
+	int len;
+
+	if (n->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+	    n->nlmsg_len < NLMSG_LENGTH(sizeof(*r)))
+		return;
+
+	if (r->idiag_family != AF_INET && r->idiag_family != AF_INET6)
+		return;
+	len = r->idiag_family == AF_INET ? 4 : 16;
+	resolve_prefetch(r->idiag_family, len, r->id.idiag_src);
+	resolve_prefetch(r->idiag_family, len, r->id.idiag_dst);
+}
+
+void resolve_prefetch_nlmsg(int proto, const struct nlmsghdr *n)
+{
+	if (proto == NETLINK_ROUTE)
+		resolve_prefetch_rtnl(n);
+	else if (proto == NETLINK_SOCK_DIAG)
+		resolve_prefetch_diag(n);
+}
+
+void resolve_start(void)
+{
+	format_host_set_resolver(resolve_lookup);
+	rtnl_dump_set_prescan(resolve_prefetch_nlmsg);
+}
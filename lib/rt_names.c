@@ -16,6 +16,9 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 #include <asm/types.h>
 #include <linux/rtnetlink.h>
@@ -150,14 +153,19 @@ static char *rtnl_rtprot_tab[256] = {
 	[RTPROT_EIGRP]	    = "eigrp",
 };
 
+struct rt_names;
+
 struct tabhash {
-	enum { TAB, HASH } type;
+	enum { TAB, HASH, NAMES } type;
 	union tab_or_hash {
 		char **tab;
 		struct rtnl_hash_entry **hash;
+		struct rt_names *names;
 	} data;
 };
 
+static int rt_names_load(struct rt_names *db, const char *file);
+
 static void
 rtnl_tabhash_readdir(const char *dirpath_base, const char *dirpath_overload,
 		     const struct tabhash tabhash, const int size)
@@ -193,6 +201,8 @@ rtnl_tabhash_readdir(const char *dirpath_base, const char *dirpath_overload,
 		snprintf(path, sizeof(path), "%s/%s", dirpath_base, de->d_name);
 		if (tabhash.type == TAB)
 			rtnl_tab_initialize(path, tabhash.data.tab, size);
+		else if (tabhash.type == NAMES)
+			rt_names_load(tabhash.data.names, path);
 		else
 			rtnl_hash_initialize(path, tabhash.data.hash, size);
 	}
@@ -226,10 +236,10 @@ rtnl_tab_initialize_dir(const char *ddir, char **tab, const int size)
 }
 
 static void
-rtnl_hash_initialize_dir(const char *ddir, struct rtnl_hash_entry **hash,
-			 const int size) {
-	struct tabhash hash_data = {.type = HASH, .data.hash = hash};
-	rtnl_tabhash_initialize_dir(ddir, hash_data, size);
+rt_names_initialize_dir(const char *ddir, struct rt_names *db)
+{
+	struct tabhash names_data = {.type = NAMES, .data.names = db};
+	rtnl_tabhash_initialize_dir(ddir, names_data, 0);
 }
 
 static int rtnl_rtprot_init;
@@ -503,48 +513,404 @@ int rtnl_rtrealm_a2n(__u32 *id, const char *arg)
 }
 
 
-static struct rtnl_hash_entry dflt_table_entry  = { .name = "default" };
-static struct rtnl_hash_entry main_table_entry  = { .name = "main" };
-static struct rtnl_hash_entry local_table_entry = { .name = "local" };
+/*
+ * Routing tables can be many thousands, so their names are not kept in
+ * a fixed hash: entries, both hash chains and the strings are arrays
+ * that grow with the database, indexed by id and by name. The same
+ * layout is written to a cache file in CONF_CACHE_DIR, when that
+ * directory exists, with the state of every file it was read from.
+ * Later runs map the cache instead of parsing the text files, as long
+ * as none of those files has changed.
+ */
+#define RT_NAMES_MAGIC		0x434e5452	/* "RTNC" */
+#define RT_NAMES_VERSION	1
+#define RT_NAMES_NONE		UINT32_MAX
+#define RT_NAMES_CACHE		CONF_CACHE_DIR "/rt_tables.cache"
+
+struct rt_names_hdr {
+	__u32	magic;
+	__u32	version;
+	__u32	nsrc;
+	__u32	nent;
+	__u32	hsize;
+	__u32	strlen;
+};
+
+/* A file or directory the names were read from, or looked for */
+struct rt_names_src {
+	__s64	mtime;
+	__u64	size;
+	__u32	mtime_nsec;
+	__u32	path;		/* offset in the strings */
+	__u32	exists;
+	__u32	pad;
+};
 
-static struct rtnl_hash_entry *rtnl_rttable_hash[256] = {
-	[RT_TABLE_DEFAULT] = &dflt_table_entry,
-	[RT_TABLE_MAIN]    = &main_table_entry,
-	[RT_TABLE_LOCAL]   = &local_table_entry,
+struct rt_names_ent {
+	__u32	id;
+	__u32	name;		/* offset in the strings */
+	__u32	next_id;
+	__u32	next_name;
 };
 
+struct rt_names {
+	const struct rt_names_src	*src;
+	const struct rt_names_ent	*ent;
+	const __u32			*id_head;
+	const __u32			*name_head;
+	const char			*str;
+	struct rt_names_hdr		hdr;
+	/* while it is read from text */
+	struct rt_names_src		*bsrc;
+	struct rt_names_ent		*bent;
+	char				*bstr;
+	size_t				src_size, ent_size, str_size;
+	bool				corrupt;
+};
+
+static __u32 rt_names_hash(const char *name)
+{
+	__u32 h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return h;
+}
+
+static void *rt_names_grow(void *arr, size_t *size, size_t used, size_t need,
+			   size_t elem)
+{
+	void *p;
+
+	if (used + need <= *size)
+		return arr;
+	while (used + need > *size)
+		*size = *size ? 2 * *size : 64;
+	p = realloc(arr, *size * elem);
+	if (!p) {
+		fprintf(stderr, "malloc error: for rt_tables\n");
+		exit(1);
+	}
+	return p;
+}
+
+static __u32 rt_names_str(struct rt_names *db, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	__u32 off = db->hdr.strlen;
+
+	db->bstr = rt_names_grow(db->bstr, &db->str_size, off, len, 1);
+	memcpy(db->bstr + off, s, len);
+	db->hdr.strlen += len;
+	return off;
+}
+
+static void rt_names_add(struct rt_names *db, __u32 id, const char *name)
+{
+	struct rt_names_ent *e;
+
+	db->bent = rt_names_grow(db->bent, &db->ent_size, db->hdr.nent, 1,
+				 sizeof(*db->bent));
+	e = &db->bent[db->hdr.nent++];
+	e->id = id;
+	e->name = rt_names_str(db, name);
+}
+
+static void rt_names_add_src(struct rt_names *db, const char *path,
+			     const struct stat *st)
+{
+	struct rt_names_src *src;
+
+	db->bsrc = rt_names_grow(db->bsrc, &db->src_size, db->hdr.nsrc, 1,
+				 sizeof(*db->bsrc));
+	src = &db->bsrc[db->hdr.nsrc++];
+	memset(src, 0, sizeof(*src));
+	src->path = rt_names_str(db, path);
+	if (st) {
+		src->exists = 1;
+		src->mtime = st->st_mtim.tv_sec;
+		src->mtime_nsec = st->st_mtim.tv_nsec;
+		src->size = st->st_size;
+	}
+}
+
+static void rt_names_stat_src(struct rt_names *db, const char *path)
+{
+	struct stat st;
+
+	rt_names_add_src(db, path, stat(path, &st) ? NULL : &st);
+}
+
+static int rt_names_load(struct rt_names *db, const char *file)
+{
+	char namebuf[NAME_MAX_LEN] = {0};
+	struct stat st;
+	int ret, id;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		return -errno;
+	if (fstat(fileno(fp), &st) == 0)
+		rt_names_add_src(db, file, &st);
+
+	while ((ret = fread_id_name(fp, &id, &namebuf[0]))) {
+		if (ret == -1) {
+			fprintf(stderr, "Database %s is corrupted at %s\n",
+					file, namebuf);
+			db->corrupt = true;
+			fclose(fp);
+			return -EINVAL;
+		}
+		if (id < 0)
+			continue;
+		rt_names_add(db, id, namebuf);
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/* Link both hash chains, later definitions first */
+static void rt_names_index(struct rt_names *db)
+{
+	__u32 *id_head, *name_head, hsize = 256, i;
+
+	while (hsize < db->hdr.nent)
+		hsize *= 2;
+	db->hdr.magic = RT_NAMES_MAGIC;
+	db->hdr.version = RT_NAMES_VERSION;
+	db->hdr.hsize = hsize;
+
+	id_head = malloc(2 * hsize * sizeof(__u32));
+	if (!id_head) {
+		fprintf(stderr, "malloc error: for rt_tables\n");
+		exit(1);
+	}
+	name_head = id_head + hsize;
+	memset(id_head, 0xff, 2 * hsize * sizeof(__u32));
+
+	for (i = 0; i < db->hdr.nent; i++) {
+		struct rt_names_ent *e = &db->bent[i];
+		__u32 h = rt_names_hash(db->bstr + e->name) & (hsize - 1);
+
+		e->next_id = id_head[e->id & (hsize - 1)];
+		id_head[e->id & (hsize - 1)] = i;
+		e->next_name = name_head[h];
+		name_head[h] = i;
+	}
+
+	db->src = db->bsrc;
+	db->ent = db->bent;
+	db->str = db->bstr;
+	db->id_head = id_head;
+	db->name_head = name_head;
+}
+
+static int rt_names_write(const struct rt_names *db, int fd)
+{
+	const struct {
+		const void	*data;
+		size_t		len;
+	} parts[] = {
+		{ &db->hdr, sizeof(db->hdr) },
+		{ db->src, db->hdr.nsrc * sizeof(*db->src) },
+		{ db->ent, db->hdr.nent * sizeof(*db->ent) },
+		{ db->id_head, db->hdr.hsize * sizeof(__u32) },
+		{ db->name_head, db->hdr.hsize * sizeof(__u32) },
+		{ db->str, db->hdr.strlen },
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(parts); i++)
+		if (parts[i].len &&
+		    write(fd, parts[i].data, parts[i].len) != parts[i].len)
+			return -1;
+	return 0;
+}
+
+static void rt_names_save(const struct rt_names *db, const char *path)
+{
+	char tmp[PATH_MAX];
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	if (rt_names_write(db, fd)) {
+		close(fd);
+		unlink(tmp);
+	} else if (close(fd) || rename(tmp, path)) {
+		unlink(tmp);
+	}
+}
+
+static bool rt_names_src_valid(const struct rt_names *db)
+{
+	__u32 i;
+
+	for (i = 0; i < db->hdr.nsrc; i++) {
+		const struct rt_names_src *src = &db->src[i];
+		struct stat st;
+		bool exists;
+
+		if (src->path >= db->hdr.strlen)
+			return false;
+		exists = stat(db->str + src->path, &st) == 0;
+		if (exists != !!src->exists)
+			return false;
+		if (exists &&
+		    (st.st_mtim.tv_sec != src->mtime ||
+		     st.st_mtim.tv_nsec != src->mtime_nsec ||
+		     st.st_size != src->size))
+			return false;
+	}
+	return true;
+}
+
+static bool rt_names_ent_valid(const struct rt_names *db)
+{
+	__u32 i;
+
+	if (!db->hdr.strlen || db->str[db->hdr.strlen - 1])
+		return false;
+	for (i = 0; i < db->hdr.hsize; i++)
+		if ((db->id_head[i] != RT_NAMES_NONE &&
+		     db->id_head[i] >= db->hdr.nent) ||
+		    (db->name_head[i] != RT_NAMES_NONE &&
+		     db->name_head[i] >= db->hdr.nent))
+			return false;
+	for (i = 0; i < db->hdr.nent; i++) {
+		const struct rt_names_ent *e = &db->ent[i];
+
+		/* chains only ever point to older entries, so cannot loop */
+		if (e->name >= db->hdr.strlen ||
+		    (e->next_id != RT_NAMES_NONE && e->next_id >= i) ||
+		    (e->next_name != RT_NAMES_NONE && e->next_name >= i))
+			return false;
+	}
+	return true;
+}
+
+/* Map the cache if it is still current, it is checked thoroughly */
+static int rt_names_map(struct rt_names *db, const char *path)
+{
+	struct rt_names_hdr hdr;
+	struct stat st;
+	size_t len;
+	char *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || (st.st_uid != 0 && st.st_uid != geteuid()) ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+	    read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    hdr.magic != RT_NAMES_MAGIC || hdr.version != RT_NAMES_VERSION ||
+	    hdr.hsize == 0 || (hdr.hsize & (hdr.hsize - 1)) ||
+	    hdr.nsrc > st.st_size || hdr.nent > st.st_size ||
+	    hdr.hsize > st.st_size)
+		goto err;
+
+	len = sizeof(hdr) + hdr.nsrc * sizeof(*db->src) +
+	      hdr.nent * sizeof(*db->ent) + 2 * hdr.hsize * sizeof(__u32) +
+	      hdr.strlen;
+	if (len != st.st_size)
+		goto err;
+
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+	close(fd);
+
+	db->hdr = hdr;
+	db->src = (void *)(map + sizeof(hdr));
+	db->ent = (void *)(db->src + hdr.nsrc);
+	db->id_head = (void *)(db->ent + hdr.nent);
+	db->name_head = db->id_head + hdr.hsize;
+	db->str = (void *)(db->name_head + hdr.hsize);
+
+	if (rt_names_ent_valid(db) && rt_names_src_valid(db))
+		return 0;
+	munmap(map, len);
+	memset(db, 0, sizeof(*db));
+	return -1;
+err:
+	close(fd);
+	return -1;
+}
+
+static const char *rt_names_id2name(const struct rt_names *db, __u32 id)
+{
+	__u32 i;
+
+	if (!db->hdr.hsize)
+		return NULL;
+	for (i = db->id_head[id & (db->hdr.hsize - 1)]; i != RT_NAMES_NONE;
+	     i = db->ent[i].next_id)
+		if (db->ent[i].id == id)
+			return db->str + db->ent[i].name;
+	return NULL;
+}
+
+static const struct rt_names_ent *rt_names_name2ent(const struct rt_names *db,
+						    const char *name)
+{
+	__u32 i, h;
+
+	if (!db->hdr.hsize)
+		return NULL;
+	h = rt_names_hash(name) & (db->hdr.hsize - 1);
+	for (i = db->name_head[h]; i != RT_NAMES_NONE; i = db->ent[i].next_name)
+		if (strcmp(db->str + db->ent[i].name, name) == 0)
+			return &db->ent[i];
+	return NULL;
+}
+
+static struct rt_names rtnl_rttable_db;
 static int rtnl_rttable_init;
 
 static void rtnl_rttable_initialize(void)
 {
-	int i;
-	int ret;
+	struct rt_names *db = &rtnl_rttable_db;
+	struct stat st;
+	bool cache;
 
 	rtnl_rttable_init = 1;
-	for (i = 0; i < 256; i++) {
-		if (rtnl_rttable_hash[i])
-			rtnl_rttable_hash[i]->id = i;
+
+	cache = stat(CONF_CACHE_DIR, &st) == 0 && S_ISDIR(st.st_mode);
+	if (cache && rt_names_map(db, RT_NAMES_CACHE) == 0)
+		return;
+
+	rt_names_add(db, RT_TABLE_DEFAULT, "default");
+	rt_names_add(db, RT_TABLE_MAIN, "main");
+	rt_names_add(db, RT_TABLE_LOCAL, "local");
+
+	if (rt_names_load(db, CONF_ETC_DIR "/rt_tables") == -ENOENT) {
+		rt_names_add_src(db, CONF_ETC_DIR "/rt_tables", NULL);
+		if (rt_names_load(db, CONF_USR_DIR "/rt_tables") == -ENOENT)
+			rt_names_add_src(db, CONF_USR_DIR "/rt_tables", NULL);
 	}
-	ret = rtnl_hash_initialize(CONF_ETC_DIR "/rt_tables",
-				   rtnl_rttable_hash, 256);
-	if (ret == -ENOENT)
-		rtnl_hash_initialize(CONF_USR_DIR "/rt_tables",
-				     rtnl_rttable_hash, 256);
+	rt_names_stat_src(db, CONF_USR_DIR "/rt_tables.d");
+	rt_names_stat_src(db, CONF_ETC_DIR "/rt_tables.d");
+	rt_names_initialize_dir("rt_tables.d", db);
 
-	rtnl_hash_initialize_dir("rt_tables.d", rtnl_rttable_hash, 256);
+	rt_names_index(db);
+	if (cache && !db->corrupt)
+		rt_names_save(db, RT_NAMES_CACHE);
 }
 
 const char *rtnl_rttable_n2a(__u32 id, char *buf, int len)
 {
-	struct rtnl_hash_entry *entry;
+	const char *name;
 
 	if (!rtnl_rttable_init)
 		rtnl_rttable_initialize();
-	entry = rtnl_rttable_hash[id & 255];
-	while (entry && entry->id != id)
-		entry = entry->next;
-	if (!numeric && entry)
-		return entry->name;
+	name = rt_names_id2name(&rtnl_rttable_db, id);
+	if (!numeric && name)
+		return name;
 	snprintf(buf, len, "%u", id);
 	return buf;
 }
@@ -553,7 +919,7 @@ int rtnl_rttable_a2n(__u32 *id, const char *arg)
 {
 	static const char *cache;
 	static unsigned long res;
-	struct rtnl_hash_entry *entry;
+	const struct rt_names_ent *entry;
 	char *end;
 	unsigned long i;
 
@@ -565,16 +931,12 @@ int rtnl_rttable_a2n(__u32 *id, const char *arg)
 	if (!rtnl_rttable_init)
 		rtnl_rttable_initialize();
 
-	for (i = 0; i < 256; i++) {
-		entry = rtnl_rttable_hash[i];
-		while (entry && strcmp(entry->name, arg))
-			entry = entry->next;
-		if (entry) {
-			cache = entry->name;
-			res = entry->id;
-			*id = res;
-			return 0;
-		}
+	entry = rt_names_name2ent(&rtnl_rttable_db, arg);
+	if (entry) {
+		cache = rtnl_rttable_db.str + entry->name;
+		res = entry->id;
+		*id = res;
+		return 0;
 	}
 
 	i = strtoul(arg, &end, 0);
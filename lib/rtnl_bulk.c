@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * rtnl_bulk.c	"file FILE" loaders: one request per line of a file
+ *
+ * The line is split into fields and handed to the parse callback of
+ * the command, which builds the request from a prototype. Requests go
+ * out in windows on a socket of their own with rtnl_flush; each is
+ * tagged with its line number so that failures can be reported by line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libnetlink.h"
+#include "rtnl_bulk.h"
+
+FILE *rtnl_bulk_open(struct rtnl_bulk *b)
+{
+	FILE *fp;
+
+	if (strcmp(b->file, "-") == 0) {
+		b->file = "stdin";
+		return stdin;
+	}
+
+	fp = fopen(b->file, "r");
+	if (!fp)
+		fprintf(stderr, "Cannot open \"%s\": %s\n", b->file,
+			strerror(errno));
+	return fp;
+}
+
+void rtnl_bulk_close(FILE *fp)
+{
+	if (fp && fp != stdin)
+		fclose(fp);
+}
+
+/* Split line into at most max fields; returns max + 1 if there are more */
+int rtnl_bulk_tokens(char *line, char **tok, int max)
+{
+	char *cp;
+	int ntok = 0;
+
+	cp = strchr(line, '#');
+	if (cp)
+		*cp = '\0';
+
+	for (cp = strtok(line, " \t\n"); cp; cp = strtok(NULL, " \t\n")) {
+		if (ntok == max)
+			return max + 1;
+		tok[ntok++] = cp;
+	}
+	return ntok;
+}
+
+void rtnl_bulk_report(const struct nlmsghdr *err, int lineno, void *arg)
+{
+	const struct nlmsgerr *e = NLMSG_DATA(err);
+	struct rtnl_bulk *b = arg;
+	const char *name = b->name ? b->name(b, lineno) : NULL;
+
+	/* requests that do not come from a line, e.g. deletes, have none */
+	if (name)
+		fprintf(stderr, "%s: ", name);
+	else if (lineno)
+		fprintf(stderr, "%s:%d: ", b->file, lineno);
+	else
+		fprintf(stderr, "%s: ", b->file);
+	if (!nl_dump_ext_ack(err, NULL))
+		fprintf(stderr, "%s%s\n", b->genl ? "" : "RTNETLINK answers: ",
+			strerror(-e->error));
+	b->failed++;
+}
+
+void rtnl_bulk_line_error(struct rtnl_bulk *b, int lineno, const char *err)
+{
+	fprintf(stderr, "%s:%d: %s\n", b->file, lineno, err);
+	b->failed++;
+}
+
+static void rtnl_bulk_answer(const struct nlmsghdr *n, int lineno, void *arg)
+{
+	struct rtnl_bulk *b = arg;
+
+	b->answer(b, n, lineno);
+}
+
+int rtnl_bulk_start(struct rtnl_bulk *b, struct rtnl_flush *f)
+{
+	/* Queued requests of a -batch-async window go first. */
+	if (rtnl_async_sync() < 0)
+		return -1;
+	if (rtnl_flush_open_byproto(f, 0, b->protocol ? : NETLINK_ROUTE) < 0)
+		return -1;
+	if (rtnl_flush_set_report(f, b->window, rtnl_bulk_report, b) < 0) {
+		rtnl_flush_close(f);
+		return -1;
+	}
+	if (b->answer)
+		rtnl_flush_set_answer(f, rtnl_bulk_answer);
+	return 0;
+}
+
+/* Send what is still queued and close f. Returns -1 if anything failed. */
+int rtnl_bulk_finish(struct rtnl_bulk *b, struct rtnl_flush *f)
+{
+	int ret = 0;
+
+	if (rtnl_flush_commit(f) == -2) {
+		perror("Cannot talk to rtnetlink");
+		ret = -1;
+	}
+	b->rate = rtnl_flush_rate(f);
+	rtnl_flush_close(f);
+
+	if (b->failed) {
+		fprintf(stderr, "%u of %u %s failed\n",
+			b->failed, b->entries, b->what ? : "entries");
+		ret = -1;
+	}
+	return ret;
+}
+
+int rtnl_bulk_load(struct rtnl_bulk *b, const struct nlmsghdr *proto,
+		   int maxlen)
+{
+	int max = b->max_fields ? : RTNL_BULK_MAX_FIELDS;
+	char *tok[RTNL_BULK_MAX_FIELDS];
+	struct nlmsghdr *n = NULL;
+	struct rtnl_flush f;
+	char *line = NULL;
+	int lineno = 0, ret = -1;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(b);
+	if (!fp)
+		return -1;
+
+	n = malloc(maxlen);
+	if (!n)
+		goto out;
+
+	if (rtnl_bulk_start(b, &f) < 0)
+		goto out;
+
+	while (getline(&line, &len, fp) != -1) {
+		const char *err;
+		int ntok;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, max);
+		if (ntok == 0)
+			continue;
+
+		b->entries++;
+		if (ntok > max) {
+			rtnl_bulk_line_error(b, lineno, "too many fields");
+			continue;
+		}
+
+		memcpy(n, proto, proto->nlmsg_len);
+		err = b->parse(b, n, maxlen, tok, ntok);
+		if (err) {
+			rtnl_bulk_line_error(b, lineno, err);
+			if (b->stop)
+				break;
+			continue;
+		}
+
+		f.tag = lineno;
+		if (rtnl_flush_add(&f, n, 0) < 0) {
+			if (errno == EMSGSIZE) {
+				rtnl_bulk_line_error(b, lineno,
+						     "request too large");
+				continue;
+			}
+			perror("Cannot talk to rtnetlink");
+			rtnl_flush_close(&f);
+			goto out;
+		}
+	}
+
+	ret = rtnl_bulk_finish(b, &f);
+out:
+	rtnl_bulk_close(fp);
+	free(line);
+	free(n);
+	return ret;
+}
@@ -0,0 +1,437 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * rtnl_ring.c	rtnetlink messages recorded in a ring file
+ *
+ * The file is a header page followed by a fixed size data area that is
+ * preallocated and mapped once, so recording a message is a memcpy.
+ * Every record is the message prefixed with its receive time and nsid,
+ * 8 byte aligned. A record never wraps: if it does not fit before the
+ * end of the area, a record of length 0 (or just the leftover bytes,
+ * when there is no room for one) pads up to the end.
+ *
+ * head and tail count bytes ever written, so the data is the range
+ * [tail, head) modulo the area size. When the writer needs room it
+ * moves tail past the oldest records before overwriting them, and a
+ * reader that finds tail moved past the record it just copied throws
+ * the copy away, so the file can be replayed while it is recorded.
+ *
+ * The data area is also cut in RTNL_RING_SEGS segments, and the rest of
+ * the header page holds a sparse index with the offset and time of the
+ * first record started in each of them. A reader after a time window
+ * starts from the last segment that began before it instead of from
+ * tail. Older readers do not look past the header and are not bothered
+ * by the index. Records older than max_age seconds, if set, are dropped
+ * as new ones are written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rtnl_ring.h"
+
+#define RTNL_RING_MAGIC		0x726c746e	/* "ntlr" on little endian */
+#define RTNL_RING_VERSION	1
+#define RTNL_RING_ALIGN(len)	(((len) + 7) & ~7ULL)
+#define RTNL_RING_SEGS		64
+#define RTNL_RING_IDX_NONE	UINT64_MAX
+
+struct rtnl_ring_hdr {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	pad;
+	uint32_t	hdrlen;		/* offset of the data area */
+	uint32_t	flags;
+	uint64_t	size;		/* of the data area */
+	uint64_t	head;
+	uint64_t	tail;
+	uint64_t	records;
+	uint64_t	lost;
+	uint64_t	overruns;
+	uint32_t	nseg;		/* index entries, 0 for no index */
+	uint32_t	max_age;	/* seconds, 0 keeps records for ever */
+	uint64_t	next_seg;	/* first segment with no entry yet */
+	uint64_t	expired;
+};
+
+struct rtnl_ring_idx {
+	uint64_t	off;		/* RTNL_RING_IDX_NONE while updated */
+	uint64_t	ts;
+};
+
+struct rtnl_ring_rec {
+	uint64_t	ts;		/* CLOCK_REALTIME, in ns */
+	int32_t		nsid;
+	uint32_t	len;		/* nlmsg_len, 0 pads to the end */
+};
+
+struct rtnl_ring {
+	struct rtnl_ring_hdr	*hdr;
+	struct rtnl_ring_idx	*idx;
+	char			*data;
+	size_t			map_len;
+};
+
+static struct rtnl_ring *rtnl_ring_map(int fd, size_t map_len, int prot)
+{
+	struct rtnl_ring *ring = calloc(1, sizeof(*ring));
+
+	if (!ring)
+		return NULL;
+	ring->hdr = mmap(NULL, map_len, prot, MAP_SHARED, fd, 0);
+	if (ring->hdr == MAP_FAILED) {
+		free(ring);
+		return NULL;
+	}
+	ring->map_len = map_len;
+	return ring;
+}
+
+struct rtnl_ring *rtnl_ring_create(const char *path, size_t size,
+				   unsigned int flags)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct rtnl_ring *ring;
+	int fd, err;
+
+	size = (size + page - 1) & ~(page - 1);
+	if (!size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+	if (fd < 0)
+		return NULL;
+	err = posix_fallocate(fd, 0, page + size);
+	if (err && err != EOPNOTSUPP && err != EINVAL) {
+		errno = err;
+		goto err;
+	}
+	if (err && ftruncate(fd, page + size) < 0)
+		goto err;
+
+	ring = rtnl_ring_map(fd, page + size, PROT_READ | PROT_WRITE);
+	if (!ring)
+		goto err;
+	close(fd);
+
+	ring->hdr->magic = RTNL_RING_MAGIC;
+	ring->hdr->version = RTNL_RING_VERSION;
+	ring->hdr->hdrlen = page;
+	ring->hdr->flags = flags;
+	ring->hdr->size = size;
+	ring->data = (char *)ring->hdr + page;
+	if (RTNL_RING_ALIGN(sizeof(*ring->hdr)) +
+	    RTNL_RING_SEGS * sizeof(*ring->idx) <= page &&
+	    size % RTNL_RING_SEGS == 0) {
+		ring->hdr->nseg = RTNL_RING_SEGS;
+		ring->idx = (void *)((char *)ring->hdr +
+				     RTNL_RING_ALIGN(sizeof(*ring->hdr)));
+	}
+	return ring;
+
+err:
+	close(fd);
+	unlink(path);
+	return NULL;
+}
+
+/* Move tail on until writing up to @end overwrites nothing that is left */
+static void rtnl_ring_reclaim(struct rtnl_ring *ring, uint64_t end)
+{
+	struct rtnl_ring_hdr *hdr = ring->hdr;
+	uint64_t tail = hdr->tail;
+
+	while (end - tail > hdr->size && tail < hdr->head) {
+		uint64_t pos = tail % hdr->size;
+		uint64_t room = hdr->size - pos;
+		const struct rtnl_ring_rec *r = (void *)(ring->data + pos);
+
+		if (room < sizeof(*r) || !r->len) {
+			tail += room;
+		} else {
+			tail += RTNL_RING_ALIGN(sizeof(*r) + r->len);
+			hdr->lost++;
+		}
+	}
+	__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+}
+
+/* Move tail past the records written before @limit */
+static void rtnl_ring_expire(struct rtnl_ring *ring, uint64_t limit)
+{
+	struct rtnl_ring_hdr *hdr = ring->hdr;
+	uint64_t tail = hdr->tail;
+
+	while (tail < hdr->head) {
+		uint64_t pos = tail % hdr->size;
+		uint64_t room = hdr->size - pos;
+		const struct rtnl_ring_rec *r = (void *)(ring->data + pos);
+
+		if (room < sizeof(*r) || !r->len) {
+			tail += room;
+			continue;
+		}
+		if (r->ts >= limit)
+			break;
+		tail += RTNL_RING_ALIGN(sizeof(*r) + r->len);
+		hdr->expired++;
+	}
+	if (tail != hdr->tail)
+		__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+}
+
+/* Note the record at @off if it is the first one of its segment */
+static void rtnl_ring_index(struct rtnl_ring *ring, uint64_t off, uint64_t ts)
+{
+	struct rtnl_ring_hdr *hdr = ring->hdr;
+	uint64_t seg = off / (hdr->size / hdr->nseg);
+	struct rtnl_ring_idx *e;
+
+	if (seg < hdr->next_seg)
+		return;
+	e = &ring->idx[seg % hdr->nseg];
+	__atomic_store_n(&e->off, RTNL_RING_IDX_NONE, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	e->ts = ts;
+	__atomic_store_n(&e->off, off, __ATOMIC_RELEASE);
+	hdr->next_seg = seg + 1;
+}
+
+int rtnl_ring_put(struct rtnl_ring *ring, const struct timespec *ts,
+		  int nsid, const struct nlmsghdr *n)
+{
+	struct rtnl_ring_hdr *hdr = ring->hdr;
+	uint64_t need = RTNL_RING_ALIGN(sizeof(struct rtnl_ring_rec) +
+					n->nlmsg_len);
+	uint64_t head = hdr->head;
+	uint64_t pos = head % hdr->size;
+	uint64_t room = hdr->size - pos;
+	struct rtnl_ring_rec *r;
+
+	if (n->nlmsg_len < sizeof(*n) || need > hdr->size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	if (room < need) {
+		rtnl_ring_reclaim(ring, head + room);
+		if (room >= sizeof(*r)) {
+			r = (void *)(ring->data + pos);
+			r->len = 0;
+		}
+		head += room;
+		pos = 0;
+	}
+	rtnl_ring_reclaim(ring, head + need);
+
+	r = (void *)(ring->data + pos);
+	r->ts = ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+	r->nsid = nsid;
+	r->len = n->nlmsg_len;
+	memcpy(r + 1, n, n->nlmsg_len);
+	if (ring->idx)
+		rtnl_ring_index(ring, head, r->ts);
+	if (hdr->max_age && r->ts > hdr->max_age * 1000000000ULL)
+		rtnl_ring_expire(ring, r->ts - hdr->max_age * 1000000000ULL);
+
+	hdr->records++;
+	__atomic_store_n(&hdr->head, head + need, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void rtnl_ring_overrun(struct rtnl_ring *ring)
+{
+	ring->hdr->overruns++;
+}
+
+void rtnl_ring_set_max_age(struct rtnl_ring *ring, unsigned int secs)
+{
+	ring->hdr->max_age = secs;
+}
+
+struct rtnl_ring *rtnl_ring_open(const char *path)
+{
+	struct rtnl_ring_hdr hdr;
+	struct rtnl_ring *ring;
+	struct stat stb;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &stb) ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    hdr.magic != RTNL_RING_MAGIC) {
+		errno = EBADMSG;
+		goto err;
+	}
+	if (hdr.version != RTNL_RING_VERSION || hdr.hdrlen < sizeof(hdr) ||
+	    hdr.size % 8 || hdr.hdrlen + hdr.size > stb.st_size) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	ring = rtnl_ring_map(fd, hdr.hdrlen + hdr.size, PROT_READ);
+	if (!ring)
+		goto err;
+	close(fd);
+	ring->data = (char *)ring->hdr + hdr.hdrlen;
+	if (hdr.nseg && hdr.size % hdr.nseg == 0 &&
+	    RTNL_RING_ALIGN(sizeof(hdr)) + hdr.nseg * sizeof(*ring->idx) <=
+	    hdr.hdrlen)
+		ring->idx = (void *)((char *)ring->hdr +
+				     RTNL_RING_ALIGN(sizeof(hdr)));
+	return ring;
+
+err:
+	close(fd);
+	return NULL;
+}
+
+/* The offset to walk from for records written from @since on */
+static uint64_t rtnl_ring_seek(struct rtnl_ring *ring, uint64_t since,
+			       uint64_t tail, uint64_t head)
+{
+	uint64_t best = tail;
+	unsigned int i;
+
+	if (!ring->idx)
+		return tail;
+
+	for (i = 0; i < ring->hdr->nseg; i++) {
+		struct rtnl_ring_idx *e = &ring->idx[i];
+		uint64_t off, ts;
+
+		off = __atomic_load_n(&e->off, __ATOMIC_ACQUIRE);
+		ts = e->ts;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (off == RTNL_RING_IDX_NONE ||
+		    __atomic_load_n(&e->off, __ATOMIC_RELAXED) != off)
+			continue;
+		if (off > best && off < head && ts <= since)
+			best = off;
+	}
+	return best;
+}
+
+/*
+ * Run @filter on a copy of every record in the ring, oldest first.
+ * Records the writer overtakes meanwhile are skipped. Returns the first
+ * negative value @filter returned, -1 if the ring is corrupt, else 0.
+ */
+int rtnl_ring_walk(struct rtnl_ring *ring, rtnl_ring_filter_t filter,
+		   void *arg)
+{
+	return rtnl_ring_walk_range(ring, NULL, NULL, filter, arg);
+}
+
+/*
+ * Like rtnl_ring_walk(), for the records written from @since up to
+ * @until only, either of which may be NULL.
+ */
+int rtnl_ring_walk_range(struct rtnl_ring *ring, const struct timespec *since,
+			 const struct timespec *until,
+			 rtnl_ring_filter_t filter, void *arg)
+{
+	const struct rtnl_ring_hdr *hdr = ring->hdr;
+	uint64_t size = hdr->size;
+	uint64_t off = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE);
+	uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	uint64_t from = 0, to = UINT64_MAX;
+	struct nlmsghdr *n;
+	int err = 0;
+
+	if (since) {
+		from = since->tv_sec * 1000000000ULL + since->tv_nsec;
+		off = rtnl_ring_seek(ring, from, off, head);
+	}
+	if (until)
+		to = until->tv_sec * 1000000000ULL + until->tv_nsec;
+
+	n = malloc(size);
+	if (!n)
+		return -1;
+
+	while (off < head) {
+		uint64_t pos = off % size;
+		uint64_t room = size - pos;
+		struct rtnl_ring_rec r;
+		struct timespec ts;
+		uint64_t tail;
+		bool valid;
+
+		if (room < sizeof(r)) {
+			off += room;
+			continue;
+		}
+		memcpy(&r, ring->data + pos, sizeof(r));
+		if (!r.len) {
+			off += room;
+			continue;
+		}
+		valid = r.len >= sizeof(*n) && r.len <= room - sizeof(r);
+		if (valid)
+			memcpy(n, ring->data + pos + sizeof(r), r.len);
+
+		/* the writer overtook us, anything copied may be torn */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&hdr->tail, __ATOMIC_RELAXED);
+		if (tail > off) {
+			off = tail;
+			continue;
+		}
+		if (!valid || n->nlmsg_len != r.len) {
+			fprintf(stderr, "rtnl_ring: malformed record at %llu\n",
+				(unsigned long long)off);
+			err = -1;
+			break;
+		}
+
+		off += RTNL_RING_ALIGN(sizeof(r) + r.len);
+		if (r.ts < from)
+			continue;
+		if (r.ts > to)
+			break;
+
+		ts.tv_sec = r.ts / 1000000000ULL;
+		ts.tv_nsec = r.ts % 1000000000ULL;
+		err = filter(&ts, r.nsid, n, arg);
+		if (err < 0)
+			break;
+		err = 0;
+	}
+
+	free(n);
+	return err;
+}
+
+unsigned int rtnl_ring_flags(const struct rtnl_ring *ring)
+{
+	return ring->hdr->flags;
+}
+
+void rtnl_ring_stats(const struct rtnl_ring *ring,
+		     struct rtnl_ring_stats *stats)
+{
+	stats->records = ring->hdr->records;
+	stats->lost = ring->hdr->lost;
+	stats->overruns = ring->hdr->overruns;
+	stats->expired = ring->hdr->expired;
+}
+
+void rtnl_ring_close(struct rtnl_ring *ring)
+{
+	if (!ring)
+		return;
+	munmap(ring->hdr, ring->map_len);
+	free(ring);
+}
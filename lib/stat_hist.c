@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * stat_hist.c	binary history files of the counter tools
+ *
+ * A history is a header followed by an array of fixed size records. The
+ * header carries a checksum of itself and one of the records, so a torn
+ * or foreign file is never taken for a history. A new history is written
+ * next to the old one and renamed over it: the file at the path is
+ * always complete. Holders of the lock on a file that was replaced
+ * meanwhile notice it and lock the new one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stat_hist.h"
+
+#define STAT_HIST_MAGIC		0x7f485354	/* "\x7fHST", never a '#' */
+#define STAT_HIST_VERSION	1
+
+struct stat_hist_hdr {
+	uint32_t	magic;
+	uint16_t	version;
+	uint16_t	kind;
+	uint32_t	rec_size;
+	uint32_t	count;
+	char		source[128];
+	uint32_t	data_csum;
+	uint32_t	csum;		/* of the header up to here */
+};
+
+/* FNV-1a */
+static uint32_t stat_hist_csum(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t h = 2166136261u;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+int stat_hist_open(const char *path)
+{
+	struct stat a, b;
+	int fd;
+
+	for (;;) {
+		fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+		if (fd < 0)
+			return -1;
+		if (flock(fd, LOCK_EX) || fstat(fd, &a))
+			goto err;
+		/* still the file at path, not one renamed over meanwhile */
+		if (lstat(path, &b) == 0) {
+			if (a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+				return fd;
+		} else if (errno != ENOENT) {
+			goto err;
+		}
+		close(fd);
+	}
+err:
+	close(fd);
+	return -1;
+}
+
+int stat_hist_map(int fd, uint16_t kind, size_t rec_size,
+		  struct stat_hist *h)
+{
+	const struct stat_hist_hdr *hdr;
+	uint32_t magic;
+	struct stat stb;
+	void *map;
+
+	memset(h, 0, sizeof(*h));
+	if (pread(fd, &magic, sizeof(magic), 0) != sizeof(magic) ||
+	    magic != STAT_HIST_MAGIC)
+		return 1;
+
+	if (fstat(fd, &stb) || stb.st_size < sizeof(*hdr))
+		return -1;
+	map = mmap(NULL, stb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	hdr = map;
+
+	if (hdr->csum != stat_hist_csum(hdr, offsetof(struct stat_hist_hdr, csum)) ||
+	    hdr->version != STAT_HIST_VERSION ||
+	    hdr->kind != kind || hdr->rec_size != rec_size ||
+	    (stb.st_size - sizeof(*hdr)) / rec_size < hdr->count ||
+	    hdr->data_csum != stat_hist_csum(hdr + 1,
+					     (size_t)hdr->count * rec_size)) {
+		munmap(map, stb.st_size);
+		return -1;
+	}
+
+	memcpy(h->source, hdr->source, sizeof(h->source));
+	h->source[sizeof(h->source) - 1] = 0;
+	h->data = hdr + 1;
+	h->count = hdr->count;
+	h->map = map;
+	h->map_len = stb.st_size;
+	return 0;
+}
+
+void stat_hist_unmap(struct stat_hist *h)
+{
+	if (h->map)
+		munmap(h->map, h->map_len);
+	memset(h, 0, sizeof(*h));
+}
+
+static int stat_hist_write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int stat_hist_write(const char *path, uint16_t kind, const char *source,
+		    const void *data, size_t rec_size, size_t count)
+{
+	struct stat_hist_hdr hdr = {
+		.magic = STAT_HIST_MAGIC,
+		.version = STAT_HIST_VERSION,
+		.kind = kind,
+		.rec_size = rec_size,
+		.count = count,
+	};
+	char tmp[PATH_MAX];
+	int fd;
+
+	if (count > UINT32_MAX || rec_size > UINT32_MAX) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+	strncpy(hdr.source, source, sizeof(hdr.source) - 1);
+	hdr.data_csum = stat_hist_csum(data, count * rec_size);
+	hdr.csum = stat_hist_csum(&hdr, offsetof(struct stat_hist_hdr, csum));
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	unlink(tmp);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	if (fd < 0)
+		return -1;
+	if (stat_hist_write_all(fd, &hdr, sizeof(hdr)) ||
+	    stat_hist_write_all(fd, data, count * rec_size) ||
+	    close(fd)) {
+		unlink(tmp);
+		return -1;
+	}
+	if (rename(tmp, path) < 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * stat_shm.c	counter snapshots published by a daemon in a shared file
+ *
+ * The writer maps the file and updates the snapshot under a sequence
+ * count, odd while an update is in progress. Readers map the file, copy
+ * the snapshot and retry if the count was odd or changed meanwhile, so
+ * neither side ever waits for the other. When a snapshot outgrows the
+ * file, a bigger one is set up and renamed over it; readers that still
+ * have the old one mapped just see no further updates.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stat_shm.h"
+
+#define STAT_SHM_MAGIC		0x73746174	/* "stat" */
+#define STAT_SHM_RETRIES	1000
+
+struct stat_shm_hdr {
+	uint32_t	magic;
+	uint32_t	seq;
+	uint32_t	pid;		/* of the writer, as of its last update */
+	uint32_t	len;
+	uint64_t	size;		/* of data[] */
+	char		data[];
+};
+
+struct stat_shm {
+	char			*path;
+	struct stat_shm_hdr	*hdr;
+	size_t			map_len;
+};
+
+static int stat_shm_grow(struct stat_shm *shm, size_t len)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t map_len = (sizeof(struct stat_shm_hdr) + 2 * len + page - 1) &
+			 ~(page - 1);
+	struct stat_shm_hdr *hdr;
+	char tmp[PATH_MAX];
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", shm->path, getpid());
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, map_len) < 0)
+		goto err;
+	hdr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		goto err;
+	close(fd);
+
+	hdr->magic = STAT_SHM_MAGIC;
+	hdr->pid = getpid();
+	hdr->size = map_len - sizeof(*hdr);
+
+	if (rename(tmp, shm->path) < 0) {
+		munmap(hdr, map_len);
+		unlink(tmp);
+		return -1;
+	}
+
+	if (shm->hdr)
+		munmap(shm->hdr, shm->map_len);
+	shm->hdr = hdr;
+	shm->map_len = map_len;
+	return 0;
+
+err:
+	close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+struct stat_shm *stat_shm_create(const char *path)
+{
+	struct stat_shm *shm = calloc(1, sizeof(*shm));
+
+	if (!shm)
+		return NULL;
+	shm->path = strdup(path);
+	if (!shm->path || stat_shm_grow(shm, 0)) {
+		free(shm->path);
+		free(shm);
+		return NULL;
+	}
+	return shm;
+}
+
+int stat_shm_publish(struct stat_shm *shm, const void *data, size_t len)
+{
+	struct stat_shm_hdr *hdr;
+	uint32_t seq;
+
+	if (len > UINT32_MAX)
+		return -1;
+	if (len > shm->hdr->size && stat_shm_grow(shm, len))
+		return -1;
+	hdr = shm->hdr;
+	hdr->pid = getpid();
+
+	seq = __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(hdr->data, data, len);
+	__atomic_store_n(&hdr->len, len, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void stat_shm_destroy(struct stat_shm *shm)
+{
+	if (!shm)
+		return;
+	unlink(shm->path);
+	munmap(shm->hdr, shm->map_len);
+	free(shm->path);
+	free(shm);
+}
+
+void *stat_shm_read(const char *path, size_t *len)
+{
+	const struct stat_shm_hdr *hdr;
+	void *snap = NULL;
+	struct stat stb;
+	int fd, i;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &stb) || stb.st_size < sizeof(*hdr) ||
+	    (stb.st_uid != getuid() && stb.st_uid != 0)) {
+		close(fd);
+		return NULL;
+	}
+	hdr = mmap(NULL, stb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	if (hdr->magic != STAT_SHM_MAGIC ||
+	    hdr->size > stb.st_size - sizeof(*hdr) ||
+	    (kill(hdr->pid, 0) && errno != EPERM))
+		goto out;
+
+	for (i = 0; i < STAT_SHM_RETRIES; i++) {
+		uint32_t seq, n;
+
+		seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		n = __atomic_load_n(&hdr->len, __ATOMIC_RELAXED);
+		if (n > hdr->size)
+			continue;
+
+		free(snap);
+		snap = malloc(n ? n : 1);
+		if (!snap)
+			goto out;
+		memcpy(snap, hdr->data, n);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == seq) {
+			/* nothing published yet */
+			if (!seq)
+				break;
+			*len = n;
+			munmap((void *)hdr, stb.st_size);
+			return snap;
+		}
+	}
+	free(snap);
+	snap = NULL;
+out:
+	munmap((void *)hdr, stb.st_size);
+	return snap;
+}
@@ -27,6 +27,10 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #ifdef HAVE_LIBCAP
 #include <sys/capability.h>
 #endif
@@ -39,12 +43,14 @@
 int resolve_hosts;
 int timestamp_short;
 int pretty;
+int json_lines;
+int json_cbor;
 int use_iec;
 int human_readable;
 const char *_SL_ = "\n";
 
-static int open_fds[5];
-static int open_fds_cnt;
+static int *open_fds;
+static int open_fds_cnt, open_fds_size;
 
 static int af_byte_len(int af);
 static void print_time(char *buf, int len, __u32 time);
@@ -194,14 +200,29 @@ static int get_netmask(unsigned int *val, const char *arg, int base)
 	return -1;
 }
 
-int get_unsigned(unsigned int *val, const char *arg, int base)
+/*
+ * Plain decimal numbers are by far the most common in batch files and
+ * are converted here; signs, blanks, octal, hex and anything long enough
+ * to overflow go through strtoul() as before.
+ */
+static int get_ulong(unsigned long *val, const char *arg, int base)
 {
-	unsigned long res;
+	unsigned long res = 0;
 	char *ptr;
+	int i;
 
 	if (!arg || !*arg)
 		return -1;
 
+	if (base == 10 || (base == 0 && (arg[0] != '0' || !arg[1]))) {
+		for (i = 0; i < 9 && arg[i] >= '0' && arg[i] <= '9'; i++)
+			res = res * 10 + arg[i] - '0';
+		if (i && !arg[i]) {
+			*val = res;
+			return 0;
+		}
+	}
+
 	res = strtoul(arg, &ptr, base);
 
 	/* empty string or trailing non-digits */
@@ -212,6 +233,17 @@ int get_unsigned(unsigned int *val, const char *arg, int base)
 	if (res == ULONG_MAX && errno == ERANGE)
 		return -1;
 
+	*val = res;
+	return 0;
+}
+
+int get_unsigned(unsigned int *val, const char *arg, int base)
+{
+	unsigned long res;
+
+	if (get_ulong(&res, arg, base))
+		return -1;
+
 	/* out side range of unsigned */
 	if (res > UINT_MAX)
 		return -1;
@@ -341,18 +373,8 @@ int get_u64(__u64 *val, const char *arg, int base)
 int get_u32(__u32 *val, const char *arg, int base)
 {
 	unsigned long res;
-	char *ptr;
-
-	if (!arg || !*arg)
-		return -1;
-	res = strtoul(arg, &ptr, base);
 
-	/* empty string or trailing non-digits */
-	if (!ptr || ptr == arg || *ptr)
-		return -1;
-
-	/* overflow */
-	if (res == ULONG_MAX && errno == ERANGE)
+	if (get_ulong(&res, arg, base))
 		return -1;
 
 	/* in case UL > 32 bits */
@@ -366,18 +388,8 @@ int get_u32(__u32 *val, const char *arg, int base)
 int get_u16(__u16 *val, const char *arg, int base)
 {
 	unsigned long res;
-	char *ptr;
-
-	if (!arg || !*arg)
-		return -1;
-	res = strtoul(arg, &ptr, base);
 
-	/* empty string or trailing non-digits */
-	if (!ptr || ptr == arg || *ptr)
-		return -1;
-
-	/* overflow */
-	if (res == ULONG_MAX && errno == ERANGE)
+	if (get_ulong(&res, arg, base))
 		return -1;
 
 	if (res > 0xFFFFUL)
@@ -390,18 +402,8 @@ int get_u16(__u16 *val, const char *arg, int base)
 int get_u8(__u8 *val, const char *arg, int base)
 {
 	unsigned long res;
-	char *ptr;
 
-	if (!arg || !*arg)
-		return -1;
-
-	res = strtoul(arg, &ptr, base);
-	/* empty string or trailing non-digits */
-	if (!ptr || ptr == arg || *ptr)
-		return -1;
-
-	/* overflow */
-	if (res == ULONG_MAX && errno == ERANGE)
+	if (get_ulong(&res, arg, base))
 		return -1;
 
 	if (res > 0xFFUL)
@@ -495,7 +497,15 @@ static int get_addr_ipv4(__u8 *ap, const char *cp)
 		unsigned long n;
 		char *endp;
 
-		n = strtoul(cp, &endp, 0);
+		if (*cp >= '0' && *cp <= '9' &&
+		    (cp[0] != '0' || !isalnum((unsigned char)cp[1]))) {
+			/* plain decimal, strtoul() takes the rest */
+			for (n = 0, endp = (char *)cp;
+			     *endp >= '0' && *endp <= '9' && n <= 255; endp++)
+				n = n * 10 + *endp - '0';
+		} else {
+			n = strtoul(cp, &endp, 0);
+		}
 		if (n > 255)
 			return -1;	/* bogus network value */
 
@@ -918,6 +928,101 @@ int matches(const char *prefix, const char *string)
 	return *prefix;
 }
 
+struct keyword_slot {
+	const char	*s;
+	unsigned int	len;
+	int		id;
+};
+
+static __u32 keyword_hash(const char *s, unsigned int len)
+{
+	__u32 h = 2166136261U;
+
+	while (len--)
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+/* The first entry matching the first @len characters of @s */
+static int keyword_scan(const struct keyword_table *t, const char *s,
+			unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->n; i++) {
+		const struct keyword *kw = &t->kw[i];
+		size_t kwlen = strlen(kw->name);
+
+		if ((kw->prefix ? len <= kwlen : len == kwlen) &&
+		    memcmp(kw->name, s, len) == 0)
+			return kw->id;
+	}
+	return -1;
+}
+
+static struct keyword_slot *keyword_slot(const struct keyword_table *t,
+					 const char *s, unsigned int len)
+{
+	struct keyword_slot *slot;
+	__u32 h = keyword_hash(s, len);
+
+	for (;; h++) {
+		slot = &t->slot[h & t->mask];
+		if (!slot->s ||
+		    (slot->len == len && memcmp(slot->s, s, len) == 0))
+			return slot;
+	}
+}
+
+/*
+ * Every string that can match at all, that is each name and, for prefix
+ * entries, each of its prefixes, goes in the table with the result of
+ * the ordered scan for it.
+ */
+static int keyword_build(struct keyword_table *t)
+{
+	unsigned int i, len, count = 0, size = 16;
+
+	for (i = 0; i < t->n; i++)
+		count += t->kw[i].prefix ? strlen(t->kw[i].name) : 1;
+	while (size < 2 * count)
+		size *= 2;
+
+	t->slot = calloc(size, sizeof(*t->slot));
+	if (!t->slot)
+		return -1;
+	t->mask = size - 1;
+
+	for (i = 0; i < t->n; i++) {
+		const char *name = t->kw[i].name;
+		unsigned int kwlen = strlen(name);
+
+		for (len = t->kw[i].prefix ? 1 : kwlen; len <= kwlen; len++) {
+			struct keyword_slot *slot = keyword_slot(t, name, len);
+
+			if (slot->s || !len)
+				continue;
+			slot->s = name;
+			slot->len = len;
+			slot->id = keyword_scan(t, name, len);
+		}
+	}
+	return 0;
+}
+
+int keyword_lookup(struct keyword_table *t, const char *arg)
+{
+	unsigned int len = strlen(arg);
+	struct keyword_slot *slot;
+
+	if (!len)
+		return -1;
+	if (!t->slot && keyword_build(t))
+		return keyword_scan(t, arg, len);
+	slot = keyword_slot(t, arg, len);
+	return slot->s ? slot->id : -1;
+}
+
 static int matches_warn(const char *prefix, const char *string)
 {
 	int rc;
@@ -1144,6 +1249,15 @@ static const char *resolve_address(const void *addr, int len, int af)
 	/* Even if we fail, "negative" entry is remembered. */
 	return n->name;
 }
+
+static const char *(*resolve_hook)(int af, int len, const void *addr);
+
+/* Look names up with @resolve instead, see resolve_start() */
+void format_host_set_resolver(const char *(*resolve)(int af, int len,
+						     const void *addr))
+{
+	resolve_hook = resolve;
+}
 #endif
 
 const char *format_host_r(int af, int len, const void *addr,
@@ -1155,8 +1269,13 @@ const char *format_host_r(int af, int len, const void *addr,
 
 		len = len <= 0 ? af_byte_len(af) : len;
 
-		if (len > 0 &&
-		    (n = resolve_address(addr, len, af)) != NULL)
+		if (len > 0 && resolve_hook)
+			n = resolve_hook(af, len, addr);
+		else if (len > 0)
+			n = resolve_address(addr, len, af);
+		else
+			n = NULL;
+		if (n)
 			return n;
 	}
 #endif
@@ -1276,22 +1395,28 @@ void print_escape_buf(const __u8 *buf, size_t len, const char *escape)
 int print_timestamp(FILE *fp)
 {
 	struct timeval tv;
-	struct tm *tm;
 
 	gettimeofday(&tv, NULL);
-	tm = localtime(&tv.tv_sec);
+	return print_timestamp_tv(fp, &tv);
+}
+
+int print_timestamp_tv(FILE *fp, const struct timeval *tv)
+{
+	struct tm *tm;
+
+	tm = localtime(&tv->tv_sec);
 
 	if (timestamp_short) {
 		char tshort[40];
 
 		strftime(tshort, sizeof(tshort), "%Y-%m-%dT%H:%M:%S", tm);
-		fprintf(fp, "[%s.%06ld] ", tshort, tv.tv_usec);
+		fprintf(fp, "[%s.%06ld] ", tshort, tv->tv_usec);
 	} else {
 		char *tstr = asctime(tm);
 
 		tstr[strlen(tstr)-1] = 0;
 		fprintf(fp, "Timestamp: %s %ld usec\n",
-			tstr, tv.tv_usec);
+			tstr, tv->tv_usec);
 	}
 
 	return 0;
@@ -1395,15 +1520,20 @@ static ssize_t getcmdline(char **linep, size_t *lenp, FILE *in)
 }
 
 /* split command line into argument vector */
+static inline bool makeargs_ws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
 static int makeargs(char *line, char *argv[], int maxargs)
 {
-	static const char ws[] = " \t\r\n";
 	char *cp = line;
 	int argc = 0;
 
 	while (*cp) {
 		/* skip leading whitespace */
-		cp += strspn(cp, ws);
+		while (makeargs_ws(*cp))
+			cp++;
 
 		if (*cp == '\0')
 			break;
@@ -1428,7 +1558,8 @@ static int makeargs(char *line, char *argv[], int maxargs)
 			argv[argc++] = cp;
 
 			/* find end of word */
-			cp += strcspn(cp, ws);
+			while (*cp && !makeargs_ws(*cp))
+				cp++;
 			if (*cp == '\0')
 				break;
 		}
@@ -1441,6 +1572,175 @@ static int makeargs(char *line, char *argv[], int maxargs)
 	return argc;
 }
 
+/*
+ * A batch file is mapped privately and split into argument vectors in
+ * place, without copying each line out of a stdio buffer first. Only
+ * lines continued with a backslash are copied to be joined. The pages
+ * of lines that are done are dropped, so a huge file does not stay in
+ * memory.
+ */
+#define BATCH_RELEASE	(1 << 20)
+
+struct batch_reader {
+	char		*map;
+	size_t		size;
+	size_t		off;
+	size_t		released;
+	int		lineno;
+	char		*buf;		/* joined lines, to free */
+};
+
+/* The next physical line, terminated in place or copied to *copy */
+static char *batch_reader_phys(struct batch_reader *r, size_t *len, bool *nl,
+			       char **copy)
+{
+	char *line = r->map + r->off, *end;
+	size_t rest = r->size - r->off;
+
+	*copy = NULL;
+	if (!rest)
+		return NULL;
+	r->lineno++;
+
+	end = memchr(line, '\n', rest);
+	*nl = end;
+	if (end) {
+		*end = '\0';
+		*len = end - line;
+		r->off += *len + 1;
+		return line;
+	}
+
+	/* no newline to put the terminator on */
+	r->off = r->size;
+	*len = rest;
+	*copy = strndup(line, rest);
+	return *copy;
+}
+
+/* Like getcmdline(): ends a line at '#' and joins continued lines */
+static char *batch_reader_line(struct batch_reader *r, char **buf,
+			       const char **err)
+{
+	size_t len, blen = 0;
+	char *line, *copy, *cp;
+	bool nl, cont;
+
+	*buf = NULL;
+	for (;;) {
+		line = batch_reader_phys(r, &len, &nl, &copy);
+		if (!line) {
+			if (*buf)
+				*err = "Missing continuation line";
+			free(*buf);
+			*buf = NULL;
+			return NULL;
+		}
+
+		cp = strchr(line, '#');
+		if (cp)
+			*cp = '\0';
+		cont = !cp && nl && len && strlen(line) == len &&
+		       line[len - 1] == '\\';
+		if (!cont && !*buf) {
+			*buf = copy;
+			return line;
+		}
+
+		len = cont ? len - 1 : strlen(line);
+		cp = realloc(*buf, blen + len + 1);
+		if (!cp) {
+			*err = "Out of memory";
+			free(copy);
+			free(*buf);
+			*buf = NULL;
+			return NULL;
+		}
+		*buf = cp;
+		memcpy(*buf + blen, line, len);
+		blen += len;
+		(*buf)[blen] = '\0';
+		free(copy);
+
+		if (!cont)
+			return *buf;
+	}
+}
+
+static struct batch_reader *batch_reader_open(FILE *in)
+{
+	struct batch_reader *r;
+	struct stat st;
+	off_t off;
+	int fd = fileno(in);
+
+	off = lseek(fd, 0, SEEK_CUR);
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || off < 0 ||
+	    off >= st.st_size)
+		return NULL;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+	r->size = st.st_size;
+	r->off = off;
+	r->map = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		      fd, 0);
+	if (r->map == MAP_FAILED) {
+		free(r);
+		return NULL;
+	}
+	return r;
+}
+
+/*
+ * The arguments of the next line that has any, 0 at the end of the file,
+ * -1 if the file ends in an error, after reporting it; exits on a line
+ * that cannot be split, like makeargs().
+ */
+static int batch_reader_next(struct batch_reader *r, char *argv[])
+{
+	size_t page = getpagesize();
+	const char *err = NULL;
+	char *line;
+	int argc;
+
+	free(r->buf);
+	r->buf = NULL;
+	if (r->off - r->released >= BATCH_RELEASE) {
+		size_t to = r->off & ~(page - 1);
+
+		madvise(r->map + r->released, to - r->released,
+			MADV_DONTNEED);
+		r->released = to;
+	}
+
+	do {
+		line = batch_reader_line(r, &r->buf, &err);
+		if (!line) {
+			if (!err)
+				return 0;
+			fprintf(stderr, "%s\n", err);
+			return -1;
+		}
+		argc = makeargs(line, argv, MAX_ARGS);
+		if (!argc) {
+			free(r->buf);	/* blank line */
+			r->buf = NULL;
+		}
+	} while (!argc);
+
+	cmdlineno = r->lineno;
+	return argc;
+}
+
+static void batch_reader_close(struct batch_reader *r)
+{
+	free(r->buf);
+	munmap(r->map, r->size);
+	free(r);
+}
+
 void print_nlmsg_timestamp(FILE *fp, const struct nlmsghdr *n)
 {
 	char *tstr;
@@ -1738,9 +2038,45 @@ char *sprint_time64(__s64 time, char *buf)
 	return buf;
 }
 
-int do_batch(const char *name, bool force,
-	     int (*cmd)(int argc, char *argv[], void *data), void *data)
+/* CLOCK_MONOTONIC in seconds, for intervals and rates */
+double monotonic_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Sleep until monotonic_now() reaches @deadline. Samplers step the
+ * deadline by their interval, so the time taken by a sample does not
+ * delay the next one. Returns -1 if a signal handler ran first, so that
+ * loops stopped by a signal can look at their flag.
+ */
+int monotonic_sleep_until(double deadline)
+{
+	struct timespec ts;
+
+	if (deadline < 0)
+		deadline = 0;
+	ts.tv_sec = deadline;
+	ts.tv_nsec = (deadline - ts.tv_sec) * 1e9;
+	if (ts.tv_nsec >= NSEC_PER_SEC)
+		ts.tv_nsec = NSEC_PER_SEC - 1;
+	return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ?
+	       -1 : 0;
+}
+
+static void batch_async_report(int lineno, void *name)
+{
+	fprintf(stderr, "Command failed %s:%d\n", (const char *)name, lineno);
+}
+
+static int __do_batch(const char *name, bool force, bool async,
+		      int (*cmd)(int argc, char *argv[], void *data),
+		      void *data)
 {
+	struct batch_reader *reader;
 	char *line = NULL;
 	size_t len = 0;
 	int ret = EXIT_SUCCESS;
@@ -1754,14 +2090,27 @@ int do_batch(const char *name, bool force,
 		}
 	}
 
+	reader = batch_reader_open(stdin);
+
 	cmdlineno = 0;
-	while (getcmdline(&line, &len, stdin) != -1) {
+	for (;;) {
 		char *largv[MAX_ARGS];
 		int largc;
 
-		largc = makeargs(line, largv, MAX_ARGS);
-		if (!largc)
-			continue;	/* blank line */
+		if (reader) {
+			largc = batch_reader_next(reader, largv);
+			if (largc <= 0)
+				break;
+		} else {
+			if (getcmdline(&line, &len, stdin) == -1)
+				break;
+			largc = makeargs(line, largv, MAX_ARGS);
+			if (!largc)
+				continue;	/* blank line */
+		}
+
+		if (async)
+			rtnl_async_tag(cmdlineno);
 
 		if (cmd(largc, largv, data)) {
 			fprintf(stderr, "Command failed %s:%d\n",
@@ -1770,9 +2119,402 @@ int do_batch(const char *name, bool force,
 			if (!force)
 				break;
 		}
+
+		/* earlier lines whose requests completed meanwhile */
+		if (async && rtnl_async_failed()) {
+			ret = EXIT_FAILURE;
+			if (!force)
+				break;
+		}
 	}
 
 	free(line);
+	if (reader)
+		batch_reader_close(reader);
+
+	if (async && rtnl_async_stop())
+		ret = EXIT_FAILURE;
+
+	return ret;
+}
+
+int do_batch(const char *name, bool force,
+	     int (*cmd)(int argc, char *argv[], void *data), void *data)
+{
+	return __do_batch(name, force, false, cmd, data);
+}
+
+/* Like do_batch(), but requests on rth which do not need an answer are
+ * sent in windows of up to "window" requests instead of waiting for an
+ * ACK after every line. Failures are reported with their line number
+ * once the window they belong to completes.
+ */
+int do_batch_async(const char *name, bool force, struct rtnl_handle *rth,
+		   unsigned int window,
+		   int (*cmd)(int argc, char *argv[], void *data), void *data)
+{
+	if (rtnl_async_start(rth, window, batch_async_report,
+			     (void *)name) < 0)
+		return EXIT_FAILURE;
+
+	return __do_batch(name, force, true, cmd, data);
+}
+
+/* Parallel batch: lines are sharded by the value following "key" (e.g.
+ * the device name) over forked workers, so lines for one key keep
+ * their order. Workers write their stdout and stderr into private
+ * files and log a record for every line, the parent replays both in
+ * line order once all workers are done.
+ */
+struct batch_rec {
+	int	lineno;
+	int	failed;
+	off_t	out_off;
+	off_t	out_len;
+	off_t	err_off;
+	off_t	err_len;	/* -1: worker died while running the line */
+	int	worker;		/* filled in by the parent */
+};
+
+struct batch_worker {
+	pid_t	pid;
+	FILE	*in;
+	int	outfd;
+	int	errfd;
+	int	recfd;
+};
+
+/* Shared with all workers: first line which failed without -force, 0 if
+ * none. Nothing after it is run, as in a serial batch.
+ */
+static int *batch_stop;
+
+static void batch_stop_at(int lineno)
+{
+	int cur = __atomic_load_n(batch_stop, __ATOMIC_RELAXED);
+
+	while ((!cur || lineno < cur) &&
+	       !__atomic_compare_exchange_n(batch_stop, &cur, lineno, false,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static bool batch_stopped(int lineno)
+{
+	int stop = __atomic_load_n(batch_stop, __ATOMIC_RELAXED);
+
+	return stop && lineno > stop;
+}
+
+/* the command called exit() in the middle of a line */
+static void batch_worker_exit(void)
+{
+	batch_stop_at(cmdlineno);
+}
+
+static unsigned int batch_key_hash(const char *line, const char *key)
+{
+	char *largv[MAX_ARGS], *copy;
+	unsigned int hash = 0;
+	int i, largc;
+
+	copy = strdup(line);
+	if (!copy)
+		return 0;
+
+	largc = makeargs(copy, largv, MAX_ARGS);
+	for (i = 0; i + 1 < largc; i++) {
+		const char *cp;
+
+		if (strcmp(largv[i], key))
+			continue;
+
+		for (cp = largv[i + 1], hash = 5381; *cp; cp++)
+			hash = hash * 33 + (unsigned char)*cp;
+		break;
+	}
+
+	free(copy);
+	return hash;
+}
+
+static int batch_worker_run(FILE *in, int recfd, bool force,
+			    int (*cmd)(int argc, char *argv[], void *data),
+			    void *data)
+{
+	char *line = NULL;
+	size_t len = 0;
+	int ret = EXIT_SUCCESS;
+
+	if (!force)
+		atexit(batch_worker_exit);
+
+	while (getline(&line, &len, in) != -1) {
+		struct batch_rec rec = {};
+		char *largv[MAX_ARGS];
+		char *cp;
+		int largc;
+
+		rec.lineno = strtol(line, &cp, 10);
+		largc = makeargs(cp, largv, MAX_ARGS);
+		if (!largc)
+			continue;
+
+		/* lines arrive in order, all later ones are stopped too */
+		if (batch_stopped(rec.lineno))
+			break;
+
+		cmdlineno = rec.lineno;
+		fflush(stdout);
+		fflush(stderr);
+		rec.out_off = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+		rec.err_off = lseek(STDERR_FILENO, 0, SEEK_CUR);
+
+		/* in case the command exits the worker */
+		rec.failed = 1;
+		rec.err_len = -1;
+		if (write(recfd, &rec, sizeof(rec)) != sizeof(rec))
+			return EXIT_FAILURE;
+
+		rec.failed = !!cmd(largc, largv, data);
+		fflush(stdout);
+		fflush(stderr);
+		rec.out_len = lseek(STDOUT_FILENO, 0, SEEK_CUR) - rec.out_off;
+		rec.err_len = lseek(STDERR_FILENO, 0, SEEK_CUR) - rec.err_off;
+		if (write(recfd, &rec, sizeof(rec)) != sizeof(rec))
+			return EXIT_FAILURE;
+
+		if (rec.failed) {
+			ret = EXIT_FAILURE;
+			if (!force) {
+				batch_stop_at(rec.lineno);
+				break;
+			}
+		}
+	}
+
+	free(line);
+	return ret;
+}
+
+static int batch_rec_cmp(const void *a, const void *b)
+{
+	const struct batch_rec *ra = a, *rb = b;
+
+	return ra->lineno - rb->lineno;
+}
+
+static void batch_replay(int fd, off_t off, off_t len, FILE *fp)
+{
+	char buf[4096];
+	off_t done = 0;
+
+	while (done < len) {
+		ssize_t cc;
+
+		cc = pread(fd, buf, MIN(sizeof(buf), len - done), off + done);
+		if (cc <= 0)
+			break;
+		fwrite(buf, 1, cc, fp);
+		done += cc;
+	}
+	fflush(fp);
+}
+
+/* Replay the records of all workers in line order */
+static int batch_workers_report(const char *name, struct batch_worker *w,
+				unsigned int jobs)
+{
+	struct batch_rec *recs = NULL;
+	size_t nrecs = 0, i;
+	int ret = EXIT_SUCCESS;
+	unsigned int j;
+
+	for (j = 0; j < jobs; j++) {
+		struct batch_rec rec;
+		off_t pos = 0;
+
+		while (pread(w[j].recfd, &rec, sizeof(rec), pos) == sizeof(rec)) {
+			pos += sizeof(rec);
+			rec.worker = j;
+
+			/* the final record of a line replaces its start */
+			if (nrecs && recs[nrecs - 1].lineno == rec.lineno &&
+			    recs[nrecs - 1].err_len < 0) {
+				recs[nrecs - 1] = rec;
+				continue;
+			}
+
+			recs = realloc(recs, (nrecs + 1) * sizeof(*recs));
+			if (!recs) {
+				fprintf(stderr, "Out of memory\n");
+				return EXIT_FAILURE;
+			}
+			recs[nrecs++] = rec;
+		}
+
+		/* worker exited in the middle of its last line */
+		if (nrecs && recs[nrecs - 1].err_len < 0) {
+			struct batch_rec *last = &recs[nrecs - 1];
+
+			last->out_len = lseek(w[j].outfd, 0, SEEK_END) -
+					last->out_off;
+			last->err_len = lseek(w[j].errfd, 0, SEEK_END) -
+					last->err_off;
+		}
+	}
+
+	qsort(recs, nrecs, sizeof(*recs), batch_rec_cmp);
+
+	fflush(stdout);
+	for (i = 0; i < nrecs; i++) {
+		const struct batch_rec *rec = &recs[i];
+
+		batch_replay(w[rec->worker].outfd, rec->out_off, rec->out_len,
+			     stdout);
+		batch_replay(w[rec->worker].errfd, rec->err_off, rec->err_len,
+			     stderr);
+
+		if (rec->failed) {
+			fprintf(stderr, "Command failed %s:%d\n",
+				name, rec->lineno);
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	free(recs);
+	return ret;
+}
+
+int do_batch_jobs(const char *name, bool force, unsigned int jobs,
+		  const char *key, int (*init)(void *data),
+		  int (*cmd)(int argc, char *argv[], void *data), void *data)
+{
+	struct batch_worker *w;
+	char *line = NULL;
+	size_t len = 0;
+	int ret = EXIT_SUCCESS;
+	unsigned int i, j;
+
+	if (name && strcmp(name, "-") != 0) {
+		if (freopen(name, "r", stdin) == NULL) {
+			fprintf(stderr,
+				"Cannot open file \"%s\" for reading: %s\n",
+				name, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	batch_stop = mmap(NULL, sizeof(*batch_stop), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (batch_stop == MAP_FAILED) {
+		perror("Cannot create batch workers");
+		return EXIT_FAILURE;
+	}
+
+	w = calloc(jobs, sizeof(*w));
+	if (!w) {
+		fprintf(stderr, "Out of memory\n");
+		munmap(batch_stop, sizeof(*batch_stop));
+		return EXIT_FAILURE;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < jobs; i++) {
+		FILE *outf = tmpfile(), *errf = tmpfile(), *recf = tmpfile();
+		int p[2];
+
+		if (!outf || !errf || !recf || pipe(p) < 0) {
+			perror("Cannot create batch worker");
+			ret = EXIT_FAILURE;
+			break;
+		}
+		w[i].outfd = dup(fileno(outf));
+		w[i].errfd = dup(fileno(errf));
+		w[i].recfd = dup(fileno(recf));
+		fclose(outf);
+		fclose(errf);
+		fclose(recf);
+
+		w[i].pid = fork();
+		if (w[i].pid < 0) {
+			perror("fork");
+			close(p[0]);
+			close(p[1]);
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		if (w[i].pid == 0) {
+			FILE *in;
+			int fd;
+
+			/* only our own pipe may stay open, or the other
+			 * workers would never see the end of their input
+			 */
+			for (j = 0; j < i; j++)
+				close(fileno(w[j].in));
+			close(p[1]);
+
+			/* the parent keeps reading the shared stdin offset */
+			fd = open("/dev/null", O_RDONLY);
+			if (fd >= 0)
+				dup2(fd, STDIN_FILENO);
+			dup2(w[i].outfd, STDOUT_FILENO);
+			dup2(w[i].errfd, STDERR_FILENO);
+
+			in = fdopen(p[0], "r");
+			if (!in || (init && init(data)))
+				_exit(EXIT_FAILURE);
+
+			ret = batch_worker_run(in, w[i].recfd, force, cmd, data);
+			fflush(stdout);
+			fflush(stderr);
+			_exit(ret);
+		}
+
+		close(p[0]);
+		w[i].in = fdopen(p[1], "w");
+	}
+	jobs = i;
+
+	/* a worker which stopped on an error no longer reads its pipe */
+	signal(SIGPIPE, SIG_IGN);
+
+	cmdlineno = 0;
+	while (ret == EXIT_SUCCESS && getcmdline(&line, &len, stdin) != -1) {
+		size_t n = strcspn(line, "\n");
+
+		if (batch_stopped(cmdlineno))
+			break;
+
+		line[n] = '\0';
+		i = batch_key_hash(line, key) % jobs;
+		fprintf(w[i].in, "%d %s\n", cmdlineno, line);
+	}
+	free(line);
+
+	for (i = 0; i < jobs; i++) {
+		int status;
+
+		if (w[i].in)
+			fclose(w[i].in);
+		if (waitpid(w[i].pid, &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = EXIT_FAILURE;
+	}
+
+	if (batch_workers_report(name, w, jobs))
+		ret = EXIT_FAILURE;
+
+	for (i = 0; i < jobs; i++) {
+		close(w[i].outfd);
+		close(w[i].errfd);
+		close(w[i].recfd);
+	}
+	free(w);
+	munmap(batch_stop, sizeof(*batch_stop));
 
 	return ret;
 }
@@ -2108,8 +2850,15 @@ void print_num(FILE *fp, unsigned int width, uint64_t count)
 
 int open_fds_add(int fd)
 {
-	if (open_fds_cnt >= ARRAY_SIZE(open_fds))
-		return -1;
+	if (open_fds_cnt >= open_fds_size) {
+		int size = open_fds_size ? 2 * open_fds_size : 8;
+		int *fds = realloc(open_fds, size * sizeof(*fds));
+
+		if (!fds)
+			return -1;
+		open_fds = fds;
+		open_fds_size = size;
+	}
 
 	open_fds[open_fds_cnt++] = fd;
 	return 0;
@@ -2119,6 +2868,10 @@ void open_fds_close(void)
 {
 	int i;
 
+	/* queued requests may still refer to them */
+	if (open_fds_cnt)
+		rtnl_async_sync();
+
 	for (i = 0; i < open_fds_cnt; i++)
 		close(open_fds[i]);
 
@@ -12,7 +12,6 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <netdb.h>
-#include <db_185.h>
 #include <sys/ioctl.h>
 #include <poll.h>
 #include <errno.h>
@@ -20,6 +19,7 @@
 #include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <time.h>
 #include <signal.h>
@@ -35,19 +35,57 @@
 #include "utils.h"
 #include "rt_names.h"
 
-DB	*dbase;
-char const	default_dbname[] = ARPDDIR "/arpd.db";
-char const	*dbname = default_dbname;
-
 int	ifnum;
 int	*ifvec;
 char	**ifnames;
 
+/* The neighbour cache is kept in memory, in an open addressing hash
+ * table.  The database file is only a log of the changes made to it:
+ * records are batched in log_buf and appended when it fills up or on
+ * sync, and the log is rewritten with just the live entries at startup
+ * or when it has grown well beyond the table.
+ */
+#define DB_ADDR_LEN	32
+#define DB_LOG_BATCH	128
+#define DB_MIN_SIZE	1024
+#define DB_MAGIC	"arpdlog1"
+
 struct dbkey {
 	__u32	iface;
 	__u32	addr;
 };
 
+struct dbent {
+	struct dbkey	key;
+	__u8		used;
+	__u8		size;
+	__u8		data[DB_ADDR_LEN];
+};
+
+enum {
+	DBREC_PUT = 1,
+	DBREC_DEL,
+};
+
+struct dbrec {
+	struct dbkey	key;
+	__u8		op;
+	__u8		size;
+	__u8		data[DB_ADDR_LEN];
+	__u8		pad[2];
+};
+
+struct dbent	*dbtab;
+unsigned int	db_size;
+unsigned int	db_count;
+int		db_fd = -1;
+struct dbrec	log_buf[DB_LOG_BATCH];
+unsigned int	log_len;
+unsigned long	log_recs;	/* records in the file */
+
+char const	default_dbname[] = ARPDDIR "/arpd.db";
+char const	*dbname = default_dbname;
+
 #define IS_NEG(x)	(((__u8 *)(x))[0] == 0xFF)
 #define NEG_TIME(x)	(((x)[2]<<24)|((x)[3]<<16)|((x)[4]<<8)|(x)[5])
 #define NEG_AGE(x)	((__u32)time(NULL) - NEG_TIME((__u8 *)x))
@@ -81,6 +119,26 @@ struct {
 	unsigned long probes_suppressed;
 } stats;
 
+/* Sockets are drained ARPD_BATCH messages at a time, for at most
+ * ARPD_ROUNDS rounds per wake-up, and the replies to the kernel and
+ * the probes are queued and sent together once the wake-up is done.
+ */
+#define ARPD_BATCH	32
+#define ARPD_ROUNDS	8
+#define NL_REPLY_SPACE	NLMSG_SPACE(sizeof(struct ndmsg) + 64)
+
+char	nl_out[ARPD_BATCH * NL_REPLY_SPACE];
+int	nl_out_len;
+
+struct probe {
+	struct sockaddr_ll	sll;
+	int			len;
+	unsigned char		buf[64];
+};
+
+struct probe	probes[ARPD_BATCH];
+int		nprobes;
+
 int active_probing;
 int negative_timeout = 60;
 int no_kernel_broadcasts;
@@ -173,6 +231,31 @@ static void undo_sysctl_adjustments(void)
 }
 
 
+static void flush_probes(void)
+{
+	struct mmsghdr msgs[ARPD_BATCH] = {};
+	struct iovec iov[ARPD_BATCH];
+	int i, n;
+
+	for (i = 0; i < nprobes; i++) {
+		iov[i].iov_base = probes[i].buf;
+		iov[i].iov_len = probes[i].len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &probes[i].sll;
+		msgs[i].msg_hdr.msg_namelen = sizeof(probes[i].sll);
+	}
+
+	for (i = 0; i < nprobes; i += n) {
+		n = sendmmsg(pset[0].fd, msgs + i, nprobes - i, 0);
+		if (n <= 0)
+			break;
+	}
+	stats.probes_sent += i;
+	stats.probes_suppressed += nprobes - i;
+	nprobes = 0;
+}
+
 static int send_probe(int ifindex, __u32 addr)
 {
 	struct ifreq ifr = { .ifr_ifindex = ifindex };
@@ -182,9 +265,9 @@ static int send_probe(int ifindex, __u32 addr)
 		.sin_addr.s_addr = addr,
 	};
 	socklen_t len;
-	unsigned char buf[256];
-	struct arphdr *ah = (struct arphdr *)buf;
-	unsigned char *p = (unsigned char *)(ah+1);
+	struct probe *pr;
+	struct arphdr *ah;
+	unsigned char *p;
 	struct sockaddr_ll sll = {
 		.sll_family = AF_PACKET,
 		.sll_ifindex = ifindex,
@@ -206,6 +289,12 @@ static int send_probe(int ifindex, __u32 addr)
 	if (getsockname(udp_sock, (struct sockaddr *)&dst, &len) < 0)
 		return -1;
 
+	if (nprobes == ARPD_BATCH)
+		flush_probes();
+	pr = &probes[nprobes];
+	ah = (struct arphdr *)pr->buf;
+	p = (unsigned char *)(ah+1);
+
 	ah->ar_hrd = htons(ifr.ifr_hwaddr.sa_family);
 	ah->ar_pro = htons(ETH_P_IP);
 	ah->ar_hln = 6;
@@ -225,9 +314,10 @@ static int send_probe(int ifindex, __u32 addr)
 	memcpy(p, &addr, 4);
 	p += 4;
 
-	if (sendto(pset[0].fd, buf, p-buf, 0, (struct sockaddr *)&sll, sizeof(sll)) < 0)
-		return -1;
-	stats.probes_sent++;
+	/* sent, and accounted for, by flush_probes() */
+	pr->sll = sll;
+	pr->len = p - pr->buf;
+	nprobes++;
 	return 0;
 }
 
@@ -258,12 +348,19 @@ static int queue_active_probe(int ifindex, __u32 addr)
 	return -1;
 }
 
+static void flush_replies(void)
+{
+	if (nl_out_len && rtnl_send(&rth, nl_out, nl_out_len) < 0)
+		syslog(LOG_ERR, "rtnl_send: %m");
+	nl_out_len = 0;
+}
+
 static int respond_to_kernel(int ifindex, __u32 addr, char *lla, int llalen)
 {
 	struct {
 		struct nlmsghdr	n;
 		struct ndmsg		ndm;
-		char			buf[256];
+		char			buf[64];
 	} req = {
 		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg)),
 		.n.nlmsg_flags = NLM_F_REQUEST,
@@ -274,9 +371,290 @@ static int respond_to_kernel(int ifindex, __u32 addr, char *lla, int llalen)
 		.ndm.ndm_type = RTN_UNICAST,
 	};
 
-	addattr_l(&req.n, sizeof(req), NDA_DST, &addr, 4);
-	addattr_l(&req.n, sizeof(req), NDA_LLADDR, lla, llalen);
-	return rtnl_send(&rth, &req, req.n.nlmsg_len) <= 0;
+	if (addattr_l(&req.n, sizeof(req), NDA_DST, &addr, 4) ||
+	    addattr_l(&req.n, sizeof(req), NDA_LLADDR, lla, llalen))
+		return -1;
+
+	if (nl_out_len + NLMSG_ALIGN(req.n.nlmsg_len) > sizeof(nl_out))
+		flush_replies();
+	memcpy(nl_out + nl_out_len, &req, req.n.nlmsg_len);
+	nl_out_len += NLMSG_ALIGN(req.n.nlmsg_len);
+	return 0;
+}
+
+static unsigned int db_hash(const struct dbkey *key, unsigned int size)
+{
+	__u32 h = key->addr ^ (key->iface * 0x9e3779b1);
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return h & (size - 1);
+}
+
+/* Slot holding the key, or the empty slot where it would go. */
+static unsigned int db_slot(const struct dbkey *key)
+{
+	unsigned int i = db_hash(key, db_size);
+
+	while (dbtab[i].used &&
+	       (dbtab[i].key.iface != key->iface ||
+		dbtab[i].key.addr != key->addr))
+		i = (i + 1) & (db_size - 1);
+	return i;
+}
+
+static struct dbent *db_get(const struct dbkey *key)
+{
+	struct dbent *e = &dbtab[db_slot(key)];
+
+	return e->used ? e : NULL;
+}
+
+static int db_grow(void)
+{
+	struct dbent *old = dbtab;
+	unsigned int i, old_size = db_size;
+
+	db_size = old_size ? 2 * old_size : DB_MIN_SIZE;
+	dbtab = calloc(db_size, sizeof(*dbtab));
+	if (!dbtab) {
+		dbtab = old;
+		db_size = old_size;
+		return -1;
+	}
+	for (i = 0; i < old_size; i++)
+		if (old[i].used)
+			dbtab[db_slot(&old[i].key)] = old[i];
+	free(old);
+	return 0;
+}
+
+static int db_store(const struct dbkey *key, const void *data, int size)
+{
+	struct dbent *e;
+
+	if (size > DB_ADDR_LEN)
+		return -1;
+	if (2 * (db_count + 1) > db_size && db_grow() < 0)
+		return -1;
+
+	e = &dbtab[db_slot(key)];
+	if (!e->used) {
+		e->used = 1;
+		e->key = *key;
+		db_count++;
+	}
+	memmove(e->data, data, size);
+	e->size = size;
+	return 0;
+}
+
+/* Linear probing, so close the gap instead of leaving a tombstone. */
+static int db_remove(const struct dbkey *key)
+{
+	unsigned int i = db_slot(key), j, k;
+
+	if (!dbtab[i].used)
+		return -1;
+
+	for (j = (i + 1) & (db_size - 1); dbtab[j].used;
+	     j = (j + 1) & (db_size - 1)) {
+		k = db_hash(&dbtab[j].key, db_size);
+		/* move j back to i unless its home lies in (i, j] */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		dbtab[i] = dbtab[j];
+		i = j;
+	}
+	dbtab[i].used = 0;
+	db_count--;
+	return 0;
+}
+
+static int db_write(int fd, const void *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int db_flush(void)
+{
+	int err = 0;
+
+	if (log_len && db_fd >= 0) {
+		err = db_write(db_fd, log_buf, log_len * sizeof(log_buf[0]));
+		log_recs += log_len;
+	}
+	log_len = 0;
+	return err;
+}
+
+static void db_log(int op, const struct dbkey *key, const void *data, int size)
+{
+	struct dbrec *r = &log_buf[log_len];
+
+	memset(r, 0, sizeof(*r));
+	r->key = *key;
+	r->op = op;
+	r->size = size;
+	memcpy(r->data, data, size);
+	if (++log_len == DB_LOG_BATCH && db_flush() < 0)
+		syslog(LOG_ERR, "%s: %m", dbname);
+}
+
+static int db_put(const struct dbkey *key, const void *data, int size)
+{
+	if (db_store(key, data, size) < 0)
+		return -1;
+	db_log(DBREC_PUT, key, data, size);
+	return 0;
+}
+
+static void db_del(const struct dbkey *key)
+{
+	if (db_remove(key) == 0)
+		db_log(DBREC_DEL, key, NULL, 0);
+}
+
+/* Rewrite the log with one record per live entry. */
+static int db_compact(void)
+{
+	char tmp[PATH_MAX];
+	unsigned int i;
+	int fd;
+
+	if (db_flush() < 0)
+		return -1;
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", dbname) >= sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	if (db_write(fd, DB_MAGIC, 8) < 0)
+		goto err;
+
+	log_recs = 0;
+	for (i = 0; i < db_size; i++) {
+		struct dbent *e = &dbtab[i];
+		struct dbrec *r;
+
+		if (!e->used)
+			continue;
+		r = &log_buf[log_len++];
+		memset(r, 0, sizeof(*r));
+		r->key = e->key;
+		r->op = DBREC_PUT;
+		r->size = e->size;
+		memcpy(r->data, e->data, e->size);
+		if (log_len == DB_LOG_BATCH) {
+			if (db_write(fd, log_buf, sizeof(log_buf)) < 0)
+				goto err;
+			log_recs += log_len;
+			log_len = 0;
+		}
+	}
+	if (db_write(fd, log_buf, log_len * sizeof(log_buf[0])) < 0)
+		goto err;
+	log_recs += log_len;
+	log_len = 0;
+
+	if (fsync(fd) < 0 || rename(tmp, dbname) < 0)
+		goto err;
+	if (db_fd >= 0)
+		close(db_fd);
+	db_fd = fd;
+	return 0;
+
+err:
+	log_len = 0;
+	close(fd);
+	unlink(tmp);
+	return -1;
+}
+
+static void db_sync(void)
+{
+	if (db_flush() < 0)
+		syslog(LOG_ERR, "%s: %m", dbname);
+	/* Mostly overwritten records, start over. */
+	if (log_recs > 2 * db_count + DB_MIN_SIZE && db_compact() < 0)
+		syslog(LOG_ERR, "compacting %s: %m", dbname);
+}
+
+/* Open the log and replay it into the table. */
+static int db_open(void)
+{
+	struct dbrec recs[DB_LOG_BATCH];
+	char magic[8];
+	off_t off = sizeof(magic);
+	ssize_t n;
+
+	if (db_grow() < 0)
+		return -1;
+
+	db_fd = open(dbname, O_RDWR|O_CREAT, 0644);
+	if (db_fd < 0)
+		return -1;
+
+	n = read(db_fd, magic, sizeof(magic));
+	if (n < 0)
+		return -1;
+	if (n != sizeof(magic) || memcmp(magic, DB_MAGIC, sizeof(magic))) {
+		if (n > 0)
+			fprintf(stderr,
+				"arpd: %s is not an arpd log, starting empty\n",
+				dbname);
+		if (ftruncate(db_fd, 0) < 0 ||
+		    pwrite(db_fd, DB_MAGIC, sizeof(magic), 0) != sizeof(magic))
+			return -1;
+	}
+
+	while ((n = pread(db_fd, recs, sizeof(recs), off)) > 0) {
+		int i, cnt = n / sizeof(recs[0]);
+
+		for (i = 0; i < cnt; i++) {
+			struct dbrec *r = &recs[i];
+
+			if (r->op == DBREC_PUT && r->size <= DB_ADDR_LEN)
+				db_store(&r->key, r->data, r->size);
+			else if (r->op == DBREC_DEL)
+				db_remove(&r->key);
+		}
+		log_recs += cnt;
+		off += cnt * sizeof(recs[0]);
+		if (n % sizeof(recs[0]))
+			break;
+	}
+	if (n < 0)
+		return -1;
+
+	/* Drop a record torn by a crash, so the next ones line up. */
+	if (ftruncate(db_fd, off) < 0 || lseek(db_fd, off, SEEK_SET) < 0)
+		return -1;
+	return 0;
+}
+
+static void db_close(void)
+{
+	if (db_flush() < 0)
+		syslog(LOG_ERR, "%s: %m", dbname);
+	if (db_fd >= 0)
+		close(db_fd);
+	db_fd = -1;
 }
 
 static void prepare_neg_entry(__u8 *ndata, __u32 stamp)
@@ -296,11 +674,11 @@ static int do_one_request(struct nlmsghdr *n)
 	int len = n->nlmsg_len;
 	struct rtattr *tb[NDA_MAX+1];
 	struct dbkey key;
-	DBT dbkey, dbdat;
+	struct dbent *ent;
 	int do_acct = 0;
 
 	if (n->nlmsg_type == NLMSG_DONE) {
-		dbase->sync(dbase, 0);
+		db_sync();
 
 		/* Now we have at least mirror of kernel db, so that
 		 * may start real resolution.
@@ -330,13 +708,7 @@ static int do_one_request(struct nlmsghdr *n)
 
 	key.iface = ndm->ndm_ifindex;
 	memcpy(&key.addr, RTA_DATA(tb[NDA_DST]), 4);
-	dbkey.data = &key;
-	dbkey.size = sizeof(key);
-
-	if (dbase->get(dbase, &dbkey, &dbdat, 0) != 0) {
-		dbdat.data = 0;
-		dbdat.size = 0;
-	}
+	ent = db_get(&key);
 
 	if (n->nlmsg_type == RTM_GETNEIGH) {
 		if (!(n->nlmsg_flags&NLM_F_REQUEST))
@@ -354,24 +726,25 @@ static int do_one_request(struct nlmsghdr *n)
 			 * Kernel is going to initiate broadcast resolution.
 			 * OK, we invalidate our information as well.
 			 */
-			if (dbdat.data && !IS_NEG(dbdat.data))
+			if (ent && !IS_NEG(ent->data))
 				stats.app_neg++;
 
-			dbase->del(dbase, &dbkey, 0);
+			db_del(&key);
 		} else {
 			/* If we get this kernel does not have any information.
 			 * If we have something tell this to kernel. */
 			stats.app_recv++;
-			if (dbdat.data && !IS_NEG(dbdat.data)) {
+			if (ent && !IS_NEG(ent->data)) {
 				stats.app_success++;
-				respond_to_kernel(key.iface, key.addr, dbdat.data, dbdat.size);
+				respond_to_kernel(key.iface, key.addr,
+						  (char *)ent->data, ent->size);
 				return 0;
 			}
 
 			/* Sheeit! We have nothing to tell. */
 			/* If we have recent negative entry, be silent. */
-			if (dbdat.data && NEG_VALID(dbdat.data)) {
-				if (NEG_CNT(dbdat.data) >= active_probing) {
+			if (ent && NEG_VALID(ent->data)) {
+				if (NEG_CNT(ent->data) >= active_probing) {
 					stats.app_suppressed++;
 					return 0;
 				}
@@ -382,8 +755,8 @@ static int do_one_request(struct nlmsghdr *n)
 		if (active_probing &&
 		    queue_active_probe(ndm->ndm_ifindex, key.addr) == 0 &&
 		    do_acct) {
-			NEG_CNT(dbdat.data)++;
-			dbase->put(dbase, &dbkey, &dbdat, 0);
+			NEG_CNT(ent->data)++;
+			db_put(&key, ent->data, ent->size);
 		}
 	} else if (n->nlmsg_type == RTM_NEWNEIGH) {
 		if (n->nlmsg_flags&NLM_F_REQUEST)
@@ -393,28 +766,25 @@ static int do_one_request(struct nlmsghdr *n)
 			/* Kernel was not able to resolve. Host is dead.
 			 * Create negative entry if it is not present
 			 * or renew it if it is too old. */
-			if (!dbdat.data ||
-			    !IS_NEG(dbdat.data) ||
-			    !NEG_VALID(dbdat.data)) {
+			if (!ent ||
+			    !IS_NEG(ent->data) ||
+			    !NEG_VALID(ent->data)) {
 				__u8 ndata[6];
 
 				stats.kern_neg++;
 				prepare_neg_entry(ndata, time(NULL));
-				dbdat.data = ndata;
-				dbdat.size = sizeof(ndata);
-				dbase->put(dbase, &dbkey, &dbdat, 0);
+				db_put(&key, ndata, sizeof(ndata));
 			}
 		} else if (tb[NDA_LLADDR]) {
-			if (dbdat.data && !IS_NEG(dbdat.data)) {
-				if (memcmp(RTA_DATA(tb[NDA_LLADDR]), dbdat.data, dbdat.size) == 0)
+			if (ent && !IS_NEG(ent->data)) {
+				if (memcmp(RTA_DATA(tb[NDA_LLADDR]), ent->data, ent->size) == 0)
 					return 0;
 				stats.kern_change++;
 			} else {
 				stats.kern_new++;
 			}
-			dbdat.data = RTA_DATA(tb[NDA_LLADDR]);
-			dbdat.size = RTA_PAYLOAD(tb[NDA_LLADDR]);
-			dbase->put(dbase, &dbkey, &dbdat, 0);
+			db_put(&key, RTA_DATA(tb[NDA_LLADDR]),
+			       RTA_PAYLOAD(tb[NDA_LLADDR]));
 		}
 	}
 	return 0;
@@ -422,6 +792,12 @@ static int do_one_request(struct nlmsghdr *n)
 
 static void load_initial_table(void)
 {
+	/* The log was replayed by db_open(), keep only what is live. */
+	if (db_compact() < 0) {
+		perror("compacting database");
+		exit(1);
+	}
+
 	if (rtnl_neighdump_req(&rth, AF_INET, NULL) < 0) {
 		perror("dump request failed");
 		exit(1);
@@ -429,33 +805,9 @@ static void load_initial_table(void)
 
 }
 
-static void get_kern_msg(void)
+static void handle_kern_msg(char *buf, int status)
 {
-	int status;
 	struct nlmsghdr *h;
-	struct sockaddr_nl nladdr = {};
-	struct iovec iov;
-	char   buf[8192];
-	struct msghdr msg = {
-		.msg_name = &nladdr,
-		.msg_namelen = sizeof(nladdr),
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
-	};
-
-	iov.iov_base = buf;
-	iov.iov_len = sizeof(buf);
-
-	status = recvmsg(rth.fd, &msg, MSG_DONTWAIT);
-
-	if (status <= 0)
-		return;
-
-	if (msg.msg_namelen != sizeof(nladdr))
-		return;
-
-	if (nladdr.nl_pid)
-		return;
 
 	for (h = (struct nlmsghdr *)buf; status >= sizeof(*h); ) {
 		int len = h->nlmsg_len;
@@ -472,26 +824,50 @@ static void get_kern_msg(void)
 	}
 }
 
+static void get_kern_msg(void)
+{
+	static char bufs[ARPD_BATCH][8192];
+	struct sockaddr_nl nladdr[ARPD_BATCH];
+	struct iovec iov[ARPD_BATCH];
+	struct mmsghdr msgs[ARPD_BATCH];
+	int i, n, round;
+
+	for (round = 0; round < ARPD_ROUNDS; round++) {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < ARPD_BATCH; i++) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = sizeof(bufs[i]);
+			msgs[i].msg_hdr.msg_name = &nladdr[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(nladdr[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = recvmmsg(rth.fd, msgs, ARPD_BATCH, MSG_DONTWAIT, NULL);
+		if (n <= 0)
+			return;
+
+		for (i = 0; i < n; i++) {
+			if (msgs[i].msg_hdr.msg_namelen != sizeof(nladdr[i]))
+				continue;
+			if (nladdr[i].nl_pid)
+				continue;
+			handle_kern_msg(bufs[i], msgs[i].msg_len);
+		}
+
+		if (n < ARPD_BATCH)
+			return;
+	}
+}
+
 /* Receive gratuitous ARP messages and store them, that's all. */
-static void get_arp_pkt(void)
+static void handle_arp_pkt(unsigned char *buf, int n, struct sockaddr_ll *sll)
 {
-	unsigned char buf[1024];
-	struct sockaddr_ll sll;
-	socklen_t sll_len = sizeof(sll);
 	struct arphdr *a = (struct arphdr *)buf;
 	struct dbkey key;
-	DBT dbkey, dbdat;
-	int n;
-
-	n = recvfrom(pset[0].fd, buf, sizeof(buf), MSG_DONTWAIT,
-		     (struct sockaddr *)&sll, &sll_len);
-	if (n < 0) {
-		if (errno != EINTR && errno != EAGAIN)
-			syslog(LOG_ERR, "recvfrom: %m");
-		return;
-	}
+	struct dbent *ent;
 
-	if (ifnum && !handle_if(sll.sll_ifindex))
+	if (ifnum && !handle_if(sll->sll_ifindex))
 		return;
 
 	/* Validate packet */
@@ -500,31 +876,61 @@ static void get_arp_pkt(void)
 	     a->ar_op != htons(ARPOP_REPLY)) ||
 	    a->ar_pln != 4 ||
 	    a->ar_pro != htons(ETH_P_IP) ||
-	    a->ar_hln != sll.sll_halen ||
+	    a->ar_hln != sll->sll_halen ||
 	    sizeof(*a) + 2*4 + 2*a->ar_hln > n)
 		return;
 
-	key.iface = sll.sll_ifindex;
+	key.iface = sll->sll_ifindex;
 	memcpy(&key.addr, (char *)(a+1) + a->ar_hln, 4);
 
 	/* DAD message, ignore. */
 	if (key.addr == 0)
 		return;
 
-	dbkey.data = &key;
-	dbkey.size = sizeof(key);
-
-	if (dbase->get(dbase, &dbkey, &dbdat, 0) == 0 && !IS_NEG(dbdat.data)) {
-		if (memcmp(dbdat.data, a+1, dbdat.size) == 0)
+	ent = db_get(&key);
+	if (ent && !IS_NEG(ent->data)) {
+		if (memcmp(ent->data, a+1, ent->size) == 0)
 			return;
 		stats.arp_change++;
 	} else {
 		stats.arp_new++;
 	}
 
-	dbdat.data = a+1;
-	dbdat.size = a->ar_hln;
-	dbase->put(dbase, &dbkey, &dbdat, 0);
+	db_put(&key, a+1, a->ar_hln);
+}
+
+static void get_arp_pkt(void)
+{
+	static unsigned char bufs[ARPD_BATCH][1024];
+	struct sockaddr_ll sll[ARPD_BATCH];
+	struct iovec iov[ARPD_BATCH];
+	struct mmsghdr msgs[ARPD_BATCH];
+	int i, n, round;
+
+	for (round = 0; round < ARPD_ROUNDS; round++) {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < ARPD_BATCH; i++) {
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len = sizeof(bufs[i]);
+			msgs[i].msg_hdr.msg_name = &sll[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(sll[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = recvmmsg(pset[0].fd, msgs, ARPD_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno != EINTR && errno != EAGAIN)
+				syslog(LOG_ERR, "recvmmsg: %m");
+			return;
+		}
+
+		for (i = 0; i < n; i++)
+			handle_arp_pkt(bufs[i], msgs[i].msg_len, &sll[i]);
+
+		if (n < ARPD_BATCH)
+			return;
+	}
 }
 
 static void catch_signal(int sig, void (*handler)(int))
@@ -676,8 +1082,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	dbase = dbopen(dbname, O_CREAT|O_RDWR, 0644, DB_HASH, NULL);
-	if (dbase == NULL) {
+	if (db_open() < 0) {
 		perror("db_open");
 		exit(-1);
 	}
@@ -686,10 +1091,6 @@ int main(int argc, char **argv)
 		char buf[128];
 		FILE *fp;
 		struct dbkey k;
-		DBT dbkey, dbdat;
-
-		dbkey.data = &k;
-		dbkey.size = sizeof(k);
 
 		if (strcmp(do_load, "-") == 0 || strcmp(do_load, "--") == 0) {
 			fp = stdin;
@@ -720,38 +1121,39 @@ int main(int argc, char **argv)
 
 			if (ll_addr_a2n((char *) b1, 6, macbuf) != 6)
 				goto do_abort;
-			dbdat.size = 6;
 
-			if (dbase->put(dbase, &dbkey, &dbdat, 0)) {
+			if (db_put(&k, b1, 6)) {
 				perror("hash->put");
 				goto do_abort;
 			}
 		}
-		dbase->sync(dbase, 0);
+		db_sync();
 		if (fp != stdin)
 			fclose(fp);
 	}
 
 	if (do_list) {
-		DBT dbkey, dbdat;
+		unsigned int i;
 
 		printf("%-8s %-15s %s\n", "#Ifindex", "IP", "MAC");
-		while (dbase->seq(dbase, &dbkey, &dbdat, R_NEXT) == 0) {
-			struct dbkey *key = dbkey.data;
+		for (i = 0; i < db_size; i++) {
+			struct dbkey *key = &dbtab[i].key;
 
+			if (!dbtab[i].used)
+				continue;
 			if (handle_if(key->iface)) {
-				if (!IS_NEG(dbdat.data)) {
+				if (!IS_NEG(dbtab[i].data)) {
 					char b1[18];
 
 					printf("%-8d %-15s %s\n",
 					       key->iface,
 					       inet_ntoa(*(struct in_addr *)&key->addr),
-					       ll_addr_n2a(dbdat.data, 6, ARPHRD_ETHER, b1, 18));
+					       ll_addr_n2a(dbtab[i].data, 6, ARPHRD_ETHER, b1, 18));
 				} else {
 					printf("%-8d %-15s FAILED: %dsec ago\n",
 					       key->iface,
 					       inet_ntoa(*(struct in_addr *)&key->addr),
-					       NEG_AGE(dbdat.data));
+					       NEG_AGE(dbtab[i].data));
 				}
 			}
 		}
@@ -813,7 +1215,7 @@ int main(int argc, char **argv)
 			break;
 		if (do_sync) {
 			in_poll = 0;
-			dbase->sync(dbase, 0);
+			db_sync();
 			do_sync = 0;
 			in_poll = 1;
 		}
@@ -825,6 +1227,8 @@ int main(int argc, char **argv)
 				get_arp_pkt();
 			if (pset[1].revents&EVENTS)
 				get_kern_msg();
+			flush_replies();
+			flush_probes();
 		} else {
 			do_sync = 1;
 		}
@@ -832,10 +1236,10 @@ int main(int argc, char **argv)
 
 	undo_sysctl_adjustments();
 out:
-	dbase->close(dbase);
+	db_close();
 	exit(0);
 
 do_abort:
-	dbase->close(dbase);
+	db_close();
 	exit(-1);
 }
@@ -26,11 +26,16 @@
 
 #include <linux/if.h>
 #include <linux/if_link.h>
+#include <linux/if_bonding.h>
+#include <linux/if_bridge.h>
+#include <linux/mpls.h>
 
 #include "libnetlink.h"
 #include "json_print.h"
 #include "version.h"
 #include "utils.h"
+#include "stat_shm.h"
+#include "stat_hist.h"
 
 int dump_zeros;
 int reset_history;
@@ -38,6 +43,7 @@ int ignore_history;
 int no_output;
 int json_output;
 int no_update;
+int publish_shm;
 int scan_interval;
 int time_constant;
 int show_errors;
@@ -45,25 +51,24 @@ double W;
 char **patterns;
 int npatterns;
 bool is_extended;
-int filter_type;
-int sub_type;
 
 char info_source[128];
 int source_mismatch;
 
 #define MAXS (sizeof(struct rtnl_link_stats64)/sizeof(__u64))
-#define NO_SUB_TYPE 0xffff
+#define MAXCOLS 32	/* of any statistics group, see xstats_opts */
 
 struct ifstat_ent {
 	struct ifstat_ent	*next;
 	char			*name;
 	int			ifindex;
-	unsigned long long	val[MAXS];
-	double			rate[MAXS];
-	__u64			ival[MAXS];
+	unsigned int		gen;
+	unsigned long long	val[MAXCOLS];
+	double			rate[MAXCOLS];
+	__u64			ival[MAXCOLS];
 };
 
-static const char *stats[MAXS] = {
+static const char * const stats[MAXS] = {
 	"rx_packets",
 	"tx_packets",
 	"rx_bytes",
@@ -95,9 +100,171 @@ static const char *stats[MAXS] = {
 	"rx_otherhost_dropped",
 };
 
+/*
+ * An extended statistics group is a block of u64 counters in the
+ * RTM_NEWSTATS message: below the IFLA_STATS_* attribute of the dump
+ * filter, at the end of a path of nested attributes. The counters are
+ * either a struct of u64, the columns being its members, or a nest of
+ * u64 attributes, the columns being indexed by attribute type. Groups
+ * laid out like rtnl_link_stats64 are shown like the link statistics,
+ * the others one counter per line.
+ */
+struct xstats_opt {
+	const char		*name;
+	int			group;
+	int			path[2];
+	int			depth;
+	bool			nested;
+	bool			link;
+	const char * const	*cols;
+	unsigned int		ncols;
+	const char		*help;
+};
+
+static const char * const bond_3ad_cols[] = {
+	[BOND_3AD_STAT_LACPDU_RX]		= "lacpdu_rx",
+	[BOND_3AD_STAT_LACPDU_TX]		= "lacpdu_tx",
+	[BOND_3AD_STAT_LACPDU_UNKNOWN_RX]	= "lacpdu_unknown_rx",
+	[BOND_3AD_STAT_LACPDU_ILLEGAL_RX]	= "lacpdu_illegal_rx",
+	[BOND_3AD_STAT_MARKER_RX]		= "marker_rx",
+	[BOND_3AD_STAT_MARKER_TX]		= "marker_tx",
+	[BOND_3AD_STAT_MARKER_RESP_RX]		= "marker_resp_rx",
+	[BOND_3AD_STAT_MARKER_RESP_TX]		= "marker_resp_tx",
+	[BOND_3AD_STAT_MARKER_UNKNOWN_RX]	= "marker_unknown_rx",
+};
+
+/* struct br_mcast_stats */
+static const char * const br_mcast_cols[] = {
+	"igmp_v1queries_rx", "igmp_v1queries_tx",
+	"igmp_v2queries_rx", "igmp_v2queries_tx",
+	"igmp_v3queries_rx", "igmp_v3queries_tx",
+	"igmp_leaves_rx", "igmp_leaves_tx",
+	"igmp_v1reports_rx", "igmp_v1reports_tx",
+	"igmp_v2reports_rx", "igmp_v2reports_tx",
+	"igmp_v3reports_rx", "igmp_v3reports_tx",
+	"igmp_parse_errors",
+	"mld_v1queries_rx", "mld_v1queries_tx",
+	"mld_v2queries_rx", "mld_v2queries_tx",
+	"mld_leaves_rx", "mld_leaves_tx",
+	"mld_v1reports_rx", "mld_v1reports_tx",
+	"mld_v2reports_rx", "mld_v2reports_tx",
+	"mld_parse_errors",
+	"mcast_bytes_rx", "mcast_bytes_tx",
+	"mcast_packets_rx", "mcast_packets_tx",
+};
+
+/* struct bridge_stp_xstats */
+static const char * const br_stp_cols[] = {
+	"transition_blk", "transition_fwd",
+	"rx_bpdu", "tx_bpdu",
+	"rx_tcn", "tx_tcn",
+};
+
+/* struct mpls_link_stats */
+static const char * const mpls_cols[] = {
+	"rx_packets", "tx_packets",
+	"rx_bytes", "tx_bytes",
+	"rx_errors", "tx_errors",
+	"rx_dropped", "tx_dropped",
+	"rx_noroute",
+};
+
+/* Note: if one xstat name is subset of another, it should be before it in this
+ * list.
+ * Name length must be under 64 chars.
+ */
+static const struct xstats_opt xstats_opts[] = {
+	{
+		.name = "cpu_hits",
+		.group = IFLA_STATS_LINK_OFFLOAD_XSTATS,
+		.path = { IFLA_OFFLOAD_XSTATS_CPU_HIT }, .depth = 1,
+		.link = true, .cols = stats, .ncols = MAXS,
+		.help = "Counts only packets that went via the CPU.",
+	},
+	{
+		.name = "l3_stats",
+		.group = IFLA_STATS_LINK_OFFLOAD_XSTATS,
+		.path = { IFLA_OFFLOAD_XSTATS_L3_STATS }, .depth = 1,
+		/* rtnl_hw_stats64 is the head of rtnl_link_stats64 */
+		.cols = stats,
+		.ncols = sizeof(struct rtnl_hw_stats64) / sizeof(__u64),
+		.help = "Offloaded L3 traffic, see ip stats set l3_stats.",
+	},
+	{
+		.name = "bond",
+		.group = IFLA_STATS_LINK_XSTATS,
+		.path = { LINK_XSTATS_TYPE_BOND, BOND_XSTATS_3AD }, .depth = 2,
+		.nested = true,
+		.cols = bond_3ad_cols, .ncols = ARRAY_SIZE(bond_3ad_cols),
+		.help = "802.3ad LACPDU and marker counters of bonds.",
+	},
+	{
+		.name = "bond_slave",
+		.group = IFLA_STATS_LINK_XSTATS_SLAVE,
+		.path = { LINK_XSTATS_TYPE_BOND, BOND_XSTATS_3AD }, .depth = 2,
+		.nested = true,
+		.cols = bond_3ad_cols, .ncols = ARRAY_SIZE(bond_3ad_cols),
+		.help = "802.3ad counters of bond ports.",
+	},
+	{
+		.name = "bridge_mcast",
+		.group = IFLA_STATS_LINK_XSTATS,
+		.path = { LINK_XSTATS_TYPE_BRIDGE, BRIDGE_XSTATS_MCAST },
+		.depth = 2,
+		.cols = br_mcast_cols, .ncols = ARRAY_SIZE(br_mcast_cols),
+		.help = "IGMP/MLD counters of bridges (mcast_stats_enabled).",
+	},
+	{
+		.name = "bridge_slave_mcast",
+		.group = IFLA_STATS_LINK_XSTATS_SLAVE,
+		.path = { LINK_XSTATS_TYPE_BRIDGE, BRIDGE_XSTATS_MCAST },
+		.depth = 2,
+		.cols = br_mcast_cols, .ncols = ARRAY_SIZE(br_mcast_cols),
+		.help = "IGMP/MLD counters of bridge ports.",
+	},
+	{
+		.name = "bridge_slave_stp",
+		.group = IFLA_STATS_LINK_XSTATS_SLAVE,
+		.path = { LINK_XSTATS_TYPE_BRIDGE, BRIDGE_XSTATS_STP },
+		.depth = 2,
+		.cols = br_stp_cols, .ncols = ARRAY_SIZE(br_stp_cols),
+		.help = "STP transitions and BPDUs of bridge ports.",
+	},
+	{
+		.name = "mpls",
+		.group = IFLA_STATS_AF_SPEC,
+		.path = { AF_MPLS, MPLS_STATS_LINK }, .depth = 2,
+		.cols = mpls_cols, .ncols = ARRAY_SIZE(mpls_cols),
+		.help = "MPLS counters of interfaces with MPLS input enabled.",
+	},
+};
+
+/* --sample without -x */
+static const struct xstats_opt link64_opt = {
+	.name = "link64",
+	.group = IFLA_STATS_LINK_64,
+	.link = true, .cols = stats, .ncols = MAXS,
+};
+
+/* The statistics group in use and its columns, the link statistics by default */
+static const struct xstats_opt *xstat;
+static const char * const *cols = stats;
+static unsigned int ncols = MAXS;
+
 struct ifstat_ent *kern_db;
 struct ifstat_ent *hist_db;
 
+/*
+ * Dumps of the kernel update the entries in place: an interface keeps
+ * its slot in ent_by_index from one scan to the next, so only new ones
+ * are allocated. load_interval is the time since the last scan, 0 when
+ * the entries only take the first values.
+ */
+static struct ifstat_ent **ent_by_index;
+static unsigned int ent_by_index_size;
+static unsigned int load_gen;
+static int load_interval;
+
 static int match(const char *id)
 {
 	int i;
@@ -112,12 +279,152 @@ static int match(const char *id)
 	return 0;
 }
 
+/* The columns of the statistics group in use, zero when not reported */
+static bool xstats_get(struct rtattr **tb, __u64 *vals)
+{
+	struct rtattr *attr = tb[xstat->group];
+	size_t len;
+	int i;
+
+	for (i = 0; attr && i < xstat->depth; i++)
+		attr = parse_rtattr_one_nested(xstat->path[i], attr);
+	if (!attr)
+		return false;
+
+	memset(vals, 0, ncols * sizeof(*vals));
+	if (xstat->nested) {
+		int rem = RTA_PAYLOAD(attr);
+		struct rtattr *a;
+
+		for (a = RTA_DATA(attr); RTA_OK(a, rem); a = RTA_NEXT(a, rem)) {
+			unsigned short type = a->rta_type & NLA_TYPE_MASK;
+
+			if (type < ncols && cols[type] &&
+			    RTA_PAYLOAD(a) >= sizeof(__u64))
+				vals[type] = rta_getattr_u64(a);
+		}
+	} else {
+		len = RTA_PAYLOAD(attr);
+		if (len > ncols * sizeof(*vals))
+			len = ncols * sizeof(*vals);
+		memcpy(vals, RTA_DATA(attr), len);
+	}
+	return true;
+}
+
+static struct ifstat_ent **ifstat_slot(int ifindex)
+{
+	if (ifindex >= ent_by_index_size) {
+		unsigned int size = ent_by_index_size ? : 64;
+		struct ifstat_ent **db;
+
+		while (size <= ifindex)
+			size *= 2;
+		db = realloc(ent_by_index, size * sizeof(*db));
+		if (!db)
+			return NULL;
+		memset(db + ent_by_index_size, 0,
+		       (size - ent_by_index_size) * sizeof(*db));
+		ent_by_index = db;
+		ent_by_index_size = size;
+	}
+	return &ent_by_index[ifindex];
+}
+
+/* Take a sample of the counters of an interface: the first one sets the
+ * values, the next ones advance them and the rates.
+ */
+static int ifstat_sample(int ifindex, const char *name, const __u64 *sample)
+{
+	struct ifstat_ent **slot, *n;
+	int interval = load_interval;
+	int i;
+
+	if (ifindex <= 0)
+		return 0;
+
+	slot = ifstat_slot(ifindex);
+	if (!slot) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	n = *slot;
+	if (n && strcmp(n->name, name)) {
+		char *s = strdup(name);
+
+		if (!s)
+			return -1;
+		free(n->name);
+		n->name = s;
+	}
+
+	if (!n) {
+		n = calloc(1, sizeof(*n));
+		if (!n) {
+			errno = ENOMEM;
+			return -1;
+		}
+		n->ifindex = ifindex;
+		n->name = strdup(name);
+		if (!n->name) {
+			free(n);
+			return -1;
+		}
+		*slot = n;
+		interval = 0;
+	}
+	n->gen = load_gen;
+
+	if (!interval) {
+		for (i = 0; i < ncols; i++)
+			n->val[i] = n->ival[i] = sample[i];
+		return 0;
+	}
+
+	if (!is_extended) {
+		for (i = 0; i < ncols; i++) {
+			if (sample[i] < n->ival[i]) {
+				memset(n->ival, 0, sizeof(n->ival));
+				break;
+			}
+		}
+	}
+	for (i = 0; i < ncols; i++) {
+		double rate;
+		__u64 incr;
+
+		if (is_extended) {
+			incr = sample[i] - n->val[i];
+			n->val[i] = sample[i];
+		} else {
+			incr = (__u32) (sample[i] - n->ival[i]);
+			n->val[i] += incr;
+			n->ival[i] = sample[i];
+		}
+
+		rate = (double)(incr*1000)/interval;
+		if (interval >= scan_interval) {
+			n->rate[i] += W*(rate-n->rate[i]);
+		} else if (interval >= 1000) {
+			if (interval >= time_constant) {
+				n->rate[i] = rate;
+			} else {
+				double w = W*(double)interval/scan_interval;
+
+				n->rate[i] += w*(rate-n->rate[i]);
+			}
+		}
+	}
+	return 0;
+}
+
 static int get_nlmsg_extended(struct nlmsghdr *m, void *arg)
 {
 	struct if_stats_msg *ifsm = NLMSG_DATA(m);
 	struct rtattr *tb[IFLA_STATS_MAX+1];
 	int len = m->nlmsg_len;
-	struct ifstat_ent *n;
+	__u64 sample[MAXCOLS];
 
 	if (m->nlmsg_type != RTM_NEWSTATS)
 		return 0;
@@ -129,39 +436,11 @@ static int get_nlmsg_extended(struct nlmsghdr *m, void *arg)
 	}
 
 	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
-	if (tb[filter_type] == NULL)
+	if (!xstats_get(tb, sample))
 		return 0;
 
-	n = malloc(sizeof(*n));
-	if (!n) {
-		errno = ENOMEM;
-		return -1;
-	}
-
-	n->ifindex = ifsm->ifindex;
-	n->name = strdup(ll_index_to_name(ifsm->ifindex));
-	if (!n->name) {
-		free(n);
-		return -1;
-	}
-
-	if (sub_type == NO_SUB_TYPE) {
-		memcpy(&n->val, RTA_DATA(tb[filter_type]), sizeof(n->val));
-	} else {
-		struct rtattr *attr;
-
-		attr = parse_rtattr_one_nested(sub_type, tb[filter_type]);
-		if (attr == NULL) {
-			free(n->name);
-			free(n);
-			return 0;
-		}
-		memcpy(&n->val, RTA_DATA(attr), sizeof(n->val));
-	}
-	memset(&n->rate, 0, sizeof(n->rate));
-	n->next = kern_db;
-	kern_db = n;
-	return 0;
+	return ifstat_sample(ifsm->ifindex, ll_index_to_name(ifsm->ifindex),
+			     sample);
 }
 
 static int get_nlmsg(struct nlmsghdr *m, void *arg)
@@ -169,7 +448,7 @@ static int get_nlmsg(struct nlmsghdr *m, void *arg)
 	struct ifinfomsg *ifi = NLMSG_DATA(m);
 	struct rtattr *tb[IFLA_MAX+1];
 	int len = m->nlmsg_len;
-	struct ifstat_ent *n;
+	__u64 sample[MAXCOLS] = {};
 	int i;
 
 	if (m->nlmsg_type != RTM_NEWLINK)
@@ -188,54 +467,42 @@ static int get_nlmsg(struct nlmsghdr *m, void *arg)
 	if (tb[IFLA_IFNAME] == NULL)
 		return 0;
 
-	n = malloc(sizeof(*n));
-	if (!n) {
-		errno = ENOMEM;
-		return -1;
-	}
-
-	n->ifindex = ifi->ifi_index;
-	n->name = strdup(RTA_DATA(tb[IFLA_IFNAME]));
-	if (!n->name) {
-		free(n);
-		return -1;
-	}
-
-	memset(&n->rate, 0, sizeof(n->rate));
-
 	if (tb[IFLA_STATS64]) {
-		memcpy(&n->ival, RTA_DATA(tb[IFLA_STATS64]), sizeof(n->ival));
+		size_t plen = RTA_PAYLOAD(tb[IFLA_STATS64]);
+
+		if (plen > MAXS * sizeof(__u64))
+			plen = MAXS * sizeof(__u64);
+		memcpy(sample, RTA_DATA(tb[IFLA_STATS64]), plen);
 	} else if (tb[IFLA_STATS]) {
 		__u32 *stats = RTA_DATA(tb[IFLA_STATS]);
+		int n = RTA_PAYLOAD(tb[IFLA_STATS]) / sizeof(__u32);
 
 		/* expand 32 bit values to 64 bit */
-		for (i = 0; i < MAXS; i++)
-			n->ival[i] = stats[i];
+		for (i = 0; i < MAXS && i < n; i++)
+			sample[i] = stats[i];
 	} else {
 		/* missing stats? */
-		free(n);
 		return 0;
 	}
 
-	for (i = 0; i < MAXS; i++)
-		n->val[i] = n->ival[i];
-	n->next = kern_db;
-	kern_db = n;
-	return 0;
+	return ifstat_sample(ifi->ifi_index, rta_getattr_str(tb[IFLA_IFNAME]),
+			     sample);
 }
 
 static void load_info(void)
 {
-	struct ifstat_ent *db, *n;
+	struct ifstat_ent *n, **tail;
 	struct rtnl_handle rth;
 	__u32 filter_mask;
+	unsigned int i;
 
 	if (rtnl_open(&rth, 0) < 0)
 		exit(1);
 
+	load_gen++;
 	if (is_extended) {
 		ll_init_map(&rth);
-		filter_mask = IFLA_STATS_FILTER_BIT(filter_type);
+		filter_mask = IFLA_STATS_FILTER_BIT(xstat->group);
 		if (rtnl_statsdump_req_filter(&rth, AF_UNSPEC,
 					      filter_mask, NULL, NULL) < 0) {
 			perror("Cannot send dump request");
@@ -260,15 +527,23 @@ static void load_info(void)
 
 	rtnl_close(&rth);
 
-	db = kern_db;
+	/* relink in ifindex order, dropping the interfaces that are gone */
 	kern_db = NULL;
-
-	while (db) {
-		n = db;
-		db = db->next;
-		n->next = kern_db;
-		kern_db = n;
+	tail = &kern_db;
+	for (i = 0; i < ent_by_index_size; i++) {
+		n = ent_by_index[i];
+		if (!n)
+			continue;
+		if (n->gen != load_gen) {
+			ent_by_index[i] = NULL;
+			free(n->name);
+			free(n);
+			continue;
+		}
+		*tail = n;
+		tail = &n->next;
 	}
+	*tail = NULL;
 }
 
 static void load_raw_table(FILE *fp)
@@ -289,7 +564,7 @@ static void load_raw_table(FILE *fp)
 			strlcpy(info_source, buf+1, sizeof(info_source));
 			continue;
 		}
-		if ((n = malloc(sizeof(*n))) == NULL)
+		if ((n = calloc(1, sizeof(*n))) == NULL)
 			abort();
 
 		if (!(p = strchr(buf, ' ')))
@@ -305,7 +580,7 @@ static void load_raw_table(FILE *fp)
 		n->name = strdup(p);
 		p = next;
 
-		for (i = 0; i < MAXS; i++) {
+		for (i = 0; i < ncols; i++) {
 			unsigned int rate;
 
 			if (!(next = strchr(p, ' ')))
@@ -335,28 +610,80 @@ static void load_raw_table(FILE *fp)
 	}
 }
 
-static void dump_raw_db(FILE *fp, int to_hist)
+/* A binary history is a copy of kern_db as records. Text histories of
+ * older versions are still read.
+ */
+struct ifstat_hist_rec {
+	__u32		ifindex;
+	char		name[IFNAMSIZ];
+	__u32		pad;
+	__u64		val[MAXCOLS];
+	double		rate[MAXCOLS];
+};
+
+static void load_hist_db(FILE *fp)
 {
-	struct ifstat_ent *n, *h;
+	const struct ifstat_hist_rec *r;
+	struct ifstat_ent *n, **tail;
+	struct stat_hist h;
+	size_t i;
+	int j;
+
+	switch (stat_hist_map(fileno(fp), STAT_HIST_IFSTAT, sizeof(*r), &h)) {
+	case 1:
+		load_raw_table(fp);
+		return;
+	case -1:
+		fprintf(stderr, "ifstat: history file is damaged or of another version, ignoring it.\n");
+		return;
+	}
 
-	h = hist_db;
-	new_json_obj_plain(json_output);
-	if (is_json_context()) {
-		open_json_object(NULL);
-		open_json_object(info_source);
-	} else
-		fprintf(fp, "#%s\n", info_source);
+	if (info_source[0] && strcmp(info_source, h.source))
+		source_mismatch = 1;
+	strlcpy(info_source, h.source, sizeof(info_source));
 
-	for (n = kern_db; n; n = n->next) {
-		int i;
+	for (tail = &kern_db; *tail; tail = &(*tail)->next)
+		;
+	for (r = h.data, i = 0; i < h.count; i++, r++) {
+		if ((n = calloc(1, sizeof(*n))) == NULL)
+			abort();
+		n->ifindex = r->ifindex;
+		n->name = strndup(r->name, sizeof(r->name));
+		if (!n->name)
+			abort();
+		memcpy(n->val, r->val, sizeof(n->val));
+		memcpy(n->rate, r->rate, sizeof(n->rate));
+		for (j = 0; j < ncols; j++)
+			n->ival[j] = (__u32)n->val[j];
+		*tail = n;
+		tail = &n->next;
+	}
+	stat_hist_unmap(&h);
+}
+
+/* Interfaces not matching the patterns keep their values from the history */
+static void save_hist_db(const char *path)
+{
+	struct ifstat_ent *n, *h = hist_db;
+	struct ifstat_hist_rec *recs;
+	size_t count = 0;
+
+	for (n = kern_db; n; n = n->next)
+		count++;
+	recs = calloc(count ? : 1, sizeof(*recs));
+	if (!recs) {
+		perror("ifstat: calloc");
+		return;
+	}
+
+	for (n = kern_db, count = 0; n; n = n->next, count++) {
+		struct ifstat_hist_rec *r = &recs[count];
 		unsigned long long *vals = n->val;
 		double *rates = n->rate;
 
 		if (!match(n->name)) {
 			struct ifstat_ent *h1;
 
-			if (!to_hist)
-				continue;
 			for (h1 = h; h1; h1 = h1->next) {
 				if (h1->ifindex == n->ifindex) {
 					vals = h1->val;
@@ -367,15 +694,48 @@ static void dump_raw_db(FILE *fp, int to_hist)
 			}
 		}
 
+		r->ifindex = n->ifindex;
+		strncpy(r->name, n->name, sizeof(r->name));
+		memcpy(r->val, vals, sizeof(r->val));
+		memcpy(r->rate, rates, sizeof(r->rate));
+	}
+
+	if (stat_hist_write(path, STAT_HIST_IFSTAT, info_source, recs,
+			    sizeof(*recs), count))
+		perror("ifstat: write history file");
+	free(recs);
+}
+
+static void dump_raw_db(FILE *fp)
+{
+	struct ifstat_ent *n;
+
+	new_json_obj_plain(json_output);
+	if (is_json_context()) {
+		open_json_object(NULL);
+		open_json_object(info_source);
+	} else
+		fprintf(fp, "#%s\n", info_source);
+
+	for (n = kern_db; n; n = n->next) {
+		int i;
+		unsigned long long *vals = n->val;
+		double *rates = n->rate;
+
+		if (!match(n->name))
+			continue;
+
 		if (is_json_context()) {
 			open_json_object(n->name);
 
-			for (i = 0; i < MAXS && stats[i]; i++)
-				print_lluint(PRINT_JSON, stats[i], NULL, vals[i]);
+			for (i = 0; i < ncols; i++)
+				if (cols[i])
+					print_lluint(PRINT_JSON, cols[i], NULL,
+						     vals[i]);
 			close_json_object();
 		} else {
 			fprintf(fp, "%d %s ", n->ifindex, n->name);
-			for (i = 0; i < MAXS; i++)
+			for (i = 0; i < ncols; i++)
 				fprintf(fp, "%llu %u ", vals[i],
 					(unsigned int)rates[i]);
 			fprintf(fp, "\n");
@@ -484,14 +844,44 @@ static void print_one_json(const struct ifstat_ent *n,
 {
 	int i, m = show_errors ? 20 : 10;
 
+	if (xstat && !xstat->link)
+		m = ncols;
+
 	open_json_object(n->name);
 
-	for (i = 0; i < m && stats[i]; i++)
-		print_lluint(PRINT_JSON, stats[i], NULL, vals[i]);
+	for (i = 0; i < m; i++)
+		if (cols[i])
+			print_lluint(PRINT_JSON, cols[i], NULL, vals[i]);
 
 	close_json_object();
 }
 
+/* Groups not laid out like the link statistics, one counter per line */
+static void print_head_cols(FILE *fp)
+{
+	fprintf(fp, "#%s\n", info_source);
+	fprintf(fp, "%-15s %-24s %8s/%-6s\n", "Interface", "Counter",
+		"Total", "Rate");
+}
+
+static void print_one_cols(FILE *fp, const struct ifstat_ent *n,
+			   const unsigned long long *vals)
+{
+	const char *name = n->name;
+	int i;
+
+	for (i = 0; i < ncols; i++) {
+		if (!cols[i])
+			continue;
+		if (!dump_zeros && !vals[i] && !(unsigned int)n->rate[i])
+			continue;
+		fprintf(fp, "%-15s %-24s ", name, cols[i]);
+		format_rate(fp, vals, n->rate, i);
+		fprintf(fp, "\n");
+		name = "";
+	}
+}
+
 static void print_one_if(FILE *fp, const struct ifstat_ent *n,
 			 const unsigned long long *vals)
 {
@@ -548,7 +938,9 @@ static void dump_kern_db(FILE *fp)
 	if (is_json_context()) {
 		open_json_object(NULL);
 		open_json_object(info_source);
-	} else
+	} else if (xstat && !xstat->link)
+		print_head_cols(fp);
+	else
 		print_head(fp);
 
 	for (n = kern_db; n; n = n->next) {
@@ -557,6 +949,8 @@ static void dump_kern_db(FILE *fp)
 
 		if (is_json_context())
 			print_one_json(n, n->val);
+		else if (xstat && !xstat->link)
+			print_one_cols(fp, n, n->val);
 		else
 			print_one_if(fp, n, n->val);
 	}
@@ -576,19 +970,21 @@ static void dump_incr_db(FILE *fp)
 	if (is_json_context()) {
 		open_json_object(NULL);
 		open_json_object(info_source);
-	} else
+	} else if (xstat && !xstat->link)
+		print_head_cols(fp);
+	else
 		print_head(fp);
 
 	for (n = kern_db; n; n = n->next) {
 		int i;
-		unsigned long long vals[MAXS];
+		unsigned long long vals[MAXCOLS];
 		struct ifstat_ent *h1;
 
 		memcpy(vals, n->val, sizeof(vals));
 
 		for (h1 = h; h1; h1 = h1->next) {
 			if (h1->ifindex == n->ifindex) {
-				for (i = 0; i < MAXS; i++)
+				for (i = 0; i < ncols; i++)
 					vals[i] -= h1->val[i];
 				h = h1->next;
 				break;
@@ -599,6 +995,8 @@ static void dump_incr_db(FILE *fp)
 
 		if (is_json_context())
 			print_one_json(n, n->val);
+		else if (xstat && !xstat->link)
+			print_one_cols(fp, n, vals);
 		else
 			print_one_if(fp, n, vals);
 	}
@@ -618,76 +1016,59 @@ static void sigchild(int signo)
 
 static void update_db(int interval)
 {
-	struct ifstat_ent *n, *h;
-
-	n = kern_db;
-	kern_db = NULL;
-
+	load_interval = interval;
 	load_info();
+}
 
-	h = kern_db;
-	kern_db = n;
-
-	for (n = kern_db; n; n = n->next) {
-		struct ifstat_ent *h1;
-
-		for (h1 = h; h1; h1 = h1->next) {
-			if (h1->ifindex == n->ifindex) {
-				int i;
-
-				for (i = 0; i < MAXS; i++) {
-					if (h1->ival[i] < n->ival[i]) {
-						memset(n->ival, 0, sizeof(n->ival));
-						break;
-					}
-				}
-				for (i = 0; i < MAXS; i++) {
-					double sample;
-					__u64 incr;
-
-					if (is_extended) {
-						incr = h1->val[i] - n->val[i];
-						n->val[i] = h1->val[i];
-					} else {
-						incr = (__u32) (h1->ival[i] - n->ival[i]);
-						n->val[i] += incr;
-						n->ival[i] = h1->ival[i];
-					}
-
-					sample = (double)(incr*1000)/interval;
-					if (interval >= scan_interval) {
-						n->rate[i] += W*(sample-n->rate[i]);
-					} else if (interval >= 1000) {
-						if (interval >= time_constant) {
-							n->rate[i] = sample;
-						} else {
-							double w = W*(double)interval/scan_interval;
-
-							n->rate[i] += w*(sample-n->rate[i]);
-						}
-					}
-				}
+static void shm_name(char *name, size_t len, uid_t uid)
+{
+	if (getenv("IFSTAT_SHM"))
+		snprintf(name, len, "%s", getenv("IFSTAT_SHM"));
+	else
+		snprintf(name, len, "/dev/shm/ifstat.u%d", uid);
+}
 
-				while (h != h1) {
-					struct ifstat_ent *tmp = h;
+/* Snapshots carry the same text clients get from the daemon's socket. */
+static void publish_raw_db(struct stat_shm *shm)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	if (!fp)
+		return;
+	dump_raw_db(fp);
+	fclose(fp);
+	stat_shm_publish(shm, buf, len);
+	free(buf);
+}
 
-					h = h->next;
-					free(tmp->name);
-					free(tmp);
-				};
-				h = h1->next;
-				free(h1->name);
-				free(h1);
-				break;
-			}
-		}
+static FILE *shm_snapshot_open(char **snap)
+{
+	char name[128];
+	size_t len;
+	FILE *fp;
+
+	shm_name(name, sizeof(name), getuid());
+	*snap = stat_shm_read(name, &len);
+	if (!*snap && !getenv("IFSTAT_SHM")) {
+		shm_name(name, sizeof(name), 0);
+		*snap = stat_shm_read(name, &len);
 	}
+	if (!*snap)
+		return NULL;
+
+	fp = fmemopen(*snap, len, "r");
+	if (!fp)
+		free(*snap);
+	return fp;
 }
 
 #define T_DIFF(a, b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
 
 
-static void server_loop(int fd)
+static void server_loop(int fd, struct stat_shm *shm)
 {
 	struct timeval snaptime = { 0 };
 	struct pollfd p;
@@ -709,6 +1090,8 @@ static void server_loop(int fd)
 		tdiff = T_DIFF(now, snaptime);
 		if (tdiff >= scan_interval) {
 			update_db(tdiff);
+			if (shm)
+				publish_raw_db(shm);
 			snaptime = now;
 			tdiff = 0;
 		}
@@ -730,7 +1113,7 @@ static void server_loop(int fd)
 					FILE *fp = fdopen(clnt, "w");
 
 					if (fp)
-						dump_raw_db(fp, 0);
+						dump_raw_db(fp);
 					exit(0);
 				}
 			}
@@ -740,6 +1123,228 @@ static void server_loop(int fd)
 	}
 }
 
+/* High resolution mode: RTM_GETSTATS dumps filtered to a single stats
+ * group are taken every hires_interval ms, each one stamped with
+ * CLOCK_MONOTONIC. Per-sample rates of the packet and byte counters go
+ * to a ring per interface, allocated when the interface is first seen,
+ * and every time hires_ring samples have been taken their average, peak
+ * and percentiles are reported.
+ */
+#define HIRES_METRICS	4	/* rx/tx packets, rx/tx bytes */
+
+struct hires_ent {
+	bool		seen;
+	__u64		last[HIRES_METRICS];
+	__u64		last_ns;
+	double		*ring;		/* hires_ring rows of HIRES_METRICS */
+	unsigned int	head;
+	unsigned int	count;
+	double		peak[HIRES_METRICS];
+};
+
+static unsigned int hires_interval;
+static unsigned int hires_ring = 100;
+static struct hires_ent *hires_db;	/* by ifindex */
+static unsigned int hires_db_size;
+static __u64 hires_now;
+
+static struct hires_ent *hires_get(int ifindex)
+{
+	struct hires_ent *e;
+
+	if (ifindex <= 0)
+		return NULL;
+
+	if (ifindex >= hires_db_size) {
+		unsigned int size = 2 * ifindex + 16;
+
+		e = realloc(hires_db, size * sizeof(*e));
+		if (!e) {
+			perror("ifstat: realloc");
+			exit(-1);
+		}
+		memset(e + hires_db_size, 0,
+		       (size - hires_db_size) * sizeof(*e));
+		hires_db = e;
+		hires_db_size = size;
+	}
+
+	e = &hires_db[ifindex];
+	if (!e->ring) {
+		e->ring = calloc(hires_ring, HIRES_METRICS * sizeof(*e->ring));
+		if (!e->ring) {
+			perror("ifstat: calloc");
+			exit(-1);
+		}
+	}
+	return e;
+}
+
+static int get_nlmsg_hires(struct nlmsghdr *m, void *arg)
+{
+	struct if_stats_msg *ifsm = NLMSG_DATA(m);
+	struct rtattr *tb[IFLA_STATS_MAX+1];
+	__u64 sample[MAXCOLS];
+	int len = m->nlmsg_len;
+	struct hires_ent *e;
+	__u64 vals[HIRES_METRICS];
+	double *row;
+	int i;
+
+	if (m->nlmsg_type != RTM_NEWSTATS)
+		return 0;
+
+	len -= NLMSG_LENGTH(sizeof(*ifsm));
+	if (len < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	parse_rtattr(tb, IFLA_STATS_MAX, IFLA_STATS_RTA(ifsm), len);
+	if (!xstats_get(tb, sample))
+		return 0;
+
+	e = hires_get(ifsm->ifindex);
+	if (!e)
+		return 0;
+
+	/* the head of rtnl_link_stats64 */
+	for (i = 0; i < HIRES_METRICS; i++)
+		vals[i] = sample[i];
+
+	if (e->seen && hires_now > e->last_ns) {
+		double dt = (hires_now - e->last_ns) / 1e9;
+
+		row = e->ring + e->head * HIRES_METRICS;
+		for (i = 0; i < HIRES_METRICS; i++) {
+			row[i] = (vals[i] - e->last[i]) / dt;
+			if (row[i] > e->peak[i])
+				e->peak[i] = row[i];
+		}
+		e->head = (e->head + 1) % hires_ring;
+		if (e->count < hires_ring)
+			e->count++;
+	}
+
+	memcpy(e->last, vals, sizeof(vals));
+	e->last_ns = hires_now;
+	e->seen = true;
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void hires_report(double *scratch)
+{
+	static const double pct[] = { 50, 95, 99 };
+	unsigned int ifindex, i, j, k;
+
+	new_json_obj(json_output);
+	open_json_object(NULL);
+	if (!is_json_context()) {
+		printf("#hires sampling_interval=%ums samples=%u\n",
+		       hires_interval, hires_ring);
+		printf("%-15s %-10s %12s %12s %12s %12s %12s\n", "Interface",
+		       "Rate/s", "Avg", "P50", "P95", "P99", "Peak");
+	}
+
+	for (ifindex = 0; ifindex < hires_db_size; ifindex++) {
+		struct hires_ent *e = &hires_db[ifindex];
+		const char *name;
+
+		if (!e->count)
+			continue;
+		name = ll_index_to_name(ifindex);
+		if (!match(name))
+			continue;
+		if (!dump_zeros) {
+			for (i = 0; i < HIRES_METRICS && !e->peak[i]; i++)
+				;
+			if (i == HIRES_METRICS)
+				goto next;
+		}
+
+		open_json_object(name);
+		for (i = 0; i < HIRES_METRICS; i++) {
+			double sum = 0;
+
+			for (j = 0; j < e->count; j++) {
+				scratch[j] = e->ring[j * HIRES_METRICS + i];
+				sum += scratch[j];
+			}
+			qsort(scratch, e->count, sizeof(*scratch), cmp_double);
+
+			open_json_object(stats[i]);
+			if (!is_json_context())
+				printf("%-15s %-10s ", i ? "" : name, stats[i]);
+			print_float(PRINT_ANY, "avg", "%12.0f ", sum / e->count);
+			for (k = 0; k < ARRAY_SIZE(pct); k++) {
+				char key[8];
+
+				snprintf(key, sizeof(key), "p%.0f", pct[k]);
+				j = (e->count - 1) * pct[k] / 100 + 0.5;
+				print_float(PRINT_ANY, key, "%12.0f ",
+					    scratch[j]);
+			}
+			print_float(PRINT_ANY, "peak", "%12.0f", e->peak[i]);
+			print_nl();
+			close_json_object();
+		}
+		close_json_object();
+next:
+		memset(e->peak, 0, sizeof(e->peak));
+	}
+	close_json_object();
+	delete_json_obj();
+	fflush(stdout);
+}
+
+static void hires_loop(void)
+{
+	__u32 filter_mask = IFLA_STATS_FILTER_BIT(xstat->group);
+	struct rtnl_handle rth;
+	double next;
+	unsigned int samples = 0;
+	double *scratch;
+
+	scratch = calloc(hires_ring, sizeof(*scratch));
+	if (!scratch) {
+		perror("ifstat: calloc");
+		exit(-1);
+	}
+
+	if (rtnl_open(&rth, 0) < 0)
+		exit(1);
+	ll_init_map(&rth);
+
+	next = monotonic_now();
+	for (;;) {
+		hires_now = monotonic_now() * 1e9;
+		if (rtnl_statsdump_req_filter(&rth, AF_UNSPEC, filter_mask,
+					      NULL, NULL) < 0) {
+			perror("Cannot send dump request");
+			exit(1);
+		}
+		if (rtnl_dump_filter(&rth, get_nlmsg_hires, NULL) < 0) {
+			perror("Dump terminated\n");
+			exit(1);
+		}
+
+		/* the first dump only sets the baseline */
+		if (samples++ && (samples - 1) % hires_ring == 0)
+			hires_report(scratch);
+
+		next += hires_interval / 1000.0;
+		while (monotonic_sleep_until(next) < 0)
+			;
+	}
+}
+
 static int verify_forging(int fd)
 {
 	struct ucred cred;
@@ -755,24 +1360,13 @@ static int verify_forging(int fd)
 
 static void xstat_usage(void)
 {
-	fprintf(stderr,
-"Usage: ifstat supported xstats:\n"
-"       cpu_hits       Counts only packets that went via the CPU.\n");
-}
-
-struct extended_stats_options_t {
-	char *name;
-	int id;
-	int sub_type;
-};
+	int i;
 
-/* Note: if one xstat name is subset of another, it should be before it in this
- * list.
- * Name length must be under 64 chars.
- */
-static const struct extended_stats_options_t extended_stats_options[] = {
-	{"cpu_hits",  IFLA_STATS_LINK_OFFLOAD_XSTATS, IFLA_OFFLOAD_XSTATS_CPU_HIT},
-};
+	fprintf(stderr, "Usage: ifstat supported xstats:\n");
+	for (i = 0; i < ARRAY_SIZE(xstats_opts); i++)
+		fprintf(stderr, "       %-18s %s\n", xstats_opts[i].name,
+			xstats_opts[i].help);
+}
 
 static const char *get_filter_type(const char *name)
 {
@@ -780,14 +1374,14 @@ static const char *get_filter_type(const char *name)
 	int i;
 
 	name_len = strlen(name);
-	for (i = 0; i < ARRAY_SIZE(extended_stats_options); i++) {
-		const struct extended_stats_options_t *xstat;
-
-		xstat = &extended_stats_options[i];
-		if (strncmp(name, xstat->name, name_len) == 0) {
-			filter_type = xstat->id;
-			sub_type = xstat->sub_type;
-			return xstat->name;
+	for (i = 0; i < ARRAY_SIZE(xstats_opts); i++) {
+		const struct xstats_opt *opt = &xstats_opts[i];
+
+		if (strncmp(name, opt->name, name_len) == 0) {
+			xstat = opt;
+			cols = opt->cols;
+			ncols = opt->ncols;
+			return opt->name;
 		}
 	}
 
@@ -807,6 +1401,7 @@ static void usage(void)
 "   -d, --scan=SECS      sample every statistics every SECS\n"
 "   -e, --errors         show errors\n"
 "   -j, --json           format output in JSON\n"
+"   -m, --shm            with -d, also publish snapshots in shared memory\n"
 "   -n, --nooutput       do history only\n"
 "   -p, --pretty         pretty print\n"
 "   -r, --reset          reset history\n"
@@ -814,7 +1409,10 @@ static void usage(void)
 "   -t, --interval=SECS  report average over the last SECS\n"
 "   -V, --version        output version information\n"
 "   -z, --zeros          show entries with zero activity\n"
-"   -x, --extended=TYPE  show extended stats of TYPE\n");
+"   -x, --extended=TYPE  show extended stats of TYPE\n"
+"   -S, --sample=MSEC    sample every MSEC milliseconds and report rate\n"
+"                        percentiles and peaks, see --ring\n"
+"   -R, --ring=N         samples per report with --sample (default 100)\n");
 
 	exit(-1);
 }
@@ -826,6 +1424,7 @@ static const struct option longopts[] = {
 	{ "errors", 0, 0, 'e' },
 	{ "nooutput", 0, 0, 'n' },
 	{ "json", 0, 0, 'j' },
+	{ "shm", 0, 0, 'm' },
 	{ "reset", 0, 0, 'r' },
 	{ "pretty", 0, 0, 'p' },
 	{ "noupdate", 0, 0, 's' },
@@ -833,6 +1432,8 @@ static const struct option longopts[] = {
 	{ "version", 0, 0, 'V' },
 	{ "zeros", 0, 0, 'z' },
 	{ "extended", 1, 0, 'x'},
+	{ "sample", 1, 0, 'S'},
+	{ "ring", 1, 0, 'R'},
 	{ 0 }
 };
 
@@ -842,11 +1443,13 @@ int main(int argc, char *argv[])
 	struct sockaddr_un sun;
 	FILE *hist_fp = NULL;
 	const char *stats_type = NULL;
+	FILE *sfp;
+	char *snap;
 	int ch;
 	int fd;
 
 	is_extended = false;
-	while ((ch = getopt_long(argc, argv, "hjpvVzrnasd:t:ex:",
+	while ((ch = getopt_long(argc, argv, "hjpvVzrnasd:t:ex:mS:R:",
 			longopts, NULL)) != EOF) {
 		switch (ch) {
 		case 'z':
@@ -870,6 +1473,9 @@ int main(int argc, char *argv[])
 		case 'j':
 			json_output = 1;
 			break;
+		case 'm':
+			publish_shm = 1;
+			break;
 		case 'p':
 			pretty = 1;
 			break;
@@ -891,6 +1497,20 @@ int main(int argc, char *argv[])
 			stats_type = optarg;
 			is_extended = true;
 			break;
+		case 'S':
+			if (get_unsigned(&hires_interval, optarg, 0) ||
+			    !hires_interval) {
+				fprintf(stderr, "ifstat: invalid sample interval\n");
+				exit(-1);
+			}
+			break;
+		case 'R':
+			if (get_unsigned(&hires_ring, optarg, 0) ||
+			    !hires_ring) {
+				fprintf(stderr, "ifstat: invalid ring size\n");
+				exit(-1);
+			}
+			break;
 		case 'v':
 		case 'V':
 			printf("ifstat utility, iproute2-%s\n", version);
@@ -911,11 +1531,30 @@ int main(int argc, char *argv[])
 			exit(-1);
 	}
 
+	if (hires_interval) {
+		if (scan_interval) {
+			fprintf(stderr, "ifstat: --sample and --scan can not be combined\n");
+			exit(-1);
+		}
+		if (!stats_type)
+			xstat = &link64_opt;
+		if (!xstat->link) {
+			fprintf(stderr, "ifstat: --sample needs packet and byte counters, not %s\n",
+				xstat->name);
+			exit(-1);
+		}
+		patterns = argv;
+		npatterns = argc;
+		hires_loop();
+	}
+
 	sun.sun_family = AF_UNIX;
 	sun.sun_path[0] = 0;
 	snprintf(sun.sun_path + 1, sizeof(sun.sun_path) - 1, "ifstat%d", getuid());
 
 	if (scan_interval > 0) {
+		struct stat_shm *shm = NULL;
+
 		if (time_constant == 0)
 			time_constant = 60;
 		time_constant *= 1000;
@@ -932,13 +1571,24 @@ int main(int argc, char *argv[])
 			perror("ifstat: listen");
 			exit(-1);
 		}
+		if (publish_shm) {
+			char name[128];
+
+			shm_name(name, sizeof(name), getuid());
+			shm = stat_shm_create(name);
+			if (!shm) {
+				fprintf(stderr, "ifstat: cannot create %s: %s\n",
+					name, strerror(errno));
+				exit(-1);
+			}
+		}
 		if (daemon(0, 0)) {
 			perror("ifstat: daemon");
 			exit(-1);
 		}
 		signal(SIGPIPE, SIG_IGN);
 		signal(SIGCHLD, sigchild);
-		server_loop(fd);
+		server_loop(fd, shm);
 		exit(0);
 	}
 
@@ -965,7 +1615,7 @@ int main(int argc, char *argv[])
 	if (!ignore_history || !no_update) {
 		struct stat stb;
 
-		fd = open(hist_name, O_RDWR|O_CREAT|O_NOFOLLOW, 0600);
+		fd = stat_hist_open(hist_name);
 		if (fd < 0) {
 			perror("ifstat: open history file");
 			exit(-1);
@@ -974,10 +1624,6 @@ int main(int argc, char *argv[])
 			perror("ifstat: fdopen history file");
 			exit(-1);
 		}
-		if (flock(fileno(hist_fp), LOCK_EX)) {
-			perror("ifstat: flock history file");
-			exit(-1);
-		}
 		if (fstat(fileno(hist_fp), &stb) != 0) {
 			perror("ifstat: fstat history file");
 			exit(-1);
@@ -1002,19 +1648,26 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		load_raw_table(hist_fp);
+		load_hist_db(hist_fp);
 
 		hist_db = kern_db;
 		kern_db = NULL;
 	}
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
+	if ((sfp = shm_snapshot_open(&snap)) != NULL) {
+		load_raw_table(sfp);
+		if (hist_db && source_mismatch) {
+			fprintf(stderr, "ifstat: history is stale, ignoring it.\n");
+			hist_db = NULL;
+		}
+		fclose(sfp);
+		free(snap);
+	} else if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
 	    (connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0
 	     || (strcpy(sun.sun_path+1, "ifstat0"),
 		 connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
 	    && verify_forging(fd) == 0) {
-		FILE *sfp = fdopen(fd, "r");
-
+		sfp = fdopen(fd, "r");
 		if (!sfp) {
 			fprintf(stderr, "ifstat: fdopen failed: %s\n",
 				strerror(errno));
@@ -1048,12 +1701,8 @@ int main(int argc, char *argv[])
 	}
 
 	if (!no_update) {
-		if (ftruncate(fileno(hist_fp), 0))
-			perror("ifstat: ftruncate");
-		rewind(hist_fp);
-
-		json_output = 0;
-		dump_raw_db(hist_fp, 1);
+		/* the lock is held until the new history is in place */
+		save_hist_db(hist_name);
 		fclose(hist_fp);
 	}
 	exit(0);
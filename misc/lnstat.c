@@ -23,9 +23,14 @@
 
 #define DEFAULT_INTERVAL	2
 
+/* default number of CPUs listed per key in --cpus mode */
+#define DEFAULT_TOP_CPUS	3
+#define MAX_TOP_CPUS		16
+
 #define HDR_LINE_LENGTH		(MAX_FIELDS*FIELD_WIDTH_MAX)
 
 #include <unistd.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +44,7 @@
 static struct option opts[] = {
 	{ "version", 0, NULL, 'V' },
 	{ "count", 1, NULL, 'c' },
+	{ "cpus", 0, NULL, 'C' },
 	{ "dump", 0, NULL, 'd' },
 	{ "json", 0, NULL, 'j' },
 	{ "file", 1, NULL, 'f' },
@@ -46,6 +52,7 @@ static struct option opts[] = {
 	{ "interval", 1, NULL, 'i' },
 	{ "keys", 1, NULL, 'k' },
 	{ "subject", 1, NULL, 's' },
+	{ "top", 1, NULL, 't' },
 	{ "width", 1, NULL, 'w' },
 	{ "oneline", 0, NULL, 0 },
 };
@@ -61,6 +68,8 @@ static int usage(char *name, int exit_code)
 		"	-V --version		Print Version of Program\n"
 		"	-c --count <count>	"
 		"Print <count> number of intervals\n"
+		"	-C --cpus		"
+		"Show per-CPU spread of each key\n"
 		"	-d --dump		"
 		"Dump list of available files/keys\n"
 		"	-j --json		"
@@ -74,9 +83,11 @@ static int usage(char *name, int exit_code)
 		"				0 = never\n"
 		"				1 = once\n"
 		"				2 = every 20 lines (default))\n"
+		"	-t --top <n>		"
+		"Busiest CPUs listed with --cpus (default %d)\n"
 		"	-w --width n,n,n,...	Width for each field\n"
 		"\n",
-		name, version);
+		name, version, DEFAULT_TOP_CPUS);
 
 	exit(exit_code);
 }
@@ -123,6 +134,125 @@ static void print_json(FILE *of, const struct lnstat_file *lnstat_files,
 	delete_json_obj_plain();
 }
 
+struct cpu_skew {
+	unsigned long min, max;
+	double stddev;
+	unsigned int num_top;
+	unsigned int top[MAX_TOP_CPUS];	/* rows, busiest first */
+};
+
+/* Spread of one key over the CPUs, and its busiest CPUs. */
+static void cpu_skew(const struct lnstat_field *lf, unsigned int num_top,
+		     struct cpu_skew *sk)
+{
+	unsigned int ncpus = lf->file->num_cpus;
+	double sum = 0, sq = 0, mean;
+	unsigned int c, k;
+
+	memset(sk, 0, sizeof(*sk));
+	if (!ncpus)
+		return;
+
+	sk->min = ULONG_MAX;
+	for (c = 0; c < ncpus; c++) {
+		unsigned long v = lf->cpu_result[c];
+
+		if (v < sk->min)
+			sk->min = v;
+		if (v > sk->max)
+			sk->max = v;
+		sum += v;
+		sq += (double)v * v;
+
+		/* insert into the top list, which stays sorted */
+		for (k = sk->num_top; k > 0; k--) {
+			if (lf->cpu_result[sk->top[k - 1]] >= v)
+				break;
+			if (k < num_top)
+				sk->top[k] = sk->top[k - 1];
+		}
+		if (k < num_top) {
+			sk->top[k] = c;
+			if (sk->num_top < num_top)
+				sk->num_top++;
+		}
+	}
+
+	mean = sum / ncpus;
+	sk->stddev = sq / ncpus - mean * mean;
+	sk->stddev = sk->stddev > 0 ? sqrt(sk->stddev) : 0;
+}
+
+static void print_cpu_hdr(FILE *of)
+{
+	fprintf(of, "%-12s %-20s %10s %10s %10s  %s\n",
+		"file", "key", "min", "max", "stddev", "top cpus");
+}
+
+static void print_cpu_lines(FILE *of, const struct field_params *fp,
+			    unsigned int num_top)
+{
+	int i;
+
+	for (i = 0; i < fp->num; i++) {
+		const struct lnstat_field *lf = fp->params[i].lf;
+		struct cpu_skew sk;
+		unsigned int k;
+
+		/* the first key is a global count, repeated on every row */
+		if (lf == &lf->file->fields[0])
+			continue;
+
+		cpu_skew(lf, num_top, &sk);
+		fprintf(of, "%-12s %-20s %10lu %10lu %10.1f ",
+			lf->file->basename, lf->name, sk.min, sk.max,
+			sk.stddev);
+		for (k = 0; k < sk.num_top; k++)
+			fprintf(of, " %d:%lu", lnstat_cpu_id(sk.top[k]),
+				lf->cpu_result[sk.top[k]]);
+		fputc('\n', of);
+	}
+	fputc('\n', of);
+}
+
+static void print_cpu_json(FILE *of, const struct field_params *fp,
+			   unsigned int num_top)
+{
+	int i;
+
+	new_json_obj_plain(1);
+	open_json_array(PRINT_JSON, NULL);
+	for (i = 0; i < fp->num; i++) {
+		const struct lnstat_field *lf = fp->params[i].lf;
+		struct cpu_skew sk;
+		unsigned int k;
+
+		if (lf == &lf->file->fields[0])
+			continue;
+
+		cpu_skew(lf, num_top, &sk);
+		open_json_object(NULL);
+		print_string(PRINT_JSON, "file", NULL, lf->file->basename);
+		print_string(PRINT_JSON, "key", NULL, lf->name);
+		print_luint(PRINT_JSON, "min", NULL, sk.min);
+		print_luint(PRINT_JSON, "max", NULL, sk.max);
+		print_float(PRINT_JSON, "stddev", NULL, sk.stddev);
+		open_json_array(PRINT_JSON, "top");
+		for (k = 0; k < sk.num_top; k++) {
+			open_json_object(NULL);
+			print_int(PRINT_JSON, "cpu", NULL,
+				  lnstat_cpu_id(sk.top[k]));
+			print_luint(PRINT_JSON, "value", NULL,
+				    lf->cpu_result[sk.top[k]]);
+			close_json_object();
+		}
+		close_json_array(PRINT_JSON, NULL);
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	delete_json_obj_plain();
+}
+
 /* find lnstat_field according to user specification */
 static int map_field_params(struct lnstat_file *lnstat_files,
 			    struct field_params *fps, int interval)
@@ -243,6 +373,8 @@ int main(int argc, char **argv)
 		MODE_NORMAL,
 	} mode = MODE_NORMAL;
 	unsigned long count = 0;
+	int per_cpu = 0;
+	unsigned int num_top = DEFAULT_TOP_CPUS;
 	struct table_hdr *header;
 	static struct field_params fp;
 	int num_req_files = 0;
@@ -265,7 +397,7 @@ int main(int argc, char **argv)
 		num_req_files = 1;
 	}
 
-	while ((c = getopt_long(argc, argv, "Vc:djpf:h?i:k:s:w:",
+	while ((c = getopt_long(argc, argv, "Vc:Cdjpf:h?i:k:s:t:w:",
 				opts, NULL)) != -1) {
 		int len = 0;
 		char *tmp, *tok;
@@ -274,6 +406,9 @@ int main(int argc, char **argv)
 		case 'c':
 			count = strtoul(optarg, NULL, 0);
 			break;
+		case 'C':
+			per_cpu = 1;
+			break;
 		case 'd':
 			mode = MODE_DUMP;
 			break;
@@ -309,6 +444,11 @@ int main(int argc, char **argv)
 		case 's':
 			sscanf(optarg, "%u", &hdr);
 			break;
+		case 't':
+			sscanf(optarg, "%u", &num_top);
+			if (num_top > MAX_TOP_CPUS)
+				num_top = MAX_TOP_CPUS;
+			break;
 		case 'w':
 			tmp = strdup(optarg);
 			if (!tmp)
@@ -338,6 +478,11 @@ int main(int argc, char **argv)
 	lnstat_files = lnstat_scan_dir(PROC_NET_STAT, num_req_files,
 				       (const char **) req_files);
 
+	if (per_cpu && lnstat_set_per_cpu(lnstat_files) < 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
 	switch (mode) {
 	case MODE_DUMP:
 		lnstat_dump(stdout, lnstat_files);
@@ -357,7 +502,14 @@ int main(int argc, char **argv)
 
 		for (i = 0; i < count || !count; i++) {
 			lnstat_update(lnstat_files);
-			if (mode == MODE_JSON)
+			if (per_cpu && mode == MODE_JSON)
+				print_cpu_json(stdout, &fp, num_top);
+			else if (per_cpu) {
+				if  ((hdr > 1 && !(i % 20)) ||
+				     (hdr == 1 && i == 0))
+					print_cpu_hdr(stdout);
+				print_cpu_lines(stdout, &fp, num_top);
+			} else if (mode == MODE_JSON)
 				print_json(stdout, lnstat_files, &fp);
 			else {
 				if  ((hdr > 1 && !(i % 20)) ||
@@ -17,8 +17,11 @@ struct lnstat_field {
 	struct lnstat_file *file;
 	unsigned int num;			/* field number in line */
 	char name[LNSTAT_MAX_FIELD_NAME_LEN+1];
-	unsigned long values[2];		/* two buffers for values */
+	unsigned long values[2];		/* previous and current values,
+						 * see lnstat_file.cur */
 	unsigned long result;
+	unsigned long *cpu_values[2];		/* per-CPU values, --cpus only */
+	unsigned long *cpu_result;
 };
 
 struct lnstat_file {
@@ -29,6 +32,12 @@ struct lnstat_file {
 	struct timeval interval;		/* interval */
 	int compat;				/* 1 == backwards compat mode */
 	FILE *fp;
+	char *buf;				/* file contents, reused */
+	size_t buf_size;
+	int cur;				/* current half of values[] */
+	int per_cpu;				/* keep per-CPU values too */
+	unsigned int num_cpus;			/* rows in the last read */
+	unsigned int max_cpus;			/* rows allocated */
 	unsigned int num_fields;		/* number of fields */
 	struct lnstat_field fields[LNSTAT_MAX_FIELDS_PER_LINE];
 };
@@ -37,6 +46,8 @@ struct lnstat_file {
 struct lnstat_file *lnstat_scan_dir(const char *path, const int num_req_files,
 				    const char **req_files);
 int lnstat_update(struct lnstat_file *lnstat_files);
+int lnstat_set_per_cpu(struct lnstat_file *lnstat_files);
+int lnstat_cpu_id(unsigned int row);
 int lnstat_dump(FILE *outfd, struct lnstat_file *lnstat_files);
 struct lnstat_field *lnstat_find_field(struct lnstat_file *lnstat_files,
 				       const char *name);
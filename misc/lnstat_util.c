@@ -30,36 +30,139 @@
 
 #define RTSTAT_COMPAT_LINE "entries  in_hit in_slow_tot in_no_route in_brd in_martian_dst in_martian_src  out_hit out_slow_tot out_slow_mc  gc_total gc_ignored gc_goal_miss gc_dst_overflow in_hlist_search out_hlist_search\n"
 
-/* Read (and summarize for SMP) the different stats vars. */
-static int scan_lines(struct lnstat_file *lf, int i)
+/* Read the whole file with pread() into the buffer kept with it. */
+static ssize_t read_file(struct lnstat_file *lf)
 {
-	char buf[FGETS_BUF_SIZE];
+	int fd = fileno(lf->fp);
+	size_t len = 0;
+	ssize_t n;
+
+	for (;;) {
+		if (len + 1 >= lf->buf_size) {
+			size_t size = lf->buf_size ? 2 * lf->buf_size : 16384;
+			char *buf = realloc(lf->buf, size);
+
+			if (!buf)
+				return -1;
+			lf->buf = buf;
+			lf->buf_size = size;
+		}
+		n = pread(fd, lf->buf + len, lf->buf_size - len - 1, len);
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		len += n;
+	}
+	lf->buf[len] = '\0';
+	return len;
+}
+
+/* value of each hex digit plus one, 0 for anything else */
+static const unsigned char hex_val[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/* Parse a hex number and skip the blanks in front of it. */
+static const char *scan_hex(const char *p, unsigned long *val)
+{
+	unsigned long v = 0;
+	unsigned char d;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	while ((d = hex_val[(unsigned char)*p]) != 0) {
+		v = (v << 4) | (d - 1);
+		p++;
+	}
+	*val = v;
+	return p;
+}
+
+/* Make room for the per-CPU values of at least 'rows' rows. */
+static int grow_cpus(struct lnstat_file *lf, unsigned int rows)
+{
+	unsigned int max = lf->max_cpus ? lf->max_cpus : 8;
+	int j, k;
+
+	while (max < rows)
+		max *= 2;
+
+	for (j = 0; j < lf->num_fields; j++) {
+		struct lnstat_field *lfi = &lf->fields[j];
+		unsigned long *v;
+
+		for (k = 0; k < 2; k++) {
+			v = realloc(lfi->cpu_values[k], max * sizeof(*v));
+			if (!v)
+				return -1;
+			memset(v + lf->max_cpus, 0,
+			       (max - lf->max_cpus) * sizeof(*v));
+			lfi->cpu_values[k] = v;
+		}
+		v = realloc(lfi->cpu_result, max * sizeof(*v));
+		if (!v)
+			return -1;
+		lfi->cpu_result = v;
+	}
+	lf->max_cpus = max;
+	return 0;
+}
+
+/* Read (and summarize for SMP) the different stats vars, into the
+ * current half of the fields' values.  In per-CPU mode each row is
+ * also kept on its own.
+ */
+static int scan_lines(struct lnstat_file *lf)
+{
+	int i = lf->cur;
+	const char *p;
 	int j, num_lines = 0;
 
 	for (j = 0; j < lf->num_fields; j++)
 		lf->fields[j].values[i] = 0;
 
-	rewind(lf->fp);
-	/* skip first line */
-	if (!lf->compat && !fgets(buf, sizeof(buf)-1, lf->fp))
+	if (read_file(lf) < 0)
 		return -1;
+	gettimeofday(&lf->last_read, NULL);
 
-	while (!feof(lf->fp) && fgets(buf, sizeof(buf)-1, lf->fp)) {
-		char *ptr = buf;
+	p = lf->buf;
+	/* skip first line */
+	if (!lf->compat) {
+		p = strchr(p, '\n');
+		if (!p)
+			return -1;
+		p++;
+	}
 
-		num_lines++;
+	while (*p) {
+		int row = num_lines++;
 
-		gettimeofday(&lf->last_read, NULL);
+		if (lf->per_cpu && num_lines > lf->max_cpus &&
+		    grow_cpus(lf, num_lines) < 0)
+			return -1;
 
 		for (j = 0; j < lf->num_fields; j++) {
-			unsigned long f = strtoul(ptr, &ptr, 16);
+			unsigned long f;
 
+			p = scan_hex(p, &f);
 			if (j == 0)
 				lf->fields[j].values[i] = f;
 			else
 				lf->fields[j].values[i] += f;
+			if (lf->per_cpu)
+				lf->fields[j].cpu_values[i][row] = f;
 		}
+
+		p = strchrnul(p, '\n');
+		if (*p)
+			p++;
 	}
+	if (lf->per_cpu)
+		lf->num_cpus = num_lines;
 	return num_lines;
 }
 
@@ -87,27 +190,104 @@ int lnstat_update(struct lnstat_file *lnstat_files)
 
 	for (lf = lnstat_files; lf; lf = lf->next) {
 		if (time_after(&lf->last_read, &lf->interval, &tv)) {
-			int i;
+			int i, cur = lf->cur, prev = !cur;
 			struct lnstat_field *lfi;
 
-			scan_lines(lf, 1);
+			/* The file is read once, and compared with the values
+			 * of the previous read.
+			 */
+			scan_lines(lf);
 
 			for (i = 0, lfi = &lf->fields[i];
 			     i < lf->num_fields; i++, lfi = &lf->fields[i]) {
 				if (i == 0)
-					lfi->result = lfi->values[1];
+					lfi->result = lfi->values[cur];
 				else
-					lfi->result = (lfi->values[1]-lfi->values[0])
+					lfi->result = (lfi->values[cur]-lfi->values[prev])
+							/ lf->interval.tv_sec;
+			}
+
+			for (i = 0, lfi = &lf->fields[i];
+			     lf->per_cpu && i < lf->num_fields;
+			     i++, lfi = &lf->fields[i]) {
+				unsigned int c;
+
+				for (c = 0; c < lf->num_cpus; c++) {
+					if (i == 0)
+						lfi->cpu_result[c] =
+							lfi->cpu_values[cur][c];
+					else
+						lfi->cpu_result[c] =
+							(lfi->cpu_values[cur][c] -
+							 lfi->cpu_values[prev][c])
 							/ lf->interval.tv_sec;
+				}
 			}
 
-			scan_lines(lf, 0);
+			lf->cur = prev;
 		}
 	}
 
 	return 0;
 }
 
+/* Keep the per-CPU rows of all files, on top of their sums. */
+int lnstat_set_per_cpu(struct lnstat_file *lnstat_files)
+{
+	struct lnstat_file *lf;
+
+	for (lf = lnstat_files; lf; lf = lf->next) {
+		lf->per_cpu = 1;
+		if (grow_cpus(lf, 1) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* The kernel prints one row per possible CPU, map a row to its CPU. */
+int lnstat_cpu_id(unsigned int row)
+{
+	static int *ids;
+	static unsigned int num_ids;
+	static int probed;
+
+	if (!probed) {
+		FILE *fp = fopen("/sys/devices/system/cpu/possible", "r");
+		unsigned int lo, hi, max = 0;
+		int c;
+
+		probed = 1;
+		while (fp && fscanf(fp, "%u", &lo) == 1) {
+			hi = lo;
+			c = fgetc(fp);
+			if (c == '-') {
+				if (fscanf(fp, "%u", &hi) != 1)
+					break;
+				c = fgetc(fp);
+			}
+			for (; lo <= hi; lo++) {
+				if (num_ids == max) {
+					int *n;
+
+					max = max ? 2 * max : 64;
+					n = realloc(ids, max * sizeof(*n));
+					if (!n)
+						goto out;
+					ids = n;
+				}
+				ids[num_ids++] = lo;
+			}
+			if (c != ',')
+				break;
+		}
+out:
+		if (fp)
+			fclose(fp);
+	}
+
+	return row < num_ids ? ids[row] : row;
+}
+
 /* scan first template line and fill in per-field data structures */
 static int __lnstat_scan_fields(struct lnstat_file *lf, char *buf)
 {
@@ -27,6 +27,8 @@
 #include "json_print.h"
 #include "version.h"
 #include "utils.h"
+#include "stat_shm.h"
+#include "stat_hist.h"
 
 int dump_zeros;
 int reset_history;
@@ -34,6 +36,7 @@ int ignore_history;
 int no_output;
 int json_output;
 int no_update;
+int publish_shm;
 int scan_interval;
 int time_constant;
 double W;
@@ -103,11 +106,16 @@ static int match(const char *id)
 	return 0;
 }
 
-static void load_good_table(FILE *fp)
+typedef void (*nstat_cb_t)(void *arg, unsigned int pos, const char *id,
+			   unsigned long long val, double rate);
+
+/* The scanners report each counter with its position in the table, which
+ * counts the useless ones too, so that positions follow the file layout.
+ */
+static void scan_good_table(FILE *fp, nstat_cb_t cb, void *arg)
 {
 	char buf[4096];
-	struct nstat_ent *db = NULL;
-	struct nstat_ent *n;
+	unsigned int pos = 0;
 
 	while (fgets(buf, sizeof(buf), fp) != NULL) {
 		int nr;
@@ -131,50 +139,23 @@ static void load_good_table(FILE *fp)
 		}
 		if (nr < 3)
 			rate = 0;
-		if (useless_number(idbuf))
-			continue;
-		if ((n = malloc(sizeof(*n))) == NULL) {
-			perror("nstat: malloc");
-			exit(-1);
-		}
-		n->id = strdup(idbuf);
-		n->val = val;
-		n->rate = rate;
-		n->next = db;
-		db = n;
-	}
-
-	while (db) {
-		n = db;
-		db = db->next;
-		n->next = kern_db;
-		kern_db = n;
+		if (!useless_number(idbuf))
+			cb(arg, pos, idbuf, val, rate);
+		pos++;
 	}
 }
 
-static int count_spaces(const char *line)
+static void scan_ugly_table(FILE *fp, nstat_cb_t cb, void *arg)
 {
-	int count = 0;
-	char c;
+	static char *buf, *vbuf;
+	static size_t buflen, vbuflen;
+	unsigned int pos = 0;
 
-	while ((c = *line++) != 0)
-		count += c == ' ' || c == '\n';
-	return count;
-}
-
-static void load_ugly_table(FILE *fp)
-{
-	char *buf = NULL;
-	size_t buflen = 0;
-	ssize_t nread;
-	struct nstat_ent *db = NULL;
-	struct nstat_ent *n;
-
-	while ((nread = getline(&buf, &buflen, fp)) != -1) {
+	while (getline(&buf, &buflen, fp) != -1) {
 		char idbuf[4096];
-		int  off;
-		char *p;
-		int count1, count2, skip = 0;
+		char *name, *val, *p, *q;
+		char *nsave, *vsave;
+		int off;
 
 		p = strchr(buf, ':');
 		if (!p) {
@@ -182,136 +163,163 @@ static void load_ugly_table(FILE *fp)
 				__FILE__, __LINE__);
 			exit(-2);
 		}
-		count1 = count_spaces(buf);
 		*p = 0;
 		idbuf[0] = 0;
 		strncat(idbuf, buf, sizeof(idbuf) - 1);
 		off = p - buf;
-		p += 2;
-
-		while (*p) {
-			char *next;
 
-			if ((next = strchr(p, ' ')) != NULL)
-				*next++ = 0;
-			else if ((next = strchr(p, '\n')) != NULL)
-				*next++ = 0;
-			if (off < sizeof(idbuf)) {
-				idbuf[off] = 0;
-				strncat(idbuf, p, sizeof(idbuf) - off - 1);
-			}
-			n = malloc(sizeof(*n));
-			if (!n) {
-				perror("nstat: malloc");
-				exit(-1);
-			}
-			n->id = strdup(idbuf);
-			if (n->id == NULL) {
-				perror("nstat: strdup");
-				exit(-1);
-			}
-			n->rate = 0;
-			n->next = db;
-			db = n;
-			if (next == NULL)
-				break;
-			p = next;
-		}
-		n = db;
-		if (n == NULL) {
+		name = strtok_r(p + 1, " \n", &nsave);
+		if (name == NULL) {
 			fprintf(stderr, "Error: Invalid input – line has ':' but no entries. Add values after ':'.\n");
 			exit(-2);
 		}
-		nread = getline(&buf, &buflen, fp);
-		if (nread == -1) {
+		if (getline(&vbuf, &vbuflen, fp) == -1 ||
+		    (q = strchr(vbuf, ':')) == NULL) {
 			fprintf(stderr, "%s:%d: error parsing history file\n",
 				__FILE__, __LINE__);
 			exit(-2);
 		}
-		count2 = count_spaces(buf);
-		if (count2 > count1)
-			skip = count2 - count1;
-		do {
-			p = strrchr(buf, ' ');
-			if (!p) {
+
+		/* Values past the last name are ignored, this skips the
+		 * "dummy" trailing ICMP MIB in 2.4.
+		 */
+		for (val = strtok_r(q + 1, " \n", &vsave); name;
+		     name = strtok_r(NULL, " \n", &nsave),
+		     val = strtok_r(NULL, " \n", &vsave), pos++) {
+			unsigned long long v;
+			char *end;
+
+			if (!val) {
 				fprintf(stderr, "%s:%d: error parsing history file\n",
 					__FILE__, __LINE__);
 				exit(-2);
 			}
-			*p = 0;
-			if (sscanf(p+1, "%llu", &n->val) != 1) {
+			v = strtoull(val, &end, 10);
+			if (end == val || *end) {
 				fprintf(stderr, "%s:%d: error parsing history file\n",
 					__FILE__, __LINE__);
 				exit(-2);
 			}
-			/* Trick to skip "dummy" trailing ICMP MIB in 2.4 */
-			if (skip)
-				skip--;
-			else
-				n = n->next;
-		} while (p > buf + off + 2);
-	}
-	free(buf);
-
-	while (db) {
-		n = db;
-		db = db->next;
-		if (useless_number(n->id)) {
-			free(n->id);
-			free(n);
-		} else {
-			n->next = kern_db;
-			kern_db = n;
+			if (off < sizeof(idbuf)) {
+				idbuf[off] = 0;
+				strncat(idbuf, name, sizeof(idbuf) - off - 1);
+			}
+			if (!useless_number(idbuf))
+				cb(arg, pos, idbuf, v, 0);
 		}
 	}
 }
 
-static void load_sctp_snmp(void)
+static void add_ent(void *arg, unsigned int pos, const char *id,
+		    unsigned long long val, double rate)
 {
-	FILE *fp = net_sctp_snmp_open();
+	struct nstat_ent ***tail = arg;
+	struct nstat_ent *n;
 
-	if (fp) {
-		load_good_table(fp);
-		fclose(fp);
+	if ((n = malloc(sizeof(*n))) == NULL) {
+		perror("nstat: malloc");
+		exit(-1);
+	}
+	n->id = strdup(id);
+	if (n->id == NULL) {
+		perror("nstat: strdup");
+		exit(-1);
 	}
+	n->val = val;
+	n->rate = rate;
+	n->next = NULL;
+	**tail = n;
+	*tail = &n->next;
 }
 
-static void load_snmp(void)
+/* The entries of a table are put in front of kern_db, in file order. */
+static void load_table(FILE *fp,
+		       void (*scan)(FILE *fp, nstat_cb_t cb, void *arg))
 {
-	FILE *fp = net_snmp_open();
+	struct nstat_ent *db = NULL;
+	struct nstat_ent **tail = &db;
 
-	if (fp) {
-		load_ugly_table(fp);
-		fclose(fp);
-	}
+	scan(fp, add_ent, &tail);
+	*tail = kern_db;
+	kern_db = db;
 }
 
-static void load_snmp6(void)
+static void load_good_table(FILE *fp)
 {
-	FILE *fp = net_snmp6_open();
+	load_table(fp, scan_good_table);
+}
 
-	if (fp) {
+/* A binary history is a copy of kern_db as records, ids longer than the
+ * record's are not kept. Text histories of older versions are still read.
+ */
+struct nstat_hist_rec {
+	char		id[64];
+	__u64		val;
+	double		rate;
+};
+
+static void load_hist_db(FILE *fp)
+{
+	struct nstat_ent *db = NULL;
+	struct nstat_ent **tail = &db;
+	const struct nstat_hist_rec *r;
+	struct stat_hist h;
+	size_t i;
+
+	switch (stat_hist_map(fileno(fp), STAT_HIST_NSTAT, sizeof(*r), &h)) {
+	case 1:
 		load_good_table(fp);
-		fclose(fp);
+		return;
+	case -1:
+		fprintf(stderr, "nstat: history file is damaged or of another version, ignoring it.\n");
+		return;
+	}
+
+	if (info_source[0] && strcmp(info_source, h.source))
+		source_mismatch = 1;
+	strlcpy(info_source, h.source, sizeof(info_source));
+
+	for (r = h.data, i = 0; i < h.count; i++, r++) {
+		char id[sizeof(r->id) + 1];
+
+		memcpy(id, r->id, sizeof(r->id));
+		id[sizeof(r->id)] = 0;
+		add_ent(&tail, i, id, r->val, r->rate);
 	}
+	*tail = kern_db;
+	kern_db = db;
+	stat_hist_unmap(&h);
 }
 
-static void load_netstat(void)
+static const struct nstat_table {
+	FILE *(*open)(void);
+	void (*scan)(FILE *fp, nstat_cb_t cb, void *arg);
+	bool paired;	/* lines of names and values alternate */
+} kern_tables[] = {
+	{ net_netstat_open,	scan_ugly_table,	true },
+	{ net_snmp6_open,	scan_good_table,	false },
+	{ net_snmp_open,	scan_ugly_table,	true },
+	{ net_sctp_snmp_open,	scan_good_table,	false },
+};
+
+static void load_kern_db(void)
 {
-	FILE *fp = net_netstat_open();
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kern_tables); i++) {
+		FILE *fp = kern_tables[i].open();
 
-	if (fp) {
-		load_ugly_table(fp);
-		fclose(fp);
+		if (fp) {
+			load_table(fp, kern_tables[i].scan);
+			fclose(fp);
+		}
 	}
 }
 
-
-static void dump_kern_db(FILE *fp, int to_hist)
+static void dump_kern_db(FILE *fp)
 {
-	struct nstat_ent *n, *h;
+	struct nstat_ent *n;
 
-	h = hist_db;
 	new_json_obj_plain(json_output);
 	if (is_json_context()) {
 		open_json_object(NULL);
@@ -319,6 +327,42 @@ static void dump_kern_db(FILE *fp, int to_hist)
 	} else
 		fprintf(fp, "#%s\n", info_source);
 
+	for (n = kern_db; n; n = n->next) {
+		unsigned long long val = n->val;
+
+		if (!dump_zeros && !val && !n->rate)
+			continue;
+		if (!match(n->id))
+			continue;
+
+		if (is_json_context())
+			print_lluint(PRINT_JSON, n->id, NULL, val);
+		else
+			fprintf(fp, "%-32s%-16llu%6.1f\n", n->id, val, n->rate);
+	}
+
+	if (is_json_context()) {
+		close_json_object();
+		close_json_object();
+	}
+	delete_json_obj_plain();
+}
+
+/* Counters not matching the patterns keep their value from the history */
+static void save_hist_db(const char *path)
+{
+	struct nstat_ent *n, *h = hist_db;
+	struct nstat_hist_rec *recs;
+	size_t count = 0, size = 0;
+
+	for (n = kern_db; n; n = n->next)
+		size++;
+	recs = calloc(size ? : 1, sizeof(*recs));
+	if (!recs) {
+		perror("nstat: calloc");
+		return;
+	}
+
 	for (n = kern_db; n; n = n->next) {
 		unsigned long long val = n->val;
 
@@ -327,8 +371,6 @@ static void dump_kern_db(FILE *fp, int to_hist)
 		if (!match(n->id)) {
 			struct nstat_ent *h1;
 
-			if (!to_hist)
-				continue;
 			for (h1 = h; h1; h1 = h1->next) {
 				if (strcmp(h1->id, n->id) == 0) {
 					val = h1->val;
@@ -337,18 +379,19 @@ static void dump_kern_db(FILE *fp, int to_hist)
 				}
 			}
 		}
+		if (strlen(n->id) >= sizeof(recs->id))
+			continue;
 
-		if (is_json_context())
-			print_lluint(PRINT_JSON, n->id, NULL, val);
-		else
-			fprintf(fp, "%-32s%-16llu%6.1f\n", n->id, val, n->rate);
+		strcpy(recs[count].id, n->id);
+		recs[count].val = val;
+		recs[count].rate = n->rate;
+		count++;
 	}
 
-	if (is_json_context()) {
-		close_json_object();
-		close_json_object();
-	}
-	delete_json_obj_plain();
+	if (stat_hist_write(path, STAT_HIST_NSTAT, info_source, recs,
+			    sizeof(*recs), count))
+		perror("nstat: write history file");
+	free(recs);
 }
 
 static void dump_incr_db(FILE *fp)
@@ -404,63 +447,378 @@ static void sigchild(int signo)
 {
 }
 
-static void update_db(int interval)
+/* State of the daemon's scans of a kernel table. The table is kept open
+ * and read whole with pread(). kern_db entries are indexed by position
+ * in the table, so that rescans update them in place. A slot is filled
+ * by an id lookup on the first scan and whenever the table's layout
+ * changes, as before counters that were not there when the daemon
+ * started are ignored.
+ *
+ * The layout is cached as the header lines of a paired table, or the
+ * ids of the other ones, each followed by a newline. While it matches,
+ * the values are picked out of the table without building any ids.
+ */
+static struct nstat_index {
+	FILE			*fp;
+	struct nstat_ent	**ents;
+	unsigned int		nr;
+	char			*layout;
+	size_t			layout_len;
+	unsigned int		*ncols;		/* per header line */
+	unsigned int		nlines;
+} kern_index[ARRAY_SIZE(kern_tables)];
+
+struct nstat_update {
+	struct nstat_index	*idx;
+	int			interval;
+};
+
+static char *scan_buf;
+static size_t scan_buf_size;
+
+static ssize_t read_table(FILE *fp)
 {
-	struct nstat_ent *n, *h;
+	int fd = fileno(fp);
+	size_t len = 0;
+	ssize_t n;
 
-	n = kern_db;
-	kern_db = NULL;
+	for (;;) {
+		if (len + 1 >= scan_buf_size) {
+			size_t size = scan_buf_size ? 2 * scan_buf_size : 16384;
+			char *buf = realloc(scan_buf, size);
 
-	load_netstat();
-	load_snmp6();
-	load_snmp();
-	load_sctp_snmp();
+			if (!buf) {
+				perror("nstat: realloc");
+				exit(-1);
+			}
+			scan_buf = buf;
+			scan_buf_size = size;
+		}
+		n = pread(fd, scan_buf + len, scan_buf_size - len - 1, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+	scan_buf[len] = 0;
+	return len;
+}
 
-	h = kern_db;
-	kern_db = n;
+static struct nstat_ent *kern_db_lookup(const char *id)
+{
+	struct nstat_ent *n;
 
-	for (n = kern_db; n; n = n->next) {
-		struct nstat_ent *h1;
+	for (n = kern_db; n; n = n->next)
+		if (strcmp(n->id, id) == 0)
+			return n;
+	return NULL;
+}
 
-		for (h1 = h; h1; h1 = h1->next) {
-			if (strcmp(h1->id, n->id) == 0) {
-				double sample;
-				unsigned long long incr = h1->val - n->val;
-
-				n->val = h1->val;
-				sample = (double)incr * 1000.0 / interval;
-				if (interval >= scan_interval) {
-					n->rate += W*(sample-n->rate);
-				} else if (interval >= 1000) {
-					if (interval >= time_constant) {
-						n->rate = sample;
-					} else {
-						double w = W*(double)interval/scan_interval;
-
-						n->rate += w*(sample-n->rate);
-					}
-				}
+static void update_rate(struct nstat_ent *n, unsigned long long val,
+			int interval)
+{
+	unsigned long long incr = val - n->val;
+	double sample;
+
+	n->val = val;
+	sample = (double)incr * 1000.0 / interval;
+	if (interval >= scan_interval) {
+		n->rate += W*(sample-n->rate);
+	} else if (interval >= 1000) {
+		if (interval >= time_constant) {
+			n->rate = sample;
+		} else {
+			double w = W*(double)interval/scan_interval;
 
-				while (h != h1) {
-					struct nstat_ent *tmp = h;
+			n->rate += w*(sample-n->rate);
+		}
+	}
+}
 
-					h = h->next;
-					free(tmp->id);
-					free(tmp);
-				};
-				h = h1->next;
-				free(h1->id);
-				free(h1);
-				break;
+static void update_ent(void *arg, unsigned int pos, const char *id,
+		       unsigned long long val, double rate)
+{
+	struct nstat_update *u = arg;
+	struct nstat_index *idx = u->idx;
+	struct nstat_ent *n = pos < idx->nr ? idx->ents[pos] : NULL;
+
+	if (!n || strcmp(n->id, id)) {
+		if (pos >= idx->nr) {
+			unsigned int nr = 2 * pos + 16;
+			struct nstat_ent **ents;
+
+			ents = realloc(idx->ents, nr * sizeof(*ents));
+			if (!ents) {
+				perror("nstat: realloc");
+				exit(-1);
+			}
+			memset(ents + idx->nr, 0,
+			       (nr - idx->nr) * sizeof(*ents));
+			idx->ents = ents;
+			idx->nr = nr;
+		}
+		n = idx->ents[pos] = kern_db_lookup(id);
+		if (!n)
+			return;
+	}
+
+	update_rate(n, val, u->interval);
+}
+
+static void layout_add(struct nstat_index *idx, const char *s, size_t len)
+{
+	char *layout = realloc(idx->layout, idx->layout_len + len + 1);
+
+	if (!layout) {
+		perror("nstat: realloc");
+		exit(-1);
+	}
+	memcpy(layout + idx->layout_len, s, len);
+	layout[idx->layout_len + len] = '\n';
+	idx->layout = layout;
+	idx->layout_len += len + 1;
+}
+
+static void cache_layout(struct nstat_index *idx, const char *buf, bool paired)
+{
+	const char *p = buf;
+
+	idx->layout_len = 0;
+	idx->nlines = 0;
+
+	while (*p) {
+		const char *eol = strchrnul(p, '\n');
+		size_t len = strcspn(p, paired ? "\n" : " \t\n");
+
+		layout_add(idx, p, len);
+		if (paired) {
+			unsigned int *ncols;
+			unsigned int n = 0;
+			const char *c;
+
+			for (c = memchr(p, ':', len); c && c < eol; c++)
+				if (*c == ' ' && c + 1 < eol && c[1] != ' ')
+					n++;
+			ncols = realloc(idx->ncols,
+					(idx->nlines + 1) * sizeof(*ncols));
+			if (!ncols) {
+				perror("nstat: realloc");
+				exit(-1);
 			}
+			idx->ncols = ncols;
+			idx->ncols[idx->nlines++] = n;
+
+			/* skip the value line */
+			if (*eol)
+				eol = strchrnul(eol + 1, '\n');
+		}
+		p = *eol ? eol + 1 : eol;
+	}
+}
+
+/* Single pass integer scanner for values, negative ones wrap around just
+ * like with strtoull().
+ */
+static const char *scan_value(const char *p, unsigned long long *val)
+{
+	unsigned long long v = 0;
+	bool neg = false;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == '-') {
+		neg = true;
+		p++;
+	}
+	if (*p < '0' || *p > '9')
+		return NULL;
+	while (*p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
+	*val = neg ? -v : v;
+	return p;
+}
+
+static void update_slot(struct nstat_index *idx, unsigned int pos,
+			unsigned long long val, int interval)
+{
+	if (pos < idx->nr && idx->ents[pos])
+		update_rate(idx->ents[pos], val, interval);
+}
+
+static int fast_update_paired(struct nstat_index *idx, const char *buf,
+			      int interval)
+{
+	const char *l = idx->layout, *p = buf;
+	unsigned int line, col, pos = 0;
+
+	/* All the header lines have to match before anything is updated */
+	for (line = 0; *p; line++) {
+		const char *eol = strchrnul(p, '\n');
+		size_t len = eol - p;
+
+		if (line >= idx->nlines ||
+		    l + len >= idx->layout + idx->layout_len ||
+		    memcmp(p, l, len) || l[len] != '\n' || !*eol)
+			return -1;
+		l += len + 1;
+		eol = strchrnul(eol + 1, '\n');
+		p = *eol ? eol + 1 : eol;
+	}
+	if (line != idx->nlines)
+		return -1;
+
+	for (p = buf, line = 0; *p; line++) {
+		const char *eol;
+
+		p = strchrnul(p, '\n') + 1;
+		eol = strchrnul(p, '\n');
+		p = memchr(p, ':', eol - p);
+		if (!p)
+			return -1;
+		p++;
+		for (col = 0; col < idx->ncols[line]; col++, pos++) {
+			unsigned long long val;
+
+			p = scan_value(p, &val);
+			if (!p)
+				return -1;
+			update_slot(idx, pos, val, interval);
 		}
+		p = strchrnul(p, '\n');
+		if (*p)
+			p++;
+	}
+	return 0;
+}
+
+static int fast_update_good(struct nstat_index *idx, const char *buf,
+			    int interval)
+{
+	const char *l = idx->layout, *p;
+	unsigned int pos;
+
+	for (p = buf; *p; ) {
+		size_t len = strcspn(p, " \t\n");
+
+		if (l + len >= idx->layout + idx->layout_len ||
+		    memcmp(p, l, len) || l[len] != '\n')
+			return -1;
+		l += len + 1;
+		p = strchrnul(p, '\n');
+		if (*p)
+			p++;
+	}
+	if (l != idx->layout + idx->layout_len)
+		return -1;
+
+	for (p = buf, pos = 0; *p; pos++) {
+		unsigned long long val;
+
+		p += strcspn(p, " \t\n");
+		p = scan_value(p, &val);
+		if (!p)
+			return -1;
+		update_slot(idx, pos, val, interval);
+		p = strchrnul(p, '\n');
+		if (*p)
+			p++;
+	}
+	return 0;
+}
+
+static void update_table(int i, int interval)
+{
+	const struct nstat_table *t = &kern_tables[i];
+	struct nstat_index *idx = &kern_index[i];
+	struct nstat_update u = {
+		.idx = idx,
+		.interval = interval,
+	};
+	FILE *fp;
+
+	if (!idx->fp && (idx->fp = t->open()) == NULL)
+		return;
+	if (read_table(idx->fp) < 0)
+		return;
+
+	if (idx->layout_len) {
+		if (t->paired ? !fast_update_paired(idx, scan_buf, interval) :
+				!fast_update_good(idx, scan_buf, interval))
+			return;
+	}
+
+	/* First scan, or the layout changed */
+	fp = fmemopen(scan_buf, strlen(scan_buf), "r");
+	if (!fp) {
+		perror("nstat: fmemopen");
+		exit(-1);
+	}
+	t->scan(fp, update_ent, &u);
+	fclose(fp);
+	cache_layout(idx, scan_buf, t->paired);
+}
+
+static void update_db(int interval)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kern_tables); i++)
+		update_table(i, interval);
+}
+
+static void shm_name(char *name, size_t len, uid_t uid)
+{
+	if (getenv("NSTAT_SHM"))
+		snprintf(name, len, "%s", getenv("NSTAT_SHM"));
+	else
+		snprintf(name, len, "/dev/shm/nstat.u%d", uid);
+}
+
+/* Snapshots carry the same text clients get from the daemon's socket. */
+static void publish_kern_db(struct stat_shm *shm)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = open_memstream(&buf, &len);
+	if (!fp)
+		return;
+	dump_kern_db(fp);
+	fclose(fp);
+	stat_shm_publish(shm, buf, len);
+	free(buf);
+}
+
+static FILE *shm_snapshot_open(char **snap)
+{
+	char name[128];
+	size_t len;
+	FILE *fp;
+
+	shm_name(name, sizeof(name), getuid());
+	*snap = stat_shm_read(name, &len);
+	if (!*snap && !getenv("NSTAT_SHM")) {
+		shm_name(name, sizeof(name), 0);
+		*snap = stat_shm_read(name, &len);
 	}
+	if (!*snap)
+		return NULL;
+
+	fp = fmemopen(*snap, len, "r");
+	if (!fp)
+		free(*snap);
+	return fp;
 }
 
 #define T_DIFF(a, b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
 
 
-static void server_loop(int fd)
+static void server_loop(int fd, struct stat_shm *shm)
 {
 	struct timeval snaptime = { 0 };
 	struct pollfd p;
@@ -471,10 +829,7 @@ static void server_loop(int fd)
 	snprintf(info_source, sizeof(info_source), "%d.%lu sampling_interval=%d time_const=%d",
 		getpid(), (unsigned long)random(), scan_interval/1000, time_constant/1000);
 
-	load_netstat();
-	load_snmp6();
-	load_snmp();
-	load_sctp_snmp();
+	load_kern_db();
 
 	for (;;) {
 		int status;
@@ -485,6 +840,8 @@ static void server_loop(int fd)
 		tdiff = T_DIFF(now, snaptime);
 		if (tdiff >= scan_interval) {
 			update_db(tdiff);
+			if (shm)
+				publish_kern_db(shm);
 			snaptime = now;
 			tdiff = 0;
 		}
@@ -505,7 +862,7 @@ static void server_loop(int fd)
 					FILE *fp = fdopen(clnt, "w");
 
 					if (fp)
-						dump_kern_db(fp, 0);
+						dump_kern_db(fp);
 					exit(0);
 				}
 			}
@@ -538,6 +895,7 @@ static void usage(void)
 		"   -a, --ignore        ignore history\n"
 		"   -d, --scan=SECS     sample every statistics every SECS\n"
 		"   -j, --json          format output in JSON\n"
+		"   -m, --shm           with -d, also publish snapshots in shared memory\n"
 		"   -n, --nooutput      do history only\n"
 		"   -p, --pretty        pretty print\n"
 		"   -r, --reset         reset history\n"
@@ -554,6 +912,7 @@ static const struct option longopts[] = {
 	{ "scan", 1, 0, 'd'},
 	{ "nooutput", 0, 0, 'n' },
 	{ "json", 0, 0, 'j' },
+	{ "shm", 0, 0, 'm' },
 	{ "reset", 0, 0, 'r' },
 	{ "noupdate", 0, 0, 's' },
 	{ "pretty", 0, 0, 'p' },
@@ -568,10 +927,12 @@ int main(int argc, char *argv[])
 	char hist_name[128];
 	struct sockaddr_un sun;
 	FILE *hist_fp = NULL;
+	FILE *sfp;
+	char *snap;
 	int ch;
 	int fd;
 
-	while ((ch = getopt_long(argc, argv, "h?vVzrnasd:t:jp",
+	while ((ch = getopt_long(argc, argv, "h?vVzrnasd:t:jpm",
 				 longopts, NULL)) != EOF) {
 		switch (ch) {
 		case 'z':
@@ -602,6 +963,9 @@ int main(int argc, char *argv[])
 		case 'j':
 			json_output = 1;
 			break;
+		case 'm':
+			publish_shm = 1;
+			break;
 		case 'p':
 			pretty = 1;
 			break;
@@ -624,6 +988,8 @@ int main(int argc, char *argv[])
 	snprintf(sun.sun_path + 1, sizeof(sun.sun_path) - 1, "nstat%d", getuid());
 
 	if (scan_interval > 0) {
+		struct stat_shm *shm = NULL;
+
 		if (time_constant == 0)
 			time_constant = 60;
 		time_constant *= 1000;
@@ -640,13 +1006,24 @@ int main(int argc, char *argv[])
 			perror("nstat: listen");
 			exit(-1);
 		}
+		if (publish_shm) {
+			char name[128];
+
+			shm_name(name, sizeof(name), getuid());
+			shm = stat_shm_create(name);
+			if (!shm) {
+				fprintf(stderr, "nstat: cannot create %s: %s\n",
+					name, strerror(errno));
+				exit(-1);
+			}
+		}
 		if (daemon(0, 0)) {
 			perror("nstat: daemon");
 			exit(-1);
 		}
 		signal(SIGPIPE, SIG_IGN);
 		signal(SIGCHLD, sigchild);
-		server_loop(fd);
+		server_loop(fd, shm);
 		exit(0);
 	}
 
@@ -665,7 +1042,7 @@ int main(int argc, char *argv[])
 	if (!ignore_history || !no_update) {
 		struct stat stb;
 
-		fd = open(hist_name, O_RDWR|O_CREAT|O_NOFOLLOW, 0600);
+		fd = stat_hist_open(hist_name);
 		if (fd < 0) {
 			perror("nstat: open history file");
 			exit(-1);
@@ -674,10 +1051,6 @@ int main(int argc, char *argv[])
 			perror("nstat: fdopen history file");
 			exit(-1);
 		}
-		if (flock(fileno(hist_fp), LOCK_EX)) {
-			perror("nstat: flock history file");
-			exit(-1);
-		}
 		if (fstat(fileno(hist_fp), &stb) != 0) {
 			perror("nstat: fstat history file");
 			exit(-1);
@@ -702,19 +1075,26 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		load_good_table(hist_fp);
+		load_hist_db(hist_fp);
 
 		hist_db = kern_db;
 		kern_db = NULL;
 	}
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
+	if ((sfp = shm_snapshot_open(&snap)) != NULL) {
+		load_good_table(sfp);
+		if (hist_db && source_mismatch) {
+			fprintf(stderr, "nstat: history is stale, ignoring it.\n");
+			hist_db = NULL;
+		}
+		fclose(sfp);
+		free(snap);
+	} else if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
 	    (connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0
 	     || (strcpy(sun.sun_path+1, "nstat0"),
 		 connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
 	    && verify_forging(fd) == 0) {
-		FILE *sfp = fdopen(fd, "r");
-
+		sfp = fdopen(fd, "r");
 		if (!sfp) {
 			fprintf(stderr, "nstat: fdopen failed: %s\n",
 				strerror(errno));
@@ -735,27 +1115,20 @@ int main(int argc, char *argv[])
 			hist_db = NULL;
 			info_source[0] = 0;
 		}
-		load_netstat();
-		load_snmp6();
-		load_snmp();
-		load_sctp_snmp();
+		load_kern_db();
 		if (info_source[0] == 0)
 			strcpy(info_source, "kernel");
 	}
 
 	if (!no_output) {
 		if (ignore_history || hist_db == NULL)
-			dump_kern_db(stdout, 0);
+			dump_kern_db(stdout);
 		else
 			dump_incr_db(stdout);
 	}
 	if (!no_update) {
-		if (ftruncate(fileno(hist_fp), 0) < 0)
-			perror("nstat: ftruncate");
-		rewind(hist_fp);
-
-		json_output = 0;
-		dump_kern_db(hist_fp, 1);
+		/* the lock is held until the new history is in place */
+		save_hist_db(hist_name);
 		fclose(hist_fp);
 	}
 	exit(0);
@@ -24,6 +24,7 @@
 #include <math.h>
 
 #include "rt_names.h"
+#include "stat_shm.h"
 
 #include "version.h"
 
@@ -34,6 +35,7 @@ int no_update;
 int scan_interval;
 int time_constant;
 int dump_zeros;
+int publish_shm;
 unsigned long magic_number;
 double W;
 
@@ -88,6 +90,32 @@ static void nread(int fd, char *buf, int tot)
 	}
 }
 
+/* The table is small and read every interval; keep the file open. */
+static int pread_kern_table(__u32 *tbl)
+{
+	static int fd = -1;
+	int count = 0;
+
+	if (fd < 0)
+		fd = net_rtacct_open();
+	if (fd < 0)
+		return -1;
+
+	while (count < 256*16) {
+		int n = pread(fd, (char *)tbl + count, 256*16 - count, count);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			exit(-1);
+		}
+		if (n == 0)
+			exit(-1);
+		count += n;
+	}
+	return 0;
+}
+
 static __u32 *read_kern_table(__u32 *tbl)
 {
 	static __u32 *tbl_ptr;
@@ -114,13 +142,8 @@ static __u32 *read_kern_table(__u32 *tbl)
 		return tbl_ptr;
 	}
 
-	fd = net_rtacct_open();
-	if (fd >= 0) {
-		nread(fd, (char *)tbl, 256*16);
-		close(fd);
-	} else {
+	if (pread_kern_table(tbl) < 0)
 		memset(tbl, 0, 256*16);
-	}
 	return tbl;
 }
 
@@ -299,7 +322,7 @@ static void update_db(int interval)
 
 		kern_db->val[i] += incr;
 		kern_db->ival[i] = ival[i];
-		sample = (double)(incr*1000)/interval;
+		sample = (double)incr*1000/interval;
 		if (interval >= scan_interval) {
 			kern_db->rate[i] += W*(sample-kern_db->rate[i]);
 		} else if (interval >= 1000) {
@@ -332,6 +355,38 @@ static void send_db(int fd)
 
 
 
+static void shm_name(char *name, size_t len, uid_t uid)
+{
+	if (getenv("RTACCT_SHM"))
+		snprintf(name, len, "%s", getenv("RTACCT_SHM"));
+	else
+		snprintf(name, len, "/dev/shm/rtacct.u%d", uid);
+}
+
+/* The snapshot is kern_db itself, as sent over the socket. */
+static int shm_snapshot_read(void)
+{
+	char name[128];
+	size_t len;
+	void *snap;
+
+	shm_name(name, sizeof(name), getuid());
+	snap = stat_shm_read(name, &len);
+	if (!snap && !getenv("RTACCT_SHM")) {
+		shm_name(name, sizeof(name), 0);
+		snap = stat_shm_read(name, &len);
+	}
+	if (!snap)
+		return -1;
+	if (len != sizeof(*kern_db)) {
+		free(snap);
+		return -1;
+	}
+	memcpy(kern_db, snap, len);
+	free(snap);
+	return 0;
+}
+
 #define T_DIFF(a, b) (((a).tv_sec-(b).tv_sec)*1000 + ((a).tv_usec-(b).tv_usec)/1000)
 
 
@@ -346,7 +401,7 @@ static void pad_kern_table(struct rtacct_data *dat, __u32 *ival)
 		dat->val[i] = ival[i];
 }
 
-static void server_loop(int fd)
+static void server_loop(int fd, struct stat_shm *shm)
 {
 	struct timeval snaptime = { 0 };
 	struct pollfd p;
@@ -360,6 +415,8 @@ static void server_loop(int fd)
 		scan_interval/1000, time_constant/1000);
 
 	pad_kern_table(kern_db, read_kern_table(kern_db->ival));
+	if (shm)
+		stat_shm_publish(shm, kern_db, sizeof(*kern_db));
 
 	for (;;) {
 		int status;
@@ -370,6 +427,9 @@ static void server_loop(int fd)
 		tdiff = T_DIFF(now, snaptime);
 		if (tdiff >= scan_interval) {
 			update_db(tdiff);
+			if (shm)
+				stat_shm_publish(shm, kern_db,
+						 sizeof(*kern_db));
 			snaptime = now;
 			tdiff = 0;
 		}
@@ -417,7 +477,7 @@ static void usage(void) __attribute__((noreturn));
 static void usage(void)
 {
 	fprintf(stderr,
-"Usage: rtacct [ -h?vVzrnasd:t: ] [ ListOfRealms ]\n"
+"Usage: rtacct [ -h?vVzrnasmd:t: ] [ ListOfRealms ]\n"
 		);
 	exit(-1);
 }
@@ -429,7 +489,7 @@ int main(int argc, char *argv[])
 	int ch;
 	int fd;
 
-	while ((ch = getopt(argc, argv, "h?vVzrM:nasd:t:")) != EOF) {
+	while ((ch = getopt(argc, argv, "h?vVzrM:nasmd:t:")) != EOF) {
 		switch (ch) {
 		case 'z':
 			dump_zeros = 1;
@@ -446,6 +506,9 @@ int main(int argc, char *argv[])
 		case 'n':
 			no_output = 1;
 			break;
+		case 'm':
+			publish_shm = 1;
+			break;
 		case 'd':
 			scan_interval = 1000*atoi(optarg);
 			break;
@@ -498,6 +561,8 @@ int main(int argc, char *argv[])
 	sprintf(sun.sun_path+1, "rtacct%d", getuid());
 
 	if (scan_interval > 0) {
+		struct stat_shm *shm = NULL;
+
 		if (time_constant == 0)
 			time_constant = 60;
 		time_constant *= 1000;
@@ -514,13 +579,24 @@ int main(int argc, char *argv[])
 			perror("rtacct: listen");
 			exit(-1);
 		}
+		if (publish_shm) {
+			char name[128];
+
+			shm_name(name, sizeof(name), getuid());
+			shm = stat_shm_create(name);
+			if (!shm) {
+				fprintf(stderr, "rtacct: cannot create %s: %s\n",
+					name, strerror(errno));
+				exit(-1);
+			}
+		}
 		if (daemon(0, 0)) {
 			perror("rtacct: daemon");
 			exit(-1);
 		}
 		signal(SIGPIPE, SIG_IGN);
 		signal(SIGCHLD, sigchild);
-		server_loop(fd);
+		server_loop(fd, shm);
 		exit(0);
 	}
 
@@ -587,7 +663,13 @@ int main(int argc, char *argv[])
 		close(fd);
 	}
 
-	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
+	if (shm_snapshot_read() == 0) {
+		if (hist_db && hist_db->signature[0] &&
+		    strcmp(kern_db->signature, hist_db->signature)) {
+			fprintf(stderr, "rtacct: history is stale, ignoring it.\n");
+			hist_db = NULL;
+		}
+	} else if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0 &&
 	    (connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0
 	     || (strcpy(sun.sun_path+1, "rtacct0"),
 		 connect(fd, (struct sockaddr *)&sun, 2+1+strlen(sun.sun_path+1)) == 0))
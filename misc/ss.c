@@ -12,7 +12,10 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <string.h>
 #include <errno.h>
@@ -34,6 +37,8 @@
 #include "version.h"
 #include "rt_names.h"
 #include "cg_map.h"
+#include "proc_scan.h"
+#include "resolve.h"
 #include "selinux.h"
 
 #include <linux/tcp.h>
@@ -70,6 +75,12 @@
 #warning "libbpf version 0.6 or later is required, disabling BPF socket-local storage support"
 #undef ENABLE_BPF_SKSTORAGE_SUPPORT
 #endif
+
+/* Socket owners from a BPF task_file iterator, needs bpf_prog_load() */
+#if ((LIBBPF_MAJOR_VERSION > 0) || (LIBBPF_MINOR_VERSION >= 7))
+#define ENABLE_BPF_ITER_SUPPORT
+#include "bpf_util.h"
+#endif
 #endif
 
 #if HAVE_RPC
@@ -111,7 +122,27 @@ static int show_tipcinfo;
 static int show_tos;
 static int show_cgroup;
 static int show_inet_sockopt;
+static int explain_filter;
+static int parallel_dumps;
+static unsigned int interval_ms;
+static const char *export_path;
+static unsigned int mem_report;
+static unsigned int top_n;
+static bool top_info;	/* --by needs tcp_info */
+static unsigned int kill_batch_max;
+static unsigned int kill_rate;
 int oneline;
+int json;
+
+/* Streaming output: column widths are computed once, from the first
+ * stream_rows rows, after that every row is printed as soon as it is
+ * complete. Longer fields seen later are not cut, they just shift the
+ * rest of their row.
+ */
+#define STREAM_ROWS_DEFAULT	100
+static int stream_rows;
+static int stream_rows_buffered;
+static bool stream_widths_fixed;
 
 enum col_id {
 	COL_NETID,
@@ -157,6 +188,25 @@ static struct column columns[] = {
 
 static struct column *current_field = columns;
 
+/* With --parallel, socket tables are dumped by child processes which don't
+ * touch the output buffer: their out(), field_set() and field_next() calls
+ * are recorded to record_fp instead and replayed by the parent, in table
+ * order, so that rows and column widths are the same as with serial dumps.
+ */
+enum {
+	SS_REC_OUT,
+	SS_REC_SET,
+	SS_REC_NEXT,
+};
+
+struct ss_rec {
+	__u16	type;
+	__u16	col;		/* SS_REC_SET */
+	__u32	len;		/* SS_REC_OUT data following */
+};
+
+static FILE *record_fp;
+
 /* Output buffer: chained chunks of BUF_CHUNK bytes. Each field is written to
  * the buffer as a variable size token. A token consists of a 16 bits length
  * field, followed by a string which is not NULL-terminated.
@@ -509,14 +559,97 @@ struct user_ent {
 	char		*socket_ctx;
 };
 
-#define USER_ENT_HASH_SIZE	256
-static struct user_ent *user_ent_hash[USER_ENT_HASH_SIZE];
+/* Owner entries and their strings are carved out of big blocks which
+ * are only freed all together by user_ent_destroy(). Task name and
+ * context are stored once per task and shared by all its sockets.
+ */
+#define USER_ARENA_CHUNK	(64 * 1024)
+
+struct user_arena {
+	struct user_arena *next;
+	size_t		size;
+	size_t		used;
+	char		data[];
+};
+
+static struct user_arena *user_arena;
+
+static void *user_arena_alloc(size_t len)
+{
+	struct user_arena *a = user_arena;
+
+	len = (len + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (!a || a->size - a->used < len) {
+		size_t size = len > USER_ARENA_CHUNK ? len : USER_ARENA_CHUNK;
+
+		a = malloc(sizeof(*a) + size);
+		if (!a) {
+			fprintf(stderr, "ss: failed to malloc buffer\n");
+			abort();
+		}
+		a->next = user_arena;
+		a->size = size;
+		a->used = 0;
+		user_arena = a;
+	}
+
+	a->used += len;
+	return a->data + a->used - len;
+}
+
+static char *user_arena_strdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	return memcpy(user_arena_alloc(len), str, len);
+}
+
+/* The inode hash doubles whenever it holds more entries than buckets */
+#define USER_ENT_HASH_MIN	256
+static struct user_ent **user_ent_hash;
+static unsigned int user_ent_hash_size;
+static unsigned int user_ent_count;
+static bool user_ent_built;
+
+static unsigned int user_ent_hashfn(unsigned int ino)
+{
+	unsigned int val = (ino >> 24) ^ (ino >> 16) ^ (ino >> 8) ^ ino;
+
+	return (val ^ (ino << 8)) & (user_ent_hash_size - 1);
+}
 
-static int user_ent_hashfn(unsigned int ino)
+static void user_ent_hash_resize(unsigned int size)
 {
-	int val = (ino >> 24) ^ (ino >> 16) ^ (ino >> 8) ^ ino;
+	struct user_ent **old = user_ent_hash, **tails;
+	unsigned int i, old_size = user_ent_hash_size;
 
-	return val & (USER_ENT_HASH_SIZE - 1);
+	user_ent_hash = calloc(size, sizeof(*user_ent_hash));
+	tails = calloc(size, sizeof(*tails));
+	if (!user_ent_hash || !tails) {
+		fprintf(stderr, "ss: failed to malloc buffer\n");
+		abort();
+	}
+	user_ent_hash_size = size;
+
+	/* append to keep the order of owners sharing a socket */
+	for (i = 0; i < old_size; i++) {
+		struct user_ent *p, *next;
+
+		for (p = old[i]; p; p = next) {
+			unsigned int h = user_ent_hashfn(p->ino);
+
+			next = p->next;
+			p->next = NULL;
+			if (tails[h])
+				tails[h]->next = p;
+			else
+				user_ent_hash[h] = p;
+			tails[h] = p;
+		}
+	}
+
+	free(tails);
+	free(old);
 }
 
 static void user_ent_add(unsigned int ino, char *task,
@@ -526,53 +659,81 @@ static void user_ent_add(unsigned int ino, char *task,
 {
 	struct user_ent *p, **pp;
 
-	p = malloc(sizeof(struct user_ent));
-	if (!p) {
-		fprintf(stderr, "ss: failed to malloc buffer\n");
-		abort();
-	}
+	if (!user_ent_hash)
+		user_ent_hash_resize(USER_ENT_HASH_MIN);
+	else if (user_ent_count >= user_ent_hash_size)
+		user_ent_hash_resize(2 * user_ent_hash_size);
+
+	p = user_arena_alloc(sizeof(struct user_ent));
 	p->next = NULL;
 	p->ino = ino;
 	p->pid = pid;
 	p->tid = tid;
 	p->fd = fd;
-	p->task = strdup(task);
-	p->task_ctx = strdup(task_ctx);
-	p->socket_ctx = strdup(sock_ctx);
+	p->task = task;
+	p->task_ctx = task_ctx;
+	p->socket_ctx = sock_ctx ? user_arena_strdup(sock_ctx) : NULL;
 
 	pp = &user_ent_hash[user_ent_hashfn(ino)];
 	p->next = *pp;
 	*pp = p;
+	user_ent_count++;
 }
 
 #define MAX_PATH_LEN	1024
 
-static void user_ent_hash_build_task(char *path, int pid, int tid)
+/* State of one walk of the process table */
+struct user_scan {
+	char	root[MAX_PATH_LEN];	/* read by the workers */
+	char	*task, *task_ctx;	/* strings of the last collected task */
+	int	pid, tid;
+};
+
+/* One socket fd of a task, as passed from the /proc scanner workers */
+struct user_rec {
+	unsigned int	ino;
+	int		pid;
+	int		tid;
+	int		fd;
+	unsigned short	task_ctx_off;	/* offsets into str[] */
+	unsigned short	sock_ctx_off;	/* 0: no context */
+	char		str[];		/* task name first */
+};
+
+#define USER_REC_STR_MAX	1024
+
+static int user_rec_add_str(struct user_rec *rec, int *len, const char *str)
+{
+	int off = *len;
+
+	*len += strlcpy(rec->str + off, str, USER_REC_STR_MAX - off) + 1;
+	if (*len > USER_REC_STR_MAX)
+		*len = USER_REC_STR_MAX;
+	return off;
+}
+
+static void user_ent_visit(int dirfd, int pid, int tid,
+			   struct proc_scan_buf *out, void *arg)
 {
+	const struct user_scan *scan = arg;
 	const char *no_ctx = "unavailable";
-	char task[20] = { };
-	int pos_id, pos_fd;
-	char *task_context;
+	char buf[sizeof(struct user_rec) + USER_REC_STR_MAX];
+	struct user_rec *rec = (struct user_rec *)buf;
+	int fdfd, len = 0, task_len = 0;
 	struct dirent *d;
 	DIR *dir;
 
-	if (getpidcon(tid, &task_context) != 0)
-		task_context = strdup(no_ctx);
-
-	pos_id = strlen(path);	/* $PROC_ROOT/$ID/ */
-
-	snprintf(path + pos_id, MAX_PATH_LEN - pos_id, "fd/");
-	dir = opendir(path);
+	fdfd = openat(dirfd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fdfd < 0)
+		return;
+	dir = fdopendir(fdfd);
 	if (!dir) {
-		freecon(task_context);
+		close(fdfd);
 		return;
 	}
 
-	pos_fd = strlen(path);	/* $PROC_ROOT/$ID/fd/ */
-
 	while ((d = readdir(dir)) != NULL) {
 		const char *pattern = "socket:[";
-		char *sock_context;
 		unsigned int ino;
 		ssize_t link_len;
 		char lnk[64];
@@ -581,9 +742,7 @@ static void user_ent_hash_build_task(char *path, int pid, int tid)
 		if (sscanf(d->d_name, "%d%*c", &fd) != 1)
 			continue;
 
-		snprintf(path + pos_fd, MAX_PATH_LEN - pos_fd, "%d", fd);
-
-		link_len = readlink(path, lnk, sizeof(lnk) - 1);
+		link_len = readlinkat(fdfd, d->d_name, lnk, sizeof(lnk) - 1);
 		if (link_len == -1)
 			continue;
 		lnk[link_len] = '\0';
@@ -594,105 +753,370 @@ static void user_ent_hash_build_task(char *path, int pid, int tid)
 		if (sscanf(lnk, "socket:[%u]", &ino) != 1)
 			continue;
 
-		if (getfilecon(path, &sock_context) <= 0)
-			sock_context = strdup(no_ctx);
-
-		if (task[0] == '\0') {
-			char stat[MAX_PATH_LEN];
-			char name[16];
+		/* task name and context are looked up once per task */
+		if (!task_len) {
+			char name[16], esc[20] = { };
+			int statfd;
 			FILE *fp;
 
-			strlcpy(stat, path, pos_id + 1);
-			snprintf(stat + pos_id, sizeof(stat) - pos_id, "stat");
-
-			fp = fopen(stat, "r");
+			statfd = openat(dirfd, "stat", O_RDONLY | O_CLOEXEC);
+			fp = statfd >= 0 ? fdopen(statfd, "r") : NULL;
 			if (fp) {
 				if (fscanf(fp, "%*d (%[^)])", name) == 1)
-					escape_str(task, name, sizeof(task));
+					escape_str(esc, name, sizeof(esc));
 				fclose(fp);
+			} else if (statfd >= 0) {
+				close(statfd);
+			}
+			user_rec_add_str(rec, &len, esc);
+
+			rec->task_ctx_off = 0;
+			if (show_proc_ctx || show_sock_ctx) {
+				char *context;
+
+				if (getpidcon(tid, &context) != 0)
+					context = strdup(no_ctx);
+				rec->task_ctx_off =
+					user_rec_add_str(rec, &len, context);
+				freecon(context);
 			}
+			task_len = len;
+		}
+
+		len = task_len;
+		rec->sock_ctx_off = 0;
+		if (show_sock_ctx) {
+			char path[MAX_PATH_LEN + 48], *context;
+
+			/* SELinux wants a path */
+			if (pid == tid)
+				snprintf(path, sizeof(path), "%s/%d/fd/%d",
+					 scan->root, pid, fd);
+			else
+				snprintf(path, sizeof(path),
+					 "%s/%d/task/%d/fd/%d",
+					 scan->root, pid, tid, fd);
+			if (getfilecon(path, &context) <= 0)
+				context = strdup(no_ctx);
+			rec->sock_ctx_off = user_rec_add_str(rec, &len, context);
+			freecon(context);
 		}
 
-		user_ent_add(ino, task, pid, tid, fd, task_context, sock_context);
-		freecon(sock_context);
+		rec->ino = ino;
+		rec->pid = pid;
+		rec->tid = tid;
+		rec->fd = fd;
+		if (proc_scan_emit(out, rec, sizeof(*rec) + len)) {
+			fprintf(stderr, "ss: failed to malloc buffer\n");
+			abort();
+		}
 	}
 
-	freecon(task_context);
 	closedir(dir);
 }
 
-static void user_ent_destroy(void)
+static int user_ent_collect(const void *data, size_t len, void *arg)
 {
-	struct user_ent *p, *p_next;
-	int cnt = 0;
+	const struct user_rec *rec = data;
+	struct user_scan *scan = arg;
 
-	while (cnt != USER_ENT_HASH_SIZE) {
-		p = user_ent_hash[cnt];
-		while (p) {
-			free(p->task);
-			free(p->task_ctx);
-			free(p->socket_ctx);
-			p_next = p->next;
-			free(p);
-			p = p_next;
-		}
-		cnt++;
+	/* consecutive records of one task share its strings */
+	if (!scan->task || rec->pid != scan->pid || rec->tid != scan->tid) {
+		scan->task = user_arena_strdup(rec->str);
+		scan->task_ctx = NULL;
+		if (show_proc_ctx || show_sock_ctx)
+			scan->task_ctx = user_arena_strdup(rec->str +
+							   rec->task_ctx_off);
+		scan->pid = rec->pid;
+		scan->tid = rec->tid;
 	}
+
+	user_ent_add(rec->ino, scan->task, rec->pid, rec->tid, rec->fd,
+		     scan->task_ctx,
+		     rec->sock_ctx_off ? (char *)rec->str + rec->sock_ctx_off
+				       : NULL);
+	return 0;
 }
 
-static void user_ent_hash_build(void)
+static void user_ent_destroy(void)
 {
-	const char *root = getenv("PROC_ROOT") ? : "/proc/";
-	char name[MAX_PATH_LEN];
-	struct dirent *d;
-	int nameoff;
-	DIR *dir;
+	struct user_arena *a, *next;
+
+	for (a = user_arena; a; a = next) {
+		next = a->next;
+		free(a);
+	}
+	user_arena = NULL;
+
+	free(user_ent_hash);
+	user_ent_hash = NULL;
+	user_ent_hash_size = 0;
+	user_ent_count = 0;
+	user_ent_built = false;
+}
 
-	strlcpy(name, root, sizeof(name));
+#ifdef ENABLE_BPF_ITER_SUPPORT
+/* The owners of all sockets can also be read with one pass of a BPF
+ * task_file iterator instead of the readlink() of every /proc/PID/fd
+ * entry. The program is put together here, with the field offsets taken
+ * from the kernel BTF, and writes one record per socket fd. Threads,
+ * SELinux contexts and PROC_ROOT are left to the /proc walk, as are
+ * kernels without BTF or iterators and users who may not load it.
+ */
+struct user_iter_rec {
+	__u32	ino;
+	__s32	pid;
+	__s32	tid;
+	__s32	fd;
+	char	comm[16];
+};
 
-	if (strlen(name) == 0 || name[strlen(name) - 1] != '/')
-		strcat(name, "/");
+enum {
+	USER_ITER_F_INODE,
+	USER_ITER_I_MODE,
+	USER_ITER_I_INO,
+	USER_ITER_TGID,
+	USER_ITER_PID,
+	USER_ITER_COMM,
+	USER_ITER_MAX,
+};
 
-	nameoff = strlen(name);
+/* the index of the "return 0" the checks jump to */
+#define USER_ITER_EXIT	30
+#define USER_ITER_SKIP(insn)	(USER_ITER_EXIT - (insn) - 1)
 
-	dir = opendir(name);
-	if (!dir)
-		return;
+static int user_iter_member_off(const struct btf *btf, __u32 id,
+				const char *name)
+{
+	const struct btf_type *t = btf__type_by_id(btf, id);
+	const struct btf_member *m;
+	int i, off;
 
-	while ((d = readdir(dir)) != NULL) {
-		int pid;
+	if (!t || !btf_is_composite(t))
+		return -1;
 
-		if (sscanf(d->d_name, "%d%*c", &pid) != 1)
+	for (i = 0, m = btf_members(t); i < btf_vlen(t); i++, m++) {
+		if (m->name_off) {
+			if (!strcmp(btf__name_by_offset(btf, m->name_off), name))
+				return btf_member_bit_offset(t, i) / 8;
 			continue;
+		}
+		/* anonymous struct or union, e.g. randomized fields */
+		off = user_iter_member_off(btf, m->type, name);
+		if (off >= 0)
+			return btf_member_bit_offset(t, i) / 8 + off;
+	}
+	return -1;
+}
 
-		snprintf(name + nameoff, sizeof(name) - nameoff, "%d/", pid);
-		user_ent_hash_build_task(name, pid, pid);
+static int user_iter_prog_load(void)
+{
+	static const char * const fields[USER_ITER_MAX][2] = {
+		[USER_ITER_F_INODE]	= { "file", "f_inode" },
+		[USER_ITER_I_MODE]	= { "inode", "i_mode" },
+		[USER_ITER_I_INO]	= { "inode", "i_ino" },
+		[USER_ITER_TGID]	= { "task_struct", "tgid" },
+		[USER_ITER_PID]		= { "task_struct", "pid" },
+		[USER_ITER_COMM]	= { "task_struct", "comm" },
+	};
+	const int rec = -(int)sizeof(struct user_iter_rec);
+	int off[USER_ITER_MAX], func_id, id, i;
+	struct btf *btf;
 
-		if (show_threads) {
-			struct dirent *task_d;
-			DIR *task_dir;
+	btf = btf__load_vmlinux_btf();
+	if (libbpf_get_error(btf))
+		return -1;
 
-			snprintf(name + nameoff, sizeof(name) - nameoff, "%d/task/", pid);
+	func_id = btf__find_by_name_kind(btf, "bpf_iter_task_file",
+					 BTF_KIND_FUNC);
+	for (i = 0; i < USER_ITER_MAX; i++) {
+		id = btf__find_by_name_kind(btf, fields[i][0],
+					    BTF_KIND_STRUCT);
+		off[i] = id < 0 ? -1 :
+			 user_iter_member_off(btf, id, fields[i][1]);
+		if (off[i] < 0 || off[i] > SHRT_MAX)
+			func_id = -1;
+	}
+	btf__free(btf);
+	if (func_id < 0)
+		return -1;
 
-			task_dir = opendir(name);
-			if (!task_dir)
-				continue;
+	/* struct bpf_iter__task_file: meta, task, fd, file, 8 bytes each */
+	struct bpf_insn insns[] = {
+		BPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+		BPF_LDX_MEM(BPF_DW, BPF_REG_7, BPF_REG_6, 24),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_7, 0, USER_ITER_SKIP(2)),
+		BPF_LDX_MEM(BPF_DW, BPF_REG_8, BPF_REG_6, 8),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_8, 0, USER_ITER_SKIP(4)),
+		/* only sockets: (file->f_inode->i_mode & S_IFMT) == S_IFSOCK */
+		BPF_LDX_MEM(BPF_DW, BPF_REG_2, BPF_REG_7,
+			    off[USER_ITER_F_INODE]),
+		BPF_JMP_IMM(BPF_JEQ, BPF_REG_2, 0, USER_ITER_SKIP(6)),
+		BPF_LDX_MEM(BPF_H, BPF_REG_3, BPF_REG_2,
+			    off[USER_ITER_I_MODE]),
+		BPF_ALU64_IMM(BPF_AND, BPF_REG_3, S_IFMT),
+		BPF_JMP_IMM(BPF_JNE, BPF_REG_3, S_IFSOCK, USER_ITER_SKIP(9)),
+		/* the record is built on the stack */
+		BPF_LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_2,
+			    off[USER_ITER_I_INO]),
+		BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_3,
+			    rec + offsetof(struct user_iter_rec, ino)),
+		BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_8, off[USER_ITER_TGID]),
+		BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_3,
+			    rec + offsetof(struct user_iter_rec, pid)),
+		BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_8, off[USER_ITER_PID]),
+		BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_3,
+			    rec + offsetof(struct user_iter_rec, tid)),
+		BPF_LDX_MEM(BPF_DW, BPF_REG_3, BPF_REG_6, 16),
+		BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_3,
+			    rec + offsetof(struct user_iter_rec, fd)),
+		BPF_MOV64_REG(BPF_REG_1, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_1,
+			      rec + offsetof(struct user_iter_rec, comm)),
+		BPF_MOV64_IMM(BPF_REG_2, sizeof(((struct user_iter_rec *)0)->comm)),
+		BPF_MOV64_REG(BPF_REG_3, BPF_REG_8),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_3, off[USER_ITER_COMM]),
+		BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, 0, 0,
+			     BPF_FUNC_probe_read_kernel),
+		/* bpf_seq_write(ctx->meta->seq, rec, sizeof(rec)) */
+		BPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_6, 0),
+		BPF_LDX_MEM(BPF_DW, BPF_REG_1, BPF_REG_1, 0),
+		BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+		BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, rec),
+		BPF_MOV64_IMM(BPF_REG_3, sizeof(struct user_iter_rec)),
+		BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_seq_write),
+		/* USER_ITER_EXIT */
+		BPF_MOV64_IMM(BPF_REG_0, 0),
+		BPF_EXIT_INSN(),
+	};
+	LIBBPF_OPTS(bpf_prog_load_opts, opts,
+		    .expected_attach_type = BPF_TRACE_ITER,
+		    .attach_btf_id = func_id);
 
-			while ((task_d = readdir(task_dir)) != NULL) {
-				int tid;
+	return bpf_prog_load(BPF_PROG_TYPE_TRACING, "ss_sock_owner", "GPL",
+			     insns, ARRAY_SIZE(insns), &opts);
+}
 
-				if (sscanf(task_d->d_name, "%d%*c", &tid) != 1)
-					continue;
-				if (tid == pid)
-					continue;
+/* All the records of one pass, NULL if the iterator is not available */
+static struct user_iter_rec *user_iter_read(size_t *count)
+{
+	int prog_fd, link_fd = -1, iter_fd = -1;
+	size_t len = 0, size = 0;
+	char *buf = NULL;
+	ssize_t n;
+
+	prog_fd = user_iter_prog_load();
+	if (prog_fd < 0)
+		return NULL;
+	link_fd = bpf_link_create(prog_fd, 0, BPF_TRACE_ITER, NULL);
+	if (link_fd >= 0)
+		iter_fd = bpf_iter_create(link_fd);
+	if (iter_fd < 0)
+		goto out;
 
-				snprintf(name + nameoff, sizeof(name) - nameoff, "%d/", tid);
-				user_ent_hash_build_task(name, pid, tid);
+	do {
+		if (len == size) {
+			char *tmp;
+
+			size = size ? size * 2 : 256 * sizeof(struct user_iter_rec);
+			tmp = realloc(buf, size);
+			if (!tmp) {
+				n = -1;
+				break;
 			}
-			closedir(task_dir);
+			buf = tmp;
 		}
+		n = read(iter_fd, buf + len, size - len);
+		if (n > 0)
+			len += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	if (n < 0) {
+		free(buf);
+		buf = NULL;
 	}
-	closedir(dir);
+	*count = len / sizeof(struct user_iter_rec);
+out:
+	if (iter_fd >= 0)
+		close(iter_fd);
+	if (link_fd >= 0)
+		close(link_fd);
+	close(prog_fd);
+	return (struct user_iter_rec *)buf;
+}
+
+static bool user_ent_iter_build(void)
+{
+	struct user_iter_rec *recs, *r;
+	const char *task = NULL;
+	bool self = false;
+	struct stat st;
+	size_t count, i;
+	int last_pid = 0;
+	int sk;
+
+	/* a socket of our own must come back with our pid, which is not
+	 * the case in a pid namespace: the iterator sees the global pids
+	 */
+	sk = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return false;
+	if (fstat(sk, &st) < 0) {
+		close(sk);
+		return false;
+	}
+
+	recs = user_iter_read(&count);
+	close(sk);
+	if (!recs)
+		return false;
+
+	for (i = 0; i < count && !self; i++)
+		self = recs[i].ino == st.st_ino && recs[i].pid == getpid();
+	if (!self) {
+		free(recs);
+		return false;
+	}
+
+	for (i = 0, r = recs; i < count; i++, r++) {
+		if (!task || r->pid != last_pid) {
+			char esc[20] = { };
+
+			r->comm[sizeof(r->comm) - 1] = '\0';
+			escape_str(esc, r->comm, sizeof(esc));
+			task = user_arena_strdup(esc);
+			last_pid = r->pid;
+		}
+		user_ent_add(r->ino, (char *)task, r->pid, r->tid, r->fd,
+			     NULL, NULL);
+	}
+
+	free(recs);
+	return true;
+}
+#endif
+
+static void user_ent_hash_build(void)
+{
+	struct user_scan scan = {};
+	struct proc_scan ps = {
+		.root = scan.root,
+		.tasks = show_threads,
+		.visit = user_ent_visit,
+		.collect = user_ent_collect,
+		.arg = &scan,
+	};
+
+	user_ent_built = true;
+
+#ifdef ENABLE_BPF_ITER_SUPPORT
+	if (!show_threads && !show_proc_ctx && !show_sock_ctx &&
+	    !getenv("PROC_ROOT") && user_ent_iter_build())
+		return;
+#endif
+
+	strlcpy(scan.root, getenv("PROC_ROOT") ? : "/proc", sizeof(scan.root));
+	proc_scan(&ps);
 }
 
 enum entry_types {
@@ -716,6 +1140,12 @@ static int find_entry(unsigned int ino, char **buf, int type)
 	if (!ino)
 		return 0;
 
+	/* the process table is only walked once a socket is to be shown */
+	if (!user_ent_built)
+		user_ent_hash_build();
+	if (!user_ent_hash)
+		return 0;
+
 	p = user_ent_hash[user_ent_hashfn(ino)];
 	ptr = *buf = NULL;
 	while (p) {
@@ -778,6 +1208,24 @@ next:
 	return cnt;
 }
 
+/* The first owner of a socket, NULL if none is found */
+static const struct user_ent *user_ent_find(unsigned int ino)
+{
+	struct user_ent *p;
+
+	if (!ino)
+		return NULL;
+	if (!user_ent_built)
+		user_ent_hash_build();
+	if (!user_ent_hash)
+		return NULL;
+
+	for (p = user_ent_hash[user_ent_hashfn(ino)]; p; p = p->next)
+		if (p->ino == ino)
+			return p;
+	return NULL;
+}
+
 static unsigned long long cookie_sk_get(const uint32_t *cookie)
 {
 	return (((unsigned long long)cookie[1] << 31) << 1) | cookie[0];
@@ -1043,6 +1491,36 @@ static int buf_update(int len)
 }
 
 /* Append content to buffer as part of the current field */
+static void record_op(int type, int col, const char *data, int len)
+{
+	struct ss_rec rec = { .type = type, .col = col, .len = len };
+
+	if (fwrite(&rec, sizeof(rec), 1, record_fp) != 1 ||
+	    (len && fwrite(data, len, 1, record_fp) != 1)) {
+		perror("ss: cannot record output");
+		_exit(1);
+	}
+}
+
+__attribute__((format(printf, 1, 0)))
+static void record_out(const char *fmt, va_list args)
+{
+	char buf[1024], *str = buf;
+	va_list _args;
+	int len;
+
+	va_copy(_args, args);
+	len = vsnprintf(buf, sizeof(buf), fmt, _args);
+	va_end(_args);
+
+	if (len >= (int)sizeof(buf) && vasprintf(&str, fmt, args) < 0)
+		abort();
+	if (len > 0)
+		record_op(SS_REC_OUT, 0, str, len);
+	if (str != buf)
+		free(str);
+}
+
 __attribute__((format(printf, 1, 0)))
 static void vout(const char *fmt, va_list args)
 {
@@ -1051,6 +1529,11 @@ static void vout(const char *fmt, va_list args)
 	char *pos;
 	int len;
 
+	if (record_fp) {
+		record_out(fmt, args);
+		return;
+	}
+
 	if (f->disabled)
 		return;
 
@@ -1176,6 +1659,22 @@ static void buf_free_all(void)
 	buffer.chunks = 0;
 }
 
+/* Reset the buffer for the next rows, keeping its first chunk around */
+static void buf_reset(void)
+{
+	struct buf_chunk *head = buffer.head;
+
+	buffer.head = head->next;
+	buf_free_all();
+
+	head->next = NULL;
+	buffer.head = buffer.tail = head;
+	buffer.cur = (struct buf_token *)head->data;
+	buffer.cur->len = 0;
+	head->end = buffer.cur->data;
+	buffer.chunks = 1;
+}
+
 /* Get current screen width. Returns -1 if TIOCGWINSZ fails and there's
  * no COLUMNS variable in the environment.
  */
@@ -1310,10 +1809,10 @@ newline:
 /* Render buffered output with spacing and delimiters, then free up buffers */
 static void render(void)
 {
+	static bool compact_output;
 	struct buf_token *token;
 	int printed, line_started = 0;
 	struct column *f, *last_visible_column = 0;
-	bool compact_output = false;
 
 	if (!buffer.head)
 		return;
@@ -1323,7 +1822,10 @@ static void render(void)
 	/* Ensure end alignment of last token, it wasn't necessarily flushed */
 	buffer.tail->end += buffer.cur->len % 2;
 
-	compact_output = render_calc_width();
+	if (!stream_widths_fixed)
+		compact_output = render_calc_width();
+	if (stream_rows)
+		stream_widths_fixed = true;
 
 	/* Rewind and replay */
 	buffer.tail = buffer.head;
@@ -1371,8 +1873,12 @@ static void render(void)
 	if (line_started)
 		printf("\n");
 
-	buf_free_all();
+	if (stream_rows)
+		buf_reset();
+	else
+		buf_free_all();
 	current_field = columns;
+	stream_rows_buffered = 0;
 }
 
 /* Move to next field, and render buffer if we reached the maximum number of
@@ -1380,11 +1886,23 @@ static void render(void)
  */
 static void field_next(void)
 {
+	if (record_fp) {
+		record_op(SS_REC_NEXT, 0, NULL, 0);
+		return;
+	}
+
 	if (field_is_last(current_field) && buffer.chunks >= BUF_CHUNKS_MAX) {
 		render();
 		return;
 	}
 
+	/* In streaming mode, print rows once the widths are known */
+	if (field_is_last(current_field) && stream_rows &&
+	    ++stream_rows_buffered >= (stream_widths_fixed ? 1 : stream_rows)) {
+		render();
+		return;
+	}
+
 	field_flush(current_field);
 	if (field_is_last(current_field))
 		current_field = columns;
@@ -1395,6 +1913,11 @@ static void field_next(void)
 /* Walk through fields and flush them until we reach the desired one */
 static void field_set(enum col_id id)
 {
+	if (record_fp) {
+		record_op(SS_REC_SET, id, NULL, 0);
+		return;
+	}
+
 	while (id != current_field - columns)
 		field_next();
 }
@@ -1409,25 +1932,26 @@ static void print_header(void)
 	}
 }
 
+static const char * const sstate_name[] = {
+	"UNKNOWN",
+	[SS_ESTABLISHED] = "ESTAB",
+	[SS_SYN_SENT] = "SYN-SENT",
+	[SS_SYN_RECV] = "SYN-RECV",
+	[SS_FIN_WAIT1] = "FIN-WAIT-1",
+	[SS_FIN_WAIT2] = "FIN-WAIT-2",
+	[SS_TIME_WAIT] = "TIME-WAIT",
+	[SS_CLOSE] = "UNCONN",
+	[SS_CLOSE_WAIT] = "CLOSE-WAIT",
+	[SS_LAST_ACK] = "LAST-ACK",
+	[SS_LISTEN] =	"LISTEN",
+	[SS_CLOSING] = "CLOSING",
+	[SS_NEW_SYN_RECV] = "UNDEF", /* Never returned by kernel */
+	[SS_BOUND_INACTIVE] = "UNDEF", /* Never returned by kernel */
+};
+
 static void sock_state_print(struct sockstat *s)
 {
 	const char *sock_name;
-	static const char * const sstate_name[] = {
-		"UNKNOWN",
-		[SS_ESTABLISHED] = "ESTAB",
-		[SS_SYN_SENT] = "SYN-SENT",
-		[SS_SYN_RECV] = "SYN-RECV",
-		[SS_FIN_WAIT1] = "FIN-WAIT-1",
-		[SS_FIN_WAIT2] = "FIN-WAIT-2",
-		[SS_TIME_WAIT] = "TIME-WAIT",
-		[SS_CLOSE] = "UNCONN",
-		[SS_CLOSE_WAIT] = "CLOSE-WAIT",
-		[SS_LAST_ACK] = "LAST-ACK",
-		[SS_LISTEN] =	"LISTEN",
-		[SS_CLOSING] = "CLOSING",
-		[SS_NEW_SYN_RECV] = "UNDEF", /* Never returned by kernel */
-		[SS_BOUND_INACTIVE] = "UNDEF", /* Never returned by kernel */
-	};
 
 	switch (s->local.family) {
 	case AF_UNIX:
@@ -1919,7 +2443,13 @@ static void ssfilter_patch(char *a, int len, int reloc)
 		abort();
 }
 
-static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
+/* Compile f into inet_diag bytecode, returns its length or 0 if f cannot
+ * be expressed. With partial set, the bytecode may accept more sockets than
+ * f does: the conjuncts the kernel cannot check are left out and only done
+ * by run_ssfilter(), which is applied to every dumped socket anyway.
+ */
+static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode,
+				bool partial)
 {
 	switch (f->type) {
 		case SSF_S_AUTO:
@@ -1955,10 +2485,10 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 			struct inet_diag_hostcond *cond = (struct inet_diag_hostcond *)(ptr+4);
 
 			*op = (struct inet_diag_bc_op){ code, oplen, oplen+4 };
-			cond->family = a->addr.family;
-			cond->port = a->port;
-			cond->prefix_len = a->addr.bitlen;
-			memcpy(cond->addr, a->addr.data, alen);
+			cond->family = b->addr.family;
+			cond->port = b->port;
+			cond->prefix_len = b->addr.bitlen;
+			memcpy(cond->addr, b->addr.data, alen);
 			ptr += oplen;
 			if (b->next) {
 				op = (struct inet_diag_bc_op *)ptr;
@@ -2010,9 +2540,14 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		char *a1 = NULL, *a2 = NULL, *a;
 		int l1, l2;
 
-		l1 = ssfilter_bytecompile(f->pred, &a1);
-		l2 = ssfilter_bytecompile(f->post, &a2);
+		l1 = ssfilter_bytecompile(f->pred, &a1, partial);
+		l2 = ssfilter_bytecompile(f->post, &a2, partial);
 		if (!l1 || !l2) {
+			/* let the kernel check the half it can */
+			if (partial && (l1 || l2)) {
+				*bytecode = l1 ? a1 : a2;
+				return l1 ? : l2;
+			}
 			free(a1);
 			free(a2);
 			return 0;
@@ -2030,8 +2565,8 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		char *a1 = NULL, *a2 = NULL, *a;
 		int l1, l2;
 
-		l1 = ssfilter_bytecompile(f->pred, &a1);
-		l2 = ssfilter_bytecompile(f->post, &a2);
+		l1 = ssfilter_bytecompile(f->pred, &a1, false);
+		l2 = ssfilter_bytecompile(f->post, &a2, false);
 		if (!l1 || !l2) {
 			free(a1);
 			free(a2);
@@ -2050,7 +2585,7 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 		char *a1 = NULL, *a;
 		int l1;
 
-		l1 = ssfilter_bytecompile(f->pred, &a1);
+		l1 = ssfilter_bytecompile(f->pred, &a1, false);
 		if (!l1) {
 			free(a1);
 			return 0;
@@ -2064,8 +2599,24 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 	}
 		case SSF_DEVCOND:
 	{
-		/* bytecompile for SSF_DEVCOND not supported yet */
-		return 0;
+		struct aafilter *a = (void *)f->pred;
+		struct instr {
+			struct inet_diag_bc_op op;
+			__u32 iface;
+		} __attribute__((packed));
+		int inslen = sizeof(struct instr);
+
+		/* older kernels leave it to run_ssfilter() */
+		if (!ssfilter_bytecode_is_supported(SSF_DEVCOND))
+			return 0;
+
+		if (!(*bytecode = malloc(inslen))) abort();
+		((struct instr *)*bytecode)[0] = (struct instr) {
+			{ INET_DIAG_BC_DEV_COND, inslen, inslen + 4 },
+			a->iface,
+		};
+
+		return inslen;
 	}
 		case SSF_MARKMASK:
 	{
@@ -2106,45 +2657,171 @@ static int ssfilter_bytecompile(struct ssfilter *f, char **bytecode)
 	}
 }
 
-static int remember_he(struct aafilter *a, struct hostent *he)
+static void ssfilter_print_hostcond(FILE *fp, const struct aafilter *a)
 {
-	char **ptr = he->h_addr_list;
-	int cnt = 0;
-	int len;
-
-	if (he->h_addrtype == AF_INET)
-		len = 4;
-	else if (he->h_addrtype == AF_INET6)
-		len = 16;
-	else
-		return 0;
-
-	while (*ptr) {
-		struct aafilter *b = a;
+	char abuf[INET6_ADDRSTRLEN];
+	const char *addr = "*";
 
-		if (a->addr.bitlen) {
-			if ((b = malloc(sizeof(*b))) == NULL)
-				return cnt;
-			*b = *a;
-			a->next = b;
-		}
-		memcpy(b->addr.data, *ptr, len);
-		b->addr.bytelen = len;
-		b->addr.bitlen = len*8;
-		b->addr.family = he->h_addrtype;
-		ptr++;
-		cnt++;
+	if (a->addr.family == AF_UNIX) {
+		memcpy(&addr, a->addr.data, sizeof(addr));
+		fprintf(fp, "unix:%s", addr ? : "*");
+		return;
 	}
-	return cnt;
+
+	if (a->addr.bitlen && (a->addr.family == AF_INET ||
+			       a->addr.family == AF_INET6))
+		addr = inet_ntop(a->addr.family, a->addr.data,
+				 abuf, sizeof(abuf)) ? : "?";
+	fprintf(fp, a->addr.family == AF_INET6 && a->addr.bitlen ?
+		"[%s]" : "%s", addr);
+	if (a->addr.bitlen && a->addr.bitlen != 8 * a->addr.bytelen)
+		fprintf(fp, "/%d", a->addr.bitlen);
+	if (a->port != -1)
+		fprintf(fp, ":%ld", a->port);
 }
 
-static int get_dns_host(struct aafilter *a, const char *addr, int fam)
+static void ssfilter_print(FILE *fp, const struct ssfilter *f)
 {
-	static int notfirst;
-	int cnt = 0;
-	struct hostent *he;
+	const struct aafilter *a = (void *)f->pred;
 
-	a->addr.bitlen = 0;
+	switch (f->type) {
+	case SSF_S_AUTO:
+		fprintf(fp, "autobound");
+		break;
+	case SSF_DCOND:
+	case SSF_SCOND:
+		fprintf(fp, "%s ", f->type == SSF_DCOND ? "dst" : "src");
+		if (a->next)
+			fprintf(fp, "{ ");
+		for (; a; a = a->next) {
+			ssfilter_print_hostcond(fp, a);
+			if (a->next)
+				fprintf(fp, ", ");
+			else if (a != (void *)f->pred)
+				fprintf(fp, " }");
+		}
+		break;
+	case SSF_D_GE:
+	case SSF_D_LE:
+	case SSF_S_GE:
+	case SSF_S_LE:
+		fprintf(fp, "%s %s :%ld",
+			f->type == SSF_D_GE || f->type == SSF_D_LE ?
+			"dport" : "sport",
+			f->type == SSF_D_GE || f->type == SSF_S_GE ? ">=" : "<=",
+			a->port);
+		break;
+	case SSF_DEVCOND:
+		fprintf(fp, "dev = %s", ll_index_to_name(a->iface));
+		break;
+	case SSF_MARKMASK:
+		fprintf(fp, "fwmark = 0x%x/0x%x", a->mark, a->mask);
+		break;
+	case SSF_CGROUPCOND:
+		fprintf(fp, "cgroup id %llu", (unsigned long long)a->cgroup_id);
+		break;
+	case SSF_AND:
+	case SSF_OR:
+		fprintf(fp, "(");
+		ssfilter_print(fp, f->pred);
+		fprintf(fp, f->type == SSF_AND ? " and " : " or ");
+		ssfilter_print(fp, f->post);
+		fprintf(fp, ")");
+		break;
+	case SSF_NOT:
+		fprintf(fp, "not ");
+		ssfilter_print(fp, f->pred);
+		break;
+	}
+}
+
+/* Print the conjuncts of f that run in the kernel (or in userspace) */
+static void ssfilter_explain_split(FILE *fp, struct ssfilter *f, bool kernel,
+				   int *count)
+{
+	char *bc = NULL;
+	int len;
+
+	if (f->type == SSF_AND) {
+		ssfilter_explain_split(fp, f->pred, kernel, count);
+		ssfilter_explain_split(fp, f->post, kernel, count);
+		return;
+	}
+
+	len = ssfilter_bytecompile(f, &bc, false);
+	free(bc);
+	if (!!len != kernel)
+		return;
+
+	if ((*count)++)
+		fprintf(fp, " and ");
+	ssfilter_print(fp, f);
+}
+
+static void ssfilter_explain(FILE *fp, const struct filter *f)
+{
+	int count = 0;
+
+	if (!f->f) {
+		fprintf(fp, "Filter: none\n");
+		return;
+	}
+
+	fprintf(fp, "Filter: ");
+	ssfilter_print(fp, f->f);
+	fprintf(fp, "\n");
+
+	fprintf(fp, "  inet sockets, checked by the kernel: ");
+	ssfilter_explain_split(fp, f->f, true, &count);
+	fprintf(fp, "%s\n", count ? "" : "nothing");
+
+	count = 0;
+	fprintf(fp, "  inet sockets, checked in userspace only: ");
+	ssfilter_explain_split(fp, f->f, false, &count);
+	fprintf(fp, "%s\n", count ? "" : "nothing");
+
+	fprintf(fp, "  other sockets, checked in userspace only: all\n");
+}
+
+static int remember_he(struct aafilter *a, struct hostent *he)
+{
+	char **ptr = he->h_addr_list;
+	int cnt = 0;
+	int len;
+
+	if (he->h_addrtype == AF_INET)
+		len = 4;
+	else if (he->h_addrtype == AF_INET6)
+		len = 16;
+	else
+		return 0;
+
+	while (*ptr) {
+		struct aafilter *b = a;
+
+		if (a->addr.bitlen) {
+			if ((b = malloc(sizeof(*b))) == NULL)
+				return cnt;
+			*b = *a;
+			a->next = b;
+		}
+		memcpy(b->addr.data, *ptr, len);
+		b->addr.bytelen = len;
+		b->addr.bitlen = len*8;
+		b->addr.family = he->h_addrtype;
+		ptr++;
+		cnt++;
+	}
+	return cnt;
+}
+
+static int get_dns_host(struct aafilter *a, const char *addr, int fam)
+{
+	static int notfirst;
+	int cnt = 0;
+	struct hostent *he;
+
+	a->addr.bitlen = 0;
 	if (!notfirst) {
 		sethostent(1);
 		notfirst = 1;
@@ -2485,32 +3162,101 @@ static void inet_stats_print(struct sockstat *s, bool v6only)
 	proc_ctx_print(s);
 }
 
+/*
+ * The /proc/net files have fixed columns of hex and decimal numbers, see
+ * get_tcp4_sock() in the kernel, so they are parsed by hand instead of
+ * with sscanf(), which dominates with a million sockets.
+ */
+static const char *proc_hex(const char *p, unsigned int width,
+			    unsigned long long *val)
+{
+	unsigned long long v = 0;
+	const char *start;
+
+	while (*p == ' ')
+		p++;
+	for (start = p; width--; p++) {
+		unsigned int c = *p | 0x20;
+
+		if (*p >= '0' && *p <= '9')
+			v = v << 4 | (*p - '0');
+		else if (c >= 'a' && c <= 'f')
+			v = v << 4 | (c - 'a' + 10);
+		else
+			break;
+	}
+	*val = v;
+	return p == start ? NULL : p;
+}
+
+static const char *proc_dec(const char *p, unsigned long long *val)
+{
+	unsigned long long v = 0;
+	const char *start;
+	bool neg;
+
+	while (*p == ' ')
+		p++;
+	neg = *p == '-';
+	if (neg)
+		p++;
+	for (start = p; *p >= '0' && *p <= '9'; p++)
+		v = v * 10 + (*p - '0');
+	*val = neg ? -v : v;
+	return p == start ? NULL : p;
+}
+
+/* Numbers as in @fmt, 'x' hex, 'd' decimal or ':' between two, parsed
+ * into @val until one is missing. Returns how many, @rest is what follows.
+ */
+static int proc_fields(const char *p, const char *fmt, unsigned long long *val,
+		       const char **rest)
+{
+	int n = 0;
+
+	for (; *fmt; fmt++) {
+		const char *q;
+
+		if (*fmt == ':') {
+			if (*p != ':')
+				break;
+			p++;
+			continue;
+		}
+		q = *fmt == 'x' ? proc_hex(p, 16, &val[n]) :
+				  proc_dec(p, &val[n]);
+		if (!q)
+			break;
+		p = q;
+		n++;
+	}
+	*rest = p;
+	return n;
+}
+
+/* ADDR:PORT, the address as one (IPv4) or four words, as printed by %08X */
+static void proc_parse_inet_one(const char *p, int family, inet_prefix *a,
+				int *port)
+{
+	unsigned int i, words = family == AF_INET ? 1 : 4;
+	unsigned long long v;
+
+	for (i = 0; i < words && p; i++) {
+		p = proc_hex(p, 8, &v);
+		a->data[i] = v;
+	}
+	if (p && *p == ':' && proc_hex(p + 1, 8, &v))
+		*port = v;
+	a->bytelen = words * 4;
+}
+
 static int proc_parse_inet_addr(char *loc, char *rem, int family, struct
 		sockstat * s)
 {
 	s->local.family = s->remote.family = family;
-	if (family == AF_INET) {
-		sscanf(loc, "%x:%x", s->local.data, (unsigned *)&s->lport);
-		sscanf(rem, "%x:%x", s->remote.data, (unsigned *)&s->rport);
-		s->local.bytelen = s->remote.bytelen = 4;
-		return 0;
-	} else {
-		sscanf(loc, "%08x%08x%08x%08x:%x",
-		       s->local.data,
-		       s->local.data + 1,
-		       s->local.data + 2,
-		       s->local.data + 3,
-		       &s->lport);
-		sscanf(rem, "%08x%08x%08x%08x:%x",
-		       s->remote.data,
-		       s->remote.data + 1,
-		       s->remote.data + 2,
-		       s->remote.data + 3,
-		       &s->rport);
-		s->local.bytelen = s->remote.bytelen = 16;
-		return 0;
-	}
-	return -1;
+	proc_parse_inet_one(loc, family, &s->local, &s->lport);
+	proc_parse_inet_one(rem, family, &s->remote, &s->rport);
+	return 0;
 }
 
 static int proc_inet_split_line(char *line, char **loc, char **rem, char **data)
@@ -2802,10 +3548,11 @@ static void sctp_timer_print(struct tcpstat *s)
 
 static int tcp_show_line(char *line, const struct filter *f, int family)
 {
-	int rto = 0, ato = 0;
+	unsigned long long v[16] = {};
 	struct tcpstat s = {};
 	char *loc, *rem, *data;
-	char opt[256];
+	const char *opt;
+	int rto = 0, ato = 0;
 	int n;
 	int hz = get_user_hz();
 
@@ -2822,23 +3569,35 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	if (f->f && run_ssfilter(f->f, &s.ss) == 0)
 		return 0;
 
-	opt[0] = 0;
-	n = sscanf(data, "%x %x:%x %x:%x %x %d %d %u %d %llx %d %d %d %u %d %[^\n]\n",
-		   &s.ss.state, &s.ss.wq, &s.ss.rq,
-		   &s.timer, &s.timeout, &s.retrans, &s.ss.uid, &s.probes,
-		   &s.ss.ino, &s.ss.refcnt, &s.ss.sk, &rto, &ato, &s.qack, &s.cwnd,
-		   &s.ssthresh, opt);
-
-	if (n < 17)
-		opt[0] = 0;
-
-	if (n < 12) {
-		rto = 0;
+	/* st tx:rx tr:when retrnsmt uid timeout inode ref sk rto ato qack cwnd ssthresh */
+	n = proc_fields(data, "xx:xx:xxddddxddddd", v, &opt);
+	s.ss.state = v[0];
+	s.ss.wq = v[1];
+	s.ss.rq = v[2];
+	s.timer = v[3];
+	s.timeout = v[4];
+	s.retrans = v[5];
+	s.ss.uid = v[6];
+	s.probes = v[7];
+	s.ss.ino = v[8];
+	s.ss.refcnt = v[9];
+	s.ss.sk = v[10];
+	if (n >= 12) {
+		rto = v[11];
+		ato = v[12];
+		s.qack = v[13];
+		s.cwnd = v[14];
+		s.ssthresh = v[15];
+	} else {
 		s.cwnd = 2;
 		s.ssthresh = -1;
-		ato = s.qack = 0;
 	}
 
+	while (*opt == ' ')
+		opt++;
+	if (n < 16)
+		opt = "";
+
 	s.retrans   = s.timer != 1 ? s.probes : s.retrans;
 	s.timeout   = (s.timeout * 1000 + hz - 1) / hz;
 	s.ato	    = (double)ato / hz;
@@ -2865,31 +3624,67 @@ static int tcp_show_line(char *line, const struct filter *f, int family)
 	return 0;
 }
 
+/* Read in large chunks and split the lines in place, the first one is
+ * the header. With a line per socket, stdio and fgets() would cost more
+ * than parsing.
+ */
 static int generic_record_read(FILE *fp,
 			       int (*worker)(char*, const struct filter *, int),
 			       const struct filter *f, int fam)
 {
-	char line[256];
+	size_t size = 1024 * 1024, len = 0;
+	bool header = true;
+	int ret = 0;
+	char *buf;
 
-	/* skip header */
-	if (fgets(line, sizeof(line), fp) == NULL)
-		goto outerr;
+	while ((buf = malloc(size)) == NULL && size > 64 * 1024)
+		size /= 2;
+	if (buf == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
 
-	while (fgets(line, sizeof(line), fp) != NULL) {
-		int n = strlen(line);
+	for (;;) {
+		char *line, *nl;
+		ssize_t cc;
 
-		if (n == 0 || line[n-1] != '\n') {
-			errno = -EINVAL;
-			return -1;
+		cc = read(fileno(fp), buf + len, size - len);
+		if (cc < 0 && errno == EINTR)
+			continue;
+		if (cc < 0) {
+			ret = -1;
+			break;
+		}
+		if (cc == 0) {
+			/* the last line has no newline */
+			if (len) {
+				errno = EINVAL;
+				ret = -1;
+			}
+			break;
+		}
+		len += cc;
+
+		for (line = buf; (nl = memchr(line, '\n', buf + len - line));
+		     line = nl + 1) {
+			*nl = 0;
+			if (header)
+				header = false;
+			else if (worker(line, f, fam) < 0)
+				goto out;
 		}
-		line[n-1] = 0;
 
-		if (worker(line, f, fam) < 0)
-			return 0;
+		len = buf + len - line;
+		if (len == size) {
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+		memmove(buf, line, len);
 	}
-outerr:
-
-	return ferror(fp) ? -1 : 0;
+out:
+	free(buf);
+	return ret;
 }
 
 static void print_skmeminfo(struct rtattr *tb[], int attrtype)
@@ -3080,6 +3875,235 @@ static void mptcp_subflow_info(struct rtattr *tb[])
 
 #define TCPI_HAS_OPT(info, opt) !!(info->tcpi_options & (opt))
 
+/* --interval: counters of every TCP flow at the previous sample, by cookie */
+struct flow_sample {
+	struct flow_sample	*next;
+	unsigned long long	cookie;
+	unsigned int		round;		/* last seen in */
+	double			ts;		/* sampled at, in seconds */
+	unsigned long long	bytes_acked;
+	unsigned long long	bytes_received;
+	unsigned int		segs_out;
+	unsigned int		segs_in;
+	unsigned int		retrans_total;
+	unsigned int		delivered;
+};
+
+#define FLOW_HASH_MIN	1024
+
+static struct flow_sample **flow_hash;
+static unsigned int flow_hash_size;
+static unsigned int flow_count;
+static unsigned int interval_round;
+static double interval_ts;
+
+static unsigned int flow_hashfn(unsigned long long cookie)
+{
+	return (cookie ^ (cookie >> 32)) * 0x9e3779b1U & (flow_hash_size - 1);
+}
+
+static void flow_hash_resize(unsigned int size)
+{
+	struct flow_sample **old = flow_hash, *p, *next;
+	unsigned int i, old_size = flow_hash_size;
+
+	flow_hash = calloc(size, sizeof(*flow_hash));
+	if (!flow_hash)
+		abort();
+	flow_hash_size = size;
+
+	for (i = 0; i < old_size; i++) {
+		for (p = old[i]; p; p = next) {
+			struct flow_sample **pp = &flow_hash[flow_hashfn(p->cookie)];
+
+			next = p->next;
+			p->next = *pp;
+			*pp = p;
+		}
+	}
+	free(old);
+}
+
+static struct flow_sample *flow_lookup(unsigned long long cookie, bool *new)
+{
+	struct flow_sample *p, **pp;
+
+	if (!flow_hash)
+		flow_hash_resize(FLOW_HASH_MIN);
+
+	for (p = flow_hash[flow_hashfn(cookie)]; p; p = p->next) {
+		if (p->cookie == cookie) {
+			*new = false;
+			return p;
+		}
+	}
+
+	if (flow_count >= flow_hash_size)
+		flow_hash_resize(2 * flow_hash_size);
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		abort();
+	p->cookie = cookie;
+	pp = &flow_hash[flow_hashfn(cookie)];
+	p->next = *pp;
+	*pp = p;
+	flow_count++;
+	*new = true;
+	return p;
+}
+
+/* Forget the flows which were not dumped in the last round */
+static void flow_expire(void)
+{
+	struct flow_sample *p, **pp;
+	unsigned int i;
+
+	for (i = 0; i < flow_hash_size; i++) {
+		for (pp = &flow_hash[i]; (p = *pp) != NULL; ) {
+			if (p->round == interval_round) {
+				pp = &p->next;
+				continue;
+			}
+			*pp = p->next;
+			free(p);
+			flow_count--;
+		}
+	}
+}
+
+static void tcp_interval_print(unsigned long long cookie,
+			       const struct tcpstat *s)
+{
+	struct flow_sample *p;
+	char b1[64], b2[64];
+	bool new;
+	double dt;
+
+	p = flow_lookup(cookie, &new);
+	dt = interval_ts - p->ts;
+
+	/* a new flow, or seen twice in one round (e.g. v4 and v6 dumps) */
+	if (!new && p->round != interval_round && dt > 0) {
+		out(" delta:(bytes_acked:%llu,bytes_received:%llu,segs_out:%u,segs_in:%u,retrans:%u,delivered:%u,tx:%sbps,rx:%sbps)",
+		    s->bytes_acked - p->bytes_acked,
+		    s->bytes_received - p->bytes_received,
+		    s->segs_out - p->segs_out,
+		    s->segs_in - p->segs_in,
+		    s->retrans_total - p->retrans_total,
+		    s->delivered - p->delivered,
+		    sprint_bw(b1, (s->bytes_acked - p->bytes_acked) * 8. / dt),
+		    sprint_bw(b2, (s->bytes_received - p->bytes_received) *
+				  8. / dt));
+	}
+
+	p->round = interval_round;
+	p->ts = interval_ts;
+	p->bytes_acked = s->bytes_acked;
+	p->bytes_received = s->bytes_received;
+	p->segs_out = s->segs_out;
+	p->segs_in = s->segs_in;
+	p->retrans_total = s->retrans_total;
+	p->delivered = s->delivered;
+}
+
+/* --interval: drop counters of every AF_XDP and packet socket, by inode */
+#define RING_CNT_MAX	6
+#define RING_HASH	1024
+
+struct ring_sample {
+	struct ring_sample	*next;
+	unsigned int		ino;
+	unsigned int		round;
+	double			ts;
+	__u64			val[RING_CNT_MAX];
+};
+
+static struct ring_sample *ring_hash[RING_HASH];
+
+static struct ring_sample *ring_lookup(unsigned int ino, bool *new)
+{
+	struct ring_sample *p, **pp = &ring_hash[ino % RING_HASH];
+
+	for (p = *pp; p; p = p->next) {
+		if (p->ino == ino) {
+			*new = false;
+			return p;
+		}
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		abort();
+	p->ino = ino;
+	p->next = *pp;
+	*pp = p;
+	*new = true;
+	return p;
+}
+
+static void ring_expire(void)
+{
+	struct ring_sample *p, **pp;
+	unsigned int i;
+
+	for (i = 0; i < RING_HASH; i++) {
+		for (pp = &ring_hash[i]; (p = *pp) != NULL; ) {
+			if (p->round == interval_round) {
+				pp = &p->next;
+				continue;
+			}
+			*pp = p->next;
+			free(p);
+		}
+	}
+}
+
+/*
+ * Store the counters of socket @ino and fill @rate with their per second
+ * rates since the previous sample. Returns 0 if the socket should be left
+ * out of this sample because none of the counters moved, 1 if it should
+ * be printed without rates (first sample) and 2 with them.
+ */
+static int ring_sample(unsigned int ino, const __u64 *val, unsigned int n,
+		       double *rate)
+{
+	struct ring_sample *p;
+	unsigned int i;
+	bool new;
+	double dt;
+	int ret;
+
+	p = ring_lookup(ino, &new);
+	dt = interval_ts - p->ts;
+
+	if (new || dt <= 0) {
+		ret = 1;
+	} else if (!memcmp(p->val, val, n * sizeof(*val))) {
+		ret = 0;
+	} else {
+		for (i = 0; i < n; i++)
+			rate[i] = (val[i] - p->val[i]) / dt;
+		ret = 2;
+	}
+
+	p->round = interval_round;
+	p->ts = interval_ts;
+	memcpy(p->val, val, n * sizeof(*val));
+	return ret;
+}
+
+static void ring_rate_print(const char *const *name, const double *rate,
+			    unsigned int n)
+{
+	unsigned int i;
+
+	out(oneline ? " rate:(" : "\n\trate:(");
+	for (i = 0; i < n; i++)
+		out("%s%s:%.1f/s", i ? "," : "", name[i], rate[i]);
+	out(")");
+}
+
 static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r,
 		struct rtattr *tb[])
 {
@@ -3224,6 +4248,9 @@ static void tcp_show_info(const struct nlmsghdr *nlh, struct inet_diag_msg *r,
 		s.rcv_wnd = info->tcpi_rcv_wnd;
 		s.rehash = info->tcpi_rehash;
 		tcp_stats_print(&s);
+		if (interval_ms)
+			tcp_interval_print(cookie_sk_get(&r->id.idiag_cookie[0]),
+					   &s);
 		free(s.dctcp);
 		free(s.bbr_info);
 	}
@@ -3452,6 +4479,15 @@ static void parse_diag_msg(struct nlmsghdr *nlh, struct sockstat *s)
 
 struct btf;
 
+/* A value field of a map, for the printer compiled from the map's BTF. */
+struct bpf_sk_storage_field {
+	const char *name;
+	const char *type;
+	unsigned int offset;
+	unsigned int size;
+	bool is_signed;
+};
+
 static struct bpf_map_opts {
 	unsigned int nr_maps;
 	struct bpf_sk_storage_map_info {
@@ -3460,8 +4496,12 @@ static struct bpf_map_opts {
 		struct bpf_map_info info;
 		struct btf *btf;
 		struct btf_dump *dump;
+		char type_name[128];
+		struct bpf_sk_storage_field *fields;
+		unsigned int nr_fields;
 	} maps[MAX_NR_BPF_MAP_ID_OPTS];
 	bool show_all;
+	bool raw;
 } bpf_map_opts;
 
 static void bpf_map_opts_mixed_error(void)
@@ -3492,11 +4532,101 @@ static void out_bpf_sk_storage_print_fn(void *ctx, const char *fmt, va_list args
 	vout(fmt, args);
 }
 
+static const struct btf_type *bpf_btf_skip_mods(const struct btf *btf,
+						__u32 *id)
+{
+	const struct btf_type *t = btf__type_by_id(btf, *id);
+
+	while (t && btf_is_mod(t)) {
+		*id = t->type;
+		t = btf__type_by_id(btf, *id);
+	}
+	return t;
+}
+
+static const struct btf_type *bpf_btf_resolve(const struct btf *btf, __u32 id)
+{
+	const struct btf_type *t = bpf_btf_skip_mods(btf, &id);
+
+	while (t && btf_is_typedef(t)) {
+		id = t->type;
+		t = bpf_btf_skip_mods(btf, &id);
+	}
+	return t;
+}
+
+/* Values that are plain structs of integers, the usual case for socket
+ * storage, are printed from a field list built here once per map rather
+ * than by walking the BTF through btf_dump for every socket. The output
+ * is laid out the way btf_dump__dump_type_data() does it. Anything else
+ * keeps using btf_dump.
+ */
+static void bpf_map_opts_compile_printer(struct bpf_sk_storage_map_info *map)
+{
+	const struct btf *btf = map->btf;
+	__u32 id = map->info.btf_value_type_id;
+	struct bpf_sk_storage_field *fields;
+	const struct btf_type *decl, *t;
+	const struct btf_member *m;
+	unsigned int i, n;
+
+	if (!btf || !id)
+		return;
+
+	decl = bpf_btf_skip_mods(btf, &id);
+	t = bpf_btf_resolve(btf, id);
+	if (!decl || !t || !btf_is_struct(t) || !btf_vlen(t) || !decl->name_off)
+		return;
+
+	n = btf_vlen(t);
+	fields = calloc(n, sizeof(*fields));
+	if (!fields)
+		return;
+
+	for (i = 0, m = btf_members(t); i < n; i++, m++) {
+		__u32 bit_off = btf_member_bit_offset(t, i);
+		const struct btf_type *md, *mt;
+		__u32 mid = m->type;
+
+		md = bpf_btf_skip_mods(btf, &mid);
+		mt = bpf_btf_resolve(btf, mid);
+		if (!md || !mt || !btf_is_int(mt) || !m->name_off ||
+		    !md->name_off || btf_member_bitfield_size(t, i) ||
+		    bit_off % 8)
+			goto fallback;
+		if ((btf_int_encoding(mt) & ~BTF_INT_SIGNED) ||
+		    btf_int_offset(mt) || btf_int_bits(mt) != mt->size * 8)
+			goto fallback;
+		if (mt->size != 1 && mt->size != 2 && mt->size != 4 &&
+		    mt->size != 8)
+			goto fallback;
+		if (bit_off / 8 + mt->size > map->info.value_size)
+			goto fallback;
+
+		fields[i].name = btf__name_by_offset(btf, m->name_off);
+		fields[i].type = btf__name_by_offset(btf, md->name_off);
+		fields[i].offset = bit_off / 8;
+		fields[i].size = mt->size;
+		fields[i].is_signed = btf_int_encoding(mt) & BTF_INT_SIGNED;
+	}
+
+	snprintf(map->type_name, sizeof(map->type_name), "%s%s",
+		 btf_is_struct(decl) ? "struct " : "",
+		 btf__name_by_offset(btf, decl->name_off));
+	map->fields = fields;
+	map->nr_fields = n;
+	return;
+
+fallback:
+	free(fields);
+}
+
 static int bpf_map_opts_load_info(unsigned int map_id)
 {
 	struct btf_dump_opts dopts = {
 		.sz = sizeof(struct btf_dump_opts)
 	};
+	struct bpf_sk_storage_map_info *map;
 	struct bpf_map_info info = {};
 	uint32_t len = sizeof(info);
 	struct btf_dump *dump;
@@ -3538,6 +4668,13 @@ static int bpf_map_opts_load_info(unsigned int map_id)
 		return -1;
 	}
 
+	/* Raw values are printed without looking at the BTF at all. */
+	if (bpf_map_opts.raw) {
+		btf = NULL;
+		dump = NULL;
+		goto out;
+	}
+
 	r = bpf_maps_opts_load_btf(&info, &btf);
 	if (r) {
 		close(fd);
@@ -3552,11 +4689,15 @@ static int bpf_map_opts_load_info(unsigned int map_id)
 		return -1;
 	}
 
-	bpf_map_opts.maps[bpf_map_opts.nr_maps].id = map_id;
-	bpf_map_opts.maps[bpf_map_opts.nr_maps].fd = fd;
-	bpf_map_opts.maps[bpf_map_opts.nr_maps].info = info;
-	bpf_map_opts.maps[bpf_map_opts.nr_maps].btf = btf;
-	bpf_map_opts.maps[bpf_map_opts.nr_maps++].dump = dump;
+out:
+	map = &bpf_map_opts.maps[bpf_map_opts.nr_maps++];
+	memset(map, 0, sizeof(*map));
+	map->id = map_id;
+	map->fd = fd;
+	map->info = info;
+	map->btf = btf;
+	map->dump = dump;
+	bpf_map_opts_compile_printer(map);
 
 	return 0;
 }
@@ -3609,6 +4750,7 @@ static void bpf_map_opts_destroy(void)
 	int i;
 
 	for (i = 0; i < bpf_map_opts.nr_maps; ++i) {
+		free(bpf_map_opts.maps[i].fields);
 		btf_dump__free(bpf_map_opts.maps[i].dump);
 		btf__free(bpf_map_opts.maps[i].btf);
 		close(bpf_map_opts.maps[i].fd);
@@ -3702,13 +4844,89 @@ static void out_bpf_sk_storage_multiline(struct bpf_sk_storage_map_info *info,
 	out("\n\t]");
 }
 
-static void out_bpf_sk_storage(int map_id, const void *data, size_t len)
+static void out_bpf_sk_storage_fields(struct bpf_sk_storage_map_info *info,
+	const void *data)
 {
-	struct bpf_sk_storage_map_info *map_info;
+	const char *indent = oneline ? "" : "\t\t";
+	const char *nl = oneline ? "" : "\n";
+	unsigned int i;
 
-	map_info = bpf_map_opts_get_info(map_id);
-	if (!map_info) {
-		/* The kernel might return a map we can't get info for, skip
+	out("%s(%s){%s", indent, info->type_name, nl);
+	for (i = 0; i < info->nr_fields; i++) {
+		const struct bpf_sk_storage_field *f = &info->fields[i];
+		const void *p = data + f->offset;
+		__u64 u;
+		__s64 v;
+
+		switch (f->size) {
+		case 1: {
+			__u8 x;
+
+			memcpy(&x, p, sizeof(x));
+			u = x;
+			v = (__s8)x;
+			break;
+		}
+		case 2: {
+			__u16 x;
+
+			memcpy(&x, p, sizeof(x));
+			u = x;
+			v = (__s16)x;
+			break;
+		}
+		case 4: {
+			__u32 x;
+
+			memcpy(&x, p, sizeof(x));
+			u = x;
+			v = (__s32)x;
+			break;
+		}
+		default:
+			memcpy(&u, p, sizeof(u));
+			v = u;
+			break;
+		}
+
+		if (f->is_signed)
+			out("%s%s.%s = (%s)%lld,%s", indent, oneline ? "" : "\t",
+			    f->name, f->type, (long long)v, nl);
+		else
+			out("%s%s.%s = (%s)%llu,%s", indent, oneline ? "" : "\t",
+			    f->name, f->type, (unsigned long long)u, nl);
+	}
+	out("%s}", indent);
+}
+
+static void out_bpf_sk_storage_raw(struct bpf_sk_storage_map_info *info,
+	const unsigned char *data, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	char buf[2 * 256 + 1];
+	size_t i, n;
+
+	out(oneline ? " map_id:%d value:" : "\n\tmap_id:%d value:", info->id);
+	while (len) {
+		n = len < 256 ? len : 256;
+		for (i = 0; i < n; i++) {
+			buf[2 * i] = hex[data[i] >> 4];
+			buf[2 * i + 1] = hex[data[i] & 0xf];
+		}
+		buf[2 * n] = '\0';
+		out("%s", buf);
+		data += n;
+		len -= n;
+	}
+}
+
+static void out_bpf_sk_storage(int map_id, const void *data, size_t len)
+{
+	struct bpf_sk_storage_map_info *map_info;
+
+	map_info = bpf_map_opts_get_info(map_id);
+	if (!map_info) {
+		/* The kernel might return a map we can't get info for, skip
 		 * it but print the other ones.
 		 */
 		out("\n\tmap_id: %d failed to fetch info, skipping\n", map_id);
@@ -3722,10 +4940,18 @@ static void out_bpf_sk_storage(int map_id, const void *data, size_t len)
 		return;
 	}
 
-	if (oneline)
+	if (bpf_map_opts.raw) {
+		out_bpf_sk_storage_raw(map_info, data, len);
+	} else if (map_info->fields) {
+		out(oneline ? " map_id:%d" : "\n\tmap_id:%d [\n", map_id);
+		out_bpf_sk_storage_fields(map_info, data);
+		if (!oneline)
+			out("\n\t]");
+	} else if (oneline) {
 		out_bpf_sk_storage_oneline(map_info, data, len);
-	else
+	} else {
 		out_bpf_sk_storage_multiline(map_info, data, len);
+	}
 }
 
 static void show_sk_bpf_storages(struct rtattr *bpf_stgs)
@@ -3900,12 +5126,12 @@ static int tcpdiag_send(int fd, int protocol, struct filter *f)
 	else
 		return -1;
 
-	if (show_mem) {
+	if (show_mem)
 		req.r.idiag_ext |= (1<<(INET_DIAG_MEMINFO-1));
+	if (show_mem || mem_report)
 		req.r.idiag_ext |= (1<<(INET_DIAG_SKMEMINFO-1));
-	}
 
-	if (show_tcpinfo) {
+	if (show_tcpinfo || top_info) {
 		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
 		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
 		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
@@ -3921,7 +5147,7 @@ static int tcpdiag_send(int fd, int protocol, struct filter *f)
 		.iov_len = sizeof(req)
 	};
 	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
+		bclen = ssfilter_bytecompile(f->f, &bc, true);
 		if (bclen) {
 			rta.rta_type = INET_DIAG_REQ_BYTECODE;
 			rta.rta_len = RTA_LENGTH(bclen);
@@ -3943,135 +5169,1570 @@ static int tcpdiag_send(int fd, int protocol, struct filter *f)
 		close(fd);
 		return -1;
 	}
-
-	return 0;
+
+	return 0;
+}
+
+static int sockdiag_send(int family, int fd, int protocol, struct filter *f)
+{
+	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
+	DIAG_REQUEST(req, struct inet_diag_req_v2 r);
+	struct rtattr *bpf_rta = NULL;
+	char    *bc = NULL;
+	int	bclen;
+	__u32	proto;
+	struct msghdr msg;
+	struct rtattr rta_bc;
+	struct rtattr rta_proto;
+	struct iovec iov[6];
+	int iovlen = 1;
+
+	if (family == PF_UNSPEC)
+		return tcpdiag_send(fd, protocol, f);
+
+	memset(&req.r, 0, sizeof(req.r));
+	req.r.sdiag_family = family;
+	req.r.sdiag_protocol = protocol;
+	req.r.idiag_states = f->states;
+	if (show_mem)
+		req.r.idiag_ext |= (1<<(INET_DIAG_MEMINFO-1));
+	if (show_mem || mem_report)
+		req.r.idiag_ext |= (1<<(INET_DIAG_SKMEMINFO-1));
+
+	if (show_tcpinfo || top_info) {
+		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
+		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
+		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
+	}
+
+	if (show_tos) {
+		req.r.idiag_ext |= (1<<(INET_DIAG_TOS-1));
+		req.r.idiag_ext |= (1<<(INET_DIAG_TCLASS-1));
+	}
+
+	iov[0] = (struct iovec){
+		.iov_base = &req,
+		.iov_len = sizeof(req)
+	};
+	if (f->f) {
+		bclen = ssfilter_bytecompile(f->f, &bc, true);
+		if (bclen) {
+			rta_bc.rta_type = INET_DIAG_REQ_BYTECODE;
+			rta_bc.rta_len = RTA_LENGTH(bclen);
+			iov[1] = (struct iovec){ &rta_bc, sizeof(rta_bc) };
+			iov[2] = (struct iovec){ bc, bclen };
+			req.nlh.nlmsg_len += RTA_LENGTH(bclen);
+			iovlen = 3;
+		}
+	}
+
+	/* put extended protocol attribute, if required */
+	if (protocol > 255) {
+		rta_proto.rta_type = INET_DIAG_REQ_PROTOCOL;
+		rta_proto.rta_len = RTA_LENGTH(sizeof(proto));
+		proto = protocol;
+		iov[iovlen] = (struct iovec){ &rta_proto, sizeof(rta_proto) };
+		iov[iovlen + 1] = (struct iovec){ &proto, sizeof(proto) };
+		req.nlh.nlmsg_len += RTA_LENGTH(sizeof(proto));
+		iovlen += 2;
+	}
+
+#ifdef ENABLE_BPF_SKSTORAGE_SUPPORT
+	if (bpf_map_opts_is_enabled()) {
+		bpf_rta = bpf_map_opts_alloc_rta();
+		if (!bpf_rta) {
+			fprintf(stderr,
+				"ss: cannot alloc request for --bpf-map\n");
+			return -1;
+		}
+
+		iov[iovlen++] = (struct iovec){ bpf_rta, bpf_rta->rta_len };
+		req.nlh.nlmsg_len += bpf_rta->rta_len;
+	}
+#endif
+
+	msg = (struct msghdr) {
+		.msg_name = (void *)&nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = iov,
+		.msg_iovlen = iovlen,
+	};
+
+	if (sendmsg(fd, &msg, 0) < 0) {
+		free(bpf_rta);
+		close(fd);
+		return -1;
+	}
+
+	free(bpf_rta);
+
+	return 0;
+}
+
+struct inet_diag_arg {
+	struct filter *f;
+	int protocol;
+	struct rtnl_handle *rth;
+};
+
+static int kill_inet_sock(struct nlmsghdr *h, void *arg, struct sockstat *s)
+{
+	struct inet_diag_msg *d = NLMSG_DATA(h);
+	struct inet_diag_arg *diag_arg = arg;
+	struct rtnl_handle *rth = diag_arg->rth;
+
+	DIAG_REQUEST(req, struct inet_diag_req_v2 r);
+
+	req.nlh.nlmsg_type = SOCK_DESTROY;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.nlh.nlmsg_seq = ++rth->seq;
+	req.r.sdiag_family = d->idiag_family;
+	req.r.sdiag_protocol = diag_arg->protocol;
+	req.r.id = d->id;
+
+	if (diag_arg->protocol == IPPROTO_RAW) {
+		struct inet_diag_req_raw *raw = (void *)&req.r;
+
+		BUILD_BUG_ON(sizeof(req.r) != sizeof(*raw));
+		raw->sdiag_raw_protocol = s->raw_prot;
+	}
+
+	return rtnl_talk(rth, &req.nlh, NULL);
+}
+
+/* Keys sockets are grouped by, for --aggregate and --event-aggregate.
+ * Addresses are masked to the prefix length, the full address by default.
+ */
+enum {
+	SK_KEY_NONE,
+	SK_KEY_SPORT,
+	SK_KEY_DPORT,
+	SK_KEY_SRC,
+	SK_KEY_DST,
+	SK_KEY_STATE,
+};
+
+static const char * const sk_key_name[] = {
+	[SK_KEY_SPORT] = "sport",
+	[SK_KEY_DPORT] = "dport",
+	[SK_KEY_SRC] = "src",
+	[SK_KEY_DST] = "dst",
+	[SK_KEY_STATE] = "state",
+};
+
+static int sk_key_parse(const char *arg, int *kind, int *plen)
+{
+	const char *slash = strchr(arg, '/');
+	size_t len = slash ? slash - arg : strlen(arg);
+	int i;
+
+	*kind = SK_KEY_NONE;
+	for (i = SK_KEY_SPORT; i < ARRAY_SIZE(sk_key_name); i++)
+		if (len == strlen(sk_key_name[i]) &&
+		    !strncmp(arg, sk_key_name[i], len))
+			*kind = i;
+	if (*kind == SK_KEY_NONE)
+		return -1;
+
+	if (slash) {
+		if (*kind != SK_KEY_SRC && *kind != SK_KEY_DST)
+			return -1;
+		if (get_integer(plen, slash + 1, 0) ||
+		    *plen < 0 || *plen > 128)
+			return -1;
+	}
+	return 0;
+}
+
+/* The key of a socket, an address in key or a port or state in port.
+ * Returns its hash.
+ */
+static unsigned int sk_key_get(int kind, int plen, const struct sockstat *s,
+			       inet_prefix *key, int *port)
+{
+	unsigned int h, i;
+
+	memset(key, 0, sizeof(*key));
+	*port = 0;
+	switch (kind) {
+	case SK_KEY_SPORT:
+		*port = s->lport;
+		break;
+	case SK_KEY_DPORT:
+		*port = s->rport;
+		break;
+	case SK_KEY_STATE:
+		*port = s->state;
+		break;
+	case SK_KEY_SRC:
+	case SK_KEY_DST:
+		*key = kind == SK_KEY_SRC ? s->local : s->remote;
+		key->bitlen = 8 * key->bytelen;
+		if (plen >= 0 && plen < key->bitlen)
+			key->bitlen = plen;
+		for (i = key->bitlen; i < 8 * key->bytelen; i++)
+			((__u8 *)key->data)[i / 8] &= ~(0x80 >> (i % 8));
+		break;
+	}
+
+	h = *port;
+	for (i = 0; i < key->bytelen / 4; i++)
+		h = h * 31 + key->data[i];
+	return h ^ (h >> 16);
+}
+
+static bool sk_key_equal(const inet_prefix *a, int aport,
+			 const inet_prefix *b, int bport)
+{
+	return aport == bport && a->family == b->family &&
+	       a->bitlen == b->bitlen &&
+	       !memcmp(a->data, b->data, a->bytelen);
+}
+
+static const char *sk_key_sprint(int kind, const inet_prefix *key, int port,
+				 char *buf, size_t len)
+{
+	char abuf[INET6_ADDRSTRLEN];
+
+	switch (kind) {
+	case SK_KEY_SPORT:
+	case SK_KEY_DPORT:
+		snprintf(buf, len, "%d", port);
+		break;
+	case SK_KEY_STATE:
+		snprintf(buf, len, "%s", port < ARRAY_SIZE(sstate_name) ?
+			 sstate_name[port] : "UNKNOWN");
+		break;
+	default:
+		snprintf(buf, len, "%s/%d",
+			 inet_ntop(key->family, key->data, abuf, sizeof(abuf)) ? : "?",
+			 key->bitlen);
+		break;
+	}
+	return buf;
+}
+
+/* --aggregate: instead of printing the sockets, their tcp_info is summed
+ * up per key into histograms with logarithmic buckets, four per power of
+ * two, so percentiles are within about 12% of the exact ones. A group
+ * takes a fixed amount of memory, and past AGG_MAX_KEYS groups sockets are
+ * counted in a last "other" group, so memory does not grow with the
+ * number of sockets.
+ */
+#define AGG_HASH		4096
+#define AGG_MAX_KEYS		16384
+#define AGG_EXACT		8	/* values below are counted exactly */
+#define AGG_BUCKETS		(AGG_EXACT + 4 * (40 - 3))	/* up to 2^40 */
+
+enum {
+	AGG_RTT,		/* usec */
+	AGG_CWND,
+	AGG_RETRANS,		/* tcpi_total_retrans */
+	AGG_RATE,		/* delivery rate, bytes/sec */
+	AGG_METRICS,
+};
+
+struct agg_hist {
+	__u32		count[AGG_BUCKETS];
+	__u64		max;
+	double		sum;
+};
+
+struct agg_ent {
+	struct agg_ent	*next;
+	inet_prefix	key;
+	int		port;
+	unsigned long	socks;
+	unsigned long	info;		/* with tcp_info */
+	unsigned long	retrans_socks;
+	struct agg_hist	hist[AGG_METRICS];
+};
+
+static int agg_key;
+static int agg_plen = -1;
+static struct agg_ent *agg_hash[AGG_HASH];
+static struct agg_ent *agg_other;
+static unsigned int agg_count;
+
+static unsigned int agg_bucket(__u64 v)
+{
+	unsigned int o, b;
+
+	if (v < AGG_EXACT)
+		return v;
+	o = 63 - __builtin_clzll(v);
+	b = AGG_EXACT + 4 * (o - 3) + ((v >> (o - 2)) & 3);
+	return b < AGG_BUCKETS ? b : AGG_BUCKETS - 1;
+}
+
+/* The middle of a bucket */
+static __u64 agg_bucket_value(unsigned int b)
+{
+	unsigned int o;
+
+	if (b < AGG_EXACT)
+		return b;
+	o = 3 + (b - AGG_EXACT) / 4;
+	return ((4ULL + (b - AGG_EXACT) % 4) << (o - 2)) + (1ULL << (o - 2)) / 2;
+}
+
+static void agg_hist_add(struct agg_hist *h, __u64 v)
+{
+	h->count[agg_bucket(v)]++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+}
+
+static __u64 agg_hist_pct(const struct agg_hist *h, unsigned long n,
+			  unsigned int pct)
+{
+	unsigned long rank = (n * pct + 99) / 100, seen = 0;
+	unsigned int b;
+
+	for (b = 0; b < AGG_BUCKETS; b++) {
+		seen += h->count[b];
+		if (seen >= rank && seen)
+			return min(agg_bucket_value(b), h->max);
+	}
+	return h->max;
+}
+
+static struct agg_ent *agg_ent_get(const struct sockstat *s)
+{
+	struct agg_ent *e, **pp;
+	inet_prefix key;
+	unsigned int h;
+	int port;
+
+	h = sk_key_get(agg_key, agg_plen, s, &key, &port) & (AGG_HASH - 1);
+	for (pp = &agg_hash[h]; (e = *pp) != NULL; pp = &e->next)
+		if (sk_key_equal(&e->key, e->port, &key, port))
+			return e;
+
+	if (agg_count >= AGG_MAX_KEYS) {
+		if (!agg_other) {
+			agg_other = calloc(1, sizeof(*agg_other));
+			if (!agg_other)
+				abort();
+		}
+		return agg_other;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		abort();
+	e->key = key;
+	e->port = port;
+	*pp = e;
+	agg_count++;
+	return e;
+}
+
+static int inet_agg_sock(struct nlmsghdr *nlh, const struct sockstat *s)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct tcp_info info = {};
+	struct agg_ent *e;
+
+	e = agg_ent_get(s);
+	e->socks++;
+
+	/* mptcp and sctp have their own info */
+	if (s->type != IPPROTO_TCP)
+		return 0;
+	parse_rtattr_flags(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
+			   nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+			   NLA_F_NESTED);
+	if (!tb[INET_DIAG_INFO])
+		return 0;
+	memcpy(&info, RTA_DATA(tb[INET_DIAG_INFO]),
+	       min(RTA_PAYLOAD(tb[INET_DIAG_INFO]), sizeof(info)));
+
+	e->info++;
+	if (info.tcpi_total_retrans)
+		e->retrans_socks++;
+	agg_hist_add(&e->hist[AGG_RTT], info.tcpi_rtt);
+	agg_hist_add(&e->hist[AGG_CWND], info.tcpi_snd_cwnd);
+	agg_hist_add(&e->hist[AGG_RETRANS], info.tcpi_total_retrans);
+	agg_hist_add(&e->hist[AGG_RATE], info.tcpi_delivery_rate);
+	return 0;
+}
+
+static int agg_ent_cmp(const void *a, const void *b)
+{
+	const struct agg_ent *x = *(const struct agg_ent **)a;
+	const struct agg_ent *y = *(const struct agg_ent **)b;
+
+	return x->socks < y->socks ? 1 : x->socks > y->socks ? -1 : 0;
+}
+
+static void agg_print_hist(const char *name, const struct agg_hist *h,
+			   unsigned long n, double scale, const char *unit,
+			   bool bw)
+{
+	static const unsigned int pcts[] = { 50, 90, 99 };
+	char b1[64];
+	unsigned int i;
+
+	if (json) {
+		open_json_object(name);
+		for (i = 0; i < ARRAY_SIZE(pcts); i++) {
+			snprintf(b1, sizeof(b1), "p%u", pcts[i]);
+			print_float(PRINT_JSON, b1, NULL,
+				    agg_hist_pct(h, n, pcts[i]) * scale);
+		}
+		print_float(PRINT_JSON, "max", NULL, h->max * scale);
+		print_float(PRINT_JSON, "mean", NULL, h->sum * scale / n);
+		close_json_object();
+		return;
+	}
+
+	printf(" %s:", name);
+	for (i = 0; i <= ARRAY_SIZE(pcts); i++) {
+		double v = (i < ARRAY_SIZE(pcts) ?
+			    agg_hist_pct(h, n, pcts[i]) : h->max) * scale;
+
+		if (bw)
+			printf("%s%s", i ? "/" : "", sprint_bw(b1, v));
+		else
+			printf("%s%g", i ? "/" : "", v);
+	}
+	printf("%s", unit);
+}
+
+/* One line per group, busiest first */
+static void agg_print(void)
+{
+	struct agg_ent **v, *e;
+	unsigned int i, n = 0;
+	char kbuf[64];
+
+	v = malloc((agg_count + 1) * sizeof(*v));
+	if (!v)
+		abort();
+	for (i = 0; i < AGG_HASH; i++)
+		for (e = agg_hash[i]; e; e = e->next)
+			v[n++] = e;
+	qsort(v, n, sizeof(*v), agg_ent_cmp);
+	if (agg_other)
+		v[n++] = agg_other;
+
+	if (json) {
+		new_json_obj(json);
+		open_json_object(NULL);
+		print_string(PRINT_JSON, "key", NULL, sk_key_name[agg_key]);
+		open_json_array(PRINT_JSON, "groups");
+	}
+
+	for (i = 0; i < n; i++) {
+		e = v[i];
+		if (e == agg_other)
+			strcpy(kbuf, "other");
+		else
+			sk_key_sprint(agg_key, &e->key, e->port,
+				      kbuf, sizeof(kbuf));
+
+		if (json) {
+			open_json_object(NULL);
+			if (e != agg_other &&
+			    (agg_key == SK_KEY_SPORT || agg_key == SK_KEY_DPORT))
+				print_int(PRINT_JSON, sk_key_name[agg_key],
+					  NULL, e->port);
+			else
+				print_string(PRINT_JSON, sk_key_name[agg_key],
+					     NULL, kbuf);
+			print_lluint(PRINT_JSON, "sockets", NULL, e->socks);
+		} else {
+			printf("%s %s sockets %lu", sk_key_name[agg_key], kbuf,
+			       e->socks);
+		}
+
+		if (e->info) {
+			agg_print_hist("rtt", &e->hist[AGG_RTT], e->info,
+				       0.001, "ms", false);
+			agg_print_hist("cwnd", &e->hist[AGG_CWND], e->info,
+				       1, "", false);
+			agg_print_hist("delivery_rate", &e->hist[AGG_RATE],
+				       e->info, 8, "bps", true);
+			if (json) {
+				print_float(PRINT_JSON, "retrans", NULL,
+					    e->hist[AGG_RETRANS].sum);
+				print_lluint(PRINT_JSON, "retrans_sockets",
+					     NULL, e->retrans_socks);
+			} else {
+				printf(" retrans:%.0f retrans_sockets:%lu",
+				       e->hist[AGG_RETRANS].sum,
+				       e->retrans_socks);
+			}
+		}
+
+		if (json)
+			close_json_object();
+		else
+			printf("\n");
+	}
+
+	if (json) {
+		close_json_array(PRINT_JSON, NULL);
+		close_json_object();
+		delete_json_obj();
+	}
+
+	for (i = 0; i < n; i++)
+		free(v[i]);
+	free(v);
+}
+
+/* --sctp-summary: instead of printing the associations and their peer
+ * addresses, they are counted per local endpoint (first local address and
+ * port) while the dump streams in: associations per state, peer paths, and
+ * the state of the primary path, the only one sock_diag reports on. The rto
+ * and srtt of the primary paths go into the --aggregate histograms, so an
+ * endpoint takes a fixed amount of memory and endpoints past AGG_MAX_KEYS
+ * share a last "other" one.
+ */
+#define SCTPSUM_STATES		(SCTP_STATE_SHUTDOWN_ACK_SENT + 1)
+#define SCTPSUM_PATH_STATES	(SCTP_UNCONFIRMED + 2)	/* + unknown */
+
+enum {
+	SCTPSUM_RTO,		/* msec */
+	SCTPSUM_SRTT,		/* jiffies */
+	SCTPSUM_METRICS,
+};
+
+static const char * const sctpsum_path_name[SCTPSUM_PATH_STATES] = {
+	[SCTP_INACTIVE] = "inactive",
+	[SCTP_PF] = "pf",
+	[SCTP_ACTIVE] = "active",
+	[SCTP_UNCONFIRMED] = "unconfirmed",
+	[SCTPSUM_PATH_STATES - 1] = "unknown",
+};
+
+struct sctpsum_ent {
+	struct sctpsum_ent	*next;
+	inet_prefix		local;
+	int			port;
+	unsigned long		endpoints;	/* without an association */
+	unsigned long		assocs;
+	unsigned long		state[SCTPSUM_STATES];
+	unsigned long		paths;
+	unsigned long		multihomed;
+	unsigned long		path_state[SCTPSUM_PATH_STATES];
+	unsigned long		info;		/* with sctp_info */
+	struct agg_hist		hist[SCTPSUM_METRICS];
+};
+
+static bool sctp_summary;
+static struct sctpsum_ent *sctpsum_hash[AGG_HASH];
+static struct sctpsum_ent *sctpsum_other;
+static struct sctpsum_ent sctpsum_total;
+static unsigned int sctpsum_count;
+
+static struct sctpsum_ent *sctpsum_ent_get(const struct sockstat *s)
+{
+	struct sctpsum_ent *e, **pp;
+	inet_prefix key;
+	unsigned int h;
+	int port;
+
+	h = sk_key_get(SK_KEY_SRC, -1, s, &key, &port);
+	port = s->lport;
+	h = (h ^ port) & (AGG_HASH - 1);
+	for (pp = &sctpsum_hash[h]; (e = *pp) != NULL; pp = &e->next)
+		if (sk_key_equal(&e->local, e->port, &key, port))
+			return e;
+
+	if (sctpsum_count >= AGG_MAX_KEYS) {
+		if (!sctpsum_other) {
+			sctpsum_other = calloc(1, sizeof(*sctpsum_other));
+			if (!sctpsum_other)
+				abort();
+		}
+		return sctpsum_other;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		abort();
+	e->local = key;
+	e->port = port;
+	*pp = e;
+	sctpsum_count++;
+	return e;
+}
+
+static int sctpsum_sock(struct nlmsghdr *nlh, const struct sockstat *s)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct sctpsum_ent *ents[2] = { NULL, &sctpsum_total };
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct sctp_info info = {};
+	unsigned int i, paths, pstate;
+
+	parse_rtattr_flags(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
+			   nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+			   NLA_F_NESTED);
+	ents[0] = sctpsum_ent_get(s);
+
+	/* an endpoint is dumped without peers */
+	if (!tb[INET_DIAG_PEERS]) {
+		for (i = 0; i < ARRAY_SIZE(ents); i++)
+			ents[i]->endpoints++;
+		return 0;
+	}
+
+	paths = RTA_PAYLOAD(tb[INET_DIAG_PEERS]) /
+		sizeof(struct sockaddr_storage);
+	if (tb[INET_DIAG_INFO])
+		memcpy(&info, RTA_DATA(tb[INET_DIAG_INFO]),
+		       min(RTA_PAYLOAD(tb[INET_DIAG_INFO]), sizeof(info)));
+	pstate = info.sctpi_p_state;
+	if (pstate >= SCTPSUM_PATH_STATES - 1)
+		pstate = SCTPSUM_PATH_STATES - 1;
+
+	for (i = 0; i < ARRAY_SIZE(ents); i++) {
+		struct sctpsum_ent *e = ents[i];
+
+		e->assocs++;
+		e->paths += paths;
+		if (paths > 1)
+			e->multihomed++;
+		if (!tb[INET_DIAG_INFO])
+			continue;
+		e->info++;
+		if (info.sctpi_state < SCTPSUM_STATES)
+			e->state[info.sctpi_state]++;
+		e->path_state[pstate]++;
+		agg_hist_add(&e->hist[SCTPSUM_RTO], info.sctpi_p_rto);
+		agg_hist_add(&e->hist[SCTPSUM_SRTT], info.sctpi_p_srtt);
+	}
+	return 0;
+}
+
+static int sctpsum_ent_cmp(const void *a, const void *b)
+{
+	const struct sctpsum_ent *x = *(const struct sctpsum_ent **)a;
+	const struct sctpsum_ent *y = *(const struct sctpsum_ent **)b;
+
+	return x->assocs < y->assocs ? 1 : x->assocs > y->assocs ? -1 : 0;
+}
+
+static void sctpsum_print_counts(const char *name,
+				 const char * const *names,
+				 const unsigned long *counts, unsigned int n)
+{
+	unsigned int i;
+
+	if (json)
+		open_json_object(name);
+	else
+		printf(" %s", name);
+	for (i = 0; i < n; i++) {
+		if (!counts[i] || !names[i])
+			continue;
+		if (json)
+			print_lluint(PRINT_JSON, names[i], NULL, counts[i]);
+		else
+			printf(" %s:%lu", names[i], counts[i]);
+	}
+	if (json)
+		close_json_object();
+}
+
+static void sctpsum_print_ent(const struct sctpsum_ent *e, const char *local,
+			      double srtt_scale)
+{
+	if (json) {
+		open_json_object(e == &sctpsum_total ? "total" : NULL);
+		if (e != &sctpsum_total)
+			print_string(PRINT_JSON, "local", NULL, local);
+		print_lluint(PRINT_JSON, "endpoints", NULL, e->endpoints);
+		print_lluint(PRINT_JSON, "assocs", NULL, e->assocs);
+		print_lluint(PRINT_JSON, "paths", NULL, e->paths);
+		print_lluint(PRINT_JSON, "multihomed", NULL, e->multihomed);
+	} else {
+		printf("%s%s endpoints %lu assocs %lu paths %lu multihomed %lu",
+		       e == &sctpsum_total ? "" : "local ", local,
+		       e->endpoints, e->assocs, e->paths, e->multihomed);
+	}
+
+	if (e->info) {
+		sctpsum_print_counts("states", sctp_sstate_name, e->state,
+				     SCTPSUM_STATES);
+		sctpsum_print_counts("primary", sctpsum_path_name,
+				     e->path_state, SCTPSUM_PATH_STATES);
+		agg_print_hist("rto", &e->hist[SCTPSUM_RTO], e->info,
+			       1, "ms", false);
+		agg_print_hist("srtt", &e->hist[SCTPSUM_SRTT], e->info,
+			       srtt_scale, "ms", false);
+	}
+
+	if (json)
+		close_json_object();
+	else
+		printf("\n");
+}
+
+/* One line per local endpoint, most associations first, then the total */
+static void sctpsum_print(void)
+{
+	double srtt_scale = 1000.0 / get_hz();
+	char abuf[INET6_ADDRSTRLEN];
+	struct sctpsum_ent **v, *e;
+	unsigned int i, n = 0;
+	char local[80];
+
+	v = malloc((sctpsum_count + 1) * sizeof(*v));
+	if (!v)
+		abort();
+	for (i = 0; i < AGG_HASH; i++)
+		for (e = sctpsum_hash[i]; e; e = e->next)
+			v[n++] = e;
+	qsort(v, n, sizeof(*v), sctpsum_ent_cmp);
+	if (sctpsum_other)
+		v[n++] = sctpsum_other;
+
+	if (json) {
+		new_json_obj(json);
+		open_json_object(NULL);
+		open_json_array(PRINT_JSON, "endpoints");
+	}
+
+	for (i = 0; i < n; i++) {
+		e = v[i];
+		if (e == sctpsum_other)
+			strcpy(local, "other");
+		else
+			snprintf(local, sizeof(local),
+				 e->local.family == AF_INET6 ? "[%s]:%d" : "%s:%d",
+				 inet_ntop(e->local.family, e->local.data,
+					   abuf, sizeof(abuf)) ? : "*",
+				 e->port);
+		sctpsum_print_ent(e, local, srtt_scale);
+	}
+
+	if (json)
+		close_json_array(PRINT_JSON, NULL);
+	sctpsum_print_ent(&sctpsum_total, "total", srtt_scale);
+	if (json) {
+		close_json_object();
+		delete_json_obj();
+	}
+
+	for (i = 0; i < n; i++)
+		free(v[i]);
+	free(v);
+}
+
+/* --top N --by FIELD: only the N sockets with the highest FIELD are
+ * shown. While the dump goes on, copies of the messages of the leaders are
+ * kept in a min-heap of N entries, and they are only shown at the end, so
+ * memory and output do not depend on the number of sockets.
+ */
+enum {
+	TOP_NONE,
+	TOP_SENDQ,
+	TOP_RECVQ,
+	TOP_RTT,		/* and the following need tcp_info */
+	TOP_RETRANS,
+	TOP_CWND,
+};
+
+static const char * const top_by_name[] = {
+	[TOP_SENDQ] = "sendq",
+	[TOP_RECVQ] = "recvq",
+	[TOP_RTT] = "rtt",
+	[TOP_RETRANS] = "retrans",
+	[TOP_CWND] = "cwnd",
+};
+
+struct top_ent {
+	__u64			val;
+	unsigned int		type;
+	struct nlmsghdr		*nlh;
+};
+
+static int top_by;
+static struct top_ent *top_heap;
+static unsigned int top_count;
+
+static int top_by_parse(const char *arg)
+{
+	int i;
+
+	for (i = TOP_SENDQ; i < ARRAY_SIZE(top_by_name); i++)
+		if (strcmp(arg, top_by_name[i]) == 0)
+			return i;
+	return TOP_NONE;
+}
+
+static __u64 top_value(struct nlmsghdr *nlh, const struct sockstat *s)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct tcp_info info = {};
+
+	if (top_by == TOP_SENDQ)
+		return s->wq;
+	if (top_by == TOP_RECVQ)
+		return s->rq;
+
+	/* mptcp and sctp have their own info */
+	if (s->type != IPPROTO_TCP)
+		return 0;
+	parse_rtattr_flags(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
+			   nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+			   NLA_F_NESTED);
+	if (!tb[INET_DIAG_INFO])
+		return 0;
+	memcpy(&info, RTA_DATA(tb[INET_DIAG_INFO]),
+	       min(RTA_PAYLOAD(tb[INET_DIAG_INFO]), sizeof(info)));
+
+	switch (top_by) {
+	case TOP_RTT:
+		return info.tcpi_rtt;
+	case TOP_RETRANS:
+		return info.tcpi_total_retrans;
+	default:
+		return info.tcpi_snd_cwnd;
+	}
+}
+
+static void top_swap(unsigned int a, unsigned int b)
+{
+	struct top_ent tmp = top_heap[a];
+
+	top_heap[a] = top_heap[b];
+	top_heap[b] = tmp;
+}
+
+static void top_sift_up(unsigned int i)
+{
+	while (i && top_heap[(i - 1) / 2].val > top_heap[i].val) {
+		top_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void top_sift_down(unsigned int i)
+{
+	for (;;) {
+		unsigned int l = 2 * i + 1, m = i;
+
+		if (l < top_count && top_heap[l].val < top_heap[m].val)
+			m = l;
+		if (l + 1 < top_count && top_heap[l + 1].val < top_heap[m].val)
+			m = l + 1;
+		if (m == i)
+			return;
+		top_swap(i, m);
+		i = m;
+	}
+}
+
+static int inet_top_sock(struct nlmsghdr *nlh, const struct sockstat *s)
+{
+	__u64 val = top_value(nlh, s);
+	struct nlmsghdr *copy;
+
+	/* the smallest of the leaders is at the top of the heap */
+	if (top_count == top_n && val <= top_heap[0].val)
+		return 0;
+
+	copy = malloc(nlh->nlmsg_len);
+	if (!copy) {
+		perror("ss: top");
+		return -1;
+	}
+	memcpy(copy, nlh, nlh->nlmsg_len);
+
+	if (top_count < top_n) {
+		top_heap[top_count] = (struct top_ent) {
+			.val = val, .type = s->type, .nlh = copy,
+		};
+		top_sift_up(top_count++);
+	} else {
+		free(top_heap[0].nlh);
+		top_heap[0] = (struct top_ent) {
+			.val = val, .type = s->type, .nlh = copy,
+		};
+		top_sift_down(0);
+	}
+	return 0;
+}
+
+static int top_ent_cmp(const void *a, const void *b)
+{
+	const struct top_ent *x = a, *y = b;
+
+	return x->val < y->val ? 1 : x->val > y->val ? -1 : 0;
+}
+
+/* The leaders, highest first */
+static void top_print(void)
+{
+	unsigned int i;
+
+	qsort(top_heap, top_count, sizeof(*top_heap), top_ent_cmp);
+	for (i = 0; i < top_count; i++) {
+		struct sockstat s = {};
+
+		parse_diag_msg(top_heap[i].nlh, &s);
+		s.type = top_heap[i].type;
+		inet_show_sock(top_heap[i].nlh, &s);
+		free(top_heap[i].nlh);
+	}
+	free(top_heap);
+	top_heap = NULL;
+	top_count = 0;
+}
+
+/* --mem-report: the socket memory counters are summed per owning process,
+ * cgroup and local port, and the top entries of each are printed. Only
+ * SK_MEMINFO is requested from the kernel. A socket shared by several
+ * processes is charged to the first one found.
+ */
+#define MEMREP_HASH		1024
+
+enum {
+	MEMREP_RMEM,		/* rmem_alloc */
+	MEMREP_WMEM,		/* wmem_queued */
+	MEMREP_FWD,		/* fwd_alloc */
+	MEMREP_BACKLOG,
+	MEMREP_DROPS,
+	MEMREP_COUNTERS,
+};
+
+enum {
+	MEMREP_PROCESS,
+	MEMREP_CGROUP,
+	MEMREP_PORT,
+	MEMREP_TABLES,
+};
+
+struct memrep_ent {
+	struct memrep_ent	*next;
+	__u64			key;
+	const char		*task;	/* of a process, in the user_ent arena */
+	unsigned long		socks;
+	__u64			sum[MEMREP_COUNTERS];
+};
+
+static struct memrep_table {
+	const char		*name;
+	struct memrep_ent	*hash[MEMREP_HASH];
+	unsigned int		count;
+} memrep[MEMREP_TABLES] = {
+	[MEMREP_PROCESS] = { .name = "process" },
+	[MEMREP_CGROUP] = { .name = "cgroup" },
+	[MEMREP_PORT] = { .name = "port" },
+};
+
+static struct memrep_ent *memrep_get(struct memrep_table *t, __u64 key)
+{
+	unsigned int h = (key ^ (key >> 32)) * 2654435761u;
+	struct memrep_ent *e, **pp;
+
+	pp = &t->hash[h % MEMREP_HASH];
+	for (; (e = *pp) != NULL; pp = &e->next)
+		if (e->key == key)
+			return e;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		abort();
+	e->key = key;
+	*pp = e;
+	t->count++;
+	return e;
+}
+
+static void memrep_add(struct memrep_ent *e, const __u64 *v)
+{
+	int i;
+
+	e->socks++;
+	for (i = 0; i < MEMREP_COUNTERS; i++)
+		e->sum[i] += v[i];
+}
+
+static int inet_memrep_sock(struct nlmsghdr *nlh, const struct sockstat *s)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	__u32 skmem[SK_MEMINFO_VARS] = {};
+	const struct user_ent *u;
+	__u64 v[MEMREP_COUNTERS];
+	struct memrep_ent *e;
+
+	parse_rtattr_flags(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
+			   nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+			   NLA_F_NESTED);
+	if (tb[INET_DIAG_SKMEMINFO])
+		memcpy(skmem, RTA_DATA(tb[INET_DIAG_SKMEMINFO]),
+		       min(RTA_PAYLOAD(tb[INET_DIAG_SKMEMINFO]),
+			   sizeof(skmem)));
+
+	v[MEMREP_RMEM] = skmem[SK_MEMINFO_RMEM_ALLOC];
+	v[MEMREP_WMEM] = skmem[SK_MEMINFO_WMEM_QUEUED];
+	v[MEMREP_FWD] = skmem[SK_MEMINFO_FWD_ALLOC];
+	v[MEMREP_BACKLOG] = skmem[SK_MEMINFO_BACKLOG];
+	v[MEMREP_DROPS] = skmem[SK_MEMINFO_DROPS];
+
+	u = user_ent_find(s->ino);
+	e = memrep_get(&memrep[MEMREP_PROCESS], u ? u->pid : 0);
+	if (u)
+		e->task = u->task;
+	memrep_add(e, v);
+	memrep_add(memrep_get(&memrep[MEMREP_CGROUP], s->cgroup_id), v);
+	memrep_add(memrep_get(&memrep[MEMREP_PORT], s->lport), v);
+	return 0;
+}
+
+static __u64 memrep_total(const struct memrep_ent *e)
+{
+	return e->sum[MEMREP_RMEM] + e->sum[MEMREP_WMEM] +
+	       e->sum[MEMREP_FWD] + e->sum[MEMREP_BACKLOG];
+}
+
+static int memrep_cmp(const void *a, const void *b)
+{
+	const struct memrep_ent *x = *(const struct memrep_ent **)a;
+	const struct memrep_ent *y = *(const struct memrep_ent **)b;
+	__u64 tx = memrep_total(x), ty = memrep_total(y);
+
+	if (tx != ty)
+		return tx < ty ? 1 : -1;
+	return x->socks < y->socks ? 1 : x->socks > y->socks ? -1 : 0;
+}
+
+static const char *memrep_key_sprint(int table, const struct memrep_ent *e,
+				     char *buf, size_t len)
+{
+	switch (table) {
+	case MEMREP_PROCESS:
+		if (!e->key)
+			return "-";
+		snprintf(buf, len, "%s,pid=%llu", e->task ? : "?",
+			 (unsigned long long)e->key);
+		return buf;
+	case MEMREP_CGROUP:
+		if (!e->key)
+			return "-";
+		return cg_id_to_path(e->key);
+	default:
+		snprintf(buf, len, "%llu", (unsigned long long)e->key);
+		return buf;
+	}
+}
+
+static void memrep_print(void)
+{
+	static const char * const counter_name[] = {
+		[MEMREP_RMEM] = "rmem_alloc",
+		[MEMREP_WMEM] = "wmem_queued",
+		[MEMREP_FWD] = "fwd_alloc",
+		[MEMREP_BACKLOG] = "backlog",
+		[MEMREP_DROPS] = "drops",
+	};
+	unsigned int i, j, k, n;
+	char buf[128];
+
+	if (json) {
+		new_json_obj(json);
+		open_json_object(NULL);
+	}
+
+	for (i = 0; i < MEMREP_TABLES; i++) {
+		struct memrep_table *t = &memrep[i];
+		struct memrep_ent **v, *e;
+
+		v = malloc((t->count ? : 1) * sizeof(*v));
+		if (!v)
+			abort();
+		for (j = 0, n = 0; j < MEMREP_HASH; j++)
+			for (e = t->hash[j]; e; e = e->next)
+				v[n++] = e;
+		qsort(v, n, sizeof(*v), memrep_cmp);
+
+		if (json) {
+			open_json_array(PRINT_JSON, t->name);
+		} else {
+			snprintf(buf, sizeof(buf), "By %s", t->name);
+			printf("%s%-32s %7s", i ? "\n" : "", buf, "Socks");
+			for (k = 0; k < MEMREP_COUNTERS; k++)
+				printf(" %12s", counter_name[k]);
+			printf("\n");
+		}
+
+		for (j = 0; j < n && j < mem_report; j++) {
+			e = v[j];
+			if (json) {
+				const char *key = memrep_key_sprint(i, e, buf,
+								    sizeof(buf));
+
+				open_json_object(NULL);
+				if (i == MEMREP_PROCESS && e->key) {
+					print_string(PRINT_JSON, "task", NULL,
+						     e->task ? : "?");
+					print_lluint(PRINT_JSON, "pid", NULL,
+						     e->key);
+				} else if (i == MEMREP_PROCESS) {
+					print_null(PRINT_JSON, "pid", NULL,
+						   NULL);
+				} else if (i == MEMREP_CGROUP) {
+					print_string(PRINT_JSON, "cgroup", NULL,
+						     key);
+				} else {
+					print_lluint(PRINT_JSON, "port", NULL,
+						     e->key);
+				}
+				print_lluint(PRINT_JSON, "sockets", NULL,
+					     e->socks);
+				for (k = 0; k < MEMREP_COUNTERS; k++)
+					print_lluint(PRINT_JSON,
+						     counter_name[k], NULL,
+						     e->sum[k]);
+				close_json_object();
+			} else {
+				printf("%-32s %7lu",
+				       memrep_key_sprint(i, e, buf, sizeof(buf)),
+				       e->socks);
+				for (k = 0; k < MEMREP_COUNTERS; k++)
+					printf(" %12llu",
+					       (unsigned long long)e->sum[k]);
+				printf("\n");
+			}
+		}
+		if (json)
+			close_json_array(PRINT_JSON, NULL);
+
+		for (j = 0; j < n; j++)
+			free(v[j]);
+		free(v);
+	}
+
+	if (json) {
+		close_json_object();
+		delete_json_obj();
+	}
+}
+
+/* --export: one fixed size record per inet socket, in host byte order and
+ * without any formatting. The stream starts with a struct ss_export_hdr;
+ * readers must use its rec_len to step over records, newer versions may
+ * append fields.
+ */
+#define SS_EXPORT_MAGIC		0x53535831	/* "SSX1" read as host u32 */
+#define SS_EXPORT_VERSION	1
+
+struct ss_export_hdr {
+	__u32	magic;
+	__u16	version;
+	__u16	rec_len;
+};
+
+struct ss_export_rec {
+	__u64	cookie;
+	__u64	cgroup_id;
+	__u8	family;
+	__u8	state;
+	__u16	protocol;
+	__u16	sport;
+	__u16	dport;
+	__u8	src[16];
+	__u8	dst[16];
+	__u32	ifindex;
+	__u32	uid;
+	__u32	inode;
+	__u32	mark;
+	__u32	rqueue;
+	__u32	wqueue;
+	__u32	skmem[SK_MEMINFO_DROPS + 1];	/* zero without -m */
+	__u32	pad;
+	__u8	has_tcp_info;	/* tcpi_* below are valid */
+	__u8	pad2[3];
+	/* tcp_info, in its own units */
+	__u8	tcpi_ca_state;
+	__u8	tcpi_options;
+	__u8	tcpi_snd_wscale;
+	__u8	tcpi_rcv_wscale;
+	__u32	tcpi_rto;
+	__u32	tcpi_rtt;
+	__u32	tcpi_rttvar;
+	__u32	tcpi_min_rtt;
+	__u32	tcpi_snd_mss;
+	__u32	tcpi_rcv_mss;
+	__u32	tcpi_snd_cwnd;
+	__u32	tcpi_snd_ssthresh;
+	__u32	tcpi_unacked;
+	__u32	tcpi_retrans;
+	__u32	tcpi_total_retrans;
+	__u32	tcpi_lost;
+	__u32	tcpi_reordering;
+	__u32	tcpi_segs_out;
+	__u32	tcpi_segs_in;
+	__u32	tcpi_data_segs_out;
+	__u32	tcpi_data_segs_in;
+	__u32	tcpi_delivered;
+	__u32	tcpi_delivered_ce;
+	__u32	tcpi_notsent_bytes;
+	__u32	tcpi_snd_wnd;
+	__u32	tcpi_rcv_wnd;
+	__u64	tcpi_bytes_acked;
+	__u64	tcpi_bytes_received;
+	__u64	tcpi_bytes_sent;
+	__u64	tcpi_bytes_retrans;
+	__u64	tcpi_pacing_rate;
+	__u64	tcpi_max_pacing_rate;
+	__u64	tcpi_delivery_rate;
+	__u64	tcpi_busy_time;
+	__u64	tcpi_rwnd_limited;
+	__u64	tcpi_sndbuf_limited;
+};
+
+static FILE *export_fp;
+
+static int export_start(const char *path)
+{
+	struct ss_export_hdr hdr = {
+		.magic = SS_EXPORT_MAGIC,
+		.version = SS_EXPORT_VERSION,
+		.rec_len = sizeof(struct ss_export_rec),
+	};
+
+	export_fp = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	if (!export_fp) {
+		fprintf(stderr, "ss: cannot open \"%s\": %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+	setvbuf(export_fp, NULL, _IOFBF, 1 << 20);
+
+	return fwrite(&hdr, sizeof(hdr), 1, export_fp) == 1 ? 0 : -1;
+}
+
+static int inet_export_sock(struct nlmsghdr *nlh, const struct sockstat *s)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(nlh);
+	struct rtattr *tb[INET_DIAG_MAX+1];
+	struct ss_export_rec rec = {
+		.cookie = s->sk,
+		.cgroup_id = s->cgroup_id,
+		.family = s->local.family,
+		.protocol = s->type,
+		.state = s->state,
+		.sport = s->lport,
+		.dport = s->rport,
+		.ifindex = s->iface,
+		.uid = s->uid,
+		.inode = s->ino,
+		.mark = s->mark,
+		.rqueue = s->rq,
+		.wqueue = s->wq,
+	};
+
+	parse_rtattr_flags(tb, INET_DIAG_MAX, (struct rtattr *)(r+1),
+			   nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)),
+			   NLA_F_NESTED);
+
+	memcpy(rec.src, s->local.data, s->local.bytelen);
+	memcpy(rec.dst, s->remote.data, s->remote.bytelen);
+
+	if (tb[INET_DIAG_SKMEMINFO])
+		memcpy(rec.skmem, RTA_DATA(tb[INET_DIAG_SKMEMINFO]),
+		       min(RTA_PAYLOAD(tb[INET_DIAG_SKMEMINFO]),
+			   sizeof(rec.skmem)));
+
+	if (tb[INET_DIAG_INFO] && s->type != IPPROTO_SCTP) {
+		struct tcp_info info = {};
+
+		memcpy(&info, RTA_DATA(tb[INET_DIAG_INFO]),
+		       min(RTA_PAYLOAD(tb[INET_DIAG_INFO]), sizeof(info)));
+
+		rec.has_tcp_info = 1;
+		rec.tcpi_ca_state = info.tcpi_ca_state;
+		rec.tcpi_options = info.tcpi_options;
+		rec.tcpi_snd_wscale = info.tcpi_snd_wscale;
+		rec.tcpi_rcv_wscale = info.tcpi_rcv_wscale;
+		rec.tcpi_rto = info.tcpi_rto;
+		rec.tcpi_rtt = info.tcpi_rtt;
+		rec.tcpi_rttvar = info.tcpi_rttvar;
+		rec.tcpi_min_rtt = info.tcpi_min_rtt;
+		rec.tcpi_snd_mss = info.tcpi_snd_mss;
+		rec.tcpi_rcv_mss = info.tcpi_rcv_mss;
+		rec.tcpi_snd_cwnd = info.tcpi_snd_cwnd;
+		rec.tcpi_snd_ssthresh = info.tcpi_snd_ssthresh;
+		rec.tcpi_unacked = info.tcpi_unacked;
+		rec.tcpi_retrans = info.tcpi_retrans;
+		rec.tcpi_total_retrans = info.tcpi_total_retrans;
+		rec.tcpi_lost = info.tcpi_lost;
+		rec.tcpi_reordering = info.tcpi_reordering;
+		rec.tcpi_segs_out = info.tcpi_segs_out;
+		rec.tcpi_segs_in = info.tcpi_segs_in;
+		rec.tcpi_data_segs_out = info.tcpi_data_segs_out;
+		rec.tcpi_data_segs_in = info.tcpi_data_segs_in;
+		rec.tcpi_delivered = info.tcpi_delivered;
+		rec.tcpi_delivered_ce = info.tcpi_delivered_ce;
+		rec.tcpi_notsent_bytes = info.tcpi_notsent_bytes;
+		rec.tcpi_snd_wnd = info.tcpi_snd_wnd;
+		rec.tcpi_rcv_wnd = info.tcpi_rcv_wnd;
+		rec.tcpi_bytes_acked = info.tcpi_bytes_acked;
+		rec.tcpi_bytes_received = info.tcpi_bytes_received;
+		rec.tcpi_bytes_sent = info.tcpi_bytes_sent;
+		rec.tcpi_bytes_retrans = info.tcpi_bytes_retrans;
+		rec.tcpi_pacing_rate = info.tcpi_pacing_rate;
+		rec.tcpi_max_pacing_rate = info.tcpi_max_pacing_rate;
+		rec.tcpi_delivery_rate = info.tcpi_delivery_rate;
+		rec.tcpi_busy_time = info.tcpi_busy_time;
+		rec.tcpi_rwnd_limited = info.tcpi_rwnd_limited;
+		rec.tcpi_sndbuf_limited = info.tcpi_sndbuf_limited;
+	}
+
+	if (fwrite(&rec, sizeof(rec), 1, export_fp) != 1) {
+		perror("ss: export");
+		return -1;
+	}
+	return 0;
+}
+
+/* Batched -K: SOCK_DESTROY requests are queued and sent to the kernel
+ * in one write each. The kernel answers every request of the write with
+ * an ACK before send() returns, so those are collected right after it
+ * and the copy of each diag message is only printed once its socket is
+ * known to be gone.
+ */
+#define KILL_BATCH_DEFAULT	256
+#define KILL_BATCH_LIMIT	4096
+
+struct kill_req {
+	struct nlmsghdr		nlh;
+	struct inet_diag_req_v2	r;
+};
+
+struct kill_batch {
+	struct rtnl_handle	*rth;
+	struct kill_req		*reqs;
+	struct nlmsghdr		**msgs;		/* diag messages, to print */
+	int			*protocols;
+	unsigned int		n;
+	__u32			first_seq;
+	double			next_send;
+	double			next_progress;
+	unsigned long		killed;
+	unsigned long		gone;		/* ENOENT or EOPNOTSUPP */
+	unsigned long		failed;
+	int			err;		/* first unexpected error */
+};
+
+static struct kill_batch kill_batch;
+
+static int kill_batch_init(struct rtnl_handle *rth)
+{
+	struct kill_batch *kb = &kill_batch;
+	int sndbuf = kill_batch_max * sizeof(*kb->reqs) + 4096;
+	int rcvbuf = kill_batch_max * 1024;
+	int one = 1;
+
+	/* The whole batch must fit in one skb, and all of its ACKs in the
+	 * receive queue; the latter need no copy of our requests.
+	 */
+	setsockopt(rth->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &rcvbuf, sizeof(rcvbuf)))
+		setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF,
+			   &rcvbuf, sizeof(rcvbuf));
+	setsockopt(rth->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+	kb->rth = rth;
+	kb->n = 0;
+	if (kb->reqs)
+		return 0;
+
+	kb->reqs = calloc(kill_batch_max, sizeof(*kb->reqs));
+	kb->msgs = calloc(kill_batch_max, sizeof(*kb->msgs));
+	kb->protocols = calloc(kill_batch_max, sizeof(*kb->protocols));
+	if (!kb->reqs || !kb->msgs || !kb->protocols) {
+		perror("ss: kill batch");
+		return -1;
+	}
+	kb->next_progress = monotonic_now() + 1;
+	return 0;
+}
+
+static void kill_batch_progress(const struct kill_batch *kb)
+{
+	fprintf(stderr, "ss: killed %lu, already gone %lu, failed %lu\n",
+		kb->killed, kb->gone, kb->failed);
+}
+
+static int kill_batch_show(struct kill_batch *kb, unsigned int i)
+{
+	struct nlmsghdr *h = kb->msgs[i];
+	struct sockstat s = {};
+
+	parse_diag_msg(h, &s);
+	s.type = kb->protocols[i];
+
+	if (export_fp)
+		return inet_export_sock(h, &s);
+	if (agg_key)
+		return inet_agg_sock(h, &s);
+	if (sctp_summary)
+		return sctpsum_sock(h, &s);
+	if (top_n)
+		return inet_top_sock(h, &s);
+	if (mem_report)
+		return inet_memrep_sock(h, &s);
+	return inet_show_sock(h, &s) < 0 ? -1 : 0;
+}
+
+static int kill_batch_ack(struct kill_batch *kb, struct nlmsghdr *h,
+			  unsigned int *acked)
+{
+	const struct nlmsgerr *e = NLMSG_DATA(h);
+	unsigned int i = h->nlmsg_seq - kb->first_seq;
+
+	if (h->nlmsg_type != NLMSG_ERROR || i >= kb->n)
+		return 0;
+	if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*e)))
+		return 0;
+	(*acked)++;
+
+	switch (-e->error) {
+	case 0:
+		kb->killed++;
+		return kill_batch_show(kb, i);
+	case ENOENT:
+	case EOPNOTSUPP:
+		/* Socket can't be closed, or is already closed. */
+		kb->gone++;
+		return 0;
+	default:
+		kb->failed++;
+		if (!kb->err)
+			kb->err = -e->error;
+		return 0;
+	}
 }
 
-static int sockdiag_send(int family, int fd, int protocol, struct filter *f)
+static int kill_batch_flush(void)
 {
-	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
-	DIAG_REQUEST(req, struct inet_diag_req_v2 r);
-	struct rtattr *bpf_rta = NULL;
-	char    *bc = NULL;
-	int	bclen;
-	__u32	proto;
-	struct msghdr msg;
-	struct rtattr rta_bc;
-	struct rtattr rta_proto;
-	struct iovec iov[6];
-	int iovlen = 1;
-
-	if (family == PF_UNSPEC)
-		return tcpdiag_send(fd, protocol, f);
+	struct kill_batch *kb = &kill_batch;
+	unsigned int i, acked = 0;
+	char buf[16384];
+	int ret = 0;
 
-	memset(&req.r, 0, sizeof(req.r));
-	req.r.sdiag_family = family;
-	req.r.sdiag_protocol = protocol;
-	req.r.idiag_states = f->states;
-	if (show_mem) {
-		req.r.idiag_ext |= (1<<(INET_DIAG_MEMINFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_SKMEMINFO-1));
-	}
+	if (!kb->n)
+		return 0;
 
-	if (show_tcpinfo) {
-		req.r.idiag_ext |= (1<<(INET_DIAG_INFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_VEGASINFO-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_CONG-1));
-	}
+	if (kill_rate) {
+		double now = monotonic_now();
 
-	if (show_tos) {
-		req.r.idiag_ext |= (1<<(INET_DIAG_TOS-1));
-		req.r.idiag_ext |= (1<<(INET_DIAG_TCLASS-1));
-	}
+		if (kb->next_send > now) {
+			double wait = kb->next_send - now;
+			struct timespec ts = {
+				.tv_sec = wait,
+				.tv_nsec = (wait - (time_t)wait) * 1e9,
+			};
 
-	iov[0] = (struct iovec){
-		.iov_base = &req,
-		.iov_len = sizeof(req)
-	};
-	if (f->f) {
-		bclen = ssfilter_bytecompile(f->f, &bc);
-		if (bclen) {
-			rta_bc.rta_type = INET_DIAG_REQ_BYTECODE;
-			rta_bc.rta_len = RTA_LENGTH(bclen);
-			iov[1] = (struct iovec){ &rta_bc, sizeof(rta_bc) };
-			iov[2] = (struct iovec){ bc, bclen };
-			req.nlh.nlmsg_len += RTA_LENGTH(bclen);
-			iovlen = 3;
+			nanosleep(&ts, NULL);
+		} else {
+			kb->next_send = now;
 		}
+		kb->next_send += (double)kb->n / kill_rate;
 	}
 
-	/* put extended protocol attribute, if required */
-	if (protocol > 255) {
-		rta_proto.rta_type = INET_DIAG_REQ_PROTOCOL;
-		rta_proto.rta_len = RTA_LENGTH(sizeof(proto));
-		proto = protocol;
-		iov[iovlen] = (struct iovec){ &rta_proto, sizeof(rta_proto) };
-		iov[iovlen + 1] = (struct iovec){ &proto, sizeof(proto) };
-		req.nlh.nlmsg_len += RTA_LENGTH(sizeof(proto));
-		iovlen += 2;
+	if (rtnl_send(kb->rth, kb->reqs, kb->n * sizeof(*kb->reqs)) < 0) {
+		perror("ss: SOCK_DESTROY");
+		ret = -1;
+		goto out;
 	}
 
-#ifdef ENABLE_BPF_SKSTORAGE_SUPPORT
-	if (bpf_map_opts_is_enabled()) {
-		bpf_rta = bpf_map_opts_alloc_rta();
-		if (!bpf_rta) {
-			fprintf(stderr,
-				"ss: cannot alloc request for --bpf-map\n");
-			return -1;
+	while (acked < kb->n) {
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
+		ssize_t len;
+
+		len = recv(kb->rth->fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			/* receive queue overflow, the missing ACKs are lost */
+			if (errno == ENOBUFS) {
+				kb->failed += kb->n - acked;
+				break;
+			}
+			perror("ss: SOCK_DESTROY answers");
+			ret = -1;
+			goto out;
 		}
 
-		iov[iovlen++] = (struct iovec){ bpf_rta, bpf_rta->rta_len };
-		req.nlh.nlmsg_len += bpf_rta->rta_len;
+		for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+			if (kill_batch_ack(kb, h, &acked) < 0) {
+				ret = -1;
+				goto out;
+			}
+		}
 	}
-#endif
 
-	msg = (struct msghdr) {
-		.msg_name = (void *)&nladdr,
-		.msg_namelen = sizeof(nladdr),
-		.msg_iov = iov,
-		.msg_iovlen = iovlen,
-	};
-
-	if (sendmsg(fd, &msg, 0) < 0) {
-		free(bpf_rta);
-		close(fd);
-		return -1;
+	if (kb->err) {
+		errno = kb->err;
+		perror("SOCK_DESTROY answers");
+		kb->err = 0;
 	}
 
-	free(bpf_rta);
+	if (monotonic_now() >= kb->next_progress) {
+		kill_batch_progress(kb);
+		kb->next_progress = monotonic_now() + 1;
+	}
 
-	return 0;
+out:
+	for (i = 0; i < kb->n; i++)
+		free(kb->msgs[i]);
+	kb->n = 0;
+	return ret;
 }
 
-struct inet_diag_arg {
-	struct filter *f;
-	int protocol;
-	struct rtnl_handle *rth;
-};
-
-static int kill_inet_sock(struct nlmsghdr *h, void *arg, struct sockstat *s)
+static int kill_batch_add(struct nlmsghdr *h, struct inet_diag_arg *diag_arg,
+			  struct sockstat *s)
 {
+	struct kill_batch *kb = &kill_batch;
 	struct inet_diag_msg *d = NLMSG_DATA(h);
-	struct inet_diag_arg *diag_arg = arg;
-	struct rtnl_handle *rth = diag_arg->rth;
+	struct kill_req *kr = &kb->reqs[kb->n];
+	struct rtnl_handle *rth = kb->rth;
 
-	DIAG_REQUEST(req, struct inet_diag_req_v2 r);
+	kb->msgs[kb->n] = malloc(h->nlmsg_len);
+	if (!kb->msgs[kb->n]) {
+		perror("ss: kill batch");
+		return -1;
+	}
+	memcpy(kb->msgs[kb->n], h, h->nlmsg_len);
+	kb->protocols[kb->n] = diag_arg->protocol;
 
-	req.nlh.nlmsg_type = SOCK_DESTROY;
-	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-	req.nlh.nlmsg_seq = ++rth->seq;
-	req.r.sdiag_family = d->idiag_family;
-	req.r.sdiag_protocol = diag_arg->protocol;
-	req.r.id = d->id;
+	memset(kr, 0, sizeof(*kr));
+	kr->nlh.nlmsg_len = sizeof(*kr);
+	kr->nlh.nlmsg_type = SOCK_DESTROY;
+	kr->nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	kr->nlh.nlmsg_seq = ++rth->seq;
+	kr->r.sdiag_family = d->idiag_family;
+	kr->r.sdiag_protocol = diag_arg->protocol;
+	kr->r.id = d->id;
 
 	if (diag_arg->protocol == IPPROTO_RAW) {
-		struct inet_diag_req_raw *raw = (void *)&req.r;
+		struct inet_diag_req_raw *raw = (void *)&kr->r;
 
-		BUILD_BUG_ON(sizeof(req.r) != sizeof(*raw));
 		raw->sdiag_raw_protocol = s->raw_prot;
 	}
 
-	return rtnl_talk(rth, &req.nlh, NULL);
+	if (!kb->n++)
+		kb->first_seq = rth->seq;
+
+	if (kb->n == kill_batch_max ||
+	    (kill_rate && kb->n >= kill_rate))
+		return kill_batch_flush();
+	return 0;
 }
 
 static int show_one_inet_sock(struct nlmsghdr *h, void *arg)
@@ -4090,6 +6751,9 @@ static int show_one_inet_sock(struct nlmsghdr *h, void *arg)
 	if (diag_arg->f->f && run_ssfilter(diag_arg->f->f, &s) == 0)
 		return 0;
 
+	if (diag_arg->f->kill && kill_batch.rth)
+		return kill_batch_add(h, diag_arg, &s);
+
 	if (diag_arg->f->kill && kill_inet_sock(h, arg, &s) != 0) {
 		if (errno == EOPNOTSUPP || errno == ENOENT) {
 			/* Socket can't be closed, or is already closed. */
@@ -4100,6 +6764,17 @@ static int show_one_inet_sock(struct nlmsghdr *h, void *arg)
 		}
 	}
 
+	if (export_fp)
+		return inet_export_sock(h, &s);
+	if (agg_key)
+		return inet_agg_sock(h, &s);
+	if (sctp_summary)
+		return sctpsum_sock(h, &s);
+	if (top_n)
+		return inet_top_sock(h, &s);
+	if (mem_report)
+		return inet_memrep_sock(h, &s);
+
 	err = inet_show_sock(h, &s);
 	if (err < 0)
 		return err;
@@ -4123,6 +6798,11 @@ static int inet_show_netlink(struct filter *f, FILE *dump_fp, int protocol)
 			return -1;
 		}
 		arg.rth = &rth2;
+		if (kill_batch_max && kill_batch_init(&rth2)) {
+			rtnl_close(&rth2);
+			rtnl_close(&rth);
+			return -1;
+		}
 	}
 
 	rth.dump = MAGIC_SEQ;
@@ -4156,6 +6836,11 @@ again:
 
 Exit:
 	rtnl_close(&rth);
+	if (kill_batch.rth) {
+		if (kill_batch_flush())
+			err = -1;
+		kill_batch.rth = NULL;
+	}
 	if (arg.rth)
 		rtnl_close(arg.rth);
 	return err;
@@ -4222,7 +6907,14 @@ static int tcp_show_netlink_file(struct filter *f)
 		if (f && f->f && run_ssfilter(f->f, &s) == 0)
 			continue;
 
-		err2 = inet_show_sock(h, &s);
+		if (agg_key)
+			err2 = inet_agg_sock(h, &s);
+		else if (top_n)
+			err2 = inet_top_sock(h, &s);
+		else if (mem_report)
+			err2 = inet_memrep_sock(h, &s);
+		else
+			err2 = inet_show_sock(h, &s);
 		if (err2 < 0) {
 			err = err2;
 			break;
@@ -4236,8 +6928,6 @@ static int tcp_show_netlink_file(struct filter *f)
 static int tcp_show(struct filter *f)
 {
 	FILE *fp = NULL;
-	char *buf = NULL;
-	int bufsize = 1024*1024;
 
 	if (!filter_af_get(f, AF_INET) && !filter_af_get(f, AF_INET6))
 		return 0;
@@ -4252,21 +6942,10 @@ static int tcp_show(struct filter *f)
 		return 0;
 
 	/* Sigh... We have to parse /proc/net/tcp... */
-	while (bufsize >= 64*1024) {
-		if ((buf = malloc(bufsize)) != NULL)
-			break;
-		bufsize /= 2;
-	}
-	if (buf == NULL) {
-		errno = ENOMEM;
-		return -1;
-	}
-
 	if (f->families & FAMILY_MASK(AF_INET)) {
 		if ((fp = net_tcp_open()) == NULL)
 			goto outerr;
 
-		setbuffer(fp, buf, bufsize);
 		if (generic_record_read(fp, tcp_show_line, f, AF_INET))
 			goto outerr;
 		fclose(fp);
@@ -4274,20 +6953,17 @@ static int tcp_show(struct filter *f)
 
 	if ((f->families & FAMILY_MASK(AF_INET6)) &&
 	    (fp = net_tcp6_open()) != NULL) {
-		setbuffer(fp, buf, bufsize);
 		if (generic_record_read(fp, tcp_show_line, f, AF_INET6))
 			goto outerr;
 		fclose(fp);
 	}
 
-	free(buf);
 	return 0;
 
 outerr:
 	do {
 		int saved_errno = errno;
 
-		free(buf);
 		if (fp)
 			fclose(fp);
 		errno = saved_errno;
@@ -4779,6 +7455,8 @@ static void packet_show_ring(struct packet_diag_ring *ring)
 	out(",features:0x%x", ring->pdr_features);
 }
 
+static const char *const packet_drop_name = "drops";
+
 static int packet_show_sock(struct nlmsghdr *nlh, void *arg)
 {
 	const struct filter *f = arg;
@@ -4789,6 +7467,9 @@ static int packet_show_sock(struct nlmsghdr *nlh, void *arg)
 	struct sockstat stat = {};
 	uint32_t fanout = 0;
 	bool has_fanout = false;
+	int sampled = 0;
+	double rate;
+	__u64 drops;
 
 	parse_rtattr(tb, PACKET_DIAG_MAX, (struct rtattr *)(r+1),
 		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*r)));
@@ -4828,9 +7509,22 @@ static int packet_show_sock(struct nlmsghdr *nlh, void *arg)
 		fanout = rta_getattr_u32(tb[PACKET_DIAG_FANOUT]);
 	}
 
+	if (interval_ms && RTA_PAYLOAD(tb[PACKET_DIAG_MEMINFO]) >
+			   SK_MEMINFO_DROPS * sizeof(__u32)) {
+		__u32 *skmeminfo = RTA_DATA(tb[PACKET_DIAG_MEMINFO]);
+
+		drops = skmeminfo[SK_MEMINFO_DROPS];
+		sampled = ring_sample(stat.ino, &drops, 1, &rate);
+		if (!sampled)
+			return 0;
+	}
+
 	if (packet_stats_print(&stat, f))
 		return 0;
 
+	if (sampled == 2)
+		ring_rate_print(&packet_drop_name, &rate, 1);
+
 	if (show_details) {
 		if (pinfo) {
 			if (oneline)
@@ -5066,6 +7760,12 @@ static void xdp_show_stats(struct xdp_diag_stats *stats)
 	out(")");
 }
 
+/* --interval rates, in the order of the xdp_diag_stats counters */
+static const char *const xdp_stat_name[] = {
+	"rx_dropped", "rx_invalid", "rx_full", "fill_ring_empty",
+	"tx_invalid", "tx_ring_empty",
+};
+
 static int xdp_show_sock(struct nlmsghdr *nlh, void *arg)
 {
 	struct xdp_diag_ring *rx = NULL, *tx = NULL, *fr = NULL, *cr = NULL;
@@ -5076,6 +7776,8 @@ static int xdp_show_sock(struct nlmsghdr *nlh, void *arg)
 	struct xdp_diag_stats *stats = NULL;
 	const struct filter *f = arg;
 	struct sockstat stat = {};
+	double rate[RING_CNT_MAX];
+	int sampled = 0;
 
 	parse_rtattr(tb, XDP_DIAG_MAX, (struct rtattr *)(msg + 1),
 		     nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg)));
@@ -5111,9 +7813,24 @@ static int xdp_show_sock(struct nlmsghdr *nlh, void *arg)
 	if (tb[XDP_DIAG_STATS])
 		stats = RTA_DATA(tb[XDP_DIAG_STATS]);
 
+	if (interval_ms && stats) {
+		__u64 val[] = {
+			stats->n_rx_dropped, stats->n_rx_invalid,
+			stats->n_rx_full, stats->n_fill_ring_empty,
+			stats->n_tx_invalid, stats->n_tx_ring_empty,
+		};
+
+		sampled = ring_sample(stat.ino, val, ARRAY_SIZE(val), rate);
+		if (!sampled)
+			return 0;
+	}
+
 	if (xdp_stats_print(&stat, f))
 		return 0;
 
+	if (sampled == 2)
+		ring_rate_print(xdp_stat_name, rate, ARRAY_SIZE(xdp_stat_name));
+
 	if (show_details) {
 		if (rx)
 			xdp_show_ring("rx", rx);
@@ -5498,51 +8215,291 @@ static int tipc_show(struct filter *f)
 {
 	DIAG_REQUEST(req, struct tipc_sock_diag_req r);
 
-	memset(&req.r, 0, sizeof(req.r));
-	req.r.sdiag_family = AF_TIPC;
-	req.r.tidiag_states = f->states;
+	memset(&req.r, 0, sizeof(req.r));
+	req.r.sdiag_family = AF_TIPC;
+	req.r.tidiag_states = f->states;
+
+	return handle_netlink_request(f, &req.nlh, sizeof(req), tipc_show_sock);
+}
+
+struct sock_diag_msg {
+	__u8 sdiag_family;
+};
+
+static int show_one_sock(struct nlmsghdr *nlh, void *arg)
+{
+	struct sock_diag_msg *r = NLMSG_DATA(nlh);
+	struct inet_diag_arg inet_arg = { .f = arg, .protocol = IPPROTO_MAX };
+	int ret;
+
+	switch (r->sdiag_family) {
+	case AF_INET:
+	case AF_INET6:
+		inet_arg.rth = inet_arg.f->rth_for_killing;
+		ret = show_one_inet_sock(nlh, &inet_arg);
+		break;
+	case AF_UNIX:
+		ret = unix_show_sock(nlh, arg);
+		break;
+	case AF_PACKET:
+		ret = packet_show_sock(nlh, arg);
+		break;
+	case AF_NETLINK:
+		ret = netlink_show_sock(nlh, arg);
+		break;
+	case AF_VSOCK:
+		ret = vsock_show_sock(nlh, arg);
+		break;
+	case AF_XDP:
+		ret = xdp_show_sock(nlh, arg);
+		break;
+	default:
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static int generic_show_sock(struct nlmsghdr *nlh, void *arg)
+{
+	int ret = show_one_sock(nlh, arg);
+
+	render();
+
+	return ret;
+}
+
+/* Batched -E: events are drained with recvmmsg() from a large receive
+ * queue, and either rendered once per batch, printed one per line, or
+ * counted per address or port over a time window.
+ */
+#define EVENT_BATCH		256
+#define EVENT_BUFSZ		8192
+#define EVENT_RCVBUF		(64 << 20)
+#define EVENT_AGG_HASH		4096
+
+struct event_agg_ent {
+	struct event_agg_ent	*next;
+	inet_prefix		key;		/* address, masked */
+	int			port;
+	unsigned long		count;
+};
+
+static bool event_batch;
+static bool event_compact;
+static int event_agg;
+static int event_agg_plen = -1;		/* -1: full address */
+static unsigned int event_window_ms = 1000;
+
+static struct event_agg_ent *event_agg_hash[EVENT_AGG_HASH];
+static unsigned int event_agg_count;
+static unsigned long event_count, event_overruns;
+
+static void event_agg_add(const struct sockstat *s)
+{
+	struct event_agg_ent *e, **pp;
+	inet_prefix key;
+	unsigned int h;
+	int port;
+
+	h = sk_key_get(event_agg, event_agg_plen, s, &key, &port) &
+	    (EVENT_AGG_HASH - 1);
+
+	for (pp = &event_agg_hash[h]; (e = *pp) != NULL; pp = &e->next) {
+		if (sk_key_equal(&e->key, e->port, &key, port)) {
+			e->count++;
+			return;
+		}
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		abort();
+	e->key = key;
+	e->port = port;
+	e->count = 1;
+	*pp = e;
+	event_agg_count++;
+}
+
+static int event_agg_cmp(const void *a, const void *b)
+{
+	const struct event_agg_ent *x = *(const struct event_agg_ent **)a;
+	const struct event_agg_ent *y = *(const struct event_agg_ent **)b;
+
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+/* Print the counts of the window just ended, busiest first, and reset them */
+static void event_agg_flush(double window)
+{
+	struct event_agg_ent **v, *e;
+	unsigned int i, n = 0;
+	char kbuf[64];
+
+	v = malloc((event_agg_count ? : 1) * sizeof(*v));
+	if (!v)
+		abort();
+	for (i = 0; i < EVENT_AGG_HASH; i++) {
+		for (e = event_agg_hash[i]; e; e = e->next)
+			v[n++] = e;
+		event_agg_hash[i] = NULL;
+	}
+	qsort(v, n, sizeof(*v), event_agg_cmp);
+
+	printf("window %.3fs events %lu overruns %lu\n",
+	       window, event_count, event_overruns);
+	for (i = 0; i < n; i++) {
+		e = v[i];
+		printf("  %s %s %lu\n", sk_key_name[event_agg],
+		       sk_key_sprint(event_agg, &e->key, e->port,
+				     kbuf, sizeof(kbuf)),
+		       e->count);
+	}
+	fflush(stdout);
+
+	for (i = 0; i < n; i++)
+		free(v[i]);
+	free(v);
+	event_agg_count = 0;
+	event_count = 0;
+	event_overruns = 0;
+}
+
+static int event_one(struct nlmsghdr *h, struct filter *f)
+{
+	struct inet_diag_msg *r = NLMSG_DATA(h);
+	char lbuf[INET6_ADDRSTRLEN], rbuf[INET6_ADDRSTRLEN];
+	struct sockstat s = {};
+
+	if (!event_compact && !event_agg)
+		return show_one_sock(h, f);
+
+	if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*r)) ||
+	    (r->idiag_family != AF_INET && r->idiag_family != AF_INET6) ||
+	    !(f->families & FAMILY_MASK(r->idiag_family)))
+		return 0;
+
+	parse_diag_msg(h, &s);
+	s.type = s.raw_prot;
+	if (f->f && run_ssfilter(f->f, &s) == 0)
+		return 0;
+
+	event_count++;
+	if (event_agg) {
+		event_agg_add(&s);
+		return 0;
+	}
+
+	printf("%s %s %s%s%s:%d %s%s%s:%d\n",
+	       s.type == IPPROTO_UDP ? "udp" : "tcp",
+	       s.state < ARRAY_SIZE(sstate_name) ? sstate_name[s.state] : "?",
+	       s.local.family == AF_INET6 ? "[" : "",
+	       inet_ntop(s.local.family, s.local.data, lbuf, sizeof(lbuf)) ? : "?",
+	       s.local.family == AF_INET6 ? "]" : "", s.lport,
+	       s.remote.family == AF_INET6 ? "[" : "",
+	       inet_ntop(s.remote.family, s.remote.data, rbuf, sizeof(rbuf)) ? : "?",
+	       s.remote.family == AF_INET6 ? "]" : "", s.rport);
+	return 0;
+}
+
+static int follow_batch(struct rtnl_handle *rth, struct filter *f)
+{
+	struct mmsghdr msgs[EVENT_BATCH] = {};
+	struct iovec iov[EVENT_BATCH];
+	struct pollfd pfd = { .fd = rth->fd, .events = POLLIN };
+	double window = event_window_ms / 1000., start, end;
+	int rcvbuf = EVENT_RCVBUF;
+	char *bufs;
+	int i;
+
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &rcvbuf, sizeof(rcvbuf)) < 0)
+		setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF,
+			   &rcvbuf, sizeof(rcvbuf));
+
+	bufs = malloc(EVENT_BATCH * EVENT_BUFSZ);
+	if (!bufs)
+		return -1;
+	for (i = 0; i < EVENT_BATCH; i++) {
+		iov[i].iov_base = bufs + i * EVENT_BUFSZ;
+		iov[i].iov_len = EVENT_BUFSZ;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	start = monotonic_now();
+	end = start + window;
+	for (;;) {
+		int timeout = -1, n;
+
+		if (event_agg) {
+			double now = monotonic_now();
+
+			if (now >= end) {
+				event_agg_flush(now - start);
+				start = now;
+				end += window;
+				if (end <= now)
+					end = now + window;
+			}
+			timeout = (end - now) * 1000 + 1;
+		}
+
+		n = poll(&pfd, 1, timeout);
+		if (n < 0 && errno != EINTR)
+			break;
+		if (n <= 0)
+			continue;
 
-	return handle_netlink_request(f, &req.nlh, sizeof(req), tipc_show_sock);
-}
+		/* drain what is queued, a batch at a time */
+		for (;;) {
+			n = recvmmsg(rth->fd, msgs, EVENT_BATCH, MSG_DONTWAIT,
+				     NULL);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == ENOBUFS) {
+					event_overruns++;
+					if (!event_agg)
+						fprintf(stderr,
+							"ss: events lost, receive queue overrun\n");
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				perror("ss: recvmmsg");
+				free(bufs);
+				return -1;
+			}
 
-struct sock_diag_msg {
-	__u8 sdiag_family;
-};
+			for (i = 0; i < n; i++) {
+				struct nlmsghdr *h = iov[i].iov_base;
+				int len = msgs[i].msg_len;
+
+				for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+					if (h->nlmsg_type == NLMSG_DONE ||
+					    h->nlmsg_type == NLMSG_ERROR)
+						continue;
+					if (event_one(h, f) < 0) {
+						free(bufs);
+						return -1;
+					}
+				}
+			}
 
-static int generic_show_sock(struct nlmsghdr *nlh, void *arg)
-{
-	struct sock_diag_msg *r = NLMSG_DATA(nlh);
-	struct inet_diag_arg inet_arg = { .f = arg, .protocol = IPPROTO_MAX };
-	int ret;
+			if (!event_compact && !event_agg)
+				render();
+			if (n < EVENT_BATCH)
+				break;
+		}
 
-	switch (r->sdiag_family) {
-	case AF_INET:
-	case AF_INET6:
-		inet_arg.rth = inet_arg.f->rth_for_killing;
-		ret = show_one_inet_sock(nlh, &inet_arg);
-		break;
-	case AF_UNIX:
-		ret = unix_show_sock(nlh, arg);
-		break;
-	case AF_PACKET:
-		ret = packet_show_sock(nlh, arg);
-		break;
-	case AF_NETLINK:
-		ret = netlink_show_sock(nlh, arg);
-		break;
-	case AF_VSOCK:
-		ret = vsock_show_sock(nlh, arg);
-		break;
-	case AF_XDP:
-		ret = xdp_show_sock(nlh, arg);
-		break;
-	default:
-		ret = -1;
+		if (event_compact)
+			fflush(stdout);
 	}
 
-	render();
-
-	return ret;
+	free(bufs);
+	return -1;
 }
 
 static int handle_follow_request(struct filter *f)
@@ -5577,7 +8534,9 @@ static int handle_follow_request(struct filter *f)
 		f->rth_for_killing = &rth2;
 	}
 
-	if (rtnl_dump_filter(&rth, generic_show_sock, f))
+	if (event_batch || event_compact || event_agg)
+		ret = follow_batch(&rth, f);
+	else if (rtnl_dump_filter(&rth, generic_show_sock, f))
 		ret = -1;
 
 	rtnl_close(&rth);
@@ -5586,53 +8545,163 @@ static int handle_follow_request(struct filter *f)
 	return ret;
 }
 
-static int get_snmp_int(char *proto, char *key, int *result)
+static const struct {
+	unsigned int	dbm;
+	const char	*name;
+	int		(*show)(struct filter *f);
+} ss_tables[] = {
+	{ 1 << NETLINK_DB,	"netlink",	netlink_show },
+	{ PACKET_DBM,		"packet",	packet_show },
+	{ UNIX_DBM,		"unix",		unix_show },
+	{ 1 << RAW_DB,		"raw",		raw_show },
+	{ 1 << UDP_DB,		"udp",		udp_show },
+	{ 1 << TCP_DB,		"tcp",		tcp_show },
+	{ 1 << DCCP_DB,		"dccp",		dccp_show },
+	{ 1 << SCTP_DB,		"sctp",		sctp_show },
+	{ VSOCK_DBM,		"vsock",	vsock_show },
+	{ 1 << TIPC_DB,		"tipc",		tipc_show },
+	{ 1 << XDP_DB,		"xdp",		xdp_show },
+	{ 1 << MPTCP_DB,	"mptcp",	mptcp_show },
+};
+
+static void replay_records(FILE *fp)
 {
-	char buf[1024];
-	FILE *fp;
-	int protolen = strlen(proto);
-	int keylen = strlen(key);
+	char *data = NULL;
+	size_t size = 0;
+	struct ss_rec rec;
+
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		switch (rec.type) {
+		case SS_REC_OUT:
+			if (rec.len > size) {
+				size = rec.len;
+				data = realloc(data, size);
+				if (!data)
+					abort();
+			}
+			if (fread(data, rec.len, 1, fp) != 1)
+				goto out;
+			out("%.*s", (int)rec.len, data);
+			break;
+		case SS_REC_SET:
+			field_set(rec.col);
+			break;
+		case SS_REC_NEXT:
+			field_next();
+			break;
+		}
+	}
+out:
+	free(data);
+}
 
-	*result = 0;
+/* Dump every requested table in its own child and replay their output in
+ * table order, table i is rendered while the following ones are still being
+ * dumped.
+ */
+static void show_tables_parallel(struct filter *f)
+{
+	FILE *rec[ARRAY_SIZE(ss_tables)] = {};
+	pid_t pid[ARRAY_SIZE(ss_tables)];
+	unsigned int i;
 
-	if ((fp = net_snmp_open()) == NULL)
-		return -1;
+	/* walk /proc once, not in every child */
+	if (show_processes || show_threads || show_proc_ctx || show_sock_ctx)
+		user_ent_hash_build();
 
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
-		char *p = buf;
-		int  pos = 0;
+	fflush(stdout);
+	fflush(stderr);
 
-		if (memcmp(buf, proto, protolen))
+	for (i = 0; i < ARRAY_SIZE(ss_tables); i++) {
+		pid[i] = -1;
+		if (!(f->dbs & ss_tables[i].dbm))
 			continue;
-		while ((p = strchr(p, ' ')) != NULL) {
-			pos++;
-			p++;
-			if (memcmp(p, key, keylen) == 0 &&
-			    (p[keylen] == ' ' || p[keylen] == '\n'))
-				break;
+
+		rec[i] = tmpfile();
+		if (!rec[i])
+			continue;	/* dumped here, in order */
+
+		pid[i] = fork();
+		if (pid[i] == 0) {
+			record_fp = rec[i];
+			ss_tables[i].show(f);
+			if (kill_batch.reqs)
+				kill_batch_progress(&kill_batch);
+			_exit(fflush(record_fp) ? 1 : 0);
 		}
-		if (fgets(buf, sizeof(buf), fp) == NULL)
-			break;
-		if (memcmp(buf, proto, protolen))
-			break;
-		p = buf;
-		while ((p = strchr(p, ' ')) != NULL) {
-			p++;
-			if (--pos == 0) {
-				sscanf(p, "%d", result);
-				fclose(fp);
-				return 0;
-			}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ss_tables); i++) {
+		int status;
+
+		if (!(f->dbs & ss_tables[i].dbm))
+			continue;
+
+		if (pid[i] < 0) {
+			ss_tables[i].show(f);
+		} else if (waitpid(pid[i], &status, 0) < 0 ||
+			   !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "ss: dump of %s sockets failed\n",
+				ss_tables[i].name);
+		} else {
+			rewind(rec[i]);
+			replay_records(rec[i]);
 		}
+
+		if (rec[i])
+			fclose(rec[i]);
 	}
+}
 
-	fclose(fp);
-	errno = ESRCH;
-	return -1;
+static void show_tables(struct filter *f)
+{
+	unsigned int i;
+
+	if (parallel_dumps) {
+		show_tables_parallel(f);
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ss_tables); i++)
+		if (f->dbs & ss_tables[i].dbm)
+			ss_tables[i].show(f);
 }
 
 
-/* Get stats from sockstat */
+/* --interval: dump and print the sockets every interval_ms, until killed */
+static int interval_loop(struct filter *f)
+{
+	double next = monotonic_now();
+
+	for (;;) {
+		interval_round++;
+		interval_ts = monotonic_now();
+
+		show_tables(f);
+		render();
+		fflush(stdout);
+		if (export_fp)
+			fflush(export_fp);
+		flow_expire();
+		ring_expire();
+
+		/* owners may have changed by the next round */
+		if (show_processes || show_threads || show_proc_ctx ||
+		    show_sock_ctx)
+			user_ent_destroy();
+
+		next += interval_ms / 1000.0;
+		while (monotonic_sleep_until(next) < 0)
+			;
+
+		if (show_header)
+			print_header();
+	}
+
+	return 0;
+}
+
+/* Get stats from sockstat and snmp */
 
 struct ssummary {
 	int socks;
@@ -5640,6 +8709,7 @@ struct ssummary {
 	int tcp_total;
 	int tcp_orphans;
 	int tcp_tws;
+	int tcp_estab;
 	int tcp4_hashed;
 	int udp4;
 	int raw4;
@@ -5652,87 +8722,242 @@ struct ssummary {
 	int frag6_mem;
 };
 
-static void get_sockstat_line(char *line, struct ssummary *s)
+static const struct ssummary_key {
+	const char	*section;
+	const char	*key;
+	size_t		off;
+} ssummary_keys[] = {
+#define SSUMMARY_KEY(sect, key, field) \
+	{ sect, key, offsetof(struct ssummary, field) }
+	SSUMMARY_KEY("sockets",	"used",		socks),
+	SSUMMARY_KEY("TCP",	"inuse",	tcp4_hashed),
+	SSUMMARY_KEY("TCP",	"orphan",	tcp_orphans),
+	SSUMMARY_KEY("TCP",	"tw",		tcp_tws),
+	SSUMMARY_KEY("TCP",	"alloc",	tcp_total),
+	SSUMMARY_KEY("TCP",	"mem",		tcp_mem),
+	SSUMMARY_KEY("UDP",	"inuse",	udp4),
+	SSUMMARY_KEY("RAW",	"inuse",	raw4),
+	SSUMMARY_KEY("FRAG",	"inuse",	frag4),
+	SSUMMARY_KEY("FRAG",	"memory",	frag4_mem),
+	SSUMMARY_KEY("TCP6",	"inuse",	tcp6_hashed),
+	SSUMMARY_KEY("UDP6",	"inuse",	udp6),
+	SSUMMARY_KEY("RAW6",	"inuse",	raw6),
+	SSUMMARY_KEY("FRAG6",	"inuse",	frag6),
+	SSUMMARY_KEY("FRAG6",	"memory",	frag6_mem),
+	SSUMMARY_KEY("Tcp",	"CurrEstab",	tcp_estab),
+#undef SSUMMARY_KEY
+};
+
+/* The files are small, so each one is read whole with pread() into a
+ * buffer kept across calls and parsed in a single pass. procfs files
+ * can't be mapped, which is why this doesn't use mmap().
+ */
+static char *proc_buf;
+static size_t proc_buf_size;
+
+static ssize_t proc_read_all(FILE *fp)
+{
+	int fd = fileno(fp);
+	size_t len = 0;
+	ssize_t n;
+
+	for (;;) {
+		if (len + 1 >= proc_buf_size) {
+			size_t size = proc_buf_size ? 2 * proc_buf_size : 8192;
+			char *buf = realloc(proc_buf, size);
+
+			if (!buf)
+				return -1;
+			proc_buf = buf;
+			proc_buf_size = size;
+		}
+
+		n = pread(fd, proc_buf + len, proc_buf_size - len - 1, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+
+	proc_buf[len] = '\0';
+	return len;
+}
+
+static const char *proc_next_field(const char **p, const char *end,
+				   size_t *len)
+{
+	const char *start = *p;
+
+	while (start < end && *start == ' ')
+		start++;
+	if (start == end)
+		return NULL;
+
+	*p = memchr(start, ' ', end - start) ? : end;
+	*len = *p - start;
+	return start;
+}
+
+static void ssummary_store(struct ssummary *s, const char *sect, size_t slen,
+			   const char *key, size_t klen, const char *val)
 {
-	char id[256], rem[256];
+	const struct ssummary_key *k;
 
-	if (sscanf(line, "%[^ ] %[^\n]\n", id, rem) != 2)
+	for (k = ssummary_keys; k < ssummary_keys + ARRAY_SIZE(ssummary_keys);
+	     k++) {
+		if (strncmp(k->section, sect, slen) || k->section[slen] ||
+		    strncmp(k->key, key, klen) || k->key[klen])
+			continue;
+		*(int *)((char *)s + k->off) = strtol(val, NULL, 10);
 		return;
+	}
+}
+
+/* sockstat lines are "Sect: key val key val ...", while snmp has a line
+ * of keys followed by a line of values for the same section.
+ */
+static void ssummary_parse(struct ssummary *s, const char *buf, bool paired)
+{
+	const char *line = buf;
+
+	while (*line) {
+		const char *eol = strchrnul(line, '\n');
+		const char *colon = memchr(line, ':', eol - line);
+		const char *key, *val, *p, *q;
+		size_t slen, klen, vlen;
+
+		if (!colon)
+			goto next;
+		slen = colon - line;
+		p = colon + 1;
+
+		if (paired) {
+			const char *vals = eol + (*eol ? 1 : 0);
+			const char *veol = strchrnul(vals, '\n');
+
+			if (veol - vals <= slen || memcmp(vals, line, slen) ||
+			    vals[slen] != ':')
+				goto next;
+			q = vals + slen + 1;
+			while ((key = proc_next_field(&p, eol, &klen)) &&
+			       (val = proc_next_field(&q, veol, &vlen)))
+				ssummary_store(s, line, slen, key, klen, val);
+			eol = veol;
+		} else {
+			while ((key = proc_next_field(&p, eol, &klen)) &&
+			       (val = proc_next_field(&p, eol, &vlen)))
+				ssummary_store(s, line, slen, key, klen, val);
+		}
+next:
+		line = eol + (*eol ? 1 : 0);
+	}
+}
+
+static int ssummary_read(struct ssummary *s, FILE *fp, bool paired)
+{
+	int err = 0;
 
-	if (strcmp(id, "sockets:") == 0)
-		sscanf(rem, "%*s%d", &s->socks);
-	else if (strcmp(id, "UDP:") == 0)
-		sscanf(rem, "%*s%d", &s->udp4);
-	else if (strcmp(id, "UDP6:") == 0)
-		sscanf(rem, "%*s%d", &s->udp6);
-	else if (strcmp(id, "RAW:") == 0)
-		sscanf(rem, "%*s%d", &s->raw4);
-	else if (strcmp(id, "RAW6:") == 0)
-		sscanf(rem, "%*s%d", &s->raw6);
-	else if (strcmp(id, "TCP6:") == 0)
-		sscanf(rem, "%*s%d", &s->tcp6_hashed);
-	else if (strcmp(id, "FRAG:") == 0)
-		sscanf(rem, "%*s%d%*s%d", &s->frag4, &s->frag4_mem);
-	else if (strcmp(id, "FRAG6:") == 0)
-		sscanf(rem, "%*s%d%*s%d", &s->frag6, &s->frag6_mem);
-	else if (strcmp(id, "TCP:") == 0)
-		sscanf(rem, "%*s%d%*s%d%*s%d%*s%d%*s%d",
-		       &s->tcp4_hashed,
-		       &s->tcp_orphans, &s->tcp_tws, &s->tcp_total, &s->tcp_mem);
+	if (proc_read_all(fp) < 0)
+		err = -1;
+	else
+		ssummary_parse(s, proc_buf, paired);
+	fclose(fp);
+	return err;
 }
 
 static int get_sockstat(struct ssummary *s)
 {
-	char buf[256];
 	FILE *fp;
 
 	memset(s, 0, sizeof(*s));
 
 	if ((fp = net_sockstat_open()) == NULL)
 		return -1;
-	while (fgets(buf, sizeof(buf), fp) != NULL)
-		get_sockstat_line(buf, s);
-	fclose(fp);
+	if (ssummary_read(s, fp, false))
+		return -1;
 
 	if ((fp = net_sockstat6_open()) == NULL)
 		return 0;
-	while (fgets(buf, sizeof(buf), fp) != NULL)
-		get_sockstat_line(buf, s);
-	fclose(fp);
+	return ssummary_read(s, fp, false);
+}
 
-	return 0;
+static int get_snmpstat(struct ssummary *s)
+{
+	FILE *fp;
+
+	if ((fp = net_snmp_open()) == NULL)
+		return -1;
+	return ssummary_read(s, fp, true);
+}
+
+static void print_summary_row(const char *name, const char *key,
+			      int v4, int v6)
+{
+	if (json) {
+		open_json_object(key);
+		print_int(PRINT_JSON, "total", NULL, v4 + v6);
+		print_int(PRINT_JSON, "ip", NULL, v4);
+		print_int(PRINT_JSON, "ipv6", NULL, v6);
+		close_json_object();
+		return;
+	}
+
+	printf("%s	  %-9d %-9d %-9d\n", name, v4 + v6, v4, v6);
 }
 
 static int print_summary(void)
 {
 	struct ssummary s;
-	int tcp_estab;
+	int closed;
 
 	if (get_sockstat(&s) < 0)
 		perror("ss: get_sockstat");
-	if (get_snmp_int("Tcp:", "CurrEstab", &tcp_estab) < 0)
+	if (get_snmpstat(&s) < 0)
 		perror("ss: get_snmpstat");
 
-	printf("Total: %d\n", s.socks);
+	closed = s.tcp_total - (s.tcp4_hashed + s.tcp6_hashed - s.tcp_tws);
+
+	if (json) {
+		new_json_obj(json);
+		open_json_object(NULL);
+		print_int(PRINT_JSON, "total", NULL, s.socks);
+		open_json_object("tcp_states");
+		print_int(PRINT_JSON, "total", NULL, s.tcp_total + s.tcp_tws);
+		print_int(PRINT_JSON, "estab", NULL, s.tcp_estab);
+		print_int(PRINT_JSON, "closed", NULL, closed);
+		print_int(PRINT_JSON, "orphaned", NULL, s.tcp_orphans);
+		print_int(PRINT_JSON, "timewait", NULL, s.tcp_tws);
+		close_json_object();
+		open_json_object("transport");
+	} else {
+		printf("Total: %d\n", s.socks);
+
+		printf("TCP:   %d (estab %d, closed %d, orphaned %d, timewait %d)\n",
+		       s.tcp_total + s.tcp_tws, s.tcp_estab, closed,
+		       s.tcp_orphans, s.tcp_tws);
 
-	printf("TCP:   %d (estab %d, closed %d, orphaned %d, timewait %d)\n",
-	       s.tcp_total + s.tcp_tws, tcp_estab,
-	       s.tcp_total - (s.tcp4_hashed + s.tcp6_hashed - s.tcp_tws),
-	       s.tcp_orphans, s.tcp_tws);
+		printf("\n");
+		printf("Transport Total     IP        IPv6\n");
+	}
 
-	printf("\n");
-	printf("Transport Total     IP        IPv6\n");
-	printf("RAW	  %-9d %-9d %-9d\n", s.raw4+s.raw6, s.raw4, s.raw6);
-	printf("UDP	  %-9d %-9d %-9d\n", s.udp4+s.udp6, s.udp4, s.udp6);
-	printf("TCP	  %-9d %-9d %-9d\n", s.tcp4_hashed+s.tcp6_hashed, s.tcp4_hashed, s.tcp6_hashed);
-	printf("INET	  %-9d %-9d %-9d\n",
-	       s.raw4+s.udp4+s.tcp4_hashed+
-	       s.raw6+s.udp6+s.tcp6_hashed,
-	       s.raw4+s.udp4+s.tcp4_hashed,
-	       s.raw6+s.udp6+s.tcp6_hashed);
-	printf("FRAG	  %-9d %-9d %-9d\n", s.frag4+s.frag6, s.frag4, s.frag6);
+	print_summary_row("RAW", "raw", s.raw4, s.raw6);
+	print_summary_row("UDP", "udp", s.udp4, s.udp6);
+	print_summary_row("TCP", "tcp", s.tcp4_hashed, s.tcp6_hashed);
+	print_summary_row("INET", "inet", s.raw4 + s.udp4 + s.tcp4_hashed,
+			  s.raw6 + s.udp6 + s.tcp6_hashed);
+	print_summary_row("FRAG", "frag", s.frag4, s.frag6);
 
-	printf("\n");
+	if (json) {
+		close_json_object();
+		close_json_object();
+		delete_json_obj();
+	} else {
+		printf("\n");
+	}
 
 	return 0;
 }
@@ -5757,12 +8982,15 @@ static void _usage(FILE *dest)
 "   -i, --info          show internal TCP information\n"
 "       --tipcinfo      show internal tipc socket information\n"
 "   -s, --summary       show socket usage summary\n"
+"   -j, --json          print the summary in JSON format, needs -s,\n"
+"                       --aggregate, --mem-report or --sctp-summary\n"
 "       --tos           show tos and priority information\n"
 "       --cgroup        show cgroup information\n"
 "   -b, --bpf           show bpf filter socket information\n"
 #ifdef ENABLE_BPF_SKSTORAGE_SUPPORT
 "       --bpf-maps      show all BPF socket-local storage maps\n"
 "       --bpf-map-id=MAP-ID    show a BPF socket-local storage map\n"
+"       --bpf-maps-raw  show BPF socket-local storage values as hex bytes\n"
 #endif
 "   -E, --events        continually display sockets as they are destroyed\n"
 "   -Z, --context       display task SELinux security contexts\n"
@@ -5786,10 +9014,37 @@ static void _usage(FILE *dest)
 "       FAMILY := {inet|inet6|link|unix|netlink|vsock|tipc|xdp|help}\n"
 "\n"
 "   -K, --kill          forcibly close sockets, display what was closed\n"
+"       --kill-batch[=N]\n"
+"                       send SOCK_DESTROY requests N at a time (default 256)\n"
+"       --kill-rate=N   close at most N sockets per second, implies --kill-batch\n"
 "   -H, --no-header     Suppress header line\n"
 "   -Q, --no-queues     Suppress sending and receiving queue columns\n"
 "   -O, --oneline       socket's data printed on a single line\n"
 "       --inet-sockopt  show various inet socket options\n"
+"       --stream[=ROWS] print sockets as they are dumped, with column widths\n"
+"                       taken from the first ROWS rows (default 100)\n"
+"       --explain       show which parts of the filter run in the kernel\n"
+"       --parallel      dump the socket tables concurrently\n"
+"       --interval=SECS dump every SECS seconds, with per-flow deltas of\n"
+"                       the TCP counters shown by -i, and drop rates of\n"
+"                       the xdp and packet sockets whose drops changed\n"
+"       --export=FILE   write binary records of inet sockets to FILE\n"
+"       --aggregate={sport|dport|src[/PLEN]|dst[/PLEN]|state}\n"
+"                       print rtt, cwnd, delivery rate and retransmit\n"
+"                       summaries of TCP sockets per key, not the sockets\n"
+"       --mem-report[=N]\n"
+"                       print the N processes, cgroups and ports whose\n"
+"                       sockets hold the most memory (default 10)\n"
+"       --sctp-summary  print SCTP association, path and rto/srtt\n"
+"                       summaries per local endpoint, not the associations\n"
+"       --top=N --by={sendq|recvq|rtt|retrans|cwnd}\n"
+"                       show only the N sockets with the highest FIELD\n"
+"       --event-batch   with -E, drain events in batches from a large queue\n"
+"       --event-compact with -E, print one short line per event\n"
+"       --event-aggregate={sport|dport|src[/PLEN]|dst[/PLEN]|state}\n"
+"                       with -E, count events per key and time window\n"
+"       --event-window=SECS\n"
+"                       length of the aggregation window (default 1)\n"
 "\n"
 "   -A, --query=QUERY, --socket=QUERY\n"
 "       QUERY := {all|inet|tcp|mptcp|udp|raw|unix|unix_dgram|unix_stream|unix_seqpacket|packet|packet_raw|packet_dgram|netlink|dccp|sctp|vsock_stream|vsock_dgram|tipc|xdp}[,QUERY]\n"
@@ -5893,6 +9148,29 @@ wrong_state:
 #define OPT_BPF_MAPS 263
 #define OPT_BPF_MAP_ID 264
 
+#define OPT_STREAM 265
+
+#define OPT_EXPLAIN 266
+
+#define OPT_PARALLEL 267
+
+#define OPT_INTERVAL 268
+
+#define OPT_EXPORT 269
+
+#define OPT_EVENT_BATCH 270
+#define OPT_EVENT_COMPACT 271
+#define OPT_EVENT_AGGREGATE 272
+#define OPT_EVENT_WINDOW 273
+#define OPT_KILL_BATCH 274
+#define OPT_KILL_RATE 275
+#define OPT_BPF_MAPS_RAW 276
+#define OPT_AGGREGATE 277
+#define OPT_MEM_REPORT 278
+#define OPT_SCTP_SUMMARY 279
+#define OPT_TOP 280
+#define OPT_TOP_BY 281
+
 static const struct option long_opts[] = {
 	{ "numeric", 0, 0, 'n' },
 	{ "resolve", 0, 0, 'r' },
@@ -5922,6 +9200,7 @@ static const struct option long_opts[] = {
 	{ "socket", 1, 0, 'A' },
 	{ "query", 1, 0, 'A' },
 	{ "summary", 0, 0, 's' },
+	{ "json", 0, 0, 'j' },
 	{ "diag", 1, 0, 'D' },
 	{ "filter", 1, 0, 'F' },
 	{ "version", 0, 0, 'V' },
@@ -5939,9 +9218,26 @@ static const struct option long_opts[] = {
 	{ "mptcp", 0, 0, 'M' },
 	{ "oneline", 0, 0, 'O' },
 	{ "inet-sockopt", 0, 0, OPT_INET_SOCKOPT },
+	{ "stream", 2, 0, OPT_STREAM },
+	{ "explain", 0, 0, OPT_EXPLAIN },
+	{ "parallel", 0, 0, OPT_PARALLEL },
+	{ "interval", 1, 0, OPT_INTERVAL },
+	{ "export", 1, 0, OPT_EXPORT },
+	{ "aggregate", 1, 0, OPT_AGGREGATE },
+	{ "mem-report", 2, 0, OPT_MEM_REPORT },
+	{ "sctp-summary", 0, 0, OPT_SCTP_SUMMARY },
+	{ "top", 1, 0, OPT_TOP },
+	{ "by", 1, 0, OPT_TOP_BY },
+	{ "event-batch", 0, 0, OPT_EVENT_BATCH },
+	{ "event-compact", 0, 0, OPT_EVENT_COMPACT },
+	{ "event-aggregate", 1, 0, OPT_EVENT_AGGREGATE },
+	{ "event-window", 1, 0, OPT_EVENT_WINDOW },
+	{ "kill-batch", 2, 0, OPT_KILL_BATCH },
+	{ "kill-rate", 1, 0, OPT_KILL_RATE },
 #ifdef ENABLE_BPF_SKSTORAGE_SUPPORT
 	{ "bpf-maps", 0, 0, OPT_BPF_MAPS},
 	{ "bpf-map-id", 1, 0, OPT_BPF_MAP_ID},
+	{ "bpf-maps-raw", 0, 0, OPT_BPF_MAPS_RAW},
 #endif
 	{ 0 }
 
@@ -5958,7 +9254,7 @@ int main(int argc, char *argv[])
 	int state_filter = 0;
 
 	while ((ch = getopt_long(argc, argv,
-				 "dhalBetuwxnro460spTbEf:mMiA:D:F:vVzZN:KHQSO",
+				 "dhalBetuwxnro460spTbEf:mMiA:D:F:vVzZN:KHQSOj",
 				 long_opts, NULL)) != EOF) {
 		switch (ch) {
 		case 'n':
@@ -6092,6 +9388,9 @@ int main(int argc, char *argv[])
 		case 's':
 			do_summary = 1;
 			break;
+		case 'j':
+			json = 1;
+			break;
 		case 'D':
 			dump_tcpdiag = optarg;
 			break;
@@ -6139,6 +9438,23 @@ int main(int argc, char *argv[])
 		case 'K':
 			current_filter.kill = 1;
 			break;
+		case OPT_KILL_BATCH:
+			kill_batch_max = KILL_BATCH_DEFAULT;
+			if (optarg &&
+			    (get_unsigned(&kill_batch_max, optarg, 0) ||
+			     !kill_batch_max || kill_batch_max > KILL_BATCH_LIMIT)) {
+				fprintf(stderr, "ss: invalid kill batch \"%s\", max %u\n",
+					optarg, KILL_BATCH_LIMIT);
+				exit(-1);
+			}
+			break;
+		case OPT_KILL_RATE:
+			if (get_unsigned(&kill_rate, optarg, 0) || !kill_rate) {
+				fprintf(stderr, "ss: invalid kill rate \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
 		case 'H':
 			show_header = 0;
 			break;
@@ -6151,6 +9467,100 @@ int main(int argc, char *argv[])
 		case OPT_INET_SOCKOPT:
 			show_inet_sockopt = 1;
 			break;
+		case OPT_EXPLAIN:
+			explain_filter = 1;
+			break;
+		case OPT_PARALLEL:
+			parallel_dumps = 1;
+			break;
+		case OPT_EXPORT:
+			export_path = optarg;
+			break;
+		case OPT_MEM_REPORT:
+			mem_report = 10;
+			if (optarg && (get_unsigned(&mem_report, optarg, 0) ||
+				       !mem_report)) {
+				fprintf(stderr, "ss: invalid report length \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case OPT_SCTP_SUMMARY:
+			sctp_summary = true;
+			break;
+		case OPT_TOP:
+			if (get_unsigned(&top_n, optarg, 0) || !top_n) {
+				fprintf(stderr, "ss: invalid top count \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case OPT_TOP_BY:
+			top_by = top_by_parse(optarg);
+			if (!top_by) {
+				fprintf(stderr, "ss: invalid top field \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case OPT_AGGREGATE:
+			if (sk_key_parse(optarg, &agg_key, &agg_plen)) {
+				fprintf(stderr, "ss: invalid aggregation key \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case OPT_EVENT_BATCH:
+			event_batch = true;
+			break;
+		case OPT_EVENT_COMPACT:
+			event_compact = true;
+			break;
+		case OPT_EVENT_AGGREGATE:
+			if (sk_key_parse(optarg, &event_agg, &event_agg_plen)) {
+				fprintf(stderr, "ss: invalid aggregation key \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
+		case OPT_EVENT_WINDOW:
+		{
+			char *end;
+			double secs = strtod(optarg, &end);
+
+			if (end == optarg || *end || secs < 0.001 ||
+			    secs > UINT_MAX / 1000) {
+				fprintf(stderr, "ss: invalid event window \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			event_window_ms = secs * 1000;
+			break;
+		}
+		case OPT_INTERVAL:
+		{
+			char *end;
+			double secs = strtod(optarg, &end);
+
+			if (end == optarg || *end || secs < 0.001 ||
+			    secs > UINT_MAX / 1000) {
+				fprintf(stderr, "ss: invalid interval \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			interval_ms = secs * 1000;
+			break;
+		}
+		case OPT_STREAM:
+			stream_rows = STREAM_ROWS_DEFAULT;
+			if (optarg &&
+			    (get_integer(&stream_rows, optarg, 0) ||
+			     stream_rows <= 0)) {
+				fprintf(stderr, "ss: invalid stream rows \"%s\"\n",
+					optarg);
+				exit(-1);
+			}
+			break;
 #ifdef ENABLE_BPF_SKSTORAGE_SUPPORT
 		case OPT_BPF_MAPS:
 			if (bpf_map_opts.nr_maps) {
@@ -6163,6 +9573,9 @@ int main(int argc, char *argv[])
 			if (bpf_map_opts_add_id(optarg))
 				exit(1);
 			break;
+		case OPT_BPF_MAPS_RAW:
+			bpf_map_opts.raw = true;
+			break;
 #endif
 		case 'h':
 			help();
@@ -6172,15 +9585,17 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (show_processes || show_threads || show_proc_ctx || show_sock_ctx)
-		user_ent_hash_build();
-
 	argc -= optind;
 	argv += optind;
 
+	if (json && !do_summary && !agg_key && !mem_report && !sctp_summary) {
+		fprintf(stderr, "ss: --json is only supported with --summary, --aggregate, --mem-report and --sctp-summary\n");
+		exit(-1);
+	}
+
 	if (do_summary) {
 		print_summary();
-		if (do_default && argc == 0)
+		if (json || (do_default && argc == 0))
 			exit(0);
 	}
 
@@ -6212,6 +9627,9 @@ int main(int argc, char *argv[])
 	filter_states_set(&current_filter, state_filter);
 	filter_merge_defaults(&current_filter);
 
+	if (resolve_hosts)
+		resolve_start();
+
 #ifdef HAVE_RPC
 	if (!numeric && resolve_hosts &&
 	    (current_filter.dbs & (UNIX_DBM|INET_L4_DBM)))
@@ -6253,6 +9671,69 @@ int main(int argc, char *argv[])
 	if (ssfilter_parse(&current_filter.f, argc, argv, filter_fp))
 		usage();
 
+	if (interval_ms && parallel_dumps) {
+		fprintf(stderr, "ss: --interval and --parallel can not be combined\n");
+		exit(-1);
+	}
+
+	if (kill_rate && !kill_batch_max)
+		kill_batch_max = kill_rate < KILL_BATCH_DEFAULT ?
+				 kill_rate : KILL_BATCH_DEFAULT;
+	if (kill_batch_max && !current_filter.kill) {
+		fprintf(stderr, "ss: --kill-batch and --kill-rate need --kill\n");
+		exit(-1);
+	}
+
+	if (export_path) {
+		if (parallel_dumps) {
+			fprintf(stderr, "ss: --export and --parallel can not be combined\n");
+			exit(-1);
+		}
+		if (export_start(export_path))
+			exit(-1);
+		current_filter.dbs &= INET_DBM;
+		show_tcpinfo = 1;
+		show_header = 0;
+	}
+
+	if (agg_key || mem_report || sctp_summary) {
+		const char *opt = agg_key ? "--aggregate" :
+				  mem_report ? "--mem-report" : "--sctp-summary";
+
+		if (parallel_dumps || interval_ms || export_path ||
+		    follow_events || !!agg_key + !!mem_report + sctp_summary > 1) {
+			fprintf(stderr, "ss: %s can not be combined with --parallel, --interval, --export, -E or each other\n",
+				opt);
+			exit(-1);
+		}
+		current_filter.dbs &= sctp_summary ? 1 << SCTP_DB : INET_DBM;
+		show_tcpinfo = agg_key || sctp_summary;
+		show_header = 0;
+	}
+
+	if (top_n || top_by) {
+		if (!top_n || !top_by) {
+			fprintf(stderr, "ss: --top and --by go together\n");
+			exit(-1);
+		}
+		if (parallel_dumps || interval_ms || export_path ||
+		    follow_events || agg_key || mem_report || sctp_summary ||
+		    current_filter.kill) {
+			fprintf(stderr, "ss: --top can not be combined with --parallel, --interval, --export, -E, -K or the other reports\n");
+			exit(-1);
+		}
+		current_filter.dbs &= INET_DBM;
+		top_info = top_by >= TOP_RTT;
+		top_heap = calloc(top_n, sizeof(*top_heap));
+		if (!top_heap) {
+			perror("ss: top");
+			exit(-1);
+		}
+	}
+
+	if (explain_filter)
+		ssfilter_explain(stderr, &current_filter);
+
 	if (!show_processes)
 		columns[COL_PROC].disabled = 1;
 
@@ -6275,39 +9756,36 @@ int main(int argc, char *argv[])
 	if (follow_events)
 		exit(handle_follow_request(&current_filter));
 
-	if (current_filter.dbs & (1<<NETLINK_DB))
-		netlink_show(&current_filter);
-	if (current_filter.dbs & PACKET_DBM)
-		packet_show(&current_filter);
-	if (current_filter.dbs & UNIX_DBM)
-		unix_show(&current_filter);
-	if (current_filter.dbs & (1<<RAW_DB))
-		raw_show(&current_filter);
-	if (current_filter.dbs & (1<<UDP_DB))
-		udp_show(&current_filter);
-	if (current_filter.dbs & (1<<TCP_DB))
-		tcp_show(&current_filter);
-	if (current_filter.dbs & (1<<DCCP_DB))
-		dccp_show(&current_filter);
-	if (current_filter.dbs & (1<<SCTP_DB))
-		sctp_show(&current_filter);
-	if (current_filter.dbs & VSOCK_DBM)
-		vsock_show(&current_filter);
-	if (current_filter.dbs & (1<<TIPC_DB))
-		tipc_show(&current_filter);
-	if (current_filter.dbs & (1<<XDP_DB))
-		xdp_show(&current_filter);
-	if (current_filter.dbs & (1<<MPTCP_DB))
-		mptcp_show(&current_filter);
+	if (interval_ms)
+		exit(interval_loop(&current_filter));
+
+	show_tables(&current_filter);
+
+	if (agg_key)
+		agg_print();
+	if (sctp_summary)
+		sctpsum_print();
+	if (top_n)
+		top_print();
+	if (mem_report)
+		memrep_print();
 
 	if (show_processes || show_threads || show_proc_ctx || show_sock_ctx)
 		user_ent_destroy();
 
+	if (export_fp && (fflush(export_fp) || ferror(export_fp))) {
+		perror("ss: export");
+		exit(-1);
+	}
+
 #ifdef ENABLE_BPF_SKSTORAGE_SUPPORT
 	bpf_map_opts_destroy();
 #endif
 
 	render();
 
+	if (kill_batch.reqs)
+		kill_batch_progress(&kill_batch);
+
 	return 0;
 }
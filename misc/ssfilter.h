@@ -19,6 +19,7 @@ enum {
 };
 
 bool ssfilter_is_supported(int type);
+bool ssfilter_bytecode_is_supported(int type);
 
 struct ssfilter
 {
@@ -13,19 +13,11 @@ static int dummy_filter(struct nlmsghdr *n, void *arg)
 	return -1;
 }
 
-static bool cgroup_filter_check(void)
+/* Probe whether the kernel accepts the bytecode instruction instr */
+static bool bytecode_check(const void *instr, int inslen)
 {
 	struct sockaddr_nl nladdr = { .nl_family = AF_NETLINK };
 	DIAG_REQUEST(req, struct inet_diag_req_v2 r);
-	struct instr {
-		struct inet_diag_bc_op op;
-		__u64 cgroup_id;
-	} __attribute__((packed));
-	int inslen = sizeof(struct instr);
-	struct instr instr = {
-		{ INET_DIAG_BC_CGROUP_COND, inslen, inslen + 4 },
-		0
-	};
 	struct rtnl_handle rth;
 	struct iovec iov[3];
 	struct msghdr msg;
@@ -48,7 +40,7 @@ static bool cgroup_filter_check(void)
 
 	iov[0] = (struct iovec) { &req, sizeof(req) };
 	iov[1] = (struct iovec) { &rta, sizeof(rta) };
-	iov[2] = (struct iovec) { &instr, inslen };
+	iov[2] = (struct iovec) { (void *)instr, inslen };
 
 	msg = (struct msghdr) {
 		.msg_name = (void *)&nladdr,
@@ -73,6 +65,35 @@ out:
 	return ret;
 }
 
+static bool cgroup_filter_check(void)
+{
+	struct instr {
+		struct inet_diag_bc_op op;
+		__u64 cgroup_id;
+	} __attribute__((packed));
+	int inslen = sizeof(struct instr);
+	struct instr instr = {
+		{ INET_DIAG_BC_CGROUP_COND, inslen, inslen + 4 },
+		0
+	};
+
+	return bytecode_check(&instr, inslen);
+}
+
+static bool devcond_bytecode_check(void)
+{
+	struct instr {
+		struct inet_diag_bc_op op;
+		__u32 iface;
+	} __attribute__((packed));
+	int inslen = sizeof(struct instr);
+	struct instr instr = {
+		{ INET_DIAG_BC_DEV_COND, inslen, inslen + 4 },
+		0
+	};
+
+	return bytecode_check(&instr, inslen);
+}
 
 struct filter_check_t {
 	bool (*check)(void);
@@ -80,25 +101,41 @@ struct filter_check_t {
 		supported:1;
 };
 
+/* Filters the parser accepts at all */
 static struct filter_check_t filter_checks[SSF__MAX] = {
 	[SSF_CGROUPCOND] = { cgroup_filter_check, 0 },
 };
 
-bool ssfilter_is_supported(int type)
+/* Filters that are evaluated in userspace if the kernel cannot */
+static struct filter_check_t bytecode_checks[SSF__MAX] = {
+	[SSF_DEVCOND] = { devcond_bytecode_check, 0 },
+};
+
+static bool filter_check(struct filter_check_t *checks, int type)
 {
-	struct filter_check_t f;
+	struct filter_check_t *f;
 
 	if (type >= SSF__MAX)
 		return false;
 
-	f = filter_checks[type];
-	if (!f.check)
+	f = &checks[type];
+	if (!f->check)
 		return true;
 
-	if (!f.checked) {
-		f.supported = f.check();
-		f.checked = 1;
+	if (!f->checked) {
+		f->supported = f->check();
+		f->checked = 1;
 	}
 
-	return f.supported;
+	return f->supported;
+}
+
+bool ssfilter_is_supported(int type)
+{
+	return filter_check(filter_checks, type);
+}
+
+bool ssfilter_bytecode_is_supported(int type)
+{
+	return filter_check(bytecode_checks, type);
 }
@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Distribution table converter
+ *
+ * Read a text distribution table, as written by maketable, normal,
+ * pareto or paretonormal, and write it in the binary format that tc
+ * maps without parsing (see include/netem_dist.h). For a trace of
+ * your own:
+ *
+ *	maketable trace.values | distbin > trace.distb
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "netem_dist.h"
+
+/* same bound as tc's netem */
+#define MAXDIST	(16 * 1024)
+
+int
+main(int argc, char **argv)
+{
+	struct netem_dist_hdr hdr = {
+		.magic = NETEM_DIST_MAGIC,
+		.version = NETEM_DIST_VERSION,
+		.hdrlen = sizeof(hdr),
+	};
+	static __s16 data[MAXDIST];
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp = stdin;
+
+	if (argc > 1) {
+		if (!(fp = fopen(argv[1], "r"))) {
+			perror(argv[1]);
+			exit(1);
+		}
+	}
+
+	while (getline(&line, &len, fp) != -1) {
+		char *p, *endp;
+		long x;
+
+		if (*line == '\n' || *line == '#')
+			continue;
+
+		for (p = line; ; p = endp) {
+			x = strtol(p, &endp, 0);
+			if (endp == p)
+				break;
+			if (hdr.count >= MAXDIST) {
+				fprintf(stderr, "Too much data\n");
+				exit(2);
+			}
+			if (x < SHRT_MIN || x > SHRT_MAX) {
+				fprintf(stderr, "Value %ld out of range\n", x);
+				exit(2);
+			}
+			data[hdr.count++] = x;
+		}
+	}
+	free(line);
+
+	if (!hdr.count) {
+		fprintf(stderr, "Nothing much read!\n");
+		exit(2);
+	}
+
+	hdr.csum = netem_dist_csum(data, hdr.count);
+	if (fwrite(&hdr, sizeof(hdr), 1, stdout) != 1 ||
+	    fwrite(data, sizeof(data[0]), hdr.count, stdout) != hdr.count ||
+	    fflush(stdout)) {
+		perror("write");
+		exit(3);
+	}
+	return 0;
+}
@@ -13,8 +13,14 @@
 #include <math.h>
 #include <malloc.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "netem_dist.h"
 
 
 double *
@@ -90,14 +96,14 @@ arraystats(double *x, int limit, double *mu, double *sigma, double *rho)
 #define DISTTABLEGRANULARITY 50000
 #define DISTTABLESIZE (DISTTABLEDOMAIN*DISTTABLEGRANULARITY*2)
 
-static int *
+static long long *
 makedist(double *x, int limit, double mu, double sigma)
 {
-	int *table;
+	long long *table;
 	int i, index, first=DISTTABLESIZE, last=0;
 	double input;
 
-	table = calloc(DISTTABLESIZE, sizeof(int));
+	table = calloc(DISTTABLESIZE, sizeof(*table));
 	if (!table) {
 		perror("table alloc");
 		exit(3);
@@ -121,9 +127,9 @@ makedist(double *x, int limit, double mu, double sigma)
 
 /* replace an array by its cumulative distribution */
 static void
-cumulativedist(int *table, int limit, int *total)
+cumulativedist(long long *table, int limit, long long *total)
 {
-	int accum=0;
+	long long accum=0;
 
 	while (--limit >= 0) {
 		accum += *table;
@@ -133,7 +139,8 @@ cumulativedist(int *table, int limit, int *total)
 }
 
 static short *
-inverttable(int *table, int inversesize, int tablesize, int cumulative)
+inverttable(long long *table, int inversesize, int tablesize,
+	    long long cumulative)
 {
 	int i, inverseindex, inversevalue;
 	short *inverse;
@@ -195,6 +202,311 @@ printtable(const short *table, int limit)
 	}
 }
 
+/* Streaming mode (-s): the trace is read once and never kept. Values go
+ * into a histogram of HISTBINS bins centered on the first value, whose
+ * width doubles, merging pairs of bins, whenever a value falls outside of
+ * it. Its memory is fixed and its resolution is 1/HISTBINS of the range
+ * seen. The moments are summed on the way, relative to the first value to
+ * keep the sums small. With -j the file is mapped and cut into chunks at
+ * blanks, each read by a thread of its own. All the histograms share the
+ * same bin edges at a given width, so the chunks merge exactly, in file
+ * order, and give the same table as a single pass.
+ */
+#define HISTBINS	(1 << 20)
+#define MAXJOBS		64
+
+struct hist {
+	double		width;		/* 0 until the first value */
+	unsigned long long *bins;	/* bin HISTBINS/2 starts at origin */
+};
+
+struct stream {
+	struct hist	h;
+	long long	n;
+	double		first, last;	/* relative to origin */
+	double		s1, s2, sxy;	/* sums of d, d^2, d[i]*d[i-1] */
+	const char	*start, *end;	/* chunk of the mapped file, for -j */
+	int		bad;
+};
+
+static double origin;
+
+static void
+histgrow(struct hist *h)
+{
+	unsigned long long *b = h->bins;
+	int i;
+
+	/* bins 2i and 2i+1 from the origin become bin i, in place */
+	for (i = HISTBINS / 2 - 1; i >= HISTBINS / 4; --i)
+		b[i] = b[2*i - HISTBINS/2] + b[2*i - HISTBINS/2 + 1];
+	for (i = HISTBINS / 2; i < 3 * HISTBINS / 4; ++i)
+		b[i] = b[2*i - HISTBINS/2] + b[2*i - HISTBINS/2 + 1];
+	memset(b, 0, HISTBINS / 4 * sizeof(*b));
+	memset(b + 3 * HISTBINS / 4, 0, HISTBINS / 4 * sizeof(*b));
+	h->width *= 2;
+}
+
+static void
+histadd(struct hist *h, double x, unsigned long long count)
+{
+	double pos;
+
+	if (h->width == 0)
+		h->width = (fabs(origin) > 1e-3 ? fabs(origin) : 1e-3) * 1e-12;
+
+	for (;;) {
+		pos = floor((x - origin) / h->width) + HISTBINS / 2;
+		if (pos >= 0 && pos < HISTBINS)
+			break;
+		histgrow(h);
+	}
+	h->bins[(int)pos] += count;
+}
+
+static void
+streamadd(struct stream *st, double x)
+{
+	double d = x - origin;
+
+	histadd(&st->h, x, 1);
+	if (st->n++ == 0)
+		st->first = d;
+	else
+		st->sxy += d * st->last;
+	st->last = d;
+	st->s1 += d;
+	st->s2 += d * d;
+}
+
+static void
+streaminit(struct stream *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->h.bins = calloc(HISTBINS, sizeof(*st->h.bins));
+	if (!st->h.bins) {
+		perror("histogram alloc");
+		exit(3);
+	}
+}
+
+/* Append @b, which follows @a in the trace, to @a */
+static void
+streammerge(struct stream *a, struct stream *b)
+{
+	int i;
+
+	if (!b->n)
+		return;
+	if (a->h.width == 0)
+		a->h.width = b->h.width;
+	while (a->h.width < b->h.width)
+		histgrow(&a->h);
+	while (b->h.width < a->h.width)
+		histgrow(&b->h);
+	for (i = 0; i < HISTBINS; ++i)
+		a->h.bins[i] += b->h.bins[i];
+
+	if (a->n)
+		a->sxy += a->last * b->first;
+	else
+		a->first = b->first;
+	a->last = b->last;
+	a->n += b->n;
+	a->s1 += b->s1;
+	a->s2 += b->s2;
+	a->sxy += b->sxy;
+}
+
+static void
+streamstats(const struct stream *st, double *mu, double *sigma, double *rho)
+{
+	double n = st->n, m = st->s1 / n;
+	double top, sigma2;
+
+	*mu = origin + m;
+	*sigma = sqrt((st->s2 - n * m * m) / (n - 1));
+
+	/* as arraystats(): lag 1 over the first n-1 values */
+	top = st->sxy - m * (2 * st->s1 - st->first - st->last) +
+	      (n - 1) * m * m;
+	sigma2 = st->s2 - st->last * st->last -
+		 2 * m * (st->s1 - st->last) + (n - 1) * m * m;
+	*rho = top / sigma2;
+}
+
+/* The counts of makedist(), taken from the histogram */
+static long long *
+histdist(const struct hist *h, double mu, double sigma)
+{
+	long long *table;
+	double input;
+	int i, index;
+
+	table = calloc(DISTTABLESIZE, sizeof(*table));
+	if (!table) {
+		perror("table alloc");
+		exit(3);
+	}
+
+	for (i = 0; i < HISTBINS; ++i) {
+		if (!h->bins[i])
+			continue;
+		input = (origin + (i - HISTBINS/2 + 0.5) * h->width - mu) /
+			sigma;
+		index = (int)rint((input+DISTTABLEDOMAIN)*DISTTABLEGRANULARITY);
+		if (index < 0) index = 0;
+		if (index >= DISTTABLESIZE) index = DISTTABLESIZE-1;
+		table[index] += h->bins[i];
+	}
+	return table;
+}
+
+static void
+streamfile(FILE *fp, struct stream *st)
+{
+	char *line = NULL, *p, *endp;
+	size_t len = 0;
+	double x;
+
+	while (getline(&line, &len, fp) != -1) {
+		for (p = line; ; p = endp) {
+			x = strtod(p, &endp);
+			if (endp == p)
+				break;
+			if (st->n == 0)
+				origin = x;
+			streamadd(st, x);
+		}
+		while (isspace((unsigned char)*p))
+			++p;
+		if (*p) {
+			st->bad = 1;
+			break;
+		}
+	}
+	free(line);
+}
+
+static void *
+streamchunk(void *arg)
+{
+	struct stream *st = arg;
+	const char *p = st->start;
+	char buf[64];
+	char *endp;
+	size_t n;
+
+	for (;;) {
+		while (p < st->end && isspace((unsigned char)*p))
+			++p;
+		if (p == st->end)
+			break;
+		for (n = 0; p < st->end && !isspace((unsigned char)*p); ++p)
+			if (n < sizeof(buf) - 1)
+				buf[n++] = *p;
+		buf[n] = '\0';
+		streamadd(st, strtod(buf, &endp));
+		if (*endp) {
+			st->bad = 1;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void
+streamparallel(FILE *fp, const char *name, int jobs, struct stream *st)
+{
+	struct stream *chunk;
+	pthread_t tid[MAXJOBS];
+	const char *data, *p;
+	struct stat info;
+	int i;
+
+	if (fstat(fileno(fp), &info) || !S_ISREG(info.st_mode)) {
+		fprintf(stderr, "%s: -j needs a regular file\n", name);
+		exit(1);
+	}
+	if (info.st_size == 0)
+		return;
+	data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+		    fileno(fp), 0);
+	if (data == MAP_FAILED) {
+		perror(name);
+		exit(1);
+	}
+	madvise((void *)data, info.st_size, MADV_SEQUENTIAL);
+
+	/* every chunk is relative to the first value of the file */
+	for (p = data; p < data + info.st_size && isspace((unsigned char)*p); ++p)
+		;
+	origin = strtod(p, NULL);
+
+	chunk = calloc(jobs, sizeof(*chunk));
+	if (!chunk) {
+		perror("chunk alloc");
+		exit(3);
+	}
+	for (i = 0; i < jobs; ++i) {
+		streaminit(&chunk[i]);
+		p = data + info.st_size / jobs * i;
+		/* a chunk starts at a value, after a blank */
+		while (i && p < data + info.st_size &&
+		       !isspace((unsigned char)p[-1]))
+			++p;
+		chunk[i].start = p;
+		if (i)
+			chunk[i - 1].end = p;
+	}
+	chunk[jobs - 1].end = data + info.st_size;
+
+	for (i = 0; i < jobs; ++i) {
+		if (pthread_create(&tid[i], NULL, streamchunk, &chunk[i])) {
+			fprintf(stderr, "Cannot start thread\n");
+			exit(3);
+		}
+	}
+	for (i = 0; i < jobs; ++i) {
+		pthread_join(tid[i], NULL);
+		st->bad |= chunk[i].bad;
+		streammerge(st, &chunk[i]);
+		free(chunk[i].h.bins);
+	}
+	free(chunk);
+	munmap((void *)data, info.st_size);
+}
+
+static void
+printbinary(const short *table, int limit)
+{
+	struct netem_dist_hdr hdr = {
+		.magic = NETEM_DIST_MAGIC,
+		.version = NETEM_DIST_VERSION,
+		.hdrlen = sizeof(hdr),
+		.count = limit,
+	};
+
+	hdr.csum = netem_dist_csum(table, limit);
+	if (fwrite(&hdr, sizeof(hdr), 1, stdout) != 1 ||
+	    fwrite(table, sizeof(*table), limit, stdout) != limit ||
+	    fflush(stdout)) {
+		perror("write");
+		exit(3);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: maketable [ -s ] [ -j JOBS ] [ -b ] [ FILE ]\n"
+		"  -s       read the values in one pass, with bounded memory\n"
+		"  -j JOBS  like -s, reading FILE in JOBS chunks at once\n"
+		"  -b       write the table in the binary format of distbin\n");
+	exit(1);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -202,34 +514,91 @@ main(int argc, char **argv)
 	double *x;
 	double mu, sigma, rho;
 	int limit;
-	int *table;
+	long long *table;
 	short *inverse;
-	int total;
+	long long total;
+	struct stream st;
+	int streaming = 0, binary = 0, jobs = 0;
+	int opt;
 
-	if (argc > 1) {
-		if (!(fp = fopen(argv[1], "r"))) {
-			perror(argv[1]);
+	while ((opt = getopt(argc, argv, "sj:bh")) != -1) {
+		switch (opt) {
+		case 's':
+			streaming = 1;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1 || jobs > MAXJOBS) {
+				fprintf(stderr, "JOBS must be 1 to %d\n",
+					MAXJOBS);
+				exit(1);
+			}
+			streaming = 1;
+			break;
+		case 'b':
+			binary = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind < argc) {
+		if (!(fp = fopen(argv[optind], "r"))) {
+			perror(argv[optind]);
 			exit(1);
 		}
 	} else {
 		fp = stdin;
 	}
-	x = readdoubles(fp, &limit);
-	if (limit <= 0) {
-		fprintf(stderr, "Nothing much read!\n");
-		exit(2);
-	}
-	arraystats(x, limit, &mu, &sigma, &rho);
+
+	if (streaming) {
+		streaminit(&st);
+		if (jobs)
+			streamparallel(fp, optind < argc ? argv[optind] :
+				       "stdin", jobs, &st);
+		else
+			streamfile(fp, &st);
+		if (st.bad) {
+			fprintf(stderr, "Not a number after %lld values\n",
+				st.n);
+			exit(2);
+		}
+		if (st.n < 2) {
+			fprintf(stderr, "Nothing much read!\n");
+			exit(2);
+		}
+		streamstats(&st, &mu, &sigma, &rho);
+		if (!(sigma > 0)) {
+			fprintf(stderr, "All values are the same\n");
+			exit(2);
+		}
+		/* netem scales the table by them: delay MU SIGMA distribution */
+		fprintf(stderr, "%lld values, mu %.6f, sigma %.6f, rho %.6f\n",
+			st.n, mu, sigma, rho);
+		table = histdist(&st.h, mu, sigma);
+		free(st.h.bins);
+	} else {
+		x = readdoubles(fp, &limit);
+		if (limit <= 0) {
+			fprintf(stderr, "Nothing much read!\n");
+			exit(2);
+		}
+		arraystats(x, limit, &mu, &sigma, &rho);
 #ifdef DEBUG
-	fprintf(stderr, "%d values, mu %10.4f, sigma %10.4f, rho %10.4f\n",
-		limit, mu, sigma, rho);
+		fprintf(stderr, "%d values, mu %10.4f, sigma %10.4f, rho %10.4f\n",
+			limit, mu, sigma, rho);
 #endif
 
-	table = makedist(x, limit, mu, sigma);
-	free((void *) x);
+		table = makedist(x, limit, mu, sigma);
+		free((void *) x);
+	}
 	cumulativedist(table, DISTTABLESIZE, &total);
 	inverse = inverttable(table, TABLESIZE, DISTTABLESIZE, total);
 	interpolatetable(inverse, TABLESIZE);
-	printtable(inverse, TABLESIZE);
+	if (binary)
+		printbinary(inverse, TABLESIZE);
+	else
+		printtable(inverse, TABLESIZE);
 	return 0;
 }
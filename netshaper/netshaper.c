@@ -8,6 +8,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <stdarg.h>
 
 #include <linux/genetlink.h>
 #include <linux/netlink.h>
@@ -21,6 +23,7 @@
 #include "json_print.h"
 #include "libgenl.h"
 #include "libnetlink.h"
+#include "rtnl_bulk.h"
 
 /* netlink socket */
 static struct rtnl_handle gen_rth = { .fd = -1 };
@@ -34,6 +37,7 @@ static void usage(void)
 		"COMMAND := { set | get | delete } dev DEVNAME\n"
 		"	    handle scope HANDLE_SCOPE [id HANDLE_ID]\n"
 		"	    [bw-max BW_MAX]\n"
+		"	   load [ diff ] file FILE\n"
 		"Where: DEVNAME         := STRING\n"
 		"       HANDLE_SCOPE    := { netdev | queue | node }\n"
 		"       HANDLE_ID       := UINT (required for queue/node, optional for netdev)\n"
@@ -218,6 +222,817 @@ static int do_cmd(int argc, char **argv, int cmd)
 	return err;
 }
 
+/* "load [ diff ] file FILE" programs a whole tree of shapers, one shaper
+ * per line:
+ *
+ *	dev DEV handle scope SCOPE [ id ID ] [ parent scope SCOPE [ id ID ] ]
+ *	    [ bw-min RATE ] [ bw-max RATE ] [ burst SIZE ]
+ *	    [ priority PRIO ] [ weight WEIGHT ]
+ *
+ * The whole file is parsed and checked before anything is sent: handles
+ * are unique, parents are the netdev or nodes of the file, nodes form a
+ * tree and have queues right under them. Node ids are labels of the file,
+ * the kernel picks the ids of the nodes it creates.
+ *
+ * Requests go out in windows on a socket of their own: the netdev shapers,
+ * the groups creating the nodes a depth of the tree at a time, since they
+ * need the ids of their parents, then the queues. With "diff", the shapers
+ * of the devices are dumped first, only what differs is sent, and the
+ * shapers the file does not have are deleted last.
+ */
+#define NS_WINDOW	256
+#define NS_MSG_SIZE	32768
+#define NS_LOAD_MAX_ARGS	32
+
+enum {
+	NS_BW_MIN,
+	NS_BW_MAX,
+	NS_BURST,
+	NS_PRIORITY,
+	NS_WEIGHT,
+	NS_ATTRS,
+};
+
+static const int ns_attr_type[NS_ATTRS] = {
+	[NS_BW_MIN]	= NET_SHAPER_A_BW_MIN,
+	[NS_BW_MAX]	= NET_SHAPER_A_BW_MAX,
+	[NS_BURST]	= NET_SHAPER_A_BURST,
+	[NS_PRIORITY]	= NET_SHAPER_A_PRIORITY,
+	[NS_WEIGHT]	= NET_SHAPER_A_WEIGHT,
+};
+
+/* the attributes a leaf of a group carries, the others need a set */
+#define NS_LEAF_ATTRS	((1 << NS_PRIORITY) | (1 << NS_WEIGHT))
+
+struct ns_shaper {
+	int		ifindex;
+	__u32		scope;
+	__u32		id;
+	__u32		pscope;		/* unspec for the netdev */
+	__u32		pid;
+	__u64		val[NS_ATTRS];
+	unsigned int	set;		/* attributes given */
+	int		lineno;
+	struct ns_shaper *parent;	/* a node of the same tree */
+	struct ns_shaper *match;	/* in the other tree, with diff */
+	unsigned int	leaves;		/* queues right under a node */
+	int		depth;		/* of a node, 1 right under the netdev */
+	__u32		kid;		/* kernel id of a node */
+	bool		kid_known;
+};
+
+struct ns_tree {
+	struct ns_shaper *s;
+	unsigned int	count;
+	unsigned int	size;
+};
+
+static struct ns_load {
+	struct rtnl_bulk bulk;		/* tags index want, or -1 - have */
+	struct ns_tree	want;
+	struct ns_tree	have;
+} ns_load;
+
+static struct ns_shaper *ns_tree_add(struct ns_tree *t)
+{
+	if (t->count == t->size) {
+		unsigned int size = t->size ? t->size * 2 : 64;
+		struct ns_shaper *s = realloc(t->s, size * sizeof(*s));
+
+		if (!s) {
+			fprintf(stderr, "Out of memory\n");
+			return NULL;
+		}
+		t->s = s;
+		t->size = size;
+	}
+	memset(&t->s[t->count], 0, sizeof(t->s[0]));
+	return &t->s[t->count++];
+}
+
+static struct ns_shaper *ns_tree_find(struct ns_tree *t, int ifindex,
+				      __u32 scope, __u32 id)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->count; i++)
+		if (t->s[i].ifindex == ifindex && t->s[i].scope == scope &&
+		    t->s[i].id == id)
+			return &t->s[i];
+	return NULL;
+}
+
+/* At "scope" of "scope SCOPE [ id ID ]", leaves argv at the last word */
+static int ns_parse_handle(int *argcp, char ***argvp, __u32 *scope, __u32 *id)
+{
+	char **argv = *argvp;
+	int argc = *argcp;
+
+	if (strcmp(*argv, "scope") != 0) {
+		fprintf(stderr, "What is \"%s\"\n", *argv);
+		return -1;
+	}
+	NEXT_ARG();
+	if (strcmp(*argv, "netdev") == 0) {
+		*scope = NET_SHAPER_SCOPE_NETDEV;
+	} else if (strcmp(*argv, "queue") == 0) {
+		*scope = NET_SHAPER_SCOPE_QUEUE;
+	} else if (strcmp(*argv, "node") == 0) {
+		*scope = NET_SHAPER_SCOPE_NODE;
+	} else {
+		fprintf(stderr, "Invalid scope\n");
+		return -1;
+	}
+
+	*id = 0;
+	if (argc > 1 && strcmp(argv[1], "id") == 0) {
+		NEXT_ARG();
+		NEXT_ARG();
+		if (get_u32(id, *argv, 10)) {
+			fprintf(stderr, "Invalid handle id\n");
+			return -1;
+		}
+	} else if (*scope != NET_SHAPER_SCOPE_NETDEV) {
+		fprintf(stderr, "A %s handle needs an id\n",
+			net_shaper_scope_names[*scope]);
+		return -1;
+	}
+	if (*scope == NET_SHAPER_SCOPE_NETDEV && *id) {
+		fprintf(stderr, "The id of a netdev handle is 0\n");
+		return -1;
+	}
+
+	*argcp = argc;
+	*argvp = argv;
+	return 0;
+}
+
+static int ns_load_line(int argc, char **argv, int lineno)
+{
+	bool handle_present = false;
+	struct ns_shaper *s;
+
+	s = ns_tree_add(&ns_load.want);
+	if (!s)
+		return -1;
+	s->lineno = lineno;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			s->ifindex = ll_name_to_index(*argv);
+			if (!s->ifindex) {
+				fprintf(stderr, "Device \"%s\" does not exist\n",
+					*argv);
+				return -1;
+			}
+		} else if (strcmp(*argv, "handle") == 0) {
+			NEXT_ARG();
+			if (ns_parse_handle(&argc, &argv, &s->scope, &s->id))
+				return -1;
+			handle_present = true;
+		} else if (strcmp(*argv, "parent") == 0) {
+			NEXT_ARG();
+			if (ns_parse_handle(&argc, &argv, &s->pscope, &s->pid))
+				return -1;
+		} else if (strcmp(*argv, "bw-min") == 0 ||
+			   strcmp(*argv, "bw-max") == 0) {
+			int a = argv[0][3] == 'm' && argv[0][4] == 'i' ?
+				NS_BW_MIN : NS_BW_MAX;
+
+			NEXT_ARG();
+			if (get_rate64(&s->val[a], *argv)) {
+				fprintf(stderr, "Invalid %s value\n", argv[-1]);
+				return -1;
+			}
+			/* Convert Bps to bps */
+			s->val[a] *= 8;
+			s->set |= 1 << a;
+		} else if (strcmp(*argv, "burst") == 0) {
+			NEXT_ARG();
+			if (get_size64(&s->val[NS_BURST], *argv)) {
+				fprintf(stderr, "Invalid burst value\n");
+				return -1;
+			}
+			s->set |= 1 << NS_BURST;
+		} else if (strcmp(*argv, "priority") == 0 ||
+			   strcmp(*argv, "weight") == 0) {
+			int a = **argv == 'p' ? NS_PRIORITY : NS_WEIGHT;
+			__u32 val;
+
+			NEXT_ARG();
+			if (get_u32(&val, *argv, 0)) {
+				fprintf(stderr, "Invalid %s value\n", argv[-1]);
+				return -1;
+			}
+			s->val[a] = val;
+			s->set |= 1 << a;
+		} else {
+			fprintf(stderr, "What is \"%s\"\n", *argv);
+			return -1;
+		}
+		argc--;
+		argv++;
+	}
+
+	if (!s->ifindex || !handle_present) {
+		fprintf(stderr, "Both dev and handle are required\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int ns_load_read(void)
+{
+	char *tok[NS_LOAD_MAX_ARGS];
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(&ns_load.bulk);
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		int ntok;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, NS_LOAD_MAX_ARGS);
+		if (!ntok)
+			continue;
+		if (ntok > NS_LOAD_MAX_ARGS)
+			rtnl_bulk_line_error(&ns_load.bulk, lineno,
+					     "too many words");
+		else if (ns_load_line(ntok, tok, lineno))
+			rtnl_bulk_line_error(&ns_load.bulk, lineno,
+					     "invalid shaper");
+	}
+
+	rtnl_bulk_close(fp);
+	free(line);
+	return ns_load.bulk.failed ? -1 : 0;
+}
+
+static int __attribute__((format(printf, 2, 3)))
+ns_load_error(const struct ns_shaper *s, const char *fmt, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "%s:%d: ", ns_load.bulk.file, s->lineno);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	return -1;
+}
+
+/* Resolves the parents and checks the tree, before anything is sent */
+static int ns_load_check(void)
+{
+	struct ns_tree *t = &ns_load.want;
+	unsigned int i;
+
+	for (i = 0; i < t->count; i++) {
+		struct ns_shaper *s = &t->s[i], *dup;
+
+		dup = ns_tree_find(t, s->ifindex, s->scope, s->id);
+		if (dup != s)
+			return ns_load_error(s, "duplicate handle, first at line %d",
+					     dup->lineno);
+		if ((s->set & (1 << NS_BW_MIN)) && (s->set & (1 << NS_BW_MAX)) &&
+		    s->val[NS_BW_MIN] > s->val[NS_BW_MAX])
+			return ns_load_error(s, "bw-min is above bw-max");
+
+		switch (s->pscope) {
+		case NET_SHAPER_SCOPE_UNSPEC:
+			break;
+		case NET_SHAPER_SCOPE_NETDEV:
+			if (s->scope == NET_SHAPER_SCOPE_NETDEV)
+				return ns_load_error(s, "a netdev shaper has no parent");
+			s->pscope = NET_SHAPER_SCOPE_UNSPEC;
+			break;
+		case NET_SHAPER_SCOPE_NODE:
+			if (s->scope == NET_SHAPER_SCOPE_NETDEV)
+				return ns_load_error(s, "a netdev shaper has no parent");
+			s->parent = ns_tree_find(t, s->ifindex,
+						 NET_SHAPER_SCOPE_NODE, s->pid);
+			if (!s->parent)
+				return ns_load_error(s, "parent node %u is not in the file",
+						     s->pid);
+			if (s->scope == NET_SHAPER_SCOPE_QUEUE)
+				s->parent->leaves++;
+			break;
+		default:
+			return ns_load_error(s, "a queue can not be a parent");
+		}
+	}
+
+	for (i = 0; i < t->count; i++) {
+		struct ns_shaper *s = &t->s[i], *p;
+
+		if (s->scope != NET_SHAPER_SCOPE_NODE)
+			continue;
+		/* a group needs leaves */
+		if (!s->leaves)
+			return ns_load_error(s, "node %u has no queue under it",
+					     s->id);
+		for (p = s; p; p = p->parent)
+			if (++s->depth > t->count)
+				return ns_load_error(s, "node %u is its own parent",
+						     s->id);
+	}
+	return 0;
+}
+
+static int ns_dump_shaper(struct nlmsghdr *n, void *arg)
+{
+	struct rtattr *tb[NET_SHAPER_A_MAX + 1] = {};
+	struct rtattr *htb[NET_SHAPER_A_HANDLE_MAX + 1];
+	struct genlmsghdr *ghdr = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	struct ns_shaper *s;
+	int a;
+
+	if (n->nlmsg_type != genl_family || len < 0)
+		return 0;
+
+	parse_rtattr_flags(tb, NET_SHAPER_A_MAX,
+			   (struct rtattr *)((char *)ghdr + GENL_HDRLEN),
+			   len, NLA_F_NESTED);
+	if (!tb[NET_SHAPER_A_IFINDEX] || !tb[NET_SHAPER_A_HANDLE])
+		return 0;
+
+	s = ns_tree_add(&ns_load.have);
+	if (!s)
+		return -1;
+	s->ifindex = rta_getattr_u32(tb[NET_SHAPER_A_IFINDEX]);
+
+	parse_rtattr_nested(htb, NET_SHAPER_A_HANDLE_MAX, tb[NET_SHAPER_A_HANDLE]);
+	if (htb[NET_SHAPER_A_HANDLE_SCOPE])
+		s->scope = rta_getattr_u32(htb[NET_SHAPER_A_HANDLE_SCOPE]);
+	if (htb[NET_SHAPER_A_HANDLE_ID])
+		s->id = rta_getattr_u32(htb[NET_SHAPER_A_HANDLE_ID]);
+
+	if (tb[NET_SHAPER_A_PARENT]) {
+		parse_rtattr_nested(htb, NET_SHAPER_A_HANDLE_MAX,
+				    tb[NET_SHAPER_A_PARENT]);
+		if (htb[NET_SHAPER_A_HANDLE_SCOPE])
+			s->pscope = rta_getattr_u32(htb[NET_SHAPER_A_HANDLE_SCOPE]);
+		if (htb[NET_SHAPER_A_HANDLE_ID])
+			s->pid = rta_getattr_u32(htb[NET_SHAPER_A_HANDLE_ID]);
+		if (s->pscope != NET_SHAPER_SCOPE_NODE)
+			s->pscope = NET_SHAPER_SCOPE_UNSPEC;
+	}
+
+	for (a = 0; a < NS_ATTRS; a++) {
+		struct rtattr *rta = tb[ns_attr_type[a]];
+
+		if (!rta)
+			continue;
+		s->val[a] = a < NS_PRIORITY ? rta_getattr_uint(rta) :
+					      rta_getattr_u32(rta);
+		s->set |= 1 << a;
+	}
+	return 0;
+}
+
+static int ns_dump_dev(int ifindex)
+{
+	GENL_REQUEST(req, 1024, genl_family, 0, NET_SHAPER_FAMILY_VERSION,
+		     NET_SHAPER_CMD_GET, NLM_F_REQUEST | NLM_F_DUMP);
+
+	addattr32(&req.n, sizeof(req), NET_SHAPER_A_IFINDEX, ifindex);
+	if (rtnl_send(&gen_rth, &req.n, req.n.nlmsg_len) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&gen_rth, ns_dump_shaper, NULL) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Pairs the shapers of the file with those of the kernel. A node is the
+ * same as one of the kernel if it has the same parent and queues.
+ */
+static void ns_load_match(void)
+{
+	struct ns_tree *want = &ns_load.want, *have = &ns_load.have;
+	unsigned int i, j, k;
+	int depth, max_depth = 0;
+
+	for (i = 0; i < have->count; i++) {
+		struct ns_shaper *h = &have->s[i], *p;
+
+		if (h->scope == NET_SHAPER_SCOPE_NODE) {
+			h->kid = h->id;
+			h->kid_known = true;
+		}
+		if (h->scope != NET_SHAPER_SCOPE_QUEUE ||
+		    h->pscope != NET_SHAPER_SCOPE_NODE)
+			continue;
+		p = ns_tree_find(have, h->ifindex, NET_SHAPER_SCOPE_NODE, h->pid);
+		if (p)
+			p->leaves++;
+	}
+
+	for (i = 0; i < want->count; i++) {
+		struct ns_shaper *w = &want->s[i];
+
+		if (w->scope == NET_SHAPER_SCOPE_NODE) {
+			if (w->depth > max_depth)
+				max_depth = w->depth;
+			continue;
+		}
+		w->match = ns_tree_find(have, w->ifindex, w->scope, w->id);
+		if (w->match)
+			w->match->match = w;
+	}
+
+	for (depth = 1; depth <= max_depth; depth++) {
+		for (i = 0; i < want->count; i++) {
+			struct ns_shaper *w = &want->s[i];
+
+			if (w->scope != NET_SHAPER_SCOPE_NODE || w->depth != depth)
+				continue;
+			for (j = 0; j < have->count && !w->match; j++) {
+				struct ns_shaper *h = &have->s[j];
+
+				if (h->match || h->ifindex != w->ifindex ||
+				    h->scope != NET_SHAPER_SCOPE_NODE ||
+				    h->leaves != w->leaves)
+					continue;
+				if (w->parent ? !w->parent->match ||
+						h->pscope != NET_SHAPER_SCOPE_NODE ||
+						h->pid != w->parent->match->id :
+						h->pscope != NET_SHAPER_SCOPE_UNSPEC)
+					continue;
+				for (k = 0; k < want->count; k++) {
+					struct ns_shaper *q = &want->s[k];
+
+					if (q->scope == NET_SHAPER_SCOPE_QUEUE &&
+					    q->parent == w &&
+					    (!q->match ||
+					     q->match->pscope != NET_SHAPER_SCOPE_NODE ||
+					     q->match->pid != h->id))
+						break;
+				}
+				if (k < want->count)
+					continue;
+				w->match = h;
+				h->match = w;
+				w->kid = h->id;
+				w->kid_known = true;
+			}
+		}
+	}
+}
+
+static const char *ns_load_name(struct rtnl_bulk *b, int tag)
+{
+	static char name[PATH_MAX + 64];
+	const struct ns_shaper *h;
+
+	if (tag >= 0) {
+		snprintf(name, sizeof(name), "%s:%d", b->file,
+			 ns_load.want.s[tag].lineno);
+		return name;
+	}
+
+	h = &ns_load.have.s[-tag - 1];
+	snprintf(name, sizeof(name), "delete dev %s handle scope %s id %u",
+		 ll_index_to_name(h->ifindex),
+		 net_shaper_scope_names[h->scope], h->id);
+	return name;
+}
+
+/* The group creating a node answers with the handle of the node */
+static void ns_load_answer(struct rtnl_bulk *b, const struct nlmsghdr *n,
+			   int tag)
+{
+	struct rtattr *tb[NET_SHAPER_A_MAX + 1] = {};
+	struct rtattr *htb[NET_SHAPER_A_HANDLE_MAX + 1];
+	struct genlmsghdr *ghdr = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+	struct ns_shaper *s;
+
+	if (tag < 0 || n->nlmsg_type != genl_family || len < 0)
+		return;
+	s = &ns_load.want.s[tag];
+
+	parse_rtattr_flags(tb, NET_SHAPER_A_MAX,
+			   (struct rtattr *)((char *)ghdr + GENL_HDRLEN),
+			   len, NLA_F_NESTED);
+	if (!tb[NET_SHAPER_A_HANDLE])
+		return;
+	parse_rtattr_nested(htb, NET_SHAPER_A_HANDLE_MAX, tb[NET_SHAPER_A_HANDLE]);
+	if (!htb[NET_SHAPER_A_HANDLE_ID])
+		return;
+	s->kid = rta_getattr_u32(htb[NET_SHAPER_A_HANDLE_ID]);
+	s->kid_known = true;
+}
+
+static void ns_add_handle(struct nlmsghdr *n, int type, __u32 scope, __u32 id,
+			  bool with_id)
+{
+	struct rtattr *nest;
+
+	nest = addattr_nest(n, NS_MSG_SIZE, type | NLA_F_NESTED);
+	addattr32(n, NS_MSG_SIZE, NET_SHAPER_A_HANDLE_SCOPE, scope);
+	if (with_id)
+		addattr32(n, NS_MSG_SIZE, NET_SHAPER_A_HANDLE_ID, id);
+	addattr_nest_end(n, nest);
+}
+
+/* The attributes given, and with diff those to reset as well */
+static void ns_add_attrs(struct nlmsghdr *n, const struct ns_shaper *s,
+			 unsigned int mask)
+{
+	int a;
+
+	for (a = 0; a < NS_ATTRS; a++) {
+		if (!(mask & (1 << a)) ||
+		    (!(s->set & (1 << a)) && !(s->match && s->match->val[a])))
+			continue;
+		if (a < NS_PRIORITY)
+			addattr64(n, NS_MSG_SIZE, ns_attr_type[a], s->val[a]);
+		else
+			addattr32(n, NS_MSG_SIZE, ns_attr_type[a], s->val[a]);
+	}
+}
+
+static int ns_load_queue(struct rtnl_flush *f, struct nlmsghdr *n, int tag)
+{
+	f->tag = tag;
+	if (rtnl_flush_add(f, n, 0) < 0) {
+		perror("Cannot talk to generic netlink");
+		return -1;
+	}
+	ns_load.bulk.entries++;
+	return 0;
+}
+
+static bool ns_differs(const struct ns_shaper *s, unsigned int mask)
+{
+	int a;
+
+	if (!s->match)
+		return true;
+	for (a = 0; a < NS_ATTRS; a++)
+		if ((mask & (1 << a)) && s->val[a] != s->match->val[a])
+			return true;
+	return false;
+}
+
+static int ns_load_set(struct rtnl_flush *f, unsigned int i, __u32 id)
+{
+	GENL_REQUEST(req, NS_MSG_SIZE, genl_family, 0,
+		     NET_SHAPER_FAMILY_VERSION, NET_SHAPER_CMD_SET,
+		     NLM_F_REQUEST);
+	const struct ns_shaper *s = &ns_load.want.s[i];
+
+	addattr32(&req.n, NS_MSG_SIZE, NET_SHAPER_A_IFINDEX, s->ifindex);
+	ns_add_handle(&req.n, NET_SHAPER_A_HANDLE, s->scope, id, true);
+	ns_add_attrs(&req.n, s, ~0U);
+	return ns_load_queue(f, &req.n, i);
+}
+
+/* Groups the queues under node, or moves them back to the netdev */
+static int ns_load_group(struct rtnl_flush *f, unsigned int i,
+			 struct ns_shaper *node, int ifindex)
+{
+	GENL_REQUEST(req, NS_MSG_SIZE, genl_family, 0,
+		     NET_SHAPER_FAMILY_VERSION, NET_SHAPER_CMD_GROUP,
+		     NLM_F_REQUEST);
+	struct ns_tree *t = &ns_load.want;
+	unsigned int j, leaves = 0;
+
+	addattr32(&req.n, NS_MSG_SIZE, NET_SHAPER_A_IFINDEX, ifindex);
+	if (node) {
+		ns_add_handle(&req.n, NET_SHAPER_A_HANDLE,
+			      NET_SHAPER_SCOPE_NODE, 0, false);
+		if (node->parent)
+			ns_add_handle(&req.n, NET_SHAPER_A_PARENT,
+				      NET_SHAPER_SCOPE_NODE,
+				      node->parent->kid, true);
+		ns_add_attrs(&req.n, node, ~0U);
+	} else {
+		ns_add_handle(&req.n, NET_SHAPER_A_HANDLE,
+			      NET_SHAPER_SCOPE_NETDEV, 0, true);
+	}
+
+	for (j = 0; j < t->count; j++) {
+		struct ns_shaper *q = &t->s[j];
+		struct rtattr *nest;
+
+		if (q->scope != NET_SHAPER_SCOPE_QUEUE ||
+		    q->ifindex != ifindex || q->parent != node)
+			continue;
+		/* back to the netdev only what is under a node now */
+		if (!node && (!q->match ||
+			      q->match->pscope != NET_SHAPER_SCOPE_NODE))
+			continue;
+		nest = addattr_nest(&req.n, NS_MSG_SIZE,
+				    NET_SHAPER_A_LEAVES | NLA_F_NESTED);
+		ns_add_handle(&req.n, NET_SHAPER_A_HANDLE,
+			      NET_SHAPER_SCOPE_QUEUE, q->id, true);
+		ns_add_attrs(&req.n, q, NS_LEAF_ATTRS);
+		addattr_nest_end(&req.n, nest);
+		leaves++;
+	}
+	if (!leaves)
+		return 0;
+
+	return ns_load_queue(f, &req.n, i);
+}
+
+static int ns_load_delete(struct rtnl_flush *f, unsigned int i)
+{
+	GENL_REQUEST(req, 1024, genl_family, 0, NET_SHAPER_FAMILY_VERSION,
+		     NET_SHAPER_CMD_DELETE, NLM_F_REQUEST);
+	const struct ns_shaper *h = &ns_load.have.s[i];
+
+	addattr32(&req.n, sizeof(req), NET_SHAPER_A_IFINDEX, h->ifindex);
+	ns_add_handle(&req.n, NET_SHAPER_A_HANDLE, h->scope, h->id, true);
+	return ns_load_queue(f, &req.n, -(int)i - 1);
+}
+
+static int ns_load_commit(struct rtnl_flush *f)
+{
+	if (rtnl_flush_commit(f) == -2) {
+		perror("Cannot talk to generic netlink");
+		return -1;
+	}
+	return 0;
+}
+
+static int ns_load_send(bool diff)
+{
+	struct ns_tree *want = &ns_load.want, *have = &ns_load.have;
+	int depth, max_depth = 0, ret = -1;
+	static const __u32 del_order[] = {
+		NET_SHAPER_SCOPE_QUEUE,
+		NET_SHAPER_SCOPE_NODE,
+		NET_SHAPER_SCOPE_NETDEV,
+	};
+	struct rtnl_flush f;
+	unsigned int i, j;
+
+	if (rtnl_bulk_start(&ns_load.bulk, &f) < 0)
+		return -1;
+
+	for (i = 0; i < want->count; i++) {
+		struct ns_shaper *s = &want->s[i];
+
+		if (s->scope == NET_SHAPER_SCOPE_NODE && s->depth > max_depth)
+			max_depth = s->depth;
+		if (s->scope == NET_SHAPER_SCOPE_NETDEV && ns_differs(s, ~0U) &&
+		    ns_load_set(&f, i, 0))
+			goto out;
+	}
+
+	for (depth = 1; depth <= max_depth; depth++) {
+		for (i = 0; i < want->count; i++) {
+			struct ns_shaper *s = &want->s[i];
+
+			if (s->scope != NET_SHAPER_SCOPE_NODE ||
+			    s->depth != depth)
+				continue;
+			if (s->match) {
+				if (ns_differs(s, ~0U) &&
+				    ns_load_set(&f, i, s->kid))
+					goto out;
+				continue;
+			}
+			if (s->parent && !s->parent->kid_known) {
+				ns_load_error(s, "parent node %u was not created",
+					      s->pid);
+				ns_load.bulk.failed++;
+				continue;
+			}
+			if (ns_load_group(&f, i, s, s->ifindex))
+				goto out;
+		}
+		/* the next depth needs the ids of these nodes */
+		if (ns_load_commit(&f))
+			goto out;
+	}
+
+	for (i = 0; i < want->count; i++) {
+		struct ns_shaper *s = &want->s[i];
+		unsigned int mask = ~0U;
+
+		if (s->scope != NET_SHAPER_SCOPE_QUEUE)
+			continue;
+		if (diff && !s->parent && s->match &&
+		    s->match->pscope == NET_SHAPER_SCOPE_NODE) {
+			/* once per device, with all its queues to move */
+			for (j = 0; j < i; j++)
+				if (want->s[j].ifindex == s->ifindex &&
+				    want->s[j].scope == NET_SHAPER_SCOPE_QUEUE &&
+				    !want->s[j].parent && want->s[j].match &&
+				    want->s[j].match->pscope == NET_SHAPER_SCOPE_NODE)
+					break;
+			if (j == i && ns_load_group(&f, i, NULL, s->ifindex))
+				goto out;
+		}
+		/* a new leaf got its priority and weight from the group */
+		if (s->parent && !s->parent->match)
+			mask &= ~NS_LEAF_ATTRS;
+		if (!s->match && s->parent && !(s->set & mask))
+			continue;
+		if (ns_differs(s, mask) && ns_load_set(&f, i, s->id))
+			goto out;
+	}
+	if (ns_load_commit(&f))
+		goto out;
+
+	/* emptied nodes are gone already */
+	f.ignore_errno = ENOENT;
+	for (j = 0; diff && j < ARRAY_SIZE(del_order); j++) {
+		for (i = 0; i < have->count; i++) {
+			if (have->s[i].match || have->s[i].scope != del_order[j])
+				continue;
+			if (ns_load_delete(&f, i))
+				goto out;
+		}
+		if (ns_load_commit(&f))
+			goto out;
+	}
+
+	ret = 0;
+out:
+	rtnl_flush_close(&f);
+	return ret;
+}
+
+static int do_load(int argc, char **argv)
+{
+	bool diff = false;
+	unsigned int i, j;
+	int ret = -1;
+
+	ns_load.bulk.what = "requests";
+	ns_load.bulk.protocol = NETLINK_GENERIC;
+	ns_load.bulk.window = NS_WINDOW;
+	ns_load.bulk.genl = true;
+	ns_load.bulk.name = ns_load_name;
+	ns_load.bulk.answer = ns_load_answer;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "diff") == 0) {
+			diff = true;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			ns_load.bulk.file = *argv;
+		} else {
+			fprintf(stderr, "What is \"%s\"\n", *argv);
+			usage();
+			return -1;
+		}
+		argc--;
+		argv++;
+	}
+	if (!ns_load.bulk.file)
+		missarg("file");
+
+	if (ns_load_read() || ns_load_check()) {
+		fprintf(stderr, "%s: nothing was sent\n", ns_load.bulk.file);
+		goto out;
+	}
+
+	if (genl_init_handle(&gen_rth, NET_SHAPER_FAMILY_NAME, &genl_family))
+		goto out;
+
+	if (diff) {
+		for (i = 0; i < ns_load.want.count; i++) {
+			int ifindex = ns_load.want.s[i].ifindex;
+
+			for (j = 0; j < i; j++)
+				if (ns_load.want.s[j].ifindex == ifindex)
+					break;
+			if (j == i && ns_dump_dev(ifindex))
+				goto out;
+		}
+		ns_load_match();
+	}
+
+	if (ns_load_send(diff) == 0) {
+		if (ns_load.bulk.failed)
+			fprintf(stderr, "%u of %u requests failed\n",
+				ns_load.bulk.failed, ns_load.bulk.entries);
+		else
+			ret = 0;
+	}
+
+out:
+	free(ns_load.want.s);
+	free(ns_load.have.s);
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	int color = default_color_opt();
@@ -249,6 +1064,10 @@ int main(int argc, char **argv)
 
 	check_enable_color(color, 0);
 
+	/* checks the file before talking to the kernel */
+	if (argc > 2 && strcmp(argv[1], "load") == 0)
+		return do_load(argc - 2, argv + 2);
+
 	if (genl_init_handle(&gen_rth, NET_SHAPER_FAMILY_NAME, &genl_family))
 		exit(1);
 
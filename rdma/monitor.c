@@ -4,9 +4,34 @@
  * Authors:     Chiara Meiohas <cmeiohas@nvidia.com>
  */
 
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+
 #include "rdma.h"
 #include "utils.h"
 
+#define MON_RCVBUF	(4 * 1024 * 1024)
+#define MON_VLEN	64
+
+struct mon_dev {
+	uint32_t idx;
+	char name[64];
+	uint64_t count[256];
+};
+
+struct mon_ctx {
+	bool brief;
+	bool stats;
+	struct timespec ts;	/* when the current batch was received */
+	uint64_t events;
+	uint64_t overruns;
+	struct mon_dev *devs;
+	unsigned int num_devs;
+};
+
+static volatile sig_atomic_t mon_stop;
+
 static int mon_is_supported_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nlattr *tb[RDMA_NLDEV_ATTR_MAX] = {};
@@ -34,31 +59,37 @@ static int mon_is_supported(struct rd *rd, uint8_t *is_sup)
 	return rd_recv_msg(rd, mon_is_supported_cb, is_sup, seq);
 }
 
-static void mon_print_event_type(struct nlattr **tb)
+static const char *mon_event_type_str(uint8_t etype, char *buf, size_t len)
 {
 	const char *const event_types_str[] = {
-		[RDMA_REGISTER_EVENT] = "[REGISTER]",
-		[RDMA_UNREGISTER_EVENT] = "[UNREGISTER]",
-		[RDMA_NETDEV_ATTACH_EVENT] = "[NETDEV_ATTACH]",
-		[RDMA_NETDEV_DETACH_EVENT] = "[NETDEV_DETACH]",
-		[RDMA_RENAME_EVENT] = "[RENAME]",
-		[RDMA_NETDEV_RENAME_EVENT] = "[NETDEV_RENAME]",
+		[RDMA_REGISTER_EVENT] = "REGISTER",
+		[RDMA_UNREGISTER_EVENT] = "UNREGISTER",
+		[RDMA_NETDEV_ATTACH_EVENT] = "NETDEV_ATTACH",
+		[RDMA_NETDEV_DETACH_EVENT] = "NETDEV_DETACH",
+		[RDMA_RENAME_EVENT] = "RENAME",
+		[RDMA_NETDEV_RENAME_EVENT] = "NETDEV_RENAME",
 	};
-	enum rdma_nl_notify_event_type etype;
-	char unknown_type[32];
+
+	if (etype < ARRAY_SIZE(event_types_str) && event_types_str[etype])
+		return event_types_str[etype];
+
+	snprintf(buf, len, "UNKNOWN 0x%02x", etype);
+	return buf;
+}
+
+static void mon_print_event_type(struct nlattr **tb)
+{
+	char unknown_type[32], type[48];
+	uint8_t etype;
 
 	if (!tb[RDMA_NLDEV_ATTR_EVENT_TYPE])
 		return;
 
 	etype = mnl_attr_get_u8(tb[RDMA_NLDEV_ATTR_EVENT_TYPE]);
-	if (etype < ARRAY_SIZE(event_types_str) && event_types_str[etype]) {
-		print_string(PRINT_ANY, "event_type", "%s\t",
-			     event_types_str[etype]);
-	} else {
-		snprintf(unknown_type, sizeof(unknown_type), "[UNKNOWN 0x%02x]",
-			 etype);
-		print_string(PRINT_ANY, "event_type", "%s\t", unknown_type);
-	}
+	snprintf(type, sizeof(type), "[%s]",
+		 mon_event_type_str(etype, unknown_type,
+				    sizeof(unknown_type)));
+	print_string(PRINT_ANY, "event_type", "%s\t", type);
 }
 
 static int mon_print_dev(struct nlattr **tb)
@@ -105,14 +136,89 @@ static void mon_print_netdev(struct nlattr **tb)
 	}
 }
 
+static void mon_print_ts(const struct timespec *ts)
+{
+	print_u64(PRINT_JSON, "ts", NULL,
+		  (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec);
+	if (!is_json_context())
+		pr_out("%lld.%06ld ", (long long)ts->tv_sec,
+		       ts->tv_nsec / 1000);
+}
+
+/* One line per event: time, type, device, port and net device */
+static void mon_print_brief(struct mon_ctx *mc, struct nlattr **tb)
+{
+	uint8_t etype = mnl_attr_get_u8(tb[RDMA_NLDEV_ATTR_EVENT_TYPE]);
+	char unknown_type[32];
+
+	open_json_object(NULL);
+	mon_print_ts(&mc->ts);
+	print_string(PRINT_ANY, "event_type", "%s ",
+		     mon_event_type_str(etype, unknown_type,
+					sizeof(unknown_type)));
+	if (tb[RDMA_NLDEV_ATTR_DEV_NAME])
+		print_string(PRINT_ANY, "rdma_dev", "%s",
+			     mnl_attr_get_str(tb[RDMA_NLDEV_ATTR_DEV_NAME]));
+	if (tb[RDMA_NLDEV_ATTR_PORT_INDEX])
+		print_uint(PRINT_ANY, "port", "/%u",
+			   mnl_attr_get_u32(tb[RDMA_NLDEV_ATTR_PORT_INDEX]));
+	if (tb[RDMA_NLDEV_ATTR_NDEV_NAME])
+		print_string(PRINT_ANY, "netdev_name", " %s",
+			     mnl_attr_get_str(tb[RDMA_NLDEV_ATTR_NDEV_NAME]));
+	close_json_object();
+	newline();
+}
+
+static int mon_count(struct mon_ctx *mc, struct nlattr **tb)
+{
+	uint8_t etype = mnl_attr_get_u8(tb[RDMA_NLDEV_ATTR_EVENT_TYPE]);
+	struct mon_dev *dev, *devs;
+	uint32_t idx = 0;
+	unsigned int i;
+
+	if (tb[RDMA_NLDEV_ATTR_DEV_INDEX])
+		idx = mnl_attr_get_u32(tb[RDMA_NLDEV_ATTR_DEV_INDEX]);
+
+	for (i = 0; i < mc->num_devs; i++)
+		if (mc->devs[i].idx == idx)
+			break;
+
+	if (i == mc->num_devs) {
+		devs = realloc(mc->devs, (mc->num_devs + 1) * sizeof(*devs));
+		if (!devs)
+			return MNL_CB_ERROR;
+		mc->devs = devs;
+		memset(&devs[i], 0, sizeof(devs[i]));
+		devs[i].idx = idx;
+		mc->num_devs++;
+	}
+
+	dev = &mc->devs[i];
+	/* keep the latest name, devices can be renamed */
+	if (tb[RDMA_NLDEV_ATTR_DEV_NAME])
+		strlcpy(dev->name, mnl_attr_get_str(tb[RDMA_NLDEV_ATTR_DEV_NAME]),
+			sizeof(dev->name));
+	dev->count[etype]++;
+	return MNL_CB_OK;
+}
+
 static int mon_show_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nlattr *tb[RDMA_NLDEV_ATTR_MAX + 1] = {};
+	struct mon_ctx *mc = data;
 
 	mnl_attr_parse(nlh, 0, rd_attr_cb, tb);
 	if (!tb[RDMA_NLDEV_ATTR_EVENT_TYPE])
 		return MNL_CB_ERROR;
 
+	mc->events++;
+	if (mc->stats)
+		return mon_count(mc, tb);
+	if (mc->brief) {
+		mon_print_brief(mc, tb);
+		return MNL_CB_OK;
+	}
+
 	open_json_object(NULL);
 
 	mon_print_event_type(tb);
@@ -122,19 +228,153 @@ static int mon_show_cb(const struct nlmsghdr *nlh, void *data)
 
 	close_json_object();
 	newline();
-	fflush(stdout);
 
 	return MNL_CB_OK;
 }
 
+static void mon_print_overrun(struct mon_ctx *mc)
+{
+	if (mc->stats)
+		return;
+
+	open_json_object(NULL);
+	if (mc->brief)
+		mon_print_ts(&mc->ts);
+	print_u64(PRINT_ANY, "overrun", "overrun %" PRIu64, mc->overruns);
+	close_json_object();
+	newline();
+}
+
+static void mon_print_stats(struct mon_ctx *mc)
+{
+	char unknown_type[32];
+	struct mon_dev *dev;
+	unsigned int i, j;
+
+	for (i = 0; i < mc->num_devs; i++) {
+		dev = &mc->devs[i];
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "rdma_index", "dev %u", dev->idx);
+		print_string(PRINT_ANY, "rdma_dev", " %s", dev->name);
+		open_json_object("events");
+		for (j = 0; j < ARRAY_SIZE(dev->count); j++) {
+			const char *type;
+
+			if (!dev->count[j])
+				continue;
+			type = mon_event_type_str(j, unknown_type,
+						  sizeof(unknown_type));
+			print_string(PRINT_FP, NULL, " %s", type);
+			print_u64(PRINT_ANY, type, " %" PRIu64, dev->count[j]);
+		}
+		close_json_object();
+		close_json_object();
+		newline();
+	}
+
+	open_json_object(NULL);
+	print_u64(PRINT_ANY, "events", "events %" PRIu64, mc->events);
+	print_u64(PRINT_ANY, "overruns", " overruns %" PRIu64, mc->overruns);
+	close_json_object();
+	newline();
+}
+
+static void mon_sig_handler(int signo)
+{
+	mon_stop = 1;
+}
+
+/*
+ * Drain everything queued with recvmmsg() each time the socket wakes
+ * up. Notifications dropped by the kernel for lack of room are counted
+ * and reported instead of ending the monitor.
+ */
+static int mon_run(struct rd *rd, struct mon_ctx *mc)
+{
+	struct sigaction act, oact_int, oact_term;
+	struct mnlu_batch batch;
+	struct pollfd pfd;
+	int err = 0, n;
+
+	if (mnlu_batch_init(&batch, MON_VLEN, MNL_SOCKET_BUFFER_SIZE)) {
+		pr_err("Buffer allocation failed\n");
+		return -ENOMEM;
+	}
+
+	act.sa_handler = mon_sig_handler;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = 0;
+	sigaction(SIGINT, &act, &oact_int);
+	sigaction(SIGTERM, &act, &oact_term);
+
+	pfd.fd = mnl_socket_get_fd(rd->nl);
+	pfd.events = POLLIN;
+
+	while (!mon_stop) {
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_err("Failed to listen to rdma socket\n");
+			err = -errno;
+			break;
+		}
+
+		do {
+			n = mnlu_socket_recv_batch(rd->nl, &batch, &mc->ts,
+						   mon_show_cb, mc);
+			if (n < 0 && errno == ENOBUFS) {
+				mc->overruns++;
+				clock_gettime(CLOCK_REALTIME, &mc->ts);
+				mon_print_overrun(mc);
+				n = MON_VLEN;
+			} else if (n < 0) {
+				pr_err("Failed to listen to rdma socket\n");
+				err = -errno;
+				goto out;
+			}
+		} while (n == MON_VLEN);
+		fflush(stdout);
+	}
+
+out:
+	if (mc->stats)
+		mon_print_stats(mc);
+	fflush(stdout);
+
+	sigaction(SIGINT, &oact_int, NULL);
+	sigaction(SIGTERM, &oact_term, NULL);
+	mnlu_batch_free(&batch);
+	return err;
+}
+
 static int mon_show(struct rd* rd)
 {
+	uint32_t rcvbuf = MON_RCVBUF;
+	struct mon_ctx mc = {};
 	unsigned int groups = 0;
 	uint8_t is_sup = 0;
 	int one = 1;
-	char *buf;
 	int err;
 
+	while (!rd_no_arg(rd)) {
+		if (!strcmpx(rd_argv(rd), "rcvbuf")) {
+			rd_arg_inc(rd);
+			if (rd_no_arg(rd) ||
+			    get_u32(&rcvbuf, rd_argv(rd), 0) || !rcvbuf) {
+				pr_err("Invalid receive buffer size\n");
+				return -EINVAL;
+			}
+		} else if (!strcmpx(rd_argv(rd), "brief")) {
+			mc.brief = true;
+		} else if (!strcmpx(rd_argv(rd), "stats")) {
+			mc.stats = true;
+		} else {
+			pr_err("Unknown parameter '%s'.\n", rd_argv(rd));
+			return -EINVAL;
+		}
+		rd_arg_inc(rd);
+	}
+
 	err = mon_is_supported(rd, &is_sup);
 	if (err) {
 		pr_err("Failed to check if RDMA monitoring is supported\n");
@@ -146,21 +386,17 @@ static int mon_show(struct rd* rd)
 		return -ENOENT;
 	}
 
-	buf = malloc(MNL_SOCKET_BUFFER_SIZE);
-	if (!buf) {
-		pr_err("Buffer allocation failed\n");
-		return -ENOMEM;
-	}
-
 	rd->nl = mnl_socket_open(NETLINK_RDMA);
 	if (!rd->nl) {
 		pr_err("Failed to open NETLINK_RDMA socket. Error: %s\n",
 		       strerror(errno));
-		err = -ENODEV;
-		goto err_free;
+		return -ENODEV;
 	}
 	mnl_socket_setsockopt(rd->nl, NETLINK_CAP_ACK, &one, sizeof(one));
 	mnl_socket_setsockopt(rd->nl, NETLINK_EXT_ACK, &one, sizeof(one));
+	if (mnlu_socket_set_rcvbuf(rd->nl, rcvbuf))
+		pr_err("Failed to set receive buffer size: %s\n",
+		       strerror(errno));
 
 	groups |= nl_mgrp(RDMA_NL_GROUP_NOTIFY);
 
@@ -172,27 +408,18 @@ static int mon_show(struct rd* rd)
 	}
 	new_json_obj(json);
 
-	err = mnlu_socket_recv_run(rd->nl, 0, buf, MNL_SOCKET_BUFFER_SIZE,
-				   mon_show_cb, rd);
-	if (err) {
-		pr_err("Failed to listen to rdma socket\n");
-		goto err_free_json;
-	}
+	err = mon_run(rd, &mc);
 
-	return 0;
-
-err_free_json:
 	delete_json_obj();
+	free(mc.devs);
 err_close:
 	mnl_socket_close(rd->nl);
-err_free:
-	free(buf);
 	return err;
 }
 
 static int mon_help(struct rd *rd)
 {
-	pr_out("Usage: rdma monitor [ -j ]\n");
+	pr_out("Usage: rdma monitor [ -j ] [ rcvbuf BYTES ] [ brief ] [ stats ]\n");
 	return 0;
 }
 
@@ -204,6 +431,10 @@ int cmd_mon(struct rd *rd)
 		{ 0 }
 	};
 
+	/* everything but help is an option of the monitor itself */
+	if (!rd_no_arg(rd) && strcmpx(rd_argv(rd), "help"))
+		return mon_show(rd);
+
 	return rd_exec_cmd(rd, cmds, "mon command");
 }
 
@@ -16,7 +16,7 @@ static void help(char *name)
 	pr_out("Usage: %s [ OPTIONS ] OBJECT { COMMAND | help }\n"
 	       "       %s [ -f[orce] ] -b[atch] filename\n"
 	       "where  OBJECT := { dev | link | resource | monitor | system | statistic | help }\n"
-	       "       OPTIONS := { -V[ersion] | -d[etails] | -j[son] | -p[retty] | -r[aw]}\n", name, name);
+	       "       OPTIONS := { -V[ersion] | -d[etails] | -j[son] | --jsonl | --cbor | -p[retty] | -r[aw]}\n", name, name);
 }
 
 static int cmd_help(struct rd *rd)
@@ -90,6 +90,8 @@ int main(int argc, char **argv)
 		{ "version",		no_argument,		NULL, 'V' },
 		{ "help",		no_argument,		NULL, 'h' },
 		{ "json",		no_argument,		NULL, 'j' },
+		{ "jsonl",		no_argument,		NULL, 'J' },
+		{ "cbor",		no_argument,		NULL, 'C' },
 		{ "oneline",		no_argument,            NULL, 'o' },
 		{ "pretty",		no_argument,		NULL, 'p' },
 		{ "details",		no_argument,		NULL, 'd' },
@@ -135,6 +137,14 @@ int main(int argc, char **argv)
 		case 'j':
 			++json;
 			break;
+		case 'J':
+			++json;
+			++json_lines;
+			break;
+		case 'C':
+			++json;
+			++json_cbor;
+			break;
 		case 'f':
 			force = true;
 			break;
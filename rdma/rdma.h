@@ -26,6 +26,9 @@
 #define pr_err(args...) fprintf(stderr, ##args)
 #define pr_out(args...) fprintf(stdout, ##args)
 
+/* largest message the kernel builds for a netlink dump */
+#define RD_DUMP_BUFFER_SIZE 32768
+
 #define RDMA_BITMAP_ENUM(name, bit_no) RDMA_BITMAP_##name = BIT(bit_no),
 #define RDMA_BITMAP_NAMES(name, bit_no) [bit_no] = #name,
 
@@ -55,6 +58,9 @@ struct dev_map {
 	uint32_t idx;
 };
 
+struct res_summary;
+struct stat_rate;
+
 struct rd {
 	int argc;
 	char **argv;
@@ -75,6 +81,8 @@ struct rd {
 	char *link_type;
 	char *dev_name;
 	int dev_type;
+	struct res_summary *res_summary;
+	struct stat_rate *stat_rate;
 };
 
 struct rd_cmd {
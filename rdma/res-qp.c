@@ -17,7 +17,7 @@ static const char *path_mig_to_str(uint8_t idx)
 	return "UNKNOWN";
 }
 
-static const char *qp_states_to_str(uint8_t idx)
+const char *qp_states_to_str(uint8_t idx)
 {
 	static const char *const qp_states_str[] = { "RESET", "INIT", "RTR",
 						     "RTS",   "SQD",  "SQE",
@@ -158,19 +158,23 @@ static int res_qp_line(struct rd *rd, const char *name, int idx,
 				       nla_line[RDMA_NLDEV_ATTR_RES_STATE]))
 		goto out;
 
-	if (nla_line[RDMA_NLDEV_ATTR_RES_PID]) {
+	if (nla_line[RDMA_NLDEV_ATTR_RES_PID])
 		pid = mnl_attr_get_u32(nla_line[RDMA_NLDEV_ATTR_RES_PID]);
-		if (!get_task_name(pid, b, sizeof(b)))
-			comm = b;
-	} else if (nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME]) {
+	if (rd_is_filtered_attr(rd, "pid", pid,
+				nla_line[RDMA_NLDEV_ATTR_RES_PID]))
+		goto out;
+
+	if (nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME])
 		/* discard const from mnl_attr_get_str */
 		comm = (char *)mnl_attr_get_str(
 			nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME]);
-	}
 
-	if (rd_is_filtered_attr(rd, "pid", pid,
-				nla_line[RDMA_NLDEV_ATTR_RES_PID]))
-		goto out;
+	if (rd->res_summary)
+		return res_summary_add_qp(rd, idx, name, pid, comm, type,
+					  state);
+
+	if (pid)
+		comm = !res_get_task_name(pid, b, sizeof(b)) ? b : NULL;
 
 	open_json_object(NULL);
 	print_link(idx, name, port, nla_line);
@@ -14,6 +14,7 @@ static int res_help(struct rd *rd)
 	pr_out("          resource show [qp|cm_id|pd|mr|cq|ctx|srq]\n");
 	pr_out("          resource show qp link [DEV/PORT]\n");
 	pr_out("          resource show qp link [DEV/PORT] [FILTER-NAME FILTER-VALUE]\n");
+	pr_out("          resource show qp link [DEV/PORT] [FILTER-NAME FILTER-VALUE] summary\n");
 	pr_out("          resource show cm_id link [DEV/PORT]\n");
 	pr_out("          resource show cm_id link [DEV/PORT] [FILTER-NAME FILTER-VALUE]\n");
 	pr_out("          resource show cq dev [DEV]\n");
@@ -22,6 +23,7 @@ static int res_help(struct rd *rd)
 	pr_out("          resource show pd dev [DEV] [FILTER-NAME FILTER-VALUE]\n");
 	pr_out("          resource show mr dev [DEV]\n");
 	pr_out("          resource show mr dev [DEV] [FILTER-NAME FILTER-VALUE]\n");
+	pr_out("          resource show mr dev [DEV] [FILTER-NAME FILTER-VALUE] summary\n");
 	pr_out("          resource show ctx dev [DEV]\n");
 	pr_out("          resource show ctx dev [DEV] [FILTER-NAME FILTER-VALUE]\n");
 	pr_out("          resource show srq dev [DEV]\n");
@@ -85,6 +87,293 @@ static int res_no_args_parse_cb(const struct nlmsghdr *nlh, void *data)
 	return MNL_CB_OK;
 }
 
+/*
+ * A process usually owns many objects of a dump, remember what /proc
+ * told about recent pids instead of reading it again for each of them.
+ */
+#define RES_TASK_CACHE_SIZE 256
+
+static struct res_task_cache {
+	uint32_t pid;
+	int ret;
+	char name[32];
+} res_task_cache[RES_TASK_CACHE_SIZE];
+
+int res_get_task_name(uint32_t pid, char *name, size_t len)
+{
+	struct res_task_cache *tc;
+
+	if (!pid)
+		return -1;
+
+	tc = &res_task_cache[pid % RES_TASK_CACHE_SIZE];
+	if (tc->pid != pid) {
+		tc->pid = pid;
+		tc->ret = get_task_name(pid, tc->name, sizeof(tc->name));
+	}
+	if (tc->ret)
+		return tc->ret;
+
+	strlcpy(name, tc->name, len);
+	return 0;
+}
+
+#define RES_SUMMARY_HT_SIZE 256
+
+struct res_summary_owner {
+	struct hlist_node hlist;
+	uint32_t pid;
+	/* kernel objects have no pid, only the name of their owner */
+	char *kern_name;
+	uint64_t count;
+	uint64_t mrlen;
+};
+
+struct res_summary {
+	uint32_t attr;
+	uint32_t ifindex;
+	char ifname[64];
+	uint64_t count;
+	uint64_t mrlen;
+	uint64_t type[256];
+	uint64_t state[256];
+	unsigned int num_owners;
+	struct hlist_head owners[RES_SUMMARY_HT_SIZE];
+};
+
+static unsigned int res_summary_hash(uint32_t pid, const char *kern_name)
+{
+	unsigned int hash = pid;
+
+	if (kern_name)
+		while (*kern_name)
+			hash = hash * 31 + *kern_name++;
+
+	return hash % RES_SUMMARY_HT_SIZE;
+}
+
+static struct res_summary_owner *
+res_summary_add(struct rd *rd, uint32_t idx, const char *name, uint32_t pid,
+		const char *kern_name)
+{
+	struct res_summary *rs = rd->res_summary;
+	struct res_summary_owner *owner;
+	struct hlist_head *head;
+	struct hlist_node *n;
+
+	if (!rs->count) {
+		rs->ifindex = idx;
+		strlcpy(rs->ifname, name, sizeof(rs->ifname));
+	}
+	rs->count++;
+
+	if (pid)
+		kern_name = NULL;
+	head = &rs->owners[res_summary_hash(pid, kern_name)];
+	hlist_for_each(n, head) {
+		owner = hlist_entry(n, struct res_summary_owner, hlist);
+		if (owner->pid == pid &&
+		    !strcmp(owner->kern_name ? : "", kern_name ? : ""))
+			goto found;
+	}
+
+	owner = calloc(1, sizeof(*owner));
+	if (!owner)
+		return NULL;
+	owner->pid = pid;
+	if (kern_name) {
+		owner->kern_name = strdup(kern_name);
+		if (!owner->kern_name) {
+			free(owner);
+			return NULL;
+		}
+	}
+	hlist_add_head(&owner->hlist, head);
+	rs->num_owners++;
+found:
+	owner->count++;
+	return owner;
+}
+
+int res_summary_add_qp(struct rd *rd, uint32_t idx, const char *name,
+		       uint32_t pid, const char *kern_name, uint8_t type,
+		       uint8_t state)
+{
+	if (!res_summary_add(rd, idx, name, pid, kern_name))
+		return MNL_CB_ERROR;
+
+	rd->res_summary->type[type]++;
+	rd->res_summary->state[state]++;
+	return MNL_CB_OK;
+}
+
+int res_summary_add_mr(struct rd *rd, uint32_t idx, const char *name,
+		       uint32_t pid, const char *kern_name, uint64_t mrlen)
+{
+	struct res_summary_owner *owner;
+
+	owner = res_summary_add(rd, idx, name, pid, kern_name);
+	if (!owner)
+		return MNL_CB_ERROR;
+
+	owner->mrlen += mrlen;
+	rd->res_summary->mrlen += mrlen;
+	return MNL_CB_OK;
+}
+
+static void res_summary_print_u64(const char *name, uint64_t val)
+{
+	print_u64(PRINT_ANY, name, name, val);
+	print_u64(PRINT_FP, NULL, " %" PRIu64 " ", val);
+}
+
+/* the values nobody named yet all print as UNKNOWN, add them up once */
+static void res_summary_print_map(const char *key, const uint64_t *vals,
+				  const char *(*to_str)(uint8_t idx))
+{
+	unsigned int i, j;
+
+	open_json_object(key);
+	print_string(PRINT_FP, NULL, "%s ", key);
+	for (i = 0; i < 256; i++) {
+		const char *str = to_str(i);
+		uint64_t sum = 0;
+
+		if (!vals[i])
+			continue;
+		for (j = 0; j < i; j++)
+			if (vals[j] && !strcmp(to_str(j), str))
+				break;
+		if (j < i)
+			continue;
+		for (j = i; j < 256; j++)
+			if (vals[j] && !strcmp(to_str(j), str))
+				sum += vals[j];
+		res_summary_print_u64(str, sum);
+	}
+	close_json_object();
+}
+
+static int res_summary_owner_cmp(const void *a, const void *b)
+{
+	const struct res_summary_owner *oa = *(void * const *)a;
+	const struct res_summary_owner *ob = *(void * const *)b;
+
+	if (oa->count != ob->count)
+		return oa->count < ob->count ? 1 : -1;
+	if (oa->pid != ob->pid)
+		return oa->pid < ob->pid ? -1 : 1;
+	return strcmp(oa->kern_name ? : "", ob->kern_name ? : "");
+}
+
+static void res_summary_print_owner(struct rd *rd,
+				    const struct res_summary_owner *owner)
+{
+	SPRINT_BUF(b);
+
+	newline_indent();
+	open_json_object(NULL);
+	if (owner->pid) {
+		print_uint(PRINT_ANY, "pid", "pid %u ", owner->pid);
+		if (!res_get_task_name(owner->pid, b, sizeof(b)))
+			print_string(PRINT_ANY, "comm", "comm %s ", b);
+	} else if (owner->kern_name) {
+		print_string(PRINT_JSON, "comm", NULL, owner->kern_name);
+		print_string(PRINT_FP, NULL, "comm [%s] ", owner->kern_name);
+	}
+	res_summary_print_u64("count", owner->count);
+	if (rd->res_summary->attr == RDMA_NLDEV_ATTR_RES_MR)
+		res_summary_print_u64("mrlen", owner->mrlen);
+	close_json_object();
+}
+
+static void res_summary_reset(struct res_summary *rs)
+{
+	struct res_summary_owner *owner;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < RES_SUMMARY_HT_SIZE; i++) {
+		hlist_for_each_safe(n, tmp, &rs->owners[i]) {
+			owner = hlist_entry(n, struct res_summary_owner,
+					     hlist);
+			hlist_del(n);
+			free(owner->kern_name);
+			free(owner);
+		}
+	}
+	rs->count = 0;
+	rs->mrlen = 0;
+	rs->num_owners = 0;
+	memset(rs->type, 0, sizeof(rs->type));
+	memset(rs->state, 0, sizeof(rs->state));
+}
+
+/*
+ * Print what one dump tallied, in place of the objects themselves:
+ * the totals, then one line per owner with the busiest first.
+ */
+static int res_summary_flush(struct rd *rd)
+{
+	struct res_summary *rs = rd->res_summary;
+	struct res_summary_owner **owners, *owner;
+	unsigned int i, n = 0;
+	struct hlist_node *pos;
+	char tmp[80];
+
+	if (!rs->count)
+		return 0;
+
+	owners = calloc(rs->num_owners, sizeof(*owners));
+	if (!owners) {
+		res_summary_reset(rs);
+		return -ENOMEM;
+	}
+	for (i = 0; i < RES_SUMMARY_HT_SIZE; i++) {
+		hlist_for_each(pos, &rs->owners[i]) {
+			owner = hlist_entry(pos, struct res_summary_owner,
+					     hlist);
+			owners[n++] = owner;
+		}
+	}
+	qsort(owners, n, sizeof(*owners), res_summary_owner_cmp);
+
+	open_json_object(NULL);
+	if (rs->attr == RDMA_NLDEV_ATTR_RES_QP) {
+		print_uint(PRINT_JSON, "ifindex", NULL, rs->ifindex);
+		print_string(PRINT_ANY, "ifname", NULL, rs->ifname);
+		if (rd->port_idx) {
+			print_uint(PRINT_ANY, "port", NULL, rd->port_idx);
+			snprintf(tmp, sizeof(tmp), "%s/%u", rs->ifname,
+				 rd->port_idx);
+		} else {
+			snprintf(tmp, sizeof(tmp), "%s/-", rs->ifname);
+		}
+		print_string(PRINT_FP, NULL, "link %s ", tmp);
+	} else {
+		print_dev(rs->ifindex, rs->ifname);
+	}
+
+	res_summary_print_u64("count", rs->count);
+	if (rs->attr == RDMA_NLDEV_ATTR_RES_MR) {
+		res_summary_print_u64("mrlen", rs->mrlen);
+	} else {
+		res_summary_print_map("type", rs->type, qp_types_to_str);
+		res_summary_print_map("state", rs->state, qp_states_to_str);
+	}
+
+	open_json_array(PRINT_JSON, "owners");
+	for (i = 0; i < n; i++)
+		res_summary_print_owner(rd, owners[i]);
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+	newline();
+
+	free(owners);
+	res_summary_reset(rs);
+	return 0;
+}
+
 int _res_send_idx_msg(struct rd *rd, uint32_t command, mnl_cb_t callback,
 		      uint32_t idx, uint32_t id)
 {
@@ -110,6 +399,8 @@ int _res_send_idx_msg(struct rd *rd, uint32_t command, mnl_cb_t callback,
 	if (ret)
 		return ret;
 	ret = rd_recv_msg(rd, callback, rd, seq);
+	if (!ret && rd->res_summary)
+		ret = res_summary_flush(rd);
 	return ret;
 }
 
@@ -140,6 +431,8 @@ int _res_send_msg(struct rd *rd, uint32_t command, mnl_cb_t callback)
 		return ret;
 
 	ret = rd_recv_msg(rd, callback, rd, seq);
+	if (!ret && rd->res_summary)
+		ret = res_summary_flush(rd);
 	return ret;
 }
 
@@ -226,6 +519,40 @@ void res_print_u64(const char *name, uint64_t val, struct nlattr *nlattr)
 
 RES_FUNC(res_no_args,	RDMA_NLDEV_CMD_RES_GET,	NULL, true, 0);
 
+static int res_show_summary(struct rd *rd, const struct rd_cmd *cmds)
+{
+	struct res_summary *rs;
+	uint32_t attr;
+	int ret;
+
+	if (!strcmpx(rd_argv(rd), "qp")) {
+		attr = RDMA_NLDEV_ATTR_RES_QP;
+	} else if (!strcmpx(rd_argv(rd), "mr")) {
+		attr = RDMA_NLDEV_ATTR_RES_MR;
+	} else {
+		pr_err("Summary is supported for qp and mr only\n");
+		return -EINVAL;
+	}
+	if (rd->show_raw) {
+		pr_err("Summary can't be combined with raw output\n");
+		return -EINVAL;
+	}
+
+	rs = calloc(1, sizeof(*rs));
+	if (!rs)
+		return -ENOMEM;
+	rs->attr = attr;
+
+	rd->argc--;
+	rd->res_summary = rs;
+	ret = rd_exec_cmd(rd, cmds, "parameter");
+	rd->res_summary = NULL;
+
+	res_summary_reset(rs);
+	free(rs);
+	return ret;
+}
+
 static int res_show(struct rd *rd)
 {
 	const struct rd_cmd cmds[] = {
@@ -240,6 +567,13 @@ static int res_show(struct rd *rd)
 		{ 0 }
 	};
 
+	/*
+	 * "summary" follows the object and its filter pairs
+	 */
+	if (rd_argc(rd) > 1 && !(rd_argc(rd) % 2) &&
+	    !strcmp(rd->argv[rd_argc(rd) - 1], "summary"))
+		return res_show_summary(rd, cmds);
+
 	/*
 	 * Special case to support "rdma res show DEV_NAME"
 	 */
@@ -11,6 +11,12 @@
 int _res_send_msg(struct rd *rd, uint32_t command, mnl_cb_t callback);
 int _res_send_idx_msg(struct rd *rd, uint32_t command, mnl_cb_t callback,
 		      uint32_t idx, uint32_t id);
+int res_get_task_name(uint32_t pid, char *name, size_t len);
+int res_summary_add_qp(struct rd *rd, uint32_t idx, const char *name,
+		       uint32_t pid, const char *kern_name, uint8_t type,
+		       uint8_t state);
+int res_summary_add_mr(struct rd *rd, uint32_t idx, const char *name,
+		       uint32_t pid, const char *kern_name, uint64_t mrlen);
 
 int res_pd_parse_cb(const struct nlmsghdr *nlh, void *data);
 int res_pd_idx_parse_cb(const struct nlmsghdr *nlh, void *data);
@@ -192,5 +198,6 @@ void res_print_u32(const char *name, uint32_t val, struct nlattr *nlattr);
 void res_print_u64(const char *name, uint64_t val, struct nlattr *nlattr);
 void print_comm(const char *str, struct nlattr **nla_line);
 const char *qp_types_to_str(uint8_t idx);
+const char *qp_states_to_str(uint8_t idx);
 void print_qp_type(uint32_t val);
 #endif /* _RDMA_TOOL_RES_H_ */
@@ -9,18 +9,21 @@
 #include "stat.h"
 #include "utils.h"
 #include <inttypes.h>
+#include <signal.h>
 
 static int stat_help(struct rd *rd)
 {
 	pr_out("Usage: %s [ OPTIONS ] statistic { COMMAND | help }\n", rd->filename);
 	pr_out("       %s statistic OBJECT show\n", rd->filename);
 	pr_out("       %s statistic OBJECT show link [ DEV/PORT_INDEX ] [ FILTER-NAME FILTER-VALUE ]\n", rd->filename);
+	pr_out("       %s statistic OBJECT show [ link [ DEV/PORT_INDEX ] ] [ FILTER-NAME FILTER-VALUE ] interval MSEC [ count N ]\n", rd->filename);
 	pr_out("       %s statistic OBJECT mode\n", rd->filename);
 	pr_out("       %s statistic OBJECT set COUNTER_SCOPE [DEV/PORT_INDEX] auto {CRITERIA | off}\n", rd->filename);
 	pr_out("       %s statistic OBJECT bind COUNTER_SCOPE [DEV/PORT_INDEX] [OBJECT-ID] [COUNTER-ID]\n", rd->filename);
 	pr_out("       %s statistic OBJECT unbind COUNTER_SCOPE [DEV/PORT_INDEX] [COUNTER-ID]\n", rd->filename);
 	pr_out("       %s statistic show\n", rd->filename);
 	pr_out("       %s statistic show link [ DEV/PORT_INDEX ]\n", rd->filename);
+	pr_out("       %s statistic show [ link [ DEV/PORT_INDEX ] ] interval MSEC [ count N ]\n", rd->filename);
 	pr_out("       %s statistic mode [ supported ]\n", rd->filename);
 	pr_out("       %s statistic mode [ supported ] link [ DEV/PORT_INDEX ]\n", rd->filename);
 	pr_out("       %s statistic set link [ DEV/PORT_INDEX ] optional-counters [ OPTIONAL-COUNTERS ]\n", rd->filename);
@@ -42,6 +45,8 @@ static int stat_help(struct rd *rd)
 	pr_out("       %s statistic qp unbind link mlx5_2/1 cntn 4 lqpn 178\n", rd->filename);
 	pr_out("       %s statistic show\n", rd->filename);
 	pr_out("       %s statistic show link mlx5_2/1\n", rd->filename);
+	pr_out("       %s statistic show link mlx5_2/1 interval 200\n", rd->filename);
+	pr_out("       %s statistic qp show link mlx5_2/1 interval 1000 count 10\n", rd->filename);
 	pr_out("       %s statistic mode\n", rd->filename);
 	pr_out("       %s statistic mode link mlx5_2/1\n", rd->filename);
 	pr_out("       %s statistic mode supported\n", rd->filename);
@@ -194,6 +199,174 @@ static int stat_qp_get_mode(struct rd *rd)
 	return rd_exec_cmd(rd, cmds, "parameter");
 }
 
+/*
+ * Interval mode of "statistic show" and "statistic qp show" samples the
+ * hardware counters every interval and prints how much they moved. One
+ * entry is kept per (dev, port, cntn), cntn being 0 for the counters of
+ * the port itself. Its counter names are learnt from the first dump, so
+ * later dumps just store the values at the same index.
+ */
+struct stat_rate_entry {
+	uint32_t dev_idx;
+	uint32_t port;
+	uint32_t cntn;
+	char ifname[64];
+	unsigned int num;
+	char **names;
+	uint64_t *prev;
+	uint64_t *cur;
+	unsigned long tick;	/* last tick the entry was dumped in */
+	bool valid;		/* prev holds the previous tick */
+};
+
+struct stat_rate_link {
+	uint32_t dev_idx;
+	uint32_t port;
+};
+
+struct stat_rate {
+	unsigned int interval;	/* msec */
+	unsigned int count;
+	bool qp;
+	unsigned long tick;
+	struct stat_rate_link *links;
+	unsigned int num_links;
+	struct stat_rate_entry *entries;
+	unsigned int num_entries;
+};
+
+static void stat_rate_entry_reset(struct stat_rate_entry *e)
+{
+	unsigned int i;
+
+	for (i = 0; i < e->num; i++)
+		free(e->names[i]);
+	free(e->names);
+	free(e->prev);
+	free(e->cur);
+	e->names = NULL;
+	e->prev = NULL;
+	e->cur = NULL;
+	e->num = 0;
+	e->valid = false;
+}
+
+static int stat_rate_entry_cmp(const struct stat_rate_entry *e,
+			       uint32_t dev_idx, uint32_t port, uint32_t cntn)
+{
+	if (e->dev_idx != dev_idx)
+		return e->dev_idx < dev_idx ? -1 : 1;
+	if (e->port != port)
+		return e->port < port ? -1 : 1;
+	if (e->cntn != cntn)
+		return e->cntn < cntn ? -1 : 1;
+	return 0;
+}
+
+static struct stat_rate_entry *
+stat_rate_entry_get(struct stat_rate *sr, uint32_t dev_idx, const char *name,
+		    uint32_t port, uint32_t cntn)
+{
+	unsigned int lo = 0, hi = sr->num_entries, mid;
+	struct stat_rate_entry *entries, *e;
+	int cmp;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		cmp = stat_rate_entry_cmp(&sr->entries[mid], dev_idx, port,
+					  cntn);
+		if (!cmp)
+			return &sr->entries[mid];
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	entries = realloc(sr->entries,
+			  (sr->num_entries + 1) * sizeof(*entries));
+	if (!entries)
+		return NULL;
+	sr->entries = entries;
+	memmove(&entries[lo + 1], &entries[lo],
+		(sr->num_entries - lo) * sizeof(*entries));
+	sr->num_entries++;
+
+	e = &entries[lo];
+	memset(e, 0, sizeof(*e));
+	e->dev_idx = dev_idx;
+	e->port = port;
+	e->cntn = cntn;
+	strlcpy(e->ifname, name, sizeof(e->ifname));
+	return e;
+}
+
+static int stat_rate_entry_fill(struct stat_rate_entry *e,
+				struct nlattr *hwc_table)
+{
+	struct nlattr *nla_entry;
+	bool learn = !e->names;
+	unsigned int i = 0, j;
+	const char *nm;
+
+	if (learn) {
+		mnl_attr_for_each_nested(nla_entry, hwc_table)
+			e->num++;
+		e->names = calloc(e->num, sizeof(*e->names));
+		e->prev = calloc(e->num, sizeof(*e->prev));
+		e->cur = calloc(e->num, sizeof(*e->cur));
+		if (!e->names || !e->prev || !e->cur)
+			return -ENOMEM;
+	}
+
+	mnl_attr_for_each_nested(nla_entry, hwc_table) {
+		struct nlattr *hw_line[RDMA_NLDEV_ATTR_MAX] = {};
+
+		if (mnl_attr_parse_nested(nla_entry, rd_attr_cb,
+					  hw_line) != MNL_CB_OK ||
+		    !hw_line[RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY_NAME] ||
+		    !hw_line[RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY_VALUE])
+			return -EINVAL;
+
+		nm = mnl_attr_get_str(hw_line[RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY_NAME]);
+		j = i++;
+		if (learn) {
+			e->names[j] = strdup(nm);
+			if (!e->names[j])
+				return -ENOMEM;
+		} else if (j >= e->num || strcmp(e->names[j], nm)) {
+			for (j = 0; j < e->num; j++)
+				if (!strcmp(e->names[j], nm))
+					break;
+			if (j == e->num) {
+				/* optional counters were turned on, start over */
+				stat_rate_entry_reset(e);
+				return stat_rate_entry_fill(e, hwc_table);
+			}
+		}
+		e->cur[j] = mnl_attr_get_u64(hw_line[RDMA_NLDEV_ATTR_STAT_HWCOUNTER_ENTRY_VALUE]);
+	}
+
+	return 0;
+}
+
+static int stat_rate_update(struct rd *rd, uint32_t dev_idx, const char *name,
+			    uint32_t port, uint32_t cntn,
+			    struct nlattr *hwc_table)
+{
+	struct stat_rate *sr = rd->stat_rate;
+	struct stat_rate_entry *e;
+
+	e = stat_rate_entry_get(sr, dev_idx, name, port, cntn);
+	if (!e || stat_rate_entry_fill(e, hwc_table))
+		return MNL_CB_ERROR;
+
+	if (e->tick != sr->tick - 1)
+		e->valid = false;
+	e->tick = sr->tick;
+	return MNL_CB_OK;
+}
+
 int res_get_hwcounters(struct nlattr *hwc_table, bool print)
 {
 	struct nlattr *nla_entry;
@@ -259,7 +432,7 @@ static int res_counter_line(struct rd *rd, const char *name, int index,
 
 	if (nla_line[RDMA_NLDEV_ATTR_RES_PID]) {
 		pid = mnl_attr_get_u32(nla_line[RDMA_NLDEV_ATTR_RES_PID]);
-		if (!get_task_name(pid, b, sizeof(b)))
+		if (!res_get_task_name(pid, b, sizeof(b)))
 			comm = b;
 	} else if (nla_line[RDMA_NLDEV_ATTR_RES_KERN_NAME]) {
 		/* discard const from mnl_attr_get_str */
@@ -290,6 +463,9 @@ static int res_counter_line(struct rd *rd, const char *name, int index,
 	err = res_get_hwcounters(hwc_table, false);
 	if (err != MNL_CB_OK)
 		return err;
+	if (rd->stat_rate)
+		return stat_rate_update(rd, index, name, port, cntn, hwc_table);
+
 	open_json_object(NULL);
 	print_link(index, name, port, nla_line);
 	print_uint(PRINT_ANY, "cntn", "cntn %u ", cntn);
@@ -389,8 +565,227 @@ static int stat_qp_show_one_link(struct rd *rd)
 	return ret;
 }
 
+static int stat_show_parse_cb(const struct nlmsghdr *nlh, void *data);
+
+static int stat_rate_parse(struct rd *rd, struct stat_rate *sr)
+{
+	char **args;
+	int i, n;
+
+	for (i = 0; i < rd_argc(rd); i++)
+		if (!strcmp(rd->argv[i], "interval"))
+			break;
+	if (i == rd_argc(rd))
+		return 0;
+
+	args = rd->argv + i;
+	n = rd_argc(rd) - i;
+	if ((n != 2 && n != 4) || (n == 4 && strcmp(args[2], "count"))) {
+		pr_err("Expected \"interval MSEC [ count N ]\" at the end\n");
+		return -EINVAL;
+	}
+	if (get_unsigned(&sr->interval, args[1], 0) || !sr->interval) {
+		pr_err("Invalid interval \"%s\"\n", args[1]);
+		return -EINVAL;
+	}
+	if (n == 4 && get_unsigned(&sr->count, args[3], 0)) {
+		pr_err("Invalid count \"%s\"\n", args[3]);
+		return -EINVAL;
+	}
+
+	rd->argc = i;
+	return 1;
+}
+
+static void stat_rate_free(struct stat_rate *sr)
+{
+	unsigned int i;
+
+	for (i = 0; i < sr->num_entries; i++)
+		stat_rate_entry_reset(&sr->entries[i]);
+	free(sr->entries);
+	free(sr->links);
+}
+
+static int stat_rate_add_link(struct rd *rd)
+{
+	struct stat_rate *sr = rd->stat_rate;
+	struct stat_rate_link *links;
+	int ret;
+
+	if (!rd->port_idx)
+		return 0;
+
+	if (sr->qp && !sr->num_links) {
+		ret = rd_build_filter(rd, stat_valid_filters);
+		if (ret)
+			return ret;
+	}
+
+	links = realloc(sr->links, (sr->num_links + 1) * sizeof(*links));
+	if (!links)
+		return -ENOMEM;
+	links[sr->num_links].dev_idx = rd->dev_idx;
+	links[sr->num_links].port = rd->port_idx;
+	sr->links = links;
+	sr->num_links++;
+	return 0;
+}
+
+/* One request per link, all on the socket the sampler keeps open */
+static int stat_rate_sample(struct rd *rd)
+{
+	struct stat_rate *sr = rd->stat_rate;
+	int flags = NLM_F_REQUEST | NLM_F_ACK;
+	unsigned int i;
+	uint32_t seq;
+	int ret;
+
+	if (sr->qp)
+		flags |= NLM_F_DUMP;
+
+	for (i = 0; i < sr->num_links; i++) {
+		rd->dev_idx = sr->links[i].dev_idx;
+		rd->port_idx = sr->links[i].port;
+
+		rd_prepare_msg(rd, RDMA_NLDEV_CMD_STAT_GET, &seq, flags);
+		mnl_attr_put_u32(rd->nlh, RDMA_NLDEV_ATTR_DEV_INDEX,
+				 rd->dev_idx);
+		mnl_attr_put_u32(rd->nlh, RDMA_NLDEV_ATTR_PORT_INDEX,
+				 rd->port_idx);
+		if (sr->qp)
+			mnl_attr_put_u32(rd->nlh, RDMA_NLDEV_ATTR_STAT_RES,
+					 RDMA_NLDEV_ATTR_RES_QP);
+
+		if (mnl_socket_sendto(rd->nl, rd->nlh,
+				      rd->nlh->nlmsg_len) < 0) {
+			pr_err("Failed to send to socket with err %d\n",
+			       -errno);
+			return -errno;
+		}
+
+		ret = rd_recv_msg(rd, sr->qp ? stat_qp_show_parse_cb :
+					       stat_show_parse_cb, rd, seq);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Print the entries dumped in this tick and in the one before it; the
+ * ones seen for the first time only get their baseline. Counters that
+ * did not move are left out unless details are asked for.
+ */
+static void stat_rate_print(struct rd *rd, double secs)
+{
+	struct stat_rate *sr = rd->stat_rate;
+	struct stat_rate_entry *e;
+	unsigned int i, j;
+	uint64_t delta;
+
+	for (i = 0; i < sr->num_entries; i++) {
+		e = &sr->entries[i];
+		if (e->tick != sr->tick)
+			continue;
+		if (!e->valid) {
+			memcpy(e->prev, e->cur, e->num * sizeof(*e->cur));
+			e->valid = true;
+			continue;
+		}
+
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "ifname", "link %s/", e->ifname);
+		print_uint(PRINT_ANY, "port", "%u ", e->port);
+		if (sr->qp)
+			print_uint(PRINT_ANY, "cntn", "cntn %u ", e->cntn);
+		print_float(PRINT_JSON, "interval", NULL, secs);
+		for (j = 0; j < e->num; j++) {
+			/* a counter going backwards was reset */
+			delta = e->cur[j] >= e->prev[j] ?
+				e->cur[j] - e->prev[j] : e->cur[j];
+			if (!delta && !rd->show_details)
+				continue;
+
+			newline_indent();
+			print_string(PRINT_FP, NULL, "%s ", e->names[j]);
+			open_json_object(e->names[j]);
+			print_u64(PRINT_ANY, "delta", "%" PRIu64 " ", delta);
+			print_float(PRINT_ANY, "rate", "%.0f/s", delta / secs);
+			close_json_object();
+		}
+		close_json_object();
+		newline();
+
+		memcpy(e->prev, e->cur, e->num * sizeof(*e->cur));
+	}
+}
+
+static volatile sig_atomic_t stat_rate_stop;
+
+static void stat_rate_sig_handler(int signo)
+{
+	stat_rate_stop = 1;
+}
+
+static int stat_rate_run(struct rd *rd)
+{
+	struct stat_rate *sr = rd->stat_rate;
+	double next, now, last;
+	unsigned int printed = 0;
+	int saved_json = json;
+	int ret;
+
+	/* learn the links quietly, output starts with the first rates */
+	json = 0;
+	ret = rd_exec_link(rd, stat_rate_add_link, false);
+	json = saved_json;
+	if (ret || !sr->num_links)
+		goto out;
+
+	rd->nl = mnlu_socket_open(NETLINK_RDMA);
+	if (!rd->nl) {
+		pr_err("Failed to open NETLINK_RDMA socket\n");
+		ret = -ENODEV;
+		goto out;
+	}
+
+	signal(SIGINT, stat_rate_sig_handler);
+	signal(SIGTERM, stat_rate_sig_handler);
+
+	new_json_obj(json);
+	next = monotonic_now();
+	last = next;
+	while (!stat_rate_stop) {
+		sr->tick++;
+		ret = stat_rate_sample(rd);
+		if (ret)
+			break;
+
+		now = monotonic_now();
+		stat_rate_print(rd, now - last);
+		fflush(stdout);
+		last = now;
+		if (sr->tick > 1 && sr->count && ++printed == sr->count)
+			break;
+
+		next += sr->interval / 1000.0;
+		while (monotonic_sleep_until(next) < 0 && !stat_rate_stop)
+			;
+	}
+	delete_json_obj();
+
+	mnl_socket_close(rd->nl);
+out:
+	stat_rate_free(sr);
+	return ret;
+}
+
 static int stat_qp_show_link(struct rd *rd)
 {
+	if (rd->stat_rate)
+		return stat_rate_run(rd);
 	return rd_exec_link(rd, stat_qp_show_one_link, false);
 }
 
@@ -402,8 +797,18 @@ static int stat_qp_show(struct rd *rd)
 		{ "help",	stat_help },
 		{ 0 }
 	};
+	struct stat_rate sr = { .qp = true };
+	int ret;
 
-	return rd_exec_cmd(rd, cmds, "parameter");
+	ret = stat_rate_parse(rd, &sr);
+	if (ret < 0)
+		return ret;
+	if (ret)
+		rd->stat_rate = &sr;
+
+	ret = rd_exec_cmd(rd, cmds, "parameter");
+	rd->stat_rate = NULL;
+	return ret;
 }
 
 static bool stat_get_on_off(struct rd *rd, const char *arg, int *ret)
@@ -1099,6 +1504,7 @@ static int stat_unset(struct rd *rd)
 static int stat_show_parse_cb(const struct nlmsghdr *nlh, void *data)
 {
 	struct nlattr *tb[RDMA_NLDEV_ATTR_MAX] = {};
+	struct rd *rd = data;
 	const char *name;
 	uint32_t port;
 	int ret;
@@ -1111,6 +1517,12 @@ static int stat_show_parse_cb(const struct nlmsghdr *nlh, void *data)
 
 	name = mnl_attr_get_str(tb[RDMA_NLDEV_ATTR_DEV_NAME]);
 	port = mnl_attr_get_u32(tb[RDMA_NLDEV_ATTR_PORT_INDEX]);
+	if (rd->stat_rate)
+		return stat_rate_update(rd,
+					mnl_attr_get_u32(tb[RDMA_NLDEV_ATTR_DEV_INDEX]),
+					name, port, 0,
+					tb[RDMA_NLDEV_ATTR_STAT_HWCOUNTERS]);
+
 	open_json_object(NULL);
 	print_string(PRINT_ANY, "ifname", "link %s/", name);
 	print_uint(PRINT_ANY, "port", "%u ", port);
@@ -1142,6 +1554,8 @@ static int stat_show_one_link(struct rd *rd)
 
 static int stat_show_link(struct rd *rd)
 {
+	if (rd->stat_rate)
+		return stat_rate_run(rd);
 	return rd_exec_link(rd, stat_show_one_link, false);
 }
 
@@ -1154,8 +1568,23 @@ static int stat_show(struct rd *rd)
 		{ "help",	stat_help },
 		{ 0 }
 	};
+	struct stat_rate sr = {};
+	int ret;
 
-	return rd_exec_cmd(rd, cmds, "parameter");
+	ret = stat_rate_parse(rd, &sr);
+	if (ret < 0)
+		return ret;
+	if (ret) {
+		if (!rd_no_arg(rd) && strcmpx(rd_argv(rd), "link")) {
+			pr_err("Interval is supported for link counters only\n");
+			return -EINVAL;
+		}
+		rd->stat_rate = &sr;
+	}
+
+	ret = rd_exec_cmd(rd, cmds, "parameter");
+	rd->stat_rate = NULL;
+	return ret;
 }
 
 int cmd_stat(struct rd *rd)
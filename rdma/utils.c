@@ -269,48 +269,33 @@ static bool rd_check_is_key_exist(struct rd *rd, const char *key)
 static bool rd_check_is_string_filtered(struct rd *rd, const char *key,
 					const char *val)
 {
-	bool key_is_filtered = false;
+	size_t val_len = strlen(val);
 	struct filter_entry *fe;
-	char *p = NULL;
-	char *str;
+	const char *p, *end;
 
 	list_for_each_entry(fe, &rd->filter_list, list) {
-		if (!strcmpx(fe->key, key)) {
-			/* We found the key */
-			p = strdup(fe->value);
-			key_is_filtered = true;
-			if (!p) {
-				/*
-				 * Something extremely wrong if we fail
-				 * to allocate small amount of bytes.
-				 */
-				pr_err("Found key, but failed to allocate memory to store value\n");
-				return key_is_filtered;
-			}
+		if (strcmpx(fe->key, key))
+			continue;
 
-			/*
-			 * Need to check if value in range
-			 * It can come in the following formats
-			 * and their permutations:
-			 * str
-			 * str1,str2
-			 */
-			str = strtok(p, ",");
-			while (str) {
-				if (strlen(str) == strlen(val) &&
-				    !strcasecmp(str, val)) {
-					key_is_filtered = false;
-					goto out;
-				}
-				str = strtok(NULL, ",");
-			}
-			goto out;
+		/*
+		 * We found the key, check if value is in the list.
+		 * It can come in the following formats
+		 * and their permutations:
+		 * str
+		 * str1,str2
+		 *
+		 * This runs for every object of a dump, so walk the
+		 * value in place rather than tokenizing a copy of it.
+		 */
+		for (p = fe->value; *p; p = *end ? end + 1 : end) {
+			end = strchrnul(p, ',');
+			if (end - p == val_len && !strncasecmp(p, val, val_len))
+				return false;
 		}
+		return true;
 	}
 
-out:
-	free(p);
-	return key_is_filtered;
+	return false;
 }
 
 /*
@@ -716,10 +701,16 @@ err:
 
 int rd_recv_msg(struct rd *rd, mnl_cb_t callback, void *data, unsigned int seq)
 {
-	char buf[MNL_SOCKET_BUFFER_SIZE];
+	/*
+	 * The kernel sizes dump messages after the largest buffer we
+	 * read with, and every message of a resource dump walks the
+	 * restrack table again from its start. Reading with a buffer of
+	 * the largest dump size cuts the number of those rounds.
+	 */
+	char buf[RD_DUMP_BUFFER_SIZE];
 	int ret;
 
-	ret = mnlu_socket_recv_run(rd->nl, seq, buf, MNL_SOCKET_BUFFER_SIZE,
+	ret = mnlu_socket_recv_run(rd->nl, seq, buf, sizeof(buf),
 				   callback, data);
 	if (ret < 0 && !rd->suppress_errors)
 		perror("error");
@@ -778,11 +769,13 @@ struct dev_map *dev_map_lookup(struct rd *rd, bool allow_port_index)
 
 #define nla_type(attr) ((attr)->nla_type & NLA_TYPE_MASK)
 
-/* End of device object always print a newline */
+/*
+ * End of device object always print a newline. Dumps can hold millions
+ * of objects, so leave flushing to stdio rather than writing each line.
+ */
 void newline(void)
 {
 	putchar('\n');
-	fflush(stdout);
 }
 
 /* End of partial multi-line segment of a device object */
@@ -24,8 +24,9 @@ static void explain(void)
 {
 	fprintf(stderr,
 		"Usage: ... bpf [ import UDS_FILE ] [ run CMD ]\n"
-		"       ... bpf [ debug ]\n"
+		"       ... bpf [ debug [ MAP_FILE [ type NAME ] [ prog PROG_FILE ] [ raw ] ] ]\n"
 		"       ... bpf [ graft MAP_FILE ] [ key KEY ]\n"
+		"       ... bpf [ load MAP_FILE ] [ from DATA_FILE ] [ hex ]\n"
 		"          `... [ object-file OBJ_FILE ] [ type TYPE ] [ section NAME ] [ verbose ]\n"
 		"          `... [ object-pinned PROG_FILE ]\n"
 		"\n"
@@ -35,7 +36,12 @@ static void explain(void)
 		"Where MAP_FILE points to a pinned map, OBJ_FILE to an object file\n"
 		"and PROG_FILE to a pinned program. TYPE can be {cls, act}, where\n"
 		"\'cls\' is default. KEY is optional and can be inferred from the\n"
-		"section name, otherwise it needs to be provided.\n",
+		"section name, otherwise it needs to be provided.\n"
+		"DATA_FILE holds packed key and value records, or with \'hex\'\n"
+		"one \"KEY VALUE\" line per entry in hex (\'-\' reads stdin).\n"
+		"With MAP_FILE, debug reads the pinned ring buffer or perf event\n"
+		"array map instead of the trace pipe, and decodes the records as\n"
+		"the BTF type NAME of the map or of PROG_FILE, or writes them raw.\n",
 		BPF_DEFAULT_CMD);
 }
 
@@ -70,10 +76,37 @@ static int parse_bpf(const struct exec_util *eu, int argc, char **argv)
 			bpf_uds_name = *argv;
 		} else if (matches(*argv, "debug") == 0 ||
 			   matches(*argv, "dbg") == 0) {
-			if (bpf_trace_pipe())
-				fprintf(stderr,
-					"No trace pipe, tracefs not mounted?\n");
-			return -1;
+			const char *bpf_map_path, *type = NULL, *prog = NULL;
+			bool raw = false;
+
+			if (argc == 1) {
+				if (bpf_trace_pipe())
+					fprintf(stderr,
+						"No trace pipe, tracefs not mounted?\n");
+				return -1;
+			}
+			NEXT_ARG();
+			bpf_map_path = *argv;
+			while (argc > 1) {
+				NEXT_ARG();
+				if (strcmp(*argv, "type") == 0) {
+					NEXT_ARG();
+					type = *argv;
+				} else if (strcmp(*argv, "prog") == 0) {
+					NEXT_ARG();
+					prog = *argv;
+				} else if (strcmp(*argv, "raw") == 0) {
+					raw = true;
+				} else {
+					explain();
+					return -1;
+				}
+			}
+			if (raw && type) {
+				fprintf(stderr, "\"raw\" and \"type\" are exclusive\n");
+				return -1;
+			}
+			return bpf_dbg_map(bpf_map_path, type, prog, raw);
 		} else if (matches(*argv, "graft") == 0) {
 			const char *bpf_map_path;
 			bool has_key = false;
@@ -93,6 +126,28 @@ static int parse_bpf(const struct exec_util *eu, int argc, char **argv)
 			}
 			return bpf_graft_map(bpf_map_path, has_key ?
 					     &key : NULL, argc, argv);
+		} else if (matches(*argv, "load") == 0) {
+			const char *bpf_map_path, *data_file;
+			bool hex = false;
+
+			NEXT_ARG();
+			bpf_map_path = *argv;
+			NEXT_ARG();
+			if (strcmp(*argv, "from") != 0) {
+				explain();
+				return -1;
+			}
+			NEXT_ARG();
+			data_file = *argv;
+			if (argc > 1 && strcmp(argv[1], "hex") == 0) {
+				hex = true;
+				NEXT_ARG_FWD();
+			}
+			if (argc > 1) {
+				explain();
+				return -1;
+			}
+			return bpf_load_map(bpf_map_path, data_file, hex);
 		} else {
 			explain();
 			return -1;
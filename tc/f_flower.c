@@ -6,6 +6,7 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -21,6 +22,7 @@
 #include "utils.h"
 #include "tc_util.h"
 #include "rt_names.h"
+#include "rtnl_bulk.h"
 
 /* maximum length of options string */
 #define FLOWER_OPTS_MAX	4096
@@ -50,6 +52,9 @@ static void explain(void)
 		"Usage: ... flower	[ MATCH-LIST ] [ verbose ]\n"
 		"			[ skip_sw | skip_hw ]\n"
 		"			[ action ACTION-SPEC ] [ classid CLASSID ]\n"
+		"       ... flower	bulk FILE keys KEY[,KEY...] [ template ]\n"
+		"			[ MATCH-LIST ] [ skip_sw | skip_hw ]\n"
+		"			[ action ACTION-SPEC ] [ classid CLASSID ]\n"
 		"\n"
 		"Where: MATCH-LIST := [ MATCH-LIST ] MATCH\n"
 		"       MATCH      := {	indev DEV-NAME |\n"
@@ -1637,6 +1642,9 @@ static int flower_parse_cfm(int *argc_p, char ***argv_p, __be16 eth_type,
 	return 0;
 }
 
+static int flower_parse_bulk(const struct filter_util *qu, char *handle,
+			     int argc, char **argv, struct nlmsghdr *n);
+
 static int flower_parse_opt(const struct filter_util *qu, char *handle,
 			    int argc, char **argv, struct nlmsghdr *n)
 {
@@ -1656,6 +1664,9 @@ static int flower_parse_opt(const struct filter_util *qu, char *handle,
 	__u32 dst_flags = 0;
 	__u32 dst_flags_mask = 0;
 
+	if (argc > 0 && strcmp(*argv, "bulk") == 0)
+		return flower_parse_bulk(qu, handle, argc, argv, n);
+
 	if (handle) {
 		ret = get_u32(&t->tcm_handle, handle, 0);
 		if (ret) {
@@ -2332,6 +2343,245 @@ parse_done:
 	return 0;
 }
 
+/* "bulk FILE keys KEY,... [ template ] [ OPTIONS ]" installs one filter per
+ * line of FILE.  A line holds one value per KEY, optionally followed by
+ * options of its own; OPTIONS apply to every line.  Actions given in
+ * OPTIONS are parsed once and copied into each request.  The last rule
+ * is left in n for the caller to send.
+ */
+#define FLOWER_BULK_MAX_KEYS	32
+#define FLOWER_BULK_MAX_ARGS	256
+#define FLOWER_BULK_WINDOW	1024
+
+struct flower_req {
+	struct nlmsghdr	n;
+	char		buf[MAX_MSG];
+};
+
+static int flower_bulk_has_action(int argc, char **argv)
+{
+	while (argc-- > 0)
+		if (matches(*argv++, "action") == 0)
+			return 1;
+	return 0;
+}
+
+/* Build one rule on top of the first proto_len bytes of n. */
+static int flower_bulk_rule(const struct filter_util *qu, struct nlmsghdr *n,
+			    __u32 proto_len, int argc, char **argv,
+			    const struct rtattr *act)
+{
+	struct rtattr *opts = (void *)n + NLMSG_ALIGN(proto_len);
+
+	n->nlmsg_len = proto_len;
+	if (flower_parse_opt(qu, NULL, argc, argv, n))
+		return -1;
+	if (act) {
+		if (addraw_l(n, MAX_MSG, act, RTA_ALIGN(act->rta_len)))
+			return -1;
+		opts->rta_len = (void *)n + n->nlmsg_len - (void *)opts;
+	}
+	return 0;
+}
+
+static int flower_parse_bulk(const struct filter_util *qu, char *handle,
+			     int argc, char **argv, struct nlmsghdr *n)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtnl_bulk b = {
+		.what = "rules",
+		.window = FLOWER_BULK_WINDOW,
+	};
+	struct flower_req *req = NULL, *act = NULL;
+	struct rtattr *act_attr = NULL;
+	struct rtnl_flush f;
+	char *keys[FLOWER_BULK_MAX_KEYS], *keylist = NULL, *cp;
+	char *pre[FLOWER_BULK_MAX_ARGS], *post[FLOWER_BULK_MAX_ARGS];
+	int npre = 0, npost = 0, nkeys = 0, template = 0;
+	__u32 proto_len = n->nlmsg_len;
+	int have_last = 0, lineno = 0;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp = NULL;
+	int ret = -1;
+
+	if (handle) {
+		fprintf(stderr, "\"bulk\" does not take a handle\n");
+		return -1;
+	}
+	if (!TC_H_MAJ(t->tcm_info)) {
+		fprintf(stderr, "\"bulk\" needs an explicit filter priority\n");
+		return -1;
+	}
+
+	NEXT_ARG();
+	b.file = *argv;
+	NEXT_ARG();
+	if (strcmp(*argv, "keys") != 0) {
+		fprintf(stderr, "\"bulk\" needs \"keys KEY[,KEY...]\"\n");
+		return -1;
+	}
+	NEXT_ARG();
+	keylist = strdup(*argv);
+	if (!keylist)
+		return -1;
+	for (cp = strtok(keylist, ","); cp; cp = strtok(NULL, ",")) {
+		if (nkeys == FLOWER_BULK_MAX_KEYS) {
+			fprintf(stderr, "Too many bulk keys\n");
+			goto out;
+		}
+		keys[nkeys++] = cp;
+	}
+	argc--; argv++;
+
+	if (argc > 0 && strcmp(*argv, "template") == 0) {
+		template = 1;
+		argc--; argv++;
+	}
+
+	/* Common options: matches before the actions, flags after them. */
+	while (argc > 0 && matches(*argv, "action") != 0) {
+		if (npre == FLOWER_BULK_MAX_ARGS)
+			goto too_many;
+		pre[npre++] = *argv;
+		argc--; argv++;
+	}
+	if (argc > 0) {
+		NEXT_ARG();
+		act = calloc(1, sizeof(*act));
+		if (!act)
+			goto out;
+		act->n.nlmsg_len = NLMSG_LENGTH(0);
+		if (parse_action(&argc, &argv, TCA_FLOWER_ACT, &act->n)) {
+			fprintf(stderr, "Illegal \"action\"\n");
+			goto out;
+		}
+		act_attr = (struct rtattr *)((char *)&act->n + NLMSG_HDRLEN);
+		while (argc > 0) {
+			if (npost == FLOWER_BULK_MAX_ARGS)
+				goto too_many;
+			post[npost++] = *argv;
+			argc--; argv++;
+		}
+	}
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		goto out;
+
+	fp = rtnl_bulk_open(&b);
+	if (!fp)
+		goto out;
+
+	if (rtnl_bulk_start(&b, &f) < 0)
+		goto out;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *rargv[FLOWER_BULK_MAX_ARGS * 2 + FLOWER_BULK_MAX_KEYS * 2];
+		char *tok[FLOWER_BULK_MAX_ARGS];
+		int rargc = 0, ntok, i;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, FLOWER_BULK_MAX_ARGS);
+		if (ntok == 0)
+			continue;
+		if (ntok > FLOWER_BULK_MAX_ARGS) {
+			rtnl_bulk_line_error(&b, lineno, "too many words");
+			goto out_close;
+		}
+		if (ntok < nkeys) {
+			fprintf(stderr, "%s:%d: expected %d key values\n",
+				b.file, lineno, nkeys);
+			goto out_close;
+		}
+
+		for (i = 0; i < npre; i++)
+			rargv[rargc++] = pre[i];
+		for (i = 0; i < nkeys; i++) {
+			rargv[rargc++] = keys[i];
+			rargv[rargc++] = tok[i];
+		}
+
+		/* The previous rule is complete, queue it. */
+		if (have_last) {
+			f.tag = have_last;
+			if (rtnl_flush_add(&f, &req->n, 0) < 0) {
+				perror("Cannot talk to rtnetlink");
+				goto out_close;
+			}
+			have_last = 0;
+		}
+
+		if (template && b.entries == 0) {
+			memcpy(req, n, proto_len);
+			req->n.nlmsg_type = RTM_NEWCHAIN;
+			req->n.nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE |
+					     NLM_F_EXCL;
+			if (flower_bulk_rule(qu, &req->n, proto_len, rargc,
+					     rargv, NULL))
+				goto out_close;
+			f.tag = lineno;
+			if (rtnl_flush_add(&f, &req->n, 0) < 0 ||
+			    rtnl_flush_commit(&f) < 0) {
+				fprintf(stderr, "Cannot create the chain template\n");
+				goto out_close;
+			}
+		}
+
+		for (i = nkeys; i < ntok; i++)
+			rargv[rargc++] = tok[i];
+		for (i = 0; i < npost; i++)
+			rargv[rargc++] = post[i];
+
+		b.entries++;
+		memcpy(req, n, proto_len);
+		if (flower_bulk_rule(qu, &req->n, proto_len, rargc, rargv,
+				     flower_bulk_has_action(ntok - nkeys,
+							    tok + nkeys) ?
+				     NULL : act_attr)) {
+			rtnl_bulk_line_error(&b, lineno, "illegal rule");
+			continue;
+		}
+		have_last = lineno;
+	}
+
+	if (!b.entries) {
+		fprintf(stderr, "\"%s\" contains no rules\n", b.file);
+		goto out_close;
+	}
+
+	/* The last rule goes back to the caller only if all others made it. */
+	if (rtnl_flush_commit(&f) == -2) {
+		perror("Cannot talk to rtnetlink");
+		goto out_close;
+	}
+	if (have_last && !b.failed) {
+		memcpy(n, req, req->n.nlmsg_len);
+	} else if (have_last) {
+		f.tag = have_last;
+		if (rtnl_flush_add(&f, &req->n, 0) < 0) {
+			perror("Cannot talk to rtnetlink");
+			goto out_close;
+		}
+	}
+	ret = rtnl_bulk_finish(&b, &f);
+	goto out;
+
+out_close:
+	rtnl_flush_close(&f);
+out:
+	rtnl_bulk_close(fp);
+	free(line);
+	free(req);
+	free(act);
+	free(keylist);
+	return ret;
+
+too_many:
+	fprintf(stderr, "Too many bulk options\n");
+	goto out;
+}
+
 static int __mask_bits(char *addr, size_t len)
 {
 	int bits = 0;
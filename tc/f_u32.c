@@ -20,7 +20,9 @@
 #include <linux/if_ether.h>
 
 #include "utils.h"
+#include "rtnl_bulk.h"
 #include "tc_util.h"
+#include "tc_common.h"
 
 static void explain(void)
 {
@@ -30,11 +32,13 @@ static void explain(void)
 		"               [ ht HTID ] [ hashkey HASHKEY_SPEC ]\n"
 		"               [ sample SAMPLE ] [skip_hw | skip_sw]\n"
 		"or         u32 divisor DIVISOR\n"
+		"or         u32 table { src | dst } FILE [ classid CLASSID ]\n"
 		"\n"
 		"Where: SELECTOR := SAMPLE SAMPLE ...\n"
 		"       SAMPLE := { ip | ip6 | udp | tcp | icmp | u{32|16|8} | mark }\n"
 		"                 SAMPLE_ARGS [ divisor DIVISOR ]\n"
 		"       FILTERID := X:Y:Z\n"
+		"       FILE holds lines of PREFIX CLASSID [ SELECTOR ]\n"
 		"\nNOTE: CLASSID is parsed at hexadecimal input.\n");
 }
 
@@ -1018,6 +1022,419 @@ static __u32 u32_hash_fold(struct tc_u32_key *key)
 	return ntohl(key->val & key->mask) >> fshift;
 }
 
+/* "table" mode: build a tree of hash tables from a file of prefix rules.
+ *
+ * Each node of the tree hashes on a window of at most eight address bits,
+ * starting after the bits all of its rules have in common.  A bucket that
+ * still holds more than U32_TABLE_LEAF rules gets its own table one level
+ * down; rules shorter than the window are expanded into every bucket they
+ * cover and placed after the link, so the longest prefix always wins.
+ */
+#define U32_TABLE_LEAF	8
+#define U32_TABLE_DEPTH	(TC_U32_MAXDEPTH - 1)
+
+struct u32_rule {
+	__u32			addr;
+	int			len;
+	int			line;
+	__u32			classid;
+	int			nkeys;
+	struct tc_u32_key	*keys;
+};
+
+struct u32_gen {
+	struct rtnl_bulk	bulk;		/* only file and line errors */
+	const struct nlmsghdr	*proto;
+	__u32			proto_len;
+	int			off;
+	__u32			next_htid;
+	unsigned int		tables;
+	unsigned int		filters;
+};
+
+static int u32_rule_cmp(const void *a, const void *b)
+{
+	const struct u32_rule *ra = *(const struct u32_rule **)a;
+	const struct u32_rule *rb = *(const struct u32_rule **)b;
+
+	if (ra->len != rb->len)
+		return rb->len - ra->len;
+	return ra->line - rb->line;
+}
+
+static int u32_read_table(struct rtnl_bulk *b, struct u32_rule **rules_p)
+{
+	struct u32_rule *rules = NULL;
+	int count = 0, size = 0, lineno = 0;
+	size_t len = 0;
+	char *line = NULL;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(b);
+	if (fp == NULL)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		struct {
+			struct tc_u32_sel sel;
+			struct tc_u32_key keys[128];
+		} extra = {};
+		struct {
+			struct nlmsghdr n;
+			char buf[256];
+		} scratch = { .n.nlmsg_len = NLMSG_LENGTH(0) };
+		char *argv[64];
+		struct u32_rule *r;
+		inet_prefix pfx;
+		int argc;
+		char **av;
+
+		lineno++;
+		argc = rtnl_bulk_tokens(line, argv, ARRAY_SIZE(argv) - 1);
+		if (argc == 0)
+			continue;
+		if (argc > ARRAY_SIZE(argv) - 1) {
+			rtnl_bulk_line_error(b, lineno, "too many words");
+			goto err;
+		}
+		argv[argc] = NULL;
+
+		if (count == size) {
+			size = size ? size * 2 : 1024;
+			r = realloc(rules, size * sizeof(*rules));
+			if (r == NULL) {
+				perror("realloc");
+				goto err;
+			}
+			rules = r;
+		}
+		r = &rules[count];
+		memset(r, 0, sizeof(*r));
+		r->line = lineno;
+
+		if (argc < 2 || get_prefix_1(&pfx, argv[0], AF_INET)) {
+			rtnl_bulk_line_error(b, lineno,
+					     "expected \"PREFIX CLASSID\"");
+			goto err;
+		}
+		r->len = pfx.bitlen;
+		r->addr = r->len ? ntohl(pfx.data[0]) & (~0U << (32 - r->len)) : 0;
+		if (get_tc_classid(&r->classid, argv[1])) {
+			rtnl_bulk_line_error(b, lineno, "illegal classid");
+			goto err;
+		}
+
+		argc -= 2;
+		av = argv + 2;
+		while (argc > 0) {
+			if (parse_selector(&argc, &av, &extra.sel, &scratch.n) ||
+			    scratch.n.nlmsg_len != NLMSG_LENGTH(0)) {
+				rtnl_bulk_line_error(b, lineno,
+						     "illegal selector");
+				goto err;
+			}
+		}
+		if (extra.sel.nkeys) {
+			r->keys = malloc(extra.sel.nkeys * sizeof(*r->keys));
+			if (r->keys == NULL) {
+				perror("malloc");
+				goto err;
+			}
+			memcpy(r->keys, extra.keys,
+			       extra.sel.nkeys * sizeof(*r->keys));
+			r->nkeys = extra.sel.nkeys;
+		}
+		count++;
+	}
+	free(line);
+	rtnl_bulk_close(fp);
+
+	if (count == 0) {
+		fprintf(stderr, "\"%s\" contains no rules\n", b->file);
+		free(rules);
+		return -1;
+	}
+	*rules_p = rules;
+	return count;
+
+err:
+	while (count--)
+		free(rules[count].keys);
+	free(rules);
+	free(line);
+	rtnl_bulk_close(fp);
+	return -1;
+}
+
+static int u32_gen_talk(struct u32_gen *g, __u32 handle, __u32 ht,
+			__u32 divisor, __u32 link, __u32 classid,
+			struct tc_u32_sel *sel)
+{
+	struct {
+		struct nlmsghdr	n;
+		char		buf[MAX_MSG];
+	} req;
+	struct rtattr *tail;
+
+	memcpy(&req, g->proto, g->proto_len);
+	req.n.nlmsg_len = g->proto_len;
+	((struct tcmsg *)NLMSG_DATA(&req.n))->tcm_handle = handle;
+
+	tail = addattr_nest(&req.n, sizeof(req), TCA_OPTIONS);
+	if (divisor)
+		addattr32(&req.n, sizeof(req), TCA_U32_DIVISOR, divisor);
+	if (ht)
+		addattr32(&req.n, sizeof(req), TCA_U32_HASH, ht);
+	if (link)
+		addattr32(&req.n, sizeof(req), TCA_U32_LINK, link);
+	if (classid)
+		addattr32(&req.n, sizeof(req), TCA_U32_CLASSID, classid);
+	if (sel)
+		addattr_l(&req.n, sizeof(req), TCA_U32_SEL, sel,
+			  sizeof(*sel) + sel->nkeys * sizeof(struct tc_u32_key));
+	addattr_nest_end(&req.n, tail);
+
+	if (rtnl_talk(&rth, &req.n, NULL) < 0)
+		return -1;
+	if (!divisor)
+		g->filters++;
+	return 0;
+}
+
+static int u32_gen_leaf(struct u32_gen *g, __u32 ht, __u32 node,
+			const struct u32_rule *r)
+{
+	struct {
+		struct tc_u32_sel sel;
+		struct tc_u32_key keys[128];
+	} sel = {};
+	int i;
+
+	sel.sel.flags = TC_U32_TERMINAL;
+	pack_key32(&sel.sel, r->addr, r->len ? ~0U << (32 - r->len) : 0,
+		   g->off, 0);
+	for (i = 0; i < r->nkeys; i++) {
+		if (pack_key(&sel.sel, r->keys[i].val, r->keys[i].mask,
+			     r->keys[i].off, r->keys[i].offmask)) {
+			rtnl_bulk_line_error(&g->bulk, r->line,
+					     "selector contradicts the prefix");
+			return -1;
+		}
+	}
+
+	return u32_gen_talk(g, ht | node, ht, 0, 0, r->classid, &sel.sel);
+}
+
+static __u32 u32_window(__u32 addr, int s, int k)
+{
+	return k ? (addr >> (32 - s - k)) & ((1U << k) - 1) : 0;
+}
+
+/* Bucket range [*lo, *hi) a rule falls into for window [s, s + k). */
+static void u32_rule_span(const struct u32_rule *r, int s, int k,
+			  unsigned int *lo, unsigned int *hi)
+{
+	if (r->len >= s + k) {
+		*lo = u32_window(r->addr, s, k);
+		*hi = *lo + 1;
+	} else if (r->len <= s) {
+		*lo = 0;
+		*hi = 1U << k;
+	} else {
+		*lo = u32_window(r->addr, s, k);
+		*hi = *lo + (1U << (s + k - r->len));
+	}
+}
+
+/* Pick the narrowest window that gets every bucket down to a leaf,
+ * or failing that the one with the smallest worst bucket, without
+ * letting short prefixes multiply the number of entries.
+ */
+static int u32_gen_stride(struct u32_rule **rules, int count, int start,
+			  int *s_p)
+{
+	unsigned int occ[256];
+	int best_k = 0, best_max = count;
+	int k;
+
+	for (k = 1; k <= 8 && k <= 32 - start; k++) {
+		int s = start > 32 - k ? 32 - k : start;
+		unsigned int total = 0, max = 0;
+		unsigned int lo, hi, b;
+		int i;
+
+		memset(occ, 0, sizeof(occ));
+		for (i = 0; i < count; i++) {
+			u32_rule_span(rules[i], s, k, &lo, &hi);
+			for (b = lo; b < hi; b++)
+				occ[b]++;
+			total += hi - lo;
+		}
+		for (b = 0; b < 1U << k; b++)
+			if (occ[b] > max)
+				max = occ[b];
+
+		if (k > 1 && total > 2 * count + (1U << k))
+			break;
+		if (max < best_max) {
+			best_max = max;
+			best_k = k;
+		}
+		if (max <= U32_TABLE_LEAF)
+			break;
+	}
+	*s_p = start > 32 - best_k ? 32 - best_k : start;
+	return best_k;
+}
+
+static int u32_gen_table(struct u32_gen *g, struct u32_rule **rules, int count,
+			 int start, int level, __u32 *htid_p, __u32 *hmask_p)
+{
+	struct u32_rule **slots = NULL;
+	unsigned int first[257];
+	unsigned int lo, hi, b;
+	__u32 htid, node = 0;
+	__u32 diff = 0;
+	int s = 32, k = 0;
+	int i, ret = -1;
+
+	for (i = 1; i < count; i++)
+		diff |= rules[i]->addr ^ rules[0]->addr;
+	if (diff && __builtin_clz(diff) > start)
+		start = __builtin_clz(diff);
+	else if (!diff)
+		start = 32;
+
+	if (count > U32_TABLE_LEAF && start < 32)
+		k = u32_gen_stride(rules, count, start, &s);
+
+	if (g->next_htid == TC_U32_USERHTID(0x80000000))
+		g->next_htid++;
+	if (g->next_htid >= TC_U32_USERHTID(TC_U32_ROOT)) {
+		fprintf(stderr, "Out of u32 hash table ids\n");
+		return -1;
+	}
+	htid = g->next_htid++ << 20;
+	if (u32_gen_talk(g, htid, 0, 1U << k, 0, 0, NULL))
+		return -1;
+	g->tables++;
+
+	/* Counting sort of the rules into their buckets. */
+	memset(first, 0, sizeof(first));
+	for (i = 0; i < count; i++) {
+		u32_rule_span(rules[i], s, k, &lo, &hi);
+		for (b = lo; b < hi; b++)
+			first[b + 1]++;
+	}
+	for (b = 1; b <= 1U << k; b++)
+		first[b] += first[b - 1];
+	slots = malloc(first[1U << k] * sizeof(*slots));
+	if (slots == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		u32_rule_span(rules[i], s, k, &lo, &hi);
+		for (b = lo; b < hi; b++)
+			slots[first[b]++] = rules[i];
+	}
+	for (b = 1U << k; b > 0; b--)
+		first[b] = first[b - 1];
+	first[0] = 0;
+
+	for (b = 0; b < 1U << k; b++) {
+		struct u32_rule **bkt = slots + first[b];
+		unsigned int n = first[b + 1] - first[b];
+		__u32 ht = htid | (b << 12);
+		unsigned int nlong = 0, j;
+
+		/* Rules that fully cover the window go first, so they
+		 * can be handed down as one contiguous run.
+		 */
+		for (j = 0; j < n; j++) {
+			if (bkt[j]->len >= s + k) {
+				struct u32_rule *tmp = bkt[nlong];
+
+				bkt[nlong++] = bkt[j];
+				bkt[j] = tmp;
+			}
+		}
+
+		if (k && nlong > U32_TABLE_LEAF && s + k < 32 &&
+		    level + 1 < U32_TABLE_DEPTH) {
+			struct tc_u32_sel link = {};
+			__u32 child;
+
+			if (u32_gen_table(g, bkt, nlong, s + k, level + 1,
+					  &child, &link.hmask))
+				goto out;
+			link.hoff = g->off;
+			if (++node > 0xfff)
+				goto full;
+			if (u32_gen_talk(g, ht | node, ht, 0, child, 0, &link))
+				goto out;
+			bkt += nlong;
+			n -= nlong;
+		}
+
+		qsort(bkt, n, sizeof(*bkt), u32_rule_cmp);
+		for (j = 0; j < n; j++) {
+			if (++node > 0xfff)
+				goto full;
+			if (u32_gen_leaf(g, ht, node, bkt[j]))
+				goto out;
+		}
+	}
+
+	*htid_p = htid;
+	*hmask_p = k ? htonl(((1U << k) - 1) << (32 - s - k)) : 0;
+	ret = 0;
+	goto out;
+full:
+	fprintf(stderr, "Hash table %x: has more than 4095 entries\n",
+		TC_U32_USERHTID(htid));
+out:
+	free(slots);
+	return ret;
+}
+
+static int u32_gen_tables(struct nlmsghdr *n, __u32 len, const char *file,
+			  int off, __u32 base, __u32 *htid_p, __u32 *hmask_p)
+{
+	struct u32_gen g = {
+		.bulk.file = file,
+		.proto = n,
+		.proto_len = len,
+		.off = off,
+		.next_htid = base ? base : 1,
+	};
+	struct u32_rule *rules, **order;
+	int count, i, ret = -1;
+
+	count = u32_read_table(&g.bulk, &rules);
+	if (count < 0)
+		return -1;
+
+	order = malloc(count * sizeof(*order));
+	if (order == NULL) {
+		perror("malloc");
+		goto out;
+	}
+	for (i = 0; i < count; i++)
+		order[i] = &rules[i];
+
+	ret = u32_gen_table(&g, order, count, 0, 0, htid_p, hmask_p);
+	if (ret == 0 && show_details)
+		fprintf(stderr, "u32 table: %d rules, %u hash tables, %u filters\n",
+			count, g.tables, g.filters);
+	free(order);
+out:
+	for (i = 0; i < count; i++)
+		free(rules[i].keys);
+	free(rules);
+	return ret;
+}
+
 static int u32_parse_opt(const struct filter_util *qu, char *handle,
 			 int argc, char **argv, struct nlmsghdr *n)
 {
@@ -1028,7 +1445,10 @@ static int u32_parse_opt(const struct filter_util *qu, char *handle,
 	struct tcmsg *t = NLMSG_DATA(n);
 	struct rtattr *tail;
 	int sel_ok = 0, terminal_ok = 0;
-	int sample_ok = 0;
+	int sample_ok = 0, hash_ok = 0;
+	char *table = NULL;
+	int table_off = 0;
+	__u32 proto_len;
 	__u32 htid = 0;
 	__u32 order = 0;
 	__u32 flags = 0;
@@ -1041,6 +1461,7 @@ static int u32_parse_opt(const struct filter_util *qu, char *handle,
 	if (argc == 0)
 		return 0;
 
+	proto_len = n->nlmsg_len;
 	tail = addattr_nest(n, MAX_MSG, TCA_OPTIONS);
 
 	while (argc > 0) {
@@ -1065,6 +1486,7 @@ static int u32_parse_opt(const struct filter_util *qu, char *handle,
 				fprintf(stderr, "Illegal \"hashkey\"\n");
 				return -1;
 			}
+			hash_ok++;
 			continue;
 		} else if (matches(*argv, "classid") == 0 ||
 			   strcmp(*argv, "flowid") == 0) {
@@ -1088,6 +1510,7 @@ static int u32_parse_opt(const struct filter_util *qu, char *handle,
 				return -1;
 			}
 			addattr_l(n, MAX_MSG, TCA_U32_DIVISOR, &divisor, 4);
+			hash_ok++;
 		} else if (matches(*argv, "order") == 0) {
 			NEXT_ARG();
 			if (get_u32(&order, *argv, 0)) {
@@ -1107,6 +1530,7 @@ static int u32_parse_opt(const struct filter_util *qu, char *handle,
 				return -1;
 			}
 			addattr_l(n, MAX_MSG, TCA_U32_LINK, &linkid, 4);
+			hash_ok++;
 		} else if (strcmp(*argv, "ht") == 0) {
 			unsigned int ht;
 
@@ -1154,6 +1578,18 @@ static int u32_parse_opt(const struct filter_util *qu, char *handle,
 			htid = ((hash % divisor) << 12) | (htid & 0xFFF00000);
 			sample_ok = 1;
 			continue;
+		} else if (strcmp(*argv, "table") == 0) {
+			NEXT_ARG();
+			if (strcmp(*argv, "src") == 0)
+				table_off = 12;
+			else if (strcmp(*argv, "dst") == 0)
+				table_off = 16;
+			else {
+				fprintf(stderr, "Illegal \"table\", expected \"src\" or \"dst\"\n");
+				return -1;
+			}
+			NEXT_ARG();
+			table = *argv;
 		} else if (strcmp(*argv, "indev") == 0) {
 			char ind[IFNAMSIZ + 1] = {};
 
@@ -1203,6 +1639,34 @@ static int u32_parse_opt(const struct filter_util *qu, char *handle,
 	if (terminal_ok)
 		sel.sel.flags |= TC_U32_TERMINAL;
 
+	if (table) {
+		__u32 linkid;
+
+		if (sel_ok || hash_ok || htid || order ||
+		    sel.sel.flags & (TC_U32_OFFSET | TC_U32_VAROFFSET)) {
+			fprintf(stderr, "\"table\" builds its own hash tables and cannot be combined with match, offset, hashkey, divisor, order, link, ht or sample\n");
+			return -1;
+		}
+		if (!TC_H_MAJ(t->tcm_info)) {
+			fprintf(stderr, "\"table\" needs an explicit filter priority\n");
+			return -1;
+		}
+		if (TC_U32_KEY(t->tcm_handle)) {
+			fprintf(stderr, "\"table\" handle may only give the first hash table id\n");
+			return -1;
+		}
+		if (u32_gen_tables(n, proto_len, table, table_off,
+				   TC_U32_USERHTID(t->tcm_handle),
+				   &linkid, &sel.sel.hmask))
+			return -1;
+
+		/* What is left to send is the hook in the root table. */
+		t->tcm_handle = 0;
+		sel.sel.hoff = table_off;
+		addattr_l(n, MAX_MSG, TCA_U32_LINK, &linkid, 4);
+		sel_ok++;
+	}
+
 	if (order) {
 		if (TC_U32_NODE(t->tcm_handle) &&
 		    order != TC_U32_NODE(t->tcm_handle)) {
@@ -18,7 +18,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
-#include <dlfcn.h>
+#include <time.h>
 
 #include "utils.h"
 #include "tc_common.h"
@@ -44,9 +44,11 @@ static void act_usage(void)
 		"Where:		ACTSPECOP := ACR | GD | FL\n"
 		"	ACR := add | change | replace <ACTSPEC>*\n"
 		"	GD := get | delete | <ACTISPEC>*\n"
-		"	FL := ls | list | flush | <ACTNAMESPEC>\n"
+		"	FL := ls | list | flush | <ACTNAMESPEC> [ACTFILTER]\n"
 		"	ACTNAMESPEC :=  action <ACTNAME>\n"
 		"	ACTISPEC := <ACTNAMESPEC> <INDEXSPEC>\n"
+		"	ACTFILTER := [ since MSTIME ] [ COUNTERSPEC ]\n"
+		"	COUNTERSPEC := counters [ interval TIME [ count N ] ]\n"
 		"	ACTSPEC := action <ACTDETAIL> [INDEXSPEC] [HWSTATSSPEC] [SKIPSPEC]\n"
 		"	INDEXSPEC := index <32 bit indexvalue>\n"
 		"	HWSTATSSPEC := hw_stats [ immediate | delayed | disabled ]\n"
@@ -85,9 +87,7 @@ static int parse_noaopt(const struct action_util *au, int *argc_p,
 
 static struct action_util *get_action_kind(const char *str)
 {
-	static void *aBODY;
-	void *dlh;
-	char buf[256];
+	char so[256], buf[256];
 	struct action_util *a;
 #ifdef CONFIG_GACT
 	int looked4gact = 0;
@@ -98,19 +98,9 @@ restart_s:
 			return a;
 	}
 
-	snprintf(buf, sizeof(buf), "%s/m_%s.so", get_tc_lib(), str);
-	dlh = dlopen(buf, RTLD_LAZY | RTLD_GLOBAL);
-	if (dlh == NULL) {
-		dlh = aBODY;
-		if (dlh == NULL) {
-			dlh = aBODY = dlopen(NULL, RTLD_LAZY);
-			if (dlh == NULL)
-				goto noexist;
-		}
-	}
-
+	snprintf(so, sizeof(so), "m_%s.so", str);
 	snprintf(buf, sizeof(buf), "%s_action_util", str);
-	a = dlsym(dlh, buf);
+	a = get_tc_util(so, buf);
 	if (a == NULL)
 		goto noexist;
 
@@ -598,6 +588,21 @@ int print_action(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+struct tc_action_req {
+	struct nlmsghdr		n;
+	struct tcamsg		t;
+	char			buf[MAX_MSG];
+};
+
+static struct nlmsg_builder action_req =
+	NLMSG_BUILDER_INIT(sizeof(struct tc_action_req));
+
+static struct tc_action_req *tc_action_req_start(int cmd, unsigned int flags)
+{
+	return (struct tc_action_req *)nlmsg_builder_start(&action_req, cmd,
+			flags, sizeof(struct tcamsg));
+}
+
 static int tc_action_gd(int cmd, unsigned int flags,
 			int *argc_p, char ***argv_p)
 {
@@ -611,23 +616,16 @@ static int tc_action_gd(int cmd, unsigned int flags,
 	struct rtattr *tail;
 	struct rtattr *tail2;
 	struct nlmsghdr *ans = NULL;
+	struct tc_action_req *req;
 
-	struct {
-		struct nlmsghdr         n;
-		struct tcamsg           t;
-		char                    buf[MAX_MSG];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcamsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.t.tca_family = AF_UNSPEC,
-	};
+	req = tc_action_req_start(cmd, NLM_F_REQUEST | flags);
+	if (!req)
+		return -1;
 
 	argc -= 1;
 	argv += 1;
 
-
-	tail = addattr_nest(&req.n, MAX_MSG, TCA_ACT_TAB);
+	tail = addattr_nest(&req->n, MAX_MSG, TCA_ACT_TAB);
 
 	while (argc > 0) {
 		if (strcmp(*argv, "action") == 0) {
@@ -676,25 +674,25 @@ static int tc_action_gd(int cmd, unsigned int flags,
 			goto bad_val;
 		}
 
-		tail2 = addattr_nest(&req.n, MAX_MSG, ++prio);
-		addattr_l(&req.n, MAX_MSG, TCA_ACT_KIND, k, strlen(k) + 1);
+		tail2 = addattr_nest(&req->n, MAX_MSG, ++prio);
+		addattr_l(&req->n, MAX_MSG, TCA_ACT_KIND, k, strlen(k) + 1);
 		if (i > 0)
-			addattr32(&req.n, MAX_MSG, TCA_ACT_INDEX, i);
-		addattr_nest_end(&req.n, tail2);
+			addattr32(&req->n, MAX_MSG, TCA_ACT_INDEX, i);
+		addattr_nest_end(&req->n, tail2);
 
 	}
 
-	addattr_nest_end(&req.n, tail);
+	addattr_nest_end(&req->n, tail);
 
-	req.n.nlmsg_seq = rth.dump = ++rth.seq;
+	req->n.nlmsg_seq = rth.dump = ++rth.seq;
 
 	if (cmd == RTM_DELACTION) {
 		if (echo_request)
-			ret = rtnl_echo_talk(&rth, &req.n, json, print_action);
+			ret = rtnl_echo_talk(&rth, &req->n, json, print_action);
 		else
-			ret = rtnl_talk(&rth, &req.n, NULL);
+			ret = rtnl_talk(&rth, &req->n, NULL);
 	} else {
-		ret = rtnl_talk(&rth, &req.n, &ans);
+		ret = rtnl_talk(&rth, &req->n, &ans);
 	}
 
 	if (ret < 0) {
@@ -727,30 +725,26 @@ static int tc_action_modify(int cmd, unsigned int flags,
 	int argc = *argc_p;
 	char **argv = *argv_p;
 	int ret = 0;
-	struct {
-		struct nlmsghdr         n;
-		struct tcamsg           t;
-		char                    buf[MAX_MSG];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcamsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.t.tca_family = AF_UNSPEC,
-	};
-	struct rtattr *tail = NLMSG_TAIL(&req.n);
+	struct tc_action_req *req;
+	struct rtattr *tail;
+
+	req = tc_action_req_start(cmd, NLM_F_REQUEST | flags);
+	if (!req)
+		return -1;
+	tail = NLMSG_TAIL(&req->n);
 
 	argc -= 1;
 	argv += 1;
-	if (parse_action(&argc, &argv, TCA_ACT_TAB, &req.n)) {
+	if (parse_action(&argc, &argv, TCA_ACT_TAB, &req->n)) {
 		fprintf(stderr, "Illegal \"action\"\n");
 		return -1;
 	}
-	tail->rta_len = (void *) NLMSG_TAIL(&req.n) - (void *) tail;
+	tail->rta_len = (void *) NLMSG_TAIL(&req->n) - (void *) tail;
 
 	if (echo_request)
-		ret = rtnl_echo_talk(&rth, &req.n, json, print_action);
+		ret = rtnl_echo_talk(&rth, &req->n, json, print_action);
 	else
-		ret = rtnl_talk(&rth, &req.n, NULL);
+		ret = rtnl_talk(&rth, &req->n, NULL);
 
 	if (ret < 0) {
 		fprintf(stderr, "We have an error talking to the kernel\n");
@@ -763,6 +757,214 @@ static int tc_action_modify(int cmd, unsigned int flags,
 	return ret;
 }
 
+/* Per-action counters kept between samples of "list ... counters interval" */
+struct act_counters {
+	__u32	index;
+	__u32	drops;
+	__u32	overlimits;
+	__u64	bytes;
+	__u64	packets;
+};
+
+struct act_counters_tab {
+	struct act_counters	*slot;
+	unsigned int		size;	/* power of two, 0 index marks a free slot */
+	unsigned int		used;
+	double			elapsed; /* seconds since the previous sample */
+	bool			delta;
+};
+
+static struct act_counters *act_counters_slot(struct act_counters_tab *tab,
+					      __u32 index)
+{
+	unsigned int i = (index * 2654435761U) & (tab->size - 1);
+
+	while (tab->slot[i].index && tab->slot[i].index != index)
+		i = (i + 1) & (tab->size - 1);
+	return &tab->slot[i];
+}
+
+static struct act_counters *act_counters_get(struct act_counters_tab *tab,
+					     __u32 index, bool *fresh)
+{
+	struct act_counters *c;
+
+	if (2 * (tab->used + 1) > tab->size) {
+		struct act_counters *old = tab->slot;
+		unsigned int i, size = tab->size;
+
+		tab->size = size ? 2 * size : 1024;
+		tab->slot = calloc(tab->size, sizeof(*tab->slot));
+		if (!tab->slot) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		for (i = 0; i < size; i++)
+			if (old[i].index)
+				*act_counters_slot(tab, old[i].index) = old[i];
+		free(old);
+	}
+
+	c = act_counters_slot(tab, index);
+	*fresh = !c->index;
+	if (*fresh) {
+		c->index = index;
+		tab->used++;
+	}
+	return c;
+}
+
+static void print_act_counters(const struct act_counters *c,
+			       const struct act_counters_tab *tab)
+{
+	open_json_object(NULL);
+	print_uint(PRINT_ANY, "index", "index %u", c->index);
+	print_lluint(PRINT_ANY, "bytes", " bytes %llu", c->bytes);
+	print_lluint(PRINT_ANY, "packets", " packets %llu", c->packets);
+	print_uint(PRINT_ANY, "drops", " drops %u", c->drops);
+	print_uint(PRINT_ANY, "overlimits", " overlimits %u", c->overlimits);
+	if (tab && tab->delta) {
+		__u64 bps = c->bytes / tab->elapsed;
+
+		print_lluint(PRINT_JSON, "rate", NULL, bps);
+		tc_print_rate(PRINT_FP, NULL, " rate %s", bps);
+		print_lluint(PRINT_ANY, "pps", " %llupps",
+			     (__u64)(c->packets / tab->elapsed));
+	}
+	close_json_object();
+	print_nl();
+}
+
+/* Print the counters of one action of a terse dump; kind is never looked up */
+static void tc_act_counters_one(struct act_counters_tab *tab,
+				struct rtattr *arg)
+{
+	struct rtattr *tb[TCA_ACT_MAX + 1];
+	struct rtattr *tbs[TCA_STATS_MAX + 1];
+	struct act_counters cur = {}, *c;
+	bool fresh;
+
+	parse_rtattr_nested(tb, TCA_ACT_MAX, arg);
+	if (!tb[TCA_ACT_INDEX] || !tb[TCA_ACT_STATS])
+		return;
+
+	cur.index = rta_getattr_u32(tb[TCA_ACT_INDEX]);
+	parse_rtattr_nested(tbs, TCA_STATS_MAX, tb[TCA_ACT_STATS]);
+	if (tbs[TCA_STATS_BASIC]) {
+		struct gnet_stats_basic bs = {0};
+
+		memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]), sizeof(bs)));
+		cur.bytes = bs.bytes;
+		cur.packets = bs.packets;
+	}
+	/* the first PKT64 follows BASIC and carries the full packet count */
+	if (tbs[TCA_STATS_PKT64])
+		cur.packets = rta_getattr_u64(tbs[TCA_STATS_PKT64]);
+	if (tbs[TCA_STATS_QUEUE]) {
+		struct gnet_stats_queue q = {0};
+
+		memcpy(&q, RTA_DATA(tbs[TCA_STATS_QUEUE]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_QUEUE]), sizeof(q)));
+		cur.drops = q.drops;
+		cur.overlimits = q.overlimits;
+	}
+
+	if (!tab) {
+		print_act_counters(&cur, NULL);
+		return;
+	}
+
+	c = act_counters_get(tab, cur.index, &fresh);
+	if (!fresh && tab->delta &&
+	    cur.bytes >= c->bytes && cur.packets >= c->packets &&
+	    cur.drops >= c->drops && cur.overlimits >= c->overlimits &&
+	    (cur.packets != c->packets || cur.drops != c->drops ||
+	     cur.overlimits != c->overlimits)) {
+		struct act_counters d = {
+			.index		= cur.index,
+			.bytes		= cur.bytes - c->bytes,
+			.packets	= cur.packets - c->packets,
+			.drops		= cur.drops - c->drops,
+			.overlimits	= cur.overlimits - c->overlimits,
+		};
+
+		print_act_counters(&d, tab);
+	}
+	/* new actions and recycled indexes only set the baseline */
+	*c = cur;
+}
+
+static int print_action_counters(struct nlmsghdr *n, void *arg)
+{
+	struct tcamsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_ROOT_MAX + 1];
+	struct rtattr *act;
+	int rem;
+
+	if (len < 0) {
+		fprintf(stderr, "Wrong len %d\n", len);
+		return -1;
+	}
+
+	parse_rtattr(tb, TCA_ROOT_MAX, TA_RTA(t), len);
+	if (!tb[TCA_ACT_TAB])
+		return 0;
+
+	rem = RTA_PAYLOAD(tb[TCA_ACT_TAB]);
+	for (act = RTA_DATA(tb[TCA_ACT_TAB]); RTA_OK(act, rem);
+	     act = RTA_NEXT(act, rem))
+		tc_act_counters_one(arg, act);
+	return 0;
+}
+
+/*
+ * Stats-only listing: terse dumps carry just kind, index and stats, so
+ * printing needs neither the action's print_aopt nor get_action_kind.
+ * With an interval the previous sample is kept per index and every
+ * round prints the actions whose counters moved, with their rates.
+ */
+static int tc_act_counters(struct tcamsg *t, int msg_size,
+			   unsigned int interval, __u32 count)
+{
+	struct act_counters_tab tab = {};
+	double last = 0, now, next = monotonic_now();
+	__u32 round = 0;
+	bool quiet;
+	int ret;
+
+	for (;;) {
+		if (rtnl_dump_request(&rth, RTM_GETACTION, t, msg_size) < 0) {
+			perror("Cannot send dump request");
+			ret = 1;
+			break;
+		}
+		now = monotonic_now();
+		tab.elapsed = now - last;
+		/* the first sample of an interval run only sets the baseline */
+		quiet = interval && !tab.delta;
+		if (!quiet)
+			new_json_obj(json);
+		ret = rtnl_dump_filter(&rth, print_action_counters,
+				       interval ? &tab : NULL);
+		if (!quiet)
+			delete_json_obj();
+		fflush(stdout);
+		if (ret < 0 || !interval)
+			break;
+		if (tab.delta && count && ++round >= count)
+			break;
+		tab.delta = true;
+		last = now;
+		next += interval / 1e6;
+		monotonic_sleep_until(next);
+	}
+
+	free(tab.slot);
+	return ret;
+}
+
 static int tc_act_list_or_flush(int *argc_p, char ***argv_p, int event)
 {
 	struct rtattr *tail, *tail2, *tail3, *tail4;
@@ -770,19 +972,21 @@ static int tc_act_list_or_flush(int *argc_p, char ***argv_p, int event)
 	struct action_util *a = NULL;
 	struct nla_bitfield32 flag_select = { 0 };
 	char **argv = *argv_p;
-	__u32 msec_since = 0;
+	__u32 msec_since = 0, count = 0;
+	unsigned int interval = 0;
+	bool counters = false;
 	int argc = *argc_p;
 	char k[FILTER_NAMESZ];
 	struct {
 		struct nlmsghdr         n;
 		struct tcamsg           t;
-		char                    buf[MAX_MSG];
+		char                    buf[256];
 	} req = {
 		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcamsg)),
 		.t.tca_family = AF_UNSPEC,
 	};
 
-	tail = addattr_nest(&req.n, MAX_MSG, TCA_ACT_TAB);
+	tail = addattr_nest(&req.n, sizeof(req), TCA_ACT_TAB);
 	tail2 = NLMSG_TAIL(&req.n);
 
 	strncpy(k, *argv, sizeof(k) - 1);
@@ -805,36 +1009,55 @@ static int tc_act_list_or_flush(int *argc_p, char ***argv_p, int event)
 	argc -= 1;
 	argv += 1;
 
-	if (argc && (strcmp(*argv, "since") == 0)) {
-		NEXT_ARG();
-		if (get_u32(&msec_since, *argv, 0))
-			invarg("dump time \"since\" is invalid", *argv);
+	while (argc > 0) {
+		if (strcmp(*argv, "since") == 0) {
+			NEXT_ARG();
+			if (get_u32(&msec_since, *argv, 0))
+				invarg("dump time \"since\" is invalid", *argv);
+		} else if (event == RTM_GETACTION &&
+			   strcmp(*argv, "counters") == 0) {
+			counters = true;
+		} else if (counters && strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_time(&interval, *argv) || !interval)
+				invarg("\"interval\" is invalid", *argv);
+		} else if (counters && strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_u32(&count, *argv, 0) || !count)
+				invarg("\"count\" is invalid", *argv);
+		} else {
+			break;
+		}
+		argc--;
+		argv++;
 	}
 
-	addattr_l(&req.n, MAX_MSG, ++prio, NULL, 0);
-	addattr_l(&req.n, MAX_MSG, TCA_ACT_KIND, k, strlen(k) + 1);
+	addattr_l(&req.n, sizeof(req), ++prio, NULL, 0);
+	addattr_l(&req.n, sizeof(req), TCA_ACT_KIND, k, strlen(k) + 1);
 	tail2->rta_len = (void *) NLMSG_TAIL(&req.n) - (void *) tail2;
 	addattr_nest_end(&req.n, tail);
 
 	tail3 = NLMSG_TAIL(&req.n);
 	flag_select.value |= TCA_ACT_FLAG_LARGE_DUMP_ON;
 	flag_select.selector |= TCA_ACT_FLAG_LARGE_DUMP_ON;
-	if (brief) {
+	if (brief || counters) {
 		flag_select.value |= TCA_ACT_FLAG_TERSE_DUMP;
 		flag_select.selector |= TCA_ACT_FLAG_TERSE_DUMP;
 	}
-	addattr_l(&req.n, MAX_MSG, TCA_ROOT_FLAGS, &flag_select,
+	addattr_l(&req.n, sizeof(req), TCA_ROOT_FLAGS, &flag_select,
 		  sizeof(struct nla_bitfield32));
 	tail3->rta_len = (void *) NLMSG_TAIL(&req.n) - (void *) tail3;
 	if (msec_since) {
 		tail4 = NLMSG_TAIL(&req.n);
-		addattr32(&req.n, MAX_MSG, TCA_ROOT_TIME_DELTA, msec_since);
+		addattr32(&req.n, sizeof(req), TCA_ROOT_TIME_DELTA, msec_since);
 		tail4->rta_len = (void *) NLMSG_TAIL(&req.n) - (void *) tail4;
 	}
 	msg_size = NLMSG_ALIGN(req.n.nlmsg_len)
 		- NLMSG_ALIGN(sizeof(struct nlmsghdr));
 
-	if (event == RTM_GETACTION) {
+	if (event == RTM_GETACTION && counters)
+		ret = tc_act_counters(&req.t, msg_size, interval, count);
+	else if (event == RTM_GETACTION) {
 		if (rtnl_dump_request(&rth, event,
 				      (void *)&req.t, msg_size) < 0) {
 			perror("Cannot send dump request");
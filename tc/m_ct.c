@@ -13,6 +13,7 @@
 #include <string.h>
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_common.h"
 #include "rt_names.h"
 #include <linux/tc_act/tc_ct.h>
 
@@ -547,3 +548,380 @@ struct action_util ct_action_util = {
 	.parse_aopt = parse_ct,
 	.print_aopt = print_ct,
 };
+
+/*
+ * "tc ct stats": the counters of all ct actions, from one action dump,
+ * summed per zone and per what the action does, next to the counters of
+ * the flower filters that match on ct_state, from one filter walk over
+ * every qdisc. The hit ratio of a zone is the share of its tracked
+ * packets that were classified as established or related, i.e. found a
+ * connection, and the hw share the part of its ct action packets that
+ * was counted in hardware.
+ */
+enum {
+	CT_STATS_LOOKUP,
+	CT_STATS_NAT,
+	CT_STATS_COMMIT,
+	CT_STATS_COMMIT_NAT,
+	CT_STATS_CLEAR,
+	__CT_STATS_ACT_MAX
+};
+
+static const char * const ct_stats_act_names[] = {
+	[CT_STATS_LOOKUP]	= "lookup",
+	[CT_STATS_NAT]		= "nat",
+	[CT_STATS_COMMIT]	= "commit",
+	[CT_STATS_COMMIT_NAT]	= "commit nat",
+	[CT_STATS_CLEAR]	= "clear",
+};
+
+enum {
+	CT_STATS_EST,
+	CT_STATS_REL,
+	CT_STATS_NEW,
+	CT_STATS_INV,
+	CT_STATS_UNTRACKED,
+	CT_STATS_OTHER,
+	__CT_STATS_STATE_MAX
+};
+
+static const char * const ct_stats_state_names[] = {
+	[CT_STATS_EST]		= "est",
+	[CT_STATS_REL]		= "rel",
+	[CT_STATS_NEW]		= "new",
+	[CT_STATS_INV]		= "inv",
+	[CT_STATS_UNTRACKED]	= "untracked",
+	[CT_STATS_OTHER]	= "other",
+};
+
+struct ct_stats_counter {
+	unsigned int	count;
+	__u64		packets;
+	__u64		bytes;
+	__u64		hw_packets;
+};
+
+struct ct_stats_zone {
+	int			zone;	/* -1: filters not matching ct_zone */
+	struct ct_stats_counter	act[__CT_STATS_ACT_MAX];
+	struct ct_stats_counter	state[__CT_STATS_STATE_MAX];
+};
+
+struct ct_stats {
+	struct ct_stats_zone	*zones;
+	int			nzones;
+};
+
+static struct ct_stats_zone *ct_stats_zone(struct ct_stats *st, int zone)
+{
+	struct ct_stats_zone *z;
+	int i;
+
+	for (i = 0; i < st->nzones; i++)
+		if (st->zones[i].zone == zone)
+			return &st->zones[i];
+
+	z = realloc(st->zones, (st->nzones + 1) * sizeof(*z));
+	if (!z) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	st->zones = z;
+	z = &st->zones[st->nzones++];
+	memset(z, 0, sizeof(*z));
+	z->zone = zone;
+	return z;
+}
+
+/* Add the basic counters of TCA_ACT_STATS @rta to @c */
+static void ct_stats_add(struct ct_stats_counter *c, struct rtattr *rta)
+{
+	struct rtattr *tbs[TCA_STATS_MAX + 1];
+	__u64 packets = 0, hw_packets = 0;
+	int prev_type = 0, rem;
+	struct rtattr *pos;
+
+	c->count++;
+	if (!rta)
+		return;
+	parse_rtattr_nested(tbs, TCA_STATS_MAX, rta);
+
+	if (tbs[TCA_STATS_BASIC]) {
+		struct gnet_stats_basic bs = {0};
+
+		memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]), sizeof(bs)));
+		c->bytes += bs.bytes;
+		packets = bs.packets;
+	}
+	if (tbs[TCA_STATS_BASIC_HW]) {
+		struct gnet_stats_basic bs = {0};
+
+		memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC_HW]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC_HW]), sizeof(bs)));
+		hw_packets = bs.packets;
+	}
+	/* a PKT64 carries the full packet count of the BASIC before it */
+	rem = RTA_PAYLOAD(rta);
+	for (pos = RTA_DATA(rta); RTA_OK(pos, rem); pos = RTA_NEXT(pos, rem)) {
+		if (pos->rta_type == TCA_STATS_PKT64 &&
+		    prev_type == TCA_STATS_BASIC)
+			packets = rta_getattr_u64(pos);
+		else if (pos->rta_type == TCA_STATS_PKT64 &&
+			 prev_type == TCA_STATS_BASIC_HW)
+			hw_packets = rta_getattr_u64(pos);
+		prev_type = pos->rta_type;
+	}
+	c->packets += packets;
+	c->hw_packets += hw_packets;
+}
+
+static void ct_stats_action(struct ct_stats *st, struct rtattr *arg)
+{
+	struct rtattr *tb[TCA_ACT_MAX + 1];
+	struct rtattr *tbc[TCA_CT_MAX + 1];
+	int ct_action = 0, zone = 0, act;
+
+	parse_rtattr_nested(tb, TCA_ACT_MAX, arg);
+	if (!tb[TCA_ACT_KIND] || !tb[TCA_ACT_OPTIONS] ||
+	    strcmp(rta_getattr_str(tb[TCA_ACT_KIND]), "ct"))
+		return;
+
+	parse_rtattr_nested(tbc, TCA_CT_MAX, tb[TCA_ACT_OPTIONS]);
+	if (tbc[TCA_CT_ACTION])
+		ct_action = rta_getattr_u16(tbc[TCA_CT_ACTION]);
+	if (tbc[TCA_CT_ZONE])
+		zone = rta_getattr_u16(tbc[TCA_CT_ZONE]);
+
+	if (ct_action & TCA_CT_ACT_CLEAR)
+		act = CT_STATS_CLEAR;
+	else if (ct_action & TCA_CT_ACT_COMMIT)
+		act = ct_action & TCA_CT_ACT_NAT ?
+		      CT_STATS_COMMIT_NAT : CT_STATS_COMMIT;
+	else
+		act = ct_action & TCA_CT_ACT_NAT ?
+		      CT_STATS_NAT : CT_STATS_LOOKUP;
+
+	ct_stats_add(&ct_stats_zone(st, zone)->act[act], tb[TCA_ACT_STATS]);
+}
+
+static int ct_stats_actions(struct nlmsghdr *n, void *arg)
+{
+	struct tcamsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_ROOT_MAX + 1];
+	struct rtattr *act;
+	int rem;
+
+	if (len < 0) {
+		fprintf(stderr, "Wrong len %d\n", len);
+		return -1;
+	}
+
+	parse_rtattr(tb, TCA_ROOT_MAX, TA_RTA(t), len);
+	if (!tb[TCA_ACT_TAB])
+		return 0;
+
+	rem = RTA_PAYLOAD(tb[TCA_ACT_TAB]);
+	for (act = RTA_DATA(tb[TCA_ACT_TAB]); RTA_OK(act, rem);
+	     act = RTA_NEXT(act, rem))
+		ct_stats_action(arg, act);
+	return 0;
+}
+
+static int ct_stats_state(__u16 state, __u16 mask)
+{
+	if ((mask & TCA_FLOWER_KEY_CT_FLAGS_TRACKED) &&
+	    !(state & TCA_FLOWER_KEY_CT_FLAGS_TRACKED))
+		return CT_STATS_UNTRACKED;
+	state &= mask;
+	if (state & TCA_FLOWER_KEY_CT_FLAGS_INVALID)
+		return CT_STATS_INV;
+	if (state & TCA_FLOWER_KEY_CT_FLAGS_NEW)
+		return CT_STATS_NEW;
+	if (state & TCA_FLOWER_KEY_CT_FLAGS_ESTABLISHED)
+		return CT_STATS_EST;
+	if (state & TCA_FLOWER_KEY_CT_FLAGS_RELATED)
+		return CT_STATS_REL;
+	return CT_STATS_OTHER;
+}
+
+/* A flower filter matching on ct_state is counted by its first action */
+static int ct_stats_filter(struct nlmsghdr *n, void *arg)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+	struct rtattr *tbf[TCA_FLOWER_MAX + 1];
+	struct rtattr *acts[TCA_ACT_MAX_PRIO + 1];
+	struct rtattr *tba[TCA_ACT_MAX + 1];
+	__u16 state, mask = 0xffff;
+	int zone = -1;
+
+	if (n->nlmsg_type != RTM_NEWTFILTER || len < 0)
+		return 0;
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len, NLA_F_NESTED);
+	if (!tb[TCA_KIND] || !tb[TCA_OPTIONS] ||
+	    strcmp(rta_getattr_str(tb[TCA_KIND]), "flower"))
+		return 0;
+
+	parse_rtattr_nested(tbf, TCA_FLOWER_MAX, tb[TCA_OPTIONS]);
+	if (!tbf[TCA_FLOWER_KEY_CT_STATE])
+		return 0;
+	state = rta_getattr_u16(tbf[TCA_FLOWER_KEY_CT_STATE]);
+	if (tbf[TCA_FLOWER_KEY_CT_STATE_MASK])
+		mask = rta_getattr_u16(tbf[TCA_FLOWER_KEY_CT_STATE_MASK]);
+	if (tbf[TCA_FLOWER_KEY_CT_ZONE] &&
+	    (!tbf[TCA_FLOWER_KEY_CT_ZONE_MASK] ||
+	     rta_getattr_u16(tbf[TCA_FLOWER_KEY_CT_ZONE_MASK]) == 0xffff))
+		zone = rta_getattr_u16(tbf[TCA_FLOWER_KEY_CT_ZONE]);
+
+	memset(tba, 0, sizeof(tba));
+	if (tbf[TCA_FLOWER_ACT]) {
+		parse_rtattr_nested(acts, TCA_ACT_MAX_PRIO, tbf[TCA_FLOWER_ACT]);
+		if (acts[1])
+			parse_rtattr_nested(tba, TCA_ACT_MAX, acts[1]);
+	}
+	ct_stats_add(&ct_stats_zone(arg, zone)->state[ct_stats_state(state, mask)],
+		     tba[TCA_ACT_STATS]);
+	return 0;
+}
+
+static int ct_stats_cmp(const void *a, const void *b)
+{
+	const struct ct_stats_zone *za = a, *zb = b;
+
+	/* filters without a zone go last */
+	return (unsigned int)za->zone > (unsigned int)zb->zone ? 1 :
+	       (unsigned int)za->zone < (unsigned int)zb->zone ? -1 : 0;
+}
+
+static void ct_stats_print_counter(const char *prefix, const char *name,
+				   const char *unit,
+				   const struct ct_stats_counter *c)
+{
+	open_json_object(NULL);
+	print_string(PRINT_FP, NULL, "\t%s ", prefix);
+	print_string(PRINT_ANY, "kind", "%s:", name);
+	print_uint(PRINT_ANY, "count", " %u", c->count);
+	print_string(PRINT_FP, NULL, " %s", unit);
+	print_lluint(PRINT_ANY, "packets", " packets %llu", c->packets);
+	print_lluint(PRINT_ANY, "bytes", " bytes %llu", c->bytes);
+	print_lluint(PRINT_ANY, "hw_packets", " hw %llu", c->hw_packets);
+	close_json_object();
+	print_nl();
+}
+
+static void ct_stats_print_zone(const struct ct_stats_zone *z)
+{
+	__u64 packets = 0, hw_packets = 0, hits, tracked;
+	int i;
+
+	open_json_object(NULL);
+	if (z->zone < 0)
+		print_null(PRINT_ANY, "zone", "zone any", NULL);
+	else
+		print_uint(PRINT_ANY, "zone", "zone %u", z->zone);
+
+	for (i = 0; i < __CT_STATS_ACT_MAX; i++) {
+		packets += z->act[i].packets;
+		hw_packets += z->act[i].hw_packets;
+	}
+	if (packets)
+		print_float(PRINT_ANY, "hw_share", " hw %.1f%%",
+			    100.0 * hw_packets / packets);
+
+	hits = z->state[CT_STATS_EST].packets + z->state[CT_STATS_REL].packets;
+	tracked = hits + z->state[CT_STATS_NEW].packets +
+		  z->state[CT_STATS_INV].packets;
+	if (tracked)
+		print_float(PRINT_ANY, "hit_ratio", " hit %.1f%%",
+			    100.0 * hits / tracked);
+	print_nl();
+
+	open_json_array(PRINT_JSON, "actions");
+	for (i = 0; i < __CT_STATS_ACT_MAX; i++)
+		if (z->act[i].count)
+			ct_stats_print_counter("ct", ct_stats_act_names[i],
+					       "actions", &z->act[i]);
+	close_json_array(PRINT_JSON, NULL);
+
+	open_json_array(PRINT_JSON, "ct_state");
+	for (i = 0; i < __CT_STATS_STATE_MAX; i++)
+		if (z->state[i].count)
+			ct_stats_print_counter("ct_state", ct_stats_state_names[i],
+					       "filters", &z->state[i]);
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+}
+
+static int ct_stats(void)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct tcamsg	t;
+		char		buf[256];
+	} areq = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcamsg)),
+		.n.nlmsg_type = RTM_GETACTION,
+		.t.tca_family = AF_UNSPEC,
+	};
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+	} freq = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_GETTFILTER,
+		.t.tcm_family = AF_UNSPEC,
+	};
+	struct nla_bitfield32 flags = {
+		.value = TCA_ACT_FLAG_LARGE_DUMP_ON,
+		.selector = TCA_ACT_FLAG_LARGE_DUMP_ON,
+	};
+	struct ct_stats st = {};
+	struct rtattr *tail, *tail2;
+	int i, ret = 1;
+
+	/* the options carry the zone, so this cannot be a terse dump */
+	tail = addattr_nest(&areq.n, sizeof(areq), TCA_ACT_TAB);
+	tail2 = addattr_nest(&areq.n, sizeof(areq), 1);
+	addattrstrz(&areq.n, sizeof(areq), TCA_ACT_KIND, "ct");
+	addattr_nest_end(&areq.n, tail2);
+	addattr_nest_end(&areq.n, tail);
+	addattr_l(&areq.n, sizeof(areq), TCA_ROOT_FLAGS, &flags, sizeof(flags));
+
+	if (rtnl_dump_request(&rth, RTM_GETACTION, &areq.t,
+			      areq.n.nlmsg_len - NLMSG_LENGTH(0)) < 0) {
+		perror("Cannot send dump request");
+		return 1;
+	}
+	if (rtnl_dump_filter(&rth, ct_stats_actions, &st) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+	if (tc_filter_walk(&freq.n, ct_stats_filter, &st))
+		goto out;
+
+	qsort(st.zones, st.nzones, sizeof(*st.zones), ct_stats_cmp);
+	new_json_obj(json);
+	for (i = 0; i < st.nzones; i++)
+		ct_stats_print_zone(&st.zones[i]);
+	delete_json_obj();
+	ret = 0;
+out:
+	free(st.zones);
+	return ret;
+}
+
+int do_ct(int argc, char **argv)
+{
+	if (argc < 1 || matches(*argv, "stats") == 0)
+		return ct_stats();
+	if (matches(*argv, "help") == 0) {
+		fprintf(stderr, "Usage: tc ct stats\n");
+		return 0;
+	}
+	fprintf(stderr, "Command \"%s\" is unknown, try \"tc ct help\".\n",
+		*argv);
+	return -1;
+}
@@ -13,12 +13,12 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
-#include <dlfcn.h>
 #include <stdarg.h>
 #include <errno.h>
 
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_common.h"
 #include "m_ematch.h"
 
 #define EMATCH_MAP_USR CONF_USR_DIR "/ematch_map"
@@ -126,9 +126,7 @@ out:
 
 static struct ematch_util *get_ematch_kind(char *kind)
 {
-	static void *body;
-	void *dlh;
-	char buf[256];
+	char so[256], buf[256];
 	struct ematch_util *e;
 
 	for (e = ematch_list; e; e = e->next) {
@@ -136,19 +134,9 @@ static struct ematch_util *get_ematch_kind(char *kind)
 			return e;
 	}
 
-	snprintf(buf, sizeof(buf), "em_%s.so", kind);
-	dlh = dlopen(buf, RTLD_LAZY);
-	if (dlh == NULL) {
-		dlh = body;
-		if (dlh == NULL) {
-			dlh = body = dlopen(NULL, RTLD_LAZY);
-			if (dlh == NULL)
-				return NULL;
-		}
-	}
-
+	snprintf(so, sizeof(so), "em_%s.so", kind);
 	snprintf(buf, sizeof(buf), "%s_ematch_util", kind);
-	e = dlsym(dlh, buf);
+	e = get_tc_util(so, buf);
 	if (e == NULL)
 		return NULL;
 
@@ -197,58 +185,88 @@ static int em_parse_call(struct nlmsghdr *n, struct tcf_ematch_hdr *hdr,
 	return e->parse_eopt(n, hdr, t->args->next);
 }
 
-static int parse_tree(struct nlmsghdr *n, struct ematch *tree)
+static int resolve_match(struct ematch *t, struct ematch_util **e_p,
+			 int *num_p)
 {
-	int index = 1;
-	struct ematch *t;
+	int num = 0, err;
+	char buf[64] = {};
+	struct ematch_util *e;
 
-	for (t = tree; t; t = t->next) {
-		struct rtattr *tail;
-		struct tcf_ematch_hdr hdr = { .flags = t->relation };
+	if (t->args == NULL)
+		return -1;
 
-		if (t->inverted)
-			hdr.flags |= TCF_EM_INVERT;
+	strncpy(buf, (char *) t->args->data, sizeof(buf)-1);
+	e = get_ematch_kind(buf);
+	if (e == NULL) {
+		fprintf(stderr, "Unknown ematch \"%s\"\n",
+		    buf);
+		return -1;
+	}
 
-		tail = addattr_nest(n, MAX_MSG, index++);
+	err = lookup_map_id(buf, &num, EMATCH_MAP_ETC);
+	if (err == -ENOENT)
+		err = lookup_map_id(buf, &num, EMATCH_MAP_USR);
+	if (err < 0) {
+		if (err == -ENOENT)
+			map_warning(e->kind_num, buf);
+		return err;
+	}
 
-		if (t->child) {
-			__u32 r = t->child_ref;
+	*e_p = e;
+	*num_p = num;
+	return 0;
+}
 
-			addraw_l(n, MAX_MSG, &hdr, sizeof(hdr));
-			addraw_l(n, MAX_MSG, &r, sizeof(r));
-		} else {
-			int num = 0, err;
-			char buf[64];
-			struct ematch_util *e;
+/* e and num are only used for matches, not for references to children */
+static int encode_match(struct nlmsghdr *n, struct ematch *t, int index,
+			struct ematch_util *e, int num)
+{
+	struct rtattr *tail;
+	struct tcf_ematch_hdr hdr = { .flags = t->relation };
 
-			if (t->args == NULL)
-				return -1;
+	if (t->inverted)
+		hdr.flags |= TCF_EM_INVERT;
 
-			strncpy(buf, (char *) t->args->data, sizeof(buf)-1);
-			e = get_ematch_kind(buf);
-			if (e == NULL) {
-				fprintf(stderr, "Unknown ematch \"%s\"\n",
-				    buf);
-				return -1;
-			}
+	tail = addattr_nest(n, MAX_MSG, index);
 
-			err = lookup_map_id(buf, &num, EMATCH_MAP_ETC);
-			if (err == -ENOENT)
-				err = lookup_map_id(buf, &num, EMATCH_MAP_USR);
-			if (err < 0) {
-				if (err == -ENOENT)
-					map_warning(e->kind_num, buf);
-				return err;
-			}
+	if (t->child) {
+		__u32 r = t->child_ref;
 
-			hdr.kind = num;
-			if (em_parse_call(n, &hdr, e, t) < 0)
-				return -1;
-		}
+		addraw_l(n, MAX_MSG, &hdr, sizeof(hdr));
+		addraw_l(n, MAX_MSG, &r, sizeof(r));
+	} else {
+		hdr.kind = num;
+		if (em_parse_call(n, &hdr, e, t) < 0)
+			return -1;
+	}
 
-		addattr_nest_end(n, tail);
+	addattr_nest_end(n, tail);
+	return 0;
+}
+
+static int parse_match(struct nlmsghdr *n, struct ematch *t, int index)
+{
+	struct ematch_util *e = NULL;
+	int num = 0, err;
+
+	if (!t->child) {
+		err = resolve_match(t, &e, &num);
+		if (err < 0)
+			return err;
 	}
 
+	return encode_match(n, t, index, e, num);
+}
+
+static int parse_tree(struct nlmsghdr *n, struct ematch *tree)
+{
+	int index = 1;
+	struct ematch *t;
+
+	for (t = tree; t; t = t->next)
+		if (parse_match(n, t, index++) < 0)
+			return -1;
+
 	return 0;
 }
 
@@ -346,8 +364,14 @@ static inline void free_ematch_err(void)
 
 extern int ematch_parse(void);
 
+static int parse_ematch_tmpl(int *argc_p, char ***argv_p, int tca_id,
+			     struct nlmsghdr *n);
+
 int parse_ematch(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
 {
+	if (*argc_p > 0 && strcmp(**argv_p, "template") == 0)
+		return parse_ematch_tmpl(argc_p, argv_p, tca_id, n);
+
 	begin_argc = ematch_argc = *argc_p;
 	begin_argv = ematch_argv = *argv_p;
 
@@ -390,6 +414,320 @@ int parse_ematch(int *argc_p, char ***argv_p, int tca_id, struct nlmsghdr *n)
 	return 0;
 }
 
+/* Templates: "tc ematch define NAME EXPR" parses EXPR once and keeps it
+ * for the rest of the run, e.g. of a batch file. Arguments $1, $2, ...
+ * of its matches are slots, filled in by "match template NAME VALUE..."
+ * of a filter. Matches without slots are encoded at definition and then
+ * copied as they are; only the ones with slots go through the parser of
+ * their kind again, with the kind already resolved.
+ */
+struct ematch_slot {
+	struct bstr	*arg;
+	int		num;		/* $num */
+};
+
+struct ematch_tmpl_match {
+	struct ematch		*em;
+	struct ematch_util	*util;
+	int			kind;
+	struct rtattr		*encoded;	/* NULL if it has slots */
+};
+
+struct ematch_tmpl {
+	struct ematch_tmpl	*next;
+	char			*name;
+	char			*text;
+	int			nmatches;
+	int			nvalues;	/* highest slot number */
+	int			nslots;
+	struct ematch_slot	*slots;
+	struct ematch_tmpl_match *matches;
+};
+
+static struct ematch_tmpl *ematch_tmpls;
+
+static struct ematch_tmpl *ematch_tmpl_find(const char *name)
+{
+	struct ematch_tmpl *tp;
+
+	for (tp = ematch_tmpls; tp; tp = tp->next)
+		if (strcmp(tp->name, name) == 0)
+			return tp;
+	return NULL;
+}
+
+/* $N with N > 0, else 0 */
+static int ematch_slot_num(const struct bstr *b)
+{
+	unsigned int i;
+	int num = 0;
+
+	if (b->quoted || b->len < 2 || b->data[0] != '$')
+		return 0;
+	for (i = 1; i < b->len; i++) {
+		if (!isdigit(b->data[i]) || num > 1000)
+			return 0;
+		num = num * 10 + b->data[i] - '0';
+	}
+	return num;
+}
+
+static struct rtattr *ematch_tmpl_encode(struct ematch_tmpl_match *m,
+					 int index)
+{
+	struct {
+		struct nlmsghdr	n;
+		char		buf[MAX_MSG];
+	} *req;
+	struct rtattr *rta = NULL;
+	int len;
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return NULL;
+	req->n.nlmsg_len = NLMSG_LENGTH(0);
+
+	if (encode_match(&req->n, m->em, index, m->util, m->kind) == 0) {
+		len = req->n.nlmsg_len - NLMSG_LENGTH(0);
+		rta = malloc(len);
+		if (rta)
+			memcpy(rta, NLMSG_DATA(&req->n), len);
+	}
+	free(req);
+	return rta;
+}
+
+static int ematch_tmpl_compile(struct ematch_tmpl *tp, struct ematch *root)
+{
+	struct ematch *t;
+	struct bstr *b;
+	int i;
+
+	tp->nmatches = flatten_tree(root, root);
+	tp->matches = calloc(tp->nmatches, sizeof(*tp->matches));
+	if (!tp->matches)
+		return -1;
+
+	for (t = root, i = 0; t; t = t->next, i++) {
+		struct ematch_tmpl_match *m = &tp->matches[i];
+		int slots = 0;
+
+		m->em = t;
+		if (!t->child && resolve_match(t, &m->util, &m->kind) < 0)
+			return -1;
+
+		for (b = t->child ? NULL : t->args->next; b; b = b->next) {
+			struct ematch_slot *s;
+			int num = ematch_slot_num(b);
+
+			if (!num)
+				continue;
+			s = realloc(tp->slots, (tp->nslots + 1) * sizeof(*s));
+			if (!s)
+				return -1;
+			tp->slots = s;
+			s[tp->nslots].arg = b;
+			s[tp->nslots].num = num;
+			tp->nslots++;
+			if (num > tp->nvalues)
+				tp->nvalues = num;
+			slots++;
+		}
+
+		if (!slots) {
+			m->encoded = ematch_tmpl_encode(m, i + 1);
+			if (!m->encoded)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static int ematch_tmpl_define(int argc, char **argv)
+{
+	struct ematch_tmpl *tp, *old;
+	char **args;
+	size_t len = 0;
+	int i, ret = -1;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: tc ematch define NAME EXPR\n");
+		return -1;
+	}
+
+	tp = calloc(1, sizeof(*tp));
+	/* an end marker tells where the grammar stopped */
+	args = calloc(argc, sizeof(*args));
+	if (!tp || !args)
+		goto out;
+	for (i = 1; i < argc; i++) {
+		args[i - 1] = argv[i];
+		len += strlen(argv[i]) + 1;
+	}
+	args[argc - 1] = "\001";
+
+	tp->name = strdup(argv[0]);
+	tp->text = malloc(len);
+	if (!tp->name || !tp->text)
+		goto out;
+	tp->text[0] = '\0';
+	for (i = 1; i < argc; i++) {
+		strcat(tp->text, argv[i]);
+		if (i + 1 < argc)
+			strcat(tp->text, " ");
+	}
+
+	begin_argc = ematch_argc = argc;
+	begin_argv = ematch_argv = args;
+	ematch_root = NULL;
+	if (ematch_parse()) {
+		em_parse_error(EINVAL, NULL, NULL, NULL, "Parse error");
+		free_ematch_err();
+		goto out;
+	}
+	free_ematch_err();
+
+	/* undo look ahead by parser, which has to be the end marker */
+	ematch_argc++;
+	ematch_argv--;
+	if (!ematch_root || ematch_argc != 1) {
+		fprintf(stderr, "Garbage after the ematch expression: \"%s\"\n",
+			ematch_argc > 1 ? *ematch_argv : "");
+		goto out;
+	}
+
+	if (ematch_tmpl_compile(tp, ematch_root) < 0) {
+		fprintf(stderr, "Illegal ematch template \"%s\"\n", tp->name);
+		goto out;
+	}
+
+	/* a new definition replaces an old one of the same name */
+	old = ematch_tmpl_find(tp->name);
+	if (old) {
+		struct ematch_tmpl tmp = *old;
+
+		*old = *tp;
+		old->next = tmp.next;
+		*tp = tmp;
+		tp->next = NULL;
+	} else {
+		tp->next = ematch_tmpls;
+		ematch_tmpls = tp;
+		tp = NULL;
+	}
+	ret = 0;
+out:
+	/* the expression trees are not freed, as elsewhere */
+	if (tp) {
+		if (tp->matches)
+			for (i = 0; i < tp->nmatches; i++)
+				free(tp->matches[i].encoded);
+		free(tp->matches);
+		free(tp->slots);
+		free(tp->name);
+		free(tp->text);
+		free(tp);
+	}
+	free(args);
+	return ret;
+}
+
+static int ematch_tmpl_show(void)
+{
+	struct ematch_tmpl *tp;
+
+	new_json_obj(json);
+	for (tp = ematch_tmpls; tp; tp = tp->next) {
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "name", "%s", tp->name);
+		print_int(PRINT_ANY, "values", " values %d", tp->nvalues);
+		print_string(PRINT_ANY, "expr", " %s", tp->text);
+		print_nl();
+		close_json_object();
+	}
+	delete_json_obj();
+	return 0;
+}
+
+static int parse_ematch_tmpl(int *argc_p, char ***argv_p, int tca_id,
+			     struct nlmsghdr *n)
+{
+	struct tcf_ematch_tree_hdr hdr = { .progid = TCF_EM_PROG_TC };
+	struct rtattr *tail, *tail_list;
+	char **argv = *argv_p;
+	struct ematch_tmpl *tp;
+	int i;
+
+	if (*argc_p < 2) {
+		fprintf(stderr, "\"template\" needs a template name\n");
+		return -1;
+	}
+	tp = ematch_tmpl_find(argv[1]);
+	if (!tp) {
+		fprintf(stderr, "Unknown ematch template \"%s\"\n", argv[1]);
+		return -1;
+	}
+	if (*argc_p < 2 + tp->nvalues) {
+		fprintf(stderr, "ematch template \"%s\" takes %d values\n",
+			tp->name, tp->nvalues);
+		return -1;
+	}
+
+	for (i = 0; i < tp->nslots; i++) {
+		struct ematch_slot *s = &tp->slots[i];
+
+		s->arg->data = argv[1 + s->num];
+		s->arg->len = strlen(s->arg->data);
+	}
+	/* the values are all there is to show for errors */
+	begin_argc = ematch_argc = 0;
+
+	hdr.nmatches = tp->nmatches;
+	tail = addattr_nest(n, MAX_MSG, tca_id);
+	addattr_l(n, MAX_MSG, TCA_EMATCH_TREE_HDR, &hdr, sizeof(hdr));
+	tail_list = addattr_nest(n, MAX_MSG, TCA_EMATCH_TREE_LIST);
+
+	for (i = 0; i < tp->nmatches; i++) {
+		struct ematch_tmpl_match *m = &tp->matches[i];
+
+		if (m->encoded) {
+			if (addraw_l(n, MAX_MSG, m->encoded,
+				     RTA_ALIGN(m->encoded->rta_len)) < 0)
+				return -1;
+		} else if (encode_match(n, m->em, i + 1, m->util,
+					m->kind) < 0) {
+			return -1;
+		}
+	}
+
+	addattr_nest_end(n, tail_list);
+	addattr_nest_end(n, tail);
+
+	*argc_p -= 2 + tp->nvalues;
+	*argv_p += 2 + tp->nvalues;
+	return 0;
+}
+
+int do_ematch(int argc, char **argv)
+{
+	if (argc < 1 || matches(*argv, "show") == 0 ||
+	    matches(*argv, "list") == 0)
+		return ematch_tmpl_show();
+	if (matches(*argv, "define") == 0)
+		return ematch_tmpl_define(argc - 1, argv + 1);
+	if (matches(*argv, "help") == 0) {
+		fprintf(stderr,
+			"Usage: tc ematch define NAME EXPR\n"
+			"       tc ematch show\n"
+			"where  EXPR may hold slots $1, $2, ... to be filled by\n"
+			"       \"match template NAME VALUE1 VALUE2 ...\"\n");
+		return 0;
+	}
+	fprintf(stderr, "Command \"%s\" is unknown, try \"tc ematch help\".\n",
+		*argv);
+	return -1;
+}
+
 static int print_ematch_seq(FILE *fd, struct rtattr **tb, int start,
 			    int prefix)
 {
@@ -18,9 +18,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
-#include <dlfcn.h>
+#include <ctype.h>
 #include "utils.h"
 #include "tc_util.h"
+#include "tc_common.h"
 #include "m_pedit.h"
 #include "rt_names.h"
 
@@ -31,6 +32,7 @@ static void explain(void)
 {
 	fprintf(stderr,
 		"Usage: ... pedit munge [ex] <MUNGE> [CONTROL]\n"
+		"       ... pedit template NAME VALUE... [munge <MUNGE>] [CONTROL]\n"
 		"Where: MUNGE := <RAW>|<LAYERED>\n"
 		"\t<RAW>:= <OFFSETC>[ATC]<CMD>\n \t\tOFFSETC:= offset <offval> <u8|u16|u32>\n"
 		"\t\tATC:= at <atval> offmask <maskval> shift <shiftval>\n"
@@ -72,9 +74,7 @@ static int pedit_parse_nopopt(int *argc_p, char ***argv_p,
 
 static struct m_pedit_util *get_pedit_kind(const char *str)
 {
-	static void *pBODY;
-	void *dlh;
-	char buf[256];
+	char so[256], buf[256];
 	struct m_pedit_util *p;
 
 	for (p = pedit_list; p; p = p->next) {
@@ -82,19 +82,9 @@ static struct m_pedit_util *get_pedit_kind(const char *str)
 			return p;
 	}
 
-	snprintf(buf, sizeof(buf), "p_%s.so", str);
-	dlh = dlopen(buf, RTLD_LAZY);
-	if (dlh == NULL) {
-		dlh = pBODY;
-		if (dlh == NULL) {
-			dlh = pBODY = dlopen(NULL, RTLD_LAZY);
-			if (dlh == NULL)
-				goto noexist;
-		}
-	}
-
+	snprintf(so, sizeof(so), "p_%s.so", str);
 	snprintf(buf, sizeof(buf), "p_pedit_%s", str);
-	p = dlsym(dlh, buf);
+	p = get_tc_util(so, buf);
 	if (p == NULL)
 		goto noexist;
 
@@ -561,6 +551,332 @@ done:
 	return res;
 }
 
+/*
+ * Fold every key into the one before it when both set bits of the same
+ * word, so a run of sub-word fields ends up as one 32 bit key. Applying
+ * (mask1, val1) and then (mask2, val2) is the same as applying
+ * (mask1 & mask2, (val1 & mask2) ^ val2). Adds would carry across fields
+ * and keys with an offmask find their word in the packet, so those stay.
+ */
+static void pedit_merge_keys(struct m_pedit_sel *_sel)
+{
+	struct tc_pedit_sel *sel = &_sel->sel;
+	struct tc_pedit_key *keys = _sel->keys;
+	struct m_pedit_key_ex *keys_ex = _sel->keys_ex;
+	unsigned int i, last = 0;
+
+	for (i = 1; i < sel->nkeys; i++) {
+		struct tc_pedit_key *prev = &keys[last], *key = &keys[i];
+
+		if (prev->off == key->off && !prev->offmask && !key->offmask &&
+		    (!_sel->extended ||
+		     (keys_ex[last].htype == keys_ex[i].htype &&
+		      keys_ex[last].cmd == TCA_PEDIT_KEY_EX_CMD_SET &&
+		      keys_ex[i].cmd == TCA_PEDIT_KEY_EX_CMD_SET))) {
+			prev->val = (prev->val & key->mask) ^ key->val;
+			prev->mask &= key->mask;
+			continue;
+		}
+		last++;
+		keys[last] = *key;
+		keys_ex[last] = keys_ex[i];
+	}
+	if (sel->nkeys)
+		sel->nkeys = last + 1;
+}
+
+/* Templates: "tc pedit define NAME [ex] munge ..." parses the munges once
+ * and keeps them for the rest of the run, e.g. of a batch file. Values
+ * written as $1, $2, ... are slots, filled in by "pedit template NAME
+ * VALUE..." of an action. The keys of munges without slots are packed at
+ * definition and copied as they are; only the munges with slots are
+ * parsed again.
+ */
+struct pedit_tmpl_step {
+	int	first;		/* fixed keys in the template's sel */
+	int	nkeys;
+	int	argc;		/* munge with slots, argc is 0 for fixed keys */
+	char	**argv;
+	int	*slot;		/* $N of argv[i], 0 if none */
+};
+
+struct pedit_tmpl {
+	struct pedit_tmpl	*next;
+	char			*name;
+	char			*text;
+	int			nvalues;	/* highest slot number */
+	int			nsteps;
+	struct pedit_tmpl_step	*steps;
+	struct m_pedit_sel	sel;
+};
+
+static struct pedit_tmpl *pedit_tmpls;
+
+static struct pedit_tmpl *pedit_tmpl_find(const char *name)
+{
+	struct pedit_tmpl *tp;
+
+	for (tp = pedit_tmpls; tp; tp = tp->next)
+		if (strcmp(tp->name, name) == 0)
+			return tp;
+	return NULL;
+}
+
+/* $N with N > 0, else 0 */
+static int pedit_slot_num(const char *arg)
+{
+	int num = 0;
+
+	if (arg[0] != '$' || !arg[1])
+		return 0;
+	for (arg++; *arg; arg++) {
+		if (!isdigit(*arg) || num > 1000)
+			return 0;
+		num = num * 10 + *arg - '0';
+	}
+	return num;
+}
+
+static void pedit_tmpl_free(struct pedit_tmpl *tp)
+{
+	int i;
+
+	for (i = 0; i < tp->nsteps; i++) {
+		struct pedit_tmpl_step *step = &tp->steps[i];
+		int j;
+
+		for (j = 0; j < step->argc; j++)
+			if (!step->slot[j])
+				free(step->argv[j]);
+		free(step->argv);
+		free(step->slot);
+	}
+	free(tp->steps);
+	free(tp->name);
+	free(tp->text);
+	free(tp);
+}
+
+/* Add the munge in argv[0..argc) as the next step of the template */
+static int pedit_tmpl_munge(struct pedit_tmpl *tp, int argc, char **argv)
+{
+	struct pedit_tmpl_step *step;
+	int i, slots = 0, *slot;
+
+	slot = calloc(argc, sizeof(*slot));
+	if (!slot)
+		return -1;
+	for (i = 0; i < argc; i++) {
+		slot[i] = pedit_slot_num(argv[i]);
+		if (slot[i] > tp->nvalues)
+			tp->nvalues = slot[i];
+		slots += !!slot[i];
+	}
+
+	step = tp->nsteps ? &tp->steps[tp->nsteps - 1] : NULL;
+	if (slots || !step || step->argc) {
+		step = realloc(tp->steps, (tp->nsteps + 1) * sizeof(*step));
+		if (!step) {
+			free(slot);
+			return -1;
+		}
+		tp->steps = step;
+		step = &tp->steps[tp->nsteps++];
+		memset(step, 0, sizeof(*step));
+		step->first = tp->sel.sel.nkeys;
+	}
+
+	if (slots) {
+		/* the arguments of a batch line do not outlive it */
+		step->argv = calloc(argc, sizeof(*argv));
+		step->slot = slot;
+		if (!step->argv)
+			return -1;
+		step->argc = argc;
+		for (i = 0; i < argc; i++)
+			if (!slot[i] && !(step->argv[i] = strdup(argv[i])))
+				return -1;
+		return 0;
+	}
+	free(slot);
+
+	if (parse_munge(&argc, &argv, &tp->sel) || argc) {
+		fprintf(stderr, "Bad pedit construct (%s)\n",
+			argc ? *argv : "munge");
+		return -1;
+	}
+	step->nkeys = tp->sel.sel.nkeys - step->first;
+	return 0;
+}
+
+static int pedit_tmpl_define(int argc, char **argv)
+{
+	struct pedit_tmpl *tp, *old;
+	size_t len = 0;
+	int i, start;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: tc pedit define NAME [ex] munge ...\n");
+		return -1;
+	}
+
+	tp = calloc(1, sizeof(*tp));
+	if (!tp)
+		return -1;
+	for (i = 1; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	tp->name = strdup(argv[0]);
+	tp->text = malloc(len);
+	if (!tp->name || !tp->text)
+		goto err;
+	tp->text[0] = '\0';
+	for (i = 1; i < argc; i++) {
+		strcat(tp->text, argv[i]);
+		if (i + 1 < argc)
+			strcat(tp->text, " ");
+	}
+
+	argc--;
+	argv++;
+	if (matches(*argv, "ex") == 0) {
+		tp->sel.extended = true;
+		argc--;
+		argv++;
+	}
+	if (!argc || matches(*argv, "munge")) {
+		fprintf(stderr, "Bad pedit template \"%s\", expected \"munge\"\n",
+			tp->name);
+		goto err;
+	}
+
+	/* the arguments of every munge run up to the next one */
+	for (start = 1, i = 1; i <= argc; i++) {
+		if (i < argc && matches(argv[i], "munge"))
+			continue;
+		if (i == start ||
+		    pedit_tmpl_munge(tp, i - start, argv + start) < 0) {
+			fprintf(stderr, "Illegal pedit template \"%s\"\n",
+				tp->name);
+			goto err;
+		}
+		start = i + 1;
+	}
+
+	/* a new definition replaces an old one of the same name */
+	old = pedit_tmpl_find(tp->name);
+	if (old) {
+		struct pedit_tmpl tmp = *old;
+
+		*old = *tp;
+		old->next = tmp.next;
+		*tp = tmp;
+		tp->next = NULL;
+		pedit_tmpl_free(tp);
+	} else {
+		tp->next = pedit_tmpls;
+		pedit_tmpls = tp;
+	}
+	return 0;
+
+err:
+	pedit_tmpl_free(tp);
+	return -1;
+}
+
+static int pedit_tmpl_show(void)
+{
+	struct pedit_tmpl *tp;
+
+	new_json_obj(json);
+	for (tp = pedit_tmpls; tp; tp = tp->next) {
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "name", "%s", tp->name);
+		print_int(PRINT_ANY, "values", " values %d", tp->nvalues);
+		print_string(PRINT_ANY, "munge", " %s", tp->text);
+		print_nl();
+		close_json_object();
+	}
+	delete_json_obj();
+	return 0;
+}
+
+/* "template NAME VALUE..." of a pedit action */
+static int parse_pedit_tmpl(int *argc_p, char ***argv_p,
+			    struct m_pedit_sel *sel)
+{
+	char **argv = *argv_p;
+	struct pedit_tmpl *tp;
+	int i, j;
+
+	if (*argc_p < 2) {
+		fprintf(stderr, "\"template\" needs a template name\n");
+		return -1;
+	}
+	tp = pedit_tmpl_find(argv[1]);
+	if (!tp) {
+		fprintf(stderr, "Unknown pedit template \"%s\"\n", argv[1]);
+		return -1;
+	}
+	if (*argc_p < 2 + tp->nvalues) {
+		fprintf(stderr, "pedit template \"%s\" takes %d values\n",
+			tp->name, tp->nvalues);
+		return -1;
+	}
+
+	sel->extended = tp->sel.extended;
+	for (i = 0; i < tp->nsteps; i++) {
+		struct pedit_tmpl_step *step = &tp->steps[i];
+		int argc = step->argc;
+		char **args = step->argv;
+
+		if (!argc) {
+			if (sel->sel.nkeys + step->nkeys > MAX_OFFS)
+				return -1;
+			memcpy(&sel->keys[sel->sel.nkeys],
+			       &tp->sel.keys[step->first],
+			       step->nkeys * sizeof(*sel->keys));
+			memcpy(&sel->keys_ex[sel->sel.nkeys],
+			       &tp->sel.keys_ex[step->first],
+			       step->nkeys * sizeof(*sel->keys_ex));
+			sel->sel.nkeys += step->nkeys;
+			continue;
+		}
+
+		for (j = 0; j < argc; j++)
+			if (step->slot[j])
+				args[j] = argv[1 + step->slot[j]];
+		if (parse_munge(&argc, &args, sel) || argc) {
+			fprintf(stderr, "Bad pedit template \"%s\" value (%s)\n",
+				tp->name, argc ? *args : "");
+			return -1;
+		}
+	}
+
+	*argc_p -= 2 + tp->nvalues;
+	*argv_p += 2 + tp->nvalues;
+	return 0;
+}
+
+int do_pedit(int argc, char **argv)
+{
+	if (argc < 1 || matches(*argv, "show") == 0 ||
+	    matches(*argv, "list") == 0)
+		return pedit_tmpl_show();
+	if (matches(*argv, "define") == 0)
+		return pedit_tmpl_define(argc - 1, argv + 1);
+	if (matches(*argv, "help") == 0) {
+		fprintf(stderr,
+			"Usage: tc pedit define NAME [ex] munge <MUNGE> [munge <MUNGE> ...]\n"
+			"       tc pedit show\n"
+			"where  MUNGE may hold slots $1, $2, ... to be filled by\n"
+			"       \"pedit template NAME VALUE1 VALUE2 ...\"\n");
+		return 0;
+	}
+	fprintf(stderr, "Command \"%s\" is unknown, try \"tc pedit help\".\n",
+		*argv);
+	return -1;
+}
+
 static int pedit_keys_ex_getattr(struct rtattr *attr,
 				 struct m_pedit_key_ex *keys_ex, int n)
 {
@@ -637,6 +953,19 @@ static int parse_pedit(const struct action_util *a, int *argc_p, char ***argv_p,
 			NEXT_ARG();
 			ok++;
 
+			if (strcmp(*argv, "template") == 0) {
+				if (ok > 1) {
+					fprintf(stderr,
+						"'template' must be before first 'munge'\n");
+					explain();
+					return -1;
+				}
+				if (parse_pedit_tmpl(&argc, &argv, &sel))
+					return -1;
+				ok++;
+				continue;
+			}
+
 			if (matches(*argv, "ex") == 0) {
 				if (ok > 1) {
 					fprintf(stderr,
@@ -692,6 +1021,8 @@ static int parse_pedit(const struct action_util *a, int *argc_p, char ***argv_p,
 		}
 	}
 
+	pedit_merge_keys(&sel);
+
 	tail = addattr_nest(n, MAX_MSG, tca_id);
 	if (!sel.extended) {
 		addattr_l(n, MAX_MSG, TCA_PEDIT_PARMS, &sel,
@@ -826,11 +826,68 @@ static int cake_print_xstats(const struct qdisc_util *qu, FILE *f,
 	return 0;
 }
 
+static const struct {
+	int		attr;
+	const char	*name;
+	bool		counter;
+} cake_tin_samples[] = {
+	{ TCA_CAKE_TIN_STATS_SENT_BYTES64,	  "sent_bytes",	    true },
+	{ TCA_CAKE_TIN_STATS_SENT_PACKETS,	  "sent_packets",   true },
+	{ TCA_CAKE_TIN_STATS_DROPPED_PACKETS,	  "drops",	    true },
+	{ TCA_CAKE_TIN_STATS_ECN_MARKED_PACKETS,  "ecn_mark",	    true },
+	{ TCA_CAKE_TIN_STATS_ACKS_DROPPED_PACKETS, "ack_drops",	    true },
+	{ TCA_CAKE_TIN_STATS_BACKLOG_BYTES,	  "backlog_bytes",  false },
+	{ TCA_CAKE_TIN_STATS_PEAK_DELAY_US,	  "peak_delay_us",  false },
+	{ TCA_CAKE_TIN_STATS_AVG_DELAY_US,	  "avg_delay_us",   false },
+	{ TCA_CAKE_TIN_STATS_BASE_DELAY_US,	  "base_delay_us",  false },
+	{ TCA_CAKE_TIN_STATS_SPARSE_FLOWS,	  "sparse_flows",   false },
+	{ TCA_CAKE_TIN_STATS_BULK_FLOWS,	  "bulk_flows",	    false },
+	{ TCA_CAKE_TIN_STATS_UNRESPONSIVE_FLOWS,  "unresponsive_flows", false },
+};
+
+static void cake_sample_xstats(const struct qdisc_util *qu,
+			       struct rtattr *xstats, struct xstats_samples *xs)
+{
+	struct rtattr *tstat[TCA_CAKE_TIN_STATS_MAX + 1];
+	struct rtattr *st[TCA_CAKE_STATS_MAX + 1];
+	struct rtattr *tins[TC_CAKE_MAX_TINS + 1];
+	int i, j;
+
+	parse_rtattr_nested(st, TCA_CAKE_STATS_MAX, xstats);
+
+	if (st[TCA_CAKE_STATS_MEMORY_USED])
+		xstats_sample_add(xs, "memory_used", -1, false,
+			rta_getattr_u32(st[TCA_CAKE_STATS_MEMORY_USED]));
+	if (st[TCA_CAKE_STATS_CAPACITY_ESTIMATE64])
+		xstats_sample_add(xs, "capacity_estimate", -1, false,
+			rta_getattr_u64(st[TCA_CAKE_STATS_CAPACITY_ESTIMATE64]));
+	if (!st[TCA_CAKE_STATS_TIN_STATS])
+		return;
+
+	parse_rtattr_nested(tins, TC_CAKE_MAX_TINS,
+			    st[TCA_CAKE_STATS_TIN_STATS]);
+	for (i = 1; i <= TC_CAKE_MAX_TINS && tins[i]; i++) {
+		parse_rtattr_nested(tstat, TCA_CAKE_TIN_STATS_MAX, tins[i]);
+		for (j = 0; j < ARRAY_SIZE(cake_tin_samples); j++) {
+			struct rtattr *a = tstat[cake_tin_samples[j].attr];
+
+			if (!a)
+				continue;
+			xstats_sample_add(xs, cake_tin_samples[j].name, i - 1,
+					  cake_tin_samples[j].counter,
+					  RTA_PAYLOAD(a) >= sizeof(__u64) ?
+					  rta_getattr_u64(a) :
+					  rta_getattr_u32(a));
+		}
+	}
+}
+
 struct qdisc_util cake_qdisc_util = {
 	.id		= "cake",
 	.parse_qopt	= cake_parse_opt,
 	.print_qopt	= cake_print_opt,
 	.print_xstats	= cake_print_xstats,
+	.sample_xstats	= cake_sample_xstats,
 };
 
 struct qdisc_util cake_mq_qdisc_util = {
@@ -838,4 +895,5 @@ struct qdisc_util cake_mq_qdisc_util = {
 	.parse_qopt	= cake_parse_opt,
 	.print_qopt	= cake_print_opt,
 	.print_xstats	= cake_print_xstats,
+	.sample_xstats	= cake_sample_xstats,
 };
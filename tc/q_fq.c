@@ -611,9 +611,42 @@ static int fq_print_xstats(const struct qdisc_util *qu, FILE *f,
 	return 0;
 }
 
+static void fq_sample_xstats(const struct qdisc_util *qu,
+			     struct rtattr *xstats, struct xstats_samples *xs)
+{
+	struct tc_fq_qd_stats st = {};
+	int i;
+
+	memcpy(&st, RTA_DATA(xstats), min(RTA_PAYLOAD(xstats), sizeof(st)));
+
+	xstats_sample_add(xs, "flows", -1, false, st.flows);
+	xstats_sample_add(xs, "inactive", -1, false, st.inactive_flows);
+	xstats_sample_add(xs, "throttled_flows", -1, false,
+			  st.throttled_flows);
+	xstats_sample_add(xs, "latency_ns", -1, false,
+			  st.unthrottle_latency_ns);
+	xstats_sample_add(xs, "throttled", -1, true, st.throttled);
+	xstats_sample_add(xs, "gc", -1, true, st.gc_flows);
+	xstats_sample_add(xs, "ce_mark", -1, true, st.ce_mark);
+	xstats_sample_add(xs, "flows_plimit", -1, true, st.flows_plimit);
+	xstats_sample_add(xs, "pkts_too_long", -1, true, st.pkts_too_long);
+	xstats_sample_add(xs, "alloc_errors", -1, true, st.allocation_errors);
+	xstats_sample_add(xs, "horizon_drops", -1, true, st.horizon_drops);
+	xstats_sample_add(xs, "horizon_caps", -1, true, st.horizon_caps);
+
+	/* bands came later, older kernels send a shorter struct */
+	if (RTA_PAYLOAD(xstats) < offsetof(struct tc_fq_qd_stats, pad))
+		return;
+	for (i = 0; i < FQ_BANDS; i++) {
+		xstats_sample_add(xs, "pkts", i, false, st.band_pkt_count[i]);
+		xstats_sample_add(xs, "drops", i, true, st.band_drops[i]);
+	}
+}
+
 struct qdisc_util fq_qdisc_util = {
 	.id		= "fq",
 	.parse_qopt	= fq_parse_opt,
 	.print_qopt	= fq_print_opt,
 	.print_xstats	= fq_print_xstats,
+	.sample_xstats	= fq_sample_xstats,
 };
@@ -317,9 +317,38 @@ static int fq_codel_print_xstats(const struct qdisc_util *qu, FILE *f,
 
 }
 
+static void fq_codel_sample_xstats(const struct qdisc_util *qu,
+				   struct rtattr *xstats,
+				   struct xstats_samples *xs)
+{
+	struct tc_fq_codel_xstats st = {};
+
+	memcpy(&st, RTA_DATA(xstats), min(RTA_PAYLOAD(xstats), sizeof(st)));
+	if (st.type != TCA_FQ_CODEL_XSTATS_QDISC)
+		return;
+
+	xstats_sample_add(xs, "maxpacket", -1, false,
+			  st.qdisc_stats.maxpacket);
+	xstats_sample_add(xs, "new_flows_len", -1, false,
+			  st.qdisc_stats.new_flows_len);
+	xstats_sample_add(xs, "old_flows_len", -1, false,
+			  st.qdisc_stats.old_flows_len);
+	xstats_sample_add(xs, "memory_used", -1, false,
+			  st.qdisc_stats.memory_usage);
+	xstats_sample_add(xs, "drop_overlimit", -1, true,
+			  st.qdisc_stats.drop_overlimit);
+	xstats_sample_add(xs, "drop_overmemory", -1, true,
+			  st.qdisc_stats.drop_overmemory);
+	xstats_sample_add(xs, "ecn_mark", -1, true, st.qdisc_stats.ecn_mark);
+	xstats_sample_add(xs, "ce_mark", -1, true, st.qdisc_stats.ce_mark);
+	xstats_sample_add(xs, "new_flow_count", -1, true,
+			  st.qdisc_stats.new_flow_count);
+}
+
 struct qdisc_util fq_codel_qdisc_util = {
 	.id		= "fq_codel",
 	.parse_qopt	= fq_codel_parse_opt,
 	.print_qopt	= fq_codel_print_opt,
 	.print_xstats	= fq_codel_print_xstats,
+	.sample_xstats	= fq_codel_sample_xstats,
 };
@@ -8,12 +8,15 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
 
 #include "utils.h"
+#include "rtnl_bulk.h"
 #include "tc_util.h"
 
 #define HTB_TC_VER 0x30003
@@ -43,6 +46,8 @@ static void explain(void)
 		" mtu      max packet size we create rate map for {1600}\n"
 		" prio     priority of leaf; lower are served first {0}\n"
 		" quantum  how much bytes to serve from leaf at once {use r2q}\n"
+		"... class add ... htb tree FILE [r2q N] [offload]\n"
+		" tree     install the classes of FILE, one \"CLASSID PARENT OPTIONS\" per line\n"
 		"\nTC HTB version %d.%d\n", HTB_TC_VER>>16, HTB_TC_VER&0xffff
 		);
 }
@@ -107,6 +112,9 @@ static int htb_parse_opt(const struct qdisc_util *qu, int argc,
 	return 0;
 }
 
+static int htb_parse_tree(const struct qdisc_util *qu, int argc, char **argv,
+			  struct nlmsghdr *n, const char *dev);
+
 static int htb_parse_class_opt(const struct qdisc_util *qu, int argc, char **argv,
 			       struct nlmsghdr *n, const char *dev)
 {
@@ -122,6 +130,9 @@ static int htb_parse_class_opt(const struct qdisc_util *qu, int argc, char **arg
 	__u64 ceil64 = 0, rate64 = 0;
 	char *param;
 
+	if (argc > 0 && strcmp(*argv, "tree") == 0)
+		return htb_parse_tree(qu, argc, argv, n, dev);
+
 	while (argc > 0) {
 		if (matches(*argv, "prio") == 0) {
 			NEXT_ARG();
@@ -263,6 +274,515 @@ static int htb_parse_class_opt(const struct qdisc_util *qu, int argc, char **arg
 	return 0;
 }
 
+/* "tree FILE [r2q N] [offload]" installs a hierarchy below the parent of
+ * the command.  Every line of FILE is "CLASSID PARENT OPTIONS" with the
+ * OPTIONS of one class, in any order.  The whole tree is checked before
+ * anything is sent: parents have to exist, a class may not be faster
+ * than its ceil, and quanta are computed for the classes that have none.
+ * Classes then go out parent first, in windows on a socket of their own,
+ * with failures reported by line.  The last class is left in n for the
+ * caller to send.
+ */
+#define HTB_TREE_MAX_ARGS	64
+#define HTB_TREE_WINDOW		1024
+/* the kernel clamps quanta computed from r2q to these and complains */
+#define HTB_QUANTUM_MIN		1000
+#define HTB_QUANTUM_MAX		200000
+
+struct htb_tree_class {
+	__u32		classid;
+	__u32		parent;
+	__u64		rate;
+	__u64		ceil;
+	__u64		child_rates;
+	__u32		quantum;
+	bool		quantum_given;
+	bool		mpu_overhead;
+	unsigned int	line;
+	unsigned int	depth;
+	int		parent_idx;	/* -1 below the parent of the command */
+	int		first_child;
+	int		next_sibling;
+	int		nargs;
+	char		*args;		/* nargs words, each NUL terminated */
+};
+
+struct htb_tree {
+	struct rtnl_bulk	bulk;
+	struct htb_tree_class	*cls;
+	int			count;
+	int			size;
+	int			*order;		/* parents before children */
+};
+
+struct htb_tree_key {
+	__u32	classid;
+	int	idx;
+};
+
+struct htb_tree_req {
+	struct nlmsghdr	n;
+	char		buf[4096];
+};
+
+static int htb_tree_class_parse(struct htb_tree_class *c, int argc,
+				char **argv, const char *dev)
+{
+	struct htb_tree_req req = { .n.nlmsg_len = NLMSG_LENGTH(0) };
+	struct rtattr *tb[TCA_HTB_MAX + 1];
+	struct tc_htb_opt *hopt;
+
+	if (htb_parse_class_opt(NULL, argc, argv, &req.n, dev))
+		return -1;
+
+	parse_rtattr_nested(tb, TCA_HTB_MAX,
+			    (struct rtattr *)NLMSG_DATA(&req.n));
+	hopt = RTA_DATA(tb[TCA_HTB_PARMS]);
+	c->rate = tb[TCA_HTB_RATE64] ?
+		  rta_getattr_u64(tb[TCA_HTB_RATE64]) : hopt->rate.rate;
+	c->ceil = tb[TCA_HTB_CEIL64] ?
+		  rta_getattr_u64(tb[TCA_HTB_CEIL64]) : hopt->ceil.rate;
+	c->quantum = hopt->quantum;
+	c->quantum_given = hopt->quantum != 0;
+	c->mpu_overhead = hopt->rate.mpu || hopt->rate.overhead;
+	return 0;
+}
+
+static int htb_tree_read(struct htb_tree *tree, const char *dev)
+{
+	int lineno = 0, ret = -1;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(&tree->bulk);
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *tok[HTB_TREE_MAX_ARGS], *cp;
+		struct htb_tree_class *c;
+		size_t args_len = 0;
+		int ntok, i;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, HTB_TREE_MAX_ARGS);
+		if (ntok == 0)
+			continue;
+		if (ntok > HTB_TREE_MAX_ARGS) {
+			rtnl_bulk_line_error(&tree->bulk, lineno,
+					     "too many words");
+			goto out;
+		}
+
+		if (tree->count == tree->size) {
+			int size = tree->size ? tree->size * 2 : 1024;
+
+			c = realloc(tree->cls, size * sizeof(*c));
+			if (!c) {
+				perror("realloc");
+				goto out;
+			}
+			tree->cls = c;
+			tree->size = size;
+		}
+		c = &tree->cls[tree->count];
+		memset(c, 0, sizeof(*c));
+		c->line = lineno;
+
+		if (ntok < 2 || get_tc_classid(&c->classid, tok[0]) ||
+		    get_tc_classid(&c->parent, tok[1])) {
+			rtnl_bulk_line_error(&tree->bulk, lineno,
+					     "expected \"CLASSID PARENT OPTIONS\"");
+			goto out;
+		}
+		if (ntok > 2 && strcmp(tok[2], "tree") == 0) {
+			rtnl_bulk_line_error(&tree->bulk, lineno,
+					     "trees do not nest");
+			goto out;
+		}
+		if (htb_tree_class_parse(c, ntok - 2, tok + 2, dev)) {
+			rtnl_bulk_line_error(&tree->bulk, lineno,
+					     "illegal class");
+			goto out;
+		}
+
+		for (i = 2; i < ntok; i++)
+			args_len += strlen(tok[i]) + 1;
+		c->args = malloc(args_len);
+		if (!c->args) {
+			perror("malloc");
+			goto out;
+		}
+		for (cp = c->args, i = 2; i < ntok; i++)
+			cp = stpcpy(cp, tok[i]) + 1;
+		c->nargs = ntok - 2;
+		tree->count++;
+	}
+
+	if (tree->count)
+		ret = 0;
+	else
+		fprintf(stderr, "\"%s\" contains no classes\n",
+			tree->bulk.file);
+out:
+	rtnl_bulk_close(fp);
+	free(line);
+	return ret;
+}
+
+static int htb_tree_key_cmp(const void *a, const void *b)
+{
+	const struct htb_tree_key *ka = a, *kb = b;
+
+	if (ka->classid != kb->classid)
+		return ka->classid < kb->classid ? -1 : 1;
+	return ka->idx - kb->idx;
+}
+
+/* class IDs are unique once htb_tree_link() checked them */
+static int htb_tree_key_find(const void *a, const void *b)
+{
+	const struct htb_tree_key *ka = a, *kb = b;
+
+	if (ka->classid != kb->classid)
+		return ka->classid < kb->classid ? -1 : 1;
+	return 0;
+}
+
+/* Resolve parents and order the classes parent first, breadth first. */
+static int htb_tree_link(struct htb_tree *tree, __u32 root)
+{
+	struct htb_tree_key *keys;
+	int i, head, tail = 0, ret = -1;
+	SPRINT_BUF(b1);
+	SPRINT_BUF(b2);
+
+	keys = malloc(tree->count * sizeof(*keys));
+	tree->order = malloc(tree->count * sizeof(*tree->order));
+	if (!keys || !tree->order) {
+		perror("malloc");
+		goto out;
+	}
+
+	for (i = 0; i < tree->count; i++) {
+		keys[i].classid = tree->cls[i].classid;
+		keys[i].idx = i;
+	}
+	qsort(keys, tree->count, sizeof(*keys), htb_tree_key_cmp);
+
+	for (i = 1; i < tree->count; i++) {
+		if (keys[i].classid == keys[i - 1].classid) {
+			fprintf(stderr, "%s:%d: class %s is already on line %d\n",
+				tree->bulk.file, tree->cls[keys[i].idx].line,
+				sprint_tc_classid(keys[i].classid, b1),
+				tree->cls[keys[i - 1].idx].line);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < tree->count; i++) {
+		struct htb_tree_class *c = &tree->cls[i];
+		struct htb_tree_key key = { .classid = c->parent }, *k;
+
+		c->first_child = c->next_sibling = -1;
+		c->depth = UINT_MAX;
+		if (TC_H_MAJ(c->classid) != TC_H_MAJ(root) ||
+		    !TC_H_MIN(c->classid)) {
+			fprintf(stderr, "%s:%d: %s is not a class of qdisc %x:\n",
+				tree->bulk.file, c->line,
+				sprint_tc_classid(c->classid, b1),
+				TC_H_MAJ(root) >> 16);
+			goto out;
+		}
+		if (c->parent == root) {
+			c->parent_idx = -1;
+			continue;
+		}
+		k = bsearch(&key, keys, tree->count, sizeof(*keys),
+			    htb_tree_key_find);
+		if (!k) {
+			fprintf(stderr, "%s:%d: parent %s is neither in the file nor %s\n",
+				tree->bulk.file, c->line,
+				sprint_tc_classid(c->parent, b1),
+				sprint_tc_classid(root, b2));
+			goto out;
+		}
+		c->parent_idx = k->idx;
+	}
+
+	/* link children in reverse, so they keep the order of the file */
+	for (i = tree->count - 1; i >= 0; i--) {
+		struct htb_tree_class *c = &tree->cls[i];
+
+		if (c->parent_idx >= 0) {
+			c->next_sibling = tree->cls[c->parent_idx].first_child;
+			tree->cls[c->parent_idx].first_child = i;
+		}
+	}
+
+	for (i = 0; i < tree->count; i++) {
+		if (tree->cls[i].parent_idx < 0) {
+			tree->cls[i].depth = 0;
+			tree->order[tail++] = i;
+		}
+	}
+	for (head = 0; head < tail; head++) {
+		struct htb_tree_class *p = &tree->cls[tree->order[head]];
+
+		for (i = p->first_child; i >= 0; i = tree->cls[i].next_sibling) {
+			tree->cls[i].depth = p->depth + 1;
+			tree->order[tail++] = i;
+		}
+	}
+	if (tail < tree->count) {
+		for (i = 0; tree->cls[i].depth != UINT_MAX; i++)
+			;
+		fprintf(stderr, "%s:%d: class %s is not below %s, its parents form a loop\n",
+			tree->bulk.file, tree->cls[i].line,
+			sprint_tc_classid(tree->cls[i].classid, b1),
+			sprint_tc_classid(root, b2));
+		goto out;
+	}
+	ret = 0;
+out:
+	free(keys);
+	return ret;
+}
+
+static int htb_tree_check(struct htb_tree *tree, __u32 r2q, bool offload)
+{
+	__u64 max_rate = 0;
+	int i, err = 0;
+	SPRINT_BUF(b1);
+
+	for (i = 0; i < tree->count; i++) {
+		struct htb_tree_class *c = &tree->cls[i];
+		struct htb_tree_class *p;
+
+		if (c->rate > c->ceil) {
+			fprintf(stderr, "%s:%d: rate of %s exceeds its ceil\n",
+				tree->bulk.file, c->line,
+				sprint_tc_classid(c->classid, b1));
+			err = -1;
+		}
+		if (offload && c->mpu_overhead) {
+			fprintf(stderr, "%s:%d: the offload supports neither mpu nor overhead\n",
+				tree->bulk.file, c->line);
+			err = -1;
+		}
+		if (c->first_child < 0 && !c->quantum_given && c->rate > max_rate)
+			max_rate = c->rate;
+		if (c->parent_idx < 0)
+			continue;
+
+		p = &tree->cls[c->parent_idx];
+		p->child_rates += c->rate;
+		if (c->rate > p->ceil) {
+			fprintf(stderr, "%s:%d: rate of %s exceeds the ceil of its parent\n",
+				tree->bulk.file, c->line,
+				sprint_tc_classid(c->classid, b1));
+			err = -1;
+		} else if (c->ceil > p->ceil) {
+			fprintf(stderr, "%s:%d: warning: ceil of %s exceeds the ceil of its parent\n",
+				tree->bulk.file, c->line,
+				sprint_tc_classid(c->classid, b1));
+		}
+	}
+
+	for (i = 0; i < tree->count; i++) {
+		const struct htb_tree_class *c = &tree->cls[i];
+
+		if (c->child_rates > c->rate)
+			fprintf(stderr, "%s:%d: warning: the children of %s are guaranteed more than its rate\n",
+				tree->bulk.file, c->line,
+				sprint_tc_classid(c->classid, b1));
+	}
+
+	/* With offload the driver weighs the classes itself. */
+	if (err || offload)
+		return err;
+
+	/* Quanta only weigh leaves against each other, so unless r2q is
+	 * given, pick it to let the fastest leaf just reach the upper bound
+	 * and keep the proportions of as many slower ones as possible.
+	 */
+	if (!r2q)
+		r2q = max_rate > HTB_QUANTUM_MAX ?
+		      (max_rate + HTB_QUANTUM_MAX - 1) / HTB_QUANTUM_MAX : 1;
+	for (i = 0; i < tree->count; i++) {
+		struct htb_tree_class *c = &tree->cls[i];
+		__u64 quantum = c->rate / r2q;
+
+		if (c->quantum_given)
+			continue;
+		if (quantum < HTB_QUANTUM_MIN)
+			quantum = HTB_QUANTUM_MIN;
+		else if (quantum > HTB_QUANTUM_MAX)
+			quantum = HTB_QUANTUM_MAX;
+		c->quantum = quantum;
+	}
+	return 0;
+}
+
+static void htb_tree_offload_report(const struct htb_tree *tree)
+{
+	unsigned int leaves = 0, depth = 0;
+	int i;
+
+	for (i = 0; i < tree->count; i++) {
+		if (tree->cls[i].first_child < 0)
+			leaves++;
+		if (tree->cls[i].depth + 1 > depth)
+			depth = tree->cls[i].depth + 1;
+	}
+	printf("offload: %d classes in %u levels, %u leaves taking a hardware queue each\n",
+	       tree->count, depth, leaves);
+}
+
+/* Build the request of c on top of the first proto_len bytes of n. */
+static int htb_tree_build(const struct htb_tree_class *c,
+			  const struct nlmsghdr *n, __u32 proto_len,
+			  struct nlmsghdr *req, int ifindex, const char *dev)
+{
+	char *argv[HTB_TREE_MAX_ARGS + 2], quantum[16], *cp = c->args;
+	struct tcmsg *t = NLMSG_DATA(req);
+	int argc;
+
+	for (argc = 0; argc < c->nargs; argc++) {
+		argv[argc] = cp;
+		cp += strlen(cp) + 1;
+	}
+	if (!c->quantum_given && c->quantum) {
+		snprintf(quantum, sizeof(quantum), "%u", c->quantum);
+		argv[argc++] = "quantum";
+		argv[argc++] = quantum;
+	}
+
+	memcpy(req, n, proto_len);
+	t->tcm_handle = c->classid;
+	t->tcm_parent = c->parent;
+	t->tcm_ifindex = ifindex;
+	return htb_parse_class_opt(NULL, argc, argv, req, dev);
+}
+
+static int htb_parse_tree(const struct qdisc_util *qu, int argc, char **argv,
+			  struct nlmsghdr *n, const char *dev)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	__u32 proto_len = n->nlmsg_len;
+	struct htb_tree_req *req = NULL;
+	struct htb_tree tree = {
+		.bulk.what = "classes",
+		.bulk.window = HTB_TREE_WINDOW,
+	};
+	bool offload = false;
+	struct rtnl_flush f;
+	int i, last = -1;
+	int ifindex, ret = -1;
+	__u32 r2q = 0;
+
+	if (t->tcm_handle) {
+		fprintf(stderr, "\"tree\" does not take a classid\n");
+		return -1;
+	}
+	if (!t->tcm_parent || t->tcm_parent == TC_H_ROOT) {
+		fprintf(stderr, "\"tree\" needs the parent of the tree\n");
+		return -1;
+	}
+	if (!dev || !dev[0]) {
+		fprintf(stderr, "\"tree\" needs a device\n");
+		return -1;
+	}
+
+	NEXT_ARG();
+	tree.bulk.file = *argv;
+	argc--; argv++;
+	while (argc > 0) {
+		if (strcmp(*argv, "r2q") == 0) {
+			NEXT_ARG();
+			if (get_u32(&r2q, *argv, 10) || !r2q) {
+				explain1("r2q");
+				return -1;
+			}
+		} else if (strcmp(*argv, "offload") == 0) {
+			offload = true;
+		} else {
+			fprintf(stderr, "What is \"%s\"?\n", *argv);
+			explain();
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	ll_init_map_lazy();
+	ifindex = ll_name_to_index(dev);
+	if (!ifindex)
+		return -nodev(dev);
+
+	if (htb_tree_read(&tree, dev) ||
+	    htb_tree_link(&tree, t->tcm_parent) ||
+	    htb_tree_check(&tree, r2q, offload))
+		goto out;
+	if (offload)
+		htb_tree_offload_report(&tree);
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		goto out;
+
+	if (rtnl_bulk_start(&tree.bulk, &f) < 0)
+		goto out;
+
+	for (i = 0; i < tree.count; i++) {
+		const struct htb_tree_class *c = &tree.cls[tree.order[i]];
+
+		/* The previous class is complete, queue it. */
+		if (last >= 0) {
+			f.tag = last;
+			if (rtnl_flush_add(&f, &req->n, 0) < 0) {
+				perror("Cannot talk to rtnetlink");
+				goto out_close;
+			}
+			last = -1;
+		}
+		tree.bulk.entries++;
+		if (htb_tree_build(c, n, proto_len, &req->n, ifindex, dev)) {
+			rtnl_bulk_line_error(&tree.bulk, c->line,
+					     "illegal class");
+			continue;
+		}
+		last = c->line;
+	}
+
+	/* The last class goes back to the caller only if all others made it. */
+	if (rtnl_flush_commit(&f) == -2) {
+		perror("Cannot talk to rtnetlink");
+		goto out_close;
+	}
+	if (last >= 0 && !tree.bulk.failed) {
+		memcpy(n, req, req->n.nlmsg_len);
+	} else if (last >= 0) {
+		f.tag = last;
+		if (rtnl_flush_add(&f, &req->n, 0) < 0) {
+			perror("Cannot talk to rtnetlink");
+			goto out_close;
+		}
+	}
+	ret = rtnl_bulk_finish(&tree.bulk, &f);
+	goto out;
+
+out_close:
+	rtnl_flush_close(&f);
+out:
+	for (i = 0; i < tree.count; i++)
+		free(tree.cls[i].args);
+	free(tree.cls);
+	free(tree.order);
+	free(req);
+	return ret;
+}
+
 static int htb_print_opt(const struct qdisc_util *qu, FILE *f, struct rtattr *opt)
 {
 	struct rtattr *tb[TCA_HTB_MAX + 1];
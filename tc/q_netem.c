@@ -15,8 +15,11 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "utils.h"
+#include "netem_dist.h"
 #include "tc_util.h"
 #include "tc_common.h"
 
@@ -25,7 +28,8 @@ static void explain(void)
 	fprintf(stderr,
 		"Usage: ... netem [ limit PACKETS ]\n"
 		"                 [ delay TIME [ JITTER [ CORRELATION ] ] ]\n"
-		"                 [ distribution {uniform|normal|pareto|paretonormal} ]\n"
+		"                 [ distribution {uniform|normal|pareto|paretonormal} |\n"
+		"                   distribution-file FILE ]\n"
 		"                 [ corrupt PERCENT [ CORRELATION ] ]\n"
 		"                 [ duplicate PERCENT [ CORRELATION ] ]\n"
 		"                 [ loss random PERCENT [ CORRELATION ] ]\n"
@@ -36,7 +40,8 @@ static void explain(void)
 		"                 [ reorder PERCENT [ CORRELATION ] [ gap DISTANCE ] ]\n"
 		"                 [ rate RATE [ PACKETOVERHEAD ] [ CELLSIZE ] [ CELLOVERHEAD ] ]\n"
 		"                 [ slot MIN_DELAY [ MAX_DELAY ] [ packets MAX_PACKETS ] [ bytes MAX_BYTES ] ]\n"
-		"                 [ slot distribution {uniform|normal|pareto|paretonormal|custom}\n"
+		"                 [ slot { distribution {uniform|normal|pareto|paretonormal|custom} |\n"
+		"                          distribution-file FILE }\n"
 		"                   DELAY JITTER [ packets MAX_PACKETS ] [ bytes MAX_BYTES ] ]\n");
 }
 
@@ -116,28 +121,32 @@ static void print_corr(bool present, __u32 value)
 	}
 }
 
+/*
+ * Distribution tables, kept for the life of the process so that a batch
+ * adding many netem qdiscs loads each table once.
+ */
+struct netem_dist {
+	struct netem_dist	*next;
+	char			*path;
+	const __s16		*data;
+	int			size;
+};
+
+static struct netem_dist *netem_dists;
+
 /*
  * Simplistic file parser for distribution data.
  * Format is:
  *	# comment line(s)
  *	data0 data1 ...
  */
-static int get_distribution(const char *type, __s16 *data, int maxdata)
+static int parse_distribution(FILE *f, const char *name, __s16 *data,
+			      int maxdata)
 {
-	FILE *f;
 	int n;
 	long x;
 	size_t len;
 	char *line = NULL;
-	char name[128];
-
-	snprintf(name, sizeof(name), "%s/%s.dist", get_tc_lib(), type);
-	f = fopen(name, "r");
-	if (f == NULL) {
-		fprintf(stderr, "No distribution data for %s (%s: %s)\n",
-			type, name, strerror(errno));
-		return -1;
-	}
 
 	n = 0;
 	while (getline(&line, &len, f) != -1) {
@@ -162,10 +171,131 @@ static int get_distribution(const char *type, __s16 *data, int maxdata)
 	}
  error:
 	free(line);
-	fclose(f);
 	return n;
 }
 
+/* Map a binary table, see include/netem_dist.h */
+static int map_distribution(int fd, const char *name, off_t size,
+			    const __s16 **data)
+{
+	const struct netem_dist_hdr *hdr;
+	const __s16 *values;
+	void *map;
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	hdr = map;
+	if (hdr->version != NETEM_DIST_VERSION ||
+	    hdr->hdrlen < sizeof(*hdr) || hdr->hdrlen % sizeof(__s16) ||
+	    hdr->count == 0 || hdr->count > MAX_DIST ||
+	    size != hdr->hdrlen + (off_t)hdr->count * sizeof(__s16)) {
+		fprintf(stderr, "%s: bad distribution table header\n", name);
+		goto err;
+	}
+
+	values = map + hdr->hdrlen;
+	if (netem_dist_csum(values, hdr->count) != hdr->csum) {
+		fprintf(stderr, "%s: distribution table checksum mismatch\n",
+			name);
+		goto err;
+	}
+	*data = values;
+	return hdr->count;
+err:
+	munmap(map, size);
+	return -1;
+}
+
+/*
+ * Load a table, either binary, recognised by its magic, or text. With
+ * @quiet a missing file is not reported.
+ */
+static const struct netem_dist *load_distribution(const char *name,
+						  bool quiet)
+{
+	struct netem_dist *d;
+	struct stat st;
+	__u32 magic = 0;
+	__s16 *data;
+	FILE *f;
+	int fd;
+
+	for (d = netem_dists; d; d = d->next)
+		if (strcmp(d->path, name) == 0)
+			return d;
+
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (!quiet || errno != ENOENT)
+			fprintf(stderr, "No distribution data in %s: %s\n",
+				name, strerror(errno));
+		return NULL;
+	}
+
+	d = calloc(1, sizeof(*d));
+	if (!d || !(d->path = strdup(name)))
+		goto err;
+
+	if (fstat(fd, &st) == 0 && st.st_size >= sizeof(struct netem_dist_hdr) &&
+	    pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+	    magic == NETEM_DIST_MAGIC) {
+		d->size = map_distribution(fd, name, st.st_size, &d->data);
+		close(fd);
+	} else if (magic == __builtin_bswap32(NETEM_DIST_MAGIC)) {
+		fprintf(stderr, "%s: distribution table of other byte order\n",
+			name);
+		goto err;
+	} else {
+		data = calloc(MAX_DIST, sizeof(data[0]));
+		f = data ? fdopen(fd, "r") : NULL;
+		if (!f) {
+			free(data);
+			goto err;
+		}
+		d->size = parse_distribution(f, name, data, MAX_DIST);
+		fclose(f);
+		if (d->size <= 0)
+			free(data);
+		else
+			d->data = data;
+	}
+	if (d->size <= 0) {
+		free(d->path);
+		free(d);
+		return NULL;
+	}
+
+	d->next = netem_dists;
+	netem_dists = d;
+	return d;
+
+err:
+	close(fd);
+	if (d)
+		free(d->path);
+	free(d);
+	return NULL;
+}
+
+/* A named table, as installed: NAME.distb if present, else NAME.dist */
+static const struct netem_dist *get_distribution(const char *type)
+{
+	const struct netem_dist *d;
+	char name[128];
+
+	snprintf(name, sizeof(name), "%s/%s.distb", get_tc_lib(), type);
+	d = load_distribution(name, true);
+	if (d)
+		return d;
+
+	snprintf(name, sizeof(name), "%s/%s.dist", get_tc_lib(), type);
+	return load_distribution(name, false);
+}
+
 #define NEXT_IS_NUMBER() (NEXT_ARG_OK() && isdigit(argv[1][0]))
 #define NEXT_IS_SIGNED_NUMBER() \
 	(NEXT_ARG_OK() && (isdigit(argv[1][0]) || argv[1][0] == '-'))
@@ -174,8 +304,6 @@ static int get_distribution(const char *type, __s16 *data, int maxdata)
 static int netem_parse_opt(const struct qdisc_util *qu, int argc, char **argv,
 			   struct nlmsghdr *n, const char *dev)
 {
-	int dist_size = 0;
-	int slot_dist_size = 0;
 	struct rtattr *tail;
 	struct tc_netem_qopt opt = { .limit = 1000 };
 	struct tc_netem_corr cor = {};
@@ -185,8 +313,8 @@ static int netem_parse_opt(const struct qdisc_util *qu, int argc, char **argv,
 	struct tc_netem_gemodel gemodel;
 	struct tc_netem_rate rate = {};
 	struct tc_netem_slot slot = {};
-	__s16 *dist_data = NULL;
-	__s16 *slot_dist_data = NULL;
+	const struct netem_dist *dist = NULL;
+	const struct netem_dist *slot_dist = NULL;
 	__u16 loss_type = NETEM_LOSS_UNSPEC;
 	int present[__TCA_NETEM_MAX] = {};
 	__s64 latency64 = 0;
@@ -412,17 +540,16 @@ random_loss_model:
 					return -1;
 				}
 			}
-		} else if (matches(*argv, "distribution") == 0) {
+		} else if (strcmp(*argv, "distribution-file") == 0) {
 			NEXT_ARG();
-			dist_data = calloc(MAX_DIST, sizeof(dist_data[0]));
-			if (dist_data == NULL)
+			dist = load_distribution(*argv, false);
+			if (!dist)
 				return -1;
-
-			dist_size = get_distribution(*argv, dist_data, MAX_DIST);
-			if (dist_size <= 0) {
-				free(dist_data);
+		} else if (matches(*argv, "distribution") == 0) {
+			NEXT_ARG();
+			dist = get_distribution(*argv);
+			if (!dist)
 				return -1;
-			}
 		} else if (matches(*argv, "rate") == 0) {
 			++present[TCA_NETEM_RATE];
 			NEXT_ARG();
@@ -476,17 +603,16 @@ random_loss_model:
 				}
 			} else {
 				NEXT_ARG();
-				if (strcmp(*argv, "distribution") == 0) {
+				bool file = strcmp(*argv, "distribution-file") == 0;
+
+				if (file || strcmp(*argv, "distribution") == 0) {
 					present[TCA_NETEM_SLOT] = 1;
 					NEXT_ARG();
-					slot_dist_data = calloc(MAX_DIST, sizeof(slot_dist_data[0]));
-					if (!slot_dist_data)
-						return -1;
-					slot_dist_size = get_distribution(*argv, slot_dist_data, MAX_DIST);
-					if (slot_dist_size <= 0) {
-						free(slot_dist_data);
+					slot_dist = file ?
+						load_distribution(*argv, false) :
+						get_distribution(*argv);
+					if (!slot_dist)
 						return -1;
-					}
 					NEXT_ARG();
 					if (get_time64(&slot.dist_delay, *argv)) {
 						explain1("slot delay");
@@ -562,7 +688,7 @@ random_loss_model:
 		}
 	}
 
-	if (dist_data && (latency64 == 0 || jitter64 == 0)) {
+	if (dist && (latency64 == 0 || jitter64 == 0)) {
 		fprintf(stderr, "distribution specified but no latency and jitter values\n");
 		explain();
 		return -1;
@@ -639,20 +765,19 @@ random_loss_model:
 		return -1;
 
 
-	if (dist_data) {
-		if (addattr_l(n, MAX_DIST * sizeof(dist_data[0]),
+	if (dist) {
+		if (addattr_l(n, MAX_DIST * sizeof(dist->data[0]),
 			      TCA_NETEM_DELAY_DIST,
-			      dist_data, dist_size * sizeof(dist_data[0])) < 0)
+			      dist->data, dist->size * sizeof(dist->data[0])) < 0)
 			return -1;
-		free(dist_data);
 	}
 
-	if (slot_dist_data) {
-		if (addattr_l(n, MAX_DIST * sizeof(slot_dist_data[0]),
+	if (slot_dist) {
+		if (addattr_l(n, MAX_DIST * sizeof(slot_dist->data[0]),
 			      TCA_NETEM_SLOT_DIST,
-			      slot_dist_data, slot_dist_size * sizeof(slot_dist_data[0])) < 0)
+			      slot_dist->data,
+			      slot_dist->size * sizeof(slot_dist->data[0])) < 0)
 			return -1;
-		free(slot_dist_data);
 	}
 	tail->rta_len = (void *) NLMSG_TAIL(n) - (void *) tail;
 	return 0;
@@ -11,24 +11,35 @@
 #include <unistd.h>
 #include <syslog.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <linux/if_ether.h>
 
 #include "utils.h"
+#include "rtnl_bulk.h"
 #include "tc_util.h"
-#include "list.h"
 
 struct sched_entry {
-	struct list_head list;
-	uint32_t index;
 	uint32_t interval;
 	uint32_t gatemask;
 	uint8_t cmd;
+	unsigned int line;	/* in the sched-file, 0 on the command line */
 };
 
+struct sched_list {
+	struct sched_entry *entries;
+	unsigned int count;
+	unsigned int size;
+};
+
+/* Preamble, start of frame delimiter and inter-frame gap */
+#define TAPRIO_WIRE_OVERHEAD	20
+
 static void explain(void)
 {
 	fprintf(stderr,
@@ -36,6 +47,7 @@ static void explain(void)
 		"		[num_tc NUMBER] [map P0 P1 ...]\n"
 		"		[queues COUNT@OFFSET COUNT@OFFSET COUNT@OFFSET ...]\n"
 		"		[ [sched-entry index cmd gate-mask interval] ... ]\n"
+		"		[sched-file FILE]\n"
 		"		[base-time time] [txtime-delay delay]\n"
 		"		[fp FP0 FP1 FP2 ...]\n"
 		"\n"
@@ -74,18 +86,20 @@ static int str_to_entry_cmd(const char *str)
 	return -1;
 }
 
-static int add_sched_list(struct list_head *sched_entries, struct nlmsghdr *n)
+static int add_sched_list(const struct sched_list *sched, struct nlmsghdr *n)
 {
-	struct sched_entry *e;
+	unsigned int i;
 
-	list_for_each_entry(e, sched_entries, list) {
+	for (i = 0; i < sched->count; i++) {
+		const struct sched_entry *e = &sched->entries[i];
 		struct rtattr *a;
 
-		a = addattr_nest(n, 1024, TCA_TAPRIO_SCHED_ENTRY);
+		a = addattr_nest(n, MAX_MSG, TCA_TAPRIO_SCHED_ENTRY);
 
-		addattr_l(n, 1024, TCA_TAPRIO_SCHED_ENTRY_CMD, &e->cmd, sizeof(e->cmd));
-		addattr_l(n, 1024, TCA_TAPRIO_SCHED_ENTRY_GATE_MASK, &e->gatemask, sizeof(e->gatemask));
-		addattr_l(n, 1024, TCA_TAPRIO_SCHED_ENTRY_INTERVAL, &e->interval, sizeof(e->interval));
+		if (addattr_l(n, MAX_MSG, TCA_TAPRIO_SCHED_ENTRY_CMD, &e->cmd, sizeof(e->cmd)) ||
+		    addattr_l(n, MAX_MSG, TCA_TAPRIO_SCHED_ENTRY_GATE_MASK, &e->gatemask, sizeof(e->gatemask)) ||
+		    addattr_l(n, MAX_MSG, TCA_TAPRIO_SCHED_ENTRY_INTERVAL, &e->interval, sizeof(e->interval)))
+			return -1;
 
 		addattr_nest_end(n, a);
 	}
@@ -98,19 +112,284 @@ static void explain_sched_entry(void)
 	fprintf(stderr, "Usage: ... taprio ... sched-entry <cmd> <gate mask> <interval>\n");
 }
 
-static struct sched_entry *create_entry(uint32_t gatemask, uint32_t interval, uint8_t cmd)
+static int sched_list_add(struct sched_list *sched, uint8_t cmd,
+			  uint32_t gatemask, uint32_t interval, unsigned int line)
 {
 	struct sched_entry *e;
 
-	e = calloc(1, sizeof(*e));
-	if (!e)
-		return NULL;
+	if (sched->count == sched->size) {
+		unsigned int size = sched->size ? sched->size * 2 : 64;
 
+		e = realloc(sched->entries, size * sizeof(*e));
+		if (!e)
+			return -1;
+		sched->entries = e;
+		sched->size = size;
+	}
+
+	e = &sched->entries[sched->count++];
 	e->gatemask = gatemask;
 	e->interval = interval;
 	e->cmd = cmd;
+	e->line = line;
+
+	return 0;
+}
+
+/*
+ * Fold runs of entries with the same command and gate mask into one.
+ * The gates do not change at the boundaries in between, so this keeps
+ * the schedule and only shortens the list the kernel walks. The first
+ * and the last entry are not folded across the end of the cycle, that
+ * would move the start of the schedule against base-time.
+ */
+static void sched_list_merge(struct sched_list *sched)
+{
+	unsigned int i, out = 0;
+
+	for (i = 0; i < sched->count; i++) {
+		struct sched_entry *e = &sched->entries[i];
+		struct sched_entry *prev = out ? &sched->entries[out - 1] : NULL;
 
-	return e;
+		if (prev && prev->cmd == e->cmd && prev->gatemask == e->gatemask &&
+		    prev->interval <= UINT32_MAX - e->interval) {
+			prev->interval += e->interval;
+			continue;
+		}
+		sched->entries[out++] = *e;
+	}
+	sched->count = out;
+}
+
+static void sched_entry_error(const char *file, const struct sched_entry *e,
+			      unsigned int idx)
+{
+	if (e->line)
+		fprintf(stderr, "%s:%u: ",
+			strcmp(file, "-") ? file : "stdin", e->line);
+	else
+		fprintf(stderr, "taprio: sched-entry %u: ", idx);
+}
+
+static int taprio_read_sched(const char *file, struct sched_list *sched)
+{
+	struct rtnl_bulk b = { .file = file };
+	unsigned int lineno = 0;
+	size_t len = 0;
+	char *line = NULL;
+	FILE *fp;
+
+	fp = rtnl_bulk_open(&b);
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) != -1) {
+		char *argv[4];
+		uint32_t mask, interval;
+		int argc, cmd;
+
+		lineno++;
+		argc = rtnl_bulk_tokens(line, argv, ARRAY_SIZE(argv));
+		if (argc == 0)
+			continue;
+
+		/* lines may be copied from a command line as they are */
+		if (argc <= ARRAY_SIZE(argv) &&
+		    strcmp(argv[0], "sched-entry") == 0)
+			memmove(argv, argv + 1, --argc * sizeof(*argv));
+
+		if (argc != 3 || (cmd = str_to_entry_cmd(argv[0])) < 0 ||
+		    get_u32(&mask, argv[1], 16) || get_u32(&interval, argv[2], 0)) {
+			rtnl_bulk_line_error(&b, lineno,
+					     "expected \"<cmd> <gate mask> <interval>\"");
+			goto err;
+		}
+		if (!interval) {
+			rtnl_bulk_line_error(&b, lineno,
+					     "interval must not be 0");
+			goto err;
+		}
+		if (sched_list_add(sched, cmd, mask, interval, lineno)) {
+			fprintf(stderr, "taprio: not enough memory for the schedule\n");
+			goto err;
+		}
+	}
+	if (ferror(fp)) {
+		fprintf(stderr, "taprio: cannot read \"%s\": %s\n",
+			b.file, strerror(errno));
+		goto err;
+	}
+	if (!sched->count) {
+		fprintf(stderr, "taprio: %s: empty schedule\n", b.file);
+		goto err;
+	}
+
+	free(line);
+	rtnl_bulk_close(fp);
+	return 0;
+
+err:
+	free(line);
+	rtnl_bulk_close(fp);
+	free(sched->entries);
+	memset(sched, 0, sizeof(*sched));
+	return -1;
+}
+
+/*
+ * The last schedule file read, merged. Batch files that put the same
+ * schedule on many ports read and fold it only once.
+ */
+static struct {
+	char		*file;
+	struct stat	st;
+	struct sched_list sched;
+} sched_file_cache;
+
+static const struct sched_list *taprio_get_sched_file(const char *file)
+{
+	struct sched_list sched = {};
+	struct stat st;
+	bool cache;
+
+	cache = strcmp(file, "-") && stat(file, &st) == 0;
+	if (cache && sched_file_cache.file &&
+	    strcmp(sched_file_cache.file, file) == 0 &&
+	    sched_file_cache.st.st_dev == st.st_dev &&
+	    sched_file_cache.st.st_ino == st.st_ino &&
+	    sched_file_cache.st.st_size == st.st_size &&
+	    sched_file_cache.st.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+	    sched_file_cache.st.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+		return &sched_file_cache.sched;
+
+	if (taprio_read_sched(file, &sched))
+		return NULL;
+	sched_list_merge(&sched);
+
+	free(sched_file_cache.file);
+	free(sched_file_cache.sched.entries);
+	sched_file_cache.file = cache ? strdup(file) : NULL;
+	sched_file_cache.st = st;
+	sched_file_cache.sched = sched;
+	return &sched_file_cache.sched;
+}
+
+/* in Mbit/s, 0 if unknown */
+static unsigned int taprio_link_speed(const char *dev)
+{
+	char path[64 + IFNAMSIZ], buf[32];
+	int fd, len, speed;
+
+	if (!dev)
+		return 0;
+	snprintf(path, sizeof(path), "/sys/class/net/%s/speed", dev);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+	speed = atoi(buf);
+	return speed > 0 ? speed : 0;
+}
+
+/*
+ * Longest time the gate of @tc stays open, also across the end of the
+ * cycle into the next one. UINT64_MAX if it never closes.
+ */
+static uint64_t sched_gate_window(const struct sched_list *sched, int tc)
+{
+	uint64_t run = 0, longest = 0;
+	unsigned int i;
+	bool closed = false;
+
+	for (i = 0; i < 2 * sched->count; i++) {
+		const struct sched_entry *e = &sched->entries[i % sched->count];
+
+		if (e->gatemask & (1U << tc)) {
+			run += e->interval;
+			if (run > longest)
+				longest = run;
+		} else {
+			closed = true;
+			run = 0;
+		}
+	}
+	return closed ? longest : UINT64_MAX;
+}
+
+/*
+ * Check a schedule file against the rest of the configuration before it
+ * goes to the kernel: the cycle has to hold all of the entries, gates may
+ * only open for traffic classes that exist, and a frame of max-sdu bytes
+ * has to fit the longest window of its traffic class, or it is never sent.
+ */
+static int taprio_check_sched(const char *file, const struct sched_list *sched,
+			      const struct tc_mqprio_qopt *opt, __s64 cycle_time,
+			      const __u32 max_sdu[TC_QOPT_MAX_QUEUE],
+			      int num_max_sdu_entries, const char *dev)
+{
+	uint32_t tc_mask = opt->num_tc ? (1U << opt->num_tc) - 1 : ~0U;
+	uint32_t opened = 0;
+	unsigned int i, speed;
+	uint64_t total = 0;
+	int tc;
+
+	for (i = 0; i < sched->count; i++) {
+		const struct sched_entry *e = &sched->entries[i];
+
+		if (e->gatemask & ~tc_mask) {
+			sched_entry_error(file, e, i);
+			fprintf(stderr, "gate mask %#x opens gates beyond num_tc %u\n",
+				e->gatemask, opt->num_tc);
+			return -1;
+		}
+		opened |= e->gatemask;
+		total += e->interval;
+	}
+
+	if (cycle_time && total > cycle_time) {
+		fprintf(stderr,
+			"taprio: the schedule takes %" PRIu64 " ns, longer than cycle-time %lld\n",
+			total, (long long)cycle_time);
+		return -1;
+	}
+
+	for (tc = 0; tc < opt->num_tc; tc++) {
+		if (!(opened & (1U << tc)))
+			fprintf(stderr,
+				"taprio: warning: the gate of traffic class %d never opens\n",
+				tc);
+	}
+
+	speed = taprio_link_speed(dev);
+	if (!speed)
+		return 0;
+
+	for (tc = 0; tc < num_max_sdu_entries; tc++) {
+		uint64_t window, frame;
+
+		if (!max_sdu[tc] || (opt->num_tc && tc >= opt->num_tc))
+			continue;
+		window = sched_gate_window(sched, tc);
+		if (window == UINT64_MAX || !window)
+			continue;
+		if (cycle_time && window > cycle_time)
+			window = cycle_time;
+
+		/* bytes a window carries at @speed Mbit/s: ns * speed / 8000 */
+		frame = max_sdu[tc] + ETH_HLEN + ETH_FCS_LEN + TAPRIO_WIRE_OVERHEAD;
+		if (frame * 8000 > window * speed) {
+			fprintf(stderr,
+				"taprio: max-sdu %u of traffic class %d does not fit its longest gate window of %" PRIu64 " ns at %u Mbit/s\n",
+				max_sdu[tc], tc, window, speed);
+			return -1;
+		}
+	}
+
+	return 0;
 }
 
 static void add_tc_entries(struct nlmsghdr *n, __u32 max_sdu[TC_QOPT_MAX_QUEUE],
@@ -150,7 +429,8 @@ static int taprio_parse_opt(const struct qdisc_util *qu, int argc,
 	__s32 clockid = CLOCKID_INVALID;
 	struct tc_mqprio_qopt opt = { };
 	__s64 cycle_time_extension = 0;
-	struct list_head sched_entries;
+	const struct sched_list *sched = NULL;
+	struct sched_list cmdline = {};
 	bool have_tc_entries = false;
 	int num_max_sdu_entries = 0;
 	struct rtattr *tail, *l;
@@ -159,10 +439,9 @@ static int taprio_parse_opt(const struct qdisc_util *qu, int argc,
 	__u32 txtime_delay = 0;
 	__s64 cycle_time = 0;
 	__s64 base_time = 0;
+	char *file = NULL;
 	int err, idx;
 
-	INIT_LIST_HEAD(&sched_entries);
-
 	while (argc > 0) {
 		idx = 0;
 		if (strcmp(*argv, "num_tc") == 0) {
@@ -235,7 +514,6 @@ static int taprio_parse_opt(const struct qdisc_util *qu, int argc,
 			have_tc_entries = true;
 		} else if (strcmp(*argv, "sched-entry") == 0) {
 			uint32_t mask, interval;
-			struct sched_entry *e;
 			uint8_t cmd;
 
 			NEXT_ARG();
@@ -258,14 +536,18 @@ static int taprio_parse_opt(const struct qdisc_util *qu, int argc,
 				return -1;
 			}
 
-			e = create_entry(mask, interval, cmd);
-			if (!e) {
+			if (sched_list_add(&cmdline, cmd, mask, interval, 0)) {
 				fprintf(stderr, "taprio: not enough memory for new schedule entry\n");
 				return -1;
 			}
 
-			list_add_tail(&e->list, &sched_entries);
-
+		} else if (strcmp(*argv, "sched-file") == 0) {
+			NEXT_ARG();
+			if (file) {
+				fprintf(stderr, "taprio: duplicate \"sched-file\" specification\n");
+				return -1;
+			}
+			file = *argv;
 		} else if (strcmp(*argv, "base-time") == 0) {
 			NEXT_ARG();
 			if (get_s64(&base_time, *argv, 10)) {
@@ -337,6 +619,21 @@ static int taprio_parse_opt(const struct qdisc_util *qu, int argc,
 		argc--; argv++;
 	}
 
+	if (file) {
+		if (cmdline.count) {
+			fprintf(stderr, "taprio: \"sched-entry\" and \"sched-file\" are mutually exclusive\n");
+			return -1;
+		}
+		sched = taprio_get_sched_file(file);
+		if (!sched)
+			return -1;
+		if (taprio_check_sched(file, sched, &opt, cycle_time, max_sdu,
+				       num_max_sdu_entries, dev))
+			return -1;
+	} else {
+		sched = &cmdline;
+	}
+
 	tail = NLMSG_TAIL(n);
 	addattr_l(n, 1024, TCA_OPTIONS, NULL, 0);
 
@@ -368,7 +665,8 @@ static int taprio_parse_opt(const struct qdisc_util *qu, int argc,
 
 	l = addattr_nest(n, 1024, TCA_TAPRIO_ATTR_SCHED_ENTRY_LIST | NLA_F_NESTED);
 
-	err = add_sched_list(&sched_entries, n);
+	err = add_sched_list(sched, n);
+	free(cmdline.entries);
 	if (err < 0) {
 		fprintf(stderr, "Could not add schedule to netlink message\n");
 		return -1;
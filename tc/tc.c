@@ -9,12 +9,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <dlfcn.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "version.h"
 #include "utils.h"
@@ -23,6 +23,8 @@
 #include "namespace.h"
 #include "rt_names.h"
 #include "bpf_util.h"
+#include "nl_stats.h"
+#include "cmd_server.h"
 
 int show_stats;
 int show_details;
@@ -38,12 +40,12 @@ int oneline;
 int brief;
 
 int echo_request;
+int show_timing;
 
 static char *conf_file;
 
 struct rtnl_handle rth;
 
-static void *BODY;	/* cached handle dlopen(NULL) */
 static struct qdisc_util *qdisc_list;
 static struct filter_util *filter_list;
 
@@ -103,28 +105,16 @@ static int parse_nofopt(const struct filter_util *qu, char *fhandle,
 
 const struct qdisc_util *get_qdisc_kind(const char *str)
 {
-	void *dlh;
-	char buf[256];
+	char so[256], buf[256];
 	struct qdisc_util *q;
 
 	for (q = qdisc_list; q; q = q->next)
 		if (strcmp(q->id, str) == 0)
 			return q;
 
-	snprintf(buf, sizeof(buf), "%s/q_%s.so", get_tc_lib(), str);
-	dlh = dlopen(buf, RTLD_LAZY);
-	if (!dlh) {
-		/* look in current binary, only open once */
-		dlh = BODY;
-		if (dlh == NULL) {
-			dlh = BODY = dlopen(NULL, RTLD_LAZY);
-			if (dlh == NULL)
-				goto noexist;
-		}
-	}
-
+	snprintf(so, sizeof(so), "q_%s.so", str);
 	snprintf(buf, sizeof(buf), "%s_qdisc_util", str);
-	q = dlsym(dlh, buf);
+	q = get_tc_util(so, buf);
 	if (q == NULL)
 		goto noexist;
 
@@ -147,27 +137,16 @@ noexist:
 
 const struct filter_util *get_filter_kind(const char *str)
 {
-	void *dlh;
-	char buf[256];
+	char so[256], buf[256];
 	struct filter_util *q;
 
 	for (q = filter_list; q; q = q->next)
 		if (strcmp(q->id, str) == 0)
 			return q;
 
-	snprintf(buf, sizeof(buf), "%s/f_%s.so", get_tc_lib(), str);
-	dlh = dlopen(buf, RTLD_LAZY);
-	if (dlh == NULL) {
-		dlh = BODY;
-		if (dlh == NULL) {
-			dlh = BODY = dlopen(NULL, RTLD_LAZY);
-			if (dlh == NULL)
-				goto noexist;
-		}
-	}
-
+	snprintf(so, sizeof(so), "f_%s.so", str);
 	snprintf(buf, sizeof(buf), "%s_filter_util", str);
-	q = dlsym(dlh, buf);
+	q = get_tc_util(so, buf);
 	if (q == NULL)
 		goto noexist;
 
@@ -190,14 +169,20 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage:	tc [ OPTIONS ] OBJECT { COMMAND | help }\n"
-		"	tc [-force] -batch filename\n"
+		"	tc [-force] [-batch-async WINDOW] [-batch-jobs N [-batch-key KEY]]\n"
+		"	   -batch filename\n"
+		"	tc -server SOCKET\n"
+		"	tc -client SOCKET [ OPTIONS ] OBJECT { COMMAND | help }\n"
 		"where  OBJECT := { qdisc | class | filter | chain |\n"
-		"		    action | monitor | exec }\n"
+		"		    action | monitor | exec | ematch | pedit |\n"
+		"		    ct }\n"
 		"       OPTIONS := { -V[ersion] | -s[tatistics] | -d[etails] | -r[aw] |\n"
-		"		    -o[neline] | -j[son] | -p[retty] | -c[olor]\n"
+		"		    -o[neline] | -j[son] | -jsonl | -cbor | -p[retty] |\n"
+		"		    -c[olor]\n"
 		"		    -b[atch] [filename] | -n[etns] name | -N[umeric] |\n"
 		"		     -nm | -nam[es] | { -cf | -conf } path\n"
-		"		     -br[ief] | -echo }\n");
+		"		     -br[ief] | -echo | -stats-nl | -dump-pipeline |\n"
+		"		     -timing }\n");
 }
 
 static int do_cmd(int argc, char **argv)
@@ -216,6 +201,12 @@ static int do_cmd(int argc, char **argv)
 		return do_tcmonitor(argc-1, argv+1);
 	if (matches(*argv, "exec") == 0)
 		return do_exec(argc-1, argv+1);
+	if (strcmp(*argv, "ematch") == 0)
+		return do_ematch(argc-1, argv+1);
+	if (strcmp(*argv, "pedit") == 0)
+		return do_pedit(argc-1, argv+1);
+	if (strcmp(*argv, "ct") == 0)
+		return do_ct(argc-1, argv+1);
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
@@ -231,21 +222,52 @@ static int tc_batch_cmd(int argc, char *argv[], void *data)
 	return do_cmd(argc, argv);
 }
 
+static unsigned int batch_window;
+static unsigned int batch_jobs;
+static const char *batch_key = "dev";
+
+/* every batch worker talks to the kernel over its own socket */
+static int tc_batch_init(void *data)
+{
+	rtnl_close(&rth);
+	if (rtnl_open(&rth, 0) < 0) {
+		fprintf(stderr, "Cannot open rtnetlink\n");
+		return -1;
+	}
+	return 0;
+}
+
 static int batch(const char *name)
 {
+	struct timespec start;
 	int ret;
 
 	batch_mode = 1;
-	tc_core_init();
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	if (rtnl_open(&rth, 0) < 0) {
 		fprintf(stderr, "Cannot open rtnetlink\n");
 		return -1;
 	}
+	tc_timing("rtnl open", &start);
+
+	if (use_names && cls_names_init(conf_file)) {
+		rtnl_close(&rth);
+		return -1;
+	}
 
-	ret = do_batch(name, force, tc_batch_cmd, NULL);
+	if (batch_jobs > 1)
+		ret = do_batch_jobs(name, force, batch_jobs, batch_key,
+				    tc_batch_init, tc_batch_cmd, NULL);
+	else if (batch_window)
+		ret = do_batch_async(name, force, &rth, batch_window,
+				     tc_batch_cmd, NULL);
+	else
+		ret = do_batch(name, force, tc_batch_cmd, NULL);
 
 	rtnl_close(&rth);
+	if (use_names)
+		cls_names_uninit();
 	return ret;
 }
 
@@ -255,12 +277,26 @@ int main(int argc, char **argv)
 	const char *libbpf_version;
 	char *batch_file = NULL;
 	int color = default_color_opt();
+	struct timespec start, phase;
 	int ret;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (argc > 2 && strcmp(argv[1], "-client") == 0)
+		return cmd_client_run(argv[2], argv[0], argc - 3, argv + 3);
+	/* returns in the children forked for the commands only */
+	if (argc > 2 && strcmp(argv[1], "-server") == 0 &&
+	    cmd_server_run(argv[2], &argc, &argv))
+		return -1;
+
 	while (argc > 1) {
 		if (argv[1][0] != '-')
 			break;
-		if (matches(argv[1], "-stats") == 0 ||
+		if (strcmp(argv[1], "-stats-nl") == 0) {
+			nl_stats_enable(false);
+		} else if (strcmp(argv[1], "-dump-pipeline") == 0) {
+			rtnl_dump_set_pipeline(RTNL_PIPELINE_DEPTH);
+		} else if (matches(argv[1], "-stats") == 0 ||
 			 matches(argv[1], "-statistics") == 0) {
 			++show_stats;
 		} else if (matches(argv[1], "-details") == 0) {
@@ -290,6 +326,24 @@ int main(int argc, char **argv)
 			if (argc <= 1)
 				missarg("batch file");
 			batch_file = argv[1];
+		} else if (matches(argv[1], "-batch-async") == 0) {
+			argc--;	argv++;
+			if (argc <= 1)
+				missarg("batch window");
+			if (get_unsigned(&batch_window, argv[1], 0) ||
+			    !batch_window)
+				invarg("invalid batch window", argv[1]);
+		} else if (matches(argv[1], "-batch-jobs") == 0) {
+			argc--;	argv++;
+			if (argc <= 1)
+				missarg("batch jobs");
+			if (get_unsigned(&batch_jobs, argv[1], 0) || !batch_jobs)
+				invarg("invalid number of batch jobs", argv[1]);
+		} else if (matches(argv[1], "-batch-key") == 0) {
+			argc--;	argv++;
+			if (argc <= 1)
+				missarg("batch key");
+			batch_key = argv[1];
 		} else if (matches(argv[1], "-netns") == 0) {
 			NEXT_ARG();
 			if (netns_switch(argv[1]))
@@ -309,6 +363,12 @@ int main(int argc, char **argv)
 		} else if (matches(argv[1], "-tshort") == 0) {
 			++timestamp;
 			++timestamp_short;
+		} else if (strcmp(argv[1], "-jsonl") == 0) {
+			++json;
+			++json_lines;
+		} else if (strcmp(argv[1], "-cbor") == 0) {
+			++json;
+			++json_cbor;
 		} else if (matches(argv[1], "-json") == 0) {
 			++json;
 		} else if (matches(argv[1], "-oneline") == 0) {
@@ -317,6 +377,8 @@ int main(int argc, char **argv)
 			++brief;
 		} else if (strcmp(argv[1], "-echo") == 0) {
 			++echo_request;
+		} else if (strcmp(argv[1], "-timing") == 0) {
+			++show_timing;
 		} else {
 			fprintf(stderr,
 				"Option \"%s\" is unknown, try \"tc -help\".\n",
@@ -329,32 +391,43 @@ int main(int argc, char **argv)
 	_SL_ = oneline ? "\\" : "\n";
 
 	check_enable_color(color, json);
+	tc_timing("options", &start);
 
-	if (batch_file)
-		return batch(batch_file);
+	if (batch_file) {
+		ret = batch(batch_file);
+		tc_timing("total", &start);
+		return ret;
+	}
 
 	if (argc <= 1) {
 		usage();
 		return 0;
 	}
 
-	tc_core_init();
+	/* psched and the class names are read when first needed, and
+	 * timed on their own, as part of the command
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &phase);
 	if (rtnl_open(&rth, 0) < 0) {
 		fprintf(stderr, "Cannot open rtnetlink\n");
 		exit(1);
 	}
+	tc_timing("rtnl open", &phase);
 
 	if (use_names && cls_names_init(conf_file)) {
 		ret = -1;
 		goto Exit;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &phase);
 	ret = do_cmd(argc-1, argv+1);
+	tc_timing("command", &phase);
 Exit:
 	rtnl_close(&rth);
 
 	if (use_names)
 		cls_names_uninit();
 
+	tc_timing("total", &start);
 	return ret;
 }
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * tc_builtin.c		Lookup of qdisc, filter, action, ematch, pedit
+ *			and exec modules linked into tc.
+ *
+ * builtin-syms.h is generated at build time from the module sources
+ * and sorted, so resolving a kind is a binary search over the modules
+ * compiled in. As before, a plug-in in TC_LIB_DIR or else the default
+ * tc library directory still overrides the built-in module.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "utils.h"
+#include "tc_util.h"
+#include "m_ematch.h"
+#include "m_pedit.h"
+
+#define TC_BUILTIN(sym, type)	extern struct type sym;
+#include "builtin-syms.h"
+#undef TC_BUILTIN
+
+static const struct tc_builtin {
+	const char	*sym;
+	void		*util;
+} tc_builtins[] = {
+#define TC_BUILTIN(sym, type)	{ #sym, &sym },
+#include "builtin-syms.h"
+#undef TC_BUILTIN
+};
+
+static int tc_builtin_cmp(const void *key, const void *elem)
+{
+	const struct tc_builtin *b = elem;
+
+	return strcmp(key, b->sym);
+}
+
+/*
+ * Return the util named @sym, e.g. "htb_qdisc_util", from the plug-in
+ * @so in the tc library directory or else from the built-in table.
+ */
+void *get_tc_util(const char *so, const char *sym)
+{
+	const struct tc_builtin *b;
+#ifndef NO_SHARED_LIBS
+	char buf[256];
+	void *dlh;
+
+	snprintf(buf, sizeof(buf), "%s/%s", get_tc_lib(), so);
+	dlh = dlopen(buf, RTLD_LAZY | RTLD_GLOBAL);
+	if (dlh)
+		return dlsym(dlh, sym);
+#endif
+
+	b = bsearch(sym, tc_builtins, ARRAY_SIZE(tc_builtins),
+		    sizeof(tc_builtins[0]), tc_builtin_cmp);
+	return b ? b->util : NULL;
+}
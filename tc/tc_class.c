@@ -18,21 +18,29 @@
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_common.h"
-#include "list.h"
 
 struct graph_node {
-	struct hlist_node hlist;
+	struct graph_node *next;		/* in dump order */
+	struct graph_node *hash_next;
+	struct graph_node *parent_node;
+	struct graph_node *first_child;
+	struct graph_node *last_child;
+	struct graph_node *next_sibling;
+	int ifindex;
 	__u32 id;
 	__u32 parent_id;
-	struct graph_node *parent_node;
-	struct graph_node *right_node;
 	void *data;
 	int data_len;
 	int nodes_count;
+	/* rolled up from the leaves of the subtree */
+	unsigned int sub_leaves;
+	__u64 sub_bytes;
+	__u64 sub_drops;
+	__u64 sub_backlog;
 };
 
-static struct hlist_head cls_list = {};
-static struct hlist_head root_cls_list = {};
+static struct graph_node *cls_head, *cls_tail;
+static unsigned int cls_count;
 
 static void usage(void);
 
@@ -44,6 +52,7 @@ static void usage(void)
 		"       [ [ QDISC_KIND ] [ help | OPTIONS ] ]\n"
 		"\n"
 		"       tc class show [ dev STRING ] [ root | parent CLASSID ]\n"
+		"       [ estimate interval TIME [ ewma LOG ] [ count N ] ]\n"
 		"Where:\n"
 		"QDISC_KIND := { prio | etc. }\n"
 		"OPTIONS := ... try tc class add <desired QDISC_KIND> help\n");
@@ -136,7 +145,7 @@ static int tc_class_modify(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (d[0])  {
-		ll_init_map(&rth);
+		ll_init_map_lazy();
 
 		req.t.tcm_ifindex = ll_name_to_index(d);
 		if (!req.t.tcm_ifindex)
@@ -153,11 +162,19 @@ static int filter_ifindex;
 static __u32 filter_qdisc;
 static __u32 filter_classid;
 
-static void graph_node_add(__u32 parent_id, __u32 id, void *data,
-		int len)
+/* Classes for "tc -g class show" are collected in dump order and found
+ * by (ifindex, classid) through a hash, so the tree is linked in one
+ * pass once the dump is complete.
+ */
+static void graph_node_add(int ifindex, __u32 parent_id, __u32 id,
+			   void *data, int len)
 {
 	struct graph_node *node = calloc(1, sizeof(struct graph_node));
 
+	if (!node)
+		return;
+
+	node->ifindex    = ifindex;
 	node->id         = id;
 	node->parent_id  = parent_id;
 
@@ -167,92 +184,302 @@ static void graph_node_add(__u32 parent_id, __u32 id, void *data,
 		memcpy(node->data, data, len);
 	}
 
-	if (parent_id == TC_H_ROOT)
-		hlist_add_head(&node->hlist, &root_cls_list);
+	if (cls_tail)
+		cls_tail->next = node;
 	else
-		hlist_add_head(&node->hlist, &cls_list);
+		cls_head = node;
+	cls_tail = node;
+	cls_count++;
 }
 
-static void graph_indent(char *buf, struct graph_node *node, int is_newline,
-		int add_spaces)
+static unsigned int graph_hash(int ifindex, __u32 id)
 {
-	char spaces[100] = {0};
+	__u32 h = id ^ ((__u32)ifindex * 0x9e3779b1);
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return h;
+}
 
-	while (node && node->parent_node) {
-		node->parent_node->right_node = node;
-		node = node->parent_node;
+static struct graph_node *graph_lookup(struct graph_node **tbl,
+				       unsigned int mask, int ifindex, __u32 id)
+{
+	struct graph_node *n = tbl[graph_hash(ifindex, id) & mask];
+
+	while (n && (n->id != id || n->ifindex != ifindex))
+		n = n->hash_next;
+	return n;
+}
+
+/* Link every class to its parent; classes whose parent is not in the
+ * dump are left out, as they cannot be placed in the tree.
+ */
+static struct graph_node *graph_build(void)
+{
+	struct graph_node **tbl, *n, *roots = NULL;
+	unsigned int size = 16;
+
+	while (size < cls_count)
+		size <<= 1;
+	tbl = calloc(size, sizeof(*tbl));
+	if (!tbl)
+		return NULL;
+
+	for (n = cls_head; n; n = n->next) {
+		unsigned int h = graph_hash(n->ifindex, n->id) & (size - 1);
+
+		n->hash_next = tbl[h];
+		tbl[h] = n;
 	}
-	while (node && node->right_node) {
-		if (node->hlist.next)
-			strcat(buf, "|    ");
+
+	for (n = cls_head; n; n = n->next) {
+		struct graph_node *p;
+
+		if (n->parent_id == TC_H_ROOT) {
+			n->next_sibling = roots;
+			roots = n;
+			continue;
+		}
+		p = graph_lookup(tbl, size - 1, n->ifindex, n->parent_id);
+		if (!p || p == n)
+			continue;
+		n->parent_node = p;
+		if (p->last_child)
+			p->last_child->next_sibling = n;
 		else
-			strcat(buf, "     ");
+			p->first_child = n;
+		p->last_child = n;
+		p->nodes_count++;
+	}
+
+	free(tbl);
+	return roots;
+}
 
-		node = node->right_node;
+/* Next class in depth first order, with the change of depth; NULL at
+ * the end of the tree.
+ */
+static struct graph_node *graph_next(struct graph_node *n, int *depth)
+{
+	if (n->first_child) {
+		(*depth)++;
+		return n->first_child;
+	}
+	while (n && !n->next_sibling) {
+		n = n->parent_node;
+		(*depth)--;
+	}
+	return n ? n->next_sibling : NULL;
+}
+
+static void graph_node_stats(struct graph_node *n)
+{
+	struct rtattr *tb[TCA_MAX + 1];
+
+	parse_rtattr_flags(tb, TCA_MAX, (struct rtattr *)n->data,
+			   n->data_len, NLA_F_NESTED);
+
+	if (tb[TCA_STATS2]) {
+		struct rtattr *tbs[TCA_STATS_MAX + 1];
+
+		parse_rtattr_nested(tbs, TCA_STATS_MAX, tb[TCA_STATS2]);
+		if (tbs[TCA_STATS_BASIC]) {
+			struct gnet_stats_basic bs = {0};
+
+			memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC]),
+			       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]),
+				   sizeof(bs)));
+			n->sub_bytes = bs.bytes;
+		}
+		if (tbs[TCA_STATS_QUEUE]) {
+			struct gnet_stats_queue q = {0};
+
+			memcpy(&q, RTA_DATA(tbs[TCA_STATS_QUEUE]),
+			       MIN(RTA_PAYLOAD(tbs[TCA_STATS_QUEUE]),
+				   sizeof(q)));
+			n->sub_drops = q.drops;
+			n->sub_backlog = q.backlog;
+		}
+	} else if (tb[TCA_STATS]) {
+		struct tc_stats st = {};
+
+		memcpy(&st, RTA_DATA(tb[TCA_STATS]),
+		       MIN(RTA_PAYLOAD(tb[TCA_STATS]), sizeof(st)));
+		n->sub_bytes = st.bytes;
+		n->sub_drops = st.drops;
+		n->sub_backlog = st.backlog;
 	}
+}
+
+/* Roll the counters of the leaves up into every inner class. Children
+ * come after their parent in depth first order, so walking that order
+ * backwards sees each class complete before its parent.
+ */
+static void graph_rollup(struct graph_node *roots)
+{
+	struct graph_node **order, *n;
+	unsigned int i, cnt = 0;
+	int depth = 0;
+
+	order = malloc(cls_count * sizeof(*order));
+	if (!order)
+		return;
+
+	for (n = roots; n; n = graph_next(n, &depth))
+		order[cnt++] = n;
+
+	for (i = cnt; i-- > 0; ) {
+		struct graph_node *p;
+
+		n = order[i];
+		if (!n->first_child) {
+			graph_node_stats(n);
+			n->sub_leaves = 1;
+		}
+		p = n->parent_node;
+		if (p) {
+			p->sub_bytes += n->sub_bytes;
+			p->sub_drops += n->sub_drops;
+			p->sub_backlog += n->sub_backlog;
+			p->sub_leaves += n->sub_leaves;
+		}
+	}
+	free(order);
+}
+
+static char *graph_buf;
+static size_t graph_buf_len, graph_buf_size;
+
+static void graph_cat(const char *s)
+{
+	size_t len = strlen(s);
+
+	if (graph_buf_len + len + 1 > graph_buf_size) {
+		size_t size = graph_buf_size ? graph_buf_size : 1024;
+		char *buf;
+
+		while (graph_buf_len + len + 1 > size)
+			size *= 2;
+		buf = realloc(graph_buf, size);
+		if (!buf)
+			return;
+		graph_buf = buf;
+		graph_buf_size = size;
+	}
+	memcpy(graph_buf + graph_buf_len, s, len + 1);
+	graph_buf_len += len;
+}
+
+static void graph_clear(void)
+{
+	graph_buf_len = 0;
+	if (graph_buf)
+		graph_buf[0] = '\0';
+}
+
+static void graph_flush(FILE *fp)
+{
+	if (graph_buf_len)
+		fputs(graph_buf, fp);
+	graph_clear();
+}
+
+/* One "|    " or "     " per ancestor, by whether it has siblings
+ * left to print below; kept in step with the depth of the walk.
+ */
+static char *graph_prefix;
+static size_t graph_prefix_size;
+
+static void graph_set_depth(int depth)
+{
+	if (graph_prefix)
+		graph_prefix[5 * depth] = '\0';
+}
+
+static void graph_push(struct graph_node *node, int depth)
+{
+	size_t len = 5 * (size_t)depth;
+
+	if (len + 6 > graph_prefix_size) {
+		size_t size = graph_prefix_size ? 2 * graph_prefix_size : 128;
+		char *p;
+
+		while (len + 6 > size)
+			size *= 2;
+		p = realloc(graph_prefix, size);
+		if (!p)
+			return;
+		graph_prefix = p;
+		graph_prefix_size = size;
+	}
+	memcpy(graph_prefix + len,
+	       node->next_sibling ? "|    " : "     ", 6);
+}
+
+static void graph_indent(struct graph_node *node, int is_newline,
+			 int add_spaces)
+{
+	if (graph_prefix)
+		graph_cat(graph_prefix);
 
 	if (is_newline) {
-		if (node->hlist.next && node->nodes_count)
-			strcat(buf, "|    |");
-		else if (node->hlist.next)
-			strcat(buf, "|     ");
+		if (node->next_sibling && node->nodes_count)
+			graph_cat("|    |");
+		else if (node->next_sibling)
+			graph_cat("|     ");
 		else if (node->nodes_count)
-			strcat(buf, "     |");
-		else if (!node->hlist.next)
-			strcat(buf, "      ");
-	}
-	if (add_spaces > 0) {
-		sprintf(spaces, "%-*s", add_spaces, "");
-		strcat(buf, spaces);
+			graph_cat("     |");
+		else
+			graph_cat("      ");
 	}
+	while (add_spaces-- > 0)
+		graph_cat(" ");
 }
 
-static void graph_cls_show(FILE *fp, char *buf, struct hlist_head *root_list,
-		int level)
+static void graph_subtree_show(struct graph_node *cls)
 {
-	struct hlist_node *n, *tmp_cls;
-	char cls_id_str[256] = {};
+	print_string(PRINT_FP, NULL, "\n%s", graph_buf);
+	print_uint(PRINT_FP, NULL, "subtree: %u leaves", cls->sub_leaves);
+	print_lluint(PRINT_FP, NULL, " Sent %llu bytes", cls->sub_bytes);
+	print_lluint(PRINT_FP, NULL, " (dropped %llu)", cls->sub_drops);
+	print_size(PRINT_FP, NULL, " backlog %s", cls->sub_backlog);
+}
+
+static void graph_cls_show(FILE *fp)
+{
+	struct graph_node *cls, *roots, *next;
 	struct rtattr *tb[TCA_MAX + 1];
+	char cls_id_str[256] = {};
 	const struct qdisc_util *q;
 	char str[300] = {};
+	int depth = 0;
 
-	hlist_for_each_safe(n, tmp_cls, root_list) {
-		struct hlist_node *c, *tmp_chld;
-		struct hlist_head children = {};
-		struct graph_node *cls = container_of(n, struct graph_node,
-				hlist);
-
-		hlist_for_each_safe(c, tmp_chld, &cls_list) {
-			struct graph_node *child = container_of(c,
-					struct graph_node, hlist);
-
-			if (cls->id == child->parent_id) {
-				hlist_del(c);
-				hlist_add_head(c, &children);
-				cls->nodes_count++;
-				child->parent_node = cls;
-			}
-		}
+	roots = graph_build();
+	if (show_stats && show_details)
+		graph_rollup(roots);
+
+	for (cls = roots; cls; cls = next) {
+		int next_depth = depth;
 
-		graph_indent(buf, cls, 0, 0);
+		graph_indent(cls, 0, 0);
 
 		print_tc_classid(cls_id_str, sizeof(cls_id_str), cls->id);
 		snprintf(str, sizeof(str),
 			 "+---(%s)", cls_id_str);
-		strcat(buf, str);
+		graph_cat(str);
 
 		parse_rtattr_flags(tb, TCA_MAX, (struct rtattr *)cls->data,
 				   cls->data_len, NLA_F_NESTED);
 
 		if (tb[TCA_KIND] == NULL) {
-			strcat(buf, " [unknown qdisc kind] ");
+			graph_cat(" [unknown qdisc kind] ");
 		} else {
 			const char *kind = rta_getattr_str(tb[TCA_KIND]);
 
-			sprintf(str, " %s ", kind);
-			strcat(buf, str);
-			fprintf(fp, "%s", buf);
-			buf[0] = '\0';
+			snprintf(str, sizeof(str), " %s ", kind);
+			graph_cat(str);
+			graph_flush(fp);
 
 			q = get_qdisc_kind(kind);
 			if (q && q->print_copt) {
@@ -263,33 +490,64 @@ static void graph_cls_show(FILE *fp, char *buf, struct hlist_head *root_list,
 					strlen(cls_id_str);
 				struct rtattr *stats = NULL;
 
-				graph_indent(buf, cls, 1, cls_indent);
+				graph_indent(cls, 1, cls_indent);
 
 				if (tb[TCA_STATS] || tb[TCA_STATS2]) {
 					fprintf(fp, "\n");
-					print_tcstats_attr(fp, tb, buf, &stats);
-					buf[0] = '\0';
+					print_tcstats_attr(fp, tb, graph_buf,
+							   &stats);
+					if (cls->nodes_count && show_details)
+						graph_subtree_show(cls);
+					graph_clear();
 				}
-				if (cls->hlist.next || cls->nodes_count) {
-					strcat(buf, "\n");
-					graph_indent(buf, cls, 1, 0);
+				if (cls->next_sibling || cls->nodes_count) {
+					graph_cat("\n");
+					graph_indent(cls, 1, 0);
 				}
 			}
 		}
-		free(cls->data);
-		fprintf(fp, "%s\n", buf);
-		buf[0] = '\0';
-
-		graph_cls_show(fp, buf, &children, level + 1);
-		if (!cls->hlist.next) {
-			graph_indent(buf, cls, 0, 0);
-			strcat(buf, "\n");
+		graph_cat("\n");
+		graph_flush(fp);
+
+		next = graph_next(cls, &next_depth);
+
+		/* A leaf ends every subtree it is the last class of, and
+		 * each last sibling is followed by a line of indentation,
+		 * with a blank column for every level down to the leaf.
+		 */
+		if (!cls->first_child) {
+			struct graph_node *n = cls;
+			int d = depth;
+
+			while (n && !n->next_sibling) {
+				graph_set_depth(d);
+				graph_indent(n, 0, 5 * (depth - d));
+				graph_cat("\n");
+				graph_flush(fp);
+				n = n->parent_node;
+				d--;
+			}
 		}
+		if (next_depth > depth)
+			graph_push(cls, depth);
+		else
+			graph_set_depth(next_depth);
+		depth = next_depth;
+	}
 
-		fprintf(fp, "%s", buf);
-		buf[0] = '\0';
+	for (cls = cls_head; cls; cls = next) {
+		next = cls->next;
+		free(cls->data);
 		free(cls);
 	}
+	cls_head = cls_tail = NULL;
+	cls_count = 0;
+	free(graph_buf);
+	graph_buf = NULL;
+	graph_buf_len = graph_buf_size = 0;
+	free(graph_prefix);
+	graph_prefix = NULL;
+	graph_prefix_size = 0;
 }
 
 int print_class(struct nlmsghdr *n, void *arg)
@@ -312,7 +570,8 @@ int print_class(struct nlmsghdr *n, void *arg)
 	}
 
 	if (show_graph) {
-		graph_node_add(t->tcm_parent, t->tcm_handle, TCA_RTA(t), len);
+		graph_node_add(t->tcm_ifindex, t->tcm_parent, t->tcm_handle,
+			       TCA_RTA(t), len);
 		return 0;
 	}
 
@@ -385,11 +644,220 @@ int print_class(struct nlmsghdr *n, void *arg)
 }
 
 
+/*
+ * Rates estimated in userspace for "show ... estimate interval": the
+ * previous counters are kept per class, so kernel estimators can stay
+ * off on large class sets and the cost is one dump per interval.
+ */
+struct cls_est {
+	int	ifindex;	/* 0 marks a free slot */
+	__u32	handle;
+	__u32	seen;		/* round the class was last dumped in */
+	bool	rated;
+	__u64	bytes;
+	__u64	packets;
+	double	bps;
+	double	pps;
+};
+
+struct cls_est_tab {
+	struct cls_est	*slot;
+	unsigned int	size;	/* power of two */
+	unsigned int	used;
+	unsigned int	ewma_log;
+	__u32		round;
+	double		elapsed; /* seconds since the previous dump */
+};
+
+static struct cls_est *cls_est_slot(struct cls_est_tab *tab, int ifindex,
+				    __u32 handle)
+{
+	unsigned int i = ((ifindex * 31U) ^ handle) * 2654435761U;
+
+	for (i &= tab->size - 1; tab->slot[i].ifindex; i = (i + 1) & (tab->size - 1))
+		if (tab->slot[i].ifindex == ifindex &&
+		    tab->slot[i].handle == handle)
+			break;
+	return &tab->slot[i];
+}
+
+static struct cls_est *cls_est_get(struct cls_est_tab *tab, int ifindex,
+				   __u32 handle)
+{
+	struct cls_est *c;
+
+	if (2 * (tab->used + 1) > tab->size) {
+		struct cls_est *old = tab->slot;
+		unsigned int i, size = tab->size;
+
+		tab->size = size ? 2 * size : 1024;
+		tab->slot = calloc(tab->size, sizeof(*tab->slot));
+		if (!tab->slot) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		for (i = 0; i < size; i++)
+			if (old[i].ifindex)
+				*cls_est_slot(tab, old[i].ifindex,
+					      old[i].handle) = old[i];
+		free(old);
+	}
+
+	c = cls_est_slot(tab, ifindex, handle);
+	if (!c->ifindex) {
+		c->ifindex = ifindex;
+		c->handle = handle;
+		tab->used++;
+	}
+	return c;
+}
+
+/* Only the basic counters are looked at, the kind is never resolved */
+static bool cls_est_counters(struct rtattr *tb[], __u64 *bytes,
+			     __u64 *packets)
+{
+	if (tb[TCA_STATS2]) {
+		struct rtattr *tbs[TCA_STATS_MAX + 1];
+		struct gnet_stats_basic bs = {0};
+
+		parse_rtattr_nested(tbs, TCA_STATS_MAX, tb[TCA_STATS2]);
+		if (!tbs[TCA_STATS_BASIC])
+			return false;
+		memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC]),
+		       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]), sizeof(bs)));
+		*bytes = bs.bytes;
+		*packets = bs.packets;
+		/* the first PKT64 follows BASIC and carries the full count */
+		if (tbs[TCA_STATS_PKT64])
+			*packets = rta_getattr_u64(tbs[TCA_STATS_PKT64]);
+		return true;
+	}
+	if (tb[TCA_STATS]) {
+		struct tc_stats st = {};
+
+		memcpy(&st, RTA_DATA(tb[TCA_STATS]),
+		       MIN(RTA_PAYLOAD(tb[TCA_STATS]), sizeof(st)));
+		*bytes = st.bytes;
+		*packets = st.packets;
+		return true;
+	}
+	return false;
+}
+
+static void print_cls_est(const struct cls_est *c)
+{
+	char abuf[256];
+
+	open_json_object(NULL);
+	if (filter_qdisc)
+		print_tc_classid(abuf, sizeof(abuf), TC_H_MIN(c->handle));
+	else
+		print_tc_classid(abuf, sizeof(abuf), c->handle);
+	print_string(PRINT_ANY, "handle", "class %s ", abuf);
+	if (filter_ifindex == 0)
+		print_devname(PRINT_ANY, c->ifindex);
+	print_lluint(PRINT_JSON, "rate", NULL, (__u64)c->bps);
+	tc_print_rate(PRINT_FP, NULL, "rate %s", (__u64)c->bps);
+	print_lluint(PRINT_ANY, "pps", " %llupps", (__u64)c->pps);
+	close_json_object();
+	print_nl();
+}
+
+static int print_class_est(struct nlmsghdr *n, void *arg)
+{
+	struct cls_est_tab *tab = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+	__u64 bytes, packets;
+	struct cls_est *c;
+
+	if (n->nlmsg_type != RTM_NEWTCLASS)
+		return 0;
+	if (len < 0) {
+		fprintf(stderr, "Wrong len %d\n", len);
+		return -1;
+	}
+	if (filter_qdisc && TC_H_MAJ(t->tcm_handle ^ filter_qdisc))
+		return 0;
+	if (filter_classid && t->tcm_handle != filter_classid)
+		return 0;
+
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len, NLA_F_NESTED);
+	if (!cls_est_counters(tb, &bytes, &packets))
+		return 0;
+
+	c = cls_est_get(tab, t->tcm_ifindex, t->tcm_handle);
+	if (c->seen && c->seen + 1 == tab->round &&
+	    bytes >= c->bytes && packets >= c->packets) {
+		double bps = (bytes - c->bytes) / tab->elapsed;
+		double pps = (packets - c->packets) / tab->elapsed;
+
+		if (c->rated) {
+			c->bps += (bps - c->bps) / (1U << tab->ewma_log);
+			c->pps += (pps - c->pps) / (1U << tab->ewma_log);
+		} else {
+			c->bps = bps;
+			c->pps = pps;
+			c->rated = true;
+		}
+		print_cls_est(c);
+	} else {
+		/* new, recreated or missed classes only set the baseline */
+		c->rated = false;
+	}
+	c->bytes = bytes;
+	c->packets = packets;
+	c->seen = tab->round;
+	return 0;
+}
+
+static int tc_class_estimate(struct tcmsg *t, unsigned int interval,
+			     unsigned int ewma_log, __u32 count)
+{
+	struct cls_est_tab tab = { .ewma_log = ewma_log };
+	double last = 0, now, next = monotonic_now();
+	int ret;
+
+	for (;;) {
+		if (rtnl_dump_request(&rth, RTM_GETTCLASS, t, sizeof(*t)) < 0) {
+			perror("Cannot send dump request");
+			ret = 1;
+			break;
+		}
+		now = monotonic_now();
+		tab.elapsed = now - last;
+		tab.round++;
+		/* the first dump only sets the baseline */
+		if (tab.round > 1)
+			new_json_obj(json);
+		ret = rtnl_dump_filter(&rth, print_class_est, &tab);
+		if (tab.round > 1)
+			delete_json_obj();
+		fflush(stdout);
+		if (ret < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = 1;
+			break;
+		}
+		if (count && tab.round > count)
+			break;
+		last = now;
+		next += interval / 1e6;
+		monotonic_sleep_until(next);
+	}
+
+	free(tab.slot);
+	return ret;
+}
+
 static int tc_class_list(int argc, char **argv)
 {
 	struct tcmsg t = { .tcm_family = AF_UNSPEC };
+	unsigned int interval = 0, ewma_log = 2;
 	char d[IFNAMSIZ] = {};
-	char buf[1024] = {0};
+	bool estimate = false;
+	__u32 count = 0;
 
 	filter_qdisc = 0;
 	filter_classid = 0;
@@ -427,6 +895,20 @@ static int tc_class_list(int argc, char **argv)
 			if (get_tc_classid(&handle, *argv))
 				invarg("invalid parent ID", *argv);
 			t.tcm_parent = handle;
+		} else if (strcmp(*argv, "estimate") == 0) {
+			estimate = true;
+		} else if (estimate && strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_time(&interval, *argv) || !interval)
+				invarg("\"interval\" is invalid", *argv);
+		} else if (estimate && strcmp(*argv, "ewma") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&ewma_log, *argv, 0) || ewma_log > 16)
+				invarg("\"ewma\" is invalid", *argv);
+		} else if (estimate && strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_u32(&count, *argv, 0) || !count)
+				invarg("\"count\" is invalid", *argv);
 		} else if (matches(*argv, "help") == 0) {
 			usage();
 		} else {
@@ -446,6 +928,14 @@ static int tc_class_list(int argc, char **argv)
 		filter_ifindex = t.tcm_ifindex;
 	}
 
+	if (estimate) {
+		if (!interval) {
+			fprintf(stderr, "\"estimate\" needs an \"interval\"\n");
+			return -1;
+		}
+		return tc_class_estimate(&t, interval, ewma_log, count);
+	}
+
 	if (rtnl_dump_request(&rth, RTM_GETTCLASS, &t, sizeof(t)) < 0) {
 		perror("Cannot send dump request");
 		return 1;
@@ -459,7 +949,7 @@ static int tc_class_list(int argc, char **argv)
 	delete_json_obj();
 
 	if (show_graph)
-		graph_cls_show(stdout, &buf[0], &root_cls_list, 0);
+		graph_cls_show(stdout);
 
 	return 0;
 }
@@ -11,9 +11,13 @@ int do_chain(int argc, char **argv);
 int do_action(int argc, char **argv);
 int do_tcmonitor(int argc, char **argv);
 int do_exec(int argc, char **argv);
+int do_ematch(int argc, char **argv);
+int do_pedit(int argc, char **argv);
+int do_ct(int argc, char **argv);
 
 int print_action(struct nlmsghdr *n, void *arg);
 int print_filter(struct nlmsghdr *n, void *arg);
+int tc_filter_walk(struct nlmsghdr *req, rtnl_filter_t filter, void *arg);
 int print_qdisc(struct nlmsghdr *n, void *arg);
 int print_class(struct nlmsghdr *n, void *arg);
 void print_size_table(struct rtattr *rta);
@@ -27,3 +31,4 @@ int check_size_table_opts(struct tc_sizespec *s);
 
 extern int show_graph;
 extern bool use_names;
+extern int show_timing;
@@ -16,31 +16,45 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <time.h>
 
 #include "utils.h"
 #include "tc_core.h"
+#include "tc_util.h"
 #include <linux/atm.h>
 
 static double tick_in_usec = 1;
 static double clock_factor = 1;
+static bool tc_core_ready;
+
+/* /proc/net/psched is read on the first conversion, not at startup */
+static void tc_core_lazy_init(void)
+{
+	if (!tc_core_ready)
+		tc_core_init();
+}
 
 static double tc_core_time2tick(double time)
 {
+	tc_core_lazy_init();
 	return time * tick_in_usec;
 }
 
 double tc_core_tick2time(double tick)
 {
+	tc_core_lazy_init();
 	return tick / tick_in_usec;
 }
 
 unsigned int tc_core_time2ktime(unsigned int time)
 {
+	tc_core_lazy_init();
 	return time * clock_factor;
 }
 
 unsigned int tc_core_ktime2time(unsigned int ktime)
 {
+	tc_core_lazy_init();
 	return ktime / clock_factor;
 }
 
@@ -109,18 +123,96 @@ static unsigned int tc_adjust_size(unsigned int sz, unsigned int mpu, enum link_
  * - commit 8a8e3d84b17 (net_sched: restore "linklayer atm" handling)
  */
 
+/* A batch creating thousands of classes typically uses a handful of
+ * distinct rates, so the tables are computed once per parameter set and
+ * copied from then on.  The cache lives as long as the process, and is
+ * flushed if the clock parameters change.
+ */
+#define TC_TAB_HASH	64
+#define TC_TAB_MAX	4096
+
+struct rtab_ent {
+	struct rtab_ent	*next;
+	__u64		rate;
+	unsigned int	mtu;
+	unsigned int	mpu;
+	int		cell_log_in;
+	enum link_layer	linklayer;
+	int		cell_log;
+	__u32		rtab[256];
+};
+
+struct stab_ent {
+	struct stab_ent		*next;
+	struct tc_sizespec	in;
+	struct tc_sizespec	out;
+	__u16			data[];
+};
+
+static struct rtab_ent *rtab_hash[TC_TAB_HASH];
+static struct stab_ent *stab_hash[TC_TAB_HASH];
+static unsigned int tab_count;
+
+static unsigned int tc_tab_hash(__u64 rate, unsigned int mtu, unsigned int mpu)
+{
+	__u64 h = rate ^ ((__u64)mtu << 32) ^ ((__u64)mpu << 16);
+
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h >> 58;
+}
+
+static void tc_tab_flush(void)
+{
+	int i;
+
+	for (i = 0; i < TC_TAB_HASH; i++) {
+		while (rtab_hash[i]) {
+			struct rtab_ent *e = rtab_hash[i];
+
+			rtab_hash[i] = e->next;
+			free(e);
+		}
+		while (stab_hash[i]) {
+			struct stab_ent *e = stab_hash[i];
+
+			stab_hash[i] = e->next;
+			free(e);
+		}
+	}
+	tab_count = 0;
+}
+
 /*
    rtab[pkt_len>>cell_log] = pkt_xmit_time
  */
 
-int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
-		   int cell_log, unsigned int mtu,
-		   enum link_layer linklayer)
+static int tc_calc_rtab(__u64 bps, unsigned int mpu, __u32 *rtab,
+			int cell_log, unsigned int mtu,
+			enum link_layer linklayer)
 {
-	int i;
+	unsigned int h = tc_tab_hash(bps, mtu, mpu);
+	struct rtab_ent *e;
 	unsigned int sz;
-	unsigned int bps = r->rate;
-	unsigned int mpu = r->mpu;
+	int i;
+
+	for (e = rtab_hash[h]; e; e = e->next) {
+		if (e->rate == bps && e->mtu == mtu && e->mpu == mpu &&
+		    e->cell_log_in == cell_log && e->linklayer == linklayer) {
+			memcpy(rtab, e->rtab, sizeof(e->rtab));
+			return e->cell_log;
+		}
+	}
+
+	e = NULL;
+	if (tab_count < TC_TAB_MAX)
+		e = malloc(sizeof(*e));
+	if (e) {
+		e->rate = bps;
+		e->mtu = mtu;
+		e->mpu = mpu;
+		e->cell_log_in = cell_log;
+		e->linklayer = linklayer;
+	}
 
 	if (mtu == 0)
 		mtu = 2047;
@@ -136,6 +228,23 @@ int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
 		rtab[i] = tc_calc_xmittime(bps, sz);
 	}
 
+	if (e) {
+		e->cell_log = cell_log;
+		memcpy(e->rtab, rtab, sizeof(e->rtab));
+		e->next = rtab_hash[h];
+		rtab_hash[h] = e;
+		tab_count++;
+	}
+	return cell_log;
+}
+
+int tc_calc_rtable(struct tc_ratespec *r, __u32 *rtab,
+		   int cell_log, unsigned int mtu,
+		   enum link_layer linklayer)
+{
+	cell_log = tc_calc_rtab(r->rate, r->mpu, rtab, cell_log, mtu,
+				linklayer);
+
 	r->cell_align =  -1;
 	r->cell_log = cell_log;
 	r->linklayer = (linklayer & TC_LINKLAYER_MASK);
@@ -146,24 +255,8 @@ int tc_calc_rtable_64(struct tc_ratespec *r, __u32 *rtab,
 		   int cell_log, unsigned int mtu,
 		   enum link_layer linklayer, __u64 rate)
 {
-	int i;
-	unsigned int sz;
-	__u64 bps = rate;
-	unsigned int mpu = r->mpu;
-
-	if (mtu == 0)
-		mtu = 2047;
-
-	if (cell_log < 0) {
-		cell_log = 0;
-		while ((mtu >> cell_log) > 255)
-			cell_log++;
-	}
-
-	for (i = 0; i < 256; i++) {
-		sz = tc_adjust_size((i + 1) << cell_log, mpu, linklayer);
-		rtab[i] = tc_calc_xmittime(bps, sz);
-	}
+	cell_log = tc_calc_rtab(rate, r->mpu, rtab, cell_log, mtu,
+				linklayer);
 
 	r->cell_align = -1;
 	r->cell_log = cell_log;
@@ -175,11 +268,27 @@ int tc_calc_rtable_64(struct tc_ratespec *r, __u32 *rtab,
    stab[pkt_len>>cell_log] = pkt_xmit_size>>size_log
  */
 
+static struct stab_ent *tc_stab_lookup(const struct tc_sizespec *s)
+{
+	struct stab_ent *e;
+
+	for (e = stab_hash[tc_tab_hash(s->linklayer, s->mtu, s->mpu)];
+	     e; e = e->next) {
+		if (e->in.mtu == s->mtu && e->in.tsize == s->tsize &&
+		    e->in.mpu == s->mpu && e->in.linklayer == s->linklayer &&
+		    e->in.size_log == s->size_log)
+			return e;
+	}
+	return NULL;
+}
+
 int tc_calc_size_table(struct tc_sizespec *s, __u16 **stab)
 {
 	int i;
 	enum link_layer linklayer = s->linklayer;
 	unsigned int sz;
+	struct tc_sizespec in = *s;
+	struct stab_ent *e;
 
 	if (linklayer <= LINKLAYER_ETHERNET && s->mpu == 0) {
 		/* don't need data table in this case (only overhead set) */
@@ -191,6 +300,17 @@ int tc_calc_size_table(struct tc_sizespec *s, __u16 **stab)
 		return 0;
 	}
 
+	e = tc_stab_lookup(s);
+	if (e) {
+		*stab = malloc(e->out.tsize * sizeof(__u16));
+		if (!*stab)
+			return -1;
+		memcpy(*stab, e->data, e->out.tsize * sizeof(__u16));
+		*s = e->out;
+		s->overhead = in.overhead;
+		return 0;
+	}
+
 	if (s->mtu == 0)
 		s->mtu = 2047;
 	if (s->tsize == 0)
@@ -215,25 +335,42 @@ again:
 	}
 
 	s->cell_align = -1; /* Due to the sz calc */
+
+	if (tab_count < TC_TAB_MAX &&
+	    (e = malloc(sizeof(*e) + s->tsize * sizeof(__u16))) != NULL) {
+		unsigned int h = tc_tab_hash(in.linklayer, in.mtu, in.mpu);
+
+		e->in = in;
+		e->out = *s;
+		memcpy(e->data, *stab, s->tsize * sizeof(__u16));
+		e->next = stab_hash[h];
+		stab_hash[h] = e;
+		tab_count++;
+	}
 	return 0;
 }
 
 int tc_core_init(void)
 {
+	struct timespec start;
 	FILE *fp;
 	__u32 clock_res;
 	__u32 t2us;
 	__u32 us2t;
+	int n;
 
+	/* a failed read is not retried, the defaults stay */
+	tc_core_ready = true;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	fp = fopen("/proc/net/psched", "r");
 	if (fp == NULL)
 		return -1;
 
-	if (fscanf(fp, "%08x%08x%08x", &t2us, &us2t, &clock_res) != 3) {
-		fclose(fp);
-		return -1;
-	}
+	n = fscanf(fp, "%08x%08x%08x", &t2us, &us2t, &clock_res);
 	fclose(fp);
+	tc_timing("psched", &start);
+	if (n != 3)
+		return -1;
 
 	/* compatibility hack: for old iproute binaries (ignoring
 	 * the kernel clock resolution) the kernel advertises a
@@ -244,5 +381,6 @@ int tc_core_init(void)
 
 	clock_factor  = (double)clock_res / TIME_UNITS_PER_SEC;
 	tick_in_usec = (double)t2us / us2t * clock_factor;
+	tc_tab_flush();
 	return 0;
 }
@@ -14,11 +14,13 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <linux/if_ether.h>
+#include <linux/tc_act/tc_gact.h>
 
 #include "rt_names.h"
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_common.h"
+#include "list.h"
 
 static void usage(void)
 {
@@ -34,6 +36,8 @@ static void usage(void)
 		"\n"
 		"       tc filter show [ dev STRING ] [ root | ingress | egress | parent CLASSID ]\n"
 		"       tc filter show [ block BLOCK_INDEX ]\n"
+		"       tc filter offload-report [ dev STRING | block BLOCK_INDEX ]\n"
+		"                [ ingress | egress | parent CLASSID ] [ top N ]\n"
 		"Where:\n"
 		"FILTER_TYPE := { u32 | bpf | fw | route | etc. }\n"
 		"FILTERID := ... format depends on classifier, see there\n"
@@ -44,27 +48,44 @@ static void chain_usage(void)
 {
 	fprintf(stderr,
 		"Usage: tc chain [ add | del | get | show ] [ dev STRING ]\n"
-		"       tc chain [ add | del | get | show ] [ block BLOCK_INDEX ] ]\n");
+		"       tc chain [ add | del | get | show ] [ block BLOCK_INDEX ] ]\n"
+		"       tc chain swap { dev STRING | block BLOCK_INDEX }\n"
+		"                [ root | ingress | egress | parent CLASSID ]\n"
+		"                [ entry CHAIN_INDEX ] pref PRIO chain CHAIN_INDEX\n"
+		"                file FILE [ keep ] [ template FILTER_TYPE OPTIONS ]\n");
 }
 
+/* Filters of "tc chain swap" are queued here instead of being sent */
+struct chain_swap {
+	const char	*file;
+	char		*loc[4];	/* dev/block and parent, as given */
+	int		nloc;
+	char		chain[16];
+	struct rtnl_flush *flush;
+	unsigned int	rules;
+	unsigned int	failed;
+};
+
+static struct chain_swap *chain_swap;
+
 struct tc_filter_req {
 	struct nlmsghdr		n;
 	struct tcmsg		t;
 	char			buf[MAX_MSG];
 };
 
+static struct nlmsg_builder filter_req =
+	NLMSG_BUILDER_INIT(sizeof(struct tc_filter_req));
+
+static struct tc_filter_req *tc_filter_req_start(int cmd, unsigned int flags)
+{
+	return (struct tc_filter_req *)nlmsg_builder_start(&filter_req, cmd,
+			flags, sizeof(struct tcmsg));
+}
+
 static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
 {
-	struct {
-		struct nlmsghdr	n;
-		struct tcmsg		t;
-		char			buf[MAX_MSG];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.t.tcm_family = AF_UNSPEC,
-	};
+	struct tc_filter_req *req;
 	const struct filter_util *q = NULL;
 	__u32 prio = 0;
 	__u32 protocol = 0;
@@ -78,6 +99,10 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
 	struct tc_estimator est = {};
 	int ret;
 
+	req = tc_filter_req_start(cmd, NLM_F_REQUEST | flags);
+	if (!req)
+		return -1;
+
 	if (cmd == RTM_NEWTFILTER && flags & NLM_F_CREATE)
 		protocol = htons(ETH_P_ALL);
 
@@ -102,37 +127,37 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_u32(&block_index, *argv, 0) || !block_index)
 				invarg("invalid block index value", *argv);
 		} else if (strcmp(*argv, "root") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr,
 					"Error: \"root\" is duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_ROOT;
+			req->t.tcm_parent = TC_H_ROOT;
 		} else if (strcmp(*argv, "ingress") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr,
 					"Error: \"ingress\" is duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+			req->t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
 						     TC_H_MIN_INGRESS);
 		} else if (strcmp(*argv, "egress") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr,
 					"Error: \"egress\" is duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+			req->t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
 						     TC_H_MIN_EGRESS);
 		} else if (strcmp(*argv, "parent") == 0) {
 			__u32 handle;
 
 			NEXT_ARG();
-			if (req.t.tcm_parent)
+			if (req->t.tcm_parent)
 				duparg("parent", *argv);
 			if (get_tc_classid(&handle, *argv))
 				invarg("Invalid parent ID", *argv);
-			req.t.tcm_parent = handle;
+			req->t.tcm_parent = handle;
 		} else if (strcmp(*argv, "handle") == 0) {
 			NEXT_ARG();
 			if (fhandle)
@@ -179,29 +204,29 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
 		argc--; argv++;
 	}
 
-	req.t.tcm_info = TC_H_MAKE(prio<<16, protocol);
+	req->t.tcm_info = TC_H_MAKE(prio<<16, protocol);
 
 	if (chain_index_set)
-		addattr32(&req.n, sizeof(req), TCA_CHAIN, chain_index);
+		addattr32(&req->n, sizeof(*req), TCA_CHAIN, chain_index);
 
 	if (k[0])
-		addattr_l(&req.n, sizeof(req), TCA_KIND, k, strlen(k)+1);
+		addattr_l(&req->n, sizeof(*req), TCA_KIND, k, strlen(k)+1);
 
 	if (d[0])  {
-		ll_init_map(&rth);
+		ll_init_map_lazy();
 
-		req.t.tcm_ifindex = ll_name_to_index(d);
-		if (req.t.tcm_ifindex == 0) {
+		req->t.tcm_ifindex = ll_name_to_index(d);
+		if (req->t.tcm_ifindex == 0) {
 			fprintf(stderr, "Cannot find device \"%s\"\n", d);
 			return 1;
 		}
 	} else if (block_index) {
-		req.t.tcm_ifindex = TCM_IFINDEX_MAGIC_BLOCK;
-		req.t.tcm_block_index = block_index;
+		req->t.tcm_ifindex = TCM_IFINDEX_MAGIC_BLOCK;
+		req->t.tcm_block_index = block_index;
 	}
 
 	if (q) {
-		if (q->parse_fopt(q, fhandle, argc, argv, &req.n))
+		if (q->parse_fopt(q, fhandle, argc, argv, &req->n))
 			return 1;
 	} else {
 		if (fhandle) {
@@ -220,12 +245,22 @@ static int tc_filter_modify(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (est.ewma_log)
-		addattr_l(&req.n, sizeof(req), TCA_RATE, &est, sizeof(est));
+		addattr_l(&req->n, sizeof(*req), TCA_RATE, &est, sizeof(est));
+
+	if (chain_swap && cmd == RTM_NEWTFILTER) {
+		chain_swap->flush->tag = cmdlineno;
+		if (rtnl_flush_add(chain_swap->flush, &req->n, 0) < 0) {
+			perror("Cannot talk to rtnetlink");
+			return 2;
+		}
+		chain_swap->rules++;
+		return 0;
+	}
 
 	if (echo_request)
-		ret = rtnl_echo_talk(&rth, &req.n, json, print_filter);
+		ret = rtnl_echo_talk(&rth, &req->n, json, print_filter);
 	else
-		ret = rtnl_talk(&rth, &req.n, NULL);
+		ret = rtnl_talk(&rth, &req->n, NULL);
 
 	if (ret < 0) {
 		fprintf(stderr, "We have an error talking to the kernel\n");
@@ -380,23 +415,7 @@ int print_filter(struct nlmsghdr *n, void *arg)
 
 static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 {
-	struct {
-		struct nlmsghdr	n;
-		struct tcmsg		t;
-		char			buf[MAX_MSG];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
-		/* NLM_F_ECHO is for backward compatibility. old kernels never
-		 * respond without it and newer kernels will ignore it.
-		 * In old kernels there is a side effect:
-		 * In addition to a response to the GET you will receive an
-		 * event (if you do tc mon).
-		 */
-		.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ECHO | flags,
-		.n.nlmsg_type = cmd,
-		.t.tcm_parent = TC_H_UNSPEC,
-		.t.tcm_family = AF_UNSPEC,
-	};
+	struct tc_filter_req *req;
 	struct nlmsghdr *answer;
 	const struct filter_util *q = NULL;
 	__u32 prio = 0;
@@ -410,6 +429,16 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 	char  d[IFNAMSIZ] = {};
 	char  k[FILTER_NAMESZ] = {};
 
+	/* NLM_F_ECHO is for backward compatibility. old kernels never
+	 * respond without it and newer kernels will ignore it.
+	 * In old kernels there is a side effect:
+	 * In addition to a response to the GET you will receive an
+	 * event (if you do tc mon).
+	 */
+	req = tc_filter_req_start(cmd, NLM_F_REQUEST | NLM_F_ECHO | flags);
+	if (!req)
+		return -1;
+
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
 			NEXT_ARG();
@@ -431,36 +460,36 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 			if (get_u32(&block_index, *argv, 0) || !block_index)
 				invarg("invalid block index value", *argv);
 		} else if (strcmp(*argv, "root") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr,
 					"Error: \"root\" is duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_ROOT;
+			req->t.tcm_parent = TC_H_ROOT;
 		} else if (strcmp(*argv, "ingress") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr,
 					"Error: \"ingress\" is duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+			req->t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
 						     TC_H_MIN_INGRESS);
 		} else if (strcmp(*argv, "egress") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr,
 					"Error: \"egress\" is duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+			req->t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
 						     TC_H_MIN_EGRESS);
 		} else if (strcmp(*argv, "parent") == 0) {
 
 			NEXT_ARG();
-			if (req.t.tcm_parent)
+			if (req->t.tcm_parent)
 				duparg("parent", *argv);
 			if (get_tc_classid(&parent_handle, *argv))
 				invarg("Invalid parent ID", *argv);
-			req.t.tcm_parent = parent_handle;
+			req->t.tcm_parent = parent_handle;
 		} else if (strcmp(*argv, "handle") == 0) {
 			NEXT_ARG();
 			if (fhandle)
@@ -518,20 +547,20 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 			return -1;
 		}
 
-		req.t.tcm_info = TC_H_MAKE(prio<<16, protocol);
+		req->t.tcm_info = TC_H_MAKE(prio<<16, protocol);
 	}
 
 	if (chain_index_set)
-		addattr32(&req.n, sizeof(req), TCA_CHAIN, chain_index);
+		addattr32(&req->n, sizeof(*req), TCA_CHAIN, chain_index);
 
-	if (req.t.tcm_parent == TC_H_UNSPEC) {
+	if (req->t.tcm_parent == TC_H_UNSPEC) {
 		fprintf(stderr, "Must specify filter parent\n");
 		return -1;
 	}
 
 	if (cmd == RTM_GETTFILTER) {
 		if (k[0])
-			addattr_l(&req.n, sizeof(req), TCA_KIND, k, strlen(k)+1);
+			addattr_l(&req->n, sizeof(*req), TCA_KIND, k, strlen(k)+1);
 		else {
 			fprintf(stderr, "Must specify filter type\n");
 			return -1;
@@ -539,15 +568,15 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (d[0])  {
-		ll_init_map(&rth);
+		ll_init_map_lazy();
 
-		req.t.tcm_ifindex = ll_name_to_index(d);
-		if (!req.t.tcm_ifindex)
+		req->t.tcm_ifindex = ll_name_to_index(d);
+		if (!req->t.tcm_ifindex)
 			return -nodev(d);
-		filter_ifindex = req.t.tcm_ifindex;
+		filter_ifindex = req->t.tcm_ifindex;
 	} else if (block_index) {
-		req.t.tcm_ifindex = TCM_IFINDEX_MAGIC_BLOCK;
-		req.t.tcm_block_index = block_index;
+		req->t.tcm_ifindex = TCM_IFINDEX_MAGIC_BLOCK;
+		req->t.tcm_block_index = block_index;
 		filter_block_index = block_index;
 	} else {
 		fprintf(stderr, "Must specify netdevice \"dev\" or block index \"block\"\n");
@@ -555,7 +584,7 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (cmd == RTM_GETTFILTER &&
-	    q->parse_fopt(q, fhandle, argc, argv, &req.n))
+	    q->parse_fopt(q, fhandle, argc, argv, &req->n))
 		return 1;
 
 	if (!fhandle && cmd == RTM_GETTFILTER) {
@@ -572,7 +601,7 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 		return -1;
 	}
 
-	if (rtnl_talk(&rth, &req.n, &answer) < 0) {
+	if (rtnl_talk(&rth, &req->n, &answer) < 0) {
 		fprintf(stderr, "We have an error talking to the kernel\n");
 		return 2;
 	}
@@ -585,12 +614,230 @@ static int tc_filter_get(int cmd, unsigned int flags, int argc, char **argv)
 	return 0;
 }
 
+/* Without "dev" or "block", the filters of every qdisc are listed.  The
+ * dumps run concurrently on a pool of handles; the replies of each are
+ * buffered so the output stays in qdisc order, and filters of a shared
+ * block are printed only for the first qdisc it is bound to.
+ */
+#define FILTER_DUMP_JOBS	16
+
+struct filter_dump_target {
+	int	ifindex;
+	__u32	parent;
+};
+
+struct filter_dump_ctx {
+	rtnl_filter_t	filter;
+	void	*arg;
+	struct filter_dump_target *targets;
+	int	count;
+	int	size;
+	__u32	parent;		/* given by the user, or 0 */
+	int	ifindex;	/* likewise */
+	int	last_ifindex;
+	__u32	*blocks;	/* shared blocks already printed */
+	int	nblocks;
+};
+
+static int filter_dump_add(struct filter_dump_ctx *ctx, int ifindex,
+			   __u32 parent)
+{
+	if (ctx->count == ctx->size) {
+		int size = ctx->size ? 2 * ctx->size : 64;
+		struct filter_dump_target *t;
+
+		t = realloc(ctx->targets, size * sizeof(*t));
+		if (!t)
+			return -1;
+		ctx->targets = t;
+		ctx->size = size;
+	}
+	ctx->targets[ctx->count].ifindex = ifindex;
+	ctx->targets[ctx->count].parent = parent;
+	ctx->count++;
+	return 0;
+}
+
+static int filter_dump_qdisc(struct nlmsghdr *n, void *arg)
+{
+	struct filter_dump_ctx *ctx = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *tb[TCA_MAX+1];
+	int len = n->nlmsg_len;
+	const char *kind;
+
+	if (n->nlmsg_type != RTM_NEWQDISC)
+		return 0;
+	len -= NLMSG_LENGTH(sizeof(*t));
+	if (len < 0)
+		return -1;
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len, NLA_F_NESTED);
+	if (!tb[TCA_KIND])
+		return 0;
+	if (ctx->ifindex && t->tcm_ifindex != ctx->ifindex)
+		return 0;
+
+	if (ctx->parent) {
+		if (t->tcm_ifindex == ctx->last_ifindex)
+			return 0;
+		ctx->last_ifindex = t->tcm_ifindex;
+		return filter_dump_add(ctx, t->tcm_ifindex, ctx->parent);
+	}
+
+	kind = rta_getattr_str(tb[TCA_KIND]);
+	if (strcmp(kind, "clsact") == 0) {
+		if (filter_dump_add(ctx, t->tcm_ifindex,
+				    TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS)))
+			return -1;
+		return filter_dump_add(ctx, t->tcm_ifindex,
+				       TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_EGRESS));
+	}
+	if (strcmp(kind, "ingress") == 0)
+		return filter_dump_add(ctx, t->tcm_ifindex,
+				       TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS));
+	/* default qdiscs have no handle and take no filters */
+	if (t->tcm_handle)
+		return filter_dump_add(ctx, t->tcm_ifindex, t->tcm_handle);
+	return 0;
+}
+
+static int filter_dump_store(struct nlmsghdr *n, void *arg)
+{
+	return nlmsg_chain_append(arg, n) ? 0 : -1;
+}
+
+static int filter_dump_walk(struct filter_dump_ctx *ctx,
+			    struct nlmsg_chain *chain)
+{
+	__u32 block = 0;
+	bool skip = false;
+	struct nlmsg_list *l;
+	int i;
+
+	for (l = chain->head; l; l = l->next) {
+		struct tcmsg *t = NLMSG_DATA(&l->h);
+
+		if (t->tcm_ifindex == TCM_IFINDEX_MAGIC_BLOCK &&
+		    (!block || t->tcm_block_index != block)) {
+			block = t->tcm_block_index;
+			for (i = 0, skip = false; i < ctx->nblocks; i++)
+				if (ctx->blocks[i] == block)
+					skip = true;
+			if (!skip) {
+				__u32 *b = realloc(ctx->blocks,
+						   (ctx->nblocks + 1) * sizeof(*b));
+
+				if (b) {
+					ctx->blocks = b;
+					ctx->blocks[ctx->nblocks++] = block;
+				}
+			}
+		}
+		if (t->tcm_ifindex == TCM_IFINDEX_MAGIC_BLOCK && skip)
+			continue;
+		if (ctx->filter(&l->h, ctx->arg) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Run @filter on the filters of every qdisc, as "tc filter show" does
+ * without "dev", or of every qdisc of the device @req names; the other
+ * fields of @req select what is dumped.
+ */
+int tc_filter_walk(struct nlmsghdr *req, rtnl_filter_t filter, void *arg)
+{
+	struct tcmsg *rt = NLMSG_DATA(req);
+	struct filter_dump_ctx ctx = {
+		.filter = filter,
+		.arg = arg,
+		.parent = rt->tcm_parent,
+		.ifindex = rt->tcm_ifindex,
+	};
+	struct rtnl_handle hs[FILTER_DUMP_JOBS];
+	struct rtnl_dump_multi dumps[FILTER_DUMP_JOBS];
+	struct nlmsg_chain chains[FILTER_DUMP_JOBS] = {};
+	struct tcmsg t = { .tcm_family = AF_UNSPEC };
+	int jobs = 0, ret = 1;
+	int i, j;
+
+	if (rtnl_dump_request(&rth, RTM_GETQDISC, &t, sizeof(t)) < 0) {
+		perror("Cannot send dump request");
+		return 1;
+	}
+	if (rtnl_dump_filter(&rth, filter_dump_qdisc, &ctx) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		goto out;
+	}
+
+	while (jobs < FILTER_DUMP_JOBS && jobs < ctx.count) {
+		hs[jobs].fd = -1;
+		if (rtnl_open(&hs[jobs], 0) < 0)
+			break;
+		if (rth.flags & RTNL_HANDLE_F_STRICT_CHK)
+			rtnl_set_strict_dump(&hs[jobs]);
+		jobs++;
+	}
+	if (ctx.count && !jobs)
+		goto out;
+
+	for (i = 0; i < ctx.count; i += jobs) {
+		int k = MIN(jobs, ctx.count - i);
+
+		for (j = 0; j < k; j++) {
+			rt->tcm_ifindex = ctx.targets[i + j].ifindex;
+			rt->tcm_parent = ctx.targets[i + j].parent;
+			if (rtnl_dump_request_n(&hs[j], req) < 0) {
+				perror("Cannot send dump request");
+				goto out_close;
+			}
+			dumps[j] = (struct rtnl_dump_multi) {
+				.rth = &hs[j],
+				.filter = filter_dump_store,
+				.arg = &chains[j],
+			};
+		}
+
+		if (rtnl_dump_filter_multi(dumps, k) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			goto out_close;
+		}
+
+		for (j = 0; j < k; j++) {
+			if (filter_dump_walk(&ctx, &chains[j]) < 0)
+				goto out_close;
+			nlmsg_chain_free(&chains[j]);
+		}
+	}
+	ret = 0;
+
+out_close:
+	for (j = 0; j < jobs; j++) {
+		nlmsg_chain_free(&chains[j]);
+		rtnl_close(&hs[j]);
+	}
+out:
+	free(ctx.targets);
+	free(ctx.blocks);
+	return ret;
+}
+
+static int tc_filter_list_all(struct nlmsghdr *req)
+{
+	int ret;
+
+	new_json_obj(json);
+	ret = tc_filter_walk(req, print_filter, stdout);
+	delete_json_obj();
+	return ret;
+}
+
 static int tc_filter_list(int cmd, int argc, char **argv)
 {
 	struct {
 		struct nlmsghdr n;
 		struct tcmsg t;
-		char buf[MAX_MSG];
+		char buf[256];
 	} req = {
 		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
 		.n.nlmsg_type = cmd,
@@ -730,9 +977,12 @@ static int tc_filter_list(int cmd, int argc, char **argv)
 			.selector = TCA_DUMP_FLAGS_TERSE
 		};
 
-		addattr_l(&req.n, MAX_MSG, TCA_DUMP_FLAGS, &flags, sizeof(flags));
+		addattr_l(&req.n, sizeof(req), TCA_DUMP_FLAGS, &flags, sizeof(flags));
 	}
 
+	if (!d[0] && !block_index)
+		return tc_filter_list_all(&req.n);
+
 	if (rtnl_dump_request_n(&rth, &req.n) < 0) {
 		perror("Cannot send dump request");
 		return 1;
@@ -749,6 +999,884 @@ static int tc_filter_list(int cmd, int argc, char **argv)
 	return 0;
 }
 
+/* "tc filter offload-report" counts the filters that are in hardware and
+ * those that are not, per device and chain and per kind of their first
+ * action, from terse dumps: the flags and the stats of the first action
+ * are all it looks at. Those not in hardware are ranked by the packets
+ * their first action saw in software.
+ */
+#define OFFLOAD_HASH		1024
+
+enum {
+	OFFLOAD_HW,		/* in_hw */
+	OFFLOAD_SW,		/* not_in_hw, or no flags at all */
+	OFFLOAD_SKIP_HW,	/* software by request */
+	OFFLOAD_MAX,
+};
+
+static const char * const offload_names[OFFLOAD_MAX] = {
+	[OFFLOAD_HW]		= "in_hw",
+	[OFFLOAD_SW]		= "not_in_hw",
+	[OFFLOAD_SKIP_HW]	= "skip_hw",
+};
+
+struct offload_counts {
+	unsigned int	filters[OFFLOAD_MAX];
+	__u64		pkts;
+	__u64		pkts_hw;
+};
+
+struct offload_chain {
+	struct hlist_node	hash;
+	int			ifindex;	/* or TCM_IFINDEX_MAGIC_BLOCK */
+	__u32			block;
+	__u32			chain;
+	struct offload_counts	c;
+};
+
+struct offload_act {
+	char			kind[IFNAMSIZ];
+	struct offload_counts	c;
+};
+
+struct offload_rule {
+	int		ifindex;
+	__u32		block;
+	__u32		parent;
+	__u32		chain;
+	__u32		info;
+	__u32		handle;
+	char		kind[IFNAMSIZ];
+	char		act[IFNAMSIZ];
+	bool		skip_hw;
+	__u64		pkts;
+	__u64		bytes;
+};
+
+struct offload_report {
+	struct hlist_head	hash[OFFLOAD_HASH];
+	struct offload_chain	**chains;
+	unsigned int		nchains;
+	struct offload_act	*acts;
+	unsigned int		nacts;
+	struct offload_rule	*top;	/* by pkts, largest first */
+	unsigned int		ntop;
+	unsigned int		max_top;
+	struct offload_counts	total;
+};
+
+/* The attributes carrying the flags and actions of the classifiers that
+ * can be offloaded; other classifiers are software only.
+ */
+static const struct {
+	const char	*kind;
+	int		max;
+	int		flags;
+	int		act;
+	int		node;	/* only on entries that are not filters */
+} offload_kinds[] = {
+	{ "flower", TCA_FLOWER_MAX, TCA_FLOWER_FLAGS, TCA_FLOWER_ACT },
+	{ "matchall", TCA_MATCHALL_MAX, TCA_MATCHALL_FLAGS, TCA_MATCHALL_ACT },
+	{ "u32", TCA_U32_MAX, TCA_U32_FLAGS, TCA_U32_ACT, TCA_U32_DIVISOR },
+	{ "bpf", TCA_BPF_MAX, TCA_BPF_FLAGS_GEN, TCA_BPF_ACT },
+};
+
+#define OFFLOAD_ATTR_MAX	TCA_FLOWER_MAX
+
+static void offload_add(struct offload_counts *c, int state,
+			__u64 pkts, __u64 pkts_hw)
+{
+	c->filters[state]++;
+	c->pkts += pkts;
+	c->pkts_hw += pkts_hw;
+}
+
+static struct offload_chain *offload_chain(struct offload_report *r,
+					   const struct tcmsg *t, __u32 chain)
+{
+	__u32 block = t->tcm_ifindex == TCM_IFINDEX_MAGIC_BLOCK ?
+		      t->tcm_block_index : 0;
+	unsigned int h = (t->tcm_ifindex * 31 + block * 17 + chain) %
+			 OFFLOAD_HASH;
+	struct offload_chain *oc, **chains;
+	struct hlist_node *pos;
+
+	hlist_for_each(pos, &r->hash[h]) {
+		oc = container_of(pos, struct offload_chain, hash);
+		if (oc->ifindex == t->tcm_ifindex && oc->block == block &&
+		    oc->chain == chain)
+			return oc;
+	}
+
+	if (!(r->nchains & (r->nchains - 1))) {
+		chains = realloc(r->chains, (r->nchains ? r->nchains * 2 : 16) *
+				 sizeof(*chains));
+		if (!chains)
+			return NULL;
+		r->chains = chains;
+	}
+	oc = calloc(1, sizeof(*oc));
+	if (!oc)
+		return NULL;
+	oc->ifindex = t->tcm_ifindex;
+	oc->block = block;
+	oc->chain = chain;
+	hlist_add_head(&oc->hash, &r->hash[h]);
+	r->chains[r->nchains++] = oc;
+	return oc;
+}
+
+static struct offload_act *offload_act(struct offload_report *r,
+				       const char *kind)
+{
+	struct offload_act *a;
+	unsigned int i;
+
+	for (i = 0; i < r->nacts; i++)
+		if (!strcmp(r->acts[i].kind, kind))
+			return &r->acts[i];
+
+	a = realloc(r->acts, (r->nacts + 1) * sizeof(*a));
+	if (!a)
+		return NULL;
+	r->acts = a;
+	a = &r->acts[r->nacts++];
+	memset(a, 0, sizeof(*a));
+	strlcpy(a->kind, kind, sizeof(a->kind));
+	return a;
+}
+
+/* Kind and counters of the first action of @acts, all and hardware */
+static const char *offload_act_stats(struct rtattr *acts, __u64 *pkts,
+				     __u64 *bytes, __u64 *pkts_hw)
+{
+	struct rtattr *tb[TCA_ACT_MAX_PRIO + 1];
+	struct rtattr *atb[TCA_ACT_MAX + 1];
+	unsigned short prev = __TCA_STATS_MAX;
+	struct rtattr *pos;
+	int i;
+
+	*pkts = *bytes = *pkts_hw = 0;
+	if (!acts)
+		return "none";
+
+	parse_rtattr_nested(tb, TCA_ACT_MAX_PRIO, acts);
+	for (i = 1; i <= TCA_ACT_MAX_PRIO && !tb[i]; i++)
+		;
+	if (i > TCA_ACT_MAX_PRIO)
+		return "none";
+
+	parse_rtattr_nested(atb, TCA_ACT_MAX, tb[i]);
+	if (!atb[TCA_ACT_KIND])
+		return "none";
+
+	if (atb[TCA_ACT_STATS]) {
+		rtattr_for_each_nested(pos, atb[TCA_ACT_STATS]) {
+			struct gnet_stats_basic bs = {};
+
+			switch (pos->rta_type) {
+			case TCA_STATS_BASIC:
+			case TCA_STATS_BASIC_HW:
+				memcpy(&bs, RTA_DATA(pos),
+				       MIN(RTA_PAYLOAD(pos), sizeof(bs)));
+				if (pos->rta_type == TCA_STATS_BASIC_HW) {
+					*pkts_hw = bs.packets;
+					break;
+				}
+				*pkts = bs.packets;
+				*bytes = bs.bytes;
+				break;
+			case TCA_STATS_PKT64:
+				/* the 64 bit count of the one before */
+				if (prev == TCA_STATS_BASIC)
+					*pkts = rta_getattr_u64(pos);
+				else if (prev == TCA_STATS_BASIC_HW)
+					*pkts_hw = rta_getattr_u64(pos);
+				break;
+			}
+			prev = pos->rta_type;
+		}
+	}
+	return rta_getattr_str(atb[TCA_ACT_KIND]);
+}
+
+static void offload_rank(struct offload_report *r,
+			 const struct offload_rule *rule)
+{
+	unsigned int i;
+
+	if (!r->max_top ||
+	    (r->ntop == r->max_top && rule->pkts <= r->top[r->ntop - 1].pkts))
+		return;
+
+	i = r->ntop < r->max_top ? r->ntop++ : r->ntop - 1;
+	for (; i > 0 && r->top[i - 1].pkts < rule->pkts; i--)
+		r->top[i] = r->top[i - 1];
+	r->top[i] = *rule;
+}
+
+static int offload_filter(struct nlmsghdr *n, void *arg)
+{
+	struct offload_report *r = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtattr *opt[OFFLOAD_ATTR_MAX + 1];
+	struct rtattr *tb[TCA_MAX + 1];
+	struct rtattr *acts = NULL;
+	struct offload_rule rule;
+	struct offload_chain *oc;
+	struct offload_act *oa;
+	int len = n->nlmsg_len;
+	int state = OFFLOAD_SW;
+	__u64 pkts_hw;
+	const char *act;
+	unsigned int i;
+
+	if (n->nlmsg_type != RTM_NEWTFILTER)
+		return 0;
+	len -= NLMSG_LENGTH(sizeof(*t));
+	if (len < 0)
+		return -1;
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len, NLA_F_NESTED);
+	/* the head of each priority has no handle and is no filter */
+	if (!tb[TCA_KIND] || !t->tcm_handle)
+		return 0;
+
+	memset(&rule, 0, sizeof(rule));
+	rule.ifindex = t->tcm_ifindex;
+	rule.block = t->tcm_ifindex == TCM_IFINDEX_MAGIC_BLOCK ?
+		     t->tcm_block_index : 0;
+	rule.parent = t->tcm_parent;
+	rule.info = t->tcm_info;
+	rule.handle = t->tcm_handle;
+	rule.chain = tb[TCA_CHAIN] ? rta_getattr_u32(tb[TCA_CHAIN]) : 0;
+	strlcpy(rule.kind, rta_getattr_str(tb[TCA_KIND]), sizeof(rule.kind));
+
+	for (i = 0; i < ARRAY_SIZE(offload_kinds); i++) {
+		__u32 flags;
+
+		if (strcmp(rule.kind, offload_kinds[i].kind) || !tb[TCA_OPTIONS])
+			continue;
+		parse_rtattr_nested(opt, offload_kinds[i].max, tb[TCA_OPTIONS]);
+		/* u32 hash tables */
+		if (offload_kinds[i].node && opt[offload_kinds[i].node])
+			return 0;
+		acts = opt[offload_kinds[i].act];
+		flags = opt[offload_kinds[i].flags] ?
+			rta_getattr_u32(opt[offload_kinds[i].flags]) : 0;
+		if (flags & TCA_CLS_FLAGS_IN_HW)
+			state = OFFLOAD_HW;
+		else if (flags & TCA_CLS_FLAGS_SKIP_HW)
+			state = OFFLOAD_SKIP_HW;
+		break;
+	}
+
+	act = offload_act_stats(acts, &rule.pkts, &rule.bytes, &pkts_hw);
+	strlcpy(rule.act, act, sizeof(rule.act));
+	if (pkts_hw > rule.pkts)
+		pkts_hw = rule.pkts;
+
+	oc = offload_chain(r, t, rule.chain);
+	oa = offload_act(r, rule.act);
+	if (!oc || !oa) {
+		fprintf(stderr, "Out of memory\n");
+		return -1;
+	}
+	offload_add(&oc->c, state, rule.pkts, pkts_hw);
+	offload_add(&oa->c, state, rule.pkts, pkts_hw);
+	offload_add(&r->total, state, rule.pkts, pkts_hw);
+
+	if (state != OFFLOAD_HW) {
+		rule.skip_hw = state == OFFLOAD_SKIP_HW;
+		rule.pkts -= pkts_hw;
+		offload_rank(r, &rule);
+	}
+	return 0;
+}
+
+static int offload_chain_cmp(const void *a, const void *b)
+{
+	const struct offload_chain *x = *(const struct offload_chain **)a;
+	const struct offload_chain *y = *(const struct offload_chain **)b;
+
+	if (x->ifindex != y->ifindex)
+		return x->ifindex < y->ifindex ? -1 : 1;
+	if (x->block != y->block)
+		return x->block < y->block ? -1 : 1;
+	return x->chain < y->chain ? -1 : x->chain > y->chain;
+}
+
+static void offload_print_counts(const struct offload_counts *c)
+{
+	int i;
+
+	print_uint(PRINT_ANY, "filters", " filters %u",
+		   c->filters[OFFLOAD_HW] + c->filters[OFFLOAD_SW] +
+		   c->filters[OFFLOAD_SKIP_HW]);
+	for (i = 0; i < OFFLOAD_MAX; i++) {
+		print_string(PRINT_FP, NULL, " %s", offload_names[i]);
+		print_uint(PRINT_ANY, offload_names[i], " %u", c->filters[i]);
+	}
+	print_lluint(PRINT_ANY, "hw_packets", " hw_pkts %llu", c->pkts_hw);
+	print_lluint(PRINT_ANY, "sw_packets", " sw_pkts %llu",
+		     c->pkts - c->pkts_hw);
+	print_nl();
+}
+
+static void offload_print_where(int ifindex, __u32 block)
+{
+	if (ifindex == TCM_IFINDEX_MAGIC_BLOCK)
+		print_uint(PRINT_ANY, "block", "block %u", block);
+	else
+		print_color_string(PRINT_ANY, COLOR_IFNAME, "dev", "dev %s",
+				   ll_index_to_name(ifindex));
+}
+
+static void offload_print(struct offload_report *r)
+{
+	struct offload_counts dev = {};
+	char b1[64];
+	unsigned int i, j;
+
+	qsort(r->chains, r->nchains, sizeof(*r->chains), offload_chain_cmp);
+
+	open_json_object(NULL);
+	print_string(PRINT_FP, NULL, "total:", NULL);
+	offload_print_counts(&r->total);
+
+	open_json_array(PRINT_JSON, "devices");
+	for (i = 0; i < r->nchains; i = j) {
+		const struct offload_chain *oc = r->chains[i];
+
+		memset(&dev, 0, sizeof(dev));
+		for (j = i; j < r->nchains &&
+		     r->chains[j]->ifindex == oc->ifindex &&
+		     r->chains[j]->block == oc->block; j++) {
+			int k;
+
+			for (k = 0; k < OFFLOAD_MAX; k++)
+				dev.filters[k] += r->chains[j]->c.filters[k];
+			dev.pkts += r->chains[j]->c.pkts;
+			dev.pkts_hw += r->chains[j]->c.pkts_hw;
+		}
+
+		open_json_object(NULL);
+		offload_print_where(oc->ifindex, oc->block);
+		print_string(PRINT_FP, NULL, ":", NULL);
+		offload_print_counts(&dev);
+		open_json_array(PRINT_JSON, "chains");
+		for (; i < j; i++) {
+			open_json_object(NULL);
+			print_uint(PRINT_ANY, "chain", "  chain %u:",
+				   r->chains[i]->chain);
+			offload_print_counts(&r->chains[i]->c);
+			close_json_object();
+		}
+		close_json_array(PRINT_JSON, NULL);
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+
+	open_json_array(PRINT_JSON, "actions");
+	for (i = 0; i < r->nacts; i++) {
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "kind", "action %s:", r->acts[i].kind);
+		offload_print_counts(&r->acts[i].c);
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+
+	open_json_array(PRINT_JSON, "top");
+	for (i = 0; i < r->ntop; i++) {
+		const struct offload_rule *rule = &r->top[i];
+
+		open_json_object(NULL);
+		print_string(PRINT_FP, NULL, "%s", i ? "" : "not in hw:\n");
+		print_string(PRINT_FP, NULL, "  ", NULL);
+		offload_print_where(rule->ifindex, rule->block);
+		print_string(PRINT_ANY, "parent", " parent %s",
+			     sprint_tc_classid(rule->parent, b1));
+		print_uint(PRINT_ANY, "chain", " chain %u", rule->chain);
+		print_uint(PRINT_ANY, "pref", " pref %u",
+			   TC_H_MAJ(rule->info) >> 16);
+		print_string(PRINT_ANY, "protocol", " protocol %s",
+			     ll_proto_n2a(TC_H_MIN(rule->info),
+					  b1, sizeof(b1)));
+		print_string(PRINT_ANY, "kind", " %s", rule->kind);
+		print_0xhex(PRINT_ANY, "handle", " handle %#llx",
+			    rule->handle);
+		print_string(PRINT_ANY, "action", " action %s", rule->act);
+		if (rule->skip_hw)
+			print_bool(PRINT_ANY, "skip_hw", " skip_hw", true);
+		print_lluint(PRINT_ANY, "sw_packets", ": sw_pkts %llu",
+			     rule->pkts);
+		print_lluint(PRINT_ANY, "bytes", " bytes %llu", rule->bytes);
+		print_nl();
+		close_json_object();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+}
+
+static void offload_reset(struct offload_report *r)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->nchains; i++)
+		free(r->chains[i]);
+	free(r->chains);
+	free(r->acts);
+	memset(r->hash, 0, sizeof(r->hash));
+	r->chains = NULL;
+	r->nchains = 0;
+	r->acts = NULL;
+	r->nacts = 0;
+	r->ntop = 0;
+	memset(&r->total, 0, sizeof(r->total));
+}
+
+static int offload_dump(struct offload_report *r, struct nlmsghdr *req,
+			bool walk)
+{
+	if (walk)
+		return tc_filter_walk(req, offload_filter, r) ? -1 : 0;
+
+	if (rtnl_dump_request_n(&rth, req) < 0) {
+		perror("Cannot send dump request");
+		return -1;
+	}
+	if (rtnl_dump_filter(&rth, offload_filter, r) < 0) {
+		fprintf(stderr, "Dump terminated\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int tc_filter_offload_report(int argc, char **argv)
+{
+	struct {
+		struct nlmsghdr n;
+		struct tcmsg t;
+		char buf[256];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_type = RTM_GETTFILTER,
+		.t.tcm_parent = TC_H_UNSPEC,
+		.t.tcm_family = AF_UNSPEC,
+	};
+	struct nla_bitfield32 flags = {
+		.value = TCA_DUMP_FLAGS_TERSE,
+		.selector = TCA_DUMP_FLAGS_TERSE
+	};
+	struct offload_report *r;
+	__u32 block_index = 0;
+	char *d = NULL;
+	int ret = 1;
+	int len;
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	r->max_top = 10;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (d || block_index)
+				duparg("dev", *argv);
+			d = *argv;
+		} else if (matches(*argv, "block") == 0) {
+			NEXT_ARG();
+			if (d || block_index)
+				duparg("block", *argv);
+			if (get_u32(&block_index, *argv, 0) || !block_index)
+				invarg("invalid block index value", *argv);
+		} else if (strcmp(*argv, "ingress") == 0 ||
+			   strcmp(*argv, "egress") == 0) {
+			if (req.t.tcm_parent)
+				duparg("parent", *argv);
+			req.t.tcm_parent = TC_H_MAKE(TC_H_CLSACT,
+						     **argv == 'i' ?
+						     TC_H_MIN_INGRESS :
+						     TC_H_MIN_EGRESS);
+		} else if (strcmp(*argv, "parent") == 0) {
+			NEXT_ARG();
+			if (req.t.tcm_parent)
+				duparg("parent", *argv);
+			if (get_tc_classid(&req.t.tcm_parent, *argv))
+				invarg("invalid parent ID", *argv);
+		} else if (strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&r->max_top, *argv, 0))
+				invarg("invalid top count", *argv);
+		} else if (matches(*argv, "help") == 0) {
+			usage();
+			goto out;
+		} else {
+			fprintf(stderr,
+				" What is \"%s\"? Try \"tc filter help\"\n",
+				*argv);
+			goto out;
+		}
+		argc--; argv++;
+	}
+
+	if (r->max_top) {
+		r->top = calloc(r->max_top, sizeof(*r->top));
+		if (!r->top) {
+			fprintf(stderr, "Out of memory\n");
+			goto out;
+		}
+	}
+
+	ll_init_map(&rth);
+	if (d) {
+		req.t.tcm_ifindex = ll_name_to_index(d);
+		if (!req.t.tcm_ifindex) {
+			ret = -nodev(d);
+			goto out;
+		}
+	} else if (block_index) {
+		req.t.tcm_ifindex = TCM_IFINDEX_MAGIC_BLOCK;
+		req.t.tcm_block_index = block_index;
+	}
+	/* only some classifiers dump tersely, the others fail the dump */
+	len = req.n.nlmsg_len;
+	addattr_l(&req.n, sizeof(req), TCA_DUMP_FLAGS, &flags, sizeof(flags));
+	if (offload_dump(r, &req.n, !block_index) < 0) {
+		fprintf(stderr, "Retrying with full dumps\n");
+		offload_reset(r);
+		req.n.nlmsg_len = len;
+		if (offload_dump(r, &req.n, !block_index) < 0)
+			goto out;
+	}
+
+	new_json_obj(json);
+	offload_print(r);
+	delete_json_obj();
+	ret = 0;
+
+out:
+	offload_reset(r);
+	free(r->top);
+	free(r);
+	return ret;
+}
+
+/* "tc chain swap" loads FILE, one "tc filter add" per line without the
+ * device and chain, into a new chain and then points the entry rule at
+ * it. The entry rule is a flower filter matching every packet, with
+ * handle 1 at PRIO of the entry chain, whose only action is "goto chain".
+ * It is replaced in one request, so packets see either the old or the
+ * new rule set, however large. The chain it pointed to before is deleted
+ * last, in one request as well. If any rule fails the new chain is
+ * deleted and the entry rule left alone.
+ */
+#define CHAIN_SWAP_WINDOW	1024
+
+static void chain_swap_report(const struct nlmsghdr *err, int lineno,
+			      void *arg)
+{
+	const struct nlmsgerr *e = NLMSG_DATA(err);
+	struct chain_swap *cs = arg;
+
+	fprintf(stderr, "%s:%d: ", cs->file, lineno);
+	if (!nl_dump_ext_ack(err, NULL))
+		fprintf(stderr, "RTNETLINK answers: %s\n", strerror(-e->error));
+	cs->failed++;
+}
+
+/* Run a filter or chain command on @chain at the location of the swap */
+static int chain_swap_cmd(struct chain_swap *cs, int cmd, unsigned int flags,
+			  const char *chain, int argc, char **argv)
+{
+	char *args[MAX_ARGS];
+	int i, n = 0;
+
+	if (cs->nloc + 2 + argc > MAX_ARGS) {
+		fprintf(stderr, "Too many arguments\n");
+		return -1;
+	}
+	for (i = 0; i < cs->nloc; i++)
+		args[n++] = cs->loc[i];
+	args[n++] = "chain";
+	args[n++] = (char *)chain;
+	for (i = 0; i < argc; i++)
+		args[n++] = argv[i];
+
+	return tc_filter_modify(cmd, flags, n, args);
+}
+
+static int chain_swap_line(int argc, char **argv, void *arg)
+{
+	struct chain_swap *cs = arg;
+
+	if (argc > 0 && (strcmp(*argv, "dev") == 0 ||
+			 matches(*argv, "block") == 0 ||
+			 matches(*argv, "chain") == 0)) {
+		fprintf(stderr, "\"%s\" is given by \"tc chain swap\"\n",
+			*argv);
+		return -1;
+	}
+	return chain_swap_cmd(cs, RTM_NEWTFILTER, NLM_F_EXCL | NLM_F_CREATE,
+			      cs->chain, argc, argv);
+}
+
+/* The chain the entry rule @n points to, or -1 */
+static long long chain_swap_target(struct nlmsghdr *n)
+{
+	struct rtattr *tb[TCA_MAX + 1], *opt[TCA_FLOWER_MAX + 1];
+	struct rtattr *act[TCA_ACT_MAX_PRIO + 1];
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct tc_gact *p;
+	int i;
+
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t),
+			   n->nlmsg_len - NLMSG_LENGTH(sizeof(*t)),
+			   NLA_F_NESTED);
+	if (!tb[TCA_KIND] || strcmp(rta_getattr_str(tb[TCA_KIND]), "flower") ||
+	    !tb[TCA_OPTIONS])
+		return -1;
+	parse_rtattr_nested(opt, TCA_FLOWER_MAX, tb[TCA_OPTIONS]);
+	if (!opt[TCA_FLOWER_ACT])
+		return -1;
+	parse_rtattr_nested(act, TCA_ACT_MAX_PRIO, opt[TCA_FLOWER_ACT]);
+
+	for (i = 1; i <= TCA_ACT_MAX_PRIO; i++) {
+		struct rtattr *a[TCA_ACT_MAX + 1], *g[TCA_GACT_MAX + 1];
+
+		if (!act[i])
+			continue;
+		parse_rtattr_nested(a, TCA_ACT_MAX, act[i]);
+		if (!a[TCA_ACT_KIND] || !a[TCA_ACT_OPTIONS] ||
+		    strcmp(rta_getattr_str(a[TCA_ACT_KIND]), "gact"))
+			continue;
+		parse_rtattr_nested(g, TCA_GACT_MAX, a[TCA_ACT_OPTIONS]);
+		if (!g[TCA_GACT_PARMS] ||
+		    RTA_PAYLOAD(g[TCA_GACT_PARMS]) < sizeof(*p))
+			continue;
+		p = RTA_DATA(g[TCA_GACT_PARMS]);
+		if (TC_ACT_EXT_CMP(p->action, TC_ACT_GOTO_CHAIN))
+			return p->action & TC_ACT_EXT_VAL_MASK;
+	}
+	return -1;
+}
+
+static long long chain_swap_get_target(const char *dev, __u32 block,
+				       __u32 parent, __u32 entry, __u32 prio)
+{
+	struct {
+		struct nlmsghdr	n;
+		struct tcmsg	t;
+		char		buf[256];
+	} req = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
+		.n.nlmsg_flags = NLM_F_REQUEST,
+		.n.nlmsg_type = RTM_GETTFILTER,
+		.t.tcm_family = AF_UNSPEC,
+		.t.tcm_parent = parent,
+		.t.tcm_handle = 1,
+		.t.tcm_info = TC_H_MAKE(prio << 16, htons(ETH_P_ALL)),
+	};
+	struct nlmsghdr *answer;
+	long long target;
+
+	if (dev) {
+		req.t.tcm_ifindex = ll_name_to_index(dev);
+		if (!req.t.tcm_ifindex) {
+			fprintf(stderr, "Cannot find device \"%s\"\n", dev);
+			return -2;
+		}
+	} else {
+		req.t.tcm_ifindex = TCM_IFINDEX_MAGIC_BLOCK;
+		req.t.tcm_block_index = block;
+	}
+	addattr32(&req.n, sizeof(req), TCA_CHAIN, entry);
+	addattr_l(&req.n, sizeof(req), TCA_KIND, "flower", strlen("flower") + 1);
+
+	/* no entry rule yet, this is the first load */
+	if (rtnl_talk_suppress_rtnl_errmsg(&rth, &req.n, &answer) < 0)
+		return -1;
+	target = chain_swap_target(answer);
+	free(answer);
+	return target;
+}
+
+static int tc_chain_swap(int argc, char **argv)
+{
+	struct chain_swap cs = {};
+	char entry_s[16] = "0", prio_s[16], old_s[16];
+	char *dev = NULL, **template = NULL;
+	__u32 block = 0, parent = 0, entry = 0, prio = 0, chain;
+	int chain_set = 0, keep = 0, ntemplate = 0;
+	char *flip[] = {
+		"pref", prio_s, "protocol", "all", "handle", "1", "flower",
+		"action", "gact", "goto", "chain", cs.chain,
+	};
+	struct rtnl_flush f;
+	long long old;
+	double rate;
+	int ret;
+
+	while (argc > 0) {
+		if (strcmp(*argv, "dev") == 0) {
+			NEXT_ARG();
+			if (dev || block)
+				duparg("dev", *argv);
+			dev = *argv;
+			cs.loc[cs.nloc++] = "dev";
+			cs.loc[cs.nloc++] = *argv;
+		} else if (matches(*argv, "block") == 0) {
+			NEXT_ARG();
+			if (dev || block)
+				duparg("block", *argv);
+			if (get_u32(&block, *argv, 0) || !block)
+				invarg("invalid block index value", *argv);
+			cs.loc[cs.nloc++] = "block";
+			cs.loc[cs.nloc++] = *argv;
+		} else if (strcmp(*argv, "root") == 0 ||
+			   strcmp(*argv, "ingress") == 0 ||
+			   strcmp(*argv, "egress") == 0 ||
+			   strcmp(*argv, "parent") == 0) {
+			if (parent)
+				duparg2("parent", *argv);
+			cs.loc[cs.nloc++] = *argv;
+			if (**argv == 'r') {
+				parent = TC_H_ROOT;
+			} else if (**argv == 'i') {
+				parent = TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS);
+			} else if (**argv == 'e') {
+				parent = TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_EGRESS);
+			} else {
+				NEXT_ARG();
+				if (get_tc_classid(&parent, *argv))
+					invarg("invalid parent ID", *argv);
+				cs.loc[cs.nloc++] = *argv;
+			}
+		} else if (strcmp(*argv, "entry") == 0) {
+			NEXT_ARG();
+			if (get_u32(&entry, *argv, 0))
+				invarg("invalid chain index value", *argv);
+		} else if (matches(*argv, "preference") == 0 ||
+			   matches(*argv, "priority") == 0) {
+			NEXT_ARG();
+			if (get_u32(&prio, *argv, 0) || !prio || prio > 0xFFFF)
+				invarg("invalid priority value", *argv);
+		} else if (matches(*argv, "chain") == 0) {
+			NEXT_ARG();
+			if (get_u32(&chain, *argv, 0))
+				invarg("invalid chain index value", *argv);
+			chain_set = 1;
+		} else if (strcmp(*argv, "file") == 0) {
+			NEXT_ARG();
+			cs.file = *argv;
+		} else if (strcmp(*argv, "keep") == 0) {
+			keep = 1;
+		} else if (strcmp(*argv, "template") == 0) {
+			NEXT_ARG();
+			template = argv;
+			ntemplate = argc;
+			break;
+		} else if (matches(*argv, "help") == 0) {
+			chain_usage();
+			return 0;
+		} else {
+			fprintf(stderr,
+				"What is \"%s\"? Try \"tc chain help\"\n",
+				*argv);
+			return -1;
+		}
+		argc--; argv++;
+	}
+
+	if ((!dev && !block) || !prio || !chain_set || !cs.file) {
+		fprintf(stderr,
+			"\"tc chain swap\" needs \"dev\" or \"block\", \"pref\", \"chain\" and \"file\"\n");
+		return -1;
+	}
+	if (chain == entry) {
+		fprintf(stderr, "The new chain can not be the entry chain\n");
+		return -1;
+	}
+	snprintf(cs.chain, sizeof(cs.chain), "%u", chain);
+	snprintf(entry_s, sizeof(entry_s), "%u", entry);
+	snprintf(prio_s, sizeof(prio_s), "%u", prio);
+
+	ll_init_map_lazy();
+
+	/* Queued requests of a -batch-async window go first. */
+	if (rtnl_async_sync() < 0)
+		return 2;
+
+	old = chain_swap_get_target(dev, block, parent, entry, prio);
+	if (old < -1)
+		return 1;
+	if (old == chain) {
+		fprintf(stderr, "Chain %u is the one in use\n", chain);
+		return 1;
+	}
+
+	/* a chain of its own, which fails if the chain is in use */
+	ret = chain_swap_cmd(&cs, RTM_NEWCHAIN, NLM_F_EXCL | NLM_F_CREATE,
+			     cs.chain, ntemplate, template);
+	if (ret)
+		return ret;
+
+	if (rtnl_flush_open(&f, 0) < 0)
+		goto del_new;
+	if (rtnl_flush_set_report(&f, CHAIN_SWAP_WINDOW, chain_swap_report,
+				  &cs) < 0)
+		goto close;
+
+	cs.flush = &f;
+	chain_swap = &cs;
+	ret = do_batch(cs.file, false, chain_swap_line, &cs);
+	chain_swap = NULL;
+	if (rtnl_flush_commit(&f) == -2) {
+		perror("Cannot talk to rtnetlink");
+		goto close;
+	}
+	if (ret || cs.failed || !cs.rules) {
+		if (cs.failed)
+			fprintf(stderr, "%u of %u rules failed\n",
+				cs.failed, cs.rules);
+		else if (!ret)
+			fprintf(stderr, "\"%s\" contains no rules\n", cs.file);
+		goto close;
+	}
+	rate = rtnl_flush_rate(&f);
+	rtnl_flush_close(&f);
+
+	ret = chain_swap_cmd(&cs, RTM_NEWTFILTER, NLM_F_CREATE, entry_s,
+			     ARRAY_SIZE(flip), flip);
+	if (ret) {
+		fprintf(stderr, "Cannot switch the entry rule to chain %u\n",
+			chain);
+		goto del_new_ret;
+	}
+
+	if (show_stats)
+		printf("chain %u: %u rules, %.0f rules/s\n", chain, cs.rules,
+		       rate);
+
+	if (old >= 0 && !keep) {
+		snprintf(old_s, sizeof(old_s), "%lld", old);
+		if (chain_swap_cmd(&cs, RTM_DELCHAIN, 0, old_s, 0, NULL))
+			fprintf(stderr, "Chain %lld was not deleted\n", old);
+	}
+	return 0;
+
+close:
+	rtnl_flush_close(&f);
+del_new:
+	ret = 1;
+del_new_ret:
+	fprintf(stderr, "Nothing was changed, deleting chain %u\n", chain);
+	chain_swap_cmd(&cs, RTM_DELCHAIN, 0, cs.chain, 0, NULL);
+	return ret;
+}
+
 int do_filter(int argc, char **argv)
 {
 	if (argc < 1)
@@ -768,6 +1896,8 @@ int do_filter(int argc, char **argv)
 	if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0
 	    || matches(*argv, "lst") == 0)
 		return tc_filter_list(RTM_GETTFILTER, argc-1, argv+1);
+	if (strcmp(*argv, "offload-report") == 0)
+		return tc_filter_offload_report(argc-1, argv+1);
 	if (matches(*argv, "help") == 0) {
 		usage();
 		return 0;
@@ -793,6 +1923,8 @@ int do_chain(int argc, char **argv)
 	} else if (matches(*argv, "list") == 0 || matches(*argv, "show") == 0 ||
 		   matches(*argv, "lst") == 0) {
 		return tc_filter_list(RTM_GETCHAIN, argc - 1, argv + 1);
+	} else if (strcmp(*argv, "swap") == 0) {
+		return tc_chain_swap(argc - 1, argv + 1);
 	} else if (matches(*argv, "help") == 0) {
 		chain_usage();
 		return 0;
@@ -14,7 +14,12 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/time.h>
 #include "rt_names.h"
+#include "list.h"
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_common.h"
@@ -24,7 +29,9 @@ static void usage(void) __attribute__((noreturn));
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: tc [-timestamp [-tshort] monitor\n");
+	fprintf(stderr,
+		"Usage: tc [-timestamp [-tshort] monitor [ file FILE ] [ batch ]\n"
+		"	[ compact | binary ] [ coalesce MSEC ] [ rcvbuf SIZE ]\n");
 	exit(-1);
 }
 
@@ -57,6 +64,13 @@ static int accept_tcmsg(struct rtnl_ctrl_data *ctrl,
 		print_action(n, arg);
 		return 0;
 	}
+	if (n->nlmsg_type == NLMSG_OVERRUN) {
+		__u32 *lost = NLMSG_DATA(n);
+
+		fprintf(fp, "Overrun: events lost (%u so far)\n",
+			n->nlmsg_len >= NLMSG_LENGTH(sizeof(*lost)) ? *lost : 0);
+		return 0;
+	}
 	if (n->nlmsg_type != NLMSG_ERROR && n->nlmsg_type != NLMSG_NOOP &&
 	    n->nlmsg_type != NLMSG_DONE) {
 		fprintf(stderr, "Unknown message: length %08d type %08x flags %08x\n",
@@ -65,16 +79,510 @@ static int accept_tcmsg(struct rtnl_ctrl_data *ctrl,
 	return 0;
 }
 
+/* Batched monitor: events are drained with recvmmsg() from a large
+ * receive queue and printed in full, as one JSON object per line or as
+ * raw netlink messages that "tc monitor file" reads back. Overruns of
+ * the queue are written into the stream itself, and with coalescing
+ * only the last event per object is printed once per window, in the
+ * order of those last events so that replaying them gives the final
+ * state.
+ */
+#define MON_BATCH		64
+#define MON_BUFSZ		32768
+#define MON_RCVBUF		(64 << 20)
+#define MON_HASH		1024
+
+enum {
+	MON_FMT_FULL,
+	MON_FMT_COMPACT,
+	MON_FMT_BINARY,
+};
+
+struct mon_key {
+	__u16	type;		/* RTM_NEWxxx of the object */
+	__u16	family;
+	__u32	ifindex;
+	__u32	parent;
+	__u32	handle;
+	__u32	info;
+	__u32	chain;
+	char	kind[FILTER_NAMESZ];	/* actions only */
+};
+
+struct mon_ent {
+	struct hlist_node	hash;
+	struct list_head	list;	/* order of the last event */
+	struct mon_key		key;
+	struct timeval		tv;
+	unsigned long		count;
+	struct nlmsghdr		*n;
+	unsigned int		size;
+};
+
+static int mon_fmt = MON_FMT_FULL;
+static unsigned int mon_coalesce_ms;
+static unsigned long mon_overruns;
+static struct timeval mon_tv;
+
+static struct hlist_head mon_hash[MON_HASH];
+static struct list_head mon_pending = { &mon_pending, &mon_pending };
+static struct list_head mon_free = { &mon_free, &mon_free };
+
+static const char *mon_obj(__u16 type)
+{
+	switch (type) {
+	case RTM_NEWQDISC:
+	case RTM_DELQDISC:
+		return "qdisc";
+	case RTM_NEWTCLASS:
+	case RTM_DELTCLASS:
+		return "class";
+	case RTM_NEWTFILTER:
+	case RTM_DELTFILTER:
+		return "filter";
+	case RTM_NEWCHAIN:
+	case RTM_DELCHAIN:
+		return "chain";
+	case RTM_NEWACTION:
+	case RTM_DELACTION:
+	case RTM_GETACTION:
+		return "action";
+	}
+	return NULL;
+}
+
+static void mon_json_str(const char *name, const char *str)
+{
+	printf(",\"%s\":\"", name);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%c", *str);
+		else if ((unsigned char)*str < ' ')
+			printf("\\u%04x", *str);
+		else
+			putchar(*str);
+	}
+	putchar('"');
+}
+
+static void mon_json_head(const struct nlmsghdr *n, const struct timeval *tv)
+{
+	const char *ev = "new";
+
+	if (n->nlmsg_type == RTM_DELQDISC || n->nlmsg_type == RTM_DELTCLASS ||
+	    n->nlmsg_type == RTM_DELTFILTER || n->nlmsg_type == RTM_DELCHAIN ||
+	    n->nlmsg_type == RTM_DELACTION)
+		ev = "del";
+	else if (n->nlmsg_type == RTM_GETACTION)
+		ev = "get";
+
+	printf("{\"event\":\"%s\",\"object\":\"%s\"", ev,
+	       mon_obj(n->nlmsg_type));
+	if (timestamp)
+		printf(",\"time\":%ld.%06ld", (long)tv->tv_sec,
+		       (long)tv->tv_usec);
+}
+
+static void mon_json_tail(unsigned long count)
+{
+	if (count > 1)
+		printf(",\"count\":%lu", count);
+	printf("}\n");
+}
+
+static void mon_print_compact_action(const struct nlmsghdr *n,
+				     const struct timeval *tv,
+				     unsigned long count)
+{
+	struct tcamsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_ROOT_MAX + 1];
+	struct rtattr *act;
+	int rem;
+
+	if (len < 0)
+		return;
+	parse_rtattr(tb, TCA_ROOT_MAX, TA_RTA(t), len);
+	if (!tb[TCA_ACT_TAB])
+		return;
+
+	rem = RTA_PAYLOAD(tb[TCA_ACT_TAB]);
+	for (act = RTA_DATA(tb[TCA_ACT_TAB]); RTA_OK(act, rem);
+	     act = RTA_NEXT(act, rem)) {
+		struct rtattr *atb[TCA_ACT_MAX + 1];
+
+		parse_rtattr_nested(atb, TCA_ACT_MAX, act);
+		mon_json_head(n, tv);
+		if (atb[TCA_ACT_KIND])
+			mon_json_str("kind", rta_getattr_str(atb[TCA_ACT_KIND]));
+		if (atb[TCA_ACT_INDEX])
+			printf(",\"index\":%u",
+			       rta_getattr_u32(atb[TCA_ACT_INDEX]));
+		mon_json_tail(count);
+	}
+}
+
+/* One line per event: identity of the object only, no options */
+static void mon_print_compact(const struct nlmsghdr *n,
+			      const struct timeval *tv, unsigned long count)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+	SPRINT_BUF(b1);
+
+	if (n->nlmsg_type == RTM_NEWACTION || n->nlmsg_type == RTM_DELACTION ||
+	    n->nlmsg_type == RTM_GETACTION) {
+		mon_print_compact_action(n, tv, count);
+		return;
+	}
+	if (len < 0)
+		return;
+
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len, NLA_F_NESTED);
+
+	mon_json_head(n, tv);
+	if (t->tcm_ifindex == TCM_IFINDEX_MAGIC_BLOCK)
+		printf(",\"block\":%u", t->tcm_block_index);
+	else
+		mon_json_str("dev", ll_index_to_name(t->tcm_ifindex));
+	if (tb[TCA_KIND])
+		mon_json_str("kind", rta_getattr_str(tb[TCA_KIND]));
+	mon_json_str("parent", sprint_tc_classid(t->tcm_parent, b1));
+	if (n->nlmsg_type == RTM_NEWTFILTER ||
+	    n->nlmsg_type == RTM_DELTFILTER) {
+		printf(",\"handle\":%u", t->tcm_handle);
+		printf(",\"pref\":%u", TC_H_MAJ(t->tcm_info) >> 16);
+		mon_json_str("protocol",
+			     ll_proto_n2a(TC_H_MIN(t->tcm_info), b1,
+					  sizeof(b1)));
+	} else if (n->nlmsg_type != RTM_NEWCHAIN &&
+		   n->nlmsg_type != RTM_DELCHAIN) {
+		mon_json_str("handle", sprint_tc_classid(t->tcm_handle, b1));
+	}
+	if (tb[TCA_CHAIN])
+		printf(",\"chain\":%u", rta_getattr_u32(tb[TCA_CHAIN]));
+	mon_json_tail(count);
+}
+
+static void mon_write(const struct nlmsghdr *n)
+{
+	static const char pad[NLMSG_ALIGNTO];
+
+	fwrite(n, 1, n->nlmsg_len, stdout);
+	fwrite(pad, 1, NLMSG_ALIGN(n->nlmsg_len) - n->nlmsg_len, stdout);
+}
+
+static void mon_emit(struct nlmsghdr *n, const struct timeval *tv,
+		     unsigned long count)
+{
+	switch (mon_fmt) {
+	case MON_FMT_COMPACT:
+		mon_print_compact(n, tv, count);
+		break;
+	case MON_FMT_BINARY:
+		mon_write(n);
+		break;
+	default:
+		accept_tcmsg(NULL, n, stdout);
+		break;
+	}
+}
+
+static bool mon_key(const struct nlmsghdr *n, struct mon_key *key)
+{
+	memset(key, 0, sizeof(*key));
+	/* NEW and DEL of one object share a key */
+	key->type = n->nlmsg_type & ~3;
+
+	if (n->nlmsg_type == RTM_NEWACTION || n->nlmsg_type == RTM_DELACTION ||
+	    n->nlmsg_type == RTM_GETACTION) {
+		struct tcamsg *t = NLMSG_DATA(n);
+		int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+		struct rtattr *tb[TCA_ROOT_MAX + 1];
+		struct rtattr *act, *atb[TCA_ACT_MAX + 1];
+
+		if (len < 0)
+			return false;
+		parse_rtattr(tb, TCA_ROOT_MAX, TA_RTA(t), len);
+		if (!tb[TCA_ACT_TAB])
+			return false;
+		/* only single action events are coalesced */
+		act = RTA_DATA(tb[TCA_ACT_TAB]);
+		if (!RTA_OK(act, RTA_PAYLOAD(tb[TCA_ACT_TAB])) ||
+		    RTA_ALIGN(act->rta_len) < RTA_PAYLOAD(tb[TCA_ACT_TAB]))
+			return false;
+		parse_rtattr_nested(atb, TCA_ACT_MAX, act);
+		if (!atb[TCA_ACT_KIND] || !atb[TCA_ACT_INDEX])
+			return false;
+		strlcpy(key->kind, rta_getattr_str(atb[TCA_ACT_KIND]),
+			sizeof(key->kind));
+		key->handle = rta_getattr_u32(atb[TCA_ACT_INDEX]);
+	} else {
+		struct tcmsg *t = NLMSG_DATA(n);
+		int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+		struct rtattr *tb[TCA_MAX + 1];
+
+		if (len < 0)
+			return false;
+		parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len,
+				   NLA_F_NESTED);
+		key->family = t->tcm_family;
+		key->ifindex = t->tcm_ifindex;
+		key->handle = t->tcm_handle;
+		key->info = t->tcm_info;
+		/* a qdisc or class is known by its handle alone */
+		if (key->type == RTM_NEWTFILTER || key->type == RTM_NEWCHAIN)
+			key->parent = t->tcm_parent;
+		if (tb[TCA_CHAIN])
+			key->chain = rta_getattr_u32(tb[TCA_CHAIN]);
+	}
+	return true;
+}
+
+static unsigned int mon_key_hash(const struct mon_key *key)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	unsigned int h = 2166136261U, i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		h = (h ^ p[i]) * 16777619U;
+	return h & (MON_HASH - 1);
+}
+
+static void mon_flush(void)
+{
+	struct mon_ent *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, &mon_pending, list) {
+		mon_emit(e->n, &e->tv, e->count);
+		list_del(&e->list);
+		list_add(&e->list, &mon_free);
+	}
+	memset(mon_hash, 0, sizeof(mon_hash));
+}
+
+static void mon_event(struct nlmsghdr *n)
+{
+	struct mon_ent *e = NULL;
+	struct hlist_node *pos;
+	struct mon_key key;
+	bool keyed;
+
+	if (!mon_obj(n->nlmsg_type))
+		return;
+
+	if (!mon_coalesce_ms) {
+		mon_emit(n, &mon_tv, 1);
+		return;
+	}
+
+	/* events without a key are queued too, to keep their place */
+	keyed = mon_key(n, &key);
+	if (keyed) {
+		hlist_for_each(pos, &mon_hash[mon_key_hash(&key)]) {
+			e = container_of(pos, struct mon_ent, hash);
+			if (!memcmp(&e->key, &key, sizeof(key)))
+				break;
+			e = NULL;
+		}
+	}
+
+	if (e) {
+		list_del(&e->list);
+	} else {
+		if (!list_empty(&mon_free)) {
+			e = list_first_entry(&mon_free, struct mon_ent, list);
+			list_del(&e->list);
+		} else {
+			e = calloc(1, sizeof(*e));
+			if (!e) {
+				perror("calloc");
+				exit(1);
+			}
+		}
+		e->count = 0;
+		if (keyed) {
+			e->key = key;
+			hlist_add_head(&e->hash,
+				       &mon_hash[mon_key_hash(&key)]);
+		}
+	}
+	list_add_tail(&e->list, &mon_pending);
+
+	if (e->size < n->nlmsg_len) {
+		free(e->n);
+		e->n = malloc(n->nlmsg_len);
+		if (!e->n) {
+			perror("malloc");
+			exit(1);
+		}
+		e->size = n->nlmsg_len;
+	}
+	memcpy(e->n, n, n->nlmsg_len);
+	e->tv = mon_tv;
+	e->count++;
+}
+
+/* Pending events go out first so the marker keeps its place in the stream */
+static void mon_overrun(unsigned long lost)
+{
+	struct {
+		struct nlmsghdr	n;
+		__u32		lost;
+	} m = {
+		.n.nlmsg_len = NLMSG_LENGTH(sizeof(__u32)),
+		.n.nlmsg_type = NLMSG_OVERRUN,
+		.lost = lost,
+	};
+
+	mon_flush();
+	switch (mon_fmt) {
+	case MON_FMT_COMPACT:
+		printf("{\"event\":\"overrun\",\"overruns\":%lu}\n", lost);
+		break;
+	case MON_FMT_BINARY:
+		mon_write(&m.n);
+		break;
+	default:
+		accept_tcmsg(NULL, &m.n, stdout);
+		break;
+	}
+	fflush(stdout);
+}
+
+static int mon_accept_file(struct rtnl_ctrl_data *ctrl,
+			   struct nlmsghdr *n, void *arg)
+{
+	if (n->nlmsg_type == NLMSG_OVERRUN) {
+		__u32 *lost = NLMSG_DATA(n);
+
+		mon_overrun(n->nlmsg_len >= NLMSG_LENGTH(sizeof(*lost)) ?
+			    *lost : 0);
+		return 0;
+	}
+	mon_event(n);
+	return 0;
+}
+
+static int mon_listen_batch(struct rtnl_handle *rth, int rcvbuf)
+{
+	struct mmsghdr msgs[MON_BATCH] = {};
+	struct iovec iov[MON_BATCH];
+	struct pollfd pfd = { .fd = rth->fd, .events = POLLIN };
+	double window = mon_coalesce_ms / 1000., end = 0;
+	char *bufs;
+	int i;
+
+	if (setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUFFORCE,
+		       &rcvbuf, sizeof(rcvbuf)) < 0)
+		setsockopt(rth->fd, SOL_SOCKET, SO_RCVBUF,
+			   &rcvbuf, sizeof(rcvbuf));
+
+	bufs = malloc(MON_BATCH * MON_BUFSZ);
+	if (!bufs)
+		return -1;
+	for (i = 0; i < MON_BATCH; i++) {
+		iov[i].iov_base = bufs + i * MON_BUFSZ;
+		iov[i].iov_len = MON_BUFSZ;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (window)
+		end = monotonic_now() + window;
+	for (;;) {
+		int timeout = -1, n;
+
+		if (window) {
+			double now = monotonic_now();
+
+			if (now >= end) {
+				mon_flush();
+				fflush(stdout);
+				end = now + window;
+			}
+			timeout = (end - now) * 1000 + 1;
+		}
+
+		n = poll(&pfd, 1, timeout);
+		if (n < 0 && errno != EINTR)
+			break;
+		if (n <= 0)
+			continue;
+
+		/* drain what is queued, a batch at a time */
+		for (;;) {
+			n = recvmmsg(rth->fd, msgs, MON_BATCH, MSG_DONTWAIT,
+				     NULL);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == ENOBUFS) {
+					mon_overrun(++mon_overruns);
+					continue;
+				}
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				perror("tc monitor: recvmmsg");
+				free(bufs);
+				return -1;
+			}
+
+			gettimeofday(&mon_tv, NULL);
+			for (i = 0; i < n; i++) {
+				struct nlmsghdr *h = iov[i].iov_base;
+				int len = msgs[i].msg_len;
+
+				if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+					fprintf(stderr, "Message truncated\n");
+				for (; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len))
+					mon_event(h);
+			}
+			if (n < MON_BATCH)
+				break;
+		}
+
+		if (!window)
+			fflush(stdout);
+	}
+
+	free(bufs);
+	return -1;
+}
+
 int do_tcmonitor(int argc, char **argv)
 {
 	struct rtnl_handle rth;
 	char *file = NULL;
 	unsigned int groups = nl_mgrp(RTNLGRP_TC);
+	unsigned int mon_rcvbuf = MON_RCVBUF;
+	bool batch = false;
 
 	while (argc > 0) {
 		if (matches(*argv, "file") == 0) {
 			NEXT_ARG();
 			file = *argv;
+		} else if (strcmp(*argv, "batch") == 0) {
+			batch = true;
+		} else if (strcmp(*argv, "compact") == 0) {
+			mon_fmt = MON_FMT_COMPACT;
+			batch = true;
+		} else if (strcmp(*argv, "binary") == 0) {
+			mon_fmt = MON_FMT_BINARY;
+			batch = true;
+		} else if (strcmp(*argv, "coalesce") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&mon_coalesce_ms, *argv, 0) ||
+			    !mon_coalesce_ms)
+				invarg("\"coalesce\" is invalid", *argv);
+			batch = true;
+		} else if (strcmp(*argv, "rcvbuf") == 0) {
+			NEXT_ARG();
+			if (get_size(&mon_rcvbuf, *argv) || !mon_rcvbuf ||
+			    mon_rcvbuf > INT_MAX)
+				invarg("\"rcvbuf\" is invalid", *argv);
+			batch = true;
 		} else {
 			if (matches(*argv, "help") == 0) {
 				usage();
@@ -95,7 +603,18 @@ int do_tcmonitor(int argc, char **argv)
 			exit(-1);
 		}
 
-		ret = rtnl_from_file(fp, accept_tcmsg, stdout);
+		if (batch) {
+			/* read in one go, coalescing over the whole file */
+			if (mon_fmt == MON_FMT_COMPACT) {
+				if (rtnl_open(&rth, 0) < 0)
+					exit(1);
+				ll_init_map(&rth);
+			}
+			ret = rtnl_from_file(fp, mon_accept_file, NULL);
+			mon_flush();
+		} else {
+			ret = rtnl_from_file(fp, accept_tcmsg, stdout);
+		}
 		fclose(fp);
 		return ret;
 	}
@@ -103,7 +622,13 @@ int do_tcmonitor(int argc, char **argv)
 	if (rtnl_open(&rth, groups) < 0)
 		exit(1);
 
-	ll_init_map(&rth);
+	if (mon_fmt != MON_FMT_BINARY)
+		ll_init_map(&rth);
+
+	if (batch && mon_listen_batch(&rth, mon_rcvbuf) < 0) {
+		rtnl_close(&rth);
+		exit(2);
+	}
 
 	if (rtnl_listen(&rth, accept_tcmsg, (void *)stdout) < 0) {
 		rtnl_close(&rth);
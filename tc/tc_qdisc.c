@@ -16,15 +16,19 @@
 #include <string.h>
 #include <math.h>
 #include <malloc.h>
+#include <time.h>
+#include <errno.h>
 
 #include "utils.h"
 #include "tc_util.h"
 #include "tc_common.h"
+#include "rtnl_bulk.h"
 
 static int usage(void)
 {
 	fprintf(stderr,
-		"Usage: tc qdisc [ add | del | replace | change | show ] dev STRING\n"
+		"Usage: tc qdisc [ add | del | replace | change | show ]\n"
+		"       { dev STRING | devs FILE }\n"
 		"       [ handle QHANDLE ] [ root | ingress | clsact | parent CLASSID ]\n"
 		"       [ estimator INTERVAL TIME_CONSTANT ]\n"
 		"       [ stab [ help | STAB_OPTIONS] ]\n"
@@ -32,6 +36,11 @@ static int usage(void)
 		"       [ [ QDISC_KIND ] [ help | OPTIONS ] ]\n"
 		"\n"
 		"       tc qdisc { show | list } [ dev STRING ] [ QDISC_ID ] [ invisible ]\n"
+		"       tc qdisc { show | list } dev STRING queues [ interval TIME [ count N ] ]\n"
+		"       [ top N ] [ by { bytes | packets | drops | overlimits | requeues |\n"
+		"       backlog | qlen } ]\n"
+		"       tc qdisc { show | list } [ dev STRING ] [ QDISC_ID ] sample\n"
+		"       interval TIME [ window N ] [ count N ]\n"
 		"Where:\n"
 		"QDISC_KIND := { [p|b]fifo | tbf | prio | red | etc. }\n"
 		"OPTIONS := ... try tc qdisc add <desired QDISC_KIND> help\n"
@@ -40,6 +49,124 @@ static int usage(void)
 	return -1;
 }
 
+struct tc_qdisc_req {
+	struct nlmsghdr		n;
+	struct tcmsg		t;
+	char			buf[TCA_BUF_MAX];
+};
+
+static struct nlmsg_builder qdisc_req =
+	NLMSG_BUILDER_INIT(sizeof(struct tc_qdisc_req));
+
+/*
+ * "devs FILE": the qdisc is parsed once, with the first device for the
+ * options that depend on it, and the request is sent for every device
+ * in FILE. A line may name several devices.
+ */
+#define QDISC_BULK_WINDOW	1024
+
+struct qdisc_bulk {
+	struct rtnl_bulk	bulk;
+	char			(*dev)[IFNAMSIZ];
+	int			count;
+};
+
+static int qdisc_bulk_read(struct qdisc_bulk *b, const char *file)
+{
+	char *line = NULL, *tok[RTNL_BULK_MAX_FIELDS];
+	int lineno = 0, size = 0;
+	size_t len = 0;
+	FILE *fp;
+
+	b->bulk.file = file;
+	fp = rtnl_bulk_open(&b->bulk);
+	if (!fp)
+		return -1;
+	while (getline(&line, &len, fp) != -1) {
+		int i, ntok;
+
+		lineno++;
+		ntok = rtnl_bulk_tokens(line, tok, RTNL_BULK_MAX_FIELDS);
+		if (ntok > RTNL_BULK_MAX_FIELDS) {
+			fprintf(stderr, "%s:%d: too many devices\n",
+				b->bulk.file, lineno);
+			goto err;
+		}
+		for (i = 0; i < ntok; i++) {
+			if (strlen(tok[i]) >= IFNAMSIZ) {
+				fprintf(stderr, "%s:%d: \"%s\" is not a valid device name\n",
+					b->bulk.file, lineno, tok[i]);
+				goto err;
+			}
+			if (b->count == size) {
+				void *dev;
+
+				size = size ? 2 * size : 64;
+				dev = realloc(b->dev, size * sizeof(*b->dev));
+				if (!dev) {
+					fprintf(stderr, "out of memory\n");
+					goto err;
+				}
+				b->dev = dev;
+			}
+			strcpy(b->dev[b->count++], tok[i]);
+		}
+	}
+	rtnl_bulk_close(fp);
+	free(line);
+	if (!b->count) {
+		fprintf(stderr, "No device in \"%s\"\n", b->bulk.file);
+		return -1;
+	}
+	return 0;
+
+err:
+	rtnl_bulk_close(fp);
+	free(line);
+	return -1;
+}
+
+/* requests are tagged with the index of their device */
+static const char *qdisc_bulk_name(struct rtnl_bulk *rb, int i)
+{
+	struct qdisc_bulk *b = (struct qdisc_bulk *)rb;
+
+	return b->dev[i];
+}
+
+static int tc_qdisc_bulk(struct nlmsghdr *n, struct qdisc_bulk *b)
+{
+	struct tcmsg *t = NLMSG_DATA(n);
+	struct rtnl_flush f;
+	int i;
+
+	ll_init_map(&rth);
+
+	b->bulk.what = "devices";
+	b->bulk.window = QDISC_BULK_WINDOW;
+	b->bulk.name = qdisc_bulk_name;
+	b->bulk.entries = b->count;
+	if (rtnl_bulk_start(&b->bulk, &f) < 0)
+		return 2;
+
+	for (i = 0; i < b->count; i++) {
+		t->tcm_ifindex = ll_name_to_index(b->dev[i]);
+		if (!t->tcm_ifindex) {
+			fprintf(stderr, "%s: Cannot find device\n", b->dev[i]);
+			b->bulk.failed++;
+			continue;
+		}
+		f.tag = i;
+		if (rtnl_flush_add(&f, n, 0) < 0) {
+			perror("Cannot talk to rtnetlink");
+			rtnl_flush_close(&f);
+			return 2;
+		}
+	}
+
+	return rtnl_bulk_finish(&b->bulk, &f) ? 2 : 0;
+}
+
 static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 {
 	const struct qdisc_util *q = NULL;
@@ -50,18 +177,16 @@ static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 	} stab = {};
 	char  d[IFNAMSIZ] = {};
 	char  k[FILTER_NAMESZ] = {};
-	struct {
-		struct nlmsghdr	n;
-		struct tcmsg		t;
-		char			buf[TCA_BUF_MAX];
-	} req = {
-		.n.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg)),
-		.n.nlmsg_flags = NLM_F_REQUEST | flags,
-		.n.nlmsg_type = cmd,
-		.t.tcm_family = AF_UNSPEC,
-	};
+	struct tc_qdisc_req *req;
+	struct qdisc_bulk bulk = {};
 	__u32 ingress_block = 0;
 	__u32 egress_block = 0;
+	int ret;
+
+	req = (struct tc_qdisc_req *)nlmsg_builder_start(&qdisc_req, cmd,
+			NLM_F_REQUEST | flags, sizeof(struct tcmsg));
+	if (!req)
+		return -1;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
@@ -69,52 +194,59 @@ static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 			if (d[0])
 				duparg("dev", *argv);
 			strncpy(d, *argv, sizeof(d)-1);
+		} else if (strcmp(*argv, "devs") == 0) {
+			NEXT_ARG();
+			if (d[0])
+				duparg("devs", *argv);
+			if (qdisc_bulk_read(&bulk, *argv))
+				return -1;
+			strcpy(d, bulk.dev[0]);
 		} else if (strcmp(*argv, "handle") == 0) {
 			__u32 handle;
 
-			if (req.t.tcm_handle)
+			if (req->t.tcm_handle)
 				duparg("handle", *argv);
 			NEXT_ARG();
 			if (get_qdisc_handle(&handle, *argv))
 				invarg("invalid qdisc ID", *argv);
-			req.t.tcm_handle = handle;
+			req->t.tcm_handle = handle;
 		} else if (strcmp(*argv, "root") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr, "Error: \"root\" is duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_ROOT;
+			req->t.tcm_parent = TC_H_ROOT;
 		} else if (strcmp(*argv, "clsact") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr, "Error: \"clsact\" is a duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_CLSACT;
+			req->t.tcm_parent = TC_H_CLSACT;
 			strncpy(k, "clsact", sizeof(k) - 1);
 			q = get_qdisc_kind(k);
-			req.t.tcm_handle = TC_H_MAKE(TC_H_CLSACT, 0);
+			req->t.tcm_handle = TC_H_MAKE(TC_H_CLSACT, 0);
 			NEXT_ARG_FWD();
 			break;
 		} else if (strcmp(*argv, "ingress") == 0) {
-			if (req.t.tcm_parent) {
+			if (req->t.tcm_parent) {
 				fprintf(stderr, "Error: \"ingress\" is a duplicate parent ID\n");
 				return -1;
 			}
-			req.t.tcm_parent = TC_H_INGRESS;
+			req->t.tcm_parent = TC_H_INGRESS;
 			strncpy(k, "ingress", sizeof(k) - 1);
 			q = get_qdisc_kind(k);
-			req.t.tcm_handle = TC_H_MAKE(TC_H_INGRESS, 0);
+			req->t.tcm_handle = TC_H_MAKE(TC_H_INGRESS, 0);
 			NEXT_ARG_FWD();
 			break;
 		} else if (strcmp(*argv, "parent") == 0) {
 			__u32 handle;
 
 			NEXT_ARG();
-			if (req.t.tcm_parent)
+			if (req->t.tcm_parent)
 				duparg("parent", *argv);
 			if (get_tc_classid(&handle, *argv))
 				invarg("invalid parent ID", *argv);
-			req.t.tcm_parent = handle;
+			req->t.tcm_parent = handle;
 		} else if (matches(*argv, "estimator") == 0) {
 			if (parse_estimator(&argc, &argv, &est))
 				return -1;
@@ -143,20 +275,20 @@ static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 	}
 
 	if (k[0])
-		addattr_l(&req.n, sizeof(req), TCA_KIND, k, strlen(k)+1);
+		addattr_l(&req->n, sizeof(*req), TCA_KIND, k, strlen(k)+1);
 	if (est.ewma_log)
-		addattr_l(&req.n, sizeof(req), TCA_RATE, &est, sizeof(est));
+		addattr_l(&req->n, sizeof(*req), TCA_RATE, &est, sizeof(est));
 
 	if (ingress_block)
-		addattr32(&req.n, sizeof(req),
+		addattr32(&req->n, sizeof(*req),
 			  TCA_INGRESS_BLOCK, ingress_block);
 	if (egress_block)
-		addattr32(&req.n, sizeof(req),
+		addattr32(&req->n, sizeof(*req),
 			  TCA_EGRESS_BLOCK, egress_block);
 
 	if (q) {
 		if (q->parse_qopt) {
-			if (q->parse_qopt(q, argc, argv, &req.n, d))
+			if (q->parse_qopt(q, argc, argv, &req->n, d))
 				return 1;
 		} else if (argc) {
 			fprintf(stderr, "qdisc '%s' does not support option parsing\n", k);
@@ -180,28 +312,34 @@ static int tc_qdisc_modify(int cmd, unsigned int flags, int argc, char **argv)
 			return -1;
 		}
 
-		tail = addattr_nest(&req.n, sizeof(req), TCA_STAB);
-		addattr_l(&req.n, sizeof(req), TCA_STAB_BASE, &stab.szopts,
+		tail = addattr_nest(&req->n, sizeof(*req), TCA_STAB);
+		addattr_l(&req->n, sizeof(*req), TCA_STAB_BASE, &stab.szopts,
 			  sizeof(stab.szopts));
 		if (stab.data)
-			addattr_l(&req.n, sizeof(req), TCA_STAB_DATA, stab.data,
+			addattr_l(&req->n, sizeof(*req), TCA_STAB_DATA, stab.data,
 				  stab.szopts.tsize * sizeof(__u16));
-		addattr_nest_end(&req.n, tail);
+		addattr_nest_end(&req->n, tail);
 		free(stab.data);
 	}
 
+	if (bulk.count) {
+		ret = tc_qdisc_bulk(&req->n, &bulk);
+		free(bulk.dev);
+		return ret;
+	}
+
 	if (d[0])  {
 		int idx;
 
-		ll_init_map(&rth);
+		ll_init_map_lazy();
 
 		idx = ll_name_to_index(d);
 		if (!idx)
 			return -nodev(d);
-		req.t.tcm_ifindex = idx;
+		req->t.tcm_ifindex = idx;
 	}
 
-	if (rtnl_talk(&rth, &req.n, NULL) < 0)
+	if (rtnl_talk(&rth, &req->n, NULL) < 0)
 		return 2;
 
 	return 0;
@@ -348,6 +486,597 @@ int print_qdisc(struct nlmsghdr *n, void *arg)
 	return 0;
 }
 
+/*
+ * Per queue table for "show dev DEV queues": the children of an mq or
+ * mqprio root are collected into an array indexed by tx queue (parent
+ * minor - 1) and printed one line each instead of one block each.
+ * The kernel dumps the root qdisc of a device before the others, so
+ * its handle is known by the time the children arrive.
+ */
+enum {
+	QS_BYTES,
+	QS_PACKETS,
+	QS_DROPS,
+	QS_OVERLIMITS,
+	QS_REQUEUES,
+	QS_BACKLOG,	/* this and the following are gauges */
+	QS_QLEN,
+	__QS_MAX
+};
+
+static const char * const qs_names[__QS_MAX] = {
+	[QS_BYTES]	= "bytes",
+	[QS_PACKETS]	= "packets",
+	[QS_DROPS]	= "drops",
+	[QS_OVERLIMITS]	= "overlimits",
+	[QS_REQUEUES]	= "requeues",
+	[QS_BACKLOG]	= "backlog",
+	[QS_QLEN]	= "qlen",
+};
+
+struct qdisc_queue {
+	__u32	seen;		/* round the child was last dumped in */
+	__u32	handle;
+	bool	based;		/* prev holds the previous round */
+	char	kind[16];
+	__u64	cur[__QS_MAX];
+	__u64	prev[__QS_MAX];
+};
+
+struct qdisc_queue_tab {
+	struct qdisc_queue	*q;
+	unsigned int		size;
+	unsigned int		max;	/* highest queue seen + 1 */
+	bool			root_seen;
+	__u32			root;
+	char			root_kind[16];
+	__u32			round;
+	bool			delta;
+	int			sort;	/* -1 to print in queue order */
+};
+
+static void qdisc_queue_counters(struct rtattr *tb[], __u64 *v)
+{
+	memset(v, 0, __QS_MAX * sizeof(*v));
+
+	if (tb[TCA_STATS2]) {
+		struct rtattr *tbs[TCA_STATS_MAX + 1];
+
+		parse_rtattr_nested(tbs, TCA_STATS_MAX, tb[TCA_STATS2]);
+		if (tbs[TCA_STATS_BASIC]) {
+			struct gnet_stats_basic bs = {0};
+
+			memcpy(&bs, RTA_DATA(tbs[TCA_STATS_BASIC]),
+			       MIN(RTA_PAYLOAD(tbs[TCA_STATS_BASIC]), sizeof(bs)));
+			v[QS_BYTES] = bs.bytes;
+			v[QS_PACKETS] = bs.packets;
+		}
+		if (tbs[TCA_STATS_PKT64])
+			v[QS_PACKETS] = rta_getattr_u64(tbs[TCA_STATS_PKT64]);
+		if (tbs[TCA_STATS_QUEUE]) {
+			struct gnet_stats_queue qs = {0};
+
+			memcpy(&qs, RTA_DATA(tbs[TCA_STATS_QUEUE]),
+			       MIN(RTA_PAYLOAD(tbs[TCA_STATS_QUEUE]), sizeof(qs)));
+			v[QS_DROPS] = qs.drops;
+			v[QS_OVERLIMITS] = qs.overlimits;
+			v[QS_REQUEUES] = qs.requeues;
+			v[QS_BACKLOG] = qs.backlog;
+			v[QS_QLEN] = qs.qlen;
+		}
+	} else if (tb[TCA_STATS]) {
+		struct tc_stats st = {};
+
+		memcpy(&st, RTA_DATA(tb[TCA_STATS]),
+		       MIN(RTA_PAYLOAD(tb[TCA_STATS]), sizeof(st)));
+		v[QS_BYTES] = st.bytes;
+		v[QS_PACKETS] = st.packets;
+		v[QS_DROPS] = st.drops;
+		v[QS_OVERLIMITS] = st.overlimits;
+		v[QS_BACKLOG] = st.backlog;
+		v[QS_QLEN] = st.qlen;
+	}
+}
+
+static struct qdisc_queue *qdisc_queue_get(struct qdisc_queue_tab *tab,
+					   unsigned int queue)
+{
+	if (queue >= tab->size) {
+		unsigned int size = tab->size ? tab->size : 64;
+		struct qdisc_queue *q;
+
+		while (size <= queue)
+			size *= 2;
+		q = realloc(tab->q, size * sizeof(*q));
+		if (!q) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		memset(q + tab->size, 0, (size - tab->size) * sizeof(*q));
+		tab->q = q;
+		tab->size = size;
+	}
+	if (queue >= tab->max)
+		tab->max = queue + 1;
+	return &tab->q[queue];
+}
+
+static int collect_qdisc_queue(struct nlmsghdr *n, void *arg)
+{
+	struct qdisc_queue_tab *tab = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1];
+	struct qdisc_queue *q;
+	__u64 v[__QS_MAX];
+	int i;
+
+	if (n->nlmsg_type != RTM_NEWQDISC)
+		return 0;
+	if (len < 0) {
+		fprintf(stderr, "Wrong len %d\n", len);
+		return -1;
+	}
+	if (filter_ifindex && filter_ifindex != t->tcm_ifindex)
+		return 0;
+
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len, NLA_F_NESTED);
+	if (!tb[TCA_KIND])
+		return 0;
+
+	if (t->tcm_parent == TC_H_ROOT) {
+		tab->root_seen = true;
+		tab->root = t->tcm_handle;
+		strlcpy(tab->root_kind, rta_getattr_str(tb[TCA_KIND]),
+			sizeof(tab->root_kind));
+		return 0;
+	}
+	if (!tab->root_seen || TC_H_MAJ(t->tcm_parent) != tab->root ||
+	    !TC_H_MIN(t->tcm_parent) || TC_H_MIN(t->tcm_parent) > 0xFFF0)
+		return 0;
+
+	qdisc_queue_counters(tb, v);
+	q = qdisc_queue_get(tab, TC_H_MIN(t->tcm_parent) - 1);
+	q->based = q->seen && q->seen + 1 == tab->round &&
+		   q->handle == t->tcm_handle;
+	for (i = 0; i < QS_BACKLOG && q->based; i++)
+		if (v[i] < q->cur[i])
+			q->based = false;	/* replaced meanwhile */
+	memcpy(q->prev, q->cur, sizeof(q->prev));
+	memcpy(q->cur, v, sizeof(q->cur));
+	q->seen = tab->round;
+	q->handle = t->tcm_handle;
+	strlcpy(q->kind, rta_getattr_str(tb[TCA_KIND]), sizeof(q->kind));
+	return 0;
+}
+
+static __u64 qdisc_queue_value(const struct qdisc_queue_tab *tab,
+			       const struct qdisc_queue *q, int i)
+{
+	if (tab->delta && i < QS_BACKLOG)
+		return q->cur[i] - q->prev[i];
+	return q->cur[i];
+}
+
+static const struct qdisc_queue_tab *qdisc_queue_sort_tab;
+
+static int qdisc_queue_cmp(const void *a, const void *b)
+{
+	const struct qdisc_queue_tab *tab = qdisc_queue_sort_tab;
+	__u64 va = qdisc_queue_value(tab, *(struct qdisc_queue **)a, tab->sort);
+	__u64 vb = qdisc_queue_value(tab, *(struct qdisc_queue **)b, tab->sort);
+
+	if (va != vb)
+		return va < vb ? 1 : -1;
+	/* keep queue order among equals */
+	return *(struct qdisc_queue **)a < *(struct qdisc_queue **)b ? -1 : 1;
+}
+
+static void print_qdisc_queues(struct qdisc_queue_tab *tab, unsigned int top)
+{
+	struct qdisc_queue **v;
+	unsigned int i, nr = 0;
+	char abuf[64];
+	int j;
+
+	v = calloc(tab->max ? tab->max : 1, sizeof(*v));
+	if (!v) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < tab->max; i++) {
+		struct qdisc_queue *q = &tab->q[i];
+
+		if (q->seen == tab->round && (!tab->delta || q->based))
+			v[nr++] = q;
+	}
+	if (tab->sort >= 0) {
+		qdisc_queue_sort_tab = tab;
+		qsort(v, nr, sizeof(*v), qdisc_queue_cmp);
+	}
+	if (top && top < nr)
+		nr = top;
+
+	print_string(PRINT_FP, NULL, "%-6s", "queue");
+	print_string(PRINT_FP, NULL, "%-8s", "handle");
+	print_string(PRINT_FP, NULL, "%-11s", "kind");
+	for (j = 0; j < __QS_MAX; j++)
+		print_string(PRINT_FP, NULL, " %12s", qs_names[j]);
+	print_nl();
+
+	for (i = 0; i < nr; i++) {
+		struct qdisc_queue *q = v[i];
+
+		open_json_object(NULL);
+		print_uint(PRINT_ANY, "queue", "%-6u", q - tab->q);
+		sprintf(abuf, "%x:", q->handle >> 16);
+		print_string(PRINT_ANY, "handle", "%-8s", abuf);
+		print_string(PRINT_ANY, "kind", "%-11s", q->kind);
+		for (j = 0; j < __QS_MAX; j++)
+			print_lluint(PRINT_ANY, qs_names[j], " %12llu",
+				     qdisc_queue_value(tab, q, j));
+		close_json_object();
+		print_nl();
+	}
+	free(v);
+}
+
+static int tc_qdisc_queues(struct nlmsghdr *req, unsigned int interval,
+			   __u32 count, unsigned int top, int sort)
+{
+	struct qdisc_queue_tab tab = { .sort = sort, .delta = !!interval };
+	double last = 0, now, next = monotonic_now();
+	int ret = 0;
+
+	for (;;) {
+		if (rtnl_dump_request_n(&rth, req) < 0) {
+			perror("Cannot send request");
+			ret = 1;
+			break;
+		}
+		now = monotonic_now();
+		tab.round++;
+		tab.root_seen = false;
+		if (rtnl_dump_filter(&rth, collect_qdisc_queue, &tab) < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = 1;
+			break;
+		}
+		if (!tab.root_seen || (strcmp(tab.root_kind, "mq") &&
+				       strcmp(tab.root_kind, "mqprio"))) {
+			fprintf(stderr, "Root qdisc is not mq or mqprio\n");
+			ret = 1;
+			break;
+		}
+		/* with an interval, the first dump only sets the baseline */
+		if (!interval || tab.round > 1) {
+			new_json_obj(json);
+			if (interval)
+				print_float(PRINT_FP, NULL, "interval %.3fs\n",
+					    now - last);
+			print_qdisc_queues(&tab, top);
+			delete_json_obj();
+			fflush(stdout);
+		}
+		if (!interval || (count && tab.round > count))
+			break;
+		last = now;
+		next += interval / 1e6;
+		monotonic_sleep_until(next);
+	}
+
+	free(tab.q);
+	return ret;
+}
+
+/*
+ * Interval sampler for "show ... sample interval": the xstats of every
+ * qdisc whose kind has sample_xstats are kept per (dev, handle) for a
+ * window of rounds. Counters become rates over the interval, gauges are
+ * taken as they are, and each value is printed with its percentiles
+ * over the window.
+ */
+struct qdisc_series {
+	double		last;	/* raw value of the previous round */
+	double		*win;	/* ring of the last "window" samples */
+	unsigned int	nwin;
+	unsigned int	pos;
+};
+
+struct qdisc_sample {
+	struct qdisc_sample	*next;
+	int			ifindex;
+	__u32			handle;
+	__u32			parent;
+	__u32			seen;	/* round it was last dumped in */
+	const struct qdisc_util	*q;
+	struct xstats_samples	layout;	/* names of the last round */
+	struct qdisc_series	*series;
+};
+
+struct qdisc_sample_tab {
+	struct qdisc_sample	*head;
+	struct qdisc_sample	*hint;	/* dumps come in the same order */
+	unsigned int		window;
+	__u32			round;
+	double			elapsed;
+};
+
+static struct qdisc_sample *qdisc_sample_get(struct qdisc_sample_tab *tab,
+					     int ifindex, __u32 handle)
+{
+	struct qdisc_sample *s = tab->hint ? tab->hint->next : NULL;
+
+	if (!s || s->ifindex != ifindex || s->handle != handle)
+		for (s = tab->head; s; s = s->next)
+			if (s->ifindex == ifindex && s->handle == handle)
+				break;
+	if (!s) {
+		s = calloc(1, sizeof(*s));
+		if (!s) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		s->ifindex = ifindex;
+		s->handle = handle;
+		if (tab->hint) {
+			s->next = tab->hint->next;
+			tab->hint->next = s;
+		} else {
+			s->next = tab->head;
+			tab->head = s;
+		}
+	}
+	tab->hint = s;
+	return s;
+}
+
+static void qdisc_sample_free_series(struct qdisc_sample *s)
+{
+	int i;
+
+	if (!s->series)
+		return;
+	for (i = 0; i < s->layout.n; i++)
+		free(s->series[i].win);
+	free(s->series);
+	s->series = NULL;
+}
+
+/* New, recreated or missed qdiscs only set the baseline */
+static bool qdisc_sample_reset(struct qdisc_sample_tab *tab,
+			       struct qdisc_sample *s,
+			       const struct qdisc_util *q,
+			       const struct xstats_samples *xs)
+{
+	int i;
+
+	if (s->series && s->q == q && s->seen + 1 == tab->round &&
+	    s->layout.n == xs->n) {
+		for (i = 0; i < xs->n; i++) {
+			const struct xstats_sample *a = &s->layout.s[i];
+			const struct xstats_sample *b = &xs->s[i];
+
+			if (a->tin != b->tin || a->counter != b->counter ||
+			    strcmp(a->name, b->name) ||
+			    (b->counter && b->value < s->series[i].last))
+				break;
+		}
+		if (i == xs->n)
+			return false;
+	}
+
+	qdisc_sample_free_series(s);
+	s->q = q;
+	s->layout = *xs;
+	s->series = calloc(xs->n ? xs->n : 1, sizeof(*s->series));
+	if (!s->series) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < xs->n; i++) {
+		s->series[i].win = calloc(tab->window, sizeof(double));
+		if (!s->series[i].win) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		s->series[i].last = xs->s[i].value;
+	}
+	return true;
+}
+
+static int qdisc_sample_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_qdisc_sample(struct qdisc_sample_tab *tab,
+			       const struct qdisc_sample *s)
+{
+	static const unsigned int pct[] = { 50, 90, 99 };
+	double sorted[tab->window];
+	char abuf[256];
+	int i, j;
+
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "kind", "qdisc %s", s->q->id);
+	sprintf(abuf, "%x:", s->handle >> 16);
+	print_string(PRINT_ANY, "handle", " %s ", abuf);
+	if (filter_ifindex == 0)
+		print_devname(PRINT_ANY, s->ifindex);
+	if (s->parent == TC_H_ROOT) {
+		print_bool(PRINT_ANY, "root", "root ", true);
+	} else if (s->parent) {
+		print_tc_classid(abuf, sizeof(abuf), s->parent);
+		print_string(PRINT_ANY, "parent", "parent %s ", abuf);
+	}
+	print_uint(PRINT_ANY, "samples", "samples %u", s->series[0].nwin);
+	print_nl();
+
+	print_string(PRINT_FP, NULL, "  %-22s", "");
+	print_string(PRINT_FP, NULL, " %4s", "tin");
+	print_string(PRINT_FP, NULL, " %14s", "now");
+	for (j = 0; j < ARRAY_SIZE(pct); j++) {
+		sprintf(abuf, "p%u", pct[j]);
+		print_string(PRINT_FP, NULL, " %14s", abuf);
+	}
+	print_nl();
+
+	open_json_array(PRINT_JSON, "stats");
+	for (i = 0; i < s->layout.n; i++) {
+		const struct xstats_sample *x = &s->layout.s[i];
+		const struct qdisc_series *r = &s->series[i];
+		double now = r->win[(r->pos + tab->window - 1) % tab->window];
+
+		open_json_object(NULL);
+		print_string(PRINT_JSON, "name", NULL, x->name);
+		snprintf(abuf, sizeof(abuf), "%s%s", x->name,
+			 x->counter ? "/s" : "");
+		print_string(PRINT_FP, NULL, "  %-22s", abuf);
+		if (x->tin >= 0)
+			print_int(PRINT_ANY, "tin", " %4d", x->tin);
+		else
+			print_string(PRINT_FP, NULL, " %4s", "-");
+		print_float(PRINT_ANY, x->counter ? "rate" : "value",
+			    " %14.1f", now);
+
+		memcpy(sorted, r->win, r->nwin * sizeof(double));
+		qsort(sorted, r->nwin, sizeof(double), qdisc_sample_cmp);
+		for (j = 0; j < ARRAY_SIZE(pct); j++) {
+			/* nearest rank */
+			unsigned int k = (pct[j] * r->nwin + 99) / 100;
+
+			sprintf(abuf, "p%u", pct[j]);
+			print_float(PRINT_ANY, abuf, " %14.1f",
+				    sorted[k ? k - 1 : 0]);
+		}
+		close_json_object();
+		print_nl();
+	}
+	close_json_array(PRINT_JSON, NULL);
+	close_json_object();
+}
+
+static int sample_qdisc(struct nlmsghdr *n, void *arg)
+{
+	struct qdisc_sample_tab *tab = arg;
+	struct tcmsg *t = NLMSG_DATA(n);
+	int len = n->nlmsg_len - NLMSG_LENGTH(sizeof(*t));
+	struct rtattr *tb[TCA_MAX + 1], *xstats = NULL;
+	static struct xstats_samples xs;
+	const struct qdisc_util *q;
+	struct qdisc_sample *s;
+	int i;
+
+	if (n->nlmsg_type != RTM_NEWQDISC)
+		return 0;
+	if (len < 0) {
+		fprintf(stderr, "Wrong len %d\n", len);
+		return -1;
+	}
+	if (filter_ifindex && filter_ifindex != t->tcm_ifindex)
+		return 0;
+	if (filter_handle && filter_handle != t->tcm_handle)
+		return 0;
+	if (filter_parent && filter_parent != t->tcm_parent)
+		return 0;
+
+	parse_rtattr_flags(tb, TCA_MAX, TCA_RTA(t), len, NLA_F_NESTED);
+	if (!tb[TCA_KIND])
+		return 0;
+	q = get_qdisc_kind(rta_getattr_str(tb[TCA_KIND]));
+	if (!q || !q->sample_xstats)
+		return 0;
+
+	if (tb[TCA_STATS2]) {
+		struct rtattr *tbs[TCA_STATS_MAX + 1];
+
+		parse_rtattr_nested(tbs, TCA_STATS_MAX, tb[TCA_STATS2]);
+		xstats = tbs[TCA_STATS_APP];
+	}
+	if (!xstats)
+		xstats = tb[TCA_XSTATS];
+	if (!xstats)
+		return 0;
+
+	xs.n = 0;
+	q->sample_xstats(q, xstats, &xs);
+	if (!xs.n)
+		return 0;
+
+	s = qdisc_sample_get(tab, t->tcm_ifindex, t->tcm_handle);
+	s->parent = t->tcm_parent;
+	if (qdisc_sample_reset(tab, s, q, &xs)) {
+		s->seen = tab->round;
+		return 0;
+	}
+	s->seen = tab->round;
+
+	for (i = 0; i < xs.n; i++) {
+		struct qdisc_series *r = &s->series[i];
+		double v = xs.s[i].value;
+
+		if (xs.s[i].counter) {
+			v = (v - r->last) / tab->elapsed;
+			r->last = xs.s[i].value;
+		}
+		r->win[r->pos] = v;
+		r->pos = (r->pos + 1) % tab->window;
+		if (r->nwin < tab->window)
+			r->nwin++;
+	}
+	print_qdisc_sample(tab, s);
+	return 0;
+}
+
+static int tc_qdisc_sample(struct nlmsghdr *req, unsigned int interval,
+			   unsigned int window, __u32 count)
+{
+	struct qdisc_sample_tab tab = { .window = window };
+	double last = 0, now, next = monotonic_now();
+	int ret = 0;
+
+	for (;;) {
+		if (rtnl_dump_request_n(&rth, req) < 0) {
+			perror("Cannot send request");
+			ret = 1;
+			break;
+		}
+		now = monotonic_now();
+		tab.elapsed = now - last;
+		tab.round++;
+		tab.hint = NULL;
+		/* the first dump only sets the baseline */
+		if (tab.round > 1)
+			new_json_obj(json);
+		ret = rtnl_dump_filter(&rth, sample_qdisc, &tab);
+		if (tab.round > 1)
+			delete_json_obj();
+		fflush(stdout);
+		if (ret < 0) {
+			fprintf(stderr, "Dump terminated\n");
+			ret = 1;
+			break;
+		}
+		if (count && tab.round > count)
+			break;
+		last = now;
+		next += interval / 1e6;
+		monotonic_sleep_until(next);
+	}
+
+	while (tab.head) {
+		struct qdisc_sample *s = tab.head;
+
+		tab.head = s->next;
+		qdisc_sample_free_series(s);
+		free(s);
+	}
+	return ret;
+}
+
 static int tc_qdisc_list(int argc, char **argv)
 {
 	struct {
@@ -362,7 +1091,10 @@ static int tc_qdisc_list(int argc, char **argv)
 
 	char d[IFNAMSIZ] = {};
 	bool dump_invisible = false;
-	__u32 handle;
+	unsigned int interval = 0, top = 0, window = 10;
+	bool queues = false, sample = false;
+	__u32 handle, count = 0;
+	int sort = -1;
 
 	while (argc > 0) {
 		if (strcmp(*argv, "dev") == 0) {
@@ -403,6 +1135,36 @@ static int tc_qdisc_list(int argc, char **argv)
 			usage();
 		} else if (strcmp(*argv, "invisible") == 0) {
 			dump_invisible = true;
+		} else if (strcmp(*argv, "queues") == 0) {
+			queues = true;
+		} else if (strcmp(*argv, "sample") == 0) {
+			sample = true;
+		} else if (sample && strcmp(*argv, "window") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&window, *argv, 0) || !window ||
+			    window > 100000)
+				invarg("\"window\" is invalid", *argv);
+		} else if ((queues || sample) && strcmp(*argv, "interval") == 0) {
+			NEXT_ARG();
+			if (get_time(&interval, *argv) || !interval)
+				invarg("\"interval\" is invalid", *argv);
+		} else if ((queues || sample) && strcmp(*argv, "count") == 0) {
+			NEXT_ARG();
+			if (get_u32(&count, *argv, 0) || !count)
+				invarg("\"count\" is invalid", *argv);
+		} else if (queues && strcmp(*argv, "top") == 0) {
+			NEXT_ARG();
+			if (get_unsigned(&top, *argv, 0) || !top)
+				invarg("\"top\" is invalid", *argv);
+			if (sort < 0)
+				sort = QS_BYTES;
+		} else if (queues && strcmp(*argv, "by") == 0) {
+			NEXT_ARG();
+			for (sort = 0; sort < __QS_MAX; sort++)
+				if (strcmp(*argv, qs_names[sort]) == 0)
+					break;
+			if (sort == __QS_MAX)
+				invarg("\"by\" is invalid", *argv);
 		} else {
 			fprintf(stderr, "What is \"%s\"? Try \"tc qdisc help\".\n", *argv);
 			return -1;
@@ -424,6 +1186,22 @@ static int tc_qdisc_list(int argc, char **argv)
 		addattr(&req.n, 256, TCA_DUMP_INVISIBLE);
 	}
 
+	if (sample) {
+		if (queues || !interval) {
+			fprintf(stderr, "\"sample\" needs an \"interval\" and no \"queues\"\n");
+			return -1;
+		}
+		return tc_qdisc_sample(&req.n, interval, window, count);
+	}
+
+	if (queues) {
+		if (!filter_ifindex) {
+			fprintf(stderr, "\"queues\" needs a \"dev\"\n");
+			return -1;
+		}
+		return tc_qdisc_queues(&req.n, interval, count, top, sort);
+	}
+
 	if (rtnl_dump_request_n(&rth, &req.n) < 0) {
 		perror("Cannot send request");
 		return 1;
@@ -16,6 +16,7 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#include <time.h>
 
 #include "utils.h"
 #include "names.h"
@@ -27,25 +28,42 @@
 #endif
 
 static struct db_names *cls_names;
+static char *cls_names_path;
+static bool cls_names_loaded;
 
 #define NAMES_DB_USR CONF_USR_DIR "/tc_cls"
 #define NAMES_DB_ETC CONF_ETC_DIR "/tc_cls"
 
+/* The names are only loaded when a class id is first printed, so that
+ * commands that print none do not read the files. An explicit file is
+ * checked for here, to fail before anything is sent.
+ */
 int cls_names_init(char *path)
 {
+	if (path && access(path, R_OK)) {
+		fprintf(stderr, "Can't open class names file: %s\n", path);
+		return -1;
+	}
+	cls_names_path = path;
+	return 0;
+}
+
+static struct db_names *cls_names_get(void)
+{
+	struct timespec start;
 	int ret;
 
+	if (cls_names_loaded)
+		return cls_names;
+	cls_names_loaded = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	cls_names = db_names_alloc();
 	if (!cls_names)
-		return -1;
+		return NULL;
 
-	if (path) {
-		ret = db_names_load(cls_names, path);
-		if (ret == -ENOENT) {
-			fprintf(stderr, "Can't open class names file: %s\n", path);
-			return -1;
-		}
-	}
+	if (cls_names_path)
+		db_names_load(cls_names, cls_names_path);
 
 	ret = db_names_load(cls_names, NAMES_DB_ETC);
 	if (ret == -ENOENT)
@@ -56,7 +74,22 @@ int cls_names_init(char *path)
 		cls_names = NULL;
 	}
 
-	return 0;
+	tc_timing("class names", &start);
+	return cls_names;
+}
+
+/* -timing: how long a startup phase took since @start, on stderr */
+void tc_timing(const char *phase, const struct timespec *start)
+{
+	struct timespec now;
+
+	if (!show_timing)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(stderr, "timing: %s %.3f ms\n", phase,
+		(now.tv_sec - start->tv_sec) * 1e3 +
+		(now.tv_nsec - start->tv_nsec) / 1e6);
 }
 
 void cls_names_uninit(void)
@@ -149,7 +182,7 @@ int print_tc_classid(char *buf, int blen, __u32 h)
 	if (use_names) {
 		char clname[IDNAME_MAX] = {};
 
-		if (id_to_name(cls_names, h, clname))
+		if (id_to_name(cls_names_get(), h, clname))
 			snprintf(buf, blen, "%s#%s", clname, handle);
 		else
 			snprintf(buf, blen, "%s", handle);
@@ -869,6 +902,20 @@ compat_xstats:
 		*xstats = tb[TCA_XSTATS];
 }
 
+void xstats_sample_add(struct xstats_samples *xs, const char *name, int tin,
+		       bool counter, double value)
+{
+	struct xstats_sample *s;
+
+	if (xs->n >= XSTATS_SAMPLE_MAX)
+		return;
+	s = &xs->s[xs->n++];
+	s->name = name;
+	s->tin = tin;
+	s->counter = counter;
+	s->value = value;
+}
+
 static void print_masked_type(__u32 type_max,
 			      __u32 (*rta_getattr_type)(const struct rtattr *),
 			      const char *name, struct rtattr *attr,
@@ -2,7 +2,8 @@
 #ifndef _TC_UTIL_H_
 #define _TC_UTIL_H_ 1
 
-#define MAX_MSG 16384
+/* attributes nest in u16 lengths, no request can usefully be larger */
+#define MAX_MSG 65536
 #include <limits.h>
 #include <linux/if.h>
 #include <stdbool.h>
@@ -28,6 +29,24 @@ enum
 
 #define FILTER_NAMESZ	16
 
+/* xstats values for "tc qdisc show ... sample", see sample_xstats */
+#define XSTATS_SAMPLE_MAX	128
+
+struct xstats_sample {
+	const char	*name;
+	int		tin;		/* tin or band, -1 if none */
+	bool		counter;	/* reported as a rate */
+	double		value;
+};
+
+struct xstats_samples {
+	int			n;
+	struct xstats_sample	s[XSTATS_SAMPLE_MAX];
+};
+
+void xstats_sample_add(struct xstats_samples *xs, const char *name, int tin,
+		       bool counter, double value);
+
 struct qdisc_util {
 	struct qdisc_util *next;
 	const char *id;
@@ -37,6 +56,9 @@ struct qdisc_util {
 			  FILE *f, struct rtattr *opt);
 	int (*print_xstats)(const struct qdisc_util *qu,
 			    FILE *f, struct rtattr *xstats);
+	/* the same xstats as values, in the same order every time */
+	void (*sample_xstats)(const struct qdisc_util *qu,
+			      struct rtattr *xstats, struct xstats_samples *xs);
 
 	int (*parse_copt)(const struct qdisc_util *qu, int argc,
 			  char **argv, struct nlmsghdr *n, const char *dev);
@@ -72,6 +94,7 @@ struct exec_util {
 };
 
 const char *get_tc_lib(void);
+void *get_tc_util(const char *so, const char *sym);
 
 const struct qdisc_util *get_qdisc_kind(const char *str);
 const struct filter_util *get_filter_kind(const char *str);
@@ -118,6 +141,7 @@ int prio_print_opt(const struct qdisc_util *qu, FILE *f, struct rtattr *opt);
 
 int cls_names_init(char *path);
 void cls_names_uninit(void);
+void tc_timing(const char *phase, const struct timespec *start);
 
 #define CLOCKID_INVALID (-1)
 int get_clockid(__s32 *val, const char *arg);
@@ -0,0 +1,17 @@
+#!/bin/sh
+. lib/generic.sh
+
+# Dumps sent in datagrams much larger than the initial receive buffer
+# must reach the filters whole, on each of the receive paths.
+TOOL=./tools/dump_dgram
+[ -x "$TOOL" ] || ts_skip
+
+for mode in plain prescan pipeline; do
+	"$TOOL" $mode 2> $STD_ERR > $STD_OUT
+	if [ $? -ne 0 ]; then
+		ts_err "$0: $mode dump failed"
+		ts_err_cat $STD_ERR
+	else
+		test_on "^$mode: 56 messages$"
+	fi
+done
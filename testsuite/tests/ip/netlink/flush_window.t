@@ -0,0 +1,56 @@
+#!/bin/sh
+. lib/generic.sh
+
+# Deletes that fail are answered before sendmsg() returns, so a flush or
+# -batch-async window of them must not overrun the receive buffer.
+COUNT=5000
+DEV="$(rand_dev)"
+TMP="$(mktemp)"
+
+ts_ip "$0" "Add $DEV veth interface" link add dev $DEV type veth
+ts_ip "$0" "Add primary address" addr add 10.1.0.1/16 dev $DEV
+
+# Removing the primary takes the secondaries with it, and their deletes
+# fail with EADDRNOTAVAIL.
+for i in $(seq 1 $COUNT); do
+	echo "addr add 10.1.$((i / 250 + 1)).$((i % 250 + 1))/16 dev $DEV"
+done > "$TMP"
+ts_ip "$0" "Add $COUNT secondary addresses" -batch "$TMP"
+
+timeout 60 "$IP" addr flush dev $DEV 2> $STD_ERR > $STD_OUT
+if [ $? -ne 0 ]; then
+	ts_err "$0: flush of $COUNT secondaries failed"
+	ts_err_cat $STD_ERR
+else
+	echo "$0: flush of $COUNT secondaries succeeded"
+fi
+ts_ip "$0" "Show addresses after flush" -4 -o addr show dev $DEV
+test_lines_count 0
+
+# A window full of failing requests: every line gets its error, and the
+# batch completes instead of waiting for an ACK that was dropped.
+for i in $(seq 1 $COUNT); do
+	echo "addr del 10.2.$((i / 250 + 1)).$((i % 250 + 1))/16 dev $DEV"
+done > "$TMP"
+timeout 60 "$IP" -force -batch-async 1000 -batch "$TMP" 2> $STD_ERR > $STD_OUT
+ret=$?
+if [ $ret -eq 124 ]; then
+	ts_err "$0: -batch-async of failing lines did not complete"
+elif [ $ret -eq 0 ]; then
+	ts_err "$0: -batch-async passed when it should have failed"
+else
+	echo "$0: -batch-async failed, as expected"
+fi
+cp $STD_ERR $STD_OUT
+test_on "^Command failed $TMP:1$"
+test_on "^Command failed $TMP:$COUNT$"
+test_on_not "No buffer space"
+echo -n "test on failed lines ($COUNT): "
+if [ $(grep -c "^Command failed" $STD_OUT) -eq $COUNT ]; then
+	pr_success
+else
+	pr_failed
+fi
+
+rm "$TMP"
+ts_ip "$0" "Del $DEV veth interface" link del dev $DEV
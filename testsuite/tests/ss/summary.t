@@ -0,0 +1,20 @@
+#!/bin/sh
+
+. lib/generic.sh
+
+# "ss -s" prints what the sockstat files and the snmp Tcp line hold
+export PROC_NET_SOCKSTAT="$(dirname $0)/summary.sockstat"
+export PROC_NET_SOCKSTAT6="$(dirname $0)/summary.sockstat6"
+export PROC_NET_SNMP="$(dirname $0)/summary.snmp"
+
+ts_log "[Testing summary]"
+
+ts_ss "$0" "Summary" -s
+test_on "^Total: 1234$"
+test_on "^TCP:   47 \(estab 2, closed 16, orphaned 1, timewait 7\)$"
+test_on "^RAW.  3 +2 +1 +$"
+test_on "^UDP.  14 +9 +5 +$"
+test_on "^TCP.  31 +20 +11 +$"
+test_on "^INET.  48 +31 +17 +$"
+test_on "^FRAG.  3 +3 +0 +$"
+test_lines_count 10
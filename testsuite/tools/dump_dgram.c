@@ -0,0 +1,205 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * dump_dgram.c	Testsuite helper feeding large dump datagrams to
+ *		rtnl_dump_filter
+ *
+ * A child writes a dump over an AF_UNIX datagram socketpair, in datagrams
+ * both smaller and much larger than the initial receive buffer, and the
+ * filter checks that every message arrives whole and in order. The mode
+ * argument picks the receive path: plain, prescan or pipeline.
+ */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/rtnetlink.h>
+#include <libnetlink.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DUMP_SEQ	4711
+#define DUMP_PID	4242
+
+/* datagrams of count messages of msglen bytes each */
+static const struct {
+	unsigned int count;
+	unsigned int msglen;
+} dgrams[] = {
+	{ 1, 4000 },
+	{ 1, 200000 },	/* one object larger than any buffer before it */
+	{ 50, 1000 },
+	{ 3, 70000 },
+	{ 1, 120000 },
+};
+
+static unsigned int received, prescanned;
+
+static unsigned int dump_total(void)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < sizeof(dgrams) / sizeof(dgrams[0]); i++)
+		n += dgrams[i].count;
+	return n;
+}
+
+static void fill_msg(struct nlmsghdr *h, unsigned int msglen, __u32 idx)
+{
+	unsigned char *p = NLMSG_DATA(h);
+
+	h->nlmsg_len = msglen;
+	h->nlmsg_type = RTM_NEWLINK;
+	h->nlmsg_flags = NLM_F_MULTI;
+	h->nlmsg_seq = DUMP_SEQ;
+	h->nlmsg_pid = DUMP_PID;
+	memcpy(p, &idx, sizeof(idx));
+	memset(p + sizeof(idx), idx & 0xff,
+	       msglen - NLMSG_HDRLEN - sizeof(idx));
+}
+
+static int write_dump(int fd)
+{
+	struct {
+		struct nlmsghdr	n;
+		int		error;
+	} done = {
+		.n = {
+			.nlmsg_len = NLMSG_LENGTH(sizeof(int)),
+			.nlmsg_type = NLMSG_DONE,
+			.nlmsg_flags = NLM_F_MULTI,
+			.nlmsg_seq = DUMP_SEQ,
+			.nlmsg_pid = DUMP_PID,
+		},
+	};
+	unsigned int i, j;
+	__u32 idx = 0;
+
+	for (i = 0; i < sizeof(dgrams) / sizeof(dgrams[0]); i++) {
+		size_t len = dgrams[i].count * NLMSG_ALIGN(dgrams[i].msglen);
+		char *buf = calloc(1, len);
+
+		if (!buf)
+			return -1;
+		for (j = 0; j < dgrams[i].count; j++)
+			fill_msg((void *)(buf + j * NLMSG_ALIGN(dgrams[i].msglen)),
+				 dgrams[i].msglen, idx++);
+		if (send(fd, buf, len, 0) != (ssize_t)len) {
+			perror("send");
+			free(buf);
+			return -1;
+		}
+		free(buf);
+	}
+
+	if (send(fd, &done, sizeof(done), 0) != sizeof(done)) {
+		perror("send");
+		return -1;
+	}
+	return 0;
+}
+
+static int check_msg(struct nlmsghdr *n, void *arg)
+{
+	const unsigned char *p = NLMSG_DATA(n);
+	unsigned int len = NLMSG_PAYLOAD(n, 0);
+	unsigned int i;
+	__u32 idx;
+
+	if (len < sizeof(idx)) {
+		fprintf(stderr, "message %u: short payload %u\n",
+			received, len);
+		return -1;
+	}
+	memcpy(&idx, p, sizeof(idx));
+	if (idx != received) {
+		fprintf(stderr, "message %u: got message %u\n", received, idx);
+		return -1;
+	}
+	for (i = sizeof(idx); i < len; i++) {
+		if (p[i] != (idx & 0xff)) {
+			fprintf(stderr, "message %u: corrupt at byte %u\n",
+				idx, i);
+			return -1;
+		}
+	}
+	received++;
+	return 0;
+}
+
+static void count_prescan(int proto, const struct nlmsghdr *n)
+{
+	prescanned++;
+}
+
+int main(int argc, char **argv)
+{
+	struct rtnl_handle rth = {
+		.dump = DUMP_SEQ,
+		.local.nl_pid = DUMP_PID,
+		.proto = NETLINK_ROUTE,
+	};
+	int sndbuf = 1 << 20;
+	int sv[2], status, ret;
+	pid_t pid;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: dump_dgram { plain | prescan | pipeline }\n");
+		return 1;
+	}
+
+	if (strcmp(argv[1], "prescan") == 0) {
+		rtnl_dump_set_prescan(count_prescan);
+	} else if (strcmp(argv[1], "pipeline") == 0) {
+		rtnl_dump_set_pipeline(4);
+	} else if (strcmp(argv[1], "plain") != 0) {
+		fprintf(stderr, "Unknown mode \"%s\"\n", argv[1]);
+		return 1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	/* capped at twice net.core.wmem_max, still room for 200000 bytes */
+	setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		_exit(write_dump(sv[1]) < 0);
+	}
+	close(sv[1]);
+
+	rth.fd = sv[0];
+	ret = rtnl_dump_filter(&rth, check_msg, NULL);
+	rtnl_close(&rth);
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		fprintf(stderr, "writer failed\n");
+		return 1;
+	}
+	if (ret < 0) {
+		fprintf(stderr, "dump failed: %d\n", ret);
+		return 1;
+	}
+	if (received != dump_total()) {
+		fprintf(stderr, "received %u of %u messages\n",
+			received, dump_total());
+		return 1;
+	}
+	if (strcmp(argv[1], "prescan") == 0 && prescanned != received) {
+		fprintf(stderr, "prescanned %u of %u messages\n",
+			prescanned, received);
+		return 1;
+	}
+
+	printf("%s: %u messages\n", argv[1], received);
+	return 0;
+}
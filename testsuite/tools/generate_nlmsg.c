@@ -6,11 +6,22 @@
  */
 
 #include <netinet/ether.h>
+#include <netinet/tcp.h>
 #include <libnetlink.h>
 #include <sys/socket.h>
 #include <linux/if.h>
+#include <linux/neighbour.h>
+#include <linux/inet_diag.h>
+#include <linux/sock_diag.h>
+#include <linux/pkt_cls.h>
+#include <linux/pkt_sched.h>
+#include <linux/tc_act/tc_gact.h>
+#include <arpa/inet.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 int fill_vf_rate_test(void *buf, size_t buflen)
 {
@@ -87,12 +98,296 @@ int fill_vf_rate_test(void *buf, size_t buflen)
 	return h->nlmsg_len;
 }
 
-int main(void)
+/*
+ * Synthetic dumps for testsuite/tools/nlbench.sh, one message per call
+ * for object @i. Interfaces other than the generated links are lo, so
+ * resolving them costs one lookup in the whole run.
+ */
+static int fill_route(void *buf, size_t buflen, unsigned int i)
+{
+	__u32 dst = htonl(0x0a000000 + (i << 8));
+	__u32 gw = htonl(0xc0000201 + i % 64);
+	struct nlmsghdr *h = buf;
+	struct rtmsg *rtm;
+
+	h->nlmsg_type = RTM_NEWROUTE;
+	h->nlmsg_len = NLMSG_LENGTH(sizeof(*rtm));
+
+	rtm = NLMSG_DATA(h);
+	rtm->rtm_family = AF_INET;
+	rtm->rtm_dst_len = 24;
+	rtm->rtm_table = RT_TABLE_MAIN;
+	rtm->rtm_protocol = RTPROT_BGP;
+	rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+	rtm->rtm_type = RTN_UNICAST;
+
+	ATTR_32(RTA_TABLE, RT_TABLE_MAIN);
+	ATTR_L(RTA_DST, &dst, sizeof(dst));
+	ATTR_32(RTA_PRIORITY, 20);
+	ATTR_L(RTA_GATEWAY, &gw, sizeof(gw));
+	ATTR_32(RTA_OIF, 1);
+
+	return h->nlmsg_len;
+}
+
+static int fill_link(void *buf, size_t buflen, unsigned int i)
+{
+	__u8 mac[ETH_ALEN] = { 0x02, 0, i >> 24, i >> 16, i >> 8, i };
+	__u8 bcmac[ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	struct nlmsghdr *h = buf;
+	struct ifinfomsg *ifi;
+	char name[IFNAMSIZ];
+
+	h->nlmsg_type = RTM_NEWLINK;
+	h->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+
+	ifi = NLMSG_DATA(h);
+	ifi->ifi_type = ARPHRD_ETHER;
+	ifi->ifi_index = 1000 + i;
+	ifi->ifi_flags = IFF_RUNNING | IFF_BROADCAST |
+			 IFF_MULTICAST | IFF_UP | IFF_LOWER_UP;
+
+	snprintf(name, sizeof(name), "bench%u", i);
+	ATTR_STRZ(IFLA_IFNAME, name);
+	ATTR_32(IFLA_TXQLEN, 1000);
+	ATTR_8(IFLA_OPERSTATE, 6);
+	ATTR_8(IFLA_LINKMODE, 0);
+	ATTR_32(IFLA_MTU, 1500);
+	ATTR_32(IFLA_GROUP, 0);
+	ATTR_32(IFLA_PROMISCUITY, 0);
+	ATTR_32(IFLA_NUM_TX_QUEUES, 1);
+	ATTR_32(IFLA_NUM_RX_QUEUES, 1);
+	ATTR_8(IFLA_CARRIER, 1);
+	ATTR_STRZ(IFLA_QDISC, "noqueue");
+	ATTR_L(IFLA_ADDRESS, mac, ETH_ALEN);
+	ATTR_L(IFLA_BROADCAST, bcmac, ETH_ALEN);
+
+	return h->nlmsg_len;
+}
+
+static int fill_addr(void *buf, size_t buflen, unsigned int i, int family)
+{
+	struct ifa_cacheinfo ci = {
+		.ifa_prefered = 0xffffffffU,	/* forever */
+		.ifa_valid = 0xffffffffU,
+	};
+	struct nlmsghdr *h = buf;
+	struct ifaddrmsg *ifa;
+	__u8 addr[16] = {};
+	int len;
+
+	h->nlmsg_type = RTM_NEWADDR;
+	h->nlmsg_len = NLMSG_LENGTH(sizeof(*ifa));
+
+	ifa = NLMSG_DATA(h);
+	ifa->ifa_family = family;
+	ifa->ifa_index = 1000 + i;
+	ifa->ifa_flags = IFA_F_PERMANENT;
+	ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+
+	if (family == AF_INET) {
+		__u32 a = htonl(0x0a000001 + (i << 8));
+
+		memcpy(addr, &a, 4);
+		len = 4;
+		ifa->ifa_prefixlen = 24;
+	} else {
+		addr[0] = 0x20;
+		addr[1] = 0x01;
+		addr[2] = 0x0d;
+		addr[3] = 0xb8;
+		addr[8] = i >> 24;
+		addr[9] = i >> 16;
+		addr[10] = i >> 8;
+		addr[11] = i;
+		addr[15] = 1;
+		len = 16;
+		ifa->ifa_prefixlen = 64;
+	}
+
+	ATTR_L(IFA_ADDRESS, addr, len);
+	if (family == AF_INET)
+		ATTR_L(IFA_LOCAL, addr, len);
+	ATTR_32(IFA_FLAGS, IFA_F_PERMANENT);
+	ATTR_L(IFA_CACHEINFO, &ci, sizeof(ci));
+
+	return h->nlmsg_len;
+}
+
+static int fill_socket(void *buf, size_t buflen, unsigned int i)
+{
+	struct nlmsghdr *h = buf;
+	struct inet_diag_msg *r;
+
+	h->nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	h->nlmsg_len = NLMSG_LENGTH(sizeof(*r));
+
+	r = NLMSG_DATA(h);
+	r->idiag_family = AF_INET;
+	r->idiag_state = TCP_ESTABLISHED;
+	r->id.idiag_sport = htons(443);
+	r->id.idiag_dport = htons(1024 + i % 60000);
+	r->id.idiag_src[0] = htonl(0xc0000201);
+	r->id.idiag_dst[0] = htonl(0x0a000000 + i / 60000);
+	r->id.idiag_cookie[0] = i;
+	r->idiag_inode = 100000 + i;
+
+	return h->nlmsg_len;
+}
+
+static int fill_flower(void *buf, size_t buflen, unsigned int i)
+{
+	struct tc_gact gact = { .action = TC_ACT_SHOT, .index = i + 1 };
+	__u32 dst = htonl(0x0a000000 + i), dmask = 0xffffffff;
+	__u16 port = htons(80), pmask = 0xffff;
+	struct rtattr *opts, *acts, *act, *aopts;
+	struct nlmsghdr *h = buf;
+	struct tcmsg *t;
+
+	h->nlmsg_type = RTM_NEWTFILTER;
+	h->nlmsg_len = NLMSG_LENGTH(sizeof(*t));
+
+	t = NLMSG_DATA(h);
+	t->tcm_family = AF_UNSPEC;
+	t->tcm_ifindex = 1;
+	t->tcm_handle = i + 1;
+	t->tcm_parent = TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS);
+	t->tcm_info = TC_H_MAKE(1 << 16, htons(ETH_P_IP));
+
+	ATTR_STRZ(TCA_KIND, "flower");
+	ATTR_32(TCA_CHAIN, 0);
+
+	opts = NEST(TCA_OPTIONS);
+	ASSERT(addattr16(h, buflen, TCA_FLOWER_KEY_ETH_TYPE, htons(ETH_P_IP)));
+	ATTR_8(TCA_FLOWER_KEY_IP_PROTO, IPPROTO_TCP);
+	ATTR_L(TCA_FLOWER_KEY_IPV4_DST, &dst, sizeof(dst));
+	ATTR_L(TCA_FLOWER_KEY_IPV4_DST_MASK, &dmask, sizeof(dmask));
+	ATTR_L(TCA_FLOWER_KEY_TCP_DST, &port, sizeof(port));
+	ATTR_L(TCA_FLOWER_KEY_TCP_DST_MASK, &pmask, sizeof(pmask));
+	ATTR_32(TCA_FLOWER_FLAGS, TCA_CLS_FLAGS_NOT_IN_HW);
+
+	acts = NEST(TCA_FLOWER_ACT);
+	act = NEST(1);
+	ATTR_STRZ(TCA_ACT_KIND, "gact");
+	aopts = NEST(TCA_ACT_OPTIONS);
+	ATTR_L(TCA_GACT_PARMS, &gact, sizeof(gact));
+	NEST_END(aopts);
+	NEST_END(act);
+	NEST_END(acts);
+	NEST_END(opts);
+
+	return h->nlmsg_len;
+}
+
+static int fill_fdb(void *buf, size_t buflen, unsigned int i)
+{
+	__u8 mac[ETH_ALEN] = { 0x02, 0x01, i >> 24, i >> 16, i >> 8, i };
+	struct nda_cacheinfo ci = { .ndm_used = 100, .ndm_updated = 100 };
+	struct nlmsghdr *h = buf;
+	struct ndmsg *ndm;
+
+	h->nlmsg_type = RTM_NEWNEIGH;
+	h->nlmsg_len = NLMSG_LENGTH(sizeof(*ndm));
+
+	ndm = NLMSG_DATA(h);
+	ndm->ndm_family = AF_BRIDGE;
+	ndm->ndm_ifindex = 1;
+	ndm->ndm_state = NUD_REACHABLE;
+	ndm->ndm_flags = NTF_SELF;
+
+	ATTR_L(NDA_LLADDR, mac, ETH_ALEN);
+	ASSERT(addattr16(h, buflen, NDA_VLAN, 1 + i % 4094));
+	ATTR_L(NDA_CACHEINFO, &ci, sizeof(ci));
+
+	return h->nlmsg_len;
+}
+
+static int put_msg(void *buf, int len)
+{
+	if (len < 0) {
+		fprintf(stderr, "Message does not fit\n");
+		return -1;
+	}
+	if (fwrite(buf, NLMSG_ALIGN(len), 1, stdout) != 1) {
+		perror("fwrite()");
+		return -1;
+	}
+	return 0;
+}
+
+#define FILL(fn, ...)							\
+	do {								\
+		memset(buf, 0, sizeof(buf));				\
+		if (put_msg(buf, fn(buf, sizeof(buf), ##__VA_ARGS__)))	\
+			return 1;					\
+	} while (0)
+
+/* Write a dump of @count objects of @type to stdout */
+static int generate_dump(const char *type, unsigned int count)
+{
+	char buf[16384];
+	unsigned int i;
+
+	if (strcmp(type, "routes") == 0) {
+		/* as "ip route save" writes it, for "ip route showdump" */
+		__u32 magic = 0x45311224;
+
+		if (fwrite(&magic, sizeof(magic), 1, stdout) != 1) {
+			perror("fwrite()");
+			return 1;
+		}
+		for (i = 0; i < count; i++)
+			FILL(fill_route, i);
+	} else if (strcmp(type, "links") == 0) {
+		for (i = 0; i < count; i++) {
+			FILL(fill_link, i);
+			FILL(fill_addr, i, AF_INET);
+			FILL(fill_addr, i, AF_INET6);
+		}
+	} else if (strcmp(type, "sockets") == 0) {
+		struct nlmsghdr done = {
+			.nlmsg_len = NLMSG_LENGTH(0),
+			.nlmsg_type = NLMSG_DONE,
+		};
+
+		for (i = 0; i < count; i++)
+			FILL(fill_socket, i);
+		if (put_msg(&done, done.nlmsg_len))
+			return 1;
+	} else if (strcmp(type, "flower") == 0) {
+		for (i = 0; i < count; i++)
+			FILL(fill_flower, i);
+	} else if (strcmp(type, "fdb") == 0) {
+		for (i = 0; i < count; i++)
+			FILL(fill_fdb, i);
+	} else {
+		fprintf(stderr,
+			"Unknown dump \"%s\", try routes, links, sockets, flower or fdb\n",
+			type);
+		return 1;
+	}
+
+	if (fflush(stdout)) {
+		perror("fflush()");
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
 {
 	char buf[16384] = { 0 };
 	int msglen;
 	FILE *fp;
 
+	/* generate_nlmsg TYPE COUNT: a synthetic dump for benchmarks */
+	if (argc == 3)
+		return generate_dump(argv[1], strtoul(argv[2], NULL, 0));
+	if (argc != 1) {
+		fprintf(stderr, "Usage: generate_nlmsg [ TYPE COUNT ]\n");
+		return 1;
+	}
+
 	msglen = fill_vf_rate_test(buf, sizeof(buf));
 	if (msglen < 0) {
 		fprintf(stderr, "fill_vf_rate_test() failed!\n");
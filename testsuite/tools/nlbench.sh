@@ -0,0 +1,122 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Time how fast ip, tc, ss and bridge parse and print large dumps. The
+# dumps are synthetic, made by generate_nlmsg, and replayed from files
+# through the paths the tools already have for that, so no kernel has
+# to hold the state:
+#
+#   routes   ip route showdump            text and JSON
+#   links    ip monitor file              text, links with 2 addresses
+#   sockets  ss -tan with TCPDIAG_FILE    text
+#   flower   tc monitor file              text, with a gact action
+#   fdb      bridge monitor file          text
+#
+# Every case prints one JSON object per line with the best and median
+# time of RUNS runs, to be kept and compared between builds.
+#
+# Usage: nlbench.sh [ CASE ... ]
+#   IP, TC, SS, BRIDGE	binaries to time, the ones of this tree by default
+#   SCALE		divide the object counts by this, 1 by default
+#   RUNS		runs per case, 3 by default
+
+TOP=$(cd "$(dirname "$0")/../.." && pwd)
+GEN=${GEN:-$TOP/testsuite/tools/generate_nlmsg}
+IP=${IP:-$TOP/ip/ip}
+TC=${TC:-$TOP/tc/tc}
+SS=${SS:-$TOP/misc/ss}
+BRIDGE=${BRIDGE:-$TOP/bridge/bridge}
+SCALE=${SCALE:-1}
+RUNS=${RUNS:-3}
+
+declare -A COUNT=(
+	[routes]=1000000
+	[links]=100000
+	[sockets]=2000000
+	[flower]=500000
+	[fdb]=1000000
+)
+CASES="routes links sockets flower fdb"
+
+DIR=$(mktemp -d /tmp/nlbench.XXXXXX) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+now()
+{
+	date +%s%N
+}
+
+# bench CASE TOOL FORMAT COMMAND...: the command reads $DUMP
+bench()
+{
+	local c=$1 tool=$2 fmt=$3 i t0 times=""
+
+	shift 3
+	for ((i = 0; i < RUNS; i++)); do
+		t0=$(now)
+		if ! "$@" >/dev/null 2>"$DIR/err"; then
+			echo "$c: $tool $fmt failed:" >&2
+			head -5 "$DIR/err" >&2
+			return 1
+		fi
+		times="$times $(($(now) - t0))"
+	done
+
+	echo $times | tr ' ' '\n' | sort -n | awk \
+		-v c="$c" -v tool="$tool" -v fmt="$fmt" \
+		-v n="${COUNT[$c]}" -v bytes="$(stat -c %s "$DUMP")" '
+		{ t[NR] = $1 / 1e9 }
+		END {
+			med = t[int((NR + 1) / 2)]
+			printf "{\"case\":\"%s\",\"tool\":\"%s\",\"format\":\"%s\",", c, tool, fmt
+			printf "\"objects\":%d,\"bytes\":%d,\"runs\":%d,", n, bytes, NR
+			printf "\"best_s\":%.6f,\"median_s\":%.6f,", t[1], med
+			printf "\"objects_per_s\":%.0f}\n", (t[1] > 0 ? n / t[1] : 0)
+		}'
+}
+
+showdump()
+{
+	"$IP" "$@" route showdump <"$DUMP"
+}
+
+tcpdiag()
+{
+	TCPDIAG_FILE=$DUMP "$SS" -tan
+}
+
+if [ ! -x "$GEN" ]; then
+	echo "$GEN is missing, run \"make -C testsuite/tools\" first" >&2
+	exit 1
+fi
+
+for c in ${@:-$CASES}; do
+	if [ -z "${COUNT[$c]}" ]; then
+		echo "Unknown case \"$c\", try: $CASES" >&2
+		exit 1
+	fi
+	COUNT[$c]=$((COUNT[$c] / SCALE))
+
+	DUMP=$DIR/$c
+	"$GEN" "$c" "${COUNT[$c]}" >"$DUMP" || exit 1
+
+	case $c in
+	routes)
+		bench $c ip text showdump
+		bench $c ip json showdump -j
+		;;
+	links)
+		bench $c ip text "$IP" monitor file "$DUMP"
+		;;
+	sockets)
+		bench $c ss text tcpdiag
+		;;
+	flower)
+		bench $c tc text "$TC" monitor file "$DUMP"
+		;;
+	fdb)
+		bench $c bridge text "$BRIDGE" monitor file "$DUMP"
+		;;
+	esac
+	rm -f "$DUMP"
+done
@@ -0,0 +1,140 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# Provisioning throughput against a real kernel: in a network namespace
+# of its own, create links, routes, neighbours, FDB entries and tc
+# filters with -batch, then flush them again. Every phase prints one
+# JSON object per line with its operations per second, the netlink
+# requests and syscalls of NL_STATS=1 and the peak RSS of the tool.
+#
+# The batch phases run once per MODE, to compare the batch engines:
+#   sync    plain -batch, an ACK per line
+#   async   -batch-async WINDOW
+#   jobs    -batch-jobs JOBS; the workers report no netlink counts,
+#           the peak RSS is that of the largest one
+#
+# Usage: nlload.sh [ MODE ... ]
+#   LINKS ROUTES NEIGHS FDBS FILTERS	counts, see below for defaults
+#   WINDOW JOBS				for async and jobs
+#   IP TC BRIDGE			the binaries of this tree by default
+
+TOP=$(cd "$(dirname "$0")/../.." && pwd)
+IP=${IP:-$TOP/ip/ip}
+TC=${TC:-$TOP/tc/tc}
+BRIDGE=${BRIDGE:-$TOP/bridge/bridge}
+LINKS=${LINKS:-1000}
+ROUTES=${ROUTES:-100000}
+NEIGHS=${NEIGHS:-100000}
+FDBS=${FDBS:-100000}
+FILTERS=${FILTERS:-10000}
+WINDOW=${WINDOW:-256}
+JOBS=${JOBS:-4}
+
+if [ -z "$NLLOAD_NETNS" ]; then
+	NLLOAD_NETNS=1 exec unshare -n "$0" "$@"
+	echo "Cannot create a network namespace" >&2
+	exit 1
+fi
+
+DIR=$(mktemp -d /tmp/nlload.XXXXXX) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+now()
+{
+	date +%s%N
+}
+
+# phase NAME OPS COMMAND...
+phase()
+{
+	local name=$1 ops=$2 t0 t1 rc
+
+	shift 2
+	t0=$(now)
+	NL_STATS=1 "$@" >/dev/null 2>"$DIR/err"
+	rc=$?
+	t1=$(now)
+
+	awk -v mode="$MODE" -v phase="$name" -v ops="$ops" -v rc=$rc \
+		-v ns=$((t1 - t0)) '
+		/^netlink: / { req += $2 }
+		/^  send: / { send += $2 }
+		/^  recv: / { recv += $2 }
+		/^  peak rss: / { rss = $3 + 0 > rss ? $3 + 0 : rss }
+		END {
+			s = ns / 1e9
+			printf "{\"mode\":\"%s\",\"phase\":\"%s\",\"ops\":%d,", mode, phase, ops
+			printf "\"seconds\":%.6f,\"ops_per_s\":%.0f,", s, (s > 0 ? ops / s : 0)
+			printf "\"requests\":%d,\"send_calls\":%d,\"recv_calls\":%d,", req, send, recv
+			printf "\"peak_rss_kb\":%d,\"failed\":%s}\n", rss, (rc ? "true" : "false")
+		}' "$DIR/err"
+	if [ $rc -ne 0 ]; then
+		grep -v "^netlink: \|^  " "$DIR/err" | head -5 >&2
+	fi
+}
+
+# gen FILE COUNT AWK: write COUNT batch lines, AWK prints line i
+gen()
+{
+	awk -v n="$2" -v links="$LINKS" -v kind="$KIND" \
+		"BEGIN { for (i = 0; i < n; i++) { $3 } }" >"$1"
+}
+
+# dummy links if the kernel has them, veth pairs otherwise
+KIND=dummy
+if ! "$IP" link add nlprobe type dummy 2>/dev/null; then
+	KIND=veth
+else
+	"$IP" link del nlprobe
+fi
+
+gen "$DIR/links" "$LINKS" '
+	if (kind == "dummy")
+		printf "link add nl%d type dummy\n", i
+	else
+		printf "link add nl%d type veth peer name nlp%d\n", i, i'
+gen "$DIR/up" "$LINKS" 'printf "link set nl%d up\n", i'
+gen "$DIR/linksdel" "$LINKS" 'printf "link del nl%d\n", i'
+gen "$DIR/routes" "$ROUTES" '
+	printf "route add 10.%d.%d.%d/32 dev nl%d\n",
+		int(i / 65536) % 256, int(i / 256) % 256, i % 256, i % links'
+gen "$DIR/neighs" "$NEIGHS" '
+	printf "neigh add 172.%d.%d.%d lladdr 02:00:00:%02x:%02x:%02x dev nl%d nud permanent\n",
+		16 + int(i / 65536) % 16, int(i / 256) % 256, i % 256,
+		int(i / 65536) % 256, int(i / 256) % 256, i % 256, i % links'
+gen "$DIR/fdbs" "$FDBS" '
+	printf "fdb add 02:01:00:%02x:%02x:%02x dev nl0 master static\n",
+		int(i / 65536) % 256, int(i / 256) % 256, i % 256'
+gen "$DIR/filters" "$FILTERS" '
+	printf "filter add dev nl0 ingress pref 1 protocol ip u32 match ip dst 10.%d.%d.%d/32 flowid 1:1\n",
+		int(i / 65536) % 256, int(i / 256) % 256, i % 256'
+
+for MODE in ${@:-sync}; do
+	case $MODE in
+	sync)	FLAGS="" ;;
+	async)	FLAGS="-batch-async $WINDOW" ;;
+	jobs)	FLAGS="-batch-jobs $JOBS" ;;
+	*)
+		echo "Unknown mode \"$MODE\", try sync, async or jobs" >&2
+		exit 1
+		;;
+	esac
+
+	phase "links add" "$LINKS" "$IP" $FLAGS -batch "$DIR/links"
+	phase "links up" "$LINKS" "$IP" $FLAGS -batch "$DIR/up"
+	"$IP" link add nlbr0 type bridge
+	"$IP" link set nl0 master nlbr0
+	"$TC" qdisc add dev nl0 clsact
+
+	phase "routes add" "$ROUTES" "$IP" $FLAGS -batch "$DIR/routes"
+	phase "neighs add" "$NEIGHS" "$IP" $FLAGS -batch "$DIR/neighs"
+	phase "fdbs add" "$FDBS" "$BRIDGE" $FLAGS -batch "$DIR/fdbs"
+	phase "filters add" "$FILTERS" "$TC" $FLAGS -batch "$DIR/filters"
+
+	phase "filters flush" "$FILTERS" "$TC" filter del dev nl0 ingress
+	phase "fdbs flush" "$FDBS" "$BRIDGE" fdb flush dev nlbr0 brport nl0 static
+	phase "neighs flush" "$NEIGHS" "$IP" -4 neigh flush nud permanent
+	phase "routes flush" "$ROUTES" "$IP" -4 route flush proto boot
+	"$IP" link del nlbr0
+	phase "links del" "$LINKS" "$IP" $FLAGS -batch "$DIR/linksdel"
+done
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include <linux/tipc_netlink.h>
 #include <linux/tipc.h>
@@ -533,9 +534,246 @@ static int link_stat_show_cb(const struct nlmsghdr *nlh, void *data)
 	return _show_link_stat(name, attrs, prop, stats);
 }
 
+/*
+ * "stat show interval SECS": the links are dumped every SECS seconds on
+ * the one TIPC socket, and the change of the traffic counters since the
+ * last dump is printed per second. The last counters of every link are
+ * kept in a hash table by link name; a link shows up from its second
+ * dump on.
+ */
+static const struct {
+	int attr;
+	const char *key;
+	const char *title;
+} link_rates[] = {
+	{ TIPC_NLA_STATS_TX_INFO,	"tx_packets",	"TX pkt/s" },
+	{ TIPC_NLA_STATS_RX_INFO,	"rx_packets",	"RX pkt/s" },
+	{ TIPC_NLA_STATS_TX_FRAGMENTS,	"tx_fragments",	"TX frag/s" },
+	{ TIPC_NLA_STATS_RX_FRAGMENTS,	"rx_fragments",	"RX frag/s" },
+	{ TIPC_NLA_STATS_RETRANSMITTED,	"retransmitted", "Retrans/s" },
+	{ TIPC_NLA_STATS_LINK_CONGS,	"congestions",	"Congs/s" },
+};
+
+#define LINK_RATES		ARRAY_SIZE(link_rates)
+#define LINK_SAMPLE_BUCKETS	256
+
+struct link_sample {
+	struct link_sample *next;
+	unsigned int tick;
+	uint32_t ctr[LINK_RATES];
+	char name[TIPC_MAX_LINK_NAME];
+};
+
+struct link_watch {
+	const char *link;
+	struct link_sample *tab[LINK_SAMPLE_BUCKETS];
+	unsigned int tick;
+	double secs;
+};
+
+static struct link_sample *link_sample_get(struct link_watch *w,
+					   const char *name, bool *created)
+{
+	unsigned int h = 5381;
+	struct link_sample *ls;
+	const char *p;
+
+	for (p = name; *p; p++)
+		h = h * 33 + (unsigned char)*p;
+	h %= LINK_SAMPLE_BUCKETS;
+
+	*created = false;
+	for (ls = w->tab[h]; ls; ls = ls->next) {
+		if (strcmp(ls->name, name) == 0)
+			return ls;
+	}
+
+	ls = calloc(1, sizeof(*ls));
+	if (!ls)
+		return NULL;
+	strncpy(ls->name, name, sizeof(ls->name) - 1);
+	ls->next = w->tab[h];
+	w->tab[h] = ls;
+	*created = true;
+	return ls;
+}
+
+static void link_watch_free(struct link_watch *w)
+{
+	struct link_sample *ls;
+	int i;
+
+	for (i = 0; i < LINK_SAMPLE_BUCKETS; i++) {
+		while ((ls = w->tab[i])) {
+			w->tab[i] = ls->next;
+			free(ls);
+		}
+	}
+}
+
+static int link_watch_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct link_watch *w = data;
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *info[TIPC_NLA_MAX + 1] = {};
+	struct nlattr *attrs[TIPC_NLA_LINK_MAX + 1] = {};
+	struct nlattr *stats[TIPC_NLA_STATS_MAX + 1] = {};
+	uint32_t ctr[LINK_RATES];
+	struct link_sample *ls;
+	const char *name;
+	bool created;
+	unsigned int i;
+
+	mnl_attr_parse(nlh, sizeof(*genl), parse_attrs, info);
+	if (!info[TIPC_NLA_LINK])
+		return MNL_CB_ERROR;
+
+	mnl_attr_parse_nested(info[TIPC_NLA_LINK], parse_attrs, attrs);
+	if (!attrs[TIPC_NLA_LINK_NAME] || !attrs[TIPC_NLA_LINK_STATS])
+		return MNL_CB_ERROR;
+
+	mnl_attr_parse_nested(attrs[TIPC_NLA_LINK_STATS], parse_attrs, stats);
+
+	name = mnl_attr_get_str(attrs[TIPC_NLA_LINK_NAME]);
+	if (w->link && !strstr(name, w->link))
+		return MNL_CB_OK;
+
+	ls = link_sample_get(w, name, &created);
+	if (!ls)
+		return MNL_CB_ERROR;
+
+	for (i = 0; i < LINK_RATES; i++)
+		ctr[i] = stats[link_rates[i].attr] ?
+			 mnl_attr_get_u32(stats[link_rates[i].attr]) : 0;
+
+	/* only a link that was in the last dump too has rates */
+	if (!created && ls->tick + 1 == w->tick) {
+		open_json_object(NULL);
+		print_string(PRINT_ANY, "link", "%-44s", name);
+		for (i = 0; i < LINK_RATES; i++)
+			print_float(PRINT_ANY, link_rates[i].key, " %10.1f",
+				    (uint32_t)(ctr[i] - ls->ctr[i]) / w->secs);
+		print_string(PRINT_FP, NULL, "\n", "");
+		close_json_object();
+	}
+
+	memcpy(ls->ctr, ctr, sizeof(ctr));
+	ls->tick = w->tick;
+	return MNL_CB_OK;
+}
+
+static struct nlmsghdr *link_stat_req(bool bcast)
+{
+	struct nlmsghdr *nlh;
+	struct nlattr *attrs;
+
+	nlh = msg_init(TIPC_NL_LINK_GET);
+	if (!nlh) {
+		fprintf(stderr, "error, message initialisation failed\n");
+		return NULL;
+	}
+	if (bcast) {
+		/* Set the flag to dump all bc links */
+		attrs = mnl_attr_nest_start(nlh, TIPC_NLA_LINK);
+		mnl_attr_put(nlh, TIPC_NLA_LINK_BROADCAST, 0, NULL);
+		mnl_attr_nest_end(nlh, attrs);
+	}
+	return nlh;
+}
+
+/*
+ * The kernel resets the counters of one link per request, so "reset"
+ * resets every link of a first dump back to back, right before the
+ * dump the first rates are taken against.
+ */
+static int link_watch_reset(struct link_watch *w, bool bcast)
+{
+	struct nlmsghdr *nlh;
+	struct nlattr *nest;
+	struct link_sample *ls;
+	int i, err;
+
+	nlh = link_stat_req(bcast);
+	if (!nlh)
+		return -1;
+	err = msg_dumpit(nlh, link_watch_cb, w);
+	if (err)
+		return err;
+
+	for (i = 0; i < LINK_SAMPLE_BUCKETS; i++) {
+		for (ls = w->tab[i]; ls; ls = ls->next) {
+			nlh = msg_init(TIPC_NL_LINK_RESET_STATS);
+			if (!nlh)
+				return -1;
+			nest = mnl_attr_nest_start(nlh, TIPC_NLA_LINK);
+			mnl_attr_put_strz(nlh, TIPC_NLA_LINK_NAME, ls->name);
+			mnl_attr_nest_end(nlh, nest);
+			err = msg_doit(nlh, NULL, NULL);
+			if (err)
+				return err;
+		}
+	}
+	link_watch_free(w);
+	return 0;
+}
+
+static int link_stat_watch(const char *link, bool bcast, double interval,
+			   unsigned int count, bool reset)
+{
+	struct link_watch w = { .link = link };
+	struct nlmsghdr *nlh;
+	double last, next, t;
+	unsigned int i;
+	int err;
+
+	if (reset) {
+		err = link_watch_reset(&w, bcast);
+		if (err)
+			goto out;
+	}
+
+	new_json_obj(json);
+	last = next = monotonic_now();
+	for (;;) {
+		nlh = link_stat_req(bcast);
+		if (!nlh) {
+			err = -1;
+			break;
+		}
+		t = monotonic_now();
+		w.secs = t - last > 0 ? t - last : interval;
+		last = t;
+		if (w.tick && !is_json_context()) {
+			printf("%-44s", "Link");
+			for (i = 0; i < LINK_RATES; i++)
+				printf(" %10s", link_rates[i].title);
+			printf("\n");
+		}
+		err = msg_dumpit(nlh, link_watch_cb, &w);
+		if (err)
+			break;
+		if (w.tick) {
+			if (!is_json_context())
+				printf("\n");
+			fflush(stdout);
+			if (count && w.tick >= count)
+				break;
+		}
+		w.tick++;
+
+		next += interval;
+		monotonic_sleep_until(next);
+	}
+	delete_json_obj();
+out:
+	link_watch_free(&w);
+	return err;
+}
+
 static void cmd_link_stat_show_help(struct cmdl *cmdl)
 {
-	fprintf(stderr, "Usage: %s link stat show [ link { LINK | SUBSTRING | all } ]\n",
+	fprintf(stderr, "Usage: %s link stat show [ link { LINK | SUBSTRING | all } ]\n"
+		"       [ interval SECS [ count N ] [ reset ] ]\n",
 		cmdl->argv[0]);
 }
 
@@ -546,9 +784,15 @@ static int cmd_link_stat_show(struct nlmsghdr *nlh, const struct cmd *cmd,
 	struct opt *opt;
 	struct opt opts[] = {
 		{ "link",		OPT_KEYVAL,	NULL },
+		{ "interval",		OPT_KEYVAL,	NULL },
+		{ "count",		OPT_KEYVAL,	NULL },
+		{ "reset",		OPT_KEY,	NULL },
 		{ NULL }
 	};
 	struct nlattr *attrs;
+	unsigned int count = 0;
+	double interval = 0;
+	char *end;
 	int err = 0;
 
 	if (help_flag) {
@@ -565,14 +809,39 @@ static int cmd_link_stat_show(struct nlmsghdr *nlh, const struct cmd *cmd,
 	if (parse_opts(opts, cmdl) < 0)
 		return -EINVAL;
 
+	opt = get_opt(opts, "interval");
+	if (opt) {
+		interval = strtod(opt->val, &end);
+		if (*end || !(interval > 0)) {
+			fprintf(stderr, "error, invalid interval \"%s\"\n",
+				opt->val);
+			return -EINVAL;
+		}
+	}
+	opt = get_opt(opts, "count");
+	if (opt && (!interval || get_unsigned(&count, opt->val, 0))) {
+		fprintf(stderr, "error, count needs a number and an interval\n");
+		return -EINVAL;
+	}
+	if (has_opt(opts, "reset") && !interval) {
+		fprintf(stderr, "error, reset needs an interval\n");
+		return -EINVAL;
+	}
+
 	opt = get_opt(opts, "link");
 	if (opt) {
 		if (strcmp(opt->val, "all"))
 			link = opt->val;
+		if (interval)
+			return link_stat_watch(link, true, interval, count,
+					       has_opt(opts, "reset"));
 		/* Set the flag to dump all bc links */
 		attrs = mnl_attr_nest_start(nlh, TIPC_NLA_LINK);
 		mnl_attr_put(nlh, TIPC_NLA_LINK_BROADCAST, 0, NULL);
 		mnl_attr_nest_end(nlh, attrs);
+	} else if (interval) {
+		return link_stat_watch(NULL, false, interval, count,
+				       has_opt(opts, "reset"));
 	}
 
 	new_json_obj(json);
@@ -586,7 +855,7 @@ static void cmd_link_stat_help(struct cmdl *cmdl)
 	fprintf(stderr, "Usage: %s link stat COMMAND [ARGS]\n\n"
 		"COMMANDS:\n"
 		" reset                 - Reset link statistics for link\n"
-		" show                  - Get link priority\n",
+		" show                  - Show link statistics, or their rates\n",
 		cmdl->argv[0]);
 }
 
@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <linux/tipc.h>
 #include <string.h>
 #include <sys/ioctl.h>
@@ -150,18 +151,115 @@ void nodeid2str(uint8_t *id, char *str)
 		str[i] = 0;
 }
 
+/*
+ * Node identities are asked for with an ioctl on a TIPC socket. A dump
+ * names the same few nodes over and over, so the socket stays open and
+ * the answers are kept, by hash.
+ */
+#define NODESTR_CACHE	1024
+
+static struct {
+	uint32_t hash;
+	bool valid;
+	char str[33];
+} nodestr_cache[NODESTR_CACHE];
+
 void hash2nodestr(uint32_t hash, char *str)
 {
 	struct tipc_sioc_nodeid_req nr = {};
-	int sd;
+	static int sd = -1;
+	unsigned int i, n;
+
+	for (n = 0, i = (hash * 2654435761U) % NODESTR_CACHE;
+	     n < NODESTR_CACHE && nodestr_cache[i].valid;
+	     n++, i = (i + 1) % NODESTR_CACHE) {
+		if (nodestr_cache[i].hash == hash) {
+			strcpy(str, nodestr_cache[i].str);
+			return;
+		}
+	}
 
-	sd = socket(AF_TIPC, SOCK_RDM, 0);
 	if (sd < 0) {
-		fprintf(stderr, "opening TIPC socket: %s\n", strerror(errno));
-		return;
+		sd = socket(AF_TIPC, SOCK_RDM | SOCK_CLOEXEC, 0);
+		if (sd < 0) {
+			fprintf(stderr, "opening TIPC socket: %s\n",
+				strerror(errno));
+			return;
+		}
 	}
 	nr.peer = hash;
-	if (!ioctl(sd, SIOCGETNODEID, &nr))
-		nodeid2str((uint8_t *)nr.node_id, str);
-	close(sd);
+	if (ioctl(sd, SIOCGETNODEID, &nr))
+		return;
+	nodeid2str((uint8_t *)nr.node_id, str);
+
+	if (n < NODESTR_CACHE) {
+		nodestr_cache[i].hash = hash;
+		nodestr_cache[i].valid = true;
+		strncpy(nodestr_cache[i].str, str,
+			sizeof(nodestr_cache[i].str) - 1);
+	}
+}
+
+/* Open addressing, grown to stay at most half full */
+struct tally_entry *tally_get(struct tally *t, uint32_t key)
+{
+	struct tally_entry *e;
+	size_t i;
+
+	if (t->used * 2 >= t->size) {
+		struct tally old = *t;
+
+		t->size = old.size ? old.size * 2 : 256;
+		t->used = 0;
+		t->tab = calloc(t->size, sizeof(*t->tab));
+		if (!t->tab) {
+			*t = old;
+			return NULL;
+		}
+		for (i = 0; i < old.size; i++) {
+			if (!old.tab[i].used)
+				continue;
+			e = tally_get(t, old.tab[i].key);
+			*e = old.tab[i];
+		}
+		free(old.tab);
+	}
+
+	for (i = (key * 2654435761U) & (t->size - 1); t->tab[i].used;
+	     i = (i + 1) & (t->size - 1)) {
+		if (t->tab[i].key == key)
+			return &t->tab[i];
+	}
+
+	e = &t->tab[i];
+	e->used = true;
+	e->key = key;
+	t->used++;
+	return e;
+}
+
+static int tally_cmp(const void *a, const void *b)
+{
+	const struct tally_entry *x = a, *y = b;
+
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+size_t tally_sort(struct tally *t)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < t->size; i++) {
+		if (t->tab[i].used)
+			t->tab[n++] = t->tab[i];
+	}
+	if (n)
+		qsort(t->tab, n, sizeof(*t->tab), tally_cmp);
+	return n;
+}
+
+void tally_free(struct tally *t)
+{
+	free(t->tab);
+	memset(t, 0, sizeof(*t));
 }
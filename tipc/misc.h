@@ -8,6 +8,8 @@
 #ifndef _TIPC_MISC_H
 #define _TIPC_MISC_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 uint32_t str2addr(char *str);
@@ -16,4 +18,26 @@ void nodeid2str(uint8_t *id, char *str);
 void hash2nodestr(uint32_t hash, char *str);
 int str2key(char *str, struct tipc_aead_key *key);
 
+/*
+ * Counts keyed by a 32-bit value, for the summaries of large dumps.
+ * tally_sort() packs the entries to the front of the table, sorted by
+ * key, after which the table is only good for reading and freeing.
+ */
+struct tally_entry {
+	uint32_t key;
+	bool used;
+	uint64_t count;
+	uint64_t sum;
+};
+
+struct tally {
+	struct tally_entry *tab;
+	size_t size;
+	size_t used;
+};
+
+struct tally_entry *tally_get(struct tally *t, uint32_t key);
+size_t tally_sort(struct tally *t);
+void tally_free(struct tally *t);
+
 #endif
@@ -6,6 +6,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 
 #include <linux/tipc_netlink.h>
@@ -20,14 +21,35 @@
 
 #define PORTID_STR_LEN 45 /* Four u32 and five delimiter chars */
 
+static const char *scope_str(uint32_t scope)
+{
+	static const char * const scopes[] = { "", "zone", "cluster", "node" };
+
+	return scope < ARRAY_SIZE(scopes) ? scopes[scope] : "";
+}
+
+enum {
+	COUNT_NONE,
+	COUNT_TYPE,
+	COUNT_NODE,
+	COUNT_SCOPE,
+};
+
+struct nametable_show {
+	int iteration;
+	int count_by;
+	struct tally tally;
+};
+
 static int nametable_show_cb(const struct nlmsghdr *nlh, void *data)
 {
-	int *iteration = data;
+	struct nametable_show *show = data;
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
 	struct nlattr *info[TIPC_NLA_MAX + 1] = {};
 	struct nlattr *attrs[TIPC_NLA_NAME_TABLE_MAX + 1] = {};
 	struct nlattr *publ[TIPC_NLA_PUBL_MAX + 1] = {};
-	const char *scope[] = { "", "zone", "cluster", "node" };
+	uint32_t lower, upper, key;
+	struct tally_entry *e;
 	char str[33] = {0,};
 
 	mnl_attr_parse(nlh, sizeof(*genl), parse_attrs, info);
@@ -42,11 +64,29 @@ static int nametable_show_cb(const struct nlmsghdr *nlh, void *data)
 	if (!publ[TIPC_NLA_NAME_TABLE_PUBL])
 		return MNL_CB_ERROR;
 
-	if (!*iteration && !is_json_context())
+	lower = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_LOWER]);
+	upper = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_UPPER]);
+
+	if (show->count_by != COUNT_NONE) {
+		if (show->count_by == COUNT_TYPE)
+			key = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_TYPE]);
+		else if (show->count_by == COUNT_NODE)
+			key = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_NODE]);
+		else
+			key = mnl_attr_get_u32(publ[TIPC_NLA_PUBL_SCOPE]);
+		e = tally_get(&show->tally, key);
+		if (!e)
+			return MNL_CB_ERROR;
+		e->count++;
+		e->sum += (uint64_t)upper - lower + 1;
+		return MNL_CB_OK;
+	}
+
+	if (!show->iteration && !is_json_context())
 		printf("%-10s %-10s %-10s %-8s %-10s %-33s\n",
 		       "Type", "Lower", "Upper", "Scope", "Port",
 		       "Node");
-	(*iteration)++;
+	show->iteration++;
 
 	hash2nodestr(mnl_attr_get_u32(publ[TIPC_NLA_PUBL_NODE]), str);
 
@@ -54,14 +94,12 @@ static int nametable_show_cb(const struct nlmsghdr *nlh, void *data)
 	print_uint(PRINT_ANY, "type", "%-10u",
 			   mnl_attr_get_u32(publ[TIPC_NLA_PUBL_TYPE]));
 	print_string(PRINT_FP, NULL, " ", "");
-	print_uint(PRINT_ANY, "lower", "%-10u",
-			   mnl_attr_get_u32(publ[TIPC_NLA_PUBL_LOWER]));
+	print_uint(PRINT_ANY, "lower", "%-10u", lower);
 	print_string(PRINT_FP, NULL, " ", "");
-	print_uint(PRINT_ANY, "upper", "%-10u",
-			   mnl_attr_get_u32(publ[TIPC_NLA_PUBL_UPPER]));
+	print_uint(PRINT_ANY, "upper", "%-10u", upper);
 	print_string(PRINT_FP, NULL, " ", "");
 	print_string(PRINT_ANY, "scope", "%-8s",
-			     scope[mnl_attr_get_u32(publ[TIPC_NLA_PUBL_SCOPE])]);
+		     scope_str(mnl_attr_get_u32(publ[TIPC_NLA_PUBL_SCOPE])));
 	print_string(PRINT_FP, NULL, " ", "");
 	print_uint(PRINT_ANY, "port", "%-10u",
 			   mnl_attr_get_u32(publ[TIPC_NLA_PUBL_REF]));
@@ -73,15 +111,92 @@ static int nametable_show_cb(const struct nlmsghdr *nlh, void *data)
 	return MNL_CB_OK;
 }
 
+/*
+ * Publications and the instances they cover, per type, node or scope,
+ * in the order of the key.
+ */
+static void nametable_count_print(struct nametable_show *show)
+{
+	static const char * const keys[] = {
+		[COUNT_TYPE] = "type",
+		[COUNT_NODE] = "node",
+		[COUNT_SCOPE] = "scope",
+	};
+	const char *key = keys[show->count_by];
+	size_t i, n = tally_sort(&show->tally);
+	char str[33];
+
+	if (!is_json_context())
+		printf("%-33s %-12s %s\n",
+		       show->count_by == COUNT_TYPE ? "Type" :
+		       show->count_by == COUNT_NODE ? "Node" : "Scope",
+		       "Publications", "Instances");
+
+	for (i = 0; i < n; i++) {
+		const struct tally_entry *e = &show->tally.tab[i];
+
+		open_json_object(NULL);
+		switch (show->count_by) {
+		case COUNT_TYPE:
+			print_uint(PRINT_ANY, key, "%-33u", e->key);
+			break;
+		case COUNT_NODE:
+			memset(str, 0, sizeof(str));
+			hash2nodestr(e->key, str);
+			print_string(PRINT_ANY, key, "%-33s", str);
+			break;
+		default:
+			print_string(PRINT_ANY, key, "%-33s",
+				     scope_str(e->key));
+			break;
+		}
+		print_u64(PRINT_ANY, "publications", " %-12llu", e->count);
+		print_u64(PRINT_ANY, "instances", " %llu", e->sum);
+		print_string(PRINT_FP, NULL, "\n", "");
+		close_json_object();
+	}
+}
+
+static void cmd_nametable_show_help(struct cmdl *cmdl)
+{
+	fprintf(stderr,
+		"Usage: %s nametable show [ count { type | node | scope } ]\n",
+		cmdl->argv[0]);
+}
+
 static int cmd_nametable_show(struct nlmsghdr *nlh, const struct cmd *cmd,
 			      struct cmdl *cmdl, void *data)
 {
-	int iteration = 0;
+	struct nametable_show show = {};
+	struct opt *opt;
+	struct opt opts[] = {
+		{ "count",		OPT_KEYVAL,	NULL },
+		{ NULL }
+	};
 	int rc = 0;
 
 	if (help_flag) {
-		fprintf(stderr, "Usage: %s nametable show\n", cmdl->argv[0]);
+		cmd_nametable_show_help(cmdl);
+		return -EINVAL;
+	}
+
+	if (parse_opts(opts, cmdl) < 0)
 		return -EINVAL;
+
+	opt = get_opt(opts, "count");
+	if (opt) {
+		if (strcmp(opt->val, "type") == 0) {
+			show.count_by = COUNT_TYPE;
+		} else if (strcmp(opt->val, "node") == 0) {
+			show.count_by = COUNT_NODE;
+		} else if (strcmp(opt->val, "scope") == 0) {
+			show.count_by = COUNT_SCOPE;
+		} else {
+			fprintf(stderr, "error, invalid count \"%s\"\n",
+				opt->val);
+			cmd_nametable_show_help(cmdl);
+			return -EINVAL;
+		}
 	}
 
 	nlh = msg_init(TIPC_NL_NAME_TABLE_GET);
@@ -91,8 +206,11 @@ static int cmd_nametable_show(struct nlmsghdr *nlh, const struct cmd *cmd,
 	}
 
 	new_json_obj(json);
-	rc = msg_dumpit(nlh, nametable_show_cb, &iteration);
+	rc = msg_dumpit(nlh, nametable_show_cb, &show);
+	if (!rc && show.count_by != COUNT_NONE)
+		nametable_count_print(&show);
 	delete_json_obj();
+	tally_free(&show.tally);
 
 	return rc;
 }
@@ -102,7 +220,8 @@ void cmd_nametable_help(struct cmdl *cmdl)
 	fprintf(stderr,
 		"Usage: %s nametable COMMAND\n\n"
 		"COMMANDS\n"
-		" show                  - Show nametable\n",
+		" show                  - Show nametable\n"
+		" show count KEY        - Count publications per type, node or scope\n",
 		cmdl->argv[0]);
 }
 
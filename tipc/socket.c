@@ -6,6 +6,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 
 #include <linux/tipc.h>
@@ -17,6 +18,8 @@
 #include "cmdl.h"
 #include "msg.h"
 #include "socket.h"
+#include "misc.h"
+#include "utils.h"
 
 #define PORTID_STR_LEN 45 /* Four u32 and five delimiter chars */
 
@@ -32,31 +35,48 @@ static int publ_list_cb(const struct nlmsghdr *nlh, void *data)
 
 	mnl_attr_parse_nested(info[TIPC_NLA_PUBL], parse_attrs, attrs);
 
-	printf("  bound to {%u,%u,%u}\n",
-	       mnl_attr_get_u32(attrs[TIPC_NLA_PUBL_TYPE]),
-	       mnl_attr_get_u32(attrs[TIPC_NLA_PUBL_LOWER]),
-	       mnl_attr_get_u32(attrs[TIPC_NLA_PUBL_UPPER]));
+	open_json_object(NULL);
+	print_uint(PRINT_ANY, "type", "  bound to {%u,",
+		   mnl_attr_get_u32(attrs[TIPC_NLA_PUBL_TYPE]));
+	print_uint(PRINT_ANY, "lower", "%u,",
+		   mnl_attr_get_u32(attrs[TIPC_NLA_PUBL_LOWER]));
+	print_uint(PRINT_ANY, "upper", "%u}\n",
+		   mnl_attr_get_u32(attrs[TIPC_NLA_PUBL_UPPER]));
+	close_json_object();
 
 	return MNL_CB_OK;
 }
 
-static int publ_list(uint32_t sock)
+/*
+ * The publications of a socket are dumped while the socket dump is
+ * still running, so on a socket of their own. It is opened for the
+ * first socket that has any and kept until the listing is done.
+ */
+struct socket_list {
+	bool publ_open;
+	struct mnlu_gen_socket publ_nlg;
+	int count_by;
+	struct tally tally;
+};
+
+static int publ_list(struct socket_list *list, uint32_t sock)
 {
-	struct mnlu_gen_socket sock_nlg;
 	struct nlmsghdr *nlh;
 	struct nlattr *nest;
 	int err;
 
-	err = mnlu_gen_socket_open(&sock_nlg, TIPC_GENL_V2_NAME,
-				   TIPC_GENL_V2_VERSION);
-	if (err)
-		return -1;
+	if (!list->publ_open) {
+		err = mnlu_gen_socket_open(&list->publ_nlg, TIPC_GENL_V2_NAME,
+					   TIPC_GENL_V2_VERSION);
+		if (err)
+			return -1;
+		list->publ_open = true;
+	}
 
-	nlh = mnlu_gen_socket_cmd_prepare(&sock_nlg, TIPC_NL_PUBL_GET,
+	nlh = mnlu_gen_socket_cmd_prepare(&list->publ_nlg, TIPC_NL_PUBL_GET,
 					  NLM_F_REQUEST | NLM_F_DUMP);
 	if (!nlh) {
 		fprintf(stderr, "error, message initialisation failed\n");
-		mnlu_gen_socket_close(&sock_nlg);
 		return -1;
 	}
 
@@ -64,16 +84,33 @@ static int publ_list(uint32_t sock)
 	mnl_attr_put_u32(nlh, TIPC_NLA_SOCK_REF, sock);
 	mnl_attr_nest_end(nlh, nest);
 
-	err = mnlu_gen_socket_sndrcv(&sock_nlg, nlh, publ_list_cb, NULL);
-	mnlu_gen_socket_close(&sock_nlg);
+	open_json_array(PRINT_JSON, "publications");
+	err = mnlu_gen_socket_sndrcv(&list->publ_nlg, nlh, publ_list_cb, NULL);
+	close_json_array(PRINT_JSON, NULL);
 	return err;
 }
 
+enum {
+	COUNT_NONE,
+	COUNT_STATE,
+	COUNT_NODE,
+};
+
+enum {
+	SOCK_CONNECTED,
+	SOCK_BOUND,
+	SOCK_UNBOUND,
+};
+
 static int sock_list_cb(const struct nlmsghdr *nlh, void *data)
 {
+	struct socket_list *list = data;
 	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
 	struct nlattr *info[TIPC_NLA_MAX + 1] = {};
 	struct nlattr *attrs[TIPC_NLA_SOCK_MAX + 1] = {};
+	struct nlattr *con[TIPC_NLA_CON_MAX + 1] = {};
+	struct tally_entry *e;
+	uint32_t key;
 
 	mnl_attr_parse(nlh, sizeof(*genl), parse_attrs, info);
 	if (!info[TIPC_NLA_SOCK])
@@ -82,38 +119,127 @@ static int sock_list_cb(const struct nlmsghdr *nlh, void *data)
 	mnl_attr_parse_nested(info[TIPC_NLA_SOCK], parse_attrs, attrs);
 	if (!attrs[TIPC_NLA_SOCK_REF])
 		return MNL_CB_ERROR;
+	if (attrs[TIPC_NLA_SOCK_CON])
+		mnl_attr_parse_nested(attrs[TIPC_NLA_SOCK_CON], parse_attrs, con);
 
-	printf("socket %u\n", mnl_attr_get_u32(attrs[TIPC_NLA_SOCK_REF]));
-
-	if (attrs[TIPC_NLA_SOCK_CON]) {
-		uint32_t node;
-		struct nlattr *con[TIPC_NLA_CON_MAX + 1] = {};
+	if (list->count_by != COUNT_NONE) {
+		if (list->count_by == COUNT_NODE) {
+			if (!con[TIPC_NLA_CON_NODE])
+				return MNL_CB_OK;
+			key = mnl_attr_get_u32(con[TIPC_NLA_CON_NODE]);
+		} else if (attrs[TIPC_NLA_SOCK_CON]) {
+			key = SOCK_CONNECTED;
+		} else if (attrs[TIPC_NLA_SOCK_HAS_PUBL]) {
+			key = SOCK_BOUND;
+		} else {
+			key = SOCK_UNBOUND;
+		}
+		e = tally_get(&list->tally, key);
+		if (!e)
+			return MNL_CB_ERROR;
+		e->count++;
+		return MNL_CB_OK;
+	}
 
-		mnl_attr_parse_nested(attrs[TIPC_NLA_SOCK_CON], parse_attrs, con);
-		node = mnl_attr_get_u32(con[TIPC_NLA_CON_NODE]);
+	open_json_object(NULL);
+	print_uint(PRINT_ANY, "socket", "socket %u\n",
+		   mnl_attr_get_u32(attrs[TIPC_NLA_SOCK_REF]));
 
-		printf("  connected to %x:%u", node,
-			mnl_attr_get_u32(con[TIPC_NLA_CON_SOCK]));
+	if (attrs[TIPC_NLA_SOCK_CON]) {
+		open_json_object("connected");
+		print_hex(PRINT_ANY, "node", "  connected to %x",
+			  mnl_attr_get_u32(con[TIPC_NLA_CON_NODE]));
+		print_uint(PRINT_ANY, "port", ":%u",
+			   mnl_attr_get_u32(con[TIPC_NLA_CON_SOCK]));
 
-		if (con[TIPC_NLA_CON_FLAG])
-			printf(" via {%u,%u}\n",
-				mnl_attr_get_u32(con[TIPC_NLA_CON_TYPE]),
-				mnl_attr_get_u32(con[TIPC_NLA_CON_INST]));
-		else
-			printf("\n");
+		if (con[TIPC_NLA_CON_FLAG]) {
+			print_uint(PRINT_ANY, "type", " via {%u,",
+				   mnl_attr_get_u32(con[TIPC_NLA_CON_TYPE]));
+			print_uint(PRINT_ANY, "instance", "%u}",
+				   mnl_attr_get_u32(con[TIPC_NLA_CON_INST]));
+		}
+		print_string(PRINT_FP, NULL, "\n", "");
+		close_json_object();
 	} else if (attrs[TIPC_NLA_SOCK_HAS_PUBL]) {
-		publ_list(mnl_attr_get_u32(attrs[TIPC_NLA_SOCK_REF]));
+		publ_list(list, mnl_attr_get_u32(attrs[TIPC_NLA_SOCK_REF]));
 	}
+	close_json_object();
 
 	return MNL_CB_OK;
 }
 
+/* Sockets per state, or connections per peer node, in key order */
+static void sock_count_print(struct socket_list *list)
+{
+	static const char * const states[] = {
+		[SOCK_CONNECTED] = "connected",
+		[SOCK_BOUND] = "bound",
+		[SOCK_UNBOUND] = "unbound",
+	};
+	size_t i, n = tally_sort(&list->tally);
+	char str[33];
+
+	if (!is_json_context())
+		printf("%-33s %s\n",
+		       list->count_by == COUNT_STATE ? "State" : "Node",
+		       list->count_by == COUNT_STATE ? "Sockets" : "Connections");
+
+	for (i = 0; i < n; i++) {
+		const struct tally_entry *e = &list->tally.tab[i];
+
+		open_json_object(NULL);
+		if (list->count_by == COUNT_STATE) {
+			print_string(PRINT_ANY, "state", "%-33s",
+				     states[e->key]);
+			print_u64(PRINT_ANY, "sockets", " %llu\n", e->count);
+		} else {
+			memset(str, 0, sizeof(str));
+			hash2nodestr(e->key, str);
+			print_string(PRINT_ANY, "node", "%-33s", str);
+			print_u64(PRINT_ANY, "connections", " %llu\n",
+				  e->count);
+		}
+		close_json_object();
+	}
+}
+
+static void cmd_socket_list_help(struct cmdl *cmdl)
+{
+	fprintf(stderr, "Usage: %s socket list [ count { state | node } ]\n",
+		cmdl->argv[0]);
+}
+
 static int cmd_socket_list(struct nlmsghdr *nlh, const struct cmd *cmd,
 			   struct cmdl *cmdl, void *data)
 {
+	struct socket_list list = {};
+	struct opt *opt;
+	struct opt opts[] = {
+		{ "count",		OPT_KEYVAL,	NULL },
+		{ NULL }
+	};
+	int rc;
+
 	if (help_flag) {
-		fprintf(stderr, "Usage: %s socket list\n", cmdl->argv[0]);
+		cmd_socket_list_help(cmdl);
+		return -EINVAL;
+	}
+
+	if (parse_opts(opts, cmdl) < 0)
 		return -EINVAL;
+
+	opt = get_opt(opts, "count");
+	if (opt) {
+		if (strcmp(opt->val, "state") == 0) {
+			list.count_by = COUNT_STATE;
+		} else if (strcmp(opt->val, "node") == 0) {
+			list.count_by = COUNT_NODE;
+		} else {
+			fprintf(stderr, "error, invalid count \"%s\"\n",
+				opt->val);
+			cmd_socket_list_help(cmdl);
+			return -EINVAL;
+		}
 	}
 
 	nlh = msg_init(TIPC_NL_SOCK_GET);
@@ -122,7 +248,16 @@ static int cmd_socket_list(struct nlmsghdr *nlh, const struct cmd *cmd,
 		return -1;
 	}
 
-	return msg_dumpit(nlh, sock_list_cb, NULL);
+	new_json_obj(json);
+	rc = msg_dumpit(nlh, sock_list_cb, &list);
+	if (!rc && list.count_by != COUNT_NONE)
+		sock_count_print(&list);
+	delete_json_obj();
+
+	if (list.publ_open)
+		mnlu_gen_socket_close(&list.publ_nlg);
+	tally_free(&list.tally);
+	return rc;
 }
 
 void cmd_socket_help(struct cmdl *cmdl)
@@ -130,7 +265,8 @@ void cmd_socket_help(struct cmdl *cmdl)
 	fprintf(stderr,
 		"Usage: %s socket COMMAND\n\n"
 		"Commands:\n"
-		" list                  - List sockets (ports)\n",
+		" list                  - List sockets (ports)\n"
+		" list count KEY        - Count sockets per state or peer node\n",
 		cmdl->argv[0]);
 }
 
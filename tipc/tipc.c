@@ -37,6 +37,7 @@ static void about(struct cmdl *cmdl)
 		"Options:\n"
 		" -h, --help \t\tPrint help for last given command\n"
 		" -j, --json \t\tJson format printouts\n"
+		"     --jsonl \t\tJson lines, one object per line as it is read\n"
 		" -p, --pretty \t\tpretty print\n"
 		"\n"
 		"Commands:\n"
@@ -59,6 +60,7 @@ int main(int argc, char *argv[])
 	struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
 		{"json", no_argument, 0, 'j'},
+		{"jsonl", no_argument, 0, 'l'},
 		{"pretty", no_argument, 0, 'p'},
 		{0, 0, 0, 0}
 	};
@@ -92,6 +94,13 @@ int main(int argc, char *argv[])
 			 */
 			json = 1;
 			break;
+		case 'l':
+			/*
+			 * Json lines, for dumps too large to hold in an array
+			 */
+			json = 1;
+			json_lines = 1;
+			break;
 		case 'p':
 			/*
 			 * Enable json pretty output
@@ -3,7 +3,10 @@
 #include <stdio.h>
 #include <getopt.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
 #include <sys/time.h>
+#include <net/if.h>
 #include <linux/genetlink.h>
 #include <linux/if_ether.h>
 #include <linux/vdpa.h>
@@ -29,6 +32,7 @@
 #define VDPA_OPT_MAX_VQP		BIT(6)
 #define VDPA_OPT_QUEUE_INDEX		BIT(7)
 #define VDPA_OPT_VDEV_FEATURES		BIT(8)
+#define VDPA_OPT_COUNT			BIT(9)
 
 struct vdpa_opts {
 	uint64_t present; /* flags of present items */
@@ -41,6 +45,7 @@ struct vdpa_opts {
 	uint16_t max_vqp;
 	uint32_t queue_idx;
 	uint64_t device_features;
+	uint32_t count;
 };
 
 struct vdpa {
@@ -357,6 +362,19 @@ static int vdpa_argv_parse(struct vdpa *vdpa, int argc, char **argv,
 
 			NEXT_ARG_FWD();
 			o_found |= VDPA_OPT_VDEV_FEATURES;
+		} else if (!strcmp(*argv, "count") &&
+			   (o_optional & VDPA_OPT_COUNT)) {
+			NEXT_ARG_FWD();
+			err = vdpa_argv_u32(vdpa, argc, argv, &opts->count);
+			if (err)
+				return err;
+			if (!opts->count) {
+				fprintf(stderr, "count must be at least 1\n");
+				return -EINVAL;
+			}
+
+			NEXT_ARG_FWD();
+			o_found |= VDPA_OPT_COUNT;
 		} else {
 			fprintf(stderr, "Unknown option \"%s\"\n", *argv);
 			return -EINVAL;
@@ -646,7 +664,8 @@ static void cmd_dev_help(void)
 	fprintf(stderr, "       vdpa dev add name NAME mgmtdev MANAGEMENTDEV [ device_features DEVICE_FEATURES]\n");
 	fprintf(stderr, "                                                    [ mac MACADDR ] [ mtu MTU ]\n");
 	fprintf(stderr, "                                                    [ max_vqp MAX_VQ_PAIRS ]\n");
-	fprintf(stderr, "       vdpa dev del DEV\n");
+	fprintf(stderr, "                                                    [ count COUNT ]\n");
+	fprintf(stderr, "       vdpa dev del DEV [ count COUNT ]\n");
 	fprintf(stderr, "Usage: vdpa dev config COMMAND [ OPTIONS ]\n");
 	fprintf(stderr, "Usage: vdpa dev vstats COMMAND\n");
 }
@@ -727,6 +746,119 @@ static int cmd_dev_show(struct vdpa *vdpa, int argc, char **argv)
 	return err;
 }
 
+/* Requests kept in flight by vdpa_pipeline() */
+#define VDPA_PIPELINE_WINDOW	64
+
+/*
+ * Send @n requests of @cmd without waiting for each answer, at most
+ * VDPA_PIPELINE_WINDOW at a time, all with NLM_F_ACK. @put fills in
+ * request @i and @cb, if any, gets the replies to it. Requests are told
+ * apart by sequence number; the error of each, 0 or a negative errno,
+ * goes to @errs[i].
+ */
+static int vdpa_pipeline(struct vdpa *vdpa, uint8_t cmd, unsigned int n,
+			 void (*put)(struct vdpa *vdpa, struct nlmsghdr *nlh,
+				     unsigned int i, void *data),
+			 int (*cb)(const struct nlmsghdr *nlh, unsigned int i,
+				   void *data),
+			 void *data, int *errs)
+{
+	struct mnlu_gen_socket *nlg = &vdpa->nlg;
+	unsigned int base, sent = 0, done = 0;
+	struct nlmsghdr *nlh;
+	int len;
+
+	base = time(NULL);
+	while (done < n) {
+		while (sent < n && sent - done < VDPA_PIPELINE_WINDOW) {
+			nlh = mnlu_gen_socket_cmd_prepare(nlg, cmd,
+							  NLM_F_REQUEST | NLM_F_ACK);
+			nlh->nlmsg_seq = base + sent;
+			put(vdpa, nlh, sent, data);
+			if (mnl_socket_sendto(nlg->nl, nlh, nlh->nlmsg_len) < 0) {
+				perror("Failed to send data");
+				return -errno;
+			}
+			sent++;
+		}
+
+		len = mnl_socket_recvfrom(nlg->nl, nlg->buf,
+					  MNL_SOCKET_BUFFER_SIZE);
+		if (len < 0) {
+			perror("Failed to receive data");
+			return -errno;
+		}
+
+		for (nlh = (struct nlmsghdr *)nlg->buf; mnl_nlmsg_ok(nlh, len);
+		     nlh = mnl_nlmsg_next(nlh, &len)) {
+			unsigned int i = nlh->nlmsg_seq - base;
+
+			if (i >= sent)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				const struct nlmsgerr *e = mnl_nlmsg_get_payload(nlh);
+
+				errs[i] = e->error;
+				done++;
+			} else if (cb && cb(nlh, i, data) != MNL_CB_OK) {
+				errs[i] = -EINVAL;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Device @i of a "count" template: NAME followed by @i, MAC plus @i */
+static void vdpa_dev_bulk_put(struct vdpa *vdpa, struct nlmsghdr *nlh,
+			      unsigned int i, void *data)
+{
+	struct vdpa_opts *opts = &vdpa->opts;
+	const struct vdpa_opts *tmpl = data;
+	char name[IFNAMSIZ * 4];
+	uint64_t mac = 0;
+	int j;
+
+	snprintf(name, sizeof(name), "%s%u", tmpl->vdev_name, i);
+	opts->vdev_name = name;
+
+	if (tmpl->present & VDPA_OPT_VDEV_MAC) {
+		for (j = 0; j < ETH_ALEN; j++)
+			mac = mac << 8 | (unsigned char)tmpl->mac[j];
+		mac += i;
+		for (j = ETH_ALEN - 1; j >= 0; j--, mac >>= 8)
+			opts->mac[j] = mac & 0xff;
+	}
+
+	vdpa_opts_put(nlh, vdpa);
+	opts->vdev_name = tmpl->vdev_name;
+}
+
+static int vdpa_dev_bulk(struct vdpa *vdpa, uint8_t cmd, const char *what)
+{
+	struct vdpa_opts tmpl = vdpa->opts;
+	unsigned int i, failed = 0;
+	int *errs, err;
+
+	errs = calloc(tmpl.count, sizeof(*errs));
+	if (!errs)
+		return -ENOMEM;
+
+	err = vdpa_pipeline(vdpa, cmd, tmpl.count, vdpa_dev_bulk_put, NULL,
+			    &tmpl, errs);
+	for (i = 0; !err && i < tmpl.count; i++) {
+		if (!errs[i])
+			continue;
+		fprintf(stderr, "Failed to %s %s%u: %s\n", what,
+			tmpl.vdev_name, i, strerror(-errs[i]));
+		failed++;
+	}
+	free(errs);
+	vdpa->opts = tmpl;
+	if (err)
+		return err;
+	return failed ? -EIO : 0;
+}
+
 static int cmd_dev_add(struct vdpa *vdpa, int argc, char **argv)
 {
 	struct nlmsghdr *nlh;
@@ -737,10 +869,14 @@ static int cmd_dev_add(struct vdpa *vdpa, int argc, char **argv)
 	err = vdpa_argv_parse_put(nlh, vdpa, argc, argv,
 				  VDPA_OPT_VDEV_MGMTDEV_HANDLE | VDPA_OPT_VDEV_NAME,
 				  VDPA_OPT_VDEV_MAC | VDPA_OPT_VDEV_MTU |
-				  VDPA_OPT_MAX_VQP | VDPA_OPT_VDEV_FEATURES);
+				  VDPA_OPT_MAX_VQP | VDPA_OPT_VDEV_FEATURES |
+				  VDPA_OPT_COUNT);
 	if (err)
 		return err;
 
+	if (vdpa->opts.present & VDPA_OPT_COUNT)
+		return vdpa_dev_bulk(vdpa, VDPA_CMD_DEV_NEW, "add");
+
 	return mnlu_gen_socket_sndrcv(&vdpa->nlg, nlh, NULL, NULL);
 }
 
@@ -752,10 +888,13 @@ static int cmd_dev_del(struct vdpa *vdpa,  int argc, char **argv)
 	nlh = mnlu_gen_socket_cmd_prepare(&vdpa->nlg, VDPA_CMD_DEV_DEL,
 					  NLM_F_REQUEST | NLM_F_ACK);
 	err = vdpa_argv_parse_put(nlh, vdpa, argc, argv, VDPA_OPT_VDEV_HANDLE,
-				  0);
+				  VDPA_OPT_COUNT);
 	if (err)
 		return err;
 
+	if (vdpa->opts.present & VDPA_OPT_COUNT)
+		return vdpa_dev_bulk(vdpa, VDPA_CMD_DEV_DEL, "delete");
+
 	return mnlu_gen_socket_sndrcv(&vdpa->nlg, nlh, NULL, NULL);
 }
 
@@ -894,24 +1033,18 @@ static int cmd_dev_config(struct vdpa *vdpa, int argc, char **argv)
 /* 5 bytes for format */
 #define MAX_FMT_LEN (MAX_KEY_LEN + 5 + 1)
 
-static void print_queue_type(struct nlattr *attr, uint16_t max_vqp, uint64_t features)
+static const char *queue_type_name(uint32_t qidx, uint16_t max_vqp,
+				   uint64_t features)
 {
-	bool is_ctrl = false;
-	uint16_t qidx = 0;
+	if (features & BIT(VIRTIO_NET_F_CTRL_VQ) && qidx == 2 * max_vqp)
+		return "control_vq";
+	return qidx & 1 ? "tx" : "rx";
+}
 
-	qidx = mnl_attr_get_u16(attr);
-	is_ctrl = features & BIT(VIRTIO_NET_F_CTRL_VQ) && qidx == 2 * max_vqp;
-	if (!is_ctrl) {
-		if (qidx & 1)
-			print_string(PRINT_ANY, "queue_type", "queue_type %s ",
-				     "tx");
-		else
-			print_string(PRINT_ANY, "queue_type", "queue_type %s ",
-				     "rx");
-	} else {
-		print_string(PRINT_ANY, "queue_type", "queue_type %s ",
-			     "control_vq");
-	}
+static void print_queue_type(struct nlattr *attr, uint16_t max_vqp, uint64_t features)
+{
+	print_string(PRINT_ANY, "queue_type", "queue_type %s ",
+		     queue_type_name(mnl_attr_get_u16(attr), max_vqp, features));
 }
 
 static void pr_out_dev_net_vstats(const struct nlmsghdr *nlh)
@@ -981,6 +1114,7 @@ static int cmd_dev_vstats_show_cb(const struct nlmsghdr *nlh, void *data)
 static void cmd_dev_vstats_help(void)
 {
 	fprintf(stderr, "Usage: vdpa dev vstats show DEV [qidx QUEUE_INDEX]\n");
+	fprintf(stderr, "       vdpa dev vstats watch [ DEV ... ] [ interval SECONDS ] [ count COUNT ]\n");
 }
 
 static int cmd_dev_vstats_show(struct vdpa *vdpa, int argc, char **argv)
@@ -1008,6 +1142,303 @@ static int cmd_dev_vstats_show(struct vdpa *vdpa, int argc, char **argv)
 	return err;
 }
 
+#define VDPA_VQ_STATS	16
+
+/* One queue sampled by "vstats watch" and its last vendor counters */
+struct vdpa_vq {
+	const char *dev;
+	uint32_t qidx;
+	const char *type;
+	bool gone;
+	unsigned int n;
+	struct {
+		char name[64];
+		uint64_t value;
+		uint64_t prev;
+	} stats[VDPA_VQ_STATS];
+};
+
+struct vdpa_watch {
+	char **devs;
+	unsigned int n_devs;
+	uint16_t *max_vqp;
+	uint64_t *features;
+	struct vdpa_vq *vqs;
+	unsigned int n_vqs;
+};
+
+static int vdpa_watch_dev_cb(const struct nlmsghdr *nlh, void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct nlattr *tb[VDPA_ATTR_MAX + 1] = {};
+	struct vdpa_watch *w = data;
+	char **devs, *name;
+
+	mnl_attr_parse(nlh, sizeof(*genl), attr_cb, tb);
+	if (!tb[VDPA_ATTR_DEV_NAME])
+		return MNL_CB_ERROR;
+
+	name = strdup(mnl_attr_get_str(tb[VDPA_ATTR_DEV_NAME]));
+	devs = realloc(w->devs, (w->n_devs + 1) * sizeof(*devs));
+	if (!name || !devs) {
+		free(name);
+		if (devs)
+			w->devs = devs;
+		return MNL_CB_ERROR;
+	}
+	w->devs = devs;
+	w->devs[w->n_devs++] = name;
+	return MNL_CB_OK;
+}
+
+static void vdpa_watch_dev_put(struct vdpa *vdpa, struct nlmsghdr *nlh,
+			       unsigned int i, void *data)
+{
+	struct vdpa_watch *w = data;
+
+	mnl_attr_put_strz(nlh, VDPA_ATTR_DEV_NAME, w->devs[i]);
+}
+
+static int vdpa_watch_config_cb(const struct nlmsghdr *nlh, unsigned int i,
+				void *data)
+{
+	struct genlmsghdr *genl = mnl_nlmsg_get_payload(nlh);
+	struct vdpa_watch *w = data;
+	struct nlattr *attr;
+
+	mnl_attr_for_each(attr, nlh, sizeof(*genl)) {
+		switch (mnl_attr_get_type(attr)) {
+		case VDPA_ATTR_DEV_NET_CFG_MAX_VQP:
+			w->max_vqp[i] = mnl_attr_get_u16(attr);
+			break;
+		case VDPA_ATTR_DEV_NEGOTIATED_FEATURES:
+			w->features[i] = mnl_attr_get_u64(attr);
+			break;
+		}
+	}
+	return MNL_CB_OK;
+}
+
+static void vdpa_watch_vq_put(struct vdpa *vdpa, struct nlmsghdr *nlh,
+			      unsigned int i, void *data)
+{
+	struct vdpa_watch *w = data;
+
+	mnl_attr_put_strz(nlh, VDPA_ATTR_DEV_NAME, w->vqs[i].dev);
+	mnl_attr_put_u32(nlh, VDPA_ATTR_DEV_QUEUE_INDEX, w->vqs[i].qidx);
+}
+
+static int vdpa_watch_vq_cb(const struct nlmsghdr *nlh, unsigned int i,
+			    void *data)
+{
+	struct vdpa_watch *w = data;
+	struct vdpa_vq *vq = &w->vqs[i];
+	const char *name = NULL;
+	struct nlattr *attr;
+	unsigned int j;
+
+	mnl_attr_for_each(attr, nlh, sizeof(struct genlmsghdr)) {
+		switch (mnl_attr_get_type(attr)) {
+		case VDPA_ATTR_DEV_VENDOR_ATTR_NAME:
+			name = mnl_attr_get_str(attr);
+			break;
+		case VDPA_ATTR_DEV_VENDOR_ATTR_VALUE:
+			if (!name)
+				break;
+			for (j = 0; j < vq->n; j++) {
+				if (!strcmp(vq->stats[j].name, name))
+					break;
+			}
+			if (j == vq->n) {
+				if (vq->n == VDPA_VQ_STATS)
+					break;
+				strlcpy(vq->stats[j].name, name,
+					sizeof(vq->stats[j].name));
+				vq->stats[j].value = mnl_attr_get_u64(attr);
+				vq->n++;
+			}
+			vq->stats[j].prev = vq->stats[j].value;
+			vq->stats[j].value = mnl_attr_get_u64(attr);
+			name = NULL;
+			break;
+		}
+	}
+	return MNL_CB_OK;
+}
+
+static void vdpa_watch_print(struct vdpa_vq *vq, double secs)
+{
+	unsigned int j;
+
+	open_json_object(NULL);
+	print_string(PRINT_ANY, "dev", "%s: ", vq->dev);
+	print_uint(PRINT_ANY, "qidx", "qidx %u ", vq->qidx);
+	print_string(PRINT_ANY, "queue_type", "queue_type %s", vq->type);
+	open_json_object("rates");
+	for (j = 0; j < vq->n; j++) {
+		uint64_t cur = vq->stats[j].value, prev = vq->stats[j].prev;
+		uint64_t rate = (cur >= prev ? cur - prev : cur) / secs + .5;
+
+		print_string(PRINT_FP, NULL, " %s", vq->stats[j].name);
+		print_u64(PRINT_ANY, vq->stats[j].name, " %" PRIu64 "/s", rate);
+	}
+	close_json_object();
+	close_json_object();
+	print_nl();
+}
+
+/*
+ * Sample the vendor counters of every queue of every device. Each tick
+ * asks for all queues at once with vdpa_pipeline(), so a tick costs a
+ * round trip per window rather than one per queue. A queue the kernel
+ * refuses, e.g. one the driver has not enabled, is left out from then on.
+ */
+static int cmd_dev_vstats_watch(struct vdpa *vdpa, int argc, char **argv)
+{
+	struct vdpa_watch w = {};
+	unsigned int count = 0, sample, i, q, n_q;
+	double interval = 1, deadline, last, now;
+	int *errs = NULL, err;
+	char *end;
+
+	while (argc > 0) {
+		if (!strcmp(*argv, "interval")) {
+			NEXT_ARG();
+			interval = strtod(*argv, &end);
+			if (*end || !(interval > 0)) {
+				fprintf(stderr, "Invalid interval \"%s\"\n", *argv);
+				err = -EINVAL;
+				goto out;
+			}
+		} else if (!strcmp(*argv, "count")) {
+			NEXT_ARG();
+			if (get_unsigned(&count, *argv, 0) || !count) {
+				fprintf(stderr, "Invalid count \"%s\"\n", *argv);
+				err = -EINVAL;
+				goto out;
+			}
+		} else {
+			char **devs = realloc(w.devs, (w.n_devs + 1) * sizeof(*devs));
+
+			if (!devs) {
+				err = -ENOMEM;
+				goto out;
+			}
+			w.devs = devs;
+			w.devs[w.n_devs] = strdup(*argv);
+			if (!w.devs[w.n_devs]) {
+				err = -ENOMEM;
+				goto out;
+			}
+			w.n_devs++;
+		}
+		NEXT_ARG_FWD();
+	}
+
+	if (!w.n_devs) {
+		struct nlmsghdr *nlh;
+
+		nlh = mnlu_gen_socket_cmd_prepare(&vdpa->nlg, VDPA_CMD_DEV_GET,
+						  NLM_F_REQUEST | NLM_F_ACK |
+						  NLM_F_DUMP);
+		err = mnlu_gen_socket_sndrcv(&vdpa->nlg, nlh,
+					     vdpa_watch_dev_cb, &w);
+		if (err)
+			goto out;
+		if (!w.n_devs) {
+			fprintf(stderr, "No vdpa devices\n");
+			err = -ENOENT;
+			goto out;
+		}
+	}
+
+	w.max_vqp = calloc(w.n_devs, sizeof(*w.max_vqp));
+	w.features = calloc(w.n_devs, sizeof(*w.features));
+	errs = calloc(w.n_devs, sizeof(*errs));
+	if (!w.max_vqp || !w.features || !errs) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	/* the queues of a device follow from its negotiated config */
+	err = vdpa_pipeline(vdpa, VDPA_CMD_DEV_CONFIG_GET, w.n_devs,
+			    vdpa_watch_dev_put, vdpa_watch_config_cb, &w, errs);
+	if (err)
+		goto out;
+
+	for (i = 0; i < w.n_devs; i++) {
+		if (errs[i]) {
+			fprintf(stderr, "Failed to read config of %s: %s\n",
+				w.devs[i], strerror(-errs[i]));
+			err = errs[i];
+			goto out;
+		}
+		if (!w.max_vqp[i])
+			w.max_vqp[i] = 1;
+		w.n_vqs += 2 * w.max_vqp[i] +
+			   !!(w.features[i] & BIT(VIRTIO_NET_F_CTRL_VQ));
+	}
+
+	w.vqs = calloc(w.n_vqs, sizeof(*w.vqs));
+	free(errs);
+	errs = calloc(w.n_vqs, sizeof(*errs));
+	if (!w.vqs || !errs) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (i = 0, n_q = 0; i < w.n_devs; i++) {
+		unsigned int n = 2 * w.max_vqp[i] +
+				 !!(w.features[i] & BIT(VIRTIO_NET_F_CTRL_VQ));
+
+		for (q = 0; q < n; q++, n_q++) {
+			w.vqs[n_q].dev = w.devs[i];
+			w.vqs[n_q].qidx = q;
+			w.vqs[n_q].type = queue_type_name(q, w.max_vqp[i],
+							  w.features[i]);
+		}
+	}
+
+	deadline = monotonic_now();
+	last = deadline;
+	for (sample = 0; ; sample++) {
+		err = vdpa_pipeline(vdpa, VDPA_CMD_DEV_VSTATS_GET, w.n_vqs,
+				    vdpa_watch_vq_put, vdpa_watch_vq_cb, &w, errs);
+		if (err)
+			goto out;
+		now = monotonic_now();
+
+		for (i = 0; i < w.n_vqs; i++) {
+			if (errs[i] && !w.vqs[i].gone) {
+				fprintf(stderr, "%s qidx %u: %s, left out\n",
+					w.vqs[i].dev, w.vqs[i].qidx,
+					strerror(-errs[i]));
+				w.vqs[i].gone = true;
+			}
+			if (sample && !w.vqs[i].gone)
+				vdpa_watch_print(&w.vqs[i], now - last);
+			errs[i] = 0;
+		}
+		fflush(stdout);
+		last = now;
+
+		if (count && sample == count)
+			break;
+		deadline += interval;
+		monotonic_sleep_until(deadline);
+	}
+	err = 0;
+
+out:
+	for (i = 0; i < w.n_devs; i++)
+		free(w.devs[i]);
+	free(w.devs);
+	free(w.max_vqp);
+	free(w.features);
+	free(w.vqs);
+	free(errs);
+	return err;
+}
+
 static int cmd_dev_vstats(struct vdpa *vdpa, int argc, char **argv)
 {
 	if (argc < 1) {
@@ -1020,6 +1451,8 @@ static int cmd_dev_vstats(struct vdpa *vdpa, int argc, char **argv)
 		return 0;
 	} else if (!strcmp(*argv, "show")) {
 		return cmd_dev_vstats_show(vdpa, argc - 1, argv + 1);
+	} else if (!strcmp(*argv, "watch")) {
+		return cmd_dev_vstats_watch(vdpa, argc - 1, argv + 1);
 	}
 	fprintf(stderr, "Command \"%s\" not found\n", *argv);
 	return -ENOENT;
@@ -1056,7 +1489,7 @@ static void help(void)
 	fprintf(stderr,
 		"Usage: vdpa [ OPTIONS ] OBJECT { COMMAND | help }\n"
 		"where  OBJECT := { mgmtdev | dev }\n"
-		"       OPTIONS := { -V[ersion] | -n[o-nice-names] | -j[son] | -p[retty] }\n");
+		"       OPTIONS := { -V[ersion] | -n[o-nice-names] | -j[son] | --jsonl | -p[retty] }\n");
 }
 
 static int vdpa_cmd(struct vdpa *vdpa, int argc, char **argv)
@@ -1122,6 +1555,7 @@ int main(int argc, char **argv)
 	static const struct option long_options[] = {
 		{ "Version",		no_argument,	NULL, 'V' },
 		{ "json",		no_argument,	NULL, 'j' },
+		{ "jsonl",		no_argument,	NULL, 'l' },
 		{ "pretty",		no_argument,	NULL, 'p' },
 		{ "help",		no_argument,	NULL, 'h' },
 		{ NULL, 0, NULL, 0 }
@@ -1146,6 +1580,11 @@ int main(int argc, char **argv)
 		case 'j':
 			vdpa->json_output = true;
 			break;
+		case 'l':
+			/* one object per line, for "dev vstats watch" */
+			vdpa->json_output = true;
+			json_lines = 1;
+			break;
 		case 'p':
 			pretty = true;
 			break;